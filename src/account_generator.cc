@@ -0,0 +1,488 @@
+// Copyright 2014 Toggl Desktop developers.
+
+// Generates a large made-up account for load testing: a /me payload
+// in the format of testdata/me.json, a database populated the way a
+// login with that payload would leave it, or both. Everything follows
+// from the seed, so the same options always give the same account.
+//
+//   make generator
+//   ./toggl_generator --time_entries=100000 --json=large.json
+//   ./toggl_generator --projects=50 --db=small.db
+//   make -s bench bench_data=large.json
+//
+// Project and description popularity follow a Zipf distribution with
+// the --skew exponent, as in real accounts where a handful of
+// projects get most of the time. --skew=0 spreads them evenly.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iostream>  // NOLINT
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./database.h"
+#include "./formatter.h"
+#include "./json.h"
+#include "./json_writer.h"
+#include "./user.h"
+
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "Poco/Logger.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Random.h"
+#include "Poco/Util/Application.h"
+#include "Poco/Util/HelpFormatter.h"
+#include "Poco/Util/Option.h"
+#include "Poco/Util/OptionSet.h"
+
+namespace kopsik {
+
+  // 2014-03-01, the default end of the generated history, fixed so
+  // that accounts don't change with the day they're generated on
+  const std::time_t kGeneratorDefaultUntil = 1393632000;
+
+  struct AccountSize {
+    AccountSize()
+      : workspaces(3)
+      , clients(500)
+      , projects(5000)
+      , tasks(10000)
+      , tags(300)
+      , time_entries(100000)
+      , descriptions(5000)
+      , max_tags_per_entry(3)
+      , no_project_percent(20)
+      , days(730)
+      , until(kGeneratorDefaultUntil)
+      , skew(1.0)
+      , seed(1) {}
+
+    int workspaces;
+    int clients;
+    int projects;
+    int tasks;
+    int tags;
+    int time_entries;
+    int descriptions;
+    int max_tags_per_entry;
+    int no_project_percent;
+    int days;
+    std::time_t until;
+    double skew;
+    int seed;
+  };
+
+  // Picks indexes 0..n-1, index i with weight 1 / (i + 1)^skew
+  class ZipfPicker {
+  public:
+    ZipfPicker(const int n, const double skew) {
+      double sum(0);
+      for (int i = 0; i < n; i++) {
+        sum += 1.0 / std::pow(static_cast<double>(i + 1), skew);
+        cumulative_.push_back(sum);
+      }
+    }
+
+    int Pick(Poco::Random *random) const {
+      if (cumulative_.empty()) {
+        return -1;
+      }
+      double x = random->nextDouble() * cumulative_.back();
+      std::vector<double>::const_iterator it =
+        std::lower_bound(cumulative_.begin(), cumulative_.end(), x);
+      if (it == cumulative_.end()) {
+        --it;
+      }
+      return static_cast<int>(it - cumulative_.begin());
+    }
+
+  private:
+    std::vector<double> cumulative_;
+  };
+
+  // IDs of each model type start from their own base,
+  // like on the server where they come from separate tables
+  const Poco::UInt64 kGeneratorUserID = 10471231;
+  const Poco::UInt64 kGeneratorWorkspaceBase = 100000000;
+  const Poco::UInt64 kGeneratorClientBase = 1000000;
+  const Poco::UInt64 kGeneratorProjectBase = 2000000;
+  const Poco::UInt64 kGeneratorTaskBase = 3000000;
+  const Poco::UInt64 kGeneratorTagBase = 20000000;
+  const Poco::UInt64 kGeneratorTimeEntryBase = 80000000;
+
+  class AccountGenerator {
+  public:
+    explicit AccountGenerator(const AccountSize &size) : size_(size) {
+      random_.seed(size.seed);
+    }
+
+    // The /me?with_related_data=true response, with since
+    std::string MeJSON() {
+      const std::string at(Formatter::Format8601(size_.until));
+
+      JSONWriter writer;
+      writer.Reserve(size_.time_entries * 300);
+      writer.BeginObject();
+      writer.Int("since", size_.until);
+      writer.Key("data");
+      writer.BeginObject();
+
+      writer.Int("id", kGeneratorUserID);
+      writer.String("api_token", "4b3e3d1c9a8f7e6d5c4b3a2918f7e6d5");
+      writer.Int("default_wid", kGeneratorWorkspaceBase);
+      writer.String("email", "loadtest@toggl.com");
+      writer.String("fullname", "Load Test");
+      writer.Bool("store_start_and_stop_time", true);
+      writer.Bool("record_timeline", false);
+      writer.String("at", at);
+
+      writer.Key("workspaces");
+      writer.BeginArray();
+      for (int i = 0; i < size_.workspaces; i++) {
+        writer.BeginObject();
+        writer.Int("id", workspaceID(i));
+        writer.String("name", "Workspace " + number(i + 1));
+        writer.Bool("premium", i == 0);
+        writer.Bool("admin", true);
+        writer.String("at", at);
+        writer.EndObject();
+      }
+      writer.EndArray();
+
+      std::vector<int> client_workspace;
+      writer.Key("clients");
+      writer.BeginArray();
+      for (int i = 0; i < size_.clients; i++) {
+        int ws = pickWorkspace();
+        client_workspace.push_back(ws);
+        writer.BeginObject();
+        writer.Int("id", kGeneratorClientBase + i);
+        writer.String("guid", guid());
+        writer.Int("wid", workspaceID(ws));
+        writer.String("name", "Client " + number(i + 1));
+        writer.String("at", at);
+        writer.EndObject();
+      }
+      writer.EndArray();
+
+      writer.Key("projects");
+      writer.BeginArray();
+      for (int i = 0; i < size_.projects; i++) {
+        int ws = pickWorkspace();
+        writer.BeginObject();
+        writer.Int("id", kGeneratorProjectBase + i);
+        writer.String("guid", guid());
+        // Most projects have a client from their own workspace
+        if (size_.clients && random_.next(10) < 7) {
+          int client = pickClientIn(client_workspace, ws);
+          if (client >= 0) {
+            writer.Int("cid", kGeneratorClientBase + client);
+          }
+        }
+        writer.Int("wid", workspaceID(ws));
+        writer.String("name", "Project " + number(i + 1));
+        writer.Bool("billable", random_.next(2) == 0);
+        writer.Bool("is_private", false);
+        writer.Bool("active", true);
+        writer.String("color", number(random_.next(24)));
+        writer.String("at", at);
+        writer.EndObject();
+        project_workspace_.push_back(ws);
+      }
+      writer.EndArray();
+
+      project_tasks_.assign(size_.projects, std::vector<int>());
+      writer.Key("tasks");
+      writer.BeginArray();
+      for (int i = 0; size_.projects && i < size_.tasks; i++) {
+        int project = static_cast<int>(random_.next(size_.projects));
+        project_tasks_[project].push_back(i);
+        writer.BeginObject();
+        writer.Int("id", kGeneratorTaskBase + i);
+        writer.String("name", "Task " + number(i + 1));
+        writer.Int("wid", workspaceID(project_workspace_[project]));
+        writer.Int("pid", kGeneratorProjectBase + project);
+        writer.Bool("active", true);
+        writer.String("at", at);
+        writer.EndObject();
+      }
+      writer.EndArray();
+
+      writer.Key("tags");
+      writer.BeginArray();
+      for (int i = 0; i < size_.tags; i++) {
+        writer.BeginObject();
+        writer.Int("id", kGeneratorTagBase + i);
+        writer.Int("wid", workspaceID(i % size_.workspaces));
+        writer.String("name", tagName(i));
+        writer.EndObject();
+      }
+      writer.EndArray();
+
+      writer.Key("time_entries");
+      writer.BeginArray();
+      ZipfPicker projects(size_.projects, size_.skew);
+      ZipfPicker descriptions(size_.descriptions, size_.skew);
+      for (int i = 0; i < size_.time_entries; i++) {
+        writeTimeEntry(i, projects, descriptions, at, &writer);
+      }
+      writer.EndArray();
+
+      writer.EndObject();
+      writer.EndObject();
+      return writer.Buffer();
+    }
+
+  private:
+    void writeTimeEntry(
+        const int i,
+        const ZipfPicker &projects,
+        const ZipfPicker &descriptions,
+        const std::string &at,
+        JSONWriter *writer) {
+      int project(-1);
+      if (static_cast<int>(random_.next(100)) >= size_.no_project_percent) {
+        project = projects.Pick(&random_);
+      }
+      int ws = project >= 0 ? project_workspace_[project] : pickWorkspace();
+
+      // Up to 8 hours, usually well under one
+      Poco::Int64 duration = 60 + static_cast<Poco::Int64>(
+        random_.next(3600) * (1 + random_.next(8)) * random_.nextDouble());
+      std::time_t start = size_.until - duration
+        - random_.next(static_cast<Poco::UInt32>(size_.days) * 86400);
+
+      writer->BeginObject();
+      writer->Int("id", kGeneratorTimeEntryBase + i);
+      writer->String("guid", guid());
+      writer->Int("wid", workspaceID(ws));
+      if (project >= 0) {
+        writer->Int("pid", kGeneratorProjectBase + project);
+        const std::vector<int> &tasks = project_tasks_[project];
+        if (!tasks.empty() && random_.next(2) == 0) {
+          writer->Int("tid",
+                      kGeneratorTaskBase + tasks[random_.next(tasks.size())]);
+        }
+      }
+      writer->Bool("billable", random_.next(2) == 0);
+      writer->String("start", Formatter::Format8601(start));
+      writer->String("stop", Formatter::Format8601(start + duration));
+      writer->Int("duration", duration);
+      int description = descriptions.Pick(&random_);
+      if (description >= 0) {
+        writer->String("description", "Working on thing "
+                       + number(description + 1));
+      }
+      writer->Key("tags");
+      writer->BeginArray();
+      if (size_.tags) {
+        int n = random_.next(size_.max_tags_per_entry + 1);
+        for (int t = 0; t < n; t++) {
+          writer->String(tagName(random_.next(size_.tags)));
+        }
+      }
+      writer->EndArray();
+      writer->Bool("duronly", false);
+      writer->String("at", at);
+      writer->EndObject();
+    }
+
+    Poco::UInt64 workspaceID(const int i) const {
+      return kGeneratorWorkspaceBase + i;
+    }
+
+    int pickWorkspace() {
+      // The first workspace is the busy one
+      if (size_.workspaces == 1 || random_.next(2) == 0) {
+        return 0;
+      }
+      return random_.next(size_.workspaces);
+    }
+
+    int pickClientIn(const std::vector<int> &client_workspace, const int ws) {
+      // Clients are spread over workspaces at random,
+      // so a few tries nearly always find one in the right place
+      for (int tries = 0; tries < 16; tries++) {
+        int client = random_.next(size_.clients);
+        if (client_workspace[client] == ws) {
+          return client;
+        }
+      }
+      return -1;
+    }
+
+    std::string guid() {
+      char buf[37];
+      Poco::UInt32 a = random_.next();
+      Poco::UInt32 b = random_.next();
+      Poco::UInt32 c = random_.next();
+      Poco::UInt32 d = random_.next();
+      snprintf(buf, sizeof(buf), "%08x-%04x-%04x-%04x-%04x%08x",
+               a, b >> 16, (b & 0x0fff) | 0x4000,
+               (c >> 16 & 0x3fff) | 0x8000, c & 0xffff, d);
+      return std::string(buf);
+    }
+
+    static std::string tagName(const int i) {
+      return "tag" + number(i + 1);
+    }
+
+    static std::string number(const Poco::Int64 n) {
+      std::string s;
+      Poco::NumberFormatter::append(s, n);
+      return s;
+    }
+
+    AccountSize size_;
+    Poco::Random random_;
+    std::vector<int> project_workspace_;
+    std::vector<std::vector<int> > project_tasks_;
+  };
+
+  // The database a login with the payload leaves behind
+  error GenerateDatabase(const std::string &json, const std::string &path) {
+    Poco::File f(path);
+    if (f.exists()) {
+      f.remove(false);
+    }
+
+    Database db(path);
+    User user("kopsik_generator", "0.1");
+    LoadUserFromJSONString(&user, json, true, true);
+    error err = db.SetCurrentAPIToken(user.APIToken());
+    if (err != noError) {
+      return err;
+    }
+    std::vector<ModelChange> changes;
+    return db.SaveUser(&user, true, &changes);
+  }
+
+  class GeneratorApp : public Poco::Util::Application {
+  protected:
+    void defineOptions(Poco::Util::OptionSet& options) {  // NOLINT
+      Poco::Util::Application::defineOptions(options);
+      options.addOption(Poco::Util::Option("help", "h", "show options"));
+      options.addOption(Poco::Util::Option(
+        "json", "", "write the /me payload to this file").argument("path"));
+      options.addOption(Poco::Util::Option(
+        "db", "", "write a logged in database to this file")
+        .argument("path"));
+      defineCount(options, "workspaces", "workspaces");
+      defineCount(options, "clients", "clients");
+      defineCount(options, "projects", "projects");
+      defineCount(options, "tasks", "tasks, on random projects");
+      defineCount(options, "tags", "tags");
+      defineCount(options, "time_entries", "time entries");
+      defineCount(options, "descriptions", "distinct descriptions");
+      defineCount(options, "max_tags_per_entry", "tags per time entry, most");
+      defineCount(options, "no_project_percent",
+                  "percentage of time entries without a project");
+      defineCount(options, "days", "days of history");
+      defineCount(options, "until", "end of the history, as a Unix time");
+      options.addOption(Poco::Util::Option(
+        "skew", "", "Zipf exponent of project and description popularity")
+        .argument("x"));
+      defineCount(options, "seed", "random seed");
+    }
+
+    void handleOption(const std::string &name, const std::string &value) {
+      Poco::Util::Application::handleOption(name, value);
+      options_[name] = value;
+    }
+
+    int main(const std::vector<std::string>& args) {
+      if (options_.count("help")
+          || (!options_.count("json") && !options_.count("db"))) {
+        Poco::Util::HelpFormatter help(options());
+        help.setCommand(commandName());
+        help.setUsage("--json=path --db=path [options]");
+        help.format(std::cout);
+        return options_.count("help") ? EXIT_OK : EXIT_USAGE;
+      }
+
+      AccountSize size;
+      try {
+        size.workspaces = count("workspaces", size.workspaces);
+        size.clients = count("clients", size.clients);
+        size.projects = count("projects", size.projects);
+        size.tasks = count("tasks", size.tasks);
+        size.tags = count("tags", size.tags);
+        size.time_entries = count("time_entries", size.time_entries);
+        size.descriptions = count("descriptions", size.descriptions);
+        size.max_tags_per_entry =
+          count("max_tags_per_entry", size.max_tags_per_entry);
+        size.no_project_percent =
+          count("no_project_percent", size.no_project_percent);
+        size.days = count("days", size.days);
+        size.until = count("until", size.until);
+        size.seed = count("seed", size.seed);
+        if (options_.count("skew")) {
+          size.skew = Poco::NumberParser::parseFloat(options_["skew"]);
+        }
+      } catch(const Poco::Exception &exc) {
+        std::cerr << exc.displayText() << std::endl;
+        return EXIT_USAGE;
+      }
+      if (size.workspaces < 1 || size.days < 1
+          || size.no_project_percent > 100) {
+        std::cerr << "Need at least one workspace and one day, "
+                  << "and at most 100 percent" << std::endl;
+        return EXIT_USAGE;
+      }
+
+      Poco::Logger::get("").setLevel(Poco::Message::PRIO_WARNING);
+
+      AccountGenerator generator(size);
+      std::string json = generator.MeJSON();
+
+      if (options_.count("json")) {
+        Poco::FileOutputStream fos(options_["json"], std::ios::binary);
+        fos << json;
+        fos.close();
+        std::cout << "Wrote " << json.size() << " bytes to "
+                  << options_["json"] << std::endl;
+      }
+
+      if (options_.count("db")) {
+        error err = GenerateDatabase(json, options_["db"]);
+        if (err != noError) {
+          std::cerr << err << std::endl;
+          return EXIT_SOFTWARE;
+        }
+        std::cout << "Wrote " << options_["db"] << std::endl;
+      }
+
+      return EXIT_OK;
+    }
+
+  private:
+    static void defineCount(
+        Poco::Util::OptionSet &options,  // NOLINT
+        const std::string &name,
+        const std::string &description) {
+      options.addOption(Poco::Util::Option(name, "", description)
+                        .argument("n"));
+    }
+
+    int count(const std::string &name, const int default_value) {
+      if (!options_.count(name)) {
+        return default_value;
+      }
+      int n = Poco::NumberParser::parse(options_[name]);
+      if (n < 0) {
+        throw Poco::InvalidArgumentException(name, options_[name]);
+      }
+      return n;
+    }
+
+    std::map<std::string, std::string> options_;
+  };
+
+}  // namespace kopsik
+
+POCO_APP_MAIN(kopsik::GeneratorApp)
@@ -0,0 +1,150 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./api_watchdog.h"
+
+#include "Poco/Logger.h"
+#include "Poco/SingletonHolder.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+volatile Poco::Int64 &apiCallBudgetMicros() {
+  static volatile Poco::Int64 micros = 0;
+  return micros;
+}
+
+ApiWatchdog &ApiWatchdog::Shared() {
+  static Poco::SingletonHolder<ApiWatchdog> sh;
+  return *sh.get();
+}
+
+void ApiWatchdog::SetBudgetMicros(const Poco::Int64 value) {
+  apiCallBudgetMicros() = value;
+}
+
+void ApiWatchdog::Add(const SlowApiCall &call) {
+  Poco::FastMutex::ScopedLock lock(calls_m_);
+  calls_.push_back(call);
+  if (calls_.size() > kApiSlowCallsKept) {
+    calls_.pop_front();
+  }
+}
+
+std::size_t ApiWatchdog::Size() {
+  Poco::FastMutex::ScopedLock lock(calls_m_);
+  return calls_.size();
+}
+
+std::string ApiWatchdog::JSON() {
+  JSONWriter writer;
+  writer.BeginArray();
+
+  Poco::FastMutex::ScopedLock lock(calls_m_);
+  for (std::deque<SlowApiCall>::const_iterator it = calls_.begin();
+      it != calls_.end();
+      it++) {
+    writer.BeginObject();
+    writer.String("name", it->name);
+    writer.String("args", it->args);
+    writer.String("thread", it->thread);
+    writer.Int("start_us", it->start_micros);
+    writer.Int("duration_us", it->duration_micros);
+    writer.Key("spans");
+    writer.BeginArray();
+    for (std::vector<TraceEvent>::const_iterator span = it->spans.begin();
+        span != it->spans.end();
+        span++) {
+      writer.BeginObject();
+      writer.String("name", span->name);
+      writer.Int("start_us", span->start_micros);
+      writer.Int("duration_us", span->duration_micros);
+      writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+  }
+
+  writer.EndArray();
+  return writer.Buffer();
+}
+
+void ApiWatchdog::Clear() {
+  Poco::FastMutex::ScopedLock lock(calls_m_);
+  calls_.clear();
+}
+
+ApiCall::ApiCall(const char *name)
+  : name_(name), start_micros_(0), args_("") {
+  if (ApiWatchdog::BudgetMicros()) {
+    start_micros_ = Poco::Timestamp().epochMicroseconds();
+  }
+}
+
+ApiCall::~ApiCall() {
+  if (!start_micros_) {
+    return;
+  }
+  Poco::Int64 duration = Poco::Timestamp().epochMicroseconds()
+    - start_micros_;
+  Metrics::Shared().Time(std::string("api.") + name_, duration);
+  Poco::Int64 budget = ApiWatchdog::BudgetMicros();
+  if (!budget || duration <= budget) {
+    return;
+  }
+
+  SlowApiCall call;
+  call.name = name_;
+  call.args = args_;
+  Poco::Thread *thread = Poco::Thread::current();
+  call.thread = thread ? thread->name() : "main";
+  call.start_micros = start_micros_;
+  call.duration_micros = duration;
+  if (Trace::Enabled()) {
+    std::vector<TraceEvent> events;
+    Trace::Shared().Buffer()->Events(&events);
+    for (std::vector<TraceEvent>::const_iterator it = events.begin();
+        it != events.end();
+        it++) {
+      if (it->start_micros >= start_micros_) {
+        call.spans.push_back(*it);
+      }
+    }
+  }
+
+  Metrics::Shared().Count("api.slow");
+  std::stringstream ss;
+  ss << name_ << "(" << args_ << ") took " << duration / 1000
+     << " ms on " << call.thread;
+  for (std::vector<TraceEvent>::const_iterator it = call.spans.begin();
+      it != call.spans.end();
+      it++) {
+    ss << (it == call.spans.begin() ? ", in " : ", ") << it->name
+       << " " << it->duration_micros / 1000 << " ms";
+  }
+  Poco::Logger::get("api_watchdog").warning(ss.str());
+
+  ApiWatchdog::Shared().Add(call);
+}
+
+std::string ApiArg(const char *value) {
+  if (!value) {
+    return "null";
+  }
+  std::string s(value);
+  if (s.size() > kApiArgMaxLength) {
+    return "\"" + s.substr(0, kApiArgMaxLength) + "...\"";
+  }
+  return "\"" + s + "\"";
+}
+
+std::string ApiPrivateArg(const char *value) {
+  if (!value) {
+    return "null";
+  }
+  std::stringstream ss;
+  ss << "<" << std::string(value).size() << " chars>";
+  return ss.str();
+}
+
+}  // namespace kopsik
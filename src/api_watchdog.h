@@ -0,0 +1,111 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_API_WATCHDOG_H_
+#define SRC_API_WATCHDOG_H_
+
+#include <deque>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "./json_writer.h"
+#include "./metrics.h"
+#include "./trace.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Slow calls kept for kopsik_api_watchdog_dump, the oldest go first
+  const std::size_t kApiSlowCallsKept = 100;
+
+  // Longer string arguments are cut in the summary
+  const std::string::size_type kApiArgMaxLength = 64;
+
+  struct SlowApiCall {
+    std::string name;
+    // "guid=\"abc\" duration=\"1:00\""
+    std::string args;
+    std::string thread;
+    Poco::Int64 start_micros;
+    Poco::Int64 duration_micros;
+    // Spans the calling thread finished during the call, with
+    // tracing on
+    std::vector<TraceEvent> spans;
+  };
+
+  // Read by every call, so it's kept out of the singleton
+  volatile Poco::Int64 &apiCallBudgetMicros();
+
+  // Catches the C API calls that keep the UI waiting. While a budget
+  // is set, every call is timed as api.<name> in the metrics, and
+  // calls over the budget are logged and kept with their arguments
+  // and spans. Off by default; a call only checks the budget then.
+  class ApiWatchdog {
+  public:
+    ApiWatchdog() {}
+
+    static ApiWatchdog &Shared();
+
+    static Poco::Int64 BudgetMicros() { return apiCallBudgetMicros(); }
+    // 0 turns it off. 16 ms is one frame at 60 Hz.
+    static void SetBudgetMicros(const Poco::Int64 value);
+
+    void Add(const SlowApiCall &call);
+
+    std::size_t Size();
+
+    // Slow calls kept, oldest first, as a JSON array
+    std::string JSON();
+
+    void Clear();
+
+  private:
+    std::deque<SlowApiCall> calls_;
+    Poco::FastMutex calls_m_;
+
+    ApiWatchdog(const ApiWatchdog &);
+    ApiWatchdog &operator=(const ApiWatchdog &);
+  };
+
+  // Times the C API call it lives in, when the watchdog is on.
+  // Name must be a string literal.
+  class ApiCall {
+  public:
+    explicit ApiCall(const char *name);
+
+    ~ApiCall();
+
+    bool Watched() const { return start_micros_ != 0; }
+    void SetArgs(const std::string &value) { args_ = value; }
+
+  private:
+    const char *name_;
+    Poco::Int64 start_micros_;
+    std::string args_;
+
+    ApiCall(const ApiCall &);
+    ApiCall &operator=(const ApiCall &);
+  };
+
+  // A string argument as it goes in the summary, quoted and cut
+  std::string ApiArg(const char *value);
+
+  // What the user typed, or a secret, goes in only by its length
+  std::string ApiPrivateArg(const char *value);
+
+}  // namespace kopsik
+
+// Times the C API function it's the first line of. Args is streamed
+// into the summary of the call, only while the watchdog is on:
+//   KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
+#define KOPSIK_API_CALL(args) \
+  kopsik::ApiCall kopsik_api_call_(__FUNCTION__); \
+  if (kopsik_api_call_.Watched()) { \
+    std::stringstream kopsik_api_args_; \
+    kopsik_api_args_ << args; \
+    kopsik_api_call_.SetArgs(kopsik_api_args_.str()); \
+  }
+
+#endif  // SRC_API_WATCHDOG_H_
@@ -0,0 +1,106 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./async_log_channel.h"
+
+#include <sstream>
+
+namespace kopsik {
+
+AsyncLogChannel::AsyncLogChannel(
+    Poco::Channel *channel, const std::size_t max_queued)
+  : channel_(channel, true)
+  , max_queued_(max_queued)
+  , dropped_(0)
+  , running_(false)
+  , closed_(false)
+  , writer_(*this, &AsyncLogChannel::runWriter) {
+  poco_assert(channel);
+  poco_assert(max_queued);
+}
+
+void AsyncLogChannel::open() {
+  Poco::FastMutex::ScopedLock lock(queue_m_);
+  start();
+}
+
+void AsyncLogChannel::close() {
+  {
+    Poco::FastMutex::ScopedLock lock(queue_m_);
+    closed_ = true;
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+  }
+  queued_.set();
+  thread_.join();
+  write();
+}
+
+void AsyncLogChannel::log(const Poco::Message &msg) {
+  {
+    Poco::FastMutex::ScopedLock lock(queue_m_);
+    start();
+    if (running_) {
+      if (queue_.size() >= max_queued_) {
+        dropped_++;
+        return;
+      }
+      queue_.push_back(msg);
+      queued_.set();
+      return;
+    }
+  }
+  Poco::FastMutex::ScopedLock lock(channel_m_);
+  channel_->log(msg);
+}
+
+AsyncLogChannel::~AsyncLogChannel() {
+  close();
+}
+
+void AsyncLogChannel::start() {
+  if (running_ || closed_) {
+    return;
+  }
+  channel_->open();
+  running_ = true;
+  thread_.start(writer_);
+}
+
+void AsyncLogChannel::runWriter() {
+  while (true) {
+    queued_.tryWait(1000);
+    write();
+    Poco::FastMutex::ScopedLock lock(queue_m_);
+    if (!running_) {
+      return;
+    }
+  }
+}
+
+void AsyncLogChannel::write() {
+  std::deque<Poco::Message> messages;
+  std::size_t dropped(0);
+  {
+    Poco::FastMutex::ScopedLock lock(queue_m_);
+    messages.swap(queue_);
+    dropped = dropped_;
+    dropped_ = 0;
+  }
+
+  Poco::FastMutex::ScopedLock lock(channel_m_);
+  for (std::deque<Poco::Message>::const_iterator it = messages.begin();
+      it != messages.end();
+      it++) {
+    channel_->log(*it);
+  }
+  if (dropped) {
+    std::stringstream ss;
+    ss << "Log queue was full, dropped " << dropped << " message(s)";
+    channel_->log(Poco::Message("kopsik", ss.str(),
+                                Poco::Message::PRIO_WARNING));
+  }
+}
+
+}  // namespace kopsik
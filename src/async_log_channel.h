@@ -0,0 +1,70 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_ASYNC_LOG_CHANNEL_H_
+#define SRC_ASYNC_LOG_CHANNEL_H_
+
+#include <deque>
+
+#include "Poco/AutoPtr.h"
+#include "Poco/Bugcheck.h"
+#include "Poco/Channel.h"
+#include "Poco/Event.h"
+#include "Poco/Message.h"
+#include "Poco/Mutex.h"
+#include "Poco/RunnableAdapter.h"
+#include "Poco/Thread.h"
+
+namespace kopsik {
+
+  // Messages waiting for the writer thread. Anything logged
+  // while the queue is full is dropped, and counted.
+  const std::size_t kLogQueueMax = 10000;
+
+  // Hands messages over to a background thread that passes them on
+  // to the wrapped channel, so that a slow disk doesn't hold up the
+  // UI thread or the database thread while it holds its lock.
+  // Messages keep the time, thread and priority they were logged
+  // with, so formatting can happen on the writer thread as well.
+  class AsyncLogChannel : public Poco::Channel {
+  public:
+    AsyncLogChannel(Poco::Channel *channel, const std::size_t max_queued);
+
+    void open();
+
+    // Writes out whatever is queued before returning. Messages
+    // logged after this are written on the calling thread.
+    void close();
+
+    void log(const Poco::Message &msg);
+
+  protected:
+    ~AsyncLogChannel();
+
+  private:
+    // Call with queue_m_ held
+    void start();
+
+    void runWriter();
+
+    void write();
+
+    Poco::AutoPtr<Poco::Channel> channel_;
+    Poco::FastMutex channel_m_;
+
+    std::deque<Poco::Message> queue_;
+    std::size_t max_queued_;
+    std::size_t dropped_;
+    bool running_;
+    bool closed_;
+    Poco::FastMutex queue_m_;
+    Poco::Event queued_;
+
+    // Not from the default thread pool, which Context joins
+    // on shutdown while logging still goes on
+    Poco::Thread thread_;
+    Poco::RunnableAdapter<AsyncLogChannel> writer_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_ASYNC_LOG_CHANNEL_H_
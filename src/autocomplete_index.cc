@@ -0,0 +1,214 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./autocomplete_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace kopsik {
+
+void AutocompleteIndex::Build(const std::vector<AutocompleteItem> &items) {
+  items_ = items;
+  lowered_.resize(items_.size());
+  words_.clear();
+  for (std::size_t i = 0; i < items_.size(); i++) {
+    lowered_[i] = Poco::UTF8::toLower(items_[i].Text);
+    std::vector<std::string> words;
+    SplitWords(lowered_[i], &words);
+    for (std::size_t j = 0; j < words.size(); j++) {
+      words_.push_back(std::make_pair(words[j], i));
+    }
+  }
+  std::sort(words_.begin(), words_.end());
+}
+
+void AutocompleteIndex::Find(
+    const std::string &typed, const std::size_t limit,
+    const bool include_time_entries, const bool include_tasks,
+    const bool include_projects, std::vector<std::size_t> *found) const {
+  poco_assert(found);
+
+  std::vector<std::string> typed_words;
+  SplitWords(Poco::UTF8::toLower(typed), &typed_words);
+
+  // Candidates come from the longest word, as it's the rarest
+  std::vector<std::size_t> candidates;
+  if (typed_words.empty()) {
+    for (std::size_t i = 0; i < items_.size(); i++) {
+      candidates.push_back(i);
+    }
+  } else {
+    std::size_t longest = 0;
+    for (std::size_t i = 1; i < typed_words.size(); i++) {
+      if (typed_words[i].size() > typed_words[longest].size()) {
+        longest = i;
+      }
+    }
+    const std::string &prefix = typed_words[longest];
+    std::vector<std::pair<std::string, std::size_t> >::const_iterator it =
+      std::lower_bound(words_.begin(), words_.end(),
+                       std::make_pair(prefix, std::size_t(0)));
+    for (; it != words_.end()
+        && it->first.compare(0, prefix.size(), prefix) == 0;
+        it++) {
+      candidates.push_back(it->second);
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+  }
+
+  for (std::vector<std::size_t>::const_iterator it = candidates.begin();
+      it != candidates.end() && found->size() < limit;
+      it++) {
+    const AutocompleteItem &item = items_[*it];
+    if ((item.IsTimeEntry() && !include_time_entries)
+        || (item.IsTask() && !include_tasks)
+        || (item.IsProject() && !include_projects)) {
+      continue;
+    }
+    if (hasWordsStartingWith(lowered_[*it], typed_words)) {
+      found->push_back(*it);
+    }
+  }
+}
+
+void AutocompleteIndex::Serialize(std::string *buffer) const {
+  putUInt64(buffer, items_.size());
+  for (std::vector<AutocompleteItem>::const_iterator it = items_.begin();
+      it != items_.end();
+      it++) {
+    putString(buffer, it->Text);
+    putString(buffer, it->Description);
+    putString(buffer, it->ProjectAndTaskLabel);
+    putString(buffer, it->ProjectColor);
+    putUInt64(buffer, it->TaskID);
+    putUInt64(buffer, it->ProjectID);
+    putUInt64(buffer, it->Type);
+    putUInt64(buffer, it->UseCount);
+    putUInt64(buffer, it->LastUsed);
+  }
+  putUInt64(buffer, words_.size());
+  for (std::size_t i = 0; i < words_.size(); i++) {
+    putString(buffer, words_[i].first);
+    putUInt64(buffer, words_[i].second);
+  }
+}
+
+bool AutocompleteIndex::Deserialize(const char *begin, const char *end) {
+  std::vector<AutocompleteItem> items;
+  std::vector<std::pair<std::string, std::size_t> > words;
+  const char *p = begin;
+  Poco::UInt64 count(0);
+  bool ok = getUInt64(&p, end, &count)
+    && count <= static_cast<Poco::UInt64>(end - p);
+  if (ok) {
+    items.resize(static_cast<std::size_t>(count));
+  }
+  for (std::size_t i = 0; ok && i < items.size(); i++) {
+    AutocompleteItem &item = items[i];
+    ok = getString(&p, end, &item.Text)
+      && getString(&p, end, &item.Description)
+      && getString(&p, end, &item.ProjectAndTaskLabel)
+      && getString(&p, end, &item.ProjectColor)
+      && getUInt64(&p, end, &item.TaskID)
+      && getUInt64(&p, end, &item.ProjectID)
+      && getUInt64(&p, end, &item.Type)
+      && getUInt64(&p, end, &item.UseCount)
+      && getUInt64(&p, end, &item.LastUsed);
+  }
+  ok = ok && getUInt64(&p, end, &count)
+    && count <= static_cast<Poco::UInt64>(end - p);
+  if (ok) {
+    words.resize(static_cast<std::size_t>(count));
+  }
+  for (std::size_t i = 0; ok && i < words.size(); i++) {
+    Poco::UInt64 position(0);
+    ok = getString(&p, end, &words[i].first)
+      && getUInt64(&p, end, &position)
+      && position < items.size();
+    words[i].second = static_cast<std::size_t>(position);
+  }
+
+  items_.clear();
+  lowered_.clear();
+  words_.clear();
+  if (!ok || p != end) {
+    return false;
+  }
+  items_.swap(items);
+  words_.swap(words);
+  lowered_.resize(items_.size());
+  for (std::size_t i = 0; i < items_.size(); i++) {
+    lowered_[i] = Poco::UTF8::toLower(items_[i].Text);
+  }
+  return true;
+}
+
+std::size_t AutocompleteIndex::MemoryBytes() const {
+  std::size_t bytes = VectorBytes(items_) + StringVectorBytes(lowered_)
+    + VectorBytes(words_);
+  for (std::vector<AutocompleteItem>::const_iterator it = items_.begin();
+      it != items_.end();
+      it++) {
+    bytes += StringBytes(it->Text)
+      + StringBytes(it->Description)
+      + StringBytes(it->ProjectAndTaskLabel)
+      + StringBytes(it->ProjectColor);
+  }
+  for (std::size_t i = 0; i < words_.size(); i++) {
+    bytes += StringBytes(words_[i].first);
+  }
+  return bytes;
+}
+
+void AutocompleteIndex::putUInt64(
+    std::string *buffer, const Poco::UInt64 value) {
+  buffer->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void AutocompleteIndex::putString(
+    std::string *buffer, const std::string &value) {
+  putUInt64(buffer, value.size());
+  buffer->append(value);
+}
+
+bool AutocompleteIndex::getUInt64(
+    const char **p, const char *end, Poco::UInt64 *value) {
+  if (static_cast<std::size_t>(end - *p) < sizeof(*value)) {
+    return false;
+  }
+  std::memcpy(value, *p, sizeof(*value));
+  *p += sizeof(*value);
+  return true;
+}
+
+bool AutocompleteIndex::getString(
+    const char **p, const char *end, std::string *value) {
+  Poco::UInt64 size(0);
+  if (!getUInt64(p, end, &size)
+      || size > static_cast<Poco::UInt64>(end - *p)) {
+    return false;
+  }
+  value->assign(*p, static_cast<std::size_t>(size));
+  *p += size;
+  return true;
+}
+
+bool AutocompleteIndex::hasWordsStartingWith(
+    const std::string &text, const std::vector<std::string> &prefixes) {
+  for (std::size_t i = 0; i < prefixes.size(); i++) {
+    bool found = false;
+    std::string::size_type pos = text.find(prefixes[i]);
+    while (pos != std::string::npos && !found) {
+      found = pos == 0 || !IsWordChar(text[pos - 1]);
+      pos = text.find(prefixes[i], pos + 1);
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace kopsik
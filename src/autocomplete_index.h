@@ -0,0 +1,80 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_AUTOCOMPLETE_INDEX_H_
+#define SRC_AUTOCOMPLETE_INDEX_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./autocomplete_item.h"
+#include "./memory_usage.h"
+#include "./text_words.h"
+
+#include "Poco/Bugcheck.h"
+#include "Poco/Types.h"
+#include "Poco/UTF8String.h"
+
+namespace kopsik {
+
+  // Word prefix index over the Text of autocomplete items, so the items
+  // matching what's typed in the timer can be found without looking at
+  // every item. Each word typed has to start a word of the item's Text,
+  // ignoring case. Matches come in the order the items were given in.
+  class AutocompleteIndex {
+  public:
+    AutocompleteIndex() {}
+
+    // Items should be sorted with CompareAutocompleteItems
+    void Build(const std::vector<AutocompleteItem> &items);
+
+    const std::vector<AutocompleteItem> &Items() const { return items_; }
+
+    // Positions in Items() of the first items matching the typed text
+    void Find(
+        const std::string &typed,
+        const std::size_t limit,
+        const bool include_time_entries,
+        const bool include_tasks,
+        const bool include_projects,
+        std::vector<std::size_t> *found) const;
+
+    // Appends the items, with their use counts, and the words, so
+    // Deserialize can put the index back together without building
+    // it. Numbers are in native byte order.
+    void Serialize(std::string *buffer) const;
+
+    // Replaces the index with the one Serialize wrote from begin to
+    // end. False, leaving the index empty, if that's not what's there.
+    bool Deserialize(const char *begin, const char *end);
+
+    // The items, their lower case texts and their words
+    std::size_t MemoryBytes() const;
+
+  private:
+    static void putUInt64(std::string *buffer, const Poco::UInt64 value);
+    static void putString(std::string *buffer, const std::string &value);
+
+    static bool getUInt64(
+        const char **p,
+        const char *end,
+        Poco::UInt64 *value);
+    static bool getString(
+        const char **p,
+        const char *end,
+        std::string *value);
+
+    static bool hasWordsStartingWith(
+        const std::string &text,
+        const std::vector<std::string> &prefixes);
+
+    std::vector<AutocompleteItem> items_;
+    // Text of each item in lower case
+    std::vector<std::string> lowered_;
+    // Every word of every item, with the position of the item
+    std::vector<std::pair<std::string, std::size_t> > words_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_AUTOCOMPLETE_INDEX_H_
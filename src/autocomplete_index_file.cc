@@ -0,0 +1,93 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./autocomplete_index_file.h"
+
+#include "Poco/File.h"
+#include "Poco/SharedMemory.h"
+
+namespace kopsik {
+
+error AutocompleteIndexFile::Write(
+    const std::string &path, const RelatedDataSnapshotKey &key,
+    const AutocompleteIndex &index) {
+  std::string buffer(header(key));
+  index.Serialize(&buffer);
+
+  try {
+    std::string temp_path(path + ".tmp");
+    {
+      Poco::FileOutputStream out(temp_path,
+                                 std::ios::out | std::ios::binary);
+      out.write(buffer.data(), buffer.size());
+      out.close();
+      if (!out.good()) {
+        return error("Cannot write autocomplete index");
+      }
+    }
+    Poco::File file(path);
+    if (file.exists()) {
+      file.remove();
+    }
+    Poco::File(temp_path).renameTo(path);
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  }
+  return noError;
+}
+
+error AutocompleteIndexFile::Read(
+    const std::string &path, const RelatedDataSnapshotKey &key,
+    AutocompleteIndex *index, bool *found) {
+  *found = false;
+  try {
+    Poco::File file(path);
+    if (!file.exists() || file.getSize() < 4) {
+      return noError;
+    }
+    Poco::SharedMemory mapped(file, Poco::SharedMemory::AM_READ);
+
+    // A file written with another key starts differently
+    std::string expected(header(key));
+    const char *begin = mapped.begin();
+    const char *end = mapped.end();
+    if (static_cast<std::size_t>(end - begin) < expected.size()
+        || expected.compare(0, expected.size(),
+                            begin, expected.size()) != 0) {
+      return noError;
+    }
+    if (!index->Deserialize(begin + expected.size(), end)) {
+      return error("Autocomplete index file is damaged");
+    }
+    *found = true;
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  }
+  return noError;
+}
+
+std::string AutocompleteIndexFile::header(const RelatedDataSnapshotKey &key) {
+  std::string buffer("");
+  buffer.append(kAutocompleteIndexFileMagic, 4);
+  putUInt32(&buffer, kAutocompleteIndexFileVersion);
+  putUInt32(&buffer, static_cast<Poco::UInt32>(key.database_id.size()));
+  buffer.append(key.database_id);
+  putUInt64(&buffer, key.generation);
+  putUInt64(&buffer, key.uid);
+  return buffer;
+}
+
+void AutocompleteIndexFile::putUInt32(
+    std::string *buffer, const Poco::UInt32 value) {
+  buffer->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void AutocompleteIndexFile::putUInt64(
+    std::string *buffer, const Poco::UInt64 value) {
+  buffer->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+}  // namespace kopsik
@@ -0,0 +1,52 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_AUTOCOMPLETE_INDEX_FILE_H_
+#define SRC_AUTOCOMPLETE_INDEX_FILE_H_
+
+#include <string>
+
+#include "./autocomplete_index.h"
+#include "./related_data_snapshot.h"
+#include "./types.h"
+
+#include "Poco/FileStream.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Bumped whenever the layout changes, so older files are ignored
+  const Poco::UInt32 kAutocompleteIndexFileVersion = 1;
+  const char kAutocompleteIndexFileMagic[] = "KACI";
+
+  // The autocomplete index of a user in a file, so a start doesn't
+  // have to collect the items from all the time entries, tasks and
+  // projects and build the index again. It carries the key of the
+  // related data it was built from, as a RelatedDataSnapshot does,
+  // and is only used while the database still matches that key.
+  class AutocompleteIndexFile {
+  public:
+    // Written to a temporary file first, so a reader never sees
+    // half of it
+    static error Write(
+        const std::string &path,
+        const RelatedDataSnapshotKey &key,
+        const AutocompleteIndex &index);
+
+    // Reads the index at path, if there is one written with key.
+    // Otherwise found is false.
+    static error Read(
+        const std::string &path,
+        const RelatedDataSnapshotKey &key,
+        AutocompleteIndex *index,
+        bool *found);
+
+  private:
+    static std::string header(const RelatedDataSnapshotKey &key);
+
+    static void putUInt32(std::string *buffer, const Poco::UInt32 value);
+    static void putUInt64(std::string *buffer, const Poco::UInt64 value);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_AUTOCOMPLETE_INDEX_FILE_H_
@@ -3,7 +3,9 @@
 #ifndef SRC_AUTOCOMPLETE_ITEM_H_
 #define SRC_AUTOCOMPLETE_ITEM_H_
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "./const.h"
 
@@ -20,9 +22,37 @@ class AutocompleteItem {
     , ProjectColor("")
     , TaskID(0)
     , ProjectID(0)
-    , Type(0) {}
+    , Type(0)
+    , UseCount(0)
+    , LastUsed(0) {}
   ~AutocompleteItem() {}
 
+  bool operator==(const AutocompleteItem &other) const {
+    return Text == other.Text
+      && Description == other.Description
+      && ProjectAndTaskLabel == other.ProjectAndTaskLabel
+      && ProjectColor == other.ProjectColor
+      && TaskID == other.TaskID
+      && ProjectID == other.ProjectID
+      && Type == other.Type
+      && UseCount == other.UseCount
+      && LastUsed == other.LastUsed;
+  }
+
+  // Items are built in place and sorted by swapping them,
+  // so their strings are never copied
+  void swap(AutocompleteItem &other) {
+    Text.swap(other.Text);
+    Description.swap(other.Description);
+    ProjectAndTaskLabel.swap(other.ProjectAndTaskLabel);
+    ProjectColor.swap(other.ProjectColor);
+    std::swap(TaskID, other.TaskID);
+    std::swap(ProjectID, other.ProjectID);
+    std::swap(Type, other.Type);
+    std::swap(UseCount, other.UseCount);
+    std::swap(LastUsed, other.LastUsed);
+  }
+
   bool IsTimeEntry() const { return kAutocompleteItemTE == Type; }
   bool IsTask() const { return kAutocompleteItemTask == Type; }
   bool IsProject() const { return kAutocompleteItemProject == Type; }
@@ -34,9 +64,21 @@ class AutocompleteItem {
   Poco::UInt64 TaskID;
   Poco::UInt64 ProjectID;
   Poco::UInt64 Type;
+
+  // Time entries with the same description, project and task
+  // come as one item: how many there are and when the latest started
+  Poco::UInt64 UseCount;
+  Poco::UInt64 LastUsed;
 };
 
-bool CompareAutocompleteItems(AutocompleteItem a, AutocompleteItem b);
+bool CompareAutocompleteItems(
+    const AutocompleteItem &a,
+    const AutocompleteItem &b);
+
+// Sorts as CompareAutocompleteItems does. Positions are sorted by a
+// key worked out once per item, then the items are swapped into
+// place, instead of copying whole items around while sorting.
+void SortAutocompleteItems(std::vector<AutocompleteItem> *list);
 
 }  // namespace kopsik
 
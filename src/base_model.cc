@@ -6,6 +6,8 @@
 
 #include "./formatter.h"
 #include "./database.h"
+#include "./memory_usage.h"
+#include "./model_pool.h"
 
 #include "Poco/Timestamp.h"
 #include "Poco/DateTime.h"
@@ -13,6 +15,38 @@
 
 namespace kopsik {
 
+Poco::AtomicCounter Generation::next_;
+
+Poco::AtomicCounter BaseModel::key_generation_;
+Poco::AtomicCounter BaseModel::change_generation_;
+Poco::AtomicCounter BaseModel::label_generation_;
+
+const std::string BaseModel::empty_string_("");
+
+Poco::Logger &BaseModel::logger() const {
+    LogComponent *component = logComponent();
+    if (component) {
+        return ComponentLogger(component);
+    }
+    return Poco::Logger::get(ModelName());
+}
+
+std::size_t BaseModel::ownedBytes() const {
+    if (!cold_) {
+        return 0;
+    }
+    return sizeof(*cold_)
+        + StringBytes(cold_->GUID) + StringBytes(cold_->Error);
+}
+
+void *BaseModel::operator new(std::size_t size) {
+    return ModelPools::Shared().Allocate(size);
+}
+
+void BaseModel::operator delete(void *p, std::size_t size) {
+    ModelPools::Shared().Free(p, size);
+}
+
 bool BaseModel::NeedsPush() const {
     return NeedsPOST() || NeedsPUT() || NeedsDELETE();
 }
@@ -33,76 +67,105 @@ bool BaseModel::NeedsDELETE() const {
 }
 
 bool BaseModel::NeedsToBeSaved() const {
-  return !local_id_ || dirty_ || guid_.empty();
+  return !local_id_ || dirty_ || GUID().empty();
 }
 
 void BaseModel::EnsureGUID() {
-    if (!guid_.empty()) {
+    if (!GUID().empty()) {
         return;
     }
     SetGUID(Database::GenerateGUID());
 }
 
+void BaseModel::SetDirty() {
+    SetDirty(kAllFields);
+}
+
+void BaseModel::SetDirty(const Poco::UInt32 fields) {
+    dirty_ = true;
+    dirty_fields_ |= fields;
+    ++change_generation_;
+    version_.Bump();
+    if (list_generation_) {
+        list_generation_->Bump();
+    }
+    if (namedInLabels()) {
+        ++label_generation_;
+    }
+    if (dirty_models_) {
+        dirty_models_->insert(this);
+    }
+}
+
 void BaseModel::SetDeletedAt(const Poco::UInt64 value) {
     if (deleted_at_ != value) {
         deleted_at_ = value;
-        dirty_ = true;
+        SetDirty(kFieldDeletedAt);
+        deletedAtChanged();
     }
 }
 
 void BaseModel::SetUpdatedAt(const Poco::UInt64 value) {
     if (updated_at_ != value) {
         updated_at_ = value;
-        dirty_ = true;
+        SetDirty(kFieldUpdatedAt);
+    }
+}
+
+BaseModel::ColdFields *BaseModel::cold() {
+    if (!cold_) {
+        cold_ = new ColdFields();
+    }
+    return cold_;
+}
+
+void BaseModel::SetGUID(const std::string &value) {
+    if (GUID() != value) {
+        cold()->GUID = value;
+        guid_key_ = BinaryGUID::Of(value);
+        SetDirty(kFieldGUID);
+        ++key_generation_;
+        if (list_generation_) {
+            list_generation_->BumpKeys(this);
+        }
     }
 }
 
-void BaseModel::SetGUID(const std::string value) {
-    if (guid_ != value) {
-        guid_ = value;
-        dirty_ = true;
+void BaseModel::SetError(const kopsik::error value) {
+    if (Error() != value) {
+        cold()->Error = value;
     }
 }
 
 void BaseModel::SetUIModifiedAt(const Poco::UInt64 value) {
     if (ui_modified_at_ != value) {
         ui_modified_at_ = value;
-        dirty_ = true;
+        SetDirty(kFieldUIModifiedAt);
     }
 }
 
 void BaseModel::SetUID(const Poco::UInt64 value) {
     if (uid_ != value) {
         uid_ = value;
-        dirty_ = true;
+        SetDirty(kFieldUID);
     }
 }
 
 void BaseModel::SetID(const Poco::UInt64 value) {
     if (id_ != value) {
         id_ = value;
-        dirty_ = true;
+        SetDirty(kFieldID);
+        ++key_generation_;
+        if (list_generation_) {
+            list_generation_->BumpKeys(this);
+        }
     }
 }
 
-void BaseModel::SetUpdatedAtString(const std::string value) {
+void BaseModel::SetUpdatedAtString(const std::string &value) {
     SetUpdatedAt(Formatter::Parse8601(value));
 }
 
-void BaseModel::LoadFromDataString(const std::string data_string) {
-  JSONNODE *n = json_parse(data_string.c_str());
-  JSONNODE_ITERATOR i = json_begin(n);
-  JSONNODE_ITERATOR e = json_end(n);
-  while (i != e) {
-    json_char *node_name = json_name(*i);
-    if (strcmp(node_name, "data") == 0) {
-      LoadFromJSONNode(*i);
-    }
-    ++i;
-  }
-  json_delete(n);
-}
-
 void BaseModel::Delete() {
   SetDeletedAt(time(0));
   SetUIModifiedAt(time(0));
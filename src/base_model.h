@@ -5,30 +5,107 @@
 
 #include <string>
 #include <vector>
+#include <set>
 #include <cstring>
 
-#include "libjson.h" // NOLINT
+#include "./json_reader.h"
+#include "./log.h"
 
 #include "./types.h"
+#include "./binary_guid.h"
 
 #include "Poco/Types.h"
 #include "Poco/Logger.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/HashMap.h"
 
 namespace kopsik {
 
+  // Number that changes whenever what it stands for does, so a cache
+  // built from it knows it's still valid by comparing one integer.
+  // Values are drawn from one process-wide counter, so no two
+  // generations ever share one, not even those of a list that was
+  // replaced with another.
+  class Generation {
+  public:
+    Generation() : value_(++next_) {}
+
+    int Value() const { return value_; }
+    void Bump() { value_ = ++next_; }
+
+  private:
+    int value_;
+
+    static Poco::AtomicCounter next_;
+  };
+
+  class BaseModel;
+
+  // Generation of one of the model lists of RelatedData, bumped by
+  // the models tracked in the list. Keys() moves only when one of
+  // them gets a new ID or GUID, so lookups over the list don't follow
+  // every edit. Tracked() counts the models tracked in the list, so a
+  // cache can tell whether the list holds models whose changes the
+  // generations don't show.
+  class ListGeneration : public Generation {
+  public:
+    ListGeneration()
+      : keys_(0)
+      , keyed_(0)
+      , keyed_from_(0)
+      , tracked_(0) {}
+
+    int Keys() const { return keys_; }
+    void BumpKeys(const BaseModel *model) {
+      if (keyed_ != model) {
+        keyed_ = model;
+        keyed_from_ = keys_;
+      }
+      keys_++;
+    }
+
+    // Whether only the model has changed keys since Keys() was from
+    bool KeyedOnlyBy(const BaseModel *model, const int from) const {
+      return keys_ == from || (keyed_ == model && keyed_from_ <= from);
+    }
+
+    std::size_t Tracked() const { return tracked_; }
+    void SetTracked(const std::size_t value) { tracked_ = value; }
+
+  private:
+    int keys_;
+    // Model that changed keys last, and Keys() before it started to
+    const BaseModel *keyed_;
+    int keyed_from_;
+    std::size_t tracked_;
+  };
+
   class BaseModel {
   public:
     BaseModel()
       : local_id_(0)
       , id_(0)
-      , guid_("")
-      , ui_modified_at_(0)
       , uid_(0)
-      , dirty_(false)
+      , ui_modified_at_(0)
       , deleted_at_(0)
-      , is_marked_as_deleted_on_server_(false)
-      , updated_at_(0) {}
-    virtual ~BaseModel() {}
+      , updated_at_(0)
+      , dirty_models_(0)
+      , list_generation_(0)
+      , cold_(0)
+      , dirty_fields_(0)
+      , dirty_(false)
+      , is_marked_as_deleted_on_server_(false) {}
+    virtual ~BaseModel() {
+      if (dirty_models_) {
+        dirty_models_->erase(this);
+      }
+      delete cold_;
+    }
+
+    // Models are allocated from ModelPools, so loading
+    // and clearing thousands of them takes a few big blocks
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p, std::size_t size);
 
     Poco::Int64 LocalID() const { return local_id_; }
     void SetLocalID(const Poco::Int64 value) { local_id_ = value; }
@@ -39,15 +116,73 @@ namespace kopsik {
     Poco::UInt64 UIModifiedAt() const { return ui_modified_at_; }
     void SetUIModifiedAt(const Poco::UInt64 value);
 
-    std::string GUID() const { return guid_; }
-    void SetGUID(const std::string value);
+    const std::string &GUID() const {
+      return cold_ ? cold_->GUID : empty_string_;
+    }
+    void SetGUID(const std::string &value);
+
+    // Same GUID for use as a key, see BinaryGUID
+    const BinaryGUID &GUIDKey() const { return guid_key_; }
+
+    // Incremented whenever the ID or GUID of any model changes, so
+    // lookups over lists with untracked models know when they need
+    // to be rebuilt. Tracked models bump their ListGeneration too.
+    static int KeyGeneration() { return key_generation_.value(); }
+
+    // Incremented whenever any model becomes dirty,
+    // so copies of model fields know when to refresh.
+    static int ChangeGeneration() { return change_generation_.value(); }
+
+    // Incremented whenever a project, task or client becomes dirty,
+    // so the labels joined from their names and the buckets they're
+    // sorted into know when to refresh.
+    static int LabelGeneration() { return label_generation_.value(); }
 
     Poco::UInt64 UID() const { return uid_; }
     void SetUID(const Poco::UInt64 value);
 
-    void SetDirty() { dirty_ = true; }
+    // Bits of the fields that have changed since the model was last
+    // saved. Models number their own fields from kFieldModel on.
+    enum Field {
+        kFieldID = 1 << 0,
+        kFieldGUID = 1 << 1,
+        kFieldUID = 1 << 2,
+        kFieldUIModifiedAt = 1 << 3,
+        kFieldDeletedAt = 1 << 4,
+        kFieldUpdatedAt = 1 << 5,
+        kFieldModel = 1 << 8,
+        kAllFields = 0xffffffff
+    };
+
+    // Without the fields, any of them may have changed
+    void SetDirty();
+    void SetDirty(const Poco::UInt32 fields);
     bool Dirty() const { return dirty_; }
-    void ClearDirty() { dirty_ = false; }
+    Poco::UInt32 DirtyFields() const { return dirty_fields_; }
+    void ClearDirty() {
+        dirty_ = false;
+        dirty_fields_ = 0;
+    }
+
+    // Bumped whenever the model becomes dirty, also while it's
+    // loaded from JSON or the database, see Generation
+    int Version() const { return version_.Value(); }
+
+    // Generation of the list the model is in, which it bumps along
+    // with its own version, see RelatedData::Track.
+    kopsik::ListGeneration *ListGeneration() const {
+      return list_generation_;
+    }
+    void SetListGeneration(kopsik::ListGeneration *value) {
+        list_generation_ = value;
+    }
+
+    // Set of changed models the model adds itself to
+    // when it becomes dirty, see RelatedData::Track.
+    std::set<BaseModel *> *DirtyModels() const { return dirty_models_; }
+    void SetDirtyModels(std::set<BaseModel *> *value) {
+        dirty_models_ = value;
+    }
 
     // Deleting a time entry hides it from
     // UI and flags it for removal from server:
@@ -58,7 +193,7 @@ namespace kopsik {
     void SetUpdatedAt(const Poco::UInt64 value);
 
     std::string UpdatedAtString() const;
-    void SetUpdatedAtString(const std::string value);
+    void SetUpdatedAtString(const std::string &value);
 
     // When a model is deleted
     // on server, it will be removed from local
@@ -80,40 +215,92 @@ namespace kopsik {
 
     void EnsureGUID();
 
-    void SetError(const kopsik::error value) { error_ = value; }
-    kopsik::error Error() const { return error_; }
+    void SetError(const kopsik::error value);
+    kopsik::error Error() const {
+      return cold_ ? cold_->Error : noError;
+    }
 
     virtual std::string String() const = 0;
+    // Estimate of the memory the model takes, with the strings
+    // and lists it owns, see memory_usage.h
+    virtual std::size_t MemoryBytes() const = 0;
     virtual std::string ModelName() const = 0;
     virtual std::string ModelURL() const = 0;
-    virtual void LoadFromJSONNode(JSONNODE * const) = 0;
+    virtual void LoadFromJSONNode(JSONValue * const) = 0;
 
     virtual bool IsDuplicateResourceError(const kopsik::error err) const {
         return false; }
 
-    void LoadFromDataString(const std::string);
-
     void Delete();
 
   protected:
-    Poco::Logger &logger() const { return Poco::Logger::get(ModelName()); }
+    // Logger named after ModelName
+    Poco::Logger &logger() const;
+
+    // Handle of the logger, for models that log often enough to keep
+    // one, see LogComponent. Without it the logger is looked up by
+    // name each time.
+    virtual LogComponent *logComponent() const { return 0; }
+
+    // What the fields of BaseModel own, for MemoryBytes
+    std::size_t ownedBytes() const;
+
+    // Lets models keep track of their own deletion
+    virtual void deletedAtChanged() {}
+
+    // Whether time entries are listed with the name of the model
+    virtual bool namedInLabels() const { return false; }
+
+    // What string getters return for a field that isn't set
+    static const std::string empty_string_;
 
   private:
+    // Strings that are seldom read: the GUID text is only needed for
+    // saving, pushing and the UI, as lookups go by guid_key_, and
+    // there's only an error after a push failed. They're kept apart,
+    // so going through the models doesn't bring them in.
+    struct ColdFields {
+      guid GUID;
+      // If model push to backend results in an error,
+      // the error is attached to the model for later inspection.
+      kopsik::error Error;
+    };
+    // Allocated when one of its fields is first set
+    ColdFields *cold();
+
+    // What lookups, filters and saving read, ordered by size so
+    // they take as few cache lines as they can. Derived models put
+    // their small fields first, where the compiler can fit them into
+    // the padding after the last of these.
     Poco::Int64 local_id_;
     Poco::UInt64 id_;
-    guid guid_;
-    Poco::UInt64 ui_modified_at_;
     Poco::UInt64 uid_;
-    bool dirty_;
+    Poco::UInt64 ui_modified_at_;
     Poco::UInt64 deleted_at_;
-    bool is_marked_as_deleted_on_server_;
     Poco::UInt64 updated_at_;
+    BinaryGUID guid_key_;
+    std::set<BaseModel *> *dirty_models_;
+    kopsik::ListGeneration *list_generation_;
+    ColdFields *cold_;
+    Generation version_;
+    Poco::UInt32 dirty_fields_;
+    bool dirty_;
+    bool is_marked_as_deleted_on_server_;
+
+    static Poco::AtomicCounter key_generation_;
+    static Poco::AtomicCounter change_generation_;
+    static Poco::AtomicCounter label_generation_;
 
-    // If model push to backend results in an error,
-    // the error is attached to the model for later inspection.
-    kopsik::error error_;
+    // Lists and indexes hold models by pointer, and the cold
+    // fields belong to one of them
+    BaseModel(const BaseModel &);
+    BaseModel &operator=(const BaseModel &);
   };
 
+  // Models being pushed, to match the server's responses to them
+  typedef Poco::HashMap<BinaryGUID, BaseModel *, BinaryGUIDHash>
+    ModelsByGUID;
+
 }  // namespace kopsik
 
 #endif  // SRC_BASE_MODEL_H_
@@ -5,6 +5,8 @@
 
 #include <string>
 
+#include "./json_reader.h"
+
 #include "./types.h"
 
 #include "Poco/Types.h"
@@ -17,12 +19,17 @@ namespace kopsik {
         : StatusCode(0)
         , Body("")
         , GUID("")
-        , ContentType("") {}
+        , ContentType("")
+        , Data(0) {}
       Poco::Int64 StatusCode;
+      // Only kept for failed updates, as the error
       std::string Body;
       std::string GUID;  // must match the BatchUpdate GUID
       std::string ContentType;
       std::string Method;
+      // Data of a successful update, parsed from its body along with
+      // the response. Owned by the result until it's processed.
+      JSONValue *Data;
 
       error Error() const;
       std::string String() const;
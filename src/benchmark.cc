@@ -0,0 +1,1792 @@
+// Copyright 2014 Toggl Desktop developers.
+
+// Microbenchmarks of the library's hot paths. Results are written to
+// stdout as one JSON document, so they can be kept and compared
+// between releases. Run from the repository root:
+//
+//   make -s bench > bench.json
+//
+// An optional argument (bench_data=path for make) replaces
+// testdata/me.json as the account the benchmarks work on.
+//
+// With --soak, a logged in context is kept busy for hours of virtual
+// time instead, to find what grows when clients run for weeks:
+//
+//   make -s soak soak_hours=24 > soak.json
+//
+// Exits with 1 when memory, database size or query latency have
+// drifted past the limits below between the first hour and the last.
+//
+// With --startup and database paths, what users wait for when the app
+// starts is timed instead: kopsik_context_init to the first list of
+// time entries, on each database. make startup_bench generates small,
+// medium and large accounts for it.
+//
+// With --timeline, synthetic window events are fed through the
+// timeline pipeline at each of the given rates, per second, to see
+// how many it keeps up with and how latency grows with the backlog:
+//
+//   make -s timeline_bench timeline_rates=100,1000 > timeline.json
+//
+// With --websocket, bursts of server updates to time entries, projects
+// and tasks are handed to a logged in context the way the WebSocket
+// client hands over its frames, at each of the given burst sizes, to
+// see how fast they're applied and saved and how often the UI hears
+// of it. make websocket_bench runs it on a large generated account:
+//
+//   make -s websocket_bench websocket_bursts=10,1000 > websocket.json
+//
+// With --check and a baselines file, the scenarios users wait on are
+// timed and held against the baselines, exiting with 1 when any of
+// them has regressed past its tolerance. --record keeps what it
+// measures as the baselines instead. Baselines only mean something
+// on the machine they were kept on, so they're not checked in, and
+// without them the scenarios are timed but not compared:
+//
+//   make -s perf_baselines
+//   make -s perf_test > perf.json
+
+#include <algorithm>
+#include <ctime>
+#include <iostream>  // NOLINT
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "./autocomplete_item.h"
+#include "./kopsik_api.h"
+#include "./context.h"
+#include "./database.h"
+#include "./fake_toggl_api.h"
+#include "./formatter.h"
+#include "./json.h"
+#include "./json_reader.h"
+#include "./json_writer.h"
+#include "./memory_usage.h"
+#include "./metrics.h"
+#include "./timeline_dispatcher.h"
+#include "./timeline_event.h"
+#include "./timeline_notifications.h"
+#include "./timeline_uploader.h"
+#include "./user.h"
+#include "./websocket_client.h"
+
+#include "Poco/Event.h"
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "Poco/Logger.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Observer.h"
+#include "Poco/Platform.h"
+#include "Poco/Runnable.h"
+#include "Poco/Stopwatch.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/Thread.h"
+
+#if POCO_OS == POCO_OS_LINUX
+#include <fcntl.h>  // NOLINT
+#include <unistd.h>  // NOLINT
+#endif
+
+namespace kopsik {
+
+  // Every benchmark runs for at least this long, in microseconds
+  const Poco::Timestamp::TimeDiff kBenchMinMicros = 500000;
+  const int kBenchMaxRounds = 100000;
+  const char kBenchDB[] = "bench.db";
+
+  // One benchmark. Only Round is timed, the rest is preparation.
+  class Bench {
+  public:
+    explicit Bench(const std::string &name) : name_(name) {}
+    virtual ~Bench() {}
+
+    const std::string &Name() const { return name_; }
+
+    virtual void SetUp() {}
+    virtual void RoundSetUp() {}
+    virtual void Round() = 0;
+    virtual void TearDown() {}
+
+  private:
+    std::string name_;
+  };
+
+  struct BenchResult {
+    BenchResult() : rounds(0), total_micros(0), min_micros(0) {}
+
+    int rounds;
+    Poco::Timestamp::TimeDiff total_micros;
+    Poco::Timestamp::TimeDiff min_micros;
+  };
+
+  BenchResult run(Bench *bench) {
+    BenchResult result;
+    bench->SetUp();
+    // Warm up caches and lazily built indexes first
+    bench->RoundSetUp();
+    bench->Round();
+    Poco::Stopwatch stopwatch;
+    while (result.total_micros < kBenchMinMicros
+        && result.rounds < kBenchMaxRounds) {
+      bench->RoundSetUp();
+      stopwatch.restart();
+      bench->Round();
+      stopwatch.stop();
+      Poco::Timestamp::TimeDiff elapsed = stopwatch.elapsed();
+      if (!result.rounds || elapsed < result.min_micros) {
+        result.min_micros = elapsed;
+      }
+      result.total_micros += elapsed;
+      result.rounds++;
+    }
+    bench->TearDown();
+    return result;
+  }
+
+  void removeBenchDB() {
+    Poco::File f(kBenchDB);
+    if (f.exists()) {
+      f.remove(false);
+    }
+    // The change journal kept next to it, see ChangeJournal
+    Poco::File journal(std::string(kBenchDB) + "-edits");
+    if (journal.exists()) {
+      journal.remove(false);
+    }
+  }
+
+  class LoadUserFromJSONStringBench : public Bench {
+  public:
+    explicit LoadUserFromJSONStringBench(const std::string &json)
+      : Bench("LoadUserFromJSONString"), json_(json) {}
+
+    void Round() {
+      User user("kopsik_bench", "0.1");
+      LoadUserFromJSONString(&user, json_, true, true);
+    }
+
+  private:
+    const std::string &json_;
+  };
+
+  class UpdateJSONBench : public Bench {
+  public:
+    explicit UpdateJSONBench(const std::string &json)
+      : Bench("UpdateJSON"), json_(json), user_("kopsik_bench", "0.1") {}
+
+    void SetUp() {
+      LoadUserFromJSONString(&user_, json_, true, true);
+      // Every entry as if edited, so all of them need a PUT
+      for (std::vector<TimeEntry *>::const_iterator it =
+          user_.related.TimeEntries.begin();
+          it != user_.related.TimeEntries.end();
+          it++) {
+        (*it)->SetUIModifiedAt(time(0));
+        time_entries_.push_back(*it);
+      }
+    }
+
+    void Round() {
+      UpdateJSON(&projects_, &time_entries_);
+    }
+
+  private:
+    const std::string &json_;
+    User user_;
+    std::vector<Project *> projects_;
+    std::vector<TimeEntry *> time_entries_;
+  };
+
+  class SaveUserBench : public Bench {
+  public:
+    explicit SaveUserBench(const std::string &json)
+      : Bench("Database::SaveUser"), json_(json), db_(0), user_(0) {}
+
+    void RoundSetUp() {
+      TearDown();
+      removeBenchDB();
+      db_ = new Database(kBenchDB);
+      user_ = new User("kopsik_bench", "0.1");
+      LoadUserFromJSONString(user_, json_, true, true);
+    }
+
+    void Round() {
+      std::vector<ModelChange> changes;
+      error err = db_->SaveUser(user_, true, &changes);
+      poco_assert(noError == err);
+    }
+
+    void TearDown() {
+      delete user_;
+      user_ = 0;
+      delete db_;
+      db_ = 0;
+    }
+
+  private:
+    const std::string &json_;
+    Database *db_;
+    User *user_;
+  };
+
+  class LoadUserByIDBench : public Bench {
+  public:
+    explicit LoadUserByIDBench(const std::string &json)
+      : Bench("Database::LoadUserByID"), json_(json), db_(0), id_(0) {}
+
+    void SetUp() {
+      removeBenchDB();
+      db_ = new Database(kBenchDB);
+      User user("kopsik_bench", "0.1");
+      LoadUserFromJSONString(&user, json_, true, true);
+      std::vector<ModelChange> changes;
+      error err = db_->SaveUser(&user, true, &changes);
+      poco_assert(noError == err);
+      id_ = user.ID();
+    }
+
+    void Round() {
+      User user("kopsik_bench", "0.1");
+      error err = db_->LoadUserByID(id_, &user, true);
+      poco_assert(noError == err);
+    }
+
+    void TearDown() {
+      delete db_;
+      db_ = 0;
+    }
+
+  private:
+    const std::string &json_;
+    Database *db_;
+    Poco::UInt64 id_;
+  };
+
+  void onModelChanges(const std::vector<ModelChange> &changes) {}
+
+  // Context benchmarks share a logged in context
+  class ContextBench : public Bench {
+  public:
+    ContextBench(const std::string &name, const std::string &json)
+      : Bench(name), json_(json), context_(0) {}
+
+    void SetUp() {
+      removeBenchDB();
+      context_ = new Context("kopsik_bench", "0.1");
+      context_->SetModelChangesCallback(onModelChanges);
+      context_->SetDBPath(kBenchDB);
+      error err = context_->SetLoggedInUserFromJSON(json_);
+      poco_assert(noError == err);
+    }
+
+    void TearDown() {
+      delete context_;
+      context_ = 0;
+    }
+
+  protected:
+    const std::string &json_;
+    Context *context_;
+  };
+
+  class TimeEntriesBench : public ContextBench {
+  public:
+    explicit TimeEntriesBench(const std::string &json)
+      : ContextBench("Context::TimeEntries", json) {}
+
+    void Round() {
+      std::map<std::string, Poco::Int64> date_durations;
+      std::vector<TimeEntry *> visible;
+      error err = context_->TimeEntries(&date_durations, &visible);
+      poco_assert(noError == err);
+    }
+  };
+
+  class AutocompleteItemsBench : public ContextBench {
+  public:
+    explicit AutocompleteItemsBench(const std::string &json)
+      : ContextBench("Context::AutocompleteItems", json) {}
+
+    void Round() {
+      std::vector<AutocompleteItem> list;
+      context_->AutocompleteItems(&list, true, true, true);
+    }
+  };
+
+  // Sync runs on the context's timer thread, which calls back
+  // when done either way
+  Poco::Event synced;
+  error sync_error = noError;
+
+  void onSyncOnline() {
+    sync_error = noError;
+    synced.set();
+  }
+
+  void onSyncError(const error err) {
+    sync_error = err;
+    synced.set();
+  }
+
+  class FullSyncBench : public ContextBench {
+  public:
+    explicit FullSyncBench(const std::string &json)
+      : ContextBench("Context::FullSync", json), api_(json) {}
+
+    void SetUp() {
+      ContextBench::SetUp();
+      context_->SetHTTPSClient(&api_);
+      context_->SetOnOnlineCallback(onSyncOnline);
+      context_->SetOnErrorCallback(onSyncError);
+    }
+
+    void Round() {
+      context_->FullSync();
+      synced.wait();
+      poco_assert(noError == sync_error);
+    }
+
+  private:
+    FakeTogglAPI api_;
+  };
+
+  // Pushes edits to a hundred time entries and fetches the
+  // changes made meanwhile, of which there are none
+  class PartialSyncBench : public Bench {
+  public:
+    explicit PartialSyncBench(const std::string &json)
+      : Bench("User::PartialSync"), json_(json), api_(json),
+        user_("kopsik_bench", "0.1") {}
+
+    void SetUp() {
+      LoadUserFromJSONString(&user_, json_, true, true);
+    }
+
+    void RoundSetUp() {
+      std::vector<TimeEntry *> &time_entries = user_.related.TimeEntries;
+      for (std::size_t i = 0; i < time_entries.size() && i < 100; i++) {
+        time_entries[i]->SetUIModifiedAt(time(0));
+      }
+    }
+
+    void Round() {
+      error err = user_.PartialSync(&api_);
+      poco_assert(noError == err);
+    }
+
+  private:
+    const std::string &json_;
+    FakeTogglAPI api_;
+    User user_;
+  };
+
+  class Parse8601Bench : public Bench {
+  public:
+    Parse8601Bench() : Bench("Formatter::Parse8601") {}
+
+    void SetUp() {
+      for (int i = 0; i < 1000; i++) {
+        dates_.push_back(Formatter::Format8601(1378362830 + i * 3607));
+      }
+    }
+
+    void Round() {
+      std::time_t sum(0);
+      for (std::vector<std::string>::const_iterator it = dates_.begin();
+          it != dates_.end();
+          it++) {
+        sum += Formatter::Parse8601(*it);
+      }
+      poco_assert(sum);
+    }
+
+  private:
+    std::vector<std::string> dates_;
+  };
+
+  class TimelineToJSONBench : public Bench {
+  public:
+    TimelineToJSONBench() : Bench("convert_timeline_to_json") {}
+
+    void SetUp() {
+      for (int i = 0; i < 1000; i++) {
+        TimelineEvent event;
+        event.id = i + 1;
+        event.user_id = 1;
+        event.title = StringTable::Timeline().Intern(
+          i % 2 ? "Inbox (3) - Mail" : "toggl_api_client_test.cc - \"src\"");
+        event.filename = StringTable::Timeline().Intern(
+          i % 2 ? "Mail" : "Sublime Text");
+        event.start_time = 1378362830 + i * 60;
+        event.end_time = event.start_time + 59;
+        events_.push_back(event);
+      }
+    }
+
+    void Round() {
+      TimelineUploader::convert_timeline_to_json(events_, "bench");
+    }
+
+  private:
+    std::vector<TimelineEvent> events_;
+  };
+
+  // Soak runs this many virtual hours unless told otherwise. Every
+  // virtual minute two windows are recorded to the timeline and the
+  // UI lists time entries and autocomplete items. WebSocket updates
+  // and timeline uploads come less often.
+  const int kSoakDefaultHours = 24;
+  const std::time_t kSoakMinuteSeconds = 60;
+  const int kSoakMinutesPerHour = 60;
+  const int kSoakUpdateEveryMinutes = 5;
+  const int kSoakUploadEveryMinutes = 10;
+  const unsigned int kSoakUploadBatchSize = 100;
+  // WebSocket updates go around this many time entries
+  const int kSoakTimeEntries = 50;
+  const Poco::UInt64 kSoakFirstTimeEntryID = 800000000;
+
+  // Growth allowed from the end of the first hour, when caches are
+  // warm, to the end of the last one
+  const Poco::Int64 kSoakMaxRSSGrowthBytes = 16 * 1024 * 1024;
+  const Poco::Int64 kSoakMaxDBGrowthBytes = 4 * 1024 * 1024;
+  const Poco::Int64 kSoakMaxWALGrowthBytes = 8 * 1024 * 1024;
+  // p99 may double, and some, before it counts as drift
+  const Poco::Int64 kSoakMaxP99Factor = 2;
+  const Poco::Int64 kSoakP99SlackMicros = 2000;
+
+  // Where a soak is at the end of a virtual hour
+  struct SoakSample {
+    SoakSample()
+      : hour(0), rss_bytes(0), db_bytes(0), wal_bytes(0),
+        time_entries_p99_micros(0), autocomplete_p99_micros(0) {}
+
+    int hour;
+    Poco::Int64 rss_bytes;
+    Poco::Int64 db_bytes;
+    Poco::Int64 wal_bytes;
+    Poco::Int64 time_entries_p99_micros;
+    Poco::Int64 autocomplete_p99_micros;
+  };
+
+  Poco::Int64 p99(std::vector<Poco::Int64> *micros) {
+    if (micros->empty()) {
+      return 0;
+    }
+    std::sort(micros->begin(), micros->end());
+    return (*micros)[(micros->size() - 1) * 99 / 100];
+  }
+
+  Poco::Int64 fileBytes(const std::string &path) {
+    Poco::File f(path);
+    if (!f.exists()) {
+      return 0;
+    }
+    return f.getSize();
+  }
+
+  int soak_errors = 0;
+
+  void onSoakError(const error err) {
+    soak_errors++;
+  }
+
+  // Deletes the timeline batches the database has ready, as if
+  // they had been uploaded, so the timeline doesn't pile up
+  class SoakUploader {
+  public:
+    explicit SoakUploader(Poco::NotificationCenter &center)  // NOLINT
+      : center_(center) {
+      center_.addObserver(
+        Poco::Observer<SoakUploader, TimelineBatchReadyNotification>(
+          *this, &SoakUploader::handleTimelineBatchReadyNotification));
+    }
+
+    ~SoakUploader() {
+      center_.removeObserver(
+        Poco::Observer<SoakUploader, TimelineBatchReadyNotification>(
+          *this, &SoakUploader::handleTimelineBatchReadyNotification));
+    }
+
+    void handleTimelineBatchReadyNotification(
+        TimelineBatchReadyNotification *notification) {
+      Poco::AutoPtr<TimelineBatchReadyNotification> ptr(notification);
+      TimelineDispatcher::Instance().Post(
+        new DeleteTimelineBatchNotification(notification->user_id,
+          static_cast<unsigned int>(notification->batch.front().id),
+          static_cast<unsigned int>(notification->batch.back().id)),
+        center_);
+    }
+
+  private:
+    Poco::NotificationCenter &center_;
+  };
+
+  class Soak {
+  public:
+    Soak(const std::string &json, const int hours)
+      : json_(json), hours_(hours), api_(json) {}
+
+    // Samples, one per virtual hour, and what drifted, if anything.
+    // Returns false when something did.
+    bool Run(JSONWriter *writer) {
+      removeBenchDB();
+      soak_errors = 0;
+
+      std::vector<SoakSample> samples;
+      {
+        Context context("kopsik_bench", "0.1");
+        context.SetModelChangesCallback(onModelChanges);
+        context.SetOnErrorCallback(onSoakError);
+        context.SetHTTPSClient(&api_);
+        context.SetDBPath(kBenchDB);
+        error err = context.SetLoggedInUserFromJSON(json_);
+        poco_assert(noError == err);
+
+        User *user = 0;
+        err = context.CurrentUser(&user);
+        poco_assert(noError == err);
+        user_id_ = user->ID();
+        wid_ = context.UsersDefaultWID();
+
+        SoakUploader uploader(context.Notifications());
+
+        // Virtual time ends now, so nothing is in the future
+        started_at_ = std::time(0)
+          - hours_ * kSoakMinutesPerHour * kSoakMinuteSeconds;
+        for (int hour = 1; hour <= hours_; hour++) {
+          samples.push_back(runHour(&context, hour));
+        }
+
+        // Whatever is still queued for the context goes first
+        TimelineDispatcher::Instance().Stop();
+      }
+      removeBenchDB();
+
+      writer->Key("samples");
+      writer->BeginArray();
+      for (std::vector<SoakSample>::const_iterator it = samples.begin();
+          it != samples.end();
+          it++) {
+        writer->BeginObject();
+        writer->Int("hour", it->hour);
+        writer->Int("rss_bytes", it->rss_bytes);
+        writer->Int("db_bytes", it->db_bytes);
+        writer->Int("wal_bytes", it->wal_bytes);
+        writer->Int("time_entries_p99_us", it->time_entries_p99_micros);
+        writer->Int("autocomplete_p99_us", it->autocomplete_p99_micros);
+        writer->EndObject();
+      }
+      writer->EndArray();
+      writer->Int("errors", soak_errors);
+
+      std::vector<std::string> drifted;
+      if (samples.size() > 1) {
+        const SoakSample &first = samples.front();
+        const SoakSample &last = samples.back();
+        // RSS is 0 where the OS doesn't tell
+        if (last.rss_bytes - first.rss_bytes > kSoakMaxRSSGrowthBytes) {
+          drifted.push_back("rss_bytes");
+        }
+        if (last.db_bytes - first.db_bytes > kSoakMaxDBGrowthBytes) {
+          drifted.push_back("db_bytes");
+        }
+        if (last.wal_bytes - first.wal_bytes > kSoakMaxWALGrowthBytes) {
+          drifted.push_back("wal_bytes");
+        }
+        if (last.time_entries_p99_micros > kSoakP99SlackMicros
+            + kSoakMaxP99Factor * first.time_entries_p99_micros) {
+          drifted.push_back("time_entries_p99_us");
+        }
+        if (last.autocomplete_p99_micros > kSoakP99SlackMicros
+            + kSoakMaxP99Factor * first.autocomplete_p99_micros) {
+          drifted.push_back("autocomplete_p99_us");
+        }
+      }
+      if (soak_errors) {
+        drifted.push_back("errors");
+      }
+      writer->Key("drifted");
+      writer->BeginArray();
+      for (std::vector<std::string>::const_iterator it = drifted.begin();
+          it != drifted.end();
+          it++) {
+        writer->String(*it);
+      }
+      writer->EndArray();
+
+      return drifted.empty();
+    }
+
+  private:
+    SoakSample runHour(Context *context, const int hour) {
+      std::vector<Poco::Int64> time_entries_micros;
+      std::vector<Poco::Int64> autocomplete_micros;
+      Poco::Stopwatch stopwatch;
+
+      for (int minute = 0; minute < kSoakMinutesPerHour; minute++) {
+        int step = (hour - 1) * kSoakMinutesPerHour + minute;
+        std::time_t at = started_at_ + step * kSoakMinuteSeconds;
+
+        recordWindow(context, at, step % 3 ? "Mail" : "Sublime Text");
+        recordWindow(context, at + kSoakMinuteSeconds / 2, "Terminal");
+
+        if (step % kSoakUpdateEveryMinutes == 0) {
+          receiveUpdate(context, at, step / kSoakUpdateEveryMinutes);
+        }
+        if (step % kSoakUploadEveryMinutes == kSoakUploadEveryMinutes - 1) {
+          TimelineDispatcher::Instance().Post(
+            new CreateTimelineBatchNotification(
+              user_id_, kSoakUploadBatchSize, 0),
+            context->Notifications());
+        }
+
+        std::map<std::string, Poco::Int64> date_durations;
+        std::vector<TimeEntry *> visible;
+        stopwatch.restart();
+        error err = context->TimeEntries(&date_durations, &visible);
+        stopwatch.stop();
+        poco_assert(noError == err);
+        time_entries_micros.push_back(stopwatch.elapsed());
+
+        std::vector<AutocompleteItem> list;
+        stopwatch.restart();
+        context->AutocompleteItems(&list, true, true, true);
+        stopwatch.stop();
+        autocomplete_micros.push_back(stopwatch.elapsed());
+      }
+
+      SoakSample sample;
+      sample.hour = hour;
+      sample.rss_bytes = ResidentBytes();
+      sample.db_bytes = fileBytes(kBenchDB);
+      sample.wal_bytes = fileBytes(std::string(kBenchDB) + "-wal");
+      sample.time_entries_p99_micros = p99(&time_entries_micros);
+      sample.autocomplete_p99_micros = p99(&autocomplete_micros);
+      return sample;
+    }
+
+    // Half a minute in the app
+    void recordWindow(
+        Context *context,
+        const std::time_t at,
+        const std::string &app) {
+      TimelineEvent event;
+      event.user_id = user_id_;
+      event.title = StringTable::Timeline().Intern(app + " - soak");
+      event.filename = StringTable::Timeline().Intern(app);
+      event.start_time = at;
+      event.end_time = at + kSoakMinuteSeconds / 2 - 1;
+      TimelineDispatcher::Instance().Post(
+        new TimelineEventNotification(event), context->Notifications());
+    }
+
+    // A time entry edited elsewhere, as the WebSocket would deliver it
+    void receiveUpdate(Context *context, const std::time_t at, const int n) {
+      JSONWriter update;
+      update.BeginObject();
+      update.String("action", "UPDATE");
+      update.String("model", "time_entry");
+      update.Key("data");
+      update.BeginObject();
+      update.Int("id", kSoakFirstTimeEntryID + n % kSoakTimeEntries);
+      update.Int("wid", wid_);
+      update.String("description",
+                    "Soak " + Poco::NumberFormatter::format(n));
+      update.String("start", Formatter::Format8601(at - kSoakMinuteSeconds));
+      update.String("stop", Formatter::Format8601(at));
+      update.Int("duration", kSoakMinuteSeconds);
+      update.String("at", Formatter::Format8601(at));
+      update.EndObject();
+      update.EndObject();
+
+      JSONValue *message = JSONParse(update.Buffer());
+      poco_assert(message);
+      context->LoadUpdateFromJSONNode(message);
+      JSONDelete(message);
+    }
+
+    const std::string &json_;
+    int hours_;
+    FakeTogglAPI api_;
+    Poco::UInt64 user_id_;
+    Poco::UInt64 wid_;
+    std::time_t started_at_;
+  };
+
+  // Startup is timed this many times per database, after a first
+  // run that migrates the copy and writes its snapshot
+  const int kStartupRounds = 5;
+  // Databases are copied here first, the originals are left alone
+  const char kStartupDB[] = "startup_bench.db";
+  // Files SQLite, the snapshot, the autocomplete index and the change
+  // journal keep next to the database
+  const char *kStartupDBSuffixes[] = {
+    "", "-wal", "-shm", "-snapshot", "-autocomplete", "-edits"
+  };
+  const std::size_t kStartupDBSuffixCount =
+    sizeof(kStartupDBSuffixes) / sizeof(kStartupDBSuffixes[0]);
+
+  // Microseconds of each step of startup, in the order the UI takes
+  // them
+  struct StartupPhases {
+    StartupPhases()
+      : context_init(0), set_db_path(0), current_user(0),
+        time_entry_view_items(0), running_time_entry_view_item(0) {}
+
+    Poco::Int64 Total() const {
+      return context_init + set_db_path + current_user
+        + time_entry_view_items + running_time_entry_view_item;
+    }
+
+    Poco::Int64 context_init;
+    Poco::Int64 set_db_path;
+    Poco::Int64 current_user;
+    Poco::Int64 time_entry_view_items;
+    Poco::Int64 running_time_entry_view_item;
+  };
+
+  void onStartupChange(
+      kopsik_api_result result,
+      const char *errmsg,
+      KopsikModelChange *change) {}
+  void onStartupError(const char *errmsg) {}
+  void onStartupCheckUpdate(
+      kopsik_api_result result,
+      const char *errmsg,
+      const int is_update_available,
+      const char *url,
+      const char *version) {}
+  void onStartupOnline() {}
+
+  void removeStartupDB() {
+    for (std::size_t i = 0; i < kStartupDBSuffixCount; i++) {
+      Poco::File f(std::string(kStartupDB) + kStartupDBSuffixes[i]);
+      if (f.exists()) {
+        f.remove(false);
+      }
+    }
+  }
+
+  // Drops the startup database from the OS page cache, so that the
+  // next run reads it from disk as after a reboot. Only Linux lets a
+  // process do that without root; returns false elsewhere.
+  bool evictStartupDB() {
+#if POCO_OS == POCO_OS_LINUX
+    for (std::size_t i = 0; i < kStartupDBSuffixCount; i++) {
+      std::string path = std::string(kStartupDB) + kStartupDBSuffixes[i];
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        continue;
+      }
+      // Dirty pages stay in the cache
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Starts a context on the startup database the way the UI does,
+  // up to the first list of time entries and the timer
+  StartupPhases startOnce() {
+    StartupPhases phases;
+    char err[256];
+    Poco::Stopwatch stopwatch;
+
+    stopwatch.start();
+    void *ctx = kopsik_context_init("kopsik_bench", "0.1",
+      onStartupChange, onStartupError, onStartupCheckUpdate,
+      onStartupOnline);
+    stopwatch.stop();
+    phases.context_init = stopwatch.elapsed();
+    poco_assert(ctx);
+    // Background sync has nowhere to go
+    kopsik_set_api_url(ctx, "https://localhost:1");
+    kopsik_set_websocket_url(ctx, "wss://localhost:1");
+
+    stopwatch.restart();
+    kopsik_api_result res = kopsik_set_db_path(ctx, err, sizeof(err),
+                                               kStartupDB);
+    stopwatch.stop();
+    phases.set_db_path = stopwatch.elapsed();
+    poco_assert(KOPSIK_API_SUCCESS == res);
+
+    KopsikUser *user = kopsik_user_init();
+    stopwatch.restart();
+    res = kopsik_current_user(ctx, err, sizeof(err), user);
+    stopwatch.stop();
+    phases.current_user = stopwatch.elapsed();
+    poco_assert(KOPSIK_API_SUCCESS == res);
+    kopsik_user_clear(user);
+
+    KopsikTimeEntryViewItem *first = 0;
+    stopwatch.restart();
+    res = kopsik_time_entry_view_items(ctx, err, sizeof(err), &first);
+    stopwatch.stop();
+    phases.time_entry_view_items = stopwatch.elapsed();
+    poco_assert(KOPSIK_API_SUCCESS == res);
+    kopsik_time_entry_view_item_clear(first);
+
+    KopsikTimeEntryViewItem *running = kopsik_time_entry_view_item_init();
+    int is_tracking(0);
+    stopwatch.restart();
+    res = kopsik_running_time_entry_view_item(ctx, err, sizeof(err),
+                                              running, &is_tracking);
+    stopwatch.stop();
+    phases.running_time_entry_view_item = stopwatch.elapsed();
+    poco_assert(KOPSIK_API_SUCCESS == res);
+    kopsik_time_entry_view_item_clear(running);
+
+    kopsik_context_clear(ctx);
+    return phases;
+  }
+
+  Poco::Int64 median(std::vector<Poco::Int64> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+  }
+
+  // Median of each phase over the rounds, which needn't add up to
+  // the median total
+  void writeStartupPhases(
+      const std::vector<StartupPhases> &rounds,
+      JSONWriter *writer) {
+    std::vector<Poco::Int64> context_init, set_db_path, current_user,
+      time_entry_view_items, running_time_entry_view_item, total;
+    for (std::vector<StartupPhases>::const_iterator it = rounds.begin();
+        it != rounds.end();
+        it++) {
+      context_init.push_back(it->context_init);
+      set_db_path.push_back(it->set_db_path);
+      current_user.push_back(it->current_user);
+      time_entry_view_items.push_back(it->time_entry_view_items);
+      running_time_entry_view_item.push_back(
+        it->running_time_entry_view_item);
+      total.push_back(it->Total());
+    }
+    writer->BeginObject();
+    writer->Int("rounds", rounds.size());
+    writer->Int("total_us", median(total));
+    writer->Int("context_init_us", median(context_init));
+    writer->Int("set_db_path_us", median(set_db_path));
+    writer->Int("current_user_us", median(current_user));
+    writer->Int("time_entry_view_items_us", median(time_entry_view_items));
+    writer->Int("running_time_entry_view_item_us",
+                median(running_time_entry_view_item));
+    writer->EndObject();
+  }
+
+  // Warm is with the database in the page cache, as when the app is
+  // restarted; cold is with it evicted, where that can be done
+  void benchStartup(const std::string &db_path, JSONWriter *writer) {
+    removeStartupDB();
+    Poco::File(db_path).copyTo(kStartupDB);
+
+    writer->BeginObject();
+    writer->String("db", db_path);
+    writer->Int("db_bytes", fileBytes(db_path));
+
+    startOnce();
+
+    std::vector<StartupPhases> warm;
+    for (int i = 0; i < kStartupRounds; i++) {
+      warm.push_back(startOnce());
+    }
+    writer->Key("warm");
+    writeStartupPhases(warm, writer);
+
+    std::vector<StartupPhases> cold;
+    for (int i = 0; i < kStartupRounds && evictStartupDB(); i++) {
+      cold.push_back(startOnce());
+    }
+    if (!cold.empty()) {
+      writer->Key("cold");
+      writeStartupPhases(cold, writer);
+    }
+
+    writer->EndObject();
+    removeStartupDB();
+  }
+
+  // Timeline runs feed events at each of these rates, per second, for
+  // this many seconds, unless told otherwise
+  const char kTimelineBenchDefaultRates[] = "100,1000,10000";
+  const int kTimelineBenchDefaultSeconds = 10;
+  // Once no more events come, what's left has this long to go out
+  const Poco::Timestamp::TimeDiff kTimelineBenchDrainMicros = 60000000;
+  // Queue depth and database size are looked at this often
+  const Poco::Timestamp::TimeDiff kTimelineBenchSampleMicros = 100000;
+  // When the database had nothing, the next batch is asked for after
+  const long kTimelineBenchIdleMillis = 10;  // NOLINT
+  const Poco::UInt64 kTimelineBenchUserID = 1;
+  // Virtual time between the starts of two events, far enough apart
+  // that none are coalesced
+  const std::time_t kTimelineBenchEventSeconds = 120;
+
+  // Goes through the dispatcher twice. The second time comes after
+  // any batch the database posted in answer to the request before it,
+  // so the uploader knows when there's none.
+  class TimelineBenchProbe : public Poco::Notification {
+  public:
+    explicit TimelineBenchProbe(const bool _again) : again(_again) {}
+    bool again;
+  };
+
+  // Runs the timeline pipeline of a context without the recorder,
+  // against FakeTogglAPI: events are posted as
+  // TimelineEventNotifications, the database stores them and selects
+  // batches on the dispatcher thread, and an upload thread turns each
+  // batch into JSON, POSTs it and has it deleted. Unlike
+  // TimelineUploader it asks for the next batch as soon as one is
+  // done, so what's measured is what the pipeline can take. Events
+  // come out in the order they went in, so the nth uploaded is the
+  // nth posted, which end-to-end latency is taken from.
+  class TimelineBench : public Poco::Runnable {
+  public:
+    explicit TimelineBench(const std::string &json)
+      : api_(json)
+      , center_(0)
+      , stopping_(false)
+      , answered_(true)
+      , uploaded_(0)
+      , batches_(0) {}
+
+    // Returns how long what was left took to go out once the last
+    // event was posted
+    Poco::Timestamp::TimeDiff Run(
+        const int rate,
+        const int seconds,
+        JSONWriter *writer) {
+      removeBenchDB();
+      std::size_t total = static_cast<std::size_t>(rate) * seconds;
+      posted_at_.assign(total, 0);
+      latencies_.clear();
+      stopping_ = false;
+      uploaded_ = 0;
+      batches_ = 0;
+
+      Poco::UInt64 max_queue_depth(0);
+      Poco::Int64 max_db_bytes(0);
+      Poco::Timestamp::TimeDiff elapsed(0);
+      Poco::Timestamp::TimeDiff drain_micros(0);
+      {
+        Poco::NotificationCenter center;
+        center_ = &center;
+        Database db(kBenchDB, DatabaseTuning(), center);
+        observe(true);
+        Poco::Thread uploader("timeline_bench_uploader");
+        uploader.start(*this);
+
+        std::time_t first_start = std::time(0)
+          - static_cast<std::time_t>(total) * kTimelineBenchEventSeconds;
+        Poco::Timestamp started;
+        Poco::Timestamp sampled_at(0);
+        std::size_t posted(0);
+        while (true) {
+          Poco::Timestamp::TimeDiff now = started.elapsed();
+          if (posted < total) {
+            std::size_t due = std::min(total, static_cast<std::size_t>(
+              Poco::Int64(rate) * now / Poco::Timestamp::resolution() + 1));
+            for (; posted < due; posted++) {
+              post(posted, first_start);
+            }
+            if (posted == total) {
+              drain_micros = now;
+            }
+          }
+          if (sampled_at.isElapsed(kTimelineBenchSampleMicros)) {
+            sampled_at.update();
+            max_queue_depth = std::max(max_queue_depth,
+                                       Poco::UInt64(posted - uploaded()));
+            max_db_bytes = std::max(max_db_bytes,
+              fileBytes(kBenchDB) + fileBytes(std::string(kBenchDB) + "-wal"));
+          }
+          if (uploaded() >= total
+              || (posted == total
+                  && now - drain_micros > kTimelineBenchDrainMicros)) {
+            break;
+          }
+          Poco::Thread::sleep(1);
+        }
+        elapsed = started.elapsed();
+        drain_micros = elapsed - drain_micros;
+
+        {
+          Poco::FastMutex::ScopedLock lock(m_);
+          stopping_ = true;
+        }
+        uploader.join();
+        // Whatever is still queued for the database goes first
+        TimelineDispatcher::Instance().Stop();
+        observe(false);
+        center_ = 0;
+      }
+      removeBenchDB();
+
+      writer->BeginObject();
+      writer->Int("rate", rate);
+      writer->Int("seconds", seconds);
+      writer->Int("posted", total);
+      writer->Int("uploaded", uploaded_);
+      writer->Int("batches", batches_);
+      writer->Int("events_per_second",
+                  Poco::Int64(uploaded_) * Poco::Timestamp::resolution()
+                  / std::max(elapsed, Poco::Timestamp::TimeDiff(1)));
+      writer->Int("max_queue_depth", max_queue_depth);
+      writer->Int("max_db_bytes", max_db_bytes);
+      writer->Int("drain_us", drain_micros);
+      if (!latencies_.empty()) {
+        writer->Int("latency_p50_us", median(latencies_));
+        writer->Int("latency_p99_us", p99(&latencies_));
+        writer->Int("latency_max_us", latencies_.back());
+      }
+      writer->EndObject();
+      return drain_micros;
+    }
+
+    // Upload thread
+    void run() {
+      while (true) {
+        {
+          Poco::FastMutex::ScopedLock lock(m_);
+          if (stopping_) {
+            return;
+          }
+        }
+        TimelineDispatcher::Instance().Post(
+          new CreateTimelineBatchNotification(
+            kTimelineBenchUserID, kTimelineUploadBatchSize, 0),
+          *center_);
+        TimelineDispatcher::Instance().Post(
+          new TimelineBenchProbe(true), *center_);
+        answered_.wait();
+
+        std::vector<TimelineEvent> batch;
+        std::string desktop_id("");
+        {
+          Poco::FastMutex::ScopedLock lock(m_);
+          batch.swap(batch_);
+          desktop_id = desktop_id_;
+        }
+        if (batch.empty()) {
+          Poco::Thread::sleep(kTimelineBenchIdleMillis);
+          continue;
+        }
+
+        std::string json =
+          TimelineUploader::convert_timeline_to_json(batch, desktop_id);
+        std::string response_body("");
+        error err = api_.PostJSON("/api/v8/timeline", json, "", "",
+                                  &response_body);
+        poco_assert(noError == err);
+        // Deleted before the next batch is selected, as it's queued
+        // ahead of the request
+        TimelineDispatcher::Instance().Post(
+          new DeleteTimelineBatchNotification(kTimelineBenchUserID,
+            batch.front().id, batch.back().id),
+          *center_);
+
+        Poco::Timestamp::TimeVal now = Poco::Timestamp().epochMicroseconds();
+        Poco::FastMutex::ScopedLock lock(m_);
+        for (std::size_t i = 0; i < batch.size(); i++) {
+          latencies_.push_back(now - posted_at_[uploaded_ + i]);
+        }
+        uploaded_ += batch.size();
+        batches_++;
+      }
+    }
+
+    void handleTimelineBatchReadyNotification(
+        TimelineBatchReadyNotification *notification) {
+      Poco::AutoPtr<TimelineBatchReadyNotification> ptr(notification);
+      Poco::FastMutex::ScopedLock lock(m_);
+      batch_.swap(notification->batch);
+      desktop_id_ = notification->desktop_id;
+    }
+
+    void handleTimelineBenchProbe(TimelineBenchProbe *notification) {
+      Poco::AutoPtr<TimelineBenchProbe> ptr(notification);
+      if (notification->again) {
+        TimelineDispatcher::Instance().Post(
+          new TimelineBenchProbe(false), *center_);
+        return;
+      }
+      answered_.set();
+    }
+
+  private:
+    void observe(const bool add) {
+      Poco::Observer<TimelineBench, TimelineBatchReadyNotification>
+        batch_ready(*this,
+                    &TimelineBench::handleTimelineBatchReadyNotification);
+      Poco::Observer<TimelineBench, TimelineBenchProbe>
+        probe(*this, &TimelineBench::handleTimelineBenchProbe);
+      if (add) {
+        center_->addObserver(batch_ready);
+        center_->addObserver(probe);
+      } else {
+        center_->removeObserver(batch_ready);
+        center_->removeObserver(probe);
+      }
+    }
+
+    // Two windows taking turns, a minute each
+    void post(const std::size_t n, const std::time_t first_start) {
+      TimelineEvent event;
+      event.user_id = kTimelineBenchUserID;
+      event.title = StringTable::Timeline().Intern(
+        n % 2 ? "Inbox (3) - Mail" : "benchmark.cc - \"src\"");
+      event.filename = StringTable::Timeline().Intern(
+        n % 2 ? "Mail" : "Sublime Text");
+      event.start_time = first_start + n * kTimelineBenchEventSeconds;
+      event.end_time = event.start_time + kSoakMinuteSeconds;
+      {
+        Poco::FastMutex::ScopedLock lock(m_);
+        posted_at_[n] = Poco::Timestamp().epochMicroseconds();
+      }
+      TimelineDispatcher::Instance().Post(
+        new TimelineEventNotification(event), *center_);
+    }
+
+    std::size_t uploaded() {
+      Poco::FastMutex::ScopedLock lock(m_);
+      return uploaded_;
+    }
+
+    FakeTogglAPI api_;
+    Poco::NotificationCenter *center_;
+    Poco::FastMutex m_;
+    bool stopping_;
+    Poco::Event answered_;
+    // Handed over by the database
+    std::vector<TimelineEvent> batch_;
+    std::string desktop_id_;
+    // When each event was posted, in epoch microseconds
+    std::vector<Poco::Int64> posted_at_;
+    std::vector<Poco::Int64> latencies_;
+    std::size_t uploaded_;
+    Poco::UInt64 batches_;
+  };
+
+  const char kWebSocketBenchDefaultBursts[] = "10,100,1000";
+  // Bursts of each size, each changing the same models again
+  const int kWebSocketBenchRounds = 5;
+  // A burst not applied by then has got stuck
+  const Poco::Timestamp::TimeDiff kWebSocketBenchTimeoutMicros =
+    60 * Poco::Timestamp::resolution();
+
+  Poco::FastMutex websocket_bench_m;
+  Poco::Int64 websocket_bench_callbacks = 0;
+
+  // Called on the worker that applied a batch, once per batch that
+  // changed anything
+  void onWebSocketBenchChanges(const std::vector<ModelChange> &changes) {
+    Poco::FastMutex::ScopedLock lock(websocket_bench_m);
+    websocket_bench_callbacks++;
+  }
+
+  // What an update frame needs to change a model the account has
+  typedef struct {
+    std::string model;
+    Poco::UInt64 id;
+    std::string guid;
+    Poco::UInt64 wid;
+    Poco::UInt64 pid;
+    Poco::UInt64 cid;
+    Poco::UInt64 start;
+    Poco::Int64 duration;
+    std::string color;
+    bool active;
+    bool billable;
+  } WebSocketBenchTarget;
+
+  // Replays bursts of update frames, seven in ten to time entries and
+  // the rest to projects and tasks, against a logged in context. Each
+  // frame is parsed from text and handed over as WebSocketClient does
+  // once it has read one off the socket, so what's measured is the
+  // path a real burst takes: Context::LoadUpdateFromJSONNode, the
+  // batch that collects the frames after kWebSocketUpdateDelayMicros,
+  // the save and the model changes callback. That delay is part of
+  // every burst, so small ones can't go faster than it allows.
+  class WebSocketBurstBench {
+  public:
+    explicit WebSocketBurstBench(const std::string &json)
+      : json_(json), api_(json), sent_(0) {}
+
+    void Run(const std::vector<int> &sizes, JSONWriter *writer) {
+      removeBenchDB();
+      {
+        Context context("kopsik_bench", "0.1");
+        context.SetModelChangesCallback(onWebSocketBenchChanges);
+        context.SetOnErrorCallback(onSoakError);
+        context.SetHTTPSClient(&api_);
+        context.SetDBPath(kBenchDB);
+        error err = context.SetLoggedInUserFromJSON(json_);
+        poco_assert(noError == err);
+
+        User *user = 0;
+        err = context.CurrentUser(&user);
+        poco_assert(noError == err);
+        collectTargets(user);
+        poco_assert(!time_entries_.empty());
+
+        for (std::vector<int>::const_iterator it = sizes.begin();
+            it != sizes.end();
+            it++) {
+          runBursts(&context, *it, writer);
+        }
+      }
+      removeBenchDB();
+    }
+
+  private:
+    void collectTargets(User *user) {
+      time_entries_.clear();
+      others_.clear();
+      for (std::vector<TimeEntry *>::const_iterator it =
+        user->related.TimeEntries.begin();
+          it != user->related.TimeEntries.end();
+          it++) {
+        TimeEntry *te = *it;
+        // Running entries are left alone, so the timer doesn't change
+        if (!te->ID() || te->DurationInSeconds() < 0) {
+          continue;
+        }
+        WebSocketBenchTarget target = targetFor("time_entry", *te);
+        target.wid = te->WID();
+        target.pid = te->PID();
+        target.start = te->Start();
+        target.duration = te->DurationInSeconds();
+        time_entries_.push_back(target);
+      }
+      for (std::vector<Project *>::const_iterator it =
+        user->related.Projects.begin();
+          it != user->related.Projects.end();
+          it++) {
+        Project *p = *it;
+        if (!p->ID()) {
+          continue;
+        }
+        WebSocketBenchTarget target = targetFor("project", *p);
+        target.wid = p->WID();
+        target.cid = p->CID();
+        target.color = p->Color();
+        target.active = p->Active();
+        target.billable = p->Billable();
+        others_.push_back(target);
+      }
+      for (std::vector<Task *>::const_iterator it =
+        user->related.Tasks.begin();
+          it != user->related.Tasks.end();
+          it++) {
+        Task *t = *it;
+        if (!t->ID()) {
+          continue;
+        }
+        WebSocketBenchTarget target = targetFor("task", *t);
+        target.wid = t->WID();
+        target.pid = t->PID();
+        others_.push_back(target);
+      }
+    }
+
+    template <class T>
+    static WebSocketBenchTarget targetFor(
+        const std::string &model,
+        const T &from) {
+      WebSocketBenchTarget target;
+      target.model = model;
+      target.id = from.ID();
+      target.guid = from.GUID();
+      target.wid = 0;
+      target.pid = 0;
+      target.cid = 0;
+      target.start = 0;
+      target.duration = 0;
+      target.active = true;
+      target.billable = false;
+      return target;
+    }
+
+    void runBursts(Context *context, const int size, JSONWriter *writer) {
+      Metrics &metrics = Metrics::Shared();
+      Poco::Int64 applied_before = metrics.Counter("websocket.updates");
+      Poco::Int64 batches_before = metrics.Counter("websocket.update_batches");
+      LatencyHistogram saves_before = metrics.Histogram("db.save.user");
+      Poco::Int64 callbacks_before = callbacks();
+      soak_errors = 0;
+
+      std::vector<Poco::Int64> burst_micros;
+      Poco::Int64 elapsed(0);
+      for (int round = 0; round < kWebSocketBenchRounds; round++) {
+        std::vector<std::string> frames;
+        for (int n = 0; n < size; n++) {
+          frames.push_back(frame(round, n));
+        }
+        Poco::Int64 applied = metrics.Counter("websocket.updates") + size;
+        Poco::Int64 batches = metrics.Counter("websocket.update_batches");
+        Poco::Int64 called = callbacks();
+
+        Poco::Timestamp started;
+        for (std::vector<std::string>::const_iterator it = frames.begin();
+            it != frames.end();
+            it++) {
+          deliver(context, *it);
+        }
+        while (metrics.Counter("websocket.updates") < applied) {
+          poco_assert(!started.isElapsed(kWebSocketBenchTimeoutMicros));
+          Poco::Thread::sleep(1);
+        }
+        // The batch that counted the last frame holds the user lock
+        // until it has saved
+        std::map<std::string, Poco::Int64> date_durations;
+        std::vector<TimeEntry *> visible;
+        error err = context->TimeEntries(&date_durations, &visible);
+        poco_assert(noError == err);
+        // Each batch changed something, so each tells the UI
+        batches = metrics.Counter("websocket.update_batches") - batches;
+        while (callbacks() - called < batches) {
+          poco_assert(!started.isElapsed(kWebSocketBenchTimeoutMicros));
+          Poco::Thread::sleep(1);
+        }
+        burst_micros.push_back(started.elapsed());
+        elapsed += burst_micros.back();
+      }
+
+      LatencyHistogram saves = metrics.Histogram("db.save.user");
+      Poco::Int64 applied =
+        metrics.Counter("websocket.updates") - applied_before;
+      Poco::Int64 save_count = saves.count - saves_before.count;
+      writer->BeginObject();
+      writer->Int("burst", size);
+      writer->Int("bursts", kWebSocketBenchRounds);
+      writer->Int("applied", applied);
+      writer->Int("updates_per_second",
+                  applied * Poco::Timestamp::resolution()
+                  / std::max(elapsed, Poco::Int64(1)));
+      writer->Int("burst_p50_us", median(burst_micros));
+      writer->Int("burst_max_us",
+                  *std::max_element(burst_micros.begin(),
+                                    burst_micros.end()));
+      writer->Int("batches",
+                  metrics.Counter("websocket.update_batches")
+                  - batches_before);
+      writer->Int("saves", save_count);
+      writer->Int("save_total_us",
+                  saves.total_micros - saves_before.total_micros);
+      writer->Int("save_mean_us", save_count
+                  ? (saves.total_micros - saves_before.total_micros)
+                    / save_count
+                  : 0);
+      writer->Int("ui_callbacks", callbacks() - callbacks_before);
+      writer->Int("errors", soak_errors);
+      writer->EndObject();
+    }
+
+    // As WebSocketClient does with a frame it has read
+    void deliver(Context *context, const std::string &text) {
+      JSONValue *root = JSONParse(text);
+      poco_assert(root);
+      if ("data" == WebSocketClient::MessageType(root)) {
+        on_websocket_message(context, root);
+      }
+      JSONDelete(root);
+    }
+
+    std::string frame(const int round, const int n) {
+      const WebSocketBenchTarget &target = (n % 10 < 7 || others_.empty())
+        ? time_entries_[(round * 7919 + n) % time_entries_.size()]
+        : others_[(round * 7919 + n) % others_.size()];
+      std::string label = "Burst " + Poco::NumberFormatter::format(round)
+        + "." + Poco::NumberFormatter::format(n);
+      // Later than anything the account had, and later each time
+      std::time_t at = std::time(0) + static_cast<std::time_t>(++sent_);
+
+      JSONWriter update;
+      update.BeginObject();
+      update.String("action", "UPDATE");
+      update.String("model", target.model);
+      update.Key("data");
+      update.BeginObject();
+      update.Int("id", target.id);
+      if (!target.guid.empty()) {
+        update.String("guid", target.guid);
+      }
+      update.Int("wid", target.wid);
+      if ("time_entry" == target.model) {
+        if (target.pid) {
+          update.Int("pid", target.pid);
+        }
+        update.String("description", label);
+        update.String("start", Formatter::Format8601(target.start));
+        update.String("stop",
+                      Formatter::Format8601(target.start + target.duration));
+        update.Int("duration", target.duration);
+      } else if ("project" == target.model) {
+        update.String("name", label);
+        update.Int("cid", target.cid);
+        update.String("color", target.color);
+        update.Bool("active", target.active);
+        update.Bool("billable", target.billable);
+      } else {
+        update.String("name", label);
+        update.Int("pid", target.pid);
+      }
+      update.String("at", Formatter::Format8601(at));
+      update.EndObject();
+      update.EndObject();
+      return update.Buffer();
+    }
+
+    Poco::Int64 callbacks() {
+      Poco::FastMutex::ScopedLock lock(websocket_bench_m);
+      return websocket_bench_callbacks;
+    }
+
+    const std::string &json_;
+    FakeTogglAPI api_;
+    std::vector<WebSocketBenchTarget> time_entries_;
+    // Projects and tasks
+    std::vector<WebSocketBenchTarget> others_;
+    Poco::UInt64 sent_;
+  };
+
+  std::string loadFile(const std::string &path) {
+    Poco::FileStream fis(path, std::ios::binary);
+    std::stringstream ss;
+    ss << fis.rdbuf();
+    return ss.str();
+  }
+
+  // What --check holds against the baselines --record keeps: the
+  // scenarios users wait on, each by its fastest round, so noise
+  // from the rest of the machine counts as little as it can.
+  // A scenario has regressed when it takes longer than its baseline
+  // plus the baseline's tolerance, in percent, plus kPerfSlackMicros.
+  const Poco::Int64 kPerfTolerancePercent = 25;
+  // Short scenarios jitter by more than any percentage of them
+  const Poco::Timestamp::TimeDiff kPerfSlackMicros = 2000;
+  // Timeline events are posted at this rate, per second, for this
+  // long, which is more than the pipeline can keep up with, and the
+  // drain is timed. Threads handing them over make it noisier, so
+  // it's run a few times and has more tolerance.
+  const int kPerfTimelineRate = 10000;
+  const int kPerfTimelineSeconds = 1;
+  const int kPerfTimelineRounds = 3;
+  const Poco::Int64 kPerfTimelineTolerancePercent = 50;
+  const char kPerfTimelineDrain[] = "Timeline::Drain";
+
+  struct PerfBaseline {
+    PerfBaseline() : micros(0), tolerance_percent(0) {}
+
+    Poco::Timestamp::TimeDiff micros;
+    Poco::Int64 tolerance_percent;
+  };
+
+  typedef std::map<std::string, PerfBaseline> PerfBaselines;
+
+  // Full sync parse, save and apply, the time entry list,
+  // autocomplete and the timeline, on the account in json
+  PerfBaselines perfMeasure(const std::string &json) {
+    std::vector<Bench *> benches;
+    benches.push_back(new LoadUserFromJSONStringBench(json));
+    benches.push_back(new SaveUserBench(json));
+    benches.push_back(new FullSyncBench(json));
+    benches.push_back(new TimeEntriesBench(json));
+    benches.push_back(new AutocompleteItemsBench(json));
+
+    PerfBaselines measured;
+    for (std::vector<Bench *>::const_iterator it = benches.begin();
+        it != benches.end();
+        it++) {
+      PerfBaseline &scenario = measured[(*it)->Name()];
+      scenario.micros = run(*it).min_micros;
+      scenario.tolerance_percent = kPerfTolerancePercent;
+      delete *it;
+    }
+
+    PerfBaseline &drain = measured[kPerfTimelineDrain];
+    drain.tolerance_percent = kPerfTimelineTolerancePercent;
+    TimelineBench timeline(json);
+    for (int i = 0; i < kPerfTimelineRounds; i++) {
+      JSONWriter ignored;
+      Poco::Timestamp::TimeDiff micros =
+        timeline.Run(kPerfTimelineRate, kPerfTimelineSeconds, &ignored);
+      if (!i || micros < drain.micros) {
+        drain.micros = micros;
+      }
+    }
+
+    removeBenchDB();
+    return measured;
+  }
+
+  error readPerfBaselines(const std::string &path, PerfBaselines *baselines) {
+    if (!Poco::File(path).exists()) {
+      return error("No baselines in " + path + ", make perf_baselines first");
+    }
+    JSONValue *root = JSONParse(loadFile(path));
+    if (!root) {
+      return error("Baselines in " + path + " are not JSON");
+    }
+    JSONValue *list = JSONGet(root, "baselines");
+    for (std::size_t i = 0; i < JSONSize(list); i++) {
+      JSONValue *item = JSONAt(list, i);
+      PerfBaseline &baseline = (*baselines)[JSONString(JSONGet(item, "name"))];
+      baseline.micros = JSONInt(JSONGet(item, "min_us"));
+      baseline.tolerance_percent =
+        JSONInt(JSONGet(item, "tolerance_percent"));
+    }
+    JSONDelete(root);
+    return noError;
+  }
+
+  void writePerfBaselines(
+      const std::string &data,
+      const PerfBaselines &measured,
+      JSONWriter *writer) {
+    writer->BeginObject();
+    writer->String("data", data);
+    writer->Key("baselines");
+    writer->BeginArray();
+    for (PerfBaselines::const_iterator it = measured.begin();
+        it != measured.end();
+        it++) {
+      writer->BeginObject();
+      writer->String("name", it->first);
+      writer->Int("min_us", it->second.micros);
+      writer->Int("tolerance_percent", it->second.tolerance_percent);
+      writer->EndObject();
+    }
+    writer->EndArray();
+    writer->EndObject();
+  }
+
+  // Scenarios without a baseline are listed, but can't regress, so
+  // one added since the baselines were kept doesn't fail the check
+  bool checkPerf(
+      const PerfBaselines &measured,
+      const PerfBaselines &baselines,
+      JSONWriter *writer) {
+    bool passed(true);
+    writer->Key("results");
+    writer->BeginArray();
+    for (PerfBaselines::const_iterator it = measured.begin();
+        it != measured.end();
+        it++) {
+      writer->BeginObject();
+      writer->String("name", it->first);
+      writer->Int("min_us", it->second.micros);
+      PerfBaselines::const_iterator baseline = baselines.find(it->first);
+      if (baseline != baselines.end()) {
+        const PerfBaseline &was = baseline->second;
+        Poco::Timestamp::TimeDiff limit = was.micros
+          + was.micros * was.tolerance_percent / 100 + kPerfSlackMicros;
+        bool regressed = it->second.micros > limit;
+        writer->Int("baseline_us", was.micros);
+        writer->Int("limit_us", limit);
+        writer->Bool("regressed", regressed);
+        if (regressed) {
+          passed = false;
+          std::cerr << it->first << " regressed: " << it->second.micros
+                    << "us, baseline " << was.micros
+                    << "us, limit " << limit << "us" << std::endl;
+        }
+      }
+      writer->EndObject();
+    }
+    writer->EndArray();
+    return passed;
+  }
+
+}  // namespace kopsik
+
+int main(int argc, char **argv) {
+  Poco::Logger::get("").setLevel(Poco::Message::PRIO_WARNING);
+
+  if (argc > 1 && std::string("--soak") == argv[1]) {
+    int hours(argc > 2 ? Poco::NumberParser::parse(argv[2])
+              : kopsik::kSoakDefaultHours);
+    std::string path(argc > 3 ? argv[3] : "testdata/me.json");
+    std::string json = kopsik::loadFile(path);
+
+    kopsik::JSONWriter writer;
+    writer.BeginObject();
+    writer.String("data", path);
+    writer.Int("hours", hours);
+    kopsik::Soak soak(json, hours);
+    bool steady = soak.Run(&writer);
+    writer.EndObject();
+
+    std::cout << writer.Buffer() << std::endl;
+    return steady ? 0 : 1;
+  }
+
+  if (argc > 1 && std::string("--timeline") == argv[1]) {
+    std::string rates(argc > 2 ? argv[2]
+                      : kopsik::kTimelineBenchDefaultRates);
+    int seconds(argc > 3 ? Poco::NumberParser::parse(argv[3])
+                : kopsik::kTimelineBenchDefaultSeconds);
+    std::string path(argc > 4 ? argv[4] : "testdata/me.json");
+    std::string json = kopsik::loadFile(path);
+
+    kopsik::JSONWriter writer;
+    writer.BeginObject();
+    writer.Key("timeline");
+    writer.BeginArray();
+    kopsik::TimelineBench bench(json);
+    Poco::StringTokenizer tokens(rates, ",",
+      Poco::StringTokenizer::TOK_IGNORE_EMPTY
+      | Poco::StringTokenizer::TOK_TRIM);
+    for (Poco::StringTokenizer::Iterator it = tokens.begin();
+        it != tokens.end();
+        it++) {
+      bench.Run(Poco::NumberParser::parse(*it), seconds, &writer);
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    std::cout << writer.Buffer() << std::endl;
+    return 0;
+  }
+
+  if (argc > 1 && std::string("--websocket") == argv[1]) {
+    std::string bursts(argc > 2 ? argv[2]
+                       : kopsik::kWebSocketBenchDefaultBursts);
+    std::string path(argc > 3 ? argv[3] : "testdata/me.json");
+    std::string json = kopsik::loadFile(path);
+
+    std::vector<int> sizes;
+    Poco::StringTokenizer tokens(bursts, ",",
+      Poco::StringTokenizer::TOK_IGNORE_EMPTY
+      | Poco::StringTokenizer::TOK_TRIM);
+    for (Poco::StringTokenizer::Iterator it = tokens.begin();
+        it != tokens.end();
+        it++) {
+      sizes.push_back(Poco::NumberParser::parse(*it));
+    }
+
+    kopsik::JSONWriter writer;
+    writer.BeginObject();
+    writer.String("data", path);
+    writer.Int("data_bytes", json.size());
+    writer.Key("websocket");
+    writer.BeginArray();
+    kopsik::WebSocketBurstBench bench(json);
+    bench.Run(sizes, &writer);
+    writer.EndArray();
+    writer.EndObject();
+
+    std::cout << writer.Buffer() << std::endl;
+    return 0;
+  }
+
+  if (argc > 2 && (std::string("--check") == argv[1]
+                   || std::string("--record") == argv[1])) {
+    bool record(std::string("--record") == argv[1]);
+    std::string baselines_path(argv[2]);
+    std::string path(argc > 3 ? argv[3] : "testdata/me.json");
+
+    kopsik::PerfBaselines baselines;
+    // Without baselines kept on this machine, the scenarios are only
+    // timed, see checkPerf
+    if (!record && !Poco::File(baselines_path).exists()) {
+      std::cerr << "No baselines in " << baselines_path
+                << ", only timing; make perf_baselines to compare"
+                << std::endl;
+    } else if (!record) {
+      kopsik::error err = kopsik::readPerfBaselines(baselines_path,
+                                                    &baselines);
+      if (err != kopsik::noError) {
+        std::cerr << err << std::endl;
+        return 1;
+      }
+    }
+
+    std::string json = kopsik::loadFile(path);
+    kopsik::PerfBaselines measured = kopsik::perfMeasure(json);
+
+    kopsik::JSONWriter writer;
+    if (record) {
+      kopsik::writePerfBaselines(path, measured, &writer);
+      Poco::FileOutputStream out(baselines_path,
+                                 std::ios::out | std::ios::trunc);
+      out << writer.Buffer() << std::endl;
+      std::cout << writer.Buffer() << std::endl;
+      return 0;
+    }
+
+    writer.BeginObject();
+    writer.String("data", path);
+    writer.String("baselines", baselines_path);
+    bool passed = kopsik::checkPerf(measured, baselines, &writer);
+    writer.Bool("passed", passed);
+    writer.EndObject();
+
+    std::cout << writer.Buffer() << std::endl;
+    return passed ? 0 : 1;
+  }
+
+  if (argc > 2 && std::string("--startup") == argv[1]) {
+    kopsik::JSONWriter writer;
+    writer.BeginObject();
+    writer.Key("startup");
+    writer.BeginArray();
+    for (int i = 2; i < argc; i++) {
+      kopsik::benchStartup(argv[i], &writer);
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    std::cout << writer.Buffer() << std::endl;
+    return 0;
+  }
+
+  std::string path(argc > 1 ? argv[1] : "testdata/me.json");
+  std::string json = kopsik::loadFile(path);
+
+  std::vector<kopsik::Bench *> benches;
+  benches.push_back(new kopsik::LoadUserFromJSONStringBench(json));
+  benches.push_back(new kopsik::UpdateJSONBench(json));
+  benches.push_back(new kopsik::SaveUserBench(json));
+  benches.push_back(new kopsik::LoadUserByIDBench(json));
+  benches.push_back(new kopsik::TimeEntriesBench(json));
+  benches.push_back(new kopsik::AutocompleteItemsBench(json));
+  benches.push_back(new kopsik::FullSyncBench(json));
+  benches.push_back(new kopsik::PartialSyncBench(json));
+  benches.push_back(new kopsik::Parse8601Bench());
+  benches.push_back(new kopsik::TimelineToJSONBench());
+
+  kopsik::JSONWriter writer;
+  writer.BeginObject();
+  writer.String("data", path);
+  writer.Int("data_bytes", json.size());
+  writer.Key("results");
+  writer.BeginArray();
+  for (std::vector<kopsik::Bench *>::const_iterator it = benches.begin();
+      it != benches.end();
+      it++) {
+    kopsik::BenchResult result = kopsik::run(*it);
+    writer.BeginObject();
+    writer.String("name", (*it)->Name());
+    writer.Int("rounds", result.rounds);
+    writer.Int("total_us", result.total_micros);
+    writer.Int("mean_us", result.total_micros / result.rounds);
+    writer.Int("min_us", result.min_micros);
+    writer.EndObject();
+    delete *it;
+  }
+  writer.EndArray();
+  writer.EndObject();
+
+  kopsik::removeBenchDB();
+
+  std::cout << writer.Buffer() << std::endl;
+  return 0;
+}
@@ -0,0 +1,60 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./binary_guid.h"
+
+#include <cstring>
+
+#include "Poco/MD5Engine.h"
+
+namespace kopsik {
+
+BinaryGUID BinaryGUID::Of(const std::string &text) {
+  BinaryGUID result;
+  if (text.empty() || parse(text, &result)) {
+    return result;
+  }
+  Poco::MD5Engine md5;
+  md5.update(text);
+  const Poco::DigestEngine::Digest &digest = md5.digest();
+  std::memcpy(result.bytes_, &digest[0], sizeof(result.bytes_));
+  return result;
+}
+
+int BinaryGUID::hexDigit(const char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+bool BinaryGUID::parse(const std::string &text, BinaryGUID *result) {
+  if (text.size() != 36) {
+    return false;
+  }
+  std::size_t byte(0);
+  for (std::size_t i = 0; i < text.size(); ) {
+    if (i == 8 || i == 13 || i == 18 || i == 23) {
+      if (text[i] != '-') {
+        return false;
+      }
+      i++;
+      continue;
+    }
+    int high = hexDigit(text[i]);
+    int low = hexDigit(text[i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    result->bytes_[byte++] = static_cast<unsigned char>(high * 16 + low);
+    i += 2;
+  }
+  return true;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,64 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_BINARY_GUID_H_
+#define SRC_BINARY_GUID_H_
+
+#include <cstring>
+#include <string>
+
+namespace kopsik {
+
+  // GUID as 16 bytes instead of its 36 character text, for keys that
+  // are hashed and compared a lot. Models keep the text as well, it's
+  // what the database, the API and the UI use.
+  // Comparing and hashing stay inline, they're done on every lookup.
+  class BinaryGUID {
+  public:
+    BinaryGUID() {
+      std::memset(bytes_, 0, sizeof(bytes_));
+    }
+
+    // The bytes of a GUID in the usual 8-4-4-4-12 hex digit layout,
+    // in either case. Any other text (there should be none, but the
+    // database doesn't enforce it) gets an MD5 of the text instead,
+    // so every text still has exactly one value. Empty text is null.
+    static BinaryGUID Of(const std::string &text);
+
+    bool IsNull() const {
+      return *this == BinaryGUID();
+    }
+
+    // The bytes are random already, so any of them make a good hash
+    std::size_t Hash() const {
+      std::size_t hash;
+      std::memcpy(&hash, bytes_, sizeof(hash));
+      return hash;
+    }
+
+    bool operator==(const BinaryGUID &other) const {
+      return std::memcmp(bytes_, other.bytes_, sizeof(bytes_)) == 0;
+    }
+    bool operator!=(const BinaryGUID &other) const {
+      return !(*this == other);
+    }
+    bool operator<(const BinaryGUID &other) const {
+      return std::memcmp(bytes_, other.bytes_, sizeof(bytes_)) < 0;
+    }
+
+  private:
+    static int hexDigit(const char c);
+
+    static bool parse(const std::string &text, BinaryGUID *result);
+
+    unsigned char bytes_[16];
+  };
+
+  struct BinaryGUIDHash {
+    std::size_t operator()(const BinaryGUID &value) const {
+      return value.Hash();
+    }
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_BINARY_GUID_H_
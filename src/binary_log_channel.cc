@@ -0,0 +1,218 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./binary_log_channel.h"
+
+#include <algorithm>
+
+namespace kopsik {
+
+BinaryLogChannel::BinaryLogChannel(const std::string &path)
+  : path_(path)
+  , out_(0)
+  , last_time_(0) {
+  block_.reserve(kBinaryLogBlockBytes);
+}
+
+void BinaryLogChannel::open() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  openFile();
+}
+
+void BinaryLogChannel::close() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  flush();
+  if (out_) {
+    out_->close();
+    delete out_;
+    out_ = 0;
+  }
+}
+
+void BinaryLogChannel::log(const Poco::Message &msg) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  openFile();
+  // Times grow, so each is written as the difference to the
+  // time before it
+  Poco::UInt64 time = msg.getTime().epochMicroseconds();
+  putVarint(time >= last_time_ ? time - last_time_ : 0);
+  last_time_ = std::max(time, last_time_);
+  block_ += static_cast<char>(msg.getPriority());
+  putVarint(msg.getTid());
+  putString(msg.getSource());
+  putString(msg.getText());
+
+  std::vector<std::string> names;
+  fieldNames(msg, &names);
+  putVarint(names.size());
+  for (std::vector<std::string>::const_iterator it = names.begin();
+      it != names.end();
+      it++) {
+    putString(*it);
+    putString(msg[*it]);
+  }
+
+  if (block_.size() >= kBinaryLogBlockBytes) {
+    flush();
+  }
+}
+
+error BinaryLogChannel::Read(
+    const std::string &data, std::vector<BinaryLogRecord> *records) {
+  if (data.size() < 5 || data.compare(0, 4, kBinaryLogMagic, 4) != 0) {
+    return error("Not a binary log");
+  }
+  std::size_t pos = 4;
+  Poco::UInt64 version(0);
+  if (!getVarint(data, &pos, &version) || version != kBinaryLogVersion) {
+    return error("Unknown binary log version");
+  }
+  Poco::UInt64 time(0);
+  while (pos < data.size()) {
+    BinaryLogRecord record;
+    Poco::UInt64 delta(0), field_count(0);
+    if (!getVarint(data, &pos, &delta) || pos >= data.size()) {
+      return error("Binary log is cut short");
+    }
+    time += delta;
+    record.time = time;
+    record.priority = static_cast<unsigned char>(data[pos++]);
+    if (!getVarint(data, &pos, &record.thread)
+        || !getString(data, &pos, &record.source)
+        || !getString(data, &pos, &record.text)
+        || !getVarint(data, &pos, &field_count)) {
+      return error("Binary log is cut short");
+    }
+    for (Poco::UInt64 i = 0; i < field_count; i++) {
+      std::pair<std::string, std::string> field;
+      if (!getString(data, &pos, &field.first)
+          || !getString(data, &pos, &field.second)) {
+        return error("Binary log is cut short");
+      }
+      record.fields.push_back(field);
+    }
+    records->push_back(record);
+  }
+  return noError;
+}
+
+BinaryLogChannel::~BinaryLogChannel() {
+  close();
+}
+
+void BinaryLogChannel::openFile() {
+  if (out_) {
+    return;
+  }
+  out_ = new Poco::FileOutputStream(path_,
+                                    std::ios::out | std::ios::trunc
+                                    | std::ios::binary);
+  last_time_ = 0;
+  std::string header(kBinaryLogMagic, 4);
+  appendVarint(&header, kBinaryLogVersion);
+  out_->write(header.data(), header.size());
+}
+
+void BinaryLogChannel::flush() {
+  if (block_.empty()) {
+    return;
+  }
+  openFile();
+  out_->write(block_.data(), block_.size());
+  out_->flush();
+  block_.clear();
+}
+
+void BinaryLogChannel::fieldNames(
+    const Poco::Message &msg, std::vector<std::string> *names) {
+  if (msg.getText().find('=') == std::string::npos) {
+    return;
+  }
+  try {
+    splitLines(msg[kLogFieldNames], names);
+  } catch(const Poco::NotFoundException &) {
+    names->clear();
+  }
+}
+
+void BinaryLogChannel::splitLines(
+    const std::string &value, std::vector<std::string> *lines) {
+  std::string::size_type start = 0;
+  while (start <= value.size()) {
+    std::string::size_type end = value.find('\n', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    lines->push_back(value.substr(start, end - start));
+    start = end + 1;
+  }
+}
+
+void BinaryLogChannel::putVarint(const Poco::UInt64 value) {
+  appendVarint(&block_, value);
+}
+
+void BinaryLogChannel::appendVarint(std::string *out, Poco::UInt64 value) {
+  while (value >= 0x80) {
+    *out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  *out += static_cast<char>(value);
+}
+
+void BinaryLogChannel::putString(const std::string &value) {
+  putVarint(value.size());
+  block_ += value;
+}
+
+bool BinaryLogChannel::getVarint(
+    const std::string &data, std::size_t *pos, Poco::UInt64 *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *pos < data.size(); shift += 7) {
+    unsigned char byte = static_cast<unsigned char>(data[(*pos)++]);
+    *value |= static_cast<Poco::UInt64>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BinaryLogChannel::getString(
+    const std::string &data, std::size_t *pos, std::string *value) {
+  Poco::UInt64 size(0);
+  if (!getVarint(data, pos, &size) || size > data.size() - *pos) {
+    return false;
+  }
+  value->assign(data, *pos, static_cast<std::size_t>(size));
+  *pos += static_cast<std::size_t>(size);
+  return true;
+}
+
+PriorityRouteChannel::PriorityRouteChannel(
+    Poco::Channel *important, Poco::Channel *verbose, const int verbose_from)
+  : important_(important, true)
+  , verbose_(verbose, true)
+  , verbose_from_(verbose_from) {
+  poco_assert(important);
+  poco_assert(verbose);
+}
+
+void PriorityRouteChannel::open() {
+  important_->open();
+  verbose_->open();
+}
+
+void PriorityRouteChannel::close() {
+  important_->close();
+  verbose_->close();
+}
+
+void PriorityRouteChannel::log(const Poco::Message &msg) {
+  if (msg.getPriority() >= verbose_from_) {
+    verbose_->log(msg);
+  } else {
+    important_->log(msg);
+  }
+}
+
+}  // namespace kopsik
@@ -0,0 +1,137 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_BINARY_LOG_CHANNEL_H_
+#define SRC_BINARY_LOG_CHANNEL_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./log.h"
+#include "./types.h"
+
+#include "Poco/AutoPtr.h"
+#include "Poco/Bugcheck.h"
+#include "Poco/Channel.h"
+#include "Poco/Exception.h"
+#include "Poco/FileStream.h"
+#include "Poco/Message.h"
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  const char kBinaryLogMagic[] = "KLOG";
+  // Bumped whenever the record layout changes
+  const Poco::UInt32 kBinaryLogVersion = 1;
+  // Records are collected into blocks of about this size
+  // before they're written out
+  const std::size_t kBinaryLogBlockBytes = 64 * 1024;
+
+  // One message as read back from a binary log
+  typedef struct {
+    // Microseconds since the epoch
+    Poco::UInt64 time;
+    int priority;
+    Poco::UInt64 thread;
+    std::string source;
+    std::string text;
+    // As set on the message, see KOPSIK_LOG_FIELDS
+    std::vector<std::pair<std::string, std::string> > fields;
+  } BinaryLogRecord;
+
+  // Writes messages to a file in a compact binary form, for trace
+  // logging that's too much to format as text as it happens. A
+  // record is the time, priority and thread of the message, its
+  // source and text, and its fields, with numbers and lengths as
+  // varints. Reading the file back goes through Read.
+  class BinaryLogChannel : public Poco::Channel {
+  public:
+    explicit BinaryLogChannel(const std::string &path);
+
+    void open();
+
+    void close();
+
+    void log(const Poco::Message &msg);
+
+    // Records of a whole binary log. Fails on anything that isn't
+    // one, and on a record cut short, after reading those before it.
+    static error Read(
+        const std::string &data,
+        std::vector<BinaryLogRecord> *records);
+
+  protected:
+    ~BinaryLogChannel();
+
+  private:
+    // Call with mutex_ held. The header goes straight to the file,
+    // ahead of any record buffered after it.
+    void openFile();
+
+    // Call with mutex_ held
+    void flush();
+
+    // Only the fields of KOPSIK_LOG_FIELDS are known by name. Asking
+    // Poco::Message for a parameter it doesn't have throws, so
+    // messages without key=value in the text aren't asked.
+    static void fieldNames(
+        const Poco::Message &msg,
+        std::vector<std::string> *names);
+
+    static void splitLines(
+        const std::string &value,
+        std::vector<std::string> *lines);
+
+    void putVarint(const Poco::UInt64 value);
+
+    static void appendVarint(std::string *out, Poco::UInt64 value);
+
+    void putString(const std::string &value);
+
+    static bool getVarint(
+        const std::string &data,
+        std::size_t *pos,
+        Poco::UInt64 *value);
+
+    static bool getString(
+        const std::string &data,
+        std::size_t *pos,
+        std::string *value);
+
+    std::string path_;
+    Poco::FileOutputStream *out_;
+    std::string block_;
+    Poco::UInt64 last_time_;
+    Poco::FastMutex mutex_;
+  };
+
+  // Sends messages at or below a priority (the less important ones,
+  // trace by default) to one channel, and the rest to another, so
+  // trace logging can go to a BinaryLogChannel while the text log
+  // stays readable.
+  class PriorityRouteChannel : public Poco::Channel {
+  public:
+    PriorityRouteChannel(
+        Poco::Channel *important,
+        Poco::Channel *verbose,
+        const int verbose_from = Poco::Message::PRIO_TRACE);
+
+    void open();
+
+    void close();
+
+    void log(const Poco::Message &msg);
+
+  protected:
+    ~PriorityRouteChannel() {}
+
+  private:
+    Poco::AutoPtr<Poco::Channel> important_;
+    Poco::AutoPtr<Poco::Channel> verbose_;
+    int verbose_from_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_BINARY_LOG_CHANNEL_H_
@@ -0,0 +1,130 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./change_journal.h"
+
+#include <cstring>
+
+#include "Poco/Checksum.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+
+namespace kopsik {
+
+ChangeJournal::ChangeJournal(const std::string &path, const std::string &owner)
+  : path_(path)
+  , owner_(owner.substr(0, kChangeJournalOwnerBytes))
+  , begin_(0) {}
+
+error ChangeJournal::Append(const std::string &record) {
+  error err = open();
+  if (err != noError) {
+    return err;
+  }
+  Poco::UInt32 end = getUInt32(begin_ + 8);
+  if (kChangeJournalBytes - end
+      < kChangeJournalRecordHeaderBytes + record.size()) {
+    return error("Change journal is full");
+  }
+  Poco::Checksum crc;
+  crc.update(record);
+  char *at = begin_ + end;
+  putUInt32(at, static_cast<Poco::UInt32>(record.size()));
+  putUInt32(at + 4, crc.checksum());
+  std::memcpy(at + kChangeJournalRecordHeaderBytes,
+              record.data(), record.size());
+  putUInt32(begin_ + 8, end + kChangeJournalRecordHeaderBytes
+            + static_cast<Poco::UInt32>(record.size()));
+  return noError;
+}
+
+error ChangeJournal::Read(std::vector<std::string> *records) {
+  error err = open();
+  if (err != noError) {
+    return err;
+  }
+  Poco::UInt32 end = getUInt32(begin_ + 8);
+  Poco::UInt32 pos = kChangeJournalHeaderBytes;
+  while (end - pos >= kChangeJournalRecordHeaderBytes) {
+    Poco::UInt32 size = getUInt32(begin_ + pos);
+    Poco::UInt32 checksum = getUInt32(begin_ + pos + 4);
+    pos += kChangeJournalRecordHeaderBytes;
+    if (size > end - pos) {
+      return error("Change journal is damaged");
+    }
+    std::string record(begin_ + pos, size);
+    Poco::Checksum crc;
+    crc.update(record);
+    if (crc.checksum() != checksum) {
+      return error("Change journal is damaged");
+    }
+    records->push_back(record);
+    pos += size;
+  }
+  return noError;
+}
+
+error ChangeJournal::Truncate() {
+  error err = open();
+  if (err != noError) {
+    return err;
+  }
+  putUInt32(begin_ + 8, kChangeJournalHeaderBytes);
+  return noError;
+}
+
+bool ChangeJournal::Empty() {
+  return open() != noError
+    || getUInt32(begin_ + 8) == kChangeJournalHeaderBytes;
+}
+
+error ChangeJournal::open() {
+  if (begin_) {
+    return noError;
+  }
+  try {
+    Poco::File file(path_);
+    bool fresh = !file.exists()
+      || file.getSize() != kChangeJournalBytes;
+    if (fresh) {
+      file.createFile();
+      file.setSize(kChangeJournalBytes);
+    }
+    mapped_ = Poco::SharedMemory(file, Poco::SharedMemory::AM_WRITE);
+    char *begin = mapped_.begin();
+    if (!fresh
+        && (std::memcmp(begin, kChangeJournalMagic, 4) != 0
+            || getUInt32(begin + 4) != kChangeJournalVersion
+            || getUInt32(begin + 8) < kChangeJournalHeaderBytes
+            || getUInt32(begin + 8) > kChangeJournalBytes
+            || getUInt32(begin + 12) != owner_.size()
+            || owner_.compare(0, owner_.size(),
+                              begin + 16, owner_.size()) != 0)) {
+      fresh = true;
+    }
+    if (fresh) {
+      std::memcpy(begin, kChangeJournalMagic, 4);
+      putUInt32(begin + 4, kChangeJournalVersion);
+      putUInt32(begin + 8, kChangeJournalHeaderBytes);
+      putUInt32(begin + 12, static_cast<Poco::UInt32>(owner_.size()));
+      std::memcpy(begin + 16, owner_.data(), owner_.size());
+    }
+    begin_ = begin;
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  }
+  return noError;
+}
+
+Poco::UInt32 ChangeJournal::getUInt32(const char *at) {
+  Poco::UInt32 value(0);
+  std::memcpy(&value, at, sizeof(value));
+  return value;
+}
+
+void ChangeJournal::putUInt32(char *at, const Poco::UInt32 value) {
+  std::memcpy(at, &value, sizeof(value));
+}
+
+}  // namespace kopsik
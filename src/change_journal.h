@@ -0,0 +1,73 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_CHANGE_JOURNAL_H_
+#define SRC_CHANGE_JOURNAL_H_
+
+#include <string>
+#include <vector>
+
+#include "./types.h"
+
+#include "Poco/SharedMemory.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  const char kChangeJournalMagic[] = "KCJN";
+  // Bumped whenever the layout changes, so older files are ignored
+  const Poco::UInt32 kChangeJournalVersion = 1;
+  // Size of the file. Edits between two saves take a few hundred
+  // bytes each, so this is only full when saving keeps failing.
+  const Poco::UInt32 kChangeJournalBytes = 1024 * 1024;
+  // Room for the owner in the header
+  const Poco::UInt32 kChangeJournalOwnerBytes = 64;
+  // Magic, version, the end of the last record and the owner
+  const Poco::UInt32 kChangeJournalHeaderBytes =
+    16 + kChangeJournalOwnerBytes;
+  // Size and CRC-32 of the record
+  const Poco::UInt32 kChangeJournalRecordHeaderBytes = 8;
+
+  // Records of edits that are not saved into the database yet, in a
+  // memory-mapped file next to it. Appending is copying the record
+  // into the mapping, so it can be done right as the edit is made,
+  // and it's in the file as soon as it's copied: if the app crashes
+  // before the save that follows, the records are still there to be
+  // replayed on the next start. The end of the last record is
+  // written after the record, so a record cut short isn't read.
+  //
+  // A record is its size and CRC-32, followed by as many bytes.
+  // What's in them is up to the caller. The journal belongs to an
+  // owner, the database it's kept for, and one found with another
+  // owner is started over. Not thread safe.
+  class ChangeJournal {
+  public:
+    ChangeJournal(const std::string &path, const std::string &owner);
+
+    error Append(const std::string &record);
+
+    // The records in the order they were appended, up to the
+    // first that's damaged
+    error Read(std::vector<std::string> *records);
+
+    // Drops the records, once what they recorded is saved
+    error Truncate();
+
+    bool Empty();
+
+  private:
+    // Maps the file, creating it first if it's missing, and starts
+    // it over if it isn't a journal of this version and owner
+    error open();
+
+    static Poco::UInt32 getUInt32(const char *at);
+    static void putUInt32(char *at, const Poco::UInt32 value);
+
+    std::string path_;
+    std::string owner_;
+    Poco::SharedMemory mapped_;
+    char *begin_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_CHANGE_JOURNAL_H_
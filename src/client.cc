@@ -5,6 +5,9 @@
 #include <sstream>
 #include <cstring>
 
+#include "./json_key.h"
+#include "./memory_usage.h"
+
 namespace kopsik {
 
 std::string Client::String() const {
@@ -17,17 +20,22 @@ std::string Client::String() const {
   return ss.str();
 }
 
-void Client::SetName(const std::string value) {
+std::size_t Client::MemoryBytes() const {
+  return sizeof(*this) + ownedBytes()
+    + StringBytes(name_);
+}
+
+void Client::SetName(const std::string &value) {
   if (name_ != value) {
     name_ = value;
-    dirty_ = true;
+    SetDirty();
   }
 }
 
 void Client::SetWID(const Poco::UInt64 value) {
   if (wid_ != value) {
     wid_ = value;
-    dirty_ = true;
+    SetDirty();
   }
 }
 
@@ -35,24 +43,33 @@ bool CompareClientByName(Client *a, Client *b) {
   return (strcmp(a->Name().c_str(), b->Name().c_str()) < 0);
 }
 
-void Client::LoadFromJSONNode(JSONNODE * const data) {
-  poco_assert(data);
-
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
-  while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "id") == 0) {
-      SetID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "name") == 0) {
-      SetName(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "guid") == 0) {
-      SetGUID(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "wid") == 0) {
-      SetWID(json_as_int(*current_node));
-    }
-    ++current_node;
-  }
+static const ModelField<Client> kClientFields[] = {
+  UIntField<Client>("id", kJSONKeyID,
+    kFieldStored | kFieldLoaded,
+    &Client::ID, &Client::SetID),
+  UIntField<Client>("uid", kJSONKeyUnknown,
+    kFieldStored,
+    &Client::UID, &Client::SetUID),
+  StringField<Client>("name", kJSONKeyName,
+    kFieldStored | kFieldLoaded,
+    &Client::Name, &Client::SetName),
+  StringField<Client>("guid", kJSONKeyGUID,
+    kFieldStored | kFieldLoaded | kFieldOptional,
+    &Client::GUID, &Client::SetGUID),
+  UIntField<Client>("wid", kJSONKeyWID,
+    kFieldStored | kFieldLoaded,
+    &Client::WID, &Client::SetWID)
+};
+
+static const ModelSchema<Client> kClientSchema("clients", kClientFields,
+    sizeof(kClientFields) / sizeof(kClientFields[0]));
+
+const ModelSchema<Client> &Client::Schema() {
+  return kClientSchema;
+}
+
+void Client::LoadFromJSONNode(JSONValue * const data) {
+  Schema().LoadFromJSONNode(data, this);
 }
 
 }   // namespace kopsik
@@ -7,7 +7,8 @@
 
 #include "./types.h"
 
-#include "libjson.h" // NOLINT
+#include "./json_reader.h"
+#include "./model_schema.h"
 
 #include "Poco/Types.h"
 
@@ -25,20 +26,26 @@ namespace kopsik {
     Poco::UInt64 WID() const { return wid_; }
     void SetWID(const Poco::UInt64 value);
 
-    std::string Name() const { return name_; }
-    void SetName(const std::string value);
+    const std::string &Name() const { return name_; }
+    void SetName(const std::string &value);
 
     std::string String() const;
+    std::size_t MemoryBytes() const;
 
     std::string ModelName() const { return "client"; }
     std::string ModelURL() const { return "/api/v8/clients"; }
 
-    void LoadFromJSONNode(JSONNODE * const);
+    // Fields as stored and sent, listed once
+    static const ModelSchema<Client> &Schema();
+
+    void LoadFromJSONNode(JSONValue * const);
+
+  protected:
+    bool namedInLabels() const { return true; }
 
   private:
     Poco::UInt64 wid_;
     std::string name_;
-    bool dirty_;
   };
 
   bool CompareClientByName(Client *a, Client *b);
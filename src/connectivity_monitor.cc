@@ -0,0 +1,88 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./connectivity_monitor.h"
+
+#include "Poco/Exception.h"
+#include "Poco/NotificationCenter.h"
+#include "Poco/SingletonHolder.h"
+#include "Poco/Net/SocketAddress.h"
+#include "Poco/Net/StreamSocket.h"
+
+namespace kopsik {
+
+ConnectivityChangedNotification::ConnectivityChangedNotification(
+    const bool _online)
+  : online(_online) {}
+
+ConnectivityMonitor::ConnectivityMonitor()
+  : offline_(false)
+  , failed_probes_(0) {}
+
+ConnectivityMonitor &ConnectivityMonitor::Instance() {
+  static Poco::SingletonHolder<ConnectivityMonitor> sh;
+  return *sh.get();
+}
+
+bool ConnectivityMonitor::IsOffline() const {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  return offline_;
+}
+
+bool ConnectivityMonitor::Reachable() {
+  {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    failed_probes_ = 0;
+    if (!offline_) {
+      return false;
+    }
+    offline_ = false;
+  }
+  Poco::NotificationCenter::defaultCenter().postNotification(
+    new ConnectivityChangedNotification(true));
+  return true;
+}
+
+bool ConnectivityMonitor::Unreachable() {
+  {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    if (offline_) {
+      return false;
+    }
+    offline_ = true;
+    failed_probes_ = 0;
+  }
+  Poco::NotificationCenter::defaultCenter().postNotification(
+    new ConnectivityChangedNotification(false));
+  return true;
+}
+
+bool ConnectivityMonitor::Probe(
+    const Poco::URI &uri, const Poco::Timespan &timeout) {
+  try {
+    Poco::Net::StreamSocket socket;
+    socket.connect(
+      Poco::Net::SocketAddress(uri.getHost(), uri.getPort()), timeout);
+    socket.close();
+  } catch(const Poco::Exception &) {
+    return false;
+  }
+  Reachable();
+  return true;
+}
+
+Poco::Timestamp::TimeDiff ConnectivityMonitor::NextProbeDelay() {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  Poco::Timestamp::TimeDiff delay(kConnectivityProbeMinMicros);
+  for (unsigned int i = 0;
+       i < failed_probes_ && delay < kConnectivityProbeMaxMicros;
+       i++) {
+    delay *= 2;
+  }
+  failed_probes_++;
+  if (delay > kConnectivityProbeMaxMicros) {
+    delay = kConnectivityProbeMaxMicros;
+  }
+  return delay;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,63 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_CONNECTIVITY_MONITOR_H_
+#define SRC_CONNECTIVITY_MONITOR_H_
+
+#include "Poco/Mutex.h"
+#include "Poco/Notification.h"
+#include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/URI.h"
+
+namespace kopsik {
+
+  // While offline, the server is tried this often, doubling
+  // with each failed attempt up to the max
+  const Poco::Timestamp::TimeDiff kConnectivityProbeMinMicros =
+    5 * Poco::Timestamp::resolution();
+  const Poco::Timestamp::TimeDiff kConnectivityProbeMaxMicros =
+    2 * 60 * Poco::Timestamp::resolution();
+
+  // Posted to the default notification center whenever
+  // the process goes offline or comes back online
+  class ConnectivityChangedNotification : public Poco::Notification {
+  public:
+    explicit ConnectivityChangedNotification(const bool _online);
+    bool online;
+  };
+
+  // Whether the server can be reached, as the OS reports it and as
+  // HTTPSClient requests and connectivity probes find out. Shared by
+  // all network clients, so that the first one to find the network
+  // gone pauses the others, instead of each one discovering the outage
+  // on its own after a timeout.
+  class ConnectivityMonitor {
+  public:
+    ConnectivityMonitor();
+
+    static ConnectivityMonitor &Instance();
+
+    bool IsOffline() const;
+
+    // Something got through. Returns true when back online.
+    bool Reachable();
+
+    // Network is gone. Returns true when it just went offline.
+    bool Unreachable();
+
+    // Tries to connect to the host of uri, without sending anything.
+    // Comes back online if it succeeds.
+    bool Probe(const Poco::URI &uri, const Poco::Timespan &timeout);
+
+    // Wait before the next probe, counting the failed ones
+    Poco::Timestamp::TimeDiff NextProbeDelay();
+
+  private:
+    bool offline_;
+    unsigned int failed_probes_;
+    mutable Poco::Mutex mutex_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_CONNECTIVITY_MONITOR_H_
@@ -4,9 +4,131 @@
 #define SRC_CONST_H_
 
 #define kIdleThresholdSeconds 300
+// While idle, the return is looked for this often. When the time
+// since the last input can't be told, it's tried again after a while.
+#define kIdleSampleWhileIdleSeconds 5
+#define kIdleSampleUnknownSeconds 60
+
+// Untracked time is suggested as a time entry once this much of it
+// went with one project and description
+#define kSuggestionMinSeconds 600
 
 #define kRequestThrottleMicros 2000000
 
+#define kSyncMaxDelayMicros 10000000
+
+// Default time limits of an HTTPS request, see HTTPSDeadlines
+#define kHTTPSConnectTimeoutMicros 10000000
+#define kHTTPSFirstByteTimeoutMicros 30000000
+#define kHTTPSTotalTimeoutMicros 180000000
+
+// Requests to one host are limited to this many per second, in
+// bursts of up to kHTTPSRequestBurst, see HTTPSRateLimiter.
+// A wait for the next request that's longer than the max isn't
+// waited out, the request is deferred instead.
+#define kHTTPSRequestsPerSecond 4
+#define kHTTPSRequestBurst 8
+#define kHTTPSRateLimitMaxWaitMicros 2000000
+// When the server is busy but doesn't say for how long, and
+// the longest time it's believed
+#define kHTTPSRetryAfterDefaultMicros 30000000
+#define kHTTPSRetryAfterMaxMicros 3600000000LL
+
+#define kSaveDelayMicros 250000
+
+#define kWebSocketUpdateDelayMicros 200000
+
+#define kTimeEntryListMaxDiffs 100
+
+#define kTimeEntryLoadDays 60
+
+// Stopped and pushed time entries older than this are moved to the
+// archive, see Database::ArchiveTimeEntries. Off unless asked for, as
+// archived entries drop out of the time entry list and search.
+#define kTimeEntryArchiveDays 0
+
+#define kBatchUpdateMaxModels 50
+
+// Rows of an import read, saved in one transaction and reported at
+// a time, see Context::ImportTimeEntries
+#define kImportChunkRows 1000
+
+// Models of a /me response parsed at a time by one thread, and how
+// many there must be before more threads are started
+#define kJSONDecodeChunkModels 256
+#define kJSONDecodeParallelMinModels 1000
+
+// Connections to a host that requests share, more wait for a turn
+#define kHTTPSMaxSessionsPerHost 6
+
+// How long resolved addresses are used, see DNSCache. While the
+// resolver fails, the last ones are used for another retry interval.
+#define kDNSCacheTTLMicros 300000000
+#define kDNSCacheRetryMicros 30000000
+// Head start an IPv6 address gets over IPv4 when connecting
+#define kHappyEyeballsDelayMicros 250000
+
+// Time entries a full sync downloads, older ones are downloaded when
+// the time entry list or a report gets to them
+#define kTimeEntryFetchDays 28
+
+// Requests a per-workspace fetch has in flight at once, and how many
+// date ranges it splits the time entries it loads into
+#define kWorkspaceFetchThreads 4
+#define kTimeEntryFetchRanges 4
+// A full sync interrupted longer ago than this starts over, rather
+// than going on from its checkpoint
+#define kSyncCheckpointMaxAgeSeconds 43200
+
+// Timeline events still on their way to the database when quitting
+// are dropped after this long
+#define kShutdownDrainMicros 1000000
+
+// Periodic full syncs, see FullSyncInterval. The WebSocket is
+// looked at every kFullSyncCheckMicros, and counts as down once it
+// has been so for kWebSocketDownThresholdMicros.
+#define kFullSyncHealthyIntervalMicros 86400000000LL
+#define kFullSyncDegradedIntervalMicros 1800000000LL
+#define kWebSocketDownThresholdMicros 300000000
+#define kFullSyncCheckMicros 300000000
+// Between full syncs, the recent time entries are compared with the
+// server's by checksum this often, see Context::Reconcile
+#define kReconcileIntervalMicros 900000000
+
+// Lookups over the user's models are brought up to date once
+// nothing has been edited or synced for this long, so the next
+// reader finds them ready
+#define kPrecomputeIdleMicros 1000000
+
+// Database upkeep runs this often, once nothing has been edited
+// or synced for a while, see Database::Maintain
+#define kDatabaseMaintenanceIntervalMicros 600000000
+#define kDatabaseMaintenanceIdleMicros 120000000
+#define kDatabaseAnalyzeIntervalMicros 86400000000LL
+// Free pages are given back once they are this part of the file
+#define kDatabaseVacuumFreePageRatio 0.25
+
+// A statement waits this long at most for another process writing
+// to the same database, sleeping a little longer each time, see
+// Database::busyHandler
+#define kDatabaseBusyTimeoutMillis 5000
+#define kDatabaseBusyMinSleepMillis 1
+#define kDatabaseBusyMaxSleepMillis 100
+// Upkeep is left to another process while it holds the lease on it,
+// and put off while the processes have had to wait for each other
+#define kDatabaseMaintenanceLeaseSeconds 300
+#define kDatabaseContentionQuietMicros 60000000
+
+// Rows deleted by one statement, see Database::deleteFromTable
+#define kDatabaseDeleteChunkSize 500
+
+// How often to look for changes another process has saved into the
+// database, see Database::ExternalChanges
+#define kExternalChangesCheckMicros 5000000
+
+// Latest spans of each thread sent along with feedback
+#define kFeedbackTraceSpans 100
+
 #define kAutocompleteItemTE  0
 #define kAutocompleteItemTask 1
 #define kAutocompleteItemProject 2
@@ -8,48 +8,280 @@
 
 #include "./context.h"
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+
+#include "./api_watchdog.h"
+#include "./const.h"
 #include "./formatter.h"
 #include "./json.h"
 #include "./time_entry.h"
-
+#include "./time_entry_digest.h"
+#include "./time_entry_groups.h"
+#include "./json_key.h"
+#include "./json_writer.h"
+#include "./log.h"
+#include "./memory_usage.h"
+#include "./metrics.h"
+#include "./model_pool.h"
+#include "./string_table.h"
+#include "./trace.h"
+#include "./version.h"
+
+#include "Poco/File.h"
+#include "Poco/LocalDateTime.h"
+#include "Poco/NotificationCenter.h"
+#include "Poco/Observer.h"
+#include "Poco/Stopwatch.h"
+#include "Poco/URI.h"
 #include "Poco/Util/Timer.h"
 #include "Poco/Util/TimerTask.h"
 #include "Poco/Util/TimerTaskAdapter.h"
 
 namespace kopsik {
 
+static LogComponent log_context = { "context", 0 };
+
+// Moves the loaded models that are not in the list yet into it.
+// Models are told apart by local ID, as all of them come from the
+// database, and the ones loaded already are kept as they are.
+template <typename T>
+static void mergeLoadedModels(
+    std::vector<T *> *loaded,
+    std::vector<T *> *list,
+    RelatedData *related,
+    std::vector<kopsik::ModelChange> *changes) {
+  std::set<Poco::Int64> local_ids;
+  for (typename std::vector<T *>::const_iterator it = list->begin();
+      it != list->end(); it++) {
+    local_ids.insert((*it)->LocalID());
+  }
+  for (typename std::vector<T *>::const_iterator it = loaded->begin();
+      it != loaded->end(); it++) {
+    T *model = *it;
+    if (local_ids.count(model->LocalID())) {
+      delete model;
+      continue;
+    }
+    list->push_back(model);
+    related->Track(model);
+    changes->push_back(kopsik::ModelChange(model, kopsik::ModelChange::Insert));
+  }
+  loaded->clear();
+}
+
+// Whether a model missing from a reload is gone from the database.
+// Time entries are only loaded since a time, so only those count.
+template <typename T>
+static bool inLoadWindow(const T *model, const Poco::UInt64 since) {
+  return true;
+}
+
+static bool inLoadWindow(const TimeEntry *model, const Poco::UInt64 since) {
+  return !since || model->Start() >= since;
+}
+
+// Replaces the models of the list with the ones loaded again after
+// another process saved into their table. Models with changes of
+// their own are kept, as their save wins anyway. Models no longer
+// in the database are deleted, and new ones are added.
+template <typename T>
+static void refreshLoadedModels(
+    std::vector<T *> *loaded,
+    std::vector<T *> *list,
+    const Poco::UInt64 since,
+    RelatedData *related,
+    std::vector<kopsik::ModelChange> *changes) {
+  std::map<Poco::Int64, T *> by_local_id;
+  for (typename std::vector<T *>::const_iterator it = loaded->begin();
+      it != loaded->end(); it++) {
+    by_local_id[(*it)->LocalID()] = *it;
+  }
+  loaded->clear();
+
+  std::vector<T *> refreshed;
+  refreshed.reserve(list->size());
+  for (typename std::vector<T *>::const_iterator it = list->begin();
+      it != list->end(); it++) {
+    T *model = *it;
+    typename std::map<Poco::Int64, T *>::iterator found =
+      by_local_id.find(model->LocalID());
+    if (!model->LocalID() || model->NeedsToBeSaved()) {
+      if (found != by_local_id.end()) {
+        delete found->second;
+        by_local_id.erase(found);
+      }
+      refreshed.push_back(model);
+      continue;
+    }
+    if (found != by_local_id.end()) {
+      T *reloaded = found->second;
+      by_local_id.erase(found);
+      related->Untrack(model);
+      delete model;
+      refreshed.push_back(reloaded);
+      related->Track(reloaded);
+      changes->push_back(
+        kopsik::ModelChange(reloaded, kopsik::ModelChange::Update));
+      continue;
+    }
+    if (!inLoadWindow(model, since)) {
+      refreshed.push_back(model);
+      continue;
+    }
+    changes->push_back(kopsik::ModelChange(model, kopsik::ModelChange::Delete));
+    related->Untrack(model);
+    delete model;
+  }
+
+  for (typename std::map<Poco::Int64, T *>::const_iterator
+      it = by_local_id.begin(); it != by_local_id.end(); it++) {
+    T *model = it->second;
+    refreshed.push_back(model);
+    related->Track(model);
+    changes->push_back(kopsik::ModelChange(model, kopsik::ModelChange::Insert));
+  }
+  list->swap(refreshed);
+}
+
+template <typename T>
+static void deleteLoadedModels(std::vector<T *> *loaded) {
+  for (typename std::vector<T *>::const_iterator it = loaded->begin();
+      it != loaded->end(); it++) {
+    delete *it;
+  }
+  loaded->clear();
+}
+
 Context::Context(
     const std::string app_name,
     const std::string app_version)
-  : db_(0),
+  : db_m_("context.db"),
+    db_(0),
+    time_entry_archive_days_(kTimeEntryArchiveDays),
+    db_opener_("db_opener"),
+    db_open_runnable_(*this, &Context::openDatabase),
+    db_opening_(false),
+    db_open_path_(""),
+    db_open_rollups_(false),
+    db_open_blocks_(false),
+    db_open_error_(""),
+    user_m_("context.user"),
     user_(0),
+    snapshot_version_(0),
+    running_timer_tracking_(false),
+    running_timer_version_(0),
     ws_client_(0),
+    autocomplete_query_pending_(false),
     timeline_uploader_(0),
+    timeline_over_websocket_(false),
     window_change_recorder_(0),
+    idle_detector_(0),
     app_name_(app_name),
     app_version_(app_version),
     api_url_(""),
     timeline_upload_url_(""),
+    https_client_(0),
+    settings_loaded_(false),
+    use_proxy_(false),
+    use_idle_detection_(false),
+    api_token_loaded_(false),
+    api_token_(""),
+    update_channel_loaded_(false),
     update_channel_(""),
     feedback_("", "", ""),
     on_model_change_callback_(0),
+    on_model_changes_callback_(0),
+    last_subscription_(0),
     on_error_callback_(0),
     on_check_update_callback_(0),
-    next_full_sync_at_(0),
-    next_partial_sync_at_(0),
+    on_online_callback_(0),
+    on_idle_callback_(0),
+    save_pending_(false),
+    related_data_loaded_(false),
+    autocomplete_index_file_current_(false),
+    autocomplete_index_file_generation_(0),
+    progressive_login_(false),
+    login_sync_pending_(false),
+    per_workspace_sync_(false),
+    sync_scheduler_(kRequestThrottleMicros, kSyncMaxDelayMicros),
+    sync_running_(SyncScheduler::None),
+    sync_downloading_(false),
+    sync_push_first_(false),
+    full_sync_interval_(kFullSyncHealthyIntervalMicros,
+                        kFullSyncDegradedIntervalMicros,
+                        kWebSocketDownThresholdMicros),
+    fetch_updates_held_(false),
+    timeline_settings_held_(false),
+    requests_cancellation_(new kopsik::HTTPSCancellation()),
     next_fetch_updates_at_(0),
-    next_update_timeline_settings_at_(0) {
+    next_update_timeline_settings_at_(0),
+    timeline_settings_sent_(""),
+    timeline_rollups_(false),
+    timeline_blocks_(false),
+    workers_(kopsik::WorkerPool::Shared()),
+    timer_(kopsik::SharedTimer()),
+    database_maintenance_scheduled_(false),
+    precompute_scheduled_(false),
+    external_changes_check_scheduled_(false),
+    connectivity_probe_scheduled_(false),
+    periodic_sync_scheduled_(false),
+    closing_(false) {
   Poco::ErrorHandler::set(&error_handler_);
-  Poco::Net::initializeSSL();
+
+  autocomplete_query_.id = 0;
+
+  kopsik::HTTPSSessionPool::Instance().Join();
+
+  notifications_.addObserver(
+    Poco::Observer<Context, TimelineEventNotification>(
+      *this, &Context::handleTimelineEventNotification));
+  // Connectivity is the same for every context
+  Poco::NotificationCenter::defaultCenter().addObserver(
+    Poco::Observer<Context, kopsik::ConnectivityChangedNotification>(
+      *this, &Context::handleConnectivityChangedNotification));
 }
 
 Context::~Context() {
+  notifications_.removeObserver(
+    Poco::Observer<Context, TimelineEventNotification>(
+      *this, &Context::handleTimelineEventNotification));
+  Poco::NotificationCenter::defaultCenter().removeObserver(
+    Poco::Observer<Context, kopsik::ConnectivityChangedNotification>(
+      *this, &Context::handleConnectivityChangedNotification));
+
+  // Tasks still running finish before what they use is deleted.
+  // The workers and the timer go on serving the other contexts.
+  {
+    Poco::Mutex::ScopedLock lock(timer_m_);
+    closing_ = true;
+    cancelScheduled();
+  }
+  workers_.Cancel(this);
+
+  tellSaved(&save_listeners_,
+            kopsik::error("Closed before the edit was saved"));
+
   if (window_change_recorder_) {
     Poco::Mutex::ScopedLock lock(window_change_recorder_m_);
     delete window_change_recorder_;
     window_change_recorder_ = 0;
   }
 
+  {
+    // Not deleted with the lock held, it may be telling us something
+    kopsik::IdleDetector *idle_detector(0);
+    {
+      Poco::Mutex::ScopedLock lock(idle_detector_m_);
+      idle_detector = idle_detector_;
+      idle_detector_ = 0;
+    }
+    delete idle_detector;
+  }
+
   if (timeline_uploader_) {
     Poco::Mutex::ScopedLock lock(timeline_uploader_m_);
     delete timeline_uploader_;
@@ -62,22 +294,83 @@ Context::~Context() {
     ws_client_ = 0;
   }
 
-  if (db_) {
-    Poco::Mutex::ScopedLock lock(db_m_);
-    delete db_;
+  {
+    Poco::Mutex::ScopedLock lock(pending_updates_m_);
+    for (std::vector<JSONValue *>::const_iterator it =
+        pending_updates_.begin();
+        it != pending_updates_.end();
+        it++) {
+      JSONDelete(*it);
+    }
+    pending_updates_.clear();
+  }
+
+  // Queued timeline notifications are delivered while db is still open
+  kopsik::TimelineDispatcher::Instance().Drain(notifications_);
+
+  {
+    InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+    delete database();
     db_ = 0;
   }
 
   if (user_) {
-    Poco::Mutex::ScopedLock lock(user_m_);
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
     delete user_;
     user_ = 0;
   }
 
-  Poco::Net::uninitializeSSL();
+  // Once no context is left, pooled connections are closed, and
+  // SSL uninitialized if they ever got to initialize it
+  kopsik::HTTPSSessionPool::Instance().Leave();
 }
 
 void Context::Shutdown() {
+  TraceSpan trace("Context::Shutdown");
+
+  Poco::Stopwatch stopwatch;
+  stopwatch.start();
+
+  // All are asked to stop first, so they wind down
+  // at the same time instead of one after the other
+  cancelRequests();
+  if (window_change_recorder_) {
+    Poco::Mutex::ScopedLock lock(window_change_recorder_m_);
+    window_change_recorder_->RequestStop();
+  }
+  if (ws_client_) {
+    Poco::Mutex::ScopedLock lock(ws_client_m_);
+    ws_client_->RequestStop();
+  }
+  if (timeline_uploader_) {
+    Poco::Mutex::ScopedLock lock(timeline_uploader_m_);
+    timeline_uploader_->RequestStop();
+  }
+
+  // Edits are never dropped, they're saved while the others stop
+  std::vector<SaveListener *> listeners;
+  kopsik::error saved = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (user_) {
+      std::vector<kopsik::ModelChange> changes;
+      kopsik::error err = loadPendingUpdates(&changes);
+      if (err != kopsik::noError) {
+        logger().error(err);
+      }
+      err = flushPendingSave(&changes);
+      if (err != kopsik::noError) {
+        logger().error(err);
+      }
+      saved = err;
+    } else {
+      saved = kopsik::error("Logged out before the edit was saved");
+    }
+    // Their background saves may not get to run anymore
+    listeners.swap(save_listeners_);
+  }
+  tellSaved(&listeners, saved);
+
   if (window_change_recorder_) {
     Poco::Mutex::ScopedLock lock(window_change_recorder_m_);
     window_change_recorder_->Stop();
@@ -91,20 +384,83 @@ void Context::Shutdown() {
     timeline_uploader_->Stop();
   }
 
-  // cancel tasks but allow them finish
+  // Recorded timeline events are written until the deadline,
+  // the rest would only be recorded again on the next start
+  Poco::Timestamp::TimeDiff drain_micros =
+    std::max(kShutdownDrainMicros - stopwatch.elapsed(),
+             Poco::Timestamp::TimeDiff(1));
+  std::size_t dropped =
+    kopsik::TimelineDispatcher::Instance().DrainWithin(notifications_,
+                                                       drain_micros);
+  if (dropped) {
+    Metrics::Shared().Count("shutdown.dropped_timeline_notifications",
+                            dropped);
+    std::stringstream ss;
+    ss << "Shutdown dropped " << dropped << " timeline notification(s)";
+    logger().warning(ss.str());
+  }
+
+  // cancel tasks but allow them finish. Waiting is not done under
+  // timer_m_, as the tasks still running may schedule more.
+  {
+    Poco::Mutex::ScopedLock lock(timer_m_);
+    cancelScheduled();
+  }
+  workers_.Cancel(this);
   {
     Poco::Mutex::ScopedLock lock(timer_m_);
-    timer_.cancel(true);
+    database_maintenance_scheduled_ = false;
+    precompute_scheduled_ = false;
+    external_changes_check_scheduled_ = false;
+    connectivity_probe_scheduled_ = false;
+    periodic_sync_scheduled_ = false;
+  }
+
+  // Next start loads the related data from the snapshot,
+  // unless it's saved again meanwhile
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (user_ && related_data_loaded_) {
+      std::vector<kopsik::ModelChange> changes;
+      kopsik::error err = flushPendingSave(&changes);
+      if (err == kopsik::noError) {
+        err = checkDatabase();
+      }
+      if (err == kopsik::noError) {
+        err = database()->SaveRelatedDataSnapshot(user_);
+      }
+      if (err == kopsik::noError) {
+        err = saveAutocompleteIndex();
+      }
+      if (err != kopsik::noError) {
+        logger().warning(err);
+      }
+    }
+    autocomplete_index_file_current_ = false;
+    Poco::FastMutex::ScopedLock stored_lock(stored_autocomplete_m_);
+    stored_autocomplete_ = 0;
+    stored_autocomplete_generations_.clear();
   }
 
   Poco::ThreadPool::defaultPool().joinAll();
+
+  // For the requests after the next start
+  {
+    Poco::Mutex::ScopedLock lock(cancellation_m_);
+    requests_cancellation_ = new kopsik::HTTPSCancellation();
+  }
+
+  stopwatch.stop();
+  Metrics::Shared().Time("shutdown", stopwatch.elapsed());
+  KOPSIK_LOG_FIELDS(logger(), PRIO_DEBUG, "Shutdown done",
+    LogFields().Add("ms", stopwatch.elapsed() / 1000));
 }
 
 kopsik::error Context::ConfigureProxy() {
   bool use_proxy(false);
   bool tmp(false);
   kopsik::Proxy proxy;
-  kopsik::error err = db_->LoadSettings(&use_proxy, &proxy, &tmp);
+  kopsik::error err = LoadSettings(&use_proxy, &proxy, &tmp);
   if (err != kopsik::noError) {
     return err;
   }
@@ -118,20 +474,19 @@ kopsik::error Context::ConfigureProxy() {
   return kopsik::noError;
 }
 
-kopsik::error Context::save() {
-  poco_assert(on_model_change_callback_);
+kopsik::error Context::save(std::vector<kopsik::ModelChange> *changes) {
+  poco_assert(changes);
 
+  TraceSpan trace("Context::save");
+
+  // Whatever was waiting for the delayed save goes in with this one
+  save_pending_ = false;
   try {
-    std::vector<kopsik::ModelChange> changes;
-    kopsik::error err = db_->SaveUser(user_, true, &changes);
+    kopsik::error err = checkDatabase();
     if (err != kopsik::noError) {
       return err;
     }
-    for (std::vector<kopsik::ModelChange>::const_iterator it = changes.begin();
-        it != changes.end();
-        it++) {
-      on_model_change_callback_(*it);
-    }
+    return database()->SaveUser(user_, true, changes);
   } catch(const Poco::Exception& exc) {
     return exc.displayText();
   } catch(const std::exception& ex) {
@@ -142,1004 +497,3792 @@ kopsik::error Context::save() {
   return kopsik::noError;
 }
 
-void Context::FullSync() {
-  logger().debug("FullSync");
-
-  next_full_sync_at_ = Poco::Timestamp() + kRequestThrottleMicros;
-  Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(*this, &Context::onFullSync);
-
-  Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, next_full_sync_at_);
+void Context::schedule(Poco::Util::TimerTask::Ptr task,
+                       const Poco::Timestamp &at) {
+  if (closing_) {
+    return;
+  }
+  // Tasks only we hold have run or were dropped
+  std::vector<Poco::Util::TimerTask::Ptr>::iterator it = scheduled_.begin();
+  while (it != scheduled_.end()) {
+    if ((*it)->referenceCount() == 1) {
+      it = scheduled_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  scheduled_.push_back(task);
+  timer_.schedule(task, at);
 }
 
-void Context::onFullSync(Poco::Util::TimerTask& task) {  // NOLINT
-  if (next_full_sync_at_ > Poco::Timestamp()) {
-    logger().debug("onFullSync postponed");
+void Context::scheduleDeferrable(Poco::Util::TimerTask::Ptr task,
+                                 const Poco::Timestamp &at) {
+  Poco::Timestamp now;
+  if (at <= now) {
+    schedule(task, at);
     return;
   }
-  logger().debug("onFullSync executing");
+  schedule(task, kopsik::PowerPolicy::Shared().Defer(at - now));
+}
 
-  kopsik::HTTPSClient https_client(api_url_, app_name_, app_version_);
-  kopsik::error err = user_->FullSync(&https_client);
-  if (err != kopsik::noError) {
-    on_error_callback_(err.c_str());
-    return;
+void Context::cancelScheduled() {
+  for (std::vector<Poco::Util::TimerTask::Ptr>::iterator it =
+      scheduled_.begin();
+      it != scheduled_.end();
+      it++) {
+    (*it)->cancel();
   }
+  scheduled_.clear();
+}
 
-  err = save();
-  if (err != kopsik::noError) {
-    on_error_callback_(err.c_str());
+void Context::scheduleSave() {
+  if (save_pending_) {
     return;
   }
+  save_pending_ = true;
+  noteActivity();
 
-  on_online_callback_();
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(*this, &Context::onSave,
+      &workers_, kopsik::WorkerPool::Interactive);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp() + kSaveDelayMicros);
 }
 
-void Context::partialSync() {
-  logger().debug("partialSync");
+kopsik::error Context::flushPendingSave(
+    std::vector<kopsik::ModelChange> *changes) {
+  if (!save_pending_) {
+    return kopsik::noError;
+  }
+  return save(changes);
+}
+
+void Context::saveInBackground(SaveListener *saved) {
+  poco_assert(saved);
+  save_listeners_.push_back(saved);
+  save_pending_ = true;
+  noteActivity();
 
-  next_partial_sync_at_ = Poco::Timestamp() + kRequestThrottleMicros;
   Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(*this, &Context::onPartialSync);
+    new kopsik::WorkerTaskAdapter<Context>(*this,
+      &Context::onSaveInBackground,
+      &workers_, kopsik::WorkerPool::Interactive);
 
   Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, next_partial_sync_at_);
+  schedule(ptask, Poco::Timestamp());
 }
 
-void Context::onPartialSync(Poco::Util::TimerTask& task) {  // NOLINT
-  if (next_partial_sync_at_ > Poco::Timestamp()) {
-    logger().debug("onPartialSync postponed");
+void Context::saveEdit(
+    std::vector<kopsik::ModelChange> *changes,
+    SaveListener *saved) {
+  refreshRunningTimer();
+  if (saved) {
+    journalEdits();
+    saveInBackground(saved);
     return;
   }
-  logger().debug("onPartialSync executing");
+  save(changes);
+}
 
-  kopsik::HTTPSClient https_client(api_url_, app_name_, app_version_);
-  kopsik::error err = user_->PartialSync(&https_client);
-  if (err != kopsik::noError) {
-    on_error_callback_(err.c_str());
+void Context::scheduleEditSave(SaveListener *saved) {
+  refreshRunningTimer();
+  journalEdits();
+  if (saved) {
+    saveInBackground(saved);
     return;
   }
+  scheduleSave();
+}
 
-  err = save();
-  if (err != kopsik::noError) {
-    on_error_callback_(err.c_str());
+void Context::journalEdits() {
+  if (!user_ || !database()) {
     return;
   }
-
-  on_online_callback_();
-}
-
-void Context::SwitchWebSocketOff() {
-  logger().debug("SwitchWebSocketOff");
-
-  Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(
-      *this, &Context::onSwitchWebSocketOff);
-
-  Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, Poco::Timestamp());
+  kopsik::error err = database()->JournalEdits(user_);
+  if (err != kopsik::noError) {
+    // Still saved a moment later, unless the app crashes first
+    logger().warning("Cannot journal edits: " + err);
+  }
 }
 
-void Context::onSwitchWebSocketOff(Poco::Util::TimerTask& task) {  // NOLINT
-  logger().debug("onSwitchWebSocketOff");
-
-  Poco::Mutex::ScopedLock lock(ws_client_m_);
-  ws_client_->Stop();
+void Context::tellSaved(
+    std::vector<SaveListener *> *listeners,
+    const kopsik::error err) {
+  for (std::vector<SaveListener *>::const_iterator it = listeners->begin();
+      it != listeners->end();
+      it++) {
+    (*it)->Saved(err);
+    delete *it;
+  }
+  listeners->clear();
 }
 
-void on_websocket_message(
-    void *context,
-    std::string json) {
-  poco_assert(context);
-  poco_assert(!json.empty());
-
-  Context *ctx = reinterpret_cast<Context *>(context);
-  ctx->LoadUpdateFromJSONString(json);
+void Context::onSaveInBackground(Poco::Util::TimerTask& task) {  // NOLINT
+  std::vector<kopsik::ModelChange> changes;
+  std::vector<SaveListener *> listeners;
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    listeners.swap(save_listeners_);
+    if (listeners.empty()) {
+      // Told by an earlier task already
+      return;
+    }
+    if (!user_) {
+      err = kopsik::error("Logged out before the edit was saved");
+    } else if (save_pending_) {
+      logger().debug("onSaveInBackground executing");
+      err = save(&changes);
+    }
+  }
+  notifyModelChanges(changes);
+  tellSaved(&listeners, err);
 }
 
-void Context::LoadUpdateFromJSONString(const std::string json) {
-  try {
-    std::stringstream ss;
-    ss << "LoadUpdateFromJSONString json=" << json;
-    logger().debug(ss.str());
-
-    if (!user_) {
-      logger().warning("User is already logged out, cannot load update JSON");
+void Context::onSave(Poco::Util::TimerTask& task) {  // NOLINT
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_ || !save_pending_) {
       return;
     }
+    logger().debug("onSave executing");
+    err = save(&changes);
+  }
+  notifyModelChanges(changes);
+  if (err != kopsik::noError) {
+    on_error_callback_(err.c_str());
+  }
+}
 
-    LoadUserUpdateFromJSONString(user_, json);
+void Context::notifyModelChanges(
+    const std::vector<kopsik::ModelChange> &changes) {
+  // UI reads the snapshot once it's notified
+  publishSnapshot();
+  schedulePrecompute(Poco::Timestamp() + kPrecomputeIdleMicros);
+
+  // Merged only once, however many want it merged
+  std::vector<kopsik::ModelChange> merged;
+  bool is_merged(false);
+  if (on_model_changes_callback_) {
+    kopsik::MergeModelChanges(changes, &merged);
+    is_merged = true;
+    if (!merged.empty()) {
+      on_model_changes_callback_(merged);
+    }
+  } else if (on_model_change_callback_) {
+    for (std::vector<kopsik::ModelChange>::const_iterator it =
+          changes.begin();
+        it != changes.end();
+        it++) {
+      on_model_change_callback_(*it);
+    }
+  }
 
-    kopsik::error err = save();
-    if (err != kopsik::noError) {
-      on_error_callback_(err.c_str());
-      return;
+  // Copied, so listeners may unsubscribe while they're told
+  std::map<unsigned int, ModelChangeSubscription> subscriptions;
+  {
+    Poco::Mutex::ScopedLock lock(subscriptions_m_);
+    subscriptions = subscriptions_;
+  }
+  for (std::map<unsigned int, ModelChangeSubscription>::iterator it =
+        subscriptions.begin();
+      it != subscriptions.end();
+      it++) {
+    ModelChangeSubscription &subscription = it->second;
+    if (subscription.coalesce && !is_merged) {
+      kopsik::MergeModelChanges(changes, &merged);
+      is_merged = true;
+    }
+    const std::vector<kopsik::ModelChange> &all =
+      subscription.coalesce ? merged : changes;
+    std::vector<kopsik::ModelChange> wanted;
+    for (std::vector<kopsik::ModelChange>::const_iterator change =
+          all.begin();
+        change != all.end();
+        change++) {
+      if (subscription.models
+          && !(subscription.models & (1 << change->ModelType()))) {
+        continue;
+      }
+      if (subscription.changes
+          && !(subscription.changes & (1 << change->ChangeType()))) {
+        continue;
+      }
+      wanted.push_back(*change);
+    }
+    if (!wanted.empty()) {
+      subscription.listener->Changed(wanted);
     }
-  } catch(const Poco::Exception& exc) {
-    on_error_callback_(exc.displayText().c_str());
-  } catch(const std::exception& ex) {
-    on_error_callback_(ex.what());
-  } catch(const std::string& ex) {
-    on_error_callback_(ex.c_str());
   }
 }
 
-void Context::SwitchWebSocketOn() {
-  logger().debug("SwitchWebSocketOn");
-
-  Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(
-      *this, &Context::onSwitchWebSocketOn);
+unsigned int Context::SubscribeModelChanges(
+    const int models,
+    const int changes,
+    const bool coalesce,
+    ModelChangeListener *listener) {
+  poco_assert(listener);
+
+  ModelChangeSubscription subscription;
+  subscription.models = models;
+  subscription.changes = changes;
+  subscription.coalesce = coalesce;
+  subscription.listener = listener;
+
+  Poco::Mutex::ScopedLock lock(subscriptions_m_);
+  subscriptions_[++last_subscription_] = subscription;
+  return last_subscription_;
+}
 
-  Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, Poco::Timestamp());
+void Context::UnsubscribeModelChanges(const unsigned int subscription) {
+  Poco::Mutex::ScopedLock lock(subscriptions_m_);
+  subscriptions_.erase(subscription);
 }
 
-void Context::onSwitchWebSocketOn(Poco::Util::TimerTask& task) {  // NOLINT
-  logger().debug("onSwitchWebSocketOn");
+Poco::AutoPtr<UserSnapshot> Context::Snapshot() const {
+  Poco::FastMutex::ScopedLock lock(snapshot_m_);
+  return snapshot_;
+}
 
-  poco_assert(!user_->APIToken().empty());
+bool Context::RunningTimer(
+    Poco::UInt64 *started,
+    Poco::UInt64 *version) const {
+  poco_assert(started);
+  poco_assert(version);
 
-  Poco::Mutex::ScopedLock lock(ws_client_m_);
-  ws_client_->Start(this, user_->APIToken(), on_websocket_message);
+  Poco::FastMutex::ScopedLock lock(running_timer_m_);
+  *started = running_timer_.Started;
+  *version = running_timer_version_;
+  return running_timer_tracking_;
 }
 
-// Start/stop timeline recording on local machine
-void Context::SwitchTimelineOff() {
-  logger().debug("SwitchTimelineOff");
+// Edits are saved later, and the snapshot published only then, so
+// they refresh the timer on their own to show a new start right away.
+void Context::refreshRunningTimer() {
+  TimeEntrySnapshot running;
+  kopsik::TimeEntry *te = 0;
+  if (user_) {
+    te = user_->RunningTimeEntry();
+  }
+  if (te) {
+    running.GUID = te->GUID();
+    running.Description = te->Description();
+    projectLabelAndColorCode(te, &running.ProjectAndTaskLabel,
+                             &running.Color);
+    running.Tags = te->Tags();
+    running.WID = te->WID();
+    running.TID = te->TID();
+    running.PID = te->PID();
+    running.Started = te->Start();
+    running.Billable = te->Billable();
+  }
+
+  Poco::FastMutex::ScopedLock lock(running_timer_m_);
+  if (running_timer_tracking_ == (te != 0) && running_timer_ == running) {
+    return;
+  }
+  running_timer_ = running;
+  running_timer_tracking_ = (te != 0);
+  running_timer_version_++;
+}
 
-  Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(
-      *this, &Context::onSwitchTimelineOff);
+bool Context::TimeEntryListChanges(
+    const Poco::UInt64 since_version,
+    Poco::AutoPtr<UserSnapshot> *snapshot,
+    TimeEntryListDiff *diff) const {
+  poco_assert(snapshot);
+  poco_assert(diff);
 
-  Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, Poco::Timestamp());
+  Poco::FastMutex::ScopedLock lock(snapshot_m_);
+  *snapshot = snapshot_;
+  return mergeListDiffs(snapshot_diffs_, since_version, diff);
 }
 
-void Context::onSwitchTimelineOff(Poco::Util::TimerTask& task) {  // NOLINT
-  logger().debug("onSwitchTimelineOff");
+bool Context::TimeEntryGroupListChanges(
+    const Poco::UInt64 since_version,
+    Poco::AutoPtr<UserSnapshot> *snapshot,
+    TimeEntryListDiff *diff) const {
+  poco_assert(snapshot);
+  poco_assert(diff);
 
-  if (window_change_recorder_) {
-    Poco::Mutex::ScopedLock lock(window_change_recorder_m_);
-    delete window_change_recorder_;
-    window_change_recorder_ = 0;
+  Poco::FastMutex::ScopedLock lock(snapshot_m_);
+  *snapshot = snapshot_;
+  return mergeListDiffs(snapshot_group_diffs_, since_version, diff);
+}
+
+bool Context::mergeListDiffs(
+    const std::deque<TimeEntryListDiff> &diffs,
+    const Poco::UInt64 since_version,
+    TimeEntryListDiff *diff) const {
+  if (!snapshot_) {
+    return false;
+  }
+  diff->Version = snapshot_->Version;
+  if (since_version == snapshot_->Version) {
+    return true;
+  }
+  if (since_version > snapshot_->Version
+      || diffs.empty()
+      || since_version + 1 < diffs.front().Version) {
+    return false;
   }
 
-  if (timeline_uploader_) {
-    Poco::Mutex::ScopedLock lock(timeline_uploader_m_);
-    delete timeline_uploader_;
-    timeline_uploader_ = 0;
+  // An item is reported by how it was at since_version, which the
+  // first diff to mention it tells, and how it is now, which the
+  // last one tells.
+  std::map<std::string, bool> existed;
+  std::map<std::string, bool> exists;
+  std::vector<std::string> order;
+  for (std::deque<TimeEntryListDiff>::const_iterator it = diffs.begin();
+      it != diffs.end();
+      it++) {
+    if (it->Version <= since_version) {
+      continue;
+    }
+    for (std::size_t i = 0; i < it->Inserted.size(); i++) {
+      const std::string &GUID = it->Inserted[i];
+      if (existed.insert(std::make_pair(GUID, false)).second) {
+        order.push_back(GUID);
+      }
+      exists[GUID] = true;
+    }
+    for (std::size_t i = 0; i < it->Updated.size(); i++) {
+      const std::string &GUID = it->Updated[i];
+      if (existed.insert(std::make_pair(GUID, true)).second) {
+        order.push_back(GUID);
+      }
+      exists[GUID] = true;
+    }
+    for (std::size_t i = 0; i < it->Deleted.size(); i++) {
+      const std::string &GUID = it->Deleted[i];
+      if (existed.insert(std::make_pair(GUID, true)).second) {
+        order.push_back(GUID);
+      }
+      exists[GUID] = false;
+    }
+    diff->DateHeaders.insert(it->DateHeaders.begin(), it->DateHeaders.end());
+  }
+
+  for (std::vector<std::string>::const_iterator it = order.begin();
+      it != order.end();
+      it++) {
+    bool was_listed = existed[*it];
+    bool is_listed = exists[*it];
+    if (was_listed && is_listed) {
+      diff->Updated.push_back(*it);
+    } else if (is_listed) {
+      diff->Inserted.push_back(*it);
+    } else if (was_listed) {
+      diff->Deleted.push_back(*it);
+    }
   }
+  return true;
 }
 
-void Context::SwitchTimelineOn() {
-  logger().debug("SwitchTimelineOn");
-
-  Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(
-      *this, &Context::onSwitchTimelineOn);
-
-  Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, Poco::Timestamp());
+static void diffTimeEntryLists(
+    const UserSnapshot &previous,
+    const UserSnapshot &next,
+    TimeEntryListDiff *diff) {
+  for (std::size_t i = 0; i < next.TimeEntries.size(); i++) {
+    const TimeEntrySnapshot &te = next.TimeEntries[i];
+    std::map<std::string, std::size_t>::const_iterator found =
+      previous.TimeEntryIndex.find(te.GUID);
+    if (found == previous.TimeEntryIndex.end()) {
+      diff->Inserted.push_back(te.GUID);
+      diff->DateHeaders.insert(te.DateHeader);
+      continue;
+    }
+    const TimeEntrySnapshot &was = previous.TimeEntries[found->second];
+    if (!(was == te)) {
+      diff->Updated.push_back(te.GUID);
+      diff->DateHeaders.insert(was.DateHeader);
+      diff->DateHeaders.insert(te.DateHeader);
+    }
+  }
+  for (std::size_t i = 0; i < previous.TimeEntries.size(); i++) {
+    const TimeEntrySnapshot &was = previous.TimeEntries[i];
+    if (next.TimeEntryIndex.find(was.GUID) == next.TimeEntryIndex.end()) {
+      diff->Deleted.push_back(was.GUID);
+      diff->DateHeaders.insert(was.DateHeader);
+    }
+  }
 }
 
-void Context::onSwitchTimelineOn(Poco::Util::TimerTask& task) {  // NOLINT
-  logger().debug("onSwitchTimelineOn");
+// Built under the shared lock, so snapshots get published in the
+// order the changes were made: no write can happen in between.
+// Each time entry list is diffed against the one before it, so the UI
+// can ask for what changed instead of listing everything again.
+void Context::publishSnapshot() {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
 
-  if (!user_) {
-    return;
-  }
+  Poco::AutoPtr<UserSnapshot> snapshot;
+  if (user_) {
+    snapshot = new UserSnapshot();
+
+    std::vector<kopsik::TimeEntry *> visible;
+    timeEntries(&snapshot->DateDurations, &visible);
+    // Each day's total is formatted once, for all of its entries
+    for (std::map<std::string, Poco::Int64>::const_iterator it =
+        snapshot->DateDurations.begin();
+        it != snapshot->DateDurations.end();
+        it++) {
+      snapshot->FormattedDateDurations[it->first] =
+        kopsik::Formatter::FormatDurationInSecondsHHMM(it->second, 2);
+    }
+    DateHeaderCache headers;
+    snapshot->TimeEntries.resize(visible.size());
+    for (std::size_t i = 0; i < visible.size(); i++) {
+      kopsik::TimeEntry *te = visible[i];
+      TimeEntrySnapshot &item = snapshot->TimeEntries[i];
+      item.GUID = te->GUID();
+      item.Description = te->Description();
+      projectLabelAndColorCode(te, &item.ProjectAndTaskLabel, &item.Color);
+      item.Duration = te->DurationString();
+      item.Tags = te->Tags();
+      item.DateHeader = headers.Get(te->Day());
+      item.WID = te->WID();
+      item.TID = te->TID();
+      item.PID = te->PID();
+      item.DurationInSeconds = te->DurationInSeconds();
+      item.Started = te->Start();
+      item.Ended = te->Stop();
+      item.UpdatedAt = te->UpdatedAt();
+      item.Billable = te->Billable();
+      item.DurOnly = te->DurOnly();
+      snapshot->TimeEntryIndex[item.GUID] = i;
+      // Days with nothing listed yet, such as the running entry's
+      std::string &formatted =
+        snapshot->FormattedDateDurations[item.DateHeader];
+      if (formatted.empty()) {
+        formatted = kopsik::Formatter::FormatDurationInSecondsHHMM(0, 2);
+      }
+    }
 
-  if (!user_->RecordTimeline()) {
-    return;
-  }
+    // When none of the lists the items come from has changed, the
+    // items can't have either. Changes to untracked models don't
+    // show in the generations, so then the items are collected.
+    autocompleteGenerations(&snapshot->AutocompleteGenerations);
+    // The index read from the file is taken once, if it's still good
+    Poco::SharedPtr<AutocompleteIndex> stored;
+    {
+      Poco::FastMutex::ScopedLock stored_lock(stored_autocomplete_m_);
+      if (!snapshot->AutocompleteGenerations.empty()
+          && stored_autocomplete_generations_
+          == snapshot->AutocompleteGenerations) {
+        stored = stored_autocomplete_;
+      }
+      stored_autocomplete_ = 0;
+      stored_autocomplete_generations_.clear();
+    }
+    Poco::AutoPtr<UserSnapshot> previous = Snapshot();
+    if (previous && !snapshot->AutocompleteGenerations.empty()
+        && previous->AutocompleteGenerations
+        == snapshot->AutocompleteGenerations) {
+      snapshot->Autocomplete = previous->Autocomplete;
+    } else if (stored) {
+      snapshot->Autocomplete = stored;
+      Metrics::Shared().Count("autocomplete.index_from_file");
+    } else {
+      std::vector<AutocompleteItem> autocomplete_items;
+      autocompleteItems(&autocomplete_items);
+      // Most changes, like editing the duration of an entry,
+      // leave the autocomplete items as they were.
+      if (previous && previous->Autocomplete->Items() == autocomplete_items) {
+        snapshot->Autocomplete = previous->Autocomplete;
+      } else {
+        snapshot->Autocomplete = new AutocompleteIndex();
+        snapshot->Autocomplete->Build(autocomplete_items);
+      }
+    }
 
-  {
-    Poco::Mutex::ScopedLock lock(timeline_uploader_m_);
-    if (timeline_uploader_) {
-      delete timeline_uploader_;
-      timeline_uploader_ = 0;
+    snapshot->Tags = tags();
+  }
+  refreshRunningTimer();
+
+  // Publishers take turns, so each diff is made against the snapshot
+  // it replaces, but readers only wait for the pointers to be swapped.
+  Poco::FastMutex::ScopedLock publish_lock(snapshot_publish_m_);
+  TimeEntryListDiff diff;
+  TimeEntryListDiff group_diff;
+  Poco::AutoPtr<UserSnapshot> previous = Snapshot();
+  if (snapshot) {
+    snapshot->Version = snapshot_version_ + 1;
+    // A user who just logged in has nothing to diff against
+    if (previous) {
+      diff.Version = snapshot->Version;
+      diffTimeEntryLists(*previous, *snapshot, &diff);
     }
-    timeline_uploader_ = new kopsik::TimelineUploader(
-      user_->ID(),
-      user_->APIToken(),
-      timeline_upload_url_,
-      app_name_,
-      app_version_);
+    TimeEntryGroups::Build(previous.get(), diff, snapshot, &group_diff);
   }
 
-  {
-    Poco::Mutex::ScopedLock lock(window_change_recorder_m_);
-    if (window_change_recorder_) {
-      delete window_change_recorder_;
-      window_change_recorder_ = 0;
+  Poco::FastMutex::ScopedLock snapshot_lock(snapshot_m_);
+  snapshot_ = snapshot;
+  if (!snapshot) {
+    snapshot_diffs_.clear();
+    snapshot_group_diffs_.clear();
+    return;
+  }
+  snapshot_version_ = snapshot->Version;
+  if (previous) {
+    snapshot_diffs_.push_back(diff);
+    snapshot_group_diffs_.push_back(group_diff);
+    if (snapshot_diffs_.size() > kTimeEntryListMaxDiffs) {
+      snapshot_diffs_.pop_front();
+      snapshot_group_diffs_.pop_front();
     }
-    window_change_recorder_ = new kopsik::WindowChangeRecorder(user_->ID());
   }
 }
 
-void Context::FetchUpdates() {
-  logger().debug("FetchUpdates");
+void Context::FullSync() {
+  logger().debug("FullSync");
 
-  poco_assert(on_check_update_callback_);
+  requestSync(SyncScheduler::Full, true);
+}
 
-  kopsik::error err = db_->LoadUpdateChannel(&update_channel_);
-  if (err != kopsik::noError) {
-    on_check_update_callback_(err, false, "", "");
-    return;
-  }
+void Context::partialSync() {
+  logger().debug("partialSync");
 
-  next_fetch_updates_at_ = Poco::Timestamp() + kRequestThrottleMicros;
-  Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(*this, &Context::onFetchUpdates);
+  requestSync(SyncScheduler::Partial, false);
+}
 
-  Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, next_fetch_updates_at_);
+kopsik::HTTPSCancellation::Ptr Context::requestCancellation() {
+  Poco::Mutex::ScopedLock lock(cancellation_m_);
+  return requests_cancellation_;
 }
 
-void Context::onFetchUpdates(Poco::Util::TimerTask& task) {  // NOLINT
-  if (next_fetch_updates_at_ > Poco::Timestamp()) {
-    logger().debug("onFetchUpdates postponed");
-    return;
+void Context::cancelRequests() {
+  {
+    Poco::Mutex::ScopedLock lock(cancellation_m_);
+    requests_cancellation_->Cancel();
   }
+  Poco::Mutex::ScopedLock lock(sync_m_);
+  if (sync_cancellation_) {
+    sync_cancellation_->Cancel();
+  }
+}
 
-  logger().debug("onFetchUpdates executing");
+Poco::Timestamp Context::requestAllowedAt(const Poco::Timestamp &at) const {
+  return std::max(at, kopsik::HTTPSRateLimiter::Instance().RetryAt(
+    Poco::URI(api_url_), at));
+}
 
-  std::string response_body("");
-  kopsik::HTTPSClient https_client(api_url_, app_name_, app_version_);
-  kopsik::error err = https_client.GetJSON(updateURL(),
-                                            std::string(""),
-                                            std::string(""),
-                                            &response_body);
-  if (err != kopsik::noError) {
-    on_check_update_callback_(err, false, "", "");
-    return;
+void Context::finishSync(kopsik::HTTPSCancellation::Ptr cancellation) {
+  Poco::Mutex::ScopedLock lock(sync_m_);
+  if (sync_cancellation_ == cancellation) {
+    sync_cancellation_ = 0;
+    sync_running_ = SyncScheduler::None;
+    sync_downloading_ = false;
   }
+}
 
-  if ("null" == response_body) {
-    on_check_update_callback_(kopsik::noError, false, "", "");
-    return;
-  }
+void Context::requestSync(
+    const SyncScheduler::Kind kind,
+    const bool user_initiated) {
+  noteActivity();
 
-  if (!IsValidJSON(response_body)) {
-    on_check_update_callback_(kopsik::error("Invalid response JSON"),
-                              false, "", "");
-    return;
+  Poco::Mutex::ScopedLock lock(sync_m_);
+  // No use finishing a download the new sync would download again
+  if (sync_downloading_ && sync_cancellation_ && kind >= sync_running_
+      && (user_initiated || kind > sync_running_)) {
+    logger().debug("Superseding the sync in flight");
+    sync_cancellation_->Cancel();
   }
+  Poco::Timestamp task_at;
+  if (sync_scheduler_.Request(kind, user_initiated, Poco::Timestamp(),
+                              &task_at)) {
+    scheduleSyncTask(task_at);
+  }
+}
 
-  std::string url("");
-  std::string version("");
-
-  JSONNODE *root = json_parse(response_body.c_str());
-  JSONNODE_ITERATOR i = json_begin(root);
-  JSONNODE_ITERATOR e = json_end(root);
-  while (i != e) {
-    json_char *node_name = json_name(*i);
-    if (strcmp(node_name, "version") == 0) {
-      version = std::string(json_as_string(*i));
-    } else if (strcmp(node_name, "url") == 0) {
-      url = std::string(json_as_string(*i));
+kopsik::error Context::ApplyWorkspaceFetch::Apply(
+    const std::string &list,
+    const std::string &json) {
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(context_->user_m_,
+                                             __FUNCTION__);
+    // Logged out meanwhile, the rest isn't wanted either
+    if (!context_->user_ || context_->user_->APIToken() != api_token_) {
+      return kopsik::kRequestCancelled;
+    }
+    err = loader_.Load(context_->user_, list, json);
+    if (err == kopsik::noError) {
+      err = context_->save(&changes);
     }
-    ++i;
   }
-  json_delete(root);
-
-  on_check_update_callback_(kopsik::noError, true, url, version);
+  context_->notifyModelChanges(changes);
+  return err;
 }
 
-const std::string Context::updateURL() const {
-  poco_assert(!update_channel_.empty());
-  poco_assert(!app_version_.empty());
-
-  std::stringstream relative_url;
-  relative_url << "/api/v8/updates?app=td"
-    << "&channel=" << update_channel_
-    << "&platform=" << osName()
-    << "&version=" << app_version_;
-  return relative_url.str();
+kopsik::error Context::ApplyWorkspaceFetch::Started(
+    const kopsik::SyncCheckpoint &checkpoint) {
+  InstrumentedRWLock::ScopedWriteLock lock(context_->user_m_, __FUNCTION__);
+  if (!context_->user_ || context_->user_->APIToken() != api_token_) {
+    return kopsik::kRequestCancelled;
+  }
+  uid_ = context_->user_->ID();
+  for (std::vector<kopsik::SyncCheckpointPiece>::const_iterator it =
+      checkpoint.pieces.begin();
+      it != checkpoint.pieces.end();
+      it++) {
+    if (it->wid) {
+      loader_.KeepWorkspace(context_->user_, it->wid);
+    } else {
+      loader_.KeepTimeEntries(context_->user_, it->since, it->until);
+    }
+  }
+  kopsik::error err = context_->checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
+  }
+  return context_->database()->SaveSyncCheckpoint(uid_, checkpoint);
 }
 
-const std::string Context::osName() {
-  if (POCO_OS_LINUX == POCO_OS) {
-    return std::string("linux");
+kopsik::error Context::ApplyWorkspaceFetch::PieceDone(
+    const kopsik::SyncCheckpointPiece &piece) {
+  InstrumentedRWLock::ScopedReadLock lock(context_->user_m_, __FUNCTION__);
+  if (!context_->user_ || context_->user_->APIToken() != api_token_) {
+    return kopsik::kRequestCancelled;
   }
-  if (POCO_OS_WINDOWS_NT == POCO_OS) {
-    return std::string("windows");
+  kopsik::error err = context_->checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
   }
-  return std::string("darwin");
+  return context_->database()->SaveSyncCheckpointPiece(uid_, piece);
 }
 
-void Context::TimelineUpdateServerSettings() {
-  logger().debug("TimelineUpdateServerSettings");
+kopsik::error Context::ApplyWorkspaceFetch::Complete(
+    const Poco::UInt64 since,
+    const Poco::UInt64 time_entries_since,
+    const Poco::UInt64 time_entries_until) {
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(context_->user_m_,
+                                             __FUNCTION__);
+    if (!context_->user_ || context_->user_->APIToken() != api_token_) {
+      return kopsik::kRequestCancelled;
+    }
+    loader_.SetTimeEntryWindow(time_entries_since, time_entries_until);
+    loader_.Complete(context_->user_, since);
+    err = context_->save(&changes);
+    if (err == kopsik::noError) {
+      err = context_->database()->SaveTimeEntryFetch(
+        context_->user_->ID(), time_entries_since, time_entries_until);
+    }
+    if (err == kopsik::noError) {
+      err = context_->database()->DeleteSyncCheckpoint(
+        context_->user_->ID());
+    }
+  }
+  context_->notifyModelChanges(changes);
+  return err;
+}
 
-  next_update_timeline_settings_at_ =
-    Poco::Timestamp() + kRequestThrottleMicros;
-  Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(*this,
-        &Context::onTimelineUpdateServerSettings);
+void Context::scheduleSyncTask(const Poco::Timestamp &task_at) {
+  if (sync_task_) {
+    sync_task_->cancel();
+  }
+  sync_task_ =
+    new kopsik::WorkerTaskAdapter<Context>(*this, &Context::onSync,
+      &workers_, kopsik::WorkerPool::Interactive);
 
   Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, next_update_timeline_settings_at_);
+  schedule(sync_task_, requestAllowedAt(task_at));
 }
 
-const std::string kRecordTimelineEnabledJSON = "{\"record_timeline\": true}";
-const std::string kRecordTimelineDisabledJSON = "{\"record_timeline\": false}";
-
-void Context::onTimelineUpdateServerSettings(Poco::Util::TimerTask& task) {  // NOLINT
-  if (next_update_timeline_settings_at_ > Poco::Timestamp()) {
-    logger().debug("onTimelineUpdateServerSettings postponed");
+void Context::onSync(Poco::Util::TimerTask& task) {  // NOLINT
+  TraceSpan trace("Context::onSync");
+  SyncScheduler::Kind kind = SyncScheduler::None;
+  {
+    Poco::Mutex::ScopedLock lock(sync_m_);
+    bool reschedule(false);
+    Poco::Timestamp task_at;
+    kind = sync_scheduler_.Take(Poco::Timestamp(), &reschedule, &task_at);
+    if (reschedule) {
+      logger().debug("onSync postponed");
+      scheduleSyncTask(task_at);
+    }
+  }
+  if (SyncScheduler::None == kind) {
     return;
   }
-
-  logger().debug("onTimelineUpdateServerSettings executing");
-
-  kopsik::HTTPSClient https_client(api_url_, app_name_, app_version_);
-
-  std::string json(kRecordTimelineDisabledJSON);
-  if (user_->RecordTimeline()) {
-    json = kRecordTimelineEnabledJSON;
+  kopsik::ConnectivityMonitor &connectivity =
+    kopsik::ConnectivityMonitor::Instance();
+  bool push_first(false);
+  {
+    Poco::Mutex::ScopedLock lock(sync_m_);
+    if (!connectivity.IsOffline()) {
+      push_first = sync_push_first_;
+      sync_push_first_ = false;
+    } else {
+      logger().debug("onSync held while offline");
+      sync_scheduler_.Hold(kind);
+      kind = SyncScheduler::None;
+    }
+  }
+  if (SyncScheduler::None == kind) {
+    scheduleConnectivityProbe();
+    return;
   }
+  logger().debug(SyncScheduler::Full == kind ?
+                 "onSync executing full sync" :
+                 "onSync executing partial sync");
 
-  std::string response_body("");
-  kopsik::error err = https_client.PostJSON("/api/v8/timeline_settings",
-                                            json,
-                                            user_->APIToken(),
-                                            "api_token",
-                                            &response_body);
-  if (err != kopsik::noError) {
-    logger().warning(err);
+  kopsik::HTTPSCancellation::Ptr cancellation =
+    new kopsik::HTTPSCancellation();
+  {
+    Poco::Mutex::ScopedLock lock(sync_m_);
+    sync_cancellation_ = cancellation;
+    sync_running_ = kind;
+    sync_downloading_ = true;
+  }
+  // Unless shutting down meanwhile
+  if (requestCancellation()->IsCancelled()) {
+    cancellation->Cancel();
+  }
+
+  kopsik::HTTPSClient default_client(api_url_, app_name_, app_version_);
+  kopsik::HTTPSClient *https_client =
+    https_client_ ? https_client_ : &default_client;
+  https_client->SetCancellation(cancellation);
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::error err = kopsik::noError;
+  std::string api_token("");
+  Poco::UInt64 uid(0);
+  Poco::UInt64 since(0);
+  bool per_workspace(false);
+  // Downloading and parsing don't touch the model, so the UI
+  // keeps reading and editing it meanwhile
+  kopsik::UserJSONStreamLoader loader(SyncScheduler::Full == kind, true);
+  // A full sync downloads while it pushes, see ChangesFetch
+  kopsik::ChangesFetch fetch;
+  bool concurrent(false);
+  std::set<std::string> pushed;
+  kopsik::error push_err = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      finishSync(cancellation);
+      https_client->SetCancellation(0);
+      return;
+    }
+    // Sync starts from what's saved
+    err = flushPendingSave(&changes);
+    api_token = user_->APIToken();
+    uid = user_->ID();
+    per_workspace = per_workspace_sync_;
+    if (SyncScheduler::Partial == kind) {
+      since = user_->Since();
+    }
+    concurrent = !since && !per_workspace;
+    if (err == kopsik::noError && concurrent) {
+      user_->CollectPushableGUIDs(&pushed);
+      fetch.Start(https_client, api_token, "api_token", 0, &loader);
+    }
+    // Edits made offline go first, so what's pulled includes them.
+    // A full sync doesn't wait for the download to push them.
+    if (err == kopsik::noError && (push_first || concurrent)) {
+      SaveAfterPush listener(this, &changes);
+      push_err = user_->Push(https_client, &listener);
+      if (push_err == kopsik::noError) {
+        push_err = save(&changes);
+      }
+      // Pulled before it was pushed, not worth applying
+      if (!concurrent) {
+        err = push_err;
+      }
+    }
   }
-}
 
-kopsik::error Context::SendFeedback(Feedback fb) {
-  if (!user_) {
-    return kopsik::error("Please login to send feedback");
+  // Pieces of a per-workspace sync are applied as they arrive
+  bool applied(false);
+  if (concurrent) {
+    kopsik::error fetch_err = fetch.Wait();
+    if (err == kopsik::noError) {
+      err = fetch_err;
+    }
+  } else if (err == kopsik::noError && !since && per_workspace) {
+    ApplyWorkspaceFetch listener(this, api_token);
+    kopsik::WorkspaceFetch fetch(https_client, api_token, "api_token",
+                                 &listener);
+    // Goes on from where an interrupted one stopped, unless that
+    // was too long ago
+    kopsik::SyncCheckpoint checkpoint;
+    bool found(false);
+    if (uid) {
+      err = checkDatabase();
+    }
+    if (uid && err == kopsik::noError) {
+      err = database()->LoadSyncCheckpoint(uid, &checkpoint, &found);
+    }
+    if (found && checkpoint.started + kSyncCheckpointMaxAgeSeconds
+        > static_cast<Poco::UInt64>(Poco::Timestamp().epochTime())) {
+      logger().debug("Resuming the full sync from its checkpoint");
+      fetch.Resume(checkpoint);
+    }
+    if (err == kopsik::noError) {
+      err = fetch.Fetch();
+    }
+    applied = true;
+  } else if (err == kopsik::noError) {
+    err = kopsik::User::FetchChanges(
+      https_client, api_token, "api_token", since, &loader);
   }
 
-  fb.SetAppVersion(app_version_);
+  // Pushing is only cancelled by shutting down
+  {
+    Poco::Mutex::ScopedLock lock(sync_m_);
+    if (sync_cancellation_ == cancellation) {
+      sync_downloading_ = false;
+    }
+  }
 
-  kopsik::error err = fb.Validate();
+  if (err == kopsik::noError) {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    // Unless the user logged out meanwhile
+    if (user_ && user_->APIToken() == api_token) {
+      if (!applied) {
+        loader.SetPushedMeanwhile(pushed);
+        loader.Apply(user_);
+      }
+      // Pushed alongside the download already
+      if (!concurrent) {
+        SaveAfterPush listener(this, &changes);
+        err = user_->Push(https_client, &listener);
+      }
+      if (err == kopsik::noError) {
+        err = save(&changes);
+      }
+      if (err == kopsik::noError) {
+        err = push_err;
+      }
+      // All of it is in now, when everything was pulled
+      if (err == kopsik::noError && !since && login_sync_pending_) {
+        login_sync_pending_ = false;
+        changes.push_back(kopsik::ModelChange(user_,
+                                              kopsik::ModelChange::Update));
+      }
+    }
+  }
+  finishSync(cancellation);
+  https_client->SetCancellation(0);
+  if (err == kopsik::noError && !since) {
+    Poco::Mutex::ScopedLock lock(sync_m_);
+    last_full_sync_at_.update();
+  }
+  notifyModelChanges(changes);
+  // Superseded by a newer sync, or shutting down
+  if (err == kopsik::kRequestCancelled) {
+    logger().debug("onSync cancelled");
+    return;
+  }
+  // Tried again once the server is ready
+  if (err == kopsik::kRequestDeferred) {
+    logger().debug("onSync deferred");
+    requestSync(kind, false);
+    return;
+  }
+  // Network went away meanwhile, run again once it's back
+  if (err != kopsik::noError && connectivity.IsOffline()) {
+    Poco::Mutex::ScopedLock lock(sync_m_);
+    sync_scheduler_.Hold(kind);
+    sync_push_first_ = sync_push_first_ || push_first;
+  }
+  if (err == kopsik::kRequestOffline) {
+    logger().debug("onSync held while offline");
+    scheduleConnectivityProbe();
+    return;
+  }
   if (err != kopsik::noError) {
-    return err;
+    on_error_callback_(err.c_str());
+    return;
   }
 
-  feedback_ = fb;
-
-  Poco::Util::TimerTask::Ptr ptask =
-    new Poco::Util::TimerTaskAdapter<Context>(
-      *this, &Context::onSendFeedback);
-
-  Poco::Mutex::ScopedLock lock(timer_m_);
-  timer_.schedule(ptask, Poco::Timestamp());
-
-  return kopsik::noError;
-};
+  on_online_callback_();
+}
 
-void Context::onSendFeedback(Poco::Util::TimerTask& task) {  // NOLINT
-  logger().debug("onSendFeedback");
+void Context::SetIdleCallback(IdleCallback cb) {
+  {
+    Poco::Mutex::ScopedLock lock(idle_detector_m_);
+    on_idle_callback_ = cb;
+  }
+  updateIdleDetection();
+}
 
-  kopsik::HTTPSClient https_client(api_url_, app_name_, app_version_);
-  std::string response_body("");
-  kopsik::error err = https_client.PostJSON("/api/v8/feedback",
-                                            feedback_.JSON(),
-                                            user_->APIToken(),
-                                            "api_token",
-                                            &response_body);
+void Context::updateIdleDetection() {
+  bool use_proxy(false);
+  kopsik::Proxy proxy;
+  bool use_idle_detection(false);
+  kopsik::error err = LoadSettings(&use_proxy, &proxy, &use_idle_detection);
   if (err != kopsik::noError) {
-    on_error_callback_(err.c_str());
+    logger().error(err);
     return;
   }
-}
 
-void Context::SetWebSocketClientURL(const std::string value) {
-  Poco::Mutex::ScopedLock lock(ws_client_m_);
-    if (ws_client_) {
-        delete ws_client_;
+  kopsik::IdleDetector *stopped(0);
+  {
+    Poco::Mutex::ScopedLock lock(idle_detector_m_);
+    bool detect = use_idle_detection && on_idle_callback_;
+    if (detect == (idle_detector_ != 0)) {
+      return;
     }
-    ws_client_ = new kopsik::WebSocketClient(value,
-                                             app_name_,
-                                             app_version_);
+    if (detect) {
+      idle_detector_ = new kopsik::IdleDetector(kIdleThresholdSeconds, this);
+      return;
+    }
+    stopped = idle_detector_;
+    idle_detector_ = 0;
+  }
+  // Not deleted with the lock held, it may be telling us something
+  delete stopped;
 }
 
-kopsik::error Context::LoadSettings(
-    bool *use_proxy,
-    kopsik::Proxy *proxy,
-    bool *use_idle_settings) const {
-  return db_->LoadSettings(use_proxy, proxy, use_idle_settings);
+void Context::WentIdle(const time_t idle_started) {
+  if (!UserIsLoggedIn()) {
+    return;
+  }
+  Poco::Mutex::ScopedLock lock(idle_detector_m_);
+  if (on_idle_callback_) {
+    on_idle_callback_(idle_started, 0);
+  }
 }
 
-kopsik::error Context::SaveSettings(
-    const bool use_proxy,
-    const kopsik::Proxy *proxy,
-    const bool use_idle_detection) {
-
-  kopsik::Proxy previous_proxy_settings;
-  bool was_using_proxy(false);
+void Context::Returned(const time_t idle_started, const time_t idle_ended) {
+  Poco::UInt64 user_id(0);
+  bool record_timeline(false);
   {
-    bool was_using_idle_detection(false);
-    kopsik::error err = LoadSettings(&was_using_proxy,
-                                     &previous_proxy_settings,
-                                     &was_using_idle_detection);
-    if (err != kopsik::noError) {
-      return err;
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return;
     }
+    user_id = user_->ID();
+    record_timeline = user_->RecordTimeline();
   }
 
-  kopsik::error err = db_->SaveSettings(use_proxy, proxy, use_idle_detection);
-  if (err != kopsik::noError) {
-    return err;
+  if (record_timeline) {
+    TimelineEvent event;
+    event.start_time = idle_started;
+    event.end_time = idle_ended;
+    event.idle = true;
+    event.user_id = static_cast<unsigned int>(user_id);
+    kopsik::TimelineDispatcher::Instance().Post(
+      new TimelineEventNotification(event), notifications_);
   }
 
-  // If proxy settings have changed, apply new settings:
-  if (use_proxy != was_using_proxy
-      || proxy->host != previous_proxy_settings.host
-      || proxy->port != previous_proxy_settings.port
-      || proxy->username != previous_proxy_settings.username
-      || proxy->password != previous_proxy_settings.password) {
-    kopsik::error err = ConfigureProxy();
-    if (err != kopsik::noError) {
-      return err;
-    }
-    if (user_) {
-      FullSync();
-      SwitchWebSocketOn();
-    }
+  Poco::Mutex::ScopedLock lock(idle_detector_m_);
+  if (on_idle_callback_) {
+    on_idle_callback_(idle_started, idle_ended);
   }
+}
 
-  return kopsik::noError;
+void Context::SwitchWebSocketOff() {
+  logger().debug("SwitchWebSocketOff");
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onSwitchWebSocketOff,
+      &workers_, kopsik::WorkerPool::Interactive);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp());
 }
 
-void Context::SetDBPath(
-    const std::string path) {
+void Context::onSwitchWebSocketOff(Poco::Util::TimerTask& task) {  // NOLINT
+  logger().debug("onSwitchWebSocketOff");
 
-  Poco::Mutex::ScopedLock lock(db_m_);
-  if (db_) {
-    delete db_;
-    db_ = 0;
-  }
-  db_ = new kopsik::Database(path);
+  Poco::Mutex::ScopedLock lock(ws_client_m_);
+  ws_client_->Stop();
 }
 
-kopsik::error Context::CurrentAPIToken(std::string *token) {
-    return db_->CurrentAPIToken(token);
+void on_websocket_message(
+    void *context,
+    JSONValue *message) {
+  poco_assert(context);
+  poco_assert(message);
+
+  Context *ctx = reinterpret_cast<Context *>(context);
+  ctx->LoadUpdateFromJSONNode(message);
 }
 
-kopsik::error Context::SetCurrentAPIToken(
-    const std::string token) {
-  return db_->SetCurrentAPIToken(token);
+void on_websocket_reconnect(void *context) {
+  poco_assert(context);
+
+  Context *ctx = reinterpret_cast<Context *>(context);
+  ctx->LoadChangesMissedByWebSocket();
 }
 
-kopsik::error Context::CurrentUser(kopsik::User **result) {
-  poco_assert(!*result);
+void Context::LoadChangesMissedByWebSocket() {
+  logger().debug("LoadChangesMissedByWebSocket");
 
-  if (user_) {
-    *result = user_;
-    return kopsik::noError;
-  }
+  // Changes since the last sync, not all data, as the whole
+  // fleet may be reconnecting after an outage
+  partialSync();
+}
 
-  kopsik::User *user = new kopsik::User(app_name_, app_version_);
-  kopsik::error err = db_->LoadCurrentUser(user, true);
-  if (err != kopsik::noError) {
-    delete user;
-    return err;
+void Context::LoadUpdateFromJSONNode(JSONValue *message) {
+  poco_assert(message);
+
+  // Message is deleted by the WebSocket client once this returns
+  JSONValue *update = JSONDuplicate(message);
+  {
+    Poco::Mutex::ScopedLock lock(pending_updates_m_);
+    pending_updates_.push_back(update);
+    // The task scheduled for the first of them takes the rest too
+    if (pending_updates_.size() > 1) {
+      return;
+    }
   }
 
-  Poco::Mutex::ScopedLock lock(user_m_);
-  user_ = user;
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onLoadPendingUpdates,
+      &workers_, kopsik::WorkerPool::Interactive);
 
-  *result = user_;
-  return kopsik::noError;
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp() + kWebSocketUpdateDelayMicros);
 }
 
-kopsik::error Context::Login(
-    const std::string email,
-    const std::string password) {
-  kopsik::User *logging_in = new kopsik::User(app_name_, app_version_);
+void Context::onLoadPendingUpdates(Poco::Util::TimerTask& task) {  // NOLINT
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    err = loadPendingUpdates(&changes);
+  }
+  notifyModelChanges(changes);
+  if (err != kopsik::noError) {
+    on_error_callback_(err.c_str());
+  }
+}
+
+kopsik::error Context::loadPendingUpdates(
+    std::vector<kopsik::ModelChange> *changes) {
+  poco_assert(changes);
+
+  std::vector<JSONValue *> updates;
+  {
+    Poco::Mutex::ScopedLock lock(pending_updates_m_);
+    updates.swap(pending_updates_);
+  }
+  if (updates.empty()) {
+    return kopsik::noError;
+  }
+
+  TraceSpan trace("Context::loadPendingUpdates");
+
+  kopsik::error err = kopsik::noError;
+  try {
+    logger().debug("loadPendingUpdates");
+
+    if (!user_) {
+      logger().warning(
+        "User is already logged out, cannot load update JSON");
+    } else {
+      for (std::vector<JSONValue *>::const_iterator it = updates.begin();
+          it != updates.end();
+          it++) {
+        LoadUserUpdateFromJSONNode(user_, *it);
+      }
+      Metrics::Shared().Count("websocket.update_batches");
+      Metrics::Shared().Count("websocket.updates", updates.size());
+
+      err = save(changes);
+    }
+  } catch(const Poco::Exception& exc) {
+    err = exc.displayText();
+  } catch(const std::exception& ex) {
+    err = ex.what();
+  } catch(const std::string& ex) {
+    err = ex;
+  }
+
+  for (std::vector<JSONValue *>::const_iterator it = updates.begin();
+      it != updates.end();
+      it++) {
+    JSONDelete(*it);
+  }
+  return err;
+}
+
+void Context::SwitchWebSocketOn() {
+  logger().debug("SwitchWebSocketOn");
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onSwitchWebSocketOn,
+      &workers_, kopsik::WorkerPool::Interactive);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp());
+}
+
+void Context::onSwitchWebSocketOn(Poco::Util::TimerTask& task) {  // NOLINT
+  logger().debug("onSwitchWebSocketOn");
+
+  std::string api_token("");
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return;
+    }
+    api_token = user_->APIToken();
+  }
+  poco_assert(!api_token.empty());
+
+  Poco::Mutex::ScopedLock lock(ws_client_m_);
+  ws_client_->Start(this, api_token, on_websocket_message,
+                    on_websocket_reconnect);
+}
+
+// Start/stop timeline recording on local machine
+void Context::SwitchTimelineOff() {
+  logger().debug("SwitchTimelineOff");
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onSwitchTimelineOff,
+      &workers_, kopsik::WorkerPool::Interactive);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp());
+}
+
+void Context::onSwitchTimelineOff(Poco::Util::TimerTask& task) {  // NOLINT
+  logger().debug("onSwitchTimelineOff");
+
+  if (window_change_recorder_) {
+    Poco::Mutex::ScopedLock lock(window_change_recorder_m_);
+    delete window_change_recorder_;
+    window_change_recorder_ = 0;
+  }
+
+  if (timeline_uploader_) {
+    Poco::Mutex::ScopedLock lock(timeline_uploader_m_);
+    delete timeline_uploader_;
+    timeline_uploader_ = 0;
+  }
+}
+
+void Context::SwitchTimelineOn() {
+  logger().debug("SwitchTimelineOn");
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onSwitchTimelineOn,
+      &workers_, kopsik::WorkerPool::Interactive);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp());
+}
+
+void Context::onSwitchTimelineOn(Poco::Util::TimerTask& task) {  // NOLINT
+  logger().debug("onSwitchTimelineOn");
+
+  Poco::UInt64 user_id(0);
+  std::string api_token("");
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return;
+    }
+    if (!user_->RecordTimeline()) {
+      return;
+    }
+    user_id = user_->ID();
+    api_token = user_->APIToken();
+  }
+
+  kopsik::WebSocketClient *ws_client(0);
+  {
+    Poco::Mutex::ScopedLock lock(ws_client_m_);
+    ws_client = ws_client_;
+  }
+
+  {
+    Poco::Mutex::ScopedLock lock(timeline_uploader_m_);
+    if (timeline_uploader_) {
+      delete timeline_uploader_;
+      timeline_uploader_ = 0;
+    }
+    timeline_uploader_ = new kopsik::TimelineUploader(
+      user_id,
+      api_token,
+      timeline_upload_url_,
+      app_name_,
+      app_version_,
+      notifications_,
+      timeline_over_websocket_ ? ws_client : 0);
+  }
+
+  {
+    Poco::Mutex::ScopedLock lock(window_change_recorder_m_);
+    if (window_change_recorder_) {
+      delete window_change_recorder_;
+      window_change_recorder_ = 0;
+    }
+    window_change_recorder_ =
+      new kopsik::WindowChangeRecorder(user_id, notifications_,
+                                       &title_filter_);
+  }
+}
+
+void Context::FetchUpdates() {
+  logger().debug("FetchUpdates");
+
+  poco_assert(on_check_update_callback_);
 
-  kopsik::HTTPSClient https_client(api_url_,
-                                   app_name_,
-                                   app_version_);
-  kopsik::error err = logging_in->Login(&https_client, email, password);
+  // Read by updateURL once the updates are fetched
+  std::string channel("");
+  kopsik::error err = LoadUpdateChannel(&channel);
   if (err != kopsik::noError) {
-    delete logging_in;
-    return err;
+    on_check_update_callback_(err, false, "", "");
+    return;
   }
 
-  poco_assert(logging_in->ID() > 0);
+  next_fetch_updates_at_ =
+    requestAllowedAt(Poco::Timestamp() + kRequestThrottleMicros);
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(*this, &Context::onFetchUpdates,
+      &workers_, kopsik::WorkerPool::Background);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, next_fetch_updates_at_);
+}
+
+void Context::onFetchUpdates(Poco::Util::TimerTask& task) {  // NOLINT
+  if (next_fetch_updates_at_ > Poco::Timestamp()) {
+    logger().debug("onFetchUpdates postponed");
+    return;
+  }
+  bool offline(false);
+  {
+    Poco::Mutex::ScopedLock lock(connectivity_m_);
+    offline = kopsik::ConnectivityMonitor::Instance().IsOffline();
+    if (offline) {
+      logger().debug("onFetchUpdates held while offline");
+      fetch_updates_held_ = true;
+    }
+  }
+  if (offline) {
+    scheduleConnectivityProbe();
+    return;
+  }
 
-  err = db_->LoadUserByID(logging_in->ID(), logging_in, true);
+  logger().debug("onFetchUpdates executing");
+
+  // Validators are only good for the URL they came from,
+  // which changes with the update channel and app version
+  std::string relative_url(updateURL());
+  std::string cached_url("");
+  std::string cached_body("");
+  kopsik::HTTPValidators validators;
+  validators.not_modified = false;
+  // Checked without the cache when there's no database
+  kopsik::error err = checkDatabase();
+  if (err == kopsik::noError) {
+    err = database()->LoadUpdateCheck(&cached_url,
+                                      &validators.etag,
+                                      &validators.last_modified,
+                                      &cached_body);
+  }
   if (err != kopsik::noError) {
-    delete logging_in;
-    return err;
+    logger().warning(err);
+  }
+  if (err != kopsik::noError || cached_url != relative_url) {
+    validators.etag = "";
+    validators.last_modified = "";
   }
 
-  err = db_->SetCurrentAPIToken(logging_in->APIToken());
+  std::string response_body("");
+  kopsik::HTTPSClient https_client(api_url_, app_name_, app_version_);
+  https_client.SetCancellation(requestCancellation());
+  err = https_client.ConditionalGetJSON(relative_url,
+                                        std::string(""),
+                                        std::string(""),
+                                        &validators,
+                                        &response_body);
   if (err != kopsik::noError) {
-    delete logging_in;
-    return err;
+    on_check_update_callback_(err, false, "", "");
+    return;
   }
 
-  Poco::Mutex::ScopedLock lock(user_m_);
-  if (user_) {
-    delete user_;
+  if (validators.not_modified) {
+    response_body.swap(cached_body);
+  } else if (database()) {
+    err = database()->SaveUpdateCheck(relative_url,
+                                    validators.etag,
+                                    validators.last_modified,
+                                    response_body);
+    if (err != kopsik::noError) {
+      logger().warning(err);
+    }
   }
-  user_ = logging_in;
 
-  return save();
-}
+  if ("null" == response_body) {
+    on_check_update_callback_(kopsik::noError, false, "", "");
+    return;
+  }
 
-kopsik::error Context::SetLoggedInUserFromJSON(
-    const std::string json) {
-  kopsik::User *import = new kopsik::User(app_name_, app_version_);
+  if (!IsValidJSON(response_body)) {
+    on_check_update_callback_(kopsik::error("Invalid response JSON"),
+                              false, "", "");
+    return;
+  }
 
-  LoadUserFromJSONString(import, json, true, true);
+  std::string url("");
+  std::string version("");
 
-  kopsik::error err = db_->SetCurrentAPIToken(import->APIToken());
-  if (err != kopsik::noError) {
-    delete import;
-    return err;
+  JSONValue *root = JSONParse(response_body);
+  JSONIterator i = JSONBegin(root);
+  JSONIterator e = JSONEnd(root);
+  while (i != e) {
+    JSONKey key = JSONNodeKey(*i);
+    if (kJSONKeyVersion == key) {
+      version = JSONString(*i);
+    } else if (kJSONKeyURL == key) {
+      url = JSONString(*i);
+    }
+    ++i;
   }
+  JSONDelete(root);
 
-  Poco::Mutex::ScopedLock lock(user_m_);
-  if (user_) {
-    delete user_;
+  on_check_update_callback_(kopsik::noError, true, url, version);
+}
+
+const std::string Context::updateURL() const {
+  std::string channel("");
+  {
+    Poco::Mutex::ScopedLock lock(settings_m_);
+    channel = update_channel_;
   }
-  user_ = import;
+  poco_assert(!channel.empty());
+  poco_assert(!app_version_.empty());
 
-  return save();
+  std::stringstream relative_url;
+  relative_url << "/api/v8/updates?app=td"
+    << "&channel=" << channel
+    << "&platform=" << osName()
+    << "&version=" << app_version_;
+  return relative_url.str();
 }
 
-kopsik::error Context::Logout() {
-  try {
+Poco::Logger &Context::logger() const {
+  return ComponentLogger(&log_context);
+}
+
+const std::string Context::osName() {
+  if (POCO_OS_LINUX == POCO_OS) {
+    return std::string("linux");
+  }
+  if (POCO_OS_WINDOWS_NT == POCO_OS) {
+    return std::string("windows");
+  }
+  return std::string("darwin");
+}
+
+void Context::TimelineUpdateServerSettings() {
+  logger().debug("TimelineUpdateServerSettings");
+
+  next_update_timeline_settings_at_ =
+    requestAllowedAt(Poco::Timestamp() + kRequestThrottleMicros);
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(*this,
+      &Context::onTimelineUpdateServerSettings,
+      &workers_, kopsik::WorkerPool::Background);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, next_update_timeline_settings_at_);
+}
+
+const std::string kRecordTimelineEnabledJSON = "{\"record_timeline\": true}";
+const std::string kRecordTimelineDisabledJSON = "{\"record_timeline\": false}";
+
+void Context::onTimelineUpdateServerSettings(Poco::Util::TimerTask& task) {  // NOLINT
+  if (next_update_timeline_settings_at_ > Poco::Timestamp()) {
+    logger().debug("onTimelineUpdateServerSettings postponed");
+    return;
+  }
+  bool offline(false);
+  {
+    Poco::Mutex::ScopedLock lock(connectivity_m_);
+    offline = kopsik::ConnectivityMonitor::Instance().IsOffline();
+    if (offline) {
+      logger().debug("onTimelineUpdateServerSettings held while offline");
+      timeline_settings_held_ = true;
+    }
+  }
+  if (offline) {
+    scheduleConnectivityProbe();
+    return;
+  }
+
+  logger().debug("onTimelineUpdateServerSettings executing");
+
+  kopsik::HTTPSClient https_client(api_url_, app_name_, app_version_);
+  https_client.SetCancellation(requestCancellation());
+
+  std::string json(kRecordTimelineDisabledJSON);
+  std::string api_token("");
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
     if (!user_) {
-      logger().warning("User is logged out, cannot logout again");
-      return kopsik::noError;
+      return;
     }
+    if (user_->RecordTimeline()) {
+      json = kRecordTimelineEnabledJSON;
+    }
+    api_token = user_->APIToken();
+  }
 
-    Shutdown();
+  // Setting is pushed, not fetched, so there's nothing to validate.
+  // What the server already has isn't sent again.
+  std::string sent(api_token + " " + json);
+  if (sent == timeline_settings_sent_) {
+    logger().debug("Timeline setting unchanged, not sending");
+    return;
+  }
+
+  std::string response_body("");
+  kopsik::error err = https_client.PostJSON("/api/v8/timeline_settings",
+                                            json,
+                                            api_token,
+                                            "api_token",
+                                            &response_body);
+  if (err != kopsik::noError) {
+    logger().warning(err);
+    return;
+  }
+  timeline_settings_sent_ = sent;
+
+  // The server says whether it wants hourly totals per app
+  // instead of every window change
+  if (!IsValidJSON(response_body)) {
+    return;
+  }
+  bool rollups(false);
+  JSONValue *root = JSONParse(response_body);
+  JSONIterator i = JSONBegin(root);
+  JSONIterator e = JSONEnd(root);
+  while (i != e) {
+    if (kJSONKeyTimelineRollups == JSONNodeKey(*i)) {
+      rollups = JSONBool(*i);
+    }
+    ++i;
+  }
+  JSONDelete(root);
+
+  InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+  timeline_rollups_ = rollups;
+  if (database()) {
+    database()->SetTimelineRollups(rollups);
+  }
+}
+
+kopsik::error Context::SendFeedback(Feedback fb) {
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to send feedback");
+    }
+  }
+
+  fb.SetAppVersion(app_version_);
+
+  kopsik::error err = fb.Validate();
+  if (err != kopsik::noError) {
+    return err;
+  }
+
+  feedback_ = fb;
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onSendFeedback,
+      &workers_, kopsik::WorkerPool::Background);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp());
+
+  return kopsik::noError;
+};
+
+void Context::onSendFeedback(Poco::Util::TimerTask& task) {  // NOLINT
+  logger().debug("onSendFeedback");
+
+  std::string api_token("");
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return;
+    }
+    api_token = user_->APIToken();
+  }
+
+  // Taken here rather than in SendFeedback, off the UI thread
+  feedback_.SetPerformance(PerformanceSnapshot());
+
+  kopsik::HTTPSClient https_client(api_url_, app_name_, app_version_);
+  https_client.SetCancellation(requestCancellation());
+  std::string response_body("");
+  kopsik::error err = https_client.PostJSON("/api/v8/feedback",
+                                            &feedback_,
+                                            api_token,
+                                            "api_token",
+                                            &response_body);
+  if (err != kopsik::noError) {
+    on_error_callback_(err.c_str());
+    return;
+  }
+}
+
+void Context::SetWebSocketClientURL(const std::string value) {
+  Poco::Mutex::ScopedLock lock(ws_client_m_);
+    if (ws_client_) {
+        delete ws_client_;
+    }
+    ws_client_ = new kopsik::WebSocketClient(value,
+                                             app_name_,
+                                             app_version_);
+    kopsik::DNSCache::Shared().Prefetch(value);
+}
+
+kopsik::error Context::LoadSettings(
+    bool *use_proxy,
+    kopsik::Proxy *proxy,
+    bool *use_idle_settings) const {
+  Poco::Mutex::ScopedLock lock(settings_m_);
+  if (!settings_loaded_) {
+    kopsik::error err = checkDatabase();
+    if (err != kopsik::noError) {
+      return err;
+    }
+    err = database()->LoadSettings(&use_proxy_,
+                                   &proxy_,
+                                   &use_idle_detection_);
+    if (err != kopsik::noError) {
+      return err;
+    }
+    settings_loaded_ = true;
+  }
+  *use_proxy = use_proxy_;
+  *proxy = proxy_;
+  *use_idle_settings = use_idle_detection_;
+  return kopsik::noError;
+}
+
+kopsik::error Context::SaveSettings(
+    const bool use_proxy,
+    const kopsik::Proxy *proxy,
+    const bool use_idle_detection) {
+
+  kopsik::Proxy previous_proxy_settings;
+  bool was_using_proxy(false);
+  {
+    bool was_using_idle_detection(false);
+    kopsik::error err = LoadSettings(&was_using_proxy,
+                                     &previous_proxy_settings,
+                                     &was_using_idle_detection);
+    if (err != kopsik::noError) {
+      return err;
+    }
+  }
+
+  {
+    Poco::Mutex::ScopedLock lock(settings_m_);
+    kopsik::error err = checkDatabase();
+    if (err != kopsik::noError) {
+      return err;
+    }
+    err = database()->SaveSettings(use_proxy, proxy, use_idle_detection);
+    if (err != kopsik::noError) {
+      settings_loaded_ = false;
+      return err;
+    }
+    use_proxy_ = use_proxy;
+    proxy_ = *proxy;
+    use_idle_detection_ = use_idle_detection;
+    settings_loaded_ = true;
+  }
+
+  updateIdleDetection();
+
+  // If proxy settings have changed, apply new settings:
+  if (use_proxy != was_using_proxy
+      || proxy->host != previous_proxy_settings.host
+      || proxy->port != previous_proxy_settings.port
+      || proxy->username != previous_proxy_settings.username
+      || proxy->password != previous_proxy_settings.password) {
+    kopsik::error err = ConfigureProxy();
+    if (err != kopsik::noError) {
+      return err;
+    }
+    if (UserIsLoggedIn()) {
+      FullSync();
+      SwitchWebSocketOn();
+    }
+  }
+
+  return kopsik::noError;
+}
+
+void Context::SetDBPath(
+    const std::string path) {
+
+  InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+  // Including one that's still being opened
+  delete database();
+  db_ = 0;
+  {
+    Poco::Mutex::ScopedLock open_lock(db_open_m_);
+    db_open_path_ = path;
+    db_open_tuning_ = db_tuning_;
+    db_open_rollups_ = timeline_rollups_;
+    db_open_blocks_ = timeline_blocks_;
+    db_open_error_ = kopsik::noError;
+    db_opening_ = true;
+    db_opener_.start(db_open_runnable_);
+  }
+  dropSettingsCache();
+
+  scheduleDatabaseMaintenance(
+    Poco::Timestamp() + kDatabaseMaintenanceIntervalMicros);
+  scheduleExternalChangesCheck();
+  schedulePeriodicSync(Poco::Timestamp() + kFullSyncCheckMicros);
+}
+
+void Context::openDatabase() {
+  kopsik::MetricsTimer timer("startup.db_open");
+  try {
+    kopsik::Database *db = new kopsik::Database(db_open_path_,
+                                                db_open_tuning_,
+                                                notifications_);
+    db->SetTimeEntryLoadDays(kTimeEntryLoadDays);
+    db->SetSnapshotPath(db_open_path_ + "-snapshot");
+    db->SetAutocompleteIndexPath(db_open_path_ + "-autocomplete");
+    db->SetChangeJournalPath(db_open_path_ + "-edits");
+    db->SetTimelineRollups(db_open_rollups_);
+    db->SetTimelineBlocks(db_open_blocks_);
+    db_ = db;
+  } catch(const Poco::Exception& exc) {
+    db_open_error_ = exc.displayText();
+  } catch(const std::exception& ex) {
+    db_open_error_ = ex.what();
+  } catch(const std::string& ex) {
+    db_open_error_ = ex;
+  }
+}
+
+kopsik::Database *Context::database() const {
+  Poco::Mutex::ScopedLock lock(db_open_m_);
+  if (db_opening_) {
+    // Time startup had nothing else to do but wait for it
+    Poco::Timestamp waiting;
+    db_opener_.join();
+    db_opening_ = false;
+    kopsik::Metrics::Shared().Time("startup.db_wait", waiting.elapsed());
+    if (db_open_error_ != kopsik::noError) {
+      logger().error("Failed to open database: " + db_open_error_);
+    }
+  }
+  return db_;
+}
+
+kopsik::error Context::checkDatabase() const {
+  if (database()) {
+    return kopsik::noError;
+  }
+  Poco::Mutex::ScopedLock lock(db_open_m_);
+  if (db_open_error_ != kopsik::noError) {
+    return db_open_error_;
+  }
+  return kopsik::error("Database is not open");
+}
+
+kopsik::error Context::SetDBTuning(const kopsik::DatabaseTuning &tuning) {
+  InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+  db_tuning_ = tuning;
+  if (!database()) {
+    return kopsik::noError;
+  }
+  return database()->Tune(tuning);
+}
+
+void Context::SetTimeEntryArchiveDays(const unsigned int days) {
+  InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+  time_entry_archive_days_ = days;
+}
+
+void Context::SetTimelineBlocks(const bool value) {
+  InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+  timeline_blocks_ = value;
+  if (database()) {
+    database()->SetTimelineBlocks(value);
+  }
+}
+
+void Context::SetTimelineOverWebSocket(const bool value) {
+  // Locked one after the other, like onSwitchTimelineOn does
+  kopsik::WebSocketClient *ws_client(0);
+  {
+    Poco::Mutex::ScopedLock lock(ws_client_m_);
+    ws_client = ws_client_;
+  }
+  Poco::Mutex::ScopedLock lock(timeline_uploader_m_);
+  timeline_over_websocket_ = value;
+  if (timeline_uploader_) {
+    timeline_uploader_->SetStream(value ? ws_client : 0);
+  }
+}
+
+void Context::SetTimelineTitleFilters(
+    const std::vector<std::string> &redact,
+    const std::vector<std::string> &drop) {
+  title_filter_.SetPatterns(redact, drop);
+}
+
+kopsik::error Context::ArchiveTimeEntries(Poco::UInt64 *archived) {
+  poco_assert(archived);
+  *archived = 0;
+
+  Poco::UInt64 days(0);
+  {
+    InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+    days = time_entry_archive_days_;
+  }
+  if (!days) {
+    return kopsik::noError;
+  }
+  Poco::UInt64 before = time(0) - days * 24 * 60 * 60;
+
+  // Held throughout, so no older entries are loaded meanwhile
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+  if (!user_ || !user_->ID()) {
+    return kopsik::noError;
+  }
+  std::set<std::string> loaded;
+  for (std::vector<kopsik::TimeEntry *>::const_iterator it =
+      user_->related.TimeEntries.begin();
+      it != user_->related.TimeEntries.end();
+      it++) {
+    if ((*it)->Start() < before) {
+      loaded.insert((*it)->GUID());
+    }
+  }
+
+  InstrumentedMutex::ScopedLock db_lock(db_m_, __FUNCTION__);
+  if (!database()) {
+    return kopsik::noError;
+  }
+  return database()->ArchiveTimeEntries(user_->ID(), before, loaded,
+                                        archived);
+}
+
+kopsik::error Context::CurrentAPIToken(std::string *token) {
+  Poco::Mutex::ScopedLock lock(settings_m_);
+  if (!api_token_loaded_) {
+    kopsik::error err = checkDatabase();
+    if (err != kopsik::noError) {
+      return err;
+    }
+    err = database()->CurrentAPIToken(&api_token_);
+    if (err != kopsik::noError) {
+      return err;
+    }
+    api_token_loaded_ = true;
+  }
+  *token = api_token_;
+  return kopsik::noError;
+}
+
+kopsik::error Context::SetCurrentAPIToken(
+    const std::string token) {
+  Poco::Mutex::ScopedLock lock(settings_m_);
+  kopsik::error err = checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
+  }
+  err = database()->SetCurrentAPIToken(token);
+  // Whatever the database has now, it's read again after a failure
+  api_token_loaded_ = err == kopsik::noError;
+  api_token_ = token;
+  return err;
+}
+
+void Context::dropSettingsCache(const std::set<std::string> *tables) {
+  Poco::Mutex::ScopedLock lock(settings_m_);
+  if (!tables || tables->count("settings")) {
+    settings_loaded_ = false;
+    update_channel_loaded_ = false;
+  }
+  if (!tables || tables->count("sessions")) {
+    api_token_loaded_ = false;
+  }
+}
+
+kopsik::error Context::CurrentUser(kopsik::User **result) {
+  poco_assert(!*result);
+
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+
+    if (user_) {
+      *result = user_;
+      return kopsik::noError;
+    }
+
+    // Only what the timer and today's list show is loaded first,
+    // so startup doesn't wait on the size of the database
+    kopsik::error err = checkDatabase();
+    if (err != kopsik::noError) {
+      return err;
+    }
+    kopsik::User *user = new kopsik::User(app_name_, app_version_);
+    err = database()->LoadCurrentUser(user, false);
+    if (err != kopsik::noError) {
+      delete user;
+      return err;
+    }
+    if (user->ID()) {
+      Poco::LocalDateTime now;
+      Poco::LocalDateTime today(now.year(), now.month(), now.day());
+      err = database()->LoadStartupTimeEntries(user,
+        today.timestamp().epochTime());
+      if (err != kopsik::noError) {
+        delete user;
+        return err;
+      }
+      // Edits the last run didn't get to save. The UI hears of
+      // them with the rest of the user.
+      std::vector<kopsik::ModelChange> changes;
+      err = database()->ReplayChangeJournal(user, &changes);
+      if (err != kopsik::noError) {
+        logger().error("Cannot replay change journal: " + err);
+      }
+    }
+
+    user_ = user;
+    related_data_loaded_ = false;
+
+    *result = user_;
+  }
+  publishSnapshot();
+  if ((*result)->ID()) {
+    loadRelatedData();
+  }
+  return kopsik::noError;
+}
+
+void Context::loadRelatedData() {
+  logger().debug("loadRelatedData");
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onLoadRelatedData,
+      &workers_, kopsik::WorkerPool::Background);
+
+  // Sync tasks are scheduled later, so they run on a complete model
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp());
+}
+
+void Context::noteActivity() {
+  Poco::FastMutex::ScopedLock lock(activity_m_);
+  last_activity_at_.update();
+}
+
+void Context::scheduleDatabaseMaintenance(const Poco::Timestamp &at) {
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  if (database_maintenance_scheduled_) {
+    return;
+  }
+  database_maintenance_scheduled_ = true;
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onMaintainDatabase,
+      &workers_, kopsik::WorkerPool::Background);
+  scheduleDeferrable(ptask, at);
+}
+
+void Context::schedulePrecompute(const Poco::Timestamp &at) {
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  if (precompute_scheduled_) {
+    return;
+  }
+  precompute_scheduled_ = true;
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onPrecompute,
+      &workers_, kopsik::WorkerPool::Background);
+  schedule(ptask, at);
+}
+
+void Context::SetOnline(const bool online) {
+  kopsik::ConnectivityMonitor &connectivity =
+    kopsik::ConnectivityMonitor::Instance();
+  if (online) {
+    connectivity.Reachable();
+  } else {
+    connectivity.Unreachable();
+  }
+}
+
+void Context::SetOnBattery(const bool on_battery) {
+  kopsik::PowerPolicy::Shared().SetOnBattery(on_battery);
+}
+
+void Context::handleConnectivityChangedNotification(
+    kopsik::ConnectivityChangedNotification *notification) {
+  Poco::AutoPtr<kopsik::ConnectivityChangedNotification> ptr(notification);
+  if (notification->online) {
+    logger().information("Back online");
+    catchUpAfterOffline();
+  } else {
+    logger().warning("Offline, network tasks are paused");
+    scheduleConnectivityProbe();
+  }
+}
+
+void Context::catchUpAfterOffline() {
+  {
+    Poco::Mutex::ScopedLock lock(sync_m_);
+    sync_push_first_ = true;
+    Poco::Timestamp task_at;
+    if (sync_scheduler_.Request(SyncScheduler::Partial, true,
+                                Poco::Timestamp(), &task_at)) {
+      scheduleSyncTask(task_at);
+    }
+  }
+
+  bool fetch_updates(false);
+  bool timeline_settings(false);
+  {
+    Poco::Mutex::ScopedLock lock(connectivity_m_);
+    fetch_updates = fetch_updates_held_;
+    timeline_settings = timeline_settings_held_;
+    fetch_updates_held_ = false;
+    timeline_settings_held_ = false;
+  }
+  if (fetch_updates) {
+    FetchUpdates();
+  }
+  if (timeline_settings) {
+    TimelineUpdateServerSettings();
+  }
+
+  Poco::Mutex::ScopedLock lock(timeline_uploader_m_);
+  if (timeline_uploader_) {
+    timeline_uploader_->Resume();
+  }
+}
+
+void Context::scheduleConnectivityProbe() {
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  if (connectivity_probe_scheduled_) {
+    return;
+  }
+  connectivity_probe_scheduled_ = true;
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onProbeConnectivity,
+      &workers_, kopsik::WorkerPool::Background);
+  scheduleDeferrable(ptask, Poco::Timestamp()
+    + kopsik::ConnectivityMonitor::Instance().NextProbeDelay());
+}
+
+void Context::onProbeConnectivity(Poco::Util::TimerTask& task) {  // NOLINT
+  {
+    Poco::Mutex::ScopedLock lock(timer_m_);
+    connectivity_probe_scheduled_ = false;
+  }
+
+  kopsik::ConnectivityMonitor &connectivity =
+    kopsik::ConnectivityMonitor::Instance();
+  if (!connectivity.IsOffline()) {
+    return;
+  }
+  if (!connectivity.Probe(Poco::URI(api_url_),
+      Poco::Timespan(kHTTPSConnectTimeoutMicros))) {
+    logger().debug("onProbeConnectivity still offline");
+    scheduleConnectivityProbe();
+  }
+}
+
+void Context::schedulePeriodicSync(const Poco::Timestamp &at) {
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  if (periodic_sync_scheduled_) {
+    return;
+  }
+  periodic_sync_scheduled_ = true;
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onPeriodicSync,
+      &workers_, kopsik::WorkerPool::Background);
+  scheduleDeferrable(ptask, at);
+}
+
+// The WebSocket brings changes as they're made, full syncs only catch
+// what it missed. So they're rare while it's delivering, and come
+// closer once it has been down for a while.
+void Context::onPeriodicSync(Poco::Util::TimerTask& task) {  // NOLINT
+  {
+    Poco::Mutex::ScopedLock lock(timer_m_);
+    periodic_sync_scheduled_ = false;
+  }
+
+  bool healthy(false);
+  {
+    Poco::Mutex::ScopedLock lock(ws_client_m_);
+    healthy = ws_client_ && ws_client_->Healthy();
+  }
+  bool due(false);
+  {
+    Poco::Mutex::ScopedLock lock(sync_m_);
+    due = full_sync_interval_.Due(healthy, Poco::Timestamp(),
+                                  last_full_sync_at_);
+  }
+  if (due && UserIsLoggedIn()) {
+    logger().debug(healthy ? "onPeriodicSync executing" :
+                   "onPeriodicSync executing, WebSocket is down");
+    requestSync(SyncScheduler::Full, false);
+  } else if (reconcileDue() && UserIsLoggedIn()) {
+    Poco::UInt64 until = time(0) + kDigestDaySeconds;
+    Poco::UInt64 since = until - (kTimeEntryFetchDays + 1) * kDigestDaySeconds;
+    Poco::UInt64 mismatched(0);
+    kopsik::error err = Reconcile(since, until, &mismatched);
+    if (err != kopsik::noError) {
+      logger().warning("Reconcile failed: " + err);
+    } else if (mismatched) {
+      std::stringstream ss;
+      ss << "Reconcile fetched " << mismatched << " mismatched days";
+      logger().debug(ss.str());
+    }
+  }
+
+  schedulePeriodicSync(Poco::Timestamp() + kFullSyncCheckMicros);
+}
+
+bool Context::reconcileDue() {
+  Poco::Mutex::ScopedLock lock(sync_m_);
+  Poco::Timestamp now;
+  if (now - last_full_sync_at_ < kReconcileIntervalMicros
+      || now - last_reconcile_at_ < kReconcileIntervalMicros) {
+    return false;
+  }
+  last_reconcile_at_ = now;
+  return true;
+}
+
+void Context::onMaintainDatabase(Poco::Util::TimerTask& task) {  // NOLINT
+  {
+    Poco::Mutex::ScopedLock lock(timer_m_);
+    database_maintenance_scheduled_ = false;
+  }
+
+  Poco::Timestamp idle_at;
+  {
+    Poco::FastMutex::ScopedLock lock(activity_m_);
+    idle_at = last_activity_at_ + kDatabaseMaintenanceIdleMicros;
+  }
+  if (idle_at > Poco::Timestamp()) {
+    logger().debug("onMaintainDatabase postponed");
+    scheduleDatabaseMaintenance(idle_at);
+    return;
+  }
+
+  logger().debug("onMaintainDatabase executing");
+
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+    if (database()) {
+      err = database()->Maintain();
+    }
+  }
+  if (err == kopsik::noError) {
+    Poco::UInt64 archived(0);
+    err = ArchiveTimeEntries(&archived);
+  }
+  if (err != kopsik::noError) {
+    logger().warning(err);
+  }
+
+  scheduleDatabaseMaintenance(
+    Poco::Timestamp() + kDatabaseMaintenanceIntervalMicros);
+}
+
+// The snapshot is published with every change already. What's left
+// for whoever reads next are the indexes, columns and buckets over
+// the lists, which the change may have made stale. Rebuilding them
+// needs the write lock, so it waits until the user and the syncs
+// have let go for a while.
+void Context::onPrecompute(Poco::Util::TimerTask& task) {  // NOLINT
+  {
+    Poco::Mutex::ScopedLock lock(timer_m_);
+    precompute_scheduled_ = false;
+  }
+
+  Poco::Timestamp idle_at;
+  {
+    Poco::FastMutex::ScopedLock lock(activity_m_);
+    idle_at = last_activity_at_ + kPrecomputeIdleMicros;
+  }
+  if (idle_at > Poco::Timestamp()) {
+    schedulePrecompute(idle_at);
+    return;
+  }
+
+  logger().debug("onPrecompute executing");
+
+  Poco::Stopwatch stopwatch;
+  stopwatch.start();
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return;
+    }
+    user_->related.RefreshLookups();
+  }
+  stopwatch.stop();
+  Metrics::Shared().Time("precompute", stopwatch.elapsed());
+}
+
+void Context::scheduleExternalChangesCheck() {
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  if (external_changes_check_scheduled_) {
+    return;
+  }
+  external_changes_check_scheduled_ = true;
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onCheckExternalChanges,
+      &workers_, kopsik::WorkerPool::Background);
+  scheduleDeferrable(ptask, Poco::Timestamp() + kExternalChangesCheckMicros);
+}
+
+void Context::onCheckExternalChanges(Poco::Util::TimerTask& task) {  // NOLINT
+  {
+    Poco::Mutex::ScopedLock lock(timer_m_);
+    external_changes_check_scheduled_ = false;
+  }
+
+  std::set<std::string> tables;
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+    if (database()) {
+      err = database()->ExternalChanges(&tables);
+    }
+  }
+
+  if (err == kopsik::noError
+      && (tables.count("settings") || tables.count("sessions"))) {
+    dropSettingsCache(&tables);
+    tables.erase("settings");
+    tables.erase("sessions");
+  }
+
+  Poco::UInt64 UID(0);
+  Poco::UInt64 since(0);
+  if (err == kopsik::noError && !tables.empty()) {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    // Unless the related data is still to be loaded anyway
+    if (user_ && related_data_loaded_) {
+      UID = user_->ID();
+      since = user_->TimeEntriesLoadedSince();
+    }
+  }
+
+  std::vector<kopsik::ModelChange> changes;
+  if (UID) {
+    logger().debug("onCheckExternalChanges reloading");
+
+    kopsik::RelatedData loaded;
+    {
+      InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+      if (database()) {
+        err = database()->LoadTables(UID, tables, since, &loaded);
+      }
+    }
+
+    if (err == kopsik::noError) {
+      InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+      if (user_ && user_->ID() == UID) {
+        kopsik::RelatedData *related = &user_->related;
+        if (tables.count("workspaces")) {
+          refreshLoadedModels(&loaded.Workspaces, &related->Workspaces,
+                              since, related, &changes);
+        }
+        if (tables.count("clients")) {
+          refreshLoadedModels(&loaded.Clients, &related->Clients,
+                              since, related, &changes);
+        }
+        if (tables.count("projects")) {
+          refreshLoadedModels(&loaded.Projects, &related->Projects,
+                              since, related, &changes);
+        }
+        if (tables.count("tasks")) {
+          refreshLoadedModels(&loaded.Tasks, &related->Tasks,
+                              since, related, &changes);
+        }
+        if (tables.count("tags")) {
+          refreshLoadedModels(&loaded.Tags, &related->Tags,
+                              since, related, &changes);
+        }
+        if (tables.count("time_entries")) {
+          refreshLoadedModels(&loaded.TimeEntries, &related->TimeEntries,
+                              since, related, &changes);
+        }
+        related->ClearLookups();
+        // The other process has journaled its pushes too
+        related->Outbox.Clear();
+      }
+    }
+
+    // Whatever was not refreshed
+    deleteLoadedModels(&loaded.Workspaces);
+    deleteLoadedModels(&loaded.Clients);
+    deleteLoadedModels(&loaded.Projects);
+    deleteLoadedModels(&loaded.Tasks);
+    deleteLoadedModels(&loaded.Tags);
+    deleteLoadedModels(&loaded.TimeEntries);
+  }
+
+  if (err != kopsik::noError) {
+    logger().warning(err);
+  } else if (!changes.empty()) {
+    notifyModelChanges(changes);
+  }
+
+  scheduleExternalChangesCheck();
+}
+
+void Context::onLoadRelatedData(Poco::Util::TimerTask& task) {  // NOLINT
+  logger().debug("onLoadRelatedData");
+
+  TraceSpan trace("Context::onLoadRelatedData");
+
+  Poco::UInt64 UID(0);
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return;
+    }
+    UID = user_->ID();
+  }
+
+  kopsik::RelatedData loaded;
+  Poco::UInt64 loaded_since(0);
+  kopsik::error err = checkDatabase();
+  if (err == kopsik::noError) {
+    err = database()->LoadRelatedData(UID, &loaded, &loaded_since);
+  }
+
+  // The index built from what was just loaded, as saved last time
+  Poco::SharedPtr<AutocompleteIndex> stored(new AutocompleteIndex());
+  Poco::UInt64 stored_generation(0);
+  bool stored_found(false);
+  if (err == kopsik::noError) {
+    kopsik::error index_err = database()->LoadAutocompleteIndex(
+      UID, stored.get(), &stored_generation, &stored_found);
+    if (index_err != kopsik::noError) {
+      // It's built again anyway
+      logger().warning(index_err);
+      stored_found = false;
+    }
+  }
+
+  std::vector<kopsik::ModelChange> changes;
+  if (err == kopsik::noError) {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (user_ && user_->ID() == UID) {
+      kopsik::RelatedData *related = &user_->related;
+      mergeLoadedModels(&loaded.Workspaces, &related->Workspaces,
+                        related, &changes);
+      mergeLoadedModels(&loaded.Clients, &related->Clients,
+                        related, &changes);
+      mergeLoadedModels(&loaded.Projects, &related->Projects,
+                        related, &changes);
+      mergeLoadedModels(&loaded.Tasks, &related->Tasks,
+                        related, &changes);
+      mergeLoadedModels(&loaded.Tags, &related->Tags,
+                        related, &changes);
+      mergeLoadedModels(&loaded.TimeEntries, &related->TimeEntries,
+                        related, &changes);
+
+      // Older entries may have been loaded meanwhile by paging
+      Poco::UInt64 before = user_->TimeEntriesLoadedSince();
+      if (!loaded_since || (before && before < loaded_since)) {
+        loaded_since = before;
+      }
+      user_->SetTimeEntriesLoadedSince(loaded_since);
+      related_data_loaded_ = true;
+
+      // Unless something was changed, or saved, since it was read
+      Poco::UInt64 generation(0);
+      if (stored_found && related->DirtyModels.empty()
+          && database()->SnapshotGeneration(&generation) == kopsik::noError
+          && generation == stored_generation) {
+        autocomplete_index_file_current_ = true;
+        autocomplete_index_file_generation_ = generation;
+        Poco::FastMutex::ScopedLock stored_lock(stored_autocomplete_m_);
+        stored_autocomplete_ = stored;
+        autocompleteGenerations(&stored_autocomplete_generations_);
+      }
+    }
+  }
+
+  // Whatever was not merged
+  deleteLoadedModels(&loaded.Workspaces);
+  deleteLoadedModels(&loaded.Clients);
+  deleteLoadedModels(&loaded.Projects);
+  deleteLoadedModels(&loaded.Tasks);
+  deleteLoadedModels(&loaded.Tags);
+  deleteLoadedModels(&loaded.TimeEntries);
+
+  if (err != kopsik::noError) {
+    on_error_callback_(err.c_str());
+    return;
+  }
+  notifyModelChanges(changes);
+}
+
+void Context::SetProgressiveLogin(const bool value) {
+  InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+  progressive_login_ = value;
+}
+
+void Context::SetPerWorkspaceSync(const bool value) {
+  InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+  per_workspace_sync_ = value;
+}
+
+bool Context::LoginSyncPending() const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+  return user_ && login_sync_pending_;
+}
+
+kopsik::error Context::Login(
+    const std::string email,
+    const std::string password) {
+  bool progressive(false);
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    progressive = progressive_login_;
+  }
+
+  // No use logging in with nowhere to keep the user
+  kopsik::error err = checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
+  }
+
+  kopsik::User *logging_in = new kopsik::User(app_name_, app_version_);
+
+  kopsik::HTTPSClient default_client(api_url_,
+                                     app_name_,
+                                     app_version_);
+  kopsik::HTTPSClient *https_client =
+    https_client_ ? https_client_ : &default_client;
+  https_client->SetCancellation(requestCancellation());
+  err = logging_in->Login(https_client, email, password, !progressive);
+  if (err != kopsik::noError) {
+    delete logging_in;
+    return err;
+  }
+
+  poco_assert(logging_in->ID() > 0);
+
+  err = database()->LoadUserByID(logging_in->ID(), logging_in, true);
+  if (err != kopsik::noError) {
+    delete logging_in;
+    return err;
+  }
+
+  if (progressive) {
+    // Only a head start, the full sync brings it in anyway
+    err = logging_in->FetchRunningTimeEntry(https_client);
+    if (err != kopsik::noError) {
+      logger().warning("Running time entry not fetched at login: " + err);
+    }
+  }
+
+  err = SetCurrentAPIToken(logging_in->APIToken());
+  if (err != kopsik::noError) {
+    delete logging_in;
+    return err;
+  }
+
+  std::vector<kopsik::ModelChange> changes;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (user_) {
+      delete user_;
+    }
+    user_ = logging_in;
+    related_data_loaded_ = true;
+    login_sync_pending_ = progressive;
+
+    err = save(&changes);
+  }
+  notifyModelChanges(changes);
+  if (progressive) {
+    FullSync();
+  }
+  scheduleDatabaseMaintenance(
+    Poco::Timestamp() + kDatabaseMaintenanceIntervalMicros);
+  return err;
+}
+
+kopsik::error Context::SetLoggedInUserFromJSON(
+    const std::string &json) {
+  kopsik::User *import = new kopsik::User(app_name_, app_version_);
+
+  LoadUserFromJSONString(import, json, true, true);
+
+  kopsik::error err = SetCurrentAPIToken(import->APIToken());
+  if (err != kopsik::noError) {
+    delete import;
+    return err;
+  }
+
+  std::vector<kopsik::ModelChange> changes;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (user_) {
+      delete user_;
+    }
+    user_ = import;
+    related_data_loaded_ = true;
+    login_sync_pending_ = false;
+
+    err = save(&changes);
+  }
+  notifyModelChanges(changes);
+  return err;
+}
+
+kopsik::error Context::Logout() {
+  try {
+    {
+      InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+      if (!user_) {
+        logger().warning("User is logged out, cannot logout again");
+        return kopsik::noError;
+      }
+    }
+
+    Shutdown();
+
+    {
+      Poco::Mutex::ScopedLock lock(settings_m_);
+      // Without a database, there's no token kept to clear
+      kopsik::error err = kopsik::noError;
+      if (database()) {
+        err = database()->ClearCurrentAPIToken();
+      }
+      api_token_loaded_ = err == kopsik::noError;
+      api_token_ = "";
+      if (err != kopsik::noError) {
+        return err;
+      }
+    }
+
+    {
+      InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+      if (user_) {
+        delete user_;
+        user_ = 0;
+      }
+      related_data_loaded_ = false;
+      login_sync_pending_ = false;
+    }
+    publishSnapshot();
+    releaseMemory();
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  } catch(const std::string& ex) {
+    return ex;
+  }
+  return kopsik::noError;
+}
+
+kopsik::error Context::ClearCache() {
+  try {
+    {
+      InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+      if (!user_) {
+        logger().warning("User is logged out, cannot clear cache");
+        return kopsik::noError;
+      }
+      kopsik::error err = checkDatabase();
+      if (err != kopsik::noError) {
+        return err;
+      }
+      err = database()->DeleteUser(user_, true);
+      if (err != kopsik::noError) {
+        return err;
+      }
+    }
+
+    return Logout();
+  } catch(const Poco::Exception& exc) {
+      return exc.displayText();
+  } catch(const std::exception& ex) {
+      return ex.what();
+  } catch(const std::string& ex) {
+      return ex;
+  }
+  return kopsik::noError;
+}
+
+kopsik::error Context::Save() {
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      logger().warning("User is logged out, cannot save");
+      return kopsik::noError;
+    }
+    err = save(&changes);
+  }
+  notifyModelChanges(changes);
+  return err;
+}
+
+void Context::UpdateMemoryMetrics() {
+  std::map<std::string, std::size_t> bytes;
+  std::map<std::string, std::size_t> related;
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (user_) {
+      user_->related.MemoryUsage(&related);
+      bytes["user"] = user_->MemoryBytes();
+    } else {
+      // Zeros for all of the lists
+      RelatedData none;
+      none.MemoryUsage(&related);
+      bytes["user"] = 0;
+    }
+  }
+  for (std::map<std::string, std::size_t>::const_iterator it =
+      related.begin();
+      it != related.end();
+      it++) {
+    bytes["related." + it->first] = it->second;
+  }
+
+  Poco::AutoPtr<UserSnapshot> snapshot = Snapshot();
+  bytes["snapshot"] = snapshot.isNull() ? 0 : snapshot->MemoryBytes();
+  bytes["autocomplete"] = snapshot.isNull() || snapshot->Autocomplete.isNull()
+    ? 0 : snapshot->Autocomplete->MemoryBytes();
+
+  {
+    InstrumentedMutex::ScopedLock lock(db_m_, __FUNCTION__);
+    kopsik::Database *db = database();
+    bytes["timeline.buffer"] = db ? db->TimelineBufferBytes() : 0;
+    bytes["report.cache"] = db ? db->ReportCacheBytes() : 0;
+  }
+  bytes["timeline.strings"] = StringTable::Timeline().MemoryBytes();
+  bytes["descriptions"] = StringTable::Descriptions().MemoryBytes();
+  bytes["model_pools"] = ModelPools::Shared().Bytes();
+
+  {
+    Poco::Mutex::ScopedLock lock(ws_client_m_);
+    bytes["websocket.buffers"] = ws_client_ ? ws_client_->BufferBytes() : 0;
+  }
+
+  Metrics &metrics = Metrics::Shared();
+  for (std::map<std::string, std::size_t>::const_iterator it = bytes.begin();
+      it != bytes.end();
+      it++) {
+    metrics.SetGauge("memory." + it->first,
+                     static_cast<Poco::Int64>(it->second));
+  }
+}
+
+// 0 when there's no such file
+static Poco::Int64 fileBytes(const std::string &path) {
+  try {
+    Poco::File file(path);
+    if (file.exists()) {
+      return static_cast<Poco::Int64>(file.getSize());
+    }
+  } catch(const Poco::Exception&) {
+    // Removed meanwhile
+  }
+  return 0;
+}
+
+std::string Context::PerformanceSnapshot() {
+  UpdateMemoryMetrics();
+
+  JSONWriter writer;
+  writer.BeginObject();
+  writer.Raw("metrics", Metrics::Shared().JSON());
+  writer.Raw("slow_api_calls", ApiWatchdog::Shared().JSON());
+
+  writer.Key("models");
+  writer.BeginObject();
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (user_) {
+      writer.Int("workspaces", user_->related.Workspaces.size());
+      writer.Int("clients", user_->related.Clients.size());
+      writer.Int("projects", user_->related.Projects.size());
+      writer.Int("tasks", user_->related.Tasks.size());
+      writer.Int("tags", user_->related.Tags.size());
+      writer.Int("time_entries", user_->related.TimeEntries.size());
+    }
+  }
+  writer.EndObject();
+
+  std::string path("");
+  {
+    Poco::Mutex::ScopedLock lock(db_open_m_);
+    path = db_open_path_;
+  }
+  writer.Key("database");
+  writer.BeginObject();
+  if (!path.empty()) {
+    writer.Int("bytes", fileBytes(path));
+    writer.Int("wal_bytes", fileBytes(path + "-wal"));
+    writer.Int("snapshot_bytes", fileBytes(path + "-snapshot"));
+  }
+  writer.EndObject();
+
+  writer.Raw("trace", Trace::Shared().JSON(kFeedbackTraceSpans));
+  writer.EndObject();
+  return writer.Buffer();
+}
+
+void Context::releaseMemory() {
+  ModelPools &pools = ModelPools::Shared();
+  StringTable &strings = StringTable::Timeline();
+
+  Metrics &metrics = Metrics::Shared();
+  metrics.SetGauge("memory.release.model_pools.before",
+                   static_cast<Poco::Int64>(pools.Bytes()));
+  metrics.SetGauge("memory.release.timeline.strings.before",
+                   static_cast<Poco::Int64>(strings.MemoryBytes()));
+
+  std::size_t released = pools.Trim();
+  strings.Sweep();
+  StringTable::Descriptions().Sweep();
+  kopsik::ReleaseFreeHeap();
+
+  metrics.SetGauge("memory.release.model_pools.after",
+                   static_cast<Poco::Int64>(pools.Bytes()));
+  metrics.SetGauge("memory.release.timeline.strings.after",
+                   static_cast<Poco::Int64>(strings.MemoryBytes()));
+
+  KOPSIK_LOG_DEBUG(logger(), "Released " << released
+    << " bytes of model pools");
+}
+
+bool Context::UserHasPremiumWorkspaces() const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
+  return (user_ && user_->HasPremiumWorkspaces());
+}
+
+bool Context::UserIsLoggedIn() const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
+  return (user_ && user_->ID());
+}
+
+Poco::UInt64 Context::UsersDefaultWID() const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
+  return (user_ && user_->DefaultWID());
+}
+
+void Context::CollectPushableTimeEntries(
+    std::vector<kopsik::TimeEntry *> *models) const {
+  poco_assert(models);
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
+  if (!user_) {
+    return;
+  }
+  user_->CollectPushableTimeEntries(models);
+}
+
+std::vector<std::string> Context::Tags() const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+  return tags();
+}
+
+std::vector<std::string> Context::tags() const {
+  std::vector<std::string> tags;
+  if (!user_) {
+    return tags;
+  }
+  if (user_->related.TagNamesComplete()) {
+    user_->related.TagNames.Names(&tags);
+    return tags;
+  }
+  std::set<std::string> unique_names;
+  for (std::vector<kopsik::Tag *>::const_iterator it =
+      user_->related.Tags.begin();
+        it != user_->related.Tags.end();
+        it++) {
+    kopsik::Tag *tag = *it;
+    if (unique_names.find(tag->Name()) != unique_names.end()) {
+      continue;
+    }
+    unique_names.insert(tag->Name());
+    tags.push_back(tag->Name());
+  }
+  std::sort(tags.rbegin(), tags.rend());
+  return tags;
+}
+
+std::vector<kopsik::Workspace *> Context::Workspaces() const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
+  std::vector<kopsik::Workspace *> result;
+  if (!user_) {
+    logger().warning("User logged out, cannot fetch workspaces");
+    return result;
+  }
+  result = user_->related.Workspaces;
+  std::sort(result.rbegin(), result.rend(), CompareWorkspaceByName);
+  return result;
+}
+
+std::vector<kopsik::Client *> Context::Clients(
+    const Poco::UInt64 workspace_id) const {
+  poco_assert(workspace_id);
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+  std::vector<kopsik::Client *> result;
+  if (!user_) {
+    logger().warning("User logged out, cannot fetch clients");
+    return result;
+  }
+  user_->related.Buckets.ClientsInWorkspace(workspace_id, &result);
+  std::sort(result.rbegin(), result.rend(), CompareClientByName);
+  return result;
+}
+
+kopsik::TimeEntry *Context::Start(
+    const std::string description,
+    const std::string duration,
+    const Poco::UInt64 task_id,
+    const Poco::UInt64 project_id,
+    SaveListener *saved) {
+  std::auto_ptr<SaveListener> listener(saved);
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::TimeEntry *te = 0;
+  bool needs_push(false);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return 0;
+    }
+    te = user_->Start(description, duration, task_id, project_id);
+    if (!te) {
+      return 0;
+    }
+    saveEdit(&changes, listener.release());
+    needs_push = te->NeedsPush();
+  }
+  notifyModelChanges(changes);
+  if (needs_push) {
+    partialSync();
+  }
+  return te;
+}
+
+kopsik::TimeEntry *Context::ContinueLatest(SaveListener *saved) {
+  std::auto_ptr<SaveListener> listener(saved);
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::TimeEntry *te = 0;
+  bool needs_push(false);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return 0;
+    }
+    kopsik::TimeEntry *latest = user_->Latest();
+    if (!latest) {
+      return 0;
+    }
+    te = user_->Continue(latest->GUID());
+    if (!te) {
+      return 0;
+    }
+    saveEdit(&changes, listener.release());
+    needs_push = te->NeedsPush();
+  }
+  notifyModelChanges(changes);
+  if (needs_push) {
+    partialSync();
+  }
+  return te;
+}
+
+kopsik::TimeEntry *Context::Continue(
+    const std::string GUID,
+    SaveListener *saved) {
+  std::auto_ptr<SaveListener> listener(saved);
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::TimeEntry *te = 0;
+  bool needs_push(false);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return 0;
+    }
+    te = user_->Continue(GUID);
+    if (!te) {
+      return 0;
+    }
+    saveEdit(&changes, listener.release());
+    needs_push = te->NeedsPush();
+  }
+  notifyModelChanges(changes);
+  if (needs_push) {
+    partialSync();
+  }
+  return te;
+}
+
+kopsik::error Context::DeleteTimeEntryByGUID(
+    const std::string GUID,
+    SaveListener *saved) {
+  std::auto_ptr<SaveListener> listener(saved);
+  std::vector<kopsik::ModelChange> changes;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to delete time entry");
+    }
+    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    if (!te) {
+      return kopsik::error("Time entry not found");
+    }
+    te->Delete();
+
+    changes.push_back(
+      kopsik::ModelChange(te, kopsik::ModelChange::Delete));
+
+    saveEdit(&changes, listener.release());
+  }
+  notifyModelChanges(changes);
+  partialSync();
+  return kopsik::noError;
+}
+
+kopsik::TimeEntry *Context::GetTimeEntryByGUID(const std::string GUID) const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
+  if (!user_) {
+    return 0;
+  }
+  return user_->GetTimeEntryByGUID(GUID);
+}
+
+kopsik::error Context::SetTimeEntryDuration(
+    const std::string GUID,
+    const std::string duration,
+    SaveListener *saved) {
+  TimeEntryEdit edit;
+  edit.fields = kEditDuration;
+  edit.duration = duration;
+  return EditTimeEntry(GUID, edit, saved);
+}
+
+kopsik::error Context::SetTimeEntryProject(
+    const std::string GUID,
+    const Poco::UInt64 task_id,
+    const Poco::UInt64 project_id,
+    const std::string project_guid,
+    SaveListener *saved) {
+  TimeEntryEdit edit;
+  edit.fields = kEditProject;
+  edit.task_id = task_id;
+  edit.project_id = project_id;
+  edit.project_guid = project_guid;
+  return EditTimeEntry(GUID, edit, saved);
+}
+
+kopsik::error Context::SetTimeEntryStartISO8601(
+    const std::string GUID,
+    const std::string value,
+    SaveListener *saved) {
+  TimeEntryEdit edit;
+  edit.fields = kEditStart;
+  edit.start = value;
+  return EditTimeEntry(GUID, edit, saved);
+}
+
+kopsik::error Context::SetTimeEntryEndISO8601(
+    const std::string GUID,
+    const std::string value,
+    SaveListener *saved) {
+  TimeEntryEdit edit;
+  edit.fields = kEditEnd;
+  edit.end = value;
+  return EditTimeEntry(GUID, edit, saved);
+}
+
+kopsik::error Context::SetTimeEntryTags(
+    const std::string GUID,
+    const std::string value,
+    SaveListener *saved) {
+  TimeEntryEdit edit;
+  edit.fields = kEditTags;
+  edit.tags = value;
+  return EditTimeEntry(GUID, edit, saved);
+}
+
+kopsik::error Context::SetTimeEntryBillable(
+    const std::string GUID,
+    const bool value,
+    SaveListener *saved) {
+  TimeEntryEdit edit;
+  edit.fields = kEditBillable;
+  edit.billable = value;
+  return EditTimeEntry(GUID, edit, saved);
+}
+
+kopsik::error Context::SetTimeEntryDescription(
+    const std::string GUID,
+    const std::string value,
+    SaveListener *saved) {
+  TimeEntryEdit edit;
+  edit.fields = kEditDescription;
+  edit.description = value;
+  return EditTimeEntry(GUID, edit, saved);
+}
+
+kopsik::error Context::EditTimeEntry(
+    const std::string GUID,
+    const TimeEntryEdit &edit,
+    SaveListener *saved) {
+  std::auto_ptr<SaveListener> listener(saved);
+  if (GUID.empty()) {
+    return kopsik::error("Missing GUID");
+  }
+  bool needs_push(false);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to change time entry");
+    }
+    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
+    if (!te) {
+      return kopsik::error("Time entry not found");
+    }
+    applyEdit(te, edit);
+    scheduleEditSave(listener.release());
+    needs_push = te->NeedsPush();
+  }
+  if (needs_push) {
+    partialSync();
+  }
+  return kopsik::noError;
+}
 
-    kopsik::error err = db_->ClearCurrentAPIToken();
+kopsik::error Context::EditTimeEntries(
+    const std::vector<std::string> &GUIDs,
+    const TimeEntryEdit &edit,
+    SaveListener *saved) {
+  std::auto_ptr<SaveListener> listener(saved);
+  std::vector<kopsik::ModelChange> changes;
+  bool needs_push(false);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to change time entries");
+    }
+    std::vector<kopsik::TimeEntry *> time_entries;
+    kopsik::error err = timeEntriesByGUID(GUIDs, &time_entries);
     if (err != kopsik::noError) {
       return err;
     }
-
-    if (user_) {
-      Poco::Mutex::ScopedLock lock(user_m_);
-      delete user_;
-      user_ = 0;
+    for (std::vector<kopsik::TimeEntry *>::const_iterator it =
+          time_entries.begin();
+        it != time_entries.end();
+        it++) {
+      applyEdit(*it, edit);
+      needs_push = needs_push || (*it)->NeedsPush();
     }
-  } catch(const Poco::Exception& exc) {
-    return exc.displayText();
-  } catch(const std::exception& ex) {
-    return ex.what();
-  } catch(const std::string& ex) {
-    return ex;
+    saveEdit(&changes, listener.release());
+  }
+  notifyModelChanges(changes);
+  if (needs_push) {
+    partialSync();
   }
   return kopsik::noError;
 }
 
-kopsik::error Context::ClearCache() {
-  try {
+kopsik::error Context::DeleteTimeEntries(
+    const std::vector<std::string> &GUIDs,
+    SaveListener *saved) {
+  std::auto_ptr<SaveListener> listener(saved);
+  std::vector<kopsik::ModelChange> changes;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
     if (!user_) {
-      logger().warning("User is logged out, cannot clear cache");
-      return kopsik::noError;
+      return kopsik::error("Please login to delete time entries");
     }
-    kopsik::error err = db_->DeleteUser(user_, true);
+    std::vector<kopsik::TimeEntry *> time_entries;
+    kopsik::error err = timeEntriesByGUID(GUIDs, &time_entries);
     if (err != kopsik::noError) {
       return err;
     }
-
-    return Logout();
-  } catch(const Poco::Exception& exc) {
-      return exc.displayText();
-  } catch(const std::exception& ex) {
-      return ex.what();
-  } catch(const std::string& ex) {
-      return ex;
+    for (std::vector<kopsik::TimeEntry *>::const_iterator it =
+          time_entries.begin();
+        it != time_entries.end();
+        it++) {
+      (*it)->Delete();
+      changes.push_back(
+        kopsik::ModelChange(*it, kopsik::ModelChange::Delete));
+    }
+    saveEdit(&changes, listener.release());
   }
+  notifyModelChanges(changes);
+  partialSync();
   return kopsik::noError;
 }
 
-bool Context::UserHasPremiumWorkspaces() const {
-  return (user_ && user_->HasPremiumWorkspaces());
-}
-
-bool Context::UserIsLoggedIn() const {
-  return (user_ && user_->ID());
-}
-
-Poco::UInt64 Context::UsersDefaultWID() const {
-  return (user_ && user_->DefaultWID());
-}
-
-void Context::CollectPushableTimeEntries(
-    std::vector<kopsik::TimeEntry *> *models) const {
-  poco_assert(models);
-
-  if (!user_) {
-    return;
+kopsik::error Context::timeEntriesByGUID(
+    const std::vector<std::string> &GUIDs,
+    std::vector<kopsik::TimeEntry *> *result) const {
+  if (GUIDs.empty()) {
+    return kopsik::error("Missing GUID");
   }
-  user_->CollectPushableTimeEntries(models);
+  result->reserve(GUIDs.size());
+  for (std::vector<std::string>::const_iterator it = GUIDs.begin();
+      it != GUIDs.end();
+      it++) {
+    kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(*it);
+    if (!te) {
+      return kopsik::error("Time entry not found");
+    }
+    result->push_back(te);
+  }
+  return kopsik::noError;
 }
 
-std::vector<std::string> Context::Tags() const {
-  std::vector<std::string> tags;
-  if (!user_) {
-    return tags;
+void Context::applyEdit(
+    kopsik::TimeEntry *te,
+    const TimeEntryEdit &edit) {
+  if (edit.fields & kEditDescription) {
+    te->SetDescription(edit.description);
   }
-  std::set<std::string> unique_names;
-  for (std::vector<kopsik::Tag *>::const_iterator it =
-      user_->related.Tags.begin();
-        it != user_->related.Tags.end();
-        it++) {
-    kopsik::Tag *tag = *it;
-    if (unique_names.find(tag->Name()) != unique_names.end()) {
-      continue;
+  // Before billable, so that billable given with the project wins
+  // over the project's own
+  if (edit.fields & kEditProject) {
+    kopsik::Project *p = 0;
+    if (edit.project_id) {
+      p = user_->GetProjectByID(edit.project_id);
     }
-    unique_names.insert(tag->Name());
-    tags.push_back(tag->Name());
+    if (!edit.project_guid.empty()) {
+      p = user_->GetProjectByGUID(edit.project_guid);
+    }
+    if (p) {
+      te->SetBillable(p->Billable());
+    }
+    te->SetTID(edit.task_id);
+    te->SetPID(edit.project_id);
+    te->SetProjectGUID(edit.project_guid);
   }
-  std::sort(tags.rbegin(), tags.rend());
-  return tags;
-}
-
-std::vector<kopsik::Workspace *> Context::Workspaces() const {
-  std::vector<kopsik::Workspace *> result;
-  if (!user_) {
-    logger().warning("User logged out, cannot fetch workspaces");
-    return result;
+  if (edit.fields & kEditBillable) {
+    te->SetBillable(edit.billable);
   }
-  result = user_->related.Workspaces;
-  std::sort(result.rbegin(), result.rend(), CompareWorkspaceByName);
-  return result;
-}
-
-std::vector<kopsik::Client *> Context::Clients(
-    const Poco::UInt64 workspace_id) const {
-  poco_assert(workspace_id);
-  std::vector<kopsik::Client *> result;
-  if (!user_) {
-    logger().warning("User logged out, cannot fetch clients");
-    return result;
+  if (edit.fields & kEditTags) {
+    te->SetTags(edit.tags);
   }
-  for (std::vector<kopsik::Client *>::const_iterator it =
-      user_->related.Clients.begin();
-        it != user_->related.Clients.end();
-        it++) {
-    kopsik::Client *client = *it;
-    if (client->WID() != workspace_id) {
-      continue;
-    }
-    result.push_back(client);
+  if (edit.fields & kEditStart) {
+    te->SetStartUserInput(edit.start);
   }
-  std::sort(result.rbegin(), result.rend(), CompareClientByName);
-  return result;
-}
-
-kopsik::TimeEntry *Context::Start(
-    const std::string description,
-    const std::string duration,
-    const Poco::UInt64 task_id,
-    const Poco::UInt64 project_id) {
-  if (!user_) {
-    return 0;
+  if (edit.fields & kEditEnd) {
+    te->SetStopUserInput(edit.end);
   }
-  kopsik::TimeEntry *te =
-    user_->Start(description, duration, task_id, project_id);
-  if (!te) {
-    return 0;
+  if (edit.fields & kEditDuration) {
+    te->SetDurationUserInput(edit.duration);
   }
-  save();
-  if (te->NeedsPush()) {
-    partialSync();
+  if (te->Dirty()) {
+    te->SetUIModifiedAt(time(0));
   }
-  return te;
 }
 
-kopsik::TimeEntry *Context::ContinueLatest() {
-  if (!user_) {
-    return 0;
+kopsik::error Context::Stop(
+    kopsik::TimeEntry **stopped_entry,
+    SaveListener *saved) {
+  std::auto_ptr<SaveListener> listener(saved);
+  *stopped_entry = 0;
+  std::vector<kopsik::ModelChange> changes;
+  bool needs_push(false);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to stop time tracking");
+    }
+
+    std::vector<kopsik::TimeEntry *> stopped = user_->Stop();
+    if (stopped.empty()) {
+      return kopsik::error("No time entry was found to stop");
+    }
+    *stopped_entry = stopped[0];
+    saveEdit(&changes, listener.release());
+    needs_push = (*stopped_entry)->NeedsPush();
   }
-  kopsik::TimeEntry *latest = user_->Latest();
-  if (!latest) {
-    return 0;
+  notifyModelChanges(changes);
+  if (needs_push) {
+    partialSync();
   }
-  kopsik::TimeEntry *te = user_->Continue(latest->GUID());
-  if (!te) {
-    return 0;
+  return kopsik::noError;
+}
+
+kopsik::error Context::SplitAt(
+    const Poco::Int64 at,
+    kopsik::TimeEntry **new_running_entry) {
+  *new_running_entry = 0;
+  bool needs_push(false);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Pleae login to split time entry");
+    }
+
+    *new_running_entry = user_->SplitAt(at);
+    if (!*new_running_entry) {
+      return kopsik::error("Failed to split tracking time entry");
+    }
+    needs_push = (*new_running_entry)->NeedsPush();
   }
-  save();
-  if (te->NeedsPush()) {
+  publishSnapshot();
+  if (needs_push) {
     partialSync();
   }
-  return te;
+  return kopsik::noError;
 }
 
-kopsik::TimeEntry *Context::Continue(const std::string GUID) {
-  if (!user_) {
-    return 0;
-  }
-  kopsik::TimeEntry *te = user_->Continue(GUID);
-  if (!te) {
-    return 0;
+kopsik::error Context::StopAt(
+    const Poco::Int64 at,
+    kopsik::TimeEntry **stopped) {
+  std::vector<kopsik::ModelChange> changes;
+  bool needs_push(false);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to stop running time entry");
+    }
+
+    *stopped = user_->StopAt(at);
+    if (!stopped) {
+      return kopsik::error("Time entry not found to stop");
+    }
+    save(&changes);
+    needs_push = (*stopped)->NeedsPush();
   }
-  save();
-  if (te->NeedsPush()) {
+  notifyModelChanges(changes);
+  if (needs_push) {
     partialSync();
   }
-  return te;
+  return kopsik::noError;
 }
 
-kopsik::error Context::DeleteTimeEntryByGUID(const std::string GUID) {
-  if (!user_) {
-    return kopsik::error("Please login to delete time entry");
+kopsik::error Context::LoadOlderTimeEntries(bool *loaded) {
+  poco_assert(loaded);
+  *loaded = false;
+  Poco::UInt64 window = kTimeEntryLoadDays * 24 * 60 * 60;
+  Poco::UInt64 since(0);
+  Poco::UInt64 before(0);
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to load time entries");
+    }
+    kopsik::error err = checkDatabase();
+    if (err != kopsik::noError) {
+      return err;
+    }
+    before = user_->TimeEntriesLoadedSince();
+    if (before) {
+      since = before > window ? before - window : 0;
+      err = database()->LoadTimeEntriesSince(user_, since);
+      if (err != kopsik::noError) {
+        return err;
+      }
+      *loaded = true;
+    } else {
+      // All that's saved is loaded, the server may have older ones
+      err = database()->OldestTimeEntryFetch(user_->ID(), &before);
+      if (err != kopsik::noError) {
+        return err;
+      }
+      for (std::vector<kopsik::TimeEntry *>::const_iterator it =
+          user_->related.TimeEntries.begin();
+          it != user_->related.TimeEntries.end();
+          it++) {
+        if ((*it)->Start() && (!before || (*it)->Start() < before)) {
+          before = (*it)->Start();
+        }
+      }
+      if (!before) {
+        return kopsik::noError;
+      }
+      since = before > window ? before - window : 0;
+    }
   }
-  kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
-  if (!te) {
-    return kopsik::error("Time entry not found");
+  if (*loaded) {
+    publishSnapshot();
   }
-  te->Delete();
 
-  kopsik::ModelChange mc("time_entry", "delete", te->ID(), te->GUID());
-  on_model_change_callback_(mc);
-
-  save();
-  partialSync();
+  // Without the network, what's saved is all there is for now
+  Poco::UInt64 count(0);
+  kopsik::error err = FetchTimeEntries(since, before, &count);
+  if (err != kopsik::noError) {
+    logger().warning("Older time entries not downloaded: " + err);
+    return kopsik::noError;
+  }
+  // Past what's saved, a period the server had nothing for ends it
+  if (count) {
+    *loaded = true;
+  }
   return kopsik::noError;
 }
 
-kopsik::TimeEntry *Context::GetTimeEntryByGUID(const std::string GUID) const {
-  if (!user_) {
-    return 0;
-  }
-  return user_->GetTimeEntryByGUID(GUID);
-}
+kopsik::error Context::FetchTimeEntries(
+    const Poco::UInt64 since,
+    const Poco::UInt64 until,
+    Poco::UInt64 *count) {
+  poco_assert(count);
+  *count = 0;
 
-kopsik::error Context::SetTimeEntryDuration(
-    const std::string GUID,
-    const std::string duration) {
-  if (GUID.empty()) {
-    return kopsik::error("Missing GUID");
+  Poco::UInt64 uid(0);
+  std::string api_token("");
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to load time entries");
+    }
+    uid = user_->ID();
+    api_token = user_->APIToken();
   }
-  if (!user_) {
-    return kopsik::error("Log in to set time entry duration");
+  kopsik::error err = checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
   }
-  kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
-  if (!te) {
-    return kopsik::error("Time entry not found");
+  std::vector<kopsik::TimeEntryRange> ranges;
+  err = database()->UnfetchedTimeEntryRanges(uid, since, until, &ranges);
+  if (err != kopsik::noError || ranges.empty()) {
+    return err;
   }
-  te->SetDurationUserInput(duration);
-  if (te->Dirty()) {
-    te->SetUIModifiedAt(time(0));
+  if (kopsik::ConnectivityMonitor::Instance().IsOffline()) {
+    return kopsik::kRequestOffline;
   }
-  save();
-  if (te->NeedsPush()) {
-    partialSync();
+  return fetchTimeEntryRanges(uid, api_token, ranges, count);
+}
+
+kopsik::error Context::fetchTimeEntryRanges(
+    const Poco::UInt64 uid,
+    const std::string &api_token,
+    const std::vector<kopsik::TimeEntryRange> &ranges,
+    Poco::UInt64 *count) {
+  kopsik::HTTPSClient default_client(api_url_, app_name_, app_version_);
+  kopsik::HTTPSClient *https_client =
+    https_client_ ? https_client_ : &default_client;
+  Poco::UInt64 window = kTimeEntryLoadDays * 24 * 60 * 60;
+  kopsik::error err = kopsik::noError;
+  std::vector<kopsik::ModelChange> changes;
+  for (std::vector<kopsik::TimeEntryRange>::const_iterator it =
+      ranges.begin();
+      err == kopsik::noError && it != ranges.end();
+      it++) {
+    // A request per period, however long ago the range goes back
+    for (Poco::UInt64 from = it->since;
+        err == kopsik::noError && from < it->until;
+        from += window) {
+      Poco::UInt64 to = std::min(from + window, it->until);
+      std::string json("");
+      err = https_client->GetJSON(
+        kopsik::WorkspaceFetch::TimeEntriesURL(from, to),
+        api_token, "api_token", &json);
+      if (err != kopsik::noError) {
+        break;
+      }
+
+      InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+      // Unless the user logged out meanwhile
+      if (!user_ || user_->APIToken() != api_token) {
+        err = kopsik::kRequestCancelled;
+        break;
+      }
+      Poco::UInt64 loaded_since = user_->TimeEntriesLoadedSince();
+      if (loaded_since > from) {
+        err = database()->LoadTimeEntriesSince(user_, from);
+      }
+      std::size_t before = user_->related.TimeEntries.size();
+      kopsik::UserListLoader loader;
+      loader.SetTimeEntryWindow(from, to);
+      if (err == kopsik::noError) {
+        err = loader.Load(user_, "time_entries", json);
+      }
+      if (err == kopsik::noError) {
+        loader.Complete(user_, 0);
+        err = save(&changes);
+      }
+      if (err == kopsik::noError) {
+        err = database()->SaveTimeEntryFetch(uid, from, to);
+      }
+      if (user_->related.TimeEntries.size() > before) {
+        *count += user_->related.TimeEntries.size() - before;
+      }
+    }
   }
-  return kopsik::noError;
+  notifyModelChanges(changes);
+  return err;
 }
 
-kopsik::error Context::SetTimeEntryProject(
-    const std::string GUID,
-    const Poco::UInt64 task_id,
-    const Poco::UInt64 project_id,
-    const std::string project_guid) {
-  if (GUID.empty()) {
-    return kopsik::error("Missing GUID");
+kopsik::error Context::Reconcile(
+    const Poco::UInt64 since,
+    const Poco::UInt64 until,
+    Poco::UInt64 *mismatched_days) {
+  poco_assert(mismatched_days);
+  *mismatched_days = 0;
+
+  TraceSpan trace("Context::Reconcile");
+
+  Poco::UInt64 uid(0);
+  std::string api_token("");
+  kopsik::TimeEntryDigests::DayDigests local;
+  std::set<Poco::UInt64> unsettled;
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to reconcile time entries");
+    }
+    uid = user_->ID();
+    api_token = user_->APIToken();
+    kopsik::TimeEntryDigests::Compute(user_->related.TimeEntries,
+                                      since, until, &local, &unsettled);
+  }
+  if (kopsik::ConnectivityMonitor::Instance().IsOffline()) {
+    return kopsik::kRequestOffline;
+  }
+
+  kopsik::HTTPSClient default_client(api_url_, app_name_, app_version_);
+  kopsik::HTTPSClient *https_client =
+    https_client_ ? https_client_ : &default_client;
+  std::string json("");
+  kopsik::error err = https_client->GetJSON(
+    kopsik::WorkspaceFetch::TimeEntryDigestsURL(since, until),
+    api_token, "api_token", &json);
+  kopsik::TimeEntryDigests::DayDigests remote;
+  if (err == kopsik::noError) {
+    err = kopsik::TimeEntryDigests::Parse(json, &remote);
   }
-  if (!user_) {
-    return kopsik::error("Please login to select project");
+  if (err != kopsik::noError) {
+    return err;
   }
+  Metrics::Shared().Count("reconcile.bytes", json.size());
 
-  kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
-  if (!te) {
-    return kopsik::error("Time entry not found");
+  std::vector<kopsik::TimeEntryRange> ranges;
+  kopsik::TimeEntryDigests::Mismatched(local, remote, unsettled,
+                                       since, until, &ranges);
+  for (std::vector<kopsik::TimeEntryRange>::const_iterator it =
+        ranges.begin();
+      it != ranges.end();
+      it++) {
+    *mismatched_days += (it->until - it->since + kDigestDaySeconds - 1)
+                        / kDigestDaySeconds;
   }
+  Metrics::Shared().Count("reconcile.mismatched_days", *mismatched_days);
+  if (ranges.empty()) {
+    return kopsik::noError;
+  }
+  Poco::UInt64 count(0);
+  return fetchTimeEntryRanges(uid, api_token, ranges, &count);
+}
 
-  kopsik::Project *p = 0;
-  if (project_id) {
-    p = user_->GetProjectByID(project_id);
+kopsik::error Context::SearchTimeEntries(
+    const std::string &query,
+    const Poco::UInt64 offset,
+    const Poco::UInt64 limit,
+    std::vector<kopsik::TimeEntry *> *results) const {
+  poco_assert(results);
+  Poco::UInt64 uid(0);
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to search time entries");
+    }
+    uid = user_->ID();
   }
-  if (!project_guid.empty()) {
-    p = user_->GetProjectByGUID(project_guid);
+  kopsik::error err = checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
   }
+  return database()->SearchTimeEntries(uid, query, offset, limit, results);
+}
 
-  if (p) {
-    te->SetBillable(p->Billable());
+kopsik::error Context::LoadReport(
+    const int from_day,
+    const int to_day,
+    kopsik::Report *report) {
+  poco_assert(report);
+
+  // What the server has of older days, unless it was fetched before
+  Poco::LocalDateTime from(from_day / 10000, from_day / 100 % 100,
+                           from_day % 100);
+  int next_day = kopsik::Report::NextDay(to_day);
+  Poco::LocalDateTime to(next_day / 10000, next_day / 100 % 100,
+                         next_day % 100);
+  Poco::UInt64 count(0);
+  kopsik::error err = FetchTimeEntries(from.timestamp().epochTime(),
+                                       to.timestamp().epochTime(),
+                                       &count);
+  if (err != kopsik::noError) {
+    logger().warning("Reporting saved time entries only: " + err);
   }
-  te->SetTID(task_id);
-  te->SetPID(project_id);
-  te->SetProjectGUID(project_guid);
 
-  if (te->Dirty()) {
-    te->SetUIModifiedAt(time(0));
+  Poco::UInt64 uid(0);
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to see reports");
+    }
+    uid = user_->ID();
   }
-
-  save();
-  if (te->NeedsPush()) {
-    partialSync();
+  err = checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
   }
-
-  return kopsik::noError;
+  return database()->LoadReport(uid, from_day, to_day, report);
 }
 
-kopsik::error Context::SetTimeEntryStartISO8601(
-    const std::string GUID,
-    const std::string value) {
-  if (GUID.empty()) {
-    return kopsik::error("Missing GUID");
-  }
-  if (!user_) {
-    return kopsik::error("Please login to change time entry start time");
+kopsik::error Context::ExportTimeEntries(
+    const int from_day,
+    const int to_day,
+    kopsik::TimeEntryExport *out) const {
+  poco_assert(out);
+  Poco::UInt64 uid(0);
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to export time entries");
+    }
+    uid = user_->ID();
   }
-  kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
-  if (!te) {
-    return kopsik::error("Time entry not found");
+  kopsik::error err = checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
   }
-  te->SetStartUserInput(value);
-  if (te->Dirty()) {
-    te->SetUIModifiedAt(time(0));
+  return database()->ExportTimeEntries(uid, from_day, to_day, out);
+}
+
+kopsik::error Context::ImportTimeEntries(
+    kopsik::TimeEntryCSVReader *in,
+    kopsik::TimeEntryImportProgress *progress,
+    kopsik::TimeEntryImportResult *result) {
+  poco_assert(in);
+  poco_assert(result);
+
+  TraceSpan trace("Context::ImportTimeEntries");
+
+  std::vector<kopsik::TimeEntryImportRow> rows(kImportChunkRows);
+  bool more = true;
+  while (more) {
+    // Read outside the lock, the file can be slow to read
+    std::size_t count = 0;
+    while (count < rows.size()) {
+      kopsik::error err = kopsik::noError;
+      if (!in->Next(&rows[count], &err)) {
+        if (err != kopsik::noError) {
+          return err;
+        }
+        more = false;
+        break;
+      }
+      if (err != kopsik::noError) {
+        result->Invalid++;
+        if (result->FirstError == kopsik::noError) {
+          result->FirstError = err;
+        }
+        continue;
+      }
+      count++;
+    }
+
+    if (count) {
+      std::vector<kopsik::ModelChange> changes;
+      kopsik::error err = importTimeEntryRows(rows, count, result, &changes);
+      notifyModelChanges(changes);
+      if (err != kopsik::noError) {
+        return err;
+      }
+    }
+    if (progress) {
+      progress->Imported(*result);
+    }
   }
-  save();
-  if (te->NeedsPush()) {
+
+  if (result->Imported) {
     partialSync();
   }
   return kopsik::noError;
 }
 
-kopsik::error Context::SetTimeEntryEndISO8601(
-    const std::string GUID,
-    const std::string value) {
-  if (GUID.empty()) {
-    return kopsik::error("Missing GUID");
-  }
+kopsik::error Context::importTimeEntryRows(
+    const std::vector<kopsik::TimeEntryImportRow> &rows,
+    const std::size_t count,
+    kopsik::TimeEntryImportResult *result,
+    std::vector<kopsik::ModelChange> *changes) {
+  InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
   if (!user_) {
-    return kopsik::error("Please login to change time entry end time");
-  }
-  kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
-  if (!te) {
-    return kopsik::error("Time entry not found");
-  }
-  te->SetStopUserInput(value);
-  if (te->Dirty()) {
-    te->SetUIModifiedAt(time(0));
-  }
-  save();
-  if (te->NeedsPush()) {
-    partialSync();
+    return kopsik::error("Please login to import time entries");
   }
-  return kopsik::noError;
-}
+  const Poco::UInt64 wid = user_->DefaultWID();
 
-kopsik::error Context::SetTimeEntryTags(
-    const std::string GUID,
-    const std::string value) {
-  if (GUID.empty()) {
-    return kopsik::error("Missing GUID");
+  // Names of the workspace, by lower case, looked up once a chunk.
+  // Projects are known by client and name, and by name alone for
+  // rows without a client.
+  std::map<std::string, kopsik::Client *> clients;
+  for (std::vector<kopsik::Client *>::const_iterator it =
+        user_->related.Clients.begin();
+      it != user_->related.Clients.end();
+      it++) {
+    if ((*it)->WID() == wid) {
+      clients.insert(std::make_pair(Poco::toLower((*it)->Name()), *it));
+    }
   }
-  if (!user_) {
-    return kopsik::error("Please login to change time entry tags");
+  std::map<std::string, kopsik::Project *> projects;
+  for (std::vector<kopsik::Project *>::const_iterator it =
+        user_->related.Projects.begin();
+      it != user_->related.Projects.end();
+      it++) {
+    if ((*it)->WID() != wid) {
+      continue;
+    }
+    std::string name = Poco::toLower((*it)->Name());
+    kopsik::Client *c = (*it)->CID() ?
+      user_->GetClientByID((*it)->CID()) : 0;
+    if (c) {
+      projects.insert(std::make_pair(
+        Poco::toLower(c->Name()) + "\n" + name, *it));
+    }
+    projects.insert(std::make_pair("\n" + name, *it));
   }
-  kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
-  if (!te) {
-    return kopsik::error("Time entry not found");
+  std::map<std::string, std::string> tags;
+  for (std::vector<kopsik::Tag *>::const_iterator it =
+        user_->related.Tags.begin();
+      it != user_->related.Tags.end();
+      it++) {
+    if ((*it)->WID() == wid) {
+      tags.insert(std::make_pair(Poco::toLower((*it)->Name()),
+                                 (*it)->Name()));
+    }
   }
-  te->SetTags(value);
-  if (te->Dirty()) {
+
+  const std::string created_with = kopsik::UserAgent(app_name_, app_version_);
+  for (std::size_t i = 0; i < count; i++) {
+    const kopsik::TimeEntryImportRow &row = rows[i];
+    if (!row.GUID.empty() && user_->GetTimeEntryByGUID(row.GUID)) {
+      result->Skipped++;
+      continue;
+    }
+
+    kopsik::Project *p = 0;
+    if (!row.Project.empty()) {
+      std::string key = Poco::toLower(row.Client) + "\n"
+                        + Poco::toLower(row.Project);
+      std::map<std::string, kopsik::Project *>::const_iterator found =
+        projects.find(key);
+      if (found != projects.end()) {
+        p = found->second;
+      } else {
+        std::map<std::string, kopsik::Client *>::const_iterator c =
+          clients.find(Poco::toLower(row.Client));
+        p = user_->AddProject(wid,
+                              c != clients.end() ? c->second->ID() : 0,
+                              row.Project);
+        p->EnsureGUID();
+        projects[key] = p;
+        result->ProjectsCreated++;
+      }
+    }
+
+    // Tags as they are spelled in the workspace already
+    std::string tag_names("");
+    std::stringstream ss(row.Tags);
+    std::string tag;
+    while (std::getline(ss, tag, '|')) {
+      std::string &name = tags[Poco::toLower(tag)];
+      if (name.empty()) {
+        name = tag;
+      }
+      if (!tag_names.empty()) {
+        tag_names += "|";
+      }
+      tag_names += name;
+    }
+
+    kopsik::TimeEntry *te = new kopsik::TimeEntry();
+    te->SetUID(user_->ID());
+    te->SetWID(wid);
+    if (p && p->ID()) {
+      te->SetPID(p->ID());
+    } else if (p) {
+      te->SetProjectGUID(p->GUID());
+    }
+    te->SetDescription(row.Description);
+    te->SetTags(tag_names);
+    te->SetBillable(row.Billable);
+    te->SetStart(row.Start);
+    te->SetStop(row.Stop);
+    te->SetDurationInSeconds(row.Stop - row.Start);
+    te->SetCreatedWith(created_with);
     te->SetUIModifiedAt(time(0));
+    if (!row.GUID.empty()) {
+      te->SetGUID(row.GUID);
+    } else {
+      te->EnsureGUID();
+    }
+    user_->related.TimeEntries.push_back(te);
+    user_->related.Track(te);
+    result->Imported++;
   }
-  save();
-  if (te->NeedsPush()) {
-    partialSync();
-  }
-  return kopsik::noError;
+  Metrics::Shared().Count("import.rows", count);
+
+  return save(changes);
 }
 
-kopsik::error Context::SetTimeEntryBillable(
-    const std::string GUID,
-    const bool value) {
-  if (GUID.empty()) {
-    return kopsik::error("Missing GUID");
+// Copied while the user is locked, the time entries may go after
+static void time_entry_spans(
+    const std::vector<kopsik::TimeEntry *> &time_entries,
+    std::vector<kopsik::TimeEntrySpan> *spans) {
+  for (std::vector<kopsik::TimeEntry *>::const_iterator it =
+      time_entries.begin();
+      it != time_entries.end();
+      it++) {
+    kopsik::TimeEntrySpan span;
+    span.GUID = (*it)->GUID();
+    span.Start = (*it)->Start();
+    if ((*it)->DurationInSeconds() >= 0) {
+      span.Stop = kopsik::TimeEntryIntervals::End(*it);
+    }
+    spans->push_back(span);
   }
+}
+
+kopsik::error Context::TimeEntriesBetween(
+    const Poco::UInt64 from,
+    const Poco::UInt64 to,
+    std::vector<kopsik::TimeEntrySpan> *spans) const {
+  poco_assert(spans);
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
   if (!user_) {
-    return kopsik::error("Please login to change time entry billable state");
-  }
-  kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
-  if (!te) {
-    return kopsik::error("Time entry not found");
-  }
-  te->SetBillable(value);
-  if (te->Dirty()) {
-    te->SetUIModifiedAt(time(0));
-  }
-  save();
-  if (te->NeedsPush()) {
-    partialSync();
+    return kopsik::error("Please login to access time entries");
   }
+  std::vector<kopsik::TimeEntry *> found;
+  user_->TimeEntriesBetween(from, to, &found);
+  time_entry_spans(found, spans);
   return kopsik::noError;
 }
 
-kopsik::error Context::SetTimeEntryDescription(
+kopsik::error Context::OverlappingTimeEntries(
     const std::string GUID,
-    const std::string value) {
-  if (GUID.empty()) {
-    return kopsik::error("Missing GUID");
-  }
+    std::vector<kopsik::TimeEntrySpan> *spans) const {
+  poco_assert(spans);
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
   if (!user_) {
-    return kopsik::error("Please login to change time entry description");
+    return kopsik::error("Please login to access time entries");
   }
   kopsik::TimeEntry *te = user_->GetTimeEntryByGUID(GUID);
   if (!te) {
-    return kopsik::error("Time entry not found");
-  }
-  te->SetDescription(value);
-  if (te->Dirty()) {
-    te->SetUIModifiedAt(time(0));
-  }
-  save();
-  if (te->NeedsPush()) {
-    partialSync();
+    return kopsik::error("Time entry not found: " + GUID);
   }
+  std::vector<kopsik::TimeEntry *> found;
+  user_->OverlappingTimeEntries(te, &found);
+  time_entry_spans(found, spans);
   return kopsik::noError;
 }
 
-kopsik::error Context::Stop(kopsik::TimeEntry **stopped_entry) {
-  *stopped_entry = 0;
-  if (!user_) {
-    return kopsik::error("Please login to stop time tracking");
+void Context::handleTimelineEventNotification(
+    TimelineEventNotification *notification) {
+  Poco::AutoPtr<TimelineEventNotification> ptr(notification);
+  const TimelineEvent &event = notification->event;
+  if (event.idle) {
+    return;
   }
 
-  std::vector<kopsik::TimeEntry *> stopped = user_->Stop();
-  if (stopped.empty()) {
-    return kopsik::error("No time entry was found to stop");
-  }
-  *stopped_entry = stopped[0];
-  save();
-  if ((*stopped_entry)->NeedsPush()) {
-    partialSync();
-  }
-  return kopsik::noError;
-}
+  Poco::UInt64 pid(0);
+  std::string description("");
+  {
+    InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return;
+    }
 
-kopsik::error Context::SplitAt(
-    const Poco::Int64 at,
-    kopsik::TimeEntry **new_running_entry) {
-  *new_running_entry = 0;
-  if (!user_) {
-    return kopsik::error("Pleae login to split time entry");
-  }
+    // What the user has tracked so far, from the time entries in memory
+    if (suggestions_.SetUser(user_->ID())) {
+      for (std::vector<kopsik::TimeEntry *>::const_iterator it =
+          user_->related.TimeEntries.begin();
+          it != user_->related.TimeEntries.end();
+          it++) {
+        kopsik::TimeEntry *te = *it;
+        if (!te->DeletedAt()) {
+          suggestions_.LearnEntry(te->PID(), te->Description(),
+                                  te->DurationInSeconds());
+        }
+      }
+    }
 
-  *new_running_entry = user_->SplitAt(at);
-  if (!*new_running_entry) {
-    return kopsik::error("Failed to split tracking time entry");
-  }
-  if ((*new_running_entry)->NeedsPush()) {
-    partialSync();
+    kopsik::TimeEntry *running = user_->RunningTimeEntry();
+    if (running && running->Start() <= Poco::UInt64(event.start_time)) {
+      pid = running->PID();
+      description = running->Description();
+    }
   }
-  return kopsik::noError;
-}
 
-kopsik::error Context::StopAt(
-    const Poco::Int64 at,
-    kopsik::TimeEntry **stopped) {
-  if (!user_) {
-    return kopsik::error("Please login to stop running time entry");
+  if (pid || !description.empty()) {
+    suggestions_.LearnWindow(*event.filename, *event.title,
+                             event.end_time - event.start_time,
+                             pid, description);
+    return;
   }
+  suggestions_.Untracked(*event.filename, *event.title,
+                         event.start_time, event.end_time);
+}
 
-  *stopped = user_->StopAt(at);
-  if (!stopped) {
-    return kopsik::error("Time entry not found to stop");
-  }
-  save();
-  if ((*stopped)->NeedsPush()) {
-    partialSync();
+kopsik::error Context::SuggestTimeEntries(
+    const std::size_t limit,
+    std::vector<kopsik::TimeEntrySuggestion> *suggestions) {
+  poco_assert(suggestions);
+  if (!UserIsLoggedIn()) {
+    return kopsik::error("Please login to see suggestions");
   }
+  suggestions_.Suggest(kSuggestionMinSeconds, limit, suggestions);
   return kopsik::noError;
 }
 
+void Context::DismissTimeEntrySuggestion(const time_t start) {
+  suggestions_.Dismiss(start);
+}
+
 kopsik::error Context::RunningTimeEntry(
     kopsik::TimeEntry **running) const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
   if (!user_) {
     return kopsik::error("Please login to access tracking time entry");
   }
@@ -1148,14 +4291,21 @@ kopsik::error Context::RunningTimeEntry(
 }
 
 kopsik::error Context::ToggleTimelineRecording() {
-  if (!user_) {
-    return kopsik::error("Please login to change timeline settings");
-  }
   try {
-    user_->SetRecordTimeline(!user_->RecordTimeline());
-    save();
+    std::vector<kopsik::ModelChange> changes;
+    bool record_timeline(false);
+    {
+      InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+      if (!user_) {
+        return kopsik::error("Please login to change timeline settings");
+      }
+      user_->SetRecordTimeline(!user_->RecordTimeline());
+      save(&changes);
+      record_timeline = user_->RecordTimeline();
+    }
+    notifyModelChanges(changes);
     TimelineUpdateServerSettings();
-    if (user_->RecordTimeline()) {
+    if (record_timeline) {
       SwitchTimelineOn();
       return kopsik::noError;
     }
@@ -1173,28 +4323,44 @@ kopsik::error Context::ToggleTimelineRecording() {
 kopsik::error Context::TimeEntries(
     std::map<std::string, Poco::Int64> *date_durations,
     std::vector<kopsik::TimeEntry *> *visible) const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+  return timeEntries(date_durations, visible);
+}
+
+kopsik::error Context::timeEntries(
+    std::map<std::string, Poco::Int64> *date_durations,
+    std::vector<kopsik::TimeEntry *> *visible) const {
   if (!user_) {
     logger().warning("User is already logged out, cannot fetch time entries");
     return kopsik::noError;
   }
 
-  for (std::vector<kopsik::TimeEntry *>::const_iterator it =
-      user_->related.TimeEntries.begin();
-      it != user_->related.TimeEntries.end(); it++) {
-    kopsik::TimeEntry *te = *it;
-    poco_assert(!te->GUID().empty());
-    if (te->DurationInSeconds() < 0) {
-      continue;
-    }
-    if (te->DeletedAt() > 0) {
+  bool totals_complete = user_->related.DayTotalsComplete();
+  DateHeaderCache headers;
+  TimeEntryFieldsPtr fields = user_->related.TimeEntryFields.Refresh();
+  for (std::size_t i = 0; i < fields->Durations.size(); i++) {
+    if (!fields->Listed(i)) {
       continue;
     }
+    kopsik::TimeEntry *te = user_->related.TimeEntries[i];
+    poco_assert(!te->GUID().empty());
     visible->push_back(te);
 
-    std::string date_header = te->DateHeaderString();
-    Poco::Int64 duration = (*date_durations)[date_header];
-    duration += te->DurationInSeconds();
-    (*date_durations)[date_header] = duration;
+    if (!totals_complete) {
+      (*date_durations)[headers.Get(fields->Days[i])] += fields->Durations[i];
+    }
+  }
+
+  // Headers repeat every year, so several days can share one
+  if (totals_complete) {
+    const std::map<int, DayTotal> &days =
+      user_->related.TimeEntryDayTotals.Days();
+    for (std::map<int, DayTotal>::const_iterator it = days.begin();
+        it != days.end();
+        it++) {
+      (*date_durations)[DayTotals::DateHeader(it->first)] +=
+        it->second.Seconds;
+    }
   }
 
   std::sort(visible->begin(), visible->end(), CompareTimeEntriesByStart);
@@ -1205,39 +4371,90 @@ kopsik::error Context::TimeEntries(
 kopsik::error Context::TrackedPerDateHeader(
     const std::string date_header,
     int *sum) const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
   if (!user_) {
     return kopsik::error("Please login to access time entries");
   }
+
+  *sum = 0;
+  if (user_->related.DayTotalsComplete()) {
+    const std::map<int, DayTotal> &days =
+      user_->related.TimeEntryDayTotals.Days();
+    for (std::map<int, DayTotal>::const_iterator it = days.begin();
+        it != days.end();
+        it++) {
+      if (DayTotals::DateHeader(it->first) == date_header) {
+        *sum += static_cast<int>(it->second.Seconds);
+      }
+    }
+    return kopsik::noError;
+  }
+
+  DateHeaderCache headers;
   for (std::vector<kopsik::TimeEntry *>::const_iterator it =
       user_->related.TimeEntries.begin();
       it != user_->related.TimeEntries.end(); it++) {
     kopsik::TimeEntry *te = *it;
     if (te->DurationInSeconds() >= 0 && !te->DeletedAt() &&
-        te->DateHeaderString() == date_header) {
-      sum += te->DurationInSeconds();
+        headers.Get(te->Day()) == date_header) {
+      *sum += static_cast<int>(te->DurationInSeconds());
     }
   }
   return kopsik::noError;
 }
 
 bool Context::RecordTimeline() const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+
   return user_ && user_->RecordTimeline();
 }
 
 kopsik::error Context::SaveUpdateChannel(
     const std::string channel) {
+  Poco::Mutex::ScopedLock lock(settings_m_);
+  kopsik::error err = checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
+  }
+  err = database()->SaveUpdateChannel(channel);
+  if (err != kopsik::noError) {
+    return err;
+  }
   update_channel_ = channel;
-  return db_->SaveUpdateChannel(std::string(channel));
+  update_channel_loaded_ = true;
+  return kopsik::noError;
 }
 
 kopsik::error Context::LoadUpdateChannel(std::string *channel) {
-  return db_->LoadUpdateChannel(channel);
+  Poco::Mutex::ScopedLock lock(settings_m_);
+  if (!update_channel_loaded_) {
+    kopsik::error err = checkDatabase();
+    if (err != kopsik::noError) {
+      return err;
+    }
+    err = database()->LoadUpdateChannel(&update_channel_);
+    if (err != kopsik::noError) {
+      return err;
+    }
+    update_channel_loaded_ = true;
+  }
+  *channel = update_channel_;
+  return kopsik::noError;
 }
 
 void Context::ProjectLabelAndColorCode(
     kopsik::TimeEntry *te,
     std::string *project_and_task_label,
     std::string *color_code) const {
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
+  projectLabelAndColorCode(te, project_and_task_label, color_code);
+}
+
+void Context::projectLabelAndColorCode(
+    kopsik::TimeEntry *te,
+    std::string *project_and_task_label,
+    std::string *color_code) const {
   poco_assert(te);
   poco_assert(project_and_task_label);
   poco_assert(color_code);
@@ -1247,6 +4464,12 @@ void Context::ProjectLabelAndColorCode(
     return;
   }
 
+  ProjectLabels &labels = user_->related.ProjectLabelCache;
+  if (labels.Find(te->TID(), te->PID(), te->ProjectGUID(),
+                  project_and_task_label, color_code)) {
+    return;
+  }
+
   kopsik::Task *t = 0;
   if (te->TID()) {
     t = user_->GetTaskByID(te->TID());
@@ -1273,11 +4496,14 @@ void Context::ProjectLabelAndColorCode(
   if (p) {
     *color_code = p->ColorCode();
   }
+
+  labels.Add(te->TID(), te->PID(), te->ProjectGUID(),
+             *project_and_task_label, *color_code);
 }
 
 bool CompareAutocompleteItems(
-    AutocompleteItem a,
-    AutocompleteItem b) {
+    const AutocompleteItem &a,
+    const AutocompleteItem &b) {
 
   // Time entries first
   if (a.IsTimeEntry() && !b.IsTimeEntry()) {
@@ -1303,11 +4529,131 @@ bool CompareAutocompleteItems(
     return false;
   }
 
-  return (strcmp(a.Text.c_str(), b.Text.c_str()) < 0);
+  int text = strcmp(a.Text.c_str(), b.Text.c_str());
+  if (text) {
+    return text < 0;
+  }
+
+  // Most recently used first
+  return a.LastUsed > b.LastUsed;
+}
+
+// Time entries first, then tasks, then projects
+static int autocompleteItemRank(const AutocompleteItem &item) {
+  if (item.IsTimeEntry()) {
+    return 0;
+  }
+  if (item.IsTask()) {
+    return 1;
+  }
+  if (item.IsProject()) {
+    return 2;
+  }
+  return 3;
+}
+
+typedef struct {
+  int rank;
+  const char *text;
+  Poco::UInt64 last_used;
+  std::size_t position;
+} AutocompleteSortKey;
+
+static bool compareAutocompleteSortKeys(
+    const AutocompleteSortKey &a,
+    const AutocompleteSortKey &b) {
+  if (a.rank != b.rank) {
+    return a.rank < b.rank;
+  }
+  int text = strcmp(a.text, b.text);
+  if (text) {
+    return text < 0;
+  }
+  // Most recently used first
+  return a.last_used > b.last_used;
+}
+
+void SortAutocompleteItems(std::vector<AutocompleteItem> *list) {
+  poco_assert(list);
+
+  std::vector<AutocompleteSortKey> keys(list->size());
+  for (std::size_t i = 0; i < list->size(); i++) {
+    const AutocompleteItem &item = (*list)[i];
+    keys[i].rank = autocompleteItemRank(item);
+    keys[i].text = item.Text.c_str();
+    keys[i].last_used = item.LastUsed;
+    keys[i].position = i;
+  }
+  std::stable_sort(keys.begin(), keys.end(), compareAutocompleteSortKeys);
+
+  std::vector<AutocompleteItem> sorted(list->size());
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    sorted[i].swap((*list)[keys[i].position]);
+  }
+  list->swap(sorted);
 }
 
 // Add time entries, in format:
 // Description - Task. Project. Client
+kopsik::error Context::saveAutocompleteIndex() {
+  kopsik::error err = checkDatabase();
+  if (err != kopsik::noError) {
+    return err;
+  }
+  Poco::UInt64 generation(0);
+  err = database()->SnapshotGeneration(&generation);
+  if (err != kopsik::noError) {
+    return err;
+  }
+  if (autocomplete_index_file_current_
+      && autocomplete_index_file_generation_ == generation) {
+    return kopsik::noError;
+  }
+
+  // The snapshot's index, unless the lists have changed since
+  Poco::AutoPtr<UserSnapshot> snapshot = Snapshot();
+  std::vector<int> generations;
+  autocompleteGenerations(&generations);
+  Poco::SharedPtr<AutocompleteIndex> index;
+  if (snapshot && !generations.empty()
+      && snapshot->AutocompleteGenerations == generations) {
+    index = snapshot->Autocomplete;
+  } else {
+    std::vector<AutocompleteItem> items;
+    autocompleteItems(&items);
+    index = new AutocompleteIndex();
+    index->Build(items);
+  }
+  err = database()->SaveAutocompleteIndex(user_->ID(), *index);
+  if (err != kopsik::noError) {
+    return err;
+  }
+  autocomplete_index_file_current_ = true;
+  autocomplete_index_file_generation_ = generation;
+  return kopsik::noError;
+}
+
+void Context::autocompleteItems(std::vector<AutocompleteItem> *items) const {
+  getTimeEntryAutocompleteItems(items);
+  getTaskAutocompleteItems(items);
+  getProjectAutocompleteItems(items);
+  SortAutocompleteItems(items);
+}
+
+void Context::autocompleteGenerations(std::vector<int> *generations) const {
+  poco_assert(generations);
+
+  generations->clear();
+  const RelatedData &related = user_->related;
+  if (!related.AllTracked()) {
+    return;
+  }
+  generations->push_back(related.TimeEntryGeneration.Value());
+  generations->push_back(related.TaskGeneration.Value());
+  generations->push_back(related.ProjectGeneration.Value());
+  generations->push_back(related.ClientGeneration.Value());
+}
+
 void Context::getTimeEntryAutocompleteItems(
     std::vector<AutocompleteItem> *list) const {
   poco_assert(list);
@@ -1317,6 +4663,13 @@ void Context::getTimeEntryAutocompleteItems(
     return;
   }
 
+  // One item per description, project and task. Keys of entries
+  // that don't get an item map to npos.
+  // Descriptions are interned, so their addresses tell them apart
+  typedef std::pair<const std::string *,
+                    std::pair<Poco::UInt64, Poco::UInt64> > Key;
+  std::map<Key, std::size_t> items;
+
   for (std::vector<kopsik::TimeEntry *>::const_iterator it =
       user_->related.TimeEntries.begin();
       it != user_->related.TimeEntries.end(); it++) {
@@ -1327,6 +4680,21 @@ void Context::getTimeEntryAutocompleteItems(
       continue;
     }
 
+    Key key(te->SharedDescription().get(),
+            std::make_pair(te->PID(), te->TID()));
+    std::map<Key, std::size_t>::iterator seen = items.find(key);
+    if (seen != items.end()) {
+      if (seen->second != std::string::npos) {
+        AutocompleteItem &item = (*list)[seen->second];
+        item.UseCount++;
+        if (te->Start() > item.LastUsed) {
+          item.LastUsed = te->Start();
+        }
+      }
+      continue;
+    }
+    items[key] = std::string::npos;
+
     kopsik::Task *t = 0;
     if (te->TID()) {
       t = user_->GetTaskByID(te->TID());
@@ -1350,22 +4718,18 @@ void Context::getTimeEntryAutocompleteItems(
 
     std::string project_label = Formatter::JoinTaskName(t, p, c);
 
-    std::stringstream search_parts;
-    search_parts << te->Description();
-    std::string description = search_parts.str();
+    items[key] = list->size();
+    list->push_back(AutocompleteItem());
+    AutocompleteItem &autocomplete_item = list->back();
+    autocomplete_item.Description = te->Description();
+    autocomplete_item.Text.reserve(
+      te->Description().size() + 3 + project_label.size());
+    autocomplete_item.Text = te->Description();
     if (!project_label.empty()) {
-      search_parts << " - " << project_label;
+      autocomplete_item.Text += " - ";
+      autocomplete_item.Text += project_label;
     }
-
-    std::string text = search_parts.str();
-    if (text.empty()) {
-      continue;
-    }
-
-    AutocompleteItem autocomplete_item;
-    autocomplete_item.Description = description;
-    autocomplete_item.Text = text;
-    autocomplete_item.ProjectAndTaskLabel = project_label;
+    autocomplete_item.ProjectAndTaskLabel.swap(project_label);
     if (p) {
       autocomplete_item.ProjectColor = p->ColorCode();
       autocomplete_item.ProjectID = p->ID();
@@ -1374,7 +4738,8 @@ void Context::getTimeEntryAutocompleteItems(
       autocomplete_item.TaskID = t->ID();
     }
     autocomplete_item.Type = kAutocompleteItemTE;
-    list->push_back(autocomplete_item);
+    autocomplete_item.UseCount = 1;
+    autocomplete_item.LastUsed = te->Start();
   }
 }
 
@@ -1389,24 +4754,17 @@ void Context::getTaskAutocompleteItems(
     return;
   }
 
-  for (std::vector<kopsik::Task *>::const_iterator it =
-      user_->related.Tasks.begin();
-      it != user_->related.Tasks.end(); it++) {
+  std::vector<kopsik::Task *> tasks;
+  user_->related.Buckets.ActiveTasks(&tasks);
+  for (std::vector<kopsik::Task *>::const_iterator it = tasks.begin();
+      it != tasks.end(); it++) {
     kopsik::Task *t = *it;
 
-    if (t->IsMarkedAsDeletedOnServer()) {
-      continue;
-    }
-
     kopsik::Project *p = 0;
     if (t->PID()) {
       p = user_->GetProjectByID(t->PID());
     }
 
-    if (p && !p->Active()) {
-      continue;
-    }
-
     kopsik::Client *c = 0;
     if (p && p->CID()) {
       c = user_->GetClientByID(p->CID());
@@ -1417,16 +4775,16 @@ void Context::getTaskAutocompleteItems(
       continue;
     }
 
-    AutocompleteItem autocomplete_item;
-    autocomplete_item.Text = text;
+    list->push_back(AutocompleteItem());
+    AutocompleteItem &autocomplete_item = list->back();
     autocomplete_item.ProjectAndTaskLabel = text;
+    autocomplete_item.Text.swap(text);
     autocomplete_item.TaskID = t->ID();
     if (p) {
       autocomplete_item.ProjectColor = p->ColorCode();
       autocomplete_item.ProjectID = p->ID();
     }
     autocomplete_item.Type = kAutocompleteItemTask;
-    list->push_back(autocomplete_item);
   }
 }
 
@@ -1441,15 +4799,12 @@ void Context::getProjectAutocompleteItems(
     return;
   }
 
-  for (std::vector<kopsik::Project *>::const_iterator it =
-       user_->related.Projects.begin();
-       it != user_->related.Projects.end(); it++) {
+  std::vector<kopsik::Project *> projects;
+  user_->ActiveProjects(&projects);
+  for (std::vector<kopsik::Project *>::const_iterator it = projects.begin();
+       it != projects.end(); it++) {
     kopsik::Project *p = *it;
 
-    if (!p->Active()) {
-      continue;
-    }
-
     kopsik::Client *c = 0;
     if (p->CID()) {
       c = user_->GetClientByID(p->CID());
@@ -1460,13 +4815,13 @@ void Context::getProjectAutocompleteItems(
       continue;
     }
 
-    AutocompleteItem autocomplete_item;
-    autocomplete_item.Text = text;
+    list->push_back(AutocompleteItem());
+    AutocompleteItem &autocomplete_item = list->back();
     autocomplete_item.ProjectAndTaskLabel = text;
+    autocomplete_item.Text.swap(text);
     autocomplete_item.ProjectID = p->ID();
     autocomplete_item.ProjectColor = p->ColorCode();
     autocomplete_item.Type = kAutocompleteItemProject;
-    list->push_back(autocomplete_item);
   }
 }
 
@@ -1476,6 +4831,7 @@ void Context::AutocompleteItems(
     const bool include_tasks,
     const bool include_projects) const {
   poco_assert(list);
+  InstrumentedRWLock::ScopedReadLock lock(user_m_, __FUNCTION__);
   if (!user_) {
     logger().warning("User is already logged out, cannot fetch autocomplete");
     return;
@@ -1493,7 +4849,85 @@ void Context::AutocompleteItems(
     getProjectAutocompleteItems(list);
   }
 
-  std::sort(list->begin(), list->end(), CompareAutocompleteItems);
+  SortAutocompleteItems(list);
+}
+
+Poco::UInt64 Context::QueryAutocomplete(
+    const std::string &typed,
+    const std::size_t limit,
+    const bool include_time_entries,
+    const bool include_tasks,
+    const bool include_projects,
+    AutocompleteQueryListener *listener) {
+  poco_assert(listener);
+
+  Poco::UInt64 id(0);
+  {
+    Poco::Mutex::ScopedLock lock(autocomplete_query_m_);
+    if (autocomplete_query_pending_) {
+      Metrics::Shared().Count("autocomplete.queries_superseded");
+    }
+    id = ++autocomplete_query_.id;
+    autocomplete_query_.typed = typed;
+    autocomplete_query_.limit = limit;
+    autocomplete_query_.include_time_entries = include_time_entries;
+    autocomplete_query_.include_tasks = include_tasks;
+    autocomplete_query_.include_projects = include_projects;
+    autocomplete_query_.listener = listener;
+    // The task scheduled for a query still waiting takes this one
+    if (autocomplete_query_pending_) {
+      return id;
+    }
+    autocomplete_query_pending_ = true;
+  }
+
+  Poco::Util::TimerTask::Ptr ptask =
+    new kopsik::WorkerTaskAdapter<Context>(
+      *this, &Context::onAutocompleteQuery,
+      &workers_, kopsik::WorkerPool::Interactive);
+
+  Poco::Mutex::ScopedLock lock(timer_m_);
+  schedule(ptask, Poco::Timestamp());
+  return id;
+}
+
+void Context::onAutocompleteQuery(Poco::Util::TimerTask& task) {  // NOLINT
+  AutocompleteQuery query;
+  {
+    Poco::Mutex::ScopedLock lock(autocomplete_query_m_);
+    if (!autocomplete_query_pending_) {
+      return;
+    }
+    query = autocomplete_query_;
+    autocomplete_query_pending_ = false;
+  }
+
+  Poco::Timestamp started;
+  std::vector<AutocompleteItem> items;
+  Poco::AutoPtr<UserSnapshot> snapshot = Snapshot();
+  if (snapshot) {
+    std::vector<std::size_t> found;
+    snapshot->Autocomplete->Find(query.typed, query.limit,
+                                 query.include_time_entries,
+                                 query.include_tasks,
+                                 query.include_projects,
+                                 &found);
+    const std::vector<AutocompleteItem> &all = snapshot->Autocomplete->Items();
+    for (std::size_t i = 0; i < found.size(); i++) {
+      items.push_back(all[found[i]]);
+    }
+  }
+
+  // Typed on meanwhile, the newer query answers instead
+  {
+    Poco::Mutex::ScopedLock lock(autocomplete_query_m_);
+    if (autocomplete_query_.id != query.id) {
+      Metrics::Shared().Count("autocomplete.queries_superseded");
+      return;
+    }
+  }
+  Metrics::Shared().Time("autocomplete.query", started.elapsed());
+  query.listener->Answered(query.id, items);
 }
 
 kopsik::error Context::AddProject(
@@ -1503,9 +4937,6 @@ kopsik::error Context::AddProject(
     Project **result) {
   poco_assert(result);
 
-  if (!user_) {
-    return kopsik::error("Please login to add a project");
-  }
   if (!workspace_id) {
     return kopsik::error("Please select a workspace");
   }
@@ -1513,10 +4944,21 @@ kopsik::error Context::AddProject(
     return kopsik::error("Project name must not be empty");
   }
 
-  *result = user_->AddProject(workspace_id, client_id, project_name);
-  poco_assert(*result);
+  std::vector<kopsik::ModelChange> changes;
+  kopsik::error err = kopsik::noError;
+  {
+    InstrumentedRWLock::ScopedWriteLock lock(user_m_, __FUNCTION__);
+    if (!user_) {
+      return kopsik::error("Please login to add a project");
+    }
+
+    *result = user_->AddProject(workspace_id, client_id, project_name);
+    poco_assert(*result);
 
-  return save();
+    err = save(&changes);
+  }
+  notifyModelChanges(changes);
+  return err;
 }
 
 }  // namespace kopsik
@@ -3,26 +3,51 @@
 #ifndef SRC_CONTEXT_H_
 #define SRC_CONTEXT_H_
 
+#include <deque>
+#include <set>
 #include <string>
 #include <vector>
 #include <map>
 
 #include "./types.h"
 #include "./database.h"
+#include "./dns_cache.h"
 #include "./websocket_client.h"
 #include "./window_change_recorder.h"
 #include "./timeline_uploader.h"
 #include "./CustomErrorHandler.h"
 #include "./autocomplete_item.h"
 #include "./feedback.h"
-
+#include "./idle_detector.h"
+#include "./user_snapshot.h"
+#include "./sync_scheduler.h"
+#include "./time_entry_import.h"
+#include "./time_entry_suggestions.h"
+#include "./timeline_notifications.h"
+#include "./worker_pool.h"
+#include "./workspace_fetch.h"
+#include "./connectivity_monitor.h"
+#include "./instrumented_lock.h"
+#include "./power_policy.h"
+
+#include "Poco/AutoPtr.h"
+#include "Poco/Mutex.h"
+#include "Poco/NotificationCenter.h"
+#include "Poco/RWLock.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/RunnableAdapter.h"
+#include "Poco/Thread.h"
 #include "Poco/Util/Timer.h"
+#include "Poco/Util/TimerTask.h"
 
 namespace kopsik {
 
 typedef void (*ModelChangeCallback)(
   const ModelChange change);
 
+typedef void (*ModelChangesCallback)(
+  const std::vector<ModelChange> &changes);
+
 typedef void (*ErrorCallback)(
   const error err);
 
@@ -34,7 +59,95 @@ typedef void (*CheckUpdateCallback)(
 
 typedef void (*OnlineCallback)();
 
-class Context {
+// idle_ended is 0 when the user has just gone idle
+typedef void (*IdleCallback)(
+  const Poco::UInt64 idle_started,
+  const Poco::UInt64 idle_ended);
+
+// Told how saving an edit went, once it has been written or failed,
+// on the worker that saved it. The context takes it over with the
+// edit and deletes it after telling it.
+class SaveListener {
+  public:
+    virtual ~SaveListener() {}
+    virtual void Saved(const error err) = 0;
+};
+
+// Told the items found for an autocomplete query, on a worker thread,
+// see Context::QueryAutocomplete. Not told anything when a newer query
+// supersedes it.
+class AutocompleteQueryListener {
+  public:
+    virtual ~AutocompleteQueryListener() {}
+    virtual void Answered(
+      const Poco::UInt64 query_id,
+      const std::vector<AutocompleteItem> &items) = 0;
+};
+
+typedef struct {
+  Poco::UInt64 id;
+  std::string typed;
+  std::size_t limit;
+  bool include_time_entries;
+  bool include_tasks;
+  bool include_projects;
+  Poco::SharedPtr<AutocompleteQueryListener> listener;
+} AutocompleteQuery;
+
+// Told about the model changes of a subscription, with the context
+// unlocked, on the thread that saved them
+class ModelChangeListener {
+  public:
+    virtual ~ModelChangeListener() {}
+    virtual void Changed(const std::vector<ModelChange> &changes) = 0;
+};
+
+// Which changes a listener is told about. Models and changes are
+// or-ed together as 1 << ModelChange::Model and 1 << ModelChange::Change,
+// 0 for all of them. Coalesced changes are merged by model first, as
+// MergeModelChanges does, so a model inserted and then deleted in one
+// save isn't reported at all.
+typedef struct {
+  int models;
+  int changes;
+  bool coalesce;
+  Poco::SharedPtr<ModelChangeListener> listener;
+} ModelChangeSubscription;
+
+// Fields of a time entry to change at once, or-ed into
+// TimeEntryEdit::fields
+enum TimeEntryEditField {
+  kEditDescription = 1 << 0,
+  kEditProject = 1 << 1,
+  kEditBillable = 1 << 2,
+  kEditTags = 1 << 3,
+  kEditStart = 1 << 4,
+  kEditEnd = 1 << 5,
+  kEditDuration = 1 << 6
+};
+
+// Several changes to one time entry, made by Context::EditTimeEntry
+// with one save and one push. Only the fields that are flagged are
+// looked at. Start, end and duration are user input, as typed.
+typedef struct {
+  int fields;
+  std::string description;
+  Poco::UInt64 task_id;
+  Poco::UInt64 project_id;
+  std::string project_guid;
+  bool billable;
+  std::string tags;
+  std::string start;
+  std::string end;
+  std::string duration;
+} TimeEntryEdit;
+
+// A process can have several contexts, each with its own user and
+// database. They share the worker threads, the timer thread, the
+// HTTPS session pool with its TLS context and the network reactor.
+// Timeline notifications go through a notification center of each
+// context's own, so they never reach another context.
+class Context : public IdleListener {
   public:
     Context(
       const std::string app_name,
@@ -54,26 +167,99 @@ class Context {
     void TimelineUpdateServerSettings();
     kopsik::error SendFeedback(Feedback);
 
-    // Load model update from JSON string (from WebSocket)
-    void LoadUpdateFromJSONString(const std::string json);
+    // Where the timeline of this context is posted, and from there
+    // stored by its database
+    Poco::NotificationCenter &Notifications() { return notifications_; }
+
+    // Network reachability as the OS reports it. Network tasks are
+    // paused while offline, and caught up with at once when back.
+    void SetOnline(const bool online);
+
+    // Whether the machine runs on battery, as the OS reports it. On
+    // battery, background work runs less often, and lined up with
+    // the rest of it, so the CPU wakes up less.
+    void SetOnBattery(const bool on_battery);
+
+    // Load model update from JSON string (from WebSocket). Updates
+    // arriving close together are applied and saved together a
+    // moment later.
+    void LoadUpdateFromJSONNode(JSONValue *message);
+
+    // WebSocket is connected again, after missing whatever
+    // was sent meanwhile
+    void LoadChangesMissedByWebSocket();
 
     void SetModelChangeCallback(ModelChangeCallback cb) {
       on_model_change_callback_ = cb; }
+    // When set, changes are delivered all at once and merged
+    // by model, instead of one at a time
+    void SetModelChangesCallback(ModelChangesCallback cb) {
+      on_model_changes_callback_ = cb; }
+    // Listener is told about the changes the subscription asks for,
+    // besides the callbacks above. The context takes it over.
+    // Returns the ID to unsubscribe with.
+    unsigned int SubscribeModelChanges(
+      const int models,
+      const int changes,
+      const bool coalesce,
+      ModelChangeListener *listener);
+    void UnsubscribeModelChanges(const unsigned int subscription);
     void SetOnErrorCallback(ErrorCallback cb) { on_error_callback_ = cb; }
     void SetCheckUpdateCallback(CheckUpdateCallback cb) {
       on_check_update_callback_ = cb; }
     void SetOnOnlineCallback(OnlineCallback cb) { on_online_callback_ = cb; }
+    // Idle time is detected while there's a callback and the settings
+    // have idle detection on
+    void SetIdleCallback(IdleCallback cb);
+
+    // IdleListener, while a user is logged in. The idle time also
+    // goes to the timeline when it's recorded.
+    void WentIdle(const time_t idle_started);
+    void Returned(const time_t idle_started, const time_t idle_ended);
 
     // Apply proxy settings
     kopsik::error ConfigureProxy();
 
     // Configure
-    void SetAPIURL(const std::string value) { api_url_ = value; }
+    // Hosts of the URLs are looked up in the background right away,
+    // see DNSCache
+    void SetAPIURL(const std::string value) {
+        api_url_ = value;
+        kopsik::DNSCache::Shared().Prefetch(value);
+    }
+    // Login and sync go through this client instead of one made for
+    // the API URL, such as a FakeTogglAPI. Not owned.
+    void SetHTTPSClient(kopsik::HTTPSClient *value) { https_client_ = value; }
     void SetTimelineUploadURL(const std::string value) {
-        timeline_upload_url_ = value; }
+        timeline_upload_url_ = value;
+        kopsik::DNSCache::Shared().Prefetch(value);
+    }
     void SetWebSocketClientURL(const std::string value);
+    // Database is opened, migrations included, on a thread of its own
+    // while startup goes on. Whatever needs it first waits for it,
+    // and fails with what opening it failed with, if it did.
     void SetDBPath(
       const std::string path);
+    // Applied to the open database, and the ones opened later
+    kopsik::error SetDBTuning(const kopsik::DatabaseTuning &tuning);
+    // Time entries are archived once they're this many days old,
+    // when the database is maintained. 0 turns archiving off.
+    void SetTimeEntryArchiveDays(const unsigned int days);
+    // Timeline events that pile up while uploads fail are packed
+    // into compressed blocks, see Database::SetTimelineBlocks
+    void SetTimelineBlocks(const bool value);
+    // Timeline batches are sent on the WebSocket while it's connected,
+    // instead of a POST each, see TimelineUploader::SetStream
+    void SetTimelineOverWebSocket(const bool value);
+    // Window titles and filenames matching a redact pattern are
+    // recorded with the match replaced, those matching a drop pattern
+    // aren't recorded, see TitleFilter
+    void SetTimelineTitleFilters(
+      const std::vector<std::string> &redact,
+      const std::vector<std::string> &drop);
+    // Archives what's old enough now, see Database::ArchiveTimeEntries.
+    // The loaded time entries are left where they are.
+    kopsik::error ArchiveTimeEntries(Poco::UInt64 *archived);
     kopsik::error LoadSettings(
       bool *use_proxy,
       kopsik::Proxy *proxy,
@@ -90,9 +276,32 @@ class Context {
     kopsik::error Login(
       const std::string email,
       const std::string password);
+    // Login returns as soon as the user and the running time entry
+    // are in, and the related data is pulled by a full sync after.
+    // Its changes are reported as usual, and the user is reported
+    // updated once all of it is in. Off by default.
+    void SetProgressiveLogin(const bool value);
+    // Full syncs fetch the user, then each workspace's lists and the
+    // time entries in date ranges, several requests at a time, and
+    // apply each piece as it arrives. One /me response by default.
+    void SetPerWorkspaceSync(const bool value);
+    // Progressive login hasn't pulled all the related data yet
+    bool LoginSyncPending() const;
     kopsik::error Logout();
-    kopsik::error SetLoggedInUserFromJSON(const std::string json);
+    kopsik::error SetLoggedInUserFromJSON(const std::string &json);
     kopsik::error ClearCache();
+    // Saves what's changed now, instead of after the save delay
+    kopsik::error Save();
+
+    // Sets the "memory." gauges of Metrics to what the user's lists,
+    // the snapshot, the timeline backlog, the model pools and the
+    // WebSocket buffers take now, in estimated bytes
+    void UpdateMemoryMetrics();
+
+    // What's sent along with feedback, as a JSON object: the metrics,
+    // the slow API calls kept, the size of the database files, how
+    // many models the user has, and each thread's latest spans
+    std::string PerformanceSnapshot();
 
     bool UserHasPremiumWorkspaces() const;
     bool UserIsLoggedIn() const;
@@ -105,38 +314,72 @@ class Context {
       const Poco::UInt64 workspace_id) const;
     kopsik::TimeEntry *GetTimeEntryByGUID(const std::string GUID) const;
 
+    // Edits change the models in memory and save them. Given a
+    // listener, they return as soon as the models are changed, the
+    // save runs on a worker and the listener is told how it went.
+    // Without one, starting, continuing, stopping and deleting save
+    // on the calling thread before they return.
     kopsik::TimeEntry *Start(
       const std::string description,
       const std::string duration,
       const Poco::UInt64 task_id,
-      const Poco::UInt64 project_id);
-    kopsik::TimeEntry *ContinueLatest();
-    kopsik::TimeEntry *Continue(const std::string GUID);
+      const Poco::UInt64 project_id,
+      SaveListener *saved = 0);
+    kopsik::TimeEntry *ContinueLatest(SaveListener *saved = 0);
+    kopsik::TimeEntry *Continue(
+      const std::string GUID,
+      SaveListener *saved = 0);
     kopsik::error SetTimeEntryDuration(
       const std::string GUID,
-      const std::string duration);
-    kopsik::error DeleteTimeEntryByGUID(const std::string GUID);
+      const std::string duration,
+      SaveListener *saved = 0);
+    kopsik::error DeleteTimeEntryByGUID(
+      const std::string GUID,
+      SaveListener *saved = 0);
     kopsik::error SetTimeEntryProject(
       const std::string GUID,
       const Poco::UInt64 task_id,
       const Poco::UInt64 project_id,
-      const std::string project_guid);
+      const std::string project_guid,
+      SaveListener *saved = 0);
     kopsik::error SetTimeEntryStartISO8601(
       const std::string GUID,
-      const std::string value);
+      const std::string value,
+      SaveListener *saved = 0);
     kopsik::error SetTimeEntryEndISO8601(
       const std::string GUID,
-      const std::string value);
+      const std::string value,
+      SaveListener *saved = 0);
     kopsik::error SetTimeEntryTags(
       const std::string GUID,
-      const std::string value);
+      const std::string value,
+      SaveListener *saved = 0);
     kopsik::error SetTimeEntryBillable(
       const std::string GUID,
-      const bool value);
+      const bool value,
+      SaveListener *saved = 0);
     kopsik::error SetTimeEntryDescription(
       const std::string GUID,
-      const std::string value);
-    kopsik::error Stop(kopsik::TimeEntry **stopped_entry);
+      const std::string value,
+      SaveListener *saved = 0);
+    // The setters above are edits of one field each
+    kopsik::error EditTimeEntry(
+      const std::string GUID,
+      const TimeEntryEdit &edit,
+      SaveListener *saved = 0);
+    // The same edit made to each of the time entries, or deleting
+    // them, under one lock and saved in one transaction. Nothing is
+    // changed if one of them isn't found. They're pushed in batches.
+    kopsik::error EditTimeEntries(
+      const std::vector<std::string> &GUIDs,
+      const TimeEntryEdit &edit,
+      SaveListener *saved = 0);
+    kopsik::error DeleteTimeEntries(
+      const std::vector<std::string> &GUIDs,
+      SaveListener *saved = 0);
+    kopsik::error Stop(
+      kopsik::TimeEntry **stopped_entry,
+      SaveListener *saved = 0);
     kopsik::error SplitAt(
       const Poco::Int64 at,
       kopsik::TimeEntry **new_running_entry);
@@ -145,6 +388,73 @@ class Context {
       kopsik::TimeEntry **stopped);
     kopsik::error RunningTimeEntry(
       kopsik::TimeEntry **running) const;
+    // Loaded time entries that overlap the time from..to, by start
+    kopsik::error TimeEntriesBetween(
+      const Poco::UInt64 from,
+      const Poco::UInt64 to,
+      std::vector<kopsik::TimeEntrySpan> *spans) const;
+    // Loaded time entries that overlap the one with the GUID, by start
+    kopsik::error OverlappingTimeEntries(
+      const std::string GUID,
+      std::vector<kopsik::TimeEntrySpan> *spans) const;
+    // Only recent time entries are loaded at login. Loads the ones
+    // from the next older period, if there are any left, from the
+    // database and then from the server.
+    kopsik::error LoadOlderTimeEntries(bool *loaded);
+    // Downloads the time entries that started from since to until,
+    // unless they were downloaded before, and merges them with the
+    // saved ones. The loaded time entries are extended back to since
+    // first, so they stay one period. count is how many came.
+    kopsik::error FetchTimeEntries(
+      const Poco::UInt64 since,
+      const Poco::UInt64 until,
+      Poco::UInt64 *count);
+    // Compares per-day checksums of the loaded time entries that
+    // started from since to until with the server's, and downloads
+    // only the days that differ, see TimeEntryDigests. Costs a small
+    // response when nothing does, so it runs every
+    // kReconcileIntervalMicros between the full syncs.
+    kopsik::error Reconcile(
+      const Poco::UInt64 since,
+      const Poco::UInt64 until,
+      Poco::UInt64 *mismatched_days);
+    // Saved time entries matching the words of the query, best first.
+    // They are not the user's loaded ones, the caller deletes them.
+    kopsik::error SearchTimeEntries(
+      const std::string &query,
+      const Poco::UInt64 offset,
+      const Poco::UInt64 limit,
+      std::vector<kopsik::TimeEntry *> *results) const;
+    // Totals of the saved time entries from from_day to to_day,
+    // yyyymmdd in local time, see Database::LoadReport. Days older
+    // than a full sync downloads are fetched first, see
+    // FetchTimeEntries.
+    kopsik::error LoadReport(
+      const int from_day,
+      const int to_day,
+      kopsik::Report *report);
+    // Writes the saved time entries from from_day to to_day, see
+    // Database::ExportTimeEntries
+    kopsik::error ExportTimeEntries(
+      const int from_day,
+      const int to_day,
+      kopsik::TimeEntryExport *out) const;
+    // Adds the time entries read, kImportChunkRows at a time, each
+    // chunk saved in one transaction. Projects are found by name, and
+    // client if the row has one, in the default workspace, and those
+    // not found are created. Rows whose GUID is there already are
+    // skipped, rows that can't be read are counted in result. What was
+    // added is pushed afterwards, in batches as usual.
+    kopsik::error ImportTimeEntries(
+      kopsik::TimeEntryCSVReader *in,
+      kopsik::TimeEntryImportProgress *progress,
+      kopsik::TimeEntryImportResult *result);
+    // Time entries for the untracked time of the recorded timeline,
+    // see TimeEntrySuggestions
+    kopsik::error SuggestTimeEntries(
+      const std::size_t limit,
+      std::vector<kopsik::TimeEntrySuggestion> *suggestions);
+    void DismissTimeEntrySuggestion(const time_t start);
     kopsik::error ToggleTimelineRecording();
     kopsik::error TimeEntries(
       std::map<std::string, Poco::Int64> *date_durations,
@@ -165,28 +475,255 @@ class Context {
       const bool include_time_entries,
       const bool include_tasks,
       const bool include_projects) const;
+    // Looks for the items AutocompleteIndex::Find would, on a worker
+    // thread, and tells the listener, which the context takes over.
+    // Returns the ID of the query. Only the latest query is answered:
+    // one still waiting is dropped, and one being looked for isn't
+    // told. The index of the current snapshot is used, so typing
+    // doesn't wait for a new one to be built.
+    Poco::UInt64 QueryAutocomplete(
+      const std::string &typed,
+      const std::size_t limit,
+      const bool include_time_entries,
+      const bool include_tasks,
+      const bool include_projects,
+      AutocompleteQueryListener *listener);
     kopsik::error AddProject(
       const Poco::UInt64 workspace_id,
       const Poco::UInt64 client_id,
       const std::string project_name,
       Project **result);
 
+    // Time entries, autocomplete items and tags as of the last change,
+    // or null when logged out. Read it without taking any locks.
+    Poco::AutoPtr<UserSnapshot> Snapshot() const;
+
+    // Current snapshot and what changed in its time entry list since
+    // the given version. Returns false when the changes since then are
+    // no longer known, so the whole list has to be shown again.
+    bool TimeEntryListChanges(
+      const Poco::UInt64 since_version,
+      Poco::AutoPtr<UserSnapshot> *snapshot,
+      TimeEntryListDiff *diff) const;
+    // Same for the grouped list, by group key, see TimeEntryGroups
+    bool TimeEntryGroupListChanges(
+      const Poco::UInt64 since_version,
+      Poco::AutoPtr<UserSnapshot> *snapshot,
+      TimeEntryListDiff *diff) const;
+
+    // For a timer that ticks every second: whether a time entry is
+    // running, its start and a version that changes only when the
+    // running time entry does.
+    bool RunningTimer(
+      Poco::UInt64 *started,
+      Poco::UInt64 *version) const;
+
+  protected:
+    // Notification handlers
+    void handleTimelineEventNotification(
+      TimelineEventNotification *notification);
+    void handleConnectivityChangedNotification(
+      kopsik::ConnectivityChangedNotification *notification);
+
   private:
     const std::string updateURL() const;
 
     static const std::string osName();
 
-    Poco::Logger &logger() const { return Poco::Logger::get("context"); }
+    Poco::Logger &logger() const;
 
     void sync(const bool full_sync);
 
-    kopsik::error save();
+    // Call with user_m_ locked for writing. The changes saved are
+    // added to the list, notify them once the lock is released.
+    kopsik::error save(std::vector<kopsik::ModelChange> *changes);
+
+    // Adds the first count rows of an import and saves them
+    kopsik::error importTimeEntryRows(
+      const std::vector<kopsik::TimeEntryImportRow> &rows,
+      const std::size_t count,
+      kopsik::TimeEntryImportResult *result,
+      std::vector<kopsik::ModelChange> *changes);
+
+    // Saves what each pushed batch changed, so it's not pushed again
+    // if a later batch fails
+    class SaveAfterPush : public kopsik::PushListener {
+     public:
+      SaveAfterPush(
+        Context *context,
+        std::vector<kopsik::ModelChange> *changes)
+        : context_(context)
+        , changes_(changes) {}
+      kopsik::error BatchPushed() { return context_->save(changes_); }
+
+     private:
+      Context *context_;
+      std::vector<kopsik::ModelChange> *changes_;
+    };
+    // Applies and saves each piece of a per-workspace sync as it
+    // arrives, and reports its changes, unless the user has logged
+    // out meanwhile. Keeps a checkpoint of the pieces done, which is
+    // dropped once the sync completes.
+    class ApplyWorkspaceFetch : public kopsik::WorkspaceFetchListener {
+     public:
+      ApplyWorkspaceFetch(
+        Context *context,
+        const std::string &api_token)
+        : context_(context)
+        , api_token_(api_token)
+        , uid_(0) {}
+      kopsik::error Apply(const std::string &list, const std::string &json);
+      kopsik::error Started(const kopsik::SyncCheckpoint &checkpoint);
+      kopsik::error PieceDone(const kopsik::SyncCheckpointPiece &piece);
+      kopsik::error Complete(
+        const Poco::UInt64 since,
+        const Poco::UInt64 time_entries_since,
+        const Poco::UInt64 time_entries_until);
+
+     private:
+      Context *context_;
+      std::string api_token_;
+      Poco::UInt64 uid_;
+      kopsik::UserListLoader loader_;
+    };
+    void notifyModelChanges(const std::vector<kopsik::ModelChange> &changes);
+    void publishSnapshot();
+    // Changes since the version, from the diffs of the snapshots
+    // after it, see TimeEntryListChanges. Call with snapshot_m_ locked.
+    bool mergeListDiffs(
+      const std::deque<TimeEntryListDiff> &diffs,
+      const Poco::UInt64 since_version,
+      TimeEntryListDiff *diff) const;
+    // Once the user's models are gone, gives the pool blocks, the
+    // unused timeline strings and descriptions and the allocator's
+    // free pages back to the OS, and reports the bytes before and after as the
+    // "memory.release." gauges
+    void releaseMemory();
+    // Drops the cached settings, API token and update channel of the
+    // tables given, or of all of them
+    void dropSettingsCache(const std::set<std::string> *tables = 0);
+    // Call with user_m_ locked
+    void refreshRunningTimer();
+
+    // Downloads and merges the time entries of the ranges, whether
+    // they were downloaded before or not
+    kopsik::error fetchTimeEntryRanges(
+      const Poco::UInt64 uid,
+      const std::string &api_token,
+      const std::vector<kopsik::TimeEntryRange> &ranges,
+      Poco::UInt64 *count);
+    // Whether a reconcile is due, taking it if so
+    bool reconcileDue();
+
+    // Call with user_m_ locked for writing
+    void applyEdit(kopsik::TimeEntry *te, const TimeEntryEdit &edit);
+    // Call with user_m_ locked. Fails if one of them isn't found.
+    kopsik::error timeEntriesByGUID(
+      const std::vector<std::string> &GUIDs,
+      std::vector<kopsik::TimeEntry *> *result) const;
+
+    // Starts or stops the idle detector to match the settings
+    void updateIdleDetection();
+
+    // Same as the public methods, but with user_m_ already locked
+    std::vector<std::string> tags() const;
+    kopsik::error timeEntries(
+      std::map<std::string, Poco::Int64> *date_durations,
+      std::vector<kopsik::TimeEntry *> *visible) const;
+    void projectLabelAndColorCode(
+      kopsik::TimeEntry *te,
+      std::string *project_and_task_label,
+      std::string *color_code) const;
+
+    // Edits are saved a moment later, together with the edits
+    // that follow them. With user_m_ locked.
+    void scheduleSave();
+    kopsik::error flushPendingSave(std::vector<kopsik::ModelChange> *changes);
+    // Saves the edit on a worker right away, then tells the listener.
+    // With user_m_ locked for writing.
+    void saveInBackground(SaveListener *saved);
+    // Saves the edit now and adds what was saved to the changes,
+    // unless there's a listener to save it in the background for
+    void saveEdit(
+      std::vector<kopsik::ModelChange> *changes,
+      SaveListener *saved);
+    // The delayed save, unless there's a listener to save it
+    // in the background for
+    void scheduleEditSave(SaveListener *saved);
+    // Keeps the edits that aren't saved yet in the change journal of
+    // the database, for the time until they are. With user_m_ locked
+    // for writing.
+    void journalEdits();
+    // Tells the listeners waiting for a save how it went
+    static void tellSaved(
+      std::vector<SaveListener *> *listeners,
+      const kopsik::error err);
+
+    // Applies the WebSocket updates received so far and saves them,
+    // with user_m_ locked for writing
+    kopsik::error loadPendingUpdates(
+      std::vector<kopsik::ModelChange> *changes);
 
     void partialSync();
+    void requestSync(const SyncScheduler::Kind kind,
+                     const bool user_initiated);
+    // With sync_m_ locked
+    void scheduleSyncTask(const Poco::Timestamp &task_at);
+
+    // For the requests made by the tasks. Cancelled by Shutdown,
+    // and replaced with a fresh one once it's done.
+    kopsik::HTTPSCancellation::Ptr requestCancellation();
+    void cancelRequests();
+    // Sync that was started with cancellation is done
+    void finishSync(kopsik::HTTPSCancellation::Ptr cancellation);
+    // Runs what was held while offline: one sync that pushes the
+    // edits made meanwhile before pulling, and the other tasks
+    void catchUpAfterOffline();
+    // Unless it's scheduled already. Shutdown cancels it.
+    void scheduleConnectivityProbe();
+
+    // Earliest time for a request to the API, after at and
+    // whenever the server asked to retry after
+    Poco::Timestamp requestAllowedAt(const Poco::Timestamp &at) const;
+
+    // Second part of startup, loads the rest of the current user's
+    // data in the background and notifies it as inserted
+    void loadRelatedData();
+
+    // Edits and syncs put database upkeep off until they've
+    // stopped for a while
+    void noteActivity();
+    // Unless it's scheduled already. Shutdown cancels it.
+    void scheduleDatabaseMaintenance(const Poco::Timestamp &at);
+    // Brings the lookups over the user's models up to date once
+    // there's been no activity for kPrecomputeIdleMicros, unless
+    // that's scheduled already.
+    void schedulePrecompute(const Poco::Timestamp &at);
+    // Next look at whether a periodic full sync is due
+    void schedulePeriodicSync(const Poco::Timestamp &at);
+    // Next look at what the command line app or another
+    // instance has saved into the database
+    void scheduleExternalChangesCheck();
+
+    // Schedules the task on the shared timer_, keeping it so
+    // cancelScheduled can cancel it. Call with timer_m_ held.
+    void schedule(Poco::Util::TimerTask::Ptr task,
+                  const Poco::Timestamp &at);
+    // Same, for background work nobody is waiting for, which is put
+    // off on battery, see PowerPolicy
+    void scheduleDeferrable(Poco::Util::TimerTask::Ptr task,
+                            const Poco::Timestamp &at);
+    // Cancels this context's tasks on timer_, as timer_.cancel
+    // would cancel every context's. Call with timer_m_ held.
+    void cancelScheduled();
 
     // timer_ callbacks
-    void onFullSync(Poco::Util::TimerTask& task);  // NOLINT
-    void onPartialSync(Poco::Util::TimerTask& task);  // NOLINT
+    void onLoadRelatedData(Poco::Util::TimerTask& task);  // NOLINT
+    void onSave(Poco::Util::TimerTask& task);  // NOLINT
+    void onSaveInBackground(Poco::Util::TimerTask& task);  // NOLINT
+    void onLoadPendingUpdates(Poco::Util::TimerTask& task);  // NOLINT
+    void onAutocompleteQuery(Poco::Util::TimerTask& task);  // NOLINT
+    void onSync(Poco::Util::TimerTask& task);  // NOLINT
     void onSwitchWebSocketOff(Poco::Util::TimerTask& task);  // NOLINT
     void onSwitchWebSocketOn(Poco::Util::TimerTask& task);  // NOLINT
     void onSwitchTimelineOff(Poco::Util::TimerTask& task);  // NOLINT
@@ -194,7 +731,21 @@ class Context {
     void onFetchUpdates(Poco::Util::TimerTask& task);  // NOLINT
     void onTimelineUpdateServerSettings(Poco::Util::TimerTask& task);  // NOLINT
     void onSendFeedback(Poco::Util::TimerTask& task);  // NOLINT
-
+    void onMaintainDatabase(Poco::Util::TimerTask& task);  // NOLINT
+    void onPrecompute(Poco::Util::TimerTask& task);  // NOLINT
+    void onPeriodicSync(Poco::Util::TimerTask& task);  // NOLINT
+    void onCheckExternalChanges(Poco::Util::TimerTask& task);  // NOLINT
+    void onProbeConnectivity(Poco::Util::TimerTask& task);  // NOLINT
+
+    // Writes the autocomplete index to its file, unless the file is
+    // current already. Call with user_m_ locked for writing, with
+    // everything saved.
+    kopsik::error saveAutocompleteIndex();
+    // All of them, sorted with CompareAutocompleteItems
+    void autocompleteItems(std::vector<AutocompleteItem> *items) const;
+    // Generations of the lists the autocomplete items come from, or
+    // none while changes to them may not show in the generations
+    void autocompleteGenerations(std::vector<int> *generations) const;
     void getTimeEntryAutocompleteItems(
       std::vector<AutocompleteItem> *list) const;
     void getTaskAutocompleteItems(
@@ -202,49 +753,215 @@ class Context {
     void getProjectAutocompleteItems(
       std::vector<AutocompleteItem> *list) const;
 
-    Poco::Mutex db_m_;
+    // Waits for the database SetDBPath is opening, if it's not
+    // open yet. Null when it couldn't be opened.
+    kopsik::Database *database() const;
+    // No error when there's a database to use. Otherwise why not:
+    // what opening it failed with, or that there's no path to it.
+    kopsik::error checkDatabase() const;
+    // Runs on db_opener_
+    void openDatabase();
+
+    InstrumentedMutex db_m_;
+    // Only read through database(), as it may still be opening
     kopsik::Database *db_;
-
-    Poco::Mutex user_m_;
+    kopsik::DatabaseTuning db_tuning_;
+    // Guarded by db_m_, 0 keeps everything in time_entries
+    unsigned int time_entry_archive_days_;
+
+    // Opening the database, and what it's opened with.
+    // Guarded by db_open_m_.
+    mutable Poco::Mutex db_open_m_;
+    mutable Poco::Thread db_opener_;
+    Poco::RunnableAdapter<Context> db_open_runnable_;
+    mutable bool db_opening_;
+    std::string db_open_path_;
+    kopsik::DatabaseTuning db_open_tuning_;
+    bool db_open_rollups_;
+    bool db_open_blocks_;
+    kopsik::error db_open_error_;
+
+    // UI reads of the user and its related models share the lock,
+    // sync, updates and edits take it exclusively. Model change
+    // callbacks run without it, so they can read the models.
+    mutable InstrumentedRWLock user_m_;
     kopsik::User *user_;
 
+    Poco::FastMutex snapshot_publish_m_;
+    mutable Poco::FastMutex snapshot_m_;
+    Poco::AutoPtr<UserSnapshot> snapshot_;
+    Poco::UInt64 snapshot_version_;
+    // Diffs leading to the last kTimeEntryListMaxDiffs snapshots
+    std::deque<TimeEntryListDiff> snapshot_diffs_;
+    // Diffs of the grouped lists, one for each of snapshot_diffs_
+    std::deque<TimeEntryListDiff> snapshot_group_diffs_;
+
+    mutable Poco::FastMutex running_timer_m_;
+    // Running time entry as last seen, without its duration
+    TimeEntrySnapshot running_timer_;
+    bool running_timer_tracking_;
+    Poco::UInt64 running_timer_version_;
+
     Poco::Mutex ws_client_m_;
     kopsik::WebSocketClient *ws_client_;
 
+    // WebSocket updates waiting to be applied, owned here
+    Poco::Mutex pending_updates_m_;
+    std::vector<JSONValue *> pending_updates_;
+
+    // The latest autocomplete query, and whether it's still to be
+    // looked for
+    Poco::Mutex autocomplete_query_m_;
+    AutocompleteQuery autocomplete_query_;
+    bool autocomplete_query_pending_;
+
     Poco::Mutex timeline_uploader_m_;
     kopsik::TimelineUploader *timeline_uploader_;
+    bool timeline_over_websocket_;
 
     Poco::Mutex window_change_recorder_m_;
     kopsik::WindowChangeRecorder *window_change_recorder_;
+    // Used by the recorder, which goes first
+    kopsik::TitleFilter title_filter_;
+
+    // Guards on_idle_callback_ as well
+    Poco::Mutex idle_detector_m_;
+    kopsik::IdleDetector *idle_detector_;
 
     std::string app_name_;
     std::string app_version_;
 
     std::string api_url_;
     std::string timeline_upload_url_;
+    kopsik::HTTPSClient *https_client_;
 
     CustomErrorHandler error_handler_;
 
+    // Settings, API token of the session and update channel as last
+    // read or saved, so the UI's frequent reads don't wait on the
+    // database. Dropped when another process saves them.
+    mutable Poco::Mutex settings_m_;
+    mutable bool settings_loaded_;
+    mutable bool use_proxy_;
+    mutable kopsik::Proxy proxy_;
+    mutable bool use_idle_detection_;
+    bool api_token_loaded_;
+    std::string api_token_;
+    bool update_channel_loaded_;
     std::string update_channel_;
 
     Feedback feedback_;
 
     ModelChangeCallback on_model_change_callback_;
+    ModelChangesCallback on_model_changes_callback_;
+    Poco::Mutex subscriptions_m_;
+    std::map<unsigned int, ModelChangeSubscription> subscriptions_;
+    unsigned int last_subscription_;
     ErrorCallback on_error_callback_;
     CheckUpdateCallback on_check_update_callback_;
     OnlineCallback on_online_callback_;
+    IdleCallback on_idle_callback_;
+
+    // Edits not saved yet, guarded by user_m_
+    bool save_pending_;
+    // Waiting for the next background save, guarded by user_m_
+    std::vector<SaveListener *> save_listeners_;
+    // All of the user's related data is in memory, so a snapshot
+    // of it can be written. Guarded by user_m_.
+    bool related_data_loaded_;
+    // Whether the autocomplete index file was read, or written, at
+    // the snapshot generation the database is at now, in which case
+    // there's no need to write it again. Guarded by user_m_.
+    bool autocomplete_index_file_current_;
+    Poco::UInt64 autocomplete_index_file_generation_;
+    // Read from the file when the related data was loaded, for the
+    // next snapshot to take instead of building the index, if the
+    // lists are still at these generations
+    Poco::FastMutex stored_autocomplete_m_;
+    Poco::SharedPtr<AutocompleteIndex> stored_autocomplete_;
+    std::vector<int> stored_autocomplete_generations_;
+    // Guarded by user_m_ too
+    bool progressive_login_;
+    bool login_sync_pending_;
+    bool per_workspace_sync_;
+
+    // Pending syncs and the task that runs them
+    Poco::Mutex sync_m_;
+    SyncScheduler sync_scheduler_;
+    Poco::Util::TimerTask::Ptr sync_task_;
+    // Aborts the requests of the sync in flight, if any. While it's
+    // downloading, a newer sync that would redo it supersedes it.
+    kopsik::HTTPSCancellation::Ptr sync_cancellation_;
+    SyncScheduler::Kind sync_running_;
+    bool sync_downloading_;
+    // Next sync pushes before it pulls, as edits were made offline
+    bool sync_push_first_;
+    // When the periodic full syncs are due, by the WebSocket health
+    FullSyncInterval full_sync_interval_;
+    Poco::Timestamp last_full_sync_at_;
+    Poco::Timestamp last_reconcile_at_;
+
+    // Tasks that found the network gone, to run when it's back.
+    // Guarded by connectivity_m_.
+    Poco::Mutex connectivity_m_;
+    bool fetch_updates_held_;
+    bool timeline_settings_held_;
+
+    Poco::Mutex cancellation_m_;
+    kopsik::HTTPSCancellation::Ptr requests_cancellation_;
 
     // Tasks are scheduled at:
-    Poco::Timestamp next_full_sync_at_;
-    Poco::Timestamp next_partial_sync_at_;
     Poco::Timestamp next_fetch_updates_at_;
     Poco::Timestamp next_update_timeline_settings_at_;
 
-    // Schedule tasks using a timer:
+    // Last edit or sync request
+    Poco::FastMutex activity_m_;
+    Poco::Timestamp last_activity_at_;
+
+    // Timeline setting last accepted by the server, with the API
+    // token it was sent with. Only touched by the background worker.
+    std::string timeline_settings_sent_;
+
+    // Learns from the timeline as it's recorded
+    kopsik::TimeEntrySuggestions suggestions_;
+
+    // Timeline is stored and uploaded as hourly totals
+    // per app, as the server asked. Guarded by db_m_.
+    bool timeline_rollups_;
+    // Guarded by db_m_ too
+    bool timeline_blocks_;
+
+    // Timeline notifications of this context only
+    Poco::NotificationCenter notifications_;
+
+    // Tasks run on the workers of the shared pool, interactive and
+    // background ones apart, so a long download doesn't hold up edits.
+    // This context's tasks of a queue run one at a time.
+    kopsik::WorkerPool &workers_;
+
+    // Schedule tasks using the shared timer:
     Poco::Mutex timer_m_;
-    Poco::Util::Timer timer_;
+    Poco::Util::Timer &timer_;
+    // Tasks scheduled on timer_ that someone besides us still holds,
+    // so they may run yet. Guarded by timer_m_.
+    std::vector<Poco::Util::TimerTask::Ptr> scheduled_;
+    // Guarded by timer_m_
+    bool database_maintenance_scheduled_;
+    bool precompute_scheduled_;
+    bool external_changes_check_scheduled_;
+    bool connectivity_probe_scheduled_;
+    bool periodic_sync_scheduled_;
+    // Set when the context goes, so that the tasks still running
+    // don't schedule more. Guarded by timer_m_
+    bool closing_;
 };
 
+// Hands a data message of the WebSocket client to the context,
+// see WebSocketClient::Start
+void on_websocket_message(
+    void *context,
+    JSONValue *message);
+
 }  // namespace kopsik
 
 #endif  // SRC_CONTEXT_H_
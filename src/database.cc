@@ -4,16 +4,38 @@
 
 #include "./database.h"
 
+#include <algorithm>
 #include <limits>
+#include <map>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "./autocomplete_index_file.h"
+#include "./const.h"
+#include "./log.h"
+#include "./memory_usage.h"
+#include "./metrics.h"
+#include "./model_schema.h"
+#include "./day_totals.h"
+#include "./json.h"
+#include "./related_data_snapshot.h"
+#include "./text_words.h"
+#include "./time_entry_archive.h"
+#include "./timeline_dispatcher.h"
+#include "./timeline_uploader.h"
+#include "./trace.h"
 #include "./user.h"
 
+#include "Poco/DeflatingStream.h"
 #include "Poco/Logger.h"
+#include "Poco/NumberFormatter.h"
 #include "Poco/UUID.h"
 #include "Poco/UUIDGenerator.h"
 #include "Poco/Stopwatch.h"
+#include "Poco/Thread.h"
+#include "Poco/UTF8String.h"
 #include "Poco/Data/Common.h"
 #include "Poco/Data/RecordSet.h"
 #include "Poco/Data/Statement.h"
@@ -23,23 +45,173 @@
 
 namespace kopsik {
 
-Database::Database(const std::string db_path)
+static LogComponent log_database = { "database", 0 };
+
+// Timeline events are written once this many have been buffered,
+// or the oldest of them has waited this long.
+const std::size_t kTimelineEventsFlushCount = 50;
+const time_t kTimelineEventsFlushSeconds = 60;
+
+// Most events kept in memory while writing them keeps failing
+const std::size_t kTimelineEventsBufferMax = 1000;
+
+const char *ModelChange::ModelTypeName(const Model model_type) {
+    switch (model_type) {
+    case TimeEntryModel:
+        return "time_entry";
+    case WorkspaceModel:
+        return "workspace";
+    case ClientModel:
+        return "client";
+    case ProjectModel:
+        return "project";
+    case UserModel:
+        return "user";
+    case TaskModel:
+        return "task";
+    case TagModel:
+        return "tag";
+    }
+    return "";
+}
+
+const char *ModelChange::ChangeTypeName(const Change change_type) {
+    switch (change_type) {
+    case Insert:
+        return "insert";
+    case Update:
+        return "update";
+    case Delete:
+        return "delete";
+    }
+    return "";
+}
+
+void MergeModelChanges(
+        const std::vector<ModelChange> &changes,
+        std::vector<ModelChange> *merged) {
+    poco_assert(merged);
+
+    // Models are told apart by their GUID, or ID when they have none
+    typedef std::pair<std::pair<int, Poco::UInt64>, std::string> Key;
+
+    std::vector<ModelChange> result;
+    // Position in result of the change of each model
+    std::map<Key, std::size_t> positions;
+    std::vector<bool> dropped;
+    for (std::vector<ModelChange>::const_iterator it = changes.begin();
+            it != changes.end();
+            it++) {
+        Key key(std::make_pair(static_cast<int>(it->ModelType()),
+                               it->GUID().empty() ? it->ModelID() : 0),
+                it->GUID());
+
+        std::map<Key, std::size_t>::iterator found = positions.find(key);
+        if (found == positions.end()) {
+            positions[key] = result.size();
+            result.push_back(*it);
+            dropped.push_back(false);
+            continue;
+        }
+
+        const ModelChange &previous = result[found->second];
+        ModelChange::Change change_type = it->ChangeType();
+        if (ModelChange::Insert == previous.ChangeType()
+                && ModelChange::Delete == change_type) {
+            // The UI never saw the model
+            dropped[found->second] = true;
+            positions.erase(found);
+            continue;
+        }
+        if (ModelChange::Insert == previous.ChangeType()) {
+            change_type = ModelChange::Insert;
+        } else if (ModelChange::Delete != change_type) {
+            change_type = ModelChange::Update;
+        }
+        Poco::UInt64 model_id = it->ModelID();
+        if (!model_id) {
+            model_id = previous.ModelID();
+        }
+        result[found->second] =
+            ModelChange(it->ModelType(), change_type, model_id, it->GUID());
+    }
+
+    for (std::size_t i = 0; i < result.size(); i++) {
+        if (!dropped[i]) {
+            merged->push_back(result[i]);
+        }
+    }
+}
+
+Database::Database(
+        const std::string db_path,
+        const DatabaseTuning &tuning,
+        Poco::NotificationCenter &notifications)
         : session(0)
-        , desktop_id_("") {
+        , read_session_(0)
+        , desktop_id_("")
+        , update_time_entry_with_id_(0)
+        , update_time_entry_(0)
+        , insert_time_entry_with_id_(0)
+        , insert_time_entry_(0)
+        , last_insert_rowid_(0)
+        , time_entry_word_("")
+        , delete_time_entry_words_(0)
+        , insert_time_entry_word_(0)
+        , time_entry_words_complete_(false)
+        , last_insert_rowid_value_(0)
+        , mutex_("db.mutex")
+        , read_m_("db.read")
+        , timeline_events_buffered_at_(0)
+        , timeline_coalesce_seconds_(kTimelineCoalesceSeconds)
+        , timeline_rollups_(false)
+        , timeline_blocks_(false)
+        , timeline_selected_until_(0)
+        , time_entry_load_days_(0)
+        , snapshot_path_("")
+        , autocomplete_index_path_("")
+        , change_journal_path_("")
+        , change_journal_(0)
+        , analyzed_at_(0)
+        , lease_holder_(GenerateGUID())
+        , busy_at_(0)
+        , busy_seen_(false)
+        , notifications_(notifications) {
+    // Each phase of opening is timed separately, to see
+    // which one holds up startup
+    Poco::Timestamp phase;
+
     Poco::Data::SQLite::Connector::registerConnector();
 
     session = new Poco::Data::Session("SQLite", db_path);
+    profileStatements(session, &statement_started_);
+    installBusyHandler(session);
+    // Writes take the lock when they begin, where they can wait for
+    // it, rather than when a read in them turns into a write
+    session->setProperty("transactionMode", std::string("IMMEDIATE"));
 
     {
         int is_sqlite_threadsafe = sqlite3_threadsafe();
 
-        std::stringstream ss;
-        ss << "sqlite3_threadsafe()=" << is_sqlite_threadsafe;
-        logger().debug(ss.str());
+        KOPSIK_LOG_DEBUG(logger(), "sqlite3_threadsafe()="
+            << is_sqlite_threadsafe);
 
         poco_assert(is_sqlite_threadsafe);
     }
 
+    // Only take effect on a new database, page size first as setting
+    // auto_vacuum writes the first page. An existing database is
+    // switched over to auto_vacuum when Maintain vacuums it.
+    try {
+        if (tuning.page_size) {
+            *session << "PRAGMA page_size = " << tuning.page_size,
+                Poco::Data::now;
+        }
+        *session << "PRAGMA auto_vacuum = INCREMENTAL", Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        logger().warning(exc.displayText());
+    }
+
     error err = setJournalMode("wal");
     poco_assert(err == noError);
     {
@@ -47,21 +219,44 @@ Database::Database(const std::string db_path)
         error err = journalMode(&mode);
         poco_assert(err == noError);
 
-        std::stringstream ss;
-        ss << "PRAGMA journal_mode=" << mode;
-        logger().debug(ss.str());
+        KOPSIK_LOG_DEBUG(logger(), "PRAGMA journal_mode=" << mode);
 
         poco_assert("wal" == mode);
     }
 
+    Metrics::Shared().Time("db.open.connect", phase.elapsed());
+    phase.update();
+
     err = initialize_tables();
     if (err != noError) {
         logger().error(err);
     }
     poco_assert(err == noError);
 
-    Poco::NotificationCenter& nc =
-    Poco::NotificationCenter::defaultCenter();
+    Metrics::Shared().Time("db.open.migrations", phase.elapsed());
+    phase.update();
+
+    // WAL lets this connection read while the other one writes.
+    // An in-memory database can't be shared by two connections.
+    if (db_path != ":memory:") {
+        read_session_ = new Poco::Data::Session("SQLite", db_path);
+        profileStatements(read_session_, &read_statement_started_);
+        installBusyHandler(read_session_);
+    }
+
+    err = loadChangeGenerations(&seen_generations_);
+    if (err != noError) {
+        logger().error(err);
+    }
+
+    err = Tune(tuning);
+    if (err != noError) {
+        logger().error(err);
+    }
+
+    Metrics::Shared().Time("db.open.tune", phase.elapsed());
+
+    Poco::NotificationCenter& nc = notifications_;
 
     Poco::Observer<Database, TimelineEventNotification>
       observeCreate(*this,
@@ -77,14 +272,44 @@ Database::Database(const std::string db_path)
         observeDelete(*this,
     &Database::handleDeleteTimelineBatchNotification);
     nc.addObserver(observeDelete);
+
+    Poco::Observer<Database, DeleteTimelineBlockNotification>
+        observeDeleteBlock(*this,
+    &Database::handleDeleteTimelineBlockNotification);
+    nc.addObserver(observeDeleteBlock);
 }
 
 Database::~Database() {
+    Poco::NotificationCenter& nc = notifications_;
+
+    nc.removeObserver(Poco::Observer<Database, TimelineEventNotification>(
+        *this, &Database::handleTimelineEventNotification));
+    nc.removeObserver(
+        Poco::Observer<Database, CreateTimelineBatchNotification>(
+            *this, &Database::handleCreateTimelineBatchNotification));
+    nc.removeObserver(
+        Poco::Observer<Database, DeleteTimelineBatchNotification>(
+            *this, &Database::handleDeleteTimelineBatchNotification));
+    nc.removeObserver(
+        Poco::Observer<Database, DeleteTimelineBlockNotification>(
+            *this, &Database::handleDeleteTimelineBlockNotification));
+
+    SetTimelineRollups(false);
+    error err = FlushTimelineEvents();
+    if (err != noError) {
+        logger().error(err);
+    }
+    clearStatements();
+    if (read_session_) {
+        delete read_session_;
+        read_session_ = 0;
+    }
     if (session) {
         delete session;
         session = 0;
     }
     Poco::Data::SQLite::Connector::unregisterConnector();
+    delete change_journal_;
 }
 
 error Database::DeleteUser(
@@ -121,6 +346,40 @@ error Database::DeleteUser(
         if (err != noError) {
             return err;
         }
+        err = deleteAllFromTableByUID("time_entries_archive", model->ID());
+        if (err != noError) {
+            return err;
+        }
+        err = deleteAllFromTableByUID("time_entry_fetches", model->ID());
+        if (err != noError) {
+            return err;
+        }
+        err = DeleteSyncCheckpoint(model->ID());
+        if (err != noError) {
+            return err;
+        }
+        err = deleteAllFromTableByUID("push_outbox", model->ID());
+        if (err != noError) {
+            return err;
+        }
+        model->related.Outbox.Clear();
+        report_cache_.Clear();
+        err = bumpSnapshotGeneration();
+        if (err != noError) {
+            return err;
+        }
+        std::set<std::string> tables;
+        tables.insert("workspaces");
+        tables.insert("clients");
+        tables.insert("projects");
+        tables.insert("tasks");
+        tables.insert("tags");
+        tables.insert("time_entries");
+        InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+        err = bumpChangeGenerations(tables);
+        if (err != noError) {
+            return err;
+        }
     }
     return noError;
 }
@@ -132,7 +391,7 @@ error Database::deleteAllFromTableByUID(
     poco_assert(UID > 0);
     poco_assert(!table_name.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
         *session << "delete from " + table_name + " where uid = :uid",
@@ -148,35 +407,46 @@ error Database::deleteAllFromTableByUID(
     return last_error("deleteAllFromTableByUID");
 }
 
-error Database::journalMode(std::string *mode) {
+error Database::Tune(const DatabaseTuning &tuning) {
     poco_assert(session);
-    poco_assert(mode);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    {
+        InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+        error err = tuneSession(session, tuning);
+        if (err != noError) {
+            return err;
+        }
+    }
+    if (read_session_) {
+        InstrumentedMutex::ScopedLock lock(read_m_, __FUNCTION__);
+        error err = tuneSession(read_session_, tuning);
+        if (err != noError) {
+            return err;
+        }
+    }
 
-    try {
-        *session << "PRAGMA journal_mode",
-            Poco::Data::into(*mode),
-            Poco::Data::now;
-    } catch(const Poco::Exception& exc) {
-        return exc.displayText();
-    } catch(const std::exception& ex) {
-        return ex.what();
-    } catch(const std::string& ex) {
-        return ex;
+    DatabaseTuning effective;
+    error err = EffectiveTuning(&effective);
+    if (err != noError) {
+        return err;
     }
-    return last_error("journalMode");
+    logger().information("SQLite " + effective.String());
+    return noError;
 }
 
-error Database::setJournalMode(const std::string mode) {
-    poco_assert(session);
-    poco_assert(!mode.empty());
-
-    Poco::Mutex::ScopedLock lock(mutex_);
-
+error Database::tuneSession(
+        Poco::Data::Session *connection,
+        const DatabaseTuning &tuning) {
     try {
-        *session << "PRAGMA journal_mode=" << mode,
-          Poco::Data::now;
+        *connection << "PRAGMA synchronous = " << tuning.synchronous,
+            Poco::Data::now;
+        *connection << "PRAGMA temp_store = " << tuning.temp_store,
+            Poco::Data::now;
+        // Negative is KiB, positive would be pages
+        *connection << "PRAGMA cache_size = " << -tuning.cache_size_kib,
+            Poco::Data::now;
+        *connection << "PRAGMA mmap_size = " << tuning.mmap_size_bytes,
+            Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -184,30 +454,36 @@ error Database::setJournalMode(const std::string mode) {
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("setJournalMode");
-}
-
-Poco::Logger &Database::logger() const {
-    return Poco::Logger::get("database");
+    return noError;
 }
 
-error Database::deleteFromTable(
-        const std::string table_name,
-        const Poco::Int64 local_id) {
+error Database::EffectiveTuning(DatabaseTuning *tuning) {
     poco_assert(session);
-    poco_assert(!table_name.empty());
-    poco_assert(local_id);
+    poco_assert(tuning);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
-    std::stringstream ss;
-    ss << "Deleting from table " << table_name
-        << ", local ID: " << local_id;
-    logger().debug(ss.str());
     try {
-        *session << "delete from " + table_name +
-            " where local_id = :local_id",
-            Poco::Data::use(local_id),
+        *session << "PRAGMA synchronous",
+            Poco::Data::into(tuning->synchronous),
+            Poco::Data::now;
+        *session << "PRAGMA temp_store",
+            Poco::Data::into(tuning->temp_store),
+            Poco::Data::now;
+        Poco::Int64 cache_size(0);
+        *session << "PRAGMA cache_size",
+            Poco::Data::into(cache_size),
+            Poco::Data::now;
+        Poco::Int64 page_size(0);
+        *session << "PRAGMA page_size",
+            Poco::Data::into(page_size),
+            Poco::Data::now;
+        tuning->page_size = static_cast<int>(page_size);
+        tuning->cache_size_kib = cache_size < 0
+            ? -cache_size : cache_size * page_size / 1024;
+        tuning->mmap_size_bytes = 0;
+        *session << "PRAGMA mmap_size",
+            Poco::Data::into(tuning->mmap_size_bytes),
             Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
@@ -216,69 +492,135 @@ error Database::deleteFromTable(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("deleteFromTable");
+    return last_error("EffectiveTuning");
 }
 
-error Database::last_error(const std::string was_doing) {
+error Database::Maintain() {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    TraceSpan trace("Database::Maintain");
 
-    Poco::Data::SessionImpl* impl = session->impl();
-    Poco::Data::SQLite::SessionImpl* sqlite =
-        static_cast<Poco::Data::SQLite::SessionImpl*>(impl);
-    std::string last = Poco::Data::SQLite::Utility::lastError(sqlite->db());
-    if (last != "not an error") {
-        return error(was_doing + ": " + last);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    bool acquired(false);
+    if (!contendedLately()) {
+        error err = acquireMaintenanceLease(&acquired);
+        if (err != noError) {
+            return err;
+        }
+    }
+    if (!acquired) {
+        logger().debug("Maintain deferred to the other process");
+        Metrics::Shared().Count("db.maintenance_deferred");
+        return noError;
     }
-    return noError;
-}
 
-std::string Database::GenerateGUID() {
-    Poco::UUIDGenerator& generator = Poco::UUIDGenerator::defaultGenerator();
-    Poco::UUID uuid(generator.createRandom());
-    return uuid.toString();
+    error err = maintain();
+    error release_err = releaseMaintenanceLease();
+    if (err != noError) {
+        return err;
+    }
+    return release_err;
 }
 
-error Database::LoadCurrentUser(
-        User *user,
-        const bool with_related_data) {
-    poco_assert(user);
+error Database::maintain() {
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
 
-    std::string api_token("");
-    error err = CurrentAPIToken(&api_token);
+    error err = checkpointWAL();
     if (err != noError) {
         return err;
     }
-    if (api_token.empty()) {
-        return noError;
+    err = vacuumFreePages();
+    if (err != noError) {
+        return err;
     }
-    return LoadUserByAPIToken(api_token, user, with_related_data);
+    if (analyzed_at_.isElapsed(kDatabaseAnalyzeIntervalMicros)) {
+        err = analyze();
+        if (err != noError) {
+            return err;
+        }
+        analyzed_at_.update();
+    }
+
+    stopwatch.stop();
+    Metrics::Shared().Time("db.maintain", stopwatch.elapsed());
+    return noError;
 }
 
-error Database::LoadSettings(
-        bool *use_proxy,
-        Proxy *proxy,
-        bool *use_idle_detection) {
-    poco_assert(session);
-    poco_assert(use_proxy);
-    poco_assert(proxy);
-    poco_assert(use_idle_detection);
+void Database::installBusyHandler(Poco::Data::Session *connection) {
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(connection->impl());
+    sqlite3_busy_handler(sqlite->db(), busyHandler, this);
+}
+
+// Sleeps 1, 2, 4 ... ms, up to the longest sleep, until the
+// sleeps add up to the timeout
+int Database::busyHandler(void *database, int count) {
+    int waited(0);
+    int sleep(kDatabaseBusyMinSleepMillis);
+    for (int i = 0; i < count && waited < kDatabaseBusyTimeoutMillis; i++) {
+        waited += sleep;
+        sleep = std::min(sleep * 2, kDatabaseBusyMaxSleepMillis);
+    }
+    if (waited >= kDatabaseBusyTimeoutMillis) {
+        Metrics::Shared().Count("db.busy_timeouts");
+        return 0;
+    }
+    if (!count) {
+        Metrics::Shared().Count("db.busy_waits");
+    }
+
+    Database *self = static_cast<Database *>(database);
+    {
+        Poco::FastMutex::ScopedLock lock(self->busy_m_);
+        self->busy_at_.update();
+        self->busy_seen_ = true;
+    }
+    Poco::Thread::sleep(sleep);
+    return 1;
+}
+
+bool Database::contendedLately() {
+    Poco::FastMutex::ScopedLock lock(busy_m_);
+    return busy_seen_ && !busy_at_.isElapsed(kDatabaseContentionQuietMicros);
+}
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+error Database::acquireMaintenanceLease(bool *acquired) {
+    poco_assert(acquired);
 
+    *acquired = false;
+
+    Poco::UInt64 now = Poco::Timestamp().epochTime();
+    Poco::UInt64 until = now + kDatabaseMaintenanceLeaseSeconds;
+    error err = noError;
     try {
-        *session << "select use_proxy, proxy_host, proxy_port, "
-                "proxy_username, proxy_password, use_idle_detection "
-                "from settings",
-            Poco::Data::into(*use_proxy),
-            Poco::Data::into(proxy->host),
-            Poco::Data::into(proxy->port),
-            Poco::Data::into(proxy->username),
-            Poco::Data::into(proxy->password),
-            Poco::Data::into(*use_idle_detection),
-            Poco::Data::limit(1),
+        session->begin();
+        std::vector<std::string> holders;
+        std::vector<Poco::UInt64> untils;
+        *session << "SELECT holder, until FROM maintenance_lease",
+            Poco::Data::into(holders),
+            Poco::Data::into(untils),
             Poco::Data::now;
+        err = last_error("acquireMaintenanceLease");
+        if (err == noError && !holders.empty()
+                && holders[0] != lease_holder_ && untils[0] > now) {
+            session->rollback();
+            return noError;
+        }
+        if (err == noError) {
+            *session << "INSERT OR REPLACE INTO maintenance_lease"
+                "(id, holder, until) VALUES(1, :holder, :until)",
+                Poco::Data::use(lease_holder_),
+                Poco::Data::use(until),
+                Poco::Data::now;
+            err = last_error("acquireMaintenanceLease");
+        }
+        if (err != noError) {
+            session->rollback();
+            return err;
+        }
+        session->commit();
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -286,31 +628,14 @@ error Database::LoadSettings(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("LoadSettings");
+    *acquired = true;
+    return noError;
 }
 
-error Database::SaveSettings(
-        const bool use_proxy,
-        const Proxy *proxy,
-        const bool use_idle_detection) {
-    poco_assert(session);
-
-    Poco::Mutex::ScopedLock lock(mutex_);
-
+error Database::releaseMaintenanceLease() {
     try {
-        *session << "update settings set "
-            "use_proxy = :use_proxy, "
-            "proxy_host = :proxy_host, "
-            "proxy_port = :proxy_port, "
-            "proxy_username = :proxy_username, "
-            "proxy_password = :proxy_password, "
-            "use_idle_detection = :use_idle_detection ",
-            Poco::Data::use(use_proxy),
-            Poco::Data::use(proxy->host),
-            Poco::Data::use(proxy->port),
-            Poco::Data::use(proxy->username),
-            Poco::Data::use(proxy->password),
-            Poco::Data::use(use_idle_detection),
+        *session << "DELETE FROM maintenance_lease WHERE holder = :holder",
+            Poco::Data::use(lease_holder_),
             Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
@@ -319,20 +644,19 @@ error Database::SaveSettings(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("SaveSettings");
+    return last_error("releaseMaintenanceLease");
 }
 
-error Database::LoadUpdateChannel(
-        std::string *update_channel) {
-    poco_assert(session);
-    poco_assert(update_channel);
-
-    Poco::Mutex::ScopedLock lock(mutex_);
-
+error Database::checkpointWAL() {
+    int busy(0);
+    int log_frames(0);
+    int checkpointed_frames(0);
     try {
-        *session << "select update_channel from settings",
-            Poco::Data::into(*update_channel),
-            Poco::Data::limit(1),
+        // Copies what no reader still needs, without blocking them
+        *session << "PRAGMA wal_checkpoint(PASSIVE)",
+            Poco::Data::into(busy),
+            Poco::Data::into(log_frames),
+            Poco::Data::into(checkpointed_frames),
             Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
@@ -341,23 +665,398 @@ error Database::LoadUpdateChannel(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("LoadUpdateChannel");
+    Metrics::Shared().SetGauge("db.wal_frames", log_frames);
+    Metrics::Shared().SetGauge("db.wal_frames_not_checkpointed",
+        log_frames - checkpointed_frames);
+    return last_error("checkpointWAL");
 }
 
-error Database::SaveUpdateChannel(
-        const std::string update_channel) {
-  poco_assert(session);
+error Database::vacuumFreePages() {
+    Poco::UInt64 page_count(0);
+    Poco::UInt64 free_pages(0);
+    int auto_vacuum(0);
+    try {
+        *session << "PRAGMA page_count",
+            Poco::Data::into(page_count),
+            Poco::Data::now;
+        *session << "PRAGMA freelist_count",
+            Poco::Data::into(free_pages),
+            Poco::Data::now;
+        *session << "PRAGMA auto_vacuum",
+            Poco::Data::into(auto_vacuum),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    error err = last_error("vacuumFreePages");
+    if (err != noError) {
+        return err;
+    }
 
-  if (update_channel != "stable" &&
-        update_channel != "beta" &&
-        update_channel != "dev") {
-    return error("Invalid update channel");
-  }
+    Metrics::Shared().SetGauge("db.pages", page_count);
+    Metrics::Shared().SetGauge("db.free_pages", free_pages);
 
-  Poco::Mutex::ScopedLock lock(mutex_);
+    if (!page_count || free_pages < page_count * kDatabaseVacuumFreePageRatio) {
+        return noError;
+    }
 
-  try {
-    *session << "update settings set "
+    KOPSIK_LOG_DEBUG(logger(), "Vacuuming " << free_pages << " free pages of "
+        << page_count << ", auto_vacuum=" << auto_vacuum);
+
+    try {
+        // 2 is incremental
+        if (2 == auto_vacuum) {
+            *session << "PRAGMA incremental_vacuum", Poco::Data::now;
+        } else {
+            // Databases made before auto_vacuum was set are switched
+            // over once, so later runs only need the incremental one
+            *session << "PRAGMA auto_vacuum = INCREMENTAL", Poco::Data::now;
+            *session << "VACUUM", Poco::Data::now;
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    Metrics::Shared().Count("db.vacuums");
+    return last_error("vacuumFreePages");
+}
+
+error Database::analyze() {
+    try {
+        *session << "ANALYZE", Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("analyze");
+}
+
+error Database::journalMode(std::string *mode) {
+    poco_assert(session);
+    poco_assert(mode);
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        *session << "PRAGMA journal_mode",
+            Poco::Data::into(*mode),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("journalMode");
+}
+
+error Database::setJournalMode(const std::string mode) {
+    poco_assert(session);
+    poco_assert(!mode.empty());
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        *session << "PRAGMA journal_mode=" << mode,
+          Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("setJournalMode");
+}
+
+// Called when a statement starts. Triggers report their statements
+// as "-- " comments, they're part of the statement that fired them.
+static void traceStatement(void *started, const char *sql) {
+    if (sql[0] == '-' && sql[1] == '-') {
+        return;
+    }
+    static_cast<Poco::Timestamp *>(started)->update();
+}
+
+// Called when a statement is done. SQLite's own time is only
+// to the millisecond, most statements would take 0, so the time
+// is measured from the start traceStatement saw.
+static void profileStatement(
+        void *started,
+        const char *sql,
+        sqlite3_uint64) {
+    Metrics::Shared().Time("sql." + MetricsStatement(sql),
+                           static_cast<Poco::Timestamp *>(started)->elapsed());
+}
+
+void Database::profileStatements(
+        Poco::Data::Session *session,
+        Poco::Timestamp *statement_started) {
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+    sqlite3_trace(sqlite->db(), traceStatement, statement_started);
+    sqlite3_profile(sqlite->db(), profileStatement, statement_started);
+}
+
+Poco::Logger &Database::logger() const {
+    return ComponentLogger(&log_database);
+}
+
+error Database::deleteFromTable(
+        const std::string table_name,
+        const Poco::Int64 local_id) {
+    poco_assert(session);
+    poco_assert(!table_name.empty());
+    poco_assert(local_id);
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    KOPSIK_LOG_FIELDS(logger(), PRIO_DEBUG, "Deleting",
+        LogFields().Add("table", table_name).Add("local_id", local_id));
+    try {
+        *session << "delete from " + table_name +
+            " where local_id = :local_id",
+            Poco::Data::use(local_id),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("deleteFromTable");
+}
+
+error Database::deleteFromTable(
+        const std::string table_name,
+        const std::vector<Poco::Int64> &local_ids) {
+    poco_assert(session);
+    poco_assert(!table_name.empty());
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    KOPSIK_LOG_DEBUG(logger(), "Deleting " << local_ids.size()
+        << " rows from table " << table_name);
+    try {
+        std::vector<Poco::Int64>::const_iterator it = local_ids.begin();
+        while (it != local_ids.end()) {
+            // IDs are numbers, so they're written into the statement
+            // instead of binding a parameter for each
+            std::stringstream sql;
+            sql << "delete from " << table_name << " where local_id in (";
+            std::size_t n(0);
+            for (; it != local_ids.end() && n < kDatabaseDeleteChunkSize;
+                    ++it) {
+                if (!*it) {
+                    continue;
+                }
+                if (n++) {
+                    sql << ",";
+                }
+                sql << *it;
+            }
+            if (!n) {
+                break;
+            }
+            sql << ")";
+            *session << sql.str(), Poco::Data::now;
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("deleteFromTable");
+}
+
+error Database::last_error(const std::string was_doing) {
+    poco_assert(session);
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    Poco::Data::SessionImpl* impl = session->impl();
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(impl);
+    std::string last = Poco::Data::SQLite::Utility::lastError(sqlite->db());
+    if (last != "not an error") {
+        return error(was_doing + ": " + last);
+    }
+    return noError;
+}
+
+Poco::Data::Session *Database::reader() {
+    if (read_session_) {
+        return read_session_;
+    }
+    return session;
+}
+
+InstrumentedMutex &Database::readerMutex() {
+    if (read_session_) {
+        return read_m_;
+    }
+    return mutex_;
+}
+
+error Database::reader_last_error(const std::string was_doing) {
+    if (!read_session_) {
+        return last_error(was_doing);
+    }
+
+    InstrumentedMutex::ScopedLock lock(read_m_, __FUNCTION__);
+
+    Poco::Data::SessionImpl* impl = read_session_->impl();
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(impl);
+    std::string last = Poco::Data::SQLite::Utility::lastError(sqlite->db());
+    if (last != "not an error") {
+        return error(was_doing + ": " + last);
+    }
+    return noError;
+}
+
+std::string Database::GenerateGUID() {
+    Poco::UUIDGenerator& generator = Poco::UUIDGenerator::defaultGenerator();
+    Poco::UUID uuid(generator.createRandom());
+    return uuid.toString();
+}
+
+error Database::LoadCurrentUser(
+        User *user,
+        const bool with_related_data) {
+    poco_assert(user);
+
+    std::string api_token("");
+    error err = CurrentAPIToken(&api_token);
+    if (err != noError) {
+        return err;
+    }
+    if (api_token.empty()) {
+        return noError;
+    }
+    return LoadUserByAPIToken(api_token, user, with_related_data);
+}
+
+error Database::LoadSettings(
+        bool *use_proxy,
+        Proxy *proxy,
+        bool *use_idle_detection) {
+    poco_assert(session);
+    poco_assert(use_proxy);
+    poco_assert(proxy);
+    poco_assert(use_idle_detection);
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+    try {
+        *reader() << "select use_proxy, proxy_host, proxy_port, "
+                "proxy_username, proxy_password, use_idle_detection "
+                "from settings",
+            Poco::Data::into(*use_proxy),
+            Poco::Data::into(proxy->host),
+            Poco::Data::into(proxy->port),
+            Poco::Data::into(proxy->username),
+            Poco::Data::into(proxy->password),
+            Poco::Data::into(*use_idle_detection),
+            Poco::Data::limit(1),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return reader_last_error("LoadSettings");
+}
+
+error Database::SaveSettings(
+        const bool use_proxy,
+        const Proxy *proxy,
+        const bool use_idle_detection) {
+    poco_assert(session);
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        *session << "update settings set "
+            "use_proxy = :use_proxy, "
+            "proxy_host = :proxy_host, "
+            "proxy_port = :proxy_port, "
+            "proxy_username = :proxy_username, "
+            "proxy_password = :proxy_password, "
+            "use_idle_detection = :use_idle_detection ",
+            Poco::Data::use(use_proxy),
+            Poco::Data::use(proxy->host),
+            Poco::Data::use(proxy->port),
+            Poco::Data::use(proxy->username),
+            Poco::Data::use(proxy->password),
+            Poco::Data::use(use_idle_detection),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    error err = last_error("SaveSettings");
+    if (err != noError) {
+        return err;
+    }
+    return bumpChangeGeneration("settings");
+}
+
+error Database::LoadUpdateChannel(
+        std::string *update_channel) {
+    poco_assert(session);
+    poco_assert(update_channel);
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        *session << "select update_channel from settings",
+            Poco::Data::into(*update_channel),
+            Poco::Data::limit(1),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("LoadUpdateChannel");
+}
+
+error Database::SaveUpdateChannel(
+        const std::string update_channel) {
+  poco_assert(session);
+
+  if (update_channel != "stable" &&
+        update_channel != "beta" &&
+        update_channel != "dev") {
+    return error("Invalid update channel");
+  }
+
+  InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+  try {
+    *session << "update settings set "
       "update_channel = :update_channel",
     Poco::Data::use(update_channel),
     Poco::Data::now;
@@ -368,34 +1067,1068 @@ error Database::SaveUpdateChannel(
   } catch(const std::string& ex) {
     return ex;
   }
-  return last_error("SaveUpdateChannel");
+  error err = last_error("SaveUpdateChannel");
+  if (err != noError) {
+    return err;
+  }
+  return bumpChangeGeneration("settings");
+}
+
+error Database::LoadUpdateCheck(
+        std::string *url,
+        std::string *etag,
+        std::string *last_modified,
+        std::string *response_body) {
+    poco_assert(session);
+    poco_assert(url);
+    poco_assert(etag);
+    poco_assert(last_modified);
+    poco_assert(response_body);
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        *session << "select update_check_url, update_check_etag, "
+                 "update_check_last_modified, update_check_body "
+                 "from settings",
+                 Poco::Data::into(*url),
+                 Poco::Data::into(*etag),
+                 Poco::Data::into(*last_modified),
+                 Poco::Data::into(*response_body),
+                 Poco::Data::limit(1),
+                 Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("LoadUpdateCheck");
+}
+
+error Database::SaveUpdateCheck(
+        const std::string url,
+        const std::string etag,
+        const std::string last_modified,
+        const std::string &response_body) {
+    poco_assert(session);
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        *session << "update settings set "
+                 "update_check_url = :update_check_url, "
+                 "update_check_etag = :update_check_etag, "
+                 "update_check_last_modified = :update_check_last_modified, "
+                 "update_check_body = :update_check_body",
+                 Poco::Data::use(url),
+                 Poco::Data::use(etag),
+                 Poco::Data::use(last_modified),
+                 Poco::Data::use(response_body),
+                 Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("SaveUpdateCheck");
+}
+
+error Database::LoadUserByAPIToken(
+        const std::string api_token,
+        User *model,
+        const bool with_related_data) {
+    poco_assert(session);
+    poco_assert(model);
+    poco_assert(!api_token.empty());
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    Poco::UInt64 uid(0);
+    model->SetAPIToken(api_token);
+    try {
+        *session << "select id from users where api_token = :api_token",
+            Poco::Data::into(uid),
+            Poco::Data::use(api_token),
+            Poco::Data::limit(1),
+            Poco::Data::now;
+        error err = last_error("LoadUserByAPIToken");
+        if (err != noError) {
+            return err;
+        }
+        if (uid <= 0) {
+            return noError;
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return LoadUserByID(uid, model, with_related_data);
+}
+
+error Database::loadUsersRelatedData(User *user) {
+    Poco::UInt64 loaded_since(0);
+    error err = LoadRelatedData(user->ID(), &user->related, &loaded_since);
+    if (err != noError) {
+        return err;
+    }
+    user->SetTimeEntriesLoadedSince(loaded_since);
+
+    user->related.TrackAll();
+
+    return noError;
+}
+
+error Database::LoadRelatedData(
+        const Poco::UInt64 UID,
+        RelatedData *related,
+        Poco::UInt64 *time_entries_loaded_since) {
+    poco_assert(UID > 0);
+    poco_assert(related);
+    poco_assert(time_entries_loaded_since);
+
+    if (!snapshot_path_.empty()) {
+        bool found(false);
+        error err = loadRelatedDataSnapshot(
+            UID, related, time_entries_loaded_since, &found);
+        if (err != noError) {
+            // SQLite has it all anyway
+            logger().warning(err);
+        } else if (found) {
+            return noError;
+        }
+    }
+
+    error err = loadWorkspaces(UID, &related->Workspaces);
+    if (err != noError) {
+        return err;
+    }
+    err = loadClients(UID, &related->Clients);
+    if (err != noError) {
+        return err;
+    }
+
+    err = loadProjects(UID, &related->Projects);
+    if (err != noError) {
+        return err;
+    }
+
+    err = loadTasks(UID, &related->Tasks);
+    if (err != noError) {
+        return err;
+    }
+
+    err = loadTags(UID, &related->Tags);
+    if (err != noError) {
+        return err;
+    }
+
+    Poco::UInt64 since(0);
+    if (time_entry_load_days_) {
+        since = time(0) - time_entry_load_days_ * 24 * 60 * 60;
+    }
+    err = loadTimeEntries(UID, since, &related->TimeEntries);
+    if (err != noError) {
+        return err;
+    }
+    bool has_older(false);
+    if (since) {
+        err = hasTimeEntriesStartedBefore(UID, since, &has_older);
+        if (err != noError) {
+            return err;
+        }
+    }
+    *time_entries_loaded_since = has_older ? since : 0;
+
+    return noError;
+}
+
+error Database::loadRelatedDataSnapshot(
+        const Poco::UInt64 UID,
+        RelatedData *related,
+        Poco::UInt64 *time_entries_loaded_since,
+        bool *found) {
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    RelatedDataSnapshotKey key;
+    key.database_id = desktop_id_;
+    key.uid = UID;
+    error err = SnapshotGeneration(&key.generation);
+    if (err != noError) {
+        return err;
+    }
+
+    err = RelatedDataSnapshot::Read(snapshot_path_, key,
+        related, time_entries_loaded_since, found);
+    if (err != noError) {
+        return err;
+    }
+
+    stopwatch.stop();
+    if (*found) {
+        Metrics::Shared().Count("db.snapshot.hits");
+        Metrics::Shared().Time("db.load.snapshot", stopwatch.elapsed());
+    } else {
+        Metrics::Shared().Count("db.snapshot.misses");
+    }
+    return noError;
+}
+
+error Database::SaveRelatedDataSnapshot(User *user) {
+    poco_assert(user);
+
+    if (snapshot_path_.empty()) {
+        return noError;
+    }
+
+    TraceSpan trace("Database::SaveRelatedDataSnapshot");
+
+    // No save may bump the generation while the snapshot is written
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    RelatedDataSnapshotKey key;
+    key.database_id = desktop_id_;
+    key.uid = user->ID();
+    error err = UInt("SELECT snapshot_generation FROM settings LIMIT 1",
+        &key.generation);
+    if (err != noError) {
+        return err;
+    }
+
+    err = RelatedDataSnapshot::Write(snapshot_path_, key,
+        user->TimeEntriesLoadedSince(), &user->related);
+    if (err != noError) {
+        return err;
+    }
+
+    stopwatch.stop();
+    Metrics::Shared().Time("db.save.snapshot", stopwatch.elapsed());
+    return noError;
+}
+
+error Database::SnapshotGeneration(Poco::UInt64 *generation) {
+    poco_assert(generation);
+
+    *generation = 0;
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+    try {
+        *reader() << "SELECT snapshot_generation FROM settings",
+            Poco::Data::into(*generation),
+            Poco::Data::limit(1),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return reader_last_error("SnapshotGeneration");
+}
+
+error Database::SaveAutocompleteIndex(
+        const Poco::UInt64 UID,
+        const AutocompleteIndex &index) {
+    if (autocomplete_index_path_.empty()) {
+        return noError;
+    }
+
+    // No save may bump the generation while the index is written
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    RelatedDataSnapshotKey key;
+    key.database_id = desktop_id_;
+    key.uid = UID;
+    error err = UInt("SELECT snapshot_generation FROM settings LIMIT 1",
+        &key.generation);
+    if (err != noError) {
+        return err;
+    }
+
+    err = AutocompleteIndexFile::Write(autocomplete_index_path_, key, index);
+    if (err != noError) {
+        return err;
+    }
+
+    stopwatch.stop();
+    Metrics::Shared().Time("db.save.autocomplete_index", stopwatch.elapsed());
+    return noError;
+}
+
+error Database::LoadAutocompleteIndex(
+        const Poco::UInt64 UID,
+        AutocompleteIndex *index,
+        Poco::UInt64 *generation,
+        bool *found) {
+    poco_assert(index);
+    poco_assert(generation);
+    poco_assert(found);
+
+    *found = false;
+    if (autocomplete_index_path_.empty()) {
+        return noError;
+    }
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    RelatedDataSnapshotKey key;
+    key.database_id = desktop_id_;
+    key.uid = UID;
+    error err = SnapshotGeneration(&key.generation);
+    if (err != noError) {
+        return err;
+    }
+    *generation = key.generation;
+
+    err = AutocompleteIndexFile::Read(autocomplete_index_path_, key,
+        index, found);
+    if (err != noError) {
+        return err;
+    }
+
+    stopwatch.stop();
+    if (*found) {
+        Metrics::Shared().Count("db.autocomplete_index.hits");
+        Metrics::Shared().Time("db.load.autocomplete_index",
+            stopwatch.elapsed());
+    } else {
+        Metrics::Shared().Count("db.autocomplete_index.misses");
+    }
+    return noError;
+}
+
+error Database::bumpSnapshotGeneration() {
+    try {
+        *session << "UPDATE settings "
+            "SET snapshot_generation = snapshot_generation + 1",
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("bumpSnapshotGeneration");
+}
+
+error Database::bumpChangeGenerations(const std::set<std::string> &tables) {
+    std::map<std::string, Poco::Int64> bumped;
+    for (std::set<std::string>::const_iterator it = tables.begin();
+            it != tables.end();
+            it++) {
+        Poco::Int64 generation(0);
+        try {
+            *session << "UPDATE change_generations "
+                "SET generation = generation + 1 WHERE name = :name",
+                Poco::Data::use(*it),
+                Poco::Data::now;
+            *session << "SELECT generation FROM change_generations "
+                "WHERE name = :name",
+                Poco::Data::into(generation),
+                Poco::Data::use(*it),
+                Poco::Data::limit(1),
+                Poco::Data::now;
+        } catch(const Poco::Exception& exc) {
+            return exc.displayText();
+        } catch(const std::exception& ex) {
+            return ex.what();
+        } catch(const std::string& ex) {
+            return ex;
+        }
+        error err = last_error("bumpChangeGenerations");
+        if (err != noError) {
+            return err;
+        }
+        bumped[*it] = generation;
+    }
+
+    // Only a bump right after the generation that was seen is ours
+    // alone. Past a gap, another process has saved meanwhile and
+    // ExternalChanges still has to report the table.
+    for (std::map<std::string, Poco::Int64>::const_iterator
+            it = bumped.begin();
+            it != bumped.end();
+            it++) {
+        Poco::Int64 &seen = seen_generations_[it->first];
+        if (seen + 1 == it->second) {
+            seen = it->second;
+        }
+    }
+    return noError;
+}
+
+error Database::bumpChangeGeneration(const std::string &table) {
+    std::set<std::string> tables;
+    tables.insert(table);
+    return bumpChangeGenerations(tables);
+}
+
+error Database::loadChangeGenerations(
+        std::map<std::string, Poco::Int64> *generations) {
+    poco_assert(generations);
+
+    std::vector<std::string> names;
+    std::vector<Poco::Int64> values;
+    {
+        InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+        try {
+            *reader() << "SELECT name, generation FROM change_generations",
+                Poco::Data::into(names),
+                Poco::Data::into(values),
+                Poco::Data::now;
+        } catch(const Poco::Exception& exc) {
+            return exc.displayText();
+        } catch(const std::exception& ex) {
+            return ex.what();
+        } catch(const std::string& ex) {
+            return ex;
+        }
+        error err = reader_last_error("loadChangeGenerations");
+        if (err != noError) {
+            return err;
+        }
+    }
+    for (std::size_t i = 0; i < names.size() && i < values.size(); i++) {
+        (*generations)[names[i]] = values[i];
+    }
+    return noError;
+}
+
+error Database::ExternalChanges(std::set<std::string> *tables) {
+    poco_assert(tables);
+
+    // Not while a save is between bumping and committing
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    std::map<std::string, Poco::Int64> generations;
+    error err = loadChangeGenerations(&generations);
+    if (err != noError) {
+        return err;
+    }
+    for (std::map<std::string, Poco::Int64>::const_iterator
+            it = generations.begin();
+            it != generations.end();
+            it++) {
+        Poco::Int64 &seen = seen_generations_[it->first];
+        if (seen != it->second) {
+            tables->insert(it->first);
+            seen = it->second;
+        }
+    }
+    if (tables->count("time_entries")) {
+        report_cache_.Clear();
+    }
+    return noError;
+}
+
+error Database::LoadTables(
+        const Poco::UInt64 UID,
+        const std::set<std::string> &tables,
+        const Poco::UInt64 time_entries_since,
+        RelatedData *related) {
+    poco_assert(UID > 0);
+    poco_assert(related);
+
+    error err = noError;
+    if (tables.count("workspaces")) {
+        err = loadWorkspaces(UID, &related->Workspaces);
+        if (err != noError) {
+            return err;
+        }
+    }
+    if (tables.count("clients")) {
+        err = loadClients(UID, &related->Clients);
+        if (err != noError) {
+            return err;
+        }
+    }
+    if (tables.count("projects")) {
+        err = loadProjects(UID, &related->Projects);
+        if (err != noError) {
+            return err;
+        }
+    }
+    if (tables.count("tasks")) {
+        err = loadTasks(UID, &related->Tasks);
+        if (err != noError) {
+            return err;
+        }
+    }
+    if (tables.count("tags")) {
+        err = loadTags(UID, &related->Tags);
+        if (err != noError) {
+            return err;
+        }
+    }
+    if (tables.count("time_entries")) {
+        err = loadTimeEntries(UID, time_entries_since, &related->TimeEntries);
+        if (err != noError) {
+            return err;
+        }
+    }
+    return noError;
+}
+
+error Database::LoadStartupTimeEntries(
+        User *user,
+        const Poco::UInt64 since) {
+    poco_assert(user);
+    poco_assert(since);
+
+    error err = loadTimeEntries(user->ID(), since, &user->related.TimeEntries);
+    if (err != noError) {
+        return err;
+    }
+    user->SetTimeEntriesLoadedSince(since);
+
+    user->related.TrackAll();
+
+    return noError;
+}
+
+error Database::LoadUserByID(
+        const Poco::UInt64 UID,
+        User *user,
+        const bool with_related_data) {
+    poco_assert(user);
+    poco_assert(session);
+    poco_assert(UID > 0);
+
+    TraceSpan trace("Database::LoadUserByID");
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    Poco::Stopwatch stopwatch;
+    stopwatch.start();
+
+    try {
+        Poco::Int64 local_id(0);
+        Poco::UInt64 id(0);
+        std::string api_token("");
+        Poco::UInt64 default_wid(0);
+        Poco::UInt64 since(0);
+        std::string fullname("");
+        std::string email("");
+        bool record_timeline(false);
+        bool store_start_and_stop_time(false);
+        *session <<
+            "select local_id, id, api_token, default_wid, since, fullname, "
+            "email, record_timeline, store_start_and_stop_time "
+            "from users where id = :id",
+            Poco::Data::into(local_id),
+            Poco::Data::into(id),
+            Poco::Data::into(api_token),
+            Poco::Data::into(default_wid),
+            Poco::Data::into(since),
+            Poco::Data::into(fullname),
+            Poco::Data::into(email),
+            Poco::Data::into(record_timeline),
+            Poco::Data::into(store_start_and_stop_time),
+            Poco::Data::use(UID),
+            Poco::Data::limit(1),
+            Poco::Data::now;
+
+        error err = last_error("LoadUserByID");
+        if (err != noError) {
+            return err;
+        }
+
+        if (!id) {
+            // No user data found
+            return noError;
+        }
+
+        user->SetLocalID(local_id);
+        user->SetID(id);
+        user->SetAPIToken(api_token);
+        user->SetDefaultWID(default_wid);
+        user->SetSince(since);
+        user->SetFullname(fullname);
+        user->SetEmail(email);
+        user->SetRecordTimeline(record_timeline);
+        user->SetStoreStartAndStopTime(store_start_and_stop_time);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    if (with_related_data) {
+        error err = loadUsersRelatedData(user);
+        if (err != noError) {
+            return err;
+        }
+    }
+
+    stopwatch.stop();
+    Metrics::Shared().Time("db.load.user", stopwatch.elapsed());
+    KOPSIK_LOG_DEBUG(logger(), "User with_related_data=" << with_related_data
+        << " loaded in " << stopwatch.elapsed() / 1000 << " ms");
+
+    return noError;
+}
+
+// Text of a column, empty for NULL
+static void columnText(
+        sqlite3_stmt *stmt,
+        const int column,
+        std::string *value) {
+    const unsigned char *text = sqlite3_column_text(stmt, column);
+    if (!text) {
+        value->clear();
+        return;
+    }
+    value->assign(reinterpret_cast<const char *>(text),
+                  sqlite3_column_bytes(stmt, column));
+}
+
+// Binds the stored fields of a model from the first parameter on.
+// Returns the parameter after them.
+template <class M>
+static int bindModelFields(
+        sqlite3_stmt *stmt,
+        const ModelSchema<M> &schema,
+        const M &model) {
+    int param = 1;
+    for (typename std::vector<ModelField<M> >::const_iterator it =
+            schema.Fields().begin();
+            it != schema.Fields().end();
+            it++) {
+        const ModelField<M> &field = *it;
+        if (!field.Is(kFieldStored)) {
+            continue;
+        }
+        if (field.Is(kFieldOptional) && field.Empty(model)) {
+            sqlite3_bind_null(stmt, param++);
+            continue;
+        }
+        switch (field.type) {
+        case kModelFieldUInt:
+            sqlite3_bind_int64(stmt, param++, (model.*field.get_uint)());
+            break;
+        case kModelFieldString: {
+            const std::string &value = (model.*field.get_string)();
+            sqlite3_bind_text(stmt, param++, value.data(),
+                static_cast<int>(value.size()), SQLITE_STATIC);
+            break;
+        }
+        case kModelFieldBool:
+            sqlite3_bind_int(stmt, param++, (model.*field.get_bool)());
+            break;
+        }
+    }
+    return param;
+}
+
+// Sets the stored fields of a model from a row of SelectSQL, where
+// they come after local_id. NULL is 0, empty or false.
+template <class M>
+static void readModelFields(
+        sqlite3_stmt *stmt,
+        const ModelSchema<M> &schema,
+        M *model) {
+    int column = 1;
+    std::string text("");
+    for (typename std::vector<ModelField<M> >::const_iterator it =
+            schema.Fields().begin();
+            it != schema.Fields().end();
+            it++) {
+        const ModelField<M> &field = *it;
+        if (!field.Is(kFieldStored)) {
+            continue;
+        }
+        switch (field.type) {
+        case kModelFieldUInt:
+            (model->*field.set_uint)(sqlite3_column_int64(stmt, column));
+            break;
+        case kModelFieldString:
+            columnText(stmt, column, &text);
+            (model->*field.set_string)(text);
+            break;
+        case kModelFieldBool:
+            (model->*field.set_bool)(sqlite3_column_int(stmt, column) != 0);
+            break;
+        }
+        column++;
+    }
+}
+
+template <class M>
+error Database::loadModels(
+        const Poco::UInt64 UID,
+        std::vector<M *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(list);
+
+    list->clear();
+
+    const ModelSchema<M> &schema = M::Schema();
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(reader()->impl());
+    sqlite3 *db = sqlite->db();
+
+    sqlite3_stmt *stmt(0);
+    int rc = sqlite3_prepare_v2(db, schema.SelectSQL().c_str(), -1,
+                                &stmt, 0);
+    if (rc != SQLITE_OK) {
+        return error("load " + schema.Table() + ": " + sqlite3_errmsg(db));
+    }
+    sqlite3_bind_int64(stmt, 1, UID);
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        M *model = new M();
+        model->SetLocalID(sqlite3_column_int64(stmt, 0));
+        readModelFields(stmt, schema, model);
+        model->ClearDirty();
+        list->push_back(model);
+    }
+    error err = noError;
+    if (rc != SQLITE_DONE) {
+        err = error("load " + schema.Table() + ": " + sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+    return err;
+}
+
+template <class M>
+error Database::saveModel(
+        M *model,
+        std::vector<ModelChange> *changes) {
+    poco_assert(model);
+    poco_assert(changes);
+    poco_assert(session);
+
+    const ModelSchema<M> &schema = M::Schema();
+    bool update = model->LocalID() != 0;
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    KOPSIK_LOG_TRACE(logger(), (update ? "Updating " : "Inserting ")
+        << model->ModelName() << " " << model->String()
+        << " in thread " << Poco::Thread::currentTid());
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+    sqlite3 *db = sqlite->db();
+
+    sqlite3_stmt *stmt(0);
+    const std::string &sql = update ? schema.UpdateSQL() : schema.InsertSQL();
+    int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+    if (rc != SQLITE_OK) {
+        return error("save " + schema.Table() + ": " + sqlite3_errmsg(db));
+    }
+    int param = bindModelFields(stmt, schema, *model);
+    if (update) {
+        sqlite3_bind_int64(stmt, param, model->LocalID());
+    }
+    rc = sqlite3_step(stmt);
+    error err = noError;
+    if (rc != SQLITE_DONE) {
+        err = error("save " + schema.Table() + ": " + sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+    if (err != noError) {
+        return err;
+    }
+
+    if (update) {
+        changes->push_back(ModelChange(model, ModelChange::Update));
+    } else {
+        model->SetLocalID(sqlite3_last_insert_rowid(db));
+        changes->push_back(ModelChange(model, ModelChange::Insert));
+    }
+    model->ClearDirty();
+    return noError;
+}
+
+error Database::loadWorkspaces(
+        const Poco::UInt64 UID,
+        std::vector<Workspace *> *list) {
+    return loadModels(UID, list);
+}
+
+error Database::loadClients(
+        const Poco::UInt64 UID,
+        std::vector<Client *> *list) {
+    return loadModels(UID, list);
+}
+
+error Database::loadProjects(
+        const Poco::UInt64 UID,
+        std::vector<Project *> *list) {
+    return loadModels(UID, list);
+}
+
+error Database::loadTasks(
+        const Poco::UInt64 UID,
+        std::vector<Task *> *list) {
+    return loadModels(UID, list);
+}
+
+error Database::loadTags(
+        const Poco::UInt64 UID,
+        std::vector<Tag *> *list) {
+    return loadModels(UID, list);
+}
+
+// Entries that started before the given time are only loaded
+// when they are running or need to be pushed.
+error Database::loadTimeEntries(
+        const Poco::UInt64 UID,
+        const Poco::UInt64 since,
+        std::vector<TimeEntry *> *list) {
+    poco_assert(UID > 0);
+    poco_assert(list);
+
+    list->clear();
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+    try {
+        Poco::Data::Statement select(*reader());
+        select << "SELECT local_id, id, uid, description, wid, guid, pid, "
+            "tid, billable, duronly, ui_modified_at, start, stop, "
+            "duration, tags, created_with, deleted_at, updated_at, "
+            "project_guid "
+            "FROM time_entries "
+            "WHERE uid = :uid "
+            "AND (start >= :since OR duration < 0 "
+            "OR id IS NULL OR id = 0 "
+            "OR ui_modified_at > 0 OR deleted_at > 0) "
+            "ORDER BY start DESC",
+            Poco::Data::use(UID),
+            Poco::Data::use(since);
+        error err = reader_last_error("loadTimeEntries");
+        if (err != noError) {
+            return err;
+        }
+        return loadTimeEntriesFromSQLStatement(&select, list);
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return reader_last_error("loadTimeEntries");
+}
+
+error Database::hasTimeEntriesStartedBefore(
+        const Poco::UInt64 UID,
+        const Poco::UInt64 before,
+        bool *result) {
+    poco_assert(UID > 0);
+    poco_assert(result);
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+    try {
+        Poco::Int64 older(0);
+        *reader() << "SELECT COUNT(*) FROM ("
+            "SELECT 1 FROM time_entries "
+            "WHERE uid = :uid AND start < :before LIMIT 1)",
+            Poco::Data::into(older),
+            Poco::Data::use(UID),
+            Poco::Data::use(before),
+            Poco::Data::now;
+        *result = older > 0;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return reader_last_error("hasTimeEntriesStartedBefore");
+}
+
+error Database::LoadTimeEntriesSince(
+        User *user,
+        const Poco::UInt64 since) {
+    poco_assert(user);
+
+    Poco::UInt64 before = user->TimeEntriesLoadedSince();
+    if (!before || since >= before) {
+        return noError;
+    }
+
+    std::vector<TimeEntry *> older;
+    {
+        InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+        try {
+            Poco::Data::Statement select(*reader());
+            select << "SELECT local_id, id, uid, description, wid, guid, pid, "
+                "tid, billable, duronly, ui_modified_at, start, stop, "
+                "duration, tags, created_with, deleted_at, updated_at, "
+                "project_guid "
+                "FROM time_entries "
+                "WHERE uid = :uid AND start >= :since AND start < :before "
+                "ORDER BY start DESC",
+                Poco::Data::use(user->ID()),
+                Poco::Data::use(since),
+                Poco::Data::use(before);
+            error err = reader_last_error("LoadTimeEntriesSince");
+            if (err != noError) {
+                return err;
+            }
+            err = loadTimeEntriesFromSQLStatement(&select, &older);
+            if (err != noError) {
+                return err;
+            }
+        } catch(const Poco::Exception& exc) {
+            return exc.displayText();
+        } catch(const std::exception& ex) {
+            return ex.what();
+        } catch(const std::string& ex) {
+            return ex;
+        }
+    }
+
+    // Running and unpushed entries were loaded with the user already
+    for (std::vector<TimeEntry *>::const_iterator it = older.begin();
+            it != older.end(); ++it) {
+        TimeEntry *te = *it;
+        if (user->related.TimeEntryIndex.ByGUID(te->GUID())) {
+            delete te;
+            continue;
+        }
+        user->related.TimeEntries.push_back(te);
+        user->related.Track(te);
+    }
+
+    bool has_older(false);
+    if (since) {
+        error err = hasTimeEntriesStartedBefore(user->ID(), since, &has_older);
+        if (err != noError) {
+            return err;
+        }
+    }
+    user->SetTimeEntriesLoadedSince(has_older ? since : 0);
+    return noError;
 }
 
-error Database::LoadUserByAPIToken(
-        const std::string api_token,
-        User *model,
-        const bool with_related_data) {
-    poco_assert(session);
-    poco_assert(model);
-    poco_assert(!api_token.empty());
+// Word prefixes are matched by range, so the primary key is used
+static std::string wordUpperBound(const std::string &word) {
+    std::string bound(word);
+    while (!bound.empty()
+            && static_cast<unsigned char>(bound[bound.size() - 1]) == 0xff) {
+        bound.erase(bound.size() - 1);
+    }
+    if (!bound.empty()) {
+        bound[bound.size() - 1] = static_cast<char>(
+            static_cast<unsigned char>(bound[bound.size() - 1]) + 1);
+    }
+    return bound;
+}
+
+static std::string likePattern(const std::string &word) {
+    std::string pattern("%");
+    for (std::string::const_iterator it = word.begin();
+            it != word.end(); ++it) {
+        if ('%' == *it || '_' == *it || '\\' == *it) {
+            pattern += '\\';
+        }
+        pattern += *it;
+    }
+    return pattern + "%";
+}
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+error Database::SearchTimeEntries(
+        const Poco::UInt64 UID,
+        const std::string &query,
+        const Poco::UInt64 offset,
+        const Poco::UInt64 limit,
+        std::vector<TimeEntry *> *results) {
+    poco_assert(results);
+
+    std::vector<std::string> words;
+    SplitWords(Poco::UTF8::toLower(query), &words);
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    if (words.empty() || !limit) {
+        return noError;
+    }
+
+    error err = indexUnindexedTimeEntries();
+    if (err != noError) {
+        return err;
+    }
+
+    // Bound by reference, so the values must not move while binding
+    std::vector<std::string> bounds;
+    std::vector<std::string> patterns;
+    for (std::vector<std::string>::const_iterator it = words.begin();
+            it != words.end(); ++it) {
+        bounds.push_back(wordUpperBound(*it));
+        patterns.push_back(likePattern(*it));
+    }
+
+    std::stringstream sql;
+    sql << "SELECT te.local_id, te.id, te.uid, te.description, te.wid, "
+        "te.guid, te.pid, te.tid, te.billable, te.duronly, "
+        "te.ui_modified_at, te.start, te.stop, te.duration, te.tags, "
+        "te.created_with, te.deleted_at, te.updated_at, te.project_guid "
+        "FROM time_entries te "
+        "LEFT JOIN projects p ON p.uid = te.uid AND (p.id = te.pid "
+        "OR ((te.pid IS NULL OR te.pid = 0) AND p.guid = te.project_guid)) "
+        "LEFT JOIN clients c ON c.uid = p.uid AND c.id = p.cid "
+        "WHERE te.uid = ? "
+        "AND (te.deleted_at IS NULL OR te.deleted_at = 0)";
+    for (std::size_t i = 0; i < words.size(); i++) {
+        sql << " AND (te.local_id IN (SELECT local_id FROM time_entry_words "
+            "WHERE word >= ? AND word < ?) "
+            "OR p.name LIKE ? ESCAPE '\\' OR c.name LIKE ? ESCAPE '\\')";
+    }
+    sql << " ORDER BY (";
+    for (std::size_t i = 0; i < words.size(); i++) {
+        if (i) {
+            sql << " + ";
+        }
+        sql << "(te.local_id IN (SELECT local_id FROM time_entry_words "
+            "WHERE word = ?))";
+    }
+    sql << ") DESC, te.start DESC LIMIT ? OFFSET ?";
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
 
-    Poco::UInt64 uid(0);
-    model->SetAPIToken(api_token);
     try {
-        *session << "select id from users where api_token = :api_token",
-            Poco::Data::into(uid),
-            Poco::Data::use(api_token),
-            Poco::Data::limit(1),
-            Poco::Data::now;
-        error err = last_error("LoadUserByAPIToken");
+        Poco::Data::Statement select(*reader());
+        select << sql.str(), Poco::Data::use(UID);
+        for (std::size_t i = 0; i < words.size(); i++) {
+            select, Poco::Data::use(words[i]),
+                Poco::Data::use(bounds[i]),
+                Poco::Data::use(patterns[i]),
+                Poco::Data::use(patterns[i]);
+        }
+        for (std::size_t i = 0; i < words.size(); i++) {
+            select, Poco::Data::use(words[i]);
+        }
+        select, Poco::Data::use(limit), Poco::Data::use(offset);
+        err = reader_last_error("SearchTimeEntries");
         if (err != noError) {
             return err;
         }
-        if (uid <= 0) {
-            return noError;
-        }
+        return loadTimeEntriesFromSQLStatement(&select, results);
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -403,96 +2136,178 @@ error Database::LoadUserByAPIToken(
     } catch(const std::string& ex) {
         return ex;
     }
-    return LoadUserByID(uid, model, with_related_data);
 }
 
-error Database::loadUsersRelatedData(User *user) {
-    error err = loadWorkspaces(user->ID(), &user->related.Workspaces);
-    if (err != noError) {
-        return err;
+// Start of a yyyymmdd day in local time
+static Poco::UInt64 localMidnight(const int day) {
+    Poco::LocalDateTime midnight(day / 10000, day / 100 % 100, day % 100);
+    return midnight.timestamp().epochTime();
+}
+
+error Database::LoadReport(
+        const Poco::UInt64 UID,
+        const int from_day,
+        const int to_day,
+        Report *report) {
+    poco_assert(report);
+
+    if (from_day > to_day) {
+        return noError;
     }
-    err = loadClients(user->ID(), &user->related.Clients);
-    if (err != noError) {
-        return err;
+
+    // Today's and later days are read every time, they're not over
+    int today = DayTotals::DayOf(time(0));
+    int generation = report_cache_.Generation();
+    std::vector<int> missing;
+    for (int day = from_day; day <= to_day; day = Report::NextDay(day)) {
+        DayReport cached;
+        if (day < today && report_cache_.Find(UID, day, &cached)) {
+            report->AddDay(day, cached);
+            continue;
+        }
+        missing.push_back(day);
     }
 
-    err = loadProjects(user->ID(), &user->related.Projects);
-    if (err != noError) {
-        return err;
+    if (!missing.empty()) {
+        std::map<int, DayReport> days;
+        error err = loadDayReports(UID, missing.front(), missing.back(),
+                                   &days);
+        if (err != noError) {
+            return err;
+        }
+        for (std::vector<int>::const_iterator it = missing.begin();
+                it != missing.end(); ++it) {
+            const DayReport &day_report = days[*it];
+            report->AddDay(*it, day_report);
+            if (*it < today) {
+                report_cache_.Put(UID, *it, day_report, generation);
+            }
+        }
     }
 
-    err = loadTasks(user->ID(), &user->related.Tasks);
+    return loadReportNames(UID, report);
+}
+
+error Database::loadDayReports(
+        const Poco::UInt64 UID,
+        const int from_day,
+        const int to_day,
+        std::map<int, DayReport> *days) {
+    poco_assert(days);
+
+    // A day around the range, so changes of the local time offset
+    // can't leave anything out. Days are told apart by DayOf.
+    Poco::UInt64 since = localMidnight(from_day) - 24 * 60 * 60;
+    Poco::UInt64 until = localMidnight(Report::NextDay(to_day)) + 24 * 60 * 60;
+
+    std::vector<Poco::UInt64> starts;
+    std::vector<Poco::Int64> durations;
+    std::vector<int> billables;
+    std::vector<Poco::UInt64> pids;
+    std::vector<std::string> project_guids;
+    std::vector<std::string> tags;
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+    try {
+        *reader() << "SELECT start, duration, ifnull(billable, 0), "
+            "ifnull(pid, 0), ifnull(project_guid, ''), ifnull(tags, '') "
+            "FROM time_entries "
+            "WHERE uid = :uid AND start >= :since AND start < :until "
+            "AND duration >= 0 "
+            "AND (deleted_at IS NULL OR deleted_at = 0)",
+            Poco::Data::into(starts),
+            Poco::Data::into(durations),
+            Poco::Data::into(billables),
+            Poco::Data::into(pids),
+            Poco::Data::into(project_guids),
+            Poco::Data::into(tags),
+            Poco::Data::use(UID),
+            Poco::Data::use(since),
+            Poco::Data::use(until),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    error err = reader_last_error("loadDayReports");
     if (err != noError) {
         return err;
     }
 
-    err = loadTags(user->ID(), &user->related.Tags);
+    std::vector<TimeEntry *> archived;
+    err = LoadArchivedTimeEntries(UID, since, until, &archived);
     if (err != noError) {
         return err;
     }
+    for (std::vector<TimeEntry *>::const_iterator it = archived.begin();
+            it != archived.end(); ++it) {
+        TimeEntry *te = *it;
+        starts.push_back(te->Start());
+        durations.push_back(te->DurationInSeconds());
+        billables.push_back(te->Billable() ? 1 : 0);
+        pids.push_back(te->PID());
+        project_guids.push_back(te->ProjectGUID());
+        tags.push_back(te->Tags());
+        delete te;
+    }
 
-    return loadTimeEntries(user->ID(), &user->related.TimeEntries);
+    for (std::size_t i = 0; i < starts.size(); i++) {
+        int day = DayTotals::DayOf(starts[i]);
+        if (day < from_day || day > to_day) {
+            continue;
+        }
+        (*days)[day].Add(pids[i], project_guids[i], tags[i],
+                         durations[i], billables[i] != 0);
+    }
+    return noError;
 }
 
-error Database::LoadUserByID(
+error Database::loadReportNames(
         const Poco::UInt64 UID,
-        User *user,
-        const bool with_related_data) {
-    poco_assert(user);
-    poco_assert(session);
-    poco_assert(UID > 0);
+        Report *report) {
+    poco_assert(report);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    if (report->Projects.empty()) {
+        return noError;
+    }
 
-    Poco::Stopwatch stopwatch;
-    stopwatch.start();
+    std::vector<Poco::UInt64> ids;
+    std::vector<std::string> guids;
+    std::vector<std::string> names;
+    std::vector<Poco::UInt64> cids;
+    std::vector<Poco::UInt64> client_ids;
+    std::vector<std::string> client_names;
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
 
     try {
-        Poco::Int64 local_id(0);
-        Poco::UInt64 id(0);
-        std::string api_token("");
-        Poco::UInt64 default_wid(0);
-        Poco::UInt64 since(0);
-        std::string fullname("");
-        std::string email("");
-        bool record_timeline(false);
-        bool store_start_and_stop_time(false);
-        *session <<
-            "select local_id, id, api_token, default_wid, since, fullname, "
-            "email, record_timeline, store_start_and_stop_time "
-            "from users where id = :id",
-            Poco::Data::into(local_id),
-            Poco::Data::into(id),
-            Poco::Data::into(api_token),
-            Poco::Data::into(default_wid),
-            Poco::Data::into(since),
-            Poco::Data::into(fullname),
-            Poco::Data::into(email),
-            Poco::Data::into(record_timeline),
-            Poco::Data::into(store_start_and_stop_time),
+        *reader() << "SELECT ifnull(id, 0), ifnull(guid, ''), "
+            "ifnull(name, ''), ifnull(cid, 0) "
+            "FROM projects WHERE uid = :uid",
+            Poco::Data::into(ids),
+            Poco::Data::into(guids),
+            Poco::Data::into(names),
+            Poco::Data::into(cids),
             Poco::Data::use(UID),
-            Poco::Data::limit(1),
             Poco::Data::now;
-
-        error err = last_error("LoadUserByID");
+        error err = reader_last_error("loadReportNames");
         if (err != noError) {
             return err;
         }
-
-        if (!id) {
-            // No user data found
-            return noError;
+        *reader() << "SELECT id, ifnull(name, '') "
+            "FROM clients WHERE uid = :uid AND id > 0",
+            Poco::Data::into(client_ids),
+            Poco::Data::into(client_names),
+            Poco::Data::use(UID),
+            Poco::Data::now;
+        err = reader_last_error("loadReportNames");
+        if (err != noError) {
+            return err;
         }
-
-        user->SetLocalID(local_id);
-        user->SetID(id);
-        user->SetAPIToken(api_token);
-        user->SetDefaultWID(default_wid);
-        user->SetSince(since);
-        user->SetFullname(fullname);
-        user->SetEmail(email);
-        user->SetRecordTimeline(record_timeline);
-        user->SetStoreStartAndStopTime(store_start_and_stop_time);
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -500,108 +2315,418 @@ error Database::LoadUserByID(
     } catch(const std::string& ex) {
         return ex;
     }
-    if (with_related_data) {
-        error err = loadUsersRelatedData(user);
+
+    std::map<ReportProjectKey, std::size_t> rows;
+    for (std::size_t i = 0; i < ids.size(); i++) {
+        rows.insert(std::make_pair(
+            ReportProjectKey(ids[i], ids[i] ? "" : guids[i]), i));
+    }
+
+    report->Clients.clear();
+    for (std::map<ReportProjectKey, ReportTotal>::const_iterator it =
+            report->Projects.begin();
+            it != report->Projects.end(); ++it) {
+        Poco::UInt64 cid(0);
+        std::map<ReportProjectKey, std::size_t>::const_iterator row =
+            rows.find(it->first);
+        if (row != rows.end()) {
+            report->ProjectNames[it->first] = names[row->second];
+            cid = cids[row->second];
+        }
+        report->Clients[cid].Add(it->second);
+    }
+
+    for (std::size_t i = 0; i < client_ids.size(); i++) {
+        if (report->Clients.count(client_ids[i])) {
+            report->ClientNames[client_ids[i]] = client_names[i];
+        }
+    }
+    return noError;
+}
+
+
+// Writes the archived entries from next on that started before the
+// given time, named as ExportTimeEntries's join would name them
+static error exportArchivedRows(
+        sqlite3 *db,
+        sqlite3_stmt *names,
+        const Poco::UInt64 UID,
+        const std::vector<TimeEntry *> &archived,
+        const Poco::UInt64 before,
+        std::size_t *next,
+        TimeEntryExport *out) {
+    TimeEntryExportRow row;
+    for (; *next < archived.size(); (*next)++) {
+        TimeEntry *te = archived[*next];
+        if (te->Start() >= before) {
+            break;
+        }
+        row.GUID = te->GUID();
+        row.Description = te->Description();
+        row.Tags = te->Tags();
+        row.Billable = te->Billable();
+        row.Start = te->Start();
+        row.Stop = te->Stop();
+        row.Duration = te->DurationInSeconds();
+        if (!row.Stop) {
+            row.Stop = row.Start + row.Duration;
+        }
+
+        sqlite3_reset(names);
+        sqlite3_bind_int64(names, 1, UID);
+        sqlite3_bind_int64(names, 2, te->PID());
+        sqlite3_bind_text(names, 3, te->ProjectGUID().data(),
+                          static_cast<int>(te->ProjectGUID().size()),
+                          SQLITE_STATIC);
+        sqlite3_bind_int64(names, 4, te->TID());
+        if (sqlite3_step(names) != SQLITE_ROW) {
+            return error(sqlite3_errmsg(db));
+        }
+        columnText(names, 0, &row.Project);
+        columnText(names, 1, &row.Task);
+        columnText(names, 2, &row.Client);
+
+        error err = out->Row(row);
         if (err != noError) {
             return err;
         }
     }
+    return noError;
+}
 
-    stopwatch.stop();
-    std::stringstream ss;
-    ss << "User with_related_data=" << with_related_data << " loaded in "
-        << stopwatch.elapsed() / 1000 << " ms";
-    logger().debug(ss.str());
+error Database::ExportTimeEntries(
+        const Poco::UInt64 UID,
+        const int from_day,
+        const int to_day,
+        TimeEntryExport *out) {
+    poco_assert(out);
 
-    return noError;
+    error err = out->Begin();
+    if (err != noError) {
+        return err;
+    }
+    if (from_day > to_day) {
+        return out->End();
+    }
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(reader()->impl());
+    sqlite3 *db = sqlite->db();
+
+    Poco::UInt64 since = localMidnight(from_day);
+    Poco::UInt64 until = localMidnight(Report::NextDay(to_day));
+
+    // Archived entries are merged in by start
+    std::vector<TimeEntry *> archived;
+    err = LoadArchivedTimeEntries(UID, since, until, &archived);
+    if (err != noError) {
+        return err;
+    }
+    std::size_t next_archived(0);
+
+    sqlite3_stmt *names(0);
+    sqlite3_stmt *stmt(0);
+    int rc = SQLITE_OK;
+    if (!archived.empty()) {
+        rc = sqlite3_prepare_v2(db,
+            "SELECT p.name, t.name, c.name FROM (SELECT 1) "
+            "LEFT JOIN projects p ON p.uid = ?1 AND (p.id = ?2 "
+            "OR (?2 = 0 AND p.guid = ?3)) "
+            "LEFT JOIN clients c ON c.uid = p.uid AND c.id = p.cid "
+            "LEFT JOIN tasks t ON t.uid = ?1 AND t.id = ?4",
+            -1, &names, 0);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(db,
+            "SELECT te.guid, te.description, p.name, t.name, c.name, "
+            "te.tags, te.billable, te.start, te.stop, te.duration "
+            "FROM time_entries te "
+            "LEFT JOIN projects p ON p.uid = te.uid AND (p.id = te.pid "
+            "OR ((te.pid IS NULL OR te.pid = 0) "
+            "AND p.guid = te.project_guid)) "
+            "LEFT JOIN clients c ON c.uid = p.uid AND c.id = p.cid "
+            "LEFT JOIN tasks t ON t.uid = te.uid AND t.id = te.tid "
+            "WHERE te.uid = ? AND te.start >= ? AND te.start < ? "
+            "AND te.duration >= 0 "
+            "AND (te.deleted_at IS NULL OR te.deleted_at = 0) "
+            "ORDER BY te.start",
+            -1, &stmt, 0);
+    }
+    if (rc != SQLITE_OK) {
+        err = error(sqlite3_errmsg(db));
+    } else {
+        sqlite3_bind_int64(stmt, 1, UID);
+        sqlite3_bind_int64(stmt, 2, since);
+        sqlite3_bind_int64(stmt, 3, until);
+
+        TimeEntryExportRow row;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            row.Start = sqlite3_column_int64(stmt, 7);
+            err = exportArchivedRows(db, names, UID, archived, row.Start,
+                                     &next_archived, out);
+            if (err != noError) {
+                break;
+            }
+            columnText(stmt, 0, &row.GUID);
+            columnText(stmt, 1, &row.Description);
+            columnText(stmt, 2, &row.Project);
+            columnText(stmt, 3, &row.Task);
+            columnText(stmt, 4, &row.Client);
+            columnText(stmt, 5, &row.Tags);
+            row.Billable = sqlite3_column_int(stmt, 6) != 0;
+            row.Stop = sqlite3_column_int64(stmt, 8);
+            row.Duration = sqlite3_column_int64(stmt, 9);
+            if (!row.Stop) {
+                row.Stop = row.Start + row.Duration;
+            }
+            err = out->Row(row);
+            if (err != noError) {
+                break;
+            }
+        }
+        if (err == noError && rc != SQLITE_DONE) {
+            err = error(sqlite3_errmsg(db));
+        }
+        if (err == noError) {
+            err = exportArchivedRows(db, names, UID, archived, until,
+                                     &next_archived, out);
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_finalize(names);
+    for (std::vector<TimeEntry *>::const_iterator it = archived.begin();
+            it != archived.end(); ++it) {
+        delete *it;
+    }
+    if (err != noError) {
+        return err;
+    }
+
+    KOPSIK_LOG_DEBUG(logger(), "Exported " << out->Rows() << " time entries");
+
+    return out->End();
 }
 
-error Database::loadWorkspaces(
+error Database::ArchiveTimeEntries(
         const Poco::UInt64 UID,
-        std::vector<Workspace *> *list) {
+        const Poco::UInt64 before,
+        const std::set<std::string> &keep,
+        Poco::UInt64 *archived) {
+    poco_assert(session);
     poco_assert(UID > 0);
-    poco_assert(list);
+    poco_assert(archived);
 
-    list->clear();
+    *archived = 0;
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
+    std::vector<TimeEntry *> closed;
+    error err = noError;
     try {
         Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, premium "
-            "FROM workspaces "
-            "WHERE uid = :uid "
-            "ORDER BY name",
-            Poco::Data::use(UID);
-        error err = last_error("loadWorkspaces");
-        if (err != noError) {
-            return err;
-        }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Workspace *model = new Workspace();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetPremium(rs[4].convert<bool>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
+        select << "SELECT local_id, id, uid, description, wid, guid, pid, "
+            "tid, billable, duronly, ui_modified_at, start, stop, "
+            "duration, tags, created_with, deleted_at, updated_at, "
+            "project_guid "
+            "FROM time_entries "
+            "WHERE uid = :uid AND start < :before AND duration >= 0 "
+            "AND id > 0 AND ifnull(ui_modified_at, 0) = 0 "
+            "AND ifnull(deleted_at, 0) = 0",
+            Poco::Data::use(UID),
+            Poco::Data::use(before);
+        err = last_error("ArchiveTimeEntries");
+        if (err == noError) {
+            err = loadTimeEntriesFromSQLStatement(&select, &closed);
         }
     } catch(const Poco::Exception& exc) {
-        return exc.displayText();
+        err = exc.displayText();
     } catch(const std::exception& ex) {
-        return ex.what();
+        err = ex.what();
     } catch(const std::string& ex) {
-        return ex;
+        err = ex;
+    }
+
+    std::map<int, std::vector<TimeEntry *> > months;
+    std::vector<Poco::Int64> local_ids;
+    for (std::vector<TimeEntry *>::const_iterator it = closed.begin();
+            it != closed.end(); ++it) {
+        TimeEntry *te = *it;
+        if (te->GUID().empty() || keep.count(te->GUID())) {
+            continue;
+        }
+        months[TimeEntryArchive::MonthOf(te->Start())].push_back(te);
+        local_ids.push_back(te->LocalID());
+    }
+
+    if (err == noError && !local_ids.empty()) {
+        session->begin();
+        for (std::map<int, std::vector<TimeEntry *> >::const_iterator it =
+                months.begin();
+                err == noError && it != months.end(); ++it) {
+            err = archiveMonth(UID, it->first, it->second);
+        }
+        if (err == noError) {
+            err = deleteFromTable("time_entries", local_ids);
+        }
+        if (err == noError) {
+            err = bumpChangeGeneration("time_entries");
+        }
+        if (err == noError) {
+            session->commit();
+            *archived = local_ids.size();
+        } else {
+            session->rollback();
+        }
+    }
+
+    for (std::vector<TimeEntry *>::const_iterator it = closed.begin();
+            it != closed.end(); ++it) {
+        delete *it;
+    }
+
+    if (*archived) {
+        KOPSIK_LOG_DEBUG(logger(), "Archived " << *archived
+            << " time entries in " << months.size() << " months");
+        Metrics::Shared().Count("db.time_entries_archived", *archived);
+    }
+    return err;
+}
+
+error Database::archiveMonth(
+        const Poco::UInt64 UID,
+        const int month,
+        const std::vector<TimeEntry *> &entries) {
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+    sqlite3 *db = sqlite->db();
+
+    std::vector<TimeEntry *> archived;
+    sqlite3_stmt *stmt(0);
+    int rc = sqlite3_prepare_v2(db,
+        "SELECT data FROM time_entries_archive WHERE uid = ? AND month = ?",
+        -1, &stmt, 0);
+    if (rc != SQLITE_OK) {
+        return error(sqlite3_errmsg(db));
+    }
+    sqlite3_bind_int64(stmt, 1, UID);
+    sqlite3_bind_int(stmt, 2, month);
+    error err = noError;
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        std::string blob(
+            static_cast<const char *>(sqlite3_column_blob(stmt, 0)),
+            sqlite3_column_bytes(stmt, 0));
+        err = TimeEntryArchive::Unpack(blob, UID, &archived);
+    } else if (rc != SQLITE_DONE) {
+        err = error(sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+    if (err != noError) {
+        return err;
+    }
+
+    // An entry that came back from the server and was closed again
+    // replaces its archived copy
+    std::set<std::string> guids;
+    for (std::vector<TimeEntry *>::const_iterator it = entries.begin();
+            it != entries.end(); ++it) {
+        guids.insert((*it)->GUID());
+    }
+    std::vector<TimeEntry *> merged(entries);
+    for (std::vector<TimeEntry *>::const_iterator it = archived.begin();
+            it != archived.end(); ++it) {
+        if (!guids.count((*it)->GUID())) {
+            merged.push_back(*it);
+        }
+    }
+
+    std::string blob("");
+    err = TimeEntryArchive::Pack(&merged, &blob);
+    if (err == noError) {
+        rc = sqlite3_prepare_v2(db,
+            "INSERT OR REPLACE INTO time_entries_archive"
+            "(uid, month, since, until, entries, data) "
+            "VALUES(?, ?, ?, ?, ?, ?)",
+            -1, &stmt, 0);
+        if (rc != SQLITE_OK) {
+            err = error(sqlite3_errmsg(db));
+        }
+    }
+    if (err == noError) {
+        sqlite3_bind_int64(stmt, 1, UID);
+        sqlite3_bind_int(stmt, 2, month);
+        sqlite3_bind_int64(stmt, 3, merged.front()->Start());
+        sqlite3_bind_int64(stmt, 4, merged.back()->Start() + 1);
+        sqlite3_bind_int64(stmt, 5, merged.size());
+        sqlite3_bind_blob(stmt, 6, blob.data(),
+                          static_cast<int>(blob.size()), SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            err = error(sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    for (std::vector<TimeEntry *>::const_iterator it = archived.begin();
+            it != archived.end(); ++it) {
+        delete *it;
     }
-    return last_error("loadWorkspaces");
+    return err;
 }
 
-error Database::loadClients(
+error Database::SaveTimeEntryFetch(
         const Poco::UInt64 UID,
-        std::vector<Client *> *list) {
+        const Poco::UInt64 since,
+        const Poco::UInt64 until) {
+    poco_assert(session);
     poco_assert(UID > 0);
-    poco_assert(list);
 
-    list->clear();
+    if (since >= until) {
+        return noError;
+    }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, guid, wid "
-            "FROM clients "
-            "WHERE uid = :uid "
-            "ORDER BY name",
-            Poco::Data::use(UID);
-
-        error err = last_error("loadClients");
+        // Takes in the fetches it overlaps or touches
+        std::vector<Poco::UInt64> sinces;
+        std::vector<Poco::UInt64> untils;
+        *session << "SELECT since, until FROM time_entry_fetches "
+            "WHERE uid = :uid AND since <= :until AND until >= :since",
+            Poco::Data::into(sinces),
+            Poco::Data::into(untils),
+            Poco::Data::use(UID),
+            Poco::Data::use(until),
+            Poco::Data::use(since),
+            Poco::Data::now;
+        error err = last_error("SaveTimeEntryFetch");
         if (err != noError) {
             return err;
         }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Client *model = new Client();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetGUID(rs[4].convert<std::string>());
-                model->SetWID(rs[5].convert<Poco::UInt64>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
+        Poco::UInt64 merged_since(since);
+        Poco::UInt64 merged_until(until);
+        for (std::size_t i = 0; i < sinces.size(); i++) {
+            merged_since = std::min(merged_since, sinces[i]);
+            merged_until = std::max(merged_until, untils[i]);
         }
+
+        *session << "DELETE FROM time_entry_fetches "
+            "WHERE uid = :uid AND since <= :until AND until >= :since",
+            Poco::Data::use(UID),
+            Poco::Data::use(until),
+            Poco::Data::use(since),
+            Poco::Data::now;
+        err = last_error("SaveTimeEntryFetch");
+        if (err != noError) {
+            return err;
+        }
+        *session << "INSERT INTO time_entry_fetches(uid, since, until) "
+            "VALUES(:uid, :since, :until)",
+            Poco::Data::use(UID),
+            Poco::Data::use(merged_since),
+            Poco::Data::use(merged_until),
+            Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -609,51 +2734,86 @@ error Database::loadClients(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("loadClients");
+    return last_error("SaveTimeEntryFetch");
 }
 
-error Database::loadProjects(
+error Database::UnfetchedTimeEntryRanges(
         const Poco::UInt64 UID,
-        std::vector<Project *> *list) {
-    poco_assert(UID > 0);
-    poco_assert(list);
+        const Poco::UInt64 since,
+        const Poco::UInt64 until,
+        std::vector<TimeEntryRange> *ranges) {
+    poco_assert(session);
+    poco_assert(ranges);
 
-    list->clear();
+    ranges->clear();
+    if (since >= until) {
+        return noError;
+    }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    std::vector<Poco::UInt64> sinces;
+    std::vector<Poco::UInt64> untils;
+    {
+        InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
-    try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, guid, wid, color, cid, "
-            "active "
-            "FROM projects "
-            "WHERE uid = :uid "
-            "ORDER BY name",
-            Poco::Data::use(UID);
-        error err = last_error("loadProjects");
+        try {
+            *session << "SELECT since, until FROM time_entry_fetches "
+                "WHERE uid = :uid AND until > :since AND since < :until "
+                "ORDER BY since",
+                Poco::Data::into(sinces),
+                Poco::Data::into(untils),
+                Poco::Data::use(UID),
+                Poco::Data::use(since),
+                Poco::Data::use(until),
+                Poco::Data::now;
+        } catch(const Poco::Exception& exc) {
+            return exc.displayText();
+        } catch(const std::exception& ex) {
+            return ex.what();
+        } catch(const std::string& ex) {
+            return ex;
+        }
+        error err = last_error("UnfetchedTimeEntryRanges");
         if (err != noError) {
             return err;
         }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Project *model = new Project();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetGUID(rs[4].convert<std::string>());
-                model->SetWID(rs[5].convert<Poco::UInt64>());
-                model->SetColor(rs[6].convert<std::string>());
-                model->SetCID(rs[7].convert<Poco::UInt64>());
-                model->SetActive(rs[8].convert<bool>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
+    }
+
+    // Fetches don't overlap, so the gaps are between them
+    Poco::UInt64 from(since);
+    for (std::size_t i = 0; i < sinces.size(); i++) {
+        if (sinces[i] > from) {
+            TimeEntryRange range;
+            range.since = from;
+            range.until = sinces[i];
+            ranges->push_back(range);
         }
+        from = std::max(from, untils[i]);
+    }
+    if (from < until) {
+        TimeEntryRange range;
+        range.since = from;
+        range.until = until;
+        ranges->push_back(range);
+    }
+    return noError;
+}
+
+error Database::OldestTimeEntryFetch(
+        const Poco::UInt64 UID,
+        Poco::UInt64 *since) {
+    poco_assert(session);
+    poco_assert(since);
+
+    *since = 0;
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        *session << "SELECT ifnull(min(since), 0) FROM time_entry_fetches "
+            "WHERE uid = :uid",
+            Poco::Data::into(*since),
+            Poco::Data::use(UID),
+            Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -661,47 +2821,69 @@ error Database::loadProjects(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("loadProjects");
+    return last_error("OldestTimeEntryFetch");
 }
 
-error Database::loadTasks(
+error Database::SaveSyncCheckpoint(
         const Poco::UInt64 UID,
-        std::vector<Task *> *list) {
+        const SyncCheckpoint &checkpoint) {
+    poco_assert(session);
     poco_assert(UID > 0);
-    poco_assert(list);
 
-    list->clear();
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    session->begin();
+    error err = DeleteSyncCheckpoint(UID);
+    if (err == noError) {
+        try {
+            *session << "INSERT INTO sync_checkpoints(uid, started, since, "
+                "time_entries_since, time_entries_until) "
+                "VALUES(:uid, :started, :since, "
+                ":time_entries_since, :time_entries_until)",
+                Poco::Data::use(UID),
+                Poco::Data::use(checkpoint.started),
+                Poco::Data::use(checkpoint.since),
+                Poco::Data::use(checkpoint.time_entries_since),
+                Poco::Data::use(checkpoint.time_entries_until),
+                Poco::Data::now;
+            err = last_error("SaveSyncCheckpoint");
+        } catch(const Poco::Exception& exc) {
+            err = exc.displayText();
+        } catch(const std::exception& ex) {
+            err = ex.what();
+        } catch(const std::string& ex) {
+            err = ex;
+        }
+    }
+    for (std::vector<SyncCheckpointPiece>::const_iterator it =
+            checkpoint.pieces.begin();
+            err == noError && it != checkpoint.pieces.end(); ++it) {
+        err = SaveSyncCheckpointPiece(UID, *it);
+    }
+    if (err == noError) {
+        session->commit();
+    } else {
+        session->rollback();
+    }
+    return err;
+}
+
+error Database::SaveSyncCheckpointPiece(
+        const Poco::UInt64 UID,
+        const SyncCheckpointPiece &piece) {
+    poco_assert(session);
+    poco_assert(UID > 0);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, wid, pid "
-            "FROM tasks "
-            "WHERE uid = :uid "
-            "ORDER BY name",
-            Poco::Data::use(UID);
-        error err = last_error("loadTasks");
-        if (err != noError) {
-            return err;
-        }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Task *model = new Task();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetWID(rs[4].convert<Poco::UInt64>());
-                model->SetPID(rs[5].convert<Poco::UInt64>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
-        }
+        *session << "INSERT INTO sync_checkpoint_pieces"
+            "(uid, wid, since, until) VALUES(:uid, :wid, :since, :until)",
+            Poco::Data::use(UID),
+            Poco::Data::use(piece.wid),
+            Poco::Data::use(piece.since),
+            Poco::Data::use(piece.until),
+            Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -709,46 +2891,64 @@ error Database::loadTasks(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("loadTasks");
+    return last_error("SaveSyncCheckpointPiece");
 }
 
-error Database::loadTags(
+error Database::LoadSyncCheckpoint(
         const Poco::UInt64 UID,
-        std::vector<Tag *> *list) {
-    poco_assert(UID > 0);
-    poco_assert(list);
+        SyncCheckpoint *checkpoint,
+        bool *found) {
+    poco_assert(session);
+    poco_assert(checkpoint);
+    poco_assert(found);
 
-    list->clear();
+    *found = false;
+    checkpoint->pieces.clear();
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, name, wid, guid "
-            "FROM tags "
-            "WHERE uid = :uid "
-            "ORDER BY name",
-            Poco::Data::use(UID);
-        error err = last_error("loadTags");
+        std::vector<Poco::UInt64> starteds;
+        std::vector<Poco::UInt64> sinces;
+        std::vector<Poco::UInt64> untils;
+        std::vector<Poco::UInt64> time_entries_sinces;
+        std::vector<Poco::UInt64> time_entries_untils;
+        *session << "SELECT started, since, time_entries_since, "
+            "time_entries_until FROM sync_checkpoints WHERE uid = :uid",
+            Poco::Data::into(starteds),
+            Poco::Data::into(sinces),
+            Poco::Data::into(time_entries_sinces),
+            Poco::Data::into(time_entries_untils),
+            Poco::Data::use(UID),
+            Poco::Data::now;
+        error err = last_error("LoadSyncCheckpoint");
+        if (err != noError || starteds.empty()) {
+            return err;
+        }
+        checkpoint->started = starteds[0];
+        checkpoint->since = sinces[0];
+        checkpoint->time_entries_since = time_entries_sinces[0];
+        checkpoint->time_entries_until = time_entries_untils[0];
+
+        std::vector<Poco::UInt64> wids;
+        sinces.clear();
+        *session << "SELECT wid, since, until FROM sync_checkpoint_pieces "
+            "WHERE uid = :uid",
+            Poco::Data::into(wids),
+            Poco::Data::into(sinces),
+            Poco::Data::into(untils),
+            Poco::Data::use(UID),
+            Poco::Data::now;
+        err = last_error("LoadSyncCheckpoint");
         if (err != noError) {
             return err;
         }
-        Poco::Data::RecordSet rs(select);
-        while (!select.done()) {
-            select.execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                Tag *model = new Tag();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetName(rs[3].convert<std::string>());
-                model->SetWID(rs[4].convert<Poco::UInt64>());
-                model->SetGUID(rs[5].convert<std::string>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
-            }
+        for (std::size_t i = 0; i < wids.size(); i++) {
+            SyncCheckpointPiece piece;
+            piece.wid = wids[i];
+            piece.since = sinces[i];
+            piece.until = untils[i];
+            checkpoint->pieces.push_back(piece);
         }
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
@@ -757,42 +2957,165 @@ error Database::loadTags(
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("loadTags");
+    *found = true;
+    return noError;
 }
 
-error Database::loadTimeEntries(
+error Database::DeleteSyncCheckpoint(const Poco::UInt64 UID) {
+    error err = deleteAllFromTableByUID("sync_checkpoints", UID);
+    if (err != noError) {
+        return err;
+    }
+    return deleteAllFromTableByUID("sync_checkpoint_pieces", UID);
+}
+
+error Database::LoadArchivedTimeEntries(
         const Poco::UInt64 UID,
+        const Poco::UInt64 since,
+        const Poco::UInt64 until,
         std::vector<TimeEntry *> *list) {
-    poco_assert(UID > 0);
     poco_assert(list);
 
-    list->clear();
+    if (since >= until) {
+        return noError;
+    }
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(reader()->impl());
+    sqlite3 *db = sqlite->db();
+
+    std::vector<TimeEntry *> found;
+    sqlite3_stmt *stmt(0);
+    int rc = sqlite3_prepare_v2(db,
+        "SELECT data FROM time_entries_archive "
+        "WHERE uid = ? AND until > ? AND since < ? ORDER BY month",
+        -1, &stmt, 0);
+    if (rc != SQLITE_OK) {
+        return error(sqlite3_errmsg(db));
+    }
+    sqlite3_bind_int64(stmt, 1, UID);
+    sqlite3_bind_int64(stmt, 2, since);
+    sqlite3_bind_int64(stmt, 3, until);
+    error err = noError;
+    while (err == noError && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        std::string blob(
+            static_cast<const char *>(sqlite3_column_blob(stmt, 0)),
+            sqlite3_column_bytes(stmt, 0));
+        std::vector<TimeEntry *> month;
+        err = TimeEntryArchive::Unpack(blob, UID, &month);
+        for (std::vector<TimeEntry *>::const_iterator it = month.begin();
+                it != month.end(); ++it) {
+            if ((*it)->Start() >= since && (*it)->Start() < until) {
+                found.push_back(*it);
+            } else {
+                delete *it;
+            }
+        }
+    }
+    if (err == noError && rc != SQLITE_DONE) {
+        err = error(sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+
+    // Entries the server changed after they were archived are back
+    // in time_entries, that copy is the one that counts
+    std::set<std::string> hot;
+    for (std::size_t from = 0;
+            err == noError && from < found.size();
+            from += kDatabaseDeleteChunkSize) {
+        std::size_t to = std::min(found.size(),
+                                  from + kDatabaseDeleteChunkSize);
+        std::stringstream sql;
+        sql << "SELECT guid FROM time_entries WHERE uid = ? AND guid IN (";
+        for (std::size_t i = from; i < to; i++) {
+            sql << (i > from ? ", ?" : "?");
+        }
+        sql << ")";
+        rc = sqlite3_prepare_v2(db, sql.str().c_str(), -1, &stmt, 0);
+        if (rc != SQLITE_OK) {
+            err = error(sqlite3_errmsg(db));
+            break;
+        }
+        sqlite3_bind_int64(stmt, 1, UID);
+        for (std::size_t i = from; i < to; i++) {
+            const std::string &guid = found[i]->GUID();
+            sqlite3_bind_text(stmt, static_cast<int>(i - from + 2),
+                              guid.data(), static_cast<int>(guid.size()),
+                              SQLITE_STATIC);
+        }
+        std::string guid("");
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            columnText(stmt, 0, &guid);
+            hot.insert(guid);
+        }
+        if (rc != SQLITE_DONE) {
+            err = error(sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    for (std::vector<TimeEntry *>::const_iterator it = found.begin();
+            it != found.end(); ++it) {
+        if (err != noError || hot.count((*it)->GUID())) {
+            delete *it;
+            continue;
+        }
+        list->push_back(*it);
+    }
+    return err;
+}
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+error Database::indexUnindexedTimeEntries() {
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
+    if (time_entry_words_complete_) {
+        return noError;
+    }
+
+    session->begin();
     try {
-        Poco::Data::Statement select(*session);
-        select << "SELECT local_id, id, uid, description, wid, guid, pid, "
-            "tid, billable, duronly, ui_modified_at, start, stop, "
-            "duration, tags, created_with, deleted_at, updated_at, "
-            "project_guid "
-            "FROM time_entries "
-            "WHERE uid = :uid "
-            "ORDER BY start DESC",
-            Poco::Data::use(UID);
-        error err = last_error("loadTimeEntries");
-        if (err != noError) {
-            return err;
+        bool indexed(false);
+        *session << "SELECT time_entry_words_indexed FROM settings LIMIT 1",
+            Poco::Data::into(indexed),
+            Poco::Data::now;
+        if (!indexed) {
+            std::vector<Poco::Int64> local_ids;
+            std::vector<std::string> descriptions;
+            *session << "SELECT local_id, description FROM time_entries "
+                "WHERE description <> '' AND local_id NOT IN "
+                "(SELECT local_id FROM time_entry_words)",
+                Poco::Data::into(local_ids),
+                Poco::Data::into(descriptions),
+                Poco::Data::now;
+
+            prepareTimeEntryStatements();
+            for (std::size_t i = 0; i < local_ids.size(); i++) {
+                time_entry_row_.local_id = local_ids[i];
+                time_entry_row_.description = descriptions[i];
+                indexTimeEntryWords(false);
+            }
+
+            *session << "UPDATE settings SET time_entry_words_indexed = 1",
+                Poco::Data::now;
+
+            KOPSIK_LOG_DEBUG(logger(), "Indexed words of "
+                << local_ids.size() << " time entries");
         }
-        return loadTimeEntriesFromSQLStatement(&select, list);
+        session->commit();
     } catch(const Poco::Exception& exc) {
+        session->rollback();
         return exc.displayText();
     } catch(const std::exception& ex) {
+        session->rollback();
         return ex.what();
     } catch(const std::string& ex) {
+        session->rollback();
         return ex;
     }
-    return last_error("loadTimeEntries");
+    time_entry_words_complete_ = true;
+    return noError;
 }
 
 error Database::loadTimeEntriesFromSQLStatement(
@@ -801,35 +3124,72 @@ error Database::loadTimeEntriesFromSQLStatement(
     poco_assert(select);
     poco_assert(list);
     try {
-        Poco::Data::RecordSet rs(*select);
+        Poco::Int64 local_id(0);
+        Poco::UInt64 id(0);
+        Poco::UInt64 uid(0);
+        std::string description("");
+        Poco::UInt64 wid(0);
+        std::string guid("");
+        Poco::UInt64 pid(0);
+        Poco::UInt64 tid(0);
+        bool billable(false);
+        bool duronly(false);
+        Poco::UInt64 ui_modified_at(0);
+        Poco::UInt64 start(0);
+        Poco::UInt64 stop(0);
+        Poco::Int64 duration(0);
+        std::string tags("");
+        std::string created_with("");
+        Poco::UInt64 deleted_at(0);
+        Poco::UInt64 updated_at(0);
+        std::string project_guid("");
+        *select,
+            Poco::Data::into(local_id),
+            Poco::Data::into(id),
+            Poco::Data::into(uid),
+            Poco::Data::into(description),
+            Poco::Data::into(wid),
+            Poco::Data::into(guid),
+            Poco::Data::into(pid),
+            Poco::Data::into(tid),
+            Poco::Data::into(billable),
+            Poco::Data::into(duronly),
+            Poco::Data::into(ui_modified_at),
+            Poco::Data::into(start),
+            Poco::Data::into(stop),
+            Poco::Data::into(duration),
+            Poco::Data::into(tags),
+            Poco::Data::into(created_with),
+            Poco::Data::into(deleted_at),
+            Poco::Data::into(updated_at),
+            Poco::Data::into(project_guid),
+            Poco::Data::limit(1);
         while (!select->done()) {
-            select->execute();
-            bool more = rs.moveFirst();
-            while (more) {
-                TimeEntry *model = new TimeEntry();
-                model->SetLocalID(rs[0].convert<Poco::Int64>());
-                model->SetID(rs[1].convert<Poco::UInt64>());
-                model->SetUID(rs[2].convert<Poco::UInt64>());
-                model->SetDescription(rs[3].convert<std::string>());
-                model->SetWID(rs[4].convert<Poco::UInt64>());
-                model->SetGUID(rs[5].convert<std::string>());
-                model->SetPID(rs[6].convert<Poco::UInt64>());
-                model->SetTID(rs[7].convert<Poco::UInt64>());
-                model->SetBillable(rs[8].convert<bool>());
-                model->SetDurOnly(rs[9].convert<bool>());
-                model->SetUIModifiedAt(rs[10].convert<Poco::UInt64>());
-                model->SetStart(rs[11].convert<Poco::UInt64>());
-                model->SetStop(rs[12].convert<Poco::UInt64>());
-                model->SetDurationInSeconds(rs[13].convert<Poco::Int64>());
-                model->SetTags(rs[14].convert<std::string>());
-                model->SetCreatedWith(rs[15].convert<std::string>());
-                model->SetDeletedAt(rs[16].convert<Poco::UInt64>());
-                model->SetUpdatedAt(rs[17].convert<Poco::UInt64>());
-                model->SetProjectGUID(rs[18].convert<std::string>());
-                model->ClearDirty();
-                list->push_back(model);
-                more = rs.moveNext();
+            if (!select->execute()) {
+                break;
             }
+            TimeEntry *model = new TimeEntry();
+            model->SetLocalID(local_id);
+            model->SetID(id);
+            model->SetUID(uid);
+            model->SetDescription(description);
+            model->SetWID(wid);
+            model->SetGUID(guid);
+            model->SetPID(pid);
+            model->SetTID(tid);
+            model->SetBillable(billable);
+            model->SetDurOnly(duronly);
+            model->SetUIModifiedAt(ui_modified_at);
+            model->SetStart(start);
+            model->SetStop(stop);
+            model->SetDurationInSeconds(duration);
+            model->SetTags(tags);
+            model->SetCreatedWith(created_with);
+            model->SetDeletedAt(deleted_at);
+            model->SetUpdatedAt(updated_at);
+            model->SetProjectGUID(project_guid);
+            model->ClearDirty();
+            list->push_back(model);
         }
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
@@ -847,6 +3207,10 @@ error Database::saveWorkspaces(
         std::vector<ModelChange> *changes) {
     poco_assert(UID > 0);
     poco_assert(list);
+    if (list->empty()) {
+        return noError;
+    }
+    MetricsTimer timer("db.save.workspaces");
     for (std::vector<Workspace *>::iterator it = list->begin();
             it != list->end(); ++it) {
         Workspace *model = *it;
@@ -865,6 +3229,10 @@ error Database::saveClients(
         std::vector<ModelChange> *changes) {
     poco_assert(UID > 0);
     poco_assert(list);
+    if (list->empty()) {
+        return noError;
+    }
+    MetricsTimer timer("db.save.clients");
     for (std::vector<Client *>::iterator it = list->begin();
             it != list->end(); ++it) {
         Client *model = *it;
@@ -885,23 +3253,21 @@ error Database::saveProjects(
   poco_assert(UID > 0);
   poco_assert(list);
   poco_assert(changes);
-
-  {
-    std::stringstream ss;
-    ss << "Saving projects in thread " << Poco::Thread::currentTid();
-    logger().trace(ss.str());
+  if (list->empty()) {
+    return noError;
   }
+  MetricsTimer timer("db.save.projects");
+
+  KOPSIK_LOG_TRACE(logger(), "Saving projects in thread "
+      << Poco::Thread::currentTid());
 
+  std::vector<Poco::Int64> deletes;
   for (std::vector<Project *>::iterator it = list->begin();
        it != list->end(); ++it) {
     Project *model = *it;
     if (model->IsMarkedAsDeletedOnServer()) {
-      error err = deleteFromTable("projects", model->LocalID());
-      if (err != noError) {
-        return err;
-      }
-      changes->push_back(ModelChange(
-        model->ModelName(), "delete", model->ID(), model->GUID()));
+      deletes.push_back(model->LocalID());
+      changes->push_back(ModelChange(model, ModelChange::Delete));
       continue;
     }
     model->SetUID(UID);
@@ -911,23 +3277,15 @@ error Database::saveProjects(
     }
   }
 
-  // Purge deleted models from memory
-  std::vector<Project *>::iterator it = list->begin();
-  while (it != list->end()) {
-    Project *model = *it;
-    if (model->IsMarkedAsDeletedOnServer()) {
-      it = list->erase(it);
-    } else {
-      ++it;
+  if (!deletes.empty()) {
+    error err = deleteFromTable("projects", deletes);
+    if (err != noError) {
+      return err;
     }
   }
 
-  {
-    std::stringstream ss;
-    ss << "Finished saving time entries in thread " <<
-    Poco::Thread::currentTid();
-    logger().trace(ss.str());
-  }
+  KOPSIK_LOG_TRACE(logger(), "Finished saving time entries in thread "
+      << Poco::Thread::currentTid());
 
   return noError;
 }
@@ -938,6 +3296,10 @@ error Database::saveTasks(
         std::vector<ModelChange> *changes) {
     poco_assert(UID > 0);
     poco_assert(list);
+    if (list->empty()) {
+        return noError;
+    }
+    MetricsTimer timer("db.save.tasks");
     for (std::vector<Task *>::iterator it = list->begin();
             it != list->end(); ++it) {
         Task *model = *it;
@@ -956,6 +3318,10 @@ error Database::saveTags(
         std::vector<ModelChange> *changes) {
     poco_assert(UID > 0);
     poco_assert(list);
+    if (list->empty()) {
+        return noError;
+    }
+    MetricsTimer timer("db.save.tags");
     for (std::vector<Tag *>::iterator it = list->begin();
             it != list->end(); ++it) {
         Tag *model = *it;
@@ -978,50 +3344,56 @@ error Database::saveTimeEntries(
     poco_assert(UID > 0);
     poco_assert(list);
     poco_assert(changes);
-
-    {
-        std::stringstream ss;
-        ss << "Saving time entries in thread " << Poco::Thread::currentTid();
-        logger().trace(ss.str());
+    if (list->empty()) {
+        return noError;
     }
+    MetricsTimer timer("db.save.time_entries");
+
+    KOPSIK_LOG_TRACE(logger(), "Saving time entries in thread "
+        << Poco::Thread::currentTid());
+
+    // Never saved entries are inserted together after the updates,
+    // and the ones deleted on the server are deleted together
+    std::vector<TimeEntry *> inserts;
+    std::vector<Poco::Int64> deletes;
 
     for (std::vector<TimeEntry *>::iterator it = list->begin();
             it != list->end(); ++it) {
         TimeEntry *model = *it;
         if (model->IsMarkedAsDeletedOnServer()) {
-            error err = deleteFromTable("time_entries", model->LocalID());
-            if (err != noError) {
-                return err;
-            }
-            changes->push_back(ModelChange(
-                model->ModelName(), "delete", model->ID(), model->GUID()));
+            deletes.push_back(model->LocalID());
+            report_cache_.Drop(model->Day());
+            changes->push_back(ModelChange(model, ModelChange::Delete));
             continue;
         }
         model->SetUID(UID);
+        if (!model->LocalID()) {
+            inserts.push_back(model);
+            continue;
+        }
         error err = saveTimeEntry(model, changes);
         if (err != noError) {
             return err;
         }
     }
 
-    // Purge deleted time entries from memory
-    std::vector<TimeEntry *>::iterator it = list->begin();
-    while (it != list->end()) {
-        TimeEntry *te = *it;
-        if (te->IsMarkedAsDeletedOnServer()) {
-            it = list->erase(it);
-        } else {
-            ++it;
+    if (!deletes.empty()) {
+        error err = deleteFromTable("time_entries", deletes);
+        if (err != noError) {
+            return err;
         }
     }
 
-    {
-        std::stringstream ss;
-        ss << "Finished saving time entries in thread " <<
-            Poco::Thread::currentTid();
-        logger().trace(ss.str());
+    if (!inserts.empty()) {
+        error err = insertTimeEntries(UID, &inserts, changes);
+        if (err != noError) {
+            return err;
+        }
     }
 
+    KOPSIK_LOG_TRACE(logger(), "Finished saving time entries in thread "
+        << Poco::Thread::currentTid());
+
     return noError;
 }
 
@@ -1038,173 +3410,77 @@ error Database::saveTimeEntry(
 
     model->EnsureGUID();
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
-        if (model->LocalID()) {
-            std::stringstream ss;
-            ss << "Updating time entry " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
+        prepareTimeEntryStatements();
 
-            if (model->ID()) {
-                *session << "update time_entries set "
-                    "id = :id, uid = :uid, description = :description, "
-                    "wid = :wid, guid = :guid, pid = :pid, tid = :tid, "
-                    "billable = :billable, "
-                    "duronly = :duronly, ui_modified_at = :ui_modified_at, "
-                    "start = :start, stop = :stop, duration = :duration, "
-                    "tags = :tags, created_with = :created_with, "
-                    "deleted_at = :deleted_at, "
-                    "updated_at = :updated_at, project_guid = :project_guid "
-                    "where local_id = :local_id",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Description()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->GUID()),
-                    Poco::Data::use(model->PID()),
-                    Poco::Data::use(model->TID()),
-                    Poco::Data::use(model->Billable()),
-                    Poco::Data::use(model->DurOnly()),
-                    Poco::Data::use(model->UIModifiedAt()),
-                    Poco::Data::use(model->Start()),
-                    Poco::Data::use(model->Stop()),
-                    Poco::Data::use(model->DurationInSeconds()),
-                    Poco::Data::use(model->Tags()),
-                    Poco::Data::use(model->CreatedWith()),
-                    Poco::Data::use(model->DeletedAt()),
-                    Poco::Data::use(model->UpdatedAt()),
-                    Poco::Data::use(model->ProjectGUID()),
-                    Poco::Data::use(model->LocalID()),
-                    Poco::Data::now;
+        setTimeEntryRow(model);
+
+        // Only the changed columns of a loaded time entry are updated
+        Poco::UInt32 fields = model->DirtyFields();
+
+        // The server may send a time entry that was not loaded, update
+        // its row instead of inserting it again
+        if (!model->LocalID() && model->ID() && time_entry_load_days_) {
+            Poco::Int64 local_id(0);
+            *session << "SELECT local_id FROM time_entries "
+                "WHERE uid = :uid AND id = :id LIMIT 1",
+                Poco::Data::into(local_id),
+                Poco::Data::use(time_entry_row_.uid),
+                Poco::Data::use(time_entry_row_.id),
+                Poco::Data::now;
+            if (local_id) {
+                model->SetLocalID(local_id);
+                fields = TimeEntry::kAllFields;
+            }
+        }
+        time_entry_row_.local_id = model->LocalID();
+
+        if (model->LocalID()) {
+            KOPSIK_LOG_TRACE(logger(), "Updating time entry "
+                << model->String() << " in thread "
+                << Poco::Thread::currentTid());
+
+            // Compiled statements are not finalized after execution,
+            // so SQLite keeps reporting their last step result as the
+            // last error. Failures are thrown as exceptions instead.
+            if (fields != TimeEntry::kAllFields) {
+                updateTimeEntryFields(fields)->execute();
+            } else if (model->ID()) {
+                update_time_entry_with_id_->execute();
             } else {
-                *session << "update time_entries set "
-                    "uid = :uid, description = :description, wid = :wid, "
-                    "guid = :guid, pid = :pid, tid = :tid, "
-                    "billable = :billable, "
-                    "duronly = :duronly, ui_modified_at = :ui_modified_at, "
-                    "start = :start, stop = :stop, duration = :duration, "
-                    "tags = :tags, created_with = :created_with, "
-                    "deleted_at = :deleted_at, "
-                    "updated_at = :updated_at, project_guid = :project_guid "
-                    "where local_id = :local_id",
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Description()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->GUID()),
-                    Poco::Data::use(model->PID()),
-                    Poco::Data::use(model->TID()),
-                    Poco::Data::use(model->Billable()),
-                    Poco::Data::use(model->DurOnly()),
-                    Poco::Data::use(model->UIModifiedAt()),
-                    Poco::Data::use(model->Start()),
-                    Poco::Data::use(model->Stop()),
-                    Poco::Data::use(model->DurationInSeconds()),
-                    Poco::Data::use(model->Tags()),
-                    Poco::Data::use(model->CreatedWith()),
-                    Poco::Data::use(model->DeletedAt()),
-                    Poco::Data::use(model->UpdatedAt()),
-                    Poco::Data::use(model->ProjectGUID()),
-                    Poco::Data::use(model->LocalID()),
-                    Poco::Data::now;
+                update_time_entry_->execute();
+            }
+            if (fields & TimeEntry::kFieldDescription) {
+                indexTimeEntryWords(true);
             }
-            error err = last_error("saveTimeEntry");
-            if (err != noError) {
-                return err;
+            // The day it was on before is not known here
+            if (fields & TimeEntry::kFieldStart) {
+                report_cache_.Clear();
+            } else {
+                report_cache_.Drop(model->Day());
             }
             if (model->DeletedAt()) {
-                changes->push_back(ModelChange(
-                    model->ModelName(), "delete", model->ID(), model->GUID()));
+                changes->push_back(ModelChange(model, ModelChange::Delete));
             } else {
-                changes->push_back(ModelChange(
-                    model->ModelName(), "update", model->ID(), model->GUID()));
+                changes->push_back(ModelChange(model, ModelChange::Update));
             }
         } else {
-            std::stringstream ss;
-            ss << "Inserting time entry " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
+            KOPSIK_LOG_TRACE(logger(), "Inserting time entry "
+                << model->String() << " in thread "
+                << Poco::Thread::currentTid());
             if (model->ID()) {
-                *session << "insert into time_entries(id, uid, description, "
-                    "wid, guid, pid, tid, billable, "
-                    "duronly, ui_modified_at, "
-                    "start, stop, duration, "
-                    "tags, created_with, deleted_at, updated_at, "
-                    "project_guid) "
-                    "values(:id, :uid, :description, :wid, "
-                    ":guid, :pid, :tid, :billable, "
-                    ":duronly, :ui_modified_at, "
-                    ":start, :stop, :duration, "
-                    ":tags, :created_with, :deleted_at, :updated_at, "
-                    ":project_guid)",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Description()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->GUID()),
-                    Poco::Data::use(model->PID()),
-                    Poco::Data::use(model->TID()),
-                    Poco::Data::use(model->Billable()),
-                    Poco::Data::use(model->DurOnly()),
-                    Poco::Data::use(model->UIModifiedAt()),
-                    Poco::Data::use(model->Start()),
-                    Poco::Data::use(model->Stop()),
-                    Poco::Data::use(model->DurationInSeconds()),
-                    Poco::Data::use(model->Tags()),
-                    Poco::Data::use(model->CreatedWith()),
-                    Poco::Data::use(model->DeletedAt()),
-                    Poco::Data::use(model->UpdatedAt()),
-                    Poco::Data::use(model->ProjectGUID()),
-                    Poco::Data::now;
+                insert_time_entry_with_id_->execute();
             } else {
-                *session << "insert into time_entries(uid, description, wid, "
-                    "guid, pid, tid, billable, "
-                    "duronly, ui_modified_at, "
-                    "start, stop, duration, "
-                    "tags, created_with, deleted_at, updated_at, "
-                    "project_guid "
-                    ") values ("
-                    ":uid, :description, :wid, "
-                    ":guid, :pid, :tid, :billable, "
-                    ":duronly, :ui_modified_at, "
-                    ":start, :stop, :duration, "
-                    ":tags, :created_with, :deleted_at, :updated_at, "
-                    ":project_guid)",
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Description()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->GUID()),
-                    Poco::Data::use(model->PID()),
-                    Poco::Data::use(model->TID()),
-                    Poco::Data::use(model->Billable()),
-                    Poco::Data::use(model->DurOnly()),
-                    Poco::Data::use(model->UIModifiedAt()),
-                    Poco::Data::use(model->Start()),
-                    Poco::Data::use(model->Stop()),
-                    Poco::Data::use(model->DurationInSeconds()),
-                    Poco::Data::use(model->Tags()),
-                    Poco::Data::use(model->CreatedWith()),
-                    Poco::Data::use(model->DeletedAt()),
-                    Poco::Data::use(model->UpdatedAt()),
-                    Poco::Data::use(model->ProjectGUID()),
-                    Poco::Data::now;
-                }
-            error err = last_error("saveTimeEntry");
-            if (err != noError) {
-                return err;
-            }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                Poco::Data::into(local_id),
-                Poco::Data::now;
-            err = last_error("saveTimeEntry");
-            if (err != noError) {
-                return err;
+                insert_time_entry_->execute();
             }
-            model->SetLocalID(local_id);
-            changes->push_back(ModelChange(
-              model->ModelName(), "insert", model->ID(), model->GUID()));
+            last_insert_rowid_->execute();
+            model->SetLocalID(last_insert_rowid_value_);
+            time_entry_row_.local_id = model->LocalID();
+            indexTimeEntryWords(false);
+            report_cache_.Drop(model->Day());
+            changes->push_back(ModelChange(model, ModelChange::Insert));
         }
         model->ClearDirty();
     } catch(const Poco::Exception& exc) {
@@ -1217,70 +3493,108 @@ error Database::saveTimeEntry(
     return noError;
 }
 
-error Database::saveWorkspace(
-        Workspace *model,
-        std::vector<ModelChange> *changes) {
-    poco_assert(model);
-    poco_assert(session);
+void Database::setTimeEntryRow(TimeEntry *model) {
+    time_entry_row_.id = model->ID();
+    time_entry_row_.uid = model->UID();
+    time_entry_row_.description = model->Description();
+    time_entry_row_.wid = model->WID();
+    time_entry_row_.guid = model->GUID();
+    time_entry_row_.pid = model->PID();
+    time_entry_row_.tid = model->TID();
+    time_entry_row_.billable = model->Billable();
+    time_entry_row_.duronly = model->DurOnly();
+    time_entry_row_.ui_modified_at = model->UIModifiedAt();
+    time_entry_row_.start = model->Start();
+    time_entry_row_.stop = model->Stop();
+    time_entry_row_.duration = model->DurationInSeconds();
+    time_entry_row_.tags = model->Tags();
+    time_entry_row_.created_with = model->CreatedWith();
+    time_entry_row_.deleted_at = model->DeletedAt();
+    time_entry_row_.updated_at = model->UpdatedAt();
+    time_entry_row_.project_guid = model->ProjectGUID();
+    time_entry_row_.local_id = model->LocalID();
+}
 
-    if (model->LocalID() && !model->Dirty()) {
-        return noError;
+// Words are kept in lower case, once per entry
+static void descriptionWords(
+        const std::string &description,
+        std::vector<std::string> *words) {
+    SplitWords(Poco::UTF8::toLower(description), words);
+    std::sort(words->begin(), words->end());
+    words->erase(std::unique(words->begin(), words->end()), words->end());
+}
+
+void Database::indexTimeEntryWords(const bool replace) {
+    if (replace) {
+        delete_time_entry_words_->execute();
     }
+    std::vector<std::string> words;
+    descriptionWords(time_entry_row_.description, &words);
+    for (std::vector<std::string>::const_iterator it = words.begin();
+            it != words.end();
+            it++) {
+        time_entry_word_ = *it;
+        insert_time_entry_word_->execute();
+    }
+}
+
+// After a first login all time entries are new. They are inserted in
+// one loop over the compiled insert statements, holding the lock once,
+// and their local IDs are read straight from the connection instead of
+// with a select per row. Entries that may already have an unloaded row
+// (see SetTimeEntryLoadDays) still go one by one through saveTimeEntry.
+error Database::insertTimeEntries(
+        const Poco::UInt64 UID,
+        std::vector<TimeEntry *> *list,
+        std::vector<ModelChange> *changes) {
+    poco_assert(list);
+    poco_assert(changes);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
-        if (model->LocalID()) {
-            std::stringstream ss;
-            ss << "Updating workspace " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
-
-            *session << "update workspaces set "
-                "id = :id, uid = :uid, name = :name, premium = :premium "
-                "where local_id = :local_id",
-                Poco::Data::use(model->ID()),
-                Poco::Data::use(model->UID()),
-                Poco::Data::use(model->Name()),
-                Poco::Data::use(model->Premium()),
-                Poco::Data::use(model->LocalID()),
+        if (time_entry_load_days_) {
+            Poco::Int64 stored(0);
+            *session << "SELECT COUNT(*) FROM ("
+                "SELECT 1 FROM time_entries WHERE uid = :uid LIMIT 1)",
+                Poco::Data::into(stored),
+                Poco::Data::use(UID),
                 Poco::Data::now;
-            error err = last_error("saveWorkspace");
-            if (err != noError) {
-                return err;
+            if (stored) {
+                for (std::vector<TimeEntry *>::iterator it = list->begin();
+                        it != list->end(); ++it) {
+                    error err = saveTimeEntry(*it, changes);
+                    if (err != noError) {
+                        return err;
+                    }
+                }
+                return noError;
             }
-            changes->push_back(ModelChange(
-                    model->ModelName(), "update", model->ID(), ""));
+        }
 
-        } else {
-            std::stringstream ss;
-            ss << "Inserting workspace " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
-            *session << "insert into workspaces(id, uid, name, premium) "
-                "values(:id, :uid, :name, :premium)",
-                Poco::Data::use(model->ID()),
-                Poco::Data::use(model->UID()),
-                Poco::Data::use(model->Name()),
-                Poco::Data::use(model->Premium()),
-                Poco::Data::now;
-            error err = last_error("saveWorkspace");
-            if (err != noError) {
-                return err;
-            }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                Poco::Data::into(local_id),
-                Poco::Data::now;
-            err = last_error("saveWorkspace");
-            if (err != noError) {
-                return err;
+        prepareTimeEntryStatements();
+
+        Poco::Data::SQLite::SessionImpl* sqlite =
+            static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+        sqlite3 *db = sqlite->db();
+
+        for (std::vector<TimeEntry *>::iterator it = list->begin();
+                it != list->end(); ++it) {
+            TimeEntry *model = *it;
+            model->EnsureGUID();
+            setTimeEntryRow(model);
+            if (model->ID()) {
+                insert_time_entry_with_id_->execute();
+            } else {
+                insert_time_entry_->execute();
             }
-            model->SetLocalID(local_id);
-            changes->push_back(ModelChange(
-              model->ModelName(), "insert", model->ID(), ""));
+            model->SetLocalID(sqlite3_last_insert_rowid(db));
+            time_entry_row_.local_id = model->LocalID();
+            indexTimeEntryWords(false);
+            report_cache_.Drop(model->Day());
+            changes->push_back(ModelChange(model, ModelChange::Insert));
+            model->ClearDirty();
         }
-        model->ClearDirty();
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -1288,113 +3602,309 @@ error Database::saveWorkspace(
     } catch(const std::string& ex) {
         return ex;
     }
+
+    KOPSIK_LOG_DEBUG(logger(), "Inserted " << list->size() << " time entries");
+
     return noError;
 }
 
-error Database::saveClient(
-        Client *model,
+// Time entries are by far the most numerous models, so their insert and
+// update statements are compiled once and then re-executed with the
+// values copied into time_entry_row_, instead of being parsed by SQLite
+// again for every saved row.
+void Database::prepareTimeEntryStatements() {
+    if (update_time_entry_) {
+        return;
+    }
+
+    TimeEntryRow &row = time_entry_row_;
+
+    update_time_entry_with_id_ = new Poco::Data::Statement(*session);
+    *update_time_entry_with_id_ << "update time_entries set "
+        "id = :id, uid = :uid, description = :description, "
+        "wid = :wid, guid = :guid, pid = :pid, tid = :tid, "
+        "billable = :billable, "
+        "duronly = :duronly, ui_modified_at = :ui_modified_at, "
+        "start = :start, stop = :stop, duration = :duration, "
+        "tags = :tags, created_with = :created_with, "
+        "deleted_at = :deleted_at, "
+        "updated_at = :updated_at, project_guid = :project_guid "
+        "where local_id = :local_id",
+        Poco::Data::use(row.id),
+        Poco::Data::use(row.uid),
+        Poco::Data::use(row.description),
+        Poco::Data::use(row.wid),
+        Poco::Data::use(row.guid),
+        Poco::Data::use(row.pid),
+        Poco::Data::use(row.tid),
+        Poco::Data::use(row.billable),
+        Poco::Data::use(row.duronly),
+        Poco::Data::use(row.ui_modified_at),
+        Poco::Data::use(row.start),
+        Poco::Data::use(row.stop),
+        Poco::Data::use(row.duration),
+        Poco::Data::use(row.tags),
+        Poco::Data::use(row.created_with),
+        Poco::Data::use(row.deleted_at),
+        Poco::Data::use(row.updated_at),
+        Poco::Data::use(row.project_guid),
+        Poco::Data::use(row.local_id);
+
+    update_time_entry_ = new Poco::Data::Statement(*session);
+    *update_time_entry_ << "update time_entries set "
+        "uid = :uid, description = :description, wid = :wid, "
+        "guid = :guid, pid = :pid, tid = :tid, "
+        "billable = :billable, "
+        "duronly = :duronly, ui_modified_at = :ui_modified_at, "
+        "start = :start, stop = :stop, duration = :duration, "
+        "tags = :tags, created_with = :created_with, "
+        "deleted_at = :deleted_at, "
+        "updated_at = :updated_at, project_guid = :project_guid "
+        "where local_id = :local_id",
+        Poco::Data::use(row.uid),
+        Poco::Data::use(row.description),
+        Poco::Data::use(row.wid),
+        Poco::Data::use(row.guid),
+        Poco::Data::use(row.pid),
+        Poco::Data::use(row.tid),
+        Poco::Data::use(row.billable),
+        Poco::Data::use(row.duronly),
+        Poco::Data::use(row.ui_modified_at),
+        Poco::Data::use(row.start),
+        Poco::Data::use(row.stop),
+        Poco::Data::use(row.duration),
+        Poco::Data::use(row.tags),
+        Poco::Data::use(row.created_with),
+        Poco::Data::use(row.deleted_at),
+        Poco::Data::use(row.updated_at),
+        Poco::Data::use(row.project_guid),
+        Poco::Data::use(row.local_id);
+
+    insert_time_entry_with_id_ = new Poco::Data::Statement(*session);
+    *insert_time_entry_with_id_ << "insert into time_entries(id, uid, "
+        "description, wid, guid, pid, tid, billable, "
+        "duronly, ui_modified_at, "
+        "start, stop, duration, "
+        "tags, created_with, deleted_at, updated_at, "
+        "project_guid) "
+        "values(:id, :uid, :description, :wid, "
+        ":guid, :pid, :tid, :billable, "
+        ":duronly, :ui_modified_at, "
+        ":start, :stop, :duration, "
+        ":tags, :created_with, :deleted_at, :updated_at, "
+        ":project_guid)",
+        Poco::Data::use(row.id),
+        Poco::Data::use(row.uid),
+        Poco::Data::use(row.description),
+        Poco::Data::use(row.wid),
+        Poco::Data::use(row.guid),
+        Poco::Data::use(row.pid),
+        Poco::Data::use(row.tid),
+        Poco::Data::use(row.billable),
+        Poco::Data::use(row.duronly),
+        Poco::Data::use(row.ui_modified_at),
+        Poco::Data::use(row.start),
+        Poco::Data::use(row.stop),
+        Poco::Data::use(row.duration),
+        Poco::Data::use(row.tags),
+        Poco::Data::use(row.created_with),
+        Poco::Data::use(row.deleted_at),
+        Poco::Data::use(row.updated_at),
+        Poco::Data::use(row.project_guid);
+
+    insert_time_entry_ = new Poco::Data::Statement(*session);
+    *insert_time_entry_ << "insert into time_entries(uid, description, wid, "
+        "guid, pid, tid, billable, "
+        "duronly, ui_modified_at, "
+        "start, stop, duration, "
+        "tags, created_with, deleted_at, updated_at, "
+        "project_guid "
+        ") values ("
+        ":uid, :description, :wid, "
+        ":guid, :pid, :tid, :billable, "
+        ":duronly, :ui_modified_at, "
+        ":start, :stop, :duration, "
+        ":tags, :created_with, :deleted_at, :updated_at, "
+        ":project_guid)",
+        Poco::Data::use(row.uid),
+        Poco::Data::use(row.description),
+        Poco::Data::use(row.wid),
+        Poco::Data::use(row.guid),
+        Poco::Data::use(row.pid),
+        Poco::Data::use(row.tid),
+        Poco::Data::use(row.billable),
+        Poco::Data::use(row.duronly),
+        Poco::Data::use(row.ui_modified_at),
+        Poco::Data::use(row.start),
+        Poco::Data::use(row.stop),
+        Poco::Data::use(row.duration),
+        Poco::Data::use(row.tags),
+        Poco::Data::use(row.created_with),
+        Poco::Data::use(row.deleted_at),
+        Poco::Data::use(row.updated_at),
+        Poco::Data::use(row.project_guid);
+
+    last_insert_rowid_ = new Poco::Data::Statement(*session);
+    *last_insert_rowid_ << "select last_insert_rowid()",
+        Poco::Data::into(last_insert_rowid_value_);
+
+    delete_time_entry_words_ = new Poco::Data::Statement(*session);
+    *delete_time_entry_words_ << "DELETE FROM time_entry_words "
+        "WHERE local_id = :local_id",
+        Poco::Data::use(row.local_id);
+
+    insert_time_entry_word_ = new Poco::Data::Statement(*session);
+    *insert_time_entry_word_ << "INSERT OR IGNORE INTO "
+        "time_entry_words(word, local_id) VALUES(:word, :local_id)",
+        Poco::Data::use(time_entry_word_),
+        Poco::Data::use(row.local_id);
+}
+
+// Columns in the order of the compiled statements
+static const struct {
+    Poco::UInt32 field;
+    const char *column;
+} kTimeEntryColumns[] = {
+    { TimeEntry::kFieldID, "id" },
+    { TimeEntry::kFieldUID, "uid" },
+    { TimeEntry::kFieldDescription, "description" },
+    { TimeEntry::kFieldWID, "wid" },
+    { TimeEntry::kFieldGUID, "guid" },
+    { TimeEntry::kFieldPID, "pid" },
+    { TimeEntry::kFieldTID, "tid" },
+    { TimeEntry::kFieldBillable, "billable" },
+    { TimeEntry::kFieldDurOnly, "duronly" },
+    { TimeEntry::kFieldUIModifiedAt, "ui_modified_at" },
+    { TimeEntry::kFieldStart, "start" },
+    { TimeEntry::kFieldStop, "stop" },
+    { TimeEntry::kFieldDuration, "duration" },
+    { TimeEntry::kFieldTags, "tags" },
+    { TimeEntry::kFieldCreatedWith, "created_with" },
+    { TimeEntry::kFieldDeletedAt, "deleted_at" },
+    { TimeEntry::kFieldUpdatedAt, "updated_at" },
+    { TimeEntry::kFieldProjectGUID, "project_guid" }
+};
+
+Poco::Data::Statement *Database::updateTimeEntryFields(
+        const Poco::UInt32 fields) {
+    std::map<Poco::UInt32, Poco::Data::Statement *>::const_iterator it =
+        update_time_entry_fields_.find(fields);
+    if (it != update_time_entry_fields_.end()) {
+        return it->second;
+    }
+
+    const std::size_t count =
+        sizeof(kTimeEntryColumns) / sizeof(kTimeEntryColumns[0]);
+    std::string sql("update time_entries set ");
+    bool first(true);
+    for (std::size_t i = 0; i < count; i++) {
+        if (!(fields & kTimeEntryColumns[i].field)) {
+            continue;
+        }
+        if (!first) {
+            sql += ", ";
+        }
+        sql += kTimeEntryColumns[i].column;
+        sql += " = :";
+        sql += kTimeEntryColumns[i].column;
+        first = false;
+    }
+    poco_assert(!first);
+    sql += " where local_id = :local_id";
+
+    TimeEntryRow &row = time_entry_row_;
+    Poco::Data::Statement *update = new Poco::Data::Statement(*session);
+    *update << sql;
+    for (std::size_t i = 0; i < count; i++) {
+        switch (fields & kTimeEntryColumns[i].field) {
+        case 0: break;
+        case TimeEntry::kFieldID: *update, Poco::Data::use(row.id); break;
+        case TimeEntry::kFieldUID: *update, Poco::Data::use(row.uid); break;
+        case TimeEntry::kFieldDescription:
+            *update, Poco::Data::use(row.description); break;
+        case TimeEntry::kFieldWID: *update, Poco::Data::use(row.wid); break;
+        case TimeEntry::kFieldGUID: *update, Poco::Data::use(row.guid); break;
+        case TimeEntry::kFieldPID: *update, Poco::Data::use(row.pid); break;
+        case TimeEntry::kFieldTID: *update, Poco::Data::use(row.tid); break;
+        case TimeEntry::kFieldBillable:
+            *update, Poco::Data::use(row.billable); break;
+        case TimeEntry::kFieldDurOnly:
+            *update, Poco::Data::use(row.duronly); break;
+        case TimeEntry::kFieldUIModifiedAt:
+            *update, Poco::Data::use(row.ui_modified_at); break;
+        case TimeEntry::kFieldStart:
+            *update, Poco::Data::use(row.start); break;
+        case TimeEntry::kFieldStop: *update, Poco::Data::use(row.stop); break;
+        case TimeEntry::kFieldDuration:
+            *update, Poco::Data::use(row.duration); break;
+        case TimeEntry::kFieldTags: *update, Poco::Data::use(row.tags); break;
+        case TimeEntry::kFieldCreatedWith:
+            *update, Poco::Data::use(row.created_with); break;
+        case TimeEntry::kFieldDeletedAt:
+            *update, Poco::Data::use(row.deleted_at); break;
+        case TimeEntry::kFieldUpdatedAt:
+            *update, Poco::Data::use(row.updated_at); break;
+        case TimeEntry::kFieldProjectGUID:
+            *update, Poco::Data::use(row.project_guid); break;
+        }
+    }
+    *update, Poco::Data::use(row.local_id);
+    update_time_entry_fields_[fields] = update;
+    return update;
+}
+
+void Database::clearStatements() {
+    for (std::map<Poco::UInt32, Poco::Data::Statement *>::const_iterator it =
+            update_time_entry_fields_.begin();
+            it != update_time_entry_fields_.end();
+            it++) {
+        delete it->second;
+    }
+    update_time_entry_fields_.clear();
+    delete update_time_entry_with_id_;
+    update_time_entry_with_id_ = 0;
+    delete update_time_entry_;
+    update_time_entry_ = 0;
+    delete insert_time_entry_with_id_;
+    insert_time_entry_with_id_ = 0;
+    delete insert_time_entry_;
+    insert_time_entry_ = 0;
+    delete last_insert_rowid_;
+    last_insert_rowid_ = 0;
+    delete delete_time_entry_words_;
+    delete_time_entry_words_ = 0;
+    delete insert_time_entry_word_;
+    insert_time_entry_word_ = 0;
+}
+
+error Database::saveWorkspace(
+        Workspace *model,
         std::vector<ModelChange> *changes) {
     poco_assert(model);
-    poco_assert(session);
 
     if (model->LocalID() && !model->Dirty()) {
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    return saveModel(model, changes);
+}
 
-    try {
-        if (model->LocalID()) {
-            std::stringstream ss;
-            ss << "Updating client " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
-
-            if (model->GUID().empty()) {
-                *session << "update clients set "
-                    "id = :id, uid = :uid, name = :name, wid = :wid "
-                    "where local_id = :local_id",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Name()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->LocalID()),
-                    Poco::Data::now;
-            } else {
-                *session << "update clients set "
-                    "id = :id, uid = :uid, name = :name, guid = :guid, "
-                    "wid = :wid "
-                    "where local_id = :local_id",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Name()),
-                    Poco::Data::use(model->GUID()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->LocalID()),
-                    Poco::Data::now;
-                }
-            error err = last_error("saveClient");
-            if (err != noError) {
-                return err;
-            }
-            changes->push_back(ModelChange(
-              model->ModelName(), "update", model->ID(), model->GUID()));
+error Database::saveClient(
+        Client *model,
+        std::vector<ModelChange> *changes) {
+    poco_assert(model);
 
-        } else {
-            std::stringstream ss;
-            ss << "Inserting client " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
-            if (model->GUID().empty()) {
-                *session << "insert into clients(id, uid, name, wid) "
-                    "values(:id, :uid, :name, :wid)",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Name()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::now;
-            } else {
-                *session << "insert into clients(id, uid, name, guid, wid) "
-                    "values(:id, :uid, :name, :guid, :wid)",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Name()),
-                    Poco::Data::use(model->GUID()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::now;
-            }
-            error err = last_error("saveClient");
-            if (err != noError) {
-                return err;
-            }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                Poco::Data::into(local_id),
-                Poco::Data::now;
-            err = last_error("saveClient");
-            if (err != noError) {
-                return err;
-            }
-            model->SetLocalID(local_id);
-            changes->push_back(ModelChange(
-              model->ModelName(), "insert", model->ID(), model->GUID()));
-        }
-        model->ClearDirty();
-    } catch(const Poco::Exception& exc) {
-        return exc.displayText();
-    } catch(const std::exception& ex) {
-        return ex.what();
-    } catch(const std::string& ex) {
-        return ex;
+    if (model->LocalID() && !model->Dirty()) {
+        return noError;
     }
-    return noError;
+
+    return saveModel(model, changes);
 }
 
 error Database::saveProject(
         Project *model,
         std::vector<ModelChange> *changes) {
     poco_assert(model);
-    poco_assert(session);
 
     if (!model->NeedsToBeSaved()) {
         return noError;
@@ -1402,186 +3912,137 @@ error Database::saveProject(
 
     model->EnsureGUID();
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    return saveModel(model, changes);
+}
 
-    try {
-        if (model->LocalID()) {
-            std::stringstream ss;
-            ss << "Updating project " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().debug(ss.str());
+error Database::saveTask(
+        Task *model,
+        std::vector<ModelChange> *changes) {
+    poco_assert(model);
 
-            if (model->ID()) {
-                if (model->GUID().empty()) {
-                    *session << "update projects set "
-                        "id = :id, uid = :uid, name = :name, "
-                        "wid = :wid, color = :color, cid = :cid, "
-                        "active = :active, billable = :billable "
-                        "where local_id = :local_id",
-                        Poco::Data::use(model->ID()),
-                        Poco::Data::use(model->UID()),
-                        Poco::Data::use(model->Name()),
-                        Poco::Data::use(model->WID()),
-                        Poco::Data::use(model->Color()),
-                        Poco::Data::use(model->CID()),
-                        Poco::Data::use(model->Active()),
-                        Poco::Data::use(model->Billable()),
-                        Poco::Data::use(model->LocalID()),
-                        Poco::Data::now;
-                } else {
-                    *session << "update projects set "
-                        "id = :id, uid = :uid, name = :name, guid = :guid,"
-                        "wid = :wid, color = :color, cid = :cid, "
-                        "active = :active, billable = :billable "
-                        "where local_id = :local_id",
-                        Poco::Data::use(model->ID()),
-                        Poco::Data::use(model->UID()),
-                        Poco::Data::use(model->Name()),
-                        Poco::Data::use(model->GUID()),
-                        Poco::Data::use(model->WID()),
-                        Poco::Data::use(model->Color()),
-                        Poco::Data::use(model->CID()),
-                        Poco::Data::use(model->Active()),
-                        Poco::Data::use(model->Billable()),
-                        Poco::Data::use(model->LocalID()),
-                        Poco::Data::now;
-                }
-            } else {
-                if (model->GUID().empty()) {
-                    *session << "update projects set "
-                        "uid = :uid, name = :name, "
-                        "wid = :wid, color = :color, cid = :cid, "
-                        "active = :active, billable = :billable "
-                        "where local_id = :local_id",
-                        Poco::Data::use(model->UID()),
-                        Poco::Data::use(model->Name()),
-                        Poco::Data::use(model->WID()),
-                        Poco::Data::use(model->Color()),
-                        Poco::Data::use(model->CID()),
-                        Poco::Data::use(model->Active()),
-                        Poco::Data::use(model->Billable()),
-                        Poco::Data::use(model->LocalID()),
-                        Poco::Data::now;
-                } else {
-                    *session << "update projects set "
-                        "uid = :uid, name = :name, guid = :guid,"
-                        "wid = :wid, color = :color, cid = :cid, "
-                        "active = :active, billable = :billable "
-                        "where local_id = :local_id",
-                        Poco::Data::use(model->UID()),
-                        Poco::Data::use(model->Name()),
-                        Poco::Data::use(model->GUID()),
-                        Poco::Data::use(model->WID()),
-                        Poco::Data::use(model->Color()),
-                        Poco::Data::use(model->CID()),
-                        Poco::Data::use(model->Active()),
-                        Poco::Data::use(model->Billable()),
-                        Poco::Data::use(model->LocalID()),
-                        Poco::Data::now;
-                }
-            }
-            error err = last_error("saveProject");
-            if (err != noError) {
-                return err;
-            }
-            changes->push_back(ModelChange(
-                    model->ModelName(), "update", model->ID(), model->GUID()));
+    if (model->LocalID() && !model->Dirty()) {
+        return noError;
+    }
 
-        } else {
-            std::stringstream ss;
-            ss << "Inserting project " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().debug(ss.str());
-            if (model->ID()) {
-                if (model->GUID().empty()) {
-                    *session <<
-                        "insert into projects("
-                        "id, uid, name, wid, color, cid, active, "
-                        "billable"
-                        ") values("
-                        ":id, :uid, :name, :wid, :color, :cid, :active, "
-                        ":billable"
-                        ")",
-                        Poco::Data::use(model->ID()),
-                        Poco::Data::use(model->UID()),
-                        Poco::Data::use(model->Name()),
-                        Poco::Data::use(model->WID()),
-                        Poco::Data::use(model->Color()),
-                        Poco::Data::use(model->CID()),
-                        Poco::Data::use(model->Active()),
-                        Poco::Data::use(model->Billable()),
-                        Poco::Data::now;
-                } else {
-                    *session <<
-                        "insert into projects("
-                        "id, uid, name, guid, wid, color, cid, active, billable"
-                        ") values("
-                        ":id, :uid, :name, :guid, :wid, :color, :cid, :active, "
-                        ":billable"
-                        ")",
-                        Poco::Data::use(model->ID()),
-                        Poco::Data::use(model->UID()),
-                        Poco::Data::use(model->Name()),
-                        Poco::Data::use(model->GUID()),
-                        Poco::Data::use(model->WID()),
-                        Poco::Data::use(model->Color()),
-                        Poco::Data::use(model->CID()),
-                        Poco::Data::use(model->Active()),
-                        Poco::Data::use(model->Billable()),
-                        Poco::Data::now;
-                }
-            } else {
-                if (model->GUID().empty()) {
-                    *session <<
-                        "insert into projects("
-                        "uid, name, wid, color, cid, active, billable"
-                        ") values("
-                        ":uid, :name, :wid, :color, :cid, :active, :billable"
-                        ")",
-                        Poco::Data::use(model->UID()),
-                        Poco::Data::use(model->Name()),
-                        Poco::Data::use(model->WID()),
-                        Poco::Data::use(model->Color()),
-                        Poco::Data::use(model->CID()),
-                        Poco::Data::use(model->Active()),
-                        Poco::Data::use(model->Billable()),
-                        Poco::Data::now;
-                } else {
-                    *session <<
-                        "insert into projects("
-                        "uid, name, guid, wid, color, cid, active, billable"
-                        ") values("
-                        ":uid, :name, :guid, :wid, :color, :cid, :active, "
-                        ":billable"
-                        ")",
-                        Poco::Data::use(model->UID()),
-                        Poco::Data::use(model->Name()),
-                        Poco::Data::use(model->GUID()),
-                        Poco::Data::use(model->WID()),
-                        Poco::Data::use(model->Color()),
-                        Poco::Data::use(model->CID()),
-                        Poco::Data::use(model->Active()),
-                        Poco::Data::use(model->Billable()),
-                        Poco::Data::now;
-                }
+    return saveModel(model, changes);
+}
+
+error Database::saveTag(
+        Tag *model,
+        std::vector<ModelChange> *changes) {
+    poco_assert(model);
+
+    if (model->LocalID() && !model->Dirty()) {
+        return noError;
+    }
+
+    return saveModel(model, changes);
+}
+
+void Database::SetChangeJournalPath(const std::string &path) {
+    Poco::FastMutex::ScopedLock lock(journal_m_);
+    delete change_journal_;
+    change_journal_ = 0;
+    change_journal_path_ = path;
+}
+
+ChangeJournal *Database::changeJournal() {
+    if (!change_journal_ && !change_journal_path_.empty()) {
+        change_journal_ = new ChangeJournal(change_journal_path_,
+                                            desktop_id_);
+    }
+    return change_journal_;
+}
+
+void Database::truncateChangeJournal() {
+    Poco::FastMutex::ScopedLock lock(journal_m_);
+    ChangeJournal *journal = changeJournal();
+    if (!journal || journal->Empty()) {
+        return;
+    }
+    error err = journal->Truncate();
+    if (err != noError) {
+        logger().error("Cannot truncate change journal: " + err);
+    }
+}
+
+error Database::JournalEdits(User *user) {
+    poco_assert(user);
+
+    Poco::FastMutex::ScopedLock lock(journal_m_);
+    ChangeJournal *journal = changeJournal();
+    if (!journal) {
+        return noError;
+    }
+
+    MetricsTimer timer("journal.append");
+
+    // Edits are made on time entries, see Context::journalEdits
+    std::vector<TimeEntry *> time_entries;
+    RelatedData *related = &user->related;
+    if (related->AllTracked()) {
+        for (std::set<BaseModel *>::const_iterator it =
+                related->DirtyModels.begin();
+                it != related->DirtyModels.end();
+                it++) {
+            if ("time_entry" == (*it)->ModelName()) {
+                time_entries.push_back(static_cast<TimeEntry *>(*it));
             }
-            error err = last_error("saveProject");
-            if (err != noError) {
-                return err;
+        }
+    } else {
+        for (std::vector<TimeEntry *>::const_iterator it =
+                related->TimeEntries.begin();
+                it != related->TimeEntries.end();
+                it++) {
+            if ((*it)->Dirty()) {
+                time_entries.push_back(*it);
             }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                Poco::Data::into(local_id),
-                Poco::Data::now;
-            err = last_error("saveProject");
-            if (err != noError) {
-                return err;
+        }
+    }
+
+    for (std::vector<TimeEntry *>::const_iterator it = time_entries.begin();
+            it != time_entries.end();
+            it++) {
+        TimeEntry *te = *it;
+        te->EnsureGUID();
+        error err = journal->Append(TimeEntryToJournalJSON(te, user->ID()));
+        if (err != noError) {
+            return err;
+        }
+    }
+    Metrics::Shared().Count("journal.records", time_entries.size());
+    return noError;
+}
+
+error Database::ReplayChangeJournal(
+        User *user,
+        std::vector<ModelChange> *changes) {
+    poco_assert(user);
+    poco_assert(changes);
+
+    std::vector<std::string> records;
+    {
+        Poco::FastMutex::ScopedLock lock(journal_m_);
+        ChangeJournal *journal = changeJournal();
+        if (!journal || journal->Empty()) {
+            return noError;
+        }
+        // The records before a damaged one are still good
+        error err = journal->Read(&records);
+        if (err != noError) {
+            logger().warning(err);
+        }
+    }
+
+    Poco::Int64 replayed(0);
+    try {
+        for (std::vector<std::string>::const_iterator it = records.begin();
+                it != records.end();
+                it++) {
+            if (LoadUserTimeEntryFromJournalJSON(user, *it)) {
+                replayed++;
             }
-            model->SetLocalID(local_id);
-            changes->push_back(ModelChange(
-              model->ModelName(), "insert", model->ID(), model->GUID()));
         }
-        model->ClearDirty();
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -1589,75 +4050,63 @@ error Database::saveProject(
     } catch(const std::string& ex) {
         return ex;
     }
-    return noError;
+    Metrics::Shared().Count("journal.replayed", replayed);
+    KOPSIK_LOG_FIELDS(logger(), PRIO_INFORMATION, "Change journal replayed",
+        LogFields()
+            .Add("records", static_cast<Poco::UInt64>(records.size()))
+            .Add("replayed", replayed));
+
+    // Truncates the journal once it's saved
+    return SaveUser(user, true, changes);
 }
 
-error Database::saveTask(
-        Task *model,
-        std::vector<ModelChange> *changes) {
-    poco_assert(model);
-    poco_assert(session);
-
-    if (model->LocalID() && !model->Dirty()) {
-      return noError;
+void Database::collectDirtyModels(
+        RelatedData *related,
+        std::vector<Workspace *> *workspaces,
+        std::vector<Client *> *clients,
+        std::vector<Project *> *projects,
+        std::vector<Task *> *tasks,
+        std::vector<Tag *> *tags,
+        std::vector<TimeEntry *> *time_entries) {
+    poco_assert(related);
+    for (std::set<BaseModel *>::const_iterator it =
+            related->DirtyModels.begin();
+            it != related->DirtyModels.end();
+            it++) {
+        BaseModel *model = *it;
+        std::string model_name = model->ModelName();
+        if ("workspace" == model_name) {
+            workspaces->push_back(static_cast<Workspace *>(model));
+        } else if ("client" == model_name) {
+            clients->push_back(static_cast<Client *>(model));
+        } else if ("project" == model_name) {
+            projects->push_back(static_cast<Project *>(model));
+        } else if ("task" == model_name) {
+            tasks->push_back(static_cast<Task *>(model));
+        } else if ("tag" == model_name) {
+            tags->push_back(static_cast<Tag *>(model));
+        } else if ("time_entry" == model_name) {
+            time_entries->push_back(static_cast<TimeEntry *>(model));
+        }
     }
+}
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+error Database::loadPushOutbox(
+        const Poco::UInt64 UID,
+        PushOutbox *outbox) {
+    poco_assert(outbox);
 
+    std::vector<std::string> guids;
+    std::vector<std::string> models;
+    std::vector<std::string> operations;
     try {
-        if (model->LocalID()) {
-            std::stringstream ss;
-            ss << "Updating task " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
-
-            *session << "update tasks set "
-                "id = :id, uid = :uid, name = :name, wid = :wid, pid = :pid "
-                "where local_id = :local_id",
-                Poco::Data::use(model->ID()),
-                Poco::Data::use(model->UID()),
-                Poco::Data::use(model->Name()),
-                Poco::Data::use(model->WID()),
-                Poco::Data::use(model->PID()),
-                Poco::Data::use(model->LocalID()),
-                Poco::Data::now;
-            error err = last_error("saveTask");
-            if (err != noError) {
-              return err;
-            }
-            changes->push_back(ModelChange(
-              model->ModelName(), "update", model->ID(), ""));
-
-        } else {
-            std::stringstream ss;
-            ss << "Inserting task " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
-            *session << "insert into tasks(id, uid, name, wid, pid) "
-                "values(:id, :uid, :name, :wid, :pid)",
-                Poco::Data::use(model->ID()),
-                Poco::Data::use(model->UID()),
-                Poco::Data::use(model->Name()),
-                Poco::Data::use(model->WID()),
-                Poco::Data::use(model->PID()),
-                Poco::Data::now;
-            error err = last_error("saveTask");
-            if (err != noError) {
-                return err;
-            }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                Poco::Data::into(local_id),
-                Poco::Data::now;
-            err = last_error("saveTask");
-            if (err != noError) {
-                return err;
-            }
-            model->SetLocalID(local_id);
-            changes->push_back(ModelChange(
-              model->ModelName(), "insert", model->ID(), ""));
-        }
-        model->ClearDirty();
+        *session << "SELECT guid, model, operation FROM push_outbox "
+            "WHERE uid = :uid",
+            Poco::Data::into(guids),
+            Poco::Data::into(models),
+            Poco::Data::into(operations),
+            Poco::Data::use(UID),
+            Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -1665,98 +4114,53 @@ error Database::saveTask(
     } catch(const std::string& ex) {
         return ex;
     }
+    error err = last_error("loadPushOutbox");
+    if (err != noError) {
+        return err;
+    }
+
+    outbox->Clear();
+    for (std::size_t i = 0; i < guids.size(); i++) {
+        outbox->Put(guids[i], models[i], operations[i]);
+    }
+    outbox->SetLoaded();
     return noError;
 }
 
-error Database::saveTag(
-        Tag *model,
-        std::vector<ModelChange> *changes    ) {
-    poco_assert(model);
-    poco_assert(session);
-
-    if (model->LocalID() && !model->Dirty()) {
+error Database::journalPush(
+        const Poco::UInt64 UID,
+        BaseModel *model,
+        PushOutbox *outbox) {
+    if (model->GUID().empty()) {
         return noError;
     }
-
-    Poco::Mutex::ScopedLock lock(mutex_);
-
     try {
-        if (model->LocalID()) {
-            std::stringstream ss;
-            ss << "Updating tag " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
-
-            if (model->GUID().empty()) {
-                *session << "update tags set "
-                    "id = :id, uid = :uid, name = :name, wid = :wid "
-                    "where local_id = :local_id",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Name()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->LocalID()),
-                    Poco::Data::now;
-            } else {
-                *session << "update tags set "
-                    "id = :id, uid = :uid, name = :name, wid = :wid, "
-                    "guid = :guid "
-                    "where local_id = :local_id",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Name()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->GUID()),
-                    Poco::Data::use(model->LocalID()),
-                    Poco::Data::now;
+        if (model->NeedsPush() && !model->IsMarkedAsDeletedOnServer()) {
+            std::string operation("PUT");
+            if (model->NeedsDELETE()) {
+                operation = "DELETE";
+            } else if (model->NeedsPOST()) {
+                operation = "POST";
             }
-            error err = last_error("saveTag");
-            if (err != noError) {
-              return err;
+            if (!outbox->Put(model->GUID(), model->ModelName(), operation)) {
+                return noError;
             }
-            changes->push_back(ModelChange(
-                model->ModelName(), "update", model->ID(), model->GUID()));
-
+            *session << "INSERT OR REPLACE INTO push_outbox"
+                "(guid, uid, model, operation) "
+                "VALUES(:guid, :uid, :model, :operation)",
+                Poco::Data::use(model->GUID()),
+                Poco::Data::use(UID),
+                Poco::Data::use(model->ModelName()),
+                Poco::Data::use(operation),
+                Poco::Data::now;
         } else {
-            std::stringstream ss;
-            ss << "Inserting tag " + model->String()
-               << " in thread " << Poco::Thread::currentTid();
-            logger().trace(ss.str());
-            if (model->GUID().empty()) {
-                *session << "insert into tags(id, uid, name, wid) "
-                    "values(:id, :uid, :name, :wid)",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Name()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::now;
-            } else {
-                *session << "insert into tags(id, uid, name, wid, guid) "
-                    "values(:id, :uid, :name, :wid, :guid)",
-                    Poco::Data::use(model->ID()),
-                    Poco::Data::use(model->UID()),
-                    Poco::Data::use(model->Name()),
-                    Poco::Data::use(model->WID()),
-                    Poco::Data::use(model->GUID()),
-                    Poco::Data::now;
-            }
-            error err = last_error("saveTag");
-            if (err != noError) {
-                return err;
+            if (!outbox->Remove(model->GUID())) {
+                return noError;
             }
-            Poco::Int64 local_id(0);
-            *session << "select last_insert_rowid()",
-                Poco::Data::into(local_id),
+            *session << "DELETE FROM push_outbox WHERE guid = :guid",
+                Poco::Data::use(model->GUID()),
                 Poco::Data::now;
-            err = last_error("saveTag");
-            if (err != noError) {
-                return err;
-            }
-            model->SetLocalID(local_id);
-            changes->push_back(ModelChange(
-              model->ModelName(), "insert", model->ID(), model->GUID()));
         }
-        model->ClearDirty();
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -1764,9 +4168,71 @@ error Database::saveTag(
     } catch(const std::string& ex) {
         return ex;
     }
+    return last_error("journalPush");
+}
+
+error Database::journalPushes(
+        const Poco::UInt64 UID,
+        const std::vector<Project *> &projects,
+        const std::vector<TimeEntry *> &time_entries,
+        RelatedData *related) {
+    poco_assert(related);
+
+    // Read once per user, then kept up to date by the saves
+    if (!related->Outbox.Loaded()) {
+        error err = loadPushOutbox(UID, &related->Outbox);
+        if (err != noError) {
+            return err;
+        }
+    }
+
+    for (std::vector<Project *>::const_iterator it = projects.begin();
+            it != projects.end(); ++it) {
+        error err = journalPush(UID, *it, &related->Outbox);
+        if (err != noError) {
+            return err;
+        }
+    }
+    for (std::vector<TimeEntry *>::const_iterator it = time_entries.begin();
+            it != time_entries.end(); ++it) {
+        error err = journalPush(UID, *it, &related->Outbox);
+        if (err != noError) {
+            return err;
+        }
+    }
     return noError;
 }
 
+template <class T>
+void purgeDeletedOnServer(
+        RelatedData *related,
+        const std::vector<T *> &saved,
+        std::vector<T *> *list) {
+    bool found(false);
+    for (typename std::vector<T *>::const_iterator it = saved.begin();
+            it != saved.end(); ++it) {
+        if ((*it)->IsMarkedAsDeletedOnServer()) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        return;
+    }
+    // One pass that moves the models that stay to the front
+    typename std::vector<T *>::iterator kept = list->begin();
+    for (typename std::vector<T *>::iterator it = list->begin();
+            it != list->end(); ++it) {
+        T *model = *it;
+        if (model->IsMarkedAsDeletedOnServer()) {
+            related->Untrack(model);
+        } else {
+            *kept++ = model;
+        }
+    }
+    list->erase(kept, list->end());
+}
+
 error Database::SaveUser(
         User *model,
         const bool with_related_data,
@@ -1779,11 +4245,10 @@ error Database::SaveUser(
     poco_assert(session);
     poco_assert(changes);
 
-    {
-        std::stringstream ss;
-        ss << "Saving user in thread " << Poco::Thread::currentTid();
-        logger().trace(ss.str());
-    }
+    TraceSpan trace("Database::SaveUser");
+
+    KOPSIK_LOG_TRACE(logger(), "Saving user in thread "
+        << Poco::Thread::currentTid());
 
     Poco::Stopwatch stopwatch;
     stopwatch.start();
@@ -1798,7 +4263,7 @@ error Database::SaveUser(
         return error("Missing user ID, cannot save user");
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     session->begin();
 
@@ -1808,10 +4273,8 @@ error Database::SaveUser(
     if (!model->LocalID() || model->Dirty()) {
         try {
             if (model->LocalID()) {
-                std::stringstream ss;
-                ss << "Updating user " + model->String()
-                   << " in thread " << Poco::Thread::currentTid();
-                logger().trace(ss.str());
+                KOPSIK_LOG_TRACE(logger(), "Updating user " << model->String()
+                    << " in thread " << Poco::Thread::currentTid());
 
                 *session << "update users set "
                     "api_token = :api_token, default_wid = :default_wid, "
@@ -1834,13 +4297,10 @@ error Database::SaveUser(
                     session->rollback();
                     return err;
                 }
-                changes->push_back(ModelChange(
-                    model->ModelName(), "update", model->ID(), ""));
+                changes->push_back(ModelChange(model, ModelChange::Update));
             } else {
-                std::stringstream ss;
-                ss << "Inserting user " + model->String()
-                   << " in thread " << Poco::Thread::currentTid();
-                logger().trace(ss.str());
+                KOPSIK_LOG_TRACE(logger(), "Inserting user " << model->String()
+                    << " in thread " << Poco::Thread::currentTid());
                 *session << "insert into users("
                     "id, api_token, default_wid, since, fullname, email, "
                     "record_timeline, store_start_and_stop_time"
@@ -1872,8 +4332,7 @@ error Database::SaveUser(
                     return err;
                 }
                 model->SetLocalID(local_id);
-                changes->push_back(ModelChange(
-                    model->ModelName(), "insert", model->ID(), ""));
+                changes->push_back(ModelChange(model, ModelChange::Insert));
             }
             model->ClearDirty();
         } catch(const Poco::Exception& exc) {
@@ -1889,51 +4348,117 @@ error Database::SaveUser(
     }
 
     if (with_related_data) {
-        error err = saveWorkspaces(model->ID(), &model->related.Workspaces,
-            changes);
+        RelatedData *related = &model->related;
+
+        // Models that were not added through RelatedData::Track
+        // may have changed unnoticed, so pick them up first.
+        if (!related->AllTracked()) {
+            related->TrackAll();
+        }
+
+        std::vector<Workspace *> workspaces;
+        std::vector<Client *> clients;
+        std::vector<Project *> projects;
+        std::vector<Task *> tasks;
+        std::vector<Tag *> tags;
+        std::vector<TimeEntry *> time_entries;
+        collectDirtyModels(related, &workspaces, &clients, &projects,
+            &tasks, &tags, &time_entries);
+
+        error err = saveWorkspaces(model->ID(), &workspaces, changes);
+        if (err != noError) {
+            session->rollback();
+            return err;
+        }
+        err = saveClients(model->ID(), &clients, changes);
+        if (err != noError) {
+            session->rollback();
+            return err;
+        }
+        err = saveProjects(model->ID(), &projects, changes);
         if (err != noError) {
             session->rollback();
             return err;
         }
-        err = saveClients(model->ID(), &model->related.Clients, changes);
+        err = saveTasks(model->ID(), &tasks, changes);
         if (err != noError) {
             session->rollback();
             return err;
         }
-        err = saveProjects(model->ID(), &model->related.Projects, changes);
+        err = saveTags(model->ID(), &tags, changes);
         if (err != noError) {
             session->rollback();
             return err;
         }
-        err = saveTasks(model->ID(), &model->related.Tasks, changes);
+        err = saveTimeEntries(model->ID(), &time_entries, changes);
         if (err != noError) {
             session->rollback();
             return err;
         }
-        err = saveTags(model->ID(), &model->related.Tags, changes);
+
+        err = journalPushes(model->ID(), projects, time_entries, related);
         if (err != noError) {
             session->rollback();
+            related->Outbox.Clear();
             return err;
         }
-        err = saveTimeEntries(model->ID(), &model->related.TimeEntries,
-            changes);
+
+        if (!workspaces.empty() || !clients.empty() || !projects.empty()
+                || !tasks.empty() || !tags.empty() || !time_entries.empty()) {
+            err = bumpSnapshotGeneration();
+            if (err != noError) {
+                session->rollback();
+                related->Outbox.Clear();
+                return err;
+            }
+        }
+
+        std::set<std::string> tables;
+        if (!workspaces.empty()) {
+            tables.insert("workspaces");
+        }
+        if (!clients.empty()) {
+            tables.insert("clients");
+        }
+        if (!projects.empty()) {
+            tables.insert("projects");
+        }
+        if (!tasks.empty()) {
+            tables.insert("tasks");
+        }
+        if (!tags.empty()) {
+            tables.insert("tags");
+        }
+        if (!time_entries.empty()) {
+            tables.insert("time_entries");
+        }
+        err = bumpChangeGenerations(tables);
         if (err != noError) {
             session->rollback();
+            related->Outbox.Clear();
             return err;
         }
+
+        // Purge models deleted on server from memory
+        purgeDeletedOnServer(related, projects, &related->Projects);
+        purgeDeletedOnServer(related, time_entries, &related->TimeEntries);
+
+        related->DirtyModels.clear();
     }
 
     session->commit();
 
+    // Everything the journal had is in the database now
+    if (with_related_data) {
+        truncateChangeJournal();
+    }
+
     stopwatch.stop();
+    Metrics::Shared().Time("db.save.user", stopwatch.elapsed());
 
-    {
-        std::stringstream ss;
-        ss  << "User with_related_data=" << with_related_data << " saved in "
-            << stopwatch.elapsed() / 1000 << " ms in thread "
-            << Poco::Thread::currentTid();
-        logger().debug(ss.str());
-    }
+    KOPSIK_LOG_DEBUG(logger(), "User with_related_data=" << with_related_data
+        << " saved in " << stopwatch.elapsed() / 1000 << " ms in thread "
+        << Poco::Thread::currentTid());
 
     return noError;
 }
@@ -1941,41 +4466,11 @@ error Database::SaveUser(
 error Database::initialize_tables() {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
-
-    std::string table_name;
-    // Check if we have migrations table
-    *session <<
-        "select name from sqlite_master "
-        "where type='table' and name='kopsik_migrations'",
-        Poco::Data::into(table_name),
-        Poco::Data::limit(1),
-        Poco::Data::now;
-    error err = last_error("initialize_tables");
-    if (err != noError) {
-        return err;
-    }
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
-    if (table_name.length() == 0) {
-        *session <<
-            "create table kopsik_migrations(id integer primary key, "
-            "name varchar not null)",
-            Poco::Data::now;
-        error err = last_error("initialize_tables");
-        if (err != noError) {
-            return err;
-        }
-        *session <<
-            "CREATE UNIQUE INDEX id_kopsik_migrations_name "
-                "ON kopsik_migrations (name);",
-            Poco::Data::now;
-        err = last_error("initialize_tables");
-        if (err != noError) {
-            return err;
-        }
-    }
+    Migrations migrations;
 
-    err = migrate("users",
+    migrations.push_back(std::make_pair("users",
         "create table users("
         "local_id integer primary key, "
         "id integer not null, "
@@ -1985,37 +4480,22 @@ error Database::initialize_tables() {
         "fullname varchar, "
         "email varchar not null, "
         "record_timeline integer not null default 0"
-        "); ");
-    if (err != noError) {
-        return err;
-    }
+        "); "));
 
-    err = migrate("users.store_start_and_stop_time",
+    migrations.push_back(std::make_pair("users.store_start_and_stop_time",
         "ALTER TABLE users "
-        "ADD COLUMN store_start_and_stop_time INT NOT NULL DEFAULT 0;");
-    if (err != noError) {
-        return err;
-    }
+        "ADD COLUMN store_start_and_stop_time INT NOT NULL DEFAULT 0;"));
 
-    err = migrate("users.id",
-        "CREATE UNIQUE INDEX id_users_id ON users (id);");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("users.id",
+        "CREATE UNIQUE INDEX id_users_id ON users (id);"));
 
-    err = migrate("users.email",
-        "CREATE UNIQUE INDEX id_users_email ON users (email);");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("users.email",
+        "CREATE UNIQUE INDEX id_users_email ON users (email);"));
 
-    err = migrate("users.api_token",
-        "CREATE UNIQUE INDEX id_users_api_token ON users (api_token);");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("users.api_token",
+        "CREATE UNIQUE INDEX id_users_api_token ON users (api_token);"));
 
-    err = migrate("workspaces",
+    migrations.push_back(std::make_pair("workspaces",
         "create table workspaces("
         "local_id integer primary key,"
         "id integer not null, "
@@ -2023,24 +4503,15 @@ error Database::initialize_tables() {
         "name varchar not null,"
         "constraint fk_workspaces_uid foreign key (uid) "
         "   references users(id) on delete no action on update no action"
-        "); ");
-    if (err != noError) {
-        return err;
-    }
+        "); "));
 
-    err = migrate("workspaces.id",
-        "CREATE UNIQUE INDEX id_workspaces_id ON workspaces (uid, id);");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("workspaces.id",
+        "CREATE UNIQUE INDEX id_workspaces_id ON workspaces (uid, id);"));
 
-    err = migrate("workspaces.premium",
-        "alter table workspaces add column premium int default 0");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("workspaces.premium",
+        "alter table workspaces add column premium int default 0"));
 
-    err = migrate("clients",
+    migrations.push_back(std::make_pair("clients",
         "create table clients("
         "local_id integer primary key,"
         "id integer, "  // ID can be null when its not pushed to server yet
@@ -2052,24 +4523,15 @@ error Database::initialize_tables() {
         "   references workpaces(id) on delete no action on update no action,"
         "constraint fk_clients_uid foreign key (uid) "
         "   references users(id) on delete no action on update no action"
-        "); ");
-    if (err != noError) {
-        return err;
-    }
+        "); "));
 
-    err = migrate("clients.id",
-        "CREATE UNIQUE INDEX id_clients_id ON clients (uid, id); ");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("clients.id",
+        "CREATE UNIQUE INDEX id_clients_id ON clients (uid, id); "));
 
-    err = migrate("clients.guid",
-        "CREATE UNIQUE INDEX id_clients_guid ON clients (uid, guid);");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("clients.guid",
+        "CREATE UNIQUE INDEX id_clients_guid ON clients (uid, guid);"));
 
-    err = migrate("projects",
+    migrations.push_back(std::make_pair("projects",
         "create table projects("
         "local_id integer primary key, "
         "id integer, "  // project ID can be null, when its created client side
@@ -2086,30 +4548,18 @@ error Database::initialize_tables() {
         "   references clients(id) on delete no action on update no action,"
         "constraint fk_projects_uid foreign key (uid) "
         "   references users(id) ON DELETE NO ACTION ON UPDATE NO ACTION"
-        "); ");
-    if (err != noError) {
-        return err;
-    }
+        "); "));
 
-    err = migrate("projects.billable",
-        "ALTER TABLE projects ADD billable INT NOT NULL DEFAULT 0");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("projects.billable",
+        "ALTER TABLE projects ADD billable INT NOT NULL DEFAULT 0"));
 
-    err = migrate("projects.id",
-        "CREATE UNIQUE INDEX id_projects_id ON projects (uid, id);");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("projects.id",
+        "CREATE UNIQUE INDEX id_projects_id ON projects (uid, id);"));
 
-    err = migrate("projects.guid",
-        "CREATE UNIQUE INDEX id_projects_guid ON projects (uid, guid);");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("projects.guid",
+        "CREATE UNIQUE INDEX id_projects_guid ON projects (uid, guid);"));
 
-    err = migrate("tasks",
+    migrations.push_back(std::make_pair("tasks",
         "create table tasks("
         "local_id integer primary key, "
         "id integer not null, "
@@ -2123,18 +4573,12 @@ error Database::initialize_tables() {
         "   references projects(id) on delete no action on update no action, "
         "constraint fk_tasks_uid foreign key (uid) "
         "   references users(id) on delete no action on update no action "
-        "); ");
-    if (err != noError) {
-        return err;
-    }
+        "); "));
 
-    err = migrate("tasks.id",
-        "CREATE UNIQUE INDEX id_tasks_id ON tasks (uid, id);");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("tasks.id",
+        "CREATE UNIQUE INDEX id_tasks_id ON tasks (uid, id);"));
 
-    err = migrate("tags",
+    migrations.push_back(std::make_pair("tags",
         "create table tags("
         "local_id integer primary key, "
         "id integer not null, "
@@ -2146,24 +4590,15 @@ error Database::initialize_tables() {
         "   references workspaces(id) on delete no action on update no action,"
         "constraint fk_tags_uid foreign key (uid) "
         "   references users(id) on delete no action on update no action"
-        "); ");
-    if (err != noError) {
-        return err;
-    }
+        "); "));
 
-    err = migrate("tags.id",
-        "CREATE UNIQUE INDEX id_tags_id ON tags (uid, id); ");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("tags.id",
+        "CREATE UNIQUE INDEX id_tags_id ON tags (uid, id); "));
 
-    err = migrate("tags.guid",
-        "CREATE UNIQUE INDEX id_tags_guid ON tags (uid, guid); ");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("tags.guid",
+        "CREATE UNIQUE INDEX id_tags_guid ON tags (uid, guid); "));
 
-    err = migrate("time_entries",
+    migrations.push_back(std::make_pair("time_entries",
         "create table time_entries("
         "local_id integer primary key, "
         "id integer, "  // ID can be null when its not pushed to server yet
@@ -2191,48 +4626,34 @@ error Database::initialize_tables() {
         "   references tasks(id) on delete no action on update no action, "
         "constraint fk_time_entries_uid foreign key (uid) "
         "   references users(id) on delete no action on update no action"
-        "); ");
-    if (err != noError) {
-      return err;
-    }
+        "); "));
 
-    err = migrate("time_entries.id",
-        "CREATE UNIQUE INDEX id_time_entries_id ON time_entries (uid, id); ");
-    if (err != noError) {
-      return err;
-    }
+    migrations.push_back(std::make_pair("time_entries.id",
+        "CREATE UNIQUE INDEX id_time_entries_id ON time_entries (uid, id); "));
 
-    err = migrate("time_entries.guid",
+    migrations.push_back(std::make_pair("time_entries.guid",
         "CREATE UNIQUE INDEX id_time_entries_guid "
-        "   ON time_entries (uid, guid); ");
-    if (err != noError) {
-      return err;
-    }
+        "   ON time_entries (uid, guid); "));
 
-    err = migrate("time_entries.project_guid",
+    migrations.push_back(std::make_pair("time_entries.start",
+        "CREATE INDEX id_time_entries_start "
+        "   ON time_entries (uid, start); "));
+
+    migrations.push_back(std::make_pair("time_entries.project_guid",
         "ALTER TABLE time_entries "
-        "ADD COLUMN project_guid VARCHAR;");
-    if (err != noError) {
-        return err;
-    }
+        "ADD COLUMN project_guid VARCHAR;"));
 
-    err = migrate("sessions",
+    migrations.push_back(std::make_pair("sessions",
         "create table sessions("
         "local_id integer primary key, "
         "api_token varchar not null, "
         "active integer not null default 1 "
-        "); ");
-    if (err != noError) {
-        return err;
-    }
+        "); "));
 
-    err = migrate("sessions.active",
-        "CREATE UNIQUE INDEX id_sessions_active ON sessions (active); ");
-    if (err != noError) {
-        return err;
-    }
+    migrations.push_back(std::make_pair("sessions.active",
+        "CREATE UNIQUE INDEX id_sessions_active ON sessions (active); "));
 
-    err = migrate("settings",
+    migrations.push_back(std::make_pair("settings",
         "create table settings("
         "local_id integer primary key, "
         "use_proxy integer not null default 0, "
@@ -2240,42 +4661,47 @@ error Database::initialize_tables() {
         "proxy_port integer, "
         "proxy_username varchar, "
         "proxy_password varchar, "
-        "use_idle_detection integer not null default 1)");
-    if (err != noError) {
-        return err;
-    }
+        "use_idle_detection integer not null default 1)"));
 
-    err = migrate("settings.update_channel",
+    migrations.push_back(std::make_pair("settings.update_channel",
         "ALTER TABLE settings "
-        "ADD COLUMN update_channel varchar not null default 'stable';");
-    if (err != noError) {
-        return err;
-    }
+        "ADD COLUMN update_channel varchar not null default 'stable';"));
 
-    err = migrate("settings.default",
+    migrations.push_back(std::make_pair("settings.default",
         "INSERT INTO settings(update_channel) "
-        "SELECT 'stable' WHERE NOT EXISTS (SELECT 1 FROM settings LIMIT 1);");
-    if (err != noError) {
-        return err;
-    }
+        "SELECT 'stable' WHERE NOT EXISTS (SELECT 1 FROM settings LIMIT 1);"));
+
+    migrations.push_back(std::make_pair("settings.update_check_url",
+        "ALTER TABLE settings "
+        "ADD COLUMN update_check_url varchar not null default '';"));
+
+    migrations.push_back(std::make_pair("settings.update_check_etag",
+        "ALTER TABLE settings "
+        "ADD COLUMN update_check_etag varchar not null default '';"));
+
+    migrations.push_back(std::make_pair("settings.update_check_last_modified",
+        "ALTER TABLE settings "
+        "ADD COLUMN update_check_last_modified varchar not null default '';"));
+
+    migrations.push_back(std::make_pair("settings.update_check_body",
+        "ALTER TABLE settings "
+        "ADD COLUMN update_check_body varchar not null default '';"));
+
+    migrations.push_back(std::make_pair("settings.snapshot_generation",
+        "ALTER TABLE settings "
+        "ADD COLUMN snapshot_generation integer not null default 0;"));
 
-    err = migrate("timeline_installation",
+    migrations.push_back(std::make_pair("timeline_installation",
         "CREATE TABLE timeline_installation("
         "id INTEGER PRIMARY KEY, "
         "desktop_id VARCHAR NOT NULL"
-        ")");
-    if (err != noError) {
-        return err;
-    }
+        ")"));
 
-    err = migrate("timeline_installation.desktop_id",
+    migrations.push_back(std::make_pair("timeline_installation.desktop_id",
         "CREATE UNIQUE INDEX id_timeline_installation_desktop_id "
-        "ON timeline_installation(desktop_id);");
-    if (err != noError) {
-        return err;
-    }
+        "ON timeline_installation(desktop_id);"));
 
-    err = migrate("timeline_events",
+    migrations.push_back(std::make_pair("timeline_events",
         "CREATE TABLE timeline_events("
         "id INTEGER PRIMARY KEY, "
         "user_id INTEGER NOT NULL, "
@@ -2284,7 +4710,183 @@ error Database::initialize_tables() {
         "start_time INTEGER NOT NULL, "
         "end_time INTEGER, "
         "idle INTEGER NOT NULL"
-        ")");
+        ")"));
+
+    migrations.push_back(std::make_pair("timeline_events.user_id",
+        "CREATE INDEX id_timeline_events_user_id "
+        "ON timeline_events (user_id, id);"));
+
+    migrations.push_back(std::make_pair("change_generations",
+        "CREATE TABLE change_generations("
+        "name VARCHAR NOT NULL PRIMARY KEY, "
+        "generation INTEGER NOT NULL DEFAULT 0"
+        ")"));
+
+    migrations.push_back(std::make_pair("change_generations.tables",
+        "INSERT INTO change_generations(name) VALUES "
+        "('workspaces'), ('clients'), ('projects'), "
+        "('tasks'), ('tags'), ('time_entries');"));
+
+    migrations.push_back(std::make_pair("change_generations.settings",
+        "INSERT INTO change_generations(name) VALUES "
+        "('settings'), ('sessions');"));
+
+    migrations.push_back(std::make_pair("push_outbox",
+        "CREATE TABLE push_outbox("
+        "guid VARCHAR NOT NULL PRIMARY KEY, "
+        "uid INTEGER NOT NULL, "
+        "model VARCHAR NOT NULL, "
+        "operation VARCHAR NOT NULL"
+        ")"));
+
+    migrations.push_back(std::make_pair("push_outbox.uid",
+        "CREATE INDEX id_push_outbox_uid ON push_outbox (uid);"));
+
+    // What was waiting to be pushed before there was an outbox
+    migrations.push_back(std::make_pair("push_outbox.time_entries",
+        "INSERT OR REPLACE INTO push_outbox(guid, uid, model, operation) "
+        "SELECT guid, uid, 'time_entry', "
+        "CASE WHEN ifnull(deleted_at, 0) > 0 THEN 'DELETE' "
+        "WHEN ifnull(id, 0) = 0 THEN 'POST' ELSE 'PUT' END "
+        "FROM time_entries WHERE guid IS NOT NULL AND ("
+        "(ifnull(deleted_at, 0) > 0 AND ifnull(id, 0) > 0) "
+        "OR (ifnull(deleted_at, 0) = 0 "
+        "AND (ifnull(id, 0) = 0 OR ifnull(ui_modified_at, 0) > 0)));"));
+
+    migrations.push_back(std::make_pair("push_outbox.projects",
+        "INSERT OR REPLACE INTO push_outbox(guid, uid, model, operation) "
+        "SELECT guid, uid, 'project', 'POST' "
+        "FROM projects WHERE guid IS NOT NULL AND ifnull(id, 0) = 0;"));
+
+    // Words of time entry descriptions, for searching them. The entries
+    // saved before are indexed on first search.
+    migrations.push_back(std::make_pair("time_entry_words",
+        "CREATE TABLE time_entry_words("
+        "word VARCHAR NOT NULL, "
+        "local_id INTEGER NOT NULL, "
+        "PRIMARY KEY (word, local_id)"
+        ")"));
+
+    migrations.push_back(std::make_pair("time_entry_words.local_id",
+        "CREATE INDEX id_time_entry_words_local_id "
+        "ON time_entry_words (local_id);"));
+
+    migrations.push_back(std::make_pair("time_entry_words.delete",
+        "CREATE TRIGGER time_entry_words_delete "
+        "AFTER DELETE ON time_entries BEGIN "
+        "DELETE FROM time_entry_words WHERE local_id = old.local_id; "
+        "END;"));
+
+    // Timeline events refer to their app filename and window title by
+    // ID, as the same few of them are recorded over and over. The text
+    // columns are left empty, SQLite can't drop them.
+    migrations.push_back(std::make_pair("timeline_apps",
+        "CREATE TABLE timeline_apps("
+        "id INTEGER PRIMARY KEY, "
+        "filename VARCHAR NOT NULL"
+        ")"));
+
+    migrations.push_back(std::make_pair("timeline_apps.filename",
+        "CREATE UNIQUE INDEX id_timeline_apps_filename "
+        "ON timeline_apps (filename);"));
+
+    migrations.push_back(std::make_pair("timeline_titles",
+        "CREATE TABLE timeline_titles("
+        "id INTEGER PRIMARY KEY, "
+        "title VARCHAR NOT NULL"
+        ")"));
+
+    migrations.push_back(std::make_pair("timeline_titles.title",
+        "CREATE UNIQUE INDEX id_timeline_titles_title "
+        "ON timeline_titles (title);"));
+
+    migrations.push_back(std::make_pair("timeline_events.app_id",
+        "ALTER TABLE timeline_events "
+        "ADD COLUMN app_id INTEGER NOT NULL DEFAULT 0;"));
+
+    migrations.push_back(std::make_pair("timeline_events.title_id",
+        "ALTER TABLE timeline_events "
+        "ADD COLUMN title_id INTEGER NOT NULL DEFAULT 0;"));
+
+    migrations.push_back(std::make_pair("timeline_apps.events",
+        "INSERT OR IGNORE INTO timeline_apps(filename) "
+        "SELECT DISTINCT filename FROM timeline_events "
+        "WHERE ifnull(filename, '') <> '';"));
+
+    migrations.push_back(std::make_pair("timeline_titles.events",
+        "INSERT OR IGNORE INTO timeline_titles(title) "
+        "SELECT DISTINCT title FROM timeline_events "
+        "WHERE ifnull(title, '') <> '';"));
+
+    migrations.push_back(std::make_pair("timeline_events.dictionary_ids",
+        "UPDATE timeline_events SET "
+        "app_id = ifnull((SELECT id FROM timeline_apps "
+        "WHERE filename = timeline_events.filename), 0), "
+        "title_id = ifnull((SELECT id FROM timeline_titles "
+        "WHERE title = timeline_events.title), 0), "
+        "filename = NULL, title = NULL;"));
+
+    migrations.push_back(std::make_pair("settings.time_entry_words_indexed",
+        "ALTER TABLE settings "
+        "ADD COLUMN time_entry_words_indexed INTEGER NOT NULL DEFAULT 0;"));
+
+    // Old closed time entries, a deflated blob per user and month,
+    // see TimeEntryArchive. since and until bound the starts in it.
+    migrations.push_back(std::make_pair("time_entries_archive",
+        "CREATE TABLE time_entries_archive("
+        "uid INTEGER NOT NULL, "
+        "month INTEGER NOT NULL, "
+        "since INTEGER NOT NULL, "
+        "until INTEGER NOT NULL, "
+        "entries INTEGER NOT NULL, "
+        "data BLOB NOT NULL, "
+        "PRIMARY KEY (uid, month)"
+        ")"));
+
+    // Periods the server's time entries were downloaded for,
+    // see SaveTimeEntryFetch
+    migrations.push_back(std::make_pair("time_entry_fetches",
+        "CREATE TABLE time_entry_fetches("
+        "uid INTEGER NOT NULL, "
+        "since INTEGER NOT NULL, "
+        "until INTEGER NOT NULL"
+        ")"));
+
+    // Which process sharing the file does upkeep, see Maintain
+    migrations.push_back(std::make_pair("maintenance_lease",
+        "CREATE TABLE maintenance_lease("
+        "id INTEGER PRIMARY KEY, "
+        "holder VARCHAR NOT NULL, "
+        "until INTEGER NOT NULL"
+        ")"));
+
+    // How far an interrupted full sync got, see SaveSyncCheckpoint
+    migrations.push_back(std::make_pair("sync_checkpoints",
+        "CREATE TABLE sync_checkpoints("
+        "uid INTEGER PRIMARY KEY, "
+        "started INTEGER NOT NULL, "
+        "since INTEGER NOT NULL, "
+        "time_entries_since INTEGER NOT NULL, "
+        "time_entries_until INTEGER NOT NULL"
+        ")"));
+    migrations.push_back(std::make_pair("sync_checkpoint_pieces",
+        "CREATE TABLE sync_checkpoint_pieces("
+        "uid INTEGER NOT NULL, "
+        "wid INTEGER NOT NULL, "
+        "since INTEGER NOT NULL, "
+        "until INTEGER NOT NULL"
+        ")"));
+
+    migrations.push_back(std::make_pair("timeline_blocks",
+        "CREATE TABLE timeline_blocks("
+        "id INTEGER PRIMARY KEY, "
+        "user_id INTEGER NOT NULL, "
+        "events INTEGER NOT NULL, "
+        "json_size INTEGER NOT NULL, "
+        "data BLOB NOT NULL"
+        ")"));
+
+    error err = migrate(migrations);
     if (err != noError) {
         return err;
     }
@@ -2309,11 +4911,11 @@ error Database::CurrentAPIToken(std::string *token) {
     poco_assert(session);
     poco_assert(token);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
 
     *token = "";
     try {
-        *session << "select api_token from sessions",
+        *reader() << "select api_token from sessions",
             Poco::Data::into(*token),
             Poco::Data::limit(1),
             Poco::Data::now;
@@ -2324,13 +4926,13 @@ error Database::CurrentAPIToken(std::string *token) {
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("CurrentAPIToken");
+    return reader_last_error("CurrentAPIToken");
 }
 
 error Database::ClearCurrentAPIToken() {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
         *session << "delete from sessions", Poco::Data::now;
@@ -2341,13 +4943,17 @@ error Database::ClearCurrentAPIToken() {
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("ClearCurrentAPIToken");
+    error err = last_error("ClearCurrentAPIToken");
+    if (err != noError) {
+        return err;
+    }
+    return bumpChangeGeneration("sessions");
 }
 
 error Database::SetCurrentAPIToken(const std::string &token) {
     poco_assert(session);
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     error err = ClearCurrentAPIToken();
     if (err != noError) {
@@ -2364,18 +4970,45 @@ error Database::SetCurrentAPIToken(const std::string &token) {
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("SetCurrentAPIToken");
+    err = last_error("SetCurrentAPIToken");
+    if (err != noError) {
+        return err;
+    }
+    return bumpChangeGeneration("sessions");
+}
+
+error Database::SaveDesktopID() {
+    poco_assert(session);
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        *session << "INSERT INTO timeline_installation(desktop_id) "
+            "VALUES(:desktop_id)",
+            Poco::Data::use(desktop_id_),
+            Poco::Data::now;
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("SaveDesktopID");
 }
 
-error Database::SaveDesktopID() {
+error Database::migrate(const Migrations &migrations) {
     poco_assert(session);
+    poco_assert(!migrations.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
+    // Schema version is the number of migrations run, so an up to
+    // date database costs one read at startup
+    int version(0);
     try {
-        *session << "INSERT INTO timeline_installation(desktop_id) "
-            "VALUES(:desktop_id)",
-            Poco::Data::use(desktop_id_),
+        *session << "PRAGMA user_version",
+            Poco::Data::into(version),
             Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
@@ -2384,44 +5017,61 @@ error Database::SaveDesktopID() {
     } catch(const std::string& ex) {
         return ex;
     }
-    return last_error("SaveDesktopID");
-}
+    error err = last_error("migrate");
+    if (err != noError) {
+        return err;
+    }
+    if (version == static_cast<int>(migrations.size())) {
+        return noError;
+    }
 
-error Database::migrate(
-        const std::string name,
-        const std::string sql) {
-    poco_assert(session);
-    poco_assert(!name.empty());
-    poco_assert(!sql.empty());
+    KOPSIK_LOG_DEBUG(logger(), "Migrating database from schema version "
+        << version << " to " << migrations.size());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    session->begin();
+    err = runMigrations(migrations);
+    if (err != noError) {
+        session->rollback();
+        return err;
+    }
+    session->commit();
+    return noError;
+}
 
+error Database::runMigrations(const Migrations &migrations) {
     try {
-        int count = 0;
-        *session << "select count(*) from kopsik_migrations where name=:name",
-            Poco::Data::into(count),
-            Poco::Data::use(name),
+        *session <<
+            "create table if not exists kopsik_migrations("
+            "id integer primary key, "
+            "name varchar not null)",
+            Poco::Data::now;
+        *session <<
+            "CREATE UNIQUE INDEX IF NOT EXISTS id_kopsik_migrations_name "
+                "ON kopsik_migrations (name);",
             Poco::Data::now;
-        error err = last_error("migrate");
-        if (err != noError) {
-            return err;
-        }
 
-        if (count < 1) {
-            *session << sql, Poco::Data::now;
-            err = last_error("migrate");
-            if (err != noError) {
-                return err;
-            }
+        // Names stay the record of what has been run, as databases
+        // from before the schema version have only them
+        std::vector<std::string> names;
+        *session << "select name from kopsik_migrations",
+            Poco::Data::into(names),
+            Poco::Data::now;
+        std::set<std::string> done(names.begin(), names.end());
 
+        for (Migrations::const_iterator it = migrations.begin();
+                it != migrations.end(); it++) {
+            if (done.count(it->first)) {
+                continue;
+            }
+            *session << it->second, Poco::Data::now;
             *session << "insert into kopsik_migrations(name) values(:name)",
-                Poco::Data::use(name),
+                Poco::Data::use(it->first),
                 Poco::Data::now;
-            err = last_error("migrate");
-            if (err != noError) {
-                return err;
-            }
         }
+
+        std::stringstream ss;
+        ss << "PRAGMA user_version = " << migrations.size();
+        *session << ss.str(), Poco::Data::now;
     } catch(const Poco::Exception& exc) {
         return exc.displayText();
     } catch(const std::exception& ex) {
@@ -2429,140 +5079,662 @@ error Database::migrate(
     } catch(const std::string& ex) {
         return ex;
     }
-    return noError;
+    return last_error("runMigrations");
 }
 
 error Database::select_timeline_batch(
         const Poco::UInt64 user_id,
+        const unsigned int limit,
+        const unsigned int after_id,
         std::vector<TimelineEvent> *timeline_events) {
-    std::stringstream out;
-    out << "select_batch, user_id = " << user_id;
-    logger().debug(out.str());
+    KOPSIK_LOG_DEBUG(logger(), "select_batch, user_id = " << user_id
+        << ", limit = " << limit << ", after_id = " << after_id);
 
     poco_assert(user_id > 0);
+    poco_assert(limit > 0);
     poco_assert(timeline_events->empty());
     if (!session) {
         logger().warning("select_batch database is not open, ignoring request");
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
 
-    Poco::Data::Statement select(*session);
-    select << "SELECT id, title, filename, start_time, end_time, idle "
-        "FROM timeline_events WHERE user_id = :user_id "
-        "LIMIT 100",
-        Poco::Data::use(user_id);
-    Poco::Data::RecordSet rs(select);
-    while (!select.done()) {
-        select.execute();
-        bool more = rs.moveFirst();
-        while (more) {
+    // Poco throws when a step fails. The connection's last error is not
+    // checked afterwards: with the statement left on a row (it's only
+    // stepped up to the limit) SQLite reports it as "unknown error".
+    try {
+        Poco::Data::Statement select(*reader());
+        select << "SELECT e.id, ifnull(t.title, ''), "
+            "ifnull(a.filename, ''), e.start_time, e.end_time, e.idle "
+            "FROM timeline_events e "
+            "LEFT JOIN timeline_titles t ON t.id = e.title_id "
+            "LEFT JOIN timeline_apps a ON a.id = e.app_id "
+            "WHERE e.user_id = :user_id AND e.id > :after_id "
+            "ORDER BY e.id "
+            "LIMIT :limit",
+            Poco::Data::use(user_id),
+            Poco::Data::use(after_id),
+            Poco::Data::use(limit);
+        unsigned int id(0);
+        std::string title("");
+        std::string filename("");
+        int start_time(0);
+        int end_time(0);
+        bool idle(false);
+        select,
+            Poco::Data::into(id),
+            Poco::Data::into(title),
+            Poco::Data::into(filename),
+            Poco::Data::into(start_time),
+            Poco::Data::into(end_time),
+            Poco::Data::into(idle),
+            Poco::Data::limit(1);
+        StringTable &strings = StringTable::Timeline();
+        while (!select.done()) {
+            if (!select.execute()) {
+                break;
+            }
             TimelineEvent event;
-            event.id = rs[0].convert<unsigned int>();
-            event.title = rs[1].convert<std::string>();
-            event.filename = rs[2].convert<std::string>();
-            event.start_time = rs[3].convert<int>();
-            event.end_time = rs[4].convert<int>();
-            event.idle = rs[5].convert<bool>();
+            event.id = id;
+            event.title = strings.Intern(title);
+            event.filename = strings.Intern(filename);
+            event.start_time = start_time;
+            event.end_time = end_time;
+            event.idle = idle;
             event.user_id = static_cast<unsigned int>(user_id);
             timeline_events->push_back(event);
-            more = rs.moveNext();
         }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
     }
 
-    std::stringstream event_count;
-    event_count << "select_batch found " << timeline_events->size()
-        <<  " events.";
-    logger().debug(event_count.str());
+    KOPSIK_LOG_DEBUG(logger(), "select_batch found "
+        << timeline_events->size() << " events.");
 
-    return last_error("select_timeline_batch");
+    return noError;
 }
 
 error Database::insert_timeline_event(const TimelineEvent& event) {
-    std::stringstream out;
-    out << "insert " << event.start_time << ";" << event.end_time << ";"
-        << event.filename << ";" << event.title;
-    logger().debug(out.str());
+    KOPSIK_LOG_DEBUG(logger(), "insert " << event.start_time << ";"
+        << event.end_time << ";" << *event.filename << ";" << *event.title);
 
     poco_assert(event.user_id > 0);
     poco_assert(event.start_time > 0);
     poco_assert(event.end_time > 0);
+
+    bool flush(false);
+    {
+        Poco::Mutex::ScopedLock lock(timeline_events_buffer_m_);
+        if (timeline_rollups_) {
+            timeline_rollup_.Add(event);
+            Metrics::Shared().Count("timeline.events_rolled_up");
+            return noError;
+        }
+        if (coalesce_timeline_event(event)) {
+            return noError;
+        }
+        if (timeline_events_buffer_.empty()) {
+            timeline_events_buffered_at_ = time(0);
+        }
+        timeline_events_buffer_.push_back(event);
+        Metrics::Shared().Count("timeline.events_queued");
+        flush = timeline_events_buffer_.size() >= kTimelineEventsFlushCount
+            || time(0) - timeline_events_buffered_at_
+                >= kTimelineEventsFlushSeconds;
+    }
+    if (flush) {
+        return FlushTimelineEvents();
+    }
+    return noError;
+}
+
+// Switching back and forth between windows records the same windows
+// over and over, so the latest buffered event of the same window is
+// extended instead, if it ended recently enough.
+bool Database::coalesce_timeline_event(const TimelineEvent& event) {
+    for (std::deque<TimelineEvent>::reverse_iterator it =
+                timeline_events_buffer_.rbegin();
+            it != timeline_events_buffer_.rend();
+            ++it) {
+        if (event.start_time - it->end_time
+                > static_cast<time_t>(timeline_coalesce_seconds_)) {
+            return false;
+        }
+        if (it->user_id == event.user_id
+                && it->idle == event.idle
+                && *it->filename == *event.filename
+                && *it->title == *event.title) {
+            it->end_time = std::max(it->end_time, event.end_time);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::size_t Database::TimelineBufferBytes() {
+    Poco::Mutex::ScopedLock lock(timeline_events_buffer_m_);
+    return timeline_events_buffer_.size() * sizeof(TimelineEvent)
+        + timeline_rollup_.MemoryBytes();
+}
+
+void Database::SetTimelineRollups(const bool value) {
+    Poco::Mutex::ScopedLock lock(timeline_events_buffer_m_);
+    if (!value && !timeline_rollup_.Empty()) {
+        std::vector<TimelineEvent> events;
+        timeline_rollup_.TakeAll(&events);
+        if (timeline_events_buffer_.empty()) {
+            timeline_events_buffered_at_ = time(0);
+        }
+        timeline_events_buffer_.insert(timeline_events_buffer_.end(),
+                                       events.begin(), events.end());
+    }
+    timeline_rollups_ = value;
+}
+
+void Database::SetTimelineBlocks(const bool value) {
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+    timeline_blocks_ = value;
+}
+
+error Database::FlushTimelineEvents() {
+    std::vector<TimelineEvent> events;
+    {
+        Poco::Mutex::ScopedLock lock(timeline_events_buffer_m_);
+        events.assign(timeline_events_buffer_.begin(),
+                      timeline_events_buffer_.end());
+        timeline_events_buffer_.clear();
+        timeline_rollup_.TakeFinished(time(0), &events);
+    }
+    if (events.empty()) {
+        return noError;
+    }
+
+    error err = insert_timeline_events(events);
+    if (err != noError) {
+        // Keep the events for next flush, but drop the oldest
+        // ones if the database has been failing for a while.
+        Poco::Mutex::ScopedLock lock(timeline_events_buffer_m_);
+        timeline_events_buffer_.insert(timeline_events_buffer_.begin(),
+                                       events.begin(), events.end());
+        while (timeline_events_buffer_.size() > kTimelineEventsBufferMax) {
+            timeline_events_buffer_.pop_front();
+        }
+        timeline_events_buffered_at_ = time(0);
+        return err;
+    }
+
+    std::set<Poco::UInt64> user_ids;
+    for (std::vector<TimelineEvent>::const_iterator it = events.begin();
+            it != events.end();
+            it++) {
+        user_ids.insert(it->user_id);
+    }
+    for (std::set<Poco::UInt64>::const_iterator it = user_ids.begin();
+            it != user_ids.end();
+            it++) {
+        err = pack_timeline_blocks(*it);
+        if (err != noError) {
+            logger().error(err);
+        }
+    }
+    return noError;
+}
+
+error Database::insert_timeline_events(
+        const std::vector<TimelineEvent> &events) {
+    KOPSIK_LOG_DEBUG(logger(), "insert_timeline_events " << events.size()
+        << " events.");
+
     if (!session) {
         logger().warning("insert database is not open, ignoring request");
         return noError;
     }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    session->begin();
+    try {
+        TimelineEvent row;
+        Poco::Int64 app_id(0);
+        Poco::Int64 title_id(0);
+        Poco::Data::Statement insert(*session);
+        insert << "INSERT INTO timeline_events("
+            "user_id, app_id, title_id, start_time, end_time, idle"
+            ") VALUES ("
+            ":user_id, :app_id, :title_id, :start_time, :end_time, :idle"
+            ")",
+            Poco::Data::use(row.user_id),
+            Poco::Data::use(app_id),
+            Poco::Data::use(title_id),
+            Poco::Data::use(row.start_time),
+            Poco::Data::use(row.end_time),
+            Poco::Data::use(row.idle);
+        for (std::vector<TimelineEvent>::const_iterator it = events.begin();
+                it != events.end();
+                it++) {
+            row = *it;
+            app_id = timelineDictionaryID("timeline_apps", "filename",
+                                          *row.filename, &timeline_app_ids_);
+            title_id = timelineDictionaryID("timeline_titles", "title",
+                                            *row.title, &timeline_title_ids_);
+            insert.execute();
+        }
+    } catch(const Poco::Exception& exc) {
+        session->rollback();
+        forgetTimelineDictionaryIDs();
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        session->rollback();
+        forgetTimelineDictionaryIDs();
+        return ex.what();
+    } catch(const std::string& ex) {
+        session->rollback();
+        forgetTimelineDictionaryIDs();
+        return ex;
+    }
+    session->commit();
+    return noError;
+}
+
+// 0 for an empty value, so events without a title or filename
+// need no row for it. Must be called with mutex_ locked.
+Poco::Int64 Database::timelineDictionaryID(
+        const std::string &table,
+        const std::string &column,
+        const std::string &value,
+        std::map<std::string, Poco::Int64> *ids) {
+    if (value.empty()) {
+        return 0;
+    }
+    std::map<std::string, Poco::Int64>::const_iterator it = ids->find(value);
+    if (it != ids->end()) {
+        return it->second;
+    }
+
+    *session << "INSERT OR IGNORE INTO " + table + "(" + column + ") "
+        "VALUES (:value)",
+        Poco::Data::use(value),
+        Poco::Data::now;
+    Poco::Int64 id(0);
+    *session << "SELECT id FROM " + table + " WHERE " + column + " = :value",
+        Poco::Data::into(id),
+        Poco::Data::use(value),
+        Poco::Data::now;
+
+    if (ids->size() >= kTimelineDictionaryCacheMax) {
+        ids->clear();
+    }
+    (*ids)[value] = id;
+    return id;
+}
+
+error Database::count_timeline_backlog(
+        const Poco::UInt64 user_id,
+        const unsigned int after_id,
+        Poco::UInt64 *count) {
+    poco_assert(user_id > 0);
+    poco_assert(count);
+    *count = 0;
+    if (!session) {
+        return noError;
+    }
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
 
-    *session << "INSERT INTO timeline_events("
-        "user_id, title, filename, start_time, end_time, idle"
-        ") VALUES ("
-        ":user_id, :title, :filename, :start_time, :end_time, :idle"
-        ")",
-        Poco::Data::use(event.user_id),
-        Poco::Data::use(event.title),
-        Poco::Data::use(event.filename),
-        Poco::Data::use(event.start_time),
-        Poco::Data::use(event.end_time),
-        Poco::Data::use(event.idle),
+    Poco::UInt64 n(0);
+    *reader() << "SELECT COUNT(*) FROM timeline_events "
+        "WHERE user_id = :user_id AND id > :after_id",
+        Poco::Data::into(n),
+        Poco::Data::use(user_id),
+        Poco::Data::use(after_id),
         Poco::Data::now;
-    return last_error("insert_timeline_event");
+    *count = n;
+    return reader_last_error("count_timeline_backlog");
 }
 
 error Database::delete_timeline_batch(
-        const std::vector<TimelineEvent> &timeline_events) {
-    std::stringstream out;
-    out << "delete_batch " << timeline_events.size() << " events.";
-    logger().debug(out.str());
+        const Poco::UInt64 user_id,
+        const unsigned int first_id,
+        const unsigned int last_id) {
+    KOPSIK_LOG_DEBUG(logger(), "delete_batch " << first_id << "-" << last_id);
 
-    poco_assert(!timeline_events.empty());
+    poco_assert(first_id <= last_id);
     if (!session) {
         logger().warning("delete_batch database is not open, ignoring request");
         return noError;
     }
-    std::vector<int> ids;
-    for (std::vector<TimelineEvent>::const_iterator i = timeline_events.begin();
-            i != timeline_events.end();
-            ++i) {
-        const TimelineEvent &event = *i;
-        ids.push_back(event.id);
-    }
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
-    *session << "DELETE FROM timeline_events WHERE id = :id",
-        Poco::Data::use(ids),
+    // Batches are selected as a range of IDs and SQLite gives new rows
+    // an ID above the highest one, so the whole range was uploaded.
+    *session << "DELETE FROM timeline_events WHERE user_id = :user_id "
+        "AND id >= :first_id AND id <= :last_id",
+        Poco::Data::use(user_id),
+        Poco::Data::use(first_id),
+        Poco::Data::use(last_id),
         Poco::Data::now;
+    error err = last_error("delete_timeline_batch");
+    if (err != noError) {
+        return err;
+    }
+
+    prune_timeline_dictionaries();
     return last_error("delete_timeline_batch");
 }
 
+// Titles and apps of uploaded or packed events that are not
+// recorded again would otherwise pile up for good.
+// Must be called with mutex_ locked.
+void Database::prune_timeline_dictionaries() {
+    *session << "DELETE FROM timeline_titles WHERE id NOT IN "
+        "(SELECT title_id FROM timeline_events)",
+        Poco::Data::now;
+    *session << "DELETE FROM timeline_apps WHERE id NOT IN "
+        "(SELECT app_id FROM timeline_events)",
+        Poco::Data::now;
+    forgetTimelineDictionaryIDs();
+}
+
+// Each block replaces its events in one transaction, so an event is
+// either a row or in a block, never both and never neither.
+error Database::pack_timeline_blocks(const Poco::UInt64 user_id) {
+    if (!session) {
+        return noError;
+    }
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    if (!timeline_blocks_) {
+        return noError;
+    }
+
+    Poco::UInt64 waiting(0);
+    error err = count_timeline_backlog(user_id, timeline_selected_until_,
+                                       &waiting);
+    if (err != noError) {
+        return err;
+    }
+    if (waiting <= 2 * kTimelineBlockEvents) {
+        return noError;
+    }
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(session->impl());
+    sqlite3 *db = sqlite->db();
+
+    Poco::UInt64 packed(0);
+    Poco::UInt64 dropped(0);
+    while (waiting > 2 * kTimelineBlockEvents && err == noError) {
+        std::vector<TimelineEvent> events;
+        err = select_timeline_batch(user_id, kTimelineBlockEvents,
+                                    timeline_selected_until_, &events);
+        if (err != noError || events.empty()) {
+            break;
+        }
+
+        std::string json =
+            TimelineUploader::convert_timeline_to_json(events, desktop_id_);
+        std::string data("");
+        try {
+            std::ostringstream out;
+            Poco::DeflatingOutputStream gzip(out,
+                Poco::DeflatingStreamBuf::STREAM_GZIP, Z_BEST_COMPRESSION);
+            gzip.write(json.data(), json.size());
+            gzip.close();
+            data = out.str();
+        } catch(const Poco::Exception& exc) {
+            err = exc.displayText();
+            break;
+        }
+
+        session->begin();
+        try {
+            // Oldest block goes first when there's no room for this one
+            Poco::UInt64 blocks(0);
+            *session << "SELECT COUNT(*) FROM timeline_blocks "
+                "WHERE user_id = :user_id",
+                Poco::Data::into(blocks),
+                Poco::Data::use(user_id),
+                Poco::Data::now;
+            if (blocks >= kTimelineBlocksMax) {
+                Poco::UInt64 events_dropped(0);
+                *session << "SELECT events FROM timeline_blocks "
+                    "WHERE user_id = :user_id ORDER BY id LIMIT 1",
+                    Poco::Data::into(events_dropped),
+                    Poco::Data::use(user_id),
+                    Poco::Data::now;
+                *session << "DELETE FROM timeline_blocks WHERE id = "
+                    "(SELECT MIN(id) FROM timeline_blocks "
+                    "WHERE user_id = :user_id)",
+                    Poco::Data::use(user_id),
+                    Poco::Data::now;
+                dropped += events_dropped;
+            }
+
+            sqlite3_stmt *stmt(0);
+            if (sqlite3_prepare_v2(db,
+                    "INSERT INTO timeline_blocks"
+                    "(user_id, events, json_size, data) VALUES(?, ?, ?, ?)",
+                    -1, &stmt, 0) != SQLITE_OK) {
+                throw Poco::Exception(sqlite3_errmsg(db));
+            }
+            sqlite3_bind_int64(stmt, 1, user_id);
+            sqlite3_bind_int64(stmt, 2, events.size());
+            sqlite3_bind_int64(stmt, 3, json.size());
+            sqlite3_bind_blob(stmt, 4, data.data(),
+                              static_cast<int>(data.size()), SQLITE_STATIC);
+            int rc = sqlite3_step(stmt);
+            sqlite3_finalize(stmt);
+            if (rc != SQLITE_DONE) {
+                throw Poco::Exception(sqlite3_errmsg(db));
+            }
+
+            unsigned int first_id = events.front().id;
+            unsigned int last_id = events.back().id;
+            *session << "DELETE FROM timeline_events WHERE user_id = :user_id "
+                "AND id >= :first_id AND id <= :last_id",
+                Poco::Data::use(user_id),
+                Poco::Data::use(first_id),
+                Poco::Data::use(last_id),
+                Poco::Data::now;
+        } catch(const Poco::Exception& exc) {
+            session->rollback();
+            err = exc.displayText();
+            break;
+        } catch(const std::exception& ex) {
+            session->rollback();
+            err = ex.what();
+            break;
+        }
+        session->commit();
+
+        packed += events.size();
+        waiting -= std::min(waiting, static_cast<Poco::UInt64>(events.size()));
+    }
+
+    if (packed) {
+        prune_timeline_dictionaries();
+        Metrics::Shared().Count("timeline.events_packed", packed);
+    }
+    if (dropped) {
+        std::stringstream ss;
+        ss << "Dropped " << dropped << " timeline event(s) of user "
+           << user_id << " that could not be uploaded in time";
+        logger().warning(ss.str());
+        Metrics::Shared().Count("timeline.events_dropped", dropped);
+    }
+    if (err != noError) {
+        return err;
+    }
+    return last_error("pack_timeline_blocks");
+}
+
+error Database::select_timeline_block(
+        const Poco::UInt64 user_id,
+        Poco::Int64 *block_id,
+        unsigned int *events,
+        Poco::UInt64 *json_size,
+        std::string *block,
+        Poco::UInt64 *later) {
+    poco_assert(block_id);
+    poco_assert(events);
+    poco_assert(json_size);
+    poco_assert(block);
+    poco_assert(later);
+    *block_id = 0;
+    *later = 0;
+    if (!session) {
+        return noError;
+    }
+
+    InstrumentedMutex::ScopedLock lock(readerMutex(), __FUNCTION__);
+
+    Poco::Data::SQLite::SessionImpl* sqlite =
+        static_cast<Poco::Data::SQLite::SessionImpl*>(reader()->impl());
+    sqlite3 *db = sqlite->db();
+
+    sqlite3_stmt *stmt(0);
+    if (sqlite3_prepare_v2(db,
+            "SELECT id, events, json_size, data FROM timeline_blocks "
+            "WHERE user_id = ? ORDER BY id LIMIT 1",
+            -1, &stmt, 0) != SQLITE_OK) {
+        return error(sqlite3_errmsg(db));
+    }
+    sqlite3_bind_int64(stmt, 1, user_id);
+    error err = noError;
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        *block_id = sqlite3_column_int64(stmt, 0);
+        *events = static_cast<unsigned int>(sqlite3_column_int64(stmt, 1));
+        *json_size = sqlite3_column_int64(stmt, 2);
+        block->assign(
+            static_cast<const char *>(sqlite3_column_blob(stmt, 3)),
+            sqlite3_column_bytes(stmt, 3));
+    } else if (rc != SQLITE_DONE) {
+        err = error(sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+    if (err != noError || !*block_id) {
+        return err;
+    }
+
+    Poco::UInt64 n(0);
+    *reader() << "SELECT ifnull(SUM(events), 0) FROM timeline_blocks "
+        "WHERE user_id = :user_id AND id > :block_id",
+        Poco::Data::into(n),
+        Poco::Data::use(user_id),
+        Poco::Data::use(*block_id),
+        Poco::Data::now;
+    *later = n;
+    return reader_last_error("select_timeline_block");
+}
+
+error Database::delete_timeline_block(
+        const Poco::UInt64 user_id,
+        const Poco::Int64 block_id) {
+    KOPSIK_LOG_DEBUG(logger(), "delete_block " << block_id);
+
+    if (!session) {
+        logger().warning("delete_block database is not open, ignoring request");
+        return noError;
+    }
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    *session << "DELETE FROM timeline_blocks WHERE user_id = :user_id "
+        "AND id = :id",
+        Poco::Data::use(user_id),
+        Poco::Data::use(block_id),
+        Poco::Data::now;
+    return last_error("delete_timeline_block");
+}
+
 void Database::handleTimelineEventNotification(
         TimelineEventNotification* notification) {
+    Poco::AutoPtr<TimelineEventNotification> ptr(notification);
     logger().debug("handleTimelineEventNotification");
     insert_timeline_event(notification->event);
 }
 
 void Database::handleCreateTimelineBatchNotification(
         CreateTimelineBatchNotification* notification) {
+    Poco::AutoPtr<CreateTimelineBatchNotification> ptr(notification);
     logger().debug("handleCreateTimelineBatchNotification");
+    error err = FlushTimelineEvents();
+    if (err != noError) {
+        logger().error(err);
+    }
+
+    // Blocks are older than the events left, so they go first
+    Poco::Int64 block_id(0);
+    unsigned int block_events(0);
+    Poco::UInt64 json_size(0);
+    std::string block("");
+    Poco::UInt64 backlog(0);
+    err = select_timeline_block(notification->user_id, &block_id,
+        &block_events, &json_size, &block, &backlog);
+    if (err != noError) {
+        logger().error(err);
+    }
+    if (block_id) {
+        Poco::UInt64 waiting(0);
+        err = count_timeline_backlog(notification->user_id,
+            notification->after_id, &waiting);
+        if (err != noError) {
+            logger().error(err);
+        }
+        TimelineDispatcher::Instance().Post(new TimelineBlockReadyNotification(
+            notification->user_id, block_id, block_events, json_size, &block,
+            backlog + waiting), notifications_);
+        return;
+    }
+
     std::vector<TimelineEvent> batch;
-    select_timeline_batch(notification->user_id, &batch);
+    err = select_timeline_batch(notification->user_id,
+        notification->batch_size, notification->after_id, &batch);
+    if (err != noError) {
+        logger().error(err);
+        return;
+    }
+    {
+        InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+        // Once the table is emptied, SQLite hands out IDs
+        // again from the start, so none are held back then
+        timeline_selected_until_ = batch.empty() ? 0
+            : std::max(timeline_selected_until_, batch.back().id);
+    }
     if (batch.empty()) {
         return;
     }
-    Poco::NotificationCenter& nc = Poco::NotificationCenter::defaultCenter();
-    TimelineBatchReadyNotification response(
-        notification->user_id, batch, desktop_id_);
-    Poco::AutoPtr<TimelineBatchReadyNotification> ptr(&response);
-    nc.postNotification(ptr);
+    err = count_timeline_backlog(notification->user_id, batch.back().id,
+        &backlog);
+    if (err != noError) {
+        logger().error(err);
+    }
+    // Upload happens on the uploader thread, not here
+    TimelineDispatcher::Instance().Post(new TimelineBatchReadyNotification(
+        notification->user_id, &batch, desktop_id_, backlog), notifications_);
 }
 
 void Database::handleDeleteTimelineBatchNotification(
         DeleteTimelineBatchNotification* notification) {
+    Poco::AutoPtr<DeleteTimelineBatchNotification> ptr(notification);
     logger().debug("handleDeleteTimelineBatchNotification");
-    poco_assert(!notification->batch.empty());
-    delete_timeline_batch(notification->batch);
+    delete_timeline_batch(notification->user_id,
+        notification->first_id, notification->last_id);
+}
+
+void Database::handleDeleteTimelineBlockNotification(
+        DeleteTimelineBlockNotification* notification) {
+    Poco::AutoPtr<DeleteTimelineBlockNotification> ptr(notification);
+    logger().debug("handleDeleteTimelineBlockNotification");
+    delete_timeline_block(notification->user_id, notification->block_id);
 }
 
 error Database::String(
@@ -2572,7 +5744,7 @@ error Database::String(
     poco_assert(result);
     poco_assert(!sql.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
         std::string value("");
@@ -2590,6 +5762,40 @@ error Database::String(
     return last_error("String");
 }
 
+error Database::QueryPlan(
+        const std::string sql,
+        std::string *result) {
+    poco_assert(session);
+    poco_assert(result);
+    poco_assert(!sql.empty());
+
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
+
+    try {
+        std::stringstream ss;
+        Poco::Data::Statement select(*session);
+        select << "EXPLAIN QUERY PLAN " + sql;
+        Poco::Data::RecordSet rs(select);
+        while (!select.done()) {
+            select.execute();
+            bool more = rs.moveFirst();
+            while (more) {
+                // selectid, order, from, detail
+                ss << rs[3].convert<std::string>() << std::endl;
+                more = rs.moveNext();
+            }
+        }
+        *result = ss.str();
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
+    }
+    return last_error("QueryPlan");
+}
+
 error Database::UInt(
         const std::string sql,
         Poco::UInt64 *result) {
@@ -2597,7 +5803,7 @@ error Database::UInt(
     poco_assert(result);
     poco_assert(!sql.empty());
 
-    Poco::Mutex::ScopedLock lock(mutex_);
+    InstrumentedMutex::ScopedLock lock(mutex_, __FUNCTION__);
 
     try {
         Poco::UInt64 value(0);
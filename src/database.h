@@ -9,48 +9,344 @@
 #include "sqlite3.h" // NOLINT
 #endif
 
+#include <map>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
+#include <deque>
 
 #include "Poco/Logger.h"
+#include "Poco/Mutex.h"
 #include "Poco/Data/Common.h"
+#include "Poco/Data/Statement.h"
 #include "Poco/Data/SQLite/Connector.h"
 #include "Poco/NotificationCenter.h"
 #include "Poco/Observer.h"
+#include "Poco/Timestamp.h"
 
 #include "./types.h"
+#include "./change_journal.h"
+#include "./database_tuning.h"
+#include "./instrumented_lock.h"
 #include "./proxy.h"
+#include "./report.h"
+#include "./sync_checkpoint.h"
+#include "./time_entry_export.h"
 #include "./user.h"
 #include "./timeline_notifications.h"
+#include "./timeline_constants.h"
+#include "./timeline_rollup.h"
 
 namespace kopsik {
 
+// Model and change kinds are enums and the GUID is the only string,
+// so a full sync that changes thousands of models stays cheap to
+// report. The names are the ones the UI gets through the C API.
+class AutocompleteIndex;
+
 class ModelChange {
     public:
-        ModelChange(const std::string model_type,
-                    const std::string change_type,
+        enum Model {
+            TimeEntryModel,
+            WorkspaceModel,
+            ClientModel,
+            ProjectModel,
+            UserModel,
+            TaskModel,
+            TagModel
+        };
+
+        enum Change {
+            Insert,
+            Update,
+            Delete
+        };
+
+        ModelChange(const Model model_type,
+                    const Change change_type,
                     const Poco::UInt64 model_id,
-                    const std::string GUID) :
+                    const std::string &GUID) :
           model_type_(model_type),
           change_type_(change_type),
           model_id_(model_id),
           GUID_(GUID) {}
-        std::string GUID() const { return GUID_; }
-        std::string ModelType() const { return model_type_; }
+
+        template <class T>
+        ModelChange(const T *model, const Change change_type) :
+          model_type_(ModelOf(model)),
+          change_type_(change_type),
+          model_id_(model->ID()),
+          GUID_(model->GUID()) {}
+
+        const std::string &GUID() const { return GUID_; }
+        Model ModelType() const { return model_type_; }
         Poco::UInt64 ModelID() const { return model_id_; }
-        std::string ChangeType() const { return change_type_; }
+        Change ChangeType() const { return change_type_; }
+
+        static const char *ModelTypeName(const Model model_type);
+        static const char *ChangeTypeName(const Change change_type);
+
+        static Model ModelOf(const TimeEntry *) { return TimeEntryModel; }
+        static Model ModelOf(const Workspace *) { return WorkspaceModel; }
+        static Model ModelOf(const Client *) { return ClientModel; }
+        static Model ModelOf(const Project *) { return ProjectModel; }
+        static Model ModelOf(const User *) { return UserModel; }
+        static Model ModelOf(const Task *) { return TaskModel; }
+        static Model ModelOf(const Tag *) { return TagModel; }
+
     private:
-        std::string model_type_;
-        std::string change_type_;
+        Model model_type_;
+        Change change_type_;
         Poco::UInt64 model_id_;
         std::string GUID_;
 };
 
+// Period of time entry starts, since to until, in seconds
+typedef struct {
+    Poco::UInt64 since;
+    Poco::UInt64 until;
+} TimeEntryRange;
+
+// Merges the changes to the same model into one change, in the order
+// the models first changed. A model inserted and then updated stays
+// an insert, inserted and then deleted it drops out altogether.
+void MergeModelChanges(
+    const std::vector<ModelChange> &changes,
+    std::vector<ModelChange> *merged);
+
 class Database {
     public:
-        explicit Database(const std::string db_path);
+        // Timeline notifications are observed on, and posted
+        // to, the notification center of its context
+        explicit Database(
+            const std::string db_path,
+            const DatabaseTuning &tuning = DatabaseTuning(),
+            Poco::NotificationCenter &notifications =  // NOLINT
+                Poco::NotificationCenter::defaultCenter());
         ~Database();
 
+        // Timeline events are buffered in memory and written in one
+        // transaction when enough of them have piled up, before a batch
+        // is selected for upload, and when the database is closed.
+        error FlushTimelineEvents();
+
+        // Estimated bytes of the timeline events waiting to be written,
+        // without their interned titles and filenames
+        std::size_t TimelineBufferBytes();
+
+        // Estimated bytes of the day reports kept for LoadReport
+        std::size_t ReportCacheBytes() { return report_cache_.MemoryBytes(); }
+
+        // Buffered events of the same window are merged when the newer
+        // one starts within this many seconds of the older one's end.
+        void SetTimelineCoalesceSeconds(const unsigned int value) {
+            timeline_coalesce_seconds_ = value;
+        }
+
+        // Instead of every event, store the time spent in each app per
+        // hour, once the hour is over. Turning it off stores what has
+        // been added up so far.
+        void SetTimelineRollups(const bool value);
+
+        // While more than twice kTimelineBlockEvents events of a user
+        // are waiting for upload, pack the oldest ones into gzipped
+        // blocks of their upload JSON, which are uploaded as they are.
+        // Turning it off leaves the blocks there are to be uploaded.
+        void SetTimelineBlocks(const bool value);
+
+        // When loading a user, load only the time entries that started
+        // within this many days, plus the running one and the ones that
+        // need pushing. The rest can be loaded later with
+        // LoadTimeEntriesSince. 0 loads all of them.
+        void SetTimeEntryLoadDays(const unsigned int value) {
+            time_entry_load_days_ = value;
+        }
+
+        // Optional binary copy of the related data next to the database,
+        // for a quick cold start, see RelatedDataSnapshot. LoadRelatedData
+        // uses it while no related data has been saved since it was
+        // written. Empty, as by default, turns it off.
+        void SetSnapshotPath(const std::string &path) {
+            snapshot_path_ = path;
+        }
+
+        // Writes the snapshot of what the user's related data was saved
+        // as. Fails if any of it isn't saved yet.
+        error SaveRelatedDataSnapshot(User *user);
+
+        // Optional file with the autocomplete index next to the
+        // database, see AutocompleteIndexFile. Empty, as by default,
+        // turns it off.
+        void SetAutocompleteIndexPath(const std::string &path) {
+            autocomplete_index_path_ = path;
+        }
+
+        // Optional file next to the database where edits are kept until
+        // they're saved, see ChangeJournal. Empty, as by default, turns
+        // it off.
+        void SetChangeJournalPath(const std::string &path);
+
+        // Appends the user's time entries that changed since they were
+        // saved to the change journal, so the edits outlive a crash
+        // before the next SaveUser. Doesn't wait on the database.
+        error JournalEdits(User *user);
+
+        // Applies what the change journal has for the user, left by a
+        // run that didn't get to save it, and saves it. Call once the
+        // user is loaded.
+        error ReplayChangeJournal(
+            User *user,
+            std::vector<ModelChange> *changes);
+
+        // Writes the index, which should be built from the user's
+        // related data as it's saved now
+        error SaveAutocompleteIndex(
+            const Poco::UInt64 UID,
+            const AutocompleteIndex &index);
+
+        // Reads the index written for the related data as it's saved
+        // now, if there is one. generation is the snapshot generation
+        // it was written with, see SnapshotGeneration.
+        error LoadAutocompleteIndex(
+            const Poco::UInt64 UID,
+            AutocompleteIndex *index,
+            Poco::UInt64 *generation,
+            bool *found);
+
+        // Bumped whenever related data is saved, so what was derived
+        // from it is stale once this has moved on
+        error SnapshotGeneration(Poco::UInt64 *generation);
+
+        // First part of a quick startup, after loading the user without
+        // related data: the time entries started since the given time,
+        // the running one and the ones that need pushing.
+        error LoadStartupTimeEntries(
+            User *user,
+            const Poco::UInt64 since);
+
+        // All related data of a user, loaded into lists of its own so
+        // the user can be used meanwhile. Time entries are loaded
+        // as SetTimeEntryLoadDays says, the time they were loaded
+        // since is stored to time_entries_loaded_since.
+        error LoadRelatedData(
+            const Poco::UInt64 UID,
+            RelatedData *related,
+            Poco::UInt64 *time_entries_loaded_since);
+
+        // Tables of related data ("time_entries"), and "settings" or
+        // "sessions", that another process sharing the database file,
+        // like the command line app, has saved into since the last
+        // call. Every save bumps a counter per table it changed, so this
+        // reads a handful of rows, and the counters this Database bumped
+        // itself are not reported.
+        error ExternalChanges(std::set<std::string> *tables);
+
+        // Like LoadRelatedData, but only the given tables, and time
+        // entries since the given time, without the snapshot
+        error LoadTables(
+            const Poco::UInt64 UID,
+            const std::set<std::string> &tables,
+            const Poco::UInt64 time_entries_since,
+            RelatedData *related);
+
+        // Add the time entries that started since the given time and
+        // are not loaded yet to the user's time entries
+        error LoadTimeEntriesSince(
+            User *user,
+            const Poco::UInt64 since);
+
+        // Saved time entries of the user having a word that starts with
+        // each word of the query in their description, or the word in
+        // their project or client name. Entries with the query's words
+        // whole in their description come first, then the latest ones.
+        // They are not added to the user, the caller owns them.
+        error SearchTimeEntries(
+            const Poco::UInt64 UID,
+            const std::string &query,
+            const Poco::UInt64 offset,
+            const Poco::UInt64 limit,
+            std::vector<TimeEntry *> *results);
+
+        // Totals of the user's saved, stopped time entries that started
+        // from from_day to to_day, yyyymmdd in local time. Days that are
+        // over are read once and kept until their time entries change.
+        error LoadReport(
+            const Poco::UInt64 UID,
+            const int from_day,
+            const int to_day,
+            Report *report);
+
+        // Writes the user's saved, stopped time entries that started
+        // from from_day to to_day, yyyymmdd in local time, oldest first.
+        // Rows are stepped through one by one, not loaded together.
+        error ExportTimeEntries(
+            const Poco::UInt64 UID,
+            const int from_day,
+            const int to_day,
+            TimeEntryExport *out);
+
+        // Moves the user's time entries that started before the given
+        // time, are stopped, pushed and not edited since into the
+        // compressed archive, see TimeEntryArchive. Entries with a GUID
+        // in keep stay, the caller has them loaded. LoadReport and
+        // ExportTimeEntries read archived entries along with the rest,
+        // the time entry list and SearchTimeEntries don't, and entries
+        // deleted on the server stay in the archive.
+        error ArchiveTimeEntries(
+            const Poco::UInt64 UID,
+            const Poco::UInt64 before,
+            const std::set<std::string> &keep,
+            Poco::UInt64 *archived);
+
+        // Archived time entries of the user that started from since
+        // to until, oldest first, without the ones time_entries has
+        // a newer copy of. The caller owns them.
+        error LoadArchivedTimeEntries(
+            const Poco::UInt64 UID,
+            const Poco::UInt64 since,
+            const Poco::UInt64 until,
+            std::vector<TimeEntry *> *list);
+
+        // Periods whose time entries have been downloaded from the
+        // server and saved. Overlapping and adjacent ones are merged as
+        // they are saved, so a user has only a few of them.
+        error SaveTimeEntryFetch(
+            const Poco::UInt64 UID,
+            const Poco::UInt64 since,
+            const Poco::UInt64 until);
+
+        // Parts of since to until no saved fetch covers, oldest first
+        error UnfetchedTimeEntryRanges(
+            const Poco::UInt64 UID,
+            const Poco::UInt64 since,
+            const Poco::UInt64 until,
+            std::vector<TimeEntryRange> *ranges);
+
+        // Start of the oldest saved fetch, 0 if there's none
+        error OldestTimeEntryFetch(
+            const Poco::UInt64 UID,
+            Poco::UInt64 *since);
+
+        // Replaces the user's sync checkpoint, see SyncCheckpoint
+        error SaveSyncCheckpoint(
+            const Poco::UInt64 UID,
+            const SyncCheckpoint &checkpoint);
+
+        // Adds a piece to the user's saved sync checkpoint
+        error SaveSyncCheckpointPiece(
+            const Poco::UInt64 UID,
+            const SyncCheckpointPiece &piece);
+
+        // found is false if the user has no sync checkpoint saved
+        error LoadSyncCheckpoint(
+            const Poco::UInt64 UID,
+            SyncCheckpoint *checkpoint,
+            bool *found);
+
+        // Once a sync completes, there's nothing to resume
+        error DeleteSyncCheckpoint(const Poco::UInt64 UID);
+
         error DeleteUser(
             User *model,
             const bool with_related_data);
@@ -81,6 +377,19 @@ class Database {
         error SaveUpdateChannel(
             const std::string update_channel);
 
+        // Last update check response and its validators,
+        // for asking the server only whether it has changed
+        error LoadUpdateCheck(
+            std::string *url,
+            std::string *etag,
+            std::string *last_modified,
+            std::string *response_body);
+        error SaveUpdateCheck(
+            const std::string url,
+            const std::string etag,
+            const std::string last_modified,
+            const std::string &response_body);
+
         error UInt(
             const std::string sql,
             Poco::UInt64 *result);
@@ -88,6 +397,12 @@ class Database {
             const std::string sql,
             std::string *result);
 
+        // How SQLite runs the query, one EXPLAIN QUERY PLAN detail
+        // per line, to check which indexes it uses
+        error QueryPlan(
+            const std::string sql,
+            std::string *result);
+
         error SaveUser(User *user, bool with_related_data,
             std::vector<ModelChange> *changes);
 
@@ -99,6 +414,19 @@ class Database {
 
         error SaveDesktopID();
 
+        // Applies the settings to the open connections and logs
+        // what SQLite then says they are
+        error Tune(const DatabaseTuning &tuning);
+        error EffectiveTuning(DatabaseTuning *tuning);
+
+        // Upkeep for while the app is idle. Checkpoints the WAL without
+        // waiting for readers, gives free pages back to the file system
+        // once there are many of them, and now and then refreshes the
+        // statistics the query planner uses. Skipped while another
+        // process sharing the file maintains it, or while the two
+        // have been waiting for each other's writes.
+        error Maintain();
+
         static std::string GenerateGUID();
 
      protected:
@@ -108,20 +436,77 @@ class Database {
             CreateTimelineBatchNotification *notification);
         void handleDeleteTimelineBatchNotification(
             DeleteTimelineBatchNotification *notification);
+        void handleDeleteTimelineBlockNotification(
+            DeleteTimelineBlockNotification *notification);
 
      private:
         error initialize_tables();
-        error migrate(
-            const std::string name,
-            const std::string sql);
+        // Schema changes by name, in the order they were added. They
+        // are only ever appended, so their count is the schema version.
+        typedef std::vector<std::pair<std::string, std::string> > Migrations;
+        error migrate(const Migrations &migrations);
+        error runMigrations(const Migrations &migrations);
         error last_error(
             const std::string was_doing);
 
+        // Selects that don't need to see uncommitted writes go through
+        // the reader connection, so they don't wait for a big save.
+        // Lock readerMutex() while using reader().
+        Poco::Data::Session *reader();
+        InstrumentedMutex &readerMutex();
+        error reader_last_error(
+            const std::string was_doing);
+
         error journalMode(std::string *);
         error setJournalMode(const std::string);
 
+        static error tuneSession(
+            Poco::Data::Session *connection,
+            const DatabaseTuning &tuning);
+
+        error maintain();
+        error checkpointWAL();
+        error vacuumFreePages();
+        error analyze();
+
+        // Another process writing to the file makes a statement wait
+        // rather than fail with SQLITE_BUSY, up to
+        // kDatabaseBusyTimeoutMillis
+        void installBusyHandler(Poco::Data::Session *connection);
+        static int busyHandler(void *database, int count);
+        bool contendedLately();
+
+        // The lease on upkeep tells other processes sharing the file
+        // to leave it be. acquired is false while one of them holds it.
+        error acquireMaintenanceLease(bool *acquired);
+        error releaseMaintenanceLease();
+
         error loadUsersRelatedData(User *user);
 
+        // Counts the saves that changed related data, so a snapshot
+        // can tell whether it's still what the database has
+        error bumpSnapshotGeneration();
+        // Bumps the change generations of the tables, in the save
+        // transaction, see ExternalChanges
+        error bumpChangeGenerations(const std::set<std::string> &tables);
+        // Same for a single table, like settings and sessions, which are
+        // saved outside of SaveUser
+        error bumpChangeGeneration(const std::string &table);
+        error loadChangeGenerations(
+            std::map<std::string, Poco::Int64> *generations);
+        error loadRelatedDataSnapshot(
+            const Poco::UInt64 UID,
+            RelatedData *related,
+            Poco::UInt64 *time_entries_loaded_since,
+            bool *found);
+
+        // The user's rows of the model's table, by name. The columns
+        // and how they're read come from M::Schema().
+        template <class M>
+        error loadModels(
+            const Poco::UInt64 UID,
+            std::vector<M *> *list);
+
         error loadWorkspaces(
             const Poco::UInt64 UID,
             std::vector<Workspace *> *list);
@@ -139,7 +524,12 @@ class Database {
             std::vector<Tag *> *list);
         error loadTimeEntries(
             const Poco::UInt64 UID,
+            const Poco::UInt64 since,
             std::vector<TimeEntry *> *list);
+        error hasTimeEntriesStartedBefore(
+            const Poco::UInt64 UID,
+            const Poco::UInt64 before,
+            bool *result);
 
         error loadTimeEntriesFromSQLStatement(
             Poco::Data::Statement *select,
@@ -173,16 +563,68 @@ class Database {
         error deleteFromTable(
             const std::string table_name,
             const Poco::Int64 local_id);
+        // Rows of all the local IDs, a chunk per statement.
+        // Models that were never saved have no row to delete.
+        error deleteFromTable(
+            const std::string table_name,
+            const std::vector<Poco::Int64> &local_ids);
         error deleteAllFromTableByUID(
             const std::string table_name,
             const Poco::Int64 UID);
 
         error insert_timeline_event(const TimelineEvent& info);
+        error insert_timeline_events(const std::vector<TimelineEvent> &events);
+        // ID of the value in timeline_apps or timeline_titles,
+        // inserted if it's not there yet
+        Poco::Int64 timelineDictionaryID(
+            const std::string &table,
+            const std::string &column,
+            const std::string &value,
+            std::map<std::string, Poco::Int64> *ids);
+        // When the rows may be gone, inserts rolled back or deleted
+        void forgetTimelineDictionaryIDs() {
+            timeline_app_ids_.clear();
+            timeline_title_ids_.clear();
+        }
+        // Must be called with timeline_events_buffer_m_ locked
+        bool coalesce_timeline_event(const TimelineEvent& event);
         error select_timeline_batch(
             const Poco::UInt64 user_id,
+            const unsigned int limit,
+            const unsigned int after_id,
             std::vector<TimelineEvent> *timeline_events);
+        // Events of the user still waiting after the given ID
+        error count_timeline_backlog(
+            const Poco::UInt64 user_id,
+            const unsigned int after_id,
+            Poco::UInt64 *count);
         error delete_timeline_batch(
-            const std::vector<TimelineEvent> &timeline_events);
+            const Poco::UInt64 user_id,
+            const unsigned int first_id,
+            const unsigned int last_id);
+        // Drops titles and apps no event refers to anymore
+        void prune_timeline_dictionaries();
+        // Packs what's waiting beyond the events handed out for upload
+        error pack_timeline_blocks(const Poco::UInt64 user_id);
+        // Oldest block of the user, block_id 0 if there's none.
+        // later is the number of events in the blocks after it.
+        error select_timeline_block(
+            const Poco::UInt64 user_id,
+            Poco::Int64 *block_id,
+            unsigned int *events,
+            Poco::UInt64 *json_size,
+            std::string *block,
+            Poco::UInt64 *later);
+        error delete_timeline_block(
+            const Poco::UInt64 user_id,
+            const Poco::Int64 block_id);
+
+        // Inserts the model, or updates its row by local ID,
+        // as M::Schema() says
+        template <class M>
+        error saveModel(
+            M *model,
+            std::vector<ModelChange> *changes);
 
         error saveWorkspace(
             Workspace *model,
@@ -202,13 +644,187 @@ class Database {
         error saveTimeEntry(
             TimeEntry *model,
             std::vector<ModelChange> *changes);
+        error insertTimeEntries(
+            const Poco::UInt64 UID,
+            std::vector<TimeEntry *> *list,
+            std::vector<ModelChange> *changes);
+
+        // Keeps the push_outbox table and the user's outbox up to date
+        // with what the saved models still need pushed
+        error journalPushes(
+            const Poco::UInt64 UID,
+            const std::vector<Project *> &projects,
+            const std::vector<TimeEntry *> &time_entries,
+            RelatedData *related);
+        error journalPush(
+            const Poco::UInt64 UID,
+            BaseModel *model,
+            PushOutbox *outbox);
+        error loadPushOutbox(
+            const Poco::UInt64 UID,
+            PushOutbox *outbox);
+
+        // The journal at change_journal_path_, 0 if there's none.
+        // Call with journal_m_ held.
+        ChangeJournal *changeJournal();
+        void truncateChangeJournal();
+
+        void collectDirtyModels(
+            RelatedData *related,
+            std::vector<Workspace *> *workspaces,
+            std::vector<Client *> *clients,
+            std::vector<Project *> *projects,
+            std::vector<Task *> *tasks,
+            std::vector<Tag *> *tags,
+            std::vector<TimeEntry *> *time_entries);
+
+        void prepareTimeEntryStatements();
+        // Update of only the given TimeEntry fields, compiled
+        // the first time the combination is saved
+        Poco::Data::Statement *updateTimeEntryFields(
+            const Poco::UInt32 fields);
+        // Copies the model's fields to time_entry_row_
+        void setTimeEntryRow(TimeEntry *model);
+        // Indexes the words of the description in time_entry_row_ for
+        // SearchTimeEntries, replacing the ones of an updated entry
+        void indexTimeEntryWords(const bool replace);
+        // Indexes the entries saved before the index existed, once
+        error indexUnindexedTimeEntries();
+        error loadDayReports(
+            const Poco::UInt64 UID,
+            const int from_day,
+            const int to_day,
+            std::map<int, DayReport> *days);
+        error loadReportNames(
+            const Poco::UInt64 UID,
+            Report *report);
+        // Packs the entries into the archive row of the month,
+        // along with the ones archived there before
+        error archiveMonth(
+            const Poco::UInt64 UID,
+            const int month,
+            const std::vector<TimeEntry *> &entries);
+        void clearStatements();
+
+        // Times every statement the session runs into the "sql."
+        // metrics, by MetricsStatement
+        static void profileStatements(
+            Poco::Data::Session *session,
+            Poco::Timestamp *statement_started);
 
         Poco::Logger &logger() const;
 
         Poco::Data::Session *session;
+        // Read only connection, guarded by read_m_
+        Poco::Data::Session *read_session_;
         std::string desktop_id_;
 
-        Poco::Mutex mutex_;
+        // Values bound to the compiled time entry statements
+        struct TimeEntryRow {
+            TimeEntryRow()
+                : id(0)
+                , uid(0)
+                , wid(0)
+                , pid(0)
+                , tid(0)
+                , billable(false)
+                , duronly(false)
+                , ui_modified_at(0)
+                , start(0)
+                , stop(0)
+                , duration(0)
+                , deleted_at(0)
+                , updated_at(0)
+                , local_id(0) {}
+            Poco::UInt64 id;
+            Poco::UInt64 uid;
+            std::string description;
+            Poco::UInt64 wid;
+            std::string guid;
+            Poco::UInt64 pid;
+            Poco::UInt64 tid;
+            bool billable;
+            bool duronly;
+            Poco::UInt64 ui_modified_at;
+            Poco::UInt64 start;
+            Poco::UInt64 stop;
+            Poco::Int64 duration;
+            std::string tags;
+            std::string created_with;
+            Poco::UInt64 deleted_at;
+            Poco::UInt64 updated_at;
+            std::string project_guid;
+            Poco::Int64 local_id;
+        };
+        TimeEntryRow time_entry_row_;
+
+        Poco::Data::Statement *update_time_entry_with_id_;
+        Poco::Data::Statement *update_time_entry_;
+        Poco::Data::Statement *insert_time_entry_with_id_;
+        Poco::Data::Statement *insert_time_entry_;
+        Poco::Data::Statement *last_insert_rowid_;
+        // Word of time_entry_row_'s description being indexed
+        std::string time_entry_word_;
+        Poco::Data::Statement *delete_time_entry_words_;
+        Poco::Data::Statement *insert_time_entry_word_;
+        bool time_entry_words_complete_;
+        ReportCache report_cache_;
+        std::map<Poco::UInt32, Poco::Data::Statement *>
+            update_time_entry_fields_;
+        Poco::Int64 last_insert_rowid_value_;
+
+        InstrumentedMutex mutex_;
+        InstrumentedMutex read_m_;
+
+        // Own lock, so recording timeline events does not
+        // wait for the database while it's busy saving.
+        std::deque<TimelineEvent> timeline_events_buffer_;
+        time_t timeline_events_buffered_at_;
+        unsigned int timeline_coalesce_seconds_;
+        bool timeline_rollups_;
+        // Guarded by mutex_. Events up to the last one handed out for
+        // upload are left out of blocks, their delete may be coming.
+        bool timeline_blocks_;
+        unsigned int timeline_selected_until_;
+        TimelineRollup timeline_rollup_;
+        Poco::Mutex timeline_events_buffer_m_;
+
+        // IDs of app filenames and window titles by their text, for
+        // inserting timeline events. Guarded by mutex_.
+        std::map<std::string, Poco::Int64> timeline_app_ids_;
+        std::map<std::string, Poco::Int64> timeline_title_ids_;
+
+        unsigned int time_entry_load_days_;
+
+        std::string snapshot_path_;
+        std::string autocomplete_index_path_;
+
+        // Opened when first used. Guarded by journal_m_ rather than
+        // mutex_, so journaling an edit doesn't wait for a statement.
+        std::string change_journal_path_;
+        ChangeJournal *change_journal_;
+        Poco::FastMutex journal_m_;
+
+        // Change generation of each table as last seen, either bumped
+        // by this Database or reported by ExternalChanges. Guarded
+        // by mutex_.
+        std::map<std::string, Poco::Int64> seen_generations_;
+
+        // Last time Maintain ran ANALYZE, guarded by mutex_
+        Poco::Timestamp analyzed_at_;
+
+        // Tells this Database's lease apart from other processes'
+        std::string lease_holder_;
+        // When a connection last had to wait for another process
+        Poco::Timestamp busy_at_;
+        bool busy_seen_;
+        Poco::FastMutex busy_m_;
+
+        Poco::NotificationCenter &notifications_;
+
+        // When the statement running on each connection started
+        Poco::Timestamp statement_started_;
+        Poco::Timestamp read_statement_started_;
 };
 
 }  // namespace kopsik
@@ -0,0 +1,26 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./database_tuning.h"
+
+#include <sstream>
+
+namespace kopsik {
+
+DatabaseTuning::DatabaseTuning()
+  : synchronous(SynchronousNormal),
+    temp_store(TempStoreMemory),
+    cache_size_kib(8192),
+    mmap_size_bytes(64 * 1024 * 1024),
+    page_size(4096) {}
+
+std::string DatabaseTuning::String() const {
+  std::stringstream ss;
+  ss << "synchronous=" << synchronous
+     << " temp_store=" << temp_store
+     << " cache_size=" << cache_size_kib << "KiB"
+     << " mmap_size=" << mmap_size_bytes
+     << " page_size=" << page_size;
+  return ss.str();
+}
+
+}  // namespace kopsik
@@ -0,0 +1,44 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_DATABASE_TUNING_H_
+#define SRC_DATABASE_TUNING_H_
+
+#include <string>
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // SQLite settings of the database connections, in the values the
+  // PRAGMAs of the same name take. Defaults suit WAL mode on a desktop.
+  class DatabaseTuning {
+   public:
+    enum Synchronous {
+      SynchronousOff = 0,
+      SynchronousNormal = 1,
+      SynchronousFull = 2
+    };
+
+    enum TempStore {
+      TempStoreDefault = 0,
+      TempStoreFile = 1,
+      TempStoreMemory = 2
+    };
+
+    DatabaseTuning();
+
+    std::string String() const;
+
+    int synchronous;
+    int temp_store;
+    // Page cache of each connection
+    Poco::Int64 cache_size_kib;
+    // 0 reads the file without mapping it
+    Poco::Int64 mmap_size_bytes;
+    // Only a new database takes it
+    int page_size;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_DATABASE_TUNING_H_
@@ -0,0 +1,82 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./day_totals.h"
+
+#include "Poco/LocalDateTime.h"
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+int DayTotals::DayOf(const Poco::UInt64 epoch_time) {
+  Poco::LocalDateTime datetime(
+    Poco::Timestamp::fromEpochTime(static_cast<std::time_t>(epoch_time)));
+  return datetime.year() * 10000 + datetime.month() * 100 + datetime.day();
+}
+
+std::string DayTotals::DateHeader(const int day) {
+  Poco::LocalDateTime noon(day / 10000, day / 100 % 100, day % 100, 12);
+  return Formatter::FormatDateHeader(noon.timestamp().epochTime());
+}
+
+Poco::Int64 DayTotals::Seconds(const int day) const {
+  std::map<int, DayTotal>::const_iterator it = days_.find(day);
+  if (it == days_.end()) {
+    return 0;
+  }
+  return it->second.Seconds;
+}
+
+void DayTotals::Add(const int day, const Poco::Int64 seconds) {
+  DayTotal &total = days_[day];
+  total.Seconds += seconds;
+  total.Entries++;
+}
+
+void DayTotals::Remove(const int day, const Poco::Int64 seconds) {
+  std::map<int, DayTotal>::iterator it = days_.find(day);
+  poco_assert(it != days_.end());
+  it->second.Seconds -= seconds;
+  it->second.Entries--;
+  if (!it->second.Entries) {
+    days_.erase(it);
+  }
+}
+
+TimeEntry *DayTotals::Running() const {
+  if (running_.empty()) {
+    return 0;
+  }
+  return *running_.begin();
+}
+
+TimeEntry *DayTotals::Latest() const {
+  if (started_.empty()) {
+    return 0;
+  }
+  return started_.rbegin()->second;
+}
+
+void DayTotals::AddStarted(const Poco::UInt64 start, TimeEntry *te) {
+  started_.insert(std::make_pair(start, te));
+}
+
+void DayTotals::RemoveStarted(const Poco::UInt64 start, TimeEntry *te) {
+  started_.erase(std::make_pair(start, te));
+}
+
+std::size_t DayTotals::MemoryBytes() const {
+  return MapNodesBytes(days_)
+    + SetNodesBytes(running_)
+    + SetNodesBytes(started_);
+}
+
+const std::string &DateHeaderCache::Get(const int day) {
+  std::map<int, std::string>::iterator it = headers_.find(day);
+  if (it == headers_.end()) {
+    it = headers_.insert(
+      std::make_pair(day, DayTotals::DateHeader(day))).first;
+  }
+  return it->second;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,92 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_DAY_TOTALS_H_
+#define SRC_DAY_TOTALS_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "./formatter.h"
+#include "./memory_usage.h"
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  class TimeEntry;
+
+  // Formats each day's header once, for listing many time entries.
+  // Use a new one for each listing, as headers like "Today" go stale.
+  class DateHeaderCache {
+  public:
+    const std::string &Get(const int day);
+
+  private:
+    std::map<int, std::string> headers_;
+  };
+
+  class DayTotal {
+  public:
+    DayTotal() : Seconds(0), Entries(0) {}
+
+    Poco::Int64 Seconds;
+    int Entries;
+  };
+
+  // Tracked time per day of the time entries that are listed in the UI
+  // (stopped and not deleted). Time entries report here themselves as
+  // they change, see TimeEntry::SetDayTotals, so day totals can be
+  // looked up without scanning all time entries. The running time
+  // entries and the start of every time entry report here the same way.
+  class DayTotals {
+  public:
+    DayTotals() : registered_(0) {}
+
+    // Local time day of a Unix timestamp, as yyyymmdd
+    static int DayOf(const Poco::UInt64 epoch_time);
+
+    // Same header TimeEntry::DateHeaderString gives the day's entries
+    static std::string DateHeader(const int day);
+
+    Poco::Int64 Seconds(const int day) const;
+
+    // Only days that have listed time entries
+    const std::map<int, DayTotal> &Days() const { return days_; }
+
+    // Time entries that report here, listed or not. When it's less than
+    // the number of time entries the totals are incomplete.
+    std::size_t Registered() const { return registered_; }
+
+    void Register() { registered_++; }
+    void Unregister() { registered_--; }
+
+    void Add(const int day, const Poco::Int64 seconds);
+
+    void Remove(const int day, const Poco::Int64 seconds);
+
+    // Any of the running time entries, there's usually just one
+    TimeEntry *Running() const;
+
+    void AddRunning(TimeEntry *te) { running_.insert(te); }
+    void RemoveRunning(TimeEntry *te) { running_.erase(te); }
+
+    // The time entry that started last, listed or not
+    TimeEntry *Latest() const;
+
+    void AddStarted(const Poco::UInt64 start, TimeEntry *te);
+    void RemoveStarted(const Poco::UInt64 start, TimeEntry *te);
+
+    std::size_t MemoryBytes() const;
+
+  private:
+    std::map<int, DayTotal> days_;
+    std::size_t registered_;
+    std::set<TimeEntry *> running_;
+    std::set<std::pair<Poco::UInt64, TimeEntry *> > started_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_DAY_TOTALS_H_
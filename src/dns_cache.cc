@@ -0,0 +1,215 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./dns_cache.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "Poco/Exception.h"
+#include "Poco/SingletonHolder.h"
+#include "Poco/Timespan.h"
+#include "Poco/URI.h"
+#include "Poco/Net/DNS.h"
+#include "Poco/Net/IPAddress.h"
+#include "Poco/Net/Socket.h"
+#include "Poco/Net/SocketAddress.h"
+
+namespace kopsik {
+
+DNSCache::DNSCache(const Poco::Timestamp::TimeDiff ttl)
+  : ttl_(ttl) {
+  // Created first, so it's still there when this one goes
+  WorkerPool::Shared();
+}
+
+DNSCache::~DNSCache() {
+  WorkerPool::Shared().Cancel(this);
+}
+
+DNSCache &DNSCache::Shared() {
+  WorkerPool::Shared();
+  static Poco::SingletonHolder<DNSCache> sh;
+  return *sh.get();
+}
+
+std::string DNSCache::Address(
+    const std::string &host, const Poco::UInt16 port) {
+  Poco::Net::IPAddress literal;
+  if (Poco::Net::IPAddress::tryParse(host, literal)) {
+    return "";
+  }
+  {
+    Poco::FastMutex::ScopedLock lock(m_);
+    std::map<std::string, Entry>::iterator it =
+      entries_.find(key(host, port));
+    if (it != entries_.end()) {
+      Metrics::Shared().Count("dns.cache_hits", 1);
+      if (it->second.expires_at < Poco::Timestamp()
+          && !it->second.refreshing) {
+        it->second.refreshing = true;
+        enqueue(host, port);
+      }
+      return it->second.address;
+    }
+  }
+  return resolve(host, port);
+}
+
+void DNSCache::Prefetch(const std::string &url) {
+  try {
+    Poco::URI uri(url);
+    Poco::Net::IPAddress literal;
+    if (uri.getHost().empty()
+        || Poco::Net::IPAddress::tryParse(uri.getHost(), literal)) {
+      return;
+    }
+    Poco::FastMutex::ScopedLock lock(m_);
+    if (entries_.find(key(uri.getHost(), uri.getPort()))
+        == entries_.end()) {
+      enqueue(uri.getHost(), uri.getPort());
+    }
+  } catch(const Poco::Exception &) {
+  }
+}
+
+DNSCache::LookupTask::LookupTask(
+    DNSCache *cache, const std::string &host, const Poco::UInt16 port)
+  : cache_(cache)
+  , host_(host)
+  , port_(port) {}
+
+void DNSCache::LookupTask::Work() {
+  cache_->resolve(host_, port_);
+}
+
+const void *DNSCache::LookupTask::Owner() const {
+  return cache_;
+}
+
+std::string DNSCache::key(const std::string &host, const Poco::UInt16 port) {
+  std::stringstream ss;
+  ss << host << ":" << port;
+  return ss.str();
+}
+
+void DNSCache::enqueue(const std::string &host, const Poco::UInt16 port) {
+  WorkerPool::Shared().Enqueue(WorkerPool::Background,
+    WorkerTask::Ptr(new LookupTask(this, host, port)));
+}
+
+std::string DNSCache::resolve(
+    const std::string &host, const Poco::UInt16 port) {
+  std::string address("");
+  Poco::Timestamp started;
+  try {
+    Poco::Net::HostEntry found = Poco::Net::DNS::hostByName(host);
+    const Poco::Net::HostEntry::AddressList &addresses =
+      found.addresses();
+    Metrics::Shared().Time("dns.lookup", started.elapsed());
+    address = race(addresses, port);
+    if (address.empty() && !addresses.empty()) {
+      address = addresses.front().toString();
+    }
+  } catch(const Poco::Exception &) {
+    Metrics::Shared().Count("dns.lookup_failures", 1);
+  }
+
+  Poco::FastMutex::ScopedLock lock(m_);
+  std::string k = key(host, port);
+  if (address.empty()) {
+    std::map<std::string, Entry>::iterator it = entries_.find(k);
+    if (it == entries_.end()) {
+      return "";
+    }
+    it->second.expires_at =
+      Poco::Timestamp() + Poco::Timestamp::TimeDiff(kDNSCacheRetryMicros);
+    it->second.refreshing = false;
+    return it->second.address;
+  }
+  Entry &entry = entries_[k];
+  entry.address = address;
+  entry.expires_at = Poco::Timestamp() + ttl_;
+  entry.refreshing = false;
+  return address;
+}
+
+std::string DNSCache::race(
+    const Poco::Net::HostEntry::AddressList &addresses,
+    const Poco::UInt16 port) {
+  std::vector<Poco::Net::IPAddress> candidates;
+  Poco::Net::IPAddress::Family families[] = {
+    Poco::Net::IPAddress::IPv6, Poco::Net::IPAddress::IPv4
+  };
+  for (std::size_t i = 0; i < 2; i++) {
+    for (std::size_t j = 0; j < addresses.size(); j++) {
+      if (addresses[j].family() == families[i]) {
+        candidates.push_back(addresses[j]);
+        break;
+      }
+    }
+  }
+  if (candidates.size() < 2) {
+    return "";
+  }
+
+  Poco::Timestamp started;
+  std::vector<Attempt> attempts;
+  for (std::size_t i = 0; i < candidates.size(); i++) {
+    try {
+      Attempt attempt;
+      attempt.address = candidates[i].toString();
+      attempt.socket.connectNB(
+        Poco::Net::SocketAddress(candidates[i], port));
+      attempts.push_back(attempt);
+    } catch(const Poco::Exception &) {
+      // Like when there's no route for the family
+    }
+    Poco::Timestamp::TimeDiff until = i + 1 < candidates.size() ?
+      started.elapsed() + kHappyEyeballsDelayMicros :
+      kHTTPSConnectTimeoutMicros;
+    std::string winner = connected(&attempts, started, until);
+    if (!winner.empty()) {
+      Metrics::Shared().Count(
+        candidates[0].toString() == winner ?
+        "dns.race_won_ipv6" : "dns.race_won_ipv4", 1);
+      return winner;
+    }
+  }
+  return "";
+}
+
+std::string DNSCache::connected(
+    std::vector<Attempt> *attempts, const Poco::Timestamp &started,
+    const Poco::Timestamp::TimeDiff until) {
+  while (!attempts->empty() && started.elapsed() < until) {
+    Poco::Net::Socket::SocketList readable;
+    Poco::Net::Socket::SocketList writable;
+    Poco::Net::Socket::SocketList failed;
+    for (std::size_t i = 0; i < attempts->size(); i++) {
+      writable.push_back((*attempts)[i].socket);
+      failed.push_back((*attempts)[i].socket);
+    }
+    if (!Poco::Net::Socket::select(readable, writable, failed,
+        Poco::Timespan(until - started.elapsed()))) {
+      return "";
+    }
+    std::vector<Attempt>::iterator it = attempts->begin();
+    while (it != attempts->end()) {
+      bool done = std::find(writable.begin(), writable.end(),
+                            it->socket) != writable.end();
+      bool error = std::find(failed.begin(), failed.end(),
+                             it->socket) != failed.end();
+      if (done && !error && !it->socket.impl()->socketError()) {
+        return it->address;
+      }
+      if (done || error) {
+        it = attempts->erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+  return "";
+}
+
+}  // namespace kopsik
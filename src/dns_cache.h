@@ -0,0 +1,113 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_DNS_CACHE_H_
+#define SRC_DNS_CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./const.h"
+#include "./metrics.h"
+#include "./worker_pool.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Types.h"
+#include "Poco/Net/HostEntry.h"
+#include "Poco/Net/StreamSocket.h"
+
+namespace kopsik {
+
+  // Addresses of the hosts the app talks to, so that new connections
+  // and WebSocket reconnects don't each wait for the system resolver.
+  // The resolver doesn't tell how long its answers are good for, so
+  // they're used for the TTL given, and when that has passed, while
+  // a worker looks the host up again. If that fails, the last address
+  // is used until the next try, kDNSCacheRetryMicros later. When a
+  // host has both IPv6 and IPv4 addresses, they race to connect, the
+  // IPv6 one with a head start (happy eyeballs, RFC 6555), and the
+  // winner is the address used.
+  class DNSCache {
+  public:
+    explicit DNSCache(
+      const Poco::Timestamp::TimeDiff ttl = kDNSCacheTTLMicros);
+
+    ~DNSCache();
+
+    // Statics go in the reverse order they were made in. The holder
+    // of the worker pool is made before this one's, not while it's
+    // filled in, so the pool outlives the shared cache at exit.
+    static DNSCache &Shared();
+
+    // Address to connect to for the host, "" if it's an address
+    // already or it can't be resolved. Only the first lookup of a
+    // host is waited for.
+    std::string Address(const std::string &host, const Poco::UInt16 port);
+
+    // Looks the host of the URL up on a worker, if it hasn't been
+    void Prefetch(const std::string &url);
+
+  private:
+    typedef struct {
+      std::string address;
+      Poco::Timestamp expires_at;
+      bool refreshing;
+    } Entry;
+
+    class LookupTask : public WorkerTask {
+    public:
+      LookupTask(DNSCache *cache,
+                 const std::string &host,
+                 const Poco::UInt16 port);
+
+      void run() {}
+
+      void Work();
+
+      const void *Owner() const;
+
+    private:
+      DNSCache *cache_;
+      std::string host_;
+      Poco::UInt16 port_;
+    };
+    friend class LookupTask;
+
+    static std::string key(const std::string &host, const Poco::UInt16 port);
+
+    void enqueue(const std::string &host, const Poco::UInt16 port);
+
+    // Outside the lock, the lookup and the race can take seconds
+    std::string resolve(const std::string &host, const Poco::UInt16 port);
+
+    // First IPv6 and first IPv4 address, in that order, with the next
+    // one tried when the last hasn't connected within its head start.
+    // The one that connects first wins, "" if neither does in time.
+    static std::string race(
+        const Poco::Net::HostEntry::AddressList &addresses,
+        const Poco::UInt16 port);
+
+    typedef struct {
+      std::string address;
+      Poco::Net::StreamSocket socket;
+    } Attempt;
+
+    // Address of the first attempt to connect before until has passed
+    // since started. Failed attempts are dropped.
+    static std::string connected(
+        std::vector<Attempt> *attempts,
+        const Poco::Timestamp &started,
+        const Poco::Timestamp::TimeDiff until);
+
+    Poco::Timestamp::TimeDiff ttl_;
+    std::map<std::string, Entry> entries_;
+    Poco::FastMutex m_;
+
+    DNSCache(const DNSCache &);
+    DNSCache &operator=(const DNSCache &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_DNS_CACHE_H_
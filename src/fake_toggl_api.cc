@@ -0,0 +1,383 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./fake_toggl_api.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#include "Poco/DateTime.h"
+#include "Poco/DateTimeFormat.h"
+#include "Poco/DateTimeParser.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Thread.h"
+#include "Poco/URI.h"
+
+namespace kopsik {
+
+FakeTogglAPI::FakeTogglAPI(const std::string &me_json)
+  : HTTPSClient("https://localhost", "kopsik_fake", "0.1")
+  , me_json_(me_json)
+  , running_json_("{\"data\":null}")
+  , latency_millis_(0)
+  , bytes_per_second_(0)
+  , error_percent_(0)
+  , next_id_(900000000) {
+  stats_.requests = 0;
+  stats_.failed_requests = 0;
+  stats_.full_fetches = 0;
+  stats_.delta_fetches = 0;
+  stats_.list_fetches = 0;
+  stats_.batch_updates = 0;
+  stats_.models_pushed = 0;
+  stats_.timeline_uploads = 0;
+  stats_.bytes_received = 0;
+  stats_.bytes_sent = 0;
+  random_.seed(1);
+  parseUser();
+}
+
+void FakeTogglAPI::SetLatencyMillis(const Poco::UInt64 value) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  latency_millis_ = value;
+}
+
+void FakeTogglAPI::SetBytesPerSecond(const Poco::UInt64 value) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  bytes_per_second_ = value;
+}
+
+void FakeTogglAPI::SetRunningTimeEntryJSON(const std::string &json) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  running_json_ = json;
+}
+
+void FakeTogglAPI::SetErrorPercent(
+    const unsigned int value, const Poco::UInt32 seed) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  error_percent_ = value;
+  random_.seed(seed);
+}
+
+FakeTogglAPIStats FakeTogglAPI::Stats() {
+  Poco::FastMutex::ScopedLock lock(m_);
+  return stats_;
+}
+
+error FakeTogglAPI::GetJSON(
+    const std::string relative_url, const std::string basic_auth_username,
+    const std::string basic_auth_password, std::string *response_body) {
+  return respond("GET", relative_url, "", 0, response_body);
+}
+
+error FakeTogglAPI::GetJSON(
+    const std::string relative_url, const std::string basic_auth_username,
+    const std::string basic_auth_password, ResponseHandler *handler) {
+  std::string response_body("");
+  return respond("GET", relative_url, "", handler, &response_body);
+}
+
+error FakeTogglAPI::PostJSON(
+    const std::string relative_url, const std::string &json,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password, std::string *response_body) {
+  return respond("POST", relative_url, json, 0, response_body);
+}
+
+error FakeTogglAPI::PostJSON(
+    const std::string relative_url, const RequestWriter *writer,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password, std::string *response_body) {
+  std::ostringstream body;
+  writer->Write(&body);
+  return respond("POST", relative_url, body.str(), 0, response_body);
+}
+
+error FakeTogglAPI::respond(
+    const std::string &method, const std::string &relative_url,
+    const std::string &payload, ResponseHandler *handler,
+    std::string *response_body) {
+  bool fail(false);
+  {
+    Poco::FastMutex::ScopedLock lock(m_);
+    stats_.requests++;
+    stats_.bytes_received += payload.size();
+    fail = error_percent_ && random_.next(100) < error_percent_;
+    if (fail) {
+      stats_.failed_requests++;
+    }
+  }
+  wait(latency(), payload.size());
+  if (fail) {
+    return "Request to server failed with status code: 500";
+  }
+
+  std::string path(relative_url.substr(0, relative_url.find('?')));
+  if ("GET" == method && "/api/v8/me" == path) {
+    *response_body = me(
+      relative_url.find("&since=") != std::string::npos,
+      relative_url.find("with_related_data=false") == std::string::npos);
+  } else if ("GET" == method && "/api/v8/workspaces" == path) {
+    *response_body = relatedList("workspaces", 0, relative_url);
+  } else if ("GET" == method && 0 == path.find("/api/v8/workspaces/")) {
+    std::string rest(path.substr(strlen("/api/v8/workspaces/")));
+    Poco::UInt64 wid(0);
+    std::string::size_type slash(rest.find('/'));
+    if (std::string::npos == slash
+        || !Poco::NumberParser::tryParseUnsigned64(rest.substr(0, slash),
+                                                  wid)) {
+      return "Request to server failed with status code: 404";
+    }
+    *response_body = relatedList(rest.substr(slash + 1), wid,
+                                 relative_url);
+  } else if ("GET" == method && "/api/v8/time_entries" == path) {
+    *response_body = relatedList("time_entries", 0, relative_url);
+  } else if ("GET" == method && "/api/v8/time_entries/current" == path) {
+    Poco::FastMutex::ScopedLock lock(m_);
+    *response_body = running_json_;
+  } else if ("POST" == method && "/api/v8/batch_updates" == path) {
+    *response_body = batchUpdates(payload);
+  } else if ("POST" == method && "/api/v8/timeline" == path) {
+    Poco::FastMutex::ScopedLock lock(m_);
+    stats_.timeline_uploads++;
+    *response_body = "";
+  } else if ("POST" == method && ("/api/v8/timeline_settings" == path
+                                  || "/api/v8/feedback" == path)) {
+    *response_body = "";
+  } else {
+    return "Request to server failed with status code: 404";
+  }
+
+  {
+    Poco::FastMutex::ScopedLock lock(m_);
+    stats_.bytes_sent += response_body->size();
+  }
+  if (!handler) {
+    wait(0, response_body->size());
+    return noError;
+  }
+  for (std::size_t i = 0; i < response_body->size();
+      i += kFakeTogglAPIChunkSize) {
+    std::size_t size = std::min(kFakeTogglAPIChunkSize,
+                                response_body->size() - i);
+    wait(0, size);
+    handler->Consume(response_body->data() + i, size);
+  }
+  return noError;
+}
+
+std::string FakeTogglAPI::me(const bool delta, const bool with_related_data) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  if (!delta && with_related_data) {
+    stats_.full_fetches++;
+    return me_json_;
+  }
+  if (delta) {
+    stats_.delta_fetches++;
+  }
+  JSONWriter writer;
+  writer.BeginObject();
+  writer.Int("since", std::time(0));
+  writer.Key("data");
+  writer.BeginObject();
+  writer.Int("id", user_id_);
+  writer.String("api_token", api_token_);
+  writer.Int("default_wid", default_wid_);
+  writer.EndObject();
+  writer.EndObject();
+  return writer.Buffer();
+}
+
+std::string FakeTogglAPI::relatedList(
+    const std::string &list, const Poco::UInt64 wid,
+    const std::string &relative_url) {
+  Poco::Timestamp start(0);
+  Poco::Timestamp end(
+    std::numeric_limits<Poco::Timestamp::TimeVal>::max());
+  if ("time_entries" == list) {
+    parseDate(queryParameter(relative_url, "start_date"), &start);
+    parseDate(queryParameter(relative_url, "end_date"), &end);
+  }
+  JSONWriter writer;
+  writer.BeginArray();
+  Poco::FastMutex::ScopedLock lock(m_);
+  stats_.list_fetches++;
+  JSONValue *root = JSONParse(me_json_);
+  JSONValue *data = root ? JSONGet(root, "data") : 0;
+  JSONValue *items = data ? JSONGet(data, list.c_str()) : 0;
+  for (std::size_t i = 0; items && i < JSONSize(items); i++) {
+    JSONValue *item = JSONAt(items, i);
+    JSONValue *item_wid = JSONGet(item, "wid");
+    if (wid && (!item_wid || Poco::UInt64(JSONInt(item_wid)) != wid)) {
+      continue;
+    }
+    if ("time_entries" == list) {
+      Poco::Timestamp started(0);
+      parseDate(nodeString(item, "start"), &started);
+      if (started < start || started >= end) {
+        continue;
+      }
+    }
+    writeNode(item, &writer);
+  }
+  JSONDelete(root);
+  writer.EndArray();
+  return writer.Buffer();
+}
+
+void FakeTogglAPI::writeNode(JSONValue *node, JSONWriter *writer) {
+  switch (JSONTypeOf(node)) {
+  case kJSONObject:
+    writer->BeginObject();
+    for (JSONIterator it = JSONBegin(node); it != JSONEnd(node); ++it) {
+      writer->Key(JSONName(*it));
+      writeNode(*it, writer);
+    }
+    writer->EndObject();
+    break;
+  case kJSONArray:
+    writer->BeginArray();
+    for (JSONIterator it = JSONBegin(node); it != JSONEnd(node); ++it) {
+      writeNode(*it, writer);
+    }
+    writer->EndArray();
+    break;
+  case kJSONString:
+    writer->String(JSONString(node));
+    break;
+  case kJSONNull:
+    writer->Raw("null");
+    break;
+  default:
+    writer->Raw(JSONString(node));
+    break;
+  }
+}
+
+std::string FakeTogglAPI::queryParameter(
+    const std::string &relative_url, const std::string &name) {
+  std::string::size_type at = relative_url.find(name + "=");
+  if (std::string::npos == at) {
+    return "";
+  }
+  at += name.size() + 1;
+  std::string value("");
+  Poco::URI::decode(
+    relative_url.substr(at, relative_url.find('&', at) - at), value);
+  return value;
+}
+
+void FakeTogglAPI::parseDate(const std::string &value, Poco::Timestamp *at) {
+  Poco::DateTime date;
+  int tzd(0);
+  if (Poco::DateTimeParser::tryParse(Poco::DateTimeFormat::ISO8601_FORMAT,
+                                     value, date, tzd)) {
+    date.makeUTC(tzd);
+    *at = date.timestamp();
+  }
+}
+
+std::string FakeTogglAPI::batchUpdates(const std::string &json) {
+  JSONValue *updates = JSONParse(json);
+  if (!updates) {
+    return "[]";
+  }
+  JSONWriter writer;
+  writer.BeginArray();
+  Poco::FastMutex::ScopedLock lock(m_);
+  stats_.batch_updates++;
+  for (std::size_t i = 0; i < JSONSize(updates); i++) {
+    JSONValue *update = JSONAt(updates, i);
+    std::string guid(nodeString(update, "GUID"));
+    std::string method(nodeString(update, "method"));
+    std::string url(nodeString(update, "relative_url"));
+    stats_.models_pushed++;
+
+    writer.BeginObject();
+    writer.Int("status", 200);
+    writer.String("guid", guid);
+    writer.String("method", method);
+    writer.String("content_type", "application/json");
+    if ("DELETE" != method) {
+      Poco::UInt64 id(0);
+      if ("PUT" != method || !Poco::NumberParser::tryParseUnsigned64(
+          url.substr(url.rfind('/') + 1), id)) {
+        id = next_id_++;
+      }
+      // Server echoes the ui_modified_at it was sent
+      Poco::Int64 ui_modified_at(0);
+      JSONValue *body = JSONGet(update, "body");
+      if (body && JSONSize(body)) {
+        JSONValue *at = JSONGet(JSONAt(body, 0), "ui_modified_at");
+        if (at) {
+          ui_modified_at = JSONInt(at);
+        }
+      }
+      JSONWriter data;
+      data.BeginObject();
+      data.Key("data");
+      data.BeginObject();
+      data.Int("id", id);
+      data.Int("ui_modified_at", ui_modified_at);
+      data.EndObject();
+      data.EndObject();
+      writer.String("body", data.Buffer());
+    }
+    writer.EndObject();
+  }
+  writer.EndArray();
+  JSONDelete(updates);
+  return writer.Buffer();
+}
+
+void FakeTogglAPI::parseUser() {
+  user_id_ = 0;
+  default_wid_ = 0;
+  api_token_ = "";
+  JSONValue *root = JSONParse(me_json_);
+  if (!root) {
+    return;
+  }
+  JSONValue *data = JSONGet(root, "data");
+  if (data) {
+    JSONValue *node = JSONGet(data, "id");
+    if (node) {
+      user_id_ = JSONInt(node);
+    }
+    node = JSONGet(data, "default_wid");
+    if (node) {
+      default_wid_ = JSONInt(node);
+    }
+    api_token_ = nodeString(data, "api_token");
+  }
+  JSONDelete(root);
+}
+
+std::string FakeTogglAPI::nodeString(JSONValue *parent, const char *name) {
+  JSONValue *node = JSONGet(parent, name);
+  if (!node) {
+    return "";
+  }
+  return JSONString(node);
+}
+
+Poco::UInt64 FakeTogglAPI::latency() {
+  Poco::FastMutex::ScopedLock lock(m_);
+  return latency_millis_;
+}
+
+void FakeTogglAPI::wait(const Poco::UInt64 millis, const std::size_t bytes) {
+  Poco::UInt64 total(millis);
+  {
+    Poco::FastMutex::ScopedLock lock(m_);
+    if (bytes_per_second_) {
+      total += bytes * 1000 / bytes_per_second_;
+    }
+  }
+  if (total) {
+    Poco::Thread::sleep(static_cast<long>(total));  // NOLINT
+  }
+}
+
+}  // namespace kopsik
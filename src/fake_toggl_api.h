@@ -0,0 +1,143 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_FAKE_TOGGL_API_H_
+#define SRC_FAKE_TOGGL_API_H_
+
+#include <ctime>
+#include <string>
+
+#include "./json_reader.h"
+
+#include "./https_client.h"
+#include "./json_writer.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Random.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Pieces a streamed response is handed over in
+  const std::size_t kFakeTogglAPIChunkSize = 16384;
+
+  // What the fake server has done since start
+  typedef struct {
+    Poco::UInt64 requests;
+    Poco::UInt64 failed_requests;
+    Poco::UInt64 full_fetches;
+    Poco::UInt64 delta_fetches;
+    Poco::UInt64 list_fetches;
+    Poco::UInt64 batch_updates;
+    Poco::UInt64 models_pushed;
+    Poco::UInt64 timeline_uploads;
+    Poco::UInt64 bytes_received;
+    Poco::UInt64 bytes_sent;
+  } FakeTogglAPIStats;
+
+  // Answers requests the way the Toggl API would, in process, for
+  // measuring sync without the network. /me returns the payload it
+  // was made with, or with since a delta where nothing changed on
+  // the server. The workspaces, their lists and time entries come
+  // from the same payload. Batch updates get IDs for created models, timeline
+  // uploads are accepted. Network conditions are made up: every
+  // request waits for the latency and for its bytes to go through
+  // at the bandwidth, and fails at the error rate. Safe to share
+  // between threads.
+  class FakeTogglAPI : public HTTPSClient {
+  public:
+    explicit FakeTogglAPI(const std::string &me_json);
+
+    // Round trip time, added to every request
+    void SetLatencyMillis(const Poco::UInt64 value);
+    // Both ways, 0 for unlimited
+    void SetBytesPerSecond(const Poco::UInt64 value);
+    // Response of /api/v8/time_entries/current
+    void SetRunningTimeEntryJSON(const std::string &json);
+    // Share of requests answered with a server error
+    void SetErrorPercent(const unsigned int value, const Poco::UInt32 seed);
+
+    FakeTogglAPIStats Stats();
+
+    error GetJSON(
+        const std::string relative_url,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        std::string *response_body);
+
+    error GetJSON(
+        const std::string relative_url,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        ResponseHandler *handler);
+
+    error PostJSON(
+        const std::string relative_url,
+        const std::string &json,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        std::string *response_body);
+
+    error PostJSON(
+        const std::string relative_url,
+        const RequestWriter *writer,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        std::string *response_body);
+
+  private:
+    error respond(
+        const std::string &method,
+        const std::string &relative_url,
+        const std::string &payload,
+        ResponseHandler *handler,
+        std::string *response_body);
+
+    // Without related data, only the user fields
+    std::string me(const bool delta, const bool with_related_data);
+
+    // Models of a related data list, of the workspace if wid is set.
+    // Time entries are those started between the dates asked for.
+    std::string relatedList(
+        const std::string &list,
+        const Poco::UInt64 wid,
+        const std::string &relative_url);
+
+    static void writeNode(JSONValue *node, JSONWriter *writer);
+
+    static std::string queryParameter(
+        const std::string &relative_url,
+        const std::string &name);
+
+    // Unchanged if it's not an ISO 8601 date
+    static void parseDate(const std::string &value, Poco::Timestamp *at);
+
+    // Every update succeeds, created models get the next free ID
+    std::string batchUpdates(const std::string &json);
+
+    // User fields that go into every delta
+    void parseUser();
+
+    static std::string nodeString(JSONValue *parent, const char *name);
+
+    Poco::UInt64 latency();
+
+    void wait(const Poco::UInt64 millis, const std::size_t bytes);
+
+    std::string me_json_;
+    std::string running_json_;
+    Poco::UInt64 user_id_;
+    Poco::UInt64 default_wid_;
+    std::string api_token_;
+
+    Poco::UInt64 latency_millis_;
+    Poco::UInt64 bytes_per_second_;
+    unsigned int error_percent_;
+    Poco::Random random_;
+    Poco::UInt64 next_id_;
+    FakeTogglAPIStats stats_;
+    Poco::FastMutex m_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_FAKE_TOGGL_API_H_
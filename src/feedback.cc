@@ -4,8 +4,9 @@
 
 #include <sstream>
 
-#include "./formatter.h"
+#include "./json_writer.h"
 
+#include "Poco/Bugcheck.h"
 #include "Poco/FileStream.h"
 #include "Poco/Base64Encoder.h"
 #include "Poco/StreamCopier.h"
@@ -14,24 +15,32 @@
 namespace kopsik {
 
 const std::string Feedback::JSON() const {
-  JSONNODE *root = json_new(JSON_NODE);
-  json_push_back(root, json_new_b("desktop", true));
-  json_push_back(root, json_new_a("toggl_version", app_version_.c_str()));
-  json_push_back(root, json_new_a("details",
-    Formatter::EscapeJSONString(details_).c_str()));
-  json_push_back(root, json_new_a("subject",
-    Formatter::EscapeJSONString(subject_).c_str()));
-  if (!attachment_path_.empty()) {
-    json_push_back(root, json_new_a("base64_encoded_attachment",
-      base64encode_attachment().c_str()));
-    json_push_back(root, json_new_a("attachment_name",
-      Formatter::EscapeJSONString(filename()).c_str()));
+  std::ostringstream json;
+  Write(&json);
+  return json.str();
+}
+
+void Feedback::Write(std::ostream *out) const {
+  poco_assert(out);
+
+  JSONWriter writer;
+  writer.BeginObject();
+  writer.Bool("desktop", true);
+  writer.String("toggl_version", app_version_);
+  writer.String("details", details_);
+  writer.String("subject", subject_);
+  if (!performance_.empty()) {
+    writer.Raw("performance", performance_);
   }
-  json_char *jc = json_write_formatted(root);
-  std::string json(jc);
-  json_free(jc);
-  json_delete(root);
-  return json;
+  if (attachment_path_.empty()) {
+    writer.EndObject();
+    *out << writer.Buffer();
+    return;
+  }
+  writer.String("attachment_name", filename());
+  *out << writer.Buffer() << ",\"base64_encoded_attachment\":\"";
+  base64encode_attachment(out);
+  *out << "\"}";
 }
 
 const std::string Feedback::filename() const {
@@ -43,17 +52,15 @@ const std::string Feedback::filename() const {
   return p.getFileName();
 }
 
-const std::string Feedback::base64encode_attachment() const {
-  std::ostringstream oss;
+void Feedback::base64encode_attachment(std::ostream *out) const {
   Poco::FileInputStream fis(attachment_path_);
   if (!fis.good()) {
-    return "";
+    return;
   }
-  Poco::Base64Encoder encoder(oss);
+  Poco::Base64Encoder encoder(*out);
   encoder.rdbuf()->setLineLength(0);  // disable line feeds in output
   Poco::StreamCopier::copyStream(fis, encoder);
   encoder.close();
-  return oss.str();
 }
 
 kopsik::error Feedback::Validate() const {
@@ -5,13 +5,17 @@
 
 #include "./feedback.h"
 
+#include <ostream>  // NOLINT
 #include <string>
 
+#include "./https_client.h"
 #include "./types.h"
 
 namespace kopsik {
 
-class Feedback {
+// Written straight into the request when sent, so the attachment is
+// base64 encoded from the file as it goes out, never held in memory.
+class Feedback : public RequestWriter {
   public:
     Feedback(
       const std::string topic,
@@ -20,20 +24,28 @@ class Feedback {
       : subject_(topic)
       , details_(details)
       , attachment_path_(attachment_path)
-      , app_version_("") {}
+      , app_version_("")
+      , performance_("") {}
     ~Feedback() {}
 
     kopsik::error Validate() const;
     const std::string JSON() const;
+    // RequestWriter, writes the JSON
+    void Write(std::ostream *out) const;
     void SetAppVersion(const std::string value) { app_version_ = value; }
+    // JSON object sent along as "performance", see
+    // Context::PerformanceSnapshot
+    void SetPerformance(const std::string value) { performance_ = value; }
+
   private:
     const std::string filename() const;
-    const std::string base64encode_attachment() const;
+    void base64encode_attachment(std::ostream *out) const;
 
     std::string subject_;
     std::string details_;
     std::string attachment_path_;
     std::string app_version_;
+    std::string performance_;
 };
 
 }  // namespace kopsik
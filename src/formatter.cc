@@ -2,6 +2,7 @@
 
 #include "./formatter.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include "Poco/Types.h"
@@ -257,12 +258,67 @@ int Formatter::parseDurationFromDecimal(const std::string value) {
 std::string Formatter::FormatDurationInSeconds(
         const Poco::Int64 value,
         const std::string format) {
+    std::string result;
+    result.reserve(format.size() + 8);
+    AppendDurationInSeconds(value, format, &result);
+    return result;
+}
+
+static void appendNumber(
+        Poco::Int64 value,
+        const int min_width,
+        std::string *out) {
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (end - p < min_width) {
+        *--p = '0';
+    }
+    out->append(p, end);
+}
+
+// Same output as Poco's Timespan formatting, in whole seconds
+void Formatter::AppendDurationInSeconds(
+        const Poco::Int64 value,
+        const std::string &format,
+        std::string *out) {
+    poco_assert(out);
+
     Poco::Int64 duration = value;
     if (duration < 0) {
         duration += time(0);
     }
-    Poco::Timespan span(duration * Poco::Timespan::SECONDS);
-    return Poco::DateTimeFormatter::format(span, format);
+    if (duration < 0) {
+        Poco::Timespan span(duration * Poco::Timespan::SECONDS);
+        Poco::DateTimeFormatter::append(*out, span, format);
+        return;
+    }
+    for (std::string::size_type i = 0; i < format.size(); i++) {
+        if (format[i] != '%') {
+            *out += format[i];
+            continue;
+        }
+        if (++i == format.size()) {
+            break;
+        }
+        switch (format[i]) {
+            case 'd': appendNumber(duration / 86400, 1, out); break;
+            case 'H': appendNumber(duration / 3600 % 24, 2, out); break;
+            case 'h': appendNumber(duration / 3600, 1, out); break;
+            case 'M': appendNumber(duration / 60 % 60, 2, out); break;
+            case 'm': appendNumber(duration / 60, 1, out); break;
+            case 'S': appendNumber(duration % 60, 2, out); break;
+            case 's': appendNumber(duration, 1, out); break;
+            case 'i': out->append("000"); break;
+            case 'c': *out += '0'; break;
+            case 'F': out->append("000000"); break;
+            default: *out += format[i]; break;
+        }
+    }
 }
 
 std::string Formatter::FormatDurationInSecondsHHMMSS(const Poco::Int64 value) {
@@ -280,10 +336,116 @@ std::string Formatter::FormatDurationInSecondsHHMM(
     return FormatDurationInSeconds(value, "%H:%M");
 }
 
+// Days from 1970-01-01 to the given proleptic Gregorian date
+static Poco::Int64 daysFromCivil(int y, const int m, const int d) {
+    y -= m <= 2;
+    const Poco::Int64 era = (y >= 0 ? y : y - 399) / 400;
+    const Poco::Int64 yoe = y - era * 400;
+    const Poco::Int64 doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const Poco::Int64 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civilFromDays(Poco::Int64 z, int *y, int *m, int *d) {
+    z += 719468;
+    const Poco::Int64 era = (z >= 0 ? z : z - 146096) / 146097;
+    const Poco::Int64 doe = z - era * 146097;
+    const Poco::Int64 yoe =
+        (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const Poco::Int64 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const Poco::Int64 mp = (5 * doy + 2) / 153;
+    *d = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+    *m = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+    *y = static_cast<int>(yoe + era * 400 + (*m <= 2));
+}
+
+static bool parseDigits(
+        const std::string &value,
+        const std::string::size_type pos,
+        const std::string::size_type count,
+        int *result) {
+    int n = 0;
+    for (std::string::size_type i = pos; i < pos + count; i++) {
+        if (value[i] < '0' || value[i] > '9') {
+            return false;
+        }
+        n = n * 10 + (value[i] - '0');
+    }
+    *result = n;
+    return true;
+}
+
+bool Formatter::parse8601Fixed(
+        const std::string &value,
+        std::time_t *result) {
+    if (value.size() != 20 && value.size() != 25) {
+        return false;
+    }
+    if (value[4] != '-' || value[7] != '-' || value[10] != 'T'
+            || value[13] != ':' || value[16] != ':') {
+        return false;
+    }
+    int year, month, day, hour, minute, second;
+    if (!parseDigits(value, 0, 4, &year)
+            || !parseDigits(value, 5, 2, &month)
+            || !parseDigits(value, 8, 2, &day)
+            || !parseDigits(value, 11, 2, &hour)
+            || !parseDigits(value, 14, 2, &minute)
+            || !parseDigits(value, 17, 2, &second)) {
+        return false;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > 31
+            || hour > 23 || minute > 59 || second > 59) {
+        return false;
+    }
+    const Poco::Int64 days = daysFromCivil(year, month, day);
+    if (day > 28) {
+        // Leave dates like February 30 for Poco to reject
+        int y, m, d;
+        civilFromDays(days, &y, &m, &d);
+        if (d != day) {
+            return false;
+        }
+    }
+    int tzd = 0;
+    if (value.size() == 20) {
+        if (value[19] != 'Z') {
+            return false;
+        }
+    } else {
+        int tz_hour, tz_minute;
+        if ((value[19] != '+' && value[19] != '-') || value[22] != ':'
+                || !parseDigits(value, 20, 2, &tz_hour)
+                || !parseDigits(value, 23, 2, &tz_minute)) {
+            return false;
+        }
+        tzd = tz_hour * 3600 + tz_minute * 60;
+        if (value[19] == '-') {
+            tzd = -tzd;
+        }
+    }
+    Poco::Int64 seconds = days * 86400
+        + hour * 3600 + minute * 60 + second - tzd;
+    *result = static_cast<std::time_t>(seconds);
+    return true;
+}
+
 std::time_t Formatter::Parse8601(const std::string iso_8601_formatted_date) {
     if ("null" == iso_8601_formatted_date) {
         return 0;
     }
+    std::time_t result;
+    if (parse8601Fixed(iso_8601_formatted_date, &result)) {
+        return result;
+    }
+    return parse8601WithPoco(iso_8601_formatted_date);
+}
+
+std::time_t Formatter::parse8601WithPoco(
+        const std::string iso_8601_formatted_date) {
+    if ("null" == iso_8601_formatted_date) {
+        return 0;
+    }
     int tzd;
     Poco::DateTime dt;
     Poco::DateTimeParser::parse(Poco::DateTimeFormat::ISO8601_FORMAT,
@@ -294,6 +456,51 @@ std::time_t Formatter::Parse8601(const std::string iso_8601_formatted_date) {
 }
 
 std::string Formatter::Format8601(const std::time_t date) {
+    if (!date) {
+        return "null";
+    }
+    Poco::Int64 seconds = date;
+    Poco::Int64 days = seconds / 86400;
+    Poco::Int64 rest = seconds % 86400;
+    if (rest < 0) {
+        rest += 86400;
+        days--;
+    }
+    int year, month, day;
+    civilFromDays(days, &year, &month, &day);
+    if (year < 0 || year > 9999) {
+        return format8601WithPoco(date);
+    }
+    const int hour = static_cast<int>(rest / 3600);
+    const int minute = static_cast<int>(rest / 60 % 60);
+    const int second = static_cast<int>(rest % 60);
+    // Same as Poco's ISO8601_FORMAT gives in UTC
+    char buf[21];
+    buf[0] = static_cast<char>('0' + year / 1000);
+    buf[1] = static_cast<char>('0' + year / 100 % 10);
+    buf[2] = static_cast<char>('0' + year / 10 % 10);
+    buf[3] = static_cast<char>('0' + year % 10);
+    buf[4] = '-';
+    buf[5] = static_cast<char>('0' + month / 10);
+    buf[6] = static_cast<char>('0' + month % 10);
+    buf[7] = '-';
+    buf[8] = static_cast<char>('0' + day / 10);
+    buf[9] = static_cast<char>('0' + day % 10);
+    buf[10] = 'T';
+    buf[11] = static_cast<char>('0' + hour / 10);
+    buf[12] = static_cast<char>('0' + hour % 10);
+    buf[13] = ':';
+    buf[14] = static_cast<char>('0' + minute / 10);
+    buf[15] = static_cast<char>('0' + minute % 10);
+    buf[16] = ':';
+    buf[17] = static_cast<char>('0' + second / 10);
+    buf[18] = static_cast<char>('0' + second % 10);
+    buf[19] = 'Z';
+    buf[20] = 0;
+    return std::string(buf, 20);
+}
+
+std::string Formatter::format8601WithPoco(const std::time_t date) {
     if (!date) {
         return "null";
     }
@@ -302,24 +509,58 @@ std::string Formatter::Format8601(const std::time_t date) {
         Poco::DateTimeFormat::ISO8601_FORMAT);
 }
 
-// http://stackoverflow.com/questions/7724448/simple-json-string-escape-for-c
+static bool needsJSONEscaping(const char c) {
+    return c == '"' || c == '\\' || c == '/'
+        || static_cast<unsigned char>(c) < 0x20;
+}
+
+// libjson writes strings as they are, so they're escaped here
 std::string Formatter::EscapeJSONString(const std::string input) {
-    std::ostringstream ss;
-    for (std::string::const_iterator iter = input.begin();
-            iter != input.end();
-            iter++) {
-        switch (*iter) {
-            case '"': ss << "\""; break;
-            case '/': ss << "\\/"; break;
-            case '\b': ss << "\\b"; break;
-            case '\f': ss << "\\f"; break;
-            case '\n': ss << "\\n"; break;
-            case '\r': ss << "\\r"; break;
-            case '\t': ss << "\\t"; break;
-            default: ss << *iter; break;
+    std::string::const_iterator it =
+        std::find_if(input.begin(), input.end(), needsJSONEscaping);
+    if (it == input.end()) {
+        return input;
+    }
+    std::string result;
+    result.reserve(input.size() + 8);
+    AppendEscapedJSONString(input, &result);
+    return result;
+}
+
+void Formatter::AppendEscapedJSONString(
+        const std::string &input,
+        std::string *out) {
+    poco_assert(out);
+
+    std::string::const_iterator start = input.begin();
+    while (start != input.end()) {
+        // Copy the run of characters that need no escaping at once
+        std::string::const_iterator it =
+            std::find_if(start, input.end(), needsJSONEscaping);
+        out->append(start, it);
+        if (it == input.end()) {
+            break;
         }
+        switch (*it) {
+            case '"': out->append("\\\""); break;
+            case '\\': out->append("\\\\"); break;
+            case '/': out->append("\\/"); break;
+            case '\b': out->append("\\b"); break;
+            case '\f': out->append("\\f"); break;
+            case '\n': out->append("\\n"); break;
+            case '\r': out->append("\\r"); break;
+            case '\t': out->append("\\t"); break;
+            default: {
+                static const char hex[] = "0123456789abcdef";
+                unsigned char c = static_cast<unsigned char>(*it);
+                out->append("\\u00");
+                *out += hex[c >> 4];
+                *out += hex[c & 0xf];
+                break;
+            }
+        }
+        start = it + 1;
     }
-    return ss.str();
 }
 
 }   // namespace kopsik
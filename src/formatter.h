@@ -21,6 +21,12 @@ namespace kopsik {
       static std::string FormatDurationInSeconds(
         const Poco::Int64 value,
         const std::string format);
+      // Appends to the buffer, so formatting into a reused
+      // buffer makes no allocations once it's big enough
+      static void AppendDurationInSeconds(
+        const Poco::Int64 value,
+        const std::string &format,
+        std::string *out);
       static std::string FormatDurationInSecondsHHMMSS(
         const Poco::Int64 value);
       static std::string FormatDurationInSecondsHHMM(
@@ -28,6 +34,11 @@ namespace kopsik {
         const int type);
       static std::time_t Parse8601(
         const std::string iso_8601_formatted_date);
+      // YYYY-MM-DDTHH:MM:SS followed by Z or +HH:MM, as the API
+      // sends. Fails on anything else, where Parse8601 is lenient.
+      static bool parse8601Fixed(
+        const std::string &value,
+        std::time_t *result);
       static int ParseDurationString(
         const std::string value);
       static bool parseDurationStringHHMMSS(
@@ -43,12 +54,21 @@ namespace kopsik {
         const std::string value);
       static std::string Format8601(
         const std::time_t date);
+      // General Poco parser and formatter, for dates
+      // the fixed layout ones above don't handle
+      static std::time_t parse8601WithPoco(
+        const std::string iso_8601_formatted_date);
+      static std::string format8601WithPoco(
+        const std::time_t date);
       static std::string FormatDateHeader(
         const std::time_t date);
       static std::string FormatDateWithTime(
         const std::time_t date);
       static std::string EscapeJSONString(
         const std::string input);
+      static void AppendEscapedJSONString(
+        const std::string &input,
+        std::string *out);
   };
 
 }  // namespace kopsik
@@ -7,4 +7,16 @@
 
 void GetFocusedWindowInfo(std::string *title, std::string *filename);
 
+// Blocks until the focused window or its title may have changed,
+// InterruptFocusedWindowWait is called, or timeout_ms passes.
+// Returns false right away if the platform cannot report focus
+// changes, then the caller has to poll instead.
+bool WaitForFocusedWindowChange(const unsigned int timeout_ms);
+
+void InterruptFocusedWindowWait();
+
+// Seconds since the user last used the keyboard or mouse. Returns
+// false if the platform cannot tell.
+bool GetIdleSeconds(unsigned int *seconds);
+
 #endif  // SRC_GET_FOCUSED_WINDOW_H_
@@ -5,13 +5,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/select.h>
+#include <sys/stat.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
+#include <X11/extensions/scrnsaver.h>
 
 #include <cstring>
 #include <string>
 
+#include "./process_name_cache.h"
+
 #define HANDLE_EINTR(x) ({ \
   typeof(x) __eintr_result__; \
   do { \
@@ -67,11 +72,136 @@ static char *get_property(Display *disp, Window win, Atom xa_prop_type,
     return ret;
 }
 
+// One display connection is kept open for the life of the process,
+// so focus changes can be received as PropertyNotify events.
+// It is only used from the window change recorder thread.
+static Display *display_ = 0;
+static Atom net_active_window_ = None;
+static Atom net_wm_name_ = None;
+static Atom wm_name_ = None;
+
+// Window whose title changes we are subscribed to
+static Window watched_window_ = (Window)0;
+
+// Written to, to wake up WaitForFocusedWindowChange.
+// Created on load, so it exists whichever thread gets to it first.
+static int wake_pipe_[2] = { -1, -1 };
+
+static bool create_wake_pipe() {
+    if (pipe(wake_pipe_) != 0) {
+        wake_pipe_[0] = wake_pipe_[1] = -1;
+        return false;
+    }
+    fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+static const bool wake_pipe_created_ = create_wake_pipe();
+
+// Windows can go away before we get to unsubscribe from them.
+// Default X error handler would exit the process on BadWindow.
+static int ignore_x_error(Display *display, XErrorEvent *event) {
+    return 0;
+}
+
+static Display *focus_display() {
+    if (display_) {
+        return display_;
+    }
+    display_ = XOpenDisplay(NULL);
+    if (!display_) {
+        return 0;
+    }
+    XSetErrorHandler(ignore_x_error);
+    net_active_window_ = XInternAtom(display_, kNetActiveWindow, False);
+    net_wm_name_ = XInternAtom(display_, "_NET_WM_NAME", False);
+    wm_name_ = XInternAtom(display_, "WM_NAME", False);
+    XSelectInput(display_, DefaultRootWindow(display_), PropertyChangeMask);
+    return display_;
+}
+
+static void watch_window(Display *display, Window window) {
+    if (window == watched_window_) {
+        return;
+    }
+    if (watched_window_) {
+        XSelectInput(display, watched_window_, NoEventMask);
+    }
+    if (window) {
+        XSelectInput(display, window, PropertyChangeMask);
+    }
+    watched_window_ = window;
+}
+
+static std::string read_process_name(const unsigned long pid) { // NOLINT
+    std::string name("");
+    char buf[256];
+    snprintf(buf, sizeof(buf), "/proc/%lu/stat", pid);
+    const int fd = open(buf, O_RDONLY);
+    if (fd >= 0) {
+        const ssize_t len = HANDLE_EINTR(read(fd, buf, sizeof(buf) - 1));
+        HANDLE_EINTR(close(fd));
+        if (len > 0) {
+            buf[len] = 0;
+            // The start of the file looks like:
+            //   <pid> (<name>) R <parent pid>
+            unsigned tmp_pid, tmp_ppid;
+            char *process_name = 0;
+            if (sscanf(buf, "%u (%a[^)]) %*c %u", // NOLINT
+                    &tmp_pid, &process_name, &tmp_ppid) == 3) {
+                name = std::string(process_name);
+            }
+            free(process_name);
+        }
+    }
+    return name;
+}
+
+static kopsik::ProcessNameCache process_names_;
+
+static Window last_window_ = (Window)0;
+static unsigned long last_pid_ = 0; // NOLINT
+static std::string last_filename_("");
+
+static std::string process_name(
+        const Window window,
+        const unsigned long pid) { // NOLINT
+    // Still the same window, nothing to look up
+    if (window == last_window_ && pid == last_pid_) {
+        return last_filename_;
+    }
+
+    // /proc/<pid> is created anew for a new process,
+    // so its change time tells a reused PID apart.
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%lu", pid);
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return "";
+    }
+    Poco::UInt64 started = static_cast<Poco::UInt64>(st.st_ctime);
+
+    std::string name("");
+    if (!process_names_.Get(pid, started, &name)) {
+        name = read_process_name(pid);
+        if (name.empty()) {
+            return name;
+        }
+        process_names_.Put(pid, started, name);
+    }
+
+    last_window_ = window;
+    last_pid_ = pid;
+    last_filename_ = name;
+    return name;
+}
+
 int GetFocusedWindowInfo(std::string *title, std::string *filename) {
   *title = "";
   *filename = "";
 
-  Display *display = XOpenDisplay(NULL);
+  Display *display = focus_display();
   if (!display) {
     return 0;
   }
@@ -86,6 +216,9 @@ int GetFocusedWindowInfo(std::string *title, std::string *filename) {
   }
   free(prop);
 
+  // title changes of active window are events, too
+  watch_window(display, active_window);
+
   // get title of active window
   if (active_window) {
     char *net_wm_name = get_property(display, active_window,
@@ -109,32 +242,97 @@ int GetFocusedWindowInfo(std::string *title, std::string *filename) {
     pid = (unsigned long *)get_property(display, active_window, // NOLINT
                 XA_CARDINAL, "_NET_WM_PID", NULL);
     if (pid) {
-      // get process name by pid
-      char buf[256];
-      snprintf(buf, sizeof(buf), "/proc/%lu/stat", *pid);
-      const int fd = open(buf, O_RDONLY);
-      if (fd >= 0) {
-          const ssize_t len = HANDLE_EINTR(read(fd, buf, sizeof(buf) - 1));
-        HANDLE_EINTR(close(fd));
-            if (len > 0) {
-              buf[len] = 0;
-              // The start of the file looks like:
-              //   <pid> (<name>) R <parent pid>
-              unsigned tmp_pid, tmp_ppid;
-              char *process_name = 0;
-              if (sscanf(buf, "%u (%a[^)]) %*c %u", // NOLINT
-                &tmp_pid, &process_name, &tmp_ppid) == 3) {
-            *filename = std::string(process_name);
-          }
-          free(process_name);
-        }
-      }
+      *filename = process_name(active_window, *pid);
     }
     free(pid);
   }
 
-  // Must close display, else max window client count is reached quickly
-  XCloseDisplay(display);
-
   return 1;
 }
+
+bool WaitForFocusedWindowChange(const unsigned int timeout_ms) {
+  Display *display = focus_display();
+  if (!display) {
+    return false;
+  }
+
+  const int x_fd = ConnectionNumber(display);
+  while (true) {
+    bool changed = false;
+    while (XPending(display)) {
+      XEvent event;
+      XNextEvent(display, &event);
+      if (PropertyNotify != event.type) {
+        continue;
+      }
+      Atom atom = event.xproperty.atom;
+      if (net_active_window_ == atom
+          || net_wm_name_ == atom
+          || wm_name_ == atom) {
+        changed = true;
+      }
+    }
+    if (changed) {
+      return true;
+    }
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(x_fd, &fds);
+    int max_fd = x_fd;
+    if (wake_pipe_[0] >= 0) {
+      FD_SET(wake_pipe_[0], &fds);
+      if (wake_pipe_[0] > max_fd) {
+        max_fd = wake_pipe_[0];
+      }
+    }
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    int ready = select(max_fd + 1, &fds, NULL, NULL, &timeout);
+    if (ready <= 0) {
+      // timed out, or interrupted by a signal
+      return true;
+    }
+    if (wake_pipe_[0] >= 0 && FD_ISSET(wake_pipe_[0], &fds)) {
+      char buf[16];
+      while (read(wake_pipe_[0], buf, sizeof(buf)) > 0) {}
+      return true;
+    }
+  }
+}
+
+void InterruptFocusedWindowWait() {
+  if (wake_pipe_[1] >= 0) {
+    const char c = 0;
+    HANDLE_EINTR(write(wake_pipe_[1], &c, 1));
+  }
+}
+
+// Idle time is asked from its own thread, which gets its own
+// connection, as the focus one is used by the recorder's thread.
+static Display *idle_display_ = 0;
+
+bool GetIdleSeconds(unsigned int *seconds) {
+    if (!idle_display_) {
+        idle_display_ = XOpenDisplay(NULL);
+        if (!idle_display_) {
+            return false;
+        }
+    }
+    int event_base(0), error_base(0);
+    if (!XScreenSaverQueryExtension(idle_display_, &event_base, &error_base)) {
+        return false;
+    }
+    XScreenSaverInfo *info = XScreenSaverAllocInfo();
+    if (!info) {
+        return false;
+    }
+    bool ok = XScreenSaverQueryInfo(idle_display_,
+        DefaultRootWindow(idle_display_), info) != 0;
+    if (ok) {
+        *seconds = static_cast<unsigned int>(info->idle / 1000);
+    }
+    XFree(info);
+    return ok;
+}
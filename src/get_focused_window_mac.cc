@@ -1,8 +1,13 @@
 // Copyright 2014 Toggl Desktop developers.
 
 #include <Carbon/Carbon.h>
+#include <IOKit/IOKitLib.h>
+#include <string.h>
+
 #include <string>
 
+#include "./process_name_cache.h"
+
 #include "/System/Library/Frameworks/ApplicationServices.framework/Frameworks/CoreGraphics.framework/Headers/CGWindow.h"
 
 static const int kTitleBufferSize = 255;
@@ -69,7 +74,15 @@ int GetFocusedWindowInfo(std::string *title, std::string *filename) {
   }
   CFRelease(windows);
 
-  // get application filename
+  // get application filename. Process serial numbers are not
+  // reused while the system is up, so no start time is needed.
+  static kopsik::ProcessNameCache process_names;
+  Poco::UInt64 psn =
+    (static_cast<Poco::UInt64>(front_process_serial_number.highLongOfPSN) << 32)
+    | front_process_serial_number.lowLongOfPSN;
+  if (process_names.Get(psn, 0, filename)) {
+    return 0;
+  }
   CFStringRef processName = NULL;
   err = CopyProcessName(&front_process_serial_number, &processName);
   if (err) {
@@ -80,6 +93,139 @@ int GetFocusedWindowInfo(std::string *title, std::string *filename) {
     kFilenameBufferSize, kCFStringEncodingUTF8);
   CFRelease(processName);
   *filename = std::string(filename_buffer);
+  process_names.Put(psn, 0, *filename);
 
   return 0;
 }
+
+// Focus changes are observed through the accessibility API on the
+// thread that waits for them, with the app that is in front. When it
+// is deactivated another app has come to front, and that one is
+// observed next. The observer callbacks and interruptions are sources
+// of the waiting thread's run loop.
+
+static CFRunLoopRef run_loop_ = 0;
+static CFRunLoopSourceRef wake_source_ = 0;
+static AXObserverRef observer_ = 0;
+static pid_t observed_pid_ = 0;
+
+static const CFStringRef kObservedNotifications[] = {
+  kAXApplicationDeactivatedNotification,
+  kAXFocusedWindowChangedNotification,
+  kAXMainWindowChangedNotification,
+  kAXTitleChangedNotification
+};
+
+static void on_ax_notification(
+    AXObserverRef observer,
+    AXUIElementRef element,
+    CFStringRef notification,
+    void *refcon) {
+  if (CFEqual(notification, kAXApplicationDeactivatedNotification)) {
+    // Observed again for the next app in front
+    observed_pid_ = 0;
+  }
+}
+
+static void on_wake(void *info) {
+}
+
+static void stop_observing() {
+  if (!observer_) {
+    return;
+  }
+  CFRunLoopRemoveSource(run_loop_, AXObserverGetRunLoopSource(observer_),
+    kCFRunLoopDefaultMode);
+  CFRelease(observer_);
+  observer_ = 0;
+  observed_pid_ = 0;
+}
+
+static void observe_front_process() {
+  ProcessSerialNumber front_process_serial_number;
+  pid_t pid = 0;
+  if (GetFrontProcess(&front_process_serial_number)
+      || GetProcessPID(&front_process_serial_number, &pid)) {
+    stop_observing();
+    return;
+  }
+  if (observer_ && pid == observed_pid_) {
+    return;
+  }
+  stop_observing();
+
+  if (AXObserverCreate(pid, on_ax_notification, &observer_)) {
+    observer_ = 0;
+    return;
+  }
+  // Notifications of its windows come through the application element
+  AXUIElementRef app = AXUIElementCreateApplication(pid);
+  for (size_t i = 0;
+      i < sizeof(kObservedNotifications) / sizeof(kObservedNotifications[0]);
+      i++) {
+    AXObserverAddNotification(observer_, app, kObservedNotifications[i], 0);
+  }
+  CFRelease(app);
+  CFRunLoopAddSource(run_loop_, AXObserverGetRunLoopSource(observer_),
+    kCFRunLoopDefaultMode);
+  observed_pid_ = pid;
+}
+
+bool WaitForFocusedWindowChange(const unsigned int timeout_ms) {
+  // Apps can be observed only when the user has allowed it
+  if (!AXIsProcessTrusted()) {
+    stop_observing();
+    return false;
+  }
+
+  if (!run_loop_) {
+    CFRunLoopSourceContext context;
+    memset(&context, 0, sizeof(context));
+    context.perform = on_wake;
+    CFRunLoopSourceRef source = CFRunLoopSourceCreate(0, 0, &context);
+    if (!source) {
+      return false;
+    }
+    CFRunLoopAddSource(CFRunLoopGetCurrent(), source, kCFRunLoopDefaultMode);
+    run_loop_ = CFRunLoopGetCurrent();
+    wake_source_ = source;
+  }
+
+  observe_front_process();
+
+  // Returns after a notification, an interruption or the timeout
+  CFRunLoopRunInMode(kCFRunLoopDefaultMode, timeout_ms / 1000.0, true);
+  return true;
+}
+
+void InterruptFocusedWindowWait() {
+  if (wake_source_) {
+    CFRunLoopSourceSignal(wake_source_);
+    CFRunLoopWakeUp(run_loop_);
+  }
+}
+
+bool GetIdleSeconds(unsigned int *seconds) {
+  io_service_t hid_system = IOServiceGetMatchingService(kIOMasterPortDefault,
+    IOServiceMatching("IOHIDSystem"));
+  if (!hid_system) {
+    return false;
+  }
+  CFTypeRef idle_time = IORegistryEntryCreateCFProperty(hid_system,
+    CFSTR("HIDIdleTime"), kCFAllocatorDefault, 0);
+  IOObjectRelease(hid_system);
+  if (!idle_time) {
+    return false;
+  }
+  // Nanoseconds
+  SInt64 nanoseconds(0);
+  bool ok = CFGetTypeID(idle_time) == CFNumberGetTypeID()
+    && CFNumberGetValue(static_cast<CFNumberRef>(idle_time),
+                        kCFNumberSInt64Type, &nanoseconds);
+  CFRelease(idle_time);
+  if (!ok) {
+    return false;
+  }
+  *seconds = static_cast<unsigned int>(nanoseconds / 1000000000);
+  return true;
+}
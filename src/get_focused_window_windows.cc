@@ -5,6 +5,10 @@
 #pragma comment(lib, "psapi.lib")
 #include <time.h>
 
+#include <string>
+
+#include "./process_name_cache.h"
+
 static const int kFilenameBufferSize = 255;
 
 template <class string_type>
@@ -33,11 +37,145 @@ void GetFocusedWindowInfo(std::string *title, std::string *filename) {
   DWORD process_id;
   GetWindowThreadProcessId(window_handle, &process_id);
 
-  // get the filename of another process
+  // Still the same window, nothing to look up
+  static HWND last_window_handle = 0;
+  static DWORD last_process_id = 0;
+  static std::string last_filename("");
+  if (window_handle == last_window_handle && process_id == last_process_id) {
+    *filename = last_filename;
+    return;
+  }
+
   HANDLE ps = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE,
     process_id);
-  CHAR filename_buffer[kFilenameBufferSize];
-  if (GetModuleFileNameExA(ps, 0, filename_buffer, kFilenameBufferSize) > 0) {
+  if (!ps) {
+    return;
+  }
+
+  // Creation time tells a reused process ID apart
+  Poco::UInt64 started = 0;
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (GetProcessTimes(ps, &creation_time, &exit_time,
+      &kernel_time, &user_time)) {
+    started = (static_cast<Poco::UInt64>(creation_time.dwHighDateTime) << 32)
+      | creation_time.dwLowDateTime;
+  }
+
+  // get the filename of another process
+  static kopsik::ProcessNameCache process_names;
+  if (!process_names.Get(process_id, started, filename)) {
+    CHAR filename_buffer[kFilenameBufferSize];
+    if (GetModuleFileNameExA(ps, 0, filename_buffer,
+        kFilenameBufferSize) > 0) {
       *filename = std::string(filename_buffer);
+      process_names.Put(process_id, started, *filename);
+    }
+  }
+  CloseHandle(ps);
+
+  last_window_handle = window_handle;
+  last_process_id = process_id;
+  last_filename = *filename;
+}
+
+// Set by the event hooks when the foreground window or its title
+// changes, and by InterruptFocusedWindowWait.
+static HANDLE focus_changed_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+static HANDLE interrupted_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+// Whether the hooks are in place, set once by the hook thread
+static HANDLE hooks_ready_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+static volatile LONG hooks_installed_ = 0;
+
+static void CALLBACK on_win_event(
+    HWINEVENTHOOK hook,
+    DWORD event,
+    HWND window_handle,
+    LONG object_id,
+    LONG child_id,
+    DWORD event_thread,
+    DWORD event_time) {
+  if (EVENT_OBJECT_NAMECHANGE == event) {
+    // Any window or control may be renamed, only the title of the
+    // foreground window is recorded
+    if (OBJID_WINDOW != object_id || CHILDID_SELF != child_id
+        || window_handle != GetForegroundWindow()) {
+      return;
+    }
+  }
+  SetEvent(focus_changed_);
+}
+
+// Out of context hooks are called on the thread that set them, which
+// must keep pumping messages for that. It runs as long as the process.
+static DWORD WINAPI hook_thread(LPVOID) {
+  HWINEVENTHOOK foreground = SetWinEventHook(
+    EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND,
+    NULL, on_win_event, 0, 0,
+    WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+  HWINEVENTHOOK name_change = SetWinEventHook(
+    EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE,
+    NULL, on_win_event, 0, 0,
+    WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+  if (foreground && name_change) {
+    InterlockedExchange(&hooks_installed_, 1);
+  }
+  SetEvent(hooks_ready_);
+  if (!hooks_installed_) {
+    if (foreground) {
+      UnhookWinEvent(foreground);
+    }
+    if (name_change) {
+      UnhookWinEvent(name_change);
+    }
+    return 0;
+  }
+
+  MSG msg;
+  while (GetMessage(&msg, NULL, 0, 0) > 0) {
+    TranslateMessage(&msg);
+    DispatchMessage(&msg);
+  }
+  return 0;
+}
+
+static bool start_hooks() {
+  static volatile LONG started = 0;
+  if (!InterlockedExchange(&started, 1)) {
+    HANDLE thread = CreateThread(NULL, 0, hook_thread, NULL, 0, NULL);
+    if (thread) {
+      CloseHandle(thread);
+    } else {
+      SetEvent(hooks_ready_);
+    }
+  }
+  WaitForSingleObject(hooks_ready_, INFINITE);
+  return hooks_installed_ != 0;
+}
+
+bool WaitForFocusedWindowChange(const unsigned int timeout_ms) {
+  if (!focus_changed_ || !interrupted_ || !hooks_ready_ || !start_hooks()) {
+    // Without the hooks the focused window is polled
+    return false;
+  }
+  HANDLE events[] = { focus_changed_, interrupted_ };
+  WaitForMultipleObjects(2, events, FALSE, timeout_ms);
+  return true;
+}
+
+void InterruptFocusedWindowWait() {
+  if (interrupted_) {
+    SetEvent(interrupted_);
+  }
+}
+
+bool GetIdleSeconds(unsigned int *seconds) {
+  LASTINPUTINFO last_input;
+  last_input.cbSize = sizeof(last_input);
+  if (!GetLastInputInfo(&last_input)) {
+    return false;
   }
+  // Tick counts wrap around, the difference is still right
+  *seconds = (GetTickCount() - last_input.dwTime) / 1000;
+  return true;
 }
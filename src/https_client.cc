@@ -2,15 +2,27 @@
 
 #include "./https_client.h"
 
+#include <algorithm>
 #include <string>
 #include <sstream>
+#include <vector>
 
+#include "Poco/CountingStream.h"
+#include "Poco/DateTime.h"
+#include "Poco/DateTimeFormat.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/DateTimeParser.h"
 #include "Poco/Exception.h"
 #include "Poco/InflatingStream.h"
 #include "Poco/DeflatingStream.h"
 #include "Poco/Logger.h"
 #include "Poco/URI.h"
 #include "Poco/NumberParser.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/SingletonHolder.h"
+#include "Poco/StreamCopier.h"
+#include "Poco/String.h"
+#include "Poco/Thread.h"
 #include "Poco/Net/Context.h"
 #include "Poco/Net/NameValueCollection.h"
 #include "Poco/Net/HTTPMessage.h"
@@ -19,16 +31,474 @@
 #include "Poco/Net/AcceptCertificateHandler.h"
 #include "Poco/Net/SSLManager.h"
 #include "Poco/Net/PrivateKeyPassphraseHandler.h"
+#include "Poco/Net/NetException.h"
 #include "Poco/Net/SecureStreamSocket.h"
+#include "Poco/Net/SocketDefs.h"
 
-#include "./libjson.h"
+#include "./connectivity_monitor.h"
+#include "./const.h"
+#include "./dns_cache.h"
+#include "./log.h"
+#include "./metrics.h"
+#include "./traffic_recorder.h"
 #include "./version.h"
 
 namespace kopsik {
 
+// Idle keep-alive sessions are closed after this time,
+// before the server is likely to drop them on its side.
+const Poco::Timestamp::TimeDiff kIdleSessionTimeoutMicros =
+  30 * Poco::Timestamp::resolution();
+
+const unsigned int kMaxIdleSessionsPerHost = 4;
+
+const std::streamsize kResponseChunkSize = 64 * 1024;
+
+// Not among Poco's HTTPResponse statuses
+const int kHTTPTooManyRequests = 429;
+
+// Waits for the rate limiter are slept in steps this long,
+// so that cancellation is noticed meanwhile
+const Poco::Timestamp::TimeDiff kRateLimitWaitStepMicros = 100000;
+
+Poco::Timestamp::TimeDiff RetryAfterMicros(
+    const std::string &value,
+    const Poco::Timestamp &now) {
+  std::string trimmed = Poco::trim(value);
+  Poco::Timestamp::TimeDiff micros(kHTTPSRetryAfterDefaultMicros);
+  if (trimmed.empty()) {
+    return micros;
+  }
+  unsigned int seconds(0);
+  Poco::DateTime date;
+  int tzd(0);
+  if (Poco::NumberParser::tryParseUnsigned(trimmed, seconds)) {
+    micros = Poco::Timestamp::TimeDiff(seconds)
+      * Poco::Timestamp::resolution();
+  } else if (Poco::DateTimeParser::tryParse(
+      Poco::DateTimeFormat::HTTP_FORMAT, trimmed, date, tzd)
+      // The parser skips what it doesn't understand, so only
+      // a GMT date that reads back the same was really one
+      && Poco::DateTimeFormatter::format(
+        date, Poco::DateTimeFormat::HTTP_FORMAT) == trimmed) {
+    micros = std::max(date.timestamp() - now, Poco::Timestamp::TimeDiff(0));
+  }
+  return std::min(micros,
+                  Poco::Timestamp::TimeDiff(kHTTPSRetryAfterMaxMicros));
+}
+
+bool IsSinceRefused(const int status) {
+  return Poco::Net::HTTPResponse::HTTP_BAD_REQUEST == status
+    || Poco::Net::HTTPResponse::HTTP_GONE == status;
+}
+
+static bool isTimeout(const Poco::Exception &exc) {
+  try {
+    exc.rethrow();
+  } catch(const Poco::TimeoutException &) {
+    return true;
+  } catch(const Poco::Exception &) {
+  }
+  return false;
+}
+
+// Failures to connect that mean the network, not the server, is gone
+static bool isNetworkDown(const Poco::Exception &exc) {
+  try {
+    exc.rethrow();
+  } catch(const Poco::Net::DNSException &) {
+    return true;
+  } catch(const Poco::Exception &) {
+  }
+  if (isTimeout(exc)) {
+    return true;
+  }
+  return POCO_ENETDOWN == exc.code()
+    || POCO_ENETUNREACH == exc.code()
+    || POCO_EHOSTUNREACH == exc.code();
+}
+
+HTTPSRateLimiter &HTTPSRateLimiter::Instance() {
+  static Poco::SingletonHolder<HTTPSRateLimiter> sh;
+  return *sh.get();
+}
+
+HTTPSRateLimiter::Bucket &HTTPSRateLimiter::bucket(
+    const Poco::URI &uri,
+    const Poco::Timestamp &now) {
+  std::map<std::string, Bucket>::iterator it =
+    buckets_.find(uri.getHost());
+  if (it == buckets_.end()) {
+    Bucket b;
+    b.tokens = burst_;
+    b.refilled_at = now;
+    b.retry_at = now;
+    it = buckets_.insert(std::make_pair(uri.getHost(), b)).first;
+  }
+  Bucket &b = it->second;
+  if (now > b.refilled_at) {
+    b.tokens = std::min(burst_, b.tokens
+      + per_second_ * (now - b.refilled_at) / Poco::Timestamp::resolution());
+    b.refilled_at = now;
+  }
+  return b;
+}
+
+Poco::Timestamp::TimeDiff HTTPSRateLimiter::Reserve(
+    const Poco::URI &uri,
+    const Poco::Timestamp &now,
+    const Poco::Timestamp::TimeDiff max_wait) {
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  Bucket &b = bucket(uri, now);
+  if (b.retry_at > now) {
+    return std::max(b.retry_at - now, max_wait + 1);
+  }
+  Poco::Timestamp::TimeDiff wait(0);
+  if (b.tokens < 1) {
+    wait = Poco::Timestamp::TimeDiff((1 - b.tokens)
+      * Poco::Timestamp::resolution() / per_second_) + 1;
+  }
+  if (wait > max_wait) {
+    return wait;
+  }
+  // Taken in advance, the ones who come next wait for the refill
+  b.tokens -= 1;
+  return wait;
+}
+
+void HTTPSRateLimiter::Defer(
+    const Poco::URI &uri,
+    const Poco::Timestamp &retry_at) {
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  Poco::Timestamp now;
+  Bucket &b = bucket(uri, now);
+  if (retry_at > b.retry_at) {
+    b.retry_at = retry_at;
+  }
+  // Requests come back gradually, not all at once when it's over
+  b.tokens = 0;
+  b.refilled_at = b.retry_at;
+}
+
+Poco::Timestamp HTTPSRateLimiter::RetryAt(
+    const Poco::URI &uri,
+    const Poco::Timestamp &now) const {
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  std::map<std::string, Bucket>::const_iterator it =
+    buckets_.find(uri.getHost());
+  if (it == buckets_.end() || it->second.retry_at < now) {
+    return now;
+  }
+  return it->second.retry_at;
+}
+
+HTTPSSessionPool::~HTTPSSessionPool() {
+  Clear();
+}
+
+HTTPSSessionPool &HTTPSSessionPool::Instance() {
+  static Poco::SingletonHolder<HTTPSSessionPool> sh;
+  return *sh.get();
+}
+
+std::string HTTPSSessionPool::key(
+    const Poco::URI &uri,
+    const Proxy &proxy) const {
+  std::stringstream ss;
+  ss << uri.getHost() << ":" << uri.getPort();
+  if (proxy.IsConfigured()) {
+    ss << " via " << proxy.username << "@" << proxy.host << ":" << proxy.port;
+  }
+  return ss.str();
+}
+
+Poco::Net::Context::Ptr HTTPSSessionPool::TLSContext() {
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  if (context_.isNull()) {
+    MetricsTimer timer("startup.ssl_init");
+
+    if (!ssl_initialized_) {
+      Poco::Net::initializeSSL();
+      ssl_initialized_ = true;
+    }
+
+    Poco::SharedPtr<Poco::Net::InvalidCertificateHandler> acceptCertHandler =
+      new Poco::Net::AcceptCertificateHandler(true);
+
+    context_ = new Poco::Net::Context(
+      Poco::Net::Context::CLIENT_USE, "",
+      Poco::Net::Context::VERIFY_RELAXED, 9, true, "ALL");
+
+    // Lets new connections resume the last TLS session to the host
+    context_->enableSessionCache(true);
+
+    Poco::Net::SSLManager::instance().initializeClient(
+      0, acceptCertHandler, context_);
+  }
+  return context_;
+}
+
+Poco::Net::HTTPSClientSession *HTTPSSessionPool::Acquire(
+    const Poco::URI &uri,
+    const Proxy &proxy,
+    const Poco::Timespan &max_wait,
+    bool *reused) {
+  poco_assert(reused);
+
+  // Looked up before taking the lock, the first lookup can take long.
+  // Through a proxy, it's the proxy that looks the host up.
+  std::string address("");
+  if (!proxy.IsConfigured()) {
+    address = DNSCache::Shared().Address(uri.getHost(), uri.getPort());
+  }
+
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  std::string k = key(uri, proxy);
+  Poco::Timestamp started;
+  while (true) {
+    closeExpired();
+    std::vector<IdleSession> &idle = idle_[k];
+    if (!idle.empty()) {
+      Poco::Net::HTTPSClientSession *session = idle.back().session;
+      idle.pop_back();
+      busy_[k]++;
+      *reused = true;
+      return session;
+    }
+    if (busy_[k] < kHTTPSMaxSessionsPerHost) {
+      break;
+    }
+    Poco::Timestamp::TimeDiff left =
+      max_wait.totalMicroseconds() - started.elapsed();
+    if (left <= 0) {
+      return 0;
+    }
+    long millis = static_cast<long>(left / 1000) + 1;  // NOLINT
+    if (!released_.tryWait(mutex_, millis)) {
+      return 0;
+    }
+  }
+  Metrics::Shared().Count("http.sessions_opened", 1);
+  busy_[k]++;
+
+  *reused = false;
+
+  Poco::Net::HTTPSClientSession *session = 0;
+  Poco::Net::Session::Ptr tls_session = tls_sessions_[k];
+  if (tls_session.isNull()) {
+    session = new Poco::Net::HTTPSClientSession(
+      uri.getHost(), uri.getPort(), TLSContext());
+  } else {
+    session = new Poco::Net::HTTPSClientSession(
+      uri.getHost(), uri.getPort(), TLSContext(), tls_session);
+  }
+  if (proxy.IsConfigured()) {
+    session->setProxy(proxy.host, proxy.port);
+    if (proxy.HasCredentials()) {
+      session->setProxyCredentials(proxy.username, proxy.password);
+    }
+  } else if (!address.empty()) {
+    // Still verified and named (SNI) as the host it was made for
+    session->setHost(address);
+  }
+  session->setKeepAlive(true);
+  session->setKeepAliveTimeout(Poco::Timespan(kIdleSessionTimeoutMicros));
+  session->setTimeout(Poco::Timespan(10 * Poco::Timespan::SECONDS));
+  return session;
+}
+
+void HTTPSSessionPool::Release(
+    const Poco::URI &uri,
+    const Proxy &proxy,
+    Poco::Net::HTTPSClientSession *session,
+    const bool reusable) {
+  poco_assert(session);
+
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  std::string k = key(uri, proxy);
+  if (busy_[k]) {
+    busy_[k]--;
+  }
+  // Whether or not it's kept, another may be opened in its place
+  released_.broadcast();
+
+  if (!reusable || !session->connected()) {
+    delete session;
+    return;
+  }
+
+  if (!session->sslSession().isNull()) {
+    tls_sessions_[k] = session->sslSession();
+  }
+
+  std::vector<IdleSession> &idle = idle_[k];
+  if (idle.size() >= kMaxIdleSessionsPerHost) {
+    delete session;
+    return;
+  }
+
+  IdleSession entry;
+  entry.session = session;
+  idle.push_back(entry);
+}
+
+Poco::Net::Session::Ptr HTTPSSessionPool::TLSSession(
+    const Poco::URI &uri,
+    const Proxy &proxy) {
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  std::map<std::string, Poco::Net::Session::Ptr>::const_iterator it =
+    tls_sessions_.find(key(uri, proxy));
+  if (it == tls_sessions_.end()) {
+    return Poco::Net::Session::Ptr();
+  }
+  return it->second;
+}
+
+void HTTPSSessionPool::KeepTLSSession(
+    const Poco::URI &uri,
+    const Proxy &proxy,
+    Poco::Net::Session::Ptr tls_session) {
+  if (tls_session.isNull()) {
+    return;
+  }
+
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  tls_sessions_[key(uri, proxy)] = tls_session;
+}
+
+void HTTPSSessionPool::closeExpired() {
+  for (std::map<std::string, std::vector<IdleSession> >::iterator it =
+      idle_.begin();
+      it != idle_.end();
+      it++) {
+    std::vector<IdleSession> &idle = it->second;
+    std::vector<IdleSession>::iterator session = idle.begin();
+    while (session != idle.end()) {
+      if (session->since.isElapsed(kIdleSessionTimeoutMicros)) {
+        delete session->session;
+        session = idle.erase(session);
+      } else {
+        ++session;
+      }
+    }
+  }
+}
+
+void HTTPSSessionPool::Clear() {
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  for (std::map<std::string, std::vector<IdleSession> >::iterator it =
+      idle_.begin();
+      it != idle_.end();
+      it++) {
+    for (std::vector<IdleSession>::iterator session = it->second.begin();
+        session != it->second.end();
+        session++) {
+      delete session->session;
+    }
+  }
+  idle_.clear();
+  tls_sessions_.clear();
+  context_ = 0;
+
+  if (ssl_initialized_) {
+    Poco::Net::uninitializeSSL();
+    ssl_initialized_ = false;
+  }
+}
+
+void HTTPSSessionPool::Join() {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  users_++;
+}
+
+void HTTPSSessionPool::Leave() {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  poco_assert(users_ > 0);
+  if (!--users_) {
+    Clear();
+  }
+}
+
+void HTTPSCancellation::Cancel() {
+  Poco::Mutex::ScopedLock lock(mutex_);
+
+  cancelled_ = true;
+  // Reads and writes blocked on the sockets fail right away
+  for (std::set<Poco::Net::HTTPSClientSession *>::iterator it =
+      sessions_.begin();
+      it != sessions_.end();
+      it++) {
+    try {
+      (*it)->abort();
+    } catch(const Poco::Exception& exc) {
+      Poco::Logger::get("https_client").debug(
+        "Aborting request failed: " + exc.displayText());
+    }
+  }
+}
+
+bool HTTPSCancellation::IsCancelled() const {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  return cancelled_;
+}
+
+bool HTTPSCancellation::Attach(Poco::Net::HTTPSClientSession *session) {
+  poco_assert(session);
+
+  Poco::Mutex::ScopedLock lock(mutex_);
+  if (cancelled_) {
+    return false;
+  }
+  sessions_.insert(session);
+  return true;
+}
+
+void HTTPSCancellation::Detach(Poco::Net::HTTPSClientSession *session) {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  sessions_.erase(session);
+}
+
+HTTPSDeadlines HTTPSClient::DefaultDeadlines() {
+  HTTPSDeadlines deadlines;
+  deadlines.connect = kHTTPSConnectTimeoutMicros;
+  deadlines.first_byte = kHTTPSFirstByteTimeoutMicros;
+  deadlines.total = kHTTPSTotalTimeoutMicros;
+  return deadlines;
+}
+
+Poco::Timespan HTTPSClient::timeLeft(
+    const Poco::Timestamp &started,
+    const Poco::Timestamp::TimeDiff limit) const {
+  if (!cancellation_.isNull() && cancellation_->IsCancelled()) {
+    throw Poco::Exception(kRequestCancelled);
+  }
+  Poco::Timestamp::TimeDiff left = deadlines_.total - started.elapsed();
+  if (left <= 0) {
+    throw Poco::TimeoutException("Request took too long");
+  }
+  return Poco::Timespan(std::min(left, limit));
+}
+
+HTTPSTrafficStats HTTPSClient::traffic_stats_ = { 0, 0, 0, 0, 0 };
+Poco::Mutex HTTPSClient::traffic_stats_m_;
+
+HTTPSTrafficStats HTTPSClient::TrafficStats() {
+  Poco::Mutex::ScopedLock lock(traffic_stats_m_);
+  return traffic_stats_;
+}
+
 error HTTPSClient::PostJSON(
     const std::string relative_url,
-    const std::string json,
+    const std::string &json,
     const std::string basic_auth_username,
     const std::string basic_auth_password,
     std::string *response_body) {
@@ -37,6 +507,26 @@ error HTTPSClient::PostJSON(
     json,
     basic_auth_username,
     basic_auth_password,
+    0,
+    response_body);
+}
+
+error HTTPSClient::PostJSON(
+    const std::string relative_url,
+    const RequestWriter *writer,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password,
+    std::string *response_body) {
+  poco_assert(writer);
+
+  return request(Poco::Net::HTTPRequest::HTTP_POST,
+    relative_url,
+    "",
+    writer,
+    basic_auth_username,
+    basic_auth_password,
+    0,
+    0,
     response_body);
 }
 
@@ -50,122 +540,450 @@ error HTTPSClient::GetJSON(
     "",
     basic_auth_username,
     basic_auth_password,
+    0,
+    response_body);
+}
+
+error HTTPSClient::GetJSON(
+    const std::string relative_url,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password,
+    ResponseHandler *handler) {
+  poco_assert(handler);
+
+  std::string response_body("");
+  return requestJSON(Poco::Net::HTTPRequest::HTTP_GET,
+    relative_url,
+    "",
+    basic_auth_username,
+    basic_auth_password,
+    handler,
+    &response_body);
+}
+
+error HTTPSClient::ConditionalGetJSON(
+    const std::string relative_url,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password,
+    HTTPValidators *validators,
+    std::string *response_body) {
+  poco_assert(validators);
+
+  return request(Poco::Net::HTTPRequest::HTTP_GET,
+    relative_url,
+    "",
+    0,
+    basic_auth_username,
+    basic_auth_password,
+    0,
+    validators,
     response_body);
 }
 
 error HTTPSClient::requestJSON(
     const std::string method,
     const std::string relative_url,
-    const std::string json,
+    const std::string &json,
     const std::string basic_auth_username,
     const std::string basic_auth_password,
+    ResponseHandler *handler,
     std::string *response_body) {
   return request(
     method,
     relative_url,
     json,
+    0,
     basic_auth_username,
     basic_auth_password,
+    handler,
+    0,
     response_body);
 }
 
+// Hands the body on, keeping a copy for TrafficRecorder
+class RecordingResponseHandler : public ResponseHandler {
+ public:
+  RecordingResponseHandler(ResponseHandler *handler, std::string *body)
+    : handler_(handler)
+    , body_(body) {}
+
+  void Consume(const char *data, const std::size_t size) {
+    body_->append(data, size);
+    handler_->Consume(data, size);
+  }
+
+ private:
+  ResponseHandler *handler_;
+  std::string *body_;
+};
+
 error HTTPSClient::request(
     const std::string method,
     const std::string relative_url,
-    const std::string payload,
+    const std::string &payload,
+    const RequestWriter *writer,
     const std::string basic_auth_username,
     const std::string basic_auth_password,
+    ResponseHandler *handler,
+    HTTPValidators *validators,
+    std::string *response_body) {
+  TrafficRecorder &recorder = TrafficRecorder::Instance();
+  if (!recorder.IsRecording()) {
+    return perform(method, relative_url, payload, writer,
+                   basic_auth_username, basic_auth_password,
+                   handler, validators, response_body);
+  }
+
+  Poco::Timestamp started;
+  std::string request_body(payload);
+  if (writer) {
+    std::stringstream ss;
+    writer->Write(&ss);
+    request_body = ss.str();
+    // Recorded as it was before it was gzipped, like other bodies
+    if (writer->GzippedFrom() > 0) {
+      std::istringstream gzipped(request_body);
+      Poco::InflatingInputStream inflater(gzipped,
+        Poco::InflatingStreamBuf::STREAM_GZIP);
+      request_body.clear();
+      Poco::StreamCopier::copyToString(inflater, request_body);
+    }
+  }
+  std::string handled_body("");
+  RecordingResponseHandler recording(handler, &handled_body);
+  error err = perform(method, relative_url, payload, writer,
+                      basic_auth_username, basic_auth_password,
+                      handler ? &recording : 0, validators, response_body);
+  recorder.RecordHTTP(method, relative_url, request_body, started, err,
+                      handler ? handled_body : *response_body);
+  return err;
+}
+
+error HTTPSClient::perform(
+    const std::string method,
+    const std::string relative_url,
+    const std::string &payload,
+    const RequestWriter *writer,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password,
+    ResponseHandler *handler,
+    HTTPValidators *validators,
     std::string *response_body) {
   poco_assert(!method.empty());
   poco_assert(!relative_url.empty());
   poco_assert(response_body);
 
   *response_body = "";
+  last_status_ = 0;
+
+  MetricsTimer timer("http." + method + " " + MetricsEndpoint(relative_url));
+
+  Poco::Timestamp started;
 
   try {
     Poco::URI uri(api_url_);
 
-    Poco::SharedPtr<Poco::Net::InvalidCertificateHandler> acceptCertHandler =
-      new Poco::Net::AcceptCertificateHandler(true);
+    // Network tasks are paused until the network is back
+    ConnectivityMonitor &connectivity = ConnectivityMonitor::Instance();
+    if (connectivity.IsOffline()) {
+      return kRequestOffline;
+    }
 
-    Poco::Net::Context::Ptr context(new Poco::Net::Context(
-      Poco::Net::Context::CLIENT_USE, "",
-      Poco::Net::Context::VERIFY_RELAXED, 9, true, "ALL"));
+    HTTPSSessionPool &pool = HTTPSSessionPool::Instance();
+    HTTPSRateLimiter &limiter = HTTPSRateLimiter::Instance();
 
-/*
-    const Poco::Net::Context::Ptr context(new Poco::Net::Context(
-      Poco::Net::Context::CLIENT_USE, "", "", "",
-      Poco::Net::Context::VERIFY_NONE, 9, false,
-      "ALL:!ADH:!LOW:!EXP:!MD5:@STRENGTH"));
-*/
+    int status(0);
+    for (int attempt = 0; ; attempt++) {
+      Poco::Timestamp::TimeDiff wait = limiter.Reserve(
+        uri, Poco::Timestamp(), kHTTPSRateLimitMaxWaitMicros);
+      if (wait > kHTTPSRateLimitMaxWaitMicros) {
+        return kRequestDeferred;
+      }
+      while (wait > 0) {
+        Poco::Timestamp::TimeDiff step =
+          timeLeft(started, std::min(wait, kRateLimitWaitStepMicros))
+          .totalMicroseconds();
+        Poco::Thread::sleep(static_cast<long>(step / 1000) + 1);  // NOLINT
+        wait -= step;
+      }
 
-    Poco::Net::SSLManager::instance().initializeClient(
-      0, acceptCertHandler, context);
-
-    Poco::Net::HTTPSClientSession session(uri.getHost(), uri.getPort(),
-      context);
-    if (proxy_.IsConfigured()) {
-      session.setProxy(proxy_.host, proxy_.port);
-      if (proxy_.HasCredentials()) {
-        session.setProxyCredentials(proxy_.username, proxy_.password);
+      // Waiting for a turn on a connection counts as connecting
+      bool reused(false);
+      Poco::Net::HTTPSClientSession *session = 0;
+      while (!session) {
+        if (!cancellation_.isNull() && cancellation_->IsCancelled()) {
+          return kRequestCancelled;
+        }
+        Poco::Timespan step(
+          std::min(timeLeft(started, deadlines_.connect).totalMicroseconds(),
+                   kRateLimitWaitStepMicros));
+        session = pool.Acquire(uri, proxy_, step, &reused);
       }
+      if (!cancellation_.isNull() && !cancellation_->Attach(session)) {
+        pool.Release(uri, proxy_, session, true);
+        return kRequestCancelled;
+      }
+      bool keep_alive(false);
+      bool receiving(false);
+      try {
+        // Applies to connecting, if the session isn't connected yet
+        session->setTimeout(timeLeft(started, deadlines_.connect));
+        status = sendRequest(session,
+          method,
+          relative_url,
+          payload,
+          writer,
+          basic_auth_username,
+          basic_auth_password,
+          handler,
+          validators,
+          response_body,
+          started,
+          &keep_alive,
+          &receiving);
+      } catch(const Poco::Exception& exc) {
+        if (!cancellation_.isNull()) {
+          cancellation_->Detach(session);
+        }
+        pool.Release(uri, proxy_, session, false);
+        // Server may have closed a kept-alive connection while it
+        // was idle in the pool. Requests that don't change anything
+        // on the server are safe to retry on a new connection.
+        if (reused && !attempt && !receiving
+            && Poco::Net::HTTPRequest::HTTP_GET == method
+            && !isTimeout(exc)
+            && (cancellation_.isNull() || !cancellation_->IsCancelled())) {
+          Poco::Logger::get("https_client").debug(
+            "Reused connection failed, retrying: " + exc.displayText());
+          continue;
+        }
+        if (!receiving && isNetworkDown(exc)
+            && (cancellation_.isNull() || !cancellation_->IsCancelled())) {
+          connectivity.Unreachable();
+        }
+        throw;
+      } catch(...) {
+        if (!cancellation_.isNull()) {
+          cancellation_->Detach(session);
+        }
+        pool.Release(uri, proxy_, session, false);
+        throw;
+      }
+      if (!cancellation_.isNull()) {
+        cancellation_->Detach(session);
+      }
+      pool.Release(uri, proxy_, session, keep_alive);
+      connectivity.Reachable();
+      break;
     }
-    session.setKeepAlive(false);
-    session.setTimeout(Poco::Timespan(10 * Poco::Timespan::SECONDS));
+    last_status_ = status;
 
-    Poco::Logger &logger = Poco::Logger::get("https_client");
-    {
-      std::stringstream ss;
-      ss << "Sending request to " << relative_url << " ..";
-      logger.debug(ss.str());
+    if (validators
+        && Poco::Net::HTTPResponse::HTTP_NOT_MODIFIED == status) {
+      return noError;
     }
 
-    Poco::Net::HTTPRequest req(method,
-      relative_url, Poco::Net::HTTPMessage::HTTP_1_1);
-    req.setKeepAlive(false);
-    req.setContentType("application/json");
-    req.set("User-Agent", kopsik::UserAgent(app_name_, app_version_));
-    req.setChunkedTransferEncoding(true);
+    if (kHTTPTooManyRequests == status
+        || Poco::Net::HTTPResponse::HTTP_SERVICE_UNAVAILABLE == status) {
+      return kRequestDeferred;
+    }
 
-    Poco::Net::HTTPBasicCredentials cred(
-      basic_auth_username, basic_auth_password);
-    if (!basic_auth_username.empty() && !basic_auth_password.empty()) {
-      cred.authenticate(req);
+    if (status < 200 || status >= 300) {
+      if (response_body->empty()) {
+        std::stringstream description;
+        description << kRequestFailedWithStatus << status;
+        return description.str();
+      }
+      return kRequestRejectedWithBody + *response_body;
     }
+  } catch(const Poco::Exception& exc) {
+    // Whatever broke the aborted connection, it was cancelled
+    if (!cancellation_.isNull() && cancellation_->IsCancelled()) {
+      return kRequestCancelled;
+    }
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  } catch(const std::string& ex) {
+    return ex;
+  }
+  return noError;
+}
+
+int HTTPSClient::sendRequest(
+    Poco::Net::HTTPSClientSession *session,
+    const std::string method,
+    const std::string relative_url,
+    const std::string &payload,
+    const RequestWriter *writer,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password,
+    ResponseHandler *handler,
+    HTTPValidators *validators,
+    std::string *response_body,
+    const Poco::Timestamp &started,
+    bool *keep_alive,
+    bool *receiving) {
+  poco_assert(session);
+  poco_assert(response_body);
+  poco_assert(keep_alive);
+  poco_assert(receiving);
 
-    std::istringstream requestStream(payload);
-    Poco::DeflatingInputStream gzipRequest(requestStream,
-      Poco::DeflatingStreamBuf::STREAM_GZIP);
-    Poco::DeflatingStreamBuf *pBuff = gzipRequest.rdbuf();
+  Poco::Logger &logger = Poco::Logger::get("https_client");
+  KOPSIK_LOG_DEBUG(logger, "Sending request to " << relative_url << " ..");
 
-    Poco::Int64 size = pBuff->pubseekoff(0, std::ios::end, std::ios::in);
-    pBuff->pubseekpos(0, std::ios::in);
+  Poco::Net::HTTPRequest req(method,
+    relative_url, Poco::Net::HTTPMessage::HTTP_1_1);
+  // The session may connect to an address of the host instead
+  Poco::URI uri(api_url_);
+  req.setHost(uri.getHost(), uri.getPort());
+  req.setKeepAlive(true);
+  req.setContentType("application/json");
+  req.set("User-Agent", kopsik::UserAgent(app_name_, app_version_));
 
-    req.setContentLength(size);
-    req.set("Content-Encoding", "gzip");
-    req.set("Accept-Encoding", "gzip");
+  Poco::Net::HTTPBasicCredentials cred(
+    basic_auth_username, basic_auth_password);
+  if (!basic_auth_username.empty() && !basic_auth_password.empty()) {
+    cred.authenticate(req);
+  }
+
+  req.set("Accept-Encoding", "gzip, deflate");
+
+  if (validators) {
+    validators->not_modified = false;
+    if (!validators->etag.empty()) {
+      req.set("If-None-Match", validators->etag);
+    }
+    if (!validators->last_modified.empty()) {
+      req.set("If-Modified-Since", validators->last_modified);
+    }
+  }
+
+  // Bytes of the body sent, and before it was compressed
+  Poco::UInt64 sent(0);
+  Poco::UInt64 sent_uncompressed(0);
+  if (writer) {
+    req.setChunkedTransferEncoding(true);
+    const bool gzipped = writer->GzippedFrom() > 0;
+    if (compress_requests_ || gzipped) {
+      req.set("Content-Encoding", "gzip");
+    }
+    Poco::CountingOutputStream wire(session->sendRequest(req));
+    if (gzipped) {
+      writer->Write(&wire);
+      sent_uncompressed = writer->GzippedFrom();
+    } else if (compress_requests_) {
+      Poco::DeflatingOutputStream gzip(wire,
+        Poco::DeflatingStreamBuf::STREAM_GZIP);
+      Poco::CountingOutputStream body(gzip);
+      writer->Write(&body);
+      body.flush();
+      gzip.close();
+      sent_uncompressed = body.chars();
+    } else {
+      Poco::CountingOutputStream body(static_cast<std::ostream &>(wire));
+      writer->Write(&body);
+      body.flush();
+      sent_uncompressed = body.chars();
+    }
+    wire.flush();
+    sent = wire.chars();
+  } else {
+    // Payload is sent as it is unless compressed, never copied
+    std::string compressed_body("");
+    const std::string *request_body = &payload;
+    if (compress_requests_ && !payload.empty()) {
+      std::ostringstream compressed;
+      Poco::DeflatingOutputStream gzip(compressed,
+        Poco::DeflatingStreamBuf::STREAM_GZIP);
+      gzip << payload;
+      gzip.close();
+      compressed_body = compressed.str();
+      request_body = &compressed_body;
+      req.set("Content-Encoding", "gzip");
+    }
+    req.setContentLength(request_body->size());
 
-    session.sendRequest(req) << pBuff << std::flush;
+    session->sendRequest(req) << *request_body << std::flush;
+    sent = request_body->size();
+    sent_uncompressed = payload.size();
+  }
 
-    // Log out request contents
+  // Log out request contents
+  if (logger.debug()) {
     std::stringstream request_string;
     req.write(request_string);
     logger.debug(request_string.str());
+  }
 
-    logger.debug("Request sent. Receiving response..");
+  logger.debug("Request sent. Receiving response..");
 
-    // Receive response
-    Poco::Net::HTTPResponse response;
-    std::istream& is = session.receiveResponse(response);
+  // Receive response
+  session->socket().setReceiveTimeout(
+    timeLeft(started, deadlines_.first_byte));
+  Poco::Net::HTTPResponse response;
+  Poco::CountingInputStream is(session->receiveResponse(response));
+  *receiving = true;
 
-    // Inflate
-    Poco::InflatingInputStream inflater(is,
+  // Inflate as the response is read, if the server compressed it
+  std::string content_encoding("");
+  if (response.has("Content-Encoding")) {
+    content_encoding = Poco::toLower(response.get("Content-Encoding"));
+  }
+  Poco::SharedPtr<Poco::InflatingInputStream> inflater;
+  if ("gzip" == content_encoding || "x-gzip" == content_encoding) {
+    inflater = new Poco::InflatingInputStream(is,
       Poco::InflatingStreamBuf::STREAM_GZIP);
-    std::stringstream ss;
-    ss << inflater.rdbuf();
-    *response_body = ss.str();
+  } else if ("deflate" == content_encoding) {
+    inflater = new Poco::InflatingInputStream(is,
+      Poco::InflatingStreamBuf::STREAM_ZLIB);
+  }
+  std::istream &body = inflater.isNull()
+    ? static_cast<std::istream &>(is) : *inflater;
+
+  // Read piece by piece, so that the deadline and cancellation
+  // are looked at between them
+  bool handled =
+    handler && response.getStatus() >= 200 && response.getStatus() < 300;
+  Poco::UInt64 uncompressed(0);
+  std::vector<char> chunk(kResponseChunkSize);
+  while (body) {
+    session->socket().setReceiveTimeout(
+      timeLeft(started, deadlines_.first_byte));
+    body.read(&chunk[0], kResponseChunkSize);
+    if (body.gcount() <= 0) {
+      break;
+    }
+    if (handled) {
+      handler->Consume(&chunk[0], body.gcount());
+    } else {
+      response_body->append(&chunk[0], body.gcount());
+    }
+    uncompressed += body.gcount();
+  }
+
+  // Connection can only be reused once the whole response is read
+  while (is) {
+    session->socket().setReceiveTimeout(
+      timeLeft(started, deadlines_.first_byte));
+    is.ignore(kResponseChunkSize);
+  }
+
+  {
+    Poco::Mutex::ScopedLock lock(traffic_stats_m_);
+    traffic_stats_.requests++;
+    traffic_stats_.bytes_sent += sent;
+    traffic_stats_.bytes_sent_uncompressed += sent_uncompressed;
+    traffic_stats_.bytes_received += is.chars();
+    traffic_stats_.bytes_received_uncompressed += uncompressed;
+  }
+
+  KOPSIK_LOG_DEBUG(logger, "Sent " << sent << " bytes ("
+      << sent_uncompressed << " uncompressed), received " << is.chars()
+      << " bytes (" << uncompressed << " uncompressed)");
 
-    // Log out response contents
+  // Log out response contents
+  if (logger.debug()) {
     std::stringstream response_string;
     response_string << "Response status: " << response.getStatus()
       << ", reason: " << response.getReason()
@@ -175,25 +993,34 @@ error HTTPSClient::request(
         << response.get("Content-Encoding");
     }
     logger.debug(response_string.str());
-    logger.trace(*response_body);
+  }
+  logger.trace(*response_body);
 
-    if (response.getStatus() < 200 || response.getStatus() >= 300) {
-      if (response_body->empty()) {
-        std::stringstream description;
-        description << "Request to server failed with status code: "
-          << response.getStatus();
-        return description.str();
-      }
-      return "Data push failed with error: " + *response_body;
+  if (validators) {
+    if (Poco::Net::HTTPResponse::HTTP_NOT_MODIFIED == response.getStatus()) {
+      validators->not_modified = true;
+    } else if (response.getStatus() >= 200 && response.getStatus() < 300) {
+      validators->etag = response.get("ETag", "");
+      validators->last_modified = response.get("Last-Modified", "");
     }
-  } catch(const Poco::Exception& exc) {
-    return exc.displayText();
-  } catch(const std::exception& ex) {
-    return ex.what();
-  } catch(const std::string& ex) {
-    return ex;
   }
-  return noError;
+
+  // All clients hold off until the server is ready again
+  if (kHTTPTooManyRequests == response.getStatus()
+      || Poco::Net::HTTPResponse::HTTP_SERVICE_UNAVAILABLE
+        == response.getStatus()) {
+    Poco::Timestamp now;
+    Poco::Timestamp::TimeDiff retry_after =
+      RetryAfterMicros(response.get("Retry-After", ""), now);
+    HTTPSRateLimiter::Instance().Defer(Poco::URI(api_url_),
+                                       now + retry_after);
+    KOPSIK_LOG_DEBUG(logger, "Server is busy, retrying after "
+      << retry_after / 1000 << " ms");
+  }
+
+  *keep_alive = response.getKeepAlive();
+
+  return response.getStatus();
 }
 
 }   // namespace kopsik
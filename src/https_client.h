@@ -3,19 +3,282 @@
 #ifndef SRC_HTTPS_CLIENT_H_
 #define SRC_HTTPS_CLIENT_H_
 
+#include <ostream>  // NOLINT
 #include <string>
 #include <vector>
+#include <map>
+#include <set>
 
 #include "Poco/Activity.h"
+#include "Poco/AutoPtr.h"
+#include "Poco/Condition.h"
+#include "Poco/Mutex.h"
+#include "Poco/RefCountedObject.h"
+#include "Poco/Types.h"
+#include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/URI.h"
+#include "Poco/Net/Context.h"
+#include "Poco/Net/Session.h"
 #include "Poco/Net/HTTPSClientSession.h"
 #include "Poco/Net/HTTPRequest.h"
 #include "Poco/Net/HTTPResponse.h"
 
+#include "./const.h"
 #include "./types.h"
 #include "./proxy.h"
 
 namespace kopsik {
 
+  // Keep-alive HTTPS sessions shared by all HTTPSClient instances,
+  // so that syncing, batch updates, timeline uploads and update
+  // checks don't pay for a TCP and TLS handshake on every request.
+  // Also keeps the one TLS context of the process, and the last TLS
+  // session to each host for other network clients to resume.
+  // Requests in parallel share a few connections to each host,
+  // taking turns on them, rather than opening one each.
+  class HTTPSSessionPool {
+  public:
+    HTTPSSessionPool() : ssl_initialized_(false), users_(0) {}
+    ~HTTPSSessionPool();
+
+    static HTTPSSessionPool &Instance();
+
+    // Returns an idle session for the host and proxy settings,
+    // or a new one that resumes the last TLS session to the host.
+    // While kHTTPSMaxSessionsPerHost of them are in use, waits up to
+    // max_wait for one to be released, and returns 0 if none was.
+    Poco::Net::HTTPSClientSession *Acquire(
+      const Poco::URI &uri,
+      const Proxy &proxy,
+      const Poco::Timespan &max_wait,
+      bool *reused);
+
+    // Returns session to pool. If it cannot be reused
+    // (request failed or server closed it), it's deleted.
+    void Release(
+      const Poco::URI &uri,
+      const Proxy &proxy,
+      Poco::Net::HTTPSClientSession *session,
+      const bool reusable);
+
+    // Closes all idle sessions and lets go of the TLS context,
+    // then uninitializes SSL if it was initialized.
+    void Clear();
+
+    // Every context of the process shares the pool, and its TLS
+    // context. It's cleared when the last one of them leaves.
+    void Join();
+    void Leave();
+
+    // Set up once, with session caching, for all network clients.
+    // SSL is initialized here, on first use, rather than at startup.
+    Poco::Net::Context::Ptr TLSContext();
+
+    // Last TLS session to the host, null if there's none yet.
+    // Connections made with it skip the full handshake.
+    Poco::Net::Session::Ptr TLSSession(
+      const Poco::URI &uri,
+      const Proxy &proxy);
+    void KeepTLSSession(
+      const Poco::URI &uri,
+      const Proxy &proxy,
+      Poco::Net::Session::Ptr tls_session);
+
+  private:
+    struct IdleSession {
+      Poco::Net::HTTPSClientSession *session;
+      Poco::Timestamp since;
+    };
+
+    std::string key(const Poco::URI &uri, const Proxy &proxy) const;
+    void closeExpired();
+
+    Poco::Net::Context::Ptr context_;
+    bool ssl_initialized_;
+    unsigned int users_;
+    std::map<std::string, std::vector<IdleSession> > idle_;
+    // Sessions handed out and not released yet
+    std::map<std::string, unsigned int> busy_;
+    std::map<std::string, Poco::Net::Session::Ptr> tls_sessions_;
+    Poco::Mutex mutex_;
+    // Signalled when a session is released
+    Poco::Condition released_;
+  };
+
+  // Receives a response body piece by piece as it's read
+  // from the network, so it never has to be held in memory whole.
+  class ResponseHandler {
+  public:
+    virtual ~ResponseHandler() {}
+    virtual void Consume(const char *data, const std::size_t size) = 0;
+  };
+
+  // Writes a request body straight into the request as it's sent,
+  // so it never has to be held in memory whole. May be asked to
+  // write it again if the request is retried.
+  class RequestWriter {
+  public:
+    virtual ~RequestWriter() {}
+    virtual void Write(std::ostream *out) const = 0;
+    // Size of the body before it was gzipped, if what Write writes
+    // is gzipped already. It's then sent as it is, not gzipped again.
+    virtual Poco::UInt64 GzippedFrom() const { return 0; }
+  };
+
+  // Body gzipped ahead of time, such as a stored timeline block
+  class GzippedRequestBody : public RequestWriter {
+  public:
+    GzippedRequestBody(
+        const std::string &gzipped,
+        const Poco::UInt64 size)
+      : gzipped_(gzipped)
+      , size_(size) {}
+    void Write(std::ostream *out) const {
+      out->write(gzipped_.data(), gzipped_.size());
+    }
+    Poco::UInt64 GzippedFrom() const { return size_; }
+
+  private:
+    const std::string &gzipped_;
+    Poco::UInt64 size_;
+  };
+
+  // Validators of a cached response. Sent with a conditional
+  // request, updated from the response when it changed.
+  typedef struct {
+    std::string etag;
+    std::string last_modified;
+    // Server answered 304, the cached response is still good
+    bool not_modified;
+  } HTTPValidators;
+
+  // Network traffic of all HTTPSClient requests since start.
+  // Compressed counts are what actually went over the wire.
+  typedef struct {
+    Poco::UInt64 requests;
+    Poco::UInt64 bytes_sent;
+    Poco::UInt64 bytes_sent_uncompressed;
+    Poco::UInt64 bytes_received;
+    Poco::UInt64 bytes_received_uncompressed;
+  } HTTPSTrafficStats;
+
+  // Error of a request that was cancelled, so that callers
+  // can tell it from a failure worth reporting
+  const error kRequestCancelled = "Request was cancelled";
+
+  // Error of a request that wasn't sent because the network is
+  // gone, see ConnectivityMonitor
+  const error kRequestOffline = "Request was not sent while offline";
+
+  // Error of a request that wasn't sent, or was refused with 429 or
+  // 503, because the server is busy. HTTPSRateLimiter::RetryAt tells
+  // when to try again.
+  const error kRequestDeferred = "Server is busy, request was deferred";
+
+  // Error of a request the server answered with an error status,
+  // followed by the status. An answer with a body is instead the
+  // second one followed by the body.
+  const char kRequestFailedWithStatus[] =
+    "Request to server failed with status code: ";
+  const char kRequestRejectedWithBody[] = "Data push failed with error: ";
+
+  // Whether the server refused a request for the changes since a time
+  // with the status, 400 Bad Request or 410 Gone, so that only asking
+  // for all of the data can help. Failed logins and server errors
+  // aren't refusals.
+  bool IsSinceRefused(const int status);
+
+  // Microseconds from now the value of a Retry-After header asks to
+  // wait, either seconds or an HTTP date. The default when it's
+  // missing or can't be parsed.
+  Poco::Timestamp::TimeDiff RetryAfterMicros(
+    const std::string &value,
+    const Poco::Timestamp &now);
+
+  // Token bucket of requests to each host, shared by all HTTPSClient
+  // instances, so that syncing, timeline uploads and update checks
+  // don't each retry a busy server on their own schedule. When the
+  // server asks to retry after a while, no requests go to it until
+  // then, and the bucket refills from empty afterwards.
+  class HTTPSRateLimiter {
+  public:
+    HTTPSRateLimiter()
+      : per_second_(kHTTPSRequestsPerSecond)
+      , burst_(kHTTPSRequestBurst) {}
+    HTTPSRateLimiter(const double per_second, const double burst)
+      : per_second_(per_second)
+      , burst_(burst) {}
+
+    static HTTPSRateLimiter &Instance();
+
+    // Takes a token for a request to the host, if one is available
+    // within max_wait. Returns how long to wait before sending: 0 when
+    // the token is available now, more than max_wait when none was
+    // taken.
+    Poco::Timestamp::TimeDiff Reserve(
+      const Poco::URI &uri,
+      const Poco::Timestamp &now,
+      const Poco::Timestamp::TimeDiff max_wait);
+
+    // Server asked not to be sent requests until retry_at
+    void Defer(const Poco::URI &uri, const Poco::Timestamp &retry_at);
+
+    // Earliest time a request to the host may be sent, or
+    // now if it's not deferred
+    Poco::Timestamp RetryAt(
+      const Poco::URI &uri,
+      const Poco::Timestamp &now) const;
+
+  private:
+    struct Bucket {
+      double tokens;
+      Poco::Timestamp refilled_at;
+      Poco::Timestamp retry_at;
+    };
+
+    Bucket &bucket(const Poco::URI &uri, const Poco::Timestamp &now);
+
+    double per_second_;
+    double burst_;
+    std::map<std::string, Bucket> buckets_;
+    mutable Poco::Mutex mutex_;
+  };
+
+  // Time limits of one request, in microseconds: for connecting,
+  // for each wait on the server (the response to start, or the next
+  // piece of it to arrive) and for the whole request, retries included.
+  typedef struct {
+    Poco::Timestamp::TimeDiff connect;
+    Poco::Timestamp::TimeDiff first_byte;
+    Poco::Timestamp::TimeDiff total;
+  } HTTPSDeadlines;
+
+  // Aborts the requests made with it, from any thread. Once cancelled
+  // it stays so, and requests made with it fail right away with
+  // kRequestCancelled. Reference counted, as whoever cancels it may
+  // outlive the request or the other way around.
+  class HTTPSCancellation : public Poco::RefCountedObject {
+  public:
+    typedef Poco::AutoPtr<HTTPSCancellation> Ptr;
+
+    HTTPSCancellation() : cancelled_(false) {}
+
+    // Aborts the connections of the requests in flight
+    void Cancel();
+    bool IsCancelled() const;
+
+    // Session is aborted on Cancel while attached. Returns false,
+    // without attaching, when already cancelled.
+    bool Attach(Poco::Net::HTTPSClientSession *session);
+    void Detach(Poco::Net::HTTPSClientSession *session);
+
+  private:
+    bool cancelled_;
+    std::set<Poco::Net::HTTPSClientSession *> sessions_;
+    mutable Poco::Mutex mutex_;
+  };
+
   class HTTPSClient {
   public:
     explicit HTTPSClient(
@@ -24,11 +287,14 @@ namespace kopsik {
         const std::string app_version) :
       api_url_(api_url),
       app_name_(app_name),
-      app_version_(app_version) {}
+      app_version_(app_version),
+      compress_requests_(true),
+      deadlines_(DefaultDeadlines()),
+      last_status_(0) {}
     virtual ~HTTPSClient() {}
     virtual error PostJSON(
       const std::string relative_url,
-      const std::string json,
+      const std::string &json,
       const std::string basic_auth_username,
       const std::string basic_auth_password,
       std::string *response_body);
@@ -38,23 +304,111 @@ namespace kopsik {
       const std::string basic_auth_password,
       std::string *response_body);
 
+    // Body is written by writer as it's sent, with chunked
+    // transfer encoding, since its size isn't known up front
+    virtual error PostJSON(
+      const std::string relative_url,
+      const RequestWriter *writer,
+      const std::string basic_auth_username,
+      const std::string basic_auth_password,
+      std::string *response_body);
+
+    // Passes a successful response body to handler as it arrives.
+    // Error responses are returned as the error instead.
+    virtual error GetJSON(
+      const std::string relative_url,
+      const std::string basic_auth_username,
+      const std::string basic_auth_password,
+      ResponseHandler *handler);
+
+    // Asks the server for the response only if it has changed
+    // since validators were given. If it hasn't, the server answers
+    // 304 with no body, and validators->not_modified is set.
+    virtual error ConditionalGetJSON(
+      const std::string relative_url,
+      const std::string basic_auth_username,
+      const std::string basic_auth_password,
+      HTTPValidators *validators,
+      std::string *response_body);
+
     void SetApiURL(const std::string value) { api_url_ = value; }
     void SetProxy(const Proxy value) { proxy_ = value; }
 
+    // Request bodies are gzipped unless turned off here
+    void SetCompressRequests(const bool value) {
+      compress_requests_ = value;
+    }
+
+    void SetDeadlines(const HTTPSDeadlines value) { deadlines_ = value; }
+
+    // Requests made while set can be aborted through it
+    void SetCancellation(HTTPSCancellation::Ptr value) {
+      cancellation_ = value;
+    }
+
+    // HTTP status the last request was answered with,
+    // 0 when it got no answer
+    virtual int LastStatus() const { return last_status_; }
+
+    static HTTPSDeadlines DefaultDeadlines();
+
+    static HTTPSTrafficStats TrafficStats();
+
   private:
+    // Sends request over session and reads the response.
+    // Returns response status, throws on network errors.
+    int sendRequest(
+        Poco::Net::HTTPSClientSession *session,
+        const std::string method,
+        const std::string relative_url,
+        const std::string &payload,
+        const RequestWriter *writer,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        ResponseHandler *handler,
+        HTTPValidators *validators,
+        std::string *response_body,
+        const Poco::Timestamp &started,
+        bool *keep_alive,
+        bool *receiving);
+
+    // Time the next wait on the network may take, at most limit.
+    // Throws when the request is out of time or cancelled.
+    Poco::Timespan timeLeft(
+        const Poco::Timestamp &started,
+        const Poco::Timestamp::TimeDiff limit) const;
+
+    // Body is either payload or what writer writes.
+    // With validators, the request is conditional.
+    // Recorded by TrafficRecorder while it's recording.
     error request(
         const std::string method,
         const std::string relative_url,
-        const std::string payload,
+        const std::string &payload,
+        const RequestWriter *writer,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        ResponseHandler *handler,
+        HTTPValidators *validators,
+        std::string *response_body);
+    // Same, without recording
+    error perform(
+        const std::string method,
+        const std::string relative_url,
+        const std::string &payload,
+        const RequestWriter *writer,
         const std::string basic_auth_username,
         const std::string basic_auth_password,
+        ResponseHandler *handler,
+        HTTPValidators *validators,
         std::string *response_body);
     error requestJSON(
       const std::string method,
       const std::string relative_url,
-      const std::string json,
+      const std::string &json,
       const std::string basic_auth_username,
       const std::string basic_auth_password,
+      ResponseHandler *handler,
       std::string *response_body);
 
     std::string api_url_;
@@ -62,6 +416,13 @@ namespace kopsik {
     std::string app_version_;
 
     Proxy proxy_;
+    bool compress_requests_;
+    HTTPSDeadlines deadlines_;
+    HTTPSCancellation::Ptr cancellation_;
+    int last_status_;
+
+    static HTTPSTrafficStats traffic_stats_;
+    static Poco::Mutex traffic_stats_m_;
   };
 }  // namespace kopsik
 
@@ -0,0 +1,70 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./idle_detector.h"
+
+namespace kopsik {
+
+IdleTracker::IdleTracker(const unsigned int threshold_seconds)
+  : threshold_seconds_(threshold_seconds)
+  , idle_(false)
+  , idle_started_(0) {}
+
+unsigned int IdleTracker::Sample(
+    const time_t now, const unsigned int idle_seconds, IdleListener *listener) {
+  if (!idle_) {
+    if (idle_seconds < threshold_seconds_) {
+      return threshold_seconds_ - idle_seconds;
+    }
+    idle_ = true;
+    idle_started_ = now - idle_seconds;
+    listener->WentIdle(idle_started_);
+    return kIdleSampleWhileIdleSeconds;
+  }
+
+  // Input since the idle time started, the user is back
+  time_t last_input = now - idle_seconds;
+  if (last_input <= idle_started_ + 1) {
+    return kIdleSampleWhileIdleSeconds;
+  }
+  idle_ = false;
+  listener->Returned(idle_started_, last_input);
+  if (idle_seconds >= threshold_seconds_) {
+    // Gone again already, it's seen on next sample
+    return 1;
+  }
+  return threshold_seconds_ - idle_seconds;
+}
+
+IdleDetector::IdleDetector(
+    const unsigned int threshold_seconds, IdleListener *listener)
+  : tracker_(threshold_seconds)
+  , listener_(listener)
+  , sampling_(this, &IdleDetector::sample, WorkerPool::Background) {
+  poco_assert(listener_);
+  sampling_.start();
+}
+
+IdleDetector::~IdleDetector() {
+  Stop();
+}
+
+void IdleDetector::RequestStop() {
+  sampling_.stop();
+}
+
+void IdleDetector::Stop() {
+  RequestStop();
+  sampling_.wait();
+}
+
+Poco::Timestamp::TimeDiff IdleDetector::sample() {
+  unsigned int idle_seconds(0);
+  unsigned int wait_seconds = kIdleSampleUnknownSeconds;
+  if (GetIdleSeconds(&idle_seconds)) {
+    wait_seconds = tracker_.Sample(time(0), idle_seconds, listener_);
+  }
+  return Poco::Timestamp::TimeDiff(wait_seconds)
+    * Poco::Timestamp::resolution();
+}
+
+}  // namespace kopsik
@@ -0,0 +1,81 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_IDLE_DETECTOR_H_
+#define SRC_IDLE_DETECTOR_H_
+
+#include <time.h>
+
+#include "./const.h"
+#include "./get_focused_window.h"
+#include "./worker_pool.h"
+
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+  // Told when the user has been away from the keyboard and mouse for
+  // the threshold, and when they're back. Called on a background
+  // worker of the shared pool.
+  class IdleListener {
+  public:
+    virtual ~IdleListener() {}
+    // idle_started is when the keyboard or mouse was last used
+    virtual void WentIdle(const time_t idle_started) = 0;
+    virtual void Returned(const time_t idle_started,
+                          const time_t idle_ended) = 0;
+  };
+
+  // Decides from the seconds since the last input when the user went
+  // idle and came back, and when to look again. While the user is
+  // active, the earliest they can reach the threshold is that many
+  // seconds after the last input, so there's no point in looking
+  // before that. While idle, it's looked often so the return is seen.
+  class IdleTracker {
+  public:
+    explicit IdleTracker(const unsigned int threshold_seconds);
+
+    // Returns the seconds until the next sample
+    unsigned int Sample(const time_t now,
+                        const unsigned int idle_seconds,
+                        IdleListener *listener);
+
+    bool Idle() const { return idle_; }
+
+  private:
+    unsigned int threshold_seconds_;
+    bool idle_;
+    time_t idle_started_;
+  };
+
+  // Samples the seconds since the last input, as rarely as
+  // IdleTracker allows. Samples are taken by the shared workers, the
+  // waits between them are timer tasks.
+  class IdleDetector {
+  public:
+    IdleDetector(const unsigned int threshold_seconds,
+                 IdleListener *listener);
+
+    ~IdleDetector();
+
+    // Asks the detector to stop, without waiting for it
+    void RequestStop();
+
+    void Stop();
+
+  protected:
+    // Loop callback, returns the wait until the next sample
+    Poco::Timestamp::TimeDiff sample();
+
+  private:
+    IdleTracker tracker_;
+    IdleListener *listener_;
+
+    WorkerLoop<IdleDetector> sampling_;
+
+    IdleDetector(const IdleDetector &);
+    IdleDetector &operator=(const IdleDetector &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_IDLE_DETECTOR_H_
@@ -0,0 +1,155 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./instrumented_lock.h"
+
+#include <sstream>
+
+#include "Poco/Logger.h"
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+volatile bool &lockMetricsEnabled() {
+  static volatile bool enabled = false;
+  return enabled;
+}
+
+volatile Poco::Int64 &lockSlowWaitMicros() {
+  static volatile Poco::Int64 micros = 0;
+  return micros;
+}
+
+void LockMetrics::SetSlowWaitMicros(const Poco::Int64 value) {
+  lockSlowWaitMicros() = value;
+}
+
+void LockMetrics::Record(
+    const std::string &name, const char *site, const char *holder,
+    const Poco::Int64 wait_micros) {
+  Metrics::Shared().Time("lock." + name + ".wait", wait_micros);
+  Poco::Int64 slow = lockSlowWaitMicros();
+  if (slow && wait_micros > slow) {
+    std::stringstream ss;
+    ss << "Waited " << wait_micros / 1000 << " ms for " << name
+       << " in " << site << ", held by " << holder;
+    Poco::Logger::get("lock_metrics").warning(ss.str());
+  }
+}
+
+void LockMetrics::RecordHold(
+    const std::string &name, const char *site, const Poco::Int64 hold_micros) {
+  Metrics::Shared().Time("lock." + name + ".hold." + site, hold_micros);
+}
+
+InstrumentedMutex::InstrumentedMutex(const std::string &name)
+  : name_(name)
+  , depth_(0)
+  , site_("")
+  , locked_at_(0) {}
+
+InstrumentedMutex::ScopedLock::ScopedLock(
+    InstrumentedMutex &mutex,  // NOLINT
+    const char *site)
+  : mutex_(mutex) {
+  mutex_.lock(site);
+}
+
+InstrumentedMutex::ScopedLock::~ScopedLock() {
+  mutex_.unlock();
+}
+
+void InstrumentedMutex::lock(const char *site) {
+  if (!LockMetrics::Enabled()) {
+    mutex_.lock();
+    depth_++;
+    return;
+  }
+  Poco::Timestamp started;
+  if (!mutex_.tryLock()) {
+    // Read without the lock, so it may be a moment off
+    const char *holder = site_;
+    mutex_.lock();
+    LockMetrics::Record(name_, site, holder, started.elapsed());
+  }
+  if (!depth_++) {
+    site_ = site;
+    locked_at_ = Poco::Timestamp().epochMicroseconds();
+  }
+}
+
+void InstrumentedMutex::unlock() {
+  if (!--depth_ && locked_at_) {
+    LockMetrics::RecordHold(name_, site_,
+      Poco::Timestamp().epochMicroseconds() - locked_at_);
+    locked_at_ = 0;
+  }
+  mutex_.unlock();
+}
+
+InstrumentedRWLock::InstrumentedRWLock(const std::string &name)
+  : name_(name)
+  , site_("")
+  , locked_at_(0) {}
+
+InstrumentedRWLock::ScopedReadLock::ScopedReadLock(
+    InstrumentedRWLock &lock,  // NOLINT
+    const char *site)
+  : lock_(lock) {
+  lock_.readLock(site);
+}
+
+InstrumentedRWLock::ScopedReadLock::~ScopedReadLock() {
+  lock_.unlock();
+}
+
+InstrumentedRWLock::ScopedWriteLock::ScopedWriteLock(
+    InstrumentedRWLock &lock,  // NOLINT
+    const char *site)
+  : lock_(lock) {
+  lock_.writeLock(site);
+}
+
+InstrumentedRWLock::ScopedWriteLock::~ScopedWriteLock() {
+  lock_.unlock();
+}
+
+void InstrumentedRWLock::readLock(const char *site) {
+  if (!LockMetrics::Enabled()) {
+    lock_.readLock();
+    return;
+  }
+  Poco::Timestamp started;
+  if (!lock_.tryReadLock()) {
+    const char *holder = site_;
+    lock_.readLock();
+    LockMetrics::Record(name_ + ".read", site, holder, started.elapsed());
+  }
+}
+
+void InstrumentedRWLock::writeLock(const char *site) {
+  if (!LockMetrics::Enabled()) {
+    lock_.writeLock();
+    locked_at_ = 0;
+    return;
+  }
+  Poco::Timestamp started;
+  if (!lock_.tryWriteLock()) {
+    const char *holder = site_;
+    lock_.writeLock();
+    LockMetrics::Record(name_ + ".write", site, holder, started.elapsed());
+  }
+  site_ = site;
+  locked_at_ = Poco::Timestamp().epochMicroseconds();
+}
+
+void InstrumentedRWLock::unlock() {
+  if (locked_at_) {
+    Poco::Int64 held = Poco::Timestamp().epochMicroseconds() - locked_at_;
+    locked_at_ = 0;
+    LockMetrics::RecordHold(name_, site_, held);
+    site_ = "";
+  }
+  lock_.unlock();
+}
+
+}  // namespace kopsik
@@ -0,0 +1,138 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_INSTRUMENTED_LOCK_H_
+#define SRC_INSTRUMENTED_LOCK_H_
+
+#include <string>
+
+#include "./metrics.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/RWLock.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Read by every lock, so they're kept out of any singleton
+  volatile bool &lockMetricsEnabled();
+  volatile Poco::Int64 &lockSlowWaitMicros();
+
+  // Whether the instrumented locks of the library record how long
+  // they're waited for and held. Off by default; a lock only checks
+  // the flag then.
+  class LockMetrics {
+  public:
+    static bool Enabled() { return lockMetricsEnabled(); }
+    static void SetEnabled(const bool value) { lockMetricsEnabled() = value; }
+
+    // While enabled, waits longer than this are logged with whoever
+    // held the lock meanwhile. 0 logs none.
+    static void SetSlowWaitMicros(const Poco::Int64 value);
+
+    // Goes to the metrics as lock.<name>.wait, and as
+    // lock.<name>.hold.<site> for the site that held it
+    static void Record(
+        const std::string &name,
+        const char *site,
+        const char *holder,
+        const Poco::Int64 wait_micros);
+
+    static void RecordHold(
+        const std::string &name,
+        const char *site,
+        const Poco::Int64 hold_micros);
+  };
+
+  // Recursive mutex, like the Poco::Mutex it wraps, that records how
+  // long it was waited for, and how long each call site held it. Only
+  // the outermost lock of a thread that already holds it counts.
+  class InstrumentedMutex {
+  public:
+    // Name as in the metrics, "db.mutex"
+    explicit InstrumentedMutex(const std::string &name);
+
+    // Site is a string literal, the function taking the lock
+    class ScopedLock {
+    public:
+      explicit ScopedLock(InstrumentedMutex &mutex,  // NOLINT
+                          const char *site = "");
+      ~ScopedLock();
+
+    private:
+      InstrumentedMutex &mutex_;
+
+      ScopedLock(const ScopedLock &);
+      ScopedLock &operator=(const ScopedLock &);
+    };
+
+    void lock(const char *site = "");
+
+    void unlock();
+
+  private:
+    std::string name_;
+    Poco::Mutex mutex_;
+    // Guarded by mutex_
+    int depth_;
+    const char * volatile site_;
+    Poco::Int64 locked_at_;
+
+    InstrumentedMutex(const InstrumentedMutex &);
+    InstrumentedMutex &operator=(const InstrumentedMutex &);
+  };
+
+  // Reader/writer lock, like the Poco::RWLock it wraps, that records
+  // how long it was waited for. Hold times are recorded for writers,
+  // readers can't be told apart.
+  class InstrumentedRWLock {
+  public:
+    explicit InstrumentedRWLock(const std::string &name);
+
+    class ScopedReadLock {
+    public:
+      explicit ScopedReadLock(InstrumentedRWLock &lock,  // NOLINT
+                              const char *site = "");
+      ~ScopedReadLock();
+
+    private:
+      InstrumentedRWLock &lock_;
+
+      ScopedReadLock(const ScopedReadLock &);
+      ScopedReadLock &operator=(const ScopedReadLock &);
+    };
+
+    class ScopedWriteLock {
+    public:
+      explicit ScopedWriteLock(InstrumentedRWLock &lock,  // NOLINT
+                               const char *site = "");
+      ~ScopedWriteLock();
+
+    private:
+      InstrumentedRWLock &lock_;
+
+      ScopedWriteLock(const ScopedWriteLock &);
+      ScopedWriteLock &operator=(const ScopedWriteLock &);
+    };
+
+    void readLock(const char *site = "");
+
+    void writeLock(const char *site = "");
+
+    // Either kind. Only a writer sets locked_at_, and nobody else
+    // holds the lock meanwhile.
+    void unlock();
+
+  private:
+    std::string name_;
+    Poco::RWLock lock_;
+    // Writer holding the lock, if any
+    const char * volatile site_;
+    Poco::Int64 locked_at_;
+
+    InstrumentedRWLock(const InstrumentedRWLock &);
+    InstrumentedRWLock &operator=(const InstrumentedRWLock &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_INSTRUMENTED_LOCK_H_
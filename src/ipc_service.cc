@@ -0,0 +1,492 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./ipc_service.h"
+
+#ifndef _WIN32
+#include <fcntl.h>  // NOLINT
+#include <unistd.h>  // NOLINT
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Thread.h"
+#include "Poco/UUIDGenerator.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/SocketAddress.h"
+#include "Poco/Net/TCPServerParams.h"
+
+namespace kopsik {
+
+void IpcProtocol::WriteTimeEntry(
+    KopsikTimeEntryViewItem *item, JSONWriter *writer) {
+  writer->BeginObject();
+  writer->String("GUID", str(item->GUID));
+  writer->String("Description", str(item->Description));
+  writer->String("ProjectAndTaskLabel", str(item->ProjectAndTaskLabel));
+  writer->String("Duration", str(item->Duration));
+  writer->Int("DurationInSeconds", item->DurationInSeconds);
+  writer->Int("WID", item->WID);
+  writer->Int("PID", item->PID);
+  writer->Int("TID", item->TID);
+  writer->Bool("Billable", item->Billable != 0);
+  writer->String("Tags", str(item->Tags));
+  writer->Int("Started", item->Started);
+  writer->Int("Ended", item->Ended);
+  writer->Int("UpdatedAt", item->UpdatedAt);
+  writer->EndObject();
+}
+
+void IpcProtocol::WriteChanges(
+    const std::vector<ModelChange> &changes, JSONWriter *writer) {
+  writer->BeginObject();
+  writer->String("event", "changes");
+  writer->Key("changes");
+  writer->BeginArray();
+  for (std::vector<ModelChange>::const_iterator it = changes.begin();
+      it != changes.end();
+      it++) {
+    writer->BeginObject();
+    writer->String("model", ModelChange::ModelTypeName(it->ModelType()));
+    writer->String("change",
+                   ModelChange::ChangeTypeName(it->ChangeType()));
+    writer->Int("id", it->ModelID());
+    writer->String("guid", it->GUID());
+    writer->EndObject();
+  }
+  writer->EndArray();
+  writer->EndObject();
+}
+
+bool IpcProtocol::NextLine(std::string *buffer, std::string *line) {
+  std::string::size_type end = buffer->find('\n');
+  if (std::string::npos == end) {
+    return false;
+  }
+  line->assign(*buffer, 0, end);
+  buffer->erase(0, end + 1);
+  return true;
+}
+
+std::string IpcProtocol::Member(JSONValue *root, const char *name) {
+  JSONValue *node = JSONGet(root, name);
+  return node ? JSONString(node) : "";
+}
+
+Poco::Int64 IpcProtocol::IntMember(JSONValue *root, const char *name) {
+  JSONValue *node = JSONGet(root, name);
+  return node ? JSONInt(node) : 0;
+}
+
+std::string IpcProtocol::str(const char *value) {
+  return value ? value : "";
+}
+
+IpcChannel::IpcChannel(const Poco::Net::StreamSocket &socket)
+  : socket_(socket), closed_(false) {}
+
+bool IpcChannel::Send(const std::string &message) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  if (closed_) {
+    return false;
+  }
+  std::string line(message + "\n");
+  try {
+    std::string::size_type sent = 0;
+    while (sent < line.size()) {
+      int n = socket_.sendBytes(line.data() + sent,
+                                static_cast<int>(line.size() - sent));
+      if (n <= 0) {
+        closed_ = true;
+        return false;
+      }
+      sent += static_cast<std::string::size_type>(n);
+    }
+  } catch(const Poco::Exception&) {
+    closed_ = true;
+    return false;
+  }
+  return true;
+}
+
+void IpcChannel::Close() {
+  Poco::FastMutex::ScopedLock lock(m_);
+  closed_ = true;
+}
+
+IpcChangesListener::IpcChangesListener(Poco::SharedPtr<IpcChannel> channel)
+  : channel_(channel) {}
+
+void IpcChangesListener::Changed(const std::vector<ModelChange> &changes) {
+  JSONWriter writer;
+  IpcProtocol::WriteChanges(changes, &writer);
+  channel_->Send(writer.Buffer());
+}
+
+IpcConnection::IpcConnection(
+    const Poco::Net::StreamSocket &socket, void *context,
+    const std::string &token, const volatile bool *stopping)
+  : Poco::Net::TCPServerConnection(socket)
+  , context_(context)
+  , token_(token)
+  , stopping_(stopping)
+  , channel_(new IpcChannel(socket))
+  , subscription_(0) {}
+
+void IpcConnection::run() {
+  socket().setSendTimeout(Poco::Timespan(kIpcSendTimeoutMicros));
+  socket().setReceiveTimeout(Poco::Timespan(kIpcPollMicros));
+  bool authenticated(false);
+  std::string buffer("");
+  char chunk[4096];
+  try {
+    while (!*stopping_) {
+      int n(0);
+      try {
+        n = socket().receiveBytes(chunk, sizeof(chunk));
+      } catch(const Poco::TimeoutException&) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      buffer.append(chunk, static_cast<std::size_t>(n));
+      std::string line("");
+      bool open(true);
+      while (open && IpcProtocol::NextLine(&buffer, &line)) {
+        open = handle(line, &authenticated);
+      }
+      if (!open || buffer.size() > kIpcMaxLineBytes) {
+        break;
+      }
+    }
+  } catch(const Poco::Exception& exc) {
+    logger().debug(exc.displayText());
+  }
+  channel_->Close();
+  if (subscription_) {
+    app()->UnsubscribeModelChanges(subscription_);
+  }
+}
+
+// Takes as long wherever the tokens differ, so the time a wrong
+// token takes to be refused tells nothing about the right one
+static bool sameToken(const std::string &a, const std::string &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  unsigned char differ(0);
+  for (std::size_t i = 0; i < a.size(); i++) {
+    differ |= static_cast<unsigned char>(a[i] ^ b[i]);
+  }
+  return !differ;
+}
+
+bool IpcConnection::handle(const std::string &line, bool *authenticated) {
+  JSONValue *root = JSONParse(line);
+  if (!root) {
+    return false;
+  }
+  std::string method(IpcProtocol::Member(root, "method"));
+  if (!*authenticated) {
+    *authenticated = "hello" == method
+      && sameToken(IpcProtocol::Member(root, "token"), token_);
+    JSONDelete(root);
+    if (*authenticated) {
+      channel_->Send("{\"result\":\"hello\"}");
+    }
+    return *authenticated;
+  }
+
+  JSONWriter writer;
+  writer.BeginObject();
+  writer.Int("id", IpcProtocol::IntMember(root, "id"));
+  error err = call(method, root, &writer);
+  if (err != noError) {
+    writer.String("error", err);
+  }
+  writer.EndObject();
+  JSONDelete(root);
+  return channel_->Send(writer.Buffer());
+}
+
+error IpcConnection::call(
+    const std::string &method, JSONValue *root, JSONWriter *writer) {
+  char errmsg[1024];
+  errmsg[0] = 0;
+  if ("running" == method) {
+    KopsikTimeEntryViewItem *item = kopsik_time_entry_view_item_init();
+    int is_tracking(0);
+    kopsik_api_result res = kopsik_running_time_entry_view_item(
+      context_, errmsg, sizeof(errmsg), item, &is_tracking);
+    if (KOPSIK_API_SUCCESS == res) {
+      writer->Key("result");
+      if (is_tracking) {
+        IpcProtocol::WriteTimeEntry(item, writer);
+      } else {
+        writer->Raw("null");
+      }
+    }
+    kopsik_time_entry_view_item_clear(item);
+    return result(res, errmsg);
+  }
+  if ("list" == method) {
+    KopsikTimeEntryViewItem *first = 0;
+    kopsik_api_result res = kopsik_time_entry_view_items(
+      context_, errmsg, sizeof(errmsg), &first);
+    if (KOPSIK_API_SUCCESS == res) {
+      writer->Key("result");
+      writer->BeginArray();
+      for (KopsikTimeEntryViewItem *item = first;
+          item;
+          item = reinterpret_cast<KopsikTimeEntryViewItem *>(
+            item->Next)) {
+        IpcProtocol::WriteTimeEntry(item, writer);
+      }
+      writer->EndArray();
+    }
+    kopsik_time_entry_view_item_clear(first);
+    return result(res, errmsg);
+  }
+  if ("start" == method || "continue" == method) {
+    KopsikTimeEntryViewItem *item = kopsik_time_entry_view_item_init();
+    kopsik_api_result res = KOPSIK_API_SUCCESS;
+    if ("start" == method) {
+      res = kopsik_start(context_, errmsg, sizeof(errmsg),
+        IpcProtocol::Member(root, "description").c_str(),
+        IpcProtocol::Member(root, "duration").c_str(),
+        static_cast<unsigned int>(
+          IpcProtocol::IntMember(root, "task_id")),
+        static_cast<unsigned int>(
+          IpcProtocol::IntMember(root, "project_id")),
+        item);
+    } else {
+      res = kopsik_continue(context_, errmsg, sizeof(errmsg),
+        IpcProtocol::Member(root, "guid").c_str(), item);
+    }
+    if (KOPSIK_API_SUCCESS == res) {
+      writer->Key("result");
+      IpcProtocol::WriteTimeEntry(item, writer);
+    }
+    kopsik_time_entry_view_item_clear(item);
+    return result(res, errmsg);
+  }
+  if ("stop" == method) {
+    KopsikTimeEntryViewItem *item = kopsik_time_entry_view_item_init();
+    int was_found(0);
+    kopsik_api_result res = kopsik_stop(
+      context_, errmsg, sizeof(errmsg), item, &was_found);
+    if (KOPSIK_API_SUCCESS == res) {
+      writer->Key("result");
+      if (was_found) {
+        IpcProtocol::WriteTimeEntry(item, writer);
+      } else {
+        writer->Raw("null");
+      }
+    }
+    kopsik_time_entry_view_item_clear(item);
+    return result(res, errmsg);
+  }
+  if ("sync" == method) {
+    kopsik_sync(context_);
+    writer->Bool("result", true);
+    return noError;
+  }
+  if ("subscribe" == method) {
+    if (subscription_) {
+      app()->UnsubscribeModelChanges(subscription_);
+    }
+    subscription_ = app()->SubscribeModelChanges(
+      static_cast<int>(IpcProtocol::IntMember(root, "models")),
+      static_cast<int>(IpcProtocol::IntMember(root, "changes")),
+      true,
+      new IpcChangesListener(channel_));
+    writer->Int("result", subscription_);
+    return noError;
+  }
+  return error("Unknown method " + method);
+}
+
+error IpcConnection::result(const kopsik_api_result res, const char *errmsg) {
+  if (KOPSIK_API_SUCCESS == res) {
+    return noError;
+  }
+  return error(errmsg);
+}
+
+Context *IpcConnection::app() const {
+  return reinterpret_cast<Context *>(context_);
+}
+
+Poco::Logger &IpcConnection::logger() const {
+  return Poco::Logger::get("ipc");
+}
+
+IpcConnectionFactory::IpcConnectionFactory(
+    void *context, const std::string &token, const volatile bool *stopping)
+  : context_(context), token_(token), stopping_(stopping) {}
+
+Poco::Net::TCPServerConnection *IpcConnectionFactory::createConnection(
+    const Poco::Net::StreamSocket &socket) {
+  return new IpcConnection(socket, context_, token_, stopping_);
+}
+
+// Writes a file only the user can read, from the moment it's created
+static error writePrivateFile(
+    const std::string &path, const std::string &contents) {
+#ifndef _WIN32
+  // Left behind by a crash. A link put in its place is removed,
+  // not followed.
+  unlink(path.c_str());
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL,
+                S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    return error("Cannot create " + path + ": " + strerror(errno));
+  }
+  ssize_t written = write(fd, contents.data(), contents.size());
+  close(fd);
+  if (written < 0
+      || static_cast<std::size_t>(written) != contents.size()) {
+    return error("Cannot write " + path);
+  }
+#else
+  Poco::FileOutputStream out(path);
+  out << contents;
+#endif
+  return noError;
+}
+
+IpcServer::IpcServer(void *context, const std::string &db_path)
+  : context_(context)
+  , path_(db_path + kIpcFileSuffix)
+  , server_(0)
+  , stopping_(false) {}
+
+IpcServer::~IpcServer() {
+  Stop();
+}
+
+error IpcServer::Start() {
+  try {
+    Poco::UUIDGenerator &generator =
+      Poco::UUIDGenerator::defaultGenerator();
+    std::string token(generator.createRandom().toString()
+                      + generator.createRandom().toString());
+
+    Poco::Net::ServerSocket socket(
+      Poco::Net::SocketAddress("127.0.0.1", 0));
+    Poco::Net::TCPServerParams *params =
+      new Poco::Net::TCPServerParams();
+    params->setMaxThreads(kIpcMaxClients);
+    params->setMaxQueued(kIpcMaxClients);
+    server_ = new Poco::Net::TCPServer(
+      new IpcConnectionFactory(context_, token, &stopping_),
+      socket,
+      params);
+
+    std::stringstream contents;
+    contents << socket.address().port() << "\n" << token << "\n";
+    error err = writePrivateFile(path_, contents.str());
+    if (err != noError) {
+      Stop();
+      return err;
+    }
+    server_->start();
+  } catch(const Poco::Exception& exc) {
+    Stop();
+    return exc.displayText();
+  }
+  return noError;
+}
+
+void IpcServer::Stop() {
+  if (server_) {
+    stopping_ = true;
+    server_->stop();
+    while (server_->currentConnections() > 0) {
+      Poco::Thread::sleep(10);
+    }
+    delete server_;
+    server_ = 0;
+  }
+  try {
+    Poco::File file(path_);
+    if (file.exists()) {
+      file.remove();
+    }
+  } catch(const Poco::Exception&) {
+    // Gone already
+  }
+}
+
+error IpcClient::Connect(const std::string &db_path) {
+  try {
+    std::string port(""), token("");
+    {
+      Poco::FileInputStream in(db_path + kIpcFileSuffix);
+      in >> port >> token;
+    }
+    socket_.connect(Poco::Net::SocketAddress(
+      "127.0.0.1",
+      static_cast<Poco::UInt16>(Poco::NumberParser::parse(port))));
+    JSONWriter hello;
+    hello.BeginObject();
+    hello.String("method", "hello");
+    hello.String("token", token);
+    hello.EndObject();
+    std::string reply("");
+    return Call(hello.Buffer(), &reply);
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  }
+}
+
+error IpcClient::Call(const std::string &request, std::string *response) {
+  try {
+    std::string line(request + "\n");
+    socket_.sendBytes(line.data(), static_cast<int>(line.size()));
+    while (true) {
+      error err = read(response);
+      if (err != noError) {
+        return err;
+      }
+      if (response->find("\"event\":") == std::string::npos) {
+        return noError;
+      }
+      events_.push_back(*response);
+    }
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  }
+}
+
+error IpcClient::Receive(std::string *message) {
+  if (!events_.empty()) {
+    *message = events_.front();
+    events_.pop_front();
+    return noError;
+  }
+  return read(message);
+}
+
+error IpcClient::read(std::string *message) {
+  try {
+    char chunk[4096];
+    while (!IpcProtocol::NextLine(&buffer_, message)) {
+      int n = socket_.receiveBytes(chunk, sizeof(chunk));
+      if (n <= 0) {
+        return error("IPC service closed the connection");
+      }
+      buffer_.append(chunk, static_cast<std::size_t>(n));
+    }
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  }
+  return noError;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,224 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_IPC_SERVICE_H_
+#define SRC_IPC_SERVICE_H_
+
+#ifndef _WIN32
+#include <sys/stat.h>  // NOLINT
+#endif
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "./context.h"
+#include "./json_reader.h"
+#include "./json_writer.h"
+#include "./kopsik_api.h"
+#include "./types.h"
+
+#include "Poco/FileStream.h"
+#include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Timespan.h"
+#include "Poco/Net/NetException.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/Net/TCPServer.h"
+#include "Poco/Net/TCPServerConnection.h"
+#include "Poco/Net/TCPServerConnectionFactory.h"
+
+namespace kopsik {
+
+  // Added to the database path for the file telling clients where the
+  // service is: its port and token, a line each
+  const char kIpcFileSuffix[] = "-ipc";
+  // Clients served at once, each has a thread while connected
+  const int kIpcMaxClients = 16;
+  // Longer requests close the connection
+  const std::string::size_type kIpcMaxLineBytes = 64 * 1024;
+  // A client that doesn't read its events for this long is dropped
+  const Poco::Timespan::TimeDiff kIpcSendTimeoutMicros =
+    5 * Poco::Timespan::SECONDS;
+  // How often a connection waiting for its client checks whether the
+  // service is stopping
+  const Poco::Timespan::TimeDiff kIpcPollMicros =
+    250 * Poco::Timespan::MILLISECONDS;
+
+  // One process owns the context and serves it to the other tools
+  // on the machine, which then share its models, its sync and its
+  // database. Poco has no Unix domain sockets, so the service listens
+  // on the loopback interface, and a client proves it can read the
+  // IPC file, which only the user can, by sending its token.
+  //
+  // Messages are JSON objects, one per line. The first request must
+  // be {"method":"hello","token":"..."}. Then:
+  //
+  //   {"id":1,"method":"running"}
+  //   {"id":2,"method":"list"}
+  //   {"id":3,"method":"start","description":"Work","project_id":1}
+  //   {"id":4,"method":"stop"}
+  //   {"id":5,"method":"continue","guid":"..."}
+  //   {"id":6,"method":"sync"}
+  //   {"id":7,"method":"subscribe","models":0,"changes":0}
+  //
+  // go through the same kopsik_* calls as in process, and are answered
+  // with {"id":1,"result":...} or {"id":1,"error":"..."}. Time entries
+  // are the fields of KopsikTimeEntryViewItem. After subscribing, the
+  // model changes asked for (as in kopsik_subscribe_model_changes) come
+  // as {"event":"changes","changes":[{"model":"time_entry",
+  // "change":"update","id":1,"guid":"..."}]}.
+  class IpcProtocol {
+  public:
+    static void WriteTimeEntry(
+        KopsikTimeEntryViewItem *item,
+        JSONWriter *writer);
+
+    static void WriteChanges(
+        const std::vector<ModelChange> &changes,
+        JSONWriter *writer);
+
+    // Splits off the next line from buffer, false when there's none
+    // yet
+    static bool NextLine(std::string *buffer, std::string *line);
+
+    static std::string Member(JSONValue *root, const char *name);
+
+    static Poco::Int64 IntMember(JSONValue *root, const char *name);
+
+  private:
+    static std::string str(const char *value);
+  };
+
+  // Serializes what's sent to a client, answers and events come from
+  // different threads. Outlives the connection while a subscription
+  // may still be told about changes.
+  class IpcChannel {
+  public:
+    explicit IpcChannel(const Poco::Net::StreamSocket &socket);
+
+    bool Send(const std::string &message);
+
+    void Close();
+
+  private:
+    Poco::Net::StreamSocket socket_;
+    bool closed_;
+    Poco::FastMutex m_;
+  };
+
+  class IpcChangesListener : public ModelChangeListener {
+  public:
+    explicit IpcChangesListener(Poco::SharedPtr<IpcChannel> channel);
+
+    void Changed(const std::vector<ModelChange> &changes);
+
+  private:
+    Poco::SharedPtr<IpcChannel> channel_;
+  };
+
+  // One client, on a thread of the TCPServer
+  class IpcConnection : public Poco::Net::TCPServerConnection {
+  public:
+    IpcConnection(
+        const Poco::Net::StreamSocket &socket,
+        void *context,
+        const std::string &token,
+        const volatile bool *stopping);
+
+    void run();
+
+  private:
+    // False closes the connection
+    bool handle(const std::string &line, bool *authenticated);
+
+    // Writes the "result" member, unless there's an error
+    error call(
+        const std::string &method,
+        JSONValue *root,
+        JSONWriter *writer);
+
+    static error result(const kopsik_api_result res, const char *errmsg);
+
+    Context *app() const;
+
+    Poco::Logger &logger() const;
+
+    void *context_;
+    std::string token_;
+    const volatile bool *stopping_;
+    Poco::SharedPtr<IpcChannel> channel_;
+    unsigned int subscription_;
+  };
+
+  class IpcConnectionFactory : public Poco::Net::TCPServerConnectionFactory {
+  public:
+    IpcConnectionFactory(
+        void *context,
+        const std::string &token,
+        const volatile bool *stopping);
+
+    Poco::Net::TCPServerConnection *createConnection(
+        const Poco::Net::StreamSocket &socket);
+
+  private:
+    void *context_;
+    std::string token_;
+    const volatile bool *stopping_;
+  };
+
+  // Serves a context to other processes until it's deleted
+  class IpcServer {
+  public:
+    // Database path of the context, the IPC file is written next to it
+    IpcServer(void *context, const std::string &db_path);
+
+    ~IpcServer();
+
+    error Start();
+
+    // Returns once no client is using the context anymore
+    void Stop();
+
+    const std::string &Path() const { return path_; }
+
+  private:
+    void *context_;
+    std::string path_;
+    Poco::Net::TCPServer *server_;
+    volatile bool stopping_;
+
+    IpcServer(const IpcServer &);
+    IpcServer &operator=(const IpcServer &);
+  };
+
+  // Talks to an IpcServer of another process, for tools that would
+  // otherwise open the database themselves
+  class IpcClient {
+  public:
+    IpcClient() {}
+
+    // IPC file of the database the service has open
+    error Connect(const std::string &db_path);
+
+    // Sends the request and returns its answer. Events that come
+    // meanwhile are kept for Receive.
+    error Call(const std::string &request, std::string *response);
+
+    // Next event, waits for it
+    error Receive(std::string *message);
+
+  private:
+    error read(std::string *message);
+
+    Poco::Net::StreamSocket socket_;
+    std::string buffer_;
+    std::deque<std::string> events_;
+
+    IpcClient(const IpcClient &);
+    IpcClient &operator=(const IpcClient &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_IPC_SERVICE_H_
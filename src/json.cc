@@ -2,24 +2,36 @@
 
 #include "./json.h"
 
+#include <algorithm>
 #include <sstream>
-#include <cstring>
 
+#include "./const.h"
 #include "./formatter.h"
+#include "./json_key.h"
+#include "./json_scan.h"
+#include "./log.h"
+#include "./metrics.h"
 
+#include "Poco/Environment.h"
 #include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/NumberParser.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
 
 namespace kopsik {
 
-Poco::UInt64 GetIDFromJSONNode(JSONNODE * const data) {
+static LogComponent log_json = { "json", 0 };
+
+Poco::UInt64 GetIDFromJSONNode(JSONValue * const data) {
   poco_assert(data);
 
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
+  JSONIterator current_node = JSONBegin(data);
+  JSONIterator last_node = JSONEnd(data);
   while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "id") == 0) {
-      return json_as_int(*current_node);
+    JSONKey key = JSONNodeKey(*current_node);
+    if (kJSONKeyID == key) {
+      return JSONInt(*current_node);
     }
     ++current_node;
   }
@@ -28,29 +40,29 @@ Poco::UInt64 GetIDFromJSONNode(JSONNODE * const data) {
   return 0;
 }
 
-guid GetGUIDFromJSONNode(JSONNODE * const data) {
+guid GetGUIDFromJSONNode(JSONValue * const data) {
   poco_assert(data);
 
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
+  JSONIterator current_node = JSONBegin(data);
+  JSONIterator last_node = JSONEnd(data);
   while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "guid") == 0) {
-      return std::string(json_as_string(*current_node));
+    JSONKey key = JSONNodeKey(*current_node);
+    if (kJSONKeyGUID == key) {
+      return JSONString(*current_node);
     }
     ++current_node;
   }
   return "";
 }
 
-bool IsDeletedAtServer(JSONNODE * const data) {
+bool IsDeletedAtServer(JSONValue * const data) {
   poco_assert(data);
 
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
+  JSONIterator current_node = JSONBegin(data);
+  JSONIterator last_node = JSONEnd(data);
   while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "server_deleted_at") == 0) {
+    JSONKey key = JSONNodeKey(*current_node);
+    if (kJSONKeyServerDeletedAt == key) {
       return true;
     }
     ++current_node;
@@ -60,7 +72,7 @@ bool IsDeletedAtServer(JSONNODE * const data) {
 
 void ParseBatchUpdateResultJSON(
     BatchUpdateResult *model,
-    JSONNODE * const n) {
+    JSONValue * const n) {
   poco_assert(n);
   poco_assert(model);
 
@@ -68,27 +80,61 @@ void ParseBatchUpdateResultJSON(
   model->Body = "";
   model->GUID = "";
   model->ContentType = "";
-  JSONNODE_ITERATOR i = json_begin(n);
-  JSONNODE_ITERATOR e = json_end(n);
+  model->Data = 0;
+  JSONValue *body = 0;
+  JSONIterator i = JSONBegin(n);
+  JSONIterator e = JSONEnd(n);
   while (i != e) {
-    json_char *node_name = json_name(*i);
-    if (strcmp(node_name, "status") == 0) {
-      model->StatusCode = json_as_int(*i);
-    } else if (strcmp(node_name, "body") == 0) {
-      model->Body = std::string(json_as_string(*i));
-    } else if (strcmp(node_name, "guid") == 0) {
-      model->GUID = std::string(json_as_string(*i));
-    } else if (strcmp(node_name, "content_type") == 0) {
-      model->ContentType = std::string(json_as_string(*i));
-    } else if (strcmp(node_name, "method") == 0) {
-      model->Method = std::string(json_as_string(*i));
+    JSONKey key = JSONNodeKey(*i);
+    if (kJSONKeyStatus == key) {
+      model->StatusCode = JSONInt(*i);
+    } else if (kJSONKeyBody == key) {
+      body = *i;
+    } else if (kJSONKeyGUID == key) {
+      model->GUID = JSONString(*i);
+    } else if (kJSONKeyContentType == key) {
+      model->ContentType = JSONString(*i);
+    } else if (kJSONKeyMethod == key) {
+      model->Method = JSONString(*i);
     }
     ++i;
   }
+  if (!body) {
+    return;
+  }
+
+  // The body is JSON in a string. Only what the model is loaded from
+  // is parsed, and only once, while the rest is kept as the error.
+  const bool succeeded = model->StatusCode >= 200 && model->StatusCode < 300;
+  if (!succeeded || model->ResourceIsGone()) {
+    model->Body = JSONString(body);
+    return;
+  }
+  JSONValue *root = JSONParse(JSONString(body));
+  if (!root) {
+    model->StatusCode = 0;
+    model->Body = "Invalid batch update response body";
+    return;
+  }
+  model->Data = JSONTake(root, "data");
+  JSONDelete(root);
+}
+
+JSONValue *GetListFromJSONNode(JSONValue * const root) {
+  poco_assert(root);
+
+  if (kJSONArray == JSONTypeOf(root)) {
+    return root;
+  }
+  JSONValue *data = JSONGet(root, "data");
+  if (data && kJSONArray == JSONTypeOf(data)) {
+    return data;
+  }
+  return 0;
 }
 
-bool IsValidJSON(const std::string json) {
-    return json_is_valid(json.c_str());
+bool IsValidJSON(const std::string &json) {
+    return JSONIsValid(json);
 }
 
 void LoadUserFromJSONString(
@@ -99,65 +145,737 @@ void LoadUserFromJSONString(
   poco_assert(model);
   poco_assert(!json.empty());
 
-  JSONNODE *root = json_parse(json.c_str());
-  JSONNODE_ITERATOR current_node = json_begin(root);
-  JSONNODE_ITERATOR last_node = json_end(root);
-  while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "since") == 0) {
-      model->SetSince(json_as_int(*current_node));
+  UserJSONStreamLoader loader(full_sync, with_related_data);
+  loader.Consume(json.data(), json.size());
+  error err = loader.Finish();
+  if (err != noError) {
+    ComponentLogger(&log_json).error(err);
+  }
+  loader.Apply(model);
+}
 
-      Poco::Logger &logger = Poco::Logger::get("json");
-      std::stringstream s;
-      s << "User data as of: " << model->Since();
-      logger.debug(s.str());
+// Sorts alive once, then looks up each model in the sorted array
+template <class T>
+void markDeletedOnServer(
+    const std::vector<T *> &list,
+    AliveIDs *alive) {
+  std::sort(alive->begin(), alive->end());
+  for (typename std::vector<T *>::const_iterator it = list.begin();
+      it != list.end();
+      it++) {
+    T *model = *it;
+    if (!std::binary_search(alive->begin(), alive->end(), model->ID())) {
+      model->MarkAsDeletedOnServer();
+    }
+  }
+}
 
-    } else if (strcmp(node_name, "data") == 0) {
-      LoadUserFromJSONNode(model, *current_node, full_sync, with_related_data);
+// Models of the workspace count as alive
+template <class T>
+void keepWorkspaceModels(
+    const std::vector<T *> &list,
+    const Poco::UInt64 wid,
+    AliveIDs *alive) {
+  for (typename std::vector<T *>::const_iterator it = list.begin();
+      it != list.end();
+      it++) {
+    if ((*it)->ID() && (*it)->WID() == wid) {
+      alive->push_back((*it)->ID());
+    }
+  }
+}
+
+// Only the time entries that started in the window fetched
+void markTimeEntriesDeletedOnServer(
+    const std::vector<TimeEntry *> &list,
+    AliveIDs *alive,
+    const Poco::UInt64 since,
+    const Poco::UInt64 until) {
+  std::sort(alive->begin(), alive->end());
+  for (std::vector<TimeEntry *>::const_iterator it = list.begin();
+      it != list.end();
+      it++) {
+    TimeEntry *model = *it;
+    if (model->Start() < since || model->Start() >= until
+        || !model->ID()) {
+      continue;
+    }
+    if (!std::binary_search(alive->begin(), alive->end(), model->ID())) {
+      model->MarkAsDeletedOnServer();
+    }
+  }
+}
+
+// Related data lists in the order their models are applied,
+// so each model finds the ones it refers to
+const char *kRelatedDataLists[] = {
+  "workspaces",
+  "clients",
+  "projects",
+  "tasks",
+  "tags",
+  "time_entries"
+};
+const std::size_t kRelatedDataListCount =
+  sizeof(kRelatedDataLists) / sizeof(kRelatedDataLists[0]);
+
+std::size_t relatedDataListIndex(const std::string name) {
+  for (std::size_t i = 0; i < kRelatedDataListCount; i++) {
+    if (name == kRelatedDataLists[i]) {
+      return i;
+    }
+  }
+  return kRelatedDataListCount;
+}
+
+bool isRelatedDataList(const std::string name) {
+  return relatedDataListIndex(name) < kRelatedDataListCount;
+}
+
+void loadUserRelatedModel(
+    User *user,
+    const std::string &list,
+    JSONValue *node,
+    AliveIDs *alive) {
+  if ("projects" == list) {
+    loadUserProjectFromJSONNode(user, node, alive);
+  } else if ("tags" == list) {
+    loadUserTagFromJSONNode(user, node, alive);
+  } else if ("tasks" == list) {
+    loadUserTaskFromJSONNode(user, node, alive);
+  } else if ("time_entries" == list) {
+    loadUserTimeEntryFromJSONNode(user, node, alive);
+  } else if ("workspaces" == list) {
+    loadUserWorkspaceFromJSONNode(user, node, alive);
+  } else if ("clients" == list) {
+    loadUserClientFromJSONNode(user, node, alive);
+  }
+}
+
+void markUserListDeletedOnServer(
+    User *user,
+    const std::string &list,
+    AliveIDs *alive) {
+  if ("projects" == list) {
+    markDeletedOnServer(user->related.Projects, alive);
+  } else if ("tags" == list) {
+    markDeletedOnServer(user->related.Tags, alive);
+  } else if ("tasks" == list) {
+    markDeletedOnServer(user->related.Tasks, alive);
+  } else if ("time_entries" == list) {
+    markDeletedOnServer(user->related.TimeEntries, alive);
+  } else if ("workspaces" == list) {
+    markDeletedOnServer(user->related.Workspaces, alive);
+  } else if ("clients" == list) {
+    markDeletedOnServer(user->related.Clients, alive);
+  }
+}
+
+// Parses models into trees, on as many threads as run() is called
+// on. Threads take the next chunk of models until none are left,
+// each tree goes into the slot of its model.
+class RelatedModelDecoder : public Poco::Runnable {
+ public:
+  RelatedModelDecoder(
+      const std::vector<const std::string *> &json,
+      std::vector<JSONValue *> *nodes)
+    : json_(json)
+    , nodes_(nodes)
+    , next_(0) {
+    nodes_->assign(json_.size(), 0);
+  }
+
+  void run() {
+    while (true) {
+      std::size_t begin(0);
+      {
+        Poco::FastMutex::ScopedLock lock(m_);
+        begin = next_;
+        if (begin >= json_.size()) {
+          return;
+        }
+        next_ += kJSONDecodeChunkModels;
+      }
+      std::size_t end = std::min(begin + kJSONDecodeChunkModels,
+                                 json_.size());
+      for (std::size_t i = begin; i < end; i++) {
+        (*nodes_)[i] = JSONParse(*json_[i]);
+      }
     }
-    ++current_node;
   }
-  json_delete(root);
+
+ private:
+  const std::vector<const std::string *> &json_;
+  std::vector<JSONValue *> *nodes_;
+  std::size_t next_;
+  Poco::FastMutex m_;
+};
+
+UserJSONStreamLoader::UserJSONStreamLoader(
+    const bool full_sync,
+    const bool with_related_data)
+  : with_related_data_(with_related_data)
+  , decode_threads_(Poco::Environment::processorCount()) {
+  Reset(full_sync);
+}
+
+UserJSONStreamLoader::~UserJSONStreamLoader() {
+  clearStaged();
+}
+
+void UserJSONStreamLoader::Reset(const bool full_sync) {
+  clearStaged();
+  for (std::size_t i = 0; i < kRelatedDataListCount; i++) {
+    related_json_[i].clear();
+  }
+  full_sync_ = full_sync;
+  error_ = noError;
+  containers_ = "";
+  root_seen_ = false;
+  in_data_ = false;
+  in_list_ = false;
+  expect_key_ = false;
+  root_key_ = "";
+  data_key_ = "";
+  in_string_ = false;
+  escaped_ = false;
+  reading_value_ = false;
+  keep_value_ = false;
+  value_type_ = 0;
+  value_nesting_ = 0;
+  value_depth_ = 0;
+  value_ = "";
+  has_since_ = false;
+  since_ = 0;
+  alive_.clear();
+  parse_micros_ = 0;
+}
+
+void UserJSONStreamLoader::clearStaged() {
+  for (std::vector<StagedNode>::const_iterator it = staged_.begin();
+      it != staged_.end();
+      it++) {
+    JSONDelete(it->node);
+  }
+  staged_.clear();
+}
+
+void UserJSONStreamLoader::Consume(const char *data, const std::size_t size) {
+  Poco::Timestamp started;
+  std::size_t i(0);
+  while (i < size && error_.empty()) {
+    // Inside strings and containers, what's up to the next quote,
+    // backslash or bracket is only copied, so it's copied at once
+    if (reading_value_ && value_type_ && !escaped_) {
+      std::size_t plain = JSONScanPlainBytes(data + i, size - i, in_string_);
+      if (plain) {
+        if (keep_value_) {
+          value_.append(data + i, plain);
+        }
+        i += plain;
+        continue;
+      }
+    }
+    consume(data[i]);
+    i++;
+  }
+  parse_micros_ += started.elapsed();
+}
+
+void UserJSONStreamLoader::consume(const char c) {
+  if (reading_value_) {
+    readValue(c);
+    return;
+  }
+
+  // Only keys are left as strings at this level
+  if (in_string_) {
+    std::string &key = (1 == containers_.size()) ? root_key_ : data_key_;
+    if (escaped_) {
+      escaped_ = false;
+    } else if ('\\' == c) {
+      escaped_ = true;
+    } else if ('"' == c) {
+      in_string_ = false;
+      return;
+    }
+    key += c;
+    return;
+  }
+
+  switch (c) {
+  case ' ':
+  case '\t':
+  case '\r':
+  case '\n':
+    return;
+  case ':':
+    expect_key_ = false;
+    return;
+  case ',':
+    expect_key_ = !containers_.empty()
+      && '{' == containers_[containers_.size() - 1];
+    return;
+  case '}':
+  case ']':
+    if (containers_.empty()) {
+      error_ = "Unexpected end of JSON container";
+      return;
+    }
+    containers_.erase(containers_.size() - 1);
+    if (containers_.size() < 2) {
+      in_data_ = false;
+    }
+    if (containers_.size() < 3) {
+      in_list_ = false;
+    }
+    expect_key_ = false;
+    return;
+  case '"':
+    if (expect_key_) {
+      in_string_ = true;
+      if (1 == containers_.size()) {
+        root_key_ = "";
+      } else {
+        data_key_ = "";
+      }
+      return;
+    }
+    break;
+  }
+
+  beginValue(c);
+}
+
+void UserJSONStreamLoader::beginValue(const char c) {
+  std::string::size_type depth = containers_.size();
+
+  if (0 == depth) {
+    if (root_seen_ || '{' != c) {
+      error_ = "User JSON is not an object";
+      return;
+    }
+    root_seen_ = true;
+    containers_ += c;
+    expect_key_ = true;
+    return;
+  }
+
+  if (1 == depth && "data" == root_key_ && '{' == c) {
+    in_data_ = true;
+    containers_ += c;
+    expect_key_ = true;
+    return;
+  }
+
+  if (2 == depth && in_data_ && with_related_data_ && '[' == c
+      && isRelatedDataList(data_key_)) {
+    in_list_ = true;
+    alive_[data_key_];
+    containers_ += c;
+    expect_key_ = false;
+    return;
+  }
+
+  reading_value_ = true;
+  value_depth_ = depth;
+  value_type_ = ('"' == c || '{' == c || '[' == c) ? c : 0;
+  value_nesting_ = ('{' == c || '[' == c) ? 1 : 0;
+  in_string_ = ('"' == c);
+
+  bool scalar = ('{' != c && '[' != c);
+  keep_value_ = (3 == depth && in_list_ && '{' == c)
+    || (2 == depth && in_data_ && scalar)
+    || (1 == depth && "since" == root_key_ && scalar);
+
+  value_ = "";
+  if (keep_value_) {
+    value_ += c;
+  }
+}
+
+void UserJSONStreamLoader::readValue(const char c) {
+  if (in_string_) {
+    if (keep_value_) {
+      value_ += c;
+    }
+    if (escaped_) {
+      escaped_ = false;
+    } else if ('\\' == c) {
+      escaped_ = true;
+    } else if ('"' == c) {
+      in_string_ = false;
+      if ('"' == value_type_) {
+        endValue();
+      }
+    }
+    return;
+  }
+
+  if (!value_type_) {
+    if (' ' == c || '\t' == c || '\r' == c || '\n' == c
+        || ',' == c || '}' == c || ']' == c) {
+      endValue();
+      consume(c);
+      return;
+    }
+    if (keep_value_) {
+      value_ += c;
+    }
+    return;
+  }
+
+  if (keep_value_) {
+    value_ += c;
+  }
+  if ('"' == c) {
+    in_string_ = true;
+  } else if ('{' == c || '[' == c) {
+    value_nesting_++;
+  } else if ('}' == c || ']' == c) {
+    value_nesting_--;
+    if (!value_nesting_) {
+      endValue();
+    }
+  }
+}
+
+void UserJSONStreamLoader::endValue() {
+  reading_value_ = false;
+  if (!keep_value_) {
+    return;
+  }
+
+  if (1 == value_depth_) {
+    Poco::UInt64 since(0);
+    if (Poco::NumberParser::tryParseUnsigned64(value_, since)) {
+      since_ = since;
+      has_since_ = true;
+    }
+  } else if (2 == value_depth_) {
+    std::string member = "{\"" + data_key_ + "\":" + value_ + "}";
+    JSONValue *node = JSONParse(member);
+    if (!node) {
+      error_ = "Invalid JSON in user field " + data_key_;
+    } else {
+      stage("", node);
+    }
+  } else {
+    // Parsed in Finish, along with the other models
+    std::vector<std::string> &list =
+      related_json_[relatedDataListIndex(data_key_)];
+    list.push_back("");
+    list.back().swap(value_);
+  }
+  value_ = "";
+}
+
+void UserJSONStreamLoader::decodeRelatedModels() {
+  std::vector<const std::string *> json;
+  std::vector<std::size_t> lists;
+  for (std::size_t i = 0; i < kRelatedDataListCount; i++) {
+    if (!related_json_[i].empty()) {
+      alive_[kRelatedDataLists[i]].reserve(related_json_[i].size());
+    }
+    for (std::vector<std::string>::const_iterator it =
+        related_json_[i].begin();
+        it != related_json_[i].end();
+        it++) {
+      json.push_back(&*it);
+      lists.push_back(i);
+    }
+  }
+  if (json.empty()) {
+    return;
+  }
+
+  std::vector<JSONValue *> nodes;
+  RelatedModelDecoder decoder(json, &nodes);
+
+  // Small responses are not worth starting threads for
+  std::size_t thread_count(0);
+  if (json.size() >= kJSONDecodeParallelMinModels) {
+    // This thread is one of them
+    thread_count = std::min(
+      decode_threads_,
+      (json.size() + kJSONDecodeChunkModels - 1) / kJSONDecodeChunkModels);
+    if (thread_count) {
+      thread_count--;
+    }
+  }
+  std::vector<Poco::Thread *> threads;
+  for (std::size_t i = 0; i < thread_count; i++) {
+    Poco::Thread *thread = new Poco::Thread("json_decoder");
+    thread->start(decoder);
+    threads.push_back(thread);
+  }
+  decoder.run();
+  for (std::vector<Poco::Thread *>::const_iterator it = threads.begin();
+      it != threads.end();
+      it++) {
+    (*it)->join();
+    delete *it;
+  }
+
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (!nodes[i]) {
+      if (error_ == noError) {
+        error_ = error("Invalid JSON in ") + kRelatedDataLists[lists[i]];
+      }
+      continue;
+    }
+    stage(kRelatedDataLists[lists[i]], nodes[i]);
+  }
+
+  for (std::size_t i = 0; i < kRelatedDataListCount; i++) {
+    related_json_[i].clear();
+  }
+}
+
+void UserJSONStreamLoader::stage(const std::string &list, JSONValue *node) {
+  StagedNode staged;
+  staged.list = list;
+  staged.node = node;
+  staged_.push_back(staged);
+}
+
+void UserJSONStreamLoader::loadRelatedModel(
+    User *user,
+    const std::string &list,
+    JSONValue *node) {
+  if (!pushed_meanwhile_.empty() && keepPushed(user, list, node)) {
+    alive_[list].push_back(GetIDFromJSONNode(node));
+    Metrics::Shared().Count("sync.kept_pushed_models");
+    return;
+  }
+  loadUserRelatedModel(user, list, node, &alive_[list]);
+}
+
+bool UserJSONStreamLoader::keepPushed(
+    User *user,
+    const std::string &list,
+    JSONValue *node) const {
+  guid GUID = GetGUIDFromJSONNode(node);
+  if (GUID.empty() || !pushed_meanwhile_.count(GUID)) {
+    return false;
+  }
+  if ("time_entries" == list) {
+    TimeEntry *te = user->GetTimeEntryByGUID(GUID);
+    return te && te->UpdatedAt() >= GetUpdatedAtFromJSONNode(node);
+  }
+  return "projects" == list;
+}
+
+void UserJSONStreamLoader::markListDeletedOnServer(
+    User *user,
+    const std::string list) {
+  AliveIDs *alive = &alive_[list];
+  // Those created by the push have their IDs only since
+  for (std::set<std::string>::const_iterator it =
+      pushed_meanwhile_.begin();
+      it != pushed_meanwhile_.end();
+      it++) {
+    BaseModel *model = 0;
+    if ("time_entries" == list) {
+      model = user->GetTimeEntryByGUID(*it);
+    } else if ("projects" == list) {
+      model = user->GetProjectByGUID(*it);
+    }
+    if (model && model->ID()) {
+      alive->push_back(model->ID());
+    }
+  }
+  markUserListDeletedOnServer(user, list, alive);
+}
+
+error UserJSONStreamLoader::Finish() {
+  Poco::Timestamp started;
+  decodeRelatedModels();
+  parse_micros_ += started.elapsed();
+  Metrics::Shared().Time("json.parse.user", parse_micros_);
+
+  if (error_ != noError) {
+    return error_;
+  }
+  if (!complete()) {
+    return error("Incomplete user JSON");
+  }
+  return noError;
+}
+
+bool UserJSONStreamLoader::complete() const {
+  return error_ == noError
+    && root_seen_
+    && containers_.empty()
+    && !reading_value_;
+}
+
+void UserJSONStreamLoader::Apply(User *user) {
+  poco_assert(user);
+
+  Poco::Timestamp started;
+  Metrics::Shared().Count("sync.applied_models", staged_.size());
+
+  for (std::vector<StagedNode>::const_iterator it = staged_.begin();
+      it != staged_.end();
+      it++) {
+    if (it->list.empty()) {
+      LoadUserFromJSONNode(user, it->node, full_sync_, false);
+    } else {
+      loadRelatedModel(user, it->list, it->node);
+    }
+  }
+  clearStaged();
+
+  if (!complete()) {
+    return;
+  }
+
+  if (has_since_) {
+    user->SetSince(since_);
+
+    Poco::Logger &logger = ComponentLogger(&log_json);
+    KOPSIK_LOG_DEBUG(logger, "User data as of: " << user->Since());
+  }
+
+  if (full_sync_) {
+    for (std::map<std::string, AliveIDs>::const_iterator it =
+        alive_.begin();
+        it != alive_.end();
+        it++) {
+      markListDeletedOnServer(user, it->first);
+    }
+  }
+
+  Metrics::Shared().Time("sync.apply", started.elapsed());
+}
+
+error UserListLoader::Load(
+    User *user,
+    const std::string &list,
+    const std::string &json) {
+  poco_assert(user);
+
+  if (!list.empty() && !isRelatedDataList(list)) {
+    return error("Unknown list ") + list;
+  }
+  // Nothing in the list, it's loaded all the same
+  if (!list.empty()) {
+    alive_[list];
+  }
+  if ("null" == json) {
+    return noError;
+  }
+  JSONValue *root = JSONParse(json);
+  if (!root) {
+    return error("Invalid JSON in ") + (list.empty() ? "user" : list);
+  }
+  if (list.empty()) {
+    JSONValue *data = JSONGet(root, "data");
+    if (data) {
+      LoadUserFromJSONNode(user, data, true, false);
+    }
+    JSONDelete(root);
+    return noError;
+  }
+
+  AliveIDs *alive = &alive_[list];
+  JSONValue *items = GetListFromJSONNode(root);
+  std::size_t count = items ? JSONSize(items) : 0;
+  for (std::size_t i = 0; i < count; i++) {
+    loadUserRelatedModel(user, list, JSONAt(items, i), alive);
+  }
+  Metrics::Shared().Count("sync.applied_models", count);
+  JSONDelete(root);
+  return noError;
+}
+
+void UserListLoader::KeepWorkspace(User *user, const Poco::UInt64 wid) {
+  poco_assert(user);
+
+  keepWorkspaceModels(user->related.Clients, wid, &alive_["clients"]);
+  keepWorkspaceModels(user->related.Projects, wid, &alive_["projects"]);
+  keepWorkspaceModels(user->related.Tasks, wid, &alive_["tasks"]);
+  keepWorkspaceModels(user->related.Tags, wid, &alive_["tags"]);
+}
+
+void UserListLoader::KeepTimeEntries(
+    User *user,
+    const Poco::UInt64 since,
+    const Poco::UInt64 until) {
+  poco_assert(user);
+
+  AliveIDs *alive = &alive_["time_entries"];
+  for (std::vector<TimeEntry *>::const_iterator it =
+      user->related.TimeEntries.begin();
+      it != user->related.TimeEntries.end();
+      it++) {
+    TimeEntry *model = *it;
+    if (model->ID() && model->Start() >= since && model->Start() < until) {
+      alive->push_back(model->ID());
+    }
+  }
+}
+
+void UserListLoader::Complete(User *user, const Poco::UInt64 since) {
+  poco_assert(user);
+
+  for (std::map<std::string, AliveIDs>::iterator it = alive_.begin();
+      it != alive_.end();
+      it++) {
+    if ("time_entries" == it->first && time_entries_until_) {
+      markTimeEntriesDeletedOnServer(user->related.TimeEntries, &it->second,
+                                     time_entries_since_,
+                                     time_entries_until_);
+    } else {
+      markUserListDeletedOnServer(user, it->first, &it->second);
+    }
+  }
+  alive_.clear();
+
+  if (since) {
+    user->SetSince(since);
+  }
 }
 
 void LoadUserFromJSONNode(
     User *model,
-    JSONNODE * const data,
+    JSONValue * const data,
     const bool full_sync,
     const bool with_related_data) {
   poco_assert(model);
   poco_assert(data);
 
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
+  JSONIterator current_node = JSONBegin(data);
+  JSONIterator last_node = JSONEnd(data);
   while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "id") == 0) {
-      model->SetID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "default_wid") == 0) {
-      model->SetDefaultWID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "api_token") == 0) {
-      model->SetAPIToken(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "email") == 0) {
-      model->SetEmail(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "fullname") == 0) {
-      model->SetFullname(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "record_timeline") == 0) {
-      model->SetRecordTimeline(json_as_bool(*current_node));
-    } else if (strcmp(node_name, "store_start_and_stop_time") == 0) {
-      model->SetStoreStartAndStopTime(json_as_bool(*current_node));
+    JSONKey key = JSONNodeKey(*current_node);
+    if (kJSONKeyID == key) {
+      model->SetID(JSONInt(*current_node));
+    } else if (kJSONKeyDefaultWID == key) {
+      model->SetDefaultWID(JSONInt(*current_node));
+    } else if (kJSONKeyAPIToken == key) {
+      model->SetAPIToken(JSONString(*current_node));
+    } else if (kJSONKeyEmail == key) {
+      model->SetEmail(JSONString(*current_node));
+    } else if (kJSONKeyFullname == key) {
+      model->SetFullname(JSONString(*current_node));
+    } else if (kJSONKeyRecordTimeline == key) {
+      model->SetRecordTimeline(JSONBool(*current_node));
+    } else if (kJSONKeyStoreStartAndStopTime == key) {
+      model->SetStoreStartAndStopTime(JSONBool(*current_node));
     } else if (with_related_data) {
-      if (strcmp(node_name, "projects") == 0) {
+      if (kJSONKeyProjects == key) {
         LoadUserProjectsFromJSONNode(model, *current_node, full_sync);
-      } else if (strcmp(node_name, "tags") == 0) {
+      } else if (kJSONKeyTags == key) {
         LoadUserTagsFromJSONNode(model, *current_node, full_sync);
-      } else if (strcmp(node_name, "tasks") == 0) {
+      } else if (kJSONKeyTasks == key) {
         LoadUserTasksFromJSONNode(model, *current_node, full_sync);
-      } else if (strcmp(node_name, "time_entries") == 0) {
+      } else if (kJSONKeyTimeEntries == key) {
         LoadUserTimeEntriesFromJSONNode(model, *current_node, full_sync);
-      } else if (strcmp(node_name, "workspaces") == 0) {
+      } else if (kJSONKeyWorkspaces == key) {
         LoadUserWorkspacesFromJSONNode(model, *current_node, full_sync);
-      } else if (strcmp(node_name, "clients") == 0) {
+      } else if (kJSONKeyClients == key) {
         LoadUserClientsFromJSONNode(model, *current_node, full_sync);
       }
     }
@@ -167,15 +885,15 @@ void LoadUserFromJSONNode(
 
 void LoadUserTagsFromJSONNode(
     User *model,
-    JSONNODE * const list,
+    JSONValue * const list,
     const bool full_sync) {
   poco_assert(model);
   poco_assert(list);
 
-  std::set<Poco::UInt64> alive;
+  AliveIDs alive;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
     loadUserTagFromJSONNode(model, *current_node, &alive);
     ++current_node;
@@ -185,21 +903,13 @@ void LoadUserTagsFromJSONNode(
     return;
   }
 
-  for (std::vector<Tag *>::const_iterator it =
-      model->related.Tags.begin();
-      it != model->related.Tags.end();
-      it++) {
-    Tag *model = *it;
-    if (alive.end() == alive.find(model->ID())) {
-      model->MarkAsDeletedOnServer();
-    }
-  }
+  markDeletedOnServer(model->related.Tags, &alive);
 }
 
 void loadUserTagFromJSONNode(
     User *user,
-    JSONNODE * const data,
-    std::set<Poco::UInt64> *alive) {
+    JSONValue * const data,
+    AliveIDs *alive) {
   poco_assert(user);
   poco_assert(data);
   // alive can be 0
@@ -221,25 +931,27 @@ void loadUserTagFromJSONNode(
   if (!model) {
     model = new Tag();
     user->related.Tags.push_back(model);
+    user->related.Track(model);
   }
   if (alive) {
-    alive->insert(id);
+    alive->push_back(id);
   }
   model->SetUID(user->ID());
   model->LoadFromJSONNode(data);
+  user->related.TagIndex.Add(model);
 }
 
 void LoadUserTasksFromJSONNode(
     User *user,
-    JSONNODE * const list,
+    JSONValue * const list,
     const bool full_sync) {
   poco_assert(user);
   poco_assert(list);
 
-  std::set<Poco::UInt64> alive;
+  AliveIDs alive;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
     loadUserTaskFromJSONNode(user, *current_node, &alive);
     ++current_node;
@@ -249,21 +961,13 @@ void LoadUserTasksFromJSONNode(
     return;
   }
 
-  for (std::vector<Task *>::const_iterator it =
-      user->related.Tasks.begin();
-      it != user->related.Tasks.end();
-      it++) {
-    Task *model = *it;
-    if (alive.end() == alive.find(model->ID())) {
-      model->MarkAsDeletedOnServer();
-    }
-  }
+  markDeletedOnServer(user->related.Tasks, &alive);
 }
 
 void loadUserTaskFromJSONNode(
     User *user,
-    JSONNODE * const data,
-    std::set<Poco::UInt64> *alive) {
+    JSONValue * const data,
+    AliveIDs *alive) {
   poco_assert(user);
   poco_assert(data);
   // alive can be 0
@@ -283,57 +987,58 @@ void loadUserTaskFromJSONNode(
   if (!model) {
     model = new Task();
     user->related.Tasks.push_back(model);
+    user->related.Track(model);
   }
 
   if (alive) {
-    alive->insert(id);
+    alive->push_back(id);
   }
   model->SetUID(user->ID());
   model->LoadFromJSONNode(data);
+  user->related.TaskIndex.Add(model);
 }
 
 void LoadUserUpdateFromJSONString(
     User *user,
-    const std::string json) {
+    const std::string &json) {
   poco_assert(user);
   poco_assert(!json.empty());
 
-  JSONNODE *root = json_parse(json.c_str());
+  MetricsTimer timer("json.parse.update");
+
+  JSONValue *root = JSONParse(json);
   LoadUserUpdateFromJSONNode(user, root);
-  json_delete(root);
+  JSONDelete(root);
 }
 
 void LoadUserUpdateFromJSONNode(
     User *user,
-    JSONNODE * const node) {
+    JSONValue * const node) {
   poco_assert(user);
   poco_assert(node);
 
-  JSONNODE *data = 0;
+  JSONValue *data = 0;
   std::string model("");
   std::string action("");
 
-  JSONNODE_ITERATOR i = json_begin(node);
-  JSONNODE_ITERATOR e = json_end(node);
+  JSONIterator i = JSONBegin(node);
+  JSONIterator e = JSONEnd(node);
   while (i != e) {
-    json_char *node_name = json_name(*i);
-    if (strcmp(node_name, "data") == 0) {
+    JSONKey key = JSONNodeKey(*i);
+    if (kJSONKeyData == key) {
       data = *i;
-    } else if (strcmp(node_name, "model") == 0) {
-      model = std::string(json_as_string(*i));
-    } else if (strcmp(node_name, "action") == 0) {
-      action = std::string(json_as_string(*i));
+    } else if (kJSONKeyModel == key) {
+      model = JSONString(*i);
+    } else if (kJSONKeyAction == key) {
+      action = JSONString(*i);
       Poco::toLowerInPlace(action);
     }
     ++i;
   }
   poco_assert(data);
 
-  std::stringstream ss;
-  ss << "Update parsed into action=" << action
-    << ", model=" + model;
-  Poco::Logger &logger = Poco::Logger::get("json");
-  logger.debug(ss.str());
+  KOPSIK_LOG_FIELDS(ComponentLogger(&log_json), PRIO_DEBUG, "Update parsed",
+      LogFields().Add("action", action).Add("model", model));
 
   if ("workspace" == model) {
     loadUserWorkspaceFromJSONNode(user, data);
@@ -352,8 +1057,8 @@ void LoadUserUpdateFromJSONNode(
 
 void loadUserWorkspaceFromJSONNode(
     User *user,
-    JSONNODE * const data,
-    std::set<Poco::UInt64> *alive) {
+    JSONValue * const data,
+    AliveIDs *alive) {
   poco_assert(user);
   poco_assert(data);
   // alive can be 0
@@ -373,38 +1078,42 @@ void loadUserWorkspaceFromJSONNode(
   if (!model) {
     model = new Workspace();
     user->related.Workspaces.push_back(model);
+    user->related.Track(model);
   }
   if (alive) {
-    alive->insert(id);
+    alive->push_back(id);
   }
   model->SetUID(user->ID());
   model->LoadFromJSONNode(data);
+  user->related.WorkspaceIndex.Add(model);
 }
 
 error LoadTagsFromJSONNode(
     TimeEntry *te,
-    JSONNODE * const list) {
+    JSONValue * const list) {
   poco_assert(te);
   poco_assert(list);
 
-  te->TagNames.clear();
+  std::vector<std::string> names;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
-    std::string tag = std::string(json_as_string(*current_node));
+    std::string tag = JSONString(*current_node);
     if (!tag.empty()) {
-      te->TagNames.push_back(tag);
+      names.push_back(tag);
     }
     ++current_node;
   }
+
+  te->SetTagNames(names);
   return noError;
 }
 
 void loadUserClientFromJSONNode(
     User *user,
-    JSONNODE * const data,
-    std::set<Poco::UInt64> *alive) {
+    JSONValue * const data,
+    AliveIDs *alive) {
   poco_assert(user);
   poco_assert(data);
   // alive can be 0
@@ -426,24 +1135,42 @@ void loadUserClientFromJSONNode(
   if (!model) {
     model = new Client();
     user->related.Clients.push_back(model);
+    user->related.Track(model);
   }
   if (alive) {
-    alive->insert(id);
+    alive->push_back(id);
   }
   model->SetUID(user->ID());
   model->LoadFromJSONNode(data);
+  user->related.ClientIndex.Add(model);
 }
 
 Poco::UInt64 GetUIModifiedAtFromJSONNode(
-    JSONNODE * const data) {
+    JSONValue * const data) {
   poco_assert(data);
 
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
+  JSONIterator current_node = JSONBegin(data);
+  JSONIterator last_node = JSONEnd(data);
   while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "ui_modified_at") == 0) {
-      return json_as_int(*current_node);
+    JSONKey key = JSONNodeKey(*current_node);
+    if (kJSONKeyUIModifiedAt == key) {
+      return JSONInt(*current_node);
+    }
+    ++current_node;
+  }
+  return 0;
+}
+
+Poco::UInt64 GetUpdatedAtFromJSONNode(
+    JSONValue * const data) {
+  poco_assert(data);
+
+  JSONIterator current_node = JSONBegin(data);
+  JSONIterator last_node = JSONEnd(data);
+  while (current_node != last_node) {
+    JSONKey key = JSONNodeKey(*current_node);
+    if (kJSONKeyAt == key) {
+      return Formatter::Parse8601(JSONString(*current_node));
     }
     ++current_node;
   }
@@ -452,15 +1179,15 @@ Poco::UInt64 GetUIModifiedAtFromJSONNode(
 
 void LoadUserClientsFromJSONNode(
     User *user,
-    JSONNODE * const list,
+    JSONValue * const list,
     const bool full_sync) {
   poco_assert(user);
   poco_assert(list);
 
-  std::set<Poco::UInt64> alive;
+  AliveIDs alive;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
     loadUserClientFromJSONNode(user, *current_node, &alive);
     ++current_node;
@@ -470,21 +1197,13 @@ void LoadUserClientsFromJSONNode(
     return;
   }
 
-  for (std::vector<Client *>::const_iterator it =
-      user->related.Clients.begin();
-      it != user->related.Clients.end();
-      it++) {
-    Client *model = *it;
-    if (alive.end() == alive.find(model->ID())) {
-      model->MarkAsDeletedOnServer();
-    }
-  }
+  markDeletedOnServer(user->related.Clients, &alive);
 }
 
 void loadUserProjectFromJSONNode(
     User *user,
-    JSONNODE * const data,
-    std::set<Poco::UInt64> *alive) {
+    JSONValue * const data,
+    AliveIDs *alive) {
   poco_assert(user);
   poco_assert(data);
   // alive can be 0
@@ -506,25 +1225,27 @@ void loadUserProjectFromJSONNode(
   if (!model) {
     model = new Project();
     user->related.Projects.push_back(model);
+    user->related.Track(model);
   }
   if (alive) {
-    alive->insert(id);
+    alive->push_back(id);
   }
   model->SetUID(user->ID());
   model->LoadFromJSONNode(data);
+  user->related.ProjectIndex.Add(model);
 }
 
 void LoadUserProjectsFromJSONNode(
     User *user,
-    JSONNODE * const list,
+    JSONValue * const list,
     const bool full_sync) {
   poco_assert(user);
   poco_assert(list);
 
-  std::set<Poco::UInt64> alive;
+  AliveIDs alive;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
     loadUserProjectFromJSONNode(user, *current_node, &alive);
     ++current_node;
@@ -534,41 +1255,35 @@ void LoadUserProjectsFromJSONNode(
     return;
   }
 
-  for (std::vector<Project *>::const_iterator it =
-      user->related.Projects.begin();
-      it != user->related.Projects.end();
-      it++) {
-    Project *model = *it;
-    if (alive.end() == alive.find(model->ID())) {
-        model->MarkAsDeletedOnServer();
-    }
-  }
+  markDeletedOnServer(user->related.Projects, &alive);
 }
 
 error LoadTimeEntryTagsFromJSONNode(
     TimeEntry *te,
-    JSONNODE * const list) {
+    JSONValue * const list) {
   poco_assert(te);
   poco_assert(list);
 
-  te->TagNames.clear();
+  std::vector<std::string> names;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
-    std::string tag = std::string(json_as_string(*current_node));
+    std::string tag = JSONString(*current_node);
     if (!tag.empty()) {
-      te->TagNames.push_back(tag);
+      names.push_back(tag);
     }
     ++current_node;
   }
+
+  te->SetTagNames(names);
   return noError;
 }
 
 void loadUserTimeEntryFromJSONNode(
     User *user,
-    JSONNODE * const data,
-    std::set<Poco::UInt64> *alive) {
+    JSONValue * const data,
+    AliveIDs *alive) {
   poco_assert(user);
   poco_assert(data);
   // alive can be 0
@@ -590,25 +1305,27 @@ void loadUserTimeEntryFromJSONNode(
   if (!model) {
     model = new TimeEntry();
     user->related.TimeEntries.push_back(model);
+    user->related.Track(model);
   }
   if (alive) {
-    alive->insert(id);
+    alive->push_back(id);
   }
   model->SetUID(user->ID());
   LoadTimeEntryFromJSONNode(model, data);
+  user->related.TimeEntryIndex.Add(model);
 }
 
 void LoadUserWorkspacesFromJSONNode(
     User *user,
-    JSONNODE * const list,
+    JSONValue * const list,
     const bool full_sync) {
   poco_assert(user);
   poco_assert(list);
 
-  std::set<Poco::UInt64> alive;
+  AliveIDs alive;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
     loadUserWorkspaceFromJSONNode(user, *current_node, &alive);
     ++current_node;
@@ -618,28 +1335,20 @@ void LoadUserWorkspacesFromJSONNode(
     return;
   }
 
-  for (std::vector<Workspace *>::const_iterator it =
-      user->related.Workspaces.begin();
-      it != user->related.Workspaces.end();
-      it++) {
-    Workspace *model = *it;
-    if (alive.end() == alive.find(model->ID())) {
-      model->MarkAsDeletedOnServer();
-    }
-  }
+  markDeletedOnServer(user->related.Workspaces, &alive);
 }
 
 void LoadUserTimeEntriesFromJSONNode(
     User *user,
-    JSONNODE * const list,
+    JSONValue * const list,
     const bool full_sync) {
   poco_assert(user);
   poco_assert(list);
 
-  std::set<Poco::UInt64> alive;
+  AliveIDs alive;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
     loadUserTimeEntryFromJSONNode(user, *current_node, &alive);
     ++current_node;
@@ -649,62 +1358,51 @@ void LoadUserTimeEntriesFromJSONNode(
     return;
   }
 
-  for (std::vector<TimeEntry *>::const_iterator it =
-     user->related.TimeEntries.begin();
-     it != user->related.TimeEntries.end();
-     it++) {
-    TimeEntry *model = *it;
-    if (alive.end() == alive.find(model->ID())) {
-      model->MarkAsDeletedOnServer();
-    }
-  }
+  markDeletedOnServer(user->related.TimeEntries, &alive);
 }
 
-JSONNODE *modelUpdateJSON(
+// Writes the batch update of the model up to its body,
+// the caller writes the model and ends the update.
+static void beginModelUpdate(
     BaseModel * const model,
-    JSONNODE * const n) {
+    JSONWriter *writer) {
   poco_assert(model);
-  poco_assert(n);
-
-  json_set_name(n, model->ModelName().c_str());
-
-  JSONNODE *body = json_new(JSON_NODE);
-  json_set_name(body, "body");
-  json_push_back(body, n);
+  poco_assert(writer);
 
-  Poco::Logger &logger = Poco::Logger::get("json");
+  Poco::Logger &logger = ComponentLogger(&log_json);
 
-  JSONNODE *update = json_new(JSON_NODE);
+  writer->BeginObject();
   if (model->NeedsDELETE()) {
     std::stringstream url;
     url << model->ModelURL() << "/" << model->ID();
-    json_push_back(update, json_new_a("method", "DELETE"));
-    json_push_back(update, json_new_a("relative_url", url.str().c_str()));
-    std::stringstream ss;
-    ss << model->ModelName() << " " << model->String() << " needs a DELETE";
-    logger.debug(ss.str());
+    writer->String("method", "DELETE");
+    writer->String("relative_url", url.str());
+    KOPSIK_LOG_DEBUG(logger, model->ModelName() << " " << model->String()
+        << " needs a DELETE");
 
   } else if (model->NeedsPOST()) {
-    json_push_back(update, json_new_a("method", "POST"));
-    json_push_back(update, json_new_a("relative_url",
-      model->ModelURL().c_str()));
-    std::stringstream ss;
-    ss << model->ModelName() << " " << model->String() << " needs a POST";
-    logger.debug(ss.str());
+    writer->String("method", "POST");
+    writer->String("relative_url", model->ModelURL());
+    KOPSIK_LOG_DEBUG(logger, model->ModelName() << " " << model->String()
+        << " needs a POST");
 
   } else if (model->NeedsPUT()) {
     std::stringstream url;
     url << model->ModelURL() << "/" << model->ID();
-    json_push_back(update, json_new_a("method", "PUT"));
-    json_push_back(update, json_new_a("relative_url", url.str().c_str()));
-    std::stringstream ss;
-    ss << model->ModelName() << " " << model->String() << " needs a PUT";
-    logger.debug(ss.str());
-  }
-  json_push_back(update, json_new_a("GUID", model->GUID().c_str()));
-  json_push_back(update, body);
+    writer->String("method", "PUT");
+    writer->String("relative_url", url.str());
+    KOPSIK_LOG_DEBUG(logger, model->ModelName() << " " << model->String()
+        << " needs a PUT");
+  }
+  writer->String("GUID", model->GUID());
+  writer->Key("body");
+  writer->BeginObject();
+  writer->Key(model->ModelName());
+}
 
-  return update;
+static void endModelUpdate(JSONWriter *writer) {
+  writer->EndObject();
+  writer->EndObject();
 }
 
 std::string UpdateJSON(
@@ -713,15 +1411,18 @@ std::string UpdateJSON(
   poco_assert(projects);
   poco_assert(time_entries);
 
-  JSONNODE *c = json_new(JSON_ARRAY);
+  JSONWriter writer;
+  writer.Reserve((projects->size() + time_entries->size()) * 512);
+  writer.BeginArray();
 
   // First, projects, because time entries depend on projects
   for (std::vector<Project *>::const_iterator it =
       projects->begin();
       it != projects->end(); it++) {
     Project *model = *it;
-    JSONNODE *update = modelUpdateJSON(model, ProjectToJSON(model));
-    json_push_back(c, update);
+    beginModelUpdate(model, &writer);
+    ProjectToJSON(model, &writer);
+    endModelUpdate(&writer);
   }
 
   // Time entries go last
@@ -729,37 +1430,37 @@ std::string UpdateJSON(
       time_entries->begin();
       it != time_entries->end(); it++) {
     TimeEntry *te = *it;
-    JSONNODE *update = modelUpdateJSON(te, TimeEntryToJSON(te));
-    json_push_back(c, update);
+    beginModelUpdate(te, &writer);
+    TimeEntryToJSON(te, &writer);
+    endModelUpdate(&writer);
   }
 
-  json_char *jc = json_write_formatted(c);
-  std::string json(jc);
-  json_free(jc);
-  json_delete(c);
-  return json;
+  writer.EndArray();
+  return writer.Buffer();
 }
 
-// Iterate through response array, parse response bodies.
-// Collect errors into a vector.
+// Iterate through response array, load models from the parsed
+// response bodies. Collect errors into a vector.
 void ProcessResponseArray(
     std::vector<BatchUpdateResult> * const results,
-    std::map<std::string, BaseModel *> *models,
+    ModelsByGUID *models,
     std::vector<error> *errors) {
   poco_assert(results);
   poco_assert(models);
   poco_assert(errors);
 
-  Poco::Logger &logger = Poco::Logger::get("json");
-  for (std::vector<BatchUpdateResult>::const_iterator it = results->begin();
+  Poco::Logger &logger = ComponentLogger(&log_json);
+  for (std::vector<BatchUpdateResult>::iterator it = results->begin();
       it != results->end();
       it++) {
-    BatchUpdateResult result = *it;
+    const BatchUpdateResult &result = *it;
 
-    logger.debug(result.String());
+    if (logger.debug()) {
+      logger.debug(result.String());
+    }
 
     poco_assert(!result.GUID.empty());
-    BaseModel *model = (*models)[result.GUID];
+    BaseModel *model = (*models)[BinaryGUID::Of(result.GUID)];
     poco_assert(model);
 
     if (result.ResourceIsGone()) {
@@ -778,163 +1479,256 @@ void ProcessResponseArray(
       continue;
     }
 
-    poco_assert(json_is_valid(result.Body.c_str()));
-    model->LoadFromDataString(result.Body);
+    if (result.Data) {
+      model->LoadFromJSONNode(result.Data);
+      JSONDelete(it->Data);
+      it->Data = 0;
+    }
   }
 }
 
 void ParseResponseArray(
-    const std::string response_body,
+    const std::string &response_body,
     std::vector<BatchUpdateResult> *responses) {
   poco_assert(responses);
-  poco_assert(responses);
 
   // There seem to be cases where response body is 0.
   // Must investigate further.
-  if (!response_body.empty()) {
-    Poco::Logger &logger = Poco::Logger::get("json");
+  if (response_body.empty()) {
+    Poco::Logger &logger = ComponentLogger(&log_json);
     logger.warning("Response is empty!");
     return;
   }
 
-  JSONNODE *response_array = json_parse(response_body.c_str());
-  JSONNODE_ITERATOR i = json_begin(response_array);
-  JSONNODE_ITERATOR e = json_end(response_array);
+  MetricsTimer timer("json.parse.batch_response");
+
+  JSONValue *response_array = JSONParse(response_body);
+  if (!response_array) {
+    Poco::Logger &logger = ComponentLogger(&log_json);
+    logger.error("Invalid batch update response");
+    return;
+  }
+  responses->reserve(JSONSize(response_array));
+  JSONIterator i = JSONBegin(response_array);
+  JSONIterator e = JSONEnd(response_array);
   while (i != e) {
-    BatchUpdateResult result;
-    ParseBatchUpdateResultJSON(&result, *i);
-    responses->push_back(result);
+    responses->push_back(BatchUpdateResult());
+    ParseBatchUpdateResultJSON(&responses->back(), *i);
     ++i;
   }
-  json_delete(response_array);
+  JSONDelete(response_array);
 }
 
-JSONNODE *TimeEntryToJSON(TimeEntry * const te) {
+void TimeEntryToJSON(TimeEntry * const te, JSONWriter *writer) {
   poco_assert(te);
+  poco_assert(writer);
 
-  JSONNODE *n = json_new(JSON_NODE);
-  json_set_name(n, te->ModelName().c_str());
+  writer->BeginObject();
   if (te->ID()) {
-    json_push_back(n, json_new_i("id", (json_int_t)te->ID()));
+    writer->Int("id", te->ID());
   }
-  json_push_back(n, json_new_a("description",
-    Formatter::EscapeJSONString(te->Description()).c_str()));
-  json_push_back(n, json_new_i("wid", (json_int_t)te->WID()));
-  json_push_back(n, json_new_a("guid", te->GUID().c_str()));
+  writer->String("description", te->Description());
+  writer->Int("wid", te->WID());
+  writer->String("guid", te->GUID());
   if (!te->PID() && !te->ProjectGUID().empty()) {
-    json_push_back(n, json_new_a("pid", te->ProjectGUID().c_str()));
+    writer->String("pid", te->ProjectGUID());
   } else {
-    json_push_back(n, json_new_i("pid", (json_int_t)te->PID()));
+    writer->Int("pid", te->PID());
   }
-  json_push_back(n, json_new_i("tid", (json_int_t)te->TID()));
-  json_push_back(n, json_new_a("start", te->StartString().c_str()));
+  writer->Int("tid", te->TID());
+  writer->String("start", te->StartString());
   if (te->Stop()) {
-    json_push_back(n, json_new_a("stop", te->StopString().c_str()));
-  }
-  json_push_back(n, json_new_i("duration",
-    (json_int_t)te->DurationInSeconds()));
-  json_push_back(n, json_new_b("billable", te->Billable()));
-  json_push_back(n, json_new_b("duronly", te->DurOnly()));
-  json_push_back(n, json_new_i("ui_modified_at",
-      (json_int_t)te->UIModifiedAt()));
-  json_push_back(n, json_new_a("created_with",
-      Formatter::EscapeJSONString(te->CreatedWith()).c_str()));
-
-  JSONNODE *tag_nodes = json_new(JSON_ARRAY);
-  json_set_name(tag_nodes, "tags");
-  for (std::vector<std::string>::const_iterator it = te->TagNames.begin();
-          it != te->TagNames.end();
+    writer->String("stop", te->StopString());
+  }
+  writer->Int("duration", te->DurationInSeconds());
+  writer->Bool("billable", te->Billable());
+  writer->Bool("duronly", te->DurOnly());
+  writer->Int("ui_modified_at", te->UIModifiedAt());
+  writer->String("created_with", te->CreatedWith());
+
+  writer->Key("tags");
+  writer->BeginArray();
+  TagNameTable &tag_names = TagNameTable::Shared();
+  for (std::vector<TagID>::const_iterator it = te->TagIDs().begin();
+          it != te->TagIDs().end();
           it++) {
-      std::string tag_name = *it;
-      json_push_back(tag_nodes, json_new_a(NULL,
-          Formatter::EscapeJSONString(tag_name).c_str()));
+      writer->String(tag_names.Name(*it));
   }
-  json_push_back(n, tag_nodes);
+  writer->EndArray();
+  writer->EndObject();
+}
 
-  return n;
+std::string TimeEntryToJournalJSON(
+    TimeEntry * const te,
+    const Poco::UInt64 UID) {
+  poco_assert(te);
+
+  JSONWriter writer;
+  writer.BeginObject();
+  writer.Int("uid", UID);
+  writer.Int("local_id", te->LocalID());
+  writer.Int("id", te->ID());
+  writer.String("guid", te->GUID());
+  writer.String("description", te->Description());
+  writer.Int("wid", te->WID());
+  writer.Int("pid", te->PID());
+  writer.String("project_guid", te->ProjectGUID());
+  writer.Int("tid", te->TID());
+  writer.Int("start", te->Start());
+  writer.Int("stop", te->Stop());
+  writer.Int("duration", te->DurationInSeconds());
+  writer.Bool("billable", te->Billable());
+  writer.Bool("duronly", te->DurOnly());
+  writer.String("tags", te->Tags());
+  writer.String("created_with", te->CreatedWith());
+  writer.Int("ui_modified_at", te->UIModifiedAt());
+  writer.Int("updated_at", te->UpdatedAt());
+  writer.Int("deleted_at", te->DeletedAt());
+  writer.EndObject();
+  return writer.Buffer();
+}
+
+bool LoadUserTimeEntryFromJournalJSON(
+    User *user,
+    const std::string &json) {
+  poco_assert(user);
+
+  JSONValue *root = JSONParse(json);
+  if (!root) {
+    return false;
+  }
+  if (static_cast<Poco::UInt64>(JSONInt(JSONGet(root, "uid")))
+      != user->ID()) {
+    JSONDelete(root);
+    return false;
+  }
+
+  TimeEntry *te = user->GetTimeEntryByGUID(
+    JSONString(JSONGet(root, "guid")));
+  bool added = !te;
+  if (added) {
+    // Older than what's loaded, or never saved
+    te = new TimeEntry();
+    te->SetLocalID(JSONInt(JSONGet(root, "local_id")));
+    te->SetUID(user->ID());
+    user->related.TimeEntries.push_back(te);
+    user->related.Track(te);
+  }
+  te->SetID(JSONInt(JSONGet(root, "id")));
+  te->SetGUID(JSONString(JSONGet(root, "guid")));
+  te->SetDescription(JSONString(JSONGet(root, "description")));
+  te->SetWID(JSONInt(JSONGet(root, "wid")));
+  te->SetPID(JSONInt(JSONGet(root, "pid")));
+  te->SetProjectGUID(JSONString(JSONGet(root, "project_guid")));
+  te->SetTID(JSONInt(JSONGet(root, "tid")));
+  te->SetStart(JSONInt(JSONGet(root, "start")));
+  te->SetStop(JSONInt(JSONGet(root, "stop")));
+  te->SetDurationInSeconds(JSONInt(JSONGet(root, "duration")));
+  te->SetBillable(JSONBool(JSONGet(root, "billable")));
+  te->SetDurOnly(JSONBool(JSONGet(root, "duronly")));
+  te->SetTags(JSONString(JSONGet(root, "tags")));
+  te->SetCreatedWith(JSONString(JSONGet(root, "created_with")));
+  te->SetUIModifiedAt(JSONInt(JSONGet(root, "ui_modified_at")));
+  te->SetUpdatedAt(JSONInt(JSONGet(root, "updated_at")));
+  te->SetDeletedAt(JSONInt(JSONGet(root, "deleted_at")));
+  // The row of one that wasn't loaded is updated whole, including
+  // the columns that happen to match the defaults of a new model
+  if (added && te->LocalID()) {
+    te->SetDirty();
+  }
+  JSONDelete(root);
+  return true;
 }
 
 void LoadTimeEntryFromJSONString(
     TimeEntry *model,
-    const std::string json) {
+    const std::string &json) {
   poco_assert(model);
   poco_assert(!json.empty());
 
-  JSONNODE *root = json_parse(json.c_str());
+  JSONValue *root = JSONParse(json);
   LoadTimeEntryFromJSONNode(model, root);
-  json_delete(root);
+  JSONDelete(root);
 }
 
-JSONNODE *ProjectToJSON(Project * const model) {
-  poco_assert(model);
+void LoadUserRunningTimeEntryFromJSONString(
+    User *user,
+    const std::string &json) {
+  poco_assert(user);
 
-  JSONNODE *n = json_new(JSON_NODE);
-  json_set_name(n, model->ModelName().c_str());
-  if (model->ID()) {
-    json_push_back(n, json_new_i("id", (json_int_t)model->ID()));
+  JSONValue *root = JSONParse(json);
+  if (!root) {
+    return;
+  }
+  JSONValue *data = JSONGet(root, "data");
+  if (data && kJSONObject == JSONTypeOf(data)) {
+    loadUserTimeEntryFromJSONNode(user, data);
   }
-  json_push_back(n, json_new_a("name",
-    Formatter::EscapeJSONString(model->Name()).c_str()));
-  json_push_back(n, json_new_i("wid", (json_int_t)model->WID()));
-  json_push_back(n, json_new_a("guid", model->GUID().c_str()));
-  json_push_back(n, json_new_i("cid", (json_int_t)model->CID()));
-  json_push_back(n, json_new_b("billable", model->Billable()));
-  json_push_back(n, json_new_i("ui_modified_at",
-      (json_int_t)model->UIModifiedAt()));
+  JSONDelete(root);
+}
 
-  return n;
+void ProjectToJSON(Project * const model, JSONWriter *writer) {
+  poco_assert(model);
+  poco_assert(writer);
+
+  ModelToJSON(*model, writer);
 }
 
 void LoadTimeEntryFromJSONNode(
     TimeEntry *model,
-    JSONNODE * const data) {
+    JSONValue * const data) {
   poco_assert(model);
   poco_assert(data);
 
+  // Unchanged on the server since it was last loaded, and without
+  // changes of our own, so there's nothing to decode
+  if (model->UpdatedAt() && !model->UIModifiedAt()
+      && model->UpdatedAt() == GetUpdatedAtFromJSONNode(data)) {
+      return;
+  }
+
   Poco::UInt64 ui_modified_at =
       GetUIModifiedAtFromJSONNode(data);
   if (model->UIModifiedAt() > ui_modified_at) {
-      Poco::Logger &logger = Poco::Logger::get("json");
-      std::stringstream ss;
-      ss  << "Will not overwrite time entry "
+      Poco::Logger &logger = ComponentLogger(&log_json);
+      KOPSIK_LOG_DEBUG(logger, "Will not overwrite time entry "
           << model->String()
-          << " with server data because we have a ui_modified_at";
-      logger.debug(ss.str());
+          << " with server data because we have a ui_modified_at");
       return;
   }
 
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
+  JSONIterator current_node = JSONBegin(data);
+  JSONIterator last_node = JSONEnd(data);
   while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "id") == 0) {
-      model->SetID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "description") == 0) {
-      model->SetDescription(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "guid") == 0) {
-      model->SetGUID(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "wid") == 0) {
-      model->SetWID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "pid") == 0) {
-      model->SetPID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "tid") == 0) {
-      model->SetTID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "start") == 0) {
-      model->SetStartString(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "stop") == 0) {
-      model->SetStopString(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "duration") == 0) {
-      model->SetDurationInSeconds(json_as_int(*current_node));
-    } else if (strcmp(node_name, "billable") == 0) {
-      model->SetBillable(json_as_bool(*current_node));
-    } else if (strcmp(node_name, "duronly") == 0) {
-      model->SetDurOnly(json_as_bool(*current_node));
-    } else if (strcmp(node_name, "tags") == 0) {
+    JSONKey key = JSONNodeKey(*current_node);
+    if (kJSONKeyID == key) {
+      model->SetID(JSONInt(*current_node));
+    } else if (kJSONKeyDescription == key) {
+      model->SetDescription(JSONString(*current_node));
+    } else if (kJSONKeyGUID == key) {
+      model->SetGUID(JSONString(*current_node));
+    } else if (kJSONKeyWID == key) {
+      model->SetWID(JSONInt(*current_node));
+    } else if (kJSONKeyPID == key) {
+      model->SetPID(JSONInt(*current_node));
+    } else if (kJSONKeyTID == key) {
+      model->SetTID(JSONInt(*current_node));
+    } else if (kJSONKeyStart == key) {
+      model->SetStartString(JSONString(*current_node));
+    } else if (kJSONKeyStop == key) {
+      model->SetStopString(JSONString(*current_node));
+    } else if (kJSONKeyDuration == key) {
+      model->SetDurationInSeconds(JSONInt(*current_node));
+    } else if (kJSONKeyBillable == key) {
+      model->SetBillable(JSONBool(*current_node));
+    } else if (kJSONKeyDuronly == key) {
+      model->SetDurOnly(JSONBool(*current_node));
+    } else if (kJSONKeyTags == key) {
       LoadTimeEntryTagsFromJSONNode(model, *current_node);
-    } else if (strcmp(node_name, "created_with") == 0) {
-      model->SetCreatedWith(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "at") == 0) {
-      model->SetUpdatedAtString(std::string(json_as_string(*current_node)));
+    } else if (kJSONKeyCreatedWith == key) {
+      model->SetCreatedWith(JSONString(*current_node));
+    } else if (kJSONKeyAt == key) {
+      model->SetUpdatedAtString(JSONString(*current_node));
     }
     ++current_node;
   }
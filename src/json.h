@@ -5,11 +5,11 @@
 #define SRC_JSON_H_
 
 #include <string>
-#include <set>
 #include <vector>
 #include <map>
+#include <set>
 
-#include "libjson.h" // NOLINT
+#include "./json_reader.h"
 
 #include "./user.h"
 #include "./workspace.h"
@@ -19,20 +19,193 @@
 #include "./time_entry.h"
 #include "./tag.h"
 #include "./batch_update_result.h"
+#include "./https_client.h"
+#include "./json_writer.h"
+#include "./model_schema.h"
+
+#include "Poco/Timestamp.h"
 
 namespace kopsik {
 
+  // IDs of the models in a full sync response, in the order they
+  // came. Sorted once to find the models deleted on the server.
+  typedef std::vector<Poco::UInt64> AliveIDs;
+
+  // Parses a batch_updates response, including the bodies of the
+  // successful updates. Their data nodes are freed once processed.
   void ParseResponseArray(
-    const std::string response_body,
+    const std::string &response_body,
     std::vector<BatchUpdateResult> *responses);
   void ProcessResponseArray(
     std::vector<BatchUpdateResult> * const results,
-    std::map<std::string, BaseModel *> *models,
+    ModelsByGUID *models,
     std::vector<error> *errors);
 
+  // Parses a /me response while it is still being received, without
+  // touching any user, so it needs no lock. Related models are kept
+  // as text until Finish parses each into a small tree of its own.
+  // Apply then loads them into a user, which is the only part that
+  // needs the exclusive lock.
+  // So the lock is held for as long as the changes take to apply,
+  // not for as long as the response takes to download and parse.
+  class UserJSONStreamLoader : public ResponseHandler {
+  public:
+    UserJSONStreamLoader(
+      const bool full_sync,
+      const bool with_related_data);
+    virtual ~UserJSONStreamLoader();
+
+    // Drops what was parsed, to load another response
+    void Reset(const bool full_sync);
+
+    // Threads Finish parses a big response on,
+    // by default one per core
+    void SetDecodeThreads(const std::size_t count) {
+      decode_threads_ = count;
+    }
+
+    bool FullSync() const { return full_sync_; }
+    bool WithRelatedData() const { return with_related_data_; }
+
+    void Consume(const char *data, const std::size_t size);
+
+    // Call once the whole response has been consumed. Parses the
+    // related models, on a thread per core for a big response, and
+    // checks the response was complete.
+    error Finish();
+
+    // Loads the parsed user fields into user, then the related
+    // models, list by list, so each finds the ones it refers to.
+    // The since value and full sync deletions are only applied
+    // when the response was complete.
+    void Apply(User *user);
+
+    // Time entries and projects, by GUID, pushed while the response
+    // was being fetched. What the push brought back can be newer than
+    // what was pulled, so Apply doesn't mark them deleted for missing
+    // from a full sync, and only loads a pulled time entry over one
+    // of them when the server has updated it (by at) since. Pulled
+    // projects don't say when they were updated, so they're kept.
+    void SetPushedMeanwhile(const std::set<std::string> &guids) {
+      pushed_meanwhile_ = guids;
+    }
+
+    // Parsed, not applied yet
+    std::size_t StagedCount() const { return staged_.size(); }
+
+  private:
+    void consume(const char c);
+    void readValue(const char c);
+    void beginValue(const char c);
+    void endValue();
+    void decodeRelatedModels();
+    void stage(const std::string &list, JSONValue *node);
+    void loadRelatedModel(
+      User *user,
+      const std::string &list,
+      JSONValue *node);
+    bool keepPushed(
+      User *user,
+      const std::string &list,
+      JSONValue *node) const;
+    void markListDeletedOnServer(User *user, const std::string list);
+    void clearStaged();
+    bool complete() const;
+
+    bool full_sync_;
+    bool with_related_data_;
+    std::size_t decode_threads_;
+    error error_;
+
+    // Related models as received, by list in the order they are
+    // applied: workspaces, clients, projects, tasks, tags and
+    // time entries
+    std::vector<std::string> related_json_[6];
+
+    // User fields (with an empty list name) and related models,
+    // parsed into trees of their own
+    typedef struct {
+      std::string list;
+      JSONValue *node;
+    } StagedNode;
+    std::vector<StagedNode> staged_;
+
+    // Objects and arrays the loader has descended into:
+    // the root object, its "data" object, and a related data list.
+    std::string containers_;
+    bool root_seen_;
+    bool in_data_;
+    bool in_list_;
+    bool expect_key_;
+    std::string root_key_;
+    std::string data_key_;
+
+    bool in_string_;
+    bool escaped_;
+
+    // Any other value is read (and kept, if needed) as a whole
+    bool reading_value_;
+    bool keep_value_;
+    char value_type_;
+    int value_nesting_;
+    std::string::size_type value_depth_;
+    std::string value_;
+
+    bool has_since_;
+    Poco::UInt64 since_;
+    std::map<std::string, AliveIDs> alive_;
+    std::set<std::string> pushed_meanwhile_;
+
+    // Time spent in Consume, without the time waiting for data
+    Poco::Timestamp::TimeDiff parse_micros_;
+
+    UserJSONStreamLoader(const UserJSONStreamLoader &);
+    UserJSONStreamLoader &operator=(const UserJSONStreamLoader &);
+  };
+
+  // Loads the pieces of a fetch made list by list into a user as
+  // they arrive: the user record (list "") and the related data
+  // lists, each a bare array, an array under "data", or null.
+  // Remembers what was loaded, so that once every piece is in,
+  // Complete can mark the models of those lists the server no
+  // longer has.
+  class UserListLoader {
+  public:
+    UserListLoader()
+      : time_entries_since_(0)
+      , time_entries_until_(0) {}
+
+    // Time entries were only fetched for the ones started in between,
+    // so the others aren't missing from the server. By default all
+    // of them were fetched.
+    void SetTimeEntryWindow(
+        const Poco::UInt64 since,
+        const Poco::UInt64 until) {
+      time_entries_since_ = since;
+      time_entries_until_ = until;
+    }
+
+    error Load(User *user, const std::string &list, const std::string &json);
+    // The lists of the workspace, or the time entries started from
+    // since to until, were loaded by an earlier fetch and aren't
+    // fetched again, so their models count as still on the server
+    void KeepWorkspace(User *user, const Poco::UInt64 wid);
+    void KeepTimeEntries(
+      User *user,
+      const Poco::UInt64 since,
+      const Poco::UInt64 until);
+    // since is left as it is when 0
+    void Complete(User *user, const Poco::UInt64 since);
+
+  private:
+    std::map<std::string, AliveIDs> alive_;
+    Poco::UInt64 time_entries_since_;
+    Poco::UInt64 time_entries_until_;
+  };
+
   void LoadUserFromJSONNode(
     User *model,
-    JSONNODE *node,
+    JSONValue *node,
     const bool full_sync,
     const bool with_related_data);
   void LoadUserFromJSONString(
@@ -42,59 +215,59 @@ namespace kopsik {
     const bool with_related_data);
   void LoadUserProjectsFromJSONNode(
     User *model,
-    JSONNODE *list,
+    JSONValue *list,
     const bool full_sync);
   void LoadUserTagsFromJSONNode(
     User *user,
-    JSONNODE *list,
+    JSONValue *list,
     const bool full_sync);
   void LoadUserClientsFromJSONNode(
     User *user,
-    JSONNODE *list,
+    JSONValue *list,
     const bool full_sync);
   void LoadUserTasksFromJSONNode(
     User *user,
-    JSONNODE *list,
+    JSONValue *list,
     const bool full_sync);
   void LoadUserTimeEntriesFromJSONNode(
     User *user,
-    JSONNODE *list,
+    JSONValue *list,
     const bool full_sync);
   void LoadUserWorkspacesFromJSONNode(
     User *user,
-    JSONNODE *list,
+    JSONValue *list,
     const bool full_sync);
   void LoadUserUpdateFromJSONNode(
     User *user,
-    JSONNODE *data);
+    JSONValue *data);
   void LoadUserUpdateFromJSONString(
     User *user,
-    const std::string json);
+    const std::string &json);
 
   void loadUserProjectFromJSONNode(
     User *model,
-    JSONNODE *data,
-    std::set<Poco::UInt64> *alive = 0);
+    JSONValue *data,
+    AliveIDs *alive = 0);
   void loadUserWorkspaceFromJSONNode(
     User *user,
-    JSONNODE *data,
-    std::set<Poco::UInt64> *alive = 0);
+    JSONValue *data,
+    AliveIDs *alive = 0);
   void loadUserTagFromJSONNode(
     User *user,
-    JSONNODE *data,
-    std::set<Poco::UInt64> *alive = 0);
+    JSONValue *data,
+    AliveIDs *alive = 0);
   void loadUserClientFromJSONNode(
     User *user,
-    JSONNODE *data,
-    std::set<Poco::UInt64> *alive = 0);
+    JSONValue *data,
+    AliveIDs *alive = 0);
   void loadUserTaskFromJSONNode(
     User *user,
-    JSONNODE *data,
-    std::set<Poco::UInt64> *alive = 0);
+    JSONValue *data,
+    AliveIDs *alive = 0);
   void loadUserTimeEntryFromJSONNode(
     User *user,
-    JSONNODE *data,
-    std::set<Poco::UInt64> *alive = 0);
+    JSONValue *data,
+    AliveIDs *alive = 0);
 
   void loadTimeEntryFromDataString(
     TimeEntry *model,
@@ -102,13 +275,62 @@ namespace kopsik {
 
   void LoadTimeEntryFromJSONNode(
     TimeEntry *model,
-    JSONNODE * const);
+    JSONValue * const);
   void LoadTimeEntryFromJSONString(
     TimeEntry *model,
-    const std::string json);
+    const std::string &json);
+
+  // Response of /api/v8/time_entries/current, {"data":null} when
+  // nothing is running
+  void LoadUserRunningTimeEntryFromJSONString(
+    User *user,
+    const std::string &json);
+
+  void TimeEntryToJSON(TimeEntry * const, JSONWriter *writer);
+
+  // A time entry of the user as the change journal keeps it, with
+  // what's local to it, see ChangeJournal
+  std::string TimeEntryToJournalJSON(
+    TimeEntry * const,
+    const Poco::UInt64 UID);
+  // Applies a record of TimeEntryToJournalJSON to the time entry of
+  // the user, which is added if it's not loaded. Records of other
+  // users are skipped, false tells.
+  bool LoadUserTimeEntryFromJournalJSON(
+    User *user,
+    const std::string &json);
+  void ProjectToJSON(Project * const, JSONWriter *writer);
+
+  // The pushed fields of a model, as its ModelSchema lists them
+  template <class M>
+  void ModelToJSON(const M &model, JSONWriter *writer) {
+    poco_assert(writer);
 
-  JSONNODE *TimeEntryToJSON(TimeEntry * const);
-  JSONNODE *ProjectToJSON(Project * const);
+    const std::vector<ModelField<M> > &fields = M::Schema().Fields();
+    writer->BeginObject();
+    for (typename std::vector<ModelField<M> >::const_iterator it =
+        fields.begin();
+        it != fields.end();
+        it++) {
+      const ModelField<M> &field = *it;
+      if (!field.Is(kFieldPushed)
+          || (field.Is(kFieldOptional) && field.Empty(model))) {
+        continue;
+      }
+      switch (field.type) {
+      case kModelFieldUInt:
+        writer->Int(field.name, (model.*field.get_uint)());
+        break;
+      case kModelFieldString:
+        writer->String(field.name, (model.*field.get_string)());
+        break;
+      case kModelFieldBool:
+        writer->Bool(field.name, (model.*field.get_bool)());
+        break;
+      }
+    }
+    writer->EndObject();
+  }
 
   std::string UpdateJSON(
     std::vector<Project *> * const,
@@ -116,14 +338,19 @@ namespace kopsik {
 
   void ParseResponseJSON(
     BatchUpdateResult *model,
-    JSONNODE *n);
+    JSONValue *n);
 
-  Poco::UInt64 GetIDFromJSONNode(JSONNODE * const);
-  guid GetGUIDFromJSONNode(JSONNODE * const);
-  Poco::UInt64 GetUIModifiedAtFromJSONNode(JSONNODE * const);
-  bool IsDeletedAtServer(JSONNODE * const);
+  Poco::UInt64 GetIDFromJSONNode(JSONValue * const);
+  guid GetGUIDFromJSONNode(JSONValue * const);
+  Poco::UInt64 GetUIModifiedAtFromJSONNode(JSONValue * const);
+  // Server's "at" of the model, or 0 if it has none
+  Poco::UInt64 GetUpdatedAtFromJSONNode(JSONValue * const);
+  bool IsDeletedAtServer(JSONValue * const);
+  // Items of a list response, a bare array or an array under "data".
+  // 0 when the response is null.
+  JSONValue *GetListFromJSONNode(JSONValue * const);
 
-  bool IsValidJSON(const std::string json);
+  bool IsValidJSON(const std::string &json);
 
 }  // namespace kopsik
 
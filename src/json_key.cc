@@ -0,0 +1,286 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./json_key.h"
+
+#include <cstring>
+
+namespace kopsik {
+
+JSONKey JSONKeyFromName(const char *name) {
+  switch (strlen(name)) {
+  case 2:
+    switch (name[0]) {
+    case 'a':
+      if (!strcmp(name + 1, "t")) {
+        return kJSONKeyAt;
+      }
+      break;
+    case 'i':
+      if (!strcmp(name + 1, "d")) {
+        return kJSONKeyID;
+      }
+      break;
+    }
+    break;
+  case 3:
+    switch (name[0]) {
+    case 'c':
+      if (!strcmp(name + 1, "id")) {
+        return kJSONKeyCID;
+      }
+      break;
+    case 'p':
+      if (!strcmp(name + 1, "id")) {
+        return kJSONKeyPID;
+      }
+      break;
+    case 't':
+      if (!strcmp(name + 1, "id")) {
+        return kJSONKeyTID;
+      }
+      break;
+    case 'u':
+      if (!strcmp(name + 1, "rl")) {
+        return kJSONKeyURL;
+      }
+      break;
+    case 'w':
+      if (!strcmp(name + 1, "id")) {
+        return kJSONKeyWID;
+      }
+      break;
+    }
+    break;
+  case 4:
+    switch (name[0]) {
+    case 'b':
+      if (!strcmp(name + 1, "ody")) {
+        return kJSONKeyBody;
+      }
+      break;
+    case 'd':
+      if (!strcmp(name + 1, "ata")) {
+        return kJSONKeyData;
+      }
+      break;
+    case 'g':
+      if (!strcmp(name + 1, "uid")) {
+        return kJSONKeyGUID;
+      }
+      break;
+    case 'n':
+      if (!strcmp(name + 1, "ame")) {
+        return kJSONKeyName;
+      }
+      break;
+    case 's':
+      if (!strcmp(name + 1, "top")) {
+        return kJSONKeyStop;
+      }
+      break;
+    case 't':
+      if (!strcmp(name + 1, "ags")) {
+        return kJSONKeyTags;
+      }
+      if (!strcmp(name + 1, "ype")) {
+        return kJSONKeyType;
+      }
+      break;
+    }
+    break;
+  case 5:
+    switch (name[0]) {
+    case 'c':
+      if (!strcmp(name + 1, "olor")) {
+        return kJSONKeyColor;
+      }
+      break;
+    case 'e':
+      if (!strcmp(name + 1, "mail")) {
+        return kJSONKeyEmail;
+      }
+      break;
+    case 'm':
+      if (!strcmp(name + 1, "odel")) {
+        return kJSONKeyModel;
+      }
+      break;
+    case 's':
+      if (!strcmp(name + 1, "tart")) {
+        return kJSONKeyStart;
+      }
+      break;
+    case 't':
+      if (!strcmp(name + 1, "asks")) {
+        return kJSONKeyTasks;
+      }
+      break;
+    }
+    break;
+  case 6:
+    switch (name[0]) {
+    case 'a':
+      if (!strcmp(name + 1, "ction")) {
+        return kJSONKeyAction;
+      }
+      if (!strcmp(name + 1, "ctive")) {
+        return kJSONKeyActive;
+      }
+      break;
+    case 'm':
+      if (!strcmp(name + 1, "ethod")) {
+        return kJSONKeyMethod;
+      }
+      break;
+    case 's':
+      if (!strcmp(name + 1, "tatus")) {
+        return kJSONKeyStatus;
+      }
+      break;
+    }
+    break;
+  case 7:
+    switch (name[0]) {
+    case 'c':
+      if (!strcmp(name + 1, "lients")) {
+        return kJSONKeyClients;
+      }
+      break;
+    case 'd':
+      if (!strcmp(name + 1, "uronly")) {
+        return kJSONKeyDuronly;
+      }
+      break;
+    case 'p':
+      if (!strcmp(name + 1, "remium")) {
+        return kJSONKeyPremium;
+      }
+      break;
+    case 'v':
+      if (!strcmp(name + 1, "ersion")) {
+        return kJSONKeyVersion;
+      }
+      break;
+    }
+    break;
+  case 8:
+    switch (name[0]) {
+    case 'b':
+      if (!strcmp(name + 1, "illable")) {
+        return kJSONKeyBillable;
+      }
+      break;
+    case 'd':
+      if (!strcmp(name + 1, "uration")) {
+        return kJSONKeyDuration;
+      }
+      break;
+    case 'f':
+      if (!strcmp(name + 1, "ullname")) {
+        return kJSONKeyFullname;
+      }
+      break;
+    case 'p':
+      if (!strcmp(name + 1, "rojects")) {
+        return kJSONKeyProjects;
+      }
+      break;
+    }
+    break;
+  case 9:
+    switch (name[0]) {
+    case 'a':
+      if (!strcmp(name + 1, "pi_token")) {
+        return kJSONKeyAPIToken;
+      }
+      break;
+    }
+    break;
+  case 10:
+    switch (name[0]) {
+    case 'w':
+      if (!strcmp(name + 1, "orkspaces")) {
+        return kJSONKeyWorkspaces;
+      }
+      break;
+    }
+    break;
+  case 11:
+    switch (name[0]) {
+    case 'd':
+      if (!strcmp(name + 1, "efault_wid")) {
+        return kJSONKeyDefaultWID;
+      }
+      if (!strcmp(name + 1, "escription")) {
+        return kJSONKeyDescription;
+      }
+      break;
+    }
+    break;
+  case 12:
+    switch (name[0]) {
+    case 'c':
+      if (!strcmp(name + 1, "ontent_type")) {
+        return kJSONKeyContentType;
+      }
+      if (!strcmp(name + 1, "reated_with")) {
+        return kJSONKeyCreatedWith;
+      }
+      break;
+    case 't':
+      if (!strcmp(name + 1, "ime_entries")) {
+        return kJSONKeyTimeEntries;
+      }
+      break;
+    }
+    break;
+  case 14:
+    switch (name[0]) {
+    case 'u':
+      if (!strcmp(name + 1, "i_modified_at")) {
+        return kJSONKeyUIModifiedAt;
+      }
+      break;
+    }
+    break;
+  case 15:
+    switch (name[0]) {
+    case 'r':
+      if (!strcmp(name + 1, "ecord_timeline")) {
+        return kJSONKeyRecordTimeline;
+      }
+      break;
+    }
+    break;
+  case 16:
+    switch (name[0]) {
+    case 't':
+      if (!strcmp(name + 1, "imeline_rollups")) {
+        return kJSONKeyTimelineRollups;
+      }
+      break;
+    }
+    break;
+  case 17:
+    switch (name[0]) {
+    case 's':
+      if (!strcmp(name + 1, "erver_deleted_at")) {
+        return kJSONKeyServerDeletedAt;
+      }
+      break;
+    }
+    break;
+  case 25:
+    switch (name[0]) {
+    case 's':
+      if (!strcmp(name + 1, "tore_start_and_stop_time")) {
+        return kJSONKeyStoreStartAndStopTime;
+      }
+      break;
+    }
+    break;
+  }
+  return kJSONKeyUnknown;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,63 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_JSON_KEY_H_
+#define SRC_JSON_KEY_H_
+
+namespace kopsik {
+
+  // Field names the JSON loaders know about.
+  enum JSONKey {
+    kJSONKeyUnknown = 0,
+    kJSONKeyAction,
+    kJSONKeyActive,
+    kJSONKeyAPIToken,
+    kJSONKeyAt,
+    kJSONKeyBillable,
+    kJSONKeyBody,
+    kJSONKeyCID,
+    kJSONKeyClients,
+    kJSONKeyColor,
+    kJSONKeyContentType,
+    kJSONKeyCreatedWith,
+    kJSONKeyData,
+    kJSONKeyDefaultWID,
+    kJSONKeyDescription,
+    kJSONKeyDuration,
+    kJSONKeyDuronly,
+    kJSONKeyEmail,
+    kJSONKeyFullname,
+    kJSONKeyGUID,
+    kJSONKeyID,
+    kJSONKeyMethod,
+    kJSONKeyModel,
+    kJSONKeyName,
+    kJSONKeyPID,
+    kJSONKeyPremium,
+    kJSONKeyProjects,
+    kJSONKeyRecordTimeline,
+    kJSONKeyServerDeletedAt,
+    kJSONKeyStart,
+    kJSONKeyStatus,
+    kJSONKeyStop,
+    kJSONKeyStoreStartAndStopTime,
+    kJSONKeyTags,
+    kJSONKeyTasks,
+    kJSONKeyTID,
+    kJSONKeyTimeEntries,
+    kJSONKeyTimelineRollups,
+    kJSONKeyType,
+    kJSONKeyUIModifiedAt,
+    kJSONKeyURL,
+    kJSONKeyVersion,
+    kJSONKeyWID,
+    kJSONKeyWorkspaces
+  };
+
+  // Looks a field name up by its length and first character,
+  // so at most one or two full comparisons are done per field.
+  // New keys go into the enum and into the switch below.
+  JSONKey JSONKeyFromName(const char *name);
+
+}  // namespace kopsik
+
+#endif  // SRC_JSON_KEY_H_
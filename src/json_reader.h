@@ -0,0 +1,47 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_JSON_READER_H_
+#define SRC_JSON_READER_H_
+
+namespace kopsik {
+
+  // The parser behind everything that reads JSON. Call sites only use
+  // what the backends declare, so another parser can be tried by giving
+  // these to it, without touching the models. JSON is written with
+  // JSONWriter, which needs no parser at all.
+  //
+  // Every backend has:
+  //
+  //   JSONValue, and JSONIterator over the members of an object or the
+  //   items of an array, in order
+  //   JSONIsValid(json), JSONParse(json), which is 0 if the text is not
+  //   an object or an array
+  //   JSONDelete and JSONDuplicate, for parsed and taken values
+  //   JSONTypeOf, JSONBegin, JSONEnd, JSONSize, JSONAt
+  //   JSONGet(value, name), 0 if there's no such member
+  //   JSONTake(value, name), a member that outlives its object
+  //   JSONName and JSONNodeKey, the name of a member
+  //   JSONString, JSONInt and JSONBool, values as the type asked for,
+  //   converted if they're of another. Strings are unescaped, other
+  //   scalars are their text, containers are empty.
+  //
+  // The tape backend is used unless KOPSIK_JSON_LIBJSON is defined.
+
+  enum JSONType {
+    kJSONNull,
+    kJSONString,
+    kJSONNumber,
+    kJSONBool,
+    kJSONArray,
+    kJSONObject
+  };
+
+}  // namespace kopsik
+
+#if defined(KOPSIK_JSON_LIBJSON)
+#include "./json_reader_libjson.h"
+#else
+#include "./json_reader_tape.h"
+#endif
+
+#endif  // SRC_JSON_READER_H_
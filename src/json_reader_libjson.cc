@@ -0,0 +1,99 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./json_reader.h"
+
+// The backend json_reader.h includes when KOPSIK_JSON_LIBJSON is defined
+#if defined(KOPSIK_JSON_LIBJSON)
+
+namespace kopsik {
+
+bool JSONIsValid(const std::string &json) {
+  return json_is_valid(json.c_str());
+}
+
+JSONValue *JSONParse(const std::string &json) {
+  return json_parse(json.c_str());
+}
+
+void JSONDelete(JSONValue *value) {
+  json_delete(value);
+}
+
+JSONValue *JSONDuplicate(JSONValue *value) {
+  return json_duplicate(value);
+}
+
+JSONType JSONTypeOf(JSONValue * const value) {
+  switch (json_type(value)) {
+  case JSON_STRING:
+    return kJSONString;
+  case JSON_NUMBER:
+    return kJSONNumber;
+  case JSON_BOOL:
+    return kJSONBool;
+  case JSON_ARRAY:
+    return kJSONArray;
+  case JSON_NODE:
+    return kJSONObject;
+  }
+  return kJSONNull;
+}
+
+JSONIterator JSONBegin(JSONValue *value) {
+  return json_begin(value);
+}
+
+JSONIterator JSONEnd(JSONValue *value) {
+  return json_end(value);
+}
+
+std::size_t JSONSize(JSONValue * const value) {
+  return json_size(value);
+}
+
+JSONValue *JSONAt(JSONValue *value, const std::size_t index) {
+  return json_at(value, static_cast<json_index_t>(index));
+}
+
+JSONValue *JSONGet(JSONValue *value, const char *name) {
+  return json_get(value, name);
+}
+
+JSONValue *JSONTake(JSONValue *value, const char *name) {
+  return json_pop_back(value, name);
+}
+
+std::string JSONName(JSONValue * const value) {
+  // The name is a copy, freed here
+  json_char *name = json_name(value);
+  std::string result(name);
+  json_free(name);
+  return result;
+}
+
+JSONKey JSONNodeKey(JSONValue * const value) {
+  json_char *name = json_name(value);
+  JSONKey key = JSONKeyFromName(name);
+  json_free(name);
+  return key;
+}
+
+std::string JSONString(JSONValue * const value) {
+  // The string is a copy, freed here
+  json_char *text = json_as_string(value);
+  std::string result(text);
+  json_free(text);
+  return result;
+}
+
+Poco::Int64 JSONInt(JSONValue * const value) {
+  return json_as_int(value);
+}
+
+bool JSONBool(JSONValue * const value) {
+  return json_as_bool(value) != 0;
+}
+
+}  // namespace kopsik
+
+#endif
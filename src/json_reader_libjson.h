@@ -0,0 +1,68 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_JSON_READER_LIBJSON_H_
+#define SRC_JSON_READER_LIBJSON_H_
+
+// Only included by json_reader.h, with KOPSIK_JSON_LIBJSON defined
+
+#include <string>
+
+#include "libjson.h" // NOLINT
+
+#include "./json_key.h"
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Values are libjson's nodes, parsed values and duplicates are
+  // deleted with JSONDelete, and everything else returned points into
+  // them.
+
+  typedef JSONNODE JSONValue;
+
+  // Members of an object or items of an array, in order
+  typedef JSONNODE_ITERATOR JSONIterator;
+
+  bool JSONIsValid(const std::string &json);
+
+  // 0 if the text is not JSON
+  JSONValue *JSONParse(const std::string &json);
+
+  void JSONDelete(JSONValue *value);
+
+  JSONValue *JSONDuplicate(JSONValue *value);
+
+  JSONType JSONTypeOf(JSONValue * const value);
+
+  JSONIterator JSONBegin(JSONValue *value);
+
+  JSONIterator JSONEnd(JSONValue *value);
+
+  std::size_t JSONSize(JSONValue * const value);
+
+  JSONValue *JSONAt(JSONValue *value, const std::size_t index);
+
+  // Member of an object by name, 0 if it has none
+  JSONValue *JSONGet(JSONValue *value, const char *name);
+
+  // Member of an object by name, taken out of it so it outlives the
+  // object. 0 if it has none.
+  JSONValue *JSONTake(JSONValue *value, const char *name);
+
+  // Name of an object member
+  std::string JSONName(JSONValue * const value);
+
+  // Name of an object member, as a key the loaders know
+  JSONKey JSONNodeKey(JSONValue * const value);
+
+  // Values as the type asked for, converted if they're of another
+  std::string JSONString(JSONValue * const value);
+
+  Poco::Int64 JSONInt(JSONValue * const value);
+
+  bool JSONBool(JSONValue * const value);
+
+}  // namespace kopsik
+
+#endif  // SRC_JSON_READER_LIBJSON_H_
@@ -0,0 +1,575 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./json_reader.h"
+
+// The backend json_reader.h includes unless KOPSIK_JSON_LIBJSON is defined
+#if !defined(KOPSIK_JSON_LIBJSON)
+
+#include <cstring>
+#include <limits>
+
+namespace kopsik {
+
+JSONValue::JSONValue()
+  : Document(0)
+  , Type(kJSONNull)
+  , Escaped(false)
+  , KeyEscaped(false)
+  , KeyBegin(0)
+  , KeyEnd(0)
+  , Begin(0)
+  , End(0)
+  , Nodes(1)
+  , Size(0) {}
+
+JSONIterator &JSONIterator::operator++() {
+  value_ += value_->Nodes;
+  return *this;
+}
+
+JSONIterator JSONIterator::operator++(int) {  // NOLINT
+  JSONIterator previous(*this);
+  value_ += value_->Nodes;
+  return previous;
+}
+
+bool JSONIterator::operator==(const JSONIterator &other) const {
+  return value_ == other.value_;
+}
+
+bool JSONIterator::operator!=(const JSONIterator &other) const {
+  return value_ != other.value_;
+}
+
+JSONValue *JSONDocument::Parse(const std::string &json) {
+  JSONDocument *document = new JSONDocument(json);
+  if (!document->parse()) {
+    delete document;
+    return 0;
+  }
+  return &document->values_[0];
+}
+
+bool JSONDocument::IsValid(const std::string &json) {
+  JSONDocument document(json);
+  return document.parse();
+}
+
+void JSONDocument::Retain() {
+  ++references_;
+}
+
+void JSONDocument::Release() {
+  if (0 == --references_) {
+    delete this;
+  }
+}
+
+const char *JSONDocument::Text() const {
+  return &text_[0];
+}
+
+std::string JSONDocument::Unescape(const char *begin, const char *end) {
+  std::string result;
+  result.reserve(end - begin);
+  const char *p = begin;
+  while (p < end) {
+    const char *run = p;
+    while (p < end && '\\' != *p) {
+      p++;
+    }
+    result.append(run, p - run);
+    if (p == end) {
+      break;
+    }
+    p++;
+    switch (*p) {
+    case 'b':
+      result += '\b';
+      break;
+    case 'f':
+      result += '\f';
+      break;
+    case 'n':
+      result += '\n';
+      break;
+    case 'r':
+      result += '\r';
+      break;
+    case 't':
+      result += '\t';
+      break;
+    case 'u': {
+      Poco::UInt32 code = hex4(p + 1);
+      p += 4;
+      // Characters outside the BMP come as surrogate pairs
+      if (code >= 0xD800 && code < 0xDC00 && p + 6 < end
+          && '\\' == p[1] && 'u' == p[2]) {
+        Poco::UInt32 low = hex4(p + 3);
+        if (low >= 0xDC00 && low < 0xE000) {
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          p += 6;
+        }
+      }
+      appendUTF8(code, &result);
+      break;
+    }
+    default:
+      result += *p;
+    }
+    p++;
+  }
+  return result;
+}
+
+Poco::Int64 JSONDocument::ToInt(const char *begin, const char *end) {
+  const char *p = begin;
+  bool negative(false);
+  if (p < end && '-' == *p) {
+    negative = true;
+    p++;
+  }
+  const Poco::UInt64 max = std::numeric_limits<Poco::Int64>::max();
+  const char *digits = p;
+  Poco::UInt64 value(0);
+  for (; p < end && isDigit(*p); p++) {
+    Poco::UInt64 digit = *p - '0';
+    if (value > (max - digit) / 10) {
+      break;
+    }
+    value = value * 10 + digit;
+  }
+  if (p == end && p != digits) {
+    Poco::Int64 result = static_cast<Poco::Int64>(value);
+    return negative ? -result : result;
+  }
+  double number = ToDouble(begin, end);
+  if (number >= static_cast<double>(max)) {
+    return std::numeric_limits<Poco::Int64>::max();
+  }
+  if (number <= -static_cast<double>(max)) {
+    return std::numeric_limits<Poco::Int64>::min();
+  }
+  return static_cast<Poco::Int64>(number);
+}
+
+double JSONDocument::ToDouble(const char *begin, const char *end) {
+  std::string text(begin, end);
+  return std::strtod(text.c_str(), 0);
+}
+
+JSONDocument::JSONDocument(const std::string &json)
+  : text_(json.begin(), json.end())
+  , references_(1) {
+  text_.push_back('\0');
+}
+
+bool JSONDocument::parse() {
+  if (text_.size() > std::numeric_limits<Poco::UInt32>::max() - 1) {
+    return false;
+  }
+  const Poco::UInt32 size = static_cast<Poco::UInt32>(text_.size() - 1);
+  char *text = &text_[0];
+  std::vector<Poco::UInt32> positions;
+  if (!JSONScanStructure(text, size, &positions) || positions.empty()) {
+    return false;
+  }
+  // At the ending zero, which is none of the characters looked for
+  positions.push_back(size);
+  values_.reserve(positions.size() / 2 + 1);
+
+  // Containers not closed yet
+  std::vector<Poco::UInt32> open;
+  std::size_t k(0);
+  Poco::UInt32 at = positions[k];
+  if (!blank(text, 0, at) || ('{' != text[at] && '[' != text[at])) {
+    return false;
+  }
+  open.push_back(push('{' == text[at] ? kJSONObject : kJSONArray,
+                      at, at + 1));
+  Poco::UInt32 from = at + 1;
+  k++;
+  bool after_value(false);
+
+  while (!open.empty()) {
+    const Poco::UInt32 parent = open.back();
+    const bool object = kJSONObject == values_[parent].Type;
+    const char close = object ? '}' : ']';
+
+    at = positions[k];
+    if (close == text[at] && blank(text, from, at)) {
+      values_[parent].End = at + 1;
+      values_[parent].Nodes =
+        static_cast<Poco::UInt32>(values_.size()) - parent;
+      open.pop_back();
+      from = at + 1;
+      k++;
+      after_value = true;
+      continue;
+    }
+    if (after_value) {
+      if (',' != text[at] || !blank(text, from, at)) {
+        return false;
+      }
+      from = at + 1;
+      k++;
+    }
+
+    Poco::UInt32 key_begin(size);
+    Poco::UInt32 key_end(size);
+    bool key_escaped(false);
+    if (object) {
+      at = positions[k];
+      if ('"' != text[at] || !blank(text, from, at)) {
+        return false;
+      }
+      key_begin = at + 1;
+      key_end = positions[k + 1];
+      if (!checkString(text, key_begin, key_end, &key_escaped)) {
+        return false;
+      }
+      // Names can be read as they are in the text from now on
+      text[key_end] = '\0';
+      k += 2;
+      at = positions[k];
+      if (':' != text[at] || !blank(text, key_end + 1, at)) {
+        return false;
+      }
+      from = at + 1;
+      k++;
+    }
+
+    Poco::UInt32 index(0);
+    at = positions[k];
+    Poco::UInt32 begin = from;
+    while (begin < at && isBlank(text[begin])) {
+      begin++;
+    }
+    if (begin == at) {
+      if ('"' == text[at]) {
+        Poco::UInt32 end = positions[k + 1];
+        bool escaped(false);
+        if (!checkString(text, at + 1, end, &escaped)) {
+          return false;
+        }
+        index = push(kJSONString, at + 1, end);
+        values_[index].Escaped = escaped;
+        from = end + 1;
+        k += 2;
+        after_value = true;
+      } else if ('{' == text[at] || '[' == text[at]) {
+        index = push('{' == text[at] ? kJSONObject : kJSONArray,
+                     at, at + 1);
+        open.push_back(index);
+        from = at + 1;
+        k++;
+        after_value = false;
+      } else {
+        return false;
+      }
+    } else {
+      // Numbers, true, false and null go up to what comes next
+      Poco::UInt32 end = at;
+      while (isBlank(text[end - 1])) {
+        end--;
+      }
+      JSONType type(kJSONNull);
+      if (!scalarType(text + begin, text + end, &type)) {
+        return false;
+      }
+      index = push(type, begin, end);
+      from = end;
+      after_value = true;
+    }
+    values_[index].KeyBegin = key_begin;
+    values_[index].KeyEnd = key_end;
+    values_[index].KeyEscaped = key_escaped;
+    values_[parent].Size++;
+  }
+
+  return positions.size() - 1 == k && blank(text, from, size);
+}
+
+Poco::UInt32 JSONDocument::push(
+    const JSONType type, const Poco::UInt32 begin, const Poco::UInt32 end) {
+  values_.push_back(JSONValue());
+  JSONValue &value = values_.back();
+  value.Document = this;
+  value.Type = type;
+  value.Begin = begin;
+  value.End = end;
+  // No name, until it's given one
+  value.KeyBegin = static_cast<Poco::UInt32>(text_.size() - 1);
+  value.KeyEnd = value.KeyBegin;
+  return static_cast<Poco::UInt32>(values_.size() - 1);
+}
+
+bool JSONDocument::isBlank(const char c) {
+  return ' ' == c || '\n' == c || '\r' == c || '\t' == c;
+}
+
+bool JSONDocument::isDigit(const char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool JSONDocument::isHex(const char c) {
+  return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+bool JSONDocument::blank(
+    const char *text, const Poco::UInt32 from, const Poco::UInt32 to) {
+  for (Poco::UInt32 i = from; i < to; i++) {
+    if (!isBlank(text[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JSONDocument::checkString(
+    const char *text, const Poco::UInt32 begin, const Poco::UInt32 end,
+    bool *escaped) {
+  const char *p = static_cast<const char *>(
+    std::memchr(text + begin, '\\', end - begin));
+  *escaped = (p != 0);
+  if (!p) {
+    return true;
+  }
+  for (; p < text + end; p++) {
+    if ('\\' != *p) {
+      continue;
+    }
+    p++;
+    switch (*p) {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+      break;
+    case 'u':
+      for (int i = 0; i < 4; i++) {
+        if (++p >= text + end || !isHex(*p)) {
+          return false;
+        }
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JSONDocument::scalarType(
+    const char *begin, const char *end, JSONType *type) {
+  const std::size_t length = end - begin;
+  if ((4 == length && !std::strncmp(begin, "true", 4))
+      || (5 == length && !std::strncmp(begin, "false", 5))) {
+    *type = kJSONBool;
+    return true;
+  }
+  if (4 == length && !std::strncmp(begin, "null", 4)) {
+    *type = kJSONNull;
+    return true;
+  }
+  *type = kJSONNumber;
+  const char *p = begin;
+  if (p < end && '-' == *p) {
+    p++;
+  }
+  if (!skipDigits(&p, end)) {
+    return false;
+  }
+  if (p < end && '.' == *p) {
+    p++;
+    if (!skipDigits(&p, end)) {
+      return false;
+    }
+  }
+  if (p < end && ('e' == *p || 'E' == *p)) {
+    p++;
+    if (p < end && ('+' == *p || '-' == *p)) {
+      p++;
+    }
+    if (!skipDigits(&p, end)) {
+      return false;
+    }
+  }
+  return p == end;
+}
+
+bool JSONDocument::skipDigits(const char **p, const char *end) {
+  const char *digits = *p;
+  while (*p < end && isDigit(**p)) {
+    (*p)++;
+  }
+  return *p != digits;
+}
+
+Poco::UInt32 JSONDocument::hex4(const char *p) {
+  Poco::UInt32 code(0);
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    code <<= 4;
+    if (isDigit(c)) {
+      code |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      code |= c - 'a' + 10;
+    } else {
+      code |= c - 'A' + 10;
+    }
+  }
+  return code;
+}
+
+void JSONDocument::appendUTF8(const Poco::UInt32 code, std::string *out) {
+  if (code < 0x80) {
+    *out += static_cast<char>(code);
+  } else if (code < 0x800) {
+    *out += static_cast<char>(0xC0 | (code >> 6));
+    *out += static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    *out += static_cast<char>(0xE0 | (code >> 12));
+    *out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    *out += static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    *out += static_cast<char>(0xF0 | (code >> 18));
+    *out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    *out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    *out += static_cast<char>(0x80 | (code & 0x3F));
+  }
+}
+
+bool JSONIsValid(const std::string &json) {
+  return JSONDocument::IsValid(json);
+}
+
+JSONValue *JSONParse(const std::string &json) {
+  return JSONDocument::Parse(json);
+}
+
+void JSONDelete(JSONValue *value) {
+  if (value) {
+    value->Document->Release();
+  }
+}
+
+JSONValue *JSONDuplicate(JSONValue *value) {
+  if (value) {
+    value->Document->Retain();
+  }
+  return value;
+}
+
+JSONType JSONTypeOf(JSONValue * const value) {
+  return value ? value->Type : kJSONNull;
+}
+
+JSONIterator JSONBegin(JSONValue *value) {
+  return JSONIterator(value ? value + 1 : 0);
+}
+
+JSONIterator JSONEnd(JSONValue *value) {
+  return JSONIterator(value ? value + value->Nodes : 0);
+}
+
+std::size_t JSONSize(JSONValue * const value) {
+  return value ? value->Size : 0;
+}
+
+JSONValue *JSONAt(JSONValue *value, const std::size_t index) {
+  if (!value || index >= value->Size) {
+    return 0;
+  }
+  JSONValue *item = value + 1;
+  for (std::size_t i = 0; i < index; i++) {
+    item += item->Nodes;
+  }
+  return item;
+}
+
+std::string JSONName(JSONValue * const value) {
+  const char *text = value->Document->Text();
+  if (value->KeyEscaped) {
+    return JSONDocument::Unescape(text + value->KeyBegin,
+                                  text + value->KeyEnd);
+  }
+  return std::string(text + value->KeyBegin, text + value->KeyEnd);
+}
+
+JSONKey JSONNodeKey(JSONValue * const value) {
+  if (value->KeyEscaped) {
+    return JSONKeyFromName(JSONName(value).c_str());
+  }
+  return JSONKeyFromName(value->Document->Text() + value->KeyBegin);
+}
+
+JSONValue *JSONGet(JSONValue *value, const char *name) {
+  if (kJSONObject != JSONTypeOf(value)) {
+    return 0;
+  }
+  const char *text = value->Document->Text();
+  JSONIterator end = JSONEnd(value);
+  for (JSONIterator it = JSONBegin(value); it != end; ++it) {
+    JSONValue *member = *it;
+    if (member->KeyEscaped ? JSONName(member) == name
+        : !std::strcmp(text + member->KeyBegin, name)) {
+      return member;
+    }
+  }
+  return 0;
+}
+
+JSONValue *JSONTake(JSONValue *value, const char *name) {
+  return JSONDuplicate(JSONGet(value, name));
+}
+
+std::string JSONString(JSONValue * const value) {
+  if (!value || kJSONObject == value->Type || kJSONArray == value->Type) {
+    return "";
+  }
+  const char *text = value->Document->Text();
+  if (value->Escaped) {
+    return JSONDocument::Unescape(text + value->Begin, text + value->End);
+  }
+  return std::string(text + value->Begin, text + value->End);
+}
+
+bool JSONBool(JSONValue * const value) {
+  switch (JSONTypeOf(value)) {
+  case kJSONBool:
+    return 't' == value->Document->Text()[value->Begin];
+  case kJSONNumber: {
+    const char *text = value->Document->Text();
+    return JSONDocument::ToDouble(text + value->Begin,
+                                  text + value->End) != 0;
+  }
+  default:
+    return false;
+  }
+}
+
+Poco::Int64 JSONInt(JSONValue * const value) {
+  switch (JSONTypeOf(value)) {
+  case kJSONNumber: {
+    const char *text = value->Document->Text();
+    return JSONDocument::ToInt(text + value->Begin, text + value->End);
+  }
+  case kJSONString: {
+    std::string text = JSONString(value);
+    return JSONDocument::ToInt(text.data(), text.data() + text.size());
+  }
+  case kJSONBool:
+    return JSONBool(value) ? 1 : 0;
+  default:
+    return 0;
+  }
+}
+
+}  // namespace kopsik
+
+#endif
@@ -0,0 +1,173 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_JSON_READER_TAPE_H_
+#define SRC_JSON_READER_TAPE_H_
+
+// Only included by json_reader.h, which declares JSONType
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "./json_key.h"
+#include "./json_scan.h"
+
+#include "Poco/AtomicCounter.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  class JSONDocument;
+
+  // A value in a parsed document. All the values of a document are in
+  // one array, in the order they are written, a container followed by
+  // what's in it, so parsing allocates nothing per value. Names and
+  // scalars are left where they are in the text and only unescaped or
+  // converted when asked for.
+  class JSONValue {
+  public:
+    JSONValue();
+
+    JSONDocument *Document;
+    JSONType Type;
+    // Has backslashes in it
+    bool Escaped;
+    bool KeyEscaped;
+    // Member name and value in the text. Strings are without their
+    // quotes, containers are from bracket to bracket. Array items have
+    // an empty name at the end of the text.
+    Poco::UInt32 KeyBegin;
+    Poco::UInt32 KeyEnd;
+    Poco::UInt32 Begin;
+    Poco::UInt32 End;
+    // Values taken up, itself and everything in it
+    Poco::UInt32 Nodes;
+    // Members or items of a container
+    Poco::UInt32 Size;
+  };
+
+  // Members of an object or items of an array, in order
+  class JSONIterator {
+  public:
+    explicit JSONIterator(JSONValue *value = 0) : value_(value) {}
+
+    JSONValue *operator*() const { return value_; }
+
+    JSONIterator &operator++();
+    JSONIterator operator++(int);
+
+    bool operator==(const JSONIterator &other) const;
+    bool operator!=(const JSONIterator &other) const;
+
+  private:
+    JSONValue *value_;
+  };
+
+  // Parsed JSON text, kept along with its values. The structure is
+  // found first, by JSONScanStructure, and the values are laid out by
+  // going over the positions it found, without looking at what's in
+  // between. Values taken out or duplicated share the document, it's
+  // deleted when the last of them is.
+  class JSONDocument {
+  public:
+    // The root value, 0 if the text is not an object or an array
+    static JSONValue *Parse(const std::string &json);
+
+    static bool IsValid(const std::string &json);
+
+    void Retain();
+
+    void Release();
+
+    // Ends with a zero, as do the member names in it
+    const char *Text() const;
+
+    static std::string Unescape(const char *begin, const char *end);
+
+    // Integers are read as they are, the rest as doubles
+    static Poco::Int64 ToInt(const char *begin, const char *end);
+
+    static double ToDouble(const char *begin, const char *end);
+
+  private:
+    explicit JSONDocument(const std::string &json);
+
+    bool parse();
+
+    Poco::UInt32 push(const JSONType type,
+                      const Poco::UInt32 begin,
+                      const Poco::UInt32 end);
+
+    static bool isBlank(const char c);
+
+    static bool isDigit(const char c);
+
+    static bool isHex(const char c);
+
+    static bool blank(const char *text,
+                      const Poco::UInt32 from,
+                      const Poco::UInt32 to);
+
+    // Only strings with backslashes are looked at more closely
+    static bool checkString(const char *text,
+                            const Poco::UInt32 begin,
+                            const Poco::UInt32 end,
+                            bool *escaped);
+
+    static bool scalarType(const char *begin,
+                           const char *end,
+                           JSONType *type);
+
+    // False if there were none
+    static bool skipDigits(const char **p, const char *end);
+
+    static Poco::UInt32 hex4(const char *p);
+
+    static void appendUTF8(const Poco::UInt32 code, std::string *out);
+
+    std::vector<char> text_;
+    std::vector<JSONValue> values_;
+    Poco::AtomicCounter references_;
+
+    JSONDocument(const JSONDocument &);
+    JSONDocument &operator=(const JSONDocument &);
+  };
+
+  bool JSONIsValid(const std::string &json);
+
+  JSONValue *JSONParse(const std::string &json);
+
+  void JSONDelete(JSONValue *value);
+
+  // Values don't change once parsed, so the duplicate is the value
+  JSONValue *JSONDuplicate(JSONValue *value);
+
+  JSONType JSONTypeOf(JSONValue * const value);
+
+  JSONIterator JSONBegin(JSONValue *value);
+
+  JSONIterator JSONEnd(JSONValue *value);
+
+  std::size_t JSONSize(JSONValue * const value);
+
+  // Goes over the items before it
+  JSONValue *JSONAt(JSONValue *value, const std::size_t index);
+
+  std::string JSONName(JSONValue * const value);
+
+  JSONKey JSONNodeKey(JSONValue * const value);
+
+  JSONValue *JSONGet(JSONValue *value, const char *name);
+
+  // The member stays in the object too
+  JSONValue *JSONTake(JSONValue *value, const char *name);
+
+  std::string JSONString(JSONValue * const value);
+
+  bool JSONBool(JSONValue * const value);
+
+  Poco::Int64 JSONInt(JSONValue * const value);
+
+}  // namespace kopsik
+
+#endif  // SRC_JSON_READER_TAPE_H_
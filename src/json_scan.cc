@@ -0,0 +1,167 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./json_scan.h"
+
+#include <cstring>
+
+namespace kopsik {
+
+JSONScanMasks::JSONScanMasks()
+  : Quotes(0)
+  , Backslashes(0)
+  , Brackets(0)
+  , Separators(0) {}
+
+void JSONScanBlock(const char *block, JSONScanMasks *masks) {
+#if defined(KOPSIK_JSON_SCAN_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  // [ and ] are { and } without the 0x20 bit
+  const __m128i lowercase = _mm_set1_epi8(0x20);
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i close = _mm_set1_epi8('}');
+  for (int i = 0; i < 4; i++) {
+    const __m128i bytes = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(block + 16 * i));
+    const __m128i folded = _mm_or_si128(bytes, lowercase);
+    const int shift = 16 * i;
+    masks->Quotes |= Poco::UInt64(static_cast<Poco::UInt16>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)))) << shift;
+    masks->Backslashes |= Poco::UInt64(static_cast<Poco::UInt16>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, backslash)))) << shift;
+    masks->Brackets |= Poco::UInt64(static_cast<Poco::UInt16>(
+      _mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(folded, open),
+        _mm_cmpeq_epi8(folded, close))))) << shift;
+    masks->Separators |= Poco::UInt64(static_cast<Poco::UInt16>(
+      _mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(bytes, colon),
+        _mm_cmpeq_epi8(bytes, comma))))) << shift;
+  }
+#else
+  for (std::size_t i = 0; i < kJSONScanBlockBytes; i++) {
+    const Poco::UInt64 bit = Poco::UInt64(1) << i;
+    switch (block[i]) {
+    case '"':
+      masks->Quotes |= bit;
+      break;
+    case '\\':
+      masks->Backslashes |= bit;
+      break;
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+      masks->Brackets |= bit;
+      break;
+    case ':':
+    case ',':
+      masks->Separators |= bit;
+      break;
+    }
+  }
+#endif
+}
+
+unsigned int JSONScanLowestBit(const Poco::UInt64 mask) {
+#if defined(__GNUC__)
+  return static_cast<unsigned int>(__builtin_ctzll(mask));
+#else
+  unsigned int bit(0);
+  while (!(mask & (Poco::UInt64(1) << bit))) {
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+std::size_t JSONScanPlainBytes(
+    const char *data, const std::size_t size, const bool in_string) {
+  std::size_t offset(0);
+  for (; offset + kJSONScanBlockBytes <= size;
+      offset += kJSONScanBlockBytes) {
+    JSONScanMasks masks;
+    JSONScanBlock(data + offset, &masks);
+    Poco::UInt64 special = masks.Quotes
+      | (in_string ? masks.Backslashes : masks.Brackets);
+    if (special) {
+      return offset + JSONScanLowestBit(special);
+    }
+  }
+  for (; offset < size; offset++) {
+    const char c = data[offset];
+    if ('"' == c) {
+      break;
+    }
+    if (in_string ? '\\' == c
+        : ('{' == c || '}' == c || '[' == c || ']' == c)) {
+      break;
+    }
+  }
+  return offset;
+}
+
+bool JSONScanStructure(
+    const char *text, const std::size_t size,
+    std::vector<Poco::UInt32> *positions) {
+  // All ones while a string goes on from the block before
+  Poco::UInt64 in_string(0);
+  // The first byte of the block is escaped
+  Poco::UInt64 escape_first(0);
+  for (std::size_t offset = 0; offset < size;
+      offset += kJSONScanBlockBytes) {
+    JSONScanMasks masks;
+    if (offset + kJSONScanBlockBytes <= size) {
+      JSONScanBlock(text + offset, &masks);
+    } else {
+      char last[kJSONScanBlockBytes];
+      std::memset(last, 0, sizeof(last));
+      std::memcpy(last, text + offset, size - offset);
+      JSONScanBlock(last, &masks);
+    }
+
+    // A backslash escapes the byte after it, unless it's escaped
+    // itself. Backslashes are rare, they're looked at one by one.
+    Poco::UInt64 escaped = escape_first;
+    escape_first = 0;
+    Poco::UInt64 backslashes = masks.Backslashes;
+    while (backslashes) {
+      const unsigned int bit = JSONScanLowestBit(backslashes);
+      backslashes &= backslashes - 1;
+      if (escaped & (Poco::UInt64(1) << bit)) {
+        continue;
+      }
+      if (kJSONScanBlockBytes - 1 == bit) {
+        escape_first = 1;
+      } else {
+        escaped |= Poco::UInt64(1) << (bit + 1);
+      }
+    }
+
+    // Bits from an opening quote up to its closing one
+    const Poco::UInt64 quotes = masks.Quotes & ~escaped;
+    Poco::UInt64 strings = quotes;
+    strings ^= strings << 1;
+    strings ^= strings << 2;
+    strings ^= strings << 4;
+    strings ^= strings << 8;
+    strings ^= strings << 16;
+    strings ^= strings << 32;
+    strings ^= in_string;
+    in_string = (strings >> (kJSONScanBlockBytes - 1))
+      ? ~Poco::UInt64(0) : 0;
+
+    Poco::UInt64 structure =
+      ((masks.Brackets | masks.Separators) & ~strings) | quotes;
+    while (structure) {
+      positions->push_back(static_cast<Poco::UInt32>(
+        offset + JSONScanLowestBit(structure)));
+      structure &= structure - 1;
+    }
+  }
+  return !in_string;
+}
+
+}  // namespace kopsik
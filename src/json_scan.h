@@ -0,0 +1,56 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_JSON_SCAN_H_
+#define SRC_JSON_SCAN_H_
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define KOPSIK_JSON_SCAN_SSE2
+#endif
+
+#include <vector>
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // JSON text is looked at 64 bytes at a time, as one bit per byte for
+  // each kind of character that matters, so long strings and numbers
+  // are skipped over without looking at them byte by byte.
+  const std::size_t kJSONScanBlockBytes = 64;
+
+  // Bit i is byte i of the block
+  class JSONScanMasks {
+  public:
+    JSONScanMasks();
+
+    Poco::UInt64 Quotes;
+    Poco::UInt64 Backslashes;
+    // { } [ ]
+    Poco::UInt64 Brackets;
+    // : ,
+    Poco::UInt64 Separators;
+  };
+
+  void JSONScanBlock(const char *block, JSONScanMasks *masks);
+
+  unsigned int JSONScanLowestBit(const Poco::UInt64 mask);
+
+  // Bytes from the start that the JSON stream loader would only copy:
+  // up to a quote or backslash in a string, up to a quote or bracket
+  // outside of strings.
+  std::size_t JSONScanPlainBytes(const char *data,
+                                        const std::size_t size,
+                                        const bool in_string);
+
+  // Positions of the brackets, colons and commas outside of strings,
+  // and of the quotes around strings, in order. Each opening quote is
+  // followed by its closing one. Returns false if the text ends in the
+  // middle of a string.
+  bool JSONScanStructure(const char *text,
+                                const std::size_t size,
+                                std::vector<Poco::UInt32> *positions);
+
+}  // namespace kopsik
+
+#endif  // SRC_JSON_SCAN_H_
@@ -0,0 +1,91 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./json_writer.h"
+
+#include "Poco/NumberFormatter.h"
+
+namespace kopsik {
+
+void JSONWriter::BeginObject() {
+  separate();
+  buffer_ += '{';
+  first_ = true;
+}
+
+void JSONWriter::EndObject() {
+  buffer_ += '}';
+  first_ = false;
+}
+
+void JSONWriter::BeginArray() {
+  separate();
+  buffer_ += '[';
+  first_ = true;
+}
+
+void JSONWriter::EndArray() {
+  buffer_ += ']';
+  first_ = false;
+}
+
+void JSONWriter::Key(const std::string &key) {
+  separate();
+  appendString(key);
+  buffer_ += ':';
+  first_ = true;
+}
+
+void JSONWriter::String(const std::string &value) {
+  separate();
+  appendString(value);
+}
+
+void JSONWriter::String(const std::string &key, const std::string &value) {
+  Key(key);
+  String(value);
+}
+
+void JSONWriter::Int(const Poco::Int64 value) {
+  separate();
+  Poco::NumberFormatter::append(buffer_, value);
+}
+
+void JSONWriter::Int(const std::string &key, const Poco::Int64 value) {
+  Key(key);
+  Int(value);
+}
+
+void JSONWriter::Bool(const bool value) {
+  separate();
+  buffer_ += value ? "true" : "false";
+}
+
+void JSONWriter::Bool(const std::string &key, const bool value) {
+  Key(key);
+  Bool(value);
+}
+
+void JSONWriter::Raw(const std::string &json) {
+  separate();
+  buffer_ += json;
+}
+
+void JSONWriter::Raw(const std::string &key, const std::string &json) {
+  Key(key);
+  Raw(json);
+}
+
+void JSONWriter::separate() {
+  if (!first_) {
+    buffer_ += ',';
+  }
+  first_ = false;
+}
+
+void JSONWriter::appendString(const std::string &value) {
+  buffer_ += '"';
+  Formatter::AppendEscapedJSONString(value, &buffer_);
+  buffer_ += '"';
+}
+
+}  // namespace kopsik
@@ -0,0 +1,65 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_JSON_WRITER_H_
+#define SRC_JSON_WRITER_H_
+
+#include <string>
+
+#include "./formatter.h"
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Writes JSON straight into one growing buffer, for payloads that
+  // would otherwise be built as a libjson node tree first. Commas are
+  // placed by the writer, the caller only has to pair up the Begin and
+  // End calls. Strings are escaped as they are written.
+  class JSONWriter {
+  public:
+    JSONWriter() : first_(true) {}
+
+    void Reserve(const std::string::size_type size) { buffer_.reserve(size); }
+
+    const std::string &Buffer() const { return buffer_; }
+
+    // Empties the buffer once what was written has been sent on,
+    // writing may go on where it left off
+    void ClearBuffer() { buffer_.clear(); }
+
+    void BeginObject();
+    void EndObject();
+
+    void BeginArray();
+    void EndArray();
+
+    // Name of the object member whose value is written next
+    void Key(const std::string &key);
+
+    void String(const std::string &value);
+    void String(const std::string &key, const std::string &value);
+
+    void Int(const Poco::Int64 value);
+    void Int(const std::string &key, const Poco::Int64 value);
+
+    void Bool(const bool value);
+    void Bool(const std::string &key, const bool value);
+
+    // Value that's JSON already, like another writer's buffer
+    void Raw(const std::string &json);
+    void Raw(const std::string &key, const std::string &json);
+
+  private:
+    void separate();
+
+    void appendString(const std::string &value);
+
+    std::string buffer_;
+    // Nothing written yet in the current object or array,
+    // or a key was just written
+    bool first_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_JSON_WRITER_H_
@@ -2,11 +2,16 @@
 
 // No exceptions should be thrown from this library.
 
+#include <algorithm>
 #include <cstring>
+#include <map>
 #include <set>
+#include <sstream>
+#include <vector>
 
 #include "./kopsik_api.h"
 #include "./kopsik_api_private.h"
+#include "./async_log_channel.h"
 #include "./database.h"
 #include "./user.h"
 #include "./https_client.h"
@@ -19,16 +24,31 @@
 #include "./context.h"
 #include "./formatter.h"
 #include "./feedback.h"
+#include "./log.h"
+#include "./binary_log_channel.h"
+#include "./api_watchdog.h"
+#include "./instrumented_lock.h"
+#include "./ipc_service.h"
+#include "./metrics.h"
+#include "./traffic_recorder.h"
+#include "./trace.h"
 
 #include "Poco/Bugcheck.h"
+#include "Poco/FileStream.h"
 #include "Poco/Path.h"
 #include "Poco/Logger.h"
 #include "Poco/SimpleFileChannel.h"
 #include "Poco/FormattingChannel.h"
 #include "Poco/PatternFormatter.h"
 
+static kopsik::LogComponent log_kopsik_api = { "kopsik_api", 0 };
+
+// The channel of kopsik_set_log_path, which stays the text log when
+// trace logging goes elsewhere
+static Poco::Channel *text_log_channel = 0;
+
 inline Poco::Logger &logger() {
-  return Poco::Logger::get("kopsik_api");
+  return kopsik::ComponentLogger(&log_kopsik_api);
 }
 
 inline Poco::Logger &rootLogger() {
@@ -40,8 +60,14 @@ inline kopsik::Context *app(void *context) {
   return reinterpret_cast<kopsik::Context *>(context);
 }
 
+// IPC services by the context they serve
+std::map<void *, kopsik::IpcServer *> ipc_servers;
+Poco::FastMutex ipc_servers_m;
+
 int kopsik_is_networking_error(
     const char *error) {
+  KOPSIK_API_CALL("error=" << kopsik::ApiArg(error));
+
   std::string value(error);
   if (value.find("Host not found") != std::string::npos) {
     return 1;
@@ -68,6 +94,9 @@ int kopsik_is_networking_error(
   if (value.find("Network is down") != std::string::npos) {
     return 1;
   }
+  if (value.find(kopsik::kRequestOffline) != std::string::npos) {
+    return 1;
+  }
   return 0;
 }
 
@@ -75,6 +104,8 @@ int kopsik_is_networking_error(
 
 void kopsik_view_item_clear(
     KopsikViewItem *item) {
+  KOPSIK_API_CALL("");
+
   if (!item) {
     return;
   }
@@ -96,6 +127,32 @@ void kopsik_view_item_clear(
 
 // Context API.
 
+// Passes how the save of an edit went on to the callback
+class ResultCallbackListener : public kopsik::SaveListener {
+ public:
+  explicit ResultCallbackListener(KopsikResultCallback callback)
+    : callback_(callback) {}
+
+  void Saved(const kopsik::error err) {
+    if (err != kopsik::noError) {
+      callback_(KOPSIK_API_FAILURE, err.c_str());
+      return;
+    }
+    callback_(KOPSIK_API_SUCCESS, 0);
+  }
+
+ private:
+  KopsikResultCallback callback_;
+};
+
+// Without a callback the edit is saved as before
+kopsik::SaveListener *saved_by(KopsikResultCallback callback) {
+  if (!callback) {
+    return 0;
+  }
+  return new ResultCallbackListener(callback);
+}
+
 KopsikViewItemChangeCallback user_data_change_callback_ = 0;
 
 void export_on_change_callback(
@@ -108,6 +165,55 @@ void export_on_change_callback(
   model_change_clear(change);
 }
 
+KopsikModelChangesCallback user_data_changes_callback_ = 0;
+
+void export_changes(
+    const std::vector<kopsik::ModelChange> &mc,
+    KopsikModelChangesCallback callback) {
+  std::vector<KopsikModelChange> changes(mc.size());
+  for (std::size_t i = 0; i < mc.size(); i++) {
+    changes[i].ModelType = 0;
+    changes[i].ChangeType = 0;
+    changes[i].ModelID = 0;
+    changes[i].GUID = 0;
+    model_change_to_change_item(mc[i], &changes[i]);
+  }
+  callback(&changes[0], static_cast<unsigned int>(changes.size()));
+  for (std::size_t i = 0; i < changes.size(); i++) {
+    model_change_clear_strings(&changes[i]);
+  }
+}
+
+void export_on_changes_callback(
+    const std::vector<kopsik::ModelChange> &mc) {
+  poco_assert(user_data_changes_callback_);
+  export_changes(mc, user_data_changes_callback_);
+}
+
+// Passes the changes of a subscription on to its callback
+class ChangesCallbackListener : public kopsik::ModelChangeListener {
+ public:
+  explicit ChangesCallbackListener(KopsikModelChangesCallback callback)
+    : callback_(callback) {}
+
+  void Changed(const std::vector<kopsik::ModelChange> &changes) {
+    export_changes(changes, callback_);
+  }
+
+ private:
+  KopsikModelChangesCallback callback_;
+};
+
+KopsikIdleCallback user_data_idle_callback_ = 0;
+
+void export_on_idle_callback(
+    const Poco::UInt64 idle_started,
+    const Poco::UInt64 idle_ended) {
+  poco_assert(user_data_idle_callback_);
+  user_data_idle_callback_(static_cast<unsigned int>(idle_started),
+                           static_cast<unsigned int>(idle_ended));
+}
+
 KopsikErrorCallback user_data_error_callback_ = 0;
 
 void export_on_error_callback(
@@ -147,14 +253,21 @@ void *kopsik_context_init(
     KopsikErrorCallback error_callback,
     KopsikCheckUpdateCallback check_updates_callback,
     KopsikOnOnlineCallback online_callback) {
+  KOPSIK_API_CALL("app_name=" << kopsik::ApiArg(app_name)
+    << " app_version=" << kopsik::ApiArg(app_version));
+
   poco_assert(app_name);
   poco_assert(app_version);
 
+  kopsik::MetricsTimer timer("startup.context_init");
+
   kopsik::Context *ctx =
     new kopsik::Context(std::string(app_name), std::string(app_version));
 
   user_data_change_callback_ = change_callback;
-  ctx->SetModelChangeCallback(export_on_change_callback);
+  if (change_callback) {
+    ctx->SetModelChangeCallback(export_on_change_callback);
+  }
 
   user_data_error_callback_ = error_callback;
   ctx->SetOnErrorCallback(export_on_error_callback);
@@ -172,16 +285,74 @@ void *kopsik_context_init(
 }
 
 void kopsik_context_shutdown(void *context) {
+  KOPSIK_API_CALL("");
+
   app(context)->Shutdown();
 }
 
+void kopsik_set_model_changes_callback(
+    void *context,
+    KopsikModelChangesCallback changes_callback) {
+  KOPSIK_API_CALL("");
+
+  user_data_changes_callback_ = changes_callback;
+  if (changes_callback) {
+    app(context)->SetModelChangesCallback(export_on_changes_callback);
+  } else {
+    app(context)->SetModelChangesCallback(0);
+  }
+}
+
+unsigned int kopsik_subscribe_model_changes(
+    void *context,
+    const unsigned int models,
+    const unsigned int changes,
+    const int coalesce,
+    KopsikModelChangesCallback changes_callback) {
+  KOPSIK_API_CALL("models=" << models << " changes=" << changes
+    << " coalesce=" << coalesce);
+
+  poco_assert(changes_callback);
+  return app(context)->SubscribeModelChanges(
+    static_cast<int>(models),
+    static_cast<int>(changes),
+    coalesce != 0,
+    new ChangesCallbackListener(changes_callback));
+}
+
+void kopsik_unsubscribe_model_changes(
+    void *context,
+    const unsigned int subscription) {
+  KOPSIK_API_CALL("subscription=" << subscription);
+
+  app(context)->UnsubscribeModelChanges(subscription);
+}
+
+void kopsik_set_idle_callback(
+    void *context,
+    KopsikIdleCallback idle_callback) {
+  KOPSIK_API_CALL("");
+
+  user_data_idle_callback_ = idle_callback;
+  if (idle_callback) {
+    app(context)->SetIdleCallback(export_on_idle_callback);
+  } else {
+    app(context)->SetIdleCallback(0);
+  }
+}
+
 void kopsik_context_clear(void *context) {
+  KOPSIK_API_CALL("");
+
+  kopsik_ipc_stop(context);
   delete app(context);
 }
 
 // Configuration API.
 
 KopsikSettings *kopsik_settings_init() {
+  KOPSIK_API_CALL("");
+
   KopsikSettings *settings = new KopsikSettings();
   settings->UseProxy = 0;
   settings->ProxyHost = 0;
@@ -194,6 +365,8 @@ KopsikSettings *kopsik_settings_init() {
 
 void kopsik_settings_clear(
     KopsikSettings *settings) {
+  KOPSIK_API_CALL("");
+
   if (settings->ProxyHost) {
     free(settings->ProxyHost);
     settings->ProxyHost = 0;
@@ -214,6 +387,8 @@ kopsik_api_result kopsik_get_settings(
     char *errmsg,
     const unsigned int errlen,
     KopsikSettings *settings) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -267,6 +442,11 @@ kopsik_api_result kopsik_set_settings(
     const char *proxy_username,
     const char *proxy_password,
     const int use_idle_detection) {
+  KOPSIK_API_CALL("use_proxy=" << use_proxy
+    << " proxy_host=" << kopsik::ApiArg(proxy_host)
+    << " proxy_port=" << proxy_port
+    << " use_idle_detection=" << use_idle_detection);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -303,6 +483,8 @@ kopsik_api_result kopsik_configure_proxy(
     void *context,
     char *errmsg,
     const unsigned int errlen) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -330,13 +512,13 @@ kopsik_api_result kopsik_set_db_path(
     char *errmsg,
     const unsigned int errlen,
     const char *path) {
+  KOPSIK_API_CALL("path=" << kopsik::ApiArg(path));
+
   kopsik::error err = kopsik::noError;
   try {
     poco_assert(path);
 
-    std::stringstream ss;
-    ss << "kopsik_set_db_path path=" << path;
-    logger().debug(ss.str());
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_set_db_path path=" << path);
 
     app(context)->SetDBPath(std::string(path));
   } catch(const Poco::Exception& exc) {
@@ -353,7 +535,103 @@ kopsik_api_result kopsik_set_db_path(
   return KOPSIK_API_SUCCESS;
 }
 
+kopsik_api_result kopsik_set_db_tuning(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const int synchronous,
+    const int temp_store,
+    const unsigned int cache_size_kib,
+    const unsigned int mmap_size_mib,
+    const unsigned int page_size) {
+  KOPSIK_API_CALL("synchronous=" << synchronous
+    << " temp_store=" << temp_store << " cache_size_kib=" << cache_size_kib
+    << " mmap_size_mib=" << mmap_size_mib << " page_size=" << page_size);
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+
+    kopsik::DatabaseTuning tuning;
+    tuning.synchronous = synchronous;
+    tuning.temp_store = temp_store;
+    tuning.cache_size_kib = cache_size_kib;
+    tuning.mmap_size_bytes = Poco::Int64(mmap_size_mib) * 1024 * 1024;
+    tuning.page_size = page_size;
+
+    kopsik::error err = app(context)->SetDBTuning(tuning);
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+void kopsik_set_time_entry_archive_days(
+    void *context,
+    const unsigned int days) {
+  KOPSIK_API_CALL("days=" << days);
+
+  app(context)->SetTimeEntryArchiveDays(days);
+}
+
+void kopsik_set_timeline_blocks(
+    void *context,
+    const int on) {
+  KOPSIK_API_CALL("on=" << on);
+
+  app(context)->SetTimelineBlocks(on != 0);
+}
+
+void kopsik_set_timeline_over_websocket(
+    void *context,
+    const int on) {
+  KOPSIK_API_CALL("on=" << on);
+
+  app(context)->SetTimelineOverWebSocket(on != 0);
+}
+
+static std::vector<std::string> pattern_lines(const char *text) {
+  std::vector<std::string> result;
+  if (!text) {
+    return result;
+  }
+  std::stringstream ss(text);
+  std::string line;
+  while (std::getline(ss, line)) {
+    if (!line.empty() && '\r' == line[line.size() - 1]) {
+      line.erase(line.size() - 1);
+    }
+    result.push_back(line);
+  }
+  return result;
+}
+
+void kopsik_set_timeline_title_filters(
+    void *context,
+    const char *redact,
+    const char *drop) {
+  std::vector<std::string> redact_patterns = pattern_lines(redact);
+  std::vector<std::string> drop_patterns = pattern_lines(drop);
+  KOPSIK_API_CALL("redact=" << redact_patterns.size()
+    << " drop=" << drop_patterns.size());
+
+  app(context)->SetTimelineTitleFilters(redact_patterns, drop_patterns);
+}
+
 void kopsik_set_log_path(const char *path) {
+  KOPSIK_API_CALL("path=" << kopsik::ApiArg(path));
+
   poco_assert(path);
 
   Poco::AutoPtr<Poco::SimpleFileChannel> simpleFileChannel(
@@ -366,19 +644,70 @@ void kopsik_set_log_path(const char *path) {
         new Poco::PatternFormatter("%Y-%m-%d %H:%M:%S.%i [%P %I]:%s:%q:%t")));
   formattingChannel->setChannel(simpleFileChannel);
 
-  rootLogger().setChannel(formattingChannel);
+  // Written on a thread of its own, formatting included
+  Poco::AutoPtr<kopsik::AsyncLogChannel> asyncChannel(
+    new kopsik::AsyncLogChannel(formattingChannel.get(),
+                                kopsik::kLogQueueMax));
+
+  rootLogger().setChannel(asyncChannel);
   rootLogger().setLevel(Poco::Message::PRIO_DEBUG);
+  text_log_channel = asyncChannel.get();
+}
+
+void kopsik_set_trace_log_path(const char *path) {
+  KOPSIK_API_CALL("path=" << kopsik::ApiArg(path));
+
+  poco_assert(path);
+
+  // Set again, the trace log replaces the one before
+  poco_assert(text_log_channel);
+
+  Poco::AutoPtr<kopsik::BinaryLogChannel> binary(
+    new kopsik::BinaryLogChannel(path));
+  Poco::AutoPtr<kopsik::PriorityRouteChannel> channel(
+    new kopsik::PriorityRouteChannel(text_log_channel, binary.get()));
+
+  // Loggers handed out already have their channel and level copied
+  Poco::Logger::setChannel("", channel);
+  Poco::Logger::setLevel("", Poco::Message::PRIO_TRACE);
 }
 
 void kopsik_set_log_level(const char *level) {
+  KOPSIK_API_CALL("level=" << kopsik::ApiArg(level));
+
   poco_assert(level);
 
   rootLogger().setLevel(level);
 }
 
+kopsik_api_result kopsik_set_traffic_recording_path(
+    char *errmsg,
+    const unsigned int errlen,
+    const char *path) {
+  KOPSIK_API_CALL("path=" << kopsik::ApiArg(path));
+
+  poco_assert(errmsg);
+  poco_assert(errlen);
+  poco_assert(path);
+
+  kopsik::TrafficRecorder &recorder = kopsik::TrafficRecorder::Instance();
+  if (!strlen(path)) {
+    recorder.Stop();
+    return KOPSIK_API_SUCCESS;
+  }
+  kopsik::error err = recorder.Start(path);
+  if (err != kopsik::noError) {
+    strncpy(errmsg, err.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
 void kopsik_set_api_url(
     void *context,
     const char *api_url) {
+  KOPSIK_API_CALL("api_url=" << kopsik::ApiArg(api_url));
+
   poco_assert(api_url);
 
   app(context)->SetAPIURL(std::string(api_url));
@@ -387,6 +716,8 @@ void kopsik_set_api_url(
 void kopsik_set_websocket_url(
     void *context,
     const char *websocket_url) {
+  KOPSIK_API_CALL("websocket_url=" << kopsik::ApiArg(websocket_url));
+
   poco_assert(websocket_url);
 
   app(context)->SetWebSocketClientURL(websocket_url);
@@ -395,6 +726,8 @@ void kopsik_set_websocket_url(
 // User API.
 
 KopsikUser *kopsik_user_init() {
+  KOPSIK_API_CALL("");
+
   KopsikUser *user = new KopsikUser();
   user->ID = 0;
   user->Fullname = 0;
@@ -403,6 +736,8 @@ KopsikUser *kopsik_user_init() {
 
 void kopsik_user_clear(
     KopsikUser *user) {
+  KOPSIK_API_CALL("");
+
   poco_assert(user);
   user->ID = 0;
   if (user->Fullname) {
@@ -417,6 +752,8 @@ kopsik_api_result kopsik_current_user(
     char *errmsg,
     const unsigned int errlen,
     KopsikUser *out_user) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -458,14 +795,14 @@ kopsik_api_result kopsik_set_api_token(
     char *errmsg,
     const unsigned int errlen,
     const char *api_token) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
     poco_assert(api_token);
 
-    std::stringstream ss;
-    ss << "kopsik_set_api_token api_token=" << api_token;
-    logger().debug(ss.str());
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_set_api_token api_token=" << api_token);
 
     kopsik::error err = app(context)->SetCurrentAPIToken(api_token);
     if (err != kopsik::noError) {
@@ -491,6 +828,8 @@ kopsik_api_result kopsik_get_api_token(
     const unsigned int errlen,
     char *str,
     const unsigned int max_strlen) {
+  KOPSIK_API_CALL("max_strlen=" << max_strlen);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -554,15 +893,15 @@ kopsik_api_result kopsik_login(
     const unsigned int errlen,
     const char *in_email,
     const char *in_password) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
     poco_assert(in_email);
     poco_assert(in_password);
 
-    std::stringstream ss;
-    ss << "kopik_login email=" << in_email;
-    logger().debug(ss.str());
+    KOPSIK_LOG_DEBUG(logger(), "kopik_login email=" << in_email);
 
     std::string email(in_email);
     std::string password(in_password);
@@ -593,10 +932,35 @@ kopsik_api_result kopsik_login(
   return KOPSIK_API_SUCCESS;
 }
 
+void kopsik_set_progressive_login(
+    void *context,
+    const int on) {
+  KOPSIK_API_CALL("on=" << on);
+
+  app(context)->SetProgressiveLogin(on != 0);
+}
+
+void kopsik_set_per_workspace_sync(
+    void *context,
+    const int on) {
+  KOPSIK_API_CALL("on=" << on);
+
+  app(context)->SetPerWorkspaceSync(on != 0);
+}
+
+int kopsik_login_sync_pending(
+    void *context) {
+  KOPSIK_API_CALL("");
+
+  return app(context)->LoginSyncPending() ? 1 : 0;
+}
+
 kopsik_api_result kopsik_logout(
     void *context,
     char *errmsg,
     const unsigned int errlen) {
+  KOPSIK_API_CALL("");
+
   poco_assert(errmsg);
   poco_assert(errlen);
 
@@ -615,6 +979,8 @@ kopsik_api_result kopsik_clear_cache(
     void *context,
     char *errmsg,
     const unsigned int errlen) {
+  KOPSIK_API_CALL("");
+
   poco_assert(errmsg);
   poco_assert(errlen);
 
@@ -628,11 +994,32 @@ kopsik_api_result kopsik_clear_cache(
   return KOPSIK_API_SUCCESS;
 }
 
+kopsik_api_result kopsik_save(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen) {
+  KOPSIK_API_CALL("");
+
+  poco_assert(errmsg);
+  poco_assert(errlen);
+
+  logger().debug("kopsik_save");
+
+  kopsik::error err = app(context)->Save();
+  if (err != kopsik::noError) {
+    strncpy(errmsg, err.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
 kopsik_api_result kopsik_user_has_premium_workspaces(
     void *context,
     char *errmsg,
     const unsigned int errlen,
     unsigned int *has_premium_workspaces) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -660,6 +1047,8 @@ kopsik_api_result kopsik_user_is_logged_in(
     char *errmsg,
     const unsigned int errlen,
     unsigned int *is_logged_in) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -688,6 +1077,8 @@ kopsik_api_result kopsik_users_default_wid(
     char *errmsg,
     const unsigned int errlen,
     unsigned int *default_wid) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -714,6 +1105,8 @@ kopsik_api_result kopsik_pushable_models(
     char *errmsg,
     const unsigned int errlen,
     KopsikPushableModelStats *stats) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -744,12 +1137,33 @@ kopsik_api_result kopsik_pushable_models(
 }
 
 void kopsik_sync(void *context) {
+  KOPSIK_API_CALL("");
+
   logger().debug("kopsik_sync");
   app(context)->FullSync();
 }
 
+void kopsik_set_online(
+    void *context,
+    const int online) {
+  KOPSIK_API_CALL("online=" << online);
+
+  logger().debug("kopsik_set_online");
+  app(context)->SetOnline(online != 0);
+}
+
+void kopsik_set_on_battery(
+    void *context,
+    const int on_battery) {
+  KOPSIK_API_CALL("on_battery=" << on_battery);
+
+  app(context)->SetOnBattery(on_battery != 0);
+}
+
 void kopsik_autocomplete_item_clear(
     KopsikAutocompleteItem *item) {
+  KOPSIK_API_CALL("");
+
   if (!item) {
     return;
   }
@@ -786,6 +1200,10 @@ kopsik_api_result kopsik_autocomplete_items(
     const unsigned int include_time_entries,
     const unsigned int include_tasks,
     const unsigned int include_projects) {
+  KOPSIK_API_CALL("include_time_entries=" << include_time_entries
+    << " include_tasks=" << include_tasks
+    << " include_projects=" << include_projects);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -795,36 +1213,30 @@ kopsik_api_result kopsik_autocomplete_items(
 
     *first = 0;
 
-    std::vector<kopsik::AutocompleteItem> items;
-    app(context)->AutocompleteItems(&items,
-                                    include_time_entries,
-                                    include_tasks,
-                                    include_projects);
+    Poco::AutoPtr<kopsik::UserSnapshot> snapshot = app(context)->Snapshot();
+    if (!snapshot) {
+      return KOPSIK_API_SUCCESS;
+    }
 
+    const std::vector<kopsik::AutocompleteItem> &items =
+      snapshot->Autocomplete->Items();
     KopsikAutocompleteItem *previous = 0;
-    for (std::vector<kopsik::AutocompleteItem>::iterator it =
+    for (std::vector<kopsik::AutocompleteItem>::const_iterator it =
         items.begin();
         it != items.end();
         it++) {
-      kopsik::AutocompleteItem &item = *it;
-
-      KopsikAutocompleteItem *autocomplete_item = autocomplete_item_init();
-      if (!*first) {
-        *first = autocomplete_item;
+      if ((it->IsTimeEntry() && !include_time_entries)
+          || (it->IsTask() && !include_tasks)
+          || (it->IsProject() && !include_projects)) {
+        continue;
       }
+      KopsikAutocompleteItem *autocomplete_item =
+        autocomplete_item_to_view_item(*it);
       if (previous) {
         previous->Next = autocomplete_item;
+      } else {
+        *first = autocomplete_item;
       }
-
-      autocomplete_item->Description = strdup(item.Description.c_str());
-      autocomplete_item->Text = strdup(item.Text.c_str());
-      autocomplete_item->ProjectAndTaskLabel =
-        strdup(item.ProjectAndTaskLabel.c_str());
-      autocomplete_item->ProjectColor = strdup(item.ProjectColor.c_str());
-      autocomplete_item->ProjectID = static_cast<unsigned int>(item.ProjectID);
-      autocomplete_item->TaskID = static_cast<unsigned int>(item.TaskID);
-      autocomplete_item->Type = static_cast<unsigned int>(item.Type);
-
       previous = autocomplete_item;
     }
   } catch(const Poco::Exception& exc) {
@@ -840,68 +1252,358 @@ kopsik_api_result kopsik_autocomplete_items(
   return KOPSIK_API_SUCCESS;
 }
 
-// Tags
+KopsikAutocompleteItemArray *kopsik_autocomplete_item_array_init() {
+  KOPSIK_API_CALL("");
 
-kopsik_api_result kopsik_tags(
-    void *context,
-    char *errmsg,
-    const unsigned int errlen,
-    KopsikViewItem **first) {
-  poco_assert(errmsg);
-  poco_assert(errlen);
-  poco_assert(first);
-  poco_assert(!*first);
+  KopsikAutocompleteItemArray *array = new KopsikAutocompleteItemArray();
+  array->Items = 0;
+  array->Length = 0;
+  array->Snapshot = 0;
+  return array;
+}
 
-  std::vector<std::string> tags = app(context)->Tags();
+void kopsik_autocomplete_item_array_clear(
+    KopsikAutocompleteItemArray *array) {
+  KOPSIK_API_CALL("");
 
-  *first = 0;
-  for (std::vector<std::string>::const_iterator it = tags.begin();
-       it != tags.end();
-       it++) {
-    std::string name = *it;
-    KopsikViewItem *item = tag_to_view_item(name);
-    item->Next = *first;
-    *first = item;
+  if (!array) {
+    return;
   }
-
-  return KOPSIK_API_SUCCESS;
+  // Items and their strings were allocated as one block
+  if (array->Items) {
+    free(array->Items);
+    array->Items = 0;
+  }
+  // Borrowed strings were in the snapshot
+  if (array->Snapshot) {
+    static_cast<kopsik::UserSnapshot *>(array->Snapshot)->release();
+    array->Snapshot = 0;
+  }
+  delete array;
 }
 
-// Workpaces
-
-kopsik_api_result kopsik_workspaces(
+// Fills the array with copies of the strings, or with strings
+// borrowed from the snapshot, which the array then holds on to
+static kopsik_api_result autocomplete_item_array(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    KopsikViewItem **first) {
-  poco_assert(errmsg);
-  poco_assert(errlen);
-  poco_assert(first);
-  poco_assert(!*first);
+    KopsikAutocompleteItemArray *array,
+    const unsigned int include_time_entries,
+    const unsigned int include_tasks,
+    const unsigned int include_projects,
+    const bool borrow) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(array);
+    poco_assert(!array->Snapshot);
 
-  std::vector<kopsik::Workspace *> workspaces = app(context)->Workspaces();
+    array->Length = 0;
 
-  *first = 0;
-  for (std::vector<kopsik::Workspace *>::const_iterator it =
-        workspaces.begin();
-      it != workspaces.end();
-      it++) {
-    KopsikViewItem *item = workspace_to_view_item(*it);
-    item->Next = *first;
-    *first = item;
-  }
+    Poco::AutoPtr<kopsik::UserSnapshot> snapshot = app(context)->Snapshot();
+    if (!snapshot) {
+      return KOPSIK_API_SUCCESS;
+    }
 
-  return KOPSIK_API_SUCCESS;
-}
+    const std::vector<kopsik::AutocompleteItem> &items =
+      snapshot->Autocomplete->Items();
+    std::vector<const kopsik::AutocompleteItem *> wanted;
+    wanted.reserve(items.size());
+    std::size_t strings_size = 0;
+    for (std::vector<kopsik::AutocompleteItem>::const_iterator it =
+        items.begin();
+        it != items.end();
+        it++) {
+      if ((it->IsTimeEntry() && !include_time_entries)
+          || (it->IsTask() && !include_tasks)
+          || (it->IsProject() && !include_projects)) {
+        continue;
+      }
+      wanted.push_back(&*it);
+      if (!borrow) {
+        strings_size += autocomplete_item_arena_size(*it);
+      }
+    }
+    if (wanted.empty()) {
+      return KOPSIK_API_SUCCESS;
+    }
 
-// Clients
+    std::size_t items_size = wanted.size() * sizeof(KopsikAutocompleteItem);
+    std::size_t size = items_size + strings_size;
+    char *block = static_cast<char *>(malloc(size));
+    if (!block) {
+      strncpy(errmsg, "Out of memory", errlen);
+      return KOPSIK_API_FAILURE;
+    }
+
+    KopsikAutocompleteItem *view_items =
+      reinterpret_cast<KopsikAutocompleteItem *>(block);
+    char *arena = block + items_size;
+    for (std::size_t i = 0; i < wanted.size(); i++) {
+      if (borrow) {
+        autocomplete_item_to_borrowed_view_item(*wanted[i], &view_items[i]);
+      } else {
+        autocomplete_item_to_arena_view_item(*wanted[i], &view_items[i],
+                                             &arena);
+      }
+      if (i > 0) {
+        view_items[i - 1].Next = &view_items[i];
+      }
+    }
+    poco_assert(arena == block + size);
+
+    array->Items = view_items;
+    array->Length = static_cast<unsigned int>(wanted.size());
+    if (borrow) {
+      array->Snapshot = snapshot.duplicate();
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_autocomplete_item_array(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikAutocompleteItemArray *array,
+    const unsigned int include_time_entries,
+    const unsigned int include_tasks,
+    const unsigned int include_projects) {
+  KOPSIK_API_CALL("include_time_entries=" << include_time_entries
+    << " include_tasks=" << include_tasks
+    << " include_projects=" << include_projects);
+
+  logger().debug("kopsik_autocomplete_item_array");
+
+  return autocomplete_item_array(context, errmsg, errlen, array,
+                                 include_time_entries, include_tasks,
+                                 include_projects, false);
+}
+
+kopsik_api_result kopsik_autocomplete_item_array_borrowed(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikAutocompleteItemArray *array,
+    const unsigned int include_time_entries,
+    const unsigned int include_tasks,
+    const unsigned int include_projects) {
+  KOPSIK_API_CALL("include_time_entries=" << include_time_entries
+    << " include_tasks=" << include_tasks
+    << " include_projects=" << include_projects);
+
+  logger().debug("kopsik_autocomplete_item_array_borrowed");
+
+  return autocomplete_item_array(context, errmsg, errlen, array,
+                                 include_time_entries, include_tasks,
+                                 include_projects, true);
+}
+
+class AutocompleteQueryCallbackListener
+    : public kopsik::AutocompleteQueryListener {
+ public:
+  explicit AutocompleteQueryCallbackListener(
+    KopsikAutocompleteQueryCallback callback)
+    : callback_(callback) {}
+
+  void Answered(
+      const Poco::UInt64 query_id,
+      const std::vector<kopsik::AutocompleteItem> &items) {
+    KopsikAutocompleteItem *first = 0;
+    KopsikAutocompleteItem *previous = 0;
+    for (std::vector<kopsik::AutocompleteItem>::const_iterator it =
+          items.begin();
+        it != items.end();
+        it++) {
+      KopsikAutocompleteItem *autocomplete_item =
+        autocomplete_item_to_view_item(*it);
+      if (previous) {
+        previous->Next = autocomplete_item;
+      } else {
+        first = autocomplete_item;
+      }
+      previous = autocomplete_item;
+    }
+    callback_(static_cast<unsigned int>(query_id), first);
+    kopsik_autocomplete_item_clear(first);
+  }
+
+ private:
+  KopsikAutocompleteQueryCallback callback_;
+};
+
+unsigned int kopsik_autocomplete_query(
+    void *context,
+    const char *typed,
+    const unsigned int limit,
+    const unsigned int include_time_entries,
+    const unsigned int include_tasks,
+    const unsigned int include_projects,
+    KopsikAutocompleteQueryCallback callback) {
+  KOPSIK_API_CALL("typed=" << kopsik::ApiPrivateArg(typed)
+    << " limit=" << limit << " include_time_entries=" << include_time_entries
+    << " include_tasks=" << include_tasks
+    << " include_projects=" << include_projects);
+
+  poco_assert(typed);
+  poco_assert(callback);
+
+  return static_cast<unsigned int>(app(context)->QueryAutocomplete(
+    typed, limit,
+    include_time_entries != 0,
+    include_tasks != 0,
+    include_projects != 0,
+    new AutocompleteQueryCallbackListener(callback)));
+}
+
+kopsik_api_result kopsik_autocomplete_items_matching(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikAutocompleteItem **first,
+    const char *typed,
+    const unsigned int limit,
+    const unsigned int include_time_entries,
+    const unsigned int include_tasks,
+    const unsigned int include_projects) {
+  KOPSIK_API_CALL("typed=" << kopsik::ApiPrivateArg(typed)
+    << " limit=" << limit << " include_time_entries=" << include_time_entries
+    << " include_tasks=" << include_tasks
+    << " include_projects=" << include_projects);
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(first);
+    poco_assert(typed);
+
+    logger().debug("kopsik_autocomplete_items_matching");
+
+    *first = 0;
+
+    Poco::AutoPtr<kopsik::UserSnapshot> snapshot = app(context)->Snapshot();
+    if (!snapshot) {
+      return KOPSIK_API_SUCCESS;
+    }
+
+    std::vector<std::size_t> found;
+    snapshot->Autocomplete->Find(typed, limit,
+                                 include_time_entries,
+                                 include_tasks,
+                                 include_projects,
+                                 &found);
+
+    const std::vector<kopsik::AutocompleteItem> &items =
+      snapshot->Autocomplete->Items();
+    KopsikAutocompleteItem *previous = 0;
+    for (std::vector<std::size_t>::const_iterator it = found.begin();
+        it != found.end();
+        it++) {
+      KopsikAutocompleteItem *autocomplete_item =
+        autocomplete_item_to_view_item(items[*it]);
+      if (previous) {
+        previous->Next = autocomplete_item;
+      } else {
+        *first = autocomplete_item;
+      }
+      previous = autocomplete_item;
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+// Tags
+
+kopsik_api_result kopsik_tags(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikViewItem **first) {
+  KOPSIK_API_CALL("");
+
+  poco_assert(errmsg);
+  poco_assert(errlen);
+  poco_assert(first);
+  poco_assert(!*first);
+
+  *first = 0;
+
+  Poco::AutoPtr<kopsik::UserSnapshot> snapshot = app(context)->Snapshot();
+  if (!snapshot) {
+    return KOPSIK_API_SUCCESS;
+  }
+
+  const std::vector<std::string> &tags = snapshot->Tags;
+  for (std::vector<std::string>::const_iterator it = tags.begin();
+       it != tags.end();
+       it++) {
+    std::string name = *it;
+    KopsikViewItem *item = tag_to_view_item(name);
+    item->Next = *first;
+    *first = item;
+  }
+
+  return KOPSIK_API_SUCCESS;
+}
+
+// Workpaces
+
+kopsik_api_result kopsik_workspaces(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikViewItem **first) {
+  KOPSIK_API_CALL("");
+
+  poco_assert(errmsg);
+  poco_assert(errlen);
+  poco_assert(first);
+  poco_assert(!*first);
+
+  std::vector<kopsik::Workspace *> workspaces = app(context)->Workspaces();
+
+  *first = 0;
+  for (std::vector<kopsik::Workspace *>::const_iterator it =
+        workspaces.begin();
+      it != workspaces.end();
+      it++) {
+    KopsikViewItem *item = workspace_to_view_item(*it);
+    item->Next = *first;
+    *first = item;
+  }
+
+  return KOPSIK_API_SUCCESS;
+}
+
+// Clients
+
+kopsik_api_result kopsik_clients(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const unsigned int workspace_id,
+    KopsikViewItem **first) {
+  KOPSIK_API_CALL("workspace_id=" << workspace_id);
 
-kopsik_api_result kopsik_clients(
-    void *context,
-    char *errmsg,
-    const unsigned int errlen,
-    const unsigned int workspace_id,
-    KopsikViewItem **first) {
   poco_assert(errmsg);
   poco_assert(errlen);
   poco_assert(first);
@@ -931,6 +1633,10 @@ kopsik_api_result kopsik_add_project(
     const unsigned int client_id,
     const char *project_name,
     KopsikViewItem **resulting_project) {
+  KOPSIK_API_CALL("workspace_id=" << workspace_id
+    << " client_id=" << client_id
+    << " project_name=" << kopsik::ApiPrivateArg(project_name));
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -965,6 +1671,8 @@ kopsik_api_result kopsik_add_project(
 // Time entries view API
 
 KopsikTimeEntryViewItem *kopsik_time_entry_view_item_init() {
+  KOPSIK_API_CALL("");
+
   KopsikTimeEntryViewItem *item = new KopsikTimeEntryViewItem();
   item->DurationInSeconds = 0;
   item->Description = 0;
@@ -988,6 +1696,8 @@ KopsikTimeEntryViewItem *kopsik_time_entry_view_item_init() {
 
 void kopsik_time_entry_view_item_clear(
     KopsikTimeEntryViewItem *item) {
+  KOPSIK_API_CALL("");
+
   if (!item) {
     return;
   }
@@ -1036,6 +1746,9 @@ void kopsik_format_duration_in_seconds_hhmmss(
     const int duration_in_seconds,
     char *out_str,
     const unsigned int max_strlen) {
+  KOPSIK_API_CALL("duration_in_seconds=" << duration_in_seconds
+    << " max_strlen=" << max_strlen);
+
   poco_assert(out_str);
   poco_assert(max_strlen);
   std::string formatted =
@@ -1048,6 +1761,9 @@ void kopsik_format_duration_in_seconds_hhmm(
     const int type,
     char *out_str,
     const unsigned int max_strlen) {
+  KOPSIK_API_CALL("duration_in_seconds=" << duration_in_seconds
+    << " type=" << type << " max_strlen=" << max_strlen);
+
   poco_assert(out_str);
   poco_assert(max_strlen);
   std::string formatted = kopsik::Formatter::FormatDurationInSecondsHHMM(
@@ -1055,7 +1771,7 @@ void kopsik_format_duration_in_seconds_hhmm(
   strncpy(out_str, formatted.c_str(), max_strlen);
 }
 
-kopsik_api_result kopsik_start(
+static kopsik_api_result start_time_entry(
     void *context,
     char *errmsg,
     const unsigned int errlen,
@@ -1063,7 +1779,8 @@ kopsik_api_result kopsik_start(
     const char *duration,
     const unsigned int task_id,
     const unsigned int project_id,
-    KopsikTimeEntryViewItem *out_view_item) {
+    KopsikTimeEntryViewItem *out_view_item,
+    KopsikResultCallback callback) {
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -1081,7 +1798,8 @@ kopsik_api_result kopsik_start(
       dur = std::string(duration);
     }
 
-    kopsik::TimeEntry *te = app(context)->Start(desc, dur, task_id, project_id);
+    kopsik::TimeEntry *te = app(context)->Start(desc, dur, task_id, project_id,
+                                                saved_by(callback));
     if (te) {
       std::string project_label("");
       std::string color_code("");
@@ -1101,6 +1819,42 @@ kopsik_api_result kopsik_start(
   return KOPSIK_API_SUCCESS;
 }
 
+kopsik_api_result kopsik_start(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *description,
+    const char *duration,
+    const unsigned int task_id,
+    const unsigned int project_id,
+    KopsikTimeEntryViewItem *out_view_item) {
+  KOPSIK_API_CALL("description=" << kopsik::ApiPrivateArg(description)
+    << " duration=" << kopsik::ApiArg(duration) << " task_id=" << task_id
+    << " project_id=" << project_id);
+
+  return start_time_entry(context, errmsg, errlen, description, duration,
+                          task_id, project_id, out_view_item, 0);
+}
+
+kopsik_api_result kopsik_start_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *description,
+    const char *duration,
+    const unsigned int task_id,
+    const unsigned int project_id,
+    KopsikTimeEntryViewItem *out_view_item,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("description=" << kopsik::ApiPrivateArg(description)
+    << " duration=" << kopsik::ApiArg(duration) << " task_id=" << task_id
+    << " project_id=" << project_id);
+
+  poco_assert(callback);
+  return start_time_entry(context, errmsg, errlen, description, duration,
+                          task_id, project_id, out_view_item, callback);
+}
+
 kopsik_api_result kopsik_time_entry_view_item_by_guid(
     void *context,
     char *errmsg,
@@ -1108,6 +1862,8 @@ kopsik_api_result kopsik_time_entry_view_item_by_guid(
     const char *guid,
     KopsikTimeEntryViewItem *view_item,
     int *was_found) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -1115,9 +1871,8 @@ kopsik_api_result kopsik_time_entry_view_item_by_guid(
     poco_assert(view_item);
     poco_assert(was_found);
 
-    std::stringstream ss;
-    ss << "kopsik_time_entry_view_item_by_guid guid=" << guid;
-    logger().trace(ss.str());
+    KOPSIK_LOG_TRACE(logger(), "kopsik_time_entry_view_item_by_guid guid="
+        << guid);
 
     std::string GUID(guid);
     poco_assert(!GUID.empty());
@@ -1148,35 +1903,55 @@ kopsik_api_result kopsik_time_entry_view_item_by_guid(
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_continue(
+kopsik_api_result kopsik_search_time_entries(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    const char *guid,
-    KopsikTimeEntryViewItem *view_item) {
+    const char *query,
+    const unsigned int offset,
+    const unsigned int limit,
+    KopsikTimeEntryViewItem **first) {
+  KOPSIK_API_CALL("query=" << kopsik::ApiPrivateArg(query)
+    << " offset=" << offset << " limit=" << limit);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(guid);
-    poco_assert(view_item);
+    poco_assert(query);
+    poco_assert(first);
 
-    std::stringstream ss;
-    ss << "kopsik_continue guid=" << guid;
-    logger().debug(ss.str());
+    KOPSIK_LOG_TRACE(logger(), "kopsik_search_time_entries query="
+        << query << " offset=" << offset << " limit=" << limit);
 
-    std::string GUID(guid);
+    *first = 0;
 
-    if (GUID.empty()) {
-      strncpy(errmsg, "Missing GUID", errlen);
+    std::vector<kopsik::TimeEntry *> results;
+    kopsik::error err = app(context)->SearchTimeEntries(
+      std::string(query), offset, limit, &results);
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
       return KOPSIK_API_FAILURE;
     }
 
-    kopsik::TimeEntry *te = app(context)->Continue(GUID);
-    if (te) {
+    KopsikTimeEntryViewItem *previous = 0;
+    for (std::vector<kopsik::TimeEntry *>::const_iterator it =
+        results.begin();
+        it != results.end();
+        it++) {
+      kopsik::TimeEntry *te = *it;
       std::string project_label("");
       std::string color_code("");
       app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
+
+      KopsikTimeEntryViewItem *view_item = kopsik_time_entry_view_item_init();
       time_entry_to_view_item(te, project_label, color_code, view_item, "");
+      if (previous) {
+        previous->Next = view_item;
+      } else {
+        *first = view_item;
+      }
+      previous = view_item;
+      delete te;
     }
   } catch(const Poco::Exception& exc) {
       strncpy(errmsg, exc.displayText().c_str(), errlen);
@@ -1191,30 +1966,74 @@ kopsik_api_result kopsik_continue(
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_continue_latest(
+void kopsik_time_entry_span_clear(
+    KopsikTimeEntrySpan *item) {
+  KOPSIK_API_CALL("");
+
+  if (!item) {
+    return;
+  }
+  if (item->GUID) {
+    free(item->GUID);
+    item->GUID = 0;
+  }
+  if (item->Next) {
+    KopsikTimeEntrySpan *next =
+      reinterpret_cast<KopsikTimeEntrySpan *>(item->Next);
+    kopsik_time_entry_span_clear(next);
+  }
+  delete item;
+  item = 0;
+}
+
+static void time_entry_spans_to_list(
+    const std::vector<kopsik::TimeEntrySpan> &spans,
+    KopsikTimeEntrySpan **first) {
+  KopsikTimeEntrySpan *previous = 0;
+  for (std::vector<kopsik::TimeEntrySpan>::const_iterator it =
+      spans.begin();
+      it != spans.end();
+      it++) {
+    KopsikTimeEntrySpan *item = new KopsikTimeEntrySpan();
+    item->GUID = strdup(it->GUID.c_str());
+    item->Started = static_cast<unsigned int>(it->Start);
+    item->Ended = static_cast<unsigned int>(it->Stop);
+    item->Next = 0;
+    if (previous) {
+      previous->Next = item;
+    } else {
+      *first = item;
+    }
+    previous = item;
+  }
+}
+
+kopsik_api_result kopsik_time_entries_between(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    KopsikTimeEntryViewItem *view_item,
-    int *was_found) {
+    const unsigned int from,
+    const unsigned int to,
+    KopsikTimeEntrySpan **first) {
+  KOPSIK_API_CALL("from=" << from << " to=" << to);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(view_item);
-    poco_assert(was_found);
+    poco_assert(first);
 
-    *was_found = 0;
+    KOPSIK_LOG_TRACE(logger(), "kopsik_time_entries_between from="
+        << from << " to=" << to);
 
-    logger().debug("kopsik_continue_latest");
+    *first = 0;
 
-    kopsik::TimeEntry *te = app(context)->ContinueLatest();
-    if (te) {
-      *was_found = 1;
-      std::string project_label("");
-      std::string color_code("");
-      app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
-      time_entry_to_view_item(te, project_label, color_code, view_item, "");
+    std::vector<kopsik::TimeEntrySpan> spans;
+    kopsik::error err = app(context)->TimeEntriesBetween(from, to, &spans);
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
     }
+    time_entry_spans_to_list(spans, first);
   } catch(const Poco::Exception& exc) {
       strncpy(errmsg, exc.displayText().c_str(), errlen);
       return KOPSIK_API_FAILURE;
@@ -1228,31 +2047,33 @@ kopsik_api_result kopsik_continue_latest(
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_delete_time_entry(
+kopsik_api_result kopsik_overlapping_time_entries(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    const char *guid) {
+    const char *guid,
+    KopsikTimeEntrySpan **first) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
     poco_assert(guid);
+    poco_assert(first);
 
-    std::stringstream ss;
-    ss << "kopsik_delete_time_entry guid=" << guid;
-    logger().debug(ss.str());
+    KOPSIK_LOG_TRACE(logger(), "kopsik_overlapping_time_entries guid="
+        << guid);
 
-    std::string GUID(guid);
-    if (GUID.empty()) {
-      strncpy(errmsg, "Missing GUID", errlen);
-      return KOPSIK_API_FAILURE;
-    }
+    *first = 0;
 
-    kopsik::error err = app(context)->DeleteTimeEntryByGUID(GUID);
+    std::vector<kopsik::TimeEntrySpan> spans;
+    kopsik::error err = app(context)->OverlappingTimeEntries(
+      std::string(guid), &spans);
     if (err != kopsik::noError) {
       strncpy(errmsg, err.c_str(), errlen);
       return KOPSIK_API_FAILURE;
     }
+    time_entry_spans_to_list(spans, first);
   } catch(const Poco::Exception& exc) {
       strncpy(errmsg, exc.displayText().c_str(), errlen);
       return KOPSIK_API_FAILURE;
@@ -1266,29 +2087,87 @@ kopsik_api_result kopsik_delete_time_entry(
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_set_time_entry_duration(
+void kopsik_time_entry_suggestion_clear(
+    KopsikTimeEntrySuggestion *item) {
+  KOPSIK_API_CALL("");
+
+  if (!item) {
+    return;
+  }
+  if (item->Description) {
+    free(item->Description);
+    item->Description = 0;
+  }
+  if (item->ProjectAndTaskLabel) {
+    free(item->ProjectAndTaskLabel);
+    item->ProjectAndTaskLabel = 0;
+  }
+  if (item->Color) {
+    free(item->Color);
+    item->Color = 0;
+  }
+  if (item->Next) {
+    KopsikTimeEntrySuggestion *next =
+      reinterpret_cast<KopsikTimeEntrySuggestion *>(item->Next);
+    kopsik_time_entry_suggestion_clear(next);
+  }
+  delete item;
+  item = 0;
+}
+
+kopsik_api_result kopsik_time_entry_suggestions(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    const char *guid,
-    const char *value) {
+    const unsigned int limit,
+    KopsikTimeEntrySuggestion **first) {
+  KOPSIK_API_CALL("limit=" << limit);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(guid);
-    poco_assert(value);
+    poco_assert(first);
 
-    std::stringstream ss;
-    ss  << "kopsik_set_time_entry_duration guid=" << guid
-        << ", value=" << value;
-    logger().debug(ss.str());
+    KOPSIK_LOG_TRACE(logger(), "kopsik_time_entry_suggestions limit="
+        << limit);
 
-    kopsik::error err = app(context)->SetTimeEntryDuration(std::string(guid),
-                                                           std::string(value));
+    *first = 0;
+
+    std::vector<kopsik::TimeEntrySuggestion> suggestions;
+    kopsik::error err = app(context)->SuggestTimeEntries(limit, &suggestions);
     if (err != kopsik::noError) {
       strncpy(errmsg, err.c_str(), errlen);
       return KOPSIK_API_FAILURE;
     }
+
+    KopsikTimeEntrySuggestion *previous = 0;
+    for (std::vector<kopsik::TimeEntrySuggestion>::const_iterator it =
+        suggestions.begin();
+        it != suggestions.end();
+        it++) {
+      // Labeled the way a time entry of the project would be
+      kopsik::TimeEntry te;
+      te.SetPID(it->PID);
+      std::string project_label("");
+      std::string color_code("");
+      app(context)->ProjectLabelAndColorCode(&te, &project_label, &color_code);
+
+      KopsikTimeEntrySuggestion *item = new KopsikTimeEntrySuggestion();
+      item->PID = static_cast<unsigned int>(it->PID);
+      item->Description = strdup(it->Description.c_str());
+      item->ProjectAndTaskLabel = strdup(project_label.c_str());
+      item->Color = strdup(color_code.c_str());
+      item->Started = static_cast<unsigned int>(it->Start);
+      item->Ended = static_cast<unsigned int>(it->End);
+      item->Seconds = static_cast<unsigned int>(it->Seconds);
+      item->Next = 0;
+      if (previous) {
+        previous->Next = item;
+      } else {
+        *first = item;
+      }
+      previous = item;
+    }
   } catch(const Poco::Exception& exc) {
       strncpy(errmsg, exc.displayText().c_str(), errlen);
       return KOPSIK_API_FAILURE;
@@ -1302,30 +2181,128 @@ kopsik_api_result kopsik_set_time_entry_duration(
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_set_time_entry_project(
+void kopsik_dismiss_time_entry_suggestion(
+    void *context,
+    const unsigned int started) {
+  KOPSIK_API_CALL("started=" << started);
+
+  app(context)->DismissTimeEntrySuggestion(started);
+}
+
+void kopsik_report_item_clear(
+    KopsikReportItem *item) {
+  KOPSIK_API_CALL("");
+
+  if (!item) {
+    return;
+  }
+  if (item->GUID) {
+    free(item->GUID);
+    item->GUID = 0;
+  }
+  if (item->Name) {
+    free(item->Name);
+    item->Name = 0;
+  }
+  if (item->Next) {
+    KopsikReportItem *next = reinterpret_cast<KopsikReportItem *>(item->Next);
+    kopsik_report_item_clear(next);
+  }
+  delete item;
+  item = 0;
+}
+
+// Appends an item with the totals to the list
+static KopsikReportItem *report_item_init(
+    const char *group,
+    const kopsik::ReportTotal &total,
+    KopsikReportItem **first,
+    KopsikReportItem **last) {
+  KopsikReportItem *item = new KopsikReportItem();
+  item->Group = group;
+  item->Day = 0;
+  item->ID = 0;
+  item->GUID = 0;
+  item->Name = 0;
+  item->Seconds = static_cast<int>(total.Seconds);
+  item->BillableSeconds = static_cast<int>(total.BillableSeconds);
+  item->Entries = total.Entries;
+  item->Next = 0;
+  if (*last) {
+    (*last)->Next = item;
+  } else {
+    *first = item;
+  }
+  *last = item;
+  return item;
+}
+
+kopsik_api_result kopsik_report(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    const char *guid,
-    const unsigned int task_id,
-    const unsigned int project_id,
-    const char *project_guid) {
+    const unsigned int from_day,
+    const unsigned int to_day,
+    KopsikReportItem **first) {
+  KOPSIK_API_CALL("from_day=" << from_day << " to_day=" << to_day);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(guid);
-    std::string pguid("");
-    if (project_guid) {
-      pguid = std::string(project_guid);
-    }
-    kopsik::error err = app(context)->SetTimeEntryProject(std::string(guid),
-                                                          task_id,
-                                                          project_id,
-                                                          pguid);
+    poco_assert(first);
+
+    KOPSIK_LOG_TRACE(logger(), "kopsik_report from_day=" << from_day
+        << " to_day=" << to_day);
+
+    *first = 0;
+
+    kopsik::Report report;
+    kopsik::error err = app(context)->LoadReport(from_day, to_day, &report);
     if (err != kopsik::noError) {
       strncpy(errmsg, err.c_str(), errlen);
       return KOPSIK_API_FAILURE;
     }
+
+    KopsikReportItem *last = 0;
+    report_item_init("total", report.Total, first, &last);
+    for (std::map<int, kopsik::ReportTotal>::const_iterator it =
+        report.Days.begin();
+        it != report.Days.end();
+        it++) {
+      report_item_init("day", it->second, first, &last)->Day = it->first;
+    }
+    for (std::map<int, kopsik::ReportTotal>::const_iterator it =
+        report.Weeks.begin();
+        it != report.Weeks.end();
+        it++) {
+      report_item_init("week", it->second, first, &last)->Day = it->first;
+    }
+    for (std::map<kopsik::ReportProjectKey, kopsik::ReportTotal>::
+        const_iterator it = report.Projects.begin();
+        it != report.Projects.end();
+        it++) {
+      KopsikReportItem *item =
+        report_item_init("project", it->second, first, &last);
+      item->ID = static_cast<unsigned int>(it->first.first);
+      item->GUID = strdup(it->first.second.c_str());
+      item->Name = strdup(report.ProjectNames[it->first].c_str());
+    }
+    for (std::map<Poco::UInt64, kopsik::ReportTotal>::const_iterator it =
+        report.Clients.begin();
+        it != report.Clients.end();
+        it++) {
+      KopsikReportItem *item =
+        report_item_init("client", it->second, first, &last);
+      item->ID = static_cast<unsigned int>(it->first);
+      item->Name = strdup(report.ClientNames[it->first].c_str());
+    }
+    for (std::map<std::string, kopsik::ReportTotal>::const_iterator it =
+        report.Tags.begin();
+        it != report.Tags.end();
+        it++) {
+      report_item_init("tag", it->second, first, &last)->Name =
+        strdup(it->first.c_str());
+    }
   } catch(const Poco::Exception& exc) {
       strncpy(errmsg, exc.displayText().c_str(), errlen);
       return KOPSIK_API_FAILURE;
@@ -1339,30 +2316,83 @@ kopsik_api_result kopsik_set_time_entry_project(
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_set_time_entry_start_iso_8601(
+class CallbackExportSink : public kopsik::ExportSink {
+ public:
+  explicit CallbackExportSink(KopsikExportCallback callback)
+    : callback_(callback) {}
+
+  kopsik::error Write(const char *data, const std::size_t size) {
+    if (callback_(data, static_cast<unsigned int>(size))
+        != KOPSIK_API_SUCCESS) {
+      return kopsik::error("Export was stopped");
+    }
+    return kopsik::noError;
+  }
+
+ private:
+  KopsikExportCallback callback_;
+};
+
+class FileExportSink : public kopsik::ExportSink {
+ public:
+  explicit FileExportSink(const std::string &path)
+    : path_(path)
+    , out_(path, std::ios::binary | std::ios::trunc) {}
+
+  kopsik::error Write(const char *data, const std::size_t size) {
+    out_.write(data, size);
+    if (!out_.good()) {
+      return kopsik::error("Failed to write export to " + path_);
+    }
+    return kopsik::noError;
+  }
+
+ private:
+  std::string path_;
+  Poco::FileOutputStream out_;
+};
+
+static kopsik_api_result export_time_entries(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    const char *guid,
-    const char *value) {
+    const unsigned int from_day,
+    const unsigned int to_day,
+    const int format,
+    kopsik::ExportSink *sink) {
+  kopsik::TimeEntryExport out(format == KOPSIK_EXPORT_JSON
+                              ? kopsik::TimeEntryExport::JSON
+                              : kopsik::TimeEntryExport::CSV,
+                              sink);
+  kopsik::error err = app(context)->ExportTimeEntries(from_day, to_day, &out);
+  if (err != kopsik::noError) {
+    strncpy(errmsg, err.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_export_time_entries(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const unsigned int from_day,
+    const unsigned int to_day,
+    const int format,
+    KopsikExportCallback callback) {
+  KOPSIK_API_CALL("from_day=" << from_day << " to_day=" << to_day
+    << " format=" << format);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(guid);
-    poco_assert(value);
+    poco_assert(callback);
 
-    std::stringstream ss;
-    ss  << "kopsik_set_time_entry_start_iso_8601 guid=" << guid
-        << ", value=" << value;
-    logger().debug(ss.str());
+    logger().debug("kopsik_export_time_entries");
 
-    kopsik::error err =
-      app(context)->SetTimeEntryStartISO8601(std::string(guid),
-                                             std::string(value));
-    if (err != kopsik::noError) {
-      strncpy(errmsg, err.c_str(), errlen);
-      return KOPSIK_API_FAILURE;
-    }
+    CallbackExportSink sink(callback);
+    return export_time_entries(context, errmsg, errlen,
+                               from_day, to_day, format, &sink);
   } catch(const Poco::Exception& exc) {
       strncpy(errmsg, exc.displayText().c_str(), errlen);
       return KOPSIK_API_FAILURE;
@@ -1373,33 +2403,30 @@ kopsik_api_result kopsik_set_time_entry_start_iso_8601(
       strncpy(errmsg, ex.c_str(), errlen);
       return KOPSIK_API_FAILURE;
   }
-  return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_set_time_entry_end_iso_8601(
+kopsik_api_result kopsik_export_time_entries_to_file(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    const char *guid,
-    const char *value) {
+    const unsigned int from_day,
+    const unsigned int to_day,
+    const int format,
+    const char *path) {
+  KOPSIK_API_CALL("from_day=" << from_day << " to_day=" << to_day
+    << " format=" << format << " path=" << kopsik::ApiArg(path));
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(guid);
-    poco_assert(value);
+    poco_assert(path);
 
-    std::stringstream ss;
-    ss  << "kopsik_set_time_entry_end_iso_8601 guid=" << guid
-        << ", value=" << value;
-    logger().debug(ss.str());
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_export_time_entries_to_file path="
+        << path);
 
-    kopsik::error err = app(context)->SetTimeEntryEndISO8601(
-      std::string(guid),
-      std::string(value));
-    if (err != kopsik::noError) {
-      strncpy(errmsg, err.c_str(), errlen);
-      return KOPSIK_API_FAILURE;
-    }
+    FileExportSink sink(path);
+    return export_time_entries(context, errmsg, errlen,
+                               from_day, to_day, format, &sink);
   } catch(const Poco::Exception& exc) {
       strncpy(errmsg, exc.displayText().c_str(), errlen);
       return KOPSIK_API_FAILURE;
@@ -1410,32 +2437,53 @@ kopsik_api_result kopsik_set_time_entry_end_iso_8601(
       strncpy(errmsg, ex.c_str(), errlen);
       return KOPSIK_API_FAILURE;
   }
-  return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_set_time_entry_tags(
+class CallbackImportProgress : public kopsik::TimeEntryImportProgress {
+ public:
+  explicit CallbackImportProgress(KopsikImportProgressCallback callback)
+    : callback_(callback) {}
+
+  void Imported(const kopsik::TimeEntryImportResult &so_far) {
+    callback_(static_cast<unsigned int>(so_far.Imported),
+              static_cast<unsigned int>(so_far.Skipped),
+              static_cast<unsigned int>(so_far.Invalid));
+  }
+
+ private:
+  KopsikImportProgressCallback callback_;
+};
+
+kopsik_api_result kopsik_import_time_entries_from_file(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    const char *guid,
-    const char *value) {
+    const char *path,
+    KopsikImportProgressCallback callback) {
+  KOPSIK_API_CALL("path=" << kopsik::ApiArg(path));
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(guid);
-    poco_assert(value);
+    poco_assert(path);
 
-    std::stringstream ss;
-    ss  << "kopsik_set_time_entry_tags guid=" << guid
-        << ", value=" << value;
-    logger().debug(ss.str());
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_import_time_entries_from_file path="
+        << path);
 
-    kopsik::error err = app(context)->SetTimeEntryTags(std::string(guid),
-                                                       std::string(value));
+    Poco::FileInputStream in(path, std::ios::binary);
+    kopsik::TimeEntryCSVReader reader(&in);
+    CallbackImportProgress progress(callback);
+    kopsik::TimeEntryImportResult result;
+    kopsik::error err = app(context)->ImportTimeEntries(
+      &reader, callback ? &progress : 0, &result);
     if (err != kopsik::noError) {
       strncpy(errmsg, err.c_str(), errlen);
       return KOPSIK_API_FAILURE;
     }
+    if (result.FirstError != kopsik::noError) {
+      strncpy(errmsg, result.FirstError.c_str(), errlen);
+    }
+    return KOPSIK_API_SUCCESS;
   } catch(const Poco::Exception& exc) {
       strncpy(errmsg, exc.displayText().c_str(), errlen);
       return KOPSIK_API_FAILURE;
@@ -1446,114 +2494,900 @@ kopsik_api_result kopsik_set_time_entry_tags(
       strncpy(errmsg, ex.c_str(), errlen);
       return KOPSIK_API_FAILURE;
   }
-  return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_set_time_entry_billable(
+static kopsik_api_result continue_time_entry(
     void *context,
     char *errmsg,
     const unsigned int errlen,
     const char *guid,
-    const int value) {
+    KopsikTimeEntryViewItem *view_item,
+    KopsikResultCallback callback) {
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
     poco_assert(guid);
+    poco_assert(view_item);
 
-    std::stringstream ss;
-    ss  << "kopsik_set_time_entry_billable guid=" << guid
-        << ", value=" << value;
-    logger().debug(ss.str());
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_continue guid=" << guid);
 
-    kopsik::error err =
-      app(context)->SetTimeEntryBillable(std::string(guid), value);
-    if (err != kopsik::noError) {
-      strncpy(errmsg, err.c_str(), errlen);
+    std::string GUID(guid);
+
+    if (GUID.empty()) {
+      strncpy(errmsg, "Missing GUID", errlen);
       return KOPSIK_API_FAILURE;
     }
+
+    kopsik::TimeEntry *te = app(context)->Continue(GUID, saved_by(callback));
+    if (te) {
+      std::string project_label("");
+      std::string color_code("");
+      app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
+      time_entry_to_view_item(te, project_label, color_code, view_item, "");
+    }
   } catch(const Poco::Exception& exc) {
-    strncpy(errmsg, exc.displayText().c_str(), errlen);
-    return KOPSIK_API_FAILURE;
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
   } catch(const std::exception& ex) {
-    strncpy(errmsg, ex.what(), errlen);
-    return KOPSIK_API_FAILURE;
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
   } catch(const std::string& ex) {
-    strncpy(errmsg, ex.c_str(), errlen);
-    return KOPSIK_API_FAILURE;
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
   }
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_set_time_entry_description(
+kopsik_api_result kopsik_continue(
     void *context,
     char *errmsg,
     const unsigned int errlen,
     const char *guid,
-    const char *value) {
-  try {
-    poco_assert(errmsg);
-    poco_assert(errlen);
-    poco_assert(guid);
-    poco_assert(value);
+    KopsikTimeEntryViewItem *view_item) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
 
-    std::stringstream ss;
-    ss  << "kopsik_set_time_entry_description guid=" << guid
-        << ", value=" << value;
-    logger().debug(ss.str());
+  return continue_time_entry(context, errmsg, errlen, guid, view_item, 0);
+}
 
-    kopsik::error err =
-      app(context)->SetTimeEntryDescription(std::string(guid),
-                                            std::string(value));
-    if (err != kopsik::noError) {
-      strncpy(errmsg, err.c_str(), errlen);
-      return KOPSIK_API_FAILURE;
-    }
-  } catch(const Poco::Exception& exc) {
-    strncpy(errmsg, exc.displayText().c_str(), errlen);
-    return KOPSIK_API_FAILURE;
-  } catch(const std::exception& ex) {
-    strncpy(errmsg, ex.what(), errlen);
-    return KOPSIK_API_FAILURE;
-  } catch(const std::string& ex) {
-    strncpy(errmsg, ex.c_str(), errlen);
-    return KOPSIK_API_FAILURE;
-  }
-  return KOPSIK_API_SUCCESS;
+kopsik_api_result kopsik_continue_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    KopsikTimeEntryViewItem *view_item,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
+
+  poco_assert(callback);
+  return continue_time_entry(context, errmsg, errlen, guid, view_item,
+                             callback);
 }
 
-kopsik_api_result kopsik_stop(
+kopsik_api_result kopsik_continue_latest(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    KopsikTimeEntryViewItem *out_view_item,
+    KopsikTimeEntryViewItem *view_item,
     int *was_found) {
+  KOPSIK_API_CALL("");
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(out_view_item);
+    poco_assert(view_item);
     poco_assert(was_found);
 
-    logger().debug("kopsik_stop");
-
     *was_found = 0;
 
-    kopsik::TimeEntry *te = 0;
-    kopsik::error err = app(context)->Stop(&te);
-    if (err != kopsik::noError) {
-      strncpy(errmsg, err.c_str(), errlen);
-      return KOPSIK_API_FAILURE;
-    }
+    logger().debug("kopsik_continue_latest");
+
+    kopsik::TimeEntry *te = app(context)->ContinueLatest();
     if (te) {
       *was_found = 1;
       std::string project_label("");
       std::string color_code("");
       app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
-      time_entry_to_view_item(te, project_label, color_code, out_view_item, "");
+      time_entry_to_view_item(te, project_label, color_code, view_item, "");
     }
   } catch(const Poco::Exception& exc) {
-    strncpy(errmsg, exc.displayText().c_str(), errlen);
-    return KOPSIK_API_FAILURE;
-  } catch(const std::exception& ex) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+static kopsik_api_result delete_time_entry(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_delete_time_entry guid=" << guid);
+
+    std::string GUID(guid);
+    if (GUID.empty()) {
+      strncpy(errmsg, "Missing GUID", errlen);
+      return KOPSIK_API_FAILURE;
+    }
+
+    kopsik::error err = app(context)->DeleteTimeEntryByGUID(GUID,
+                                                          saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_delete_time_entry(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
+
+  return delete_time_entry(context, errmsg, errlen, guid, 0);
+}
+
+kopsik_api_result kopsik_delete_time_entry_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
+
+  poco_assert(callback);
+  return delete_time_entry(context, errmsg, errlen, guid, callback);
+}
+
+static kopsik_api_result set_time_entry_duration(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+    poco_assert(value);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_set_time_entry_duration guid=" << guid
+        << ", value=" << value);
+
+    kopsik::error err = app(context)->SetTimeEntryDuration(std::string(guid),
+                                                           std::string(value),
+                                                           saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_set_time_entry_duration(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  return set_time_entry_duration(context, errmsg, errlen, guid, value, 0);
+}
+
+kopsik_api_result kopsik_set_time_entry_duration_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  poco_assert(callback);
+  return set_time_entry_duration(context, errmsg, errlen, guid, value,
+                                 callback);
+}
+
+static kopsik_api_result set_time_entry_project(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const unsigned int task_id,
+    const unsigned int project_id,
+    const char *project_guid,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+    std::string pguid("");
+    if (project_guid) {
+      pguid = std::string(project_guid);
+    }
+    kopsik::error err = app(context)->SetTimeEntryProject(std::string(guid),
+                                                          task_id,
+                                                          project_id,
+                                                          pguid,
+                                                          saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_set_time_entry_project(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const unsigned int task_id,
+    const unsigned int project_id,
+    const char *project_guid) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid) << " task_id=" << task_id
+    << " project_id=" << project_id
+    << " project_guid=" << kopsik::ApiArg(project_guid));
+
+  return set_time_entry_project(context, errmsg, errlen, guid, task_id,
+                                project_id, project_guid, 0);
+}
+
+kopsik_api_result kopsik_set_time_entry_project_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const unsigned int task_id,
+    const unsigned int project_id,
+    const char *project_guid,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid) << " task_id=" << task_id
+    << " project_id=" << project_id
+    << " project_guid=" << kopsik::ApiArg(project_guid));
+
+  poco_assert(callback);
+  return set_time_entry_project(context, errmsg, errlen, guid, task_id,
+                                project_id, project_guid, callback);
+}
+
+static kopsik_api_result set_time_entry_start_iso_8601(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+    poco_assert(value);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_set_time_entry_start_iso_8601 guid="
+        << guid << ", value=" << value);
+
+    kopsik::error err =
+      app(context)->SetTimeEntryStartISO8601(std::string(guid),
+                                             std::string(value),
+                                             saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_set_time_entry_start_iso_8601(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  return set_time_entry_start_iso_8601(context, errmsg, errlen, guid, value, 0);
+}
+
+kopsik_api_result kopsik_set_time_entry_start_iso_8601_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  poco_assert(callback);
+  return set_time_entry_start_iso_8601(context, errmsg, errlen, guid, value,
+                                       callback);
+}
+
+static kopsik_api_result set_time_entry_end_iso_8601(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+    poco_assert(value);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_set_time_entry_end_iso_8601 guid="
+        << guid << ", value=" << value);
+
+    kopsik::error err = app(context)->SetTimeEntryEndISO8601(
+      std::string(guid),
+      std::string(value),
+      saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_set_time_entry_end_iso_8601(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  return set_time_entry_end_iso_8601(context, errmsg, errlen, guid, value, 0);
+}
+
+kopsik_api_result kopsik_set_time_entry_end_iso_8601_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  poco_assert(callback);
+  return set_time_entry_end_iso_8601(context, errmsg, errlen, guid, value,
+                                     callback);
+}
+
+static kopsik_api_result set_time_entry_tags(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+    poco_assert(value);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_set_time_entry_tags guid=" << guid
+        << ", value=" << value);
+
+    kopsik::error err = app(context)->SetTimeEntryTags(std::string(guid),
+                                                       std::string(value),
+                                                       saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_set_time_entry_tags(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  return set_time_entry_tags(context, errmsg, errlen, guid, value, 0);
+}
+
+kopsik_api_result kopsik_set_time_entry_tags_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  poco_assert(callback);
+  return set_time_entry_tags(context, errmsg, errlen, guid, value, callback);
+}
+
+static kopsik_api_result set_time_entry_billable(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const int value,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_set_time_entry_billable guid=" << guid
+        << ", value=" << value);
+
+    kopsik::error err =
+      app(context)->SetTimeEntryBillable(std::string(guid), value,
+                                        saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_set_time_entry_billable(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const int value) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid) << " value=" << value);
+
+  return set_time_entry_billable(context, errmsg, errlen, guid, value, 0);
+}
+
+kopsik_api_result kopsik_set_time_entry_billable_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const int value,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid) << " value=" << value);
+
+  poco_assert(callback);
+  return set_time_entry_billable(context, errmsg, errlen, guid, value,
+                                 callback);
+}
+
+static kopsik_api_result set_time_entry_description(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+    poco_assert(value);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_set_time_entry_description guid="
+        << guid << ", value=" << value);
+
+    kopsik::error err =
+      app(context)->SetTimeEntryDescription(std::string(guid),
+                                            std::string(value),
+                                            saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_set_time_entry_description(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  return set_time_entry_description(context, errmsg, errlen, guid, value, 0);
+}
+
+kopsik_api_result kopsik_set_time_entry_description_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const char *value,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid)
+    << " value=" << kopsik::ApiPrivateArg(value));
+
+  poco_assert(callback);
+  return set_time_entry_description(context, errmsg, errlen, guid, value,
+                                    callback);
+}
+
+static void time_entry_edit(
+    const KopsikTimeEntryEdit *edit,
+    kopsik::TimeEntryEdit *te_edit) {
+  te_edit->fields = 0;
+  if (edit->Fields & KOPSIK_EDIT_DESCRIPTION) {
+    poco_assert(edit->Description);
+    te_edit->fields |= kopsik::kEditDescription;
+    te_edit->description = std::string(edit->Description);
+  }
+  if (edit->Fields & KOPSIK_EDIT_PROJECT) {
+    te_edit->fields |= kopsik::kEditProject;
+    te_edit->task_id = edit->TID;
+    te_edit->project_id = edit->PID;
+    te_edit->project_guid = "";
+    if (edit->ProjectGUID) {
+      te_edit->project_guid = std::string(edit->ProjectGUID);
+    }
+  }
+  if (edit->Fields & KOPSIK_EDIT_BILLABLE) {
+    te_edit->fields |= kopsik::kEditBillable;
+    te_edit->billable = edit->Billable;
+  }
+  if (edit->Fields & KOPSIK_EDIT_TAGS) {
+    poco_assert(edit->Tags);
+    te_edit->fields |= kopsik::kEditTags;
+    te_edit->tags = std::string(edit->Tags);
+  }
+  if (edit->Fields & KOPSIK_EDIT_START) {
+    poco_assert(edit->StartISO8601);
+    te_edit->fields |= kopsik::kEditStart;
+    te_edit->start = std::string(edit->StartISO8601);
+  }
+  if (edit->Fields & KOPSIK_EDIT_END) {
+    poco_assert(edit->EndISO8601);
+    te_edit->fields |= kopsik::kEditEnd;
+    te_edit->end = std::string(edit->EndISO8601);
+  }
+  if (edit->Fields & KOPSIK_EDIT_DURATION) {
+    poco_assert(edit->Duration);
+    te_edit->fields |= kopsik::kEditDuration;
+    te_edit->duration = std::string(edit->Duration);
+  }
+}
+
+static kopsik_api_result edit_time_entry(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const KopsikTimeEntryEdit *edit,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(guid);
+    poco_assert(edit);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_edit_time_entry guid=" << guid
+        << ", fields=" << edit->Fields);
+
+    kopsik::TimeEntryEdit te_edit;
+    time_entry_edit(edit, &te_edit);
+
+    kopsik::error err = app(context)->EditTimeEntry(std::string(guid),
+                                                    te_edit,
+                                                    saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_edit_time_entry(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const KopsikTimeEntryEdit *edit) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
+
+  return edit_time_entry(context, errmsg, errlen, guid, edit, 0);
+}
+
+kopsik_api_result kopsik_edit_time_entry_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *guid,
+    const KopsikTimeEntryEdit *edit,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("guid=" << kopsik::ApiArg(guid));
+
+  poco_assert(callback);
+  return edit_time_entry(context, errmsg, errlen, guid, edit, callback);
+}
+
+static std::vector<std::string> guid_list(
+    const char **guids,
+    const unsigned int count) {
+  poco_assert(guids || !count);
+  std::vector<std::string> result;
+  result.reserve(count);
+  for (unsigned int i = 0; i < count; i++) {
+    poco_assert(guids[i]);
+    result.push_back(std::string(guids[i]));
+  }
+  return result;
+}
+
+static kopsik_api_result edit_time_entries(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char **guids,
+    const unsigned int count,
+    const KopsikTimeEntryEdit *edit,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(edit);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_edit_time_entries count=" << count
+        << ", fields=" << edit->Fields);
+
+    kopsik::TimeEntryEdit te_edit;
+    time_entry_edit(edit, &te_edit);
+
+    kopsik::error err = app(context)->EditTimeEntries(guid_list(guids, count),
+                                                      te_edit,
+                                                      saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_edit_time_entries(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char **guids,
+    const unsigned int count,
+    const KopsikTimeEntryEdit *edit) {
+  KOPSIK_API_CALL("count=" << count);
+
+  return edit_time_entries(context, errmsg, errlen, guids, count, edit, 0);
+}
+
+kopsik_api_result kopsik_edit_time_entries_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char **guids,
+    const unsigned int count,
+    const KopsikTimeEntryEdit *edit,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("count=" << count);
+
+  poco_assert(callback);
+  return edit_time_entries(context, errmsg, errlen, guids, count, edit,
+                           callback);
+}
+
+static kopsik_api_result delete_time_entries(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char **guids,
+    const unsigned int count,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+
+    KOPSIK_LOG_DEBUG(logger(), "kopsik_delete_time_entries count=" << count);
+
+    kopsik::error err = app(context)->DeleteTimeEntries(
+      guid_list(guids, count), saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_delete_time_entries(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char **guids,
+    const unsigned int count) {
+  KOPSIK_API_CALL("count=" << count);
+
+  return delete_time_entries(context, errmsg, errlen, guids, count, 0);
+}
+
+kopsik_api_result kopsik_delete_time_entries_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char **guids,
+    const unsigned int count,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("count=" << count);
+
+  poco_assert(callback);
+  return delete_time_entries(context, errmsg, errlen, guids, count, callback);
+}
+
+static kopsik_api_result stop_time_entry(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikTimeEntryViewItem *out_view_item,
+    int *was_found,
+    KopsikResultCallback callback) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(out_view_item);
+    poco_assert(was_found);
+
+    logger().debug("kopsik_stop");
+
+    *was_found = 0;
+
+    kopsik::TimeEntry *te = 0;
+    kopsik::error err = app(context)->Stop(&te, saved_by(callback));
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+    if (te) {
+      *was_found = 1;
+      std::string project_label("");
+      std::string color_code("");
+      app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
+      time_entry_to_view_item(te, project_label, color_code, out_view_item, "");
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
     strncpy(errmsg, ex.what(), errlen);
     return KOPSIK_API_FAILURE;
   } catch(const std::string& ex) {
@@ -1563,6 +3397,31 @@ kopsik_api_result kopsik_stop(
   return KOPSIK_API_SUCCESS;
 }
 
+kopsik_api_result kopsik_stop(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikTimeEntryViewItem *out_view_item,
+    int *was_found) {
+  KOPSIK_API_CALL("");
+
+  return stop_time_entry(context, errmsg, errlen, out_view_item, was_found, 0);
+}
+
+kopsik_api_result kopsik_stop_async(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikTimeEntryViewItem *out_view_item,
+    int *was_found,
+    KopsikResultCallback callback) {
+  KOPSIK_API_CALL("");
+
+  poco_assert(callback);
+  return stop_time_entry(context, errmsg, errlen, out_view_item, was_found,
+                         callback);
+}
+
 kopsik_api_result kopsik_split_running_time_entry_at(
     void *context,
     char *errmsg,
@@ -1570,6 +3429,8 @@ kopsik_api_result kopsik_split_running_time_entry_at(
     const unsigned int at,
     KopsikTimeEntryViewItem *out_view_item,
     int *was_found) {
+  KOPSIK_API_CALL("at=" << at);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -1617,6 +3478,8 @@ kopsik_api_result kopsik_stop_running_time_entry_at(
     const unsigned int at,
     KopsikTimeEntryViewItem *out_view_item,
     int *was_found) {
+  KOPSIK_API_CALL("at=" << at);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -1633,16 +3496,357 @@ kopsik_api_result kopsik_stop_running_time_entry_at(
       strncpy(errmsg, err.c_str(), errlen);
       return KOPSIK_API_FAILURE;
     }
-    if (te) {
-      *was_found = 1;
-      std::string project_label("");
-      std::string color_code("");
-      app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
-      time_entry_to_view_item(te,
-                              project_label,
-                              color_code,
-                              out_view_item,
-                              "");
+    if (te) {
+      *was_found = 1;
+      std::string project_label("");
+      std::string color_code("");
+      app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
+      time_entry_to_view_item(te,
+                              project_label,
+                              color_code,
+                              out_view_item,
+                              "");
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_running_time_entry_view_item(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikTimeEntryViewItem *out_item,
+    int *out_is_tracking) {
+  KOPSIK_API_CALL("");
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(out_item);
+    poco_assert(out_is_tracking);
+
+    logger().debug("kopsik_running_time_entry_view_item");
+
+    *out_is_tracking = 0;
+    kopsik::TimeEntry *te = 0;
+    kopsik::error err = app(context)->RunningTimeEntry(&te);
+    if (err != kopsik::noError) {
+      strncpy(errmsg, err.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+    }
+    if (te) {
+      *out_is_tracking = true;
+      std::string project_label("");
+      std::string color_code("");
+      app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
+      time_entry_to_view_item(te,
+                              project_label,
+                              color_code,
+                              out_item,
+                              "");
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+// Called every second, so it doesn't log
+kopsik_api_result kopsik_running_timer(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    unsigned int *out_started,
+    unsigned int *out_version,
+    int *out_is_tracking) {
+  KOPSIK_API_CALL("");
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(out_started);
+    poco_assert(out_version);
+    poco_assert(out_is_tracking);
+
+    *out_started = 0;
+    *out_is_tracking = 0;
+    Poco::UInt64 started(0);
+    Poco::UInt64 version(0);
+    if (app(context)->RunningTimer(&started, &version)) {
+      *out_is_tracking = 1;
+      *out_started = static_cast<unsigned int>(started);
+    }
+    *out_version = static_cast<unsigned int>(version);
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+kopsik_api_result kopsik_time_entry_view_items(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikTimeEntryViewItem **first) {
+  KOPSIK_API_CALL("");
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(first);
+
+    logger().debug("kopsik_time_entry_view_items");
+
+    // The snapshot is never modified, so none of the user model
+    // locks are needed while the list is built from it.
+    Poco::AutoPtr<kopsik::UserSnapshot> snapshot = app(context)->Snapshot();
+    if (!snapshot || snapshot->TimeEntries.empty()) {
+      return KOPSIK_API_SUCCESS;
+    }
+
+    const std::vector<kopsik::TimeEntrySnapshot> &visible =
+      snapshot->TimeEntries;
+
+    *first = 0;
+    KopsikTimeEntryViewItem *previous = 0;
+    for (unsigned int i = 0; i < visible.size(); i++) {
+      const kopsik::TimeEntrySnapshot &te = visible[i];
+      KopsikTimeEntryViewItem *view_item = kopsik_time_entry_view_item_init();
+      if (previous) {
+        previous->Next = view_item;
+      }
+      if (!*first) {
+        *first = view_item;
+      }
+
+      time_entry_snapshot_to_view_item(te, view_item,
+        snapshot->FormattedDateDuration(te.DateHeader));
+      previous = view_item;
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+// Time entries in a snapshot are listed by start time, newest first
+static bool started_at_or_after(
+    const kopsik::TimeEntrySnapshot &te,
+    const Poco::UInt64 started_before) {
+  return te.Started >= started_before;
+}
+
+kopsik_api_result kopsik_time_entry_view_items_page(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const unsigned int started_before,
+    const unsigned int limit,
+    KopsikTimeEntryViewItem **first,
+    unsigned int *next_started_before) {
+  KOPSIK_API_CALL("started_before=" << started_before << " limit=" << limit);
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(first);
+    poco_assert(limit);
+    poco_assert(next_started_before);
+
+    logger().debug("kopsik_time_entry_view_items_page");
+
+    *first = 0;
+    *next_started_before = 0;
+
+    Poco::AutoPtr<kopsik::UserSnapshot> snapshot = app(context)->Snapshot();
+    if (!snapshot) {
+      return KOPSIK_API_SUCCESS;
+    }
+
+    std::vector<kopsik::TimeEntrySnapshot>::const_iterator it;
+    while (true) {
+      const std::vector<kopsik::TimeEntrySnapshot> &visible =
+        snapshot->TimeEntries;
+      it = visible.begin();
+      if (started_before) {
+        it = std::lower_bound(visible.begin(), visible.end(),
+                              Poco::UInt64(started_before),
+                              started_at_or_after);
+      }
+      // Older time entries are loaded from the database only when
+      // paging reaches them
+      if (static_cast<unsigned int>(visible.end() - it) > limit) {
+        break;
+      }
+      bool loaded(false);
+      kopsik::error err = app(context)->LoadOlderTimeEntries(&loaded);
+      if (err != kopsik::noError) {
+        strncpy(errmsg, err.c_str(), errlen);
+        return KOPSIK_API_FAILURE;
+      }
+      if (!loaded) {
+        break;
+      }
+      snapshot = app(context)->Snapshot();
+      if (!snapshot) {
+        return KOPSIK_API_SUCCESS;
+      }
+    }
+    const std::vector<kopsik::TimeEntrySnapshot> &visible =
+      snapshot->TimeEntries;
+
+    KopsikTimeEntryViewItem *previous = 0;
+    unsigned int count = 0;
+    for (; it != visible.end(); it++) {
+      if (count >= limit && it->Started != previous->Started) {
+        *next_started_before = previous->Started;
+        break;
+      }
+      KopsikTimeEntryViewItem *view_item = kopsik_time_entry_view_item_init();
+      time_entry_snapshot_to_view_item(*it, view_item,
+        snapshot->FormattedDateDuration(it->DateHeader));
+      if (previous) {
+        previous->Next = view_item;
+      } else {
+        *first = view_item;
+      }
+      previous = view_item;
+      count++;
+    }
+  } catch(const Poco::Exception& exc) {
+    strncpy(errmsg, exc.displayText().c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+    strncpy(errmsg, ex.what(), errlen);
+    return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+    strncpy(errmsg, ex.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+KopsikTimeEntryViewItemArray *kopsik_time_entry_view_item_array_init() {
+  KOPSIK_API_CALL("");
+
+  KopsikTimeEntryViewItemArray *array = new KopsikTimeEntryViewItemArray();
+  array->Items = 0;
+  array->Length = 0;
+  array->Snapshot = 0;
+  return array;
+}
+
+void kopsik_time_entry_view_item_array_clear(
+    KopsikTimeEntryViewItemArray *array) {
+  KOPSIK_API_CALL("");
+
+  if (!array) {
+    return;
+  }
+  // Items and their strings were allocated as one block
+  if (array->Items) {
+    free(array->Items);
+    array->Items = 0;
+  }
+  // Borrowed strings were in the snapshot
+  if (array->Snapshot) {
+    static_cast<kopsik::UserSnapshot *>(array->Snapshot)->release();
+    array->Snapshot = 0;
+  }
+  delete array;
+}
+
+// Fills the array with copies of the strings, or with strings
+// borrowed from the snapshot, which the array then holds on to
+static kopsik_api_result time_entry_view_item_array(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikTimeEntryViewItemArray *array,
+    const bool borrow) {
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(array);
+    poco_assert(!array->Items);
+    poco_assert(!array->Snapshot);
+
+    array->Length = 0;
+
+    Poco::AutoPtr<kopsik::UserSnapshot> snapshot = app(context)->Snapshot();
+    if (!snapshot || snapshot->TimeEntries.empty()) {
+      return KOPSIK_API_SUCCESS;
+    }
+
+    const std::vector<kopsik::TimeEntrySnapshot> &visible =
+      snapshot->TimeEntries;
+
+    std::size_t items_size = visible.size() * sizeof(KopsikTimeEntryViewItem);
+    std::size_t size = items_size;
+    for (std::size_t i = 0; !borrow && i < visible.size(); i++) {
+      size += time_entry_snapshot_arena_size(
+        visible[i], snapshot->FormattedDateDuration(visible[i].DateHeader));
+    }
+
+    char *block = static_cast<char *>(malloc(size));
+    if (!block) {
+      strncpy(errmsg, "Out of memory", errlen);
+      return KOPSIK_API_FAILURE;
+    }
+
+    KopsikTimeEntryViewItem *items =
+      reinterpret_cast<KopsikTimeEntryViewItem *>(block);
+    char *arena = block + items_size;
+    for (std::size_t i = 0; i < visible.size(); i++) {
+      const std::string &date_duration =
+        snapshot->FormattedDateDuration(visible[i].DateHeader);
+      if (borrow) {
+        time_entry_snapshot_to_borrowed_view_item(
+          visible[i], &items[i], date_duration);
+      } else {
+        time_entry_snapshot_to_arena_view_item(
+          visible[i], &items[i], date_duration, &arena);
+      }
+      if (i > 0) {
+        items[i - 1].Next = &items[i];
+      }
+    }
+    poco_assert(arena == block + size);
+
+    array->Items = items;
+    array->Length = static_cast<unsigned int>(visible.size());
+    if (borrow) {
+      array->Snapshot = snapshot.duplicate();
     }
   } catch(const Poco::Exception& exc) {
     strncpy(errmsg, exc.displayText().c_str(), errlen);
@@ -1657,38 +3861,174 @@ kopsik_api_result kopsik_stop_running_time_entry_at(
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_running_time_entry_view_item(
+kopsik_api_result kopsik_time_entry_view_item_array(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    KopsikTimeEntryViewItem *out_item,
-    int *out_is_tracking) {
+    KopsikTimeEntryViewItemArray *array) {
+  KOPSIK_API_CALL("");
+
+  logger().debug("kopsik_time_entry_view_item_array");
+
+  return time_entry_view_item_array(context, errmsg, errlen, array, false);
+}
+
+kopsik_api_result kopsik_time_entry_view_item_array_borrowed(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    KopsikTimeEntryViewItemArray *array) {
+  KOPSIK_API_CALL("");
+
+  logger().debug("kopsik_time_entry_view_item_array_borrowed");
+
+  return time_entry_view_item_array(context, errmsg, errlen, array, true);
+}
+
+static void clear_date_durations(KopsikDateDuration *day) {
+  while (day) {
+    KopsikDateDuration *next = reinterpret_cast<KopsikDateDuration *>(
+      day->Next);
+    free(day->DateHeader);
+    free(day->DateDuration);
+    delete day;
+    day = next;
+  }
+}
+
+// View items with only the GUID set, in the given order
+static KopsikViewItem *deleted_view_items(
+    const std::vector<std::string> &GUIDs) {
+  KopsikViewItem *first = 0;
+  for (std::vector<std::string>::const_reverse_iterator it = GUIDs.rbegin();
+      it != GUIDs.rend();
+      it++) {
+    KopsikViewItem *item = view_item_init();
+    item->GUID = strdup(it->c_str());
+    item->Next = first;
+    first = item;
+  }
+  return first;
+}
+
+// Totals of the given days as the snapshot has them, null for the
+// days without time entries
+static KopsikDateDuration *date_durations(
+    kopsik::UserSnapshot *snapshot,
+    const std::set<std::string> &date_headers) {
+  KopsikDateDuration *first = 0;
+  for (std::set<std::string>::const_reverse_iterator it =
+      date_headers.rbegin();
+      it != date_headers.rend();
+      it++) {
+    KopsikDateDuration *day = new KopsikDateDuration();
+    day->DateHeader = strdup(it->c_str());
+    day->DateDuration = 0;
+    if (snapshot->DateDurations.count(*it)) {
+      day->DateDuration = strdup(
+        snapshot->FormattedDateDuration(*it).c_str());
+    }
+    day->Next = first;
+    first = day;
+  }
+  return first;
+}
+
+KopsikTimeEntryListChanges *kopsik_time_entry_list_changes_init() {
+  KOPSIK_API_CALL("");
+
+  KopsikTimeEntryListChanges *changes = new KopsikTimeEntryListChanges();
+  changes->Version = 0;
+  changes->IsFullList = 0;
+  changes->Inserted = 0;
+  changes->Updated = 0;
+  changes->Deleted = 0;
+  changes->DateDurations = 0;
+  return changes;
+}
+
+void kopsik_time_entry_list_changes_clear(
+    KopsikTimeEntryListChanges *changes) {
+  KOPSIK_API_CALL("");
+
+  if (!changes) {
+    return;
+  }
+  kopsik_time_entry_view_item_clear(changes->Inserted);
+  kopsik_time_entry_view_item_clear(changes->Updated);
+  kopsik_view_item_clear(changes->Deleted);
+  clear_date_durations(changes->DateDurations);
+  delete changes;
+}
+
+// Appends view items of the given snapshot entries, in the given order
+static void append_time_entry_view_items(
+    kopsik::UserSnapshot *snapshot,
+    const std::vector<std::string> &GUIDs,
+    KopsikTimeEntryViewItem **first) {
+  KopsikTimeEntryViewItem *previous = 0;
+  for (std::vector<std::string>::const_iterator it = GUIDs.begin();
+      it != GUIDs.end();
+      it++) {
+    const kopsik::TimeEntrySnapshot &te =
+      snapshot->TimeEntries[snapshot->TimeEntryIndex[*it]];
+    KopsikTimeEntryViewItem *view_item = kopsik_time_entry_view_item_init();
+    time_entry_snapshot_to_view_item(te, view_item,
+      snapshot->FormattedDateDuration(te.DateHeader));
+    if (previous) {
+      previous->Next = view_item;
+    } else {
+      *first = view_item;
+    }
+    previous = view_item;
+  }
+}
+
+kopsik_api_result kopsik_time_entry_list_changes(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const unsigned int since_version,
+    KopsikTimeEntryListChanges *changes) {
+  KOPSIK_API_CALL("since_version=" << since_version);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(out_item);
-    poco_assert(out_is_tracking);
-
-    logger().debug("kopsik_running_time_entry_view_item");
-
-    *out_is_tracking = 0;
-    kopsik::TimeEntry *te = 0;
-    kopsik::error err = app(context)->RunningTimeEntry(&te);
-    if (err != kopsik::noError) {
-      strncpy(errmsg, err.c_str(), errlen);
-      return KOPSIK_API_FAILURE;
+    poco_assert(changes);
+    poco_assert(!changes->Inserted);
+    poco_assert(!changes->Updated);
+    poco_assert(!changes->Deleted);
+    poco_assert(!changes->DateDurations);
+
+    logger().debug("kopsik_time_entry_list_changes");
+
+    Poco::AutoPtr<kopsik::UserSnapshot> snapshot;
+    kopsik::TimeEntryListDiff diff;
+    bool is_diff = since_version && app(context)->TimeEntryListChanges(
+      since_version, &snapshot, &diff);
+    if (!is_diff) {
+      snapshot = app(context)->Snapshot();
+      diff = kopsik::TimeEntryListDiff();
+      if (snapshot) {
+        diff.Version = snapshot->Version;
+        for (std::size_t i = 0; i < snapshot->TimeEntries.size(); i++) {
+          diff.Inserted.push_back(snapshot->TimeEntries[i].GUID);
+          diff.DateHeaders.insert(snapshot->TimeEntries[i].DateHeader);
+        }
+      }
     }
-    if (te) {
-      *out_is_tracking = true;
-      std::string project_label("");
-      std::string color_code("");
-      app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
-      time_entry_to_view_item(te,
-                              project_label,
-                              color_code,
-                              out_item,
-                              "");
+
+    changes->Version = static_cast<unsigned int>(diff.Version);
+    changes->IsFullList = is_diff ? 0 : 1;
+    if (!snapshot) {
+      return KOPSIK_API_SUCCESS;
     }
+
+    append_time_entry_view_items(snapshot, diff.Inserted, &changes->Inserted);
+    append_time_entry_view_items(snapshot, diff.Updated, &changes->Updated);
+    changes->Deleted = deleted_view_items(diff.Deleted);
+    changes->DateDurations = date_durations(snapshot, diff.DateHeaders);
   } catch(const Poco::Exception& exc) {
     strncpy(errmsg, exc.displayText().c_str(), errlen);
     return KOPSIK_API_FAILURE;
@@ -1702,58 +4042,156 @@ kopsik_api_result kopsik_running_time_entry_view_item(
   return KOPSIK_API_SUCCESS;
 }
 
-kopsik_api_result kopsik_time_entry_view_items(
+void kopsik_time_entry_group_view_item_clear(
+    KopsikTimeEntryGroupViewItem *item) {
+  KOPSIK_API_CALL("");
+
+  while (item) {
+    KopsikTimeEntryGroupViewItem *next =
+      reinterpret_cast<KopsikTimeEntryGroupViewItem *>(item->Next);
+    free(item->Key);
+    free(item->Description);
+    free(item->ProjectAndTaskLabel);
+    free(item->Color);
+    free(item->Duration);
+    free(item->DateHeader);
+    free(item->DateDuration);
+    kopsik_view_item_clear(item->TimeEntries);
+    delete item;
+    item = next;
+  }
+}
+
+KopsikTimeEntryGroupListChanges *
+    kopsik_time_entry_group_list_changes_init() {
+  KOPSIK_API_CALL("");
+
+  KopsikTimeEntryGroupListChanges *changes =
+    new KopsikTimeEntryGroupListChanges();
+  changes->Version = 0;
+  changes->IsFullList = 0;
+  changes->Inserted = 0;
+  changes->Updated = 0;
+  changes->Deleted = 0;
+  changes->DateDurations = 0;
+  return changes;
+}
+
+void kopsik_time_entry_group_list_changes_clear(
+    KopsikTimeEntryGroupListChanges *changes) {
+  KOPSIK_API_CALL("");
+
+  if (!changes) {
+    return;
+  }
+  kopsik_time_entry_group_view_item_clear(changes->Inserted);
+  kopsik_time_entry_group_view_item_clear(changes->Updated);
+  kopsik_view_item_clear(changes->Deleted);
+  clear_date_durations(changes->DateDurations);
+  delete changes;
+}
+
+// Appends view items of the given snapshot groups, in the given order
+static void append_time_entry_group_view_items(
+    kopsik::UserSnapshot *snapshot,
+    const std::vector<std::string> &keys,
+    KopsikTimeEntryGroupViewItem **first) {
+  KopsikTimeEntryGroupViewItem *previous = 0;
+  for (std::vector<std::string>::const_iterator it = keys.begin();
+      it != keys.end();
+      it++) {
+    const kopsik::TimeEntryGroupSnapshot &group =
+      snapshot->TimeEntryGroups[snapshot->TimeEntryGroupIndex[*it]];
+    KopsikTimeEntryGroupViewItem *view_item =
+      new KopsikTimeEntryGroupViewItem();
+    view_item->Key = strdup(group.Key.c_str());
+    view_item->Description = strdup(group.Description.c_str());
+    view_item->ProjectAndTaskLabel =
+      strdup(group.ProjectAndTaskLabel.c_str());
+    view_item->Color = strdup(group.Color.c_str());
+    view_item->WID = static_cast<unsigned int>(group.WID);
+    view_item->PID = static_cast<unsigned int>(group.PID);
+    view_item->TID = static_cast<unsigned int>(group.TID);
+    view_item->DurationInSeconds =
+      static_cast<int>(group.DurationInSeconds);
+    view_item->Duration = strdup(group.Duration.c_str());
+    view_item->Started = static_cast<unsigned int>(group.Started);
+    view_item->Ended = static_cast<unsigned int>(group.Ended);
+    view_item->DateHeader = strdup(group.DateHeader.c_str());
+    view_item->DateDuration = 0;
+    const std::string &date_duration =
+      snapshot->FormattedDateDuration(group.DateHeader);
+    if (!date_duration.empty()) {
+      view_item->DateDuration = strdup(date_duration.c_str());
+    }
+    view_item->Count = static_cast<unsigned int>(group.GUIDs.size());
+    view_item->TimeEntries = 0;
+    for (std::vector<std::string>::const_reverse_iterator guid =
+        group.GUIDs.rbegin();
+        guid != group.GUIDs.rend();
+        guid++) {
+      KopsikViewItem *entry = view_item_init();
+      entry->GUID = strdup(guid->c_str());
+      entry->Next = view_item->TimeEntries;
+      view_item->TimeEntries = entry;
+    }
+    view_item->Next = 0;
+    if (previous) {
+      previous->Next = view_item;
+    } else {
+      *first = view_item;
+    }
+    previous = view_item;
+  }
+}
+
+kopsik_api_result kopsik_time_entry_group_list_changes(
     void *context,
     char *errmsg,
     const unsigned int errlen,
-    KopsikTimeEntryViewItem **first) {
+    const unsigned int since_version,
+    KopsikTimeEntryGroupListChanges *changes) {
+  KOPSIK_API_CALL("since_version=" << since_version);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
-    poco_assert(first);
-
-    logger().debug("kopsik_time_entry_view_items");
-
-    std::map<std::string, Poco::Int64> date_durations;
-    std::vector<kopsik::TimeEntry *> visible;
-
-    kopsik::error err = app(context)->TimeEntries(&date_durations,
-      &visible);
-    if (err != kopsik::noError) {
-      strncpy(errmsg, err.c_str(), errlen);
-      return KOPSIK_API_FAILURE;
+    poco_assert(changes);
+    poco_assert(!changes->Inserted);
+    poco_assert(!changes->Updated);
+    poco_assert(!changes->Deleted);
+    poco_assert(!changes->DateDurations);
+
+    logger().debug("kopsik_time_entry_group_list_changes");
+
+    Poco::AutoPtr<kopsik::UserSnapshot> snapshot;
+    kopsik::TimeEntryListDiff diff;
+    bool is_diff = since_version && app(context)->TimeEntryGroupListChanges(
+      since_version, &snapshot, &diff);
+    if (!is_diff) {
+      snapshot = app(context)->Snapshot();
+      diff = kopsik::TimeEntryListDiff();
+      if (snapshot) {
+        diff.Version = snapshot->Version;
+        for (std::size_t i = 0; i < snapshot->TimeEntryGroups.size(); i++) {
+          diff.Inserted.push_back(snapshot->TimeEntryGroups[i].Key);
+          diff.DateHeaders.insert(snapshot->TimeEntryGroups[i].DateHeader);
+        }
+      }
     }
 
-    if (visible.empty()) {
+    changes->Version = static_cast<unsigned int>(diff.Version);
+    changes->IsFullList = is_diff ? 0 : 1;
+    if (!snapshot) {
       return KOPSIK_API_SUCCESS;
     }
 
-    *first = 0;
-    KopsikTimeEntryViewItem *previous = 0;
-    for (unsigned int i = 0; i < visible.size(); i++) {
-      kopsik::TimeEntry *te = visible[i];
-      KopsikTimeEntryViewItem *view_item = kopsik_time_entry_view_item_init();
-      if (previous) {
-        previous->Next = view_item;
-      }
-      if (!*first) {
-        *first = view_item;
-      }
-
-      Poco::Int64 duration = date_durations[te->DateHeaderString()];
-      std::string formatted =
-        kopsik::Formatter::FormatDurationInSecondsHHMM(duration, 2);
-
-      std::string project_label("");
-      std::string color_code("");
-      app(context)->ProjectLabelAndColorCode(te, &project_label, &color_code);
-      time_entry_to_view_item(te,
-                              project_label,
-                              color_code,
-                              view_item,
-                              formatted);
-      previous = view_item;
-    }
+    append_time_entry_group_view_items(snapshot, diff.Inserted,
+                                       &changes->Inserted);
+    append_time_entry_group_view_items(snapshot, diff.Updated,
+                                       &changes->Updated);
+    changes->Deleted = deleted_view_items(diff.Deleted);
+    changes->DateDurations = date_durations(snapshot, diff.DateHeaders);
   } catch(const Poco::Exception& exc) {
     strncpy(errmsg, exc.displayText().c_str(), errlen);
     return KOPSIK_API_FAILURE;
@@ -1774,6 +4212,9 @@ kopsik_api_result kopsik_duration_for_date_header(
     const char *date,
     char *duration,
     const unsigned int duration_len) {
+  KOPSIK_API_CALL("date=" << kopsik::ApiArg(date)
+    << " duration_len=" << duration_len);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -1810,9 +4251,9 @@ kopsik_api_result kopsik_duration_for_date_header(
 void kopsik_websocket_switch(
     void *context,
     const unsigned int on) {
-  std::stringstream ss;
-  ss << "kopsik_websocket_switch on=" << on;
-  logger().debug(ss.str());
+  KOPSIK_API_CALL("on=" << on);
+
+  KOPSIK_LOG_DEBUG(logger(), "kopsik_websocket_switch on=" << on);
 
   if (on) {
     app(context)->SwitchWebSocketOn();
@@ -1826,9 +4267,9 @@ void kopsik_websocket_switch(
 void kopsik_timeline_switch(
     void *context,
     const unsigned int on) {
-  std::stringstream ss;
-  ss << "kopsik_timeline_switch on=" << on;
-  logger().debug(ss.str());
+  KOPSIK_API_CALL("on=" << on);
+
+  KOPSIK_LOG_DEBUG(logger(), "kopsik_timeline_switch on=" << on);
 
   if (on) {
     app(context)->SwitchTimelineOn();
@@ -1840,12 +4281,16 @@ void kopsik_timeline_switch(
 
 void kopsik_timeline_toggle_recording(
     void *context) {
+  KOPSIK_API_CALL("");
+
   logger().debug("kopsik_timeline_toggle_recording");
   app(context)->ToggleTimelineRecording();
 }
 
 int kopsik_timeline_is_recording_enabled(
     void *context) {
+  KOPSIK_API_CALL("");
+
   return app(context)->RecordTimeline();
 }
 
@@ -1858,9 +4303,12 @@ kopsik_api_result kopsik_feedback_send(
     const char *topic,
     const char *details,
     const char *filename) {
-  std::stringstream ss;
-  ss << "kopsik_feedback_send topic=" << topic << " details=" << details;
-  logger().debug(ss.str());
+  KOPSIK_API_CALL("topic=" << kopsik::ApiPrivateArg(topic)
+    << " details=" << kopsik::ApiPrivateArg(details)
+    << " filename=" << kopsik::ApiArg(filename));
+
+  KOPSIK_LOG_DEBUG(logger(), "kopsik_feedback_send topic=" << topic
+      << " details=" << details);
 
   kopsik::Feedback feedback(topic, details, filename);
 
@@ -1876,6 +4324,8 @@ kopsik_api_result kopsik_feedback_send(
 
 void kopsik_check_for_updates(
     void *context) {
+  KOPSIK_API_CALL("");
+
   logger().debug("kopsik_check_for_updates");
 
   app(context)->FetchUpdates();
@@ -1886,6 +4336,8 @@ kopsik_api_result kopsik_set_update_channel(
     char *errmsg,
     const unsigned int errlen,
     const char *update_channel) {
+  KOPSIK_API_CALL("update_channel=" << kopsik::ApiArg(update_channel));
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -1916,6 +4368,8 @@ kopsik_api_result kopsik_get_update_channel(
     const unsigned int errlen,
     char *update_channel,
     const unsigned int update_channel_len) {
+  KOPSIK_API_CALL("update_channel_len=" << update_channel_len);
+
   try {
     poco_assert(errmsg);
     poco_assert(errlen);
@@ -1944,8 +4398,194 @@ kopsik_api_result kopsik_get_update_channel(
 }
 
 int kopsik_parse_duration_string_into_seconds(const char *duration_string) {
+  KOPSIK_API_CALL("duration_string=" << kopsik::ApiArg(duration_string));
+
   if (!duration_string) {
     return 0;
   }
   return kopsik::Formatter::ParseDurationString(std::string(duration_string));
 }
+
+kopsik_api_result kopsik_get_metrics(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    char **json) {
+  KOPSIK_API_CALL("");
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(json);
+
+    app(context)->UpdateMemoryMetrics();
+    *json = strdup(kopsik::Metrics::Shared().JSON().c_str());
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+void kopsik_metrics_clear(
+    char *json) {
+  KOPSIK_API_CALL("");
+
+  free(json);
+}
+
+void kopsik_trace_switch(
+    void *context,
+    const unsigned int on) {
+  KOPSIK_API_CALL("on=" << on);
+
+  KOPSIK_LOG_DEBUG(logger(), "kopsik_trace_switch on=" << on);
+
+  kopsik::Trace::SetEnabled(on != 0);
+}
+
+kopsik_api_result kopsik_trace_dump(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    char **json) {
+  KOPSIK_API_CALL("");
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(json);
+
+    *json = strdup(kopsik::Trace::Shared().JSON().c_str());
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+void kopsik_trace_clear(
+    char *json) {
+  KOPSIK_API_CALL("");
+
+  free(json);
+}
+
+void kopsik_lock_metrics_switch(
+    void *context,
+    const unsigned int on,
+    const unsigned int slow_wait_ms) {
+  KOPSIK_API_CALL("on=" << on << " slow_wait_ms=" << slow_wait_ms);
+
+  KOPSIK_LOG_DEBUG(logger(), "kopsik_lock_metrics_switch on=" << on
+    << " slow_wait_ms=" << slow_wait_ms);
+
+  kopsik::LockMetrics::SetSlowWaitMicros(
+    static_cast<Poco::Int64>(slow_wait_ms) * 1000);
+  kopsik::LockMetrics::SetEnabled(on != 0);
+}
+
+void kopsik_api_watchdog_switch(
+    void *context,
+    const unsigned int budget_ms) {
+  KOPSIK_API_CALL("budget_ms=" << budget_ms);
+
+  KOPSIK_LOG_DEBUG(logger(), "kopsik_api_watchdog_switch budget_ms="
+    << budget_ms);
+
+  kopsik::ApiWatchdog::SetBudgetMicros(
+    static_cast<Poco::Int64>(budget_ms) * 1000);
+}
+
+kopsik_api_result kopsik_api_watchdog_dump(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    char **json) {
+  KOPSIK_API_CALL("");
+
+  try {
+    poco_assert(errmsg);
+    poco_assert(errlen);
+    poco_assert(json);
+
+    *json = strdup(kopsik::ApiWatchdog::Shared().JSON().c_str());
+  } catch(const Poco::Exception& exc) {
+      strncpy(errmsg, exc.displayText().c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::exception& ex) {
+      strncpy(errmsg, ex.what(), errlen);
+      return KOPSIK_API_FAILURE;
+  } catch(const std::string& ex) {
+      strncpy(errmsg, ex.c_str(), errlen);
+      return KOPSIK_API_FAILURE;
+  }
+  return KOPSIK_API_SUCCESS;
+}
+
+void kopsik_api_watchdog_clear(
+    char *json) {
+  KOPSIK_API_CALL("");
+
+  free(json);
+}
+
+kopsik_api_result kopsik_ipc_serve(
+    void *context,
+    char *errmsg,
+    const unsigned int errlen,
+    const char *db_path) {
+  KOPSIK_API_CALL("db_path=" << kopsik::ApiArg(db_path));
+
+  poco_assert(errmsg);
+  poco_assert(errlen);
+  poco_assert(db_path);
+
+  logger().debug("kopsik_ipc_serve");
+
+  kopsik_ipc_stop(context);
+
+  kopsik::IpcServer *server = new kopsik::IpcServer(context, db_path);
+  kopsik::error err = server->Start();
+  if (err != kopsik::noError) {
+    delete server;
+    strncpy(errmsg, err.c_str(), errlen);
+    return KOPSIK_API_FAILURE;
+  }
+
+  Poco::FastMutex::ScopedLock lock(ipc_servers_m);
+  ipc_servers[context] = server;
+  return KOPSIK_API_SUCCESS;
+}
+
+void kopsik_ipc_stop(
+    void *context) {
+  KOPSIK_API_CALL("");
+
+  kopsik::IpcServer *server = 0;
+  {
+    Poco::FastMutex::ScopedLock lock(ipc_servers_m);
+    std::map<void *, kopsik::IpcServer *>::iterator it =
+      ipc_servers.find(context);
+    if (it == ipc_servers.end()) {
+      return;
+    }
+    server = it->second;
+    ipc_servers.erase(it);
+  }
+
+  // Waits for the clients, outside the lock
+  delete server;
+}
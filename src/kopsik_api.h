@@ -21,8 +21,8 @@ KOPSIK_EXPORT int kopsik_is_networking_error(
   const char *error);
 
 typedef struct {
-  char *ModelType;
-  char *ChangeType;
+  const char *ModelType;
+  const char *ChangeType;
   unsigned int ModelID;
   char *GUID;
 } KopsikModelChange;
@@ -32,6 +32,11 @@ typedef void (*KopsikViewItemChangeCallback)(
   const char *errmsg,
   KopsikModelChange *change);
 
+// The changes are valid only during the call
+typedef void (*KopsikModelChangesCallback)(
+  KopsikModelChange *changes,
+  const unsigned int count);
+
 typedef void (*KopsikResultCallback)(
   kopsik_api_result result,
   const char *errmsg);
@@ -48,6 +53,12 @@ typedef void (*KopsikCheckUpdateCallback)(
 
 typedef void (*KopsikOnOnlineCallback)();
 
+// idle_ended is 0 when the user has just gone idle, and the time they
+// came back once they have. Called on the idle detector's thread.
+typedef void (*KopsikIdleCallback)(
+  const unsigned int idle_started,
+  const unsigned int idle_ended);
+
 // Generic view item
 
 typedef struct {
@@ -76,6 +87,50 @@ KOPSIK_EXPORT void kopsik_context_shutdown(
 KOPSIK_EXPORT void kopsik_context_clear(
   void *context);
 
+// Deliver model changes to the callback all at once, with the changes
+// to the same model merged, instead of one by one to change_callback.
+// After a sync, the UI can then apply everything in one render pass.
+KOPSIK_EXPORT void kopsik_set_model_changes_callback(
+  void *context,
+  KopsikModelChangesCallback changes_callback);
+
+// Models and kinds of change a subscription asks for, or-ed together
+#define KOPSIK_MODEL_TIME_ENTRY (1 << 0)
+#define KOPSIK_MODEL_WORKSPACE (1 << 1)
+#define KOPSIK_MODEL_CLIENT (1 << 2)
+#define KOPSIK_MODEL_PROJECT (1 << 3)
+#define KOPSIK_MODEL_USER (1 << 4)
+#define KOPSIK_MODEL_TASK (1 << 5)
+#define KOPSIK_MODEL_TAG (1 << 6)
+
+#define KOPSIK_CHANGE_INSERT (1 << 0)
+#define KOPSIK_CHANGE_UPDATE (1 << 1)
+#define KOPSIK_CHANGE_DELETE (1 << 2)
+
+// Deliver only the changes of the given models and kinds to the
+// callback, 0 for all of them, so each part of the UI hears about
+// what it renders. With coalesce, changes to the same model are
+// merged first, as with kopsik_set_model_changes_callback.
+// Subscriptions are told besides change_callback, which may be 0.
+// Returns the subscription, to unsubscribe with.
+KOPSIK_EXPORT unsigned int kopsik_subscribe_model_changes(
+  void *context,
+  const unsigned int models,
+  const unsigned int changes,
+  const int coalesce,
+  KopsikModelChangesCallback changes_callback);
+
+KOPSIK_EXPORT void kopsik_unsubscribe_model_changes(
+  void *context,
+  const unsigned int subscription);
+
+// Tell the callback when the keyboard and mouse have not been used for
+// a while, and when they are again. Only when idle detection is on in
+// the settings. Pass 0 to stop.
+KOPSIK_EXPORT void kopsik_set_idle_callback(
+  void *context,
+  KopsikIdleCallback idle_callback);
+
 // Configuration API
 
 typedef struct {
@@ -120,12 +175,75 @@ KOPSIK_EXPORT kopsik_api_result kopsik_set_db_path(
   const unsigned int errlen,
   const char *path);
 
+// SQLite settings of the database, applied now if it's open and
+// whenever kopsik_set_db_path opens one. synchronous is 0 for OFF,
+// 1 for NORMAL and 2 for FULL. temp_store is 0 for DEFAULT, 1 for
+// FILE and 2 for MEMORY. A page size only applies to a new database.
+// The values that took effect are logged.
+KOPSIK_EXPORT kopsik_api_result kopsik_set_db_tuning(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const int synchronous,
+  const int temp_store,
+  const unsigned int cache_size_kib,
+  const unsigned int mmap_size_mib,
+  const unsigned int page_size);
+
+// Stopped and pushed time entries this many days old are moved out of
+// the time entry table into a compressed archive while the app is
+// idle. Reports and exports still include them, the time entry list
+// and search don't, and server deletes of them aren't applied. 0, the
+// default, turns archiving off.
+KOPSIK_EXPORT void kopsik_set_time_entry_archive_days(
+  void *context,
+  const unsigned int days);
+
+// Timeline events that pile up while they can't be uploaded, behind a
+// proxy that blocks it for days, are packed into gzipped blocks of
+// their upload JSON. Blocks are uploaded as they are once it works
+// again. Off by default.
+KOPSIK_EXPORT void kopsik_set_timeline_blocks(
+  void *context,
+  const int on);
+
+// Timeline batches are sent on the WebSocket connection while it's up,
+// instead of a new HTTPS request each, and the server's acknowledgement
+// has them deleted. Needs a stream server that takes them. Off by
+// default.
+KOPSIK_EXPORT void kopsik_set_timeline_over_websocket(
+  void *context,
+  const int on);
+
+// Patterns, one per line, that keep window titles out of the timeline.
+// They're plain text, matched anywhere in a title or filename
+// regardless of case. Matches of a redact pattern are recorded as ***,
+// windows matching a drop pattern are not recorded. Either can be
+// NULL for none. Replaces the patterns set before.
+KOPSIK_EXPORT void kopsik_set_timeline_title_filters(
+  void *context,
+  const char *redact,
+  const char *drop);
+
 KOPSIK_EXPORT void kopsik_set_log_path(
   const char *path);
 
 KOPSIK_EXPORT void kopsik_set_log_level(
   const char *level);
 
+// Turns trace logging on and writes it to the file in a compact
+// binary form, leaving the other levels in the log set with
+// kopsik_set_log_path. Call after it.
+KOPSIK_EXPORT void kopsik_set_trace_log_path(
+  const char *path);
+
+// Records HTTP requests and WebSocket messages, bodies included, to
+// the file for replaying them later. An empty path stops recording.
+KOPSIK_EXPORT kopsik_api_result kopsik_set_traffic_recording_path(
+  char *errmsg,
+  const unsigned int errlen,
+  const char *path);
+
 KOPSIK_EXPORT void kopsik_set_api_url(
   void *context,
   const char *api_url);
@@ -178,6 +296,28 @@ KOPSIK_EXPORT kopsik_api_result kopsik_login(
   const char *email,
   const char *password);
 
+// With progressive login on, kopsik_login returns once the user and
+// the running time entry are in, and the rest of the user's data is
+// pulled in the background. Its changes come through the model change
+// callbacks, the last of them an update of the user once all of it is
+// in. Off by default.
+KOPSIK_EXPORT void kopsik_set_progressive_login(
+  void *context,
+  const int on);
+
+// With per-workspace sync on, a full sync fetches the user first, then
+// the clients, projects, tasks and tags of each workspace and the
+// time entries in date ranges, several requests at a time. Each piece
+// is applied, and its changes reported, as it arrives, so a slow
+// workspace doesn't hold the others back. Off by default.
+KOPSIK_EXPORT void kopsik_set_per_workspace_sync(
+  void *context,
+  const int on);
+
+// 1 while progressive login is still pulling the user's data
+KOPSIK_EXPORT int kopsik_login_sync_pending(
+  void *context);
+
 KOPSIK_EXPORT kopsik_api_result kopsik_logout(
   void *context,
   char *errmsg,
@@ -188,6 +328,12 @@ KOPSIK_EXPORT kopsik_api_result kopsik_clear_cache(
   char *errmsg,
   const unsigned int errlen);
 
+// Writes changes to the database now, instead of a moment later
+KOPSIK_EXPORT kopsik_api_result kopsik_save(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen);
+
 KOPSIK_EXPORT kopsik_api_result kopsik_user_has_premium_workspaces(
   void *context,
   char *errmsg,
@@ -221,6 +367,21 @@ KOPSIK_EXPORT kopsik_api_result kopsik_pushable_models(
 KOPSIK_EXPORT void kopsik_sync(
   void *context);
 
+// Network reachability as the OS reports it, 0 for offline. Syncing,
+// update checks and timeline uploads are paused while offline. When
+// back online, edits made meanwhile are pushed before changes are pulled.
+KOPSIK_EXPORT void kopsik_set_online(
+  void *context,
+  const int online);
+
+// Power source as the OS reports it, 1 when on battery. On battery,
+// background work like periodic syncs, timeline uploads and polls runs
+// less often and in shared wakeups, to let the CPU sleep. On AC power
+// (the default) it runs as usual.
+KOPSIK_EXPORT void kopsik_set_on_battery(
+  void *context,
+  const int on_battery);
+
 // Autocomplete list items
 
 typedef struct {
@@ -243,9 +404,81 @@ KOPSIK_EXPORT kopsik_api_result kopsik_autocomplete_items(
   const unsigned int include_tasks,
   const unsigned int include_projects);
 
+// At most limit items, in the same order as kopsik_autocomplete_items,
+// where each word of the typed text starts a word of the item's Text.
+KOPSIK_EXPORT kopsik_api_result kopsik_autocomplete_items_matching(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  KopsikAutocompleteItem **first,
+  const char *typed,
+  const unsigned int limit,
+  const unsigned int include_time_entries,
+  const unsigned int include_tasks,
+  const unsigned int include_projects);
+
+// Items found for a query of kopsik_autocomplete_query. They're freed
+// when the callback returns.
+typedef void (*KopsikAutocompleteQueryCallback)(
+  const unsigned int query_id,
+  KopsikAutocompleteItem *first);
+
+// Finds the same items as kopsik_autocomplete_items_matching, but on a
+// worker thread, so the UI can query as the user types. Returns the ID
+// of the query, which the callback is called with. A query supersedes
+// those before it: their callbacks aren't called anymore.
+KOPSIK_EXPORT unsigned int kopsik_autocomplete_query(
+  void *context,
+  const char *typed,
+  const unsigned int limit,
+  const unsigned int include_time_entries,
+  const unsigned int include_tasks,
+  const unsigned int include_projects,
+  KopsikAutocompleteQueryCallback callback);
+
 KOPSIK_EXPORT void kopsik_autocomplete_item_clear(
   KopsikAutocompleteItem *item);
 
+// The same items as kopsik_autocomplete_items, in one array that also
+// holds all of their strings, copied once from the items the context
+// keeps. The items are linked through Next as well. Free them only
+// with kopsik_autocomplete_item_array_clear.
+typedef struct {
+  KopsikAutocompleteItem *Items;
+  unsigned int Length;
+  // Kept alive for a borrowed array, see
+  // kopsik_autocomplete_item_array_borrowed
+  void *Snapshot;
+} KopsikAutocompleteItemArray;
+
+KOPSIK_EXPORT KopsikAutocompleteItemArray *
+  kopsik_autocomplete_item_array_init();
+
+KOPSIK_EXPORT void kopsik_autocomplete_item_array_clear(
+  KopsikAutocompleteItemArray *array);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_autocomplete_item_array(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  KopsikAutocompleteItemArray *array,
+  const unsigned int include_time_entries,
+  const unsigned int include_tasks,
+  const unsigned int include_projects);
+
+// Like kopsik_autocomplete_item_array, but no string is copied: they
+// point into the context's snapshot of the user's data, which the
+// array keeps alive until kopsik_autocomplete_item_array_clear. The
+// strings are read-only.
+KOPSIK_EXPORT kopsik_api_result kopsik_autocomplete_item_array_borrowed(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  KopsikAutocompleteItemArray *array,
+  const unsigned int include_time_entries,
+  const unsigned int include_tasks,
+  const unsigned int include_projects);
+
 // Tags
 
 KOPSIK_EXPORT kopsik_api_result kopsik_tags(
@@ -318,6 +551,19 @@ KOPSIK_EXPORT kopsik_api_result kopsik_running_time_entry_view_item(
   KopsikTimeEntryViewItem *item,
   int *is_tracking);
 
+// For a timer that ticks every second: the start of the running time
+// entry, as Unix time, and a version that changes only when the
+// running time entry does. Read the whole entry with
+// kopsik_running_time_entry_view_item when the version changes.
+// Allocates nothing.
+KOPSIK_EXPORT kopsik_api_result kopsik_running_timer(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  unsigned int *started,
+  unsigned int *version,
+  int *is_tracking);
+
 KOPSIK_EXPORT void kopsik_format_duration_in_seconds_hhmmss(
   const int duration_in_seconds,
   char *str,
@@ -421,6 +667,58 @@ KOPSIK_EXPORT kopsik_api_result kopsik_set_time_entry_description(
   const char *guid,
   const char *value);
 
+// Fields of KopsikTimeEntryEdit to change, or-ed into Fields
+#define KOPSIK_EDIT_DESCRIPTION (1 << 0)
+#define KOPSIK_EDIT_PROJECT (1 << 1)
+#define KOPSIK_EDIT_BILLABLE (1 << 2)
+#define KOPSIK_EDIT_TAGS (1 << 3)
+#define KOPSIK_EDIT_START (1 << 4)
+#define KOPSIK_EDIT_END (1 << 5)
+#define KOPSIK_EDIT_DURATION (1 << 6)
+
+// Values are the same as given to the kopsik_set_time_entry_* calls.
+// Only the flagged ones are looked at, so the others can be left 0.
+typedef struct {
+  unsigned int Fields;
+  const char *Description;
+  unsigned int TID;
+  unsigned int PID;
+  const char *ProjectGUID;
+  int Billable;
+  const char *Tags;
+  const char *StartISO8601;
+  const char *EndISO8601;
+  const char *Duration;
+} KopsikTimeEntryEdit;
+
+// Makes all the changes of an edit at once, saving and pushing the
+// entry once instead of after each field.
+KOPSIK_EXPORT kopsik_api_result kopsik_edit_time_entry(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  const KopsikTimeEntryEdit *edit);
+
+// The same edit made to each of count time entries, such as moving
+// them to a project, or deleting them. They're changed under one
+// lock, saved in one transaction and pushed in batches. None is
+// changed if one of the GUIDs isn't found.
+KOPSIK_EXPORT kopsik_api_result kopsik_edit_time_entries(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char **guids,
+  const unsigned int count,
+  const KopsikTimeEntryEdit *edit);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_delete_time_entries(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char **guids,
+  const unsigned int count);
+
 KOPSIK_EXPORT kopsik_api_result kopsik_stop(
   void *context,
   char *errmsg,
@@ -428,6 +726,127 @@ KOPSIK_EXPORT kopsik_api_result kopsik_stop(
   KopsikTimeEntryViewItem *item,
   int *was_found);
 
+// Same as the calls above, but they return once the change is made
+// in memory. It's saved on a background thread, which then calls the
+// callback with how it went. The callback must be given.
+
+KOPSIK_EXPORT kopsik_api_result kopsik_start_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *description,
+  const char *duration,
+  const unsigned int task_id,
+  const unsigned int project_id,
+  KopsikTimeEntryViewItem *item,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_continue_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  KopsikTimeEntryViewItem *item,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_delete_time_entry_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_set_time_entry_duration_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  const char *value,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_set_time_entry_project_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  const unsigned int task_id,
+  const unsigned int project_id,
+  const char *project_guid,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_set_time_entry_start_iso_8601_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  const char *value,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_set_time_entry_end_iso_8601_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  const char *value,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_set_time_entry_tags_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  const char *value,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_set_time_entry_billable_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  int value,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_set_time_entry_description_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  const char *value,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_edit_time_entry_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  const KopsikTimeEntryEdit *edit,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_edit_time_entries_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char **guids,
+  const unsigned int count,
+  const KopsikTimeEntryEdit *edit,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_delete_time_entries_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char **guids,
+  const unsigned int count,
+  KopsikResultCallback callback);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_stop_async(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  KopsikTimeEntryViewItem *item,
+  int *was_found,
+  KopsikResultCallback callback);
+
 KOPSIK_EXPORT kopsik_api_result kopsik_split_running_time_entry_at(
   void *context,
   char *err,
@@ -450,6 +869,315 @@ KOPSIK_EXPORT kopsik_api_result kopsik_time_entry_view_items(
   const unsigned int errlen,
   KopsikTimeEntryViewItem **first);
 
+// One page of the items kopsik_time_entry_view_items lists, newest
+// first: at most limit items that started before started_before
+// (0 to start from the newest). Items starting in the same second
+// are never split between pages, so a page may run over the limit.
+// Pass next_started_before to get the following page. It's 0 when
+// there are no more items.
+KOPSIK_EXPORT kopsik_api_result kopsik_time_entry_view_items_page(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const unsigned int started_before,
+  const unsigned int limit,
+  KopsikTimeEntryViewItem **first,
+  unsigned int *next_started_before);
+
+// Saved time entries having words that start with each word of the
+// query in their description, or the words in their project or client
+// name. Entries with the whole words in their description come first,
+// then the newest. Skips offset entries and lists at most limit.
+KOPSIK_EXPORT kopsik_api_result kopsik_search_time_entries(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *query,
+  const unsigned int offset,
+  const unsigned int limit,
+  KopsikTimeEntryViewItem **first);
+
+// Overlaps
+
+// A loaded time entry found by the time it covers. Ended is 0 while
+// it's running.
+typedef struct {
+  char *GUID;
+  unsigned int Started;
+  unsigned int Ended;
+  void *Next;
+} KopsikTimeEntrySpan;
+
+KOPSIK_EXPORT void kopsik_time_entry_span_clear(
+  KopsikTimeEntrySpan *first);
+
+// Time entries that overlap the time from..to, by start. Running
+// time entries overlap everything after they started.
+KOPSIK_EXPORT kopsik_api_result kopsik_time_entries_between(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const unsigned int from,
+  const unsigned int to,
+  KopsikTimeEntrySpan **first);
+
+// Other time entries that overlap the time entry with the GUID, for
+// flagging the conflict after its start or end has been edited
+KOPSIK_EXPORT kopsik_api_result kopsik_overlapping_time_entries(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *guid,
+  KopsikTimeEntrySpan **first);
+
+// Suggestions
+
+// A time entry for untracked time, from the windows used meanwhile
+// and what was tracked with them before. Started and Ended are the
+// untracked time, Seconds the part of it that went with the project
+// and description.
+typedef struct {
+  unsigned int PID;
+  char *Description;
+  char *ProjectAndTaskLabel;
+  char *Color;
+  unsigned int Started;
+  unsigned int Ended;
+  unsigned int Seconds;
+  void *Next;
+} KopsikTimeEntrySuggestion;
+
+KOPSIK_EXPORT void kopsik_time_entry_suggestion_clear(
+  KopsikTimeEntrySuggestion *first);
+
+// Most matched time first, at most limit of them. Only while the
+// timeline is recorded.
+KOPSIK_EXPORT kopsik_api_result kopsik_time_entry_suggestions(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const unsigned int limit,
+  KopsikTimeEntrySuggestion **first);
+
+// The suggestion with the Started time is not suggested again
+KOPSIK_EXPORT void kopsik_dismiss_time_entry_suggestion(
+  void *context,
+  const unsigned int started);
+
+// Reports
+
+// Totals of the saved, stopped time entries that started in a range
+// of days. Group is "total", "day", "week", "project", "client" or
+// "tag". Days and weeks are yyyymmdd, weeks by their Monday. Projects
+// have their ID, or GUID when not pushed yet, and clients their ID.
+typedef struct {
+  const char *Group;
+  unsigned int Day;
+  unsigned int ID;
+  char *GUID;
+  char *Name;
+  int Seconds;
+  int BillableSeconds;
+  unsigned int Entries;
+  void *Next;
+} KopsikReportItem;
+
+KOPSIK_EXPORT void kopsik_report_item_clear(
+  KopsikReportItem *first);
+
+// From from_day to to_day, yyyymmdd in local time. Days that are over
+// are read from the database once, so long ranges are cheap to report
+// again. Days no sync has downloaded yet are downloaded first, when
+// online.
+KOPSIK_EXPORT kopsik_api_result kopsik_report(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const unsigned int from_day,
+  const unsigned int to_day,
+  KopsikReportItem **first);
+
+// Export
+
+#define KOPSIK_EXPORT_CSV 0
+#define KOPSIK_EXPORT_JSON 1
+
+// Gets the export a chunk at a time. Return KOPSIK_API_SUCCESS
+// to go on, anything else stops the export.
+typedef kopsik_api_result (*KopsikExportCallback)(
+  const char *data,
+  const unsigned int length);
+
+// Saved, stopped time entries that started from from_day to to_day,
+// yyyymmdd in local time, oldest first, as CSV or a JSON array. They
+// are formatted as they are read, so exports of any length take the
+// same memory.
+KOPSIK_EXPORT kopsik_api_result kopsik_export_time_entries(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const unsigned int from_day,
+  const unsigned int to_day,
+  const int format,
+  KopsikExportCallback callback);
+
+// The same export, written to a file
+KOPSIK_EXPORT kopsik_api_result kopsik_export_time_entries_to_file(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const unsigned int from_day,
+  const unsigned int to_day,
+  const int format,
+  const char *path);
+
+// Import
+
+// Counts of an import so far, after each chunk of it is saved
+typedef void (*KopsikImportProgressCallback)(
+  const unsigned int imported,
+  const unsigned int skipped,
+  const unsigned int invalid);
+
+// Adds the time entries of a CSV file, such as an export, reading it
+// a chunk at a time. Projects are found by name, or created, in the
+// default workspace. Rows already there by GUID are skipped. Rows
+// that can't be read are counted and left out, and the reason for
+// the first one is put into errmsg while the import goes on. The
+// callback can be NULL. What was added is pushed afterwards.
+KOPSIK_EXPORT kopsik_api_result kopsik_import_time_entries_from_file(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *path,
+  KopsikImportProgressCallback callback);
+
+// The same items as kopsik_time_entry_view_items, but in one array
+// that also holds all of their strings. The items are linked through
+// Next as well. Free them only with kopsik_time_entry_view_item_array_clear,
+// never with kopsik_time_entry_view_item_clear.
+typedef struct {
+  KopsikTimeEntryViewItem *Items;
+  unsigned int Length;
+  // Kept alive for a borrowed array, see
+  // kopsik_time_entry_view_item_array_borrowed
+  void *Snapshot;
+} KopsikTimeEntryViewItemArray;
+
+KOPSIK_EXPORT KopsikTimeEntryViewItemArray *
+  kopsik_time_entry_view_item_array_init();
+
+KOPSIK_EXPORT void kopsik_time_entry_view_item_array_clear(
+  KopsikTimeEntryViewItemArray *array);
+
+KOPSIK_EXPORT kopsik_api_result kopsik_time_entry_view_item_array(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  KopsikTimeEntryViewItemArray *array);
+
+// Like kopsik_time_entry_view_item_array, but the strings aren't
+// copied. They point into the snapshot of the time entry list the
+// items come from, which the array keeps alive until
+// kopsik_time_entry_view_item_array_clear, and are read-only.
+KOPSIK_EXPORT kopsik_api_result kopsik_time_entry_view_item_array_borrowed(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  KopsikTimeEntryViewItemArray *array);
+
+// Time entry list changes
+
+typedef struct {
+  char *DateHeader;
+  // Null when the day has no time entries listed any more
+  char *DateDuration;
+  void *Next;
+} KopsikDateDuration;
+
+// What changed in the time entry list since the version the UI last
+// saw. When those changes aren't known any more, IsFullList is set
+// and Inserted lists every item, so the UI has to start over.
+typedef struct {
+  unsigned int Version;
+  int IsFullList;
+  KopsikTimeEntryViewItem *Inserted;
+  KopsikTimeEntryViewItem *Updated;
+  // Only the GUID of each deleted item is set
+  KopsikViewItem *Deleted;
+  KopsikDateDuration *DateDurations;
+} KopsikTimeEntryListChanges;
+
+KOPSIK_EXPORT KopsikTimeEntryListChanges *
+  kopsik_time_entry_list_changes_init();
+
+KOPSIK_EXPORT void kopsik_time_entry_list_changes_clear(
+  KopsikTimeEntryListChanges *changes);
+
+// Pass 0 as since_version to get the full list
+KOPSIK_EXPORT kopsik_api_result kopsik_time_entry_list_changes(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const unsigned int since_version,
+  KopsikTimeEntryListChanges *changes);
+
+// Grouped time entry list changes
+
+// Time entries of one day with the same description, project and task
+typedef struct {
+  // Stays the same for as long as the group has time entries
+  char *Key;
+  char *Description;
+  char *ProjectAndTaskLabel;
+  char *Color;
+  unsigned int WID;
+  unsigned int PID;
+  unsigned int TID;
+  // Total of the time entries
+  int DurationInSeconds;
+  char *Duration;
+  // Earliest start and latest end of the time entries
+  unsigned int Started;
+  unsigned int Ended;
+  char *DateHeader;
+  char *DateDuration;
+  unsigned int Count;
+  // Only the GUID of each time entry is set, in the order they are
+  // listed
+  KopsikViewItem *TimeEntries;
+  void *Next;
+} KopsikTimeEntryGroupViewItem;
+
+KOPSIK_EXPORT void kopsik_time_entry_group_view_item_clear(
+  KopsikTimeEntryGroupViewItem *item);
+
+// Same as KopsikTimeEntryListChanges, for the list with the time
+// entries grouped. The GUID of each deleted item is the group key.
+typedef struct {
+  unsigned int Version;
+  int IsFullList;
+  KopsikTimeEntryGroupViewItem *Inserted;
+  KopsikTimeEntryGroupViewItem *Updated;
+  KopsikViewItem *Deleted;
+  KopsikDateDuration *DateDurations;
+} KopsikTimeEntryGroupListChanges;
+
+KOPSIK_EXPORT KopsikTimeEntryGroupListChanges *
+  kopsik_time_entry_group_list_changes_init();
+
+KOPSIK_EXPORT void kopsik_time_entry_group_list_changes_clear(
+  KopsikTimeEntryGroupListChanges *changes);
+
+// Pass 0 as since_version to get the full list. Versions are the
+// same as those of kopsik_time_entry_list_changes.
+KOPSIK_EXPORT kopsik_api_result kopsik_time_entry_group_list_changes(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const unsigned int since_version,
+  KopsikTimeEntryGroupListChanges *changes);
+
 KOPSIK_EXPORT kopsik_api_result kopsik_duration_for_date_header(
   void *context,
   char *err,
@@ -504,6 +1232,87 @@ KOPSIK_EXPORT kopsik_api_result kopsik_get_update_channel(
   char *update_channel,
   const unsigned int update_channel_len);
 
+// Metrics
+
+// Counters and latency histograms collected since the library was
+// loaded, and gauges of the memory the context's data takes now
+// ("memory.related.time_entries"), as a JSON object. Free it with
+// kopsik_metrics_clear.
+KOPSIK_EXPORT kopsik_api_result kopsik_get_metrics(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  char **json);
+
+KOPSIK_EXPORT void kopsik_metrics_clear(
+  char *json);
+
+// Tracing
+
+// Spans of sync, saves, WebSocket messages and timeline uploads
+// are recorded per thread while tracing is on. Off by default.
+KOPSIK_EXPORT void kopsik_trace_switch(
+  void *context,
+  const unsigned int on);
+
+// Recent spans of all threads, in the Chrome trace event format
+// (load the JSON in chrome://tracing).
+KOPSIK_EXPORT kopsik_api_result kopsik_trace_dump(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  char **json);
+
+KOPSIK_EXPORT void kopsik_trace_clear(
+  char *json);
+
+// Lock contention
+
+// While on, waits for the database and user locks, and how long each
+// function held them, go to kopsik_get_metrics ("lock.db.mutex.wait",
+// "lock.db.mutex.hold.SaveUser"). Waits longer than slow_wait_ms are
+// logged with the function holding the lock, 0 logs none. Off by
+// default.
+KOPSIK_EXPORT void kopsik_lock_metrics_switch(
+  void *context,
+  const unsigned int on,
+  const unsigned int slow_wait_ms);
+
+// API call watchdog
+
+// While a budget is set, every call of this API is timed
+// ("api.kopsik_time_entry_view_items" in kopsik_get_metrics), and
+// calls taking longer are logged and kept with a summary of their
+// arguments and, with tracing on, the spans they ran. 16 ms is one
+// frame of the UI. 0 turns it off, as it is by default.
+KOPSIK_EXPORT void kopsik_api_watchdog_switch(
+  void *context,
+  const unsigned int budget_ms);
+
+// The slow calls kept, oldest first, as a JSON array
+KOPSIK_EXPORT kopsik_api_result kopsik_api_watchdog_dump(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  char **json);
+
+KOPSIK_EXPORT void kopsik_api_watchdog_clear(
+  char *json);
+
+// Serves the context to other processes of the user, so several
+// frontends can share it instead of each opening the database. Clients
+// find the service and its token in "<db_path>-ipc", readable by the
+// user only; the protocol is described in ipc_service.h. The service
+// stops with kopsik_ipc_stop or kopsik_context_clear.
+KOPSIK_EXPORT kopsik_api_result kopsik_ipc_serve(
+  void *context,
+  char *errmsg,
+  const unsigned int errlen,
+  const char *db_path);
+
+KOPSIK_EXPORT void kopsik_ipc_stop(
+  void *context);
+
 #undef KOPSIK_EXPORT
 
 #ifdef __cplusplus
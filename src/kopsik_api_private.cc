@@ -14,46 +14,35 @@ KopsikModelChange *model_change_init() {
 void model_change_clear(
     KopsikModelChange *change) {
   poco_assert(change);
-  if (change->ModelType) {
-    free(change->ModelType);
-    change->ModelType = 0;
-  }
-  if (change->ChangeType) {
-    free(change->ChangeType);
-    change->ChangeType = 0;
-  }
+  model_change_clear_strings(change);
+  delete change;
+}
+
+void model_change_clear_strings(
+    KopsikModelChange *change) {
+  poco_assert(change);
+  // Model and change type names are not copied
+  change->ModelType = 0;
+  change->ChangeType = 0;
   if (change->GUID) {
     free(change->GUID);
     change->GUID = 0;
   }
-  delete change;
 }
 
 void model_change_to_change_item(
-    const kopsik::ModelChange in,
+    const kopsik::ModelChange &in,
     KopsikModelChange *out) {
 
-  poco_assert(in.ModelType() == "time_entry" ||
-    in.ModelType() == "workspace" ||
-    in.ModelType() == "client" ||
-    in.ModelType() == "project" ||
-    in.ModelType() == "user" ||
-    in.ModelType() == "task" ||
-    in.ModelType() == "tag");
-
-  poco_assert(in.ChangeType() == "delete" ||
-    in.ChangeType() == "insert" ||
-    in.ChangeType() == "update");
-
   poco_assert(!in.GUID().empty() || in.ModelID() > 0);
 
   poco_assert(!out->ModelType);
-  out->ModelType = strdup(in.ModelType().c_str());
+  out->ModelType = kopsik::ModelChange::ModelTypeName(in.ModelType());
 
   out->ModelID = (unsigned int)in.ModelID();
 
   poco_assert(!out->ChangeType);
-  out->ChangeType = strdup(in.ChangeType().c_str());
+  out->ChangeType = kopsik::ModelChange::ChangeTypeName(in.ChangeType());
 
   poco_assert(!out->GUID);
   out->GUID = strdup(in.GUID().c_str());
@@ -61,10 +50,10 @@ void model_change_to_change_item(
 
 void time_entry_to_view_item(
     kopsik::TimeEntry * const te,
-    const std::string project_and_task_label,
-    const std::string color_code,
+    const std::string &project_and_task_label,
+    const std::string &color_code,
     KopsikTimeEntryViewItem *view_item,
-    const std::string dateDuration) {
+    const std::string &dateDuration) {
   poco_assert(te);
   poco_assert(view_item);
 
@@ -98,7 +87,7 @@ void time_entry_to_view_item(
   }
 
   poco_assert(!view_item->Tags);
-  if (!te->Tags().empty()) {
+  if (!te->TagIDs().empty()) {
     view_item->Tags = strdup(te->Tags().c_str());
   }
 
@@ -119,6 +108,152 @@ void time_entry_to_view_item(
   }
 }
 
+void time_entry_snapshot_to_view_item(
+    const kopsik::TimeEntrySnapshot &te,
+    KopsikTimeEntryViewItem *view_item,
+    const std::string &dateDuration) {
+  poco_assert(view_item);
+
+  view_item->DurationInSeconds = static_cast<int>(te.DurationInSeconds);
+
+  poco_assert(!view_item->Description);
+  view_item->Description = strdup(te.Description.c_str());
+
+  poco_assert(!view_item->GUID);
+  view_item->GUID = strdup(te.GUID.c_str());
+
+  view_item->WID = static_cast<unsigned int>(te.WID);
+  view_item->TID = static_cast<unsigned int>(te.TID);
+  view_item->PID = static_cast<unsigned int>(te.PID);
+
+  poco_assert(!view_item->ProjectAndTaskLabel);
+  view_item->ProjectAndTaskLabel = strdup(te.ProjectAndTaskLabel.c_str());
+
+  poco_assert(!view_item->Color);
+  view_item->Color = strdup(te.Color.c_str());
+
+  poco_assert(!view_item->Duration);
+  view_item->Duration = strdup(te.Duration.c_str());
+
+  view_item->Started = static_cast<unsigned int>(te.Started);
+  view_item->Ended = static_cast<unsigned int>(te.Ended);
+  view_item->Billable = te.Billable ? 1 : 0;
+
+  poco_assert(!view_item->Tags);
+  if (!te.Tags.empty()) {
+    view_item->Tags = strdup(te.Tags.c_str());
+  }
+
+  view_item->UpdatedAt = static_cast<unsigned int>(te.UpdatedAt);
+
+  poco_assert(!view_item->DateHeader);
+  view_item->DateHeader = strdup(te.DateHeader.c_str());
+
+  poco_assert(!view_item->DateDuration);
+  if (!dateDuration.empty()) {
+    view_item->DateDuration = strdup(dateDuration.c_str());
+  }
+
+  view_item->DurOnly = te.DurOnly ? 1 : 0;
+}
+
+std::size_t time_entry_snapshot_arena_size(
+    const kopsik::TimeEntrySnapshot &te,
+    const std::string &dateDuration) {
+  std::size_t size = 0;
+  size += te.Description.size() + 1;
+  size += te.GUID.size() + 1;
+  size += te.ProjectAndTaskLabel.size() + 1;
+  size += te.Color.size() + 1;
+  size += te.Duration.size() + 1;
+  if (!te.Tags.empty()) {
+    size += te.Tags.size() + 1;
+  }
+  size += te.DateHeader.size() + 1;
+  if (!dateDuration.empty()) {
+    size += dateDuration.size() + 1;
+  }
+  return size;
+}
+
+static char *arena_copy(const std::string &value, char **arena) {
+  char *copy = *arena;
+  memcpy(copy, value.c_str(), value.size() + 1);
+  *arena += value.size() + 1;
+  return copy;
+}
+
+void time_entry_snapshot_to_arena_view_item(
+    const kopsik::TimeEntrySnapshot &te,
+    KopsikTimeEntryViewItem *view_item,
+    const std::string &dateDuration,
+    char **arena) {
+  poco_assert(view_item);
+  poco_assert(arena);
+  poco_assert(*arena);
+
+  view_item->DurationInSeconds = static_cast<int>(te.DurationInSeconds);
+  view_item->Description = arena_copy(te.Description, arena);
+  view_item->GUID = arena_copy(te.GUID, arena);
+  view_item->WID = static_cast<unsigned int>(te.WID);
+  view_item->TID = static_cast<unsigned int>(te.TID);
+  view_item->PID = static_cast<unsigned int>(te.PID);
+  view_item->ProjectAndTaskLabel = arena_copy(te.ProjectAndTaskLabel, arena);
+  view_item->Color = arena_copy(te.Color, arena);
+  view_item->Duration = arena_copy(te.Duration, arena);
+  view_item->Started = static_cast<unsigned int>(te.Started);
+  view_item->Ended = static_cast<unsigned int>(te.Ended);
+  view_item->Billable = te.Billable ? 1 : 0;
+  view_item->Tags = 0;
+  if (!te.Tags.empty()) {
+    view_item->Tags = arena_copy(te.Tags, arena);
+  }
+  view_item->UpdatedAt = static_cast<unsigned int>(te.UpdatedAt);
+  view_item->DateHeader = arena_copy(te.DateHeader, arena);
+  view_item->DateDuration = 0;
+  if (!dateDuration.empty()) {
+    view_item->DateDuration = arena_copy(dateDuration, arena);
+  }
+  view_item->DurOnly = te.DurOnly ? 1 : 0;
+  view_item->Next = 0;
+}
+
+static char *borrowed(const std::string &value) {
+  return const_cast<char *>(value.c_str());
+}
+
+void time_entry_snapshot_to_borrowed_view_item(
+    const kopsik::TimeEntrySnapshot &te,
+    KopsikTimeEntryViewItem *view_item,
+    const std::string &dateDuration) {
+  poco_assert(view_item);
+
+  view_item->DurationInSeconds = static_cast<int>(te.DurationInSeconds);
+  view_item->Description = borrowed(te.Description);
+  view_item->GUID = borrowed(te.GUID);
+  view_item->WID = static_cast<unsigned int>(te.WID);
+  view_item->TID = static_cast<unsigned int>(te.TID);
+  view_item->PID = static_cast<unsigned int>(te.PID);
+  view_item->ProjectAndTaskLabel = borrowed(te.ProjectAndTaskLabel);
+  view_item->Color = borrowed(te.Color);
+  view_item->Duration = borrowed(te.Duration);
+  view_item->Started = static_cast<unsigned int>(te.Started);
+  view_item->Ended = static_cast<unsigned int>(te.Ended);
+  view_item->Billable = te.Billable ? 1 : 0;
+  view_item->Tags = 0;
+  if (!te.Tags.empty()) {
+    view_item->Tags = borrowed(te.Tags);
+  }
+  view_item->UpdatedAt = static_cast<unsigned int>(te.UpdatedAt);
+  view_item->DateHeader = borrowed(te.DateHeader);
+  view_item->DateDuration = 0;
+  if (!dateDuration.empty()) {
+    view_item->DateDuration = borrowed(dateDuration);
+  }
+  view_item->DurOnly = te.DurOnly ? 1 : 0;
+  view_item->Next = 0;
+}
+
 KopsikAutocompleteItem *autocomplete_item_init() {
   KopsikAutocompleteItem *item = new KopsikAutocompleteItem();
   item->Text = 0;
@@ -132,6 +267,60 @@ KopsikAutocompleteItem *autocomplete_item_init() {
   return item;
 }
 
+KopsikAutocompleteItem *autocomplete_item_to_view_item(
+    const kopsik::AutocompleteItem &item) {
+  KopsikAutocompleteItem *result = autocomplete_item_init();
+  result->Description = strdup(item.Description.c_str());
+  result->Text = strdup(item.Text.c_str());
+  result->ProjectAndTaskLabel = strdup(item.ProjectAndTaskLabel.c_str());
+  result->ProjectColor = strdup(item.ProjectColor.c_str());
+  result->ProjectID = static_cast<unsigned int>(item.ProjectID);
+  result->TaskID = static_cast<unsigned int>(item.TaskID);
+  result->Type = static_cast<unsigned int>(item.Type);
+  return result;
+}
+
+std::size_t autocomplete_item_arena_size(
+    const kopsik::AutocompleteItem &item) {
+  return item.Description.size() + 1
+    + item.Text.size() + 1
+    + item.ProjectAndTaskLabel.size() + 1
+    + item.ProjectColor.size() + 1;
+}
+
+void autocomplete_item_to_arena_view_item(
+    const kopsik::AutocompleteItem &item,
+    KopsikAutocompleteItem *view_item,
+    char **arena) {
+  poco_assert(view_item);
+  poco_assert(arena);
+  poco_assert(*arena);
+
+  view_item->Description = arena_copy(item.Description, arena);
+  view_item->Text = arena_copy(item.Text, arena);
+  view_item->ProjectAndTaskLabel = arena_copy(item.ProjectAndTaskLabel, arena);
+  view_item->ProjectColor = arena_copy(item.ProjectColor, arena);
+  view_item->ProjectID = static_cast<unsigned int>(item.ProjectID);
+  view_item->TaskID = static_cast<unsigned int>(item.TaskID);
+  view_item->Type = static_cast<unsigned int>(item.Type);
+  view_item->Next = 0;
+}
+
+void autocomplete_item_to_borrowed_view_item(
+    const kopsik::AutocompleteItem &item,
+    KopsikAutocompleteItem *view_item) {
+  poco_assert(view_item);
+
+  view_item->Description = borrowed(item.Description);
+  view_item->Text = borrowed(item.Text);
+  view_item->ProjectAndTaskLabel = borrowed(item.ProjectAndTaskLabel);
+  view_item->ProjectColor = borrowed(item.ProjectColor);
+  view_item->ProjectID = static_cast<unsigned int>(item.ProjectID);
+  view_item->TaskID = static_cast<unsigned int>(item.TaskID);
+  view_item->Type = static_cast<unsigned int>(item.Type);
+  view_item->Next = 0;
+}
+
 KopsikViewItem *view_item_init() {
   KopsikViewItem *result = new KopsikViewItem();
   result->ID = 0;
@@ -152,7 +341,7 @@ KopsikViewItem *project_to_view_item(
 }
 
 KopsikViewItem *tag_to_view_item(
-    const std::string tag_name) {
+    const std::string &tag_name) {
   KopsikViewItem *result = view_item_init();
   result->Name = strdup(tag_name.c_str());
   return result;
@@ -14,16 +14,41 @@ KopsikViewItem *view_item_init();
 
 void time_entry_to_view_item(
   kopsik::TimeEntry * const,
-  const std::string project_and_task_label,
-  const std::string color_code,
+  const std::string &project_and_task_label,
+  const std::string &color_code,
   KopsikTimeEntryViewItem *view_item,
-  const std::string dateDuration);
+  const std::string &dateDuration);
+
+void time_entry_snapshot_to_view_item(
+  const kopsik::TimeEntrySnapshot &te,
+  KopsikTimeEntryViewItem *view_item,
+  const std::string &dateDuration);
+
+// Bytes time_entry_snapshot_to_arena_view_item will copy into the arena
+std::size_t time_entry_snapshot_arena_size(
+  const kopsik::TimeEntrySnapshot &te,
+  const std::string &dateDuration);
+
+// Like time_entry_snapshot_to_view_item, but copies the strings to
+// the arena, and moves it past them, instead of allocating each one.
+void time_entry_snapshot_to_arena_view_item(
+  const kopsik::TimeEntrySnapshot &te,
+  KopsikTimeEntryViewItem *view_item,
+  const std::string &dateDuration,
+  char **arena);
+
+// Like time_entry_snapshot_to_view_item, but the strings point into
+// te and dateDuration, which have to outlive the item
+void time_entry_snapshot_to_borrowed_view_item(
+  const kopsik::TimeEntrySnapshot &te,
+  KopsikTimeEntryViewItem *view_item,
+  const std::string &dateDuration);
 
 KopsikViewItem *project_to_view_item(
   kopsik::Project * const);
 
 KopsikViewItem *tag_to_view_item(
-  const std::string tag_name);
+  const std::string &tag_name);
 
 KopsikViewItem *workspace_to_view_item(
   kopsik::Workspace * const);
@@ -34,15 +59,39 @@ KopsikViewItem *client_to_view_item(
 KopsikModelChange *model_change_init();
 
 void model_change_to_change_item(
-  const kopsik::ModelChange in,
+  const kopsik::ModelChange &in,
   KopsikModelChange *out);
 
 void model_change_clear(
   KopsikModelChange *change);
 
+// Frees the strings of a change that isn't allocated by itself
+void model_change_clear_strings(
+  KopsikModelChange *change);
+
 void autocomplete_item_clear(
   KopsikAutocompleteItem *item);
 
 KopsikAutocompleteItem *autocomplete_item_init();
 
+KopsikAutocompleteItem *autocomplete_item_to_view_item(
+  const kopsik::AutocompleteItem &item);
+
+// Bytes autocomplete_item_to_arena_view_item will copy into the arena
+std::size_t autocomplete_item_arena_size(
+  const kopsik::AutocompleteItem &item);
+
+// Like autocomplete_item_to_view_item, but copies the strings to
+// the arena and moves it past them
+void autocomplete_item_to_arena_view_item(
+  const kopsik::AutocompleteItem &item,
+  KopsikAutocompleteItem *view_item,
+  char **arena);
+
+// Like autocomplete_item_to_view_item, but the strings point into
+// item, which has to outlive the view item
+void autocomplete_item_to_borrowed_view_item(
+  const kopsik::AutocompleteItem &item,
+  KopsikAutocompleteItem *view_item);
+
 #endif  // SRC_KOPSIK_API_PRIVATE_H_
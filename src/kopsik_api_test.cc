@@ -1,14 +1,26 @@
 // Copyright 2014 Toggl Desktop developers.
 
+#include <ctime>
+#include <set>
+#include <string>
+
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 
 #include "./kopsik_api.h"
+#include "./context.h"
+#include "./database.h"
 #include "./https_client.h"
+#include "./ipc_service.h"
+#include "./json_reader.h"
 #include "./test_data.h"
 
 #include "Poco/FileStream.h"
+#include "Poco/Event.h"
 #include "Poco/File.h"
+#include "Poco/Mutex.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Thread.h"
 
 const int ERRLEN = 1024;
 
@@ -20,6 +32,41 @@ namespace kopsik {
         KopsikModelChange *change) {
     }
 
+    int in_test_changes_calls = 0;
+    unsigned int in_test_changes_count = 0;
+    bool in_test_changes_unique = true;
+
+    void in_test_changes_callback(
+        KopsikModelChange *changes,
+        const unsigned int count) {
+        in_test_changes_calls++;
+        in_test_changes_count += count;
+        std::set<std::string> seen;
+        for (unsigned int i = 0; i < count; i++) {
+            std::string key = std::string(changes[i].ModelType) + "/" +
+                changes[i].GUID;
+            if (!std::string(changes[i].GUID).empty() &&
+                    !seen.insert(key).second) {
+                in_test_changes_unique = false;
+            }
+        }
+    }
+
+    int in_test_client_changes_calls = 0;
+    bool in_test_client_changes_only = true;
+
+    void in_test_client_changes_callback(
+        KopsikModelChange *changes,
+        const unsigned int count) {
+        in_test_client_changes_calls++;
+        for (unsigned int i = 0; i < count; i++) {
+            if (std::string(changes[i].ModelType) != "client" ||
+                    std::string(changes[i].ChangeType) != "insert") {
+                in_test_client_changes_only = false;
+            }
+        }
+    }
+
     void in_test_on_error_callback(
         const char *errmsg) {
     }
@@ -34,6 +81,47 @@ namespace kopsik {
 
     void in_test_online_callback() {}
 
+    Poco::Event in_test_saved;
+    kopsik_api_result in_test_saved_result = -1;
+
+    void in_test_saved_callback(
+        kopsik_api_result result,
+        const char *errmsg) {
+        in_test_saved_result = result;
+        in_test_saved.set();
+    }
+
+    Poco::Mutex in_test_autocomplete_m;
+    unsigned int in_test_autocomplete_query_id = 0;
+    std::string in_test_autocomplete_text("");
+    unsigned int in_test_autocomplete_count = 0;
+
+    void in_test_autocomplete_query_callback(
+        const unsigned int query_id,
+        KopsikAutocompleteItem *first) {
+        Poco::Mutex::ScopedLock lock(in_test_autocomplete_m);
+        in_test_autocomplete_query_id = query_id;
+        in_test_autocomplete_text = first ? first->Text : "";
+        in_test_autocomplete_count = 0;
+        for (KopsikAutocompleteItem *it = first; it;
+                it = reinterpret_cast<KopsikAutocompleteItem *>(it->Next)) {
+            in_test_autocomplete_count++;
+        }
+    }
+
+    bool wait_for_autocomplete_query(const unsigned int query_id) {
+        for (int i = 0; i < 50; i++) {
+            {
+                Poco::Mutex::ScopedLock lock(in_test_autocomplete_m);
+                if (in_test_autocomplete_query_id == query_id) {
+                    return true;
+                }
+            }
+            Poco::Thread::sleep(100);
+        }
+        return false;
+    }
+
     void *create_test_context() {
         return kopsik_context_init("tests", "0.1",
             in_test_change_callback,
@@ -47,6 +135,18 @@ namespace kopsik {
         if (f.exists()) {
             f.remove(false);
         }
+        Poco::File snapshot(std::string(TESTDB) + "-snapshot");
+        if (snapshot.exists()) {
+            snapshot.remove(false);
+        }
+        Poco::File autocomplete(std::string(TESTDB) + "-autocomplete");
+        if (autocomplete.exists()) {
+            autocomplete.remove(false);
+        }
+        Poco::File journal(std::string(TESTDB) + "-edits");
+        if (journal.exists()) {
+            journal.remove(false);
+        }
     }
 
     TEST(KopsikApiTest, kopsik_context_init) {
@@ -126,6 +226,35 @@ namespace kopsik {
         kopsik_context_clear(ctx);
     }
 
+    TEST(KopsikApiTest, kopsik_get_metrics) {
+        void *ctx = create_test_context();
+        char err[ERRLEN];
+        char *json = 0;
+        kopsik_api_result res = kopsik_get_metrics(ctx, err, ERRLEN, &json);
+        ASSERT_EQ(KOPSIK_API_SUCCESS, res);
+        ASSERT_TRUE(json);
+        ASSERT_NE(std::string::npos, std::string(json).find("\"counters\""));
+        ASSERT_NE(std::string::npos,
+                  std::string(json).find("\"memory.related.time_entries\""));
+        kopsik_metrics_clear(json);
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_trace_dump) {
+        void *ctx = create_test_context();
+        char err[ERRLEN];
+        char *json = 0;
+        kopsik_trace_switch(ctx, 1);
+        kopsik_api_result res = kopsik_trace_dump(ctx, err, ERRLEN, &json);
+        kopsik_trace_switch(ctx, 0);
+        ASSERT_EQ(KOPSIK_API_SUCCESS, res);
+        ASSERT_TRUE(json);
+        ASSERT_NE(std::string::npos,
+                  std::string(json).find("\"traceEvents\""));
+        kopsik_trace_clear(json);
+        kopsik_context_clear(ctx);
+    }
+
     TEST(KopsikApiTest, kopsik_set_db_path) {
         void *ctx = create_test_context();
         wipe_test_db();
@@ -139,6 +268,64 @@ namespace kopsik {
         ASSERT_TRUE(f.exists());
     }
 
+    TEST(KopsikApiTest, TimesStartupPhases) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+                  kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+
+        // Reading metrics needs the database, so waits for it to open
+        char *json = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+                  kopsik_get_metrics(ctx, err, ERRLEN, &json));
+        std::string metrics(json);
+        kopsik_metrics_clear(json);
+        ASSERT_NE(std::string::npos, metrics.find("startup.context_init"));
+        ASSERT_NE(std::string::npos, metrics.find("startup.db_open"));
+        ASSERT_NE(std::string::npos, metrics.find("startup.db_wait"));
+        ASSERT_NE(std::string::npos, metrics.find("db.open.migrations"));
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, ReportsDatabaseThatCannotBeOpened) {
+        void *ctx = create_test_context();
+
+        // Opened in the background, so it fails later on
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_db_path(ctx, err, ERRLEN,
+            "no_such_directory/kopsik_api_test.db"));
+
+        KopsikUser *user = kopsik_user_init();
+        ASSERT_NE(KOPSIK_API_SUCCESS,
+                  kopsik_current_user(ctx, err, ERRLEN, user));
+        kopsik_user_clear(user);
+        ASSERT_NE(KOPSIK_API_SUCCESS,
+                  kopsik_set_api_token(ctx, err, ERRLEN, "token"));
+        char str[ERRLEN];
+        ASSERT_NE(KOPSIK_API_SUCCESS,
+                  kopsik_get_api_token(ctx, err, ERRLEN, str, ERRLEN));
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_set_db_tuning) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+                  kopsik_set_db_tuning(ctx, err, ERRLEN, 2, 1, 4096, 0, 8192));
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+                  kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+                  kopsik_set_db_tuning(ctx, err, ERRLEN, 1, 2, 8192, 64, 4096));
+
+        kopsik_context_clear(ctx);
+    }
+
     TEST(KopsikApiTest, kopsik_set_log_path) {
         kopsik_set_log_path("test.log");
     }
@@ -217,8 +404,77 @@ namespace kopsik {
             ctx, err, ERRLEN, &first));
         int number_of_items = list_length(first);
         ASSERT_EQ(3, number_of_items);
+
+        // Paging through them one at a time should list
+        // the same items in the same order, too.
+        KopsikTimeEntryViewItem *listed = first;
+        unsigned int started_before = 0;
+        for (int i = 0; i < number_of_items; i++) {
+            KopsikTimeEntryViewItem *page = 0;
+            ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items_page(
+                ctx, err, ERRLEN, started_before, 1, &page, &started_before));
+            ASSERT_EQ((unsigned int)1, list_length(page));
+            ASSERT_EQ(std::string(listed->GUID), std::string(page->GUID));
+            ASSERT_EQ(listed->Started, page->Started);
+            kopsik_time_entry_view_item_clear(page);
+            listed = reinterpret_cast<KopsikTimeEntryViewItem *>(listed->Next);
+        }
+        ASSERT_FALSE(started_before);
+
+        // The array API should list the same items in the same order
+        KopsikTimeEntryViewItemArray *array =
+            kopsik_time_entry_view_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_array(
+            ctx, err, ERRLEN, array));
+        ASSERT_EQ((unsigned int)number_of_items, array->Length);
+        ASSERT_EQ((unsigned int)number_of_items, list_length(array->Items));
+        listed = first;
+        for (unsigned int i = 0; i < array->Length; i++) {
+            ASSERT_EQ(std::string(listed->GUID),
+                std::string(array->Items[i].GUID));
+            ASSERT_EQ(std::string(listed->Description),
+                std::string(array->Items[i].Description));
+            ASSERT_EQ(std::string(listed->DateDuration),
+                std::string(array->Items[i].DateDuration));
+            ASSERT_EQ(listed->Started, array->Items[i].Started);
+            listed = reinterpret_cast<KopsikTimeEntryViewItem *>(listed->Next);
+        }
+        kopsik_time_entry_view_item_array_clear(array);
+
+        // A borrowed array lists them too, its strings pointing into
+        // the snapshot it holds
+        array = kopsik_time_entry_view_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_time_entry_view_item_array_borrowed(ctx, err, ERRLEN,
+                                                       array));
+        ASSERT_EQ((unsigned int)number_of_items, array->Length);
+        ASSERT_TRUE(array->Snapshot);
+        listed = first;
+        for (unsigned int i = 0; i < array->Length; i++) {
+            ASSERT_EQ(std::string(listed->GUID),
+                std::string(array->Items[i].GUID));
+            ASSERT_EQ(std::string(listed->DateDuration),
+                std::string(array->Items[i].DateDuration));
+            listed = reinterpret_cast<KopsikTimeEntryViewItem *>(listed->Next);
+        }
+        kopsik_time_entry_view_item_array_clear(array);
         kopsik_time_entry_view_item_clear(first);
 
+        // Without a version to start from, we get the full list
+        KopsikTimeEntryListChanges *changes =
+            kopsik_time_entry_list_changes_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_list_changes(
+            ctx, err, ERRLEN, 0, changes));
+        ASSERT_TRUE(changes->IsFullList);
+        ASSERT_EQ((unsigned int)number_of_items,
+            list_length(changes->Inserted));
+        ASSERT_FALSE(changes->Updated);
+        ASSERT_FALSE(changes->Deleted);
+        ASSERT_TRUE(changes->DateDurations);
+        unsigned int listed_version = changes->Version;
+        ASSERT_TRUE(listed_version);
+        kopsik_time_entry_list_changes_clear(changes);
+
         // Start tracking
         KopsikTimeEntryViewItem *item = kopsik_time_entry_view_item_init();
         ASSERT_EQ(KOPSIK_API_SUCCESS,
@@ -275,6 +531,20 @@ namespace kopsik {
         ASSERT_EQ(-1385644530, running->DurationInSeconds);
         kopsik_time_entry_view_item_clear(running);
 
+        // The timer gets the new start, and keeps its version
+        // until the running time entry changes again
+        unsigned int timer_started = 0;
+        unsigned int timer_version = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_running_timer(
+            ctx, err, ERRLEN, &timer_started, &timer_version, &is_tracking));
+        ASSERT_TRUE(is_tracking);
+        ASSERT_EQ((unsigned int)1385644530, timer_started);
+        ASSERT_TRUE(timer_version);
+        unsigned int same_version = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_running_timer(
+            ctx, err, ERRLEN, &timer_started, &same_version, &is_tracking));
+        ASSERT_EQ(timer_version, same_version);
+
         // Stop the time entry
         KopsikTimeEntryViewItem *stopped = kopsik_time_entry_view_item_init();
         int was_stopped = 0;
@@ -285,6 +555,31 @@ namespace kopsik {
         std::string dirty_guid(stopped->GUID);
         kopsik_time_entry_view_item_clear(stopped);
 
+        // Since the list was last seen, only the stopped
+        // time entry should have been added to it.
+        changes = kopsik_time_entry_list_changes_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_list_changes(
+            ctx, err, ERRLEN, listed_version, changes));
+        ASSERT_FALSE(changes->IsFullList);
+        ASSERT_LT(listed_version, changes->Version);
+        ASSERT_EQ((unsigned int)1, list_length(changes->Inserted));
+        ASSERT_EQ(dirty_guid, std::string(changes->Inserted->GUID));
+        ASSERT_FALSE(changes->Updated);
+        ASSERT_FALSE(changes->Deleted);
+        ASSERT_TRUE(changes->DateDurations);
+        listed_version = changes->Version;
+        kopsik_time_entry_list_changes_clear(changes);
+
+        // Nothing has changed since
+        changes = kopsik_time_entry_list_changes_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_list_changes(
+            ctx, err, ERRLEN, listed_version, changes));
+        ASSERT_FALSE(changes->IsFullList);
+        ASSERT_EQ(listed_version, changes->Version);
+        ASSERT_FALSE(changes->Inserted);
+        ASSERT_FALSE(changes->DateDurations);
+        kopsik_time_entry_list_changes_clear(changes);
+
         // Change duration of the stopped time entry to 1 hour.
         // Check it was really applied.
         ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_duration(
@@ -358,6 +653,13 @@ namespace kopsik {
         ASSERT_FALSE(is_tracking);
         kopsik_time_entry_view_item_clear(running);
 
+        unsigned int stopped_version = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_running_timer(
+            ctx, err, ERRLEN, &timer_started, &stopped_version, &is_tracking));
+        ASSERT_FALSE(is_tracking);
+        ASSERT_FALSE(timer_started);
+        ASSERT_LT(timer_version, stopped_version);
+
         // We started and stopped one time entry.
         // This means we should have one dirty model now.
         KopsikPushableModelStats stats;
@@ -380,6 +682,60 @@ namespace kopsik {
             ctx, err, ERRLEN, &stats));
         ASSERT_EQ((unsigned int)2, stats.TimeEntries);
 
+        // Both time entries are offered as one autocomplete item
+        KopsikAutocompleteItem *autocomplete = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_autocomplete_items_matching(
+            ctx, err, ERRLEN, &autocomplete, "test", 10, 1, 0, 0));
+        ASSERT_TRUE(autocomplete);
+        ASSERT_EQ(std::string("Test"), std::string(autocomplete->Text));
+        ASSERT_FALSE(autocomplete->Next);
+        kopsik_autocomplete_item_clear(autocomplete);
+
+        // Of queries typed one after another, the last one answers
+        unsigned int first_query = kopsik_autocomplete_query(
+            ctx, "x", 10, 1, 0, 0, in_test_autocomplete_query_callback);
+        unsigned int last_query = kopsik_autocomplete_query(
+            ctx, "te", 10, 1, 0, 0, in_test_autocomplete_query_callback);
+        ASSERT_LT(first_query, last_query);
+        ASSERT_TRUE(wait_for_autocomplete_query(last_query));
+        {
+            Poco::Mutex::ScopedLock lock(in_test_autocomplete_m);
+            ASSERT_EQ("Test", in_test_autocomplete_text);
+        }
+
+        // The array holds the same items as the list
+        KopsikAutocompleteItem *all = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_autocomplete_items(
+            ctx, err, ERRLEN, &all, 1, 1, 1));
+        KopsikAutocompleteItemArray *autocomplete_array =
+            kopsik_autocomplete_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_autocomplete_item_array(
+            ctx, err, ERRLEN, autocomplete_array, 1, 1, 1));
+        KopsikAutocompleteItem *in_list = all;
+        for (unsigned int i = 0; i < autocomplete_array->Length; i++) {
+            ASSERT_TRUE(in_list);
+            ASSERT_EQ(std::string(in_list->Text),
+                std::string(autocomplete_array->Items[i].Text));
+            ASSERT_EQ(in_list->Type, autocomplete_array->Items[i].Type);
+            in_list = reinterpret_cast<KopsikAutocompleteItem *>(in_list->Next);
+        }
+        ASSERT_FALSE(in_list);
+        kopsik_autocomplete_item_array_clear(autocomplete_array);
+
+        autocomplete_array = kopsik_autocomplete_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_autocomplete_item_array_borrowed(
+            ctx, err, ERRLEN, autocomplete_array, 1, 1, 1));
+        in_list = all;
+        for (unsigned int i = 0; i < autocomplete_array->Length; i++) {
+            ASSERT_TRUE(in_list);
+            ASSERT_EQ(std::string(in_list->Text),
+                std::string(autocomplete_array->Items[i].Text));
+            in_list = reinterpret_cast<KopsikAutocompleteItem *>(in_list->Next);
+        }
+        ASSERT_FALSE(in_list);
+        kopsik_autocomplete_item_array_clear(autocomplete_array);
+        kopsik_autocomplete_item_clear(all);
+
         // Get time entry view using GUID
         was_found = 0;
         KopsikTimeEntryViewItem *found = kopsik_time_entry_view_item_init();
@@ -425,6 +781,842 @@ namespace kopsik {
         kopsik_context_clear(ctx);
     }
 
+    TEST(KopsikApiTest, kopsik_set_model_changes_callback) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+        kopsik_set_model_changes_callback(ctx, in_test_changes_callback);
+        in_test_changes_calls = 0;
+        in_test_changes_count = 0;
+        in_test_changes_unique = true;
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        // All the models loaded arrive in one call
+        ASSERT_EQ(1, in_test_changes_calls);
+        ASSERT_LT((unsigned int)3, in_test_changes_count);
+        ASSERT_TRUE(in_test_changes_unique);
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_subscribe_model_changes) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+        in_test_changes_calls = 0;
+        in_test_changes_count = 0;
+        in_test_client_changes_calls = 0;
+        in_test_client_changes_only = true;
+        unsigned int clients = kopsik_subscribe_model_changes(ctx,
+            KOPSIK_MODEL_CLIENT, KOPSIK_CHANGE_INSERT, 1,
+            in_test_client_changes_callback);
+        unsigned int all = kopsik_subscribe_model_changes(ctx,
+            0, 0, 0, in_test_changes_callback);
+        ASSERT_NE(clients, all);
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        // Each subscriber gets only what it asked for
+        ASSERT_EQ(1, in_test_client_changes_calls);
+        ASSERT_TRUE(in_test_client_changes_only);
+        ASSERT_EQ(1, in_test_changes_calls);
+        ASSERT_LT((unsigned int)3, in_test_changes_count);
+
+        // A time entry started reaches only the one asking for all
+        KopsikTimeEntryViewItem *item = kopsik_time_entry_view_item_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_start(ctx, err, ERRLEN, "Test", 0, 0, 0, item));
+        kopsik_time_entry_view_item_clear(item);
+        ASSERT_EQ(1, in_test_client_changes_calls);
+        ASSERT_EQ(2, in_test_changes_calls);
+
+        // Nothing reaches a subscriber once it has unsubscribed
+        kopsik_unsubscribe_model_changes(ctx, clients);
+        kopsik_unsubscribe_model_changes(ctx, all);
+        item = kopsik_time_entry_view_item_init();
+        int was_found(0);
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_stop(ctx, err, ERRLEN, item, &was_found));
+        kopsik_time_entry_view_item_clear(item);
+        ASSERT_TRUE(was_found);
+        ASSERT_EQ(1, in_test_client_changes_calls);
+        ASSERT_EQ(2, in_test_changes_calls);
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_ipc_serve) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+        // Left behind by a crash
+        {
+            Poco::FileOutputStream out(std::string(TESTDB) + kIpcFileSuffix);
+            out << "1\nstale\n";
+        }
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_ipc_serve(ctx, err, ERRLEN, TESTDB));
+        Poco::File file(std::string(TESTDB) + kIpcFileSuffix);
+        ASSERT_TRUE(file.exists());
+#ifndef _WIN32
+        // Only the user can read the token
+        struct stat info;
+        ASSERT_EQ(0, stat(file.path().c_str(), &info));
+        ASSERT_EQ(mode_t(S_IRUSR | S_IWUSR), info.st_mode & 0777);
+#endif
+
+        IpcClient client;
+        ASSERT_EQ(noError, client.Connect(TESTDB));
+
+        // Goes through the context of the service
+        std::string response("");
+        ASSERT_EQ(noError, client.Call(
+            "{\"id\":1,\"method\":\"subscribe\"}", &response));
+        ASSERT_EQ(noError, client.Call(
+            "{\"id\":2,\"method\":\"start\",\"description\":\"IPC\"}",
+            &response));
+        JSONValue *root = JSONParse(response);
+        ASSERT_TRUE(root);
+        ASSERT_EQ(2, JSONInt(JSONGet(root, "id")));
+        ASSERT_EQ("IPC", JSONString(
+            JSONGet(JSONGet(root, "result"), "Description")));
+        JSONDelete(root);
+
+        // The subscriber is told about the new time entry
+        std::string event("");
+        ASSERT_EQ(noError, client.Receive(&event));
+        ASSERT_NE(std::string::npos, event.find("\"time_entry\""));
+
+        ASSERT_EQ(noError, client.Call(
+            "{\"id\":3,\"method\":\"nothing\"}", &response));
+        ASSERT_NE(std::string::npos, response.find("\"error\""));
+
+        // A client without the token is let go
+        std::string port(""), token("");
+        {
+            Poco::FileInputStream in(file.path());
+            in >> port >> token;
+        }
+        std::string other(std::string(TESTDB) + ".other");
+        {
+            Poco::FileOutputStream out(other + kIpcFileSuffix);
+            out << port << "\n" << "wrong" << "\n";
+        }
+        IpcClient stranger;
+        ASSERT_NE(noError, stranger.Connect(other));
+
+        // So is one with a token as long as the right one
+        token[token.size() - 1] = '0' == token[token.size() - 1] ? '1' : '0';
+        {
+            Poco::FileOutputStream out(other + kIpcFileSuffix);
+            out << port << "\n" << token << "\n";
+        }
+        IpcClient guesser;
+        ASSERT_NE(noError, guesser.Connect(other));
+        Poco::File(other + kIpcFileSuffix).remove();
+
+        kopsik_ipc_stop(ctx);
+        ASSERT_FALSE(file.exists());
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_applies_websocket_updates_together) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+        kopsik_set_model_changes_callback(ctx, in_test_changes_callback);
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        in_test_changes_calls = 0;
+        in_test_changes_count = 0;
+
+        // A burst of updates is saved and notified once
+        Context *context = reinterpret_cast<Context *>(ctx);
+        for (int i = 1; i <= 3; i++) {
+            std::string update("{\"action\": \"INSERT\", "
+                "\"model\": \"client\", \"data\": {\"id\": "
+                + Poco::NumberFormatter::format(900000 + i)
+                + ", \"name\": \"Batched\", \"wid\": 123456789}}");
+            JSONValue *message = JSONParse(update);
+            context->LoadUpdateFromJSONNode(message);
+            JSONDelete(message);
+        }
+        ASSERT_EQ(0, in_test_changes_calls);
+
+        for (int i = 0; i < 50 && !in_test_changes_calls; i++) {
+            Poco::Thread::sleep(100);
+        }
+        ASSERT_EQ(1, in_test_changes_calls);
+        ASSERT_EQ((unsigned int)3, in_test_changes_count);
+
+        kopsik_context_clear(ctx);
+
+        Database db(TESTDB);
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, db.UInt(
+            "select count(1) from clients where name = 'Batched'", &n));
+        ASSERT_EQ(Poco::UInt64(3), n);
+    }
+
+    TEST(KopsikApiTest, kopsik_context_shutdown_saves_edits) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        KopsikTimeEntryViewItem *first = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items(
+            ctx, err, ERRLEN, &first));
+        ASSERT_TRUE(first);
+        std::string GUID(first->GUID);
+        kopsik_time_entry_view_item_clear(first);
+
+        // Edits in quick succession are saved together, later,
+        // but at the latest when the app shuts down.
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_description(
+            ctx, err, ERRLEN, GUID.c_str(), "Typing"));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_description(
+            ctx, err, ERRLEN, GUID.c_str(), "Typed"));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_billable(
+            ctx, err, ERRLEN, GUID.c_str(), 1));
+        kopsik_context_shutdown(ctx);
+        kopsik_context_clear(ctx);
+
+        ctx = create_test_context();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        KopsikUser *user = kopsik_user_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_current_user(ctx, err, ERRLEN, user));
+        kopsik_user_clear(user);
+
+        KopsikTimeEntryViewItem *found = kopsik_time_entry_view_item_init();
+        int was_found(0);
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_by_guid(
+            ctx, err, ERRLEN, GUID.c_str(), found, &was_found));
+        ASSERT_TRUE(was_found);
+        ASSERT_EQ("Typed", std::string(found->Description));
+        ASSERT_TRUE(found->Billable);
+        kopsik_time_entry_view_item_clear(found);
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_start_async) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        // Started in memory, saved in the background
+        in_test_saved.reset();
+        in_test_saved_result = -1;
+        KopsikTimeEntryViewItem *item = kopsik_time_entry_view_item_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_start_async(
+            ctx, err, ERRLEN, "Started async", "", 0, 0, item,
+            in_test_saved_callback));
+        std::string GUID(item->GUID);
+        kopsik_time_entry_view_item_clear(item);
+        ASSERT_FALSE(GUID.empty());
+
+        int was_found(0);
+        KopsikTimeEntryViewItem *running = kopsik_time_entry_view_item_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_running_time_entry_view_item(
+            ctx, err, ERRLEN, running, &was_found));
+        ASSERT_TRUE(was_found);
+        ASSERT_EQ(GUID, std::string(running->GUID));
+        kopsik_time_entry_view_item_clear(running);
+
+        ASSERT_TRUE(in_test_saved.tryWait(10000));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, in_test_saved_result);
+
+        // An edit is told about once saved too
+        in_test_saved.reset();
+        in_test_saved_result = -1;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_description_async(
+            ctx, err, ERRLEN, GUID.c_str(), "Renamed async",
+            in_test_saved_callback));
+        ASSERT_TRUE(in_test_saved.tryWait(10000));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, in_test_saved_result);
+
+        void *other = create_test_context();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(other, err, ERRLEN, TESTDB));
+        KopsikUser *user = kopsik_user_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_current_user(other, err, ERRLEN, user));
+        kopsik_user_clear(user);
+
+        KopsikTimeEntryViewItem *found = kopsik_time_entry_view_item_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_by_guid(
+            other, err, ERRLEN, GUID.c_str(), found, &was_found));
+        ASSERT_TRUE(was_found);
+        ASSERT_EQ("Renamed async", std::string(found->Description));
+        kopsik_time_entry_view_item_clear(found);
+
+        kopsik_context_clear(other);
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_save) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        KopsikTimeEntryViewItem *first = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items(
+            ctx, err, ERRLEN, &first));
+        ASSERT_TRUE(first);
+        std::string GUID(first->GUID);
+        kopsik_time_entry_view_item_clear(first);
+
+        // Saved right away, while the first context still runs
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_description(
+            ctx, err, ERRLEN, GUID.c_str(), "Saved now"));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_save(ctx, err, ERRLEN));
+
+        void *other = create_test_context();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(other, err, ERRLEN, TESTDB));
+        KopsikUser *user = kopsik_user_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_current_user(other, err, ERRLEN, user));
+        kopsik_user_clear(user);
+
+        KopsikTimeEntryViewItem *found = kopsik_time_entry_view_item_init();
+        int was_found(0);
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_by_guid(
+            other, err, ERRLEN, GUID.c_str(), found, &was_found));
+        ASSERT_TRUE(was_found);
+        ASSERT_EQ("Saved now", std::string(found->Description));
+        kopsik_time_entry_view_item_clear(found);
+
+        kopsik_context_clear(other);
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_edit_time_entry) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        KopsikTimeEntryViewItem *first = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items(
+            ctx, err, ERRLEN, &first));
+        ASSERT_TRUE(first);
+        std::string GUID(first->GUID);
+        std::string duration(first->Duration);
+        kopsik_time_entry_view_item_clear(first);
+
+        // Fields that are not flagged are left as they are
+        KopsikTimeEntryEdit edit;
+        memset(&edit, 0, sizeof(edit));
+        edit.Fields = KOPSIK_EDIT_DESCRIPTION | KOPSIK_EDIT_TAGS
+            | KOPSIK_EDIT_BILLABLE;
+        edit.Description = "Edited at once";
+        edit.Tags = "one|two";
+        edit.Billable = 1;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_edit_time_entry(
+            ctx, err, ERRLEN, GUID.c_str(), &edit));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_save(ctx, err, ERRLEN));
+
+        KopsikTimeEntryViewItem *found = kopsik_time_entry_view_item_init();
+        int was_found(0);
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_by_guid(
+            ctx, err, ERRLEN, GUID.c_str(), found, &was_found));
+        ASSERT_TRUE(was_found);
+        ASSERT_EQ("Edited at once", std::string(found->Description));
+        ASSERT_EQ("one|two", std::string(found->Tags));
+        ASSERT_TRUE(found->Billable);
+        ASSERT_EQ(duration, std::string(found->Duration));
+        kopsik_time_entry_view_item_clear(found);
+
+        ASSERT_NE(KOPSIK_API_SUCCESS, kopsik_edit_time_entry(
+            ctx, err, ERRLEN, "no such guid", &edit));
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_edit_time_entries) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        KopsikTimeEntryViewItem *first = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items(
+            ctx, err, ERRLEN, &first));
+        ASSERT_TRUE(first);
+        ASSERT_TRUE(first->Next);
+        KopsikTimeEntryViewItem *second =
+            reinterpret_cast<KopsikTimeEntryViewItem *>(first->Next);
+        std::string GUIDs[2] = { first->GUID, second->GUID };
+        kopsik_time_entry_view_item_clear(first);
+        const char *guids[2] = { GUIDs[0].c_str(), GUIDs[1].c_str() };
+
+        KopsikTimeEntryEdit edit;
+        memset(&edit, 0, sizeof(edit));
+        edit.Fields = KOPSIK_EDIT_TAGS | KOPSIK_EDIT_BILLABLE;
+        edit.Tags = "bulk";
+        edit.Billable = 1;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_edit_time_entries(
+            ctx, err, ERRLEN, guids, 2, &edit));
+
+        for (int i = 0; i < 2; i++) {
+            KopsikTimeEntryViewItem *found =
+                kopsik_time_entry_view_item_init();
+            int was_found(0);
+            ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_by_guid(
+                ctx, err, ERRLEN, guids[i], found, &was_found));
+            ASSERT_TRUE(was_found);
+            ASSERT_EQ("bulk", std::string(found->Tags));
+            ASSERT_TRUE(found->Billable);
+            kopsik_time_entry_view_item_clear(found);
+        }
+
+        // One unknown GUID and none of them is deleted
+        const char *some_unknown[2] = { guids[0], "no such guid" };
+        ASSERT_NE(KOPSIK_API_SUCCESS, kopsik_delete_time_entries(
+            ctx, err, ERRLEN, some_unknown, 2));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_delete_time_entries(
+            ctx, err, ERRLEN, guids, 2));
+
+        KopsikTimeEntryViewItem *visible = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items(
+            ctx, err, ERRLEN, &visible));
+        for (KopsikTimeEntryViewItem *it = visible; it;
+                it = reinterpret_cast<KopsikTimeEntryViewItem *>(it->Next)) {
+            ASSERT_NE(GUIDs[0], std::string(it->GUID));
+            ASSERT_NE(GUIDs[1], std::string(it->GUID));
+        }
+        kopsik_time_entry_view_item_clear(visible);
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_time_entry_view_item_array) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+
+        // Nobody is logged in, so there's nothing to list
+        KopsikTimeEntryViewItemArray *array =
+            kopsik_time_entry_view_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_array(
+            ctx, err, ERRLEN, array));
+        ASSERT_EQ((unsigned int)0, array->Length);
+        ASSERT_FALSE(array->Items);
+        kopsik_time_entry_view_item_array_clear(array);
+
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        // Items are linked in the order they're in the array
+        array = kopsik_time_entry_view_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_array(
+            ctx, err, ERRLEN, array));
+        ASSERT_EQ((unsigned int)3, array->Length);
+        ASSERT_FALSE(array->Snapshot);
+        for (unsigned int i = 0; i + 1 < array->Length; i++) {
+            ASSERT_EQ(&array->Items[i + 1], array->Items[i].Next);
+            ASSERT_GE(array->Items[i].Started, array->Items[i + 1].Started);
+        }
+        ASSERT_FALSE(array->Items[array->Length - 1].Next);
+        std::string GUID(array->Items[0].GUID);
+        std::string description(array->Items[0].Description);
+
+        // The strings are copies, they don't change with the time entry
+        KopsikTimeEntryEdit edit;
+        memset(&edit, 0, sizeof(edit));
+        edit.Fields = KOPSIK_EDIT_DESCRIPTION;
+        edit.Description = "Edited after listing";
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_edit_time_entry(
+            ctx, err, ERRLEN, GUID.c_str(), &edit));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_save(ctx, err, ERRLEN));
+        ASSERT_EQ(GUID, std::string(array->Items[0].GUID));
+        ASSERT_EQ(description, std::string(array->Items[0].Description));
+        kopsik_time_entry_view_item_array_clear(array);
+
+        array = kopsik_time_entry_view_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_item_array(
+            ctx, err, ERRLEN, array));
+        ASSERT_EQ(GUID, std::string(array->Items[0].GUID));
+        ASSERT_EQ("Edited after listing",
+            std::string(array->Items[0].Description));
+        kopsik_time_entry_view_item_array_clear(array);
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_time_entry_list_changes) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        KopsikTimeEntryListChanges *changes =
+            kopsik_time_entry_list_changes_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_list_changes(
+            ctx, err, ERRLEN, 0, changes));
+        ASSERT_TRUE(changes->IsFullList);
+        ASSERT_EQ((unsigned int)3, list_length(changes->Inserted));
+        KopsikTimeEntryViewItem *second =
+            reinterpret_cast<KopsikTimeEntryViewItem *>(
+                changes->Inserted->Next);
+        std::string edited(changes->Inserted->GUID);
+        std::string deleted(second->GUID);
+        unsigned int listed_version = changes->Version;
+        kopsik_time_entry_list_changes_clear(changes);
+
+        // An edited time entry is listed as updated
+        KopsikTimeEntryEdit edit;
+        memset(&edit, 0, sizeof(edit));
+        edit.Fields = KOPSIK_EDIT_DESCRIPTION;
+        edit.Description = "Edited since listed";
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_edit_time_entry(
+            ctx, err, ERRLEN, edited.c_str(), &edit));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_save(ctx, err, ERRLEN));
+
+        changes = kopsik_time_entry_list_changes_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_list_changes(
+            ctx, err, ERRLEN, listed_version, changes));
+        ASSERT_FALSE(changes->IsFullList);
+        ASSERT_LT(listed_version, changes->Version);
+        ASSERT_FALSE(changes->Inserted);
+        ASSERT_EQ((unsigned int)1, list_length(changes->Updated));
+        ASSERT_EQ(edited, std::string(changes->Updated->GUID));
+        ASSERT_EQ("Edited since listed",
+            std::string(changes->Updated->Description));
+        ASSERT_FALSE(changes->Deleted);
+        listed_version = changes->Version;
+        kopsik_time_entry_list_changes_clear(changes);
+
+        // A deleted one only by its GUID
+        const char *guids[1] = { deleted.c_str() };
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_delete_time_entries(
+            ctx, err, ERRLEN, guids, 1));
+
+        changes = kopsik_time_entry_list_changes_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_list_changes(
+            ctx, err, ERRLEN, listed_version, changes));
+        ASSERT_FALSE(changes->IsFullList);
+        ASSERT_FALSE(changes->Inserted);
+        ASSERT_FALSE(changes->Updated);
+        ASSERT_TRUE(changes->Deleted);
+        ASSERT_EQ(deleted, std::string(changes->Deleted->GUID));
+        ASSERT_FALSE(changes->Deleted->Next);
+        listed_version = changes->Version;
+        kopsik_time_entry_list_changes_clear(changes);
+
+        // A version the context never had means starting over
+        changes = kopsik_time_entry_list_changes_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_list_changes(
+            ctx, err, ERRLEN, listed_version + 100, changes));
+        ASSERT_TRUE(changes->IsFullList);
+        ASSERT_EQ(listed_version, changes->Version);
+        ASSERT_EQ((unsigned int)2, list_length(changes->Inserted));
+        ASSERT_FALSE(changes->Deleted);
+        kopsik_time_entry_list_changes_clear(changes);
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_time_entry_view_items_page) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        KopsikTimeEntryViewItem *first = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items(
+            ctx, err, ERRLEN, &first));
+        ASSERT_EQ((unsigned int)3, list_length(first));
+        std::string GUIDs[3];
+        KopsikTimeEntryViewItem *it = first;
+        for (int i = 0; i < 3; i++) {
+            GUIDs[i] = it->GUID;
+            it = reinterpret_cast<KopsikTimeEntryViewItem *>(it->Next);
+        }
+        kopsik_time_entry_view_item_clear(first);
+
+        // Two of them start in the same second
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_start_iso_8601(
+            ctx, err, ERRLEN, GUIDs[0].c_str(), "2013-11-28T10:00:00Z"));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_start_iso_8601(
+            ctx, err, ERRLEN, GUIDs[1].c_str(), "2013-11-27T10:00:00Z"));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_set_time_entry_start_iso_8601(
+            ctx, err, ERRLEN, GUIDs[2].c_str(), "2013-11-27T10:00:00Z"));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_save(ctx, err, ERRLEN));
+
+        // First page ends before them
+        KopsikTimeEntryViewItem *page = 0;
+        unsigned int started_before = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items_page(
+            ctx, err, ERRLEN, 0, 1, &page, &started_before));
+        ASSERT_EQ((unsigned int)1, list_length(page));
+        ASSERT_EQ(GUIDs[0], std::string(page->GUID));
+        ASSERT_EQ((unsigned int)1385632800, page->Started);
+        ASSERT_EQ(page->Started, started_before);
+        kopsik_time_entry_view_item_clear(page);
+
+        // and the next one has both, over the limit
+        page = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items_page(
+            ctx, err, ERRLEN, started_before, 1, &page, &started_before));
+        ASSERT_EQ((unsigned int)2, list_length(page));
+        KopsikTimeEntryViewItem *next =
+            reinterpret_cast<KopsikTimeEntryViewItem *>(page->Next);
+        ASSERT_EQ((unsigned int)1385546400, page->Started);
+        ASSERT_EQ(page->Started, next->Started);
+        ASSERT_FALSE(started_before);
+        kopsik_time_entry_view_item_clear(page);
+
+        // Nothing is older than the oldest
+        page = 0;
+        started_before = 1;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items_page(
+            ctx, err, ERRLEN, 1385546400, 10, &page, &started_before));
+        ASSERT_FALSE(page);
+        ASSERT_FALSE(started_before);
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_running_timer) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        KopsikTimeEntryViewItem *first = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_time_entry_view_items(
+            ctx, err, ERRLEN, &first));
+        ASSERT_TRUE(first);
+        std::string stopped_guid(first->GUID);
+        kopsik_time_entry_view_item_clear(first);
+
+        unsigned int started = 0;
+        unsigned int version = 0;
+        int is_tracking = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_running_timer(
+            ctx, err, ERRLEN, &started, &version, &is_tracking));
+        ASSERT_FALSE(is_tracking);
+        ASSERT_FALSE(started);
+        unsigned int idle_version = version;
+
+        std::time_t before = time(0);
+        KopsikTimeEntryViewItem *item = kopsik_time_entry_view_item_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_start(ctx, err, ERRLEN, "Timed", 0, 0, 0, item));
+        std::string GUID(item->GUID);
+        kopsik_time_entry_view_item_clear(item);
+
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_running_timer(
+            ctx, err, ERRLEN, &started, &version, &is_tracking));
+        ASSERT_TRUE(is_tracking);
+        ASSERT_LE((unsigned int)before, started);
+        ASSERT_GE((unsigned int)time(0), started);
+        ASSERT_LT(idle_version, version);
+        unsigned int running_version = version;
+
+        // Editing another time entry leaves the timer as it is
+        KopsikTimeEntryEdit edit;
+        memset(&edit, 0, sizeof(edit));
+        edit.Fields = KOPSIK_EDIT_DESCRIPTION;
+        edit.Description = "Not the running one";
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_edit_time_entry(
+            ctx, err, ERRLEN, stopped_guid.c_str(), &edit));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_save(ctx, err, ERRLEN));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_running_timer(
+            ctx, err, ERRLEN, &started, &version, &is_tracking));
+        ASSERT_EQ(running_version, version);
+
+        // Editing the running one gives the timer a new version,
+        // for the UI to read the whole entry again
+        unsigned int running_started = started;
+        edit.Description = "Timed and edited";
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_edit_time_entry(
+            ctx, err, ERRLEN, GUID.c_str(), &edit));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_save(ctx, err, ERRLEN));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_running_timer(
+            ctx, err, ERRLEN, &started, &version, &is_tracking));
+        ASSERT_TRUE(is_tracking);
+        ASSERT_EQ(running_started, started);
+        ASSERT_LT(running_version, version);
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_autocomplete_query) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        // Answers with the same items as the call that blocks,
+        // no more than the limit
+        KopsikAutocompleteItem *matching = 0;
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_autocomplete_items_matching(
+            ctx, err, ERRLEN, &matching, "", 2, 1, 1, 1));
+        ASSERT_TRUE(matching);
+        ASSERT_TRUE(matching->Next);
+        std::string first_text(matching->Text);
+        kopsik_autocomplete_item_clear(matching);
+
+        unsigned int query = kopsik_autocomplete_query(
+            ctx, "", 2, 1, 1, 1, in_test_autocomplete_query_callback);
+        ASSERT_TRUE(wait_for_autocomplete_query(query));
+        {
+            Poco::Mutex::ScopedLock lock(in_test_autocomplete_m);
+            ASSERT_EQ((unsigned int)2, in_test_autocomplete_count);
+            ASSERT_EQ(first_text, in_test_autocomplete_text);
+        }
+
+        // Nothing found is an answer too
+        unsigned int next_query = kopsik_autocomplete_query(
+            ctx, "nothing starts with this", 10, 1, 1, 1,
+            in_test_autocomplete_query_callback);
+        ASSERT_LT(query, next_query);
+        ASSERT_TRUE(wait_for_autocomplete_query(next_query));
+        {
+            Poco::Mutex::ScopedLock lock(in_test_autocomplete_m);
+            ASSERT_EQ((unsigned int)0, in_test_autocomplete_count);
+            ASSERT_EQ("", in_test_autocomplete_text);
+        }
+
+        kopsik_context_clear(ctx);
+    }
+
+    TEST(KopsikApiTest, kopsik_view_item_arrays_borrowed) {
+        void *ctx = create_test_context();
+        wipe_test_db();
+
+        char err[ERRLEN];
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_db_path(ctx, err, ERRLEN, TESTDB));
+        std::string json = loadTestData();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_set_logged_in_user(ctx, err, ERRLEN, json.c_str()));
+
+        KopsikTimeEntryViewItemArray *array =
+            kopsik_time_entry_view_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_time_entry_view_item_array_borrowed(ctx, err, ERRLEN,
+                                                       array));
+        ASSERT_EQ((unsigned int)3, array->Length);
+        ASSERT_TRUE(array->Snapshot);
+        std::string GUID(array->Items[0].GUID);
+        std::string description(array->Items[0].Description);
+
+        KopsikAutocompleteItemArray *autocomplete_array =
+            kopsik_autocomplete_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_autocomplete_item_array_borrowed(
+            ctx, err, ERRLEN, autocomplete_array, 1, 1, 1));
+        ASSERT_LT((unsigned int)0, autocomplete_array->Length);
+        ASSERT_TRUE(autocomplete_array->Snapshot);
+        std::string text(autocomplete_array->Items[0].Text);
+
+        // The snapshot they borrow from outlives an edit,
+        // and even a logout
+        KopsikTimeEntryEdit edit;
+        memset(&edit, 0, sizeof(edit));
+        edit.Fields = KOPSIK_EDIT_DESCRIPTION;
+        edit.Description = "Edited while borrowed";
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_edit_time_entry(
+            ctx, err, ERRLEN, GUID.c_str(), &edit));
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_save(ctx, err, ERRLEN));
+
+        KopsikTimeEntryViewItemArray *edited =
+            kopsik_time_entry_view_item_array_init();
+        ASSERT_EQ(KOPSIK_API_SUCCESS,
+            kopsik_time_entry_view_item_array_borrowed(ctx, err, ERRLEN,
+                                                       edited));
+        ASSERT_NE(array->Snapshot, edited->Snapshot);
+        ASSERT_EQ(GUID, std::string(edited->Items[0].GUID));
+        ASSERT_EQ("Edited while borrowed",
+            std::string(edited->Items[0].Description));
+        kopsik_time_entry_view_item_array_clear(edited);
+
+        ASSERT_EQ(KOPSIK_API_SUCCESS, kopsik_logout(ctx, err, ERRLEN));
+        ASSERT_EQ(GUID, std::string(array->Items[0].GUID));
+        ASSERT_EQ(description, std::string(array->Items[0].Description));
+        ASSERT_EQ(text, std::string(autocomplete_array->Items[0].Text));
+        kopsik_time_entry_view_item_array_clear(array);
+        kopsik_autocomplete_item_array_clear(autocomplete_array);
+
+        kopsik_context_clear(ctx);
+    }
+
     TEST(KopsikApiTest, kopsik_time_entry_view_item_init) {
         KopsikTimeEntryViewItem *te = kopsik_time_entry_view_item_init();
         ASSERT_TRUE(te);
@@ -0,0 +1,102 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./log.h"
+
+#include "Poco/NumberFormatter.h"
+
+namespace kopsik {
+
+Poco::Logger &ComponentLogger(LogComponent *component) {
+  Poco::Logger *logger = component->logger;
+  if (!logger) {
+    logger = &Poco::Logger::get(component->name);
+    component->logger = logger;
+  }
+  return *logger;
+}
+
+LogFields &LogFields::Add(const char *key, const std::string &value) {
+  fields_.push_back(Field(key, value));
+  return *this;
+}
+
+LogFields &LogFields::Add(const char *key, const char *value) {
+  return Add(key, std::string(value ? value : ""));
+}
+
+LogFields &LogFields::Add(const char *key, const int value) {
+  return Add(key, Poco::NumberFormatter::format(value));
+}
+
+LogFields &LogFields::Add(const char *key, const unsigned int value) {
+  return Add(key, Poco::NumberFormatter::format(value));
+}
+
+LogFields &LogFields::Add(const char *key, const Poco::Int64 value) {
+  return Add(key, Poco::NumberFormatter::format(value));
+}
+
+LogFields &LogFields::Add(const char *key, const Poco::UInt64 value) {
+  return Add(key, Poco::NumberFormatter::format(value));
+}
+
+LogFields &LogFields::Add(const char *key, const bool value) {
+  return Add(key, std::string(value ? "true" : "false"));
+}
+
+LogFields &LogFields::Add(const char *key, const double value) {
+  return Add(key, Poco::NumberFormatter::format(value));
+}
+
+std::string LogFields::Text(const std::string &message) const {
+  std::string text(message);
+  for (std::vector<Field>::const_iterator it = fields_.begin();
+      it != fields_.end();
+      it++) {
+    text += ' ';
+    text += it->first;
+    text += '=';
+    appendValue(it->second, &text);
+  }
+  return text;
+}
+
+void LogFields::Log(
+    Poco::Logger *logger, const Poco::Message::Priority priority,
+    const std::string &message) const {
+  Poco::Message msg(logger->name(), Text(message), priority);
+  std::string names("");
+  for (std::vector<Field>::const_iterator it = fields_.begin();
+      it != fields_.end();
+      it++) {
+    msg[it->first] = it->second;
+    if (!names.empty()) {
+      names += '\n';
+    }
+    names += it->first;
+  }
+  if (!names.empty()) {
+    msg[kLogFieldNames] = names;
+  }
+  logger->log(msg);
+}
+
+void LogFields::appendValue(const std::string &value, std::string *text) {
+  if (!value.empty()
+      && value.find_first_of(" \t\r\n\"=") == std::string::npos) {
+    *text += value;
+    return;
+  }
+  *text += '"';
+  for (std::string::const_iterator it = value.begin();
+      it != value.end();
+      it++) {
+    if ('"' == *it || '\\' == *it) {
+      *text += '\\';
+    }
+    *text += *it;
+  }
+  *text += '"';
+}
+
+}  // namespace kopsik
@@ -0,0 +1,107 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_LOG_H_
+#define SRC_LOG_H_
+
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Poco/Logger.h"
+#include "Poco/Message.h"
+#include "Poco/Types.h"
+
+// Streams the message into the logger only when the logger has the
+// level enabled, so a disabled level doesn't pay for formatting:
+//
+//   KOPSIK_LOG_DEBUG(logger(), "Saved " << n << " time entries");
+//
+// Unlike poco_debug and poco_trace these are not compiled out of
+// release builds, where the log level is set at runtime.
+#define KOPSIK_LOG(logger, level, message) \
+  do { \
+    Poco::Logger &kopsik_log_logger_ = (logger); \
+    if (kopsik_log_logger_.level()) { \
+      std::ostringstream kopsik_log_message_; \
+      kopsik_log_message_ << message; \
+      kopsik_log_logger_.level(kopsik_log_message_.str()); \
+    } \
+  } while (0)
+
+#define KOPSIK_LOG_TRACE(logger, message) KOPSIK_LOG(logger, trace, message)
+#define KOPSIK_LOG_DEBUG(logger, message) KOPSIK_LOG(logger, debug, message)
+
+// Logs the message with typed fields, which are only put together
+// when the logger has the priority enabled:
+//
+//   KOPSIK_LOG_FIELDS(logger(), PRIO_DEBUG, "Saved time entries",
+//     kopsik::LogFields().Add("count", n).Add("ms", ms));
+//
+// The text reads "Saved time entries count=3 ms=12", and each field
+// is also set on the Poco::Message, for channels that keep them apart
+// such as BinaryLogChannel. As Poco::Message can't list what's set on
+// it, the names go along in kLogFieldNames.
+#define KOPSIK_LOG_FIELDS(logger, priority, message, fields) \
+  do { \
+    Poco::Logger &kopsik_log_logger_ = (logger); \
+    if (kopsik_log_logger_.is(Poco::Message::priority)) { \
+      (fields).Log(&kopsik_log_logger_, Poco::Message::priority, message); \
+    } \
+  } while (0)
+
+namespace kopsik {
+
+  // Parameter of a Poco::Message with the names of the fields set on
+  // it, one per line
+  const char kLogFieldNames[] = "kopsik.fields";
+
+  // Logger of one component, looked up by name on first use only.
+  // Poco::Logger::get locks a global mutex and searches the loggers
+  // by name on every call, which adds up for loggers asked for each
+  // time something is logged. It's a plain struct, so a handle at
+  // namespace scope is set up before any code runs:
+  //
+  //   static kopsik::LogComponent log_json = { "json", 0 };
+  //   kopsik::ComponentLogger(&log_json).warning(err);
+  //
+  // Threads that race to the first use look up the same logger.
+  typedef struct {
+    const char *name;
+    Poco::Logger *logger;
+  } LogComponent;
+
+  Poco::Logger &ComponentLogger(LogComponent *component);
+
+  // Named values to log along with a message, see KOPSIK_LOG_FIELDS.
+  // Numbers are formatted without going through a stream. String
+  // values with spaces, quotes or = in them are quoted in the text.
+  class LogFields {
+  public:
+    LogFields &Add(const char *key, const std::string &value);
+    LogFields &Add(const char *key, const char *value);
+    LogFields &Add(const char *key, const int value);
+    LogFields &Add(const char *key, const unsigned int value);
+    LogFields &Add(const char *key, const Poco::Int64 value);
+    LogFields &Add(const char *key, const Poco::UInt64 value);
+    LogFields &Add(const char *key, const bool value);
+    LogFields &Add(const char *key, const double value);
+
+    // message followed by the fields as key=value
+    std::string Text(const std::string &message) const;
+
+    void Log(Poco::Logger *logger,
+             const Poco::Message::Priority priority,
+             const std::string &message) const;
+
+  private:
+    typedef std::pair<std::string, std::string> Field;
+
+    static void appendValue(const std::string &value, std::string *text);
+
+    std::vector<Field> fields_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_LOG_H_
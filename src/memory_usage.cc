@@ -0,0 +1,61 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./memory_usage.h"
+
+namespace kopsik {
+
+std::size_t StringBytes(const std::string &value) {
+  if (value.capacity() < sizeof(std::string)) {
+    return 0;
+  }
+  return value.capacity() + 1;
+}
+
+std::size_t StringVectorBytes(const std::vector<std::string> &list) {
+  std::size_t bytes = VectorBytes(list);
+  for (std::vector<std::string>::const_iterator it = list.begin();
+      it != list.end();
+      it++) {
+    bytes += StringBytes(*it);
+  }
+  return bytes;
+}
+
+void ReleaseFreeHeap() {
+#if defined(__GLIBC__)
+  malloc_trim(0);
+#elif POCO_OS == POCO_OS_MAC_OS_X
+  malloc_zone_pressure_relief(0, 0);
+#elif defined(POCO_OS_FAMILY_WINDOWS)
+  HeapCompact(GetProcessHeap(), 0);
+#endif
+}
+
+std::size_t ResidentBytes() {
+#if POCO_OS == POCO_OS_LINUX
+  std::FILE *statm = std::fopen("/proc/self/statm", "r");
+  if (!statm) {
+    return 0;
+  }
+  unsigned long total_pages(0), resident_pages(0);  // NOLINT
+  int found = std::fscanf(statm, "%lu %lu", &total_pages, &resident_pages);
+  std::fclose(statm);
+  if (found != 2) {
+    return 0;
+  }
+  return resident_pages * sysconf(_SC_PAGESIZE);
+#elif POCO_OS == POCO_OS_MAC_OS_X
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                reinterpret_cast<task_info_t>(&info), &count)
+      != KERN_SUCCESS) {
+    return 0;
+  }
+  return info.resident_size;
+#else
+  return 0;
+#endif
+}
+
+}  // namespace kopsik
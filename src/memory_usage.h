@@ -0,0 +1,80 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_MEMORY_USAGE_H_
+#define SRC_MEMORY_USAGE_H_
+
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Poco/Platform.h"
+
+#if POCO_OS == POCO_OS_LINUX
+#include <unistd.h>  // NOLINT
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>  // NOLINT
+#elif POCO_OS == POCO_OS_MAC_OS_X
+#include <malloc/malloc.h>  // NOLINT
+#include <mach/mach.h>  // NOLINT
+#elif defined(POCO_OS_FAMILY_WINDOWS)
+#include "Poco/UnWindows.h"
+#endif
+
+namespace kopsik {
+
+  // Memory accounting is an estimate of what the containers hold on
+  // the heap, from their sizes and capacities. Allocator overhead
+  // isn't counted.
+
+  // Bookkeeping of a node of std::map and std::set, besides the value
+  const std::size_t kTreeNodeOverheadBytes = 4 * sizeof(std::size_t);
+
+  // Heap bytes of a string, nothing when short enough to be kept
+  // inside the string itself
+  std::size_t StringBytes(const std::string &value);
+
+  template <class T>
+  std::size_t VectorBytes(const std::vector<T> &list) {
+    return list.capacity() * sizeof(T);
+  }
+
+  std::size_t StringVectorBytes(const std::vector<std::string> &list);
+
+  template <class K, class V, class C>
+  std::size_t MapNodesBytes(const std::map<K, V, C> &map) {
+    return map.size() * (kTreeNodeOverheadBytes + sizeof(K) + sizeof(V));
+  }
+
+  template <class T, class C>
+  std::size_t SetNodesBytes(const std::set<T, C> &set) {
+    return set.size() * (kTreeNodeOverheadBytes + sizeof(T));
+  }
+
+  // A list of models and the models themselves, see
+  // BaseModel::MemoryBytes
+  template <class T>
+  std::size_t ModelsBytes(const std::vector<T *> &list) {
+    std::size_t bytes = VectorBytes(list);
+    for (typename std::vector<T *>::const_iterator it = list.begin();
+        it != list.end();
+        it++) {
+      bytes += (*it)->MemoryBytes();
+    }
+    return bytes;
+  }
+
+  // Asks the allocator to return the free pages it's holding on to
+  // to the OS. Freeing memory alone doesn't make the process shrink.
+  void ReleaseFreeHeap();
+
+  // Memory the process has in RAM now, in bytes, as the OS counts it.
+  // 0 where that isn't known.
+  std::size_t ResidentBytes();
+
+}  // namespace kopsik
+
+#endif  // SRC_MEMORY_USAGE_H_
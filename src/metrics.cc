@@ -0,0 +1,226 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./metrics.h"
+
+#include "Poco/SingletonHolder.h"
+
+namespace kopsik {
+
+LatencyHistogram::LatencyHistogram()
+  : count(0), total_micros(0), max_micros(0) {
+  for (std::size_t i = 0; i < kMetricsBucketCount; i++) {
+    buckets[i] = 0;
+  }
+}
+
+void LatencyHistogram::Add(const Poco::Int64 micros) {
+  count++;
+  total_micros += micros;
+  if (micros > max_micros) {
+    max_micros = micros;
+  }
+  std::size_t i = 0;
+  while (i < kMetricsBucketCount - 1
+      && micros > kMetricsBucketBoundsMicros[i]) {
+    i++;
+  }
+  buckets[i]++;
+}
+
+Metrics &Metrics::Shared() {
+  static Poco::SingletonHolder<Metrics> sh;
+  return *sh.get();
+}
+
+void Metrics::Count(const std::string &name, const Poco::Int64 n) {
+  Poco::FastMutex::ScopedLock lock(metrics_m_);
+  counters_[name] += n;
+}
+
+void Metrics::Time(const std::string &name, const Poco::Int64 micros) {
+  Poco::FastMutex::ScopedLock lock(metrics_m_);
+  latencies_[name].Add(micros);
+}
+
+void Metrics::SetGauge(const std::string &name, const Poco::Int64 value) {
+  Poco::FastMutex::ScopedLock lock(metrics_m_);
+  gauges_[name] = value;
+}
+
+Poco::Int64 Metrics::Counter(const std::string &name) {
+  Poco::FastMutex::ScopedLock lock(metrics_m_);
+  std::map<std::string, Poco::Int64>::const_iterator it =
+    counters_.find(name);
+  if (it == counters_.end()) {
+    return 0;
+  }
+  return it->second;
+}
+
+Poco::Int64 Metrics::Gauge(const std::string &name) {
+  Poco::FastMutex::ScopedLock lock(metrics_m_);
+  std::map<std::string, Poco::Int64>::const_iterator it =
+    gauges_.find(name);
+  if (it == gauges_.end()) {
+    return 0;
+  }
+  return it->second;
+}
+
+LatencyHistogram Metrics::Histogram(const std::string &name) {
+  Poco::FastMutex::ScopedLock lock(metrics_m_);
+  std::map<std::string, LatencyHistogram>::const_iterator it =
+    latencies_.find(name);
+  if (it == latencies_.end()) {
+    return LatencyHistogram();
+  }
+  return it->second;
+}
+
+std::string Metrics::JSON() {
+  JSONWriter writer;
+  writer.BeginObject();
+
+  writer.Key("bucket_bounds_us");
+  writer.BeginArray();
+  for (std::size_t i = 0; i < kMetricsBucketCount - 1; i++) {
+    writer.Int(kMetricsBucketBoundsMicros[i]);
+  }
+  writer.EndArray();
+
+  Poco::FastMutex::ScopedLock lock(metrics_m_);
+
+  writer.Key("counters");
+  writer.BeginObject();
+  for (std::map<std::string, Poco::Int64>::const_iterator it =
+      counters_.begin();
+      it != counters_.end();
+      it++) {
+    writer.Int(it->first, it->second);
+  }
+  writer.EndObject();
+
+  writer.Key("gauges");
+  writer.BeginObject();
+  for (std::map<std::string, Poco::Int64>::const_iterator it =
+      gauges_.begin();
+      it != gauges_.end();
+      it++) {
+    writer.Int(it->first, it->second);
+  }
+  writer.EndObject();
+
+  writer.Key("latencies");
+  writer.BeginObject();
+  for (std::map<std::string, LatencyHistogram>::const_iterator it =
+      latencies_.begin();
+      it != latencies_.end();
+      it++) {
+    const LatencyHistogram &h = it->second;
+    writer.Key(it->first);
+    writer.BeginObject();
+    writer.Int("count", h.count);
+    writer.Int("total_us", h.total_micros);
+    writer.Int("max_us", h.max_micros);
+    writer.Key("buckets");
+    writer.BeginArray();
+    for (std::size_t i = 0; i < kMetricsBucketCount; i++) {
+      writer.Int(h.buckets[i]);
+    }
+    writer.EndArray();
+    writer.EndObject();
+  }
+  writer.EndObject();
+
+  writer.EndObject();
+  return writer.Buffer();
+}
+
+void Metrics::Clear() {
+  Poco::FastMutex::ScopedLock lock(metrics_m_);
+  counters_.clear();
+  gauges_.clear();
+  latencies_.clear();
+}
+
+MetricsTimer::~MetricsTimer() {
+  Metrics::Shared().Time(name_, started_.elapsed());
+}
+
+std::string MetricsStatement(const std::string &sql) {
+  std::string result("");
+  result.reserve(sql.size());
+  std::string::size_type i = 0;
+  while (i < sql.size() && result.size() < kMetricsStatementLength) {
+    unsigned char c = sql[i];
+    if (isspace(c)) {
+      while (i < sql.size() && isspace(static_cast<unsigned char>(sql[i]))) {
+        i++;
+      }
+      if (!result.empty() && i < sql.size()) {
+        result += ' ';
+      }
+      continue;
+    }
+    if ('\'' == c) {
+      // Quotes inside a string are doubled
+      i++;
+      while (i < sql.size()) {
+        if ('\'' == sql[i] && (i + 1 == sql.size() || '\'' != sql[i + 1])) {
+          break;
+        }
+        i += ('\'' == sql[i]) ? 2 : 1;
+      }
+      i++;
+    } else if (isdigit(c) && (result.empty()
+        || !(isalnum(static_cast<unsigned char>(result[result.size() - 1]))
+          || '_' == result[result.size() - 1]))) {
+      while (i < sql.size()
+          && (isalnum(static_cast<unsigned char>(sql[i])) || '.' == sql[i])) {
+        i++;
+      }
+    } else {
+      result += c;
+      i++;
+      continue;
+    }
+    // A literal. If it follows "?," it's part of a list already
+    // written as ?
+    std::string::size_type comma = result.find_last_not_of(' ');
+    if (comma != std::string::npos && comma > 0 && ',' == result[comma]) {
+      std::string::size_type prev = result.find_last_not_of(' ', comma - 1);
+      if (prev != std::string::npos && '?' == result[prev]) {
+        result.erase(prev + 1);
+        continue;
+      }
+    }
+    result += '?';
+  }
+  return result;
+}
+
+std::string MetricsEndpoint(const std::string &relative_url) {
+  std::string path(relative_url.substr(0, relative_url.find('?')));
+  std::string result("");
+  result.reserve(path.size());
+  std::string::size_type start = 0;
+  while (start < path.size()) {
+    std::string::size_type end = path.find('/', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    std::string segment(path.substr(start, end - start));
+    if (!segment.empty()
+        && segment.find_first_not_of("0123456789") == std::string::npos) {
+      segment = ":id";
+    }
+    result += segment;
+    if (end < path.size()) {
+      result += '/';
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,103 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_METRICS_H_
+#define SRC_METRICS_H_
+
+#include <cctype>
+#include <map>
+#include <string>
+
+#include "./json_writer.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Upper bounds of the latency histogram buckets, in microseconds.
+  // Anything slower lands in one more bucket after the last bound.
+  const Poco::Int64 kMetricsBucketBoundsMicros[] = {
+    1000, 5000, 10000, 25000, 50000, 100000, 250000,
+    500000, 1000000, 2500000, 5000000, 10000000
+  };
+  const std::size_t kMetricsBucketCount =
+    sizeof(kMetricsBucketBoundsMicros) / sizeof(kMetricsBucketBoundsMicros[0])
+    + 1;
+
+  struct LatencyHistogram {
+    LatencyHistogram();
+
+    void Add(const Poco::Int64 micros);
+
+    Poco::Int64 count;
+    Poco::Int64 total_micros;
+    Poco::Int64 max_micros;
+    Poco::Int64 buckets[kMetricsBucketCount];
+  };
+
+  // Counters and latency histograms of the library, by name. Names
+  // are dotted, with the area first ("db.save.time_entries",
+  // "http.GET /api/v8/me"). Shared by all contexts, since the
+  // database and HTTP code don't know which context they work for.
+  class Metrics {
+  public:
+    Metrics() {}
+
+    static Metrics &Shared();
+
+    void Count(const std::string &name, const Poco::Int64 n = 1);
+
+    void Time(const std::string &name, const Poco::Int64 micros);
+
+    // Latest value of something that goes up and down,
+    // like the memory a list takes
+    void SetGauge(const std::string &name, const Poco::Int64 value);
+
+    Poco::Int64 Counter(const std::string &name);
+
+    Poco::Int64 Gauge(const std::string &name);
+
+    LatencyHistogram Histogram(const std::string &name);
+
+    // Everything as one JSON object, for kopsik_get_metrics
+    std::string JSON();
+
+    void Clear();
+
+  private:
+    std::map<std::string, Poco::Int64> counters_;
+    std::map<std::string, Poco::Int64> gauges_;
+    std::map<std::string, LatencyHistogram> latencies_;
+    Poco::FastMutex metrics_m_;
+
+    Metrics(const Metrics &);
+    Metrics &operator=(const Metrics &);
+  };
+
+  // Adds the time it lived to the named latency histogram
+  class MetricsTimer {
+  public:
+    explicit MetricsTimer(const std::string &name) : name_(name) {}
+    ~MetricsTimer();
+
+  private:
+    std::string name_;
+    Poco::Timestamp started_;
+  };
+
+  // Longest statement kept in a metric name
+  const std::size_t kMetricsStatementLength = 120;
+
+  // SQL with whitespace collapsed and literals replaced by ?, so
+  // statements that only differ in values add up. A list of values
+  // becomes a single ?.
+  std::string MetricsStatement(const std::string &sql);
+
+  // Request path without the query string, and with numeric
+  // segments replaced, so all requests to an endpoint add up.
+  std::string MetricsEndpoint(const std::string &relative_url);
+
+}  // namespace kopsik
+
+#endif  // SRC_METRICS_H_
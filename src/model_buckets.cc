@@ -0,0 +1,153 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./model_buckets.h"
+
+#include "Poco/HashMap.h"
+
+namespace kopsik {
+
+ModelBuckets::ModelBuckets(
+    const std::vector<Project *> &projects, const std::vector<Task *> &tasks,
+    const std::vector<Client *> &clients,
+    const ListGeneration &project_generation,
+    const ListGeneration &task_generation,
+    const ListGeneration &client_generation)
+  : projects_(projects)
+  , tasks_(tasks)
+  , clients_(clients)
+  , project_generation_(project_generation)
+  , task_generation_(task_generation)
+  , client_generation_(client_generation)
+  , projects_generation_(0)
+  , tasks_generation_(0)
+  , clients_generation_(0)
+  , label_generation_(BaseModel::LabelGeneration() - 1)
+  , key_generation_(BaseModel::KeyGeneration() - 1)
+  , projects_size_(0)
+  , tasks_size_(0)
+  , clients_size_(0) {}
+
+void ModelBuckets::ClientsInWorkspace(
+    const Poco::UInt64 wid, std::vector<Client *> *list) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  refresh();
+  append(clients_by_wid_, wid, list);
+}
+
+void ModelBuckets::ProjectsInWorkspace(
+    const Poco::UInt64 wid, std::vector<Project *> *list) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  refresh();
+  append(projects_by_wid_, wid, list);
+}
+
+void ModelBuckets::ActiveProjects(std::vector<Project *> *list) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  refresh();
+  list->insert(list->end(), active_projects_.begin(),
+               active_projects_.end());
+}
+
+void ModelBuckets::ActiveTasks(std::vector<Task *> *list) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  refresh();
+  list->insert(list->end(), active_tasks_.begin(), active_tasks_.end());
+}
+
+void ModelBuckets::Refresh() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  refresh();
+}
+
+void ModelBuckets::Clear() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  projects_generation_ = 0;
+  label_generation_ = BaseModel::LabelGeneration() - 1;
+}
+
+std::size_t ModelBuckets::MemoryBytes() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  return bucketsBytes(clients_by_wid_)
+    + bucketsBytes(projects_by_wid_)
+    + VectorBytes(active_projects_)
+    + VectorBytes(active_tasks_);
+}
+
+bool ModelBuckets::current() const {
+  if (projects_.size() != projects_size_
+      || tasks_.size() != tasks_size_
+      || clients_.size() != clients_size_) {
+    return false;
+  }
+  if (project_generation_.Tracked() == projects_.size()
+      && task_generation_.Tracked() == tasks_.size()
+      && client_generation_.Tracked() == clients_.size()) {
+    return projects_generation_ == project_generation_.Value()
+      && tasks_generation_ == task_generation_.Value()
+      && clients_generation_ == client_generation_.Value();
+  }
+  return label_generation_ == BaseModel::LabelGeneration()
+    && key_generation_ == BaseModel::KeyGeneration();
+}
+
+void ModelBuckets::refresh() {
+  if (current()) {
+    return;
+  }
+  int label_generation = BaseModel::LabelGeneration();
+  int key_generation = BaseModel::KeyGeneration();
+
+  clients_by_wid_.clear();
+  for (std::vector<Client *>::const_iterator it = clients_.begin();
+      it != clients_.end();
+      it++) {
+    clients_by_wid_[(*it)->WID()].push_back(*it);
+  }
+
+  projects_by_wid_.clear();
+  active_projects_.clear();
+  // Whether the project of an ID is active, the first one wins
+  // like in the lookups
+  Poco::HashMap<Poco::UInt64, bool> active;
+  for (std::vector<Project *>::const_iterator it = projects_.begin();
+      it != projects_.end();
+      it++) {
+    Project *p = *it;
+    projects_by_wid_[p->WID()].push_back(p);
+    if (p->Active()) {
+      active_projects_.push_back(p);
+    }
+    if (p->ID() && active.find(p->ID()) == active.end()) {
+      active[p->ID()] = p->Active();
+    }
+  }
+
+  active_tasks_.clear();
+  for (std::vector<Task *>::const_iterator it = tasks_.begin();
+      it != tasks_.end();
+      it++) {
+    Task *t = *it;
+    if (t->IsMarkedAsDeletedOnServer()) {
+      continue;
+    }
+    if (t->PID()) {
+      Poco::HashMap<Poco::UInt64, bool>::ConstIterator p =
+        active.find(t->PID());
+      if (p != active.end() && !p->second) {
+        continue;
+      }
+    }
+    active_tasks_.push_back(t);
+  }
+
+  projects_generation_ = project_generation_.Value();
+  tasks_generation_ = task_generation_.Value();
+  clients_generation_ = client_generation_.Value();
+  label_generation_ = label_generation;
+  key_generation_ = key_generation;
+  projects_size_ = projects_.size();
+  tasks_size_ = tasks_.size();
+  clients_size_ = clients_.size();
+}
+
+}  // namespace kopsik
@@ -0,0 +1,113 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_MODEL_BUCKETS_H_
+#define SRC_MODEL_BUCKETS_H_
+
+#include <map>
+#include <vector>
+
+#include "./base_model.h"
+#include "./client.h"
+#include "./memory_usage.h"
+#include "./project.h"
+#include "./task.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Clients and projects by workspace, and the projects and tasks
+  // that are offered for picking, in the order of their lists. Like
+  // ModelIndex, the buckets compare the list sizes and the list
+  // generations to what they were built from and are built again
+  // when any has changed, so they follow loads and updates without
+  // knowing about every place that makes them.
+  class ModelBuckets {
+  public:
+    ModelBuckets(const std::vector<Project *> &projects,
+                 const std::vector<Task *> &tasks,
+                 const std::vector<Client *> &clients,
+                 const ListGeneration &project_generation,
+                 const ListGeneration &task_generation,
+                 const ListGeneration &client_generation);
+
+    void ClientsInWorkspace(const Poco::UInt64 wid,
+                            std::vector<Client *> *list);
+
+    void ProjectsInWorkspace(const Poco::UInt64 wid,
+                             std::vector<Project *> *list);
+
+    void ActiveProjects(std::vector<Project *> *list);
+
+    // Tasks still on the server, unless their project is archived
+    void ActiveTasks(std::vector<Task *> *list);
+
+    // Brings the buckets up to date now rather than on the next use
+    void Refresh();
+
+    // Builds the buckets again on next use, even if nothing seems
+    // to have changed
+    void Clear();
+
+    std::size_t MemoryBytes();
+
+  private:
+    template <class T>
+    static void append(const std::map<Poco::UInt64, std::vector<T *> > &b,
+                       const Poco::UInt64 wid,
+                       std::vector<T *> *list) {
+      typename std::map<Poco::UInt64, std::vector<T *> >::const_iterator it =
+        b.find(wid);
+      if (it != b.end()) {
+        list->insert(list->end(), it->second.begin(), it->second.end());
+      }
+    }
+
+    template <class T>
+    static std::size_t bucketsBytes(
+        const std::map<Poco::UInt64, std::vector<T *> > &b) {
+      std::size_t bytes = MapNodesBytes(b);
+      for (typename std::map<Poco::UInt64, std::vector<T *> >::const_iterator
+          it = b.begin();
+          it != b.end();
+          it++) {
+        bytes += VectorBytes(it->second);
+      }
+      return bytes;
+    }
+
+    // Must be called with mutex_ locked
+    void refresh();
+    bool current() const;
+
+    const std::vector<Project *> &projects_;
+    const std::vector<Task *> &tasks_;
+    const std::vector<Client *> &clients_;
+    const ListGeneration &project_generation_;
+    const ListGeneration &task_generation_;
+    const ListGeneration &client_generation_;
+    // Generations of the lists, or while they hold untracked models
+    // the process-wide ones
+    int projects_generation_;
+    int tasks_generation_;
+    int clients_generation_;
+    int label_generation_;
+    int key_generation_;
+    std::size_t projects_size_;
+    std::size_t tasks_size_;
+    std::size_t clients_size_;
+
+    std::map<Poco::UInt64, std::vector<Client *> > clients_by_wid_;
+    std::map<Poco::UInt64, std::vector<Project *> > projects_by_wid_;
+    std::vector<Project *> active_projects_;
+    std::vector<Task *> active_tasks_;
+    Poco::FastMutex mutex_;
+
+    ModelBuckets(const ModelBuckets &);
+    ModelBuckets &operator=(const ModelBuckets &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_MODEL_BUCKETS_H_
@@ -0,0 +1,193 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_MODEL_INDEX_H_
+#define SRC_MODEL_INDEX_H_
+
+#include <vector>
+
+#include "./types.h"
+#include "./base_model.h"
+
+#include "Poco/Types.h"
+#include "Poco/HashMap.h"
+#include "Poco/Mutex.h"
+
+namespace kopsik {
+
+  // ID and GUID hash index over a list of models, GUIDs
+  // are hashed by their binary value.
+  // The index watches the size of the list and the key generation of
+  // the list (see ListGeneration) and rebuilds itself when either has
+  // changed since it was last brought up to date, so models pushed
+  // onto the list or given a new ID are found without telling it.
+  // While the list holds untracked models, whose keys only bump the
+  // process-wide BaseModel::KeyGeneration, it watches that too.
+  // Removing a model from the list has to be told with Invalidate(),
+  // as the list may be back to the same size by the next lookup.
+  // Lookups run beside each other under the read lock of the lists,
+  // so the index has a lock of its own.
+  template <class T>
+  class ModelIndex {
+  public:
+    ModelIndex(
+      const std::vector<T *> &list,
+      const ListGeneration &generation)
+      : list_(list)
+      , generation_(generation)
+      , indexed_size_(0)
+      , indexed_keys_(0)
+      , indexed_generation_(0)
+      , stale_(true) {}
+
+    T *ByID(const Poco::UInt64 id) {
+      Poco::FastMutex::ScopedLock lock(mutex_);
+      ensureUpToDate();
+      typename Poco::HashMap<Poco::UInt64, T *>::Iterator it =
+        by_id_.find(id);
+      if (it == by_id_.end()) {
+        return 0;
+      }
+      if (it->second->ID() != id) {
+        by_id_.erase(it);
+        return 0;
+      }
+      return it->second;
+    }
+
+    T *ByGUID(const guid GUID) {
+      return ByGUID(BinaryGUID::Of(GUID));
+    }
+
+    T *ByGUID(const BinaryGUID &GUID) {
+      Poco::FastMutex::ScopedLock lock(mutex_);
+      ensureUpToDate();
+      typename Poco::HashMap<BinaryGUID, T *, BinaryGUIDHash>::Iterator it =
+        by_guid_.find(GUID);
+      if (it == by_guid_.end()) {
+        return 0;
+      }
+      if (it->second->GUIDKey() != GUID) {
+        by_guid_.erase(it);
+        return 0;
+      }
+      return it->second;
+    }
+
+    // Index a model that was just added to the list or just had its
+    // keys changed. When that model is the only change since the last
+    // lookup, the index stays up to date without a rebuild. Anything
+    // else (several models pushed at once, keys of other models
+    // changed, untracked models in the list) falls back to the
+    // rebuild.
+    void Add(T *model) {
+      Poco::FastMutex::ScopedLock lock(mutex_);
+      if (stale_
+          || (indexed_size_ != list_.size()
+              && indexed_size_ + 1 != list_.size())
+          || generation_.Tracked() != list_.size()
+          || !generation_.KeyedOnlyBy(model, indexed_keys_)) {
+        ensureUpToDate();
+        return;
+      }
+      index(model);
+      indexed_size_ = list_.size();
+      indexed_keys_ = generation_.Keys();
+      indexed_generation_ = BaseModel::KeyGeneration();
+    }
+
+    // Brings the index up to date now rather than on the next lookup
+    void Refresh() {
+      Poco::FastMutex::ScopedLock lock(mutex_);
+      ensureUpToDate();
+    }
+
+    // Rebuilt on the next lookup. Call when models left the list.
+    void Invalidate() {
+      Poco::FastMutex::ScopedLock lock(mutex_);
+      stale_ = true;
+    }
+
+    // Each bucket of the hash maps is a vector, holding about one entry
+    std::size_t MemoryBytes() const {
+      Poco::FastMutex::ScopedLock lock(mutex_);
+      return by_id_.size() * (sizeof(std::vector<char>)
+        + sizeof(typename Poco::HashMap<Poco::UInt64, T *>::ValueType))
+        + by_guid_.size() * (sizeof(std::vector<char>)
+        + sizeof(typename Poco::HashMap<BinaryGUID, T *,
+                                        BinaryGUIDHash>::ValueType));
+    }
+
+    // Gives the buckets back too, unlike a rebuild
+    void Clear() {
+      Poco::FastMutex::ScopedLock lock(mutex_);
+      Poco::HashMap<Poco::UInt64, T *>().swap(by_id_);
+      Poco::HashMap<BinaryGUID, T *, BinaryGUIDHash>().swap(by_guid_);
+      indexed_size_ = 0;
+      stale_ = true;
+    }
+
+  private:
+    // Call with mutex_ held
+    bool upToDate() const {
+      if (stale_
+          || indexed_size_ != list_.size()
+          || indexed_keys_ != generation_.Keys()) {
+        return false;
+      }
+      return generation_.Tracked() == list_.size()
+        || indexed_generation_ == BaseModel::KeyGeneration();
+    }
+
+    // Call with mutex_ held
+    void ensureUpToDate() {
+      if (upToDate()) {
+        return;
+      }
+      by_id_.clear();
+      by_guid_.clear();
+      for (typename std::vector<T *>::const_iterator it = list_.begin();
+          it != list_.end();
+          it++) {
+        index(*it);
+      }
+      indexed_size_ = list_.size();
+      indexed_keys_ = generation_.Keys();
+      indexed_generation_ = BaseModel::KeyGeneration();
+      stale_ = false;
+    }
+
+    // Like the linear scans it replaces, the first model in the
+    // list wins when keys are duplicated.
+    void index(T *model) {
+      if (model->ID()) {
+        T *&entry = by_id_[model->ID()];
+        if (!entry || entry->ID() != model->ID()) {
+          entry = model;
+        }
+      }
+      if (!model->GUIDKey().IsNull()) {
+        T *&entry = by_guid_[model->GUIDKey()];
+        if (!entry || entry->GUIDKey() != model->GUIDKey()) {
+          entry = model;
+        }
+      }
+    }
+
+    const std::vector<T *> &list_;
+    const ListGeneration &generation_;
+    typename std::vector<T *>::size_type indexed_size_;
+    int indexed_keys_;
+    int indexed_generation_;
+    bool stale_;
+
+    Poco::HashMap<Poco::UInt64, T *> by_id_;
+    Poco::HashMap<BinaryGUID, T *, BinaryGUIDHash> by_guid_;
+    mutable Poco::FastMutex mutex_;
+
+    ModelIndex(const ModelIndex &);
+    ModelIndex &operator=(const ModelIndex &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_MODEL_INDEX_H_
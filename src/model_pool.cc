@@ -0,0 +1,185 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./model_pool.h"
+
+#include <algorithm>
+
+#include "Poco/SingletonHolder.h"
+
+namespace kopsik {
+
+ModelPool::ModelPool(const std::size_t size)
+    : slot_size_(roundUp(size))
+    , slots_per_block_(kModelPoolBlockBytes / slot_size_)
+    , free_(0)
+    , in_use_(0) {
+    if (!slots_per_block_) {
+        slots_per_block_ = 1;
+    }
+}
+
+ModelPool::~ModelPool() {
+    for (std::vector<char *>::const_iterator it = blocks_.begin();
+            it != blocks_.end();
+            it++) {
+        ::operator delete(*it);
+    }
+}
+
+void *ModelPool::Allocate() {
+    if (!free_) {
+        grow();
+    }
+    Slot *slot = free_;
+    free_ = slot->next;
+    in_use_++;
+    return slot;
+}
+
+void ModelPool::Free(void *p) {
+    Slot *slot = static_cast<Slot *>(p);
+    slot->next = free_;
+    free_ = slot;
+    in_use_--;
+}
+
+std::size_t ModelPool::Trim() {
+    std::size_t released = 0;
+    if (!in_use_) {
+        released = blocks_.size() * BlockBytes();
+        for (std::vector<char *>::const_iterator it = blocks_.begin();
+                it != blocks_.end();
+                it++) {
+            ::operator delete(*it);
+        }
+        std::vector<char *>().swap(blocks_);
+        free_ = 0;
+        return released;
+    }
+
+    // Count the free slots of each block, blocks sorted by address
+    std::sort(blocks_.begin(), blocks_.end());
+    std::vector<std::size_t> free_slots(blocks_.size(), 0);
+    for (Slot *slot = free_; slot; slot = slot->next) {
+        free_slots[blockOf(slot)]++;
+    }
+
+    // Unlink the slots of blocks that are about to go
+    Slot **link = &free_;
+    while (*link) {
+        if (free_slots[blockOf(*link)] == slots_per_block_) {
+            *link = (*link)->next;
+        } else {
+            link = &(*link)->next;
+        }
+    }
+
+    std::vector<char *> kept;
+    for (std::size_t i = 0; i < blocks_.size(); i++) {
+        if (free_slots[i] == slots_per_block_) {
+            ::operator delete(blocks_[i]);
+            released += BlockBytes();
+        } else {
+            kept.push_back(blocks_[i]);
+        }
+    }
+    blocks_.swap(kept);
+    return released;
+}
+
+std::size_t ModelPool::roundUp(const std::size_t size) {
+    std::size_t slot = size < sizeof(Slot) ? sizeof(Slot) : size;
+    return (slot + kModelPoolAlignment - 1)
+           / kModelPoolAlignment * kModelPoolAlignment;
+}
+
+std::size_t ModelPool::blockOf(const Slot *slot) const {
+    const char *p = reinterpret_cast<const char *>(slot);
+    std::vector<char *>::const_iterator it =
+        std::upper_bound(blocks_.begin(), blocks_.end(), p);
+    return (it - blocks_.begin()) - 1;
+}
+
+void ModelPool::grow() {
+    char *block = static_cast<char *>(
+        ::operator new(slot_size_ * slots_per_block_));
+    blocks_.push_back(block);
+    for (std::size_t i = slots_per_block_; i > 0; i--) {
+        Slot *slot = reinterpret_cast<Slot *>(
+            block + (i - 1) * slot_size_);
+        slot->next = free_;
+        free_ = slot;
+    }
+}
+
+ModelPools::~ModelPools() {
+    // Models still alive (leaked ones, or static ones destroyed
+    // after us) keep their memory
+    for (Pools::iterator it = pools_.begin(); it != pools_.end(); it++) {
+        if (!it->second->InUse()) {
+            delete it->second;
+        }
+    }
+}
+
+ModelPools &ModelPools::Shared() {
+    static Poco::SingletonHolder<ModelPools> sh;
+    return *sh.get();
+}
+
+void *ModelPools::Allocate(const std::size_t size) {
+    Poco::FastMutex::ScopedLock lock(pools_m_);
+    ModelPool *&pool = pools_[size];
+    if (!pool) {
+        pool = new ModelPool(size);
+    }
+    return pool->Allocate();
+}
+
+void ModelPools::Free(void *p, const std::size_t size) {
+    if (!p) {
+        return;
+    }
+    Poco::FastMutex::ScopedLock lock(pools_m_);
+    pools_[size]->Free(p);
+}
+
+std::size_t ModelPools::InUse(const std::size_t size) {
+    Poco::FastMutex::ScopedLock lock(pools_m_);
+    Pools::const_iterator it = pools_.find(size);
+    if (it == pools_.end()) {
+        return 0;
+    }
+    return it->second->InUse();
+}
+
+std::size_t ModelPools::Blocks(const std::size_t size) {
+    Poco::FastMutex::ScopedLock lock(pools_m_);
+    Pools::const_iterator it = pools_.find(size);
+    if (it == pools_.end()) {
+        return 0;
+    }
+    return it->second->Blocks();
+}
+
+std::size_t ModelPools::Bytes() {
+    Poco::FastMutex::ScopedLock lock(pools_m_);
+    std::size_t bytes = 0;
+    for (Pools::const_iterator it = pools_.begin();
+            it != pools_.end();
+            it++) {
+        bytes += it->second->Blocks() * it->second->BlockBytes();
+    }
+    return bytes;
+}
+
+std::size_t ModelPools::Trim() {
+    Poco::FastMutex::ScopedLock lock(pools_m_);
+    std::size_t released = 0;
+    for (Pools::iterator it = pools_.begin(); it != pools_.end(); it++) {
+        released += it->second->Trim();
+    }
+    return released;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,103 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_MODEL_POOL_H_
+#define SRC_MODEL_POOL_H_
+
+#include <map>
+#include <new>
+#include <vector>
+
+#include "Poco/Mutex.h"
+
+namespace kopsik {
+
+const std::size_t kModelPoolBlockBytes = 64 * 1024;
+const std::size_t kModelPoolAlignment = 16;
+
+// Memory for models of one size, carved out of large blocks.
+// Freed slots are linked into a free list and handed out again
+// before a new block is allocated. Blocks are kept until the
+// pool itself goes away, or until Trim finds them empty.
+class ModelPool {
+ public:
+    explicit ModelPool(const std::size_t size);
+
+    ~ModelPool();
+
+    void *Allocate();
+
+    void Free(void *p);
+
+    std::size_t InUse() const { return in_use_; }
+    std::size_t Blocks() const { return blocks_.size(); }
+    std::size_t BlockBytes() const { return slot_size_ * slots_per_block_; }
+
+    // Gives the blocks with no model in them back to the heap.
+    // Returns the number of bytes released.
+    std::size_t Trim();
+
+ private:
+    struct Slot {
+        Slot *next;
+    };
+
+    static std::size_t roundUp(const std::size_t size);
+
+    // Index of the block the slot was carved from,
+    // blocks_ must be sorted
+    std::size_t blockOf(const Slot *slot) const;
+
+    void grow();
+
+    std::size_t slot_size_;
+    std::size_t slots_per_block_;
+    Slot *free_;
+    std::size_t in_use_;
+    std::vector<char *> blocks_;
+
+    ModelPool(const ModelPool &);
+    ModelPool &operator=(const ModelPool &);
+};
+
+// One pool per model size, so every model class gets a pool of its
+// own without declaring one. BaseModel allocates from here, see
+// BaseModel::operator new.
+class ModelPools {
+ public:
+    ModelPools() {}
+
+    ~ModelPools();
+
+    static ModelPools &Shared();
+
+    void *Allocate(const std::size_t size);
+
+    void Free(void *p, const std::size_t size);
+
+    // Models of this size currently allocated
+    std::size_t InUse(const std::size_t size);
+
+    // Blocks allocated for models of this size
+    std::size_t Blocks(const std::size_t size);
+
+    // Bytes held in blocks by all of the pools, used or not
+    std::size_t Bytes();
+
+    // Releases the empty blocks of all of the pools, for when a lot
+    // of models have just been deleted (like on logout). Returns the
+    // number of bytes released.
+    std::size_t Trim();
+
+ private:
+    typedef std::map<std::size_t, ModelPool *> Pools;
+
+    Pools pools_;
+    Poco::FastMutex pools_m_;
+
+    ModelPools(const ModelPools &);
+    ModelPools &operator=(const ModelPools &);
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_MODEL_POOL_H_
@@ -0,0 +1,200 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_MODEL_SCHEMA_H_
+#define SRC_MODEL_SCHEMA_H_
+
+#include <string>
+#include <vector>
+
+#include "./json_key.h"
+#include "./json_reader.h"
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  enum ModelFieldType {
+    kModelFieldUInt,
+    kModelFieldString,
+    kModelFieldBool
+  };
+
+  // What a field is used for, or-ed together
+  enum ModelFieldRole {
+    // Has a column of the same name
+    kFieldStored = 1 << 0,
+    // Loaded from the JSON the server sends
+    kFieldLoaded = 1 << 1,
+    // Written to the JSON pushed to the server
+    kFieldPushed = 1 << 2,
+    // 0 or empty is stored as NULL and left out of pushed JSON,
+    // for IDs and GUIDs the server hasn't given yet
+    kFieldOptional = 1 << 3
+  };
+
+  // One field of a model: its name as a column and as a JSON field,
+  // what it's used for, and the getter and setter of the model. Made
+  // with UIntField, StringField and BoolField.
+  template <class M>
+  struct ModelField {
+    const char *name;
+    JSONKey key;
+    int roles;
+    ModelFieldType type;
+    Poco::UInt64 (M::*get_uint)() const;
+    void (M::*set_uint)(const Poco::UInt64);
+    const std::string &(M::*get_string)() const;  // NOLINT
+    void (M::*set_string)(const std::string &);
+    bool (M::*get_bool)() const;
+    void (M::*set_bool)(const bool);
+
+    bool Is(const ModelFieldRole role) const { return roles & role; }
+
+    // 0, empty or false
+    bool Empty(const M &model) const {
+      switch (type) {
+      case kModelFieldUInt:
+        return !(model.*get_uint)();
+      case kModelFieldString:
+        return (model.*get_string)().empty();
+      case kModelFieldBool:
+        return !(model.*get_bool)();
+      }
+      return true;
+    }
+  };
+
+  // The model type is given explicitly, UIntField<Client>(...), so
+  // that getters and setters of BaseModel can be used as the model's
+  template <class M>
+  ModelField<M> UIntField(
+      const char *name,
+      const JSONKey key,
+      const int roles,
+      Poco::UInt64 (M::*get)() const,
+      void (M::*set)(const Poco::UInt64)) {
+    ModelField<M> field = {
+      name, key, roles, kModelFieldUInt, get, set, 0, 0, 0, 0
+    };
+    return field;
+  }
+
+  template <class M>
+  ModelField<M> StringField(
+      const char *name,
+      const JSONKey key,
+      const int roles,
+      const std::string &(M::*get)() const,  // NOLINT
+      void (M::*set)(const std::string &)) {
+    ModelField<M> field = {
+      name, key, roles, kModelFieldString, 0, 0, get, set, 0, 0
+    };
+    return field;
+  }
+
+  template <class M>
+  ModelField<M> BoolField(
+      const char *name,
+      const JSONKey key,
+      const int roles,
+      bool (M::*get)() const,
+      void (M::*set)(const bool)) {
+    ModelField<M> field = {
+      name, key, roles, kModelFieldBool, 0, 0, 0, 0, get, set
+    };
+    return field;
+  }
+
+  // The fields of a model, listed once, and what follows from them:
+  // the SQL its table is read and written with, and how it's loaded
+  // from JSON. The stored fields are bound and read in the order
+  // they're listed, after local_id when selecting; Database does that
+  // in loadModels and saveModel. Pushed JSON is written by ModelToJSON.
+  template <class M>
+  class ModelSchema {
+  public:
+    ModelSchema(
+        const std::string &table,
+        const ModelField<M> *fields,
+        const std::size_t count)
+      : table_(table)
+      , fields_(fields, fields + count) {
+      std::string columns("");
+      std::string values("");
+      std::string assignments("");
+      for (std::size_t i = 0; i < fields_.size(); i++) {
+        if (!fields_[i].Is(kFieldStored)) {
+          continue;
+        }
+        if (!columns.empty()) {
+          columns += ", ";
+          values += ", ";
+          assignments += ", ";
+        }
+        columns += fields_[i].name;
+        values += "?";
+        assignments += std::string(fields_[i].name) + " = ?";
+      }
+      select_sql_ = "SELECT local_id, " + columns + " FROM " + table_
+        + " WHERE uid = ? ORDER BY name";
+      insert_sql_ = "INSERT INTO " + table_ + "(" + columns + ") VALUES("
+        + values + ")";
+      update_sql_ = "UPDATE " + table_ + " SET " + assignments
+        + " WHERE local_id = ?";
+    }
+
+    const std::string &Table() const { return table_; }
+    const std::vector<ModelField<M> > &Fields() const { return fields_; }
+
+    // The user's rows, by name. Binds the uid.
+    const std::string &SelectSQL() const { return select_sql_; }
+    // Binds the stored fields
+    const std::string &InsertSQL() const { return insert_sql_; }
+    // Binds the stored fields, then local_id
+    const std::string &UpdateSQL() const { return update_sql_; }
+
+    // Sets the loaded fields that are in the JSON object. Other
+    // fields are skipped without looking at their values.
+    void LoadFromJSONNode(JSONValue * const data, M *model) const {
+      poco_assert(data);
+      poco_assert(model);
+
+      JSONIterator i = JSONBegin(data);
+      JSONIterator e = JSONEnd(data);
+      while (i != e) {
+        JSONKey key = JSONNodeKey(*i);
+        if (kJSONKeyUnknown != key) {
+          for (std::size_t f = 0; f < fields_.size(); f++) {
+            const ModelField<M> &field = fields_[f];
+            if (field.key != key || !field.Is(kFieldLoaded)) {
+              continue;
+            }
+            switch (field.type) {
+            case kModelFieldUInt:
+              (model->*field.set_uint)(JSONInt(*i));
+              break;
+            case kModelFieldString:
+              (model->*field.set_string)(JSONString(*i));
+              break;
+            case kModelFieldBool:
+              (model->*field.set_bool)(JSONBool(*i));
+              break;
+            }
+            break;
+          }
+        }
+        ++i;
+      }
+    }
+
+  private:
+    std::string table_;
+    std::vector<ModelField<M> > fields_;
+    std::string select_sql_;
+    std::string insert_sql_;
+    std::string update_sql_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_MODEL_SCHEMA_H_
@@ -0,0 +1,58 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./network_reactor.h"
+
+#include "Poco/NObserver.h"
+#include "Poco/SingletonHolder.h"
+#include "Poco/Net/SocketAddress.h"
+
+namespace kopsik {
+
+NetworkReactor::NetworkReactor()
+  : reactor_(Poco::Timespan(kNetworkReactorTimeoutMicros))
+  , wakeup_(Poco::Net::SocketAddress("127.0.0.1", 0))
+  , thread_("network_reactor") {
+  reactor_.addEventHandler(wakeup_,
+    Poco::NObserver<NetworkReactor, Poco::Net::ReadableNotification>(
+      *this, &NetworkReactor::onWakeUp));
+  thread_.start(reactor_);
+}
+
+NetworkReactor::~NetworkReactor() {
+  reactor_.stop();
+  wakeUp();
+  thread_.join();
+  reactor_.removeEventHandler(wakeup_,
+    Poco::NObserver<NetworkReactor, Poco::Net::ReadableNotification>(
+      *this, &NetworkReactor::onWakeUp));
+}
+
+NetworkReactor &NetworkReactor::Instance() {
+  static Poco::SingletonHolder<NetworkReactor> sh;
+  return *sh.get();
+}
+
+void NetworkReactor::Add(
+    const Poco::Net::Socket &socket, const Poco::AbstractObserver &observer) {
+  reactor_.addEventHandler(socket, observer);
+  wakeUp();
+}
+
+void NetworkReactor::Remove(
+    const Poco::Net::Socket &socket, const Poco::AbstractObserver &observer) {
+  reactor_.removeEventHandler(socket, observer);
+  wakeUp();
+}
+
+void NetworkReactor::wakeUp() {
+  char byte(0);
+  wakeup_.sendTo(&byte, 1, wakeup_.address());
+}
+
+void NetworkReactor::onWakeUp(
+    const Poco::AutoPtr<Poco::Net::ReadableNotification> &notification) {
+  char byte(0);
+  wakeup_.receiveBytes(&byte, 1);
+}
+
+}  // namespace kopsik
@@ -0,0 +1,59 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_NETWORK_REACTOR_H_
+#define SRC_NETWORK_REACTOR_H_
+
+#include "Poco/AbstractObserver.h"
+#include "Poco/Thread.h"
+#include "Poco/Timespan.h"
+#include "Poco/Net/DatagramSocket.h"
+#include "Poco/Net/Socket.h"
+#include "Poco/Net/SocketNotification.h"
+#include "Poco/Net/SocketReactor.h"
+
+namespace kopsik {
+
+  // Longest the reactor sleeps in select(). It's woken up whenever
+  // a socket is added or removed, so this is only a safety net.
+  const Poco::Timespan::TimeDiff kNetworkReactorTimeoutMicros =
+    5 * 60 * Poco::Timespan::SECONDS;
+
+  // One thread that sleeps until a socket of any network client
+  // that is read without asking becomes readable, and then calls
+  // the client's handler on it. Nothing is polled on a timer.
+  // Handlers run on the reactor thread, one at a time.
+  class NetworkReactor {
+  public:
+    NetworkReactor();
+
+    ~NetworkReactor();
+
+    static NetworkReactor &Instance();
+
+    void Add(const Poco::Net::Socket &socket,
+             const Poco::AbstractObserver &observer);
+
+    // Once this returns, the handler is not running and won't be
+    // called again. Safe to call from the handler itself.
+    void Remove(const Poco::Net::Socket &socket,
+                const Poco::AbstractObserver &observer);
+
+  private:
+    // Makes the reactor leave select() and pick up the current
+    // sockets, or notice it was stopped
+    void wakeUp();
+
+    void onWakeUp(
+        const Poco::AutoPtr<Poco::Net::ReadableNotification> &notification);
+
+    Poco::Net::SocketReactor reactor_;
+    Poco::Net::DatagramSocket wakeup_;
+    Poco::Thread thread_;
+
+    NetworkReactor(const NetworkReactor &);
+    NetworkReactor &operator=(const NetworkReactor &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_NETWORK_REACTOR_H_
@@ -0,0 +1,49 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./power_policy.h"
+
+#include "Poco/SingletonHolder.h"
+
+namespace kopsik {
+
+PowerPolicy &PowerPolicy::Shared() {
+  static Poco::SingletonHolder<PowerPolicy> sh;
+  return *sh.get();
+}
+
+void PowerPolicy::SetOnBattery(const bool value) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  on_battery_ = value;
+}
+
+bool PowerPolicy::OnBattery() const {
+  Poco::FastMutex::ScopedLock lock(m_);
+  return on_battery_;
+}
+
+Poco::Timestamp::TimeDiff PowerPolicy::Stretch(
+    const Poco::Timestamp::TimeDiff interval) const {
+  if (!OnBattery()) {
+    return interval;
+  }
+  return interval * kBatteryIntervalFactor;
+}
+
+Poco::Timestamp PowerPolicy::Coalesce(const Poco::Timestamp &at) const {
+  if (!OnBattery()) {
+    return at;
+  }
+  Poco::Timestamp::TimeVal micros = at.epochMicroseconds();
+  Poco::Timestamp::TimeVal late = micros % kBatteryWakeupWindowMicros;
+  if (!late) {
+    return at;
+  }
+  return Poco::Timestamp(micros - late + kBatteryWakeupWindowMicros);
+}
+
+Poco::Timestamp PowerPolicy::Defer(
+    const Poco::Timestamp::TimeDiff interval) const {
+  return Coalesce(Poco::Timestamp() + Stretch(interval));
+}
+
+}  // namespace kopsik
@@ -0,0 +1,54 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_POWER_POLICY_H_
+#define SRC_POWER_POLICY_H_
+
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+  // On battery, background work waits this many times longer between
+  // runs, and starts at the next of the wakeup windows shared by all
+  const Poco::Timestamp::TimeDiff kBatteryIntervalFactor = 3;
+  const Poco::Timestamp::TimeDiff kBatteryWakeupWindowMicros =
+    5 * Poco::Timestamp::resolution();
+
+  // Whether the machine runs on battery, as the app reports it, and
+  // when background work that nobody is waiting for runs meanwhile.
+  // On battery its intervals are stretched, and it's lined up on
+  // shared wakeup windows, so that the timer tasks, uploads and polls
+  // of the process wake the CPU together instead of at scattered
+  // times. On AC power everything runs when it asked to. Work already
+  // scheduled keeps its time when the power source changes.
+  class PowerPolicy {
+  public:
+    PowerPolicy() : on_battery_(false) {}
+
+    static PowerPolicy &Shared();
+
+    void SetOnBattery(const bool value);
+
+    bool OnBattery() const;
+
+    // How long to wait between runs instead of interval
+    Poco::Timestamp::TimeDiff Stretch(
+        const Poco::Timestamp::TimeDiff interval) const;
+
+    // When work due at runs, the start of the next window on battery
+    Poco::Timestamp Coalesce(const Poco::Timestamp &at) const;
+
+    // Both: when work that waits interval from now runs
+    Poco::Timestamp Defer(const Poco::Timestamp::TimeDiff interval) const;
+
+  private:
+    bool on_battery_;
+    mutable Poco::FastMutex m_;
+
+    PowerPolicy(const PowerPolicy &);
+    PowerPolicy &operator=(const PowerPolicy &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_POWER_POLICY_H_
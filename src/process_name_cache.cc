@@ -0,0 +1,44 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./process_name_cache.h"
+
+namespace kopsik {
+
+bool ProcessNameCache::Get(
+    const Poco::UInt64 pid, const Poco::UInt64 start_time, std::string *name) {
+    for (std::list<Entry>::iterator it = entries_.begin();
+            it != entries_.end();
+            it++) {
+        if (it->pid != pid) {
+            continue;
+        }
+        if (it->start_time != start_time) {
+            entries_.erase(it);
+            return false;
+        }
+        *name = it->name;
+        entries_.splice(entries_.begin(), entries_, it);
+        return true;
+    }
+    return false;
+}
+
+void ProcessNameCache::Put(
+    const Poco::UInt64 pid, const Poco::UInt64 start_time,
+    const std::string name) {
+    std::string existing("");
+    if (Get(pid, start_time, &existing)) {
+        entries_.front().name = name;
+        return;
+    }
+    Entry entry;
+    entry.pid = pid;
+    entry.start_time = start_time;
+    entry.name = name;
+    entries_.push_front(entry);
+    if (entries_.size() > kProcessNameCacheSize) {
+        entries_.pop_back();
+    }
+}
+
+}  // namespace kopsik
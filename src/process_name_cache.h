@@ -0,0 +1,45 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_PROCESS_NAME_CACHE_H_
+#define SRC_PROCESS_NAME_CACHE_H_
+
+#include <list>
+#include <string>
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+const std::size_t kProcessNameCacheSize = 32;
+
+// Executable names of recently focused processes, least recently
+// used one is dropped first. Process IDs get reused, so each name
+// is stored with the start time of its process (or anything else
+// that changes when the ID is given to a new process) and a lookup
+// with another start time is a miss.
+class ProcessNameCache {
+ public:
+    ProcessNameCache() {}
+
+    bool Get(const Poco::UInt64 pid,
+             const Poco::UInt64 start_time,
+             std::string *name);
+
+    void Put(const Poco::UInt64 pid,
+             const Poco::UInt64 start_time,
+             const std::string name);
+
+ private:
+    struct Entry {
+        Poco::UInt64 pid;
+        Poco::UInt64 start_time;
+        std::string name;
+    };
+
+    // Most recently used first
+    std::list<Entry> entries_;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_PROCESS_NAME_CACHE_H_
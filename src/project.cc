@@ -5,6 +5,9 @@
 #include <sstream>
 #include <ctime>
 
+#include "./json_key.h"
+#include "./memory_usage.h"
+
 #include "Poco/String.h"
 #include "Poco/NumberParser.h"
 
@@ -31,6 +34,12 @@ std::string Project::String() const {
   return ss.str();
 }
 
+std::size_t Project::MemoryBytes() const {
+  return sizeof(*this) + ownedBytes()
+    + StringBytes(name_)
+    + StringBytes(color_);
+}
+
 std::string Project::UppercaseName() const {
   return Poco::toUpper(name_);
 }
@@ -42,7 +51,7 @@ void Project::SetActive(const bool value) {
   }
 }
 
-void Project::SetName(const std::string value) {
+void Project::SetName(const std::string &value) {
   if (name_ != value) {
     name_ = value;
     SetDirty();
@@ -56,14 +65,14 @@ void Project::SetBillable(const bool value) {
   }
 }
 
-void Project::SetColor(const std::string value) {
+void Project::SetColor(const std::string &value) {
   if (color_ != value) {
     color_ = value;
     SetDirty();
   }
 }
 
-std::string Project::ColorCode() const {
+const std::string &Project::ColorCode() const {
   int index(0);
   if (!Poco::NumberParser::tryParse(Color(), index)) {
     return color_codes.back();
@@ -88,32 +97,48 @@ void Project::SetCID(const Poco::UInt64 value) {
   }
 }
 
-void Project::LoadFromJSONNode(JSONNODE * const data) {
-  poco_assert(data);
-
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
-  while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "id") == 0) {
-      SetID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "name") == 0) {
-      SetName(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "guid") == 0) {
-      SetGUID(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "wid") == 0) {
-      SetWID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "cid") == 0) {
-      SetCID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "color") == 0) {
-      SetColor(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "active") == 0) {
-      SetActive(json_as_bool(*current_node));
-    } else if (strcmp(node_name, "billable") == 0) {
-      SetBillable(json_as_bool(*current_node));
-    }
-    ++current_node;
-  }
+static const ModelField<Project> kProjectFields[] = {
+  UIntField<Project>("id", kJSONKeyID,
+    kFieldStored | kFieldLoaded | kFieldPushed | kFieldOptional,
+    &Project::ID, &Project::SetID),
+  UIntField<Project>("uid", kJSONKeyUnknown,
+    kFieldStored,
+    &Project::UID, &Project::SetUID),
+  StringField<Project>("name", kJSONKeyName,
+    kFieldStored | kFieldLoaded | kFieldPushed,
+    &Project::Name, &Project::SetName),
+  StringField<Project>("guid", kJSONKeyGUID,
+    kFieldStored | kFieldLoaded | kFieldPushed | kFieldOptional,
+    &Project::GUID, &Project::SetGUID),
+  UIntField<Project>("wid", kJSONKeyWID,
+    kFieldStored | kFieldLoaded | kFieldPushed,
+    &Project::WID, &Project::SetWID),
+  StringField<Project>("color", kJSONKeyColor,
+    kFieldStored | kFieldLoaded,
+    &Project::Color, &Project::SetColor),
+  UIntField<Project>("cid", kJSONKeyCID,
+    kFieldStored | kFieldLoaded | kFieldPushed,
+    &Project::CID, &Project::SetCID),
+  BoolField<Project>("active", kJSONKeyActive,
+    kFieldStored | kFieldLoaded,
+    &Project::Active, &Project::SetActive),
+  BoolField<Project>("billable", kJSONKeyBillable,
+    kFieldStored | kFieldLoaded | kFieldPushed,
+    &Project::Billable, &Project::SetBillable),
+  UIntField<Project>("ui_modified_at", kJSONKeyUIModifiedAt,
+    kFieldPushed,
+    &Project::UIModifiedAt, &Project::SetUIModifiedAt)
+};
+
+static const ModelSchema<Project> kProjectSchema("projects", kProjectFields,
+    sizeof(kProjectFields) / sizeof(kProjectFields[0]));
+
+const ModelSchema<Project> &Project::Schema() {
+  return kProjectSchema;
+}
+
+void Project::LoadFromJSONNode(JSONValue * const data) {
+  Schema().LoadFromJSONNode(data, this);
 }
 
 bool Project::IsDuplicateResourceError(const kopsik::error err) const {
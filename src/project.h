@@ -8,6 +8,7 @@
 
 #include "./types.h"
 #include "./base_model.h"
+#include "./model_schema.h"
 
 #include "Poco/Types.h"
 
@@ -17,12 +18,12 @@ namespace kopsik {
   public:
     Project()
       : BaseModel()
+      , active_(false)
+      , billable_(false)
       , wid_(0)
       , cid_(0)
       , name_("")
-      , color_("")
-      , active_(false)
-      , billable_(false) {}
+      , color_("") {}
 
     Poco::UInt64 WID() const { return wid_; }
     void SetWID(const Poco::UInt64 value);
@@ -31,17 +32,19 @@ namespace kopsik {
     void SetCID(const Poco::UInt64 value);
 
     std::string UppercaseName() const;
-    std::string Name() const { return name_; }
-    void SetName(const std::string value);
+    const std::string &Name() const { return name_; }
+    void SetName(const std::string &value);
 
-    std::string Color() const { return color_; }
-    void SetColor(const std::string value);
-    std::string ColorCode() const;
+    const std::string &Color() const { return color_; }
+    void SetColor(const std::string &value);
+    // One of color_codes, which live as long as the process
+    const std::string &ColorCode() const;
 
     bool Active() const { return active_; }
     void SetActive(const bool value);
 
     std::string String() const;
+    std::size_t MemoryBytes() const;
 
     static std::vector<std::string> color_codes;
 
@@ -51,17 +54,24 @@ namespace kopsik {
     std::string ModelName() const { return "project"; }
     std::string ModelURL() const { return "/api/v8/projects"; }
 
-    void LoadFromJSONNode(JSONNODE * const);
+    // Fields as stored and sent, listed once
+    static const ModelSchema<Project> &Schema();
+
+    void LoadFromJSONNode(JSONValue * const);
 
     bool IsDuplicateResourceError(const kopsik::error err) const;
 
+  protected:
+    bool namedInLabels() const { return true; }
+
   private:
+    // Into the padding BaseModel ends with
+    bool active_;
+    bool billable_;
     Poco::UInt64 wid_;
     Poco::UInt64 cid_;
     std::string name_;
     std::string color_;
-    bool active_;
-    bool billable_;
   };
 
 }  // namespace kopsik
@@ -0,0 +1,129 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./project_labels.h"
+
+namespace kopsik {
+
+ProjectLabels::ProjectLabels(
+    const std::vector<Project *> &projects, const std::vector<Task *> &tasks,
+    const std::vector<Client *> &clients,
+    const ListGeneration &project_generation,
+    const ListGeneration &task_generation,
+    const ListGeneration &client_generation)
+  : projects_(projects)
+  , tasks_(tasks)
+  , clients_(clients)
+  , project_generation_(project_generation)
+  , task_generation_(task_generation)
+  , client_generation_(client_generation)
+  , projects_generation_(0)
+  , tasks_generation_(0)
+  , clients_generation_(0)
+  , label_generation_(BaseModel::LabelGeneration() - 1)
+  , key_generation_(BaseModel::KeyGeneration() - 1)
+  , projects_size_(0)
+  , tasks_size_(0)
+  , clients_size_(0) {}
+
+bool ProjectLabels::Find(
+    const Poco::UInt64 tid, const Poco::UInt64 pid,
+    const std::string &project_guid, std::string *label,
+    std::string *color_code) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  refresh();
+  std::map<Key, Value>::const_iterator it =
+    labels_.find(Key(tid, pid, project_guid));
+  if (it == labels_.end()) {
+    return false;
+  }
+  *label = it->second.label;
+  *color_code = it->second.color_code;
+  return true;
+}
+
+void ProjectLabels::Add(
+    const Poco::UInt64 tid, const Poco::UInt64 pid,
+    const std::string &project_guid, const std::string &label,
+    const std::string &color_code) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  refresh();
+  Value &value = labels_[Key(tid, pid, project_guid)];
+  value.label = label;
+  value.color_code = color_code;
+}
+
+void ProjectLabels::Clear() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  labels_.clear();
+  projects_generation_ = 0;
+  label_generation_ = BaseModel::LabelGeneration() - 1;
+}
+
+std::size_t ProjectLabels::Size() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  return labels_.size();
+}
+
+std::size_t ProjectLabels::MemoryBytes() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  std::size_t bytes = MapNodesBytes(labels_);
+  for (std::map<Key, Value>::const_iterator it = labels_.begin();
+      it != labels_.end();
+      it++) {
+    bytes += StringBytes(it->first.project_guid)
+      + StringBytes(it->second.label)
+      + StringBytes(it->second.color_code);
+  }
+  return bytes;
+}
+
+ProjectLabels::Key::Key(
+    const Poco::UInt64 tid, const Poco::UInt64 pid,
+    const std::string &project_guid)
+  : tid(tid), pid(pid), project_guid(project_guid) {}
+
+bool ProjectLabels::Key::operator<(const Key &other) const {
+  if (tid != other.tid) {
+    return tid < other.tid;
+  }
+  if (pid != other.pid) {
+    return pid < other.pid;
+  }
+  return project_guid < other.project_guid;
+}
+
+bool ProjectLabels::current() const {
+  if (projects_.size() != projects_size_
+      || tasks_.size() != tasks_size_
+      || clients_.size() != clients_size_) {
+    return false;
+  }
+  if (project_generation_.Tracked() == projects_.size()
+      && task_generation_.Tracked() == tasks_.size()
+      && client_generation_.Tracked() == clients_.size()) {
+    return projects_generation_ == project_generation_.Value()
+      && tasks_generation_ == task_generation_.Value()
+      && clients_generation_ == client_generation_.Value();
+  }
+  return label_generation_ == BaseModel::LabelGeneration()
+    && key_generation_ == BaseModel::KeyGeneration();
+}
+
+void ProjectLabels::refresh() {
+  if (current()) {
+    return;
+  }
+  int label_generation = BaseModel::LabelGeneration();
+  int key_generation = BaseModel::KeyGeneration();
+  labels_.clear();
+  projects_generation_ = project_generation_.Value();
+  tasks_generation_ = task_generation_.Value();
+  clients_generation_ = client_generation_.Value();
+  label_generation_ = label_generation;
+  key_generation_ = key_generation;
+  projects_size_ = projects_.size();
+  tasks_size_ = tasks_.size();
+  clients_size_ = clients_.size();
+}
+
+}  // namespace kopsik
@@ -0,0 +1,100 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_PROJECT_LABELS_H_
+#define SRC_PROJECT_LABELS_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./base_model.h"
+#include "./client.h"
+#include "./memory_usage.h"
+#include "./project.h"
+#include "./task.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Project and task labels with the project color, as listed with
+  // time entries, by the task ID, project ID and project GUID of the
+  // time entry. Many time entries share them, so each is looked up
+  // and joined once. The labels are dropped when a project, task or
+  // client changes, or when models join or leave their lists, as told
+  // by the generations of the lists.
+  class ProjectLabels {
+  public:
+    ProjectLabels(const std::vector<Project *> &projects,
+                  const std::vector<Task *> &tasks,
+                  const std::vector<Client *> &clients,
+                  const ListGeneration &project_generation,
+                  const ListGeneration &task_generation,
+                  const ListGeneration &client_generation);
+
+    bool Find(const Poco::UInt64 tid,
+              const Poco::UInt64 pid,
+              const std::string &project_guid,
+              std::string *label,
+              std::string *color_code);
+
+    void Add(const Poco::UInt64 tid,
+             const Poco::UInt64 pid,
+             const std::string &project_guid,
+             const std::string &label,
+             const std::string &color_code);
+
+    // Drops the labels even if nothing seems to have changed
+    void Clear();
+
+    std::size_t Size();
+
+    std::size_t MemoryBytes();
+
+  private:
+    struct Key {
+      Key(const Poco::UInt64 tid,
+          const Poco::UInt64 pid,
+          const std::string &project_guid);
+      bool operator<(const Key &other) const;
+      Poco::UInt64 tid;
+      Poco::UInt64 pid;
+      std::string project_guid;
+    };
+
+    struct Value {
+      std::string label;
+      std::string color_code;
+    };
+
+    // Must be called with mutex_ locked
+    void refresh();
+    bool current() const;
+
+    const std::vector<Project *> &projects_;
+    const std::vector<Task *> &tasks_;
+    const std::vector<Client *> &clients_;
+    const ListGeneration &project_generation_;
+    const ListGeneration &task_generation_;
+    const ListGeneration &client_generation_;
+    // Generations of the lists, or while they hold untracked models
+    // the process-wide ones
+    int projects_generation_;
+    int tasks_generation_;
+    int clients_generation_;
+    int label_generation_;
+    int key_generation_;
+    std::size_t projects_size_;
+    std::size_t tasks_size_;
+    std::size_t clients_size_;
+    std::map<Key, Value> labels_;
+    Poco::FastMutex mutex_;
+
+    ProjectLabels(const ProjectLabels &);
+    ProjectLabels &operator=(const ProjectLabels &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_PROJECT_LABELS_H_
@@ -0,0 +1,40 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./push_outbox.h"
+
+namespace kopsik {
+
+void PushOutbox::Clear() {
+  entries_.clear();
+  loaded_ = false;
+}
+
+bool PushOutbox::Put(
+    const std::string &guid, const std::string &model_name,
+    const std::string &operation) {
+  Entry &entry = entries_[guid];
+  if (entry.model_name == model_name && entry.operation == operation) {
+    return false;
+  }
+  entry.model_name = model_name;
+  entry.operation = operation;
+  return true;
+}
+
+bool PushOutbox::Remove(const std::string &guid) {
+  return entries_.erase(guid) != 0;
+}
+
+std::size_t PushOutbox::MemoryBytes() const {
+  std::size_t bytes = MapNodesBytes(entries_);
+  for (Entries::const_iterator it = entries_.begin();
+      it != entries_.end();
+      it++) {
+    bytes += StringBytes(it->first)
+      + StringBytes(it->second.model_name)
+      + StringBytes(it->second.operation);
+  }
+  return bytes;
+}
+
+}  // namespace kopsik
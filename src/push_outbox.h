@@ -0,0 +1,56 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_PUSH_OUTBOX_H_
+#define SRC_PUSH_OUTBOX_H_
+
+#include <map>
+#include <string>
+
+#include "./memory_usage.h"
+
+namespace kopsik {
+
+  // Time entries and projects waiting to be pushed, by GUID, with the
+  // operation ("POST", "PUT" or "DELETE") the server still has to do,
+  // as journaled in the push_outbox table. A model has one entry at
+  // most, so editing it again and again before a push doesn't grow
+  // the outbox. Saving keeps it up to date once it's loaded.
+  class PushOutbox {
+  public:
+    struct Entry {
+      std::string model_name;
+      std::string operation;
+    };
+    typedef std::map<std::string, Entry> Entries;
+
+    PushOutbox() : loaded_(false) {}
+
+    // Whether it has all that is waiting, as read from the database
+    bool Loaded() const { return loaded_; }
+    void SetLoaded() { loaded_ = true; }
+
+    // Forgets the entries, so they are read again before next use
+    void Clear();
+
+    // Whether it's a new entry or a new operation of one
+    bool Put(const std::string &guid,
+             const std::string &model_name,
+             const std::string &operation);
+
+    // Whether there was an entry
+    bool Remove(const std::string &guid);
+
+    const Entries &All() const { return entries_; }
+
+    std::size_t Size() const { return entries_.size(); }
+
+    std::size_t MemoryBytes() const;
+
+  private:
+    Entries entries_;
+    bool loaded_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_PUSH_OUTBOX_H_
@@ -2,6 +2,215 @@
 
 #include "./related_data.h"
 
+#include "./memory_usage.h"
+
 namespace kopsik {
 
+template <class T>
+void trackList(RelatedData *related, const std::vector<T *> &list) {
+  for (typename std::vector<T *>::const_iterator it = list.begin();
+      it != list.end();
+      it++) {
+    related->Track(*it);
+  }
+}
+
+void RelatedData::track(BaseModel *model, ListGeneration *generation) {
+  poco_assert(model);
+  if (model->DirtyModels() == &DirtyModels) {
+    return;
+  }
+  model->SetDirtyModels(&DirtyModels);
+  model->SetListGeneration(generation);
+  generation->Bump();
+  // Its keys may have changed while it wasn't tracked
+  generation->BumpKeys(model);
+  generation->SetTracked(generation->Tracked() + 1);
+  tracked_++;
+  if (model->NeedsToBeSaved()) {
+    DirtyModels.insert(model);
+  }
+}
+
+void RelatedData::untrack(BaseModel *model) {
+  poco_assert(model);
+  if (model->DirtyModels() != &DirtyModels) {
+    return;
+  }
+  model->SetDirtyModels(0);
+  ListGeneration *generation = model->ListGeneration();
+  generation->Bump();
+  generation->SetTracked(generation->Tracked() - 1);
+  model->SetListGeneration(0);
+  tracked_--;
+  DirtyModels.erase(model);
+}
+
+void RelatedData::Track(Workspace *model) {
+  track(model, &WorkspaceGeneration);
+}
+
+void RelatedData::Track(Client *model) {
+  track(model, &ClientGeneration);
+}
+
+void RelatedData::Track(Project *model) {
+  track(model, &ProjectGeneration);
+}
+
+void RelatedData::Track(Task *model) {
+  track(model, &TaskGeneration);
+}
+
+void RelatedData::Untrack(Workspace *model) {
+  untrack(model);
+  WorkspaceIndex.Invalidate();
+}
+
+void RelatedData::Untrack(Client *model) {
+  untrack(model);
+  ClientIndex.Invalidate();
+  Buckets.Clear();
+}
+
+void RelatedData::Untrack(Project *model) {
+  untrack(model);
+  ProjectIndex.Invalidate();
+  Buckets.Clear();
+}
+
+void RelatedData::Untrack(Task *model) {
+  untrack(model);
+  TaskIndex.Invalidate();
+  Buckets.Clear();
+}
+
+void RelatedData::Track(TimeEntry *model) {
+  track(model, &TimeEntryGeneration);
+  model->SetDayTotals(&TimeEntryDayTotals);
+}
+
+void RelatedData::Untrack(TimeEntry *model) {
+  untrack(model);
+  TimeEntryIndex.Invalidate();
+  TimeEntryFields.Clear();
+  TimeEntryRanges.Clear();
+  if (model->GetDayTotals() == &TimeEntryDayTotals) {
+    model->SetDayTotals(0);
+  }
+}
+
+void RelatedData::Track(Tag *model) {
+  track(model, &TagGeneration);
+  model->SetTagNameCounts(&TagNames);
+}
+
+void RelatedData::Untrack(Tag *model) {
+  untrack(model);
+  TagIndex.Invalidate();
+  if (model->GetTagNameCounts() == &TagNames) {
+    model->SetTagNameCounts(0);
+  }
+}
+
+bool RelatedData::AllTracked() const {
+  return tracked_ == Workspaces.size()
+    + Clients.size()
+    + Projects.size()
+    + Tasks.size()
+    + Tags.size()
+    + TimeEntries.size();
+}
+
+void RelatedData::TrackAll() {
+  trackList(this, Workspaces);
+  trackList(this, Clients);
+  trackList(this, Projects);
+  trackList(this, Tasks);
+  trackList(this, Tags);
+  trackList(this, TimeEntries);
+  // Models that were tracked but left the lists
+  // without Untrack() no longer count, and the
+  // lists may have changed in any way.
+  tracked_ = Workspaces.size()
+    + Clients.size()
+    + Projects.size()
+    + Tasks.size()
+    + Tags.size()
+    + TimeEntries.size();
+  WorkspaceGeneration.SetTracked(Workspaces.size());
+  ClientGeneration.SetTracked(Clients.size());
+  ProjectGeneration.SetTracked(Projects.size());
+  TaskGeneration.SetTracked(Tasks.size());
+  TagGeneration.SetTracked(Tags.size());
+  TimeEntryGeneration.SetTracked(TimeEntries.size());
+  invalidateIndexes();
+  bumpGenerations();
+}
+
+void RelatedData::invalidateIndexes() {
+  WorkspaceIndex.Invalidate();
+  ClientIndex.Invalidate();
+  ProjectIndex.Invalidate();
+  TaskIndex.Invalidate();
+  TagIndex.Invalidate();
+  TimeEntryIndex.Invalidate();
+}
+
+void RelatedData::bumpGenerations() {
+  WorkspaceGeneration.Bump();
+  ClientGeneration.Bump();
+  ProjectGeneration.Bump();
+  TaskGeneration.Bump();
+  TagGeneration.Bump();
+  TimeEntryGeneration.Bump();
+}
+
+void RelatedData::RefreshLookups() {
+  WorkspaceIndex.Refresh();
+  ClientIndex.Refresh();
+  ProjectIndex.Refresh();
+  TaskIndex.Refresh();
+  TagIndex.Refresh();
+  TimeEntryIndex.Refresh();
+  TimeEntryFields.Refresh();
+  TimeEntryRanges.Refresh();
+  Buckets.Refresh();
+}
+
+void RelatedData::ClearLookups() {
+  WorkspaceIndex.Clear();
+  ClientIndex.Clear();
+  ProjectIndex.Clear();
+  TaskIndex.Clear();
+  TagIndex.Clear();
+  TimeEntryIndex.Clear();
+  TimeEntryFields.Clear();
+  TimeEntryRanges.Clear();
+  ProjectLabelCache.Clear();
+  Buckets.Clear();
+  bumpGenerations();
+}
+
+void RelatedData::MemoryUsage(
+    std::map<std::string, std::size_t> *bytes) const {
+  poco_assert(bytes);
+  (*bytes)["workspaces"] =
+    ModelsBytes(Workspaces) + WorkspaceIndex.MemoryBytes();
+  (*bytes)["clients"] = ModelsBytes(Clients) + ClientIndex.MemoryBytes();
+  (*bytes)["projects"] = ModelsBytes(Projects)
+    + ProjectIndex.MemoryBytes()
+    + ProjectLabelCache.MemoryBytes()
+    + Buckets.MemoryBytes();
+  (*bytes)["tasks"] = ModelsBytes(Tasks) + TaskIndex.MemoryBytes();
+  (*bytes)["tags"] = ModelsBytes(Tags) + TagIndex.MemoryBytes();
+  (*bytes)["time_entries"] = ModelsBytes(TimeEntries)
+    + TimeEntryIndex.MemoryBytes()
+    + TimeEntryFields.MemoryBytes()
+    + TimeEntryRanges.MemoryBytes()
+    + TimeEntryDayTotals.MemoryBytes();
+  (*bytes)["dirty_models"] = SetNodesBytes(DirtyModels);
+  (*bytes)["push_outbox"] = Outbox.MemoryBytes();
+}
+
 }   // namespace kopsik
@@ -3,7 +3,10 @@
 #ifndef SRC_RELATED_DATA_H_
 #define SRC_RELATED_DATA_H_
 
+#include <map>
 #include <vector>
+#include <set>
+#include <string>
 
 #include "./workspace.h"
 #include "./client.h"
@@ -11,17 +14,152 @@
 #include "./task.h"
 #include "./tag.h"
 #include "./time_entry.h"
+#include "./model_index.h"
+#include "./time_entry_columns.h"
+#include "./time_entry_intervals.h"
+#include "./project_labels.h"
+#include "./push_outbox.h"
+#include "./model_buckets.h"
+#include "./day_totals.h"
+#include "./tag_names.h"
 
 namespace kopsik {
 
   class RelatedData {
   public:
+    RelatedData()
+      : WorkspaceIndex(Workspaces, WorkspaceGeneration)
+      , ClientIndex(Clients, ClientGeneration)
+      , ProjectIndex(Projects, ProjectGeneration)
+      , TaskIndex(Tasks, TaskGeneration)
+      , TagIndex(Tags, TagGeneration)
+      , TimeEntryIndex(TimeEntries, TimeEntryGeneration)
+      , TimeEntryFields(TimeEntries, TimeEntryGeneration)
+      , TimeEntryRanges(TimeEntries)
+      , ProjectLabelCache(Projects, Tasks, Clients,
+                          ProjectGeneration, TaskGeneration, ClientGeneration)
+      , Buckets(Projects, Tasks, Clients,
+                ProjectGeneration, TaskGeneration, ClientGeneration)
+      , tracked_(0) {}
+
     std::vector<Workspace *> Workspaces;
     std::vector<Client *> Clients;
     std::vector<Project *> Projects;
     std::vector<Task *> Tasks;
     std::vector<Tag *> Tags;
     std::vector<TimeEntry *> TimeEntries;
+
+    // ID and GUID lookups into the lists above
+    mutable ModelIndex<Workspace> WorkspaceIndex;
+    mutable ModelIndex<Client> ClientIndex;
+    mutable ModelIndex<Project> ProjectIndex;
+    mutable ModelIndex<Task> TaskIndex;
+    mutable ModelIndex<Tag> TagIndex;
+    mutable ModelIndex<TimeEntry> TimeEntryIndex;
+
+    // Fields of TimeEntries for scanning the list
+    mutable TimeEntryColumns TimeEntryFields;
+
+    // Time entries by the time they cover, for finding overlaps
+    mutable TimeEntryIntervals TimeEntryRanges;
+
+    // Project and task labels of time entries, as listed
+    mutable ProjectLabels ProjectLabelCache;
+
+    // Clients and projects by workspace, active projects and tasks
+    mutable ModelBuckets Buckets;
+
+    // Tracked time per day of the tracked time entries,
+    // and which of them are running
+    DayTotals TimeEntryDayTotals;
+
+    // Whether every time entry counts in TimeEntryDayTotals.
+    // If not, day totals need to be summed from the list
+    // and the running time entry looked up from it.
+    bool DayTotalsComplete() const {
+      return TimeEntryDayTotals.Registered() == TimeEntries.size();
+    }
+
+    // Distinct names of the tracked tags
+    TagNameCounts TagNames;
+
+    // Whether every tag counts in TagNames. If not,
+    // the names need to be collected from the list.
+    bool TagNamesComplete() const {
+      return TagNames.Registered() == Tags.size();
+    }
+
+    // Generations of the lists above. Each is bumped when its list
+    // gains or loses a tracked model, or when one of them changes, so
+    // what's derived from a list stays valid while its generation
+    // does. Changes to untracked models don't show.
+    ListGeneration WorkspaceGeneration;
+    ListGeneration ClientGeneration;
+    ListGeneration ProjectGeneration;
+    ListGeneration TaskGeneration;
+    ListGeneration TagGeneration;
+    ListGeneration TimeEntryGeneration;
+
+    // Models that have changed since they were last saved.
+    // Tracked models add themselves here when they become dirty,
+    // so saving doesn't need to walk all of the lists above.
+    std::set<BaseModel *> DirtyModels;
+
+    // Time entries and projects that were saved while they needed
+    // a push. Once all models are tracked, these and DirtyModels are
+    // all that pushing needs to look at.
+    PushOutbox Outbox;
+
+    // Start collecting changes of a model that was
+    // just added to one of the lists.
+    void Track(Workspace *model);
+    void Track(Client *model);
+    void Track(Project *model);
+    void Track(Task *model);
+    // Time entries also start counting in the day totals,
+    // and tags in the tag names
+    void Track(TimeEntry *model);
+    void Track(Tag *model);
+    // Stop collecting changes of a model that is being
+    // removed from its list. The lookups over the list
+    // let go of it too.
+    void Untrack(Workspace *model);
+    void Untrack(Client *model);
+    void Untrack(Project *model);
+    void Untrack(Task *model);
+    void Untrack(TimeEntry *model);
+    void Untrack(Tag *model);
+
+    // Models can be pushed into the lists without tracking
+    // (for example when loading from database). Once all
+    // models are tracked, DirtyModels is all that needs saving.
+    bool AllTracked() const;
+    void TrackAll();
+
+    // Brings the lookups and caches over the lists up to date, so the
+    // next reader doesn't pay for it. Call with the lists locked.
+    void RefreshLookups();
+
+    // Drops the lookups and caches over the lists and bumps their
+    // generations. Needed when models were replaced in place, which
+    // their generations may not show.
+    void ClearLookups();
+
+    // Estimated bytes of each list by name ("time_entries"), with
+    // its models, the strings they own and its lookups
+    void MemoryUsage(std::map<std::string, std::size_t> *bytes) const;
+
+  private:
+    void track(BaseModel *model, ListGeneration *generation);
+    void untrack(BaseModel *model);
+    void invalidateIndexes();
+    void bumpGenerations();
+
+    std::vector<BaseModel *>::size_type tracked_;
+
+    // Indexes keep references to the lists
+    RelatedData(const RelatedData &);
+    RelatedData &operator=(const RelatedData &);
   };
 
 }  // namespace kopsik
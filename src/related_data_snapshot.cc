@@ -0,0 +1,445 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./related_data_snapshot.h"
+
+#include <cstring>
+
+#include "Poco/File.h"
+#include "Poco/SharedMemory.h"
+
+namespace kopsik {
+
+error RelatedDataSnapshot::Write(
+    const std::string &path, const RelatedDataSnapshotKey &key,
+    const Poco::UInt64 time_entries_loaded_since, RelatedData *related) {
+  std::string buffer("");
+  buffer.append(kRelatedDataSnapshotMagic, 4);
+  putUInt32(&buffer, kRelatedDataSnapshotVersion);
+  putString(&buffer, key.database_id);
+  putUInt64(&buffer, key.generation);
+  putUInt64(&buffer, key.uid);
+  putUInt64(&buffer, time_entries_loaded_since);
+
+  error err = writeWorkspaces(&buffer, related->Workspaces);
+  if (err == noError) {
+    err = writeClients(&buffer, related->Clients);
+  }
+  if (err == noError) {
+    err = writeProjects(&buffer, related->Projects);
+  }
+  if (err == noError) {
+    err = writeTasks(&buffer, related->Tasks);
+  }
+  if (err == noError) {
+    err = writeTags(&buffer, related->Tags);
+  }
+  if (err == noError) {
+    err = writeTimeEntries(&buffer, related->TimeEntries);
+  }
+  if (err != noError) {
+    return err;
+  }
+
+  try {
+    std::string temp_path(path + ".tmp");
+    {
+      Poco::FileOutputStream out(temp_path,
+                                 std::ios::out | std::ios::binary);
+      out.write(buffer.data(), buffer.size());
+      out.close();
+      if (!out.good()) {
+        return error("Cannot write related data snapshot");
+      }
+    }
+    Poco::File file(path);
+    if (file.exists()) {
+      file.remove();
+    }
+    Poco::File(temp_path).renameTo(path);
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  }
+  return noError;
+}
+
+error RelatedDataSnapshot::Read(
+    const std::string &path, const RelatedDataSnapshotKey &key,
+    RelatedData *related, Poco::UInt64 *time_entries_loaded_since,
+    bool *found) {
+  *found = false;
+  try {
+    Poco::File file(path);
+    if (!file.exists() || file.getSize() < 4) {
+      return noError;
+    }
+    Poco::SharedMemory mapped(file, Poco::SharedMemory::AM_READ);
+    Reader reader(mapped.begin(), mapped.end());
+
+    std::string magic(reader.Bytes(4));
+    if (magic != std::string(kRelatedDataSnapshotMagic, 4)
+        || reader.UInt32() != kRelatedDataSnapshotVersion
+        || reader.String() != key.database_id
+        || reader.UInt64() != key.generation
+        || reader.UInt64() != key.uid) {
+      return noError;
+    }
+    Poco::UInt64 loaded_since = reader.UInt64();
+
+    RelatedData loaded;
+    readWorkspaces(&reader, &loaded.Workspaces);
+    readClients(&reader, &loaded.Clients);
+    readProjects(&reader, &loaded.Projects);
+    readTasks(&reader, &loaded.Tasks);
+    readTags(&reader, &loaded.Tags);
+    readTimeEntries(&reader, &loaded.TimeEntries);
+    if (!reader.Ok() || !reader.AtEnd()) {
+      deleteModels(&loaded.Workspaces);
+      deleteModels(&loaded.Clients);
+      deleteModels(&loaded.Projects);
+      deleteModels(&loaded.Tasks);
+      deleteModels(&loaded.Tags);
+      deleteModels(&loaded.TimeEntries);
+      return error("Related data snapshot is damaged");
+    }
+
+    related->Workspaces.swap(loaded.Workspaces);
+    related->Clients.swap(loaded.Clients);
+    related->Projects.swap(loaded.Projects);
+    related->Tasks.swap(loaded.Tasks);
+    related->Tags.swap(loaded.Tags);
+    related->TimeEntries.swap(loaded.TimeEntries);
+    *time_entries_loaded_since = loaded_since;
+    *found = true;
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  }
+  return noError;
+}
+
+RelatedDataSnapshot::Reader::Reader(const char *begin, const char *end)
+  : p_(begin), end_(end), ok_(true) {}
+
+std::string RelatedDataSnapshot::Reader::Bytes(const std::size_t size) {
+  if (!take(size)) {
+    return "";
+  }
+  return std::string(p_ - size, size);
+}
+
+std::string RelatedDataSnapshot::Reader::String() {
+  Poco::UInt32 size = UInt32();
+  return Bytes(size);
+}
+
+Poco::UInt32 RelatedDataSnapshot::Reader::UInt32() {
+  Poco::UInt32 value(0);
+  if (take(sizeof(value))) {
+    std::memcpy(&value, p_ - sizeof(value), sizeof(value));
+  }
+  return value;
+}
+
+Poco::UInt64 RelatedDataSnapshot::Reader::UInt64() {
+  Poco::UInt64 value(0);
+  if (take(sizeof(value))) {
+    std::memcpy(&value, p_ - sizeof(value), sizeof(value));
+  }
+  return value;
+}
+
+Poco::Int64 RelatedDataSnapshot::Reader::Int64() {
+  return static_cast<Poco::Int64>(UInt64());
+}
+
+bool RelatedDataSnapshot::Reader::Bool() {
+  if (!take(1)) {
+    return false;
+  }
+  return *(p_ - 1) != 0;
+}
+
+bool RelatedDataSnapshot::Reader::take(const std::size_t size) {
+  if (!ok_ || static_cast<std::size_t>(end_ - p_) < size) {
+    ok_ = false;
+    return false;
+  }
+  p_ += size;
+  return true;
+}
+
+void RelatedDataSnapshot::putUInt32(
+    std::string *buffer, const Poco::UInt32 value) {
+  buffer->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void RelatedDataSnapshot::putUInt64(
+    std::string *buffer, const Poco::UInt64 value) {
+  buffer->append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void RelatedDataSnapshot::putInt64(
+    std::string *buffer, const Poco::Int64 value) {
+  putUInt64(buffer, static_cast<Poco::UInt64>(value));
+}
+
+void RelatedDataSnapshot::putBool(std::string *buffer, const bool value) {
+  buffer->push_back(value ? 1 : 0);
+}
+
+void RelatedDataSnapshot::putString(
+    std::string *buffer, const std::string &value) {
+  putUInt32(buffer, static_cast<Poco::UInt32>(value.size()));
+  buffer->append(value);
+}
+
+void RelatedDataSnapshot::putBase(std::string *buffer, BaseModel *model) {
+  putInt64(buffer, model->LocalID());
+  putUInt64(buffer, model->ID());
+  putUInt64(buffer, model->UID());
+}
+
+void RelatedDataSnapshot::readBase(Reader *reader, BaseModel *model) {
+  model->SetLocalID(reader->Int64());
+  model->SetID(reader->UInt64());
+  model->SetUID(reader->UInt64());
+}
+
+error RelatedDataSnapshot::writeWorkspaces(
+    std::string *buffer, const std::vector<Workspace *> &list) {
+  std::vector<Workspace *> saved;
+  error err = collectSaved(list, &saved);
+  if (err != noError) {
+    return err;
+  }
+  putUInt32(buffer, static_cast<Poco::UInt32>(saved.size()));
+  for (std::vector<Workspace *>::const_iterator it = saved.begin();
+      it != saved.end();
+      it++) {
+    Workspace *model = *it;
+    putBase(buffer, model);
+    putString(buffer, model->Name());
+    putBool(buffer, model->Premium());
+  }
+  return noError;
+}
+
+void RelatedDataSnapshot::readWorkspaces(
+    Reader *reader, std::vector<Workspace *> *list) {
+  Poco::UInt32 count = reader->UInt32();
+  for (Poco::UInt32 i = 0; i < count && reader->Ok(); i++) {
+    Workspace *model = new Workspace();
+    readBase(reader, model);
+    model->SetName(reader->String());
+    model->SetPremium(reader->Bool());
+    model->ClearDirty();
+    list->push_back(model);
+  }
+}
+
+error RelatedDataSnapshot::writeClients(
+    std::string *buffer, const std::vector<Client *> &list) {
+  std::vector<Client *> saved;
+  error err = collectSaved(list, &saved);
+  if (err != noError) {
+    return err;
+  }
+  putUInt32(buffer, static_cast<Poco::UInt32>(saved.size()));
+  for (std::vector<Client *>::const_iterator it = saved.begin();
+      it != saved.end();
+      it++) {
+    Client *model = *it;
+    putBase(buffer, model);
+    putString(buffer, model->Name());
+    putString(buffer, model->GUID());
+    putUInt64(buffer, model->WID());
+  }
+  return noError;
+}
+
+void RelatedDataSnapshot::readClients(
+    Reader *reader, std::vector<Client *> *list) {
+  Poco::UInt32 count = reader->UInt32();
+  for (Poco::UInt32 i = 0; i < count && reader->Ok(); i++) {
+    Client *model = new Client();
+    readBase(reader, model);
+    model->SetName(reader->String());
+    model->SetGUID(reader->String());
+    model->SetWID(reader->UInt64());
+    model->ClearDirty();
+    list->push_back(model);
+  }
+}
+
+error RelatedDataSnapshot::writeProjects(
+    std::string *buffer, const std::vector<Project *> &list) {
+  std::vector<Project *> saved;
+  error err = collectSaved(list, &saved);
+  if (err != noError) {
+    return err;
+  }
+  putUInt32(buffer, static_cast<Poco::UInt32>(saved.size()));
+  for (std::vector<Project *>::const_iterator it = saved.begin();
+      it != saved.end();
+      it++) {
+    Project *model = *it;
+    putBase(buffer, model);
+    putString(buffer, model->Name());
+    putString(buffer, model->GUID());
+    putUInt64(buffer, model->WID());
+    putString(buffer, model->Color());
+    putUInt64(buffer, model->CID());
+    putBool(buffer, model->Active());
+    putBool(buffer, model->Billable());
+  }
+  return noError;
+}
+
+void RelatedDataSnapshot::readProjects(
+    Reader *reader, std::vector<Project *> *list) {
+  Poco::UInt32 count = reader->UInt32();
+  for (Poco::UInt32 i = 0; i < count && reader->Ok(); i++) {
+    Project *model = new Project();
+    readBase(reader, model);
+    model->SetName(reader->String());
+    model->SetGUID(reader->String());
+    model->SetWID(reader->UInt64());
+    model->SetColor(reader->String());
+    model->SetCID(reader->UInt64());
+    model->SetActive(reader->Bool());
+    model->SetBillable(reader->Bool());
+    model->ClearDirty();
+    list->push_back(model);
+  }
+}
+
+error RelatedDataSnapshot::writeTasks(
+    std::string *buffer, const std::vector<Task *> &list) {
+  std::vector<Task *> saved;
+  error err = collectSaved(list, &saved);
+  if (err != noError) {
+    return err;
+  }
+  putUInt32(buffer, static_cast<Poco::UInt32>(saved.size()));
+  for (std::vector<Task *>::const_iterator it = saved.begin();
+      it != saved.end();
+      it++) {
+    Task *model = *it;
+    putBase(buffer, model);
+    putString(buffer, model->Name());
+    putUInt64(buffer, model->WID());
+    putUInt64(buffer, model->PID());
+  }
+  return noError;
+}
+
+void RelatedDataSnapshot::readTasks(Reader *reader, std::vector<Task *> *list) {
+  Poco::UInt32 count = reader->UInt32();
+  for (Poco::UInt32 i = 0; i < count && reader->Ok(); i++) {
+    Task *model = new Task();
+    readBase(reader, model);
+    model->SetName(reader->String());
+    model->SetWID(reader->UInt64());
+    model->SetPID(reader->UInt64());
+    model->ClearDirty();
+    list->push_back(model);
+  }
+}
+
+error RelatedDataSnapshot::writeTags(
+    std::string *buffer, const std::vector<Tag *> &list) {
+  std::vector<Tag *> saved;
+  error err = collectSaved(list, &saved);
+  if (err != noError) {
+    return err;
+  }
+  putUInt32(buffer, static_cast<Poco::UInt32>(saved.size()));
+  for (std::vector<Tag *>::const_iterator it = saved.begin();
+      it != saved.end();
+      it++) {
+    Tag *model = *it;
+    putBase(buffer, model);
+    putString(buffer, model->Name());
+    putUInt64(buffer, model->WID());
+    putString(buffer, model->GUID());
+  }
+  return noError;
+}
+
+void RelatedDataSnapshot::readTags(Reader *reader, std::vector<Tag *> *list) {
+  Poco::UInt32 count = reader->UInt32();
+  for (Poco::UInt32 i = 0; i < count && reader->Ok(); i++) {
+    Tag *model = new Tag();
+    readBase(reader, model);
+    model->SetName(reader->String());
+    model->SetWID(reader->UInt64());
+    model->SetGUID(reader->String());
+    model->ClearDirty();
+    list->push_back(model);
+  }
+}
+
+error RelatedDataSnapshot::writeTimeEntries(
+    std::string *buffer, const std::vector<TimeEntry *> &list) {
+  std::vector<TimeEntry *> saved;
+  error err = collectSaved(list, &saved);
+  if (err != noError) {
+    return err;
+  }
+  putUInt32(buffer, static_cast<Poco::UInt32>(saved.size()));
+  for (std::vector<TimeEntry *>::const_iterator it = saved.begin();
+      it != saved.end();
+      it++) {
+    TimeEntry *model = *it;
+    putBase(buffer, model);
+    putString(buffer, model->Description());
+    putUInt64(buffer, model->WID());
+    putString(buffer, model->GUID());
+    putUInt64(buffer, model->PID());
+    putUInt64(buffer, model->TID());
+    putBool(buffer, model->Billable());
+    putBool(buffer, model->DurOnly());
+    putUInt64(buffer, model->UIModifiedAt());
+    putUInt64(buffer, model->Start());
+    putUInt64(buffer, model->Stop());
+    putInt64(buffer, model->DurationInSeconds());
+    putString(buffer, model->Tags());
+    putString(buffer, model->CreatedWith());
+    putUInt64(buffer, model->DeletedAt());
+    putUInt64(buffer, model->UpdatedAt());
+    putString(buffer, model->ProjectGUID());
+  }
+  return noError;
+}
+
+void RelatedDataSnapshot::readTimeEntries(
+    Reader *reader, std::vector<TimeEntry *> *list) {
+  Poco::UInt32 count = reader->UInt32();
+  for (Poco::UInt32 i = 0; i < count && reader->Ok(); i++) {
+    TimeEntry *model = new TimeEntry();
+    readBase(reader, model);
+    model->SetDescription(reader->String());
+    model->SetWID(reader->UInt64());
+    model->SetGUID(reader->String());
+    model->SetPID(reader->UInt64());
+    model->SetTID(reader->UInt64());
+    model->SetBillable(reader->Bool());
+    model->SetDurOnly(reader->Bool());
+    model->SetUIModifiedAt(reader->UInt64());
+    model->SetStart(reader->UInt64());
+    model->SetStop(reader->UInt64());
+    model->SetDurationInSeconds(reader->Int64());
+    model->SetTags(reader->String());
+    model->SetCreatedWith(reader->String());
+    model->SetDeletedAt(reader->UInt64());
+    model->SetUpdatedAt(reader->UInt64());
+    model->SetProjectGUID(reader->String());
+    model->ClearDirty();
+    list->push_back(model);
+  }
+}
+
+}  // namespace kopsik
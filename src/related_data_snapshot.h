@@ -0,0 +1,173 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_RELATED_DATA_SNAPSHOT_H_
+#define SRC_RELATED_DATA_SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+
+#include "./types.h"
+#include "./related_data.h"
+#include "./workspace.h"
+#include "./client.h"
+#include "./project.h"
+#include "./task.h"
+#include "./tag.h"
+#include "./time_entry.h"
+
+#include "Poco/FileStream.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Bumped whenever the layout changes, so older snapshots are ignored
+  const Poco::UInt32 kRelatedDataSnapshotVersion = 2;
+  const char kRelatedDataSnapshotMagic[] = "KSNP";
+
+  // Where a snapshot was written from. It's only used when it matches
+  // the database as it is now: same database, same user, and no
+  // related data saved since.
+  typedef struct {
+    std::string database_id;
+    Poco::UInt64 generation;
+    Poco::UInt64 uid;
+  } RelatedDataSnapshotKey;
+
+  // A copy of the related data of a user in one flat file, so a cold
+  // start can map it and build the models without going through SQL.
+  // The fields are the ones Database loads, in native byte order:
+  // the file is only read on the machine that wrote it. SQLite stays
+  // the source of truth, a snapshot that doesn't match is ignored.
+  class RelatedDataSnapshot {
+  public:
+    // Saved models only; written to a temporary file first,
+    // so a reader never sees half of it
+    static error Write(
+        const std::string &path,
+        const RelatedDataSnapshotKey &key,
+        const Poco::UInt64 time_entries_loaded_since,
+        RelatedData *related);
+
+    // Builds the models from the snapshot at path, if there is one
+    // written with key. Otherwise found is false and related is
+    // left empty.
+    static error Read(
+        const std::string &path,
+        const RelatedDataSnapshotKey &key,
+        RelatedData *related,
+        Poco::UInt64 *time_entries_loaded_since,
+        bool *found);
+
+  private:
+    // Reads fields off the mapped file. Reading past its end
+    // gives zeroes and makes Ok false.
+    class Reader {
+    public:
+      Reader(const char *begin, const char *end);
+
+      bool Ok() const { return ok_; }
+      bool AtEnd() const { return p_ == end_; }
+
+      std::string Bytes(const std::size_t size);
+      std::string String();
+      Poco::UInt32 UInt32();
+      Poco::UInt64 UInt64();
+      Poco::Int64 Int64();
+      bool Bool();
+
+    private:
+      bool take(const std::size_t size);
+
+      const char *p_;
+      const char *end_;
+      bool ok_;
+    };
+
+    static void putUInt32(std::string *buffer, const Poco::UInt32 value);
+    static void putUInt64(std::string *buffer, const Poco::UInt64 value);
+    static void putInt64(std::string *buffer, const Poco::Int64 value);
+    static void putBool(std::string *buffer, const bool value);
+    static void putString(std::string *buffer, const std::string &value);
+
+    // Models deleted on server are gone from the database,
+    // unsaved ones are not there yet
+    template <class T>
+    static error collectSaved(
+        const std::vector<T *> &list,
+        std::vector<T *> *saved) {
+      saved->reserve(list.size());
+      for (typename std::vector<T *>::const_iterator it = list.begin();
+          it != list.end();
+          it++) {
+        T *model = *it;
+        if (model->IsMarkedAsDeletedOnServer()) {
+          continue;
+        }
+        if (!model->LocalID() || model->Dirty()) {
+          return error("Cannot snapshot unsaved " + model->ModelName());
+        }
+        saved->push_back(model);
+      }
+      return noError;
+    }
+
+    template <class T>
+    static void deleteModels(std::vector<T *> *list) {
+      for (typename std::vector<T *>::const_iterator it = list->begin();
+          it != list->end();
+          it++) {
+        delete *it;
+      }
+      list->clear();
+    }
+
+    // Fields of BaseModel every model has
+    static void putBase(std::string *buffer, BaseModel *model);
+    static void readBase(Reader *reader, BaseModel *model);
+
+    static error writeWorkspaces(
+        std::string *buffer,
+        const std::vector<Workspace *> &list);
+    static void readWorkspaces(
+        Reader *reader,
+        std::vector<Workspace *> *list);
+
+    static error writeClients(
+        std::string *buffer,
+        const std::vector<Client *> &list);
+    static void readClients(
+        Reader *reader,
+        std::vector<Client *> *list);
+
+    static error writeProjects(
+        std::string *buffer,
+        const std::vector<Project *> &list);
+    static void readProjects(
+        Reader *reader,
+        std::vector<Project *> *list);
+
+    static error writeTasks(
+        std::string *buffer,
+        const std::vector<Task *> &list);
+    static void readTasks(
+        Reader *reader,
+        std::vector<Task *> *list);
+
+    static error writeTags(
+        std::string *buffer,
+        const std::vector<Tag *> &list);
+    static void readTags(
+        Reader *reader,
+        std::vector<Tag *> *list);
+
+    static error writeTimeEntries(
+        std::string *buffer,
+        const std::vector<TimeEntry *> &list);
+    static void readTimeEntries(
+        Reader *reader,
+        std::vector<TimeEntry *> *list);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_RELATED_DATA_SNAPSHOT_H_
@@ -0,0 +1,150 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./report.h"
+
+#include "Poco/LocalDateTime.h"
+#include "Poco/Timespan.h"
+
+namespace kopsik {
+
+void ReportTotal::Add(const Poco::Int64 seconds, const bool billable) {
+  Seconds += seconds;
+  if (billable) {
+    BillableSeconds += seconds;
+  }
+  Entries++;
+}
+
+void ReportTotal::Add(const ReportTotal &other) {
+  Seconds += other.Seconds;
+  BillableSeconds += other.BillableSeconds;
+  Entries += other.Entries;
+}
+
+void DayReport::Add(
+    const Poco::UInt64 pid, const std::string &project_guid,
+    const std::string &tags, const Poco::Int64 seconds, const bool billable) {
+  Total.Add(seconds, billable);
+  Projects[ReportProjectKey(pid, pid ? "" : project_guid)].Add(
+    seconds, billable);
+  // Tag names joined with |, as stored in the database
+  std::string::size_type from(0);
+  while (from < tags.size()) {
+    std::string::size_type to = tags.find('|', from);
+    if (to == std::string::npos) {
+      to = tags.size();
+    }
+    if (to > from) {
+      Tags[tags.substr(from, to - from)].Add(seconds, billable);
+    }
+    from = to + 1;
+  }
+}
+
+std::size_t DayReport::MemoryBytes() const {
+  std::size_t bytes = MapNodesBytes(Projects) + MapNodesBytes(Tags);
+  for (std::map<ReportProjectKey, ReportTotal>::const_iterator it =
+      Projects.begin();
+      it != Projects.end();
+      it++) {
+    bytes += StringBytes(it->first.second);
+  }
+  for (std::map<std::string, ReportTotal>::const_iterator it =
+      Tags.begin();
+      it != Tags.end();
+      it++) {
+    bytes += StringBytes(it->first);
+  }
+  return bytes;
+}
+
+void Report::AddDay(const int day, const DayReport &day_report) {
+  if (!day_report.Total.Entries) {
+    return;
+  }
+  Total.Add(day_report.Total);
+  Days[day].Add(day_report.Total);
+  Weeks[WeekOf(day)].Add(day_report.Total);
+  for (std::map<ReportProjectKey, ReportTotal>::const_iterator it =
+      day_report.Projects.begin();
+      it != day_report.Projects.end();
+      it++) {
+    Projects[it->first].Add(it->second);
+  }
+  for (std::map<std::string, ReportTotal>::const_iterator it =
+      day_report.Tags.begin();
+      it != day_report.Tags.end();
+      it++) {
+    Tags[it->first].Add(it->second);
+  }
+}
+
+int Report::WeekOf(const int day) {
+  Poco::LocalDateTime noon(day / 10000, day / 100 % 100, day % 100, 12);
+  noon -= Poco::Timespan((noon.dayOfWeek() + 6) % 7, 0, 0, 0, 0);
+  return noon.year() * 10000 + noon.month() * 100 + noon.day();
+}
+
+int Report::NextDay(const int day) {
+  Poco::LocalDateTime noon(day / 10000, day / 100 % 100, day % 100, 12);
+  noon += Poco::Timespan(1, 0, 0, 0, 0);
+  return noon.year() * 10000 + noon.month() * 100 + noon.day();
+}
+
+int ReportCache::Generation() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  return generation_;
+}
+
+bool ReportCache::Find(
+    const Poco::UInt64 uid, const int day, DayReport *day_report) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  if (uid != uid_) {
+    return false;
+  }
+  std::map<int, DayReport>::const_iterator it = days_.find(day);
+  if (it == days_.end()) {
+    return false;
+  }
+  *day_report = it->second;
+  return true;
+}
+
+void ReportCache::Put(
+    const Poco::UInt64 uid, const int day, const DayReport &day_report,
+    const int generation) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  if (generation != generation_) {
+    return;
+  }
+  if (uid != uid_) {
+    days_.clear();
+    uid_ = uid;
+  }
+  days_[day] = day_report;
+}
+
+void ReportCache::Drop(const int day) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  days_.erase(day);
+  generation_++;
+}
+
+void ReportCache::Clear() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  days_.clear();
+  generation_++;
+}
+
+std::size_t ReportCache::MemoryBytes() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  std::size_t bytes = MapNodesBytes(days_);
+  for (std::map<int, DayReport>::const_iterator it = days_.begin();
+      it != days_.end();
+      it++) {
+    bytes += it->second.MemoryBytes();
+  }
+  return bytes;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,117 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_REPORT_H_
+#define SRC_REPORT_H_
+
+#include <map>
+#include <string>
+#include <utility>
+
+#include "./memory_usage.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Tracked time of stopped time entries, and how much of it is billable
+  class ReportTotal {
+  public:
+    ReportTotal() : Seconds(0), BillableSeconds(0), Entries(0) {}
+
+    void Add(const Poco::Int64 seconds, const bool billable);
+
+    void Add(const ReportTotal &other);
+
+    Poco::Int64 Seconds;
+    Poco::Int64 BillableSeconds;
+    int Entries;
+  };
+
+  // A project the way time entries refer to it: by ID, or by GUID when
+  // it's not pushed yet. Both are empty for time entries without one.
+  typedef std::pair<Poco::UInt64, std::string> ReportProjectKey;
+
+  // Totals of one day, by project and by tag
+  class DayReport {
+  public:
+    void Add(const Poco::UInt64 pid,
+             const std::string &project_guid,
+             const std::string &tags,
+             const Poco::Int64 seconds,
+             const bool billable);
+
+    std::size_t MemoryBytes() const;
+
+    ReportTotal Total;
+    std::map<ReportProjectKey, ReportTotal> Projects;
+    std::map<std::string, ReportTotal> Tags;
+  };
+
+  // Totals of a range of days, grouped by day, week, project, client
+  // and tag. Days and weeks are yyyymmdd like DayTotals::DayOf, weeks
+  // by their Monday. Only days and weeks with time tracked are listed.
+  class Report {
+  public:
+    void AddDay(const int day, const DayReport &day_report);
+
+    // Monday of the day's week
+    static int WeekOf(const int day);
+
+    // The day after, for walking over a range of days
+    static int NextDay(const int day);
+
+    ReportTotal Total;
+    std::map<int, ReportTotal> Days;
+    std::map<int, ReportTotal> Weeks;
+    std::map<ReportProjectKey, ReportTotal> Projects;
+    // By client ID of the projects, 0 for time entries without a client
+    std::map<Poco::UInt64, ReportTotal> Clients;
+    std::map<std::string, ReportTotal> Tags;
+
+    // Names of the projects and clients in the totals, as saved
+    std::map<ReportProjectKey, std::string> ProjectNames;
+    std::map<Poco::UInt64, std::string> ClientNames;
+  };
+
+  // Day reports of the user's days that are over, so reports over long
+  // ranges read only the new days from the database. A day is dropped
+  // when one of its time entries is saved or deleted, and all of them
+  // when a time entry moves to another day or the database is changed
+  // by someone else.
+  class ReportCache {
+  public:
+    ReportCache() : uid_(0), generation_(0) {}
+
+    // Changes whenever days are dropped. Reports read before a change
+    // are not kept, as they may be older than it.
+    int Generation();
+
+    bool Find(const Poco::UInt64 uid,
+              const int day,
+              DayReport *day_report);
+
+    void Put(const Poco::UInt64 uid,
+             const int day,
+             const DayReport &day_report,
+             const int generation);
+
+    void Drop(const int day);
+
+    void Clear();
+
+    std::size_t MemoryBytes();
+
+  private:
+    Poco::UInt64 uid_;
+    int generation_;
+    std::map<int, DayReport> days_;
+    Poco::FastMutex mutex_;
+
+    ReportCache(const ReportCache &);
+    ReportCache &operator=(const ReportCache &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_REPORT_H_
@@ -0,0 +1,76 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./string_table.h"
+
+#include "Poco/SingletonHolder.h"
+
+namespace kopsik {
+
+StringTable &StringTable::Timeline() {
+    static Poco::SingletonHolder<StringTable> sh;
+    return *sh.get();
+}
+
+StringTable &StringTable::Descriptions() {
+    static Poco::SingletonHolder<StringTable> sh;
+    return *sh.get();
+}
+
+SharedString StringTable::Intern(const std::string &value) {
+    Poco::Mutex::ScopedLock lock(strings_m_);
+    Strings::iterator it = strings_.find(&value);
+    if (it != strings_.end()) {
+        return it->second;
+    }
+    if (strings_.size() >= sweep_at_) {
+        sweep();
+    }
+    SharedString interned(new std::string(value));
+    strings_.insert(std::make_pair(interned.get(), interned));
+    return interned;
+}
+
+std::size_t StringTable::Size() {
+    Poco::Mutex::ScopedLock lock(strings_m_);
+    return strings_.size();
+}
+
+void StringTable::Sweep() {
+    Poco::Mutex::ScopedLock lock(strings_m_);
+    sweep();
+}
+
+std::size_t StringTable::MemoryBytes() {
+    Poco::Mutex::ScopedLock lock(strings_m_);
+    std::size_t bytes = MapNodesBytes(strings_)
+        + strings_.size()
+        * (sizeof(std::string) + sizeof(Poco::ReferenceCounter));
+    for (Strings::const_iterator it = strings_.begin();
+            it != strings_.end();
+            it++) {
+        bytes += StringBytes(*it->first);
+    }
+    return bytes;
+}
+
+bool StringTable::ValueLess::operator()(
+    const std::string *a, const std::string *b) const {
+    return *a < *b;
+}
+
+void StringTable::sweep() {
+    Strings::iterator it = strings_.begin();
+    while (it != strings_.end()) {
+        if (it->second.referenceCount() == 1) {
+            strings_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    sweep_at_ = strings_.size() * 2;
+    if (sweep_at_ < kStringTableMinSweepSize) {
+        sweep_at_ = kStringTableMinSweepSize;
+    }
+}
+
+}  // namespace kopsik
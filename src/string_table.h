@@ -0,0 +1,65 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_STRING_TABLE_H_
+#define SRC_STRING_TABLE_H_
+
+#include <map>
+#include <string>
+
+#include "./memory_usage.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/SharedPtr.h"
+
+namespace kopsik {
+
+// Shared by everyone who interned the same value, so never modify it
+typedef Poco::SharedPtr<std::string> SharedString;
+
+const std::size_t kStringTableMinSweepSize = 256;
+
+// Hands out one shared copy of each distinct string, so values that
+// repeat a lot (like window titles in the timeline) are stored once
+// no matter how many times they're held. Strings nobody holds any more
+// are dropped when the table has doubled in size since the last sweep.
+class StringTable {
+ public:
+    StringTable() : sweep_at_(kStringTableMinSweepSize) {}
+
+    // Shared table for timeline titles and filenames
+    static StringTable &Timeline();
+
+    // Shared table for time entry descriptions, which most users pick
+    // from a few they use again and again. Those of a user who logged
+    // out go with the next sweep.
+    static StringTable &Descriptions();
+
+    SharedString Intern(const std::string &value);
+
+    std::size_t Size();
+
+    // Drops the strings nobody holds any more right away,
+    // instead of waiting for the table to double
+    void Sweep();
+
+    // The strings, their shared pointers' counters and the table
+    std::size_t MemoryBytes();
+
+ private:
+    struct ValueLess {
+        bool operator()(const std::string *a, const std::string *b) const;
+    };
+
+    // Keys point into the shared strings themselves
+    typedef std::map<const std::string *, SharedString, ValueLess> Strings;
+
+    void sweep();
+
+    Strings strings_;
+    std::size_t sweep_at_;
+    Poco::Mutex strings_m_;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_STRING_TABLE_H_
@@ -0,0 +1,37 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_SYNC_CHECKPOINT_H_
+#define SRC_SYNC_CHECKPOINT_H_
+
+#include <vector>
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // A piece of a per-workspace fetch that was applied and saved:
+  // the lists of a workspace (wid set), or the time entries that
+  // started from since to until
+  typedef struct {
+    Poco::UInt64 wid;
+    Poco::UInt64 since;
+    Poco::UInt64 until;
+  } SyncCheckpointPiece;
+
+  // How far a full sync got, kept in the database so a sync that was
+  // interrupted by quitting or by the network goes on from there
+  // rather than downloading everything again. See WorkspaceFetch::Resume.
+  typedef struct {
+    // When the first of the fetches began, in seconds
+    Poco::UInt64 started;
+    // As the server gave it to that fetch, so whatever changed
+    // afterwards is synced with the next partial sync
+    Poco::UInt64 since;
+    Poco::UInt64 time_entries_since;
+    Poco::UInt64 time_entries_until;
+    std::vector<SyncCheckpointPiece> pieces;
+  } SyncCheckpoint;
+
+}  // namespace kopsik
+
+#endif  // SRC_SYNC_CHECKPOINT_H_
@@ -0,0 +1,107 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./sync_scheduler.h"
+
+namespace kopsik {
+
+SyncScheduler::SyncScheduler(
+    const Poco::Timestamp::TimeDiff delay,
+    const Poco::Timestamp::TimeDiff max_delay)
+  : delay_(delay)
+  , max_delay_(max_delay)
+  , pending_(None)
+  , user_initiated_(false)
+  , task_scheduled_(false) {}
+
+bool SyncScheduler::Request(
+    const Kind kind, const bool user_initiated, const Poco::Timestamp &now,
+    Poco::Timestamp *task_at) {
+  poco_assert(task_at);
+
+  if (None == pending_) {
+    first_requested_at_ = now;
+  }
+  if (kind > pending_) {
+    pending_ = kind;
+  }
+  if (user_initiated) {
+    user_initiated_ = true;
+    due_at_ = now;
+  } else if (!user_initiated_) {
+    due_at_ = now + delay_;
+    if (due_at_ > first_requested_at_ + max_delay_) {
+      due_at_ = first_requested_at_ + max_delay_;
+    }
+  }
+
+  if (task_scheduled_ && task_at_ <= due_at_) {
+    return false;
+  }
+  return schedule(task_at);
+}
+
+SyncScheduler::Kind SyncScheduler::Take(
+    const Poco::Timestamp &now, bool *reschedule, Poco::Timestamp *task_at) {
+  poco_assert(reschedule);
+  poco_assert(task_at);
+
+  task_scheduled_ = false;
+  *reschedule = false;
+  if (None == pending_) {
+    return None;
+  }
+  if (due_at_ > now) {
+    *reschedule = schedule(task_at);
+    return None;
+  }
+  Kind kind = pending_;
+  pending_ = None;
+  user_initiated_ = false;
+  return kind;
+}
+
+void SyncScheduler::Hold(const Kind kind) {
+  if (kind > pending_) {
+    pending_ = kind;
+  }
+}
+
+bool SyncScheduler::schedule(Poco::Timestamp *task_at) {
+  task_scheduled_ = true;
+  task_at_ = due_at_;
+  *task_at = due_at_;
+  return true;
+}
+
+FullSyncInterval::FullSyncInterval(
+    const Poco::Timestamp::TimeDiff healthy_interval,
+    const Poco::Timestamp::TimeDiff degraded_interval,
+    const Poco::Timestamp::TimeDiff down_threshold)
+  : healthy_interval_(healthy_interval)
+  , degraded_interval_(degraded_interval)
+  , down_threshold_(down_threshold)
+  , down_(false) {}
+
+Poco::Timestamp::TimeDiff FullSyncInterval::Interval(
+    const bool healthy, const Poco::Timestamp &now) {
+  if (healthy) {
+    down_ = false;
+    return healthy_interval_;
+  }
+  if (!down_) {
+    down_ = true;
+    down_since_ = now;
+  }
+  if (now - down_since_ >= down_threshold_) {
+    return degraded_interval_;
+  }
+  return healthy_interval_;
+}
+
+bool FullSyncInterval::Due(
+    const bool healthy, const Poco::Timestamp &now,
+    const Poco::Timestamp &last_full_sync_at) {
+  return now - last_full_sync_at >= Interval(healthy, now);
+}
+
+}  // namespace kopsik
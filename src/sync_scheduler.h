@@ -0,0 +1,98 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_SYNC_SCHEDULER_H_
+#define SRC_SYNC_SCHEDULER_H_
+
+#include "Poco/Bugcheck.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Decides when the pending sync requests run, so that a burst of
+  // them ends up as one sync. A full sync absorbs partial syncs, edits
+  // are debounced into one push and a sync asked for by the user runs
+  // right away, ahead of the debounced ones. Keeps track of one timer
+  // task at a time, the caller schedules it and guards the calls.
+  class SyncScheduler {
+  public:
+    // Stronger kinds absorb weaker ones
+    enum Kind {
+      None = 0,
+      Partial = 1,
+      Full = 2
+    };
+
+    // Background requests wait for delay microseconds without new
+    // requests, but not longer than max_delay after the first one.
+    SyncScheduler(const Poco::Timestamp::TimeDiff delay,
+                  const Poco::Timestamp::TimeDiff max_delay);
+
+    // Returns true when the task should be (re)scheduled at task_at,
+    // replacing the task scheduled before.
+    bool Request(const Kind kind,
+                 const bool user_initiated,
+                 const Poco::Timestamp &now,
+                 Poco::Timestamp *task_at);
+
+    // Called when the task runs. Returns the sync to run now, if any.
+    // When the sync was postponed meanwhile, reschedule is set and the
+    // task should be scheduled again at task_at.
+    Kind Take(const Poco::Timestamp &now,
+              bool *reschedule,
+              Poco::Timestamp *task_at);
+
+    // Called instead of running the sync taken, while syncing is
+    // paused. It's kept pending without a task, until the next request.
+    void Hold(const Kind kind);
+
+    Kind Pending() const { return pending_; }
+
+  private:
+    bool schedule(Poco::Timestamp *task_at);
+
+    Poco::Timestamp::TimeDiff delay_;
+    Poco::Timestamp::TimeDiff max_delay_;
+
+    Kind pending_;
+    bool user_initiated_;
+    Poco::Timestamp first_requested_at_;
+    Poco::Timestamp due_at_;
+
+    bool task_scheduled_;
+    Poco::Timestamp task_at_;
+  };
+
+  // How far apart the periodic full syncs are, which only catch what
+  // the WebSocket missed. While the stream delivers, the deltas it
+  // brings are trusted and full syncs are rare. Once it has been down
+  // past the threshold, they come much closer, until it's back.
+  class FullSyncInterval {
+  public:
+    FullSyncInterval(const Poco::Timestamp::TimeDiff healthy_interval,
+                     const Poco::Timestamp::TimeDiff degraded_interval,
+                     const Poco::Timestamp::TimeDiff down_threshold);
+
+    // Called as the stream is looked at. Returns the interval now
+    // in effect.
+    Poco::Timestamp::TimeDiff Interval(const bool healthy,
+                                       const Poco::Timestamp &now);
+
+    // Whether a full sync is due, the last one having finished at
+    // last_full_sync_at
+    bool Due(const bool healthy,
+             const Poco::Timestamp &now,
+             const Poco::Timestamp &last_full_sync_at);
+
+  private:
+    Poco::Timestamp::TimeDiff healthy_interval_;
+    Poco::Timestamp::TimeDiff degraded_interval_;
+    Poco::Timestamp::TimeDiff down_threshold_;
+
+    bool down_;
+    Poco::Timestamp down_since_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_SYNC_SCHEDULER_H_
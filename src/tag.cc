@@ -4,6 +4,10 @@
 
 #include <sstream>
 
+#include "./json_key.h"
+#include "./memory_usage.h"
+#include "./tag_names.h"
+
 namespace kopsik {
 
 std::string Tag::String() const {
@@ -16,6 +20,11 @@ std::string Tag::String() const {
   return ss.str();
 }
 
+std::size_t Tag::MemoryBytes() const {
+  return sizeof(*this) + ownedBytes()
+    + StringBytes(name_);
+}
+
 void Tag::SetWID(const Poco::UInt64 value) {
   if (wid_ != value) {
     wid_ = value;
@@ -23,31 +32,59 @@ void Tag::SetWID(const Poco::UInt64 value) {
   }
 }
 
-void Tag::SetName(const std::string value) {
+void Tag::SetName(const std::string &value) {
   if (name_ != value) {
+    if (tag_name_counts_) {
+      tag_name_counts_->Remove(name_);
+      tag_name_counts_->Add(value);
+    }
     name_ = value;
     SetDirty();
   }
 }
 
-void Tag::LoadFromJSONNode(JSONNODE * const data) {
-  poco_assert(data);
-
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
-  while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "id") == 0) {
-      SetID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "name") == 0) {
-      SetName(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "guid") == 0) {
-      SetGUID(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "wid") == 0) {
-      SetWID(json_as_int(*current_node));
-    }
-    ++current_node;
+void Tag::SetTagNameCounts(TagNameCounts *value) {
+  if (tag_name_counts_ == value) {
+    return;
+  }
+  if (tag_name_counts_) {
+    tag_name_counts_->Remove(name_);
+    tag_name_counts_->Unregister();
+  }
+  tag_name_counts_ = value;
+  if (tag_name_counts_) {
+    tag_name_counts_->Register();
+    tag_name_counts_->Add(name_);
   }
 }
 
+static const ModelField<Tag> kTagFields[] = {
+  UIntField<Tag>("id", kJSONKeyID,
+    kFieldStored | kFieldLoaded,
+    &Tag::ID, &Tag::SetID),
+  UIntField<Tag>("uid", kJSONKeyUnknown,
+    kFieldStored,
+    &Tag::UID, &Tag::SetUID),
+  StringField<Tag>("name", kJSONKeyName,
+    kFieldStored | kFieldLoaded,
+    &Tag::Name, &Tag::SetName),
+  UIntField<Tag>("wid", kJSONKeyWID,
+    kFieldStored | kFieldLoaded,
+    &Tag::WID, &Tag::SetWID),
+  StringField<Tag>("guid", kJSONKeyGUID,
+    kFieldStored | kFieldLoaded | kFieldOptional,
+    &Tag::GUID, &Tag::SetGUID)
+};
+
+static const ModelSchema<Tag> kTagSchema("tags", kTagFields,
+    sizeof(kTagFields) / sizeof(kTagFields[0]));
+
+const ModelSchema<Tag> &Tag::Schema() {
+  return kTagSchema;
+}
+
+void Tag::LoadFromJSONNode(JSONValue * const data) {
+  Schema().LoadFromJSONNode(data, this);
+}
+
 }   // namespace kopsik
@@ -6,6 +6,7 @@
 #include <string>
 
 #include "./types.h"
+#include "./model_schema.h"
 
 #include "Poco/Types.h"
 
@@ -13,29 +14,46 @@
 
 namespace kopsik {
 
+  class TagNameCounts;
+
   class Tag : public BaseModel {
   public:
     Tag()
       : BaseModel()
       , wid_(0)
-      , name_("") {}
+      , name_("")
+      , tag_name_counts_(0) {}
+    virtual ~Tag() {
+      SetTagNameCounts(0);
+    }
 
     Poco::UInt64 WID() const { return wid_; }
     void SetWID(const Poco::UInt64 value);
 
-    std::string Name() const { return name_; }
-    void SetName(const std::string value);
+    const std::string &Name() const { return name_; }
+    void SetName(const std::string &value);
 
     std::string String() const;
+    std::size_t MemoryBytes() const;
 
     std::string ModelName() const { return "tag"; }
     std::string ModelURL() const { return "/api/v8/tags"; }
 
-    void LoadFromJSONNode(JSONNODE * const data);
+    // Fields as stored and sent, listed once
+    static const ModelSchema<Tag> &Schema();
+
+    void LoadFromJSONNode(JSONValue * const data);
+
+    // Distinct names the tag keeps its name counted in,
+    // see RelatedData::Track.
+    TagNameCounts *GetTagNameCounts() const { return tag_name_counts_; }
+    void SetTagNameCounts(TagNameCounts *value);
 
   private:
     Poco::UInt64 wid_;
     std::string name_;
+
+    TagNameCounts *tag_name_counts_;
   };
 
 }  // namespace kopsik
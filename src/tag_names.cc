@@ -0,0 +1,59 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./tag_names.h"
+
+#include "Poco/SingletonHolder.h"
+
+namespace kopsik {
+
+TagNameTable::~TagNameTable() {
+  for (std::vector<std::string *>::const_iterator it = names_.begin();
+      it != names_.end();
+      it++) {
+    delete *it;
+  }
+}
+
+TagNameTable &TagNameTable::Shared() {
+  static Poco::SingletonHolder<TagNameTable> sh;
+  return *sh.get();
+}
+
+TagID TagNameTable::Intern(const std::string &name) {
+  Poco::FastMutex::ScopedLock lock(names_m_);
+  std::map<std::string, TagID>::const_iterator it = ids_.find(name);
+  if (it != ids_.end()) {
+    return it->second;
+  }
+  TagID id = static_cast<TagID>(names_.size());
+  names_.push_back(new std::string(name));
+  ids_[name] = id;
+  return id;
+}
+
+const std::string &TagNameTable::Name(const TagID id) {
+  Poco::FastMutex::ScopedLock lock(names_m_);
+  poco_assert(id < names_.size());
+  return *names_[id];
+}
+
+void TagNameCounts::Remove(const std::string &name) {
+  std::map<std::string, int>::iterator it = counts_.find(name);
+  poco_assert(it != counts_.end());
+  if (!--it->second) {
+    counts_.erase(it);
+  }
+}
+
+void TagNameCounts::Names(std::vector<std::string> *result) const {
+  poco_assert(result);
+  result->reserve(result->size() + counts_.size());
+  for (std::map<std::string, int>::const_reverse_iterator it =
+      counts_.rbegin();
+      it != counts_.rend();
+      it++) {
+    result->push_back(it->first);
+  }
+}
+
+}  // namespace kopsik
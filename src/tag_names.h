@@ -0,0 +1,74 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TAG_NAMES_H_
+#define SRC_TAG_NAMES_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Small number standing for a tag name, see TagNameTable
+  typedef Poco::UInt32 TagID;
+
+  // Hands out one ID per distinct tag name, so time entries can keep
+  // their tags as a few small numbers instead of a list of strings.
+  // Names are never dropped, and their IDs stay the same for as long
+  // as the process runs. There are only ever a few hundred of them,
+  // so the table is shared by all users and time entries that don't
+  // belong to a user yet.
+  class TagNameTable {
+  public:
+    TagNameTable() {}
+
+    ~TagNameTable();
+
+    static TagNameTable &Shared();
+
+    TagID Intern(const std::string &name);
+
+    // Names don't move once interned, so the reference stays valid
+    const std::string &Name(const TagID id);
+
+  private:
+    std::map<std::string, TagID> ids_;
+    std::vector<std::string *> names_;
+    Poco::FastMutex names_m_;
+
+    TagNameTable(const TagNameTable &);
+    TagNameTable &operator=(const TagNameTable &);
+  };
+
+  // Distinct names of a user's tags. Tags report their names here
+  // themselves as they change, see Tag::SetTagNameCounts, so the
+  // list of tags doesn't have to be deduplicated on every lookup.
+  class TagNameCounts {
+  public:
+    TagNameCounts() : registered_(0) {}
+
+    // Tags that report here. When it's less than the number
+    // of tags the names are incomplete.
+    std::size_t Registered() const { return registered_; }
+
+    void Register() { registered_++; }
+    void Unregister() { registered_--; }
+
+    void Add(const std::string &name) { counts_[name]++; }
+
+    void Remove(const std::string &name);
+
+    // Distinct names in reverse order, the way Context::Tags lists them
+    void Names(std::vector<std::string> *result) const;
+
+  private:
+    std::map<std::string, int> counts_;
+    std::size_t registered_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TAG_NAMES_H_
@@ -4,6 +4,9 @@
 
 #include <sstream>
 
+#include "./json_key.h"
+#include "./memory_usage.h"
+
 namespace kopsik {
 
 std::string Task::String() const {
@@ -16,6 +19,11 @@ std::string Task::String() const {
   return ss.str();
 }
 
+std::size_t Task::MemoryBytes() const {
+  return sizeof(*this) + ownedBytes()
+    + StringBytes(name_);
+}
+
 void Task::SetPID(const Poco::UInt64 value) {
   if (pid_ != value) {
     pid_ = value;
@@ -30,31 +38,40 @@ void Task::SetWID(const Poco::UInt64 value) {
   }
 }
 
-void Task::SetName(const std::string value) {
+void Task::SetName(const std::string &value) {
   if (name_ != value) {
     name_ = value;
     SetDirty();
   }
 }
 
-void Task::LoadFromJSONNode(JSONNODE * const data) {
-  poco_assert(data);
-
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
-  while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "id") == 0) {
-      SetID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "name") == 0) {
-      SetName(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "pid") == 0) {
-      SetPID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "wid") == 0) {
-      SetWID(json_as_int(*current_node));
-    }
-    ++current_node;
-  }
+static const ModelField<Task> kTaskFields[] = {
+  UIntField<Task>("id", kJSONKeyID,
+    kFieldStored | kFieldLoaded,
+    &Task::ID, &Task::SetID),
+  UIntField<Task>("uid", kJSONKeyUnknown,
+    kFieldStored,
+    &Task::UID, &Task::SetUID),
+  StringField<Task>("name", kJSONKeyName,
+    kFieldStored | kFieldLoaded,
+    &Task::Name, &Task::SetName),
+  UIntField<Task>("wid", kJSONKeyWID,
+    kFieldStored | kFieldLoaded,
+    &Task::WID, &Task::SetWID),
+  UIntField<Task>("pid", kJSONKeyPID,
+    kFieldStored | kFieldLoaded,
+    &Task::PID, &Task::SetPID)
+};
+
+static const ModelSchema<Task> kTaskSchema("tasks", kTaskFields,
+    sizeof(kTaskFields) / sizeof(kTaskFields[0]));
+
+const ModelSchema<Task> &Task::Schema() {
+  return kTaskSchema;
+}
+
+void Task::LoadFromJSONNode(JSONValue * const data) {
+  Schema().LoadFromJSONNode(data, this);
 }
 
 }   // namespace kopsik
@@ -5,7 +5,8 @@
 
 #include <string>
 
-#include "libjson.h" // NOLINT
+#include "./json_reader.h"
+#include "./model_schema.h"
 
 #include "Poco/Types.h"
 
@@ -17,12 +18,12 @@ namespace kopsik {
   public:
     Task()
       : BaseModel()
-      , name_("")
       , wid_(0)
-      , pid_(0) {}
+      , pid_(0)
+      , name_("") {}
 
-    std::string Name() const { return name_; }
-    void SetName(const std::string value);
+    const std::string &Name() const { return name_; }
+    void SetName(const std::string &value);
 
     Poco::UInt64 WID() const { return wid_; }
     void SetWID(const Poco::UInt64 value);
@@ -31,16 +32,23 @@ namespace kopsik {
     void SetPID(const Poco::UInt64 value);
 
     std::string String() const;
+    std::size_t MemoryBytes() const;
 
     std::string ModelName() const { return "task"; }
     std::string ModelURL() const { return "/api/v8/tasks"; }
 
-    void LoadFromJSONNode(JSONNODE * const);
+    // Fields as stored and sent, listed once
+    static const ModelSchema<Task> &Schema();
+
+    void LoadFromJSONNode(JSONValue * const);
+
+  protected:
+    bool namedInLabels() const { return true; }
 
   private:
-    std::string name_;
     Poco::UInt64 wid_;
     Poco::UInt64 pid_;
+    std::string name_;
   };
 
 }  // namespace kopsik
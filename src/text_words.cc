@@ -0,0 +1,25 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./text_words.h"
+
+namespace kopsik {
+
+bool IsWordChar(const char c) {
+  unsigned char u = static_cast<unsigned char>(c);
+  return u >= 0x80 || isalnum(u);
+}
+
+void SplitWords(const std::string &text, std::vector<std::string> *words) {
+  std::string::size_type start = std::string::npos;
+  for (std::string::size_type i = 0; i <= text.size(); i++) {
+    bool word_char = i < text.size() && IsWordChar(text[i]);
+    if (word_char && start == std::string::npos) {
+      start = i;
+    } else if (!word_char && start != std::string::npos) {
+      words->push_back(text.substr(start, i - start));
+      start = std::string::npos;
+    }
+  }
+}
+
+}  // namespace kopsik
@@ -0,0 +1,21 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TEXT_WORDS_H_
+#define SRC_TEXT_WORDS_H_
+
+#include <cctype>
+#include <string>
+#include <vector>
+
+namespace kopsik {
+
+  // Bytes of multibyte UTF-8 characters count as letters
+  bool IsWordChar(const char c);
+
+  // Words of the text in the order they come, as they are written
+  void SplitWords(const std::string &text,
+                         std::vector<std::string> *words);
+
+}  // namespace kopsik
+
+#endif  // SRC_TEXT_WORDS_H_
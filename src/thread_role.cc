@@ -0,0 +1,37 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./thread_role.h"
+
+namespace kopsik {
+
+void SetCurrentThreadRole(const ThreadRole role) {
+#if POCO_OS == POCO_OS_MAC_OS_X && defined(MAC_OS_X_VERSION_10_10)
+  qos_class_t qos = QOS_CLASS_USER_INITIATED;
+  if (kThreadUtility == role) {
+    qos = QOS_CLASS_UTILITY;
+  } else if (kThreadBackground == role) {
+    qos = QOS_CLASS_BACKGROUND;
+  }
+  pthread_set_qos_class_self_np(qos, 0);
+#elif POCO_OS == POCO_OS_LINUX
+  int nice = 0;
+  if (kThreadUtility == role) {
+    nice = kThreadUtilityNice;
+  } else if (kThreadBackground == role) {
+    nice = kThreadBackgroundNice;
+  }
+  setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), nice);
+#elif defined(POCO_OS_FAMILY_WINDOWS)
+  int priority = THREAD_PRIORITY_NORMAL;
+  if (kThreadUtility == role) {
+    priority = THREAD_PRIORITY_BELOW_NORMAL;
+  } else if (kThreadBackground == role) {
+    priority = THREAD_PRIORITY_LOWEST;
+  }
+  SetThreadPriority(GetCurrentThread(), priority);
+#else
+  (void)role;
+#endif
+}
+
+}  // namespace kopsik
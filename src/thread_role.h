@@ -0,0 +1,48 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_THREAD_ROLE_H_
+#define SRC_THREAD_ROLE_H_
+
+#include "Poco/Platform.h"
+
+#if POCO_OS == POCO_OS_MAC_OS_X
+#include <AvailabilityMacros.h>  // NOLINT
+#include <pthread.h>  // NOLINT
+#if defined(MAC_OS_X_VERSION_10_10)
+#include <pthread/qos.h>  // NOLINT
+#endif
+#elif POCO_OS == POCO_OS_LINUX
+#include <sys/resource.h>  // NOLINT
+#include <sys/syscall.h>  // NOLINT
+#include <unistd.h>  // NOLINT
+#elif defined(POCO_OS_FAMILY_WINDOWS)
+#include "Poco/UnWindows.h"
+#endif
+
+namespace kopsik {
+
+  // How much a thread's work matters to the user right now. Threads
+  // nobody is waiting for give way to the UI when the CPU is busy,
+  // so a heavy sync never makes the app stutter on a slow laptop.
+  enum ThreadRole {
+    // Edits being saved, things the user has just switched
+    kThreadInteractive,
+    // Sync, JSON decoding, WebSocket: wanted soon, but not waited on
+    kThreadUtility,
+    // Timeline recording and upload, database upkeep
+    kThreadBackground
+  };
+
+  // Nice level of each role on Linux, where a thread has its own
+  const int kThreadUtilityNice = 5;
+  const int kThreadBackgroundNice = 10;
+
+  // Gives the calling thread the role, through QoS classes on OS X,
+  // nice levels on Linux and thread priorities on Windows. Best
+  // effort: where the OS refuses, like a thread asking to be nicer
+  // than it's allowed, the thread keeps running as it was.
+  void SetCurrentThreadRole(const ThreadRole role);
+
+}  // namespace kopsik
+
+#endif  // SRC_THREAD_ROLE_H_
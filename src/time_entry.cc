@@ -7,14 +7,19 @@
 // needs to be recalculated after some user
 // action, the recalculation should be started
 // from context, using specific functions, not
-// setters.
+// setters. Keeping the day totals up to date
+// is bookkeeping like SetDirty, not a recalculation.
 
 #include "./time_entry.h"
 
 #include <sstream>
 
+#include "./day_totals.h"
 #include "./formatter.h"
 #include "./json.h"
+#include "./json_key.h"
+#include "./log.h"
+#include "./memory_usage.h"
 
 #include "Poco/Timestamp.h"
 #include "Poco/DateTime.h"
@@ -22,6 +27,8 @@
 
 namespace kopsik {
 
+static LogComponent log_json = { "json", 0 };
+
 void TimeEntry::StopAt(const Poco::Int64 at) {
     poco_assert(at);
     SetDurationInSeconds(at + DurationInSeconds());
@@ -34,7 +41,7 @@ std::string TimeEntry::String() const {
     std::stringstream ss;
     ss  << "ID=" << ID()
         << " local_id=" << LocalID()
-        << " description=" << description_
+        << " description=" << *description_
         << " wid=" << wid_
         << " guid=" << GUID()
         << " pid=" << pid_
@@ -52,60 +59,80 @@ std::string TimeEntry::String() const {
     return ss.str();
 }
 
+std::size_t TimeEntry::MemoryBytes() const {
+    // The description is counted with the table
+    std::size_t bytes = sizeof(*this) + ownedBytes() + VectorBytes(tag_ids_);
+    if (cold_) {
+        bytes += sizeof(*cold_)
+            + StringBytes(cold_->CreatedWith)
+            + StringBytes(cold_->ProjectGUID);
+    }
+    return bytes;
+}
+
 void TimeEntry::SetDurOnly(const bool value) {
     if (duronly_ != value) {
         duronly_ = value;
-        SetDirty();
+        SetDirty(kFieldDurOnly);
     }
 }
 
 void TimeEntry::SetStart(const Poco::UInt64 value) {
     if (start_ != value) {
         start_ = value;
-        SetDirty();
+        day_ = value ? DayTotals::DayOf(value) : 0;
+        SetDirty(kFieldStart);
+        recount();
     }
 }
 
 void TimeEntry::SetStop(const Poco::UInt64 value) {
     if (stop_ != value) {
         stop_ = value;
-        SetDirty();
+        SetDirty(kFieldStop);
     }
 }
 
-void TimeEntry::SetDescription(const std::string value) {
-    if (description_ != value) {
-        description_ = value;
-        SetDirty();
+void TimeEntry::SetDescription(const std::string &value) {
+    if (*description_ != value) {
+        description_ = StringTable::Descriptions().Intern(value);
+        SetDirty(kFieldDescription);
     }
 }
 
-void TimeEntry::SetStopString(const std::string value) {
+void TimeEntry::SetStopString(const std::string &value) {
     SetStop(Formatter::Parse8601(value));
 }
 
-void TimeEntry::SetCreatedWith(const std::string value) {
-    if (created_with_ != value) {
-        created_with_ = value;
-        SetDirty();
+TimeEntry::ColdFields *TimeEntry::cold() {
+    if (!cold_) {
+        cold_ = new ColdFields();
+    }
+    return cold_;
+}
+
+void TimeEntry::SetCreatedWith(const std::string &value) {
+    if (CreatedWith() != value) {
+        cold()->CreatedWith = value;
+        SetDirty(kFieldCreatedWith);
     }
 }
 
 void TimeEntry::SetBillable(const bool value) {
     if (billable_ != value) {
         billable_ = value;
-        SetDirty();
+        SetDirty(kFieldBillable);
     }
 }
 
 void TimeEntry::SetWID(const Poco::UInt64 value) {
     if (wid_ != value) {
         wid_ = value;
-        SetDirty();
+        SetDirty(kFieldWID);
     }
 }
 
-void TimeEntry::SetStopUserInput(const std::string value) {
+void TimeEntry::SetStopUserInput(const std::string &value) {
   SetStopString(value);
 
   if (Stop() < Start()) {
@@ -124,40 +151,116 @@ void TimeEntry::SetStopUserInput(const std::string value) {
 void TimeEntry::SetTID(const Poco::UInt64 value) {
     if (tid_ != value) {
         tid_ = value;
-        SetDirty();
+        SetDirty(kFieldTID);
+    }
+}
+
+void TimeEntry::SetTagIDs(const std::vector<TagID> &value) {
+    if (tag_ids_ != value) {
+        tag_ids_ = value;
+        SetDirty(kFieldTags);
     }
 }
 
+void TimeEntry::SetTagNames(const std::vector<std::string> &value) {
+    TagNameTable &table = TagNameTable::Shared();
+    std::vector<TagID> ids;
+    ids.reserve(value.size());
+    for (std::vector<std::string>::const_iterator it = value.begin();
+            it != value.end();
+            it++) {
+        ids.push_back(table.Intern(*it));
+    }
+    SetTagIDs(ids);
+}
+
 void TimeEntry::SetTags(const std::string tags) {
-    if (Tags() != tags) {
-        TagNames.clear();
-        if (!tags.empty()) {
-          std::stringstream ss(tags);
-          while (ss.good()) {
-              std::string tag;
-              getline(ss, tag, '|');
-              TagNames.push_back(tag);
-          }
+    TagNameTable &table = TagNameTable::Shared();
+    std::vector<TagID> ids;
+    if (!tags.empty()) {
+        std::string::size_type from(0);
+        while (true) {
+            std::string::size_type to = tags.find('|', from);
+            if (to == std::string::npos) {
+                ids.push_back(table.Intern(tags.substr(from)));
+                break;
+            }
+            ids.push_back(table.Intern(tags.substr(from, to - from)));
+            from = to + 1;
         }
-        SetDirty();
     }
+    SetTagIDs(ids);
 }
 
 void TimeEntry::SetPID(const Poco::UInt64 value) {
     if (pid_ != value) {
         pid_ = value;
-        SetDirty();
+        SetDirty(kFieldPID);
     }
 }
 
 void TimeEntry::SetDurationInSeconds(const Poco::Int64 value) {
     if (duration_in_seconds_ != value) {
         duration_in_seconds_ = value;
-        SetDirty();
+        SetDirty(kFieldDuration);
+        recount();
+    }
+}
+
+void TimeEntry::SetDayTotals(DayTotals *value) {
+    if (day_totals_ == value) {
+        return;
+    }
+    if (day_totals_) {
+        uncount();
+        day_totals_->Unregister();
+    }
+    day_totals_ = value;
+    if (day_totals_) {
+        day_totals_->Register();
+        count();
     }
 }
 
-void TimeEntry::SetStartUserInput(const std::string value) {
+void TimeEntry::uncount() {
+    if (counted_) {
+        day_totals_->Remove(counted_day_, counted_seconds_);
+        counted_ = false;
+    }
+    if (counted_running_) {
+        day_totals_->RemoveRunning(this);
+        counted_running_ = false;
+    }
+    day_totals_->RemoveStarted(counted_start_, this);
+}
+
+// Only entries that are listed count, running ones are kept apart.
+// Every entry counts by its start.
+void TimeEntry::count() {
+    counted_start_ = start_;
+    day_totals_->AddStarted(counted_start_, this);
+    if (duration_in_seconds_ < 0) {
+        day_totals_->AddRunning(this);
+        counted_running_ = true;
+        return;
+    }
+    if (DeletedAt() || !day_) {
+        return;
+    }
+    counted_day_ = day_;
+    counted_seconds_ = duration_in_seconds_;
+    day_totals_->Add(counted_day_, counted_seconds_);
+    counted_ = true;
+}
+
+void TimeEntry::recount() {
+    if (day_totals_) {
+        uncount();
+        count();
+    }
+}
+
+void TimeEntry::SetStartUserInput(const std::string &value) {
     Poco::Int64 start = Formatter::Parse8601(value);
     if (IsTracking()) {
         SetDurationInSeconds(-start);
@@ -167,11 +270,11 @@ void TimeEntry::SetStartUserInput(const std::string value) {
     SetStart(start);
 }
 
-void TimeEntry::SetStartString(const std::string value) {
+void TimeEntry::SetStartString(const std::string &value) {
     SetStart(Formatter::Parse8601(value));
 }
 
-void TimeEntry::SetDurationUserInput(const std::string value) {
+void TimeEntry::SetDurationUserInput(const std::string &value) {
     int seconds = Formatter::ParseDurationString(value);
     if (duration_in_seconds_ < 0) {
         time_t now = time(0);
@@ -184,29 +287,42 @@ void TimeEntry::SetDurationUserInput(const std::string value) {
     }
 }
 
-void TimeEntry::SetProjectGUID(const std::string value) {
-    if (project_guid_ != value) {
-        project_guid_ = value;
-        SetDirty();
+void TimeEntry::SetProjectGUID(const std::string &value) {
+    if (ProjectGUID() != value) {
+        cold()->ProjectGUID = value;
+        SetDirty(kFieldProjectGUID);
     }
 }
 
+std::vector<std::string> TimeEntry::TagNames() const {
+    TagNameTable &table = TagNameTable::Shared();
+    std::vector<std::string> names;
+    names.reserve(tag_ids_.size());
+    for (std::vector<TagID>::const_iterator it = tag_ids_.begin();
+            it != tag_ids_.end();
+            it++) {
+        names.push_back(table.Name(*it));
+    }
+    return names;
+}
+
 std::string TimeEntry::Tags() const {
-    std::stringstream ss;
-    for (std::vector<std::string>::const_iterator it =
-            TagNames.begin();
-            it != TagNames.end();
+    TagNameTable &table = TagNameTable::Shared();
+    std::string tags;
+    for (std::vector<TagID>::const_iterator it = tag_ids_.begin();
+            it != tag_ids_.end();
             it++) {
-        if (it != TagNames.begin()) {
-            ss << "|";
+        if (it != tag_ids_.begin()) {
+            tags += '|';
         }
-        ss << *it;
+        tags += table.Name(*it);
     }
-    return ss.str();
+    return tags;
 }
 
 std::string TimeEntry::DateHeaderString() const {
-    return Formatter::FormatDateHeader(start_);
+    poco_assert(day_);
+    return DayTotals::DateHeader(day_);
 }
 
 std::string TimeEntry::DurationString() const {
@@ -222,65 +338,57 @@ std::string TimeEntry::StartString() const {
 }
 
 bool TimeEntry::IsToday() const {
-  Poco::Timestamp ts = Poco::Timestamp::fromEpochTime(Start());
-  Poco::LocalDateTime datetime(ts);
-  Poco::LocalDateTime today;
-  return today.year() == datetime.year() &&
-      today.month() == datetime.month() &&
-      today.day() == datetime.day();
+  return day_ == DayTotals::DayOf(time(0));
 }
 
 bool CompareTimeEntriesByStart(TimeEntry *a, TimeEntry *b) {
     return a->Start() > b->Start();
 }
 
-void TimeEntry::LoadFromJSONNode(JSONNODE * const data) {
+void TimeEntry::LoadFromJSONNode(JSONValue * const data) {
   poco_assert(data);
 
   Poco::UInt64 ui_modified_at =
       GetUIModifiedAtFromJSONNode(data);
   if (UIModifiedAt() > ui_modified_at) {
-      Poco::Logger &logger = Poco::Logger::get("json");
-      std::stringstream ss;
-      ss  << "Will not overwrite time entry "
-          << String()
-          << " with server data because we have a ui_modified_at";
-      logger.debug(ss.str());
+      Poco::Logger &logger = ComponentLogger(&log_json);
+      KOPSIK_LOG_DEBUG(logger, "Will not overwrite time entry " << String()
+          << " with server data because we have a ui_modified_at");
       return;
   }
 
-  JSONNODE_ITERATOR current_node = json_begin(data);
-  JSONNODE_ITERATOR last_node = json_end(data);
+  JSONIterator current_node = JSONBegin(data);
+  JSONIterator last_node = JSONEnd(data);
   while (current_node != last_node) {
-    json_char *node_name = json_name(*current_node);
-    if (strcmp(node_name, "id") == 0) {
-      SetID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "description") == 0) {
-      SetDescription(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "guid") == 0) {
-      SetGUID(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "wid") == 0) {
-      SetWID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "pid") == 0) {
-      SetPID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "tid") == 0) {
-      SetTID(json_as_int(*current_node));
-    } else if (strcmp(node_name, "start") == 0) {
-      SetStartString(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "stop") == 0) {
-      SetStopString(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "duration") == 0) {
-      SetDurationInSeconds(json_as_int(*current_node));
-    } else if (strcmp(node_name, "billable") == 0) {
-      SetBillable(json_as_bool(*current_node));
-    } else if (strcmp(node_name, "duronly") == 0) {
-      SetDurOnly(json_as_bool(*current_node));
-    } else if (strcmp(node_name, "tags") == 0) {
+    JSONKey key = JSONNodeKey(*current_node);
+    if (kJSONKeyID == key) {
+      SetID(JSONInt(*current_node));
+    } else if (kJSONKeyDescription == key) {
+      SetDescription(JSONString(*current_node));
+    } else if (kJSONKeyGUID == key) {
+      SetGUID(JSONString(*current_node));
+    } else if (kJSONKeyWID == key) {
+      SetWID(JSONInt(*current_node));
+    } else if (kJSONKeyPID == key) {
+      SetPID(JSONInt(*current_node));
+    } else if (kJSONKeyTID == key) {
+      SetTID(JSONInt(*current_node));
+    } else if (kJSONKeyStart == key) {
+      SetStartString(JSONString(*current_node));
+    } else if (kJSONKeyStop == key) {
+      SetStopString(JSONString(*current_node));
+    } else if (kJSONKeyDuration == key) {
+      SetDurationInSeconds(JSONInt(*current_node));
+    } else if (kJSONKeyBillable == key) {
+      SetBillable(JSONBool(*current_node));
+    } else if (kJSONKeyDuronly == key) {
+      SetDurOnly(JSONBool(*current_node));
+    } else if (kJSONKeyTags == key) {
       loadTagsFromJSONNode(*current_node);
-    } else if (strcmp(node_name, "created_with") == 0) {
-      SetCreatedWith(std::string(json_as_string(*current_node)));
-    } else if (strcmp(node_name, "at") == 0) {
-      SetUpdatedAtString(std::string(json_as_string(*current_node)));
+    } else if (kJSONKeyCreatedWith == key) {
+      SetCreatedWith(JSONString(*current_node));
+    } else if (kJSONKeyAt == key) {
+      SetUpdatedAtString(JSONString(*current_node));
     }
     ++current_node;
   }
@@ -288,20 +396,23 @@ void TimeEntry::LoadFromJSONNode(JSONNODE * const data) {
   SetUIModifiedAt(0);
 }
 
-void TimeEntry::loadTagsFromJSONNode(JSONNODE * const list) {
+void TimeEntry::loadTagsFromJSONNode(JSONValue * const list) {
   poco_assert(list);
 
-  TagNames.clear();
+  TagNameTable &table = TagNameTable::Shared();
+  std::vector<TagID> ids;
 
-  JSONNODE_ITERATOR current_node = json_begin(list);
-  JSONNODE_ITERATOR last_node = json_end(list);
+  JSONIterator current_node = JSONBegin(list);
+  JSONIterator last_node = JSONEnd(list);
   while (current_node != last_node) {
-    std::string tag = std::string(json_as_string(*current_node));
+    std::string tag = JSONString(*current_node);
     if (!tag.empty()) {
-      TagNames.push_back(tag);
+      ids.push_back(table.Intern(tag));
     }
     ++current_node;
   }
+
+  SetTagIDs(ids);
 }
 
 }   // namespace kopsik
@@ -8,30 +8,65 @@
 
 #include "./types.h"
 #include "./base_model.h"
+#include "./string_table.h"
+#include "./tag_names.h"
 
 #include "Poco/Types.h"
 
 namespace kopsik {
 
+  class DayTotals;
+
   class TimeEntry : public BaseModel {
   public:
     TimeEntry()
       : BaseModel()
+      , day_(0)
+      , billable_(false)
+      , duronly_(false)
+      , counted_(false)
+      , counted_running_(false)
+      , counted_day_(0)
       , wid_(0)
       , pid_(0)
       , tid_(0)
-      , billable_(false)
       , start_(0)
       , stop_(0)
       , duration_in_seconds_(0)
-      , description_("")
-      , duronly_(false)
-      , created_with_("")
-      , project_guid_("") {}
-    virtual ~TimeEntry() {}
-
-    std::vector<std::string> TagNames;
-
+      , day_totals_(0)
+      , counted_seconds_(0)
+      , counted_start_(0)
+      , description_(StringTable::Descriptions().Intern(""))
+      , cold_(0) {}
+    virtual ~TimeEntry() {
+      SetDayTotals(0);
+      delete cold_;
+    }
+
+    // Bits of DirtyFields, one per column
+    enum TimeEntryField {
+      kFieldDescription = kFieldModel << 0,
+      kFieldWID = kFieldModel << 1,
+      kFieldPID = kFieldModel << 2,
+      kFieldTID = kFieldModel << 3,
+      kFieldBillable = kFieldModel << 4,
+      kFieldDurOnly = kFieldModel << 5,
+      kFieldStart = kFieldModel << 6,
+      kFieldStop = kFieldModel << 7,
+      kFieldDuration = kFieldModel << 8,
+      kFieldTags = kFieldModel << 9,
+      kFieldCreatedWith = kFieldModel << 10,
+      kFieldProjectGUID = kFieldModel << 11
+    };
+
+    // Tags as interned names, see TagNameTable
+    const std::vector<TagID> &TagIDs() const { return tag_ids_; }
+    void SetTagIDs(const std::vector<TagID> &value);
+
+    std::vector<std::string> TagNames() const;
+    void SetTagNames(const std::vector<std::string> &value);
+
+    // Tag names joined with |, as stored in the database
     std::string Tags() const;
     void SetTags(const std::string tags);
 
@@ -55,67 +90,115 @@ namespace kopsik {
     bool DurOnly() const { return duronly_; }
     void SetDurOnly(const bool value);
 
-    std::string Description() const { return description_; }
-    void SetDescription(const std::string value);
+    const std::string &Description() const { return *description_; }
+    // One string for all time entries with the same description, so
+    // comparing these compares the descriptions
+    const SharedString &SharedDescription() const { return description_; }
+    void SetDescription(const std::string &value);
 
     std::string StartString() const;
-    void SetStartString(const std::string value);
+    void SetStartString(const std::string &value);
 
     Poco::UInt64 Start() const { return start_; }
     void SetStart(const Poco::UInt64 value);
 
+    // Local time day of the start, see DayTotals::DayOf.
+    // It's 0 while there is no start.
+    int Day() const { return day_; }
+
+    // In loops, format headers with a DateHeaderCache instead
     std::string DateHeaderString() const;
 
     std::string StopString() const;
-    void SetStopString(const std::string value);
+    void SetStopString(const std::string &value);
 
     Poco::UInt64 Stop() { return stop_; }
     void SetStop(const Poco::UInt64 value);
 
-    std::string CreatedWith() const { return created_with_; }
-    void SetCreatedWith(const std::string value);
+    const std::string &CreatedWith() const {
+      return cold_ ? cold_->CreatedWith : empty_string_;
+    }
+    void SetCreatedWith(const std::string &value);
 
     void StopAt(const Poco::Int64);
 
     std::string String() const;
+    std::size_t MemoryBytes() const;
 
     bool IsToday() const;
 
-    std::string ProjectGUID() const { return project_guid_; }
-    void SetProjectGUID(const std::string);
+    // Set while the project is only known by its GUID, as it has not
+    // been pushed yet
+    const std::string &ProjectGUID() const {
+      return cold_ ? cold_->ProjectGUID : empty_string_;
+    }
+    void SetProjectGUID(const std::string &);
 
     std::string ModelName() const { return "time_entry"; }
     std::string ModelURL() const { return "/api/v8/time_entries"; }
 
-    void LoadFromJSONNode(JSONNODE * const);
+    void LoadFromJSONNode(JSONValue * const);
 
     // User-triggered changes to timer:
-    void SetDurationUserInput(const std::string);
-    void SetStopUserInput(const std::string);
-    void SetStartUserInput(const std::string);
+    void SetDurationUserInput(const std::string &);
+    void SetStopUserInput(const std::string &);
+    void SetStartUserInput(const std::string &);
 
     bool IsTracking() const { return duration_in_seconds_ < 0; }
 
+    // Day totals the time entry keeps its duration counted in,
+    // see RelatedData::Track.
+    DayTotals *GetDayTotals() const { return day_totals_; }
+    void SetDayTotals(DayTotals *value);
+
+  protected:
+    void deletedAtChanged() { recount(); }
+
   private:
+    // Strings that are only needed for saving and pushing,
+    // kept apart like those of BaseModel
+    struct ColdFields {
+      std::string CreatedWith;
+      std::string ProjectGUID;
+    };
+    // Allocated when one of its fields is first set
+    ColdFields *cold();
+
+    // Small fields first, into the padding BaseModel ends with
+    int day_;
+    bool billable_;
+    bool duronly_;
+    // What the time entry has added to day_totals_, along with
+    // the counted_ fields below
+    bool counted_;
+    bool counted_running_;
+    int counted_day_;
+
+    // What lists, filters and day totals read
     Poco::UInt64 wid_;
     Poco::UInt64 pid_;
     Poco::UInt64 tid_;
-    bool billable_;
     Poco::UInt64 start_;
     Poco::UInt64 stop_;
     Poco::Int64 duration_in_seconds_;
-    std::string description_;
-    bool duronly_;
-    std::string created_with_;
-    std::string project_guid_;
+    DayTotals *day_totals_;
+    Poco::Int64 counted_seconds_;
+    Poco::UInt64 counted_start_;
+
+    // Interned, see StringTable::Descriptions
+    SharedString description_;
+    std::vector<TagID> tag_ids_;
+    ColdFields *cold_;
+
+    void uncount();
+    void count();
+    void recount();
 
     bool setDurationStringHHMMSS(const std::string value);
     bool setDurationStringHHMM(const std::string value);
     bool setDurationStringMMSS(const std::string value);
 
-    void loadTagsFromJSONNode(JSONNODE * const);
-
-    Poco::Logger &logger() { return Poco::Logger::get("time_entry"); }
+    void loadTagsFromJSONNode(JSONValue * const);
   };
 
   bool CompareTimeEntriesByStart(TimeEntry *a, TimeEntry *b);
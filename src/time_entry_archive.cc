@@ -0,0 +1,173 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./time_entry_archive.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "Poco/DateTime.h"
+#include "Poco/StreamCopier.h"
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+int TimeEntryArchive::MonthOf(const Poco::UInt64 start) {
+  Poco::DateTime date(Poco::Timestamp::fromEpochTime(
+    static_cast<time_t>(start)));
+  return date.year() * 100 + date.month();
+}
+
+error TimeEntryArchive::Pack(
+    std::vector<TimeEntry *> *list, std::string *blob) {
+  poco_assert(list);
+  poco_assert(blob);
+
+  std::sort(list->begin(), list->end(), startedBefore);
+
+  std::string buffer("");
+  putVarInt(&buffer, kTimeEntryArchiveVersion);
+  putVarInt(&buffer, list->size());
+  Poco::UInt64 previous_start(0);
+  for (std::vector<TimeEntry *>::const_iterator it = list->begin();
+      it != list->end();
+      it++) {
+    TimeEntry *te = *it;
+    putVarInt(&buffer, te->Start() - previous_start);
+    previous_start = te->Start();
+    putVarInt(&buffer, te->Stop());
+    putVarInt(&buffer, static_cast<Poco::UInt64>(te->DurationInSeconds()));
+    putVarInt(&buffer, te->ID());
+    putVarInt(&buffer, te->WID());
+    putVarInt(&buffer, te->PID());
+    putVarInt(&buffer, te->TID());
+    putVarInt(&buffer, (te->Billable() ? 1 : 0) | (te->DurOnly() ? 2 : 0));
+    putVarInt(&buffer, te->UpdatedAt());
+    putString(&buffer, te->GUID());
+    putString(&buffer, te->Description());
+    putString(&buffer, te->Tags());
+    putString(&buffer, te->ProjectGUID());
+    putString(&buffer, te->CreatedWith());
+  }
+
+  try {
+    std::ostringstream out;
+    Poco::DeflatingOutputStream deflater(out,
+      Poco::DeflatingStreamBuf::STREAM_ZLIB, Z_BEST_COMPRESSION);
+    deflater.write(buffer.data(), buffer.size());
+    deflater.close();
+    *blob = out.str();
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  }
+  return noError;
+}
+
+error TimeEntryArchive::Unpack(
+    const std::string &blob, const Poco::UInt64 uid,
+    std::vector<TimeEntry *> *list) {
+  poco_assert(list);
+
+  std::string buffer("");
+  try {
+    std::istringstream in(blob);
+    Poco::InflatingInputStream inflater(in,
+      Poco::InflatingStreamBuf::STREAM_ZLIB);
+    Poco::StreamCopier::copyToString(inflater, buffer);
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  }
+
+  Reader reader(buffer);
+  if (reader.VarInt() != kTimeEntryArchiveVersion) {
+    return error("Archived time entries have an unknown layout");
+  }
+  std::vector<TimeEntry *> unpacked;
+  Poco::UInt64 count = reader.VarInt();
+  Poco::UInt64 start(0);
+  for (Poco::UInt64 i = 0; i < count && reader.Ok(); i++) {
+    TimeEntry *te = new TimeEntry();
+    te->SetUID(uid);
+    start += reader.VarInt();
+    te->SetStart(start);
+    te->SetStop(reader.VarInt());
+    te->SetDurationInSeconds(static_cast<Poco::Int64>(reader.VarInt()));
+    te->SetID(reader.VarInt());
+    te->SetWID(reader.VarInt());
+    te->SetPID(reader.VarInt());
+    te->SetTID(reader.VarInt());
+    Poco::UInt64 flags = reader.VarInt();
+    te->SetBillable(0 != (flags & 1));
+    te->SetDurOnly(0 != (flags & 2));
+    te->SetUpdatedAt(reader.VarInt());
+    te->SetGUID(reader.String());
+    te->SetDescription(reader.String());
+    te->SetTags(reader.String());
+    te->SetProjectGUID(reader.String());
+    te->SetCreatedWith(reader.String());
+    te->ClearDirty();
+    unpacked.push_back(te);
+  }
+  if (!reader.Ok() || !reader.AtEnd()) {
+    for (std::size_t i = 0; i < unpacked.size(); i++) {
+      delete unpacked[i];
+    }
+    return error("Archived time entries are damaged");
+  }
+  list->insert(list->end(), unpacked.begin(), unpacked.end());
+  return noError;
+}
+
+TimeEntryArchive::Reader::Reader(const std::string &buffer)
+  : buffer_(buffer), pos_(0), ok_(true) {}
+
+Poco::UInt64 TimeEntryArchive::Reader::VarInt() {
+  Poco::UInt64 value(0);
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos_ >= buffer_.size()) {
+      ok_ = false;
+      return 0;
+    }
+    unsigned char byte = static_cast<unsigned char>(buffer_[pos_++]);
+    value |= static_cast<Poco::UInt64>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  ok_ = false;
+  return 0;
+}
+
+std::string TimeEntryArchive::Reader::String() {
+  Poco::UInt64 size = VarInt();
+  if (!ok_ || buffer_.size() - pos_ < size) {
+    ok_ = false;
+    return "";
+  }
+  pos_ += static_cast<std::size_t>(size);
+  return buffer_.substr(pos_ - static_cast<std::size_t>(size),
+                        static_cast<std::size_t>(size));
+}
+
+bool TimeEntryArchive::startedBefore(TimeEntry *a, TimeEntry *b) {
+  return a->Start() < b->Start();
+}
+
+void TimeEntryArchive::putVarInt(std::string *buffer, Poco::UInt64 value) {
+  while (value >= 0x80) {
+    buffer->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  buffer->push_back(static_cast<char>(value));
+}
+
+void TimeEntryArchive::putString(
+    std::string *buffer, const std::string &value) {
+  putVarInt(buffer, value.size());
+  buffer->append(value);
+}
+
+}  // namespace kopsik
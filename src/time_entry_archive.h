@@ -0,0 +1,68 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIME_ENTRY_ARCHIVE_H_
+#define SRC_TIME_ENTRY_ARCHIVE_H_
+
+#include <string>
+#include <vector>
+
+#include "./types.h"
+#include "./time_entry.h"
+
+#include "Poco/DeflatingStream.h"
+#include "Poco/InflatingStream.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Bumped whenever the layout changes; older blobs are refused
+  const Poco::UInt32 kTimeEntryArchiveVersion = 1;
+
+  // Closed time entries nobody edits anymore are moved out of
+  // time_entries into one row of time_entries_archive per user and
+  // month. A row holds the month's entries packed into a deflated
+  // blob: variable length integers, starts as differences from the
+  // one before, tags as they're saved. Local fields (local_id,
+  // ui_modified_at, deleted_at) aren't kept, an archived entry has
+  // nothing to push.
+  class TimeEntryArchive {
+  public:
+    // Month the entry is archived in, yyyymm in UTC
+    static int MonthOf(const Poco::UInt64 start);
+
+    // Entries are written by start; list is sorted along the way
+    static error Pack(std::vector<TimeEntry *> *list, std::string *blob);
+
+    // New models of the entries in the blob, of user uid
+    static error Unpack(
+        const std::string &blob,
+        const Poco::UInt64 uid,
+        std::vector<TimeEntry *> *list);
+
+  private:
+    // Reading past the end gives zeroes and makes Ok false
+    class Reader {
+    public:
+      explicit Reader(const std::string &buffer);
+
+      bool Ok() const { return ok_; }
+      bool AtEnd() const { return pos_ == buffer_.size(); }
+
+      Poco::UInt64 VarInt();
+      std::string String();
+
+    private:
+      const std::string &buffer_;
+      std::size_t pos_;
+      bool ok_;
+    };
+
+    static bool startedBefore(TimeEntry *a, TimeEntry *b);
+
+    static void putVarInt(std::string *buffer, Poco::UInt64 value);
+    static void putString(std::string *buffer, const std::string &value);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIME_ENTRY_ARCHIVE_H_
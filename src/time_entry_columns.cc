@@ -0,0 +1,108 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./time_entry_columns.h"
+
+namespace kopsik {
+
+std::size_t TimeEntryFieldCopy::Running() const {
+  std::size_t i = 0;
+  while (i < Durations.size() && Durations[i] >= 0) {
+    i++;
+  }
+  return i;
+}
+
+bool TimeEntryFieldCopy::Listed(const std::size_t i) const {
+  return Durations[i] >= 0 && !DeletedAts[i];
+}
+
+Poco::Int64 TimeEntryFieldCopy::DaySeconds(const int day) const {
+  Poco::Int64 seconds(0);
+  for (std::size_t i = 0; i < Days.size(); i++) {
+    if (Days[i] == day && Durations[i] > 0) {
+      seconds += Durations[i];
+    }
+  }
+  return seconds;
+}
+
+std::size_t TimeEntryFieldCopy::MemoryBytes() const {
+  return sizeof(*this)
+    + VectorBytes(Starts)
+    + VectorBytes(Days)
+    + VectorBytes(Durations)
+    + VectorBytes(DeletedAts)
+    + VectorBytes(WIDs)
+    + VectorBytes(PIDs)
+    + VectorBytes(NeedsPush);
+}
+
+TimeEntryColumns::TimeEntryColumns(
+    const std::vector<TimeEntry *> &list,
+    const Generation &generation)
+  : list_(list)
+  , generation_(generation)
+  , copied_generation_(0) {}
+
+bool TimeEntryColumns::current() const {
+  if (copy_.isNull()
+      || copied_generation_ != generation_.Value()
+      || rows_.size() != list_.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < rows_.size(); i++) {
+    if (rows_[i] != list_[i] || list_[i]->ListGeneration() != &generation_) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TimeEntryFieldsPtr TimeEntryColumns::Refresh() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  if (current()) {
+    return copy_;
+  }
+  int generation = generation_.Value();
+  std::size_t size = list_.size();
+  TimeEntryFieldCopy *copy = new TimeEntryFieldCopy();
+  copy->Starts.resize(size);
+  copy->Days.resize(size);
+  copy->Durations.resize(size);
+  copy->DeletedAts.resize(size);
+  copy->WIDs.resize(size);
+  copy->PIDs.resize(size);
+  copy->NeedsPush.resize(size);
+  for (std::size_t i = 0; i < size; i++) {
+    const TimeEntry *te = list_[i];
+    copy->Starts[i] = te->Start();
+    copy->Days[i] = te->Day();
+    copy->Durations[i] = te->DurationInSeconds();
+    copy->DeletedAts[i] = te->DeletedAt();
+    copy->WIDs[i] = te->WID();
+    copy->PIDs[i] = te->PID();
+    copy->NeedsPush[i] = te->NeedsPush();
+  }
+  // Readers still scanning the old copy keep it until they're done
+  copy_ = copy;
+  rows_ = list_;
+  copied_generation_ = generation;
+  return copy_;
+}
+
+void TimeEntryColumns::Clear() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  rows_.clear();
+  copy_ = 0;
+}
+
+std::size_t TimeEntryColumns::MemoryBytes() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  std::size_t bytes = VectorBytes(rows_);
+  if (!copy_.isNull()) {
+    bytes += copy_->MemoryBytes();
+  }
+  return bytes;
+}
+
+}  // namespace kopsik
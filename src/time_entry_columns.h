@@ -0,0 +1,87 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIME_ENTRY_COLUMNS_H_
+#define SRC_TIME_ENTRY_COLUMNS_H_
+
+#include <vector>
+
+#include "./base_model.h"
+#include "./memory_usage.h"
+#include "./time_entry.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Copies of the time entry fields that filtering and totals look at,
+  // stored column by column in the order of the time entry list, so
+  // scans over them are linear passes over plain arrays instead of
+  // visits to every time entry. A copy never changes once made, so
+  // readers can scan it while another reader refreshes.
+  class TimeEntryFieldCopy {
+  public:
+    // Position of the first running time entry, or the list size
+    std::size_t Running() const;
+
+    // Stopped and not deleted, as listed in the UI
+    bool Listed(const std::size_t i) const;
+
+    // Tracked time of the stopped entries of a day
+    Poco::Int64 DaySeconds(const int day) const;
+
+    std::size_t MemoryBytes() const;
+
+    std::vector<Poco::UInt64> Starts;
+    std::vector<int> Days;
+    std::vector<Poco::Int64> Durations;
+    std::vector<Poco::UInt64> DeletedAts;
+    std::vector<Poco::UInt64> WIDs;
+    std::vector<Poco::UInt64> PIDs;
+    // Not vector<bool>, so the flags stay one per byte
+    std::vector<char> NeedsPush;
+  };
+
+  typedef Poco::SharedPtr<TimeEntryFieldCopy> TimeEntryFieldsPtr;
+
+  // Keeps a TimeEntryFieldCopy of the time entry list. The copy is
+  // made again when the list or its generation (see
+  // RelatedData::TimeEntryGeneration) has changed, or when the list
+  // holds untracked time entries, whose changes the generation
+  // doesn't show.
+  class TimeEntryColumns {
+  public:
+    TimeEntryColumns(
+      const std::vector<TimeEntry *> &list,
+      const Generation &generation);
+
+    // Call with the list locked at least for reading, and scan
+    // the copy returned while it's still locked. Readers may
+    // refresh at the same time.
+    TimeEntryFieldsPtr Refresh();
+
+    // Copies the fields again on next Refresh, even if nothing
+    // seems to have changed
+    void Clear();
+
+    std::size_t MemoryBytes();
+
+  private:
+    bool current() const;
+
+    const std::vector<TimeEntry *> &list_;
+    const Generation &generation_;
+    // The list the fields were copied from
+    std::vector<TimeEntry *> rows_;
+    int copied_generation_;
+    TimeEntryFieldsPtr copy_;
+    Poco::FastMutex mutex_;
+
+    TimeEntryColumns(const TimeEntryColumns &);
+    TimeEntryColumns &operator=(const TimeEntryColumns &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIME_ENTRY_COLUMNS_H_
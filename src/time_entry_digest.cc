@@ -0,0 +1,117 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./time_entry_digest.h"
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+#include "Poco/DigestEngine.h"
+#include "Poco/MD5Engine.h"
+
+namespace kopsik {
+
+void TimeEntryDigests::Compute(
+    const std::vector<TimeEntry *> &time_entries, const Poco::UInt64 since,
+    const Poco::UInt64 until, DayDigests *digests,
+    std::set<Poco::UInt64> *unsettled) {
+  typedef std::pair<Poco::UInt64, Poco::UInt64> IDAndAt;
+  std::map<Poco::UInt64, std::vector<IDAndAt> > days;
+  for (std::vector<TimeEntry *>::const_iterator it =
+        time_entries.begin();
+      it != time_entries.end();
+      it++) {
+    TimeEntry *te = *it;
+    if (te->Start() < since || te->Start() >= until) {
+      continue;
+    }
+    Poco::UInt64 day = te->Start() - te->Start() % kDigestDaySeconds;
+    if (!te->ID() || te->NeedsPush()) {
+      unsettled->insert(day);
+      continue;
+    }
+    if (te->DeletedAt() || te->IsMarkedAsDeletedOnServer()) {
+      continue;
+    }
+    days[day].push_back(IDAndAt(te->ID(), te->UpdatedAt()));
+  }
+
+  for (std::map<Poco::UInt64, std::vector<IDAndAt> >::iterator it =
+        days.begin();
+      it != days.end();
+      it++) {
+    std::sort(it->second.begin(), it->second.end());
+    Poco::MD5Engine md5;
+    for (std::vector<IDAndAt>::const_iterator entry = it->second.begin();
+        entry != it->second.end();
+        entry++) {
+      std::stringstream ss;
+      ss << entry->first << ":" << entry->second << "\n";
+      md5.update(ss.str());
+    }
+    (*digests)[it->first] = Poco::DigestEngine::digestToHex(md5.digest());
+  }
+}
+
+error TimeEntryDigests::Parse(const std::string &json, DayDigests *digests) {
+  JSONValue *root = JSONParse(json);
+  if (!root || JSONTypeOf(root) != kJSONArray) {
+    if (root) {
+      JSONDelete(root);
+    }
+    return error("Invalid time entry digests");
+  }
+  for (std::size_t i = 0; i < JSONSize(root); i++) {
+    JSONValue *item = JSONAt(root, i);
+    JSONValue *day = JSONGet(item, "day");
+    JSONValue *digest = JSONGet(item, "digest");
+    if (day && digest) {
+      (*digests)[JSONInt(day)] = JSONString(digest);
+    }
+  }
+  JSONDelete(root);
+  return noError;
+}
+
+void TimeEntryDigests::Mismatched(
+    const DayDigests &local, const DayDigests &remote,
+    const std::set<Poco::UInt64> &unsettled, const Poco::UInt64 since,
+    const Poco::UInt64 until, std::vector<TimeEntryRange> *ranges) {
+  std::set<Poco::UInt64> differing;
+  for (DayDigests::const_iterator it = local.begin();
+      it != local.end();
+      it++) {
+    DayDigests::const_iterator other = remote.find(it->first);
+    if (other == remote.end() || other->second != it->second) {
+      differing.insert(it->first);
+    }
+  }
+  for (DayDigests::const_iterator it = remote.begin();
+      it != remote.end();
+      it++) {
+    if (local.find(it->first) == local.end()) {
+      differing.insert(it->first);
+    }
+  }
+
+  for (std::set<Poco::UInt64>::const_iterator it = differing.begin();
+      it != differing.end();
+      it++) {
+    if (unsettled.count(*it)) {
+      continue;
+    }
+    TimeEntryRange range;
+    range.since = std::max(*it, since);
+    range.until = std::min(*it + kDigestDaySeconds, until);
+    if (range.since >= range.until) {
+      continue;
+    }
+    if (!ranges->empty() && ranges->back().until == range.since) {
+      ranges->back().until = range.until;
+    } else {
+      ranges->push_back(range);
+    }
+  }
+}
+
+}  // namespace kopsik
@@ -0,0 +1,60 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIME_ENTRY_DIGEST_H_
+#define SRC_TIME_ENTRY_DIGEST_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "./database.h"
+#include "./json_reader.h"
+#include "./time_entry.h"
+#include "./types.h"
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  const Poco::UInt64 kDigestDaySeconds = 24 * 60 * 60;
+
+  // Checksums of the time entries of each day, for telling which days
+  // differ from the server without downloading them. A day, in UTC,
+  // has the hex MD5 of "id:at\n" of each of its entries, ordered by
+  // ID, where at is when the server last updated it. Days without
+  // entries have none. The server answers
+  // /api/v8/time_entries/digests with [{"day":start,"digest":"..."}]
+  // for the same period.
+  class TimeEntryDigests {
+  public:
+    // By the start of the day, in seconds
+    typedef std::map<Poco::UInt64, std::string> DayDigests;
+
+    // Of the entries that started from since to until. Those the
+    // server doesn't have yet, or that have changes to push, can't
+    // match, so their days go into unsettled instead and are left
+    // out of the comparison until the push is done.
+    static void Compute(
+        const std::vector<TimeEntry *> &time_entries,
+        const Poco::UInt64 since,
+        const Poco::UInt64 until,
+        DayDigests *digests,
+        std::set<Poco::UInt64> *unsettled);
+
+    static error Parse(const std::string &json, DayDigests *digests);
+
+    // Days from since to until whose digests differ, adjacent ones
+    // joined into one range. Unsettled days are taken to match.
+    static void Mismatched(
+        const DayDigests &local,
+        const DayDigests &remote,
+        const std::set<Poco::UInt64> &unsettled,
+        const Poco::UInt64 since,
+        const Poco::UInt64 until,
+        std::vector<TimeEntryRange> *ranges);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIME_ENTRY_DIGEST_H_
@@ -0,0 +1,136 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./time_entry_export.h"
+
+namespace kopsik {
+
+TimeEntryExport::TimeEntryExport(
+    const Format format, ExportSink *sink,
+    const std::string::size_type chunk_size)
+  : format_(format)
+  , sink_(sink)
+  , chunk_size_(chunk_size)
+  , rows_(0) {
+  buffer_.reserve(chunk_size_ + 1024);
+  json_.Reserve(chunk_size_ + 1024);
+}
+
+error TimeEntryExport::Begin() {
+  if (JSON == format_) {
+    json_.BeginArray();
+    return noError;
+  }
+  buffer_ += "GUID,Description,Project,Task,Client,Tags,Billable,"
+    "Start,Stop,Duration\r\n";
+  return noError;
+}
+
+error TimeEntryExport::Row(const TimeEntryExportRow &row) {
+  rows_++;
+  if (JSON == format_) {
+    json_.BeginObject();
+    json_.String("guid", row.GUID);
+    json_.String("description", row.Description);
+    json_.String("project", row.Project);
+    json_.String("task", row.Task);
+    json_.String("client", row.Client);
+    json_.Key("tags");
+    json_.BeginArray();
+    std::string::size_type from(0);
+    while (from < row.Tags.size()) {
+      std::string::size_type to = row.Tags.find('|', from);
+      if (to == std::string::npos) {
+        to = row.Tags.size();
+      }
+      json_.String(row.Tags.substr(from, to - from));
+      from = to + 1;
+    }
+    json_.EndArray();
+    json_.Bool("billable", row.Billable);
+    json_.String("start", Formatter::Format8601(row.Start));
+    json_.String("stop", Formatter::Format8601(row.Stop));
+    json_.Int("duration", row.Duration);
+    json_.EndObject();
+    if (json_.Buffer().size() < chunk_size_) {
+      return noError;
+    }
+    return flushJSON();
+  }
+
+  appendCSV(row.GUID);
+  buffer_ += ',';
+  appendCSV(row.Description);
+  buffer_ += ',';
+  appendCSV(row.Project);
+  buffer_ += ',';
+  appendCSV(row.Task);
+  buffer_ += ',';
+  appendCSV(row.Client);
+  buffer_ += ',';
+  // Tags are listed the way the UI lists them
+  std::string::size_type tags_at = buffer_.size();
+  appendCSV(row.Tags);
+  for (std::string::size_type i = tags_at; i < buffer_.size(); i++) {
+    if ('|' == buffer_[i]) {
+      buffer_[i] = ',';
+    }
+  }
+  buffer_ += ',';
+  buffer_ += row.Billable ? "Yes" : "No";
+  buffer_ += ',';
+  buffer_ += Formatter::Format8601(row.Start);
+  buffer_ += ',';
+  buffer_ += Formatter::Format8601(row.Stop);
+  buffer_ += ',';
+  buffer_ += Formatter::FormatDurationInSecondsHHMMSS(row.Duration);
+  buffer_ += "\r\n";
+  if (buffer_.size() < chunk_size_) {
+    return noError;
+  }
+  return flushCSV();
+}
+
+error TimeEntryExport::End() {
+  if (JSON == format_) {
+    json_.EndArray();
+    return flushJSON();
+  }
+  return flushCSV();
+}
+
+void TimeEntryExport::appendCSV(const std::string &value) {
+  if (value.find_first_of(",\"\r\n|") == std::string::npos) {
+    buffer_ += value;
+    return;
+  }
+  buffer_ += '"';
+  for (std::string::const_iterator it = value.begin();
+      it != value.end();
+      it++) {
+    if ('"' == *it) {
+      buffer_ += '"';
+    }
+    buffer_ += *it;
+  }
+  buffer_ += '"';
+}
+
+error TimeEntryExport::flushCSV() {
+  if (buffer_.empty()) {
+    return noError;
+  }
+  error err = sink_->Write(buffer_.data(), buffer_.size());
+  buffer_.clear();
+  return err;
+}
+
+error TimeEntryExport::flushJSON() {
+  if (json_.Buffer().empty()) {
+    return noError;
+  }
+  error err = sink_->Write(json_.Buffer().data(), json_.Buffer().size());
+  json_.ClearBuffer();
+  return err;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,86 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIME_ENTRY_EXPORT_H_
+#define SRC_TIME_ENTRY_EXPORT_H_
+
+#include <string>
+
+#include "./formatter.h"
+#include "./json_writer.h"
+#include "./types.h"
+
+#include "Poco/NumberFormatter.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Where exported time entries go, a chunk at a time
+  class ExportSink {
+  public:
+    virtual ~ExportSink() {}
+    virtual error Write(const char *data, const std::size_t size) = 0;
+  };
+
+  // Fields of one exported time entry. The strings are assigned row
+  // after row, so they keep their capacity.
+  class TimeEntryExportRow {
+  public:
+    TimeEntryExportRow() : Billable(false), Start(0), Stop(0), Duration(0) {}
+
+    std::string GUID;
+    std::string Description;
+    std::string Project;
+    std::string Task;
+    std::string Client;
+    // Tag names joined with |, as stored in the database
+    std::string Tags;
+    bool Billable;
+    Poco::UInt64 Start;
+    Poco::UInt64 Stop;
+    Poco::Int64 Duration;
+  };
+
+  // Formats time entries as CSV or as a JSON array into one buffer,
+  // which goes to the sink whenever it has filled up, so exports take
+  // the same memory however many time entries they have.
+  class TimeEntryExport {
+  public:
+    enum Format {
+      CSV,
+      JSON
+    };
+
+    TimeEntryExport(const Format format,
+                    ExportSink *sink,
+                    const std::string::size_type chunk_size = 64 * 1024);
+
+    error Begin();
+
+    error Row(const TimeEntryExportRow &row);
+
+    error End();
+
+    Poco::UInt64 Rows() const { return rows_; }
+
+  private:
+    // Quoted when it has a separator, quote or line break in it
+    void appendCSV(const std::string &value);
+
+    error flushCSV();
+
+    error flushJSON();
+
+    Format format_;
+    ExportSink *sink_;
+    std::string::size_type chunk_size_;
+    Poco::UInt64 rows_;
+    std::string buffer_;
+    JSONWriter json_;
+
+    TimeEntryExport(const TimeEntryExport &);
+    TimeEntryExport &operator=(const TimeEntryExport &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIME_ENTRY_EXPORT_H_
@@ -0,0 +1,140 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./time_entry_groups.h"
+
+#include <algorithm>
+#include <map>
+
+#include "Poco/NumberFormatter.h"
+
+namespace kopsik {
+
+std::string TimeEntryGroups::Key(const TimeEntrySnapshot &te) {
+  return te.DateHeader
+    + "\n" + Poco::NumberFormatter::format(te.PID)
+    + "\n" + Poco::NumberFormatter::format(te.TID)
+    + "\n" + te.Description;
+}
+
+void TimeEntryGroups::Build(
+    const UserSnapshot *previous, const TimeEntryListDiff &diff,
+    UserSnapshot *next, TimeEntryListDiff *group_diff) {
+  poco_assert(next);
+  poco_assert(group_diff);
+
+  // Keys of the groups the changed entries were and are in
+  std::set<std::string> touched;
+  if (previous) {
+    addKeys(*previous, diff.Updated, &touched);
+    addKeys(*previous, diff.Deleted, &touched);
+    addKeys(*next, diff.Inserted, &touched);
+    addKeys(*next, diff.Updated, &touched);
+  }
+
+  std::vector<TimeEntryGroupSnapshot> &groups = next->TimeEntryGroups;
+  // Whether each group was taken over as it was
+  std::vector<bool> kept;
+  for (std::size_t i = 0; i < next->TimeEntries.size(); i++) {
+    const TimeEntrySnapshot &te = next->TimeEntries[i];
+    std::string key(Key(te));
+    std::map<std::string, std::size_t>::iterator found =
+      next->TimeEntryGroupIndex.find(key);
+    std::size_t position(0);
+    if (found != next->TimeEntryGroupIndex.end()) {
+      position = found->second;
+    } else {
+      position = groups.size();
+      next->TimeEntryGroupIndex[key] = position;
+      bool keep(false);
+      std::map<std::string, std::size_t>::const_iterator was;
+      if (previous && !touched.count(key)) {
+        was = previous->TimeEntryGroupIndex.find(key);
+        keep = was != previous->TimeEntryGroupIndex.end();
+      }
+      if (keep) {
+        groups.push_back(previous->TimeEntryGroups[was->second]);
+        kept.push_back(true);
+      } else {
+        groups.push_back(start(te, key));
+        kept.push_back(false);
+      }
+    }
+    if (!kept[position]) {
+      add(te, &groups[position]);
+    }
+  }
+  for (std::size_t i = 0; i < groups.size(); i++) {
+    if (!kept[i]) {
+      groups[i].Duration = Formatter::FormatDurationInSecondsHHMMSS(
+        groups[i].DurationInSeconds);
+    }
+  }
+
+  if (!previous) {
+    return;
+  }
+  group_diff->Version = diff.Version;
+  group_diff->DateHeaders = diff.DateHeaders;
+  for (std::size_t i = 0; i < groups.size(); i++) {
+    const TimeEntryGroupSnapshot &group = groups[i];
+    if (kept[i] || !touched.count(group.Key)) {
+      continue;
+    }
+    std::map<std::string, std::size_t>::const_iterator was =
+      previous->TimeEntryGroupIndex.find(group.Key);
+    if (was == previous->TimeEntryGroupIndex.end()) {
+      group_diff->Inserted.push_back(group.Key);
+    } else if (!(previous->TimeEntryGroups[was->second] == group)) {
+      group_diff->Updated.push_back(group.Key);
+    }
+  }
+  for (std::size_t i = 0; i < previous->TimeEntryGroups.size(); i++) {
+    const std::string &key = previous->TimeEntryGroups[i].Key;
+    if (touched.count(key) && !next->TimeEntryGroupIndex.count(key)) {
+      group_diff->Deleted.push_back(key);
+    }
+  }
+}
+
+void TimeEntryGroups::addKeys(
+    const UserSnapshot &snapshot, const std::vector<std::string> &GUIDs,
+    std::set<std::string> *keys) {
+  for (std::vector<std::string>::const_iterator it = GUIDs.begin();
+      it != GUIDs.end();
+      it++) {
+    std::map<std::string, std::size_t>::const_iterator found =
+      snapshot.TimeEntryIndex.find(*it);
+    if (found != snapshot.TimeEntryIndex.end()) {
+      keys->insert(Key(snapshot.TimeEntries[found->second]));
+    }
+  }
+}
+
+TimeEntryGroupSnapshot TimeEntryGroups::start(
+    const TimeEntrySnapshot &te, const std::string &key) {
+  TimeEntryGroupSnapshot group;
+  group.Key = key;
+  group.Description = te.Description;
+  group.ProjectAndTaskLabel = te.ProjectAndTaskLabel;
+  group.Color = te.Color;
+  group.DateHeader = te.DateHeader;
+  group.WID = te.WID;
+  group.TID = te.TID;
+  group.PID = te.PID;
+  group.Started = te.Started;
+  group.Ended = te.Ended;
+  return group;
+}
+
+void TimeEntryGroups::add(
+    const TimeEntrySnapshot &te, TimeEntryGroupSnapshot *group) {
+  group->GUIDs.push_back(te.GUID);
+  // A running entry has a negative duration
+  if (te.DurationInSeconds > 0) {
+    group->DurationInSeconds += te.DurationInSeconds;
+  }
+  group->Started = std::min(group->Started, te.Started);
+  group->Ended = std::max(group->Ended, te.Ended);
+}
+
+}  // namespace kopsik
@@ -0,0 +1,52 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIME_ENTRY_GROUPS_H_
+#define SRC_TIME_ENTRY_GROUPS_H_
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "./formatter.h"
+#include "./user_snapshot.h"
+
+#include "Poco/Bugcheck.h"
+
+namespace kopsik {
+
+  // Groups the time entry list of a snapshot for the collapsed view.
+  // Only the groups the list diff touches are put together again, the
+  // others are taken over from the snapshot before, and the diff of
+  // the groups comes from those touched, so no group list has to be
+  // compared with another.
+  class TimeEntryGroups {
+  public:
+    static std::string Key(const TimeEntrySnapshot &te);
+
+    // Fills the groups of next, whose time entry list differs from
+    // that of previous as diff tells. Without previous, all groups are
+    // put together and group_diff is left alone.
+    static void Build(
+        const UserSnapshot *previous,
+        const TimeEntryListDiff &diff,
+        UserSnapshot *next,
+        TimeEntryListDiff *group_diff);
+
+  private:
+    static void addKeys(
+        const UserSnapshot &snapshot,
+        const std::vector<std::string> &GUIDs,
+        std::set<std::string> *keys);
+
+    static TimeEntryGroupSnapshot start(
+        const TimeEntrySnapshot &te,
+        const std::string &key);
+
+    static void add(
+        const TimeEntrySnapshot &te,
+        TimeEntryGroupSnapshot *group);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIME_ENTRY_GROUPS_H_
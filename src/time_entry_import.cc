@@ -0,0 +1,189 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./time_entry_import.h"
+
+#include <sstream>
+
+namespace kopsik {
+
+TimeEntryImportResult::TimeEntryImportResult()
+  : Imported(0), Skipped(0), Invalid(0), ProjectsCreated(0) {}
+
+TimeEntryCSVReader::TimeEntryCSVReader(std::istream *in)
+  : in_(in)
+  , fields_used_(0)
+  , line_(0)
+  , next_line_(1)
+  , header_read_(false) {
+  for (std::size_t i = 0; i < kColumns; i++) {
+    columns_[i] = -1;
+  }
+}
+
+bool TimeEntryCSVReader::Next(TimeEntryImportRow *row, error *err) {
+  *err = noError;
+  if (!header_read_) {
+    header_read_ = true;
+    if (!readRecord()) {
+      return false;
+    }
+    readHeader();
+    if (columns_[kStart] < 0
+        || (columns_[kStop] < 0 && columns_[kDuration] < 0)) {
+      *err = error("The file has no Start, and Stop or Duration columns");
+      return false;
+    }
+  }
+  do {
+    if (!readRecord()) {
+      return false;
+    }
+  } while (1 == fields_used_ && fields_[0].empty());
+
+  row->Line = line_;
+  row->GUID = field(kGUID);
+  row->Description = field(kDescription);
+  row->Project = field(kProject);
+  row->Client = field(kClient);
+  row->Tags = tags(field(kTags));
+  std::string billable = Poco::toLower(field(kBillable));
+  row->Billable = "yes" == billable || "true" == billable
+                  || "1" == billable;
+
+  // Strictly, as Poco's parser makes a date of about anything
+  if (field(kStart).empty()) {
+    *err = lineError("no start time");
+    return true;
+  }
+  std::time_t start(0), stop(0);
+  if (!Formatter::parse8601Fixed(field(kStart), &start)
+      || (!field(kStop).empty()
+          && !Formatter::parse8601Fixed(field(kStop), &stop))) {
+    *err = lineError("invalid start or stop time");
+    return true;
+  }
+  row->Start = start;
+  row->Stop = stop;
+  if (!row->Stop) {
+    int duration = Formatter::ParseDurationString(field(kDuration));
+    if (duration <= 0) {
+      *err = lineError("no stop time or duration");
+      return true;
+    }
+    row->Stop = row->Start + duration;
+  }
+  if (row->Stop < row->Start) {
+    *err = lineError("stops before it starts");
+    return true;
+  }
+  return true;
+}
+
+void TimeEntryCSVReader::readHeader() {
+  const char *names[kColumns] = {
+    "guid", "description", "project", "client", "tags",
+    "billable", "start", "stop", "duration"
+  };
+  for (std::size_t i = 0; i < fields_used_; i++) {
+    std::string name = Poco::toLower(Poco::trim(fields_[i]));
+    if ("end" == name) {
+      name = "stop";
+    }
+    for (std::size_t c = 0; c < kColumns; c++) {
+      if (name == names[c] && columns_[c] < 0) {
+        columns_[c] = static_cast<int>(i);
+      }
+    }
+  }
+}
+
+const std::string &TimeEntryCSVReader::field(const Column column) const {
+  static const std::string empty("");
+  int i = columns_[column];
+  if (i < 0 || static_cast<std::size_t>(i) >= fields_used_) {
+    return empty;
+  }
+  return fields_[i];
+}
+
+std::string TimeEntryCSVReader::tags(const std::string &value) {
+  std::string result("");
+  std::string::size_type start = 0;
+  while (start <= value.size()) {
+    std::string::size_type end = value.find_first_of(",|", start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    std::string name = Poco::trim(value.substr(start, end - start));
+    if (!name.empty()) {
+      if (!result.empty()) {
+        result += '|';
+      }
+      result += name;
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+error TimeEntryCSVReader::lineError(const std::string &what) const {
+  std::stringstream ss;
+  ss << "Line " << line_ << ": " << what;
+  return ss.str();
+}
+
+std::string *TimeEntryCSVReader::nextField() {
+  if (fields_used_ == fields_.size()) {
+    fields_.push_back("");
+  }
+  std::string *field = &fields_[fields_used_++];
+  field->clear();
+  return field;
+}
+
+bool TimeEntryCSVReader::readRecord() {
+  typedef std::char_traits<char> traits;
+  std::streambuf *buf = in_->rdbuf();
+  fields_used_ = 0;
+  if (!buf || traits::eq_int_type(buf->sgetc(), traits::eof())) {
+    return false;
+  }
+  line_ = next_line_;
+  std::string *field = nextField();
+  bool quoted = false;
+  while (true) {
+    traits::int_type c = buf->sbumpc();
+    if (traits::eq_int_type(c, traits::eof())) {
+      break;
+    }
+    char ch = traits::to_char_type(c);
+    if ('\n' == ch) {
+      next_line_++;
+    }
+    if (quoted) {
+      if ('"' != ch) {
+        field->push_back(ch);
+      } else if (traits::eq_int_type(buf->sgetc(),
+                                     traits::to_int_type('"'))) {
+        buf->sbumpc();
+        field->push_back('"');
+      } else {
+        quoted = false;
+      }
+      continue;
+    }
+    if ('\n' == ch) {
+      break;
+    }
+    if ('"' == ch) {
+      quoted = true;
+    } else if (',' == ch) {
+      field = nextField();
+    } else if ('\r' != ch) {
+      field->push_back(ch);
+    }
+  }
+  return true;
+}
+
+}  // namespace kopsik
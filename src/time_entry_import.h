@@ -0,0 +1,118 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIME_ENTRY_IMPORT_H_
+#define SRC_TIME_ENTRY_IMPORT_H_
+
+#include <string>
+#include <vector>
+
+#include "./formatter.h"
+#include "./types.h"
+
+#include "Poco/String.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Fields of one imported time entry, as named in the file. The
+  // strings are assigned row after row, so they keep their capacity.
+  class TimeEntryImportRow {
+  public:
+    TimeEntryImportRow() : Billable(false), Start(0), Stop(0), Line(0) {}
+
+    std::string GUID;
+    std::string Description;
+    std::string Project;
+    std::string Client;
+    // Tag names joined with |, as stored in the database
+    std::string Tags;
+    bool Billable;
+    Poco::UInt64 Start;
+    Poco::UInt64 Stop;
+    // Line of the file the row starts on, for errors
+    Poco::UInt64 Line;
+  };
+
+  // Counts of an import so far
+  class TimeEntryImportResult {
+  public:
+    TimeEntryImportResult();
+
+    Poco::UInt64 Imported;
+    // Already there, by GUID
+    Poco::UInt64 Skipped;
+    // Couldn't be read, FirstError tells why for the first one
+    Poco::UInt64 Invalid;
+    Poco::UInt64 ProjectsCreated;
+    error FirstError;
+  };
+
+  // Told about an import after each chunk of it is saved
+  class TimeEntryImportProgress {
+  public:
+    virtual ~TimeEntryImportProgress() {}
+    virtual void Imported(const TimeEntryImportResult &so_far) = 0;
+  };
+
+  // Reads time entries from CSV a row at a time, so files of any
+  // length take the same memory. The first row names the columns,
+  // in any order and case; those of TimeEntryExport are understood,
+  // so an export can be imported again. Start is needed, and Stop or
+  // Duration. Fields are quoted as in RFC 4180, and tags are
+  // separated by commas or |.
+  class TimeEntryCSVReader {
+  public:
+    explicit TimeEntryCSVReader(std::istream *in);
+
+    // Reads the next row into row, false at the end of the input.
+    // When a row can't be read, err tells why, and the next call
+    // goes on with the row after it. A file without the columns
+    // needed ends with an error right away.
+    bool Next(TimeEntryImportRow *row, error *err);
+
+  private:
+    enum Column {
+      kGUID,
+      kDescription,
+      kProject,
+      kClient,
+      kTags,
+      kBillable,
+      kStart,
+      kStop,
+      kDuration,
+      kColumns
+    };
+
+    void readHeader();
+
+    const std::string &field(const Column column) const;
+
+    // Tag names trimmed and joined with |
+    static std::string tags(const std::string &value);
+
+    error lineError(const std::string &what) const;
+
+    std::string *nextField();
+
+    // Fields of the next record into fields_, false at the end of
+    // the input. Line breaks in quotes are part of the field.
+    bool readRecord();
+
+    std::istream *in_;
+    // Fields are reused from record to record, only the first
+    // fields_used_ are of the current one
+    std::vector<std::string> fields_;
+    std::size_t fields_used_;
+    int columns_[kColumns];
+    Poco::UInt64 line_;
+    Poco::UInt64 next_line_;
+    bool header_read_;
+
+    TimeEntryCSVReader(const TimeEntryCSVReader &);
+    TimeEntryCSVReader &operator=(const TimeEntryCSVReader &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIME_ENTRY_IMPORT_H_
@@ -0,0 +1,121 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./time_entry_intervals.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace kopsik {
+
+TimeEntryIntervals::TimeEntryIntervals(const std::vector<TimeEntry *> &list)
+  : list_(list)
+  , generation_(BaseModel::ChangeGeneration() - 1) {}
+
+void TimeEntryIntervals::Refresh() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  int generation = BaseModel::ChangeGeneration();
+  if (generation == generation_ && rows_ == list_) {
+    return;
+  }
+  rows_ = list_;
+
+  std::vector<Interval> intervals;
+  intervals.reserve(list_.size());
+  for (std::size_t i = 0; i < list_.size(); i++) {
+    TimeEntry *te = list_[i];
+    if (te->DeletedAt() || !te->Start()) {
+      continue;
+    }
+    Interval interval;
+    interval.Start = te->Start();
+    interval.End = End(te);
+    interval.Position = i;
+    intervals.push_back(interval);
+  }
+  std::sort(intervals.begin(), intervals.end(), startsEarlier);
+
+  std::size_t size = intervals.size();
+  starts_.resize(size);
+  ends_.resize(size);
+  positions_.resize(size);
+  for (std::size_t i = 0; i < size; i++) {
+    starts_[i] = intervals[i].Start;
+    ends_[i] = intervals[i].End;
+    positions_[i] = intervals[i].Position;
+  }
+  max_ends_.resize(size);
+  buildMaxEnds(0, size);
+  generation_ = generation;
+}
+
+void TimeEntryIntervals::Clear() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  rows_.clear();
+  generation_ = BaseModel::ChangeGeneration() - 1;
+}
+
+void TimeEntryIntervals::Overlapping(
+    const Poco::UInt64 from, const Poco::UInt64 to,
+    std::vector<std::size_t> *positions) const {
+  if (from < to) {
+    overlapping(0, starts_.size(), from, to, positions);
+  }
+}
+
+Poco::UInt64 TimeEntryIntervals::End(TimeEntry *te) {
+  if (te->DurationInSeconds() < 0) {
+    return std::numeric_limits<Poco::UInt64>::max();
+  }
+  if (te->Stop() > te->Start()) {
+    return te->Stop();
+  }
+  return te->Start() + te->DurationInSeconds();
+}
+
+std::size_t TimeEntryIntervals::MemoryBytes() {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  return VectorBytes(starts_)
+    + VectorBytes(ends_)
+    + VectorBytes(max_ends_)
+    + VectorBytes(positions_)
+    + VectorBytes(rows_);
+}
+
+bool TimeEntryIntervals::startsEarlier(const Interval &a, const Interval &b) {
+  return a.Start < b.Start;
+}
+
+Poco::UInt64 TimeEntryIntervals::buildMaxEnds(
+    const std::size_t lo, const std::size_t hi) {
+  if (lo >= hi) {
+    return 0;
+  }
+  std::size_t mid = lo + (hi - lo) / 2;
+  max_ends_[mid] = std::max(ends_[mid],
+                            std::max(buildMaxEnds(lo, mid),
+                                     buildMaxEnds(mid + 1, hi)));
+  return max_ends_[mid];
+}
+
+void TimeEntryIntervals::overlapping(
+    const std::size_t lo, const std::size_t hi, const Poco::UInt64 from,
+    const Poco::UInt64 to, std::vector<std::size_t> *positions) const {
+  if (lo >= hi) {
+    return;
+  }
+  std::size_t mid = lo + (hi - lo) / 2;
+  if (max_ends_[mid] <= from) {
+    return;
+  }
+  overlapping(lo, mid, from, to, positions);
+  // The rest starts later still
+  if (starts_[mid] >= to) {
+    return;
+  }
+  if (ends_[mid] > from) {
+    positions->push_back(positions_[mid]);
+  }
+  overlapping(mid + 1, hi, from, to, positions);
+}
+
+}  // namespace kopsik
@@ -0,0 +1,94 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIME_ENTRY_INTERVALS_H_
+#define SRC_TIME_ENTRY_INTERVALS_H_
+
+#include <string>
+#include <vector>
+
+#include "./base_model.h"
+#include "./memory_usage.h"
+#include "./time_entry.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // A time entry found by its time, Stop is 0 while it's running
+  class TimeEntrySpan {
+  public:
+    TimeEntrySpan() : GUID(""), Start(0), Stop(0) {}
+
+    std::string GUID;
+    Poco::UInt64 Start;
+    Poco::UInt64 Stop;
+  };
+
+  // Start and end of the time entries in a list, sorted by start, for
+  // finding the ones that overlap a stretch of time without looking at
+  // all of them. The sorted list is read as a balanced search tree,
+  // its middle entry being the root, and each entry also keeps the
+  // latest end under it, so subtrees that all end too early are
+  // skipped. Deleted time entries are left out, running ones last for
+  // good. Like TimeEntryColumns, it's built again when the list or
+  // the model change generation is not what it was built from.
+  class TimeEntryIntervals {
+  public:
+    explicit TimeEntryIntervals(const std::vector<TimeEntry *> &list);
+
+    // Call before querying, with the list locked at least for reading
+    void Refresh();
+
+    // Builds again on next Refresh, even if nothing seems to have changed
+    void Clear();
+
+    // Positions in the list of the time entries that overlap the time
+    // from..to, not counting the ones that only touch it, by start
+    void Overlapping(const Poco::UInt64 from,
+                     const Poco::UInt64 to,
+                     std::vector<std::size_t> *positions) const;
+
+    // End of the time entry as indexed
+    static Poco::UInt64 End(TimeEntry *te);
+
+    std::size_t MemoryBytes();
+
+  private:
+    class Interval {
+    public:
+      Poco::UInt64 Start;
+      Poco::UInt64 End;
+      std::size_t Position;
+    };
+
+    static bool startsEarlier(const Interval &a, const Interval &b);
+
+    // Latest end in lo..hi, kept at its middle
+    Poco::UInt64 buildMaxEnds(const std::size_t lo, const std::size_t hi);
+
+    void overlapping(const std::size_t lo,
+                     const std::size_t hi,
+                     const Poco::UInt64 from,
+                     const Poco::UInt64 to,
+                     std::vector<std::size_t> *positions) const;
+
+    const std::vector<TimeEntry *> &list_;
+    // The list the intervals were built from
+    std::vector<TimeEntry *> rows_;
+    int generation_;
+
+    std::vector<Poco::UInt64> starts_;
+    std::vector<Poco::UInt64> ends_;
+    std::vector<Poco::UInt64> max_ends_;
+    std::vector<std::size_t> positions_;
+
+    Poco::FastMutex mutex_;
+
+    TimeEntryIntervals(const TimeEntryIntervals &);
+    TimeEntryIntervals &operator=(const TimeEntryIntervals &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIME_ENTRY_INTERVALS_H_
@@ -0,0 +1,210 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./time_entry_suggestions.h"
+
+#include <algorithm>
+
+namespace kopsik {
+
+TimeEntrySuggestions::TimeEntrySuggestions(
+    const std::size_t max_keys, const std::size_t max_spans,
+    const time_t span_gap_seconds)
+  : uid_(0)
+  , max_keys_(max_keys)
+  , max_spans_(max_spans)
+  , span_gap_seconds_(span_gap_seconds) {}
+
+bool TimeEntrySuggestions::SetUser(const Poco::UInt64 uid) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  if (uid == uid_) {
+    return false;
+  }
+  uid_ = uid;
+  keys_.clear();
+  spans_.clear();
+  return true;
+}
+
+void TimeEntrySuggestions::LearnEntry(
+    const Poco::UInt64 pid, const std::string &description,
+    const Poco::Int64 seconds) {
+  if (seconds <= 0 || (!pid && description.empty())) {
+    return;
+  }
+  std::vector<std::string> keys;
+  wordKeys(description, &keys);
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  learn(keys, SuggestionTarget(pid, description), seconds);
+}
+
+void TimeEntrySuggestions::LearnWindow(
+    const std::string &filename, const std::string &title,
+    const time_t seconds, const Poco::UInt64 pid,
+    const std::string &description) {
+  if (seconds <= 0 || (!pid && description.empty())) {
+    return;
+  }
+  std::vector<std::string> keys;
+  windowKeys(filename, title, &keys);
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  learn(keys, SuggestionTarget(pid, description), seconds);
+}
+
+void TimeEntrySuggestions::Untracked(
+    const std::string &filename, const std::string &title, const time_t start,
+    const time_t end) {
+  if (end <= start) {
+    return;
+  }
+  std::vector<std::string> keys;
+  windowKeys(filename, title, &keys);
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  if (spans_.empty() || start - spans_.back().End > span_gap_seconds_) {
+    spans_.push_back(Span());
+    spans_.back().Start = start;
+    if (spans_.size() > max_spans_) {
+      spans_.pop_front();
+    }
+  }
+  Span &span = spans_.back();
+  span.End = std::max(span.End, end);
+  SuggestionTarget target;
+  if (bestTarget(keys, &target)) {
+    span.Seconds[target] += end - start;
+  }
+}
+
+void TimeEntrySuggestions::Suggest(
+    const time_t min_seconds, const std::size_t limit,
+    std::vector<TimeEntrySuggestion> *suggestions) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  for (std::deque<Span>::const_iterator it = spans_.begin();
+      it != spans_.end();
+      it++) {
+    TimeEntrySuggestion suggestion;
+    for (std::map<SuggestionTarget, time_t>::const_iterator target =
+        it->Seconds.begin();
+        target != it->Seconds.end();
+        target++) {
+      if (target->second > suggestion.Seconds) {
+        suggestion.PID = target->first.first;
+        suggestion.Description = target->first.second;
+        suggestion.Seconds = target->second;
+      }
+    }
+    if (!suggestion.Seconds || suggestion.Seconds < min_seconds) {
+      continue;
+    }
+    suggestion.Start = it->Start;
+    suggestion.End = it->End;
+    suggestions->push_back(suggestion);
+  }
+  std::stable_sort(suggestions->begin(), suggestions->end(),
+                   moreSeconds);
+  if (suggestions->size() > limit) {
+    suggestions->resize(limit);
+  }
+}
+
+void TimeEntrySuggestions::Dismiss(const time_t start) {
+  Poco::FastMutex::ScopedLock lock(mutex_);
+  for (std::deque<Span>::iterator it = spans_.begin();
+      it != spans_.end();
+      it++) {
+    if (it->Start == start) {
+      spans_.erase(it);
+      return;
+    }
+  }
+}
+
+bool TimeEntrySuggestions::moreSeconds(
+    const TimeEntrySuggestion &a, const TimeEntrySuggestion &b) {
+  return a.Seconds > b.Seconds;
+}
+
+void TimeEntrySuggestions::wordKeys(
+    const std::string &text, std::vector<std::string> *keys) {
+  std::vector<std::string> words;
+  SplitWords(text, &words);
+  for (std::vector<std::string>::const_iterator it = words.begin();
+      it != words.end();
+      it++) {
+    // Too common to tell anything apart
+    if (it->size() < 3) {
+      continue;
+    }
+    keys->push_back("w:" + Poco::toLower(*it));
+  }
+}
+
+void TimeEntrySuggestions::windowKeys(
+    const std::string &filename, const std::string &title,
+    std::vector<std::string> *keys) {
+  if (!filename.empty()) {
+    keys->push_back("a:" + filename);
+  }
+  wordKeys(title, keys);
+}
+
+void TimeEntrySuggestions::learn(
+    const std::vector<std::string> &keys, const SuggestionTarget &target,
+    const Poco::Int64 seconds) {
+  for (std::vector<std::string>::const_iterator it = keys.begin();
+      it != keys.end();
+      it++) {
+    if (keys_.size() >= max_keys_ && keys_.find(*it) == keys_.end()) {
+      forgetWeakestKey();
+    }
+    Key &key = keys_[*it];
+    key.Total += seconds;
+    key.Targets[target] += seconds;
+  }
+}
+
+void TimeEntrySuggestions::forgetWeakestKey() {
+  std::map<std::string, Key>::iterator weakest = keys_.begin();
+  for (std::map<std::string, Key>::iterator it = keys_.begin();
+      it != keys_.end();
+      it++) {
+    if (it->second.Total < weakest->second.Total) {
+      weakest = it;
+    }
+  }
+  if (weakest != keys_.end()) {
+    keys_.erase(weakest);
+  }
+}
+
+bool TimeEntrySuggestions::bestTarget(
+    const std::vector<std::string> &keys, SuggestionTarget *best) const {
+  std::map<SuggestionTarget, double> votes;
+  for (std::vector<std::string>::const_iterator it = keys.begin();
+      it != keys.end();
+      it++) {
+    std::map<std::string, Key>::const_iterator key = keys_.find(*it);
+    if (key == keys_.end()) {
+      continue;
+    }
+    for (std::map<SuggestionTarget, Poco::Int64>::const_iterator target =
+        key->second.Targets.begin();
+        target != key->second.Targets.end();
+        target++) {
+      votes[target->first] += static_cast<double>(target->second)
+                              / key->second.Total;
+    }
+  }
+  double best_votes(0);
+  for (std::map<SuggestionTarget, double>::const_iterator it =
+      votes.begin();
+      it != votes.end();
+      it++) {
+    if (it->second > best_votes) {
+      best_votes = it->second;
+      *best = it->first;
+    }
+  }
+  return best_votes > 0;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,137 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIME_ENTRY_SUGGESTIONS_H_
+#define SRC_TIME_ENTRY_SUGGESTIONS_H_
+
+#include <time.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./text_words.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/String.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // What a suggested time entry would be tracked as
+  typedef std::pair<Poco::UInt64, std::string> SuggestionTarget;
+
+  class TimeEntrySuggestion {
+  public:
+    TimeEntrySuggestion() : PID(0), Start(0), End(0), Seconds(0) {}
+
+    Poco::UInt64 PID;
+    std::string Description;
+    // Untracked time the suggestion is for
+    time_t Start;
+    time_t End;
+    // Of that, the time spent in windows that went with the project
+    time_t Seconds;
+  };
+
+  // Suggests time entries for untracked time from the timeline, as it
+  // is recorded. Apps and window title words are associated with the
+  // projects and descriptions of the time entries that were running
+  // while they were used, and description words with their own entries.
+  // Untracked windows are matched against these associations as they
+  // come, into spans of untracked time, so suggesting only goes over
+  // the few spans kept.
+  class TimeEntrySuggestions {
+  public:
+    TimeEntrySuggestions(
+      const std::size_t max_keys = 4096,
+      const std::size_t max_spans = 24,
+      const time_t span_gap_seconds = 5 * 60);
+
+    // Associations are per user, a new user starts over.
+    // Returns true when the user changed.
+    bool SetUser(const Poco::UInt64 uid);
+
+    // A time entry of the user, for its description words
+    void LearnEntry(const Poco::UInt64 pid,
+                    const std::string &description,
+                    const Poco::Int64 seconds);
+
+    // A window used while the time entry was running
+    void LearnWindow(const std::string &filename,
+                     const std::string &title,
+                     const time_t seconds,
+                     const Poco::UInt64 pid,
+                     const std::string &description);
+
+    // A window used while nothing was tracked. Windows come in the
+    // order they were used.
+    void Untracked(const std::string &filename,
+                   const std::string &title,
+                   const time_t start,
+                   const time_t end);
+
+    // Most matched time first, only spans that have at least
+    // min_seconds of it
+    void Suggest(const time_t min_seconds,
+                 const std::size_t limit,
+                 std::vector<TimeEntrySuggestion> *suggestions);
+
+    // The span starting at the time is not suggested again
+    void Dismiss(const time_t start);
+
+  private:
+    class Span {
+    public:
+      Span() : Start(0), End(0) {}
+      time_t Start;
+      time_t End;
+      std::map<SuggestionTarget, time_t> Seconds;
+    };
+
+    // Seconds each target was seen with a key, and their sum
+    class Key {
+    public:
+      Key() : Total(0) {}
+      Poco::Int64 Total;
+      std::map<SuggestionTarget, Poco::Int64> Targets;
+    };
+
+    static bool moreSeconds(const TimeEntrySuggestion &a,
+                            const TimeEntrySuggestion &b);
+
+    static void wordKeys(const std::string &text,
+                         std::vector<std::string> *keys);
+
+    static void windowKeys(const std::string &filename,
+                           const std::string &title,
+                           std::vector<std::string> *keys);
+
+    // Must be called with mutex_ locked
+    void learn(const std::vector<std::string> &keys,
+               const SuggestionTarget &target,
+               const Poco::Int64 seconds);
+
+    void forgetWeakestKey();
+
+    // Each key votes for its targets by their share of its time.
+    // Must be called with mutex_ locked.
+    bool bestTarget(const std::vector<std::string> &keys,
+                    SuggestionTarget *best) const;
+
+    Poco::UInt64 uid_;
+    std::size_t max_keys_;
+    std::size_t max_spans_;
+    time_t span_gap_seconds_;
+    std::map<std::string, Key> keys_;
+    std::deque<Span> spans_;
+    Poco::FastMutex mutex_;
+
+    TimeEntrySuggestions(const TimeEntrySuggestions &);
+    TimeEntrySuggestions &operator=(const TimeEntrySuggestions &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIME_ENTRY_SUGGESTIONS_H_
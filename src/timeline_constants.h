@@ -3,11 +3,48 @@
 #ifndef SRC_TIMELINE_CONSTANTS_H_
 #define SRC_TIMELINE_CONSTANTS_H_
 
+#include <cstddef>
+
 const unsigned int kTimelineUploadIntervalSeconds = 60;
 const unsigned int kTimelineUploadMaxBackoffSeconds =
     kTimelineUploadIntervalSeconds * 10;
 
+// Number of events uploaded at once. The batch grows while there's a
+// backlog that the server keeps accepting, and shrinks when uploads fail.
+const unsigned int kTimelineUploadBatchSize = 100;
+const unsigned int kTimelineUploadMinBatchSize = 25;
+const unsigned int kTimelineUploadMaxBatchSize = 1600;
+
+// While at least this many events are left after an uploaded batch,
+// the next one is uploaded right away instead of after the interval.
+const unsigned int kTimelineUploadBacklogThreshold = 200;
+
+// A batch sent on the stream connection that hasn't been acknowledged
+// within this long counts as a failed upload.
+const unsigned int kTimelineStreamAckTimeoutSeconds = 30;
+
+// With timeline blocks on, events that pile up while uploads fail are
+// packed this many at a time into one gzipped row of timeline_blocks,
+// once more than twice as many are waiting.
+const unsigned int kTimelineBlockEvents = kTimelineUploadMaxBatchSize;
+
+// Blocks kept at most; the oldest is dropped to make room for a new
+// one, so an outage of weeks doesn't fill the disk.
+const unsigned int kTimelineBlocksMax = 1000;
+
 const unsigned int kWindowFocusThresholdSeconds = 5;
+
+// Events of the same window that start at most this many seconds after
+// the previous one ended are merged into it before they're stored.
+const unsigned int kTimelineCoalesceSeconds = 30;
+
+// IDs of this many app filenames and window titles each are remembered
+// for inserting events, before they're forgotten and looked up again.
+const std::size_t kTimelineDictionaryCacheMax = 4096;
 const unsigned int kWindowChangeRecordingIntervalMillis = 500;
 
+// Where focus changes come as events, the focused window is
+// still checked this often, in case an event was missed.
+const unsigned int kWindowChangeEventTimeoutMillis = 60 * 1000;
+
 #endif  // SRC_TIMELINE_CONSTANTS_H_
@@ -0,0 +1,122 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./timeline_dispatcher.h"
+
+#include <vector>
+
+#include "Poco/SingletonHolder.h"
+
+namespace kopsik {
+
+TimelineDispatcher::TimelineDispatcher()
+    : dispatching_(this, &TimelineDispatcher::dispatch_loop) {}
+
+TimelineDispatcher::~TimelineDispatcher() {
+    Stop();
+}
+
+TimelineDispatcher &TimelineDispatcher::Instance() {
+    static Poco::SingletonHolder<TimelineDispatcher> sh;
+    return *sh.get();
+}
+
+void TimelineDispatcher::Post(
+    Poco::Notification *notification, Poco::NotificationCenter &center) {
+    poco_assert(notification);
+    queue_.enqueueNotification(
+        new RoutedNotification(notification, &center));
+    Poco::Mutex::ScopedLock lock(dispatching_m_);
+    if (!dispatching_.isRunning()) {
+        dispatching_.start();
+    }
+}
+
+void TimelineDispatcher::Stop() {
+    drain(0, 0);
+}
+
+std::size_t TimelineDispatcher::StopWithin(
+    const Poco::Timestamp::TimeDiff drain_micros) {
+    poco_assert(drain_micros > 0);
+    return drain(0, drain_micros);
+}
+
+void TimelineDispatcher::Drain(Poco::NotificationCenter &center) {  // NOLINT
+    drain(&center, 0);
+}
+
+std::size_t TimelineDispatcher::DrainWithin(
+    Poco::NotificationCenter &center,  // NOLINT
+    const Poco::Timestamp::TimeDiff drain_micros) {
+    poco_assert(drain_micros > 0);
+    return drain(&center, drain_micros);
+}
+
+std::size_t TimelineDispatcher::drain(
+    Poco::NotificationCenter *center,
+    const Poco::Timestamp::TimeDiff drain_micros) {
+    Poco::Timestamp started;
+    Poco::Mutex::ScopedLock lock(dispatching_m_);
+    if (dispatching_.isRunning()) {
+        dispatching_.stop();
+        queue_.wakeUpAll();
+        dispatching_.wait();
+    }
+    std::size_t dropped(0);
+    std::vector<Poco::AutoPtr<Poco::Notification> > others;
+    while (true) {
+        Poco::AutoPtr<Poco::Notification> ptr(
+            queue_.dequeueNotification());
+        if (!ptr) {
+            break;
+        }
+        if (center && routed(ptr.get())->center != center) {
+            others.push_back(ptr);
+        } else if (drain_micros && started.isElapsed(drain_micros)) {
+            dropped++;
+        } else {
+            deliver(ptr);
+        }
+    }
+    if (!others.empty()) {
+        for (std::vector<Poco::AutoPtr<Poco::Notification> >::
+                reverse_iterator it = others.rbegin();
+                it != others.rend();
+                it++) {
+            queue_.enqueueUrgentNotification(*it);
+        }
+        dispatching_.start();
+    }
+    return dropped;
+}
+
+void TimelineDispatcher::dispatch_loop() {
+    SetCurrentThreadRole(kThreadBackground);
+    while (!dispatching_.isStopped()) {
+        // Wait in increments, as a wake up that comes just before
+        // the wait starts gets lost.
+        Poco::AutoPtr<Poco::Notification> ptr(
+            queue_.waitDequeueNotification(1000));
+        if (ptr) {
+            deliver(ptr);
+        }
+    }
+}
+
+TimelineDispatcher::RoutedNotification::RoutedNotification(
+    Poco::Notification *notification, Poco::NotificationCenter *center)
+    : notification(notification)
+    , center(center) {}
+
+TimelineDispatcher::RoutedNotification *TimelineDispatcher::routed(
+    Poco::Notification *notification) {
+    return static_cast<RoutedNotification *>(notification);
+}
+
+void TimelineDispatcher::deliver(Poco::AutoPtr<Poco::Notification> ptr) {
+    RoutedNotification *routed_notification = routed(ptr.get());
+    routed_notification->center->postNotification(
+        routed_notification->notification);
+}
+
+}  // namespace kopsik
@@ -0,0 +1,92 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIMELINE_DISPATCHER_H_
+#define SRC_TIMELINE_DISPATCHER_H_
+
+#include "./thread_role.h"
+
+#include "Poco/Activity.h"
+#include "Poco/AutoPtr.h"
+#include "Poco/Mutex.h"
+#include "Poco/Notification.h"
+#include "Poco/NotificationCenter.h"
+#include "Poco/NotificationQueue.h"
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+// Delivers timeline notifications to the NotificationCenter of their
+// context from a thread of its own, so posting one only queues it.
+// One dispatcher thread serves all of the contexts of the process,
+// each context's notifications only reach that context's observers. This keeps
+// the stages of the timeline pipeline apart: the recorder thread posts
+// events, the dispatcher thread stores them and reads upload batches
+// from the database, and the uploader thread does the HTTPS upload.
+// None of them waits for another to finish its work.
+class TimelineDispatcher {
+ public:
+    TimelineDispatcher();
+
+    ~TimelineDispatcher();
+
+    static TimelineDispatcher &Instance();
+
+    // Takes ownership of the heap allocated notification. Observers
+    // of the center receive it on the dispatcher thread, which is
+    // started on demand. The center must outlive the notification,
+    // see Stop.
+    void Post(Poco::Notification *notification,
+              Poco::NotificationCenter &center =  // NOLINT
+                Poco::NotificationCenter::defaultCenter());
+
+    // Stops the dispatcher thread and delivers whatever is still queued
+    // on the calling thread, for all contexts. For the end of the
+    // process, a context going away uses Drain.
+    void Stop();
+
+    // Same, but what is still queued after drain_micros is dropped.
+    // Returns how many notifications were.
+    std::size_t StopWithin(const Poco::Timestamp::TimeDiff drain_micros);
+
+    // Delivers what is queued for the center on the calling thread,
+    // so recorded events reach the database before it is closed.
+    // Notifications of other contexts stay queued for the dispatcher
+    // thread, in the order they were posted.
+    void Drain(Poco::NotificationCenter &center);  // NOLINT
+
+    // Same, but what is still queued for the center after drain_micros
+    // is dropped. Returns how many notifications were.
+    std::size_t DrainWithin(
+            Poco::NotificationCenter &center,  // NOLINT
+            const Poco::Timestamp::TimeDiff drain_micros);
+
+ private:
+    // Of the center, or of all centers when it is null. The thread is
+    // stopped meanwhile, so nothing for the center is being delivered
+    // beside the caller, and started again for what others still have.
+    std::size_t drain(Poco::NotificationCenter *center,
+                      const Poco::Timestamp::TimeDiff drain_micros);
+
+    void dispatch_loop();
+
+    // A notification and where it goes
+    class RoutedNotification : public Poco::Notification {
+     public:
+        RoutedNotification(Poco::Notification *notification,
+                           Poco::NotificationCenter *center);
+        Poco::AutoPtr<Poco::Notification> notification;
+        Poco::NotificationCenter *center;
+    };
+
+    static RoutedNotification *routed(Poco::Notification *notification);
+
+    static void deliver(Poco::AutoPtr<Poco::Notification> ptr);
+
+    Poco::NotificationQueue queue_;
+    Poco::Mutex dispatching_m_;
+    Poco::Activity<TimelineDispatcher> dispatching_;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_TIMELINE_DISPATCHER_H_
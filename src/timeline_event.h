@@ -6,13 +6,17 @@
 #include <time.h>
 #include <string>
 
+#include "./string_table.h"
+
+// Title and filename are interned, as the same
+// ones are recorded over and over again.
 class TimelineEvent {
  public:
     TimelineEvent() :
         id(0),
         user_id(0),
-        title(""),
-        filename(""),
+        title(kopsik::StringTable::Timeline().Intern("")),
+        filename(kopsik::StringTable::Timeline().Intern("")),
         start_time(0),
         end_time(0),
         idle(false) {
@@ -20,8 +24,8 @@ class TimelineEvent {
 
     unsigned int id;
     unsigned int user_id;
-    std::string title;
-    std::string filename;
+    kopsik::SharedString title;
+    kopsik::SharedString filename;
     time_t start_time;
     time_t end_time;
     bool idle;
@@ -14,39 +14,98 @@
 // or there's and idle event.
 class TimelineEventNotification : public Poco::Notification {
  public:
-    explicit TimelineEventNotification(TimelineEvent _event) : event(_event) {}
+    explicit TimelineEventNotification(const TimelineEvent &_event)
+        : event(_event) {}
     TimelineEvent event;
 };
 
-// Find timeline events (for upload).
+// Find timeline events (for upload), at most batch_size of them,
+// starting after the event with ID after_id.
 class CreateTimelineBatchNotification : public Poco::Notification {
  public:
-  explicit CreateTimelineBatchNotification(const Poco::UInt64 _user_id) :
-        user_id(_user_id) {}
+  CreateTimelineBatchNotification(const Poco::UInt64 _user_id,
+            const unsigned int _batch_size,
+            const unsigned int _after_id) :
+        user_id(_user_id),
+        batch_size(_batch_size),
+        after_id(_after_id) {}
     Poco::UInt64 user_id;
+    unsigned int batch_size;
+    unsigned int after_id;
 };
 
 // A batch of timeline events has been found in database, that
-// is ready for upload.
+// is ready for upload. Events are ordered by ID. The batch
+// is taken over from the given vector, which is left empty.
+// Backlog is the number of events still waiting after the batch.
 class TimelineBatchReadyNotification : public Poco::Notification {
  public:
   TimelineBatchReadyNotification(const Poco::UInt64 _user_id,
-            std::vector<TimelineEvent> _batch,
-            std::string _desktop_id) :
+            std::vector<TimelineEvent> *_batch,
+            const std::string &_desktop_id,
+            const Poco::UInt64 _backlog) :
         user_id(_user_id),
-        batch(_batch),
-        desktop_id(_desktop_id) {}
+        desktop_id(_desktop_id),
+        backlog(_backlog) {
+        batch.swap(*_batch);
+    }
     Poco::UInt64 user_id;
     std::vector<TimelineEvent> batch;
     std::string desktop_id;
+    Poco::UInt64 backlog;
 };
 
 // A batch of timeline events has been upladed and may be deleted.
+// The batch is the range of event IDs from first_id to last_id.
 class DeleteTimelineBatchNotification : public Poco::Notification {
  public:
-    explicit DeleteTimelineBatchNotification(std::vector<TimelineEvent> _batch)
-        : batch(_batch) {}
-    std::vector<TimelineEvent> batch;
+    DeleteTimelineBatchNotification(const Poco::UInt64 _user_id,
+            const unsigned int _first_id,
+            const unsigned int _last_id) :
+        user_id(_user_id),
+        first_id(_first_id),
+        last_id(_last_id) {}
+    Poco::UInt64 user_id;
+    unsigned int first_id;
+    unsigned int last_id;
+};
+
+// A block of timeline events packed while uploads were failing is
+// ready for upload, in place of a batch. The block is the gzipped
+// JSON of its events, taken over from the given string, and is sent
+// as it is. Backlog is the number of events still waiting after it.
+class TimelineBlockReadyNotification : public Poco::Notification {
+ public:
+  TimelineBlockReadyNotification(const Poco::UInt64 _user_id,
+            const Poco::Int64 _block_id,
+            const unsigned int _events,
+            const Poco::UInt64 _json_size,
+            std::string *_block,
+            const Poco::UInt64 _backlog) :
+        user_id(_user_id),
+        block_id(_block_id),
+        events(_events),
+        json_size(_json_size),
+        backlog(_backlog) {
+        block.swap(*_block);
+    }
+    Poco::UInt64 user_id;
+    Poco::Int64 block_id;
+    unsigned int events;
+    Poco::UInt64 json_size;
+    std::string block;
+    Poco::UInt64 backlog;
+};
+
+// A block of timeline events has been uploaded and may be deleted.
+class DeleteTimelineBlockNotification : public Poco::Notification {
+ public:
+    DeleteTimelineBlockNotification(const Poco::UInt64 _user_id,
+            const Poco::Int64 _block_id) :
+        user_id(_user_id),
+        block_id(_block_id) {}
+    Poco::UInt64 user_id;
+    Poco::Int64 block_id;
 };
 
 #endif  // SRC_TIMELINE_NOTIFICATIONS_H_
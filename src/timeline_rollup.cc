@@ -0,0 +1,82 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./timeline_rollup.h"
+
+#include <algorithm>
+
+namespace kopsik {
+
+TimelineRollupKey::TimelineRollupKey(
+    const unsigned int _user_id, const time_t _hour, const bool _idle,
+    const SharedString &_filename) :
+    user_id(_user_id),
+    hour(_hour),
+    idle(_idle),
+    filename(_filename) {}
+
+bool TimelineRollupKey::operator<(const TimelineRollupKey &other) const {
+    if (hour != other.hour) {
+        return hour < other.hour;
+    }
+    if (user_id != other.user_id) {
+        return user_id < other.user_id;
+    }
+    if (idle != other.idle) {
+        return other.idle;
+    }
+    return *filename < *other.filename;
+}
+
+void TimelineRollup::Add(const TimelineEvent &event) {
+    time_t start = event.start_time;
+    while (start < event.end_time) {
+        time_t hour = start - start % kTimelineRollupSeconds;
+        time_t end = std::min(event.end_time,
+                              hour + kTimelineRollupSeconds);
+        TimelineRollupKey key(event.user_id, hour, event.idle,
+                              event.idle ? empty() : event.filename);
+        seconds_[key] += end - start;
+        start = end;
+    }
+}
+
+void TimelineRollup::TakeFinished(
+    const time_t now, std::vector<TimelineEvent> *events) {
+    while (!seconds_.empty()
+            && seconds_.begin()->first.hour + kTimelineRollupSeconds
+                <= now) {
+        take(seconds_.begin(), events);
+    }
+}
+
+void TimelineRollup::TakeAll(std::vector<TimelineEvent> *events) {
+    while (!seconds_.empty()) {
+        take(seconds_.begin(), events);
+    }
+}
+
+bool TimelineRollup::Empty() const {
+    return seconds_.empty();
+}
+
+std::size_t TimelineRollup::MemoryBytes() const {
+    return MapNodesBytes(seconds_);
+}
+
+void TimelineRollup::take(
+    Seconds::iterator it, std::vector<TimelineEvent> *events) {
+    TimelineEvent event;
+    event.user_id = it->first.user_id;
+    event.start_time = it->first.hour;
+    event.end_time = it->first.hour + it->second;
+    event.idle = it->first.idle;
+    event.filename = it->first.filename;
+    events->push_back(event);
+    seconds_.erase(it);
+}
+
+SharedString TimelineRollup::empty() {
+    return StringTable::Timeline().Intern("");
+}
+
+}  // namespace kopsik
@@ -0,0 +1,67 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIMELINE_ROLLUP_H_
+#define SRC_TIMELINE_ROLLUP_H_
+
+#include <time.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./memory_usage.h"
+#include "./string_table.h"
+#include "./timeline_event.h"
+
+namespace kopsik {
+
+const time_t kTimelineRollupSeconds = 60 * 60;
+
+// App of a user within one hour, idle time kept apart
+class TimelineRollupKey {
+ public:
+    TimelineRollupKey(const unsigned int _user_id,
+                      const time_t _hour,
+                      const bool _idle,
+                      const SharedString &_filename);
+
+    bool operator<(const TimelineRollupKey &other) const;
+
+    unsigned int user_id;
+    time_t hour;
+    bool idle;
+    SharedString filename;
+};
+
+// Seconds spent in each app per hour, added up as timeline events come
+// in, for storing and uploading instead of every focus change. Events
+// are split where hours change. An hour is taken out as one event per
+// app, starting at the hour and lasting as long as the app was used in
+// it, without a window title.
+class TimelineRollup {
+ public:
+    void Add(const TimelineEvent &event);
+
+    // Takes out the hours that are over by now
+    void TakeFinished(const time_t now, std::vector<TimelineEvent> *events);
+
+    void TakeAll(std::vector<TimelineEvent> *events);
+
+    bool Empty() const;
+
+    // Without the interned filenames
+    std::size_t MemoryBytes() const;
+
+ private:
+    typedef std::map<TimelineRollupKey, time_t> Seconds;
+
+    void take(Seconds::iterator it, std::vector<TimelineEvent> *events);
+
+    static SharedString empty();
+
+    Seconds seconds_;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_TIMELINE_ROLLUP_H_
@@ -0,0 +1,44 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TIMELINE_STREAM_H_
+#define SRC_TIMELINE_STREAM_H_
+
+#include <string>
+
+#include "./types.h"
+
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Takes the server's answers to the timeline batches sent on a
+  // TimelineStream
+  class TimelineStreamListener {
+  public:
+    virtual ~TimelineStreamListener() {}
+    // On the thread that receives from the stream. err is noError
+    // when the server has stored the batch.
+    virtual void TimelineAcknowledged(
+      const Poco::UInt64 batch_id,
+      const error &err) = 0;
+  };
+
+  // Authenticated connection that's kept open anyway, which timeline
+  // batches can be sent on as messages instead of a POST each. The
+  // server acknowledges each batch by its ID.
+  class TimelineStream {
+  public:
+    virtual ~TimelineStream() {}
+    // events_json is a JSON array of the events. Fails right away,
+    // without sending, while the connection isn't up.
+    virtual error SendTimeline(
+      const Poco::UInt64 batch_id,
+      const std::string &events_json) = 0;
+    // One at a time, 0 for none. Once this returns, the one before
+    // isn't called anymore.
+    virtual void SetTimelineListener(TimelineStreamListener *listener) = 0;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TIMELINE_STREAM_H_
@@ -2,111 +2,288 @@
 
 #include "./timeline_uploader.h"
 
-#include <libjson.h>
-
+#include <algorithm>
 #include <sstream>
 #include <string>
 
 #include "./timeline_constants.h"
+#include "./connectivity_monitor.h"
 #include "./https_client.h"
+#include "./log.h"
+#include "./metrics.h"
+#include "./trace.h"
 
 #include "Poco/Foundation.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Timestamp.h"
+#include "Poco/URI.h"
 #include "Poco/Util/Application.h"
-#include "Poco/Thread.h"
 
 namespace kopsik {
 
 void TimelineUploader::handleTimelineBatchReadyNotification(
         TimelineBatchReadyNotification *notification) {
+    Poco::AutoPtr<TimelineBatchReadyNotification> ptr(notification);
+
     Poco::Logger &logger = Poco::Logger::get("timeline_uploader");
     logger.debug("handleTimelineBatchReadyNotification");
 
-    poco_assert(user_id_ == notification->user_id);
+    // The batch may have been queued for a user who has logged out since.
+    if (user_id_ != notification->user_id) {
+        return;
+    }
     poco_assert(!notification->desktop_id.empty());
     poco_assert(!notification->batch.empty());
 
-    if (!sync(user_id_, api_token_, notification->batch,
-            notification->desktop_id)) {
+    {
+        Poco::Mutex::ScopedLock lock(batch_m_);
+        batch_.swap(notification->batch);
+        batch_desktop_id_ = notification->desktop_id;
+        batch_backlog_ = notification->backlog;
+        batch_pending_ = true;
+    }
+    uploading_.Wake();
+}
+
+void TimelineUploader::handleTimelineBlockReadyNotification(
+        TimelineBlockReadyNotification *notification) {
+    Poco::AutoPtr<TimelineBlockReadyNotification> ptr(notification);
+
+    Poco::Logger &logger = Poco::Logger::get("timeline_uploader");
+    logger.debug("handleTimelineBlockReadyNotification");
+
+    if (user_id_ != notification->user_id) {
+        return;
+    }
+    poco_assert(!notification->block.empty());
+
+    {
+        Poco::Mutex::ScopedLock lock(batch_m_);
+        block_.swap(notification->block);
+        block_id_ = notification->block_id;
+        block_events_ = notification->events;
+        block_json_size_ = notification->json_size;
+        batch_backlog_ = notification->backlog;
+        batch_pending_ = true;
+    }
+    uploading_.Wake();
+}
+
+bool TimelineUploader::upload_batch() {
+    TraceSpan trace("TimelineUploader::upload_batch");
+    std::vector<TimelineEvent> batch;
+    std::string desktop_id("");
+    std::string block("");
+    Poco::Int64 block_id(0);
+    unsigned int block_events(0);
+    Poco::UInt64 block_json_size(0);
+    Poco::UInt64 backlog(0);
+    {
+        Poco::Mutex::ScopedLock lock(batch_m_);
+        batch.swap(batch_);
+        desktop_id = batch_desktop_id_;
+        block.swap(block_);
+        block_id = block_id_;
+        block_events = block_events_;
+        block_json_size = block_json_size_;
+        backlog = batch_backlog_;
+    }
+    if (batch.empty() && block.empty()) {
+        return false;
+    }
+    // Blocks are answered instead of batches, never along with them
+    const std::size_t events = block.empty() ? batch.size() : block_events;
+
+    Poco::Logger &logger = Poco::Logger::get("timeline_uploader");
+
+    error err = block.empty()
+        ? sync(user_id_, api_token_, batch, desktop_id)
+        : sync_block(user_id_, block, block_json_size, block_events);
+    // Busy server has said when to come back, the upload loop
+    // waits for that instead of backing off on its own
+    if (err == kRequestDeferred) {
+        logger.information("Timeline upload deferred, server is busy");
+        Poco::Timestamp now;
+        return HTTPSRateLimiter::Instance().RetryAt(
+            Poco::URI(timeline_upload_url_), now) > now;
+    }
+    if (err != noError) {
         std::stringstream out;
-        out << "Sync of " << notification->batch.size() << " event(s) failed.";
+        out << "Sync of " << events << " event(s) failed.";
         logger.error(out.str());
-        return;
+
+        exponential_backoff();
+        batch_size_ = std::max(batch_size_ / 2, kTimelineUploadMinBatchSize);
+        return false;
     }
 
+    Metrics::Shared().Count("timeline.events_uploaded", events);
+    Metrics::Shared().SetGauge("timeline.backlog",
+        static_cast<Poco::Int64>(backlog));
+
     std::stringstream out;
-    out << "Sync of " << notification->batch.size()
-        << " event(s) was successful.";
+    out << "Sync of " << events << " event(s) was successful.";
     logger.information(out.str());
 
-    Poco::NotificationCenter& nc =
-        Poco::NotificationCenter::defaultCenter();
-    DeleteTimelineBatchNotification response(notification->batch);
-    Poco::AutoPtr<DeleteTimelineBatchNotification> ptr(&response);
-    nc.postNotification(ptr);
+    reset_backoff();
+
+    // The events after a block are still where they were, so the
+    // next batch is selected after the same ID as before
+    if (!block.empty()) {
+        TimelineDispatcher::Instance().Post(
+            new DeleteTimelineBlockNotification(user_id_, block_id),
+            notifications_);
+        return backlog >= kTimelineUploadBacklogThreshold;
+    }
+
+    TimelineDispatcher::Instance().Post(new DeleteTimelineBatchNotification(
+        user_id_, batch.front().id, batch.back().id), notifications_);
+
+    // Drain a large backlog back-to-back, taking bigger bites while
+    // batches come back full. What's left under the threshold waits
+    // for the normal interval.
+    if (backlog < kTimelineUploadBacklogThreshold) {
+        last_uploaded_id_ = 0;
+        return false;
+    }
+    last_uploaded_id_ = batch.back().id;
+    if (batch.size() >= batch_size_) {
+        batch_size_ = std::min(batch_size_ * 2, kTimelineUploadMaxBatchSize);
+    }
+    return true;
+}
+
+// Quoted JSON string, only what JSON requires is escaped.
+static void append_json_string(const std::string &value, std::string *out) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    out->push_back('"');
+    for (std::string::const_iterator it = value.begin();
+            it != value.end();
+            ++it) {
+        const unsigned char c = static_cast<unsigned char>(*it);
+        switch (c) {
+        case '"': out->append("\\\""); break;
+        case '\\': out->append("\\\\"); break;
+        case '\b': out->append("\\b"); break;
+        case '\f': out->append("\\f"); break;
+        case '\n': out->append("\\n"); break;
+        case '\r': out->append("\\r"); break;
+        case '\t': out->append("\\t"); break;
+        default:
+            if (c < 0x20) {
+                out->append("\\u00");
+                out->push_back(kHexDigits[c >> 4]);
+                out->push_back(kHexDigits[c & 0xf]);
+            } else {
+                out->push_back(*it);
+            }
+        }
+    }
+    out->push_back('"');
 }
 
+// The upload can hold a large backlog, so the JSON is written
+// straight into one buffer without whitespace, instead of building
+// a libjson tree first.
 std::string TimelineUploader::convert_timeline_to_json(
         const std::vector<TimelineEvent> &timeline_events,
         const std::string &desktop_id) {
-    // initialize a new JSON array
-    JSONNODE *c = json_new(JSON_ARRAY);
+    std::string json("");
+    json.reserve(timeline_events.size() * 192);
+    json.push_back('[');
     for (std::vector<TimelineEvent>::const_iterator i = timeline_events.begin();
             i != timeline_events.end();
             ++i) {
         const TimelineEvent &event = *i;
-        // initialize new event node
-        JSONNODE *n = json_new(JSON_NODE);
-        // add fields to event node
+        if (i != timeline_events.begin()) {
+            json.push_back(',');
+        }
         if (event.idle) {
-            json_push_back(n, json_new_b("idle", true));
+            json.append("{\"idle\":true");
         } else {
-            json_push_back(n, json_new_a("filename", event.filename.c_str()));
-            json_push_back(n, json_new_a("title", event.title.c_str()));
+            json.append("{\"filename\":");
+            append_json_string(*event.filename, &json);
+            json.append(",\"title\":");
+            append_json_string(*event.title, &json);
         }
-        json_push_back(n,
-            json_new_i("start_time", (json_int_t)event.start_time));
-        json_push_back(n,
-            json_new_i("end_time", (json_int_t)event.end_time));
-        json_push_back(n, json_new_a("desktop_id", desktop_id.c_str()));
-        json_push_back(n, json_new_a("created_with", "timeline"));
-        // Push event node to array
-        json_push_back(c, n);
-    }
-    json_char *jc = json_write_formatted(c);
-    std::string json(jc);
-    json_free(jc);
-    json_delete(c);
+        json.append(",\"start_time\":");
+        Poco::NumberFormatter::append(json,
+            static_cast<Poco::Int64>(event.start_time));
+        json.append(",\"end_time\":");
+        Poco::NumberFormatter::append(json,
+            static_cast<Poco::Int64>(event.end_time));
+        json.append(",\"desktop_id\":");
+        append_json_string(desktop_id, &json);
+        json.append(",\"created_with\":\"timeline\"}");
+    }
+    json.push_back(']');
     return json;
 }
 
-void TimelineUploader::upload_loop_activity() {
-    while (!uploading_.isStopped()) {
-        std::stringstream out;
-        out << "upload_loop_activity (current interval "
-            << current_upload_interval_seconds_ << "s)";
-        Poco::Logger &logger = Poco::Logger::get("timeline_uploader");
-        logger.debug(out.str());
-
+Poco::Timestamp::TimeDiff TimelineUploader::upload_step() {
+    if (batch_requested_) {
+        // Upload the batch as soon as it's ready, and wait out
+        // the rest of the interval
+        bool pending(false);
         {
-            // Request data for upload.
-            Poco::NotificationCenter& nc =
-                Poco::NotificationCenter::defaultCenter();
-            CreateTimelineBatchNotification notification(user_id_);
-            Poco::AutoPtr<CreateTimelineBatchNotification> ptr(&notification);
-            nc.postNotification(ptr);
+            Poco::Mutex::ScopedLock lock(batch_m_);
+            pending = batch_pending_;
+            batch_pending_ = false;
         }
-
-        // Sleep in increments for faster shutdown.
-        for (unsigned int i = 0; i < current_upload_interval_seconds_; i++) {
-            if (uploading_.isStopped()) {
-                break;
+        if (pending) {
+            got_batch_ = true;
+            if (upload_batch()) {
+                batch_requested_ = false;
+                return 0;
             }
-            Poco::Thread::sleep(1000);
+        }
+        Poco::Timestamp::TimeDiff wait_micros =
+            next_request_at_ - Poco::Timestamp();
+        if (wait_micros > 0) {
+            return wait_micros;
+        }
+        batch_requested_ = false;
+        // Once the table is emptied, SQLite hands out
+        // IDs again from the start, so start over too.
+        if (!got_batch_) {
+            last_uploaded_id_ = 0;
         }
     }
+
+    // Busy server is left alone for as long as it asked,
+    // by all clients of the process
+    Poco::URI upload_uri(timeline_upload_url_);
+    Poco::Timestamp now;
+    Poco::Timestamp::TimeDiff deferred_micros =
+        HTTPSRateLimiter::Instance().RetryAt(upload_uri, now) - now;
+    if (deferred_micros > 0) {
+        return deferred_micros;
+    }
+    // Nor is the network tried while it's gone, see Resume
+    Poco::Timestamp::TimeDiff interval_micros =
+        Poco::Timestamp::TimeDiff(current_upload_interval_seconds_)
+        * Poco::Timestamp::resolution();
+    if (ConnectivityMonitor::Instance().IsOffline()) {
+        return interval_micros;
+    }
+
+    KOPSIK_LOG_DEBUG(Poco::Logger::get("timeline_uploader"),
+        "upload_step (current interval "
+        << current_upload_interval_seconds_ << "s)");
+
+    // Request data for upload. The database answers
+    // on the dispatcher thread, and wakes up the loop.
+    TimelineDispatcher::Instance().Post(
+        new CreateTimelineBatchNotification(
+            user_id_, batch_size_, last_uploaded_id_),
+        notifications_);
+    batch_requested_ = true;
+    got_batch_ = false;
+    next_request_at_ = now + interval_micros;
+    return interval_micros;
 }
 
-bool TimelineUploader::sync(
+error TimelineUploader::sync(
         const Poco::UInt64 user_id,
         const std::string api_token,
         const std::vector<TimelineEvent> &timeline_events,
@@ -114,23 +291,93 @@ bool TimelineUploader::sync(
     poco_assert(!timeline_events.empty());
     poco_assert(user_id > 0);
 
-    HTTPSClient client(timeline_upload_url_, app_name_, app_version_);
-
-    std::stringstream out;
-    out << "Uploading " << timeline_events.size()
-        << " event(s) of user " << user_id;
     Poco::Logger &logger = Poco::Logger::get("timeline_uploader");
-    logger.debug(out.str());
+    KOPSIK_LOG_DEBUG(logger, "Uploading " << timeline_events.size()
+        << " event(s) of user " << user_id);
 
     std::string json = convert_timeline_to_json(timeline_events, desktop_id);
+
+    bool sent(false);
+    error err = sync_stream(json, &sent);
+    if (sent) {
+        if (err != noError) {
+            logger.error(err);
+        }
+        return err;
+    }
+
+    HTTPSClient client(timeline_upload_url_, app_name_, app_version_);
     std::string response_body("");
-    error err = client.PostJSON("/api/v8/timeline", json,
+    err = client.PostJSON("/api/v8/timeline", json,
       api_token_, "api_token",  &response_body);
     if (err != noError) {
         logger.error(err);
-        return false;
     }
-    return true;
+    return err;
+}
+
+error TimelineUploader::sync_stream(const std::string &json, bool *sent) {
+    poco_assert(sent);
+    *sent = false;
+
+    Poco::UInt64 batch_id(0);
+    {
+        Poco::FastMutex::ScopedLock lock(ack_m_);
+        batch_id = ++stream_batch_id_;
+    }
+    {
+        Poco::FastMutex::ScopedLock lock(stream_m_);
+        if (!stream_) {
+            return noError;
+        }
+        error err = stream_->SendTimeline(batch_id, json);
+        if (err != noError) {
+            KOPSIK_LOG_DEBUG(Poco::Logger::get("timeline_uploader"),
+                "Not sending on the stream: " << err);
+            return noError;
+        }
+    }
+    *sent = true;
+    Metrics::Shared().Count("timeline.stream_batches", 1);
+
+    Poco::Timestamp started;
+    const Poco::Timestamp::TimeDiff timeout =
+        Poco::Timestamp::TimeDiff(kTimelineStreamAckTimeoutSeconds)
+        * Poco::Timestamp::resolution();
+    Poco::FastMutex::ScopedLock lock(ack_m_);
+    while (acked_batch_id_ != batch_id) {
+        Poco::Timestamp::TimeDiff left = timeout - started.elapsed();
+        if (left <= 0) {
+            return error("Timeline batch was not acknowledged in time");
+        }
+        ack_.tryWait(ack_m_, static_cast<long>(left / 1000) + 1);  // NOLINT
+    }
+    return ack_error_;
+}
+
+error TimelineUploader::sync_block(
+        const Poco::UInt64 user_id,
+        const std::string &block,
+        const Poco::UInt64 json_size,
+        const unsigned int events) {
+    poco_assert(!block.empty());
+    poco_assert(json_size > 0);
+
+    HTTPSClient client(timeline_upload_url_, app_name_, app_version_);
+
+    Poco::Logger &logger = Poco::Logger::get("timeline_uploader");
+    KOPSIK_LOG_DEBUG(logger, "Uploading block of " << events
+        << " event(s) of user " << user_id << ", " << block.size()
+        << " of " << json_size << " bytes");
+
+    GzippedRequestBody body(block, json_size);
+    std::string response_body("");
+    error err = client.PostJSON("/api/v8/timeline", &body,
+      api_token_, "api_token", &response_body);
+    if (err != noError) {
+        logger.error(err);
+    }
+    return err;
 }
 
 void TimelineUploader::exponential_backoff() {
@@ -141,9 +388,8 @@ void TimelineUploader::exponential_backoff() {
         logger.warning("Max upload interval reached.");
         current_upload_interval_seconds_ = max_upload_interval_seconds_;
     }
-    std::stringstream out;
-    out << "Upload interval set to " << current_upload_interval_seconds_ << "s";
-    logger.debug(out.str());
+    KOPSIK_LOG_DEBUG(logger, "Upload interval set to "
+        << current_upload_interval_seconds_ << "s");
 }
 
 void TimelineUploader::reset_backoff() {
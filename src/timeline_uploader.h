@@ -9,53 +9,93 @@
 #include "./timeline_event.h"
 #include "./timeline_notifications.h"
 #include "./timeline_constants.h"
+#include "./timeline_dispatcher.h"
+#include "./timeline_stream.h"
 #include "./types.h"
+#include "./worker_pool.h"
 
-#include "Poco/Activity.h"
+#include "Poco/Condition.h"
+#include "Poco/Mutex.h"
 #include "Poco/Observer.h"
 #include "Poco/NotificationCenter.h"
 #include "Poco/Logger.h"
+#include "Poco/Timestamp.h"
 
 namespace kopsik {
 
-class TimelineUploader {
+class TimelineUploader : public TimelineStreamListener {
  public:
+    // Talks to the database through the notification
+    // center of its context. Batches go on the stream, if
+    // there's one, see SetStream.
     TimelineUploader(
                 const Poco::UInt64 user_id,
                 const std::string api_token,
                 const std::string timeline_upload_url,
                 const std::string app_name,
-                const std::string app_version) :
+                const std::string app_version,
+                Poco::NotificationCenter &notifications,  // NOLINT
+                TimelineStream *stream = 0) :
             user_id_(user_id),
             api_token_(api_token),
             upload_interval_seconds_(kTimelineUploadIntervalSeconds),
             current_upload_interval_seconds_(kTimelineUploadIntervalSeconds),
             max_upload_interval_seconds_(kTimelineUploadMaxBackoffSeconds),
+            batch_size_(kTimelineUploadBatchSize),
+            last_uploaded_id_(0),
             timeline_upload_url_(timeline_upload_url),
             app_name_(app_name),
             app_version_(app_version),
-            uploading_(this, &TimelineUploader::upload_loop_activity) {
-        Poco::NotificationCenter& nc =
-            Poco::NotificationCenter::defaultCenter();
+            batch_backlog_(0),
+            block_id_(0),
+            block_events_(0),
+            block_json_size_(0),
+            batch_pending_(false),
+            batch_requested_(false),
+            got_batch_(false),
+            stream_(0),
+            stream_batch_id_(0),
+            acked_batch_id_(0),
+            ack_error_(noError),
+            notifications_(notifications),
+            uploading_(this, &TimelineUploader::upload_step,
+                       WorkerPool::Background) {
+        Poco::NotificationCenter& nc = notifications_;
 
         Poco::Observer<TimelineUploader, TimelineBatchReadyNotification>
             observeUpload(*this,
                 &TimelineUploader::handleTimelineBatchReadyNotification);
         nc.addObserver(observeUpload);
 
+        Poco::Observer<TimelineUploader, TimelineBlockReadyNotification>
+            observeBlock(*this,
+                &TimelineUploader::handleTimelineBlockReadyNotification);
+        nc.addObserver(observeBlock);
+
         poco_assert(!api_token_.empty());
         poco_assert(user_id_ > 0);
         poco_assert(!timeline_upload_url.empty());
 
+        SetStream(stream);
         uploading_.start();
     }
 
+    // Asks the upload loop to stop, without waiting for it.
+    // An upload already under way is finished first.
+    void RequestStop() {
+        uploading_.stop();
+    }
+
+    // Uploads are paused while offline. Once back, the next
+    // batch is asked for right away.
+    void Resume() {
+        uploading_.Wake();
+    }
+
     error Stop() {
         try {
-            if (uploading_.isRunning()) {
-                uploading_.stop();
-                uploading_.wait();
-            }
+            RequestStop();
+            uploading_.wait();
         } catch(const Poco::Exception& exc) {
             return exc.displayText();
         } catch(const std::exception& ex) {
@@ -66,28 +106,85 @@ class TimelineUploader {
         return noError;
     }
 
+    // While the stream is connected, batches are sent on it instead
+    // of being POSTed, and the server's acknowledgement of a batch
+    // is what has it deleted. Blocks are still POSTed as they are,
+    // gzipped. 0 for POSTs only.
+    void SetStream(TimelineStream *stream) {
+        Poco::FastMutex::ScopedLock lock(stream_m_);
+        if (stream_) {
+            stream_->SetTimelineListener(0);
+        }
+        stream_ = stream;
+        if (stream_) {
+            stream_->SetTimelineListener(this);
+        }
+    }
+
+    // TimelineStreamListener
+    void TimelineAcknowledged(
+        const Poco::UInt64 batch_id,
+        const error &err) {
+        Poco::FastMutex::ScopedLock lock(ack_m_);
+        acked_batch_id_ = batch_id;
+        ack_error_ = err;
+        ack_.broadcast();
+    }
+
     ~TimelineUploader() {
         Stop();
+        SetStream(0);
+
+        Poco::NotificationCenter& nc = notifications_;
+
+        Poco::Observer<TimelineUploader, TimelineBatchReadyNotification>
+            observeUpload(*this,
+                &TimelineUploader::handleTimelineBatchReadyNotification);
+        nc.removeObserver(observeUpload);
+
+        Poco::Observer<TimelineUploader, TimelineBlockReadyNotification>
+            observeBlock(*this,
+                &TimelineUploader::handleTimelineBlockReadyNotification);
+        nc.removeObserver(observeBlock);
     }
 
+    static std::string convert_timeline_to_json(
+        const std::vector<TimelineEvent> &timeline_events,
+        const std::string &desktop_id);
+
  protected:
     // Notification handlers
     void handleTimelineBatchReadyNotification(
         TimelineBatchReadyNotification *notification);
+    void handleTimelineBlockReadyNotification(
+        TimelineBlockReadyNotification *notification);
 
-    // Activity callback
-    void upload_loop_activity();
+    // Loop callback: asks the database for a batch, uploads it once
+    // it's handed over, and returns how long to wait for what's next
+    Poco::Timestamp::TimeDiff upload_step();
 
  private:
+    // Upload the batch handed over by the database, if there is one.
+    // Returns true if the next batch should be requested right away,
+    // or as soon as the server is ready for it, if it was busy.
+    bool upload_batch();
+
     // Sync with server
-  bool sync(
+    error sync(
         const Poco::UInt64 user_id,
         const std::string api_token,
         const std::vector<TimelineEvent> &timeline_events,
         const std::string desktop_id);
-    static std::string convert_timeline_to_json(
-        const std::vector<TimelineEvent> &timeline_events,
-        const std::string &desktop_id);
+    // Sends the JSON of a batch on the stream and waits for the
+    // server to acknowledge it. sent is false when the stream wasn't
+    // connected, and the batch can be POSTed instead.
+    error sync_stream(const std::string &json, bool *sent);
+    // Sends the gzipped JSON of a block as it is
+    error sync_block(
+        const Poco::UInt64 user_id,
+        const std::string &block,
+        const Poco::UInt64 json_size,
+        const unsigned int events);
 
     Poco::UInt64 user_id_;
     std::string api_token_;
@@ -102,13 +199,53 @@ class TimelineUploader {
     unsigned int current_upload_interval_seconds_;
     unsigned int max_upload_interval_seconds_;
 
+    // How many events to request for the next upload.
+    unsigned int batch_size_;
+
+    // While draining a backlog, the next batch is selected after
+    // the last event uploaded, so events whose delete is still queued
+    // (or has failed) are not uploaded again.
+    unsigned int last_uploaded_id_;
+
     std::string timeline_upload_url_;
     std::string app_name_;
     std::string app_version_;
 
-    // An Activity is a possibly long running void/no arguments
-    // member function running in its own thread.
-    Poco::Activity<TimelineUploader> uploading_;
+    // Batch ready for upload. The database stage sets it on the
+    // dispatcher thread, the upload itself runs on the uploader thread.
+    Poco::Mutex batch_m_;
+    std::vector<TimelineEvent> batch_;
+    std::string batch_desktop_id_;
+    Poco::UInt64 batch_backlog_;
+    // Or a block, see TimelineBlockReadyNotification
+    std::string block_;
+    Poco::Int64 block_id_;
+    unsigned int block_events_;
+    Poco::UInt64 block_json_size_;
+    // Set when a batch or a block is handed over
+    bool batch_pending_;
+
+    // Used by the loop only. A batch has been asked for, and is
+    // waited for until the next one is due.
+    bool batch_requested_;
+    bool got_batch_;
+    Poco::Timestamp next_request_at_;
+
+    Poco::FastMutex stream_m_;
+    TimelineStream *stream_;
+    // The last batch sent on the stream, and the last one the server
+    // has acknowledged
+    Poco::FastMutex ack_m_;
+    Poco::Condition ack_;
+    Poco::UInt64 stream_batch_id_;
+    Poco::UInt64 acked_batch_id_;
+    error ack_error_;
+
+    Poco::NotificationCenter &notifications_;
+
+    // Runs on the shared workers, the waits between steps take no
+    // thread
+    WorkerLoop<TimelineUploader> uploading_;
 };
 
 }  // namespace kopsik
@@ -0,0 +1,183 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./title_filter.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace kopsik {
+
+void TitleFilter::SetPatterns(
+    const std::vector<std::string> &redact,
+    const std::vector<std::string> &drop) {
+  Poco::SharedPtr<Automaton> automaton(new Automaton());
+  for (std::size_t i = 0; i < redact.size(); i++) {
+    automaton->Add(redact[i], false);
+  }
+  for (std::size_t i = 0; i < drop.size(); i++) {
+    automaton->Add(drop[i], true);
+  }
+  automaton->Compile();
+
+  Poco::FastMutex::ScopedLock lock(m_);
+  automaton_ = automaton;
+  cache_.clear();
+}
+
+bool TitleFilter::Apply(std::string *filename, std::string *title) {
+  Key key(*filename, *title);
+  Poco::SharedPtr<Automaton> automaton;
+  {
+    Poco::FastMutex::ScopedLock lock(m_);
+    if (automaton_->Empty()) {
+      return true;
+    }
+    std::map<Key, Verdict>::const_iterator it = cache_.find(key);
+    if (it != cache_.end()) {
+      Metrics::Shared().Count("title_filter.cache_hits");
+      *filename = it->second.filename;
+      *title = it->second.title;
+      return !it->second.drop;
+    }
+    automaton = automaton_;
+  }
+
+  // The two in one pass, a line break between them so that no
+  // pattern matches across
+  std::string text(*filename + "\n" + *title);
+  std::vector<bool> redacted;
+  Verdict verdict;
+  verdict.drop = automaton->Match(text, &redacted);
+  if (!verdict.drop) {
+    verdict.filename = redact(text, redacted, 0, filename->size());
+    verdict.title = redact(text, redacted, filename->size() + 1,
+                           text.size());
+  }
+  Metrics::Shared().Count("title_filter.passes");
+
+  Poco::FastMutex::ScopedLock lock(m_);
+  if (automaton == automaton_) {
+    if (cache_.size() >= kTitleFilterCacheSize) {
+      cache_.clear();
+    }
+    cache_[key] = verdict;
+  }
+  *filename = verdict.filename;
+  *title = verdict.title;
+  return !verdict.drop;
+}
+
+std::string TitleFilter::redact(
+    const std::string &text, const std::vector<bool> &redacted,
+    const std::size_t begin, const std::size_t end) {
+  std::string result("");
+  for (std::size_t i = begin; i < end; i++) {
+    if (!redacted[i]) {
+      result += text[i];
+    } else if (i == begin || !redacted[i - 1]) {
+      result += kTitleRedacted;
+    }
+  }
+  return result;
+}
+
+bool TitleFilter::Automaton::Empty() const {
+  return nodes_.size() == 1;
+}
+
+void TitleFilter::Automaton::Add(const std::string &pattern, const bool drop) {
+  if (pattern.empty()) {
+    return;
+  }
+  std::size_t state = 0;
+  for (std::size_t i = 0; i < pattern.size(); i++) {
+    char c = lower(pattern[i]);
+    std::size_t next = child(state, c);
+    if (!next) {
+      next = nodes_.size();
+      nodes_.push_back(Node());
+      nodes_[state].edges.push_back(std::make_pair(c, next));
+    }
+    state = next;
+  }
+  if (drop) {
+    nodes_[state].drop = true;
+  } else {
+    nodes_[state].length = std::max(nodes_[state].length,
+                                    pattern.size());
+  }
+}
+
+void TitleFilter::Automaton::Compile() {
+  std::deque<std::size_t> queue;
+  for (std::size_t i = 0; i < nodes_[0].edges.size(); i++) {
+    queue.push_back(nodes_[0].edges[i].second);
+  }
+  while (!queue.empty()) {
+    std::size_t state = queue.front();
+    queue.pop_front();
+    const Node &node = nodes_[state];
+    for (std::size_t i = 0; i < node.edges.size(); i++) {
+      char c = node.edges[i].first;
+      std::size_t next = node.edges[i].second;
+      nodes_[next].fail = step(node.fail, c);
+      const Node &fail = nodes_[nodes_[next].fail];
+      nodes_[next].drop = nodes_[next].drop || fail.drop;
+      nodes_[next].length = std::max(nodes_[next].length, fail.length);
+      queue.push_back(next);
+    }
+  }
+}
+
+bool TitleFilter::Automaton::Match(
+    const std::string &text, std::vector<bool> *redacted) const {
+  redacted->assign(text.size(), false);
+  std::size_t state = 0;
+  // Characters before this are marked already
+  std::size_t marked = 0;
+  for (std::size_t i = 0; i < text.size(); i++) {
+    state = step(state, lower(text[i]));
+    const Node &node = nodes_[state];
+    if (node.drop) {
+      return true;
+    }
+    if (node.length) {
+      for (std::size_t j = std::max(i + 1 - node.length, marked);
+          j <= i;
+          j++) {
+        (*redacted)[j] = true;
+      }
+      marked = i + 1;
+    }
+  }
+  return false;
+}
+
+char TitleFilter::Automaton::lower(const char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+std::size_t TitleFilter::Automaton::child(
+    const std::size_t state, const char c) const {
+  const std::vector<std::pair<char, std::size_t> > &edges =
+    nodes_[state].edges;
+  for (std::size_t i = 0; i < edges.size(); i++) {
+    if (edges[i].first == c) {
+      return edges[i].second;
+    }
+  }
+  return 0;
+}
+
+std::size_t TitleFilter::Automaton::step(
+    std::size_t state, const char c) const {
+  while (true) {
+    std::size_t next = child(state, c);
+    if (next || !state) {
+      return next;
+    }
+    state = nodes_[state].fail;
+  }
+}
+
+}  // namespace kopsik
@@ -0,0 +1,110 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TITLE_FILTER_H_
+#define SRC_TITLE_FILTER_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./metrics.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/SharedPtr.h"
+
+namespace kopsik {
+
+  // What a redacted part of a title or filename is replaced with
+  const char kTitleRedacted[] = "***";
+  // Verdicts kept before the cache is started over
+  const std::size_t kTitleFilterCacheSize = 1000;
+
+  // Patterns that keep window titles out of the timeline, such as
+  // customer names and ticket IDs. They're plain text, matched
+  // anywhere and regardless of ASCII case. Where a redact pattern
+  // matches, the text is replaced with kTitleRedacted; when a drop
+  // pattern matches, the window isn't recorded at all. All of them
+  // are compiled into one Aho-Corasick automaton, so a title and its
+  // filename are looked at in one pass however many patterns there
+  // are, and the verdict for each (filename, title) is cached, as the
+  // same few windows come back all day. Safe to share between
+  // threads.
+  class TitleFilter {
+  public:
+    TitleFilter() : automaton_(new Automaton()) {}
+
+    // Replaces the patterns, empty ones are left out
+    void SetPatterns(
+        const std::vector<std::string> &redact,
+        const std::vector<std::string> &drop);
+
+    // False when the window isn't to be recorded. Otherwise the
+    // title and filename are redacted as needed.
+    bool Apply(std::string *filename, std::string *title);
+
+  private:
+    typedef std::pair<std::string, std::string> Key;
+
+    typedef struct {
+      bool drop;
+      std::string filename;
+      std::string title;
+    } Verdict;
+
+    // text from begin to end, with each run of redacted characters
+    // replaced once
+    static std::string redact(
+        const std::string &text,
+        const std::vector<bool> &redacted,
+        const std::size_t begin,
+        const std::size_t end);
+
+    class Automaton {
+    public:
+      Automaton() : nodes_(1) {}
+
+      bool Empty() const;
+
+      void Add(const std::string &pattern, const bool drop);
+
+      // Failure links, breadth first, and what ends at each node
+      // through them
+      void Compile();
+
+      // True if a drop pattern matches. Otherwise redacted tells which
+      // characters of text a redact pattern matched.
+      bool Match(
+          const std::string &text,
+          std::vector<bool> *redacted) const;
+
+    private:
+      static char lower(const char c);
+
+      struct Node {
+        Node() : fail(0), length(0), drop(false) {}
+        std::vector<std::pair<char, std::size_t> > edges;
+        std::size_t fail;
+        // Longest redact pattern ending here
+        std::size_t length;
+        bool drop;
+      };
+
+      std::size_t child(const std::size_t state, const char c) const;
+
+      std::size_t step(std::size_t state, const char c) const;
+
+      std::vector<Node> nodes_;
+    };
+
+    Poco::SharedPtr<Automaton> automaton_;
+    std::map<Key, Verdict> cache_;
+    Poco::FastMutex m_;
+
+    TitleFilter(const TitleFilter &);
+    TitleFilter &operator=(const TitleFilter &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TITLE_FILTER_H_
@@ -10,11 +10,75 @@
 #include "./tag.h"
 #include "./kopsik_api_test.h"
 #include "./database.h"
+#include "./dns_cache.h"
 #include "./test_data.h"
 #include "./json.h"
-
+#include "./json_key.h"
+#include "./json_scan.h"
+#include "./process_name_cache.h"
+#include "./autocomplete_index.h"
+#include "./string_table.h"
+#include "./timeline_dispatcher.h"
+#include "./timeline_uploader.h"
+#include "./timeline_rollup.h"
+#include "./https_client.h"
+#include "./formatter.h"
+#include "./sync_scheduler.h"
+#include "./idle_detector.h"
+#include "./time_entry_digest.h"
+#include "./time_entry_groups.h"
+#include "./time_entry_import.h"
+#include "./time_entry_suggestions.h"
+#include "./title_filter.h"
+#include "./const.h"
+#include "./model_pool.h"
+#include "./power_policy.h"
+#include "./metrics.h"
+#include "./log.h"
+#include "./memory_usage.h"
+#include "./async_log_channel.h"
+#include "./binary_log_channel.h"
+#include "./connectivity_monitor.h"
+#include "./fake_toggl_api.h"
+#include "./feedback.h"
+#include "./trace.h"
+#include "./api_watchdog.h"
+#include "./instrumented_lock.h"
+#include "./thread_role.h"
+#include "./traffic_replay.h"
+#include "./network_reactor.h"
+#include "./websocket_client.h"
+#include "./websocket_inflater.h"
+#include "./window_change_recorder.h"
+#include "./worker_pool.h"
+#include "./workspace_fetch.h"
+
+#include "Poco/Base64Decoder.h"
+#include "Poco/DeflatingStream.h"
 #include "Poco/FileStream.h"
+#include "Poco/Event.h"
+#include "Poco/InflatingStream.h"
+#include "Poco/LocalDateTime.h"
 #include "Poco/File.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/StreamCopier.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/Stopwatch.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/Thread.h"
+#include "Poco/Timespan.h"
+#include "Poco/NObserver.h"
+#include "Poco/Net/DatagramSocket.h"
+#include "Poco/Net/HTTPClientSession.h"
+#include "Poco/Net/HTTPRequestHandler.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/Net/HTTPServer.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/HTTPServerResponse.h"
+#include "Poco/Net/SSLManager.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/SocketAddress.h"
 
 namespace kopsik {
 
@@ -24,6 +88,43 @@ namespace kopsik {
         ASSERT_EQ(std::string("alfa|beeta"), te.Tags());
     }
 
+    TEST(TogglApiClientTest, KeepsSeldomReadStringsApart) {
+        TimeEntry te;
+        ASSERT_EQ("", te.GUID());
+        ASSERT_EQ(noError, te.Error());
+        ASSERT_EQ("", te.CreatedWith());
+        ASSERT_EQ("", te.ProjectGUID());
+        std::size_t bytes = te.MemoryBytes();
+
+        // Nothing is allocated for values that are not set
+        te.SetCreatedWith("");
+        te.SetProjectGUID("");
+        te.SetError(noError);
+        ASSERT_FALSE(te.Dirty());
+        ASSERT_EQ(bytes, te.MemoryBytes());
+
+        std::string guid("07fba193-91c4-0ec8-2345-820df0548123");
+        te.SetGUID(guid);
+        ASSERT_EQ(guid, te.GUID());
+        ASSERT_TRUE(BinaryGUID::Of(guid) == te.GUIDKey());
+        ASSERT_LT(bytes, te.MemoryBytes());
+        bytes = te.MemoryBytes();
+
+        te.SetCreatedWith("kopsik_test");
+        te.SetProjectGUID("c3a86b8f-5b2d-4e86-8f09-f5b6a4a9d1a1");
+        ASSERT_EQ("kopsik_test", te.CreatedWith());
+        ASSERT_EQ("c3a86b8f-5b2d-4e86-8f09-f5b6a4a9d1a1", te.ProjectGUID());
+        ASSERT_TRUE(te.DirtyFields() & TimeEntry::kFieldCreatedWith);
+        ASSERT_TRUE(te.DirtyFields() & TimeEntry::kFieldProjectGUID);
+        ASSERT_LT(bytes, te.MemoryBytes());
+
+        te.SetError("Push failed");
+        ASSERT_EQ("Push failed", te.Error());
+        te.SetError(noError);
+        ASSERT_EQ(noError, te.Error());
+        ASSERT_EQ(guid, te.GUID());
+    }
+
     TEST(TogglApiClientTest, ProjectsHaveColorCodes) {
         Project p;
         p.SetColor("1");
@@ -66,6 +167,79 @@ namespace kopsik {
         ASSERT_EQ("", api_token_from_db);
     }
 
+    TEST(TogglApiClientTest, MergesTimeEntryFetches) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        Poco::UInt64 oldest(1);
+        ASSERT_EQ(noError, db.OldestTimeEntryFetch(1, &oldest));
+        ASSERT_EQ(Poco::UInt64(0), oldest);
+
+        std::vector<TimeEntryRange> ranges;
+        ASSERT_EQ(noError, db.UnfetchedTimeEntryRanges(1, 100, 200, &ranges));
+        ASSERT_EQ(std::size_t(1), ranges.size());
+        ASSERT_EQ(Poco::UInt64(100), ranges[0].since);
+        ASSERT_EQ(Poco::UInt64(200), ranges[0].until);
+
+        ASSERT_EQ(noError, db.SaveTimeEntryFetch(1, 120, 140));
+        ASSERT_EQ(noError, db.SaveTimeEntryFetch(1, 160, 180));
+        // Another user's fetches don't count
+        ASSERT_EQ(noError, db.SaveTimeEntryFetch(2, 100, 200));
+        ASSERT_EQ(noError, db.UnfetchedTimeEntryRanges(1, 100, 200, &ranges));
+        ASSERT_EQ(std::size_t(3), ranges.size());
+        ASSERT_EQ(Poco::UInt64(100), ranges[0].since);
+        ASSERT_EQ(Poco::UInt64(120), ranges[0].until);
+        ASSERT_EQ(Poco::UInt64(140), ranges[1].since);
+        ASSERT_EQ(Poco::UInt64(160), ranges[1].until);
+        ASSERT_EQ(Poco::UInt64(180), ranges[2].since);
+        ASSERT_EQ(Poco::UInt64(200), ranges[2].until);
+
+        // Fills the gap, touching both sides
+        ASSERT_EQ(noError, db.SaveTimeEntryFetch(1, 140, 160));
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, db.UInt(
+            "select count(1) from time_entry_fetches where uid = 1", &n));
+        ASSERT_EQ(Poco::UInt64(1), n);
+        ASSERT_EQ(noError, db.UnfetchedTimeEntryRanges(1, 130, 170, &ranges));
+        ASSERT_TRUE(ranges.empty());
+
+        ASSERT_EQ(noError, db.OldestTimeEntryFetch(1, &oldest));
+        ASSERT_EQ(Poco::UInt64(120), oldest);
+    }
+
+    TEST(TogglApiClientTest, SavesAndLoadsUpdateCheckValidators) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        std::string url("x");
+        std::string etag("x");
+        std::string last_modified("x");
+        std::string body("x");
+        ASSERT_EQ(noError,
+                  db.LoadUpdateCheck(&url, &etag, &last_modified, &body));
+        ASSERT_EQ("", url);
+        ASSERT_EQ("", etag);
+        ASSERT_EQ("", last_modified);
+        ASSERT_EQ("", body);
+
+        ASSERT_EQ(noError, db.SaveUpdateCheck(
+            "/api/v8/updates?app=td&channel=beta",
+            "\"abc123\"",
+            "Wed, 15 Oct 2014 07:28:00 GMT",
+            "{\"version\":\"7.0.1\"}"));
+        ASSERT_EQ(noError,
+                  db.LoadUpdateCheck(&url, &etag, &last_modified, &body));
+        ASSERT_EQ("/api/v8/updates?app=td&channel=beta", url);
+        ASSERT_EQ("\"abc123\"", etag);
+        ASSERT_EQ("Wed, 15 Oct 2014 07:28:00 GMT", last_modified);
+        ASSERT_EQ("{\"version\":\"7.0.1\"}", body);
+
+        // Channel setting lives in the same row and is left alone
+        std::string update_channel("");
+        ASSERT_EQ(noError, db.LoadUpdateChannel(&update_channel));
+        ASSERT_EQ("stable", update_channel);
+    }
+
     TEST(TogglApiClientTest, UpdatesTimeEntryFromJSON) {
         wipe_test_db();
         Database db(TESTDB);
@@ -81,6 +255,73 @@ namespace kopsik {
         ASSERT_EQ("Changed", te->Description());
     }
 
+    TEST(TogglApiClientTest, LoadsBatchUpdateResponseBodiesOnce) {
+        TimeEntry ok;
+        ok.EnsureGUID();
+        ok.SetDescription("Before");
+        TimeEntry failed;
+        failed.EnsureGUID();
+        ModelsByGUID models;
+        models[BinaryGUID::Of(ok.GUID())] = &ok;
+        models[BinaryGUID::Of(failed.GUID())] = &failed;
+
+        JSONWriter writer;
+        writer.BeginArray();
+        writer.BeginObject();
+        writer.String("body",
+            "{\"data\":{\"id\":123,\"description\":\"After\"}}");
+        writer.Int("status", 200);
+        writer.String("guid", ok.GUID());
+        writer.String("method", "PUT");
+        writer.EndObject();
+        writer.BeginObject();
+        writer.Int("status", 400);
+        writer.String("guid", failed.GUID());
+        writer.String("method", "POST");
+        writer.String("body", "Project is required");
+        writer.EndObject();
+        writer.EndArray();
+
+        std::vector<BatchUpdateResult> results;
+        ParseResponseArray(writer.Buffer(), &results);
+        ASSERT_EQ(std::size_t(2), results.size());
+        ASSERT_TRUE(results[0].Data);
+        ASSERT_EQ("", results[0].Body);
+        ASSERT_FALSE(results[1].Data);
+        ASSERT_EQ("Project is required", results[1].Body);
+
+        std::vector<error> errors;
+        ProcessResponseArray(&results, &models, &errors);
+        ASSERT_FALSE(results[0].Data);
+        ASSERT_EQ(Poco::UInt64(123), ok.ID());
+        ASSERT_EQ("After", ok.Description());
+        ASSERT_EQ(std::size_t(1), errors.size());
+        ASSERT_EQ("Project is required", failed.Error());
+    }
+
+    TEST(TogglApiClientTest, SkipsTimeEntriesUnchangedOnServer) {
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+
+        TimeEntry *te = user.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(te);
+        ASSERT_TRUE(te->UpdatedAt());
+        std::string description = te->Description();
+
+        // Same "at" as before, so the time entry is left as it is
+        te->SetDescription("Not from the server");
+        te->ClearDirty();
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        ASSERT_EQ("Not from the server", te->Description());
+        ASSERT_FALSE(te->Dirty());
+
+        // A newer one is loaded
+        std::string json = "{\"id\":89818605,\"description\":\"Newer\","
+            "\"at\":\"2037-01-01T00:00:00+00:00\"}";
+        LoadTimeEntryFromJSONString(te, json);
+        ASSERT_EQ("Newer", te->Description());
+    }
+
     TEST(TogglApiClientTest, UpdatesTimeEntryFromFullUserJSON) {
         wipe_test_db();
         Database db(TESTDB);
@@ -97,6 +338,11 @@ namespace kopsik {
         ASSERT_TRUE(n);
         json = json.replace(n,
             std::string("Important things").length(), "Even more important!");
+        // Edited on the server, so it has a newer "at"
+        n = json.find("2013-09-05T08:19:45", n);
+        ASSERT_NE(std::string::npos, n);
+        json = json.replace(n, std::string("2013-09-05T08:19:45").length(),
+            "2013-09-05T09:00:00");
 
         LoadUserFromJSONString(&user, json, true, true);
         te = user.GetTimeEntryByID(89818605);
@@ -104,6 +350,33 @@ namespace kopsik {
         ASSERT_EQ("Even more important!", te->Description());
     }
 
+    TEST(TogglApiClientTest, ParsesUserJSONWithoutTouchingUserUntilApplied) {
+        std::string json = loadTestData();
+
+        UserJSONStreamLoader loader(true, true);
+        loader.Consume(json.data(), json.size());
+        ASSERT_EQ(noError, loader.Finish());
+        ASSERT_LT(std::size_t(0), loader.StagedCount());
+
+        User user("kopsik_test", "0.1");
+        ASSERT_EQ(std::size_t(0), user.related.TimeEntries.size());
+        ASSERT_EQ(Poco::UInt64(0), user.Since());
+
+        loader.Apply(&user);
+        ASSERT_EQ(std::size_t(0), loader.StagedCount());
+        ASSERT_TRUE(user.GetTimeEntryByID(89818605));
+        ASSERT_TRUE(user.ID());
+        ASSERT_TRUE(user.Since());
+
+        // Reset drops what was parsed
+        loader.Reset(true);
+        loader.Consume(json.data(), json.size());
+        ASSERT_LT(std::size_t(0), loader.StagedCount());
+        loader.Reset(false);
+        ASSERT_EQ(std::size_t(0), loader.StagedCount());
+        ASSERT_FALSE(loader.FullSync());
+    }
+
     TEST(TogglApiClientTest, SavesAndLoadsUserFields) {
         wipe_test_db();
         Database db(TESTDB);
@@ -133,6 +406,733 @@ namespace kopsik {
         ASSERT_TRUE(user3.StoreStartAndStopTime());
     }
 
+    TEST(TogglApiClientTest, ReadsAndWritesModelsAsTheirSchemaSays) {
+        ASSERT_EQ("INSERT INTO tags(id, uid, name, wid, guid) "
+                  "VALUES(?, ?, ?, ?, ?)", Tag::Schema().InsertSQL());
+        ASSERT_EQ("UPDATE workspaces SET id = ?, uid = ?, name = ?, "
+                  "premium = ? WHERE local_id = ?",
+                  Workspace::Schema().UpdateSQL());
+
+        // uid is stored but not taken from JSON, color only loaded
+        Project p;
+        JSONValue *root = JSONParse("{\"id\":5,\"uid\":9,\"name\":\"P\","
+            "\"wid\":2,\"cid\":3,\"color\":\"4\",\"billable\":true}");
+        p.LoadFromJSONNode(root);
+        JSONDelete(root);
+        ASSERT_EQ(Poco::UInt64(0), p.UID());
+        ASSERT_EQ("4", p.Color());
+        JSONWriter writer;
+        ProjectToJSON(&p, &writer);
+        ASSERT_EQ("{\"id\":5,\"name\":\"P\",\"wid\":2,\"cid\":3,"
+                  "\"billable\":true,\"ui_modified_at\":0}", writer.Buffer());
+
+        wipe_test_db();
+        Database db(TESTDB);
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        ASSERT_FALSE(user.related.Projects.empty());
+        Project *project = user.related.Projects.front();
+        project->SetBillable(!project->Billable());
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        User reloaded("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &reloaded, true));
+        Project *loaded = reloaded.GetProjectByID(project->ID());
+        ASSERT_TRUE(loaded);
+        ASSERT_EQ(project->Billable(), loaded->Billable());
+        ASSERT_EQ(project->GUID(), loaded->GUID());
+        ASSERT_EQ(project->LocalID(), loaded->LocalID());
+        ASSERT_FALSE(loaded->Dirty());
+        ASSERT_EQ(user.related.Tags.size(), reloaded.related.Tags.size());
+        ASSERT_EQ(user.related.Clients.size(),
+                  reloaded.related.Clients.size());
+    }
+
+    TEST(TogglApiClientTest, UpdatesOnlyChangedTimeEntryColumns) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        TimeEntry *te = user.related.TimeEntries[0];
+        ASSERT_EQ(Poco::UInt32(0), te->DirtyFields());
+        std::string where = " from time_entries where local_id = "
+            + Poco::NumberFormatter::format(te->LocalID());
+
+        // Changed behind the model's back, so a full update would undo it
+        sqlite3 *other = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(TESTDB, &other));
+        std::string sql = "update time_entries set created_with = 'other'"
+            " where local_id = "
+            + Poco::NumberFormatter::format(te->LocalID());
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(other, sql.c_str(), 0, 0, 0));
+        sqlite3_close(other);
+
+        te->SetDescription("Only this changed");
+        ASSERT_EQ(Poco::UInt32(TimeEntry::kFieldDescription),
+                  te->DirtyFields());
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(Poco::UInt32(0), te->DirtyFields());
+
+        std::string value("");
+        ASSERT_EQ(noError, db.String("select description" + where, &value));
+        ASSERT_EQ("Only this changed", value);
+        ASSERT_EQ(noError, db.String("select created_with" + where, &value));
+        ASSERT_EQ("other", value);
+
+        // Each combination of fields has its own statement
+        te->SetDescription("Again");
+        te->SetBillable(!te->Billable());
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(noError, db.String("select description" + where, &value));
+        ASSERT_EQ("Again", value);
+        Poco::UInt64 billable(0);
+        ASSERT_EQ(noError, db.UInt("select billable" + where, &billable));
+        ASSERT_EQ(te->Billable(), billable != 0);
+    }
+
+    TEST(TogglApiClientTest, ReportsTablesChangedByAnotherDatabase) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        // Its own saves are not external
+        std::set<std::string> tables;
+        ASSERT_EQ(noError, db.ExternalChanges(&tables));
+        ASSERT_TRUE(tables.empty());
+
+        // Like the command line app, opened on the same file
+        Database other(TESTDB);
+        ASSERT_EQ(noError, other.ExternalChanges(&tables));
+        ASSERT_TRUE(tables.empty());
+
+        TimeEntry *te = user.related.TimeEntries[0];
+        te->SetDescription("Saved by the other one");
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        ASSERT_EQ(noError, db.ExternalChanges(&tables));
+        ASSERT_TRUE(tables.empty());
+        ASSERT_EQ(noError, other.ExternalChanges(&tables));
+        ASSERT_EQ(std::size_t(1), tables.size());
+        ASSERT_EQ(std::size_t(1), tables.count("time_entries"));
+
+        // Reported once
+        std::set<std::string> again;
+        ASSERT_EQ(noError, other.ExternalChanges(&again));
+        ASSERT_TRUE(again.empty());
+
+        // Only the changed table is loaded again
+        RelatedData loaded;
+        ASSERT_EQ(noError, other.LoadTables(user.ID(), tables, 0, &loaded));
+        ASSERT_TRUE(loaded.Projects.empty());
+        ASSERT_EQ(user.related.TimeEntries.size(), loaded.TimeEntries.size());
+        bool found(false);
+        for (std::size_t i = 0; i < loaded.TimeEntries.size(); i++) {
+            TimeEntry *reloaded = loaded.TimeEntries[i];
+            if (reloaded->LocalID() == te->LocalID()) {
+                ASSERT_EQ("Saved by the other one", reloaded->Description());
+                found = true;
+            }
+            delete reloaded;
+        }
+        ASSERT_TRUE(found);
+
+        // The other way around too
+        user.related.Projects[0]->SetName("Renamed elsewhere");
+        ASSERT_EQ(noError, other.SaveUser(&user, true, &changes));
+        ASSERT_EQ(noError, db.ExternalChanges(&again));
+        ASSERT_EQ(std::size_t(1), again.count("projects"));
+        ASSERT_EQ(std::size_t(0), again.count("time_entries"));
+    }
+
+    TEST(TogglApiClientTest, ReportsSettingsSavedByAnotherDatabase) {
+        wipe_test_db();
+        Database db(TESTDB);
+        Database other(TESTDB);
+
+        // Settings and the session are cached by whoever reads them,
+        // so saving them is reported to the other one
+        Proxy proxy;
+        ASSERT_EQ(noError, db.SaveSettings(false, &proxy, true));
+        ASSERT_EQ(noError, db.SaveUpdateChannel("beta"));
+        std::set<std::string> tables;
+        ASSERT_EQ(noError, db.ExternalChanges(&tables));
+        ASSERT_TRUE(tables.empty());
+        ASSERT_EQ(noError, other.ExternalChanges(&tables));
+        ASSERT_EQ(std::size_t(1), tables.size());
+        ASSERT_EQ(std::size_t(1), tables.count("settings"));
+
+        tables.clear();
+        ASSERT_EQ(noError, other.SetCurrentAPIToken("token"));
+        ASSERT_EQ(noError, other.ExternalChanges(&tables));
+        ASSERT_TRUE(tables.empty());
+        ASSERT_EQ(noError, db.ExternalChanges(&tables));
+        ASSERT_EQ(std::size_t(1), tables.size());
+        ASSERT_EQ(std::size_t(1), tables.count("sessions"));
+    }
+
+    TEST(TogglApiClientTest, SearchesTimeEntryDescriptions) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        const char *descriptions[] = {
+            "Reviewing the Quarterly report",
+            "Planning the quarter report",
+            "Report, again: quarterly",
+        };
+        std::vector<TimeEntry *> added;
+        for (int i = 0; i < 3; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetDescription(descriptions[i]);
+            te->SetStart(1500000000 + i * 60);
+            te->SetDurationInSeconds(60);
+            user.related.TimeEntries.push_back(te);
+            user.related.Track(te);
+            added.push_back(te);
+        }
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        // Words are matched by prefix in any case, newest first
+        std::vector<TimeEntry *> results;
+        ASSERT_EQ(noError,
+                  db.SearchTimeEntries(user.ID(), "QUART", 0, 10, &results));
+        ASSERT_EQ(std::size_t(3), results.size());
+        ASSERT_EQ(added[2]->GUID(), results[0]->GUID());
+        ASSERT_EQ(added[1]->GUID(), results[1]->GUID());
+        ASSERT_EQ(added[0]->GUID(), results[2]->GUID());
+        for (std::size_t i = 0; i < results.size(); i++) {
+            delete results[i];
+        }
+        results.clear();
+
+        // Entries with the whole words come first, in pages
+        ASSERT_EQ(noError, db.SearchTimeEntries(user.ID(), "report quarter",
+                                                0, 1, &results));
+        ASSERT_EQ(std::size_t(1), results.size());
+        ASSERT_EQ(added[1]->GUID(), results[0]->GUID());
+        delete results[0];
+        results.clear();
+        ASSERT_EQ(noError, db.SearchTimeEntries(user.ID(), "report quarter",
+                                                1, 10, &results));
+        ASSERT_EQ(std::size_t(2), results.size());
+        ASSERT_EQ(added[2]->GUID(), results[0]->GUID());
+        ASSERT_EQ(added[0]->GUID(), results[1]->GUID());
+        for (std::size_t i = 0; i < results.size(); i++) {
+            delete results[i];
+        }
+        results.clear();
+
+        // Edited and deleted entries are found no more
+        added[0]->SetDescription("Something else");
+        added[2]->MarkAsDeletedOnServer();
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(noError,
+                  db.SearchTimeEntries(user.ID(), "quart", 0, 10, &results));
+        ASSERT_EQ(std::size_t(1), results.size());
+        ASSERT_EQ(added[1]->GUID(), results[0]->GUID());
+        delete results[0];
+        results.clear();
+        Poco::UInt64 rows(0);
+        ASSERT_EQ(noError, db.UInt("select count(1) from time_entry_words "
+                                   "where word = 'reviewing'", &rows));
+        ASSERT_EQ(Poco::UInt64(0), rows);
+    }
+
+    static Poco::UInt64 localNoon(const int day) {
+        Poco::LocalDateTime noon(day / 10000, day / 100 % 100, day % 100, 12);
+        return noon.timestamp().epochTime();
+    }
+
+    TEST(TogglApiClientTest, ReportsTotalsOfDaysFromDatabase) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        Project *project = 0;
+        for (std::size_t i = 0; i < user.related.Projects.size(); i++) {
+            if (user.related.Projects[i]->CID()) {
+                project = user.related.Projects[i];
+                break;
+            }
+        }
+        ASSERT_TRUE(project);
+
+        // Monday, the same day and the Wednesday of the next week
+        const int days[] = { 20100301, 20100301, 20100310 };
+        const Poco::Int64 durations[] = { 3600, 1800, 600 };
+        const char *tags[] = { "a|b", "b", "" };
+        std::vector<TimeEntry *> added;
+        for (int i = 0; i < 3; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetStart(localNoon(days[i]));
+            te->SetDurationInSeconds(durations[i]);
+            te->SetTags(tags[i]);
+            te->SetBillable(i == 0);
+            if (i != 1) {
+                te->SetPID(project->ID());
+            }
+            user.related.TimeEntries.push_back(te);
+            user.related.Track(te);
+            added.push_back(te);
+        }
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        Report report;
+        ASSERT_EQ(noError,
+                  db.LoadReport(user.ID(), 20100301, 20100331, &report));
+        ASSERT_EQ(Poco::Int64(6000), report.Total.Seconds);
+        ASSERT_EQ(Poco::Int64(3600), report.Total.BillableSeconds);
+        ASSERT_EQ(3, report.Total.Entries);
+        ASSERT_EQ(std::size_t(2), report.Days.size());
+        ASSERT_EQ(Poco::Int64(5400), report.Days[20100301].Seconds);
+        ASSERT_EQ(Poco::Int64(600), report.Days[20100310].Seconds);
+        ASSERT_EQ(std::size_t(2), report.Weeks.size());
+        ASSERT_EQ(Poco::Int64(600), report.Weeks[20100308].Seconds);
+        ReportProjectKey key(project->ID(), "");
+        ASSERT_EQ(Poco::Int64(4200), report.Projects[key].Seconds);
+        ASSERT_EQ(project->Name(), report.ProjectNames[key]);
+        ASSERT_EQ(Poco::Int64(4200), report.Clients[project->CID()].Seconds);
+        ASSERT_EQ(Poco::Int64(1800), report.Clients[0].Seconds);
+        ASSERT_EQ(Poco::Int64(3600), report.Tags["a"].Seconds);
+        ASSERT_EQ(Poco::Int64(5400), report.Tags["b"].Seconds);
+        ASSERT_GT(db.ReportCacheBytes(), std::size_t(0));
+
+        // Days that are kept are dropped when their time entries change
+        added[2]->SetDurationInSeconds(900);
+        added[0]->SetDeletedAt(1400000000);
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        Report again;
+        ASSERT_EQ(noError,
+                  db.LoadReport(user.ID(), 20100301, 20100331, &again));
+        ASSERT_EQ(Poco::Int64(2700), again.Total.Seconds);
+        ASSERT_EQ(Poco::Int64(0), again.Total.BillableSeconds);
+        ASSERT_EQ(Poco::Int64(900), again.Weeks[20100308].Seconds);
+        ASSERT_EQ(std::size_t(0), again.Tags.count("a"));
+
+        // Moved to another day
+        added[2]->SetStart(localNoon(20100302));
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        Report moved;
+        ASSERT_EQ(noError,
+                  db.LoadReport(user.ID(), 20100301, 20100331, &moved));
+        ASSERT_EQ(std::size_t(1), moved.Weeks.size());
+        ASSERT_EQ(Poco::Int64(2700), moved.Weeks[20100301].Seconds);
+    }
+
+    class StringExportSink : public ExportSink {
+    public:
+        StringExportSink() : writes(0) {}
+        error Write(const char *data, const std::size_t size) {
+            written.append(data, size);
+            writes++;
+            return noError;
+        }
+        std::string written;
+        int writes;
+    };
+
+    TEST(TogglApiClientTest, ExportsTimeEntriesInChunks) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        Project *project = user.related.Projects[0];
+        const int count = 50;
+        for (int i = 0; i < count; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetStart(localNoon(20100601) + i * 60);
+            te->SetDurationInSeconds(60);
+            te->SetDescription(i ? "Plain" : "Says \"hi\", twice\nover");
+            te->SetTags(i ? "" : "a|b");
+            te->SetBillable(!i);
+            te->SetPID(project->ID());
+            user.related.TimeEntries.push_back(te);
+            user.related.Track(te);
+        }
+        TimeEntry *running = new TimeEntry();
+        running->SetStart(localNoon(20100601) + 3600 * 2);
+        running->SetDurationInSeconds(-1275390000);
+        user.related.TimeEntries.push_back(running);
+        user.related.Track(running);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        // A small chunk, so the buffer is written many times
+        StringExportSink csv;
+        TimeEntryExport csv_out(TimeEntryExport::CSV, &csv, 256);
+        ASSERT_EQ(noError,
+                  db.ExportTimeEntries(user.ID(), 20100601, 20100601,
+                                       &csv_out));
+        ASSERT_EQ(Poco::UInt64(count), csv_out.Rows());
+        ASSERT_GT(csv.writes, 1);
+        ASSERT_EQ(0u, csv.written.find("GUID,Description,Project,"));
+        ASSERT_NE(std::string::npos, csv.written.find(
+            ",\"Says \"\"hi\"\", twice\nover\"," + project->Name()));
+        ASSERT_NE(std::string::npos, csv.written.find(
+            ",\"a,b\",Yes,2010-06-01"));
+        ASSERT_NE(std::string::npos, csv.written.find(",No,"));
+
+        StringExportSink json;
+        TimeEntryExport json_out(TimeEntryExport::JSON, &json, 256);
+        ASSERT_EQ(noError,
+                  db.ExportTimeEntries(user.ID(), 20100601, 20100601,
+                                       &json_out));
+        ASSERT_GT(json.writes, 1);
+        JSONValue *root = JSONParse(json.written);
+        ASSERT_TRUE(root);
+        ASSERT_EQ(kJSONArray, JSONTypeOf(root));
+        ASSERT_EQ(std::size_t(count), JSONSize(root));
+        JSONDelete(root);
+
+        // Nothing from the days around
+        StringExportSink none;
+        TimeEntryExport none_out(TimeEntryExport::JSON, &none);
+        ASSERT_EQ(noError,
+                  db.ExportTimeEntries(user.ID(), 20100602, 20100630,
+                                       &none_out));
+        ASSERT_EQ("[]", none.written);
+    }
+
+    TEST(TogglApiClientTest, FiltersWindowTitles) {
+        TitleFilter filter;
+        std::string filename("Mail.app");
+        std::string title("Re: Acme Corp invoice");
+        // Nothing to do without patterns
+        ASSERT_TRUE(filter.Apply(&filename, &title));
+        ASSERT_EQ("Re: Acme Corp invoice", title);
+
+        std::vector<std::string> redact;
+        redact.push_back("acme corp");
+        redact.push_back("corp invoice");
+        redact.push_back("TKT-");
+        redact.push_back("");
+        std::vector<std::string> drop;
+        drop.push_back("Payroll");
+        filter.SetPatterns(redact, drop);
+
+        // Overlapping matches are replaced as one
+        ASSERT_TRUE(filter.Apply(&filename, &title));
+        ASSERT_EQ("Mail.app", filename);
+        ASSERT_EQ("Re: ***", title);
+
+        filename = "tkt-tracker";
+        title = "TKT-123 and tkt-9 - ACME CORP";
+        ASSERT_TRUE(filter.Apply(&filename, &title));
+        ASSERT_EQ("***tracker", filename);
+        ASSERT_EQ("***123 and ***9 - ***", title);
+
+        // No match across the filename and the title
+        filename = "Acme";
+        title = "Corp";
+        ASSERT_TRUE(filter.Apply(&filename, &title));
+        ASSERT_EQ("Acme", filename);
+        ASSERT_EQ("Corp", title);
+
+        filename = "Numbers";
+        title = "payroll 2014.numbers";
+        ASSERT_FALSE(filter.Apply(&filename, &title));
+
+        // The same window again comes from the cache
+        Poco::Int64 hits = Metrics::Shared().Counter("title_filter.cache_hits");
+        filename = "Numbers";
+        title = "payroll 2014.numbers";
+        ASSERT_FALSE(filter.Apply(&filename, &title));
+        ASSERT_EQ(hits + 1,
+                  Metrics::Shared().Counter("title_filter.cache_hits"));
+    }
+
+    TEST(TogglApiClientTest, FindsDaysThatDifferByDigest) {
+        const Poco::UInt64 day = kDigestDaySeconds;
+        const Poco::UInt64 since = 16000 * day;
+        std::vector<TimeEntry *> time_entries;
+        for (Poco::UInt64 i = 0; i < 8; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetID(100 + i);
+            te->SetStart(since + (i / 2) * day + 3600);
+            te->SetUpdatedAt(1400000000 + i);
+            time_entries.push_back(te);
+        }
+        // Not on the server yet, so its day can't be compared
+        TimeEntry *unpushed = new TimeEntry();
+        unpushed->SetStart(since + 5 * day);
+        time_entries.push_back(unpushed);
+
+        TimeEntryDigests::DayDigests local;
+        std::set<Poco::UInt64> unsettled;
+        TimeEntryDigests::Compute(time_entries, since, since + 7 * day,
+                                  &local, &unsettled);
+        ASSERT_EQ(std::size_t(4), local.size());
+        ASSERT_EQ(std::size_t(1), unsettled.size());
+        ASSERT_EQ(std::size_t(32), local[since].size());
+
+        // The order of the entries doesn't matter
+        std::vector<TimeEntry *> reversed(time_entries.rbegin(),
+                                          time_entries.rend());
+        TimeEntryDigests::DayDigests same;
+        std::set<Poco::UInt64> ignored;
+        TimeEntryDigests::Compute(reversed, since, since + 7 * day,
+                                  &same, &ignored);
+        ASSERT_TRUE(local == same);
+
+        // The server has a newer entry on day 1, another one on day 2
+        // and one on day 5, which is unsettled here
+        std::stringstream json;
+        json << "[";
+        for (TimeEntryDigests::DayDigests::const_iterator it =
+                local.begin(); it != local.end(); it++) {
+            std::string digest = it->second;
+            if (since + day == it->first) {
+                digest = "changed";
+            }
+            json << "{\"day\":" << it->first
+                 << ",\"digest\":\"" << digest << "\"},";
+        }
+        json << "{\"day\":" << since + 2 * day << ",\"digest\":\"x\"},"
+             << "{\"day\":" << since + 5 * day << ",\"digest\":\"x\"}]";
+        TimeEntryDigests::DayDigests remote;
+        ASSERT_EQ(noError, TimeEntryDigests::Parse(json.str(), &remote));
+        ASSERT_EQ(std::size_t(5), remote.size());
+
+        std::vector<TimeEntryRange> ranges;
+        TimeEntryDigests::Mismatched(local, remote, unsettled,
+                                     since, since + 7 * day, &ranges);
+        ASSERT_EQ(std::size_t(1), ranges.size());
+        ASSERT_EQ(since + day, ranges[0].since);
+        ASSERT_EQ(since + 3 * day, ranges[0].until);
+
+        ASSERT_NE(noError, TimeEntryDigests::Parse("{}", &remote));
+
+        for (std::size_t i = 0; i < time_entries.size(); i++) {
+            delete time_entries[i];
+        }
+    }
+
+    TEST(TogglApiClientTest, ReadsTimeEntriesFromCSV) {
+        std::stringstream csv;
+        csv << "Stop,DESCRIPTION,Project,Client,Tags,Billable,Start,"
+            << "Duration,Extra\r\n"
+            << "2013-09-05T06:43:24Z,\"Says \"\"hi\"\", twice\nover\","
+            << "Website,Acme,\"a, b\",Yes,2013-09-05T06:33:50Z,,x\r\n"
+            << "\r\n"
+            << ",Plain,,,,No,2013-09-05T07:00:00Z,01:30:00,\n"
+            << ",Broken,,,,No,yesterday,,\n"
+            << ",Running,,,,No,2013-09-05T08:00:00Z,,";
+
+        TimeEntryCSVReader reader(&csv);
+        TimeEntryImportRow row;
+        error err = noError;
+
+        ASSERT_TRUE(reader.Next(&row, &err));
+        ASSERT_EQ(noError, err);
+        ASSERT_EQ(Poco::UInt64(2), row.Line);
+        ASSERT_EQ("Says \"hi\", twice\nover", row.Description);
+        ASSERT_EQ("Website", row.Project);
+        ASSERT_EQ("Acme", row.Client);
+        ASSERT_EQ("a|b", row.Tags);
+        ASSERT_TRUE(row.Billable);
+        ASSERT_EQ(Poco::UInt64(1378362830), row.Start);
+        ASSERT_EQ(Poco::UInt64(574), row.Stop - row.Start);
+
+        // The blank line is passed over
+        ASSERT_TRUE(reader.Next(&row, &err));
+        ASSERT_EQ(noError, err);
+        ASSERT_EQ(Poco::UInt64(5), row.Line);
+        ASSERT_EQ("Plain", row.Description);
+        ASSERT_EQ("", row.Tags);
+        ASSERT_FALSE(row.Billable);
+        ASSERT_EQ(Poco::UInt64(5400), row.Stop - row.Start);
+
+        ASSERT_TRUE(reader.Next(&row, &err));
+        ASSERT_EQ("Line 6: invalid start or stop time", err);
+        ASSERT_TRUE(reader.Next(&row, &err));
+        ASSERT_EQ("Line 7: no stop time or duration", err);
+        ASSERT_FALSE(reader.Next(&row, &err));
+        ASSERT_EQ(noError, err);
+
+        std::stringstream no_start("Description,Stop\nx,2013-09-05T06:43:24Z");
+        TimeEntryCSVReader bad(&no_start);
+        ASSERT_FALSE(bad.Next(&row, &err));
+        ASSERT_NE(noError, err);
+    }
+
+    TEST(TogglApiClientTest, ArchivesOldTimeEntries) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        Project *project = user.related.Projects[0];
+        const char *guids[] = {
+            "07fba193-91c4-0ec8-2345-820df0548123",
+            "07fba193-91c4-0ec8-2345-820df0548124",
+            "07fba193-91c4-0ec8-2345-820df0548125"
+        };
+        for (int i = 0; i < 3; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetID(900000 + i);
+            te->SetGUID(guids[i]);
+            te->SetStart(localNoon(20100301 + i));
+            te->SetDurationInSeconds(600);
+            te->SetDescription(i ? "Archived" : "Kept");
+            te->SetTags("a|b");
+            te->SetBillable(true);
+            te->SetPID(project->ID());
+            user.related.TimeEntries.push_back(te);
+            user.related.Track(te);
+        }
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        Report report;
+        ASSERT_EQ(noError,
+                  db.LoadReport(user.ID(), 20100301, 20100331, &report));
+        ASSERT_EQ(Poco::Int64(1800), report.Total.Seconds);
+
+        Poco::UInt64 before = localNoon(20100401);
+        std::stringstream old;
+        old << "select count(1) from time_entries where start < " << before;
+        Poco::UInt64 closed(0);
+        ASSERT_EQ(noError, db.UInt(old.str(), &closed));
+
+        // Loaded entries are left alone
+        std::set<std::string> keep;
+        keep.insert(guids[0]);
+        Poco::UInt64 archived(0);
+        ASSERT_EQ(noError,
+                  db.ArchiveTimeEntries(user.ID(), before, keep, &archived));
+        ASSERT_EQ(closed - 1, archived);
+        Poco::UInt64 left(0);
+        ASSERT_EQ(noError, db.UInt(old.str(), &left));
+        ASSERT_EQ(Poco::UInt64(1), left);
+
+        std::vector<TimeEntry *> found;
+        ASSERT_EQ(noError, db.LoadArchivedTimeEntries(
+            user.ID(), localNoon(20100301), localNoon(20100331), &found));
+        ASSERT_EQ(std::size_t(2), found.size());
+        ASSERT_EQ(std::string(guids[1]), found[0]->GUID());
+        ASSERT_EQ("Archived", found[0]->Description());
+        ASSERT_EQ("a|b", found[0]->Tags());
+        ASSERT_EQ(project->ID(), found[0]->PID());
+        ASSERT_EQ(Poco::Int64(600), found[0]->DurationInSeconds());
+        ASSERT_EQ(localNoon(20100303), found[1]->Start());
+        for (std::size_t i = 0; i < found.size(); i++) {
+            delete found[i];
+        }
+
+        // Archiving more of the same month adds to it
+        keep.clear();
+        ASSERT_EQ(noError,
+                  db.ArchiveTimeEntries(user.ID(), before, keep, &archived));
+        ASSERT_EQ(Poco::UInt64(1), archived);
+        Poco::UInt64 months(0);
+        ASSERT_EQ(noError, db.UInt("select count(1) from time_entries_archive "
+                                   "where month = 201003", &months));
+        ASSERT_EQ(Poco::UInt64(1), months);
+
+        // Still in reports and exports
+        Report again;
+        ASSERT_EQ(noError,
+                  db.LoadReport(user.ID(), 20100301, 20100331, &again));
+        ASSERT_EQ(Poco::Int64(1800), again.Total.Seconds);
+        ASSERT_EQ(Poco::Int64(1800), again.Tags["a"].Seconds);
+
+        StringExportSink csv;
+        TimeEntryExport csv_out(TimeEntryExport::CSV, &csv);
+        ASSERT_EQ(noError,
+                  db.ExportTimeEntries(user.ID(), 20100301, 20100331,
+                                       &csv_out));
+        ASSERT_EQ(Poco::UInt64(3), csv_out.Rows());
+        ASSERT_NE(std::string::npos, csv.written.find(
+            std::string(guids[0]) + ",Kept," + project->Name()));
+    }
+
+    TEST(TogglApiClientTest, JournalsPendingPushesInOutbox) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_TRUE(user.related.Outbox.Loaded());
+        std::size_t pending = user.related.Outbox.Size();
+
+        // Edited again and again, it's still pushed once
+        TimeEntry *edited = user.related.TimeEntries[0];
+        ASSERT_TRUE(edited->ID());
+        for (int i = 0; i < 3; i++) {
+            edited->SetDescription("Edit " + Poco::NumberFormatter::format(i));
+            edited->SetUIModifiedAt(1400000000 + i);
+            ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        }
+        ASSERT_EQ(pending + 1, user.related.Outbox.Size());
+        std::string where = " from push_outbox where guid = '"
+            + edited->GUID() + "'";
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, db.UInt("select count(1)" + where, &n));
+        ASSERT_EQ(Poco::UInt64(1), n);
+        std::string operation("");
+        ASSERT_EQ(noError, db.String("select operation" + where, &operation));
+        ASSERT_EQ("PUT", operation);
+
+        // Deleted before the push, the PUT becomes a DELETE
+        edited->SetDeletedAt(1400000100);
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(noError, db.UInt("select count(1)" + where, &n));
+        ASSERT_EQ(Poco::UInt64(1), n);
+        ASSERT_EQ(noError, db.String("select operation" + where, &operation));
+        ASSERT_EQ("DELETE", operation);
+
+        // Pushing looks at the outbox and what's not saved yet
+        TimeEntry *added = new TimeEntry();
+        added->SetStart(1400010000);
+        added->SetDurationInSeconds(60);
+        user.related.TimeEntries.push_back(added);
+        user.related.Track(added);
+        std::vector<TimeEntry *> pushable;
+        user.CollectPushableTimeEntries(&pushable);
+        ASSERT_EQ(pending + 2, pushable.size());
+        std::set<TimeEntry *> found(pushable.begin(), pushable.end());
+        ASSERT_EQ(std::size_t(1), found.count(edited));
+        ASSERT_EQ(std::size_t(1), found.count(added));
+
+        // Pushed, it leaves the outbox
+        edited->MarkAsDeletedOnServer();
+        added->SetID(123456789);
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(pending, user.related.Outbox.Size());
+        ASSERT_EQ(noError, db.UInt("select count(1)" + where, &n));
+        ASSERT_EQ(Poco::UInt64(0), n);
+        pushable.clear();
+        user.CollectPushableTimeEntries(&pushable);
+        ASSERT_EQ(pending, pushable.size());
+
+        // The journal is what a new session starts from
+        User reloaded("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &reloaded, true));
+        std::vector<TimeEntry *> scanned;
+        reloaded.CollectPushableTimeEntries(&scanned);
+        ASSERT_EQ(noError, db.SaveUser(&reloaded, true, &changes));
+        ASSERT_TRUE(reloaded.related.Outbox.Loaded());
+        std::vector<TimeEntry *> journaled;
+        reloaded.CollectPushableTimeEntries(&journaled);
+        ASSERT_EQ(scanned.size(), journaled.size());
+    }
+
     TEST(TogglApiClientTest, SavesModelsAndKnowsToUpdateWithSameUserInstance) {
         wipe_test_db();
         Database db(TESTDB);
@@ -306,6 +1306,55 @@ namespace kopsik {
         }
     }
 
+    TEST(TogglApiClientTest, DeletesModelsDeletedOnServerInChunks) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::vector<TimeEntry *> &list = user.related.TimeEntries;
+        const std::size_t loaded = list.size();
+        // More than fit in one delete statement
+        const int added = 2 * kDatabaseDeleteChunkSize + 100;
+        for (int i = 0; i < added; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetID(1000000 + i);
+            te->SetDescription("Deleted on server soon");
+            te->SetStart(1400000000 + i * 60);
+            te->SetDurationInSeconds(60);
+            list.push_back(te);
+            user.related.Track(te);
+        }
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        Poco::UInt64 rows(0);
+        ASSERT_EQ(noError, db.UInt("select count(1) from time_entries", &rows));
+        ASSERT_EQ(Poco::UInt64(loaded + added), rows);
+
+        // Every other added one, and one that was never saved
+        for (std::size_t i = loaded; i < list.size(); i += 2) {
+            list[i]->MarkAsDeletedOnServer();
+        }
+        TimeEntry *unsaved = new TimeEntry();
+        unsaved->MarkAsDeletedOnServer();
+        list.push_back(unsaved);
+        user.related.Track(unsaved);
+
+        changes.clear();
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(noError, db.UInt("select count(1) from time_entries", &rows));
+        ASSERT_EQ(Poco::UInt64(loaded + added / 2), rows);
+
+        // The rest keep their order
+        ASSERT_EQ(loaded + added / 2, list.size());
+        for (std::size_t i = loaded; i < list.size(); i++) {
+            ASSERT_FALSE(list[i]->IsMarkedAsDeletedOnServer());
+            ASSERT_EQ(Poco::UInt64(1000000 + 2 * (i - loaded) + 1),
+                      list[i]->ID());
+        }
+    }
+
     TEST(TogglApiClientTest, SavesModels) {
         User user("kopsik_test", "0.1");
         LoadUserFromJSONString(&user, loadTestData(), true, true);
@@ -363,7 +1412,7 @@ namespace kopsik {
         ASSERT_EQ(6356, user.related.TimeEntries[0]->DurationInSeconds());
         ASSERT_EQ("Important things",
             user.related.TimeEntries[0]->Description());
-        ASSERT_EQ(uint(0), user.related.TimeEntries[0]->TagNames.size());
+        ASSERT_EQ(uint(0), user.related.TimeEntries[0]->TagIDs().size());
         ASSERT_FALSE(user.related.TimeEntries[0]->DurOnly());
         ASSERT_EQ(user.ID(), user.related.TimeEntries[0]->UID());
 
@@ -686,6 +1735,4237 @@ namespace kopsik {
         ASSERT_EQ(count+1, user.related.TimeEntries.size());
     }
 
+    TEST(TogglApiClientTest, SavesTimeEntriesWithReusedStatements) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        TimeEntry *first = user.Start("first", "", 0, 0);
+        TimeEntry *second = user.Start("second", "", 0, 0);
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_TRUE(first->LocalID());
+        ASSERT_TRUE(second->LocalID());
+        ASSERT_NE(first->LocalID(), second->LocalID());
+
+        first->SetDescription("first changed");
+        second->SetID(123123);
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, db.UInt("select count(1) from time_entries", &n));
+        ASSERT_EQ(uint(5), n);
+
+        std::string description("");
+        ASSERT_EQ(noError, db.String("select description from time_entries "
+            "where description = 'first changed'", &description));
+        ASSERT_EQ("first changed", description);
+
+        ASSERT_EQ(noError, db.UInt("select count(1) from time_entries "
+            "where id = 123123", &n));
+        ASSERT_EQ(uint(1), n);
+    }
+
+    TEST(TogglApiClientTest, InsertsNewTimeEntriesInBulk) {
+        wipe_test_db();
+        Database db(TESTDB);
+        db.SetTimeEntryLoadDays(60);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        for (int i = 0; i < 500; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetID(1000000 + i);
+            te->SetStart(1400000000 + i * 60);
+            te->SetDurationInSeconds(30);
+            user.related.TimeEntries.push_back(te);
+            user.related.Track(te);
+        }
+
+        TimeEntry *first = user.GetTimeEntryByID(1000000);
+
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        std::set<Poco::Int64> local_ids;
+        for (std::size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+            TimeEntry *te = user.related.TimeEntries[i];
+            ASSERT_TRUE(te->LocalID());
+            ASSERT_FALSE(te->GUID().empty());
+            local_ids.insert(te->LocalID());
+        }
+        ASSERT_EQ(user.related.TimeEntries.size(), local_ids.size());
+
+        std::string guid("");
+        ASSERT_EQ(noError, db.String("select guid from time_entries "
+            "where local_id = " + Poco::NumberFormatter::format(
+                user.related.TimeEntries.back()->LocalID()), &guid));
+        ASSERT_EQ(user.related.TimeEntries.back()->GUID(), guid);
+
+        // Entries that may have a row already are looked up first
+        TimeEntry *unloaded = new TimeEntry();
+        unloaded->SetID(1000000);
+        unloaded->SetDescription("from server");
+        user.related.TimeEntries.push_back(unloaded);
+        user.related.Track(unloaded);
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(first->LocalID(), unloaded->LocalID());
+    }
+
+    TEST(TogglApiClientTest, SavesOnlyDirtyModels) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        ASSERT_FALSE(user.related.DirtyModels.empty());
+
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_TRUE(user.related.DirtyModels.empty());
+
+        TimeEntry *te = user.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(te);
+        te->SetDescription("Only this one");
+        ASSERT_EQ(uint(1), user.related.DirtyModels.size());
+
+        changes.clear();
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(uint(1), changes.size());
+        ASSERT_EQ(te->GUID(), changes[0].GUID());
+        ASSERT_TRUE(user.related.DirtyModels.empty());
+
+        // Models loaded from database are tracked, too
+        User user2("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user2, true));
+        ASSERT_TRUE(user2.related.AllTracked());
+        te = user2.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(te);
+        ASSERT_EQ("Only this one", te->Description());
+
+        te->MarkAsDeletedOnServer();
+        size_t count = user2.related.TimeEntries.size();
+        ASSERT_EQ(noError, db.SaveUser(&user2, true, &changes));
+        ASSERT_EQ(count - 1, user2.related.TimeEntries.size());
+        ASSERT_FALSE(user2.GetTimeEntryByID(89818605));
+        ASSERT_TRUE(user2.related.AllTracked());
+        delete te;
+    }
+
+    TEST(TogglApiClientTest, LoadsOlderTimeEntriesOnDemand) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(uint(0), user.TimeEntriesLoadedSince());
+
+        // Test data is older than the load window
+        db.SetTimeEntryLoadDays(60);
+        User user2("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user2, true));
+        ASSERT_TRUE(user2.TimeEntriesLoadedSince());
+        ASSERT_LT(user2.related.TimeEntries.size(),
+                  user.related.TimeEntries.size());
+        ASSERT_FALSE(user2.GetTimeEntryByID(89818605));
+
+        ASSERT_EQ(noError, db.LoadTimeEntriesSince(&user2, 0));
+        ASSERT_EQ(uint(0), user2.TimeEntriesLoadedSince());
+        ASSERT_EQ(user.related.TimeEntries.size(),
+                  user2.related.TimeEntries.size());
+        ASSERT_TRUE(user2.GetTimeEntryByID(89818605));
+        ASSERT_TRUE(user2.related.AllTracked());
+
+        // Time entries from server that were not loaded are not
+        // inserted twice
+        User user3("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user3, true));
+        LoadUserFromJSONString(&user3, loadTestData(), true, true);
+        ASSERT_EQ(noError, db.SaveUser(&user3, true, &changes));
+        Poco::UInt64 n;
+        ASSERT_EQ(noError, db.UInt("select count(1) from time_entries", &n));
+        ASSERT_EQ(Poco::UInt64(user.related.TimeEntries.size()), n);
+    }
+
+    TEST(TogglApiClientTest, LoadsStartupTimeEntriesBeforeRelatedData) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        TimeEntry *running = user.Start("Startup", "", 0, 0);
+        ASSERT_TRUE(running);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        // Only the running entry is recent enough
+        User user2("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user2, false));
+        ASSERT_EQ(noError, db.LoadStartupTimeEntries(&user2, time(0) - 60));
+        ASSERT_EQ(uint(1), user2.related.TimeEntries.size());
+        ASSERT_TRUE(user2.RunningTimeEntry());
+        ASSERT_EQ(running->GUID(), user2.RunningTimeEntry()->GUID());
+        ASSERT_TRUE(user2.related.Workspaces.empty());
+        ASSERT_TRUE(user2.TimeEntriesLoadedSince());
+
+        RelatedData related;
+        Poco::UInt64 loaded_since(0);
+        ASSERT_EQ(noError,
+                  db.LoadRelatedData(user.ID(), &related, &loaded_since));
+        ASSERT_EQ(uint(0), loaded_since);
+        ASSERT_EQ(user.related.Workspaces.size(), related.Workspaces.size());
+        ASSERT_EQ(user.related.Projects.size(), related.Projects.size());
+        ASSERT_EQ(user.related.TimeEntries.size(),
+                  related.TimeEntries.size());
+        ASSERT_TRUE(related.TimeEntryIndex.ByGUID(running->GUID()));
+
+        User cleanup("kopsik_test", "0.1");
+        cleanup.related.Workspaces.swap(related.Workspaces);
+        cleanup.related.Clients.swap(related.Clients);
+        cleanup.related.Projects.swap(related.Projects);
+        cleanup.related.Tasks.swap(related.Tasks);
+        cleanup.related.Tags.swap(related.Tags);
+        cleanup.related.TimeEntries.swap(related.TimeEntries);
+    }
+
+    TEST(TogglApiClientTest, LoadsRelatedDataFromSnapshotUntilSaved) {
+        wipe_test_db();
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+        Database db(TESTDB);
+        db.SetSnapshotPath(std::string(TESTDB) + "-snapshot");
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        Project *billable = user.related.Projects[0];
+        billable->SetBillable(true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(noError, db.SaveRelatedDataSnapshot(&user));
+        ASSERT_EQ(1, metrics.Histogram("db.save.snapshot").count);
+
+        User user2("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user2, true));
+        ASSERT_EQ(1, metrics.Counter("db.snapshot.hits"));
+        ASSERT_EQ(user.related.Workspaces.size(),
+                  user2.related.Workspaces.size());
+        ASSERT_EQ(user.related.Clients.size(), user2.related.Clients.size());
+        ASSERT_EQ(user.related.Projects.size(),
+                  user2.related.Projects.size());
+        ASSERT_EQ(user.related.Tasks.size(), user2.related.Tasks.size());
+        ASSERT_EQ(user.related.Tags.size(), user2.related.Tags.size());
+        ASSERT_EQ(user.related.TimeEntries.size(),
+                  user2.related.TimeEntries.size());
+        ASSERT_TRUE(user2.related.AllTracked());
+
+        Project *billable2 = user2.GetProjectByID(billable->ID());
+        ASSERT_TRUE(billable2);
+        ASSERT_TRUE(billable2->Billable());
+
+        TimeEntry *te = user.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(te);
+        TimeEntry *te2 = user2.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(te2);
+        ASSERT_EQ(te->LocalID(), te2->LocalID());
+        ASSERT_EQ(te->GUID(), te2->GUID());
+        ASSERT_EQ(te->Description(), te2->Description());
+        ASSERT_EQ(te->Start(), te2->Start());
+        ASSERT_EQ(te->DurationInSeconds(), te2->DurationInSeconds());
+        ASSERT_EQ(te->PID(), te2->PID());
+        ASSERT_EQ(te->Tags(), te2->Tags());
+        ASSERT_FALSE(te2->Dirty());
+
+        // Saving related data makes the snapshot stale
+        te2->SetDescription("Changed after the snapshot");
+        ASSERT_EQ(noError, db.SaveUser(&user2, true, &changes));
+        User user3("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user3, true));
+        ASSERT_EQ(1, metrics.Counter("db.snapshot.hits"));
+        ASSERT_EQ(1, metrics.Counter("db.snapshot.misses"));
+        TimeEntry *te3 = user3.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(te3);
+        ASSERT_EQ("Changed after the snapshot", te3->Description());
+
+        // Unsaved edits are not written into a snapshot
+        te3->SetDescription("Not saved");
+        ASSERT_NE(noError, db.SaveRelatedDataSnapshot(&user3));
+
+        metrics.Clear();
+    }
+
+    TEST(TogglApiClientTest, ReplaysJournaledEditsThatWereNotSaved) {
+        wipe_test_db();
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+        std::string journal(std::string(TESTDB) + "-edits");
+        std::vector<ModelChange> changes;
+        Poco::UInt64 uid(0);
+        std::string started_guid("");
+        {
+            Database db(TESTDB);
+            db.SetChangeJournalPath(journal);
+            User user("kopsik_test", "0.1");
+            LoadUserFromJSONString(&user, loadTestData(), true, true);
+            ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+            uid = user.ID();
+
+            // Edited, then gone before the save
+            TimeEntry *te = user.GetTimeEntryByID(89818605);
+            ASSERT_TRUE(te);
+            te->SetDescription("Journaled");
+            te->SetUIModifiedAt(1400000000);
+            TimeEntry *started = user.Start("Not saved yet", "", 0, 0);
+            ASSERT_EQ(noError, db.JournalEdits(&user));
+            ASSERT_EQ(2, metrics.Counter("journal.records"));
+            started_guid = started->GUID();
+        }
+        {
+            Database db(TESTDB);
+            db.SetChangeJournalPath(journal);
+            User user("kopsik_test", "0.1");
+            ASSERT_EQ(noError, db.LoadUserByID(uid, &user, true));
+            ASSERT_NE("Journaled",
+                      user.GetTimeEntryByID(89818605)->Description());
+            ASSERT_FALSE(user.GetTimeEntryByGUID(started_guid));
+
+            ASSERT_EQ(noError, db.ReplayChangeJournal(&user, &changes));
+            ASSERT_EQ(2, metrics.Counter("journal.replayed"));
+            TimeEntry *te = user.GetTimeEntryByID(89818605);
+            ASSERT_EQ("Journaled", te->Description());
+            ASSERT_EQ(Poco::UInt64(1400000000), te->UIModifiedAt());
+            ASSERT_FALSE(te->Dirty());
+            TimeEntry *started = user.GetTimeEntryByGUID(started_guid);
+            ASSERT_TRUE(started);
+            ASSERT_EQ("Not saved yet", started->Description());
+            ASSERT_TRUE(started->IsTracking());
+            ASSERT_TRUE(started->LocalID());
+        }
+        {
+            // Saved by the replay, which emptied the journal
+            Database db(TESTDB);
+            db.SetChangeJournalPath(journal);
+            User user("kopsik_test", "0.1");
+            ASSERT_EQ(noError, db.LoadUserByID(uid, &user, true));
+            ASSERT_EQ("Journaled",
+                      user.GetTimeEntryByID(89818605)->Description());
+            ASSERT_TRUE(user.GetTimeEntryByGUID(started_guid));
+            ASSERT_EQ(noError, db.ReplayChangeJournal(&user, &changes));
+            ASSERT_EQ(2, metrics.Counter("journal.replayed"));
+        }
+        metrics.Clear();
+    }
+
+    TEST(TogglApiClientTest, LoadsNullColumnsAsEmptyValues) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        std::stringstream insert;
+        insert << "INSERT INTO time_entries(uid, wid, guid, start, duration) "
+               << "VALUES(" << user.ID() << ", "
+               << user.related.Workspaces[0]->ID() << ", "
+               << "'07fba193-91c4-0ec8-2345-820df0548123', "
+               << "1400000000, 60)";
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, db.UInt(insert.str(), &n));
+
+        User user2("kopsik_test", "0.1");
+        ASSERT_EQ(noError, db.LoadUserByID(user.ID(), &user2, true));
+        TimeEntry *te = user2.related.TimeEntryIndex.ByGUID(
+            "07fba193-91c4-0ec8-2345-820df0548123");
+        ASSERT_TRUE(te);
+        ASSERT_EQ(uint(0), te->ID());
+        ASSERT_EQ("", te->Description());
+        ASSERT_EQ(uint(0), te->PID());
+        ASSERT_EQ(uint(0), te->Stop());
+        ASSERT_EQ("", te->Tags());
+        ASSERT_EQ(uint(1400000000), te->Start());
+        ASSERT_EQ(60, te->DurationInSeconds());
+        ASSERT_EQ(user.related.TimeEntries.size() + 1,
+                  user2.related.TimeEntries.size());
+    }
+
+    TEST(TogglApiClientTest, MaintainsDatabaseFreePagesAndWAL) {
+        wipe_test_db();
+        Database db(TESTDB);
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+
+        // Made before auto_vacuum was turned on
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, db.UInt("PRAGMA auto_vacuum = NONE", &n));
+        ASSERT_EQ(noError, db.UInt("VACUUM", &n));
+        ASSERT_EQ(noError, db.UInt("PRAGMA auto_vacuum", &n));
+        ASSERT_EQ(uint(0), n);
+
+        for (int round = 0; round < 2; round++) {
+            ASSERT_EQ(noError, db.UInt("CREATE TABLE scratch(data blob)", &n));
+            for (int i = 0; i < 20; i++) {
+                ASSERT_EQ(noError, db.UInt(
+                    "INSERT INTO scratch VALUES(zeroblob(65536))", &n));
+            }
+            ASSERT_EQ(noError, db.UInt("DROP TABLE scratch", &n));
+            ASSERT_EQ(noError, db.UInt("PRAGMA freelist_count", &n));
+            ASSERT_LT(uint(100), n);
+
+            ASSERT_EQ(noError, db.Maintain());
+            ASSERT_EQ(noError, db.UInt("PRAGMA freelist_count", &n));
+            ASSERT_EQ(uint(0), n);
+            ASSERT_EQ(noError, db.UInt("PRAGMA auto_vacuum", &n));
+            ASSERT_EQ(uint(2), n);
+        }
+        ASSERT_EQ(2, metrics.Counter("db.vacuums"));
+        ASSERT_EQ(2, metrics.Histogram("db.maintain").count);
+        ASSERT_EQ(0, metrics.Gauge("db.wal_frames_not_checkpointed"));
+
+        // And the query planner has statistics
+        ASSERT_EQ(noError,
+                  db.UInt("SELECT count(*) FROM sqlite_master "
+                          "WHERE name = 'sqlite_stat1'", &n));
+        ASSERT_EQ(uint(1), n);
+
+        metrics.Clear();
+    }
+
+    // Stands for another process writing to the same file
+    class DelayedCommit : public Poco::Runnable {
+    public:
+        explicit DelayedCommit(Database *db) : db_(db) {}
+        void run() {
+            Poco::Thread::sleep(200);
+            Poco::UInt64 n(0);
+            db_->UInt("COMMIT", &n);
+        }
+
+    private:
+        Database *db_;
+    };
+
+    TEST(TogglApiClientTest, WaitsForAnotherProcessWriting) {
+        wipe_test_db();
+        Database db(TESTDB);
+        Database other(TESTDB);
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+
+        // Written once the other one is done, rather than failing
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, other.UInt("BEGIN IMMEDIATE", &n));
+        DelayedCommit commit(&other);
+        Poco::Thread thread;
+        thread.start(commit);
+        ASSERT_EQ(noError, db.UInt("CREATE TABLE scratch(data blob)", &n));
+        thread.join();
+        ASSERT_EQ(1, metrics.Counter("db.busy_waits"));
+        ASSERT_EQ(0, metrics.Counter("db.busy_timeouts"));
+
+        // Upkeep is put off while they wait for each other
+        ASSERT_EQ(noError, db.Maintain());
+        ASSERT_EQ(1, metrics.Counter("db.maintenance_deferred"));
+        ASSERT_EQ(0, metrics.Histogram("db.maintain").count);
+
+        // And while another one holds the lease on it
+        Database third(TESTDB);
+        ASSERT_EQ(noError, other.UInt("INSERT INTO maintenance_lease"
+            "(id, holder, until) VALUES(1, 'other', 4000000000)", &n));
+        ASSERT_EQ(noError, third.Maintain());
+        ASSERT_EQ(2, metrics.Counter("db.maintenance_deferred"));
+        ASSERT_EQ(noError, other.UInt("DELETE FROM maintenance_lease", &n));
+        ASSERT_EQ(noError, third.Maintain());
+        ASSERT_EQ(1, metrics.Histogram("db.maintain").count);
+        ASSERT_EQ(noError,
+                  third.UInt("SELECT count(*) FROM maintenance_lease", &n));
+        ASSERT_EQ(uint(0), n);
+
+        metrics.Clear();
+    }
+
+    TEST(TogglApiClientTest, AppliesDatabaseTuning) {
+        wipe_test_db();
+        DatabaseTuning tuning;
+        tuning.synchronous = DatabaseTuning::SynchronousFull;
+        tuning.temp_store = DatabaseTuning::TempStoreFile;
+        tuning.cache_size_kib = 2048;
+        tuning.mmap_size_bytes = 0;
+        tuning.page_size = 8192;
+        Database db(TESTDB, tuning);
+
+        DatabaseTuning effective;
+        ASSERT_EQ(noError, db.EffectiveTuning(&effective));
+        ASSERT_EQ(tuning.String(), effective.String());
+
+        // Page size can't change once there are tables
+        DatabaseTuning retuned;
+        retuned.page_size = 1024;
+        ASSERT_EQ(noError, db.Tune(retuned));
+        ASSERT_EQ(noError, db.EffectiveTuning(&effective));
+        ASSERT_EQ(static_cast<int>(DatabaseTuning::SynchronousNormal),
+                  effective.synchronous);
+        ASSERT_EQ(static_cast<int>(DatabaseTuning::TempStoreMemory),
+                  effective.temp_store);
+        ASSERT_EQ(Poco::Int64(8192), effective.cache_size_kib);
+        ASSERT_EQ(8192, effective.page_size);
+    }
+
+    TEST(TogglApiClientTest, RunsMigrationsOnceBySchemaVersion) {
+        wipe_test_db();
+        Poco::UInt64 migrations(0);
+        {
+            Database db(TESTDB);
+            Poco::UInt64 version(0);
+            ASSERT_EQ(noError, db.UInt("PRAGMA user_version", &version));
+            ASSERT_EQ(noError,
+                      db.UInt("select count(*) from kopsik_migrations",
+                              &migrations));
+            ASSERT_TRUE(migrations);
+            ASSERT_EQ(migrations, version);
+
+            // Pretend the database is from before the last migration
+            ASSERT_EQ(noError, db.UInt("DROP INDEX id_time_entries_start",
+                                       &version));
+            ASSERT_EQ(noError, db.UInt("DELETE FROM kopsik_migrations "
+                                       "WHERE name = 'time_entries.start'",
+                                       &version));
+            ASSERT_EQ(noError, db.UInt("PRAGMA user_version = 0", &version));
+        }
+
+        Database db(TESTDB);
+        Poco::UInt64 n(0);
+        ASSERT_EQ(noError, db.UInt("PRAGMA user_version", &n));
+        ASSERT_EQ(migrations, n);
+        ASSERT_EQ(noError, db.UInt("select count(*) from kopsik_migrations",
+                                   &n));
+        ASSERT_EQ(migrations, n);
+        ASSERT_EQ(noError, db.UInt("select count(*) from sqlite_master "
+                                   "where name = 'id_time_entries_start'",
+                                   &n));
+        ASSERT_EQ(Poco::UInt64(1), n);
+    }
+
+    TEST(TogglApiClientTest, LooksUpModelsByIndex) {
+        wipe_test_db();
+        Database db(TESTDB);
+
+        std::string plan("");
+        ASSERT_EQ(noError, db.QueryPlan("SELECT local_id FROM time_entries "
+            "WHERE uid = 1 AND start >= 10 AND start < 20 "
+            "ORDER BY start DESC", &plan));
+        ASSERT_NE(std::string::npos, plan.find("id_time_entries_start"));
+        ASSERT_EQ(std::string::npos, plan.find("TEMP B-TREE"));
+
+        // Loading at startup is ordered by the index, too
+        ASSERT_EQ(noError, db.QueryPlan("SELECT local_id FROM time_entries "
+            "WHERE uid = 1 AND (start >= 10 OR duration < 0 "
+            "OR id IS NULL OR id = 0 "
+            "OR ui_modified_at > 0 OR deleted_at > 0) "
+            "ORDER BY start DESC", &plan));
+        ASSERT_NE(std::string::npos, plan.find("id_time_entries_start"));
+
+        const char *tables[] = { "time_entries", "projects", "clients",
+                                 "tags" };
+        for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+            std::string table(tables[i]);
+            ASSERT_EQ(noError, db.QueryPlan("SELECT local_id FROM " + table
+                + " WHERE uid = 1 AND id = 2", &plan));
+            ASSERT_NE(std::string::npos, plan.find("id_" + table + "_id"));
+            ASSERT_EQ(noError, db.QueryPlan("SELECT local_id FROM " + table
+                + " WHERE uid = 1 AND guid = 'x'", &plan));
+            ASSERT_NE(std::string::npos, plan.find("id_" + table + "_guid"));
+        }
+        ASSERT_EQ(noError, db.QueryPlan("SELECT local_id FROM workspaces "
+            "WHERE uid = 1 AND id = 2", &plan));
+        ASSERT_NE(std::string::npos, plan.find("id_workspaces_id"));
+        ASSERT_EQ(noError, db.QueryPlan("SELECT local_id FROM tasks "
+            "WHERE uid = 1 AND id = 2", &plan));
+        ASSERT_NE(std::string::npos, plan.find("id_tasks_id"));
+    }
+
+    class FakeHTTPSClient : public HTTPSClient {
+    public:
+        FakeHTTPSClient()
+            : HTTPSClient("https://localhost", "kopsik_test", "0.1")
+            , DeltaError(noError)
+            , DeltaStatus(0)
+            , Status(0) {}
+
+        error GetJSON(
+                const std::string relative_url,
+                const std::string basic_auth_username,
+                const std::string basic_auth_password,
+                std::string *response_body) {
+            URLs.push_back(relative_url);
+            if (DeltaError != noError
+                    && relative_url.find("&since=") != std::string::npos) {
+                Status = DeltaStatus;
+                return DeltaError;
+            }
+            Status = 200;
+            *response_body = loadTestData();
+            return noError;
+        }
+
+        int LastStatus() const {
+            return Status;
+        }
+
+        error GetJSON(
+                const std::string relative_url,
+                const std::string basic_auth_username,
+                const std::string basic_auth_password,
+                ResponseHandler *handler) {
+            std::string response_body("");
+            error err = GetJSON(relative_url,
+                basic_auth_username, basic_auth_password, &response_body);
+            if (err != noError) {
+                return err;
+            }
+            // Feed in small pieces, like a slow network would
+            for (std::size_t i = 0; i < response_body.size(); i += 7) {
+                handler->Consume(response_body.data() + i,
+                    std::min(std::size_t(7), response_body.size() - i));
+            }
+            return noError;
+        }
+
+        error PostJSON(
+                const std::string relative_url,
+                const std::string &json,
+                const std::string basic_auth_username,
+                const std::string basic_auth_password,
+                std::string *response_body) {
+            URLs.push_back(relative_url);
+            *response_body = "[]";
+            return noError;
+        }
+
+        std::vector<std::string> URLs;
+        // What a request for changes since the last sync fails with,
+        // and the status it was answered with
+        error DeltaError;
+        int DeltaStatus;
+        int Status;
+    };
+
+    // Answers each batch update as the server would, giving
+    // created models an ID
+    class FakeBatchUpdateClient : public FakeHTTPSClient {
+    public:
+        FakeBatchUpdateClient() : FailBatch(-1), Batches(0), NextID(1000) {}
+
+        error PostJSON(
+                const std::string relative_url,
+                const std::string &json,
+                const std::string basic_auth_username,
+                const std::string basic_auth_password,
+                std::string *response_body) {
+            URLs.push_back(relative_url);
+            if (Batches++ == FailBatch) {
+                return "Request timed out";
+            }
+            JSONValue *updates = JSONParse(json);
+            JSONWriter writer;
+            writer.BeginArray();
+            for (size_t i = 0; i < JSONSize(updates); i++) {
+                JSONValue *update = JSONAt(updates, i);
+                std::string guid(JSONString(JSONGet(update, "GUID")));
+                std::string method(JSONString(JSONGet(update, "method")));
+                // Server echoes the ui_modified_at it was sent
+                JSONValue *model = JSONAt(JSONGet(update, "body"), 0);
+                std::stringstream body;
+                body << "{\"data\":{\"id\":" << NextID++
+                     << ",\"ui_modified_at\":"
+                     << JSONInt(JSONGet(model, "ui_modified_at"))
+                     << "}}";
+                writer.BeginObject();
+                writer.Int("status", 200);
+                writer.String("guid", guid);
+                writer.String("method", method);
+                writer.String("content_type", "application/json");
+                writer.String("body", body.str());
+                writer.EndObject();
+            }
+            writer.EndArray();
+            JSONDelete(updates);
+            *response_body = writer.Buffer();
+            return noError;
+        }
+
+        int FailBatch;
+        int Batches;
+        Poco::UInt64 NextID;
+    };
+
+    class CountingPushListener : public PushListener {
+    public:
+        CountingPushListener() : Batches(0) {}
+        error BatchPushed() {
+            Batches++;
+            return noError;
+        }
+        int Batches;
+    };
+
+    TEST(TogglApiClientTest, PushesInBatchesThatSurviveFailures) {
+        User user("kopsik_test", "0.1");
+        user.SetAPIToken("30eb0ae954b536d2f6628f7fec47beb6");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+
+        std::vector<TimeEntry *> created;
+        for (int i = 0; i < 2 * kBatchUpdateMaxModels + 10; i++) {
+            TimeEntry *te = user.Start("Offline", "", 0, 0);
+            te->EnsureGUID();
+            created.push_back(te);
+        }
+        user.Stop();
+
+        // Third batch fails, the first two keep their results
+        FakeBatchUpdateClient failing;
+        failing.FailBatch = 2;
+        CountingPushListener listener;
+        ASSERT_NE(noError, user.FullSync(&failing, &listener));
+        ASSERT_EQ(2, listener.Batches);
+        for (size_t i = 0; i < created.size(); i++) {
+            ASSERT_EQ(i < 2 * kBatchUpdateMaxModels,
+                      created[i]->ID() != 0) << i;
+        }
+
+        // Only what's left is pushed again
+        FakeBatchUpdateClient retry;
+        CountingPushListener retried;
+        ASSERT_EQ(noError, user.FullSync(&retry, &retried));
+        ASSERT_EQ(1, retried.Batches);
+        for (size_t i = 0; i < created.size(); i++) {
+            ASSERT_TRUE(created[i]->ID());
+        }
+    }
+
+    TEST(TogglApiClientTest, PartialSyncFetchesChangesSinceLastSync) {
+        User user("kopsik_test", "0.1");
+        user.SetAPIToken("30eb0ae954b536d2f6628f7fec47beb6");
+
+        // Nothing to build a delta on yet
+        FakeHTTPSClient first;
+        ASSERT_EQ(noError, user.PartialSync(&first));
+        ASSERT_EQ(uint(1), first.URLs.size());
+        ASSERT_EQ(std::string::npos, first.URLs[0].find("since="));
+        ASSERT_EQ(uint(1379068550), user.Since());
+
+        FakeHTTPSClient delta;
+        ASSERT_EQ(noError, user.PartialSync(&delta));
+        ASSERT_EQ(uint(1), delta.URLs.size());
+        ASSERT_NE(std::string::npos,
+            delta.URLs[0].find("&since=1379068550"));
+
+        // Server refuses the delta
+        FakeHTTPSClient refused;
+        refused.DeltaError = "Request to server failed with status code: 400";
+        refused.DeltaStatus = 400;
+        ASSERT_EQ(noError, user.PartialSync(&refused));
+        ASSERT_EQ(uint(2), refused.URLs.size());
+        ASSERT_EQ(std::string::npos, refused.URLs[1].find("since="));
+
+        FakeHTTPSClient rejected;
+        rejected.DeltaError = "Data push failed with error: bad since";
+        rejected.DeltaStatus = 410;
+        ASSERT_EQ(noError, user.PartialSync(&rejected));
+        ASSERT_EQ(uint(2), rejected.URLs.size());
+
+        // Failed logins are reported rather than followed by a full fetch
+        FakeHTTPSClient unauthorized;
+        unauthorized.DeltaError =
+            "Request to server failed with status code: 401";
+        unauthorized.DeltaStatus = 401;
+        ASSERT_EQ(unauthorized.DeltaError, user.PartialSync(&unauthorized));
+        ASSERT_EQ(uint(1), unauthorized.URLs.size());
+
+        FakeHTTPSClient forbidden;
+        forbidden.DeltaError = "Data push failed with error: forbidden";
+        forbidden.DeltaStatus = 403;
+        ASSERT_EQ(forbidden.DeltaError, user.PartialSync(&forbidden));
+        ASSERT_EQ(uint(1), forbidden.URLs.size());
+
+        // Other failures are not followed by a full fetch
+        FakeHTTPSClient cancelled;
+        cancelled.DeltaError = kRequestCancelled;
+        ASSERT_EQ(kRequestCancelled, user.PartialSync(&cancelled));
+        ASSERT_EQ(uint(1), cancelled.URLs.size());
+
+        FakeHTTPSClient broken;
+        broken.DeltaError = "Request to server failed with status code: 500";
+        broken.DeltaStatus = 500;
+        ASSERT_EQ(broken.DeltaError, user.PartialSync(&broken));
+        ASSERT_EQ(uint(1), broken.URLs.size());
+
+        FakeHTTPSClient offline;
+        offline.DeltaError = kRequestOffline;
+        ASSERT_EQ(kRequestOffline, user.PartialSync(&offline));
+        ASSERT_EQ(uint(1), offline.URLs.size());
+    }
+
+    TEST(TogglApiClientTest, SyncsAgainstFakeTogglAPI) {
+        FakeTogglAPI api(loadTestData());
+
+        User user("kopsik_test", "0.1");
+        user.SetAPIToken("30eb0ae954b536d2f6628f7fec47beb6");
+        ASSERT_EQ(noError, user.FullSync(&api));
+        ASSERT_EQ(uint(2), user.related.Workspaces.size());
+
+        TimeEntry *te = user.Start("Pushed", "", 0, 0);
+        te->EnsureGUID();
+        user.Stop();
+        ASSERT_FALSE(te->ID());
+        ASSERT_EQ(noError, user.PartialSync(&api));
+        ASSERT_TRUE(te->ID());
+
+        FakeTogglAPIStats stats = api.Stats();
+        ASSERT_EQ(uint(3), stats.requests);
+        ASSERT_EQ(uint(1), stats.full_fetches);
+        ASSERT_EQ(uint(1), stats.delta_fetches);
+        ASSERT_EQ(uint(1), stats.batch_updates);
+        ASSERT_EQ(uint(1), stats.models_pushed);
+        ASSERT_TRUE(stats.bytes_sent > loadTestData().size());
+
+        std::string response_body("");
+        ASSERT_EQ(noError, api.PostJSON("/api/v8/timeline", "[]",
+            "", "", &response_body));
+        ASSERT_EQ(uint(1), api.Stats().timeline_uploads);
+        ASSERT_NE(noError, api.GetJSON("/api/v8/nothing", "", "",
+            &response_body));
+
+        // Server down
+        api.SetErrorPercent(100, 1);
+        ASSERT_EQ("Request to server failed with status code: 500",
+            user.FullSync(&api));
+        ASSERT_EQ(uint(1), api.Stats().failed_requests);
+
+        // Responses take as long as the network
+        api.SetErrorPercent(0, 1);
+        api.SetLatencyMillis(50);
+        Poco::Stopwatch stopwatch;
+        stopwatch.start();
+        ASSERT_EQ(noError, user.PartialSync(&api));
+        ASSERT_GE(stopwatch.elapsed(), 50000);
+    }
+
+    TEST(TogglApiClientTest, PushesWhileFullSyncPulls) {
+        FakeTogglAPI api(loadTestData());
+
+        User user("kopsik_test", "0.1");
+        user.SetAPIToken("30eb0ae954b536d2f6628f7fec47beb6");
+        ASSERT_EQ(noError, user.FullSync(&api));
+        std::size_t count = user.related.TimeEntries.size();
+
+        TimeEntry *te = user.Start("Pushed meanwhile", "", 0, 0);
+        te->EnsureGUID();
+        user.Stop();
+
+        // Push and pull wait for the network at the same time
+        api.SetLatencyMillis(200);
+        Poco::Stopwatch stopwatch;
+        stopwatch.start();
+        ASSERT_EQ(noError, user.FullSync(&api));
+        ASSERT_LT(stopwatch.elapsed(), 400000);
+        ASSERT_EQ(uint(1), api.Stats().batch_updates);
+
+        // Created on the server after what was pulled
+        ASSERT_TRUE(te->ID());
+        ASSERT_FALSE(te->IsMarkedAsDeletedOnServer());
+        ASSERT_FALSE(te->NeedsPush());
+        ASSERT_EQ(count + 1, user.related.TimeEntries.size());
+        ASSERT_EQ("Pushed meanwhile", te->Description());
+    }
+
+    class UserWorkspaceFetchListener : public WorkspaceFetchListener {
+    public:
+        explicit UserWorkspaceFetchListener(User *user) : user_(user) {}
+        error Apply(const std::string &list, const std::string &json) {
+            Lists.push_back(list);
+            return loader_.Load(user_, list, json);
+        }
+        error Started(const SyncCheckpoint &checkpoint) {
+            Checkpoint = checkpoint;
+            for (std::size_t i = 0; i < checkpoint.pieces.size(); i++) {
+                const SyncCheckpointPiece &piece = checkpoint.pieces[i];
+                if (piece.wid) {
+                    loader_.KeepWorkspace(user_, piece.wid);
+                } else {
+                    loader_.KeepTimeEntries(user_, piece.since, piece.until);
+                }
+            }
+            return noError;
+        }
+        error PieceDone(const SyncCheckpointPiece &piece) {
+            Checkpoint.pieces.push_back(piece);
+            return noError;
+        }
+        error Complete(
+                const Poco::UInt64 since,
+                const Poco::UInt64 time_entries_since,
+                const Poco::UInt64 time_entries_until) {
+            loader_.SetTimeEntryWindow(time_entries_since,
+                                       time_entries_until);
+            loader_.Complete(user_, since);
+            return noError;
+        }
+        std::vector<std::string> Lists;
+        SyncCheckpoint Checkpoint;
+
+    private:
+        User *user_;
+        UserListLoader loader_;
+    };
+
+    TEST(TogglApiClientTest, FetchesWorkspacesInParallel) {
+        FakeTogglAPI api(loadTestData());
+
+        User expected("kopsik_test", "0.1");
+        LoadUserFromJSONString(&expected, loadTestData(), true, true);
+
+        User user("kopsik_test", "0.1");
+        UserWorkspaceFetchListener listener(&user);
+        WorkspaceFetch fetch(&api, "token", "api_token", &listener);
+        fetch.SetTimeEntryWindow(
+            Poco::DateTime(2013, 1, 1).timestamp().epochTime(),
+            Poco::Timestamp().epochTime());
+        ASSERT_EQ(noError, fetch.Fetch());
+
+        ASSERT_EQ(expected.ID(), user.ID());
+        ASSERT_EQ(expected.APIToken(), user.APIToken());
+        ASSERT_TRUE(user.Since());
+        ASSERT_EQ(expected.related.Workspaces.size(),
+                  user.related.Workspaces.size());
+        ASSERT_EQ(expected.related.Clients.size(),
+                  user.related.Clients.size());
+        ASSERT_EQ(expected.related.Projects.size(),
+                  user.related.Projects.size());
+        ASSERT_EQ(expected.related.Tasks.size(),
+                  user.related.Tasks.size());
+        ASSERT_EQ(expected.related.Tags.size(),
+                  user.related.Tags.size());
+        ASSERT_EQ(expected.related.TimeEntries.size(),
+                  user.related.TimeEntries.size());
+
+        // User and workspaces first, then the lists of the workspace
+        // that isn't premium, without tasks, of the premium one, and
+        // the time entry ranges. The deleted workspace is skipped.
+        ASSERT_EQ("", listener.Lists[0]);
+        ASSERT_EQ("workspaces", listener.Lists[1]);
+        ASSERT_EQ(std::size_t(2 + 3 + 4 + 4), listener.Lists.size());
+        ASSERT_EQ(uint(2 + 3 + 4 + 4), api.Stats().requests);
+        ASSERT_EQ(uint(0), api.Stats().full_fetches);
+
+        api.SetErrorPercent(100, 1);
+        ASSERT_EQ("Request to server failed with status code: 500",
+                  fetch.Fetch());
+    }
+
+    TEST(TogglApiClientTest, ResumesWorkspaceFetchFromCheckpoint) {
+        FakeTogglAPI api(loadTestData());
+        Poco::UInt64 since = Poco::DateTime(2013, 1, 1).timestamp().epochTime();
+        Poco::UInt64 until = Poco::Timestamp().epochTime();
+
+        User user("kopsik_test", "0.1");
+        UserWorkspaceFetchListener listener(&user);
+        {
+            WorkspaceFetch fetch(&api, "token", "api_token", &listener);
+            fetch.SetTimeEntryWindow(since, until);
+            ASSERT_EQ(noError, fetch.Fetch());
+        }
+        // Two workspaces and the time entry ranges
+        SyncCheckpoint checkpoint = listener.Checkpoint;
+        ASSERT_EQ(std::size_t(2 + 4), checkpoint.pieces.size());
+        ASSERT_EQ(since, checkpoint.time_entries_since);
+        ASSERT_EQ(until, checkpoint.time_entries_until);
+
+        // Interrupted before a workspace and the newest range were done
+        std::vector<SyncCheckpointPiece> done;
+        Poco::UInt64 undone_wid(0), undone_since(0);
+        for (std::size_t i = 0; i < checkpoint.pieces.size(); i++) {
+            const SyncCheckpointPiece &piece = checkpoint.pieces[i];
+            if (piece.wid && !undone_wid) {
+                undone_wid = piece.wid;
+            } else if (!piece.wid) {
+                undone_since = std::max(undone_since, piece.since);
+            }
+        }
+        for (std::size_t i = 0; i < checkpoint.pieces.size(); i++) {
+            const SyncCheckpointPiece &piece = checkpoint.pieces[i];
+            if (piece.wid != undone_wid
+                    && (piece.wid || piece.since != undone_since)) {
+                done.push_back(piece);
+            }
+        }
+        checkpoint.pieces = done;
+        checkpoint.since = 1;
+
+        UserWorkspaceFetchListener resumed(&user);
+        unsigned int requests = api.Stats().requests;
+        {
+            WorkspaceFetch fetch(&api, "token", "api_token", &resumed);
+            fetch.Resume(checkpoint);
+            ASSERT_EQ(noError, fetch.Fetch());
+        }
+
+        // Only the pieces not done are fetched again
+        ASSERT_EQ(done.size(), resumed.Checkpoint.pieces.size() - 2);
+        ASSERT_EQ(checkpoint.started, resumed.Checkpoint.started);
+        ASSERT_EQ(resumed.Lists.size(), api.Stats().requests - requests);
+        ASSERT_LT(resumed.Lists.size(), listener.Lists.size());
+        ASSERT_EQ(1, std::count(resumed.Lists.begin(), resumed.Lists.end(),
+                                std::string("clients")));
+        ASSERT_EQ(1, std::count(resumed.Lists.begin(), resumed.Lists.end(),
+                                std::string("time_entries")));
+
+        // The models of the pieces done before are still there, and
+        // changes since the first fetch are synced next time
+        ASSERT_EQ(Poco::UInt64(1), user.Since());
+        for (std::size_t i = 0; i < user.related.Clients.size(); i++) {
+            ASSERT_FALSE(user.related.Clients[i]->IsMarkedAsDeletedOnServer());
+        }
+        for (std::size_t i = 0; i < user.related.Projects.size(); i++) {
+            ASSERT_FALSE(
+                user.related.Projects[i]->IsMarkedAsDeletedOnServer());
+        }
+        for (std::size_t i = 0; i < user.related.TimeEntries.size(); i++) {
+            ASSERT_FALSE(
+                user.related.TimeEntries[i]->IsMarkedAsDeletedOnServer());
+        }
+    }
+
+    TEST(TogglApiClientTest, StreamsFeedbackAttachment) {
+        std::string attachment("");
+        for (int i = 0; i < 100000; i++) {
+            attachment += static_cast<char>(i % 256);
+        }
+        {
+            Poco::FileOutputStream fos("feedback_test.bin");
+            fos << attachment;
+        }
+
+        Feedback feedback("Topic", "Some \"details\"", "feedback_test.bin");
+        feedback.SetAppVersion("1.0");
+        std::string json = feedback.JSON();
+        ASSERT_TRUE(IsValidJSON(json));
+
+        JSONValue *root = JSONParse(json);
+        ASSERT_EQ("feedback_test.bin",
+                  JSONString(JSONGet(root, "attachment_name")));
+        std::istringstream iss(
+            JSONString(JSONGet(root, "base64_encoded_attachment")));
+        JSONDelete(root);
+        Poco::Base64Decoder decoder(iss);
+        std::string decoded("");
+        Poco::StreamCopier::copyToString(decoder, decoded);
+        ASSERT_EQ(attachment, decoded);
+
+        // Sent as it's written
+        FakeTogglAPI api(loadTestData());
+        std::string response_body("");
+        ASSERT_EQ(noError, api.PostJSON("/api/v8/feedback", &feedback,
+            "", "", &response_body));
+        ASSERT_EQ(json.size(), api.Stats().bytes_received);
+
+        Poco::File("feedback_test.bin").remove(false);
+    }
+
+    TEST(TogglApiClientTest, LogsInWithoutRelatedDataFirst) {
+        FakeTogglAPI api(loadTestData());
+        api.SetRunningTimeEntryJSON("{\"data\":{\"id\":90000001,"
+            "\"guid\":\"2f3a6f2e-7a1c-4d32-8a54-3b5b2e9b1c01\","
+            "\"wid\":123456789,\"start\":\"2013-09-05T09:00:00+00:00\","
+            "\"duration\":-1378371600,\"description\":\"Running\"}}");
+
+        User user("kopsik_test", "0.1");
+        ASSERT_EQ(noError, user.Login(&api, "foo@bar.com", "secret", false));
+        ASSERT_TRUE(user.ID());
+        ASSERT_FALSE(user.APIToken().empty());
+        ASSERT_TRUE(user.related.Workspaces.empty());
+        ASSERT_TRUE(user.related.TimeEntries.empty());
+        // The full sync after needs all of it
+        ASSERT_EQ(Poco::UInt64(0), user.Since());
+        ASSERT_EQ(uint(0), api.Stats().full_fetches);
+
+        ASSERT_EQ(noError, user.FetchRunningTimeEntry(&api));
+        ASSERT_EQ(std::size_t(1), user.related.TimeEntries.size());
+        TimeEntry *running = user.RunningTimeEntry();
+        ASSERT_TRUE(running);
+        ASSERT_EQ("Running", running->Description());
+
+        // Nothing running is fine too
+        api.SetRunningTimeEntryJSON("{\"data\":null}");
+        ASSERT_EQ(noError, user.FetchRunningTimeEntry(&api));
+        ASSERT_EQ(std::size_t(1), user.related.TimeEntries.size());
+
+        ASSERT_EQ(noError, user.FullSync(&api));
+        ASSERT_EQ(uint(1), api.Stats().full_fetches);
+        ASSERT_FALSE(user.related.Workspaces.empty());
+        ASSERT_TRUE(user.Since());
+    }
+
+    TEST(TogglApiClientTest, SendsPerformanceSnapshotWithFeedback) {
+        Trace &trace = Trace::Shared();
+        trace.Clear();
+        Trace::SetEnabled(true);
+        for (int i = 0; i < 3; i++) {
+            TraceSpan span(i ? "test.newer" : "test.oldest");
+        }
+        Trace::SetEnabled(false);
+
+        // Only the latest spans of each thread, when asked
+        std::string spans = trace.JSON(2);
+        ASSERT_TRUE(IsValidJSON(spans));
+        ASSERT_EQ(std::string::npos, spans.find("test.oldest"));
+        ASSERT_NE(std::string::npos, spans.find("test.newer"));
+        trace.Clear();
+
+        JSONWriter snapshot;
+        snapshot.BeginObject();
+        snapshot.Raw("trace", spans);
+        snapshot.Raw("slow_api_calls", "[]");
+        snapshot.EndObject();
+
+        Feedback feedback("Topic", "Slow", "");
+        feedback.SetAppVersion("1.0");
+        feedback.SetPerformance(snapshot.Buffer());
+        std::string json = feedback.JSON();
+        ASSERT_TRUE(IsValidJSON(json));
+
+        JSONValue *root = JSONParse(json);
+        JSONValue *performance = JSONGet(root, "performance");
+        ASSERT_TRUE(performance);
+        ASSERT_TRUE(JSONGet(performance, "trace"));
+        ASSERT_TRUE(JSONGet(performance, "slow_api_calls"));
+        ASSERT_EQ("Slow", JSONString(JSONGet(root, "details")));
+        JSONDelete(root);
+    }
+
+    TEST(TogglApiClientTest, LookupsFollowModelChanges) {
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+
+        Project *p = user.GetProjectByID(2598305);
+        ASSERT_TRUE(p);
+        ASSERT_EQ(p, user.GetProjectByGUID(p->GUID()));
+
+        // Server assigns an ID to a locally created project
+        Project *added = user.AddProject(123456789, 0, "Indexed");
+        ASSERT_FALSE(
+            user.GetProjectByGUID("07fba193-91c4-0ec8-2345-820df0548123"));
+        added->SetGUID("07fba193-91c4-0ec8-2345-820df0548123");
+        added->SetID(1234);
+        ASSERT_EQ(added, user.GetProjectByID(1234));
+        ASSERT_EQ(added,
+            user.GetProjectByGUID("07fba193-91c4-0ec8-2345-820df0548123"));
+
+        // Old keys are forgotten
+        p->SetID(4321);
+        ASSERT_FALSE(user.GetProjectByID(2598305));
+        ASSERT_EQ(p, user.GetProjectByID(4321));
+
+        TimeEntry *te = user.Start("Indexed", "", 0, 0);
+        ASSERT_TRUE(te);
+        te->EnsureGUID();
+        ASSERT_EQ(te, user.GetTimeEntryByGUID(te->GUID()));
+
+        user.ClearProjects();
+        ASSERT_FALSE(user.GetProjectByID(1234));
+        ASSERT_FALSE(user.GetProjectByID(4321));
+
+        user.ClearTimeEntries();
+        ASSERT_FALSE(user.GetTimeEntryByID(89818605));
+    }
+
+    TEST(TogglApiClientTest, LoadsUserFromJSONStreamInPieces) {
+        std::string json = loadTestData();
+
+        User whole("kopsik_test", "0.1");
+        LoadUserFromJSONString(&whole, json, true, true);
+
+        User pieces("kopsik_test", "0.1");
+        UserJSONStreamLoader loader(true, true);
+        for (std::size_t i = 0; i < json.size(); i++) {
+            loader.Consume(json.data() + i, 1);
+        }
+        ASSERT_EQ(noError, loader.Finish());
+        loader.Apply(&pieces);
+
+        ASSERT_EQ(whole.ID(), pieces.ID());
+        ASSERT_EQ(whole.Since(), pieces.Since());
+        ASSERT_EQ(whole.APIToken(), pieces.APIToken());
+        ASSERT_EQ(whole.related.Workspaces.size(),
+            pieces.related.Workspaces.size());
+        ASSERT_EQ(whole.related.Clients.size(),
+            pieces.related.Clients.size());
+        ASSERT_EQ(whole.related.Projects.size(),
+            pieces.related.Projects.size());
+        ASSERT_EQ(whole.related.Tasks.size(), pieces.related.Tasks.size());
+        ASSERT_EQ(whole.related.Tags.size(), pieces.related.Tags.size());
+        ASSERT_EQ(whole.related.TimeEntries.size(),
+            pieces.related.TimeEntries.size());
+        ASSERT_GT(pieces.related.TimeEntries.size(), uint(0));
+        ASSERT_EQ(whole.related.TimeEntries[0]->Description(),
+            pieces.related.TimeEntries[0]->Description());
+
+        // Since is not moved on by a response that was cut off
+        User cut("kopsik_test", "0.1");
+        UserJSONStreamLoader partial(true, true);
+        partial.Consume(json.data(), json.size() / 2);
+        ASSERT_NE(noError, partial.Finish());
+        partial.Apply(&cut);
+        ASSERT_EQ(uint(0), cut.Since());
+    }
+
+    TEST(TogglApiClientTest, DecodesBigUserJSONOnSeveralThreads) {
+        // Time entries come first, but are applied after their project
+        std::stringstream json;
+        json << "{\"since\":1400000000,\"data\":{\"id\":10,"
+             << "\"time_entries\":[";
+        const int n = kJSONDecodeParallelMinModels * 2;
+        for (int i = 1; i <= n; i++) {
+            if (i > 1) {
+                json << ",";
+            }
+            json << "{\"id\":" << i << ",\"wid\":1,\"pid\":7,"
+                 << "\"description\":\"entry " << i << "\","
+                 << "\"start\":\"2013-09-05T06:33:50+00:00\","
+                 << "\"duration\":60}";
+        }
+        json << "],\"projects\":[{\"id\":7,\"wid\":1,"
+             << "\"name\":\"project\"}],"
+             << "\"workspaces\":[{\"id\":1,\"name\":\"ws\"}]}}";
+
+        UserJSONStreamLoader loader(true, true);
+        loader.SetDecodeThreads(4);
+        std::string body(json.str());
+        loader.Consume(body.data(), body.size());
+        ASSERT_EQ(noError, loader.Finish());
+        ASSERT_EQ(std::size_t(n + 3), loader.StagedCount());
+
+        User user("kopsik_test", "0.1");
+        loader.Apply(&user);
+        ASSERT_EQ(std::size_t(n), user.related.TimeEntries.size());
+        ASSERT_EQ(std::size_t(1), user.related.Projects.size());
+        ASSERT_EQ(std::size_t(1), user.related.Workspaces.size());
+        for (int i = 1; i <= n; i++) {
+            TimeEntry *te = user.GetTimeEntryByID(i);
+            ASSERT_TRUE(te);
+            ASSERT_EQ("entry " + Poco::NumberFormatter::format(i),
+                      te->Description());
+            ASSERT_EQ(Poco::UInt64(7), te->PID());
+        }
+        ASSERT_EQ(Poco::UInt64(1400000000), user.Since());
+    }
+
+    static std::string timeEntriesJSON(const std::string &ids) {
+        std::stringstream json;
+        json << "{\"since\":1400000000,\"data\":{\"id\":10,"
+             << "\"time_entries\":[";
+        Poco::StringTokenizer tokens(ids, ",");
+        for (Poco::StringTokenizer::Iterator it = tokens.begin();
+                it != tokens.end();
+                it++) {
+            if (it != tokens.begin()) {
+                json << ",";
+            }
+            json << "{\"id\":" << *it << ",\"wid\":1,"
+                 << "\"start\":\"2013-09-05T06:33:50+00:00\","
+                 << "\"duration\":60}";
+        }
+        json << "]}}";
+        return json.str();
+    }
+
+    TEST(TogglApiClientTest, MarksModelsMissingFromFullSyncAsDeleted) {
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, timeEntriesJSON("5,3,1,4"), true, true);
+        ASSERT_EQ(std::size_t(4), user.related.TimeEntries.size());
+
+        // A delta only has what changed
+        LoadUserFromJSONString(&user, timeEntriesJSON("4"), false, true);
+        ASSERT_FALSE(user.GetTimeEntryByID(1)->IsMarkedAsDeletedOnServer());
+
+        LoadUserFromJSONString(&user, timeEntriesJSON("4,5,3,5"), true, true);
+        ASSERT_TRUE(user.GetTimeEntryByID(1)->IsMarkedAsDeletedOnServer());
+        ASSERT_FALSE(user.GetTimeEntryByID(3)->IsMarkedAsDeletedOnServer());
+        ASSERT_FALSE(user.GetTimeEntryByID(4)->IsMarkedAsDeletedOnServer());
+        ASSERT_FALSE(user.GetTimeEntryByID(5)->IsMarkedAsDeletedOnServer());
+    }
+
+    TEST(TogglApiClientTest, LooksUpJSONKeys) {
+        ASSERT_EQ(kJSONKeyID, JSONKeyFromName("id"));
+        ASSERT_EQ(kJSONKeyAt, JSONKeyFromName("at"));
+        ASSERT_EQ(kJSONKeyWID, JSONKeyFromName("wid"));
+        ASSERT_EQ(kJSONKeyTags, JSONKeyFromName("tags"));
+        ASSERT_EQ(kJSONKeyTasks, JSONKeyFromName("tasks"));
+        ASSERT_EQ(kJSONKeyStoreStartAndStopTime,
+            JSONKeyFromName("store_start_and_stop_time"));
+        ASSERT_EQ(kJSONKeyUnknown, JSONKeyFromName(""));
+        ASSERT_EQ(kJSONKeyUnknown, JSONKeyFromName("i"));
+        ASSERT_EQ(kJSONKeyUnknown, JSONKeyFromName("ids"));
+        ASSERT_EQ(kJSONKeyUnknown, JSONKeyFromName("Id"));
+        ASSERT_EQ(kJSONKeyUnknown, JSONKeyFromName("tagz"));
+    }
+
+    TEST(TogglApiClientTest, CachesProcessNamesByStartTime) {
+        ProcessNameCache cache;
+        std::string name("");
+        ASSERT_FALSE(cache.Get(100, 1, &name));
+
+        cache.Put(100, 1, "firefox");
+        ASSERT_TRUE(cache.Get(100, 1, &name));
+        ASSERT_EQ("firefox", name);
+
+        // PID was reused by another process
+        ASSERT_FALSE(cache.Get(100, 2, &name));
+        ASSERT_FALSE(cache.Get(100, 1, &name));
+
+        // Least recently used name goes first
+        for (Poco::UInt64 pid = 1; pid <= kProcessNameCacheSize; pid++) {
+            cache.Put(pid, 1, "process");
+        }
+        ASSERT_TRUE(cache.Get(1, 1, &name));
+        cache.Put(1000, 1, "new");
+        ASSERT_TRUE(cache.Get(1, 1, &name));
+        ASSERT_FALSE(cache.Get(2, 1, &name));
+        ASSERT_TRUE(cache.Get(1000, 1, &name));
+    }
+
+    TEST(TogglApiClientTest, BuffersTimelineEvents) {
+        Database db(TESTDB);
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        Poco::UInt64 before = count;
+
+        Poco::NotificationCenter& nc =
+            Poco::NotificationCenter::defaultCenter();
+        for (int i = 0; i < 3; i++) {
+            TimelineEvent event;
+            event.user_id = 1;
+            event.title = StringTable::Timeline().Intern(
+                "Terminal " + Poco::NumberFormatter::format(i));
+            event.filename = StringTable::Timeline().Intern("bash");
+            event.start_time = time(0) - 10;
+            event.end_time = time(0);
+            nc.postNotification(new TimelineEventNotification(event));
+        }
+
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before, count);
+
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before + 3, count);
+    }
+
+    TEST(TogglApiClientTest, DispatchesTimelineEventsToDatabase) {
+        Database db(TESTDB);
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        Poco::UInt64 before = count;
+
+        TimelineEvent event;
+        event.user_id = 1;
+        event.title = StringTable::Timeline().Intern("Terminal");
+        event.filename = StringTable::Timeline().Intern("bash");
+        event.start_time = time(0) - 10;
+        event.end_time = time(0);
+        TimelineDispatcher::Instance().Post(
+            new TimelineEventNotification(event));
+
+        // Stopping delivers whatever the dispatcher thread has not yet
+        TimelineDispatcher::Instance().Stop();
+
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before + 1, count);
+    }
+
+    TEST(TogglApiClientTest, RoutesTimelineEventsToTheirOwnContext) {
+        Poco::NotificationCenter mine;
+        Poco::NotificationCenter theirs;
+        // Same file, but as if for two contexts
+        Database db(TESTDB, DatabaseTuning(), mine);
+        Database other(TESTDB, DatabaseTuning(), theirs);
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        Poco::UInt64 before = count;
+
+        TimelineEvent event;
+        event.user_id = 1;
+        event.title = StringTable::Timeline().Intern("Terminal");
+        event.filename = StringTable::Timeline().Intern("bash");
+        event.start_time = time(0) - 10;
+        event.end_time = time(0);
+        TimelineDispatcher::Instance().Post(
+            new TimelineEventNotification(event), theirs);
+        TimelineDispatcher::Instance().Stop();
+
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before, count);
+
+        ASSERT_EQ(noError, other.FlushTimelineEvents());
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before + 1, count);
+    }
+
+    TEST(TogglApiClientTest, DrainsTimelineEventsOfOneContext) {
+        Poco::NotificationCenter mine;
+        Poco::NotificationCenter theirs;
+        Database db(TESTDB, DatabaseTuning(), mine);
+        Database other(TESTDB, DatabaseTuning(), theirs);
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        Poco::UInt64 before = count;
+
+        TimelineEvent event;
+        event.user_id = 1;
+        event.title = StringTable::Timeline().Intern("Terminal");
+        event.filename = StringTable::Timeline().Intern("bash");
+        event.start_time = time(0) - 10;
+        event.end_time = time(0);
+        TimelineDispatcher::Instance().Post(
+            new TimelineEventNotification(event), theirs);
+        TimelineDispatcher::Instance().Post(
+            new TimelineEventNotification(event), mine);
+
+        // Only this context's event is delivered by the caller,
+        // the other one is left to the dispatcher thread
+        ASSERT_EQ(std::size_t(0),
+                  TimelineDispatcher::Instance().DrainWithin(mine, 1000000));
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before + 1, count);
+
+        TimelineDispatcher::Instance().Stop();
+        ASSERT_EQ(noError, other.FlushTimelineEvents());
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before + 2, count);
+    }
+
+    TEST(TogglApiClientTest, StopsTimelineUploaderWithoutWaitingOutInterval) {
+        TimelineUploader uploader(1, "token", "https://timeline.invalid",
+                                  "kopsik_test", "0.1",
+                                  Poco::NotificationCenter::defaultCenter());
+        Poco::Thread::sleep(100);
+
+        Poco::Stopwatch stopwatch;
+        stopwatch.start();
+        uploader.RequestStop();
+        ASSERT_EQ(noError, uploader.Stop());
+        ASSERT_GT(500000, stopwatch.elapsed());
+
+        // Nothing left to drain for the database
+        ASSERT_EQ(std::size_t(0),
+                  TimelineDispatcher::Instance().StopWithin(1000));
+    }
+
+    class FakeTimelineStream : public TimelineStream {
+     public:
+        FakeTimelineStream() : batches(0), listener_(0) {}
+
+        error SendTimeline(
+                const Poco::UInt64 batch_id,
+                const std::string &events_json) {
+            Poco::FastMutex::ScopedLock lock(m_);
+            batches++;
+            json = events_json;
+            if (listener_) {
+                listener_->TimelineAcknowledged(batch_id, noError);
+            }
+            return noError;
+        }
+
+        void SetTimelineListener(TimelineStreamListener *listener) {
+            Poco::FastMutex::ScopedLock lock(m_);
+            listener_ = listener;
+        }
+
+        int batches;
+        std::string json;
+
+     private:
+        TimelineStreamListener *listener_;
+        Poco::FastMutex m_;
+    };
+
+    TEST(TogglApiClientTest, UploadsTimelineOverStream) {
+        // The uploader waits while offline, which contexts of
+        // earlier tests may have left the shared monitor in
+        ConnectivityMonitor::Instance().Reachable();
+        Database db(TESTDB);
+        const Poco::UInt64 user_id(79);
+
+        Poco::NotificationCenter& nc =
+            Poco::NotificationCenter::defaultCenter();
+        for (int i = 0; i < 3; i++) {
+            TimelineEvent event;
+            event.user_id = static_cast<unsigned int>(user_id);
+            event.title = StringTable::Timeline().Intern(
+                "Slides " + Poco::NumberFormatter::format(i));
+            event.filename = StringTable::Timeline().Intern("keynote");
+            event.start_time = time(0) - 10;
+            event.end_time = time(0);
+            nc.postNotification(new TimelineEventNotification(event));
+        }
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+
+        FakeTimelineStream stream;
+        Poco::UInt64 count(0);
+        {
+            // Acknowledged batch is deleted, no POST is made
+            TimelineUploader uploader(user_id, "token",
+                                      "https://timeline.invalid",
+                                      "kopsik_test", "0.1", nc, &stream);
+            for (int i = 0; i < 50; i++) {
+                ASSERT_EQ(noError, db.UInt(
+                    "select count(*) from timeline_events where user_id = 79",
+                    &count));
+                if (!count) {
+                    break;
+                }
+                Poco::Thread::sleep(100);
+            }
+            ASSERT_EQ(noError, uploader.Stop());
+        }
+        TimelineDispatcher::Instance().Stop();
+
+        ASSERT_EQ(Poco::UInt64(0), count);
+        ASSERT_EQ(1, stream.batches);
+        ASSERT_NE(std::string::npos, stream.json.find("Slides 2"));
+    }
+
+    TEST(TogglApiClientTest, StopsWindowChangeRecorderBetweenPolls) {
+        WindowChangeRecorder recorder(
+            1, Poco::NotificationCenter::defaultCenter());
+        Poco::Thread::sleep(100);
+
+        Poco::Stopwatch stopwatch;
+        stopwatch.start();
+        ASSERT_EQ(noError, recorder.Stop());
+        ASSERT_GT(250000, stopwatch.elapsed());
+        TimelineDispatcher::Instance().Stop();
+    }
+
+    TEST(TogglApiClientTest, DeletesUploadedTimelineEventsAsRange) {
+        Database db(TESTDB);
+
+        Poco::NotificationCenter& nc =
+            Poco::NotificationCenter::defaultCenter();
+        for (int i = 0; i < 3; i++) {
+            TimelineEvent event;
+            event.user_id = 1;
+            event.title = StringTable::Timeline().Intern(
+                "Terminal " + Poco::NumberFormatter::format(i));
+            event.filename = StringTable::Timeline().Intern("bash");
+            event.start_time = time(0) - 10;
+            event.end_time = time(0);
+            nc.postNotification(new TimelineEventNotification(event));
+        }
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        Poco::UInt64 before = count;
+        Poco::UInt64 last_id(0);
+        ASSERT_EQ(noError,
+            db.UInt("select max(id) from timeline_events", &last_id));
+
+        nc.postNotification(new DeleteTimelineBatchNotification(1,
+            static_cast<unsigned int>(last_id - 2),
+            static_cast<unsigned int>(last_id)));
+
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before - 3, count);
+    }
+
+    class TimelineBatchCatcher {
+     public:
+        TimelineBatchCatcher() : size(0), backlog(0) {}
+        void onBatchReady(
+                const Poco::AutoPtr<TimelineBatchReadyNotification> &n) {
+            size = n->batch.size();
+            backlog = n->backlog;
+            batch = n->batch;
+        }
+        std::size_t size;
+        Poco::UInt64 backlog;
+        std::vector<TimelineEvent> batch;
+    };
+
+    TEST(TogglApiClientTest, ReportsTimelineBacklogWithBatch) {
+        Database db(TESTDB);
+        const Poco::UInt64 user_id(75);
+
+        Poco::NotificationCenter& nc =
+            Poco::NotificationCenter::defaultCenter();
+        for (int i = 0; i < 5; i++) {
+            TimelineEvent event;
+            event.user_id = static_cast<unsigned int>(user_id);
+            event.title = StringTable::Timeline().Intern(
+                "Editor " + Poco::NumberFormatter::format(i));
+            event.filename = StringTable::Timeline().Intern("vim");
+            event.start_time = time(0) - 10;
+            event.end_time = time(0);
+            nc.postNotification(new TimelineEventNotification(event));
+        }
+
+        TimelineBatchCatcher catcher;
+        Poco::NObserver<TimelineBatchCatcher, TimelineBatchReadyNotification>
+            observer(catcher, &TimelineBatchCatcher::onBatchReady);
+        nc.addObserver(observer);
+
+        nc.postNotification(new CreateTimelineBatchNotification(
+            user_id, 2, 0));
+        // Stopping delivers the batch the database has posted
+        TimelineDispatcher::Instance().Stop();
+        nc.removeObserver(observer);
+
+        ASSERT_EQ(std::size_t(2), catcher.size);
+        ASSERT_EQ(Poco::UInt64(3), catcher.backlog);
+
+        Poco::UInt64 last_id(0);
+        ASSERT_EQ(noError,
+            db.UInt("select max(id) from timeline_events", &last_id));
+        nc.postNotification(new DeleteTimelineBatchNotification(user_id,
+            0, static_cast<unsigned int>(last_id)));
+    }
+
+    class TimelineBlockCatcher {
+     public:
+        TimelineBlockCatcher() : block_id(0), events(0), backlog(0) {}
+        void onBlockReady(
+                const Poco::AutoPtr<TimelineBlockReadyNotification> &n) {
+            block_id = n->block_id;
+            events = n->events;
+            backlog = n->backlog;
+            std::istringstream in(n->block);
+            Poco::InflatingInputStream inflater(in,
+                Poco::InflatingStreamBuf::STREAM_GZIP);
+            Poco::StreamCopier::copyToString(inflater, json);
+        }
+        Poco::Int64 block_id;
+        unsigned int events;
+        Poco::UInt64 backlog;
+        std::string json;
+    };
+
+    TEST(TogglApiClientTest, PacksWaitingTimelineEventsIntoBlocks) {
+        Database db(TESTDB);
+        db.SetTimelineCoalesceSeconds(0);
+        db.SetTimelineBlocks(true);
+        const Poco::UInt64 user_id(77);
+
+        Poco::NotificationCenter& nc =
+            Poco::NotificationCenter::defaultCenter();
+        const unsigned int recorded = 2 * kTimelineBlockEvents + 10;
+        for (unsigned int i = 0; i < recorded; i++) {
+            TimelineEvent event;
+            event.user_id = static_cast<unsigned int>(user_id);
+            event.title = StringTable::Timeline().Intern(
+                "Page " + Poco::NumberFormatter::format(i));
+            event.filename = StringTable::Timeline().Intern("browser");
+            event.start_time = 3000 + i * 100;
+            event.end_time = event.start_time + 10;
+            nc.postNotification(new TimelineEventNotification(event));
+        }
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_blocks "
+                                   "where user_id = 77", &count));
+        ASSERT_EQ(Poco::UInt64(1), count);
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_events "
+                                   "where user_id = 77", &count));
+        ASSERT_EQ(Poco::UInt64(recorded - kTimelineBlockEvents), count);
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_titles "
+                                   "where title = 'Page 0'", &count));
+        ASSERT_EQ(Poco::UInt64(0), count);
+
+        // The block is handed out before the events left, as the
+        // JSON the uploader would have written for its events
+        TimelineBlockCatcher catcher;
+        Poco::NObserver<TimelineBlockCatcher, TimelineBlockReadyNotification>
+            observer(catcher, &TimelineBlockCatcher::onBlockReady);
+        nc.addObserver(observer);
+        nc.postNotification(new CreateTimelineBatchNotification(
+            user_id, 10, 0));
+        TimelineDispatcher::Instance().Stop();
+        nc.removeObserver(observer);
+
+        ASSERT_NE(Poco::Int64(0), catcher.block_id);
+        ASSERT_EQ(kTimelineBlockEvents, catcher.events);
+        ASSERT_EQ(Poco::UInt64(recorded - kTimelineBlockEvents),
+                  catcher.backlog);
+        ASSERT_EQ(std::size_t(0), catcher.json.find(
+            "[{\"filename\":\"browser\",\"title\":\"Page 0\","
+            "\"start_time\":3000,"));
+        ASSERT_EQ(']', catcher.json[catcher.json.size() - 1]);
+
+        nc.postNotification(new DeleteTimelineBlockNotification(user_id,
+            catcher.block_id));
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_blocks "
+                                   "where user_id = 77", &count));
+        ASSERT_EQ(Poco::UInt64(0), count);
+
+        Poco::UInt64 last_id(0);
+        ASSERT_EQ(noError,
+            db.UInt("select max(id) from timeline_events", &last_id));
+        nc.postNotification(new DeleteTimelineBatchNotification(user_id,
+            0, static_cast<unsigned int>(last_id)));
+    }
+
+    TEST(TogglApiClientTest, SendsGzippedRequestBodyAsItIs) {
+        std::string json("[{\"idle\":true}]");
+        std::ostringstream out;
+        Poco::DeflatingOutputStream gzip(out,
+            Poco::DeflatingStreamBuf::STREAM_GZIP);
+        gzip << json;
+        gzip.close();
+        std::string gzipped = out.str();
+
+        GzippedRequestBody body(gzipped, json.size());
+        ASSERT_EQ(Poco::UInt64(json.size()), body.GzippedFrom());
+        std::stringstream written;
+        body.Write(&written);
+        ASSERT_EQ(gzipped, written.str());
+    }
+
+    TEST(TogglApiClientTest, StoresTimelineTitlesAndAppsOnce) {
+        Database db(TESTDB);
+        db.SetTimelineCoalesceSeconds(0);
+        const Poco::UInt64 user_id(76);
+
+        Poco::NotificationCenter& nc =
+            Poco::NotificationCenter::defaultCenter();
+        for (int i = 0; i < 3; i++) {
+            TimelineEvent event;
+            event.user_id = static_cast<unsigned int>(user_id);
+            event.title = StringTable::Timeline().Intern("Shared title");
+            event.filename = StringTable::Timeline().Intern("shared_app");
+            event.start_time = 2000 + i * 100;
+            event.end_time = event.start_time + 10;
+            nc.postNotification(new TimelineEventNotification(event));
+        }
+        TimelineEvent idle;
+        idle.user_id = static_cast<unsigned int>(user_id);
+        idle.idle = true;
+        idle.start_time = 2500;
+        idle.end_time = 2600;
+        nc.postNotification(new TimelineEventNotification(idle));
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_titles "
+                                   "where title = 'Shared title'", &count));
+        ASSERT_EQ(Poco::UInt64(1), count);
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_apps "
+                                   "where filename = 'shared_app'", &count));
+        ASSERT_EQ(Poco::UInt64(1), count);
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_events "
+                                   "where user_id = 76 and title is null "
+                                   "and filename is null", &count));
+        ASSERT_EQ(Poco::UInt64(4), count);
+
+        // Events come back with their text for upload
+        TimelineBatchCatcher catcher;
+        Poco::NObserver<TimelineBatchCatcher, TimelineBatchReadyNotification>
+            observer(catcher, &TimelineBatchCatcher::onBatchReady);
+        nc.addObserver(observer);
+        nc.postNotification(new CreateTimelineBatchNotification(
+            user_id, 10, 0));
+        TimelineDispatcher::Instance().Stop();
+        nc.removeObserver(observer);
+
+        ASSERT_EQ(std::size_t(4), catcher.size);
+        ASSERT_EQ("Shared title", *catcher.batch[0].title);
+        ASSERT_EQ("shared_app", *catcher.batch[2].filename);
+        ASSERT_EQ("", *catcher.batch[3].title);
+        ASSERT_EQ("", *catcher.batch[3].filename);
+        ASSERT_TRUE(catcher.batch[3].idle);
+
+        // Once uploaded, the text goes too
+        nc.postNotification(new DeleteTimelineBatchNotification(user_id,
+            catcher.batch[0].id, catcher.batch[3].id));
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_titles "
+                                   "where title = 'Shared title'", &count));
+        ASSERT_EQ(Poco::UInt64(0), count);
+    }
+
+    TEST(TogglApiClientTest, RollsTimelineUpIntoHoursPerApp) {
+        TimelineRollup rollup;
+        StringTable &strings = StringTable::Timeline();
+
+        TimelineEvent event;
+        event.user_id = 1;
+        event.filename = strings.Intern("editor");
+        event.title = strings.Intern("main.cc");
+        event.start_time = 3600 - 600;
+        event.end_time = 3600 + 300;
+        rollup.Add(event);
+        event.title = strings.Intern("main.h");
+        event.start_time = 3600 + 400;
+        event.end_time = 3600 + 500;
+        rollup.Add(event);
+        event.filename = strings.Intern("browser");
+        event.start_time = 3600 + 500;
+        event.end_time = 3600 + 800;
+        rollup.Add(event);
+
+        // Second hour is not over yet
+        std::vector<TimelineEvent> events;
+        rollup.TakeFinished(3600 + 900, &events);
+        ASSERT_EQ(std::size_t(1), events.size());
+        ASSERT_EQ("editor", *events[0].filename);
+        ASSERT_EQ("", *events[0].title);
+        ASSERT_EQ(0, events[0].start_time);
+        ASSERT_EQ(600, events[0].end_time);
+
+        events.clear();
+        rollup.TakeAll(&events);
+        ASSERT_TRUE(rollup.Empty());
+        ASSERT_EQ(std::size_t(2), events.size());
+        ASSERT_EQ("browser", *events[0].filename);
+        ASSERT_EQ(3600, events[0].start_time);
+        ASSERT_EQ(3600 + 300, events[0].end_time);
+        ASSERT_EQ("editor", *events[1].filename);
+        ASSERT_EQ(3600 + 400, events[1].end_time);
+    }
+
+    TEST(TogglApiClientTest, StoresTimelineRollupsOfFinishedHours) {
+        Database db(TESTDB);
+        db.SetTimelineRollups(true);
+        const unsigned int user_id(77);
+
+        Poco::NotificationCenter& nc =
+            Poco::NotificationCenter::defaultCenter();
+        const char *apps[] = { "shell", "mail", "shell", "mail", "shell" };
+        for (int i = 0; i < 5; i++) {
+            TimelineEvent event;
+            event.user_id = user_id;
+            event.title = StringTable::Timeline().Intern(
+                "Window " + Poco::NumberFormatter::format(i));
+            event.filename = StringTable::Timeline().Intern(apps[i]);
+            event.start_time = 7200 + i * 100;
+            event.end_time = event.start_time + 50;
+            nc.postNotification(new TimelineEventNotification(event));
+        }
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_events "
+                                   "where user_id = 77", &count));
+        ASSERT_EQ(Poco::UInt64(2), count);
+        Poco::UInt64 seconds(0);
+        ASSERT_EQ(noError, db.UInt("select sum(e.end_time - e.start_time) "
+                                   "from timeline_events e "
+                                   "join timeline_apps a on a.id = e.app_id "
+                                   "where e.user_id = 77 "
+                                   "and a.filename = 'shell'", &seconds));
+        ASSERT_EQ(Poco::UInt64(150), seconds);
+
+        // Events of the running hour are kept until it's over
+        TimelineEvent now;
+        now.user_id = user_id;
+        now.filename = StringTable::Timeline().Intern("shell");
+        now.start_time = time(0) - 1;
+        now.end_time = time(0);
+        nc.postNotification(new TimelineEventNotification(now));
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_events "
+                                   "where user_id = 77", &count));
+        ASSERT_EQ(Poco::UInt64(2), count);
+
+        db.SetTimelineRollups(false);
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+        ASSERT_EQ(noError, db.UInt("select count(*) from timeline_events "
+                                   "where user_id = 77", &count));
+        ASSERT_EQ(Poco::UInt64(3), count);
+
+        ASSERT_EQ(noError, db.UInt("select max(id) from timeline_events",
+                                   &count));
+        nc.postNotification(new DeleteTimelineBatchNotification(user_id,
+            0, static_cast<unsigned int>(count)));
+    }
+
+    TEST(TogglApiClientTest, SuggestsTimeEntriesForUntrackedWindows) {
+        TimeEntrySuggestions suggestions(100, 2, 300);
+        ASSERT_TRUE(suggestions.SetUser(1));
+        ASSERT_FALSE(suggestions.SetUser(1));
+
+        // Tracked before
+        suggestions.LearnEntry(10, "Release notes", 3600);
+        suggestions.LearnWindow("Xcode", "Kopsik - main.cc", 1800,
+                                20, "Desktop app");
+        suggestions.LearnWindow("Mail", "Inbox", 600, 0, "Email");
+
+        // Untracked, windows of the desktop app
+        // and the release notes, then mail
+        suggestions.Untracked("Xcode", "Kopsik - context.cc", 1000, 2800);
+        suggestions.Untracked("Terminal", "bash", 2800, 2900);
+        suggestions.Untracked("Editor", "Release notes 1.2", 2900, 3100);
+        suggestions.Untracked("Mail", "Inbox", 5000, 5100);
+
+        std::vector<TimeEntrySuggestion> list;
+        suggestions.Suggest(60, 10, &list);
+        ASSERT_EQ(std::size_t(2), list.size());
+        ASSERT_EQ(Poco::UInt64(20), list[0].PID);
+        ASSERT_EQ("Desktop app", list[0].Description);
+        ASSERT_EQ(1000, list[0].Start);
+        ASSERT_EQ(3100, list[0].End);
+        ASSERT_EQ(1800, list[0].Seconds);
+        ASSERT_EQ(Poco::UInt64(0), list[1].PID);
+        ASSERT_EQ("Email", list[1].Description);
+        ASSERT_EQ(100, list[1].Seconds);
+
+        list.clear();
+        suggestions.Suggest(600, 10, &list);
+        ASSERT_EQ(std::size_t(1), list.size());
+
+        // Only the latest spans are kept
+        suggestions.Dismiss(5000);
+        suggestions.Untracked("Mail", "Inbox", 6000, 6100);
+        suggestions.Untracked("Mail", "Inbox", 7000, 7100);
+        list.clear();
+        suggestions.Suggest(60, 10, &list);
+        ASSERT_EQ(std::size_t(2), list.size());
+        ASSERT_EQ(6000, list[0].Start);
+        ASSERT_EQ(7000, list[1].Start);
+
+        // Another user starts over
+        ASSERT_TRUE(suggestions.SetUser(2));
+        list.clear();
+        suggestions.Suggest(0, 10, &list);
+        ASSERT_TRUE(list.empty());
+    }
+
+    TEST(TogglApiClientTest, CoalescesRepeatingTimelineEvents) {
+        Database db(TESTDB);
+        db.SetTimelineCoalesceSeconds(20);
+
+        Poco::UInt64 count(0);
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        Poco::UInt64 before = count;
+
+        // Switching between two windows, then back
+        // to the first one after a long while.
+        const char *titles[] = { "Terminal", "Browser", "Terminal",
+            "Browser", "Terminal" };
+        const time_t starts[] = { 1000, 1010, 1020, 1030, 1100 };
+        Poco::NotificationCenter& nc =
+            Poco::NotificationCenter::defaultCenter();
+        for (int i = 0; i < 5; i++) {
+            TimelineEvent event;
+            event.user_id = 1;
+            event.title = StringTable::Timeline().Intern(titles[i]);
+            event.filename = StringTable::Timeline().Intern("app");
+            event.start_time = starts[i];
+            event.end_time = starts[i] + 10;
+            nc.postNotification(new TimelineEventNotification(event));
+        }
+        ASSERT_EQ(noError, db.FlushTimelineEvents());
+
+        ASSERT_EQ(noError,
+            db.UInt("select count(*) from timeline_events", &count));
+        ASSERT_EQ(before + 3, count);
+
+        Poco::UInt64 end_time(0);
+        ASSERT_EQ(noError,
+            db.UInt("select e.end_time from timeline_events e "
+                    "join timeline_titles t on t.id = e.title_id "
+                    "where t.title = 'Terminal' and e.start_time = 1000",
+                    &end_time));
+        ASSERT_EQ(Poco::UInt64(1030), end_time);
+    }
+
+    TEST(TogglApiClientTest, InternsStrings) {
+        StringTable table;
+        SharedString a = table.Intern("Terminal");
+        SharedString b = table.Intern(std::string("Term") + "inal");
+        ASSERT_EQ(a.get(), b.get());
+        ASSERT_EQ("Terminal", *b);
+        ASSERT_NE(a.get(), table.Intern("Browser").get());
+
+        // Strings nobody holds are dropped once the table fills up
+        a = 0;
+        b = 0;
+        for (std::size_t i = 0; i < kStringTableMinSweepSize; i++) {
+            table.Intern(Poco::NumberFormatter::format(i));
+        }
+        ASSERT_LT(table.Size(), kStringTableMinSweepSize);
+    }
+
+    TEST(TogglApiClientTest, InternsTimeEntryDescriptions) {
+        TimeEntry standup;
+        standup.SetDescription("standup");
+        TimeEntry again;
+        again.SetDescription(std::string("stand") + "up");
+        ASSERT_EQ(standup.SharedDescription().get(),
+                  again.SharedDescription().get());
+        ASSERT_EQ("standup", again.Description());
+
+        again.SetDescription("code review");
+        ASSERT_NE(standup.SharedDescription().get(),
+                  again.SharedDescription().get());
+        ASSERT_EQ("standup", standup.Description());
+        ASSERT_TRUE(again.Dirty());
+
+        TimeEntry none;
+        ASSERT_EQ("", none.Description());
+    }
+
+#if POCO_OS == POCO_OS_LINUX
+    class ThreadRoleProbe : public Poco::Runnable {
+     public:
+        ThreadRoleProbe() : nice(0) {}
+        void run() {
+            SetCurrentThreadRole(kThreadBackground);
+            nice = getpriority(PRIO_PROCESS,
+                               static_cast<id_t>(syscall(SYS_gettid)));
+        }
+        int nice;
+    };
+
+    TEST(TogglApiClientTest, LowersPriorityOfBackgroundThreads) {
+        ThreadRoleProbe probe;
+        Poco::Thread thread;
+        thread.start(probe);
+        thread.join();
+        ASSERT_EQ(kThreadBackgroundNice, probe.nice);
+
+        // Only the thread itself is affected
+        ASSERT_GT(kThreadBackgroundNice, getpriority(PRIO_PROCESS,
+            static_cast<id_t>(syscall(SYS_gettid))));
+    }
+#endif
+
+    TEST(TogglApiClientTest, SortsAutocompleteItemsByKindTextAndUse) {
+        std::vector<AutocompleteItem> items;
+        AutocompleteItem item;
+        item.Type = kAutocompleteItemProject;
+        item.Text = "Apollo";
+        items.push_back(item);
+        item.Type = kAutocompleteItemTE;
+        item.Text = "Write docs";
+        item.LastUsed = 100;
+        items.push_back(item);
+        item.Type = kAutocompleteItemTask;
+        item.Text = "Backend";
+        items.push_back(item);
+        item.Type = kAutocompleteItemTE;
+        item.Text = "Write docs";
+        item.LastUsed = 200;
+        items.push_back(item);
+        item.Text = "Review";
+        items.push_back(item);
+
+        std::vector<AutocompleteItem> expected(items);
+        std::sort(expected.begin(), expected.end(), CompareAutocompleteItems);
+
+        SortAutocompleteItems(&items);
+        ASSERT_TRUE(expected == items);
+        ASSERT_EQ("Review", items[0].Text);
+        ASSERT_EQ(Poco::UInt64(200), items[1].LastUsed);
+        ASSERT_EQ("Backend", items[3].Text);
+        ASSERT_EQ("Apollo", items[4].Text);
+    }
+
+    TEST(TogglApiClientTest, FindsAutocompleteItemsByWordPrefix) {
+        std::vector<AutocompleteItem> items;
+        AutocompleteItem item;
+        item.Type = kAutocompleteItemTE;
+        item.Text = "Daily standup - Internal";
+        items.push_back(item);
+        item.Text = "Stand-alone build";
+        items.push_back(item);
+        item.Type = kAutocompleteItemProject;
+        item.Text = "Internal. Toggl";
+        items.push_back(item);
+
+        AutocompleteIndex index;
+        index.Build(items);
+
+        std::vector<std::size_t> found;
+        index.Find("STAND", 10, true, true, true, &found);
+        ASSERT_EQ(std::size_t(2), found.size());
+        ASSERT_EQ(std::size_t(0), found[0]);
+        ASSERT_EQ(std::size_t(1), found[1]);
+
+        // Every typed word has to start a word
+        found.clear();
+        index.Find("intern stand", 10, true, true, true, &found);
+        ASSERT_EQ(std::size_t(1), found.size());
+        ASSERT_EQ(std::size_t(0), found[0]);
+
+        found.clear();
+        index.Find("andup", 10, true, true, true, &found);
+        ASSERT_TRUE(found.empty());
+
+        // Kinds can be left out, and the limit is kept
+        found.clear();
+        index.Find("internal", 10, false, true, true, &found);
+        ASSERT_EQ(std::size_t(1), found.size());
+        ASSERT_EQ(std::size_t(2), found[0]);
+
+        found.clear();
+        index.Find("", 2, true, true, true, &found);
+        ASSERT_EQ(std::size_t(2), found.size());
+    }
+
+    TEST(TogglApiClientTest, LoadsAutocompleteIndexUntilRelatedDataSaved) {
+        wipe_test_db();
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+        std::string path(std::string(TESTDB) + "-autocomplete");
+        Database db(TESTDB);
+        db.SetAutocompleteIndexPath(path);
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+
+        std::vector<AutocompleteItem> items;
+        AutocompleteItem item;
+        item.Type = kAutocompleteItemTE;
+        item.Text = "Daily standup - Internal";
+        item.UseCount = 12;
+        item.LastUsed = 1385644530;
+        items.push_back(item);
+        item.Type = kAutocompleteItemProject;
+        item.Text = "Internal. Toggl";
+        item.ProjectID = 2567324;
+        items.push_back(item);
+        AutocompleteIndex index;
+        index.Build(items);
+        ASSERT_EQ(noError, db.SaveAutocompleteIndex(user.ID(), index));
+
+        AutocompleteIndex loaded;
+        Poco::UInt64 generation(0);
+        bool found(false);
+        ASSERT_EQ(noError, db.LoadAutocompleteIndex(
+            user.ID(), &loaded, &generation, &found));
+        ASSERT_TRUE(found);
+        ASSERT_EQ(1, metrics.Counter("db.autocomplete_index.hits"));
+        ASSERT_TRUE(items == loaded.Items());
+        std::vector<std::size_t> matches;
+        loaded.Find("intern", 10, true, true, true, &matches);
+        ASSERT_EQ(std::size_t(2), matches.size());
+
+        // Another user's is not read
+        ASSERT_EQ(noError, db.LoadAutocompleteIndex(
+            user.ID() + 1, &loaded, &generation, &found));
+        ASSERT_FALSE(found);
+
+        // Saving related data makes it stale
+        TimeEntry *te = user.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(te);
+        te->SetDescription("Changed after the index");
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(noError, db.LoadAutocompleteIndex(
+            user.ID(), &loaded, &generation, &found));
+        ASSERT_FALSE(found);
+        ASSERT_EQ(2, metrics.Counter("db.autocomplete_index.misses"));
+
+        // A damaged index is not taken
+        std::string serialized("");
+        index.Serialize(&serialized);
+        ASSERT_TRUE(loaded.Deserialize(
+            serialized.data(), serialized.data() + serialized.size()));
+        ASSERT_TRUE(items == loaded.Items());
+        ASSERT_FALSE(loaded.Deserialize(
+            serialized.data(), serialized.data() + serialized.size() - 1));
+        ASSERT_TRUE(loaded.Items().empty());
+
+        Poco::File(path).remove(false);
+        metrics.Clear();
+    }
+
+    static void addEntrySnapshot(
+            UserSnapshot *snapshot,
+            const std::string &GUID,
+            const std::string &description,
+            const Poco::UInt64 PID,
+            const Poco::Int64 duration) {
+        TimeEntrySnapshot te;
+        te.GUID = GUID;
+        te.Description = description;
+        te.PID = PID;
+        te.DateHeader = "Mon 04. Nov";
+        te.DurationInSeconds = duration;
+        snapshot->TimeEntryIndex[GUID] = snapshot->TimeEntries.size();
+        snapshot->TimeEntries.push_back(te);
+    }
+
+    TEST(TogglApiClientTest, GroupsTimeEntriesFromListDiffs) {
+        Poco::AutoPtr<UserSnapshot> first(new UserSnapshot());
+        addEntrySnapshot(first, "a", "Standup", 1, 600);
+        addEntrySnapshot(first, "b", "Review", 1, 1200);
+        addEntrySnapshot(first, "c", "Standup", 1, 300);
+        addEntrySnapshot(first, "d", "Standup", 2, 60);
+        TimeEntryListDiff none;
+        TimeEntryGroups::Build(0, none, first, &none);
+        ASSERT_EQ(std::size_t(3), first->TimeEntryGroups.size());
+        const TimeEntryGroupSnapshot &standup = first->TimeEntryGroups[0];
+        ASSERT_EQ("Standup", standup.Description);
+        ASSERT_EQ(Poco::Int64(900), standup.DurationInSeconds);
+        ASSERT_EQ(std::size_t(2), standup.GUIDs.size());
+        ASSERT_EQ("c", standup.GUIDs[1]);
+        ASSERT_EQ("Review", first->TimeEntryGroups[1].Description);
+        ASSERT_EQ(Poco::UInt64(2), first->TimeEntryGroups[2].PID);
+
+        // b is renamed into the first group and d is deleted
+        Poco::AutoPtr<UserSnapshot> second(new UserSnapshot());
+        addEntrySnapshot(second, "a", "Standup", 1, 600);
+        addEntrySnapshot(second, "b", "Standup", 1, 1200);
+        addEntrySnapshot(second, "c", "Standup", 1, 300);
+        addEntrySnapshot(second, "e", "Planning", 3, 60);
+        TimeEntryListDiff diff;
+        diff.Version = 2;
+        diff.Updated.push_back("b");
+        diff.Deleted.push_back("d");
+        diff.Inserted.push_back("e");
+        TimeEntryListDiff group_diff;
+        TimeEntryGroups::Build(first, diff, second, &group_diff);
+        ASSERT_EQ(std::size_t(2), second->TimeEntryGroups.size());
+        ASSERT_EQ(Poco::Int64(2100),
+                  second->TimeEntryGroups[0].DurationInSeconds);
+        ASSERT_EQ(std::size_t(3), second->TimeEntryGroups[0].GUIDs.size());
+
+        ASSERT_EQ(Poco::UInt64(2), group_diff.Version);
+        ASSERT_EQ(std::size_t(1), group_diff.Updated.size());
+        ASSERT_EQ(standup.Key, group_diff.Updated[0]);
+        ASSERT_EQ(std::size_t(1), group_diff.Inserted.size());
+        ASSERT_EQ(second->TimeEntryGroups[1].Key, group_diff.Inserted[0]);
+        ASSERT_EQ(std::size_t(2), group_diff.Deleted.size());
+
+        // Groups the diff leaves alone are taken over as they were
+        Poco::AutoPtr<UserSnapshot> third(new UserSnapshot());
+        addEntrySnapshot(third, "a", "Standup", 1, 600);
+        addEntrySnapshot(third, "b", "Standup", 1, 1200);
+        addEntrySnapshot(third, "c", "Standup", 1, 300);
+        addEntrySnapshot(third, "e", "Planning", 3, 120);
+        diff = TimeEntryListDiff();
+        diff.Updated.push_back("e");
+        group_diff = TimeEntryListDiff();
+        TimeEntryGroups::Build(second, diff, third, &group_diff);
+        ASSERT_TRUE(second->TimeEntryGroups[0] == third->TimeEntryGroups[0]);
+        ASSERT_EQ(std::size_t(1), group_diff.Updated.size());
+        ASSERT_EQ(third->TimeEntryGroups[1].Key, group_diff.Updated[0]);
+        ASSERT_TRUE(group_diff.Inserted.empty());
+        ASSERT_TRUE(group_diff.Deleted.empty());
+    }
+
+    TEST(TogglApiClientTest, KeepsDayTotalsUpToDate) {
+        RelatedData related;
+        Poco::UInt64 start(1385644530);
+        int day = DayTotals::DayOf(start);
+        int next_day = DayTotals::DayOf(start + 24 * 60 * 60);
+
+        TimeEntry *a = new TimeEntry();
+        a->SetStart(start);
+        a->SetDurationInSeconds(60);
+        related.TimeEntries.push_back(a);
+        related.Track(a);
+
+        TimeEntry *b = new TimeEntry();
+        b->SetStart(start + 60);
+        b->SetDurationInSeconds(-time(0));
+        related.TimeEntries.push_back(b);
+        related.Track(b);
+
+        // Running entries don't count until they're stopped
+        ASSERT_TRUE(related.DayTotalsComplete());
+        ASSERT_EQ(60, related.TimeEntryDayTotals.Seconds(day));
+        b->SetDurationInSeconds(120);
+        ASSERT_EQ(180, related.TimeEntryDayTotals.Seconds(day));
+
+        // Moving an entry to another day moves its duration along
+        b->SetStart(start + 24 * 60 * 60);
+        ASSERT_EQ(next_day, b->Day());
+        ASSERT_EQ(60, related.TimeEntryDayTotals.Seconds(day));
+        ASSERT_EQ(120, related.TimeEntryDayTotals.Seconds(next_day));
+
+        // Deleted entries don't count
+        a->Delete();
+        ASSERT_FALSE(related.TimeEntryDayTotals.Days().count(day));
+        ASSERT_TRUE(related.TimeEntryDayTotals.Days().count(next_day));
+        ASSERT_EQ(b->DateHeaderString(), DayTotals::DateHeader(next_day));
+
+        related.Untrack(b);
+        ASSERT_FALSE(related.DayTotalsComplete());
+        ASSERT_TRUE(related.TimeEntryDayTotals.Days().empty());
+
+        related.Untrack(a);
+        delete a;
+        delete b;
+        related.TimeEntries.clear();
+        ASSERT_TRUE(related.DayTotalsComplete());
+    }
+
+    TEST(TogglApiClientTest, Parses8601LikePoco) {
+        ASSERT_EQ(0, Formatter::Parse8601("null"));
+        ASSERT_EQ("null", Formatter::Format8601(0));
+
+        const char *dates[] = { "2013-09-05T06:33:50+00:00",
+                                "2013-09-05T06:33:50Z",
+                                "2013-09-05T08:33:50+02:00",
+                                "2013-09-04T20:03:50-10:30",
+                                "2012-02-29T23:59:59+00:00",
+                                "2000-01-01T00:00:00+00:00",
+                                "1969-12-31T23:59:59Z",
+                                "2013-09-05T06:33:50.123Z",
+                                "2013-09-05" };
+        for (size_t i = 0; i < sizeof(dates) / sizeof(dates[0]); i++) {
+            ASSERT_EQ(Formatter::parse8601WithPoco(dates[i]),
+                      Formatter::Parse8601(dates[i])) << dates[i];
+        }
+
+        for (std::time_t t = -86400 * 400; t < 2200000000; t += 3607 * 37) {
+            std::string formatted = Formatter::Format8601(t);
+            ASSERT_EQ(Formatter::format8601WithPoco(t), formatted);
+            ASSERT_EQ(t, Formatter::Parse8601(formatted));
+        }
+    }
+
+    TEST(TogglApiClientTest, EscapesJSONStrings) {
+        ASSERT_EQ("Plain text", Formatter::EscapeJSONString("Plain text"));
+        ASSERT_EQ("Say \\\"hi\\\" \\\\ \\/ \\n\\t\\u0001",
+                  Formatter::EscapeJSONString("Say \"hi\" \\ / \n\t\x01"));
+
+        // Escaped strings read back as they were
+        std::string text("Line \"one\"\nC:\\temp\\");
+        std::string json("{\"text\": \"");
+        Formatter::AppendEscapedJSONString(text, &json);
+        json += "\"}";
+        JSONValue *root = JSONParse(json);
+        ASSERT_TRUE(root);
+        ASSERT_EQ(text, JSONString(JSONGet(root, "text")));
+        JSONDelete(root);
+    }
+
+#if !defined(KOPSIK_JSON_LIBJSON)
+    TEST(TogglApiClientTest, ReadsJSONFromStructuralIndex) {
+        // Escapes at every position around the 64 byte blocks
+        for (std::size_t padding = 0; padding < 140; padding++) {
+            std::string json("{\"k\":\"" + std::string(padding, 'x')
+                             + "\\\"\\\\\",\"n\":[1,{\"\\\"q\":\"]\"}]}");
+            JSONValue *root = JSONParse(json);
+            ASSERT_TRUE(root) << json;
+            ASSERT_EQ(std::string(padding, 'x') + "\"\\",
+                      JSONString(JSONGet(root, "k")));
+            JSONValue *n = JSONGet(root, "n");
+            ASSERT_EQ(kJSONArray, JSONTypeOf(n));
+            ASSERT_EQ(std::size_t(2), JSONSize(n));
+            ASSERT_EQ("]", JSONString(JSONGet(JSONAt(n, 1), "\"q")));
+            JSONDelete(root);
+        }
+
+        std::string json(" {\"id\": 9007199254740993, \"neg\": -7,"
+                         " \"float\": 1.5e3,"
+                         " \"text\": \"x\\u00e9\\ud83d\\ude00\","
+                         " \"on\": true, \"off\": false, \"none\": null,"
+                         " \"empty\": {}, \"list\": [ 1 , \"two\" , [3] ],"
+                         " \"data\": {\"name\": \"kept\"}} ");
+        JSONValue *root = JSONParse(json);
+        ASSERT_TRUE(root);
+        ASSERT_EQ(kJSONObject, JSONTypeOf(root));
+        ASSERT_EQ(std::size_t(10), JSONSize(root));
+        ASSERT_EQ(9007199254740993LL, JSONInt(JSONGet(root, "id")));
+        ASSERT_EQ(-7, JSONInt(JSONGet(root, "neg")));
+        ASSERT_EQ(1500, JSONInt(JSONGet(root, "float")));
+        ASSERT_EQ("1.5e3", JSONString(JSONGet(root, "float")));
+        ASSERT_EQ("x\xC3\xA9\xF0\x9F\x98\x80",
+                  JSONString(JSONGet(root, "text")));
+        ASSERT_TRUE(JSONBool(JSONGet(root, "on")));
+        ASSERT_FALSE(JSONBool(JSONGet(root, "off")));
+        ASSERT_EQ(kJSONNull, JSONTypeOf(JSONGet(root, "none")));
+        ASSERT_EQ(std::size_t(0), JSONSize(JSONGet(root, "empty")));
+        ASSERT_FALSE(JSONGet(root, "missing"));
+
+        std::vector<std::string> names;
+        for (JSONIterator it = JSONBegin(root); it != JSONEnd(root); ++it) {
+            names.push_back(JSONName(*it));
+        }
+        ASSERT_EQ(std::size_t(10), names.size());
+        ASSERT_EQ("id", names.front());
+        ASSERT_EQ("data", names.back());
+        ASSERT_EQ(kJSONKeyID, JSONNodeKey(JSONGet(root, "id")));
+
+        JSONValue *list = JSONGet(root, "list");
+        ASSERT_EQ(std::size_t(3), JSONSize(list));
+        ASSERT_EQ(1, JSONInt(JSONAt(list, 0)));
+        ASSERT_EQ("two", JSONString(JSONAt(list, 1)));
+        ASSERT_EQ(3, JSONInt(JSONAt(JSONAt(list, 2), 0)));
+        ASSERT_FALSE(JSONAt(list, 3));
+
+        // Taken values outlive what they were taken from
+        JSONValue *data = JSONTake(root, "data");
+        JSONDelete(root);
+        ASSERT_EQ("kept", JSONString(JSONGet(data, "name")));
+        JSONDelete(data);
+
+        const char *invalid[] = { "", "1", "\"x\"", "{\"a\":}", "[1,]",
+                                  "{\"a\":1} x", "{\"a\":\"\\x\"}",
+                                  "{\"a\":\"open}", "{\"a\":tru}",
+                                  "{\"a\" 1}", "[1 2]", "{\"a\":1", "]" };
+        for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+            ASSERT_FALSE(JSONParse(invalid[i])) << invalid[i];
+            ASSERT_FALSE(IsValidJSON(invalid[i])) << invalid[i];
+        }
+        ASSERT_TRUE(IsValidJSON("[]"));
+
+        std::string plain(std::string(100, 'a') + "\\\"" + "{");
+        ASSERT_EQ(std::size_t(100),
+                  JSONScanPlainBytes(plain.data(), plain.size(), true));
+        ASSERT_EQ(std::size_t(101),
+                  JSONScanPlainBytes(plain.data(), plain.size(), false));
+    }
+#endif
+
+    TEST(TogglApiClientTest, FormatsDurationsLikePoco) {
+        const char *formats[] = { "%H:%M:%S", "%H %M", "%Hh:%Mm", "%H:%M",
+                                  "%d %h %m %s %i %c %F %%" };
+        std::string buffer;
+        for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+            for (Poco::Int64 seconds = 0; seconds < 200000; seconds += 997) {
+                Poco::Timespan span(seconds * Poco::Timespan::SECONDS);
+                std::string expected =
+                    Poco::DateTimeFormatter::format(span, formats[i]);
+                ASSERT_EQ(expected,
+                          Formatter::FormatDurationInSeconds(seconds,
+                                                             formats[i]));
+                buffer.clear();
+                Formatter::AppendDurationInSeconds(seconds, formats[i],
+                                                   &buffer);
+                ASSERT_EQ(expected, buffer);
+            }
+        }
+    }
+
+    TEST(TogglApiClientTest, WritesBatchUpdateJSON) {
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+
+        std::vector<Project *> projects;
+        projects.push_back(user.related.Projects[0]);
+        projects[0]->SetUIModifiedAt(time(0));
+
+        std::vector<TimeEntry *> time_entries;
+        TimeEntry *updated = user.GetTimeEntryByID(89818605);
+        ASSERT_TRUE(updated);
+        updated->SetDescription("Say \"hi\" to C:\\temp");
+        updated->SetUIModifiedAt(time(0));
+        time_entries.push_back(updated);
+        TimeEntry *created = user.Start("New", "", 0, 0);
+        ASSERT_TRUE(created);
+        time_entries.push_back(created);
+        TimeEntry *deleted = user.related.TimeEntries[0];
+        if (deleted == updated) {
+            deleted = user.related.TimeEntries[1];
+        }
+        ASSERT_TRUE(deleted->ID());
+        deleted->Delete();
+        time_entries.push_back(deleted);
+
+        std::string json = UpdateJSON(&projects, &time_entries);
+        ASSERT_TRUE(IsValidJSON(json));
+
+        JSONValue *root = JSONParse(json);
+        ASSERT_EQ(kJSONArray, JSONTypeOf(root));
+        ASSERT_EQ(uint(4), JSONSize(root));
+
+        const char *methods[] = { "PUT", "PUT", "POST", "DELETE" };
+        BaseModel *models[] = { projects[0], updated, created, deleted };
+        for (size_t i = 0; i < 4; i++) {
+            JSONValue *update = JSONAt(root, i);
+            ASSERT_EQ(std::string(methods[i]),
+                      JSONString(JSONGet(update, "method")));
+            ASSERT_EQ(models[i]->GUID(), JSONString(JSONGet(update, "GUID")));
+            ASSERT_TRUE(JSONGet(JSONGet(update, "body"),
+                                 models[i]->ModelName().c_str()));
+        }
+
+        // Strings are escaped once and read back as they were
+        JSONValue *te = JSONGet(JSONGet(JSONAt(root, 1), "body"),
+                                "time_entry");
+        ASSERT_EQ(updated->Description(),
+                  JSONString(JSONGet(te, "description")));
+        ASSERT_EQ(kJSONArray, JSONTypeOf(JSONGet(te, "tags")));
+        ASSERT_EQ(updated->TagIDs().size(), JSONSize(JSONGet(te, "tags")));
+
+        JSONDelete(root);
+    }
+
+    TEST(TogglApiClientTest, Benchmarks8601AgainstPoco) {
+        const int kRounds = 20000;
+        std::vector<std::string> dates;
+        for (int i = 0; i < kRounds; i++) {
+            dates.push_back(
+                Formatter::format8601WithPoco(1378362830 + i * 3607));
+        }
+
+        Poco::Stopwatch stopwatch;
+        std::time_t sum_poco(0), sum_fixed(0);
+        stopwatch.restart();
+        for (int i = 0; i < kRounds; i++) {
+            sum_poco += Formatter::parse8601WithPoco(dates[i]);
+            Formatter::format8601WithPoco(sum_poco % 2000000000);
+        }
+        Poco::Timestamp::TimeDiff poco_micros = stopwatch.elapsed();
+
+        stopwatch.restart();
+        for (int i = 0; i < kRounds; i++) {
+            sum_fixed += Formatter::Parse8601(dates[i]);
+            Formatter::Format8601(sum_fixed % 2000000000);
+        }
+        Poco::Timestamp::TimeDiff fixed_micros = stopwatch.elapsed();
+
+        ASSERT_EQ(sum_poco, sum_fixed);
+        RecordProperty("PocoMicros", static_cast<int>(poco_micros));
+        RecordProperty("FixedLayoutMicros", static_cast<int>(fixed_micros));
+    }
+
+    TEST(TogglApiClientTest, KeepsTrackOfRunningTimeEntry) {
+        User user("kopsik_test", "0.1");
+        user.SetID(1);
+        ASSERT_FALSE(user.RunningTimeEntry());
+
+        TimeEntry *started = user.Start("Running", "", 0, 0);
+        ASSERT_TRUE(user.related.DayTotalsComplete());
+        ASSERT_EQ(started, user.RunningTimeEntry());
+
+        Poco::Int64 hour_ago = time(0) - 3600;
+        started->SetStart(hour_ago);
+        started->SetDurationInSeconds(-hour_ago);
+        TimeEntry *split = user.SplitAt(hour_ago + 1800);
+        ASSERT_NE(started, split);
+        ASSERT_EQ(split, user.RunningTimeEntry());
+
+        ASSERT_EQ(std::size_t(1), user.Stop().size());
+        ASSERT_FALSE(user.RunningTimeEntry());
+
+        // As when the server says it's running again
+        split->SetDurationInSeconds(-static_cast<Poco::Int64>(split->Start()));
+        ASSERT_EQ(split, user.RunningTimeEntry());
+
+        user.related.TimeEntries.pop_back();
+        user.related.Untrack(split);
+        delete split;
+        ASSERT_FALSE(user.RunningTimeEntry());
+    }
+
+    TEST(TogglApiClientTest, KeepsTrackOfLatestTimeEntry) {
+        User user("kopsik_test", "0.1");
+        ASSERT_FALSE(user.Latest());
+        for (int i = 0; i < 3; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetStart(1400000000 + i * 3600);
+            te->SetDurationInSeconds(60);
+            user.related.TimeEntries.push_back(te);
+        }
+        TimeEntry *first = user.related.TimeEntries[0];
+        TimeEntry *last = user.related.TimeEntries[2];
+
+        // Before tracking, and after it
+        ASSERT_EQ(last, user.Latest());
+        user.related.TrackAll();
+        ASSERT_EQ(last, user.Latest());
+
+        first->SetStart(1400020000);
+        ASSERT_EQ(first, user.Latest());
+
+        user.related.TimeEntries.erase(user.related.TimeEntries.begin());
+        user.related.Untrack(first);
+        delete first;
+        ASSERT_EQ(last, user.Latest());
+    }
+
+    TEST(TogglApiClientTest, BumpsListGenerations) {
+        RelatedData related;
+        int time_entries = related.TimeEntryGeneration.Value();
+        int projects = related.ProjectGeneration.Value();
+
+        TimeEntry *te = new TimeEntry();
+        related.TimeEntries.push_back(te);
+        related.Track(te);
+        ASSERT_NE(time_entries, related.TimeEntryGeneration.Value());
+        ASSERT_EQ(projects, related.ProjectGeneration.Value());
+
+        // Changes bump the version of the model and the generation
+        // of its list only
+        time_entries = related.TimeEntryGeneration.Value();
+        int version = te->Version();
+        te->SetDescription("Reading");
+        ASSERT_NE(version, te->Version());
+        ASSERT_NE(time_entries, related.TimeEntryGeneration.Value());
+        ASSERT_EQ(projects, related.ProjectGeneration.Value());
+
+        // Setting a field to what it was changes nothing
+        time_entries = related.TimeEntryGeneration.Value();
+        version = te->Version();
+        te->SetDescription("Reading");
+        ASSERT_EQ(version, te->Version());
+        ASSERT_EQ(time_entries, related.TimeEntryGeneration.Value());
+
+        related.TimeEntries.clear();
+        related.Untrack(te);
+        ASSERT_NE(time_entries, related.TimeEntryGeneration.Value());
+        time_entries = related.TimeEntryGeneration.Value();
+        te->SetDescription("Writing");
+        ASSERT_EQ(time_entries, related.TimeEntryGeneration.Value());
+        delete te;
+
+        // Lists of another user never have the same generation
+        RelatedData other;
+        ASSERT_NE(related.TimeEntryGeneration.Value(),
+                  other.TimeEntryGeneration.Value());
+    }
+
+    TEST(TogglApiClientTest, RefreshesLookupsAhead) {
+        RelatedData related;
+        for (int i = 0; i < 2; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetID(i + 1);
+            te->SetStart(1400000000 + i * 3600);
+            te->SetDurationInSeconds(60);
+            related.TimeEntries.push_back(te);
+            related.Track(te);
+        }
+
+        // Readers find the columns copied already
+        related.RefreshLookups();
+        TimeEntryFieldsPtr fields = related.TimeEntryFields.Refresh();
+        ASSERT_EQ(std::size_t(2), fields->Starts.size());
+        ASSERT_EQ(Poco::UInt64(1400003600), fields->Starts[1]);
+        ASSERT_EQ(related.TimeEntries[1], related.TimeEntryIndex.ByID(2));
+
+        for (std::size_t i = 0; i < related.TimeEntries.size(); i++) {
+            related.Untrack(related.TimeEntries[i]);
+            delete related.TimeEntries[i];
+        }
+        related.TimeEntries.clear();
+    }
+
+    TEST(TogglApiClientTest, ForgetsModelsRemovedFromTheIndexedList) {
+        RelatedData related;
+        for (int i = 0; i < 2; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetID(i + 1);
+            related.TimeEntries.push_back(te);
+            related.Track(te);
+        }
+        TimeEntry *replacement = new TimeEntry();
+        replacement->SetID(3);
+        ASSERT_EQ(related.TimeEntries[1], related.TimeEntryIndex.ByID(2));
+
+        // Same size and no new keys since the last lookup
+        TimeEntry *removed = related.TimeEntries[1];
+        related.TimeEntries.pop_back();
+        related.Untrack(removed);
+        delete removed;
+        related.TimeEntries.push_back(replacement);
+        related.Track(replacement);
+        ASSERT_FALSE(related.TimeEntryIndex.ByID(2));
+        ASSERT_EQ(replacement, related.TimeEntryIndex.ByID(3));
+
+        for (std::size_t i = 0; i < related.TimeEntries.size(); i++) {
+            related.Untrack(related.TimeEntries[i]);
+            delete related.TimeEntries[i];
+        }
+        related.TimeEntries.clear();
+    }
+
+    TEST(TogglApiClientTest, IndexesKeysChangedBeforeAnAdd) {
+        RelatedData related;
+        for (int i = 0; i < 2; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetID(i + 1);
+            related.TimeEntries.push_back(te);
+            related.Track(te);
+        }
+        TimeEntry *first = related.TimeEntries[0];
+        ASSERT_EQ(first, related.TimeEntryIndex.ByID(1));
+
+        // Another model got a new ID before this one was added
+        first->SetID(10);
+        TimeEntry *added = new TimeEntry();
+        related.TimeEntries.push_back(added);
+        related.Track(added);
+        added->SetID(3);
+        related.TimeEntryIndex.Add(added);
+        ASSERT_EQ(added, related.TimeEntryIndex.ByID(3));
+        ASSERT_EQ(first, related.TimeEntryIndex.ByID(10));
+        ASSERT_FALSE(related.TimeEntryIndex.ByID(1));
+
+        // Keys changing in the lists of another user don't show
+        int keys = related.TimeEntryGeneration.Keys();
+        RelatedData other;
+        TimeEntry *elsewhere = new TimeEntry();
+        other.TimeEntries.push_back(elsewhere);
+        other.Track(elsewhere);
+        elsewhere->SetID(4);
+        ASSERT_EQ(keys, related.TimeEntryGeneration.Keys());
+        ASSERT_NE(keys, other.TimeEntryGeneration.Keys());
+        other.Untrack(elsewhere);
+        delete elsewhere;
+
+        for (std::size_t i = 0; i < related.TimeEntries.size(); i++) {
+            related.Untrack(related.TimeEntries[i]);
+            delete related.TimeEntries[i];
+        }
+        related.TimeEntries.clear();
+    }
+
+    TEST(TogglApiClientTest, KeepsTimeEntryColumnsUpToDate) {
+        User user("kopsik_test", "0.1");
+        for (int i = 0; i < 3; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetID(i + 1);
+            te->SetStart(1400000000 + i * 3600);
+            te->SetDurationInSeconds(60);
+            user.related.TimeEntries.push_back(te);
+            user.related.Track(te);
+        }
+
+        ASSERT_FALSE(user.RunningTimeEntry());
+        std::vector<TimeEntry *> pushable;
+        user.CollectPushableTimeEntries(&pushable);
+        ASSERT_TRUE(pushable.empty());
+
+        // Changes to the time entries show up in the next scan
+        TimeEntry *second = user.related.TimeEntries[1];
+        second->SetDurationInSeconds(-1400003600);
+        second->SetUIModifiedAt(1400003700);
+        ASSERT_EQ(second, user.RunningTimeEntry());
+        user.CollectPushableTimeEntries(&pushable);
+        ASSERT_EQ(std::size_t(1), pushable.size());
+        ASSERT_EQ(second, pushable[0]);
+
+        // So do changes to the list
+        TimeEntry *added = new TimeEntry();
+        added->SetStart(1400010000);
+        added->SetDurationInSeconds(60);
+        user.related.TimeEntries.erase(user.related.TimeEntries.begin() + 1);
+        user.related.Untrack(second);
+        delete second;
+        user.related.TimeEntries.push_back(added);
+        user.related.Track(added);
+        ASSERT_FALSE(user.RunningTimeEntry());
+        pushable.clear();
+        user.CollectPushableTimeEntries(&pushable);
+        ASSERT_EQ(std::size_t(1), pushable.size());
+        ASSERT_EQ(added, pushable[0]);
+
+        TimeEntryFieldsPtr fields = user.related.TimeEntryFields.Refresh();
+        ASSERT_EQ(std::size_t(3), fields->Starts.size());
+        ASSERT_EQ(Poco::UInt64(1400010000), fields->Starts[2]);
+        ASSERT_TRUE(fields->Listed(2));
+
+        // Changes in other lists leave the copy alone, and a reader
+        // keeps the copy it has while the fields are copied again
+        TimeEntry *other = new TimeEntry();
+        other->SetStart(1400020000);
+        RelatedData elsewhere;
+        elsewhere.TimeEntries.push_back(other);
+        elsewhere.Track(other);
+        other->SetDurationInSeconds(120);
+        ASSERT_EQ(fields.get(), user.related.TimeEntryFields.Refresh().get());
+        user.related.TimeEntries[0]->SetDurationInSeconds(90);
+        TimeEntryFieldsPtr again = user.related.TimeEntryFields.Refresh();
+        ASSERT_NE(fields.get(), again.get());
+        ASSERT_EQ(Poco::Int64(60), fields->Durations[0]);
+        ASSERT_EQ(Poco::Int64(90), again->Durations[0]);
+        elsewhere.Untrack(other);
+        delete other;
+    }
+
+    TEST(TogglApiClientTest, FindsOverlappingTimeEntries) {
+        User user("kopsik_test", "0.1");
+        // 10:00-11:00, 10:30-10:45, 12:00-13:00 and 11:00-11:30,
+        // in the order they were added
+        const Poco::UInt64 starts[] = { 36000, 37800, 43200, 39600 };
+        const Poco::Int64 durations[] = { 3600, 900, 3600, 1800 };
+        for (int i = 0; i < 4; i++) {
+            TimeEntry *te = new TimeEntry();
+            te->SetStart(starts[i]);
+            te->SetDurationInSeconds(durations[i]);
+            te->SetStop(starts[i] + durations[i]);
+            user.related.TimeEntries.push_back(te);
+        }
+        TimeEntry *first = user.related.TimeEntries[0];
+        TimeEntry *inside = user.related.TimeEntries[1];
+        TimeEntry *noon = user.related.TimeEntries[2];
+        TimeEntry *after = user.related.TimeEntries[3];
+
+        std::vector<TimeEntry *> found;
+        user.OverlappingTimeEntries(first, &found);
+        ASSERT_EQ(std::size_t(1), found.size());
+        ASSERT_EQ(inside, found[0]);
+
+        // Touching is not overlapping
+        found.clear();
+        user.OverlappingTimeEntries(after, &found);
+        ASSERT_TRUE(found.empty());
+
+        found.clear();
+        user.TimeEntriesBetween(37000, 40000, &found);
+        ASSERT_EQ(std::size_t(3), found.size());
+        ASSERT_EQ(first, found[0]);
+        ASSERT_EQ(inside, found[1]);
+        ASSERT_EQ(after, found[2]);
+
+        // Edits show up in the next query
+        after->SetStart(42000);
+        after->SetStop(43800);
+        found.clear();
+        user.OverlappingTimeEntries(after, &found);
+        ASSERT_EQ(std::size_t(1), found.size());
+        ASSERT_EQ(noon, found[0]);
+
+        // Running time entries go on for good
+        TimeEntry *running = new TimeEntry();
+        running->SetStart(30000);
+        running->SetDurationInSeconds(-30000);
+        user.related.TimeEntries.push_back(running);
+        found.clear();
+        user.TimeEntriesBetween(50000, 50001, &found);
+        ASSERT_EQ(std::size_t(1), found.size());
+        ASSERT_EQ(running, found[0]);
+
+        // Deleted ones are left out
+        running->SetDeletedAt(1);
+        found.clear();
+        user.OverlappingTimeEntries(noon, &found);
+        ASSERT_EQ(std::size_t(1), found.size());
+        ASSERT_EQ(after, found[0]);
+    }
+
+    TEST(TogglApiClientTest, DropsProjectLabelsWhenProjectsChange) {
+        User user("kopsik_test", "0.1");
+        Project *p = new Project();
+        p->SetID(10);
+        p->SetName("Website");
+        user.related.Projects.push_back(p);
+        user.related.Track(p);
+
+        ProjectLabels &labels = user.related.ProjectLabelCache;
+        std::string label("");
+        std::string color("");
+        ASSERT_FALSE(labels.Find(0, 10, "", &label, &color));
+        labels.Add(0, 10, "", "Website", "#fff");
+        ASSERT_TRUE(labels.Find(0, 10, "", &label, &color));
+        ASSERT_EQ("Website", label);
+        ASSERT_EQ("#fff", color);
+
+        // Time entries changing leave the labels alone
+        TimeEntry te;
+        te.SetDescription("Changed");
+        ASSERT_TRUE(labels.Find(0, 10, "", &label, &color));
+
+        p->SetName("Web site");
+        ASSERT_FALSE(labels.Find(0, 10, "", &label, &color));
+
+        labels.Add(0, 10, "", "Web site", "#fff");
+        Client *c = new Client();
+        c->SetID(20);
+        user.related.Clients.push_back(c);
+        ASSERT_FALSE(labels.Find(0, 10, "", &label, &color));
+        ASSERT_EQ(std::size_t(0), labels.Size());
+    }
+
+    TEST(TogglApiClientTest, KeepsWorkspaceBucketsUpToDate) {
+        User user("kopsik_test", "0.1");
+        for (int i = 0; i < 4; i++) {
+            Client *c = new Client();
+            c->SetID(i + 1);
+            c->SetWID(i % 2 ? 200 : 100);
+            user.related.Clients.push_back(c);
+
+            Project *p = new Project();
+            p->SetID(i + 10);
+            p->SetWID(i % 2 ? 200 : 100);
+            p->SetActive(i != 3);
+            user.related.Projects.push_back(p);
+
+            Task *t = new Task();
+            t->SetID(i + 20);
+            t->SetPID(i + 10);
+            user.related.Tasks.push_back(t);
+        }
+
+        ModelBuckets &buckets = user.related.Buckets;
+        std::vector<Client *> clients;
+        buckets.ClientsInWorkspace(200, &clients);
+        ASSERT_EQ(std::size_t(2), clients.size());
+        ASSERT_EQ(Poco::UInt64(2), clients[0]->ID());
+        ASSERT_EQ(Poco::UInt64(4), clients[1]->ID());
+
+        std::vector<Project *> projects;
+        user.ActiveProjects(&projects);
+        ASSERT_EQ(std::size_t(3), projects.size());
+        std::vector<Task *> tasks;
+        buckets.ActiveTasks(&tasks);
+        ASSERT_EQ(std::size_t(3), tasks.size());
+
+        // Archiving a project takes it and its tasks out
+        user.related.Projects[0]->SetActive(false);
+        user.related.Tasks[1]->MarkAsDeletedOnServer();
+        projects.clear();
+        user.ActiveProjects(&projects);
+        ASSERT_EQ(std::size_t(2), projects.size());
+        ASSERT_EQ(Poco::UInt64(11), projects[0]->ID());
+        tasks.clear();
+        buckets.ActiveTasks(&tasks);
+        ASSERT_EQ(std::size_t(1), tasks.size());
+        ASSERT_EQ(Poco::UInt64(22), tasks[0]->ID());
+
+        // Moving a client to another workspace moves its bucket
+        user.related.Clients[0]->SetWID(200);
+        clients.clear();
+        buckets.ClientsInWorkspace(200, &clients);
+        ASSERT_EQ(std::size_t(3), clients.size());
+        clients.clear();
+        buckets.ClientsInWorkspace(100, &clients);
+        ASSERT_EQ(std::size_t(1), clients.size());
+        projects.clear();
+        buckets.ProjectsInWorkspace(100, &projects);
+        ASSERT_EQ(std::size_t(2), projects.size());
+    }
+
+    TEST(TogglApiClientTest, MergesModelChanges) {
+        std::vector<ModelChange> changes;
+        changes.push_back(ModelChange(ModelChange::TimeEntryModel,
+            ModelChange::Insert, 0, "a"));
+        changes.push_back(ModelChange(ModelChange::ProjectModel,
+            ModelChange::Update, 1, "p"));
+        changes.push_back(ModelChange(ModelChange::TimeEntryModel,
+            ModelChange::Update, 5, "a"));
+        changes.push_back(ModelChange(ModelChange::TimeEntryModel,
+            ModelChange::Insert, 0, "b"));
+        changes.push_back(ModelChange(ModelChange::TagModel,
+            ModelChange::Update, 7, ""));
+        changes.push_back(ModelChange(ModelChange::TimeEntryModel,
+            ModelChange::Delete, 0, "b"));
+        changes.push_back(ModelChange(ModelChange::ProjectModel,
+            ModelChange::Delete, 1, "p"));
+        changes.push_back(ModelChange(ModelChange::TagModel,
+            ModelChange::Update, 7, ""));
+        changes.push_back(ModelChange(ModelChange::TimeEntryModel,
+            ModelChange::Update, 0, "a"));
+
+        std::vector<ModelChange> merged;
+        MergeModelChanges(changes, &merged);
+        ASSERT_EQ(std::size_t(3), merged.size());
+
+        // Inserted and then updated, keeping the ID it got
+        ASSERT_EQ("a", merged[0].GUID());
+        ASSERT_EQ(ModelChange::Insert, merged[0].ChangeType());
+        ASSERT_EQ(Poco::UInt64(5), merged[0].ModelID());
+
+        ASSERT_EQ("p", merged[1].GUID());
+        ASSERT_EQ(ModelChange::Delete, merged[1].ChangeType());
+
+        // Models without GUID are told apart by ID
+        ASSERT_EQ(ModelChange::TagModel, merged[2].ModelType());
+        ASSERT_EQ(ModelChange::Update, merged[2].ChangeType());
+
+        // The C API gets the names
+        ASSERT_EQ(std::string("tag"),
+                  ModelChange::ModelTypeName(merged[2].ModelType()));
+        ASSERT_EQ(std::string("update"),
+                  ModelChange::ChangeTypeName(merged[2].ChangeType()));
+    }
+
+    TEST(TogglApiClientTest, CoalescesAndDebouncesSyncs) {
+        SyncScheduler scheduler(2, 10);
+        Poco::Timestamp start;
+        Poco::Timestamp task_at;
+        bool reschedule(false);
+
+        // Edits are debounced into one partial sync
+        ASSERT_TRUE(scheduler.Request(SyncScheduler::Partial, false,
+                                      start, &task_at));
+        ASSERT_EQ(start + 2, task_at);
+        ASSERT_FALSE(scheduler.Request(SyncScheduler::Partial, false,
+                                       start + 1, &task_at));
+        ASSERT_EQ(SyncScheduler::None,
+                  scheduler.Take(start + 2, &reschedule, &task_at));
+        ASSERT_TRUE(reschedule);
+        ASSERT_EQ(start + 3, task_at);
+        ASSERT_EQ(SyncScheduler::Partial,
+                  scheduler.Take(start + 3, &reschedule, &task_at));
+        ASSERT_FALSE(reschedule);
+        ASSERT_EQ(SyncScheduler::None, scheduler.Pending());
+
+        // Nothing left for a stale task to run
+        ASSERT_EQ(SyncScheduler::None,
+                  scheduler.Take(start + 4, &reschedule, &task_at));
+        ASSERT_FALSE(reschedule);
+
+        // A full sync absorbs the pending partial one
+        // and runs ahead of it when asked for by the user
+        ASSERT_TRUE(scheduler.Request(SyncScheduler::Partial, false,
+                                      start + 10, &task_at));
+        ASSERT_TRUE(scheduler.Request(SyncScheduler::Full, true,
+                                      start + 11, &task_at));
+        ASSERT_EQ(start + 11, task_at);
+        ASSERT_FALSE(scheduler.Request(SyncScheduler::Partial, false,
+                                       start + 11, &task_at));
+        ASSERT_EQ(SyncScheduler::Full,
+                  scheduler.Take(start + 11, &reschedule, &task_at));
+        ASSERT_EQ(SyncScheduler::None, scheduler.Pending());
+
+        // Constant editing doesn't postpone the push forever
+        ASSERT_TRUE(scheduler.Request(SyncScheduler::Partial, false,
+                                      start + 20, &task_at));
+        for (int i = 21; i < 40; i++) {
+            scheduler.Request(SyncScheduler::Partial, false,
+                              start + i, &task_at);
+        }
+        ASSERT_EQ(SyncScheduler::Partial,
+                  scheduler.Take(start + 30, &reschedule, &task_at));
+    }
+
+    TEST(TogglApiClientTest, HoldsSyncsWhileOffline) {
+        SyncScheduler scheduler(2, 10);
+        Poco::Timestamp start;
+        Poco::Timestamp task_at;
+        bool reschedule(false);
+
+        ASSERT_TRUE(scheduler.Request(SyncScheduler::Full, false,
+                                      start, &task_at));
+        ASSERT_EQ(SyncScheduler::Full,
+                  scheduler.Take(start + 2, &reschedule, &task_at));
+        scheduler.Hold(SyncScheduler::Full);
+        ASSERT_EQ(SyncScheduler::Full, scheduler.Pending());
+
+        // Back online, the held sync runs right away with the new one
+        ASSERT_TRUE(scheduler.Request(SyncScheduler::Partial, true,
+                                      start + 20, &task_at));
+        ASSERT_EQ(start + 20, task_at);
+        ASSERT_EQ(SyncScheduler::Full,
+                  scheduler.Take(start + 20, &reschedule, &task_at));
+    }
+
+    TEST(TogglApiClientTest, StretchesFullSyncsWhileWebSocketDelivers) {
+        FullSyncInterval interval(1000, 100, 50);
+        Poco::Timestamp start;
+
+        // Healthy stream, deltas are trusted
+        ASSERT_EQ(1000, interval.Interval(true, start));
+        ASSERT_FALSE(interval.Due(true, start + 500, start));
+        ASSERT_TRUE(interval.Due(true, start + 1000, start));
+
+        // Down, but not for long enough yet
+        ASSERT_EQ(1000, interval.Interval(false, start + 600));
+        ASSERT_FALSE(interval.Due(false, start + 640, start));
+
+        // Down past the threshold
+        ASSERT_EQ(100, interval.Interval(false, start + 650));
+        ASSERT_TRUE(interval.Due(false, start + 700, start + 590));
+        ASSERT_FALSE(interval.Due(false, start + 700, start + 650));
+
+        // Back, and it starts over when it goes down again
+        ASSERT_FALSE(interval.Due(true, start + 800, start + 650));
+        ASSERT_EQ(1000, interval.Interval(false, start + 900));
+        ASSERT_EQ(100, interval.Interval(false, start + 950));
+    }
+
+    TEST(TogglApiClientTest, TracksConnectivity) {
+        ConnectivityMonitor monitor;
+        ASSERT_FALSE(monitor.IsOffline());
+        ASSERT_FALSE(monitor.Reachable());
+
+        ASSERT_TRUE(monitor.Unreachable());
+        ASSERT_FALSE(monitor.Unreachable());
+        ASSERT_TRUE(monitor.IsOffline());
+
+        // Probes back off while the network stays away
+        ASSERT_EQ(kConnectivityProbeMinMicros, monitor.NextProbeDelay());
+        ASSERT_EQ(kConnectivityProbeMinMicros * 2, monitor.NextProbeDelay());
+        for (int i = 0; i < 20; i++) {
+            monitor.NextProbeDelay();
+        }
+        ASSERT_EQ(kConnectivityProbeMaxMicros, monitor.NextProbeDelay());
+
+        ASSERT_TRUE(monitor.Reachable());
+        ASSERT_FALSE(monitor.IsOffline());
+        ASSERT_EQ(kConnectivityProbeMinMicros, monitor.NextProbeDelay());
+
+        // Requests aren't even tried while offline
+        ConnectivityMonitor &shared = ConnectivityMonitor::Instance();
+        shared.Unreachable();
+        HTTPSClient client("https://localhost", "kopsik_test", "0.1");
+        std::string response_body("");
+        ASSERT_EQ(kRequestOffline,
+                  client.GetJSON("/api/v8/me", "", "", &response_body));
+        shared.Reachable();
+    }
+
+    TEST(TogglApiClientTest, AllocatesModelsFromPools) {
+        ModelPool pool(sizeof(TimeEntry));
+        void *first = pool.Allocate();
+        void *second = pool.Allocate();
+        ASSERT_EQ(std::size_t(2), pool.InUse());
+        ASSERT_EQ(std::size_t(1), pool.Blocks());
+
+        // Freed slots are reused before the pool grows
+        pool.Free(first);
+        ASSERT_EQ(first, pool.Allocate());
+        pool.Free(second);
+        pool.Free(first);
+        ASSERT_EQ(std::size_t(0), pool.InUse());
+
+        ModelPools &pools = ModelPools::Shared();
+        std::size_t in_use = pools.InUse(sizeof(TimeEntry));
+        {
+            User user("kopsik_test", "0.1");
+            for (int i = 0; i < 1000; i++) {
+                user.related.TimeEntries.push_back(new TimeEntry());
+            }
+            ASSERT_EQ(in_use + 1000, pools.InUse(sizeof(TimeEntry)));
+        }
+        ASSERT_EQ(in_use, pools.InUse(sizeof(TimeEntry)));
+
+        // Memory is kept for the next login
+        std::size_t blocks = pools.Blocks(sizeof(TimeEntry));
+        TimeEntry *te = new TimeEntry();
+        ASSERT_EQ(blocks, pools.Blocks(sizeof(TimeEntry)));
+        delete te;
+    }
+
+    TEST(TogglApiClientTest, TrimsEmptyPoolBlocks) {
+        ModelPool pool(sizeof(TimeEntry));
+        std::vector<void *> slots;
+        while (pool.Blocks() < 3) {
+            slots.push_back(pool.Allocate());
+        }
+        void *last = slots.back();
+        slots.pop_back();
+
+        // Only the block of the last slot has a model left in it
+        for (std::vector<void *>::const_iterator it = slots.begin();
+                it != slots.end();
+                it++) {
+            pool.Free(*it);
+        }
+        ASSERT_EQ(2 * pool.BlockBytes(), pool.Trim());
+        ASSERT_EQ(std::size_t(1), pool.Blocks());
+        ASSERT_EQ(std::size_t(1), pool.InUse());
+
+        // What's left of the free list is still usable
+        void *next = pool.Allocate();
+        ASSERT_NE(last, next);
+        ASSERT_EQ(std::size_t(1), pool.Blocks());
+        pool.Free(next);
+
+        pool.Free(last);
+        ASSERT_EQ(pool.BlockBytes(), pool.Trim());
+        ASSERT_EQ(std::size_t(0), pool.Blocks());
+    }
+
+    TEST(TogglApiClientTest, InternsTagNames) {
+        TimeEntry a;
+        a.SetTags("alfa|beeta");
+        TimeEntry b;
+        std::vector<std::string> names;
+        names.push_back("beeta");
+        b.SetTagNames(names);
+        ASSERT_EQ(a.TagIDs()[1], b.TagIDs()[0]);
+        ASSERT_EQ("beeta", b.Tags());
+        ASSERT_EQ(std::size_t(2), a.TagNames().size());
+        ASSERT_EQ("alfa", a.TagNames()[0]);
+
+        // Setting the same tags again changes nothing
+        a.ClearDirty();
+        a.SetTags("alfa|beeta");
+        ASSERT_FALSE(a.Dirty());
+        a.SetTags("");
+        ASSERT_TRUE(a.TagIDs().empty());
+        ASSERT_TRUE(a.Dirty());
+    }
+
+    TEST(TogglApiClientTest, KeepsDistinctTagNamesUpToDate) {
+        User user("kopsik_test", "0.1");
+        const char *names[] = { "work", "home", "work" };
+        for (int i = 0; i < 3; i++) {
+            Tag *tag = new Tag();
+            tag->SetName(names[i]);
+            user.related.Tags.push_back(tag);
+        }
+        ASSERT_FALSE(user.related.TagNamesComplete());
+        user.related.TrackAll();
+        ASSERT_TRUE(user.related.TagNamesComplete());
+
+        std::vector<std::string> distinct;
+        user.related.TagNames.Names(&distinct);
+        ASSERT_EQ(std::size_t(2), distinct.size());
+        ASSERT_EQ("work", distinct[0]);
+        ASSERT_EQ("home", distinct[1]);
+
+        user.related.Tags[0]->SetName("office");
+        distinct.clear();
+        user.related.TagNames.Names(&distinct);
+        ASSERT_EQ(std::size_t(3), distinct.size());
+        ASSERT_EQ("office", distinct[1]);
+
+        user.ClearTags();
+        distinct.clear();
+        user.related.TagNames.Names(&distinct);
+        ASSERT_TRUE(distinct.empty());
+        ASSERT_TRUE(user.related.TagNamesComplete());
+    }
+
+    TEST(TogglApiClientTest, KeysModelsByBinaryGUID) {
+        BinaryGUID lower = BinaryGUID::Of(
+            "07fba193-91c4-0ec8-2345-820df0548123");
+        BinaryGUID upper = BinaryGUID::Of(
+            "07FBA193-91C4-0EC8-2345-820DF0548123");
+        ASSERT_TRUE(lower == upper);
+        ASSERT_FALSE(lower.IsNull());
+        ASSERT_EQ(lower.Hash(), upper.Hash());
+        ASSERT_TRUE(lower != BinaryGUID::Of(
+            "07fba193-91c4-0ec8-2345-820df0548124"));
+        ASSERT_TRUE(BinaryGUID::Of("").IsNull());
+
+        // Other text still gets a value of its own
+        ASSERT_TRUE(BinaryGUID::Of("abc") == BinaryGUID::Of("abc"));
+        ASSERT_TRUE(BinaryGUID::Of("abc") != BinaryGUID::Of("abd"));
+        ASSERT_FALSE(BinaryGUID::Of("abc").IsNull());
+
+        TimeEntry te;
+        te.SetGUID("07fba193-91c4-0ec8-2345-820df0548123");
+        ASSERT_TRUE(lower == te.GUIDKey());
+
+        ModelsByGUID models;
+        models[te.GUIDKey()] = &te;
+        ASSERT_EQ(&te, models[upper]);
+    }
+
+    TEST(TogglApiClientTest, CollectsMetrics) {
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+
+        metrics.Count("test.things");
+        metrics.Count("test.things", 2);
+        ASSERT_EQ(3, metrics.Counter("test.things"));
+        ASSERT_EQ(0, metrics.Counter("test.nothing"));
+
+        metrics.Time("test.latency", 500);
+        metrics.Time("test.latency", 7000);
+        metrics.Time("test.latency", 60000000);
+        LatencyHistogram h = metrics.Histogram("test.latency");
+        ASSERT_EQ(3, h.count);
+        ASSERT_EQ(60000000, h.max_micros);
+        ASSERT_EQ(1, h.buckets[0]);
+        ASSERT_EQ(1, h.buckets[2]);
+        ASSERT_EQ(1, h.buckets[kMetricsBucketCount - 1]);
+
+        ASSERT_EQ("/api/v8/time_entries/:id",
+                  MetricsEndpoint("/api/v8/time_entries/1234?x=1"));
+        ASSERT_EQ("/api/v8/me", MetricsEndpoint("/api/v8/me?since=123"));
+
+        std::string json = metrics.JSON();
+        ASSERT_TRUE(IsValidJSON(json));
+        ASSERT_NE(std::string::npos, json.find("\"test.things\":3"));
+
+        // Saving a user times each table that had something to save
+        wipe_test_db();
+        Database db(TESTDB);
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::vector<ModelChange> changes;
+        ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        ASSERT_EQ(1, metrics.Histogram("db.save.time_entries").count);
+        ASSERT_EQ(1, metrics.Histogram("db.save.user").count);
+        ASSERT_EQ(1, metrics.Histogram("json.parse.user").count);
+
+        metrics.Clear();
+    }
+
+    TEST(TogglApiClientTest, AccountsMemoryPerCollection) {
+        ASSERT_EQ(std::size_t(0), StringBytes("short"));
+        ASSERT_LT(std::size_t(100), StringBytes(std::string(100, 'x')));
+
+        User user("kopsik_test", "0.1");
+        LoadUserFromJSONString(&user, loadTestData(), true, true);
+        std::map<std::string, std::size_t> bytes;
+        user.related.MemoryUsage(&bytes);
+        ASSERT_LE(user.related.TimeEntries.size() * sizeof(TimeEntry),
+                  bytes["time_entries"]);
+        ASSERT_LE(user.related.Tags.size() * sizeof(Tag), bytes["tags"]);
+        ASSERT_LT(std::size_t(0), bytes["workspaces"]);
+
+        // Descriptions are interned, so they count in the
+        // memory.descriptions gauge rather than in time_entries
+        std::size_t before = StringTable::Descriptions().MemoryBytes();
+        user.related.TimeEntries[0]->SetDescription(std::string(1000, 'x'));
+        ASSERT_LE(before + 1000, StringTable::Descriptions().MemoryBytes());
+    }
+
+    TEST(TogglApiClientTest, ProfilesSQLStatements) {
+        ASSERT_EQ("SELECT id FROM tags WHERE uid = ? AND name = ?",
+                  MetricsStatement("SELECT id\n  FROM tags WHERE uid = 12 "
+                                   "AND name = 'it''s'"));
+        ASSERT_EQ("DELETE FROM time_entries WHERE id IN (?)",
+                  MetricsStatement("DELETE FROM time_entries "
+                                   "WHERE id IN (1, 2,3)"));
+        ASSERT_EQ("select * from t1 where x = -?",
+                  MetricsStatement("select * from t1 where x = -1.5e3"));
+
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+        {
+            wipe_test_db();
+            Database db(TESTDB);
+            User user("kopsik_test", "0.1");
+            LoadUserFromJSONString(&user, loadTestData(), true, true);
+            std::vector<ModelChange> changes;
+            ASSERT_EQ(noError, db.SaveUser(&user, true, &changes));
+        }
+        ASSERT_LT(0, metrics.Histogram("sql.BEGIN IMMEDIATE").count);
+        ASSERT_LT(0, metrics.Histogram("sql.COMMIT").count);
+        std::string json = metrics.JSON();
+        ASSERT_NE(std::string::npos, json.find("\"sql.INSERT INTO tags"));
+
+        metrics.Clear();
+    }
+
+    class TracedRunnable : public Poco::Runnable {
+    public:
+        void run() {
+            TraceSpan span("test.worker");
+        }
+    };
+
+    TEST(TogglApiClientTest, RecordsTraceSpansPerThread) {
+        Trace &trace = Trace::Shared();
+        trace.Clear();
+
+        // Nothing is recorded while tracing is off
+        {
+            TraceSpan span("test.off");
+        }
+        ASSERT_EQ(std::string::npos, trace.JSON().find("test.off"));
+
+        Trace::SetEnabled(true);
+        {
+            TraceSpan span("test.main");
+        }
+        TracedRunnable runnable;
+        Poco::Thread thread;
+        thread.setName("trace_test");
+        thread.start(runnable);
+        thread.join();
+
+        std::string json = trace.JSON();
+        ASSERT_TRUE(IsValidJSON(json));
+        ASSERT_EQ(std::size_t(0), json.find("{\"traceEvents\":["));
+        ASSERT_NE(std::string::npos, json.find("\"name\":\"test.main\""));
+        ASSERT_NE(std::string::npos, json.find("\"name\":\"test.worker\""));
+        ASSERT_NE(std::string::npos, json.find("\"name\":\"trace_test\""));
+
+        // Oldest spans are overwritten once the buffer is full
+        std::vector<TraceEvent> events;
+        trace.Clear();
+        for (std::size_t i = 0; i < kTraceBufferSpans + 1; i++) {
+            TraceSpan span(i ? "test.newer" : "test.oldest");
+        }
+        trace.Buffer()->Events(&events);
+        ASSERT_EQ(kTraceBufferSpans, events.size());
+        ASSERT_EQ(std::string("test.newer"), events.front().name);
+
+        Trace::SetEnabled(false);
+        trace.Clear();
+    }
+
+    class LockHolder : public Poco::Runnable {
+    public:
+        explicit LockHolder(InstrumentedMutex &mutex)  // NOLINT
+            : mutex_(mutex) {}
+        void run() {
+            InstrumentedMutex::ScopedLock lock(mutex_, "LockHolder");
+            locked.set();
+            Poco::Thread::sleep(50);
+        }
+        Poco::Event locked;
+
+    private:
+        InstrumentedMutex &mutex_;
+    };
+
+    TEST(TogglApiClientTest, RecordsLockWaitsWithHolder) {
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+        InstrumentedMutex mutex("test.mutex");
+
+        // Nothing is recorded while it's off
+        {
+            InstrumentedMutex::ScopedLock lock(mutex, "Off");
+        }
+        ASSERT_EQ(0, metrics.Histogram("lock.test.mutex.hold.Off").count);
+
+        LockMetrics::SetEnabled(true);
+        LockHolder holder(mutex);
+        Poco::Thread thread;
+        thread.start(holder);
+        holder.locked.wait();
+        {
+            InstrumentedMutex::ScopedLock lock(mutex, "Waiter");
+            // Taken again by the same thread, only the outermost counts
+            InstrumentedMutex::ScopedLock again(mutex, "Again");
+        }
+        thread.join();
+        LockMetrics::SetEnabled(false);
+
+        ASSERT_EQ(1, metrics.Histogram("lock.test.mutex.wait").count);
+        ASSERT_EQ(1,
+                  metrics.Histogram("lock.test.mutex.hold.LockHolder").count);
+        ASSERT_EQ(1, metrics.Histogram("lock.test.mutex.hold.Waiter").count);
+        ASSERT_EQ(0, metrics.Histogram("lock.test.mutex.hold.Again").count);
+        metrics.Clear();
+    }
+
+    static void fastApiCall() {
+        KOPSIK_API_CALL("");
+    }
+
+    static void slowApiCall(const char *guid, const char *typed) {
+        KOPSIK_API_CALL("guid=" << ApiArg(guid)
+            << " typed=" << ApiPrivateArg(typed));
+        TraceSpan span("test.slow_api_call");
+        Poco::Thread::sleep(20);
+    }
+
+    TEST(TogglApiClientTest, KeepsApiCallsOverBudget) {
+        Metrics &metrics = Metrics::Shared();
+        metrics.Clear();
+        ApiWatchdog &watchdog = ApiWatchdog::Shared();
+        watchdog.Clear();
+
+        // Nothing is timed while there's no budget
+        slowApiCall("abc", "secret");
+        ASSERT_EQ(0, metrics.Histogram("api.slowApiCall").count);
+        ASSERT_EQ(std::size_t(0), watchdog.Size());
+
+        ApiWatchdog::SetBudgetMicros(10000);
+        Trace::SetEnabled(true);
+        fastApiCall();
+        slowApiCall("abc", "secret");
+        Trace::SetEnabled(false);
+        ApiWatchdog::SetBudgetMicros(0);
+
+        ASSERT_EQ(1, metrics.Histogram("api.fastApiCall").count);
+        ASSERT_EQ(1, metrics.Histogram("api.slowApiCall").count);
+        ASSERT_EQ(1, metrics.Counter("api.slow"));
+        ASSERT_EQ(std::size_t(1), watchdog.Size());
+
+        std::string json = watchdog.JSON();
+        ASSERT_TRUE(IsValidJSON(json));
+        ASSERT_NE(std::string::npos, json.find("\"name\":\"slowApiCall\""));
+        ASSERT_NE(std::string::npos,
+                  json.find("guid=\\\"abc\\\" typed=<6 chars>"));
+        ASSERT_EQ(std::string::npos, json.find("secret"));
+        ASSERT_NE(std::string::npos, json.find("test.slow_api_call"));
+
+        watchdog.Clear();
+        Trace::Shared().Clear();
+        metrics.Clear();
+    }
+
+    static int formatted_log_messages = 0;
+
+    static std::string formatLogMessage() {
+        formatted_log_messages++;
+        return "message";
+    }
+
+    TEST(TogglApiClientTest, FormatsLogMessagesOnlyForEnabledLevels) {
+        Poco::Logger &logger = Poco::Logger::get("log_test");
+        logger.setLevel(Poco::Message::PRIO_DEBUG);
+
+        formatted_log_messages = 0;
+        KOPSIK_LOG_TRACE(logger, "trace " << formatLogMessage());
+        ASSERT_EQ(0, formatted_log_messages);
+        KOPSIK_LOG_DEBUG(logger, "debug " << formatLogMessage());
+        ASSERT_EQ(1, formatted_log_messages);
+
+        logger.setLevel(Poco::Message::PRIO_INFORMATION);
+        KOPSIK_LOG_DEBUG(logger, "debug " << formatLogMessage());
+        ASSERT_EQ(1, formatted_log_messages);
+    }
+
+    // Keeps the texts it's given, holding up the writer until opened
+    class GatedLogChannel : public Poco::Channel {
+    public:
+        GatedLogChannel() : gate(false), entered(false) {}
+
+        void log(const Poco::Message &msg) {
+            entered.set();
+            gate.wait();
+            texts.push_back(msg.getText());
+        }
+
+        Poco::Event gate;
+        Poco::Event entered;
+        std::vector<std::string> texts;
+    };
+
+    TEST(TogglApiClientTest, WritesLogOnBackgroundThreadWithBoundedQueue) {
+        Poco::AutoPtr<GatedLogChannel> target(new GatedLogChannel());
+        Poco::AutoPtr<AsyncLogChannel> channel(
+            new AsyncLogChannel(target.get(), 3));
+
+        // Writer thread takes the first message and waits at the gate
+        channel->log(Poco::Message("test", "1", Poco::Message::PRIO_DEBUG));
+        target->entered.wait();
+
+        for (int i = 2; i <= 6; i++) {
+            channel->log(Poco::Message("test",
+                Poco::NumberFormatter::format(i), Poco::Message::PRIO_DEBUG));
+        }
+        ASSERT_TRUE(target->texts.empty());
+
+        target->gate.set();
+        channel->close();
+        ASSERT_EQ(std::size_t(5), target->texts.size());
+        ASSERT_EQ("1", target->texts[0]);
+        ASSERT_EQ("4", target->texts[3]);
+        ASSERT_EQ("Log queue was full, dropped 2 message(s)",
+                  target->texts[4]);
+
+        // Once closed, messages are written right away
+        channel->log(Poco::Message("test", "7", Poco::Message::PRIO_DEBUG));
+        ASSERT_EQ(std::size_t(6), target->texts.size());
+    }
+
+    TEST(TogglApiClientTest, LogsFieldsToTextAndBinaryChannels) {
+        LogFields fields;
+        fields.Add("count", 3).Add("name", "a \"b\"").Add("ok", true);
+        ASSERT_EQ("Saved count=3 name=\"a \\\"b\\\"\" ok=true",
+                  fields.Text("Saved"));
+
+        LogComponent component = { "log_fields_test", 0 };
+        Poco::Logger &logger = ComponentLogger(&component);
+        ASSERT_EQ(&logger, component.logger);
+        ASSERT_EQ(&logger, &ComponentLogger(&component));
+
+        std::string path("binary_log_test.bin");
+        Poco::AutoPtr<GatedLogChannel> text(new GatedLogChannel());
+        text->gate.set();
+        Poco::AutoPtr<BinaryLogChannel> binary(new BinaryLogChannel(path));
+        Poco::AutoPtr<PriorityRouteChannel> channel(
+            new PriorityRouteChannel(text.get(), binary.get()));
+        logger.setChannel(channel);
+        logger.setLevel(Poco::Message::PRIO_TRACE);
+
+        KOPSIK_LOG_FIELDS(logger, PRIO_TRACE, "Saved", fields);
+        logger.trace("plain");
+        KOPSIK_LOG_FIELDS(logger, PRIO_WARNING, "Failed",
+                          LogFields().Add("code", 500));
+        channel->close();
+        ASSERT_EQ(std::size_t(1), text->texts.size());
+        ASSERT_EQ("Failed code=500", text->texts[0]);
+
+        std::string data("");
+        {
+            Poco::FileInputStream in(path);
+            Poco::StreamCopier::copyToString(in, data);
+        }
+        Poco::File(path).remove(false);
+        std::vector<BinaryLogRecord> records;
+        ASSERT_EQ(noError, BinaryLogChannel::Read(data, &records));
+        ASSERT_EQ(std::size_t(2), records.size());
+        ASSERT_EQ("log_fields_test", records[0].source);
+        ASSERT_EQ(Poco::Message::PRIO_TRACE, records[0].priority);
+        ASSERT_EQ(std::size_t(3), records[0].fields.size());
+        ASSERT_EQ("name", records[0].fields[1].first);
+        ASSERT_EQ("a \"b\"", records[0].fields[1].second);
+        ASSERT_EQ("plain", records[1].text);
+        ASSERT_TRUE(records[1].fields.empty());
+        ASSERT_LE(records[0].time, records[1].time);
+
+        ASSERT_NE(noError, BinaryLogChannel::Read(
+            data.substr(0, data.size() - 2), &records));
+        ASSERT_NE(noError, BinaryLogChannel::Read("plain text", &records));
+
+        logger.setChannel(0);
+    }
+
+    TEST(TogglApiClientTest, SharesOneTLSContextAcrossClients) {
+        Poco::Net::initializeSSL();
+        HTTPSSessionPool &pool = HTTPSSessionPool::Instance();
+        Poco::Net::Context::Ptr context = pool.TLSContext();
+        ASSERT_FALSE(context.isNull());
+        ASSERT_EQ(context.get(), pool.TLSContext().get());
+
+        Poco::URI uri("https://stream.toggl.com");
+        ASSERT_TRUE(pool.TLSSession(uri, Proxy()).isNull());
+        pool.KeepTLSSession(uri, Proxy(), Poco::Net::Session::Ptr());
+        ASSERT_TRUE(pool.TLSSession(uri, Proxy()).isNull());
+
+        pool.Clear();
+        Poco::Net::uninitializeSSL();
+    }
+
+    TEST(TogglApiClientTest, TakesTurnsOnConnectionsToAHost) {
+        Poco::Net::initializeSSL();
+        HTTPSSessionPool &pool = HTTPSSessionPool::Instance();
+        Poco::URI uri("https://www.toggl.com");
+        Poco::Timespan no_wait(0);
+
+        std::vector<Poco::Net::HTTPSClientSession *> sessions;
+        bool reused(true);
+        for (int i = 0; i < kHTTPSMaxSessionsPerHost; i++) {
+            sessions.push_back(pool.Acquire(uri, Proxy(), no_wait, &reused));
+            ASSERT_TRUE(sessions.back());
+            ASSERT_FALSE(reused);
+        }
+        ASSERT_FALSE(pool.Acquire(uri, Proxy(), no_wait, &reused));
+        // Another host has connections of its own
+        Poco::URI other("https://stream.toggl.com");
+        Poco::Net::HTTPSClientSession *session =
+            pool.Acquire(other, Proxy(), no_wait, &reused);
+        ASSERT_TRUE(session);
+        pool.Release(other, Proxy(), session, false);
+
+        pool.Release(uri, Proxy(), sessions.back(), false);
+        sessions.pop_back();
+        session = pool.Acquire(uri, Proxy(), Poco::Timespan(1, 0), &reused);
+        ASSERT_TRUE(session);
+        sessions.push_back(session);
+
+        for (std::size_t i = 0; i < sessions.size(); i++) {
+            pool.Release(uri, Proxy(), sessions[i], false);
+        }
+        pool.Clear();
+        Poco::Net::uninitializeSSL();
+    }
+
+    TEST(TogglApiClientTest, ConnectsToCachedAddresses) {
+        DNSCache cache;
+        // Addresses are used as they are
+        ASSERT_EQ("", cache.Address("127.0.0.1", 443));
+
+        // Whether or not localhost has an IPv6 address too, the IPv4
+        // one that's listening is the one to connect to
+        Poco::Net::ServerSocket server(
+            Poco::Net::SocketAddress("127.0.0.1", 0));
+        Poco::UInt16 port = server.address().port();
+        Metrics &metrics = Metrics::Shared();
+        Poco::Int64 hits = metrics.Counter("dns.cache_hits");
+        ASSERT_EQ("127.0.0.1", cache.Address("localhost", port));
+        ASSERT_EQ(hits, metrics.Counter("dns.cache_hits"));
+
+        // And it's looked up only once
+        ASSERT_EQ("127.0.0.1", cache.Address("localhost", port));
+        ASSERT_EQ(hits + 1, metrics.Counter("dns.cache_hits"));
+
+        ASSERT_EQ("", cache.Address("nonexistent.invalid", port));
+    }
+
+    TEST(TogglApiClientTest, FailsCancelledAndOverdueRequestsRightAway) {
+        HTTPSClient client("https://localhost", "kopsik_test", "0.1");
+        std::string response_body("");
+
+        HTTPSCancellation::Ptr cancellation = new HTTPSCancellation();
+        client.SetCancellation(cancellation);
+        cancellation->Cancel();
+        ASSERT_TRUE(cancellation->IsCancelled());
+        ASSERT_EQ(kRequestCancelled,
+                  client.GetJSON("/api/v8/me", "", "", &response_body));
+        ASSERT_EQ(kRequestCancelled,
+                  client.PostJSON("/api/v8/feedback", "{}", "", "",
+                                  &response_body));
+
+        client.SetCancellation(0);
+        HTTPSDeadlines deadlines = HTTPSClient::DefaultDeadlines();
+        deadlines.total = 0;
+        client.SetDeadlines(deadlines);
+        kopsik::error err =
+            client.GetJSON("/api/v8/me", "", "", &response_body);
+        ASSERT_NE(noError, err);
+        ASSERT_NE(kRequestCancelled, err);
+    }
+
+    TEST(TogglApiClientTest, ParsesRetryAfter) {
+        Poco::Timestamp now(Poco::Timestamp::fromEpochTime(1400000000));
+        ASSERT_EQ(120 * Poco::Timestamp::resolution(),
+                  RetryAfterMicros("120", now));
+        ASSERT_EQ(0, RetryAfterMicros("0", now));
+        // 40 seconds after now
+        ASSERT_EQ(40 * Poco::Timestamp::resolution(),
+                  RetryAfterMicros("Tue, 13 May 2014 16:54:00 GMT", now));
+        ASSERT_EQ(0, RetryAfterMicros("Tue, 13 May 2014 16:00:00 GMT", now));
+        ASSERT_EQ(kHTTPSRetryAfterDefaultMicros, RetryAfterMicros("", now));
+        ASSERT_EQ(kHTTPSRetryAfterDefaultMicros,
+                  RetryAfterMicros("soon", now));
+        ASSERT_EQ(kHTTPSRetryAfterDefaultMicros,
+                  RetryAfterMicros("13 May 2014", now));
+        ASSERT_EQ(kHTTPSRetryAfterMaxMicros,
+                  RetryAfterMicros("99999999", now));
+    }
+
+    TEST(TogglApiClientTest, RateLimitsRequestsPerHost) {
+        HTTPSRateLimiter limiter(2, 2);
+        Poco::URI api("https://www.toggl.com/api/v8/me");
+        Poco::URI timeline("https://timeline.toggl.com/api/v8/timeline");
+        Poco::Timestamp now;
+        const Poco::Timestamp::TimeDiff second =
+            Poco::Timestamp::resolution();
+
+        // Burst goes right away, the next waits for the refill
+        ASSERT_EQ(0, limiter.Reserve(api, now, second));
+        ASSERT_EQ(0, limiter.Reserve(api, now, second));
+        Poco::Timestamp::TimeDiff wait = limiter.Reserve(api, now, second);
+        ASSERT_GT(wait, second / 2 - 10);
+        ASSERT_LT(wait, second / 2 + 10);
+        // Not taken when the wait is too long
+        ASSERT_GT(limiter.Reserve(api, now, 0), 0);
+        // Other hosts have their own
+        ASSERT_EQ(0, limiter.Reserve(timeline, now, second));
+
+        // Server asked to wait: nothing goes until then,
+        // and the bucket refills from empty afterwards
+        Poco::Timestamp retry_at = now + 10 * second;
+        limiter.Defer(timeline, retry_at);
+        ASSERT_EQ(retry_at, limiter.RetryAt(timeline, now));
+        ASSERT_EQ(now, limiter.RetryAt(api, now));
+        ASSERT_GT(limiter.Reserve(timeline, now, second), second);
+        ASSERT_GT(limiter.Reserve(timeline, retry_at, second), 0);
+        ASSERT_EQ(0, limiter.Reserve(timeline, retry_at + second, second));
+    }
+
+    TEST(TogglApiClientTest, BacksOffWebSocketReconnectsWithJitter) {
+        // Upper half of the backoff, by random
+        ASSERT_EQ(kWebSocketReconnectMinMicros / 2,
+                  WebSocketReconnectDelay(0, 0));
+        ASSERT_EQ(kWebSocketReconnectMinMicros,
+                  WebSocketReconnectDelay(0,
+                      Poco::UInt32(kWebSocketReconnectMinMicros / 2)));
+        ASSERT_EQ(kWebSocketReconnectMinMicros / 2 + 1000,
+                  WebSocketReconnectDelay(0, 1000));
+
+        // Doubles with each attempt
+        ASSERT_EQ(kWebSocketReconnectMinMicros,
+                  WebSocketReconnectDelay(1, 0));
+        ASSERT_EQ(kWebSocketReconnectMinMicros * 2,
+                  WebSocketReconnectDelay(2, 0));
+
+        // Up to the max, however many attempts
+        ASSERT_EQ(kWebSocketReconnectMaxMicros / 2,
+                  WebSocketReconnectDelay(20, 0));
+        ASSERT_EQ(kWebSocketReconnectMaxMicros / 2,
+                  WebSocketReconnectDelay(1000, 0));
+        ASSERT_GE(kWebSocketReconnectMaxMicros,
+                  WebSocketReconnectDelay(1000, 0xffffffff));
+    }
+
+    // Sends a message in fragments with a ping between
+    // them, then a whole one, and closes the connection
+    class FragmentingWebSocketHandler : public Poco::Net::HTTPRequestHandler {
+     public:
+        FragmentingWebSocketHandler(Poco::Event *done, std::string *pong)
+            : done_(done)
+            , pong_(pong) {}
+
+        void handleRequest(Poco::Net::HTTPServerRequest &request,  // NOLINT
+                           Poco::Net::HTTPServerResponse &response) {  // NOLINT
+            try {
+                Poco::Net::WebSocket ws(request, response);
+                ws.setReceiveTimeout(Poco::Timespan(5, 0));
+                ws.sendFrame("{\"type\":", 8,
+                             Poco::Net::WebSocket::FRAME_OP_TEXT);
+                ws.sendFrame("hello", 5,
+                             Poco::Net::WebSocket::FRAME_FLAG_FIN
+                             | Poco::Net::WebSocket::FRAME_OP_PING);
+                ws.sendFrame("\"data\"}", 7,
+                             Poco::Net::WebSocket::FRAME_FLAG_FIN
+                             | Poco::Net::WebSocket::FRAME_OP_CONT);
+
+                char buf[64];
+                int flags(0);
+                int n = ws.receiveFrame(buf, sizeof(buf), flags);
+                if (Poco::Net::WebSocket::FRAME_OP_PONG
+                        == (flags & Poco::Net::WebSocket::FRAME_OP_BITMASK)
+                        && n > 0) {
+                    pong_->assign(buf, n);
+                }
+
+                ws.sendFrame("{}", 2);
+                ws.shutdown();
+            } catch(const Poco::Exception &) {
+            }
+            done_->set();
+        }
+
+     private:
+        Poco::Event *done_;
+        std::string *pong_;
+    };
+
+    class FragmentingWebSocketHandlerFactory
+        : public Poco::Net::HTTPRequestHandlerFactory {
+     public:
+        FragmentingWebSocketHandlerFactory(Poco::Event *done,
+                                           std::string *pong)
+            : done_(done)
+            , pong_(pong) {}
+
+        Poco::Net::HTTPRequestHandler *createRequestHandler(
+            const Poco::Net::HTTPServerRequest &) {
+            return new FragmentingWebSocketHandler(done_, pong_);
+        }
+
+     private:
+        Poco::Event *done_;
+        std::string *pong_;
+    };
+
+    TEST(TogglApiClientTest, ReassemblesFragmentedWebSocketMessages) {
+        Poco::Event done;
+        std::string pong("");
+        Poco::Net::ServerSocket socket(
+            Poco::Net::SocketAddress("127.0.0.1", 0));
+        Poco::Net::HTTPServer server(
+            new FragmentingWebSocketHandlerFactory(&done, &pong),
+            socket,
+            new Poco::Net::HTTPServerParams);
+        server.start();
+
+        Poco::Net::HTTPClientSession session("127.0.0.1",
+                                             socket.address().port());
+        Poco::Net::HTTPRequest req(Poco::Net::HTTPRequest::HTTP_GET, "/ws",
+                                   Poco::Net::HTTPMessage::HTTP_1_1);
+        Poco::Net::HTTPResponse res;
+        Poco::Net::WebSocket ws(session, req, res);
+        ws.setReceiveTimeout(Poco::Timespan(5, 0));
+
+        WebSocketMessageReader reader;
+        Poco::FastMutex send_m;
+        std::string message("");
+        bool rsv1(true);
+
+        // Fragments are joined, and the ping between them answered
+        ASSERT_EQ(noError, reader.Read(&ws, &send_m, &message, &rsv1));
+        ASSERT_EQ("{\"type\":\"data\"}", message);
+        ASSERT_FALSE(rsv1);
+        ASSERT_LT(std::size_t(0), reader.BufferBytes());
+
+        // Next message starts from scratch
+        ASSERT_EQ(noError, reader.Read(&ws, &send_m, &message, &rsv1));
+        ASSERT_EQ("{}", message);
+
+        // Closed connection leaves the message empty
+        ASSERT_EQ(noError, reader.Read(&ws, &send_m, &message, &rsv1));
+        ASSERT_EQ("", message);
+
+        ASSERT_TRUE(done.tryWait(5000));
+        ASSERT_EQ("hello", pong);
+        server.stop();
+    }
+
+    // Compresses messages the way a permessage-deflate sender does
+    class MessageDeflater {
+     public:
+        explicit MessageDeflater(const bool context_takeover)
+            : context_takeover_(context_takeover) {
+            std::memset(&stream_, 0, sizeof(stream_));
+            deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        }
+        ~MessageDeflater() {
+            deflateEnd(&stream_);
+        }
+        std::string Deflate(const std::string &message) {
+            std::string result(deflateBound(&stream_, message.size()) + 16,
+                               '\0');
+            stream_.next_in = reinterpret_cast<Bytef *>(
+                const_cast<char *>(message.data()));
+            stream_.avail_in = static_cast<uInt>(message.size());
+            stream_.next_out = reinterpret_cast<Bytef *>(&result[0]);
+            stream_.avail_out = static_cast<uInt>(result.size());
+            deflate(&stream_, Z_SYNC_FLUSH);
+            result.resize(result.size() - stream_.avail_out);
+            if (!context_takeover_) {
+                deflateReset(&stream_);
+            }
+            // Empty block at the end is left out
+            return result.substr(0, result.size() - 4);
+        }
+
+     private:
+        z_stream stream_;
+        bool context_takeover_;
+    };
+
+    TEST(TogglApiClientTest, InflatesPerMessageDeflateMessages) {
+        std::string first("{\"action\":\"UPDATE\",\"model\":"
+                          "\"time_entry\",\"data\":{\"id\":1}}");
+        std::string second("{\"action\":\"UPDATE\",\"model\":"
+                           "\"time_entry\",\"data\":{\"id\":2}}");
+        std::string message("");
+
+        // Second message refers back to the first one
+        MessageDeflater deflater(true);
+        WebSocketInflater inflater;
+        inflater.Reset(true);
+        std::string compressed = deflater.Deflate(first);
+        ASSERT_LT(std::size_t(0), compressed.size());
+        ASSERT_EQ(noError, inflater.Inflate(compressed, 1024, &message));
+        ASSERT_EQ(first, message);
+        compressed = deflater.Deflate(second);
+        ASSERT_GT(first.size() / 2, compressed.size());
+        ASSERT_EQ(noError, inflater.Inflate(compressed, 1024, &message));
+        ASSERT_EQ(second, message);
+
+        // Each message on its own
+        MessageDeflater no_takeover(false);
+        inflater.Reset(false);
+        for (int i = 0; i < 2; i++) {
+            ASSERT_EQ(noError, inflater.Inflate(
+                no_takeover.Deflate(first), 1024, &message));
+            ASSERT_EQ(first, message);
+        }
+
+        ASSERT_NE(noError, inflater.Inflate(
+            no_takeover.Deflate(first), 10, &message));
+        ASSERT_NE(noError, inflater.Inflate("not deflated", 1024, &message));
+    }
+
+    class ReadableCounter {
+     public:
+        explicit ReadableCounter(Poco::Net::DatagramSocket *s)
+            : socket(s), count(0) {}
+        void onReadable(
+                const Poco::AutoPtr<Poco::Net::ReadableNotification> &n) {
+            char buffer[16];
+            socket->receiveBytes(buffer, sizeof(buffer));
+            count++;
+            readable.set();
+        }
+        Poco::Net::DatagramSocket *socket;
+        int count;
+        Poco::Event readable;
+    };
+
+    TEST(TogglApiClientTest, CallsReactorHandlerOnlyWhenSocketIsReadable) {
+        NetworkReactor &reactor = NetworkReactor::Instance();
+        Poco::Net::DatagramSocket socket(
+            Poco::Net::SocketAddress("127.0.0.1", 0));
+        ReadableCounter counter(&socket);
+        Poco::NObserver<ReadableCounter, Poco::Net::ReadableNotification>
+            observer(counter, &ReadableCounter::onReadable);
+
+        reactor.Add(socket, observer);
+        ASSERT_FALSE(counter.readable.tryWait(200));
+        ASSERT_EQ(0, counter.count);
+
+        Poco::Net::DatagramSocket sender;
+        sender.sendTo("x", 1, socket.address());
+        ASSERT_TRUE(counter.readable.tryWait(5000));
+        ASSERT_EQ(1, counter.count);
+
+        reactor.Remove(socket, observer);
+        sender.sendTo("x", 1, socket.address());
+        ASSERT_FALSE(counter.readable.tryWait(200));
+        ASSERT_EQ(1, counter.count);
+    }
+
+    class WorkerTaskRecorder {
+     public:
+        WorkerTaskRecorder() : interactive_runs(0) {}
+        void onBackground(Poco::Util::TimerTask &task) {  // NOLINT
+            background_started.set();
+            release_background.wait();
+        }
+        void onInteractive(Poco::Util::TimerTask &task) {  // NOLINT
+            interactive_runs++;
+            interactive_done.set();
+        }
+        int interactive_runs;
+        Poco::Event background_started;
+        Poco::Event release_background;
+        Poco::Event interactive_done;
+    };
+
+    TEST(TogglApiClientTest, RunsInteractiveTasksWhileBackgroundTaskRuns) {
+        WorkerTaskRecorder recorder;
+        WorkerPool pool(1, 1);
+
+        Poco::Util::TimerTask::Ptr background =
+            new WorkerTaskAdapter<WorkerTaskRecorder>(recorder,
+                &WorkerTaskRecorder::onBackground,
+                &pool, WorkerPool::Background);
+        background->run();
+        ASSERT_TRUE(recorder.background_started.tryWait(5000));
+
+        Poco::Util::TimerTask::Ptr interactive =
+            new WorkerTaskAdapter<WorkerTaskRecorder>(recorder,
+                &WorkerTaskRecorder::onInteractive,
+                &pool, WorkerPool::Interactive);
+        interactive->run();
+        ASSERT_TRUE(recorder.interactive_done.tryWait(5000));
+        ASSERT_EQ(1, recorder.interactive_runs);
+
+        // Cancelled before a worker got to it
+        Poco::Util::TimerTask::Ptr cancelled =
+            new WorkerTaskAdapter<WorkerTaskRecorder>(recorder,
+                &WorkerTaskRecorder::onInteractive,
+                &pool, WorkerPool::Background);
+        cancelled->cancel();
+        cancelled->run();
+
+        recorder.release_background.set();
+        pool.Cancel();
+        ASSERT_EQ(1, recorder.interactive_runs);
+
+        // Workers keep running after Cancel
+        Poco::Util::TimerTask::Ptr later =
+            new WorkerTaskAdapter<WorkerTaskRecorder>(recorder,
+                &WorkerTaskRecorder::onInteractive,
+                &pool, WorkerPool::Interactive);
+        later->run();
+        ASSERT_TRUE(recorder.interactive_done.tryWait(5000));
+        ASSERT_EQ(2, recorder.interactive_runs);
+        pool.Stop();
+    }
+
+    TEST(TogglApiClientTest, PutsOffBackgroundWorkOnBattery) {
+        PowerPolicy power;
+        Poco::Timestamp at(Poco::Timestamp::TimeVal(
+            1000 * kBatteryWakeupWindowMicros + 1));
+        ASSERT_EQ(at, power.Coalesce(at));
+        ASSERT_EQ(60, power.Stretch(60));
+
+        power.SetOnBattery(true);
+        ASSERT_EQ(Poco::Timestamp(1001 * kBatteryWakeupWindowMicros),
+                  power.Coalesce(at));
+        // Already on a window
+        ASSERT_EQ(Poco::Timestamp(1001 * kBatteryWakeupWindowMicros),
+                  power.Coalesce(
+                      Poco::Timestamp(1001 * kBatteryWakeupWindowMicros)));
+        ASSERT_EQ(60 * kBatteryIntervalFactor, power.Stretch(60));
+        Poco::Timestamp deferred = power.Defer(1);
+        ASSERT_EQ(0, deferred.epochMicroseconds()
+                  % kBatteryWakeupWindowMicros);
+        ASSERT_TRUE(deferred > Poco::Timestamp());
+
+        power.SetOnBattery(false);
+        ASSERT_EQ(at, power.Coalesce(at));
+    }
+
+    TEST(TogglApiClientTest, RecordsAndReplaysTraffic) {
+        TrafficRecorder &recorder = TrafficRecorder::Instance();
+        ASSERT_EQ(noError, recorder.Start("traffic_test.log"));
+        Poco::Timestamp started;
+        recorder.RecordHTTP("GET", "/api/v8/me?since=100", "", started,
+                            noError, "{\"since\":100}");
+        recorder.RecordWebSocket("{\"type\":\"ping\"}");
+        recorder.RecordHTTP("POST", "/api/v8/batch_updates", "[\n]", started,
+                            "Server error", "");
+        recorder.Stop();
+        // Not recorded once stopped
+        recorder.RecordWebSocket("{\"type\":\"ping\"}");
+
+        std::vector<TrafficRecord> records;
+        ASSERT_EQ(noError, TrafficRecorder::Load("traffic_test.log",
+                                                 &records));
+        Poco::File("traffic_test.log").remove(false);
+        ASSERT_EQ(std::size_t(3), records.size());
+        ASSERT_EQ(kTrafficHTTP, records[0].kind);
+        ASSERT_EQ("/api/v8/me?since=100", records[0].url);
+        ASSERT_EQ(kTrafficWebSocket, records[1].kind);
+        ASSERT_EQ("{\"type\":\"ping\"}", records[1].body);
+        ASSERT_EQ("[\n]", records[2].request_body);
+        ASSERT_LE(records[0].at_micros, records[1].at_micros);
+
+        ReplayHTTPSClient client(records, 0);
+        std::string body("");
+
+        // Since differs from the recording, the path is the same
+        ASSERT_EQ(noError, client.GetJSON("/api/v8/me?since=200", "", "",
+                                          &body));
+        ASSERT_EQ("{\"since\":100}", body);
+
+        // Each response is given once
+        ASSERT_NE(noError, client.GetJSON("/api/v8/me?since=200", "", "",
+                                          &body));
+        ASSERT_EQ(Poco::UInt64(1), client.Unanswered());
+
+        ASSERT_EQ("Server error", client.PostJSON("/api/v8/batch_updates",
+                                                  "[]", "", "", &body));
+    }
+
+    TEST(TogglApiClientTest, RunsTasksOfEachOwnerOneAtATime) {
+        WorkerTaskRecorder busy;
+        WorkerTaskRecorder other;
+        WorkerPool pool(2, 1);
+
+        Poco::Util::TimerTask::Ptr blocking =
+            new WorkerTaskAdapter<WorkerTaskRecorder>(busy,
+                &WorkerTaskRecorder::onBackground,
+                &pool, WorkerPool::Interactive);
+        blocking->run();
+        ASSERT_TRUE(busy.background_started.tryWait(5000));
+
+        // Waits for the owner's task before it, though a worker is free
+        Poco::Util::TimerTask::Ptr next =
+            new WorkerTaskAdapter<WorkerTaskRecorder>(busy,
+                &WorkerTaskRecorder::onInteractive,
+                &pool, WorkerPool::Interactive);
+        next->run();
+        ASSERT_FALSE(busy.interactive_done.tryWait(200));
+
+        // Another owner's task goes ahead on the free worker
+        Poco::Util::TimerTask::Ptr others =
+            new WorkerTaskAdapter<WorkerTaskRecorder>(other,
+                &WorkerTaskRecorder::onInteractive,
+                &pool, WorkerPool::Interactive);
+        others->run();
+        ASSERT_TRUE(other.interactive_done.tryWait(5000));
+
+        // Cancelling the other owner's tasks doesn't wait for this one
+        pool.Cancel(&other);
+
+        busy.release_background.set();
+        ASSERT_TRUE(busy.interactive_done.tryWait(5000));
+        ASSERT_EQ(1, busy.interactive_runs);
+        pool.Stop();
+    }
+
+    class LoopRecorder {
+     public:
+        LoopRecorder() : runs(0), last_run(3) {}
+        // Waits a minute between runs, the third is the last
+        Poco::Timestamp::TimeDiff onRun() {
+            runs++;
+            ran.set();
+            if (runs >= last_run) {
+                return -1;
+            }
+            return 60 * Poco::Timestamp::resolution();
+        }
+        int runs;
+        int last_run;
+        Poco::Event ran;
+    };
+
+    TEST(TogglApiClientTest, RunsWorkerLoopWithoutThreadOfItsOwn) {
+        LoopRecorder recorder;
+        WorkerPool pool(1, 1);
+        WorkerLoop<LoopRecorder> loop(&recorder, &LoopRecorder::onRun,
+                                      WorkerPool::Background, &pool);
+        loop.start();
+        ASSERT_TRUE(recorder.ran.tryWait(5000));
+        ASSERT_EQ(1, recorder.runs);
+        ASSERT_TRUE(loop.isRunning());
+
+        // Runs before its wait is over when woken up
+        loop.Wake();
+        ASSERT_TRUE(recorder.ran.tryWait(5000));
+        ASSERT_EQ(2, recorder.runs);
+
+        // Done when the callback says so
+        loop.Wake();
+        ASSERT_TRUE(recorder.ran.tryWait(5000));
+        loop.wait();
+        ASSERT_EQ(3, recorder.runs);
+        ASSERT_FALSE(loop.isRunning());
+        loop.Wake();
+        ASSERT_FALSE(recorder.ran.tryWait(200));
+
+        // Stopped between runs, the next one never comes
+        recorder.runs = 0;
+        loop.start();
+        ASSERT_TRUE(recorder.ran.tryWait(5000));
+        loop.stop();
+        loop.wait();
+        ASSERT_FALSE(loop.isRunning());
+        loop.Wake();
+        ASSERT_FALSE(recorder.ran.tryWait(200));
+        ASSERT_EQ(1, recorder.runs);
+        pool.Stop();
+    }
+
+    class IdleRecorder : public IdleListener {
+     public:
+        IdleRecorder() : went_idle(0), idle_started(0), idle_ended(0) {}
+        void WentIdle(const time_t started) {
+            went_idle++;
+            idle_started = started;
+        }
+        void Returned(const time_t started, const time_t ended) {
+            idle_started = started;
+            idle_ended = ended;
+        }
+        int went_idle;
+        time_t idle_started;
+        time_t idle_ended;
+    };
+
+    TEST(TogglApiClientTest, TracksIdleTimeWithAdaptiveSampling) {
+        IdleRecorder recorder;
+        IdleTracker tracker(300);
+        time_t now = 1000000;
+
+        // Active, looked at again when the threshold could be reached
+        ASSERT_EQ(300U, tracker.Sample(now, 0, &recorder));
+        ASSERT_EQ(180U, tracker.Sample(now + 120, 120, &recorder));
+        ASSERT_FALSE(tracker.Idle());
+        ASSERT_EQ(0, recorder.went_idle);
+
+        // Idle since the last input, looked at often while idle
+        now += 300;
+        ASSERT_EQ(uint(kIdleSampleWhileIdleSeconds),
+                  tracker.Sample(now, 300, &recorder));
+        ASSERT_TRUE(tracker.Idle());
+        ASSERT_EQ(1, recorder.went_idle);
+        ASSERT_EQ(1000000, recorder.idle_started);
+
+        now += 600;
+        ASSERT_EQ(uint(kIdleSampleWhileIdleSeconds),
+                  tracker.Sample(now, 900, &recorder));
+        ASSERT_EQ(1, recorder.went_idle);
+        ASSERT_EQ(0, recorder.idle_ended);
+
+        // Back two seconds ago
+        now += 5;
+        ASSERT_EQ(298U, tracker.Sample(now, 2, &recorder));
+        ASSERT_FALSE(tracker.Idle());
+        ASSERT_EQ(1000000, recorder.idle_started);
+        ASSERT_EQ(now - 2, recorder.idle_ended);
+    }
+
 }  // namespace kopsik
 
 int main(int argc, char **argv) {
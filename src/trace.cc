@@ -0,0 +1,149 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./trace.h"
+
+#include "Poco/SingletonHolder.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+TraceBuffer::TraceBuffer(const int tid, const std::string &thread_name)
+  : tid_(tid), thread_name_(thread_name), next_(0), wrapped_(false) {
+  events_.resize(kTraceBufferSpans);
+}
+
+void TraceBuffer::Add(
+    const char *name, const Poco::Int64 start_micros,
+    const Poco::Int64 duration_micros) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  TraceEvent &event = events_[next_];
+  event.name = name;
+  event.start_micros = start_micros;
+  event.duration_micros = duration_micros;
+  next_++;
+  if (next_ == events_.size()) {
+    next_ = 0;
+    wrapped_ = true;
+  }
+}
+
+void TraceBuffer::Events(std::vector<TraceEvent> *result) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  if (wrapped_) {
+    result->insert(result->end(), events_.begin() + next_, events_.end());
+  }
+  result->insert(result->end(), events_.begin(), events_.begin() + next_);
+}
+
+void TraceBuffer::Clear() {
+  Poco::FastMutex::ScopedLock lock(m_);
+  next_ = 0;
+  wrapped_ = false;
+}
+
+volatile bool &traceEnabled() {
+  static volatile bool enabled = false;
+  return enabled;
+}
+
+Trace::~Trace() {
+  for (std::vector<TraceBuffer *>::const_iterator it = buffers_.begin();
+      it != buffers_.end();
+      it++) {
+    delete *it;
+  }
+}
+
+Trace &Trace::Shared() {
+  static Poco::SingletonHolder<Trace> sh;
+  return *sh.get();
+}
+
+TraceBuffer *Trace::Buffer() {
+  TraceBuffer *&buffer = buffer_.get();
+  if (!buffer) {
+    Poco::FastMutex::ScopedLock lock(buffers_m_);
+    Poco::Thread *thread = Poco::Thread::current();
+    buffer = new TraceBuffer(static_cast<int>(buffers_.size()) + 1,
+                             thread ? thread->name() : "main");
+    buffers_.push_back(buffer);
+  }
+  return buffer;
+}
+
+std::string Trace::JSON(const std::size_t last_spans) {
+  JSONWriter writer;
+  writer.BeginObject();
+  writer.Key("traceEvents");
+  writer.BeginArray();
+
+  Poco::FastMutex::ScopedLock lock(buffers_m_);
+  std::vector<TraceEvent> events;
+  for (std::vector<TraceBuffer *>::const_iterator it = buffers_.begin();
+      it != buffers_.end();
+      it++) {
+    TraceBuffer *buffer = *it;
+
+    writer.BeginObject();
+    writer.String("name", "thread_name");
+    writer.String("ph", "M");
+    writer.Int("pid", 1);
+    writer.Int("tid", buffer->Tid());
+    writer.Key("args");
+    writer.BeginObject();
+    writer.String("name", buffer->ThreadName());
+    writer.EndObject();
+    writer.EndObject();
+
+    events.clear();
+    buffer->Events(&events);
+    if (last_spans && events.size() > last_spans) {
+      events.erase(events.begin(), events.end() - last_spans);
+    }
+    for (std::vector<TraceEvent>::const_iterator ev = events.begin();
+        ev != events.end();
+        ev++) {
+      writer.BeginObject();
+      writer.String("name", ev->name);
+      writer.String("cat", "kopsik");
+      writer.String("ph", "X");
+      writer.Int("ts", ev->start_micros);
+      writer.Int("dur", ev->duration_micros);
+      writer.Int("pid", 1);
+      writer.Int("tid", buffer->Tid());
+      writer.EndObject();
+    }
+  }
+
+  writer.EndArray();
+  writer.EndObject();
+  return writer.Buffer();
+}
+
+void Trace::Clear() {
+  Poco::FastMutex::ScopedLock lock(buffers_m_);
+  for (std::vector<TraceBuffer *>::const_iterator it = buffers_.begin();
+      it != buffers_.end();
+      it++) {
+    (*it)->Clear();
+  }
+}
+
+TraceSpan::TraceSpan(const char *name)
+  : name_(name), start_micros_(0) {
+  if (Trace::Enabled()) {
+    start_micros_ = Poco::Timestamp().epochMicroseconds();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (!start_micros_) {
+    return;
+  }
+  Poco::Int64 end_micros = Poco::Timestamp().epochMicroseconds();
+  Trace::Shared().Buffer()->Add(name_, start_micros_,
+                                end_micros - start_micros_);
+}
+
+}  // namespace kopsik
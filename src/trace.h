@@ -0,0 +1,108 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+#include <string>
+#include <vector>
+
+#include "./json_writer.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/ThreadLocal.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Spans each thread keeps, the oldest are overwritten
+  const std::size_t kTraceBufferSpans = 4096;
+
+  struct TraceEvent {
+    // A string literal, so recording doesn't allocate
+    const char *name;
+    Poco::Int64 start_micros;
+    Poco::Int64 duration_micros;
+  };
+
+  // Ring buffer of one thread's spans. Written by its own thread,
+  // read by whoever dumps the trace.
+  class TraceBuffer {
+  public:
+    TraceBuffer(const int tid, const std::string &thread_name);
+
+    void Add(const char *name,
+             const Poco::Int64 start_micros,
+             const Poco::Int64 duration_micros);
+
+    // Oldest first
+    void Events(std::vector<TraceEvent> *result);
+
+    void Clear();
+
+    int Tid() const { return tid_; }
+    const std::string &ThreadName() const { return thread_name_; }
+
+  private:
+    int tid_;
+    std::string thread_name_;
+    std::vector<TraceEvent> events_;
+    std::size_t next_;
+    bool wrapped_;
+    Poco::FastMutex m_;
+  };
+
+  // Read by every span, so it's kept out of the singleton,
+  // whose accessor takes a lock
+  volatile bool &traceEnabled();
+
+  // Where spans go. Off by default; a span only checks the flag
+  // then, so spans can stay in hot code.
+  class Trace {
+  public:
+    Trace() {}
+    ~Trace();
+
+    static Trace &Shared();
+
+    static bool Enabled() { return traceEnabled(); }
+    static void SetEnabled(const bool value) { traceEnabled() = value; }
+
+    // The calling thread's buffer. Buffers outlive their threads,
+    // so what a finished thread did can still be dumped.
+    TraceBuffer *Buffer();
+
+    // All threads' spans in the Chrome trace event format, for
+    // chrome://tracing and other viewers. With last_spans, only
+    // that many of each thread's latest spans.
+    std::string JSON(const std::size_t last_spans = 0);
+
+    void Clear();
+
+  private:
+    Poco::ThreadLocal<TraceBuffer *> buffer_;
+    std::vector<TraceBuffer *> buffers_;
+    Poco::FastMutex buffers_m_;
+
+    Trace(const Trace &);
+    Trace &operator=(const Trace &);
+  };
+
+  // Records the time it lived as a span of the calling thread,
+  // when tracing is on. Name must be a string literal.
+  class TraceSpan {
+  public:
+    explicit TraceSpan(const char *name);
+
+    ~TraceSpan();
+
+  private:
+    const char *name_;
+    Poco::Int64 start_micros_;
+
+    TraceSpan(const TraceSpan &);
+    TraceSpan &operator=(const TraceSpan &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TRACE_H_
@@ -0,0 +1,141 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./traffic_recorder.h"
+
+#include "Poco/Exception.h"
+#include "Poco/SingletonHolder.h"
+
+namespace kopsik {
+
+TrafficRecorder::TrafficRecorder()
+  : recording_(false)
+  , out_(0) {}
+
+TrafficRecorder::~TrafficRecorder() {
+  Stop();
+}
+
+TrafficRecorder &TrafficRecorder::Instance() {
+  static Poco::SingletonHolder<TrafficRecorder> sh;
+  return *sh.get();
+}
+
+error TrafficRecorder::Start(const std::string &path) {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  recording_ = false;
+  close();
+  try {
+    out_ = new Poco::FileOutputStream(path,
+                                      std::ios::out | std::ios::trunc);
+  } catch(const Poco::Exception &exc) {
+    return error("Cannot open " + path + " for recording traffic: "
+                 + exc.displayText());
+  }
+  started_.update();
+  recording_ = true;
+  return noError;
+}
+
+void TrafficRecorder::Stop() {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  recording_ = false;
+  close();
+}
+
+bool TrafficRecorder::IsRecording() const {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  return recording_;
+}
+
+void TrafficRecorder::RecordHTTP(
+    const std::string &method, const std::string &url,
+    const std::string &request_body, const Poco::Timestamp &request_started,
+    const error &err, const std::string &response_body) {
+  TrafficRecord record;
+  record.kind = kTrafficHTTP;
+  record.duration_micros = request_started.elapsed();
+  record.method = method;
+  record.url = url;
+  record.request_body = request_body;
+  record.err = err;
+  record.body = response_body;
+  write(&record, request_started);
+}
+
+void TrafficRecorder::RecordWebSocket(const std::string &message) {
+  TrafficRecord record;
+  record.kind = kTrafficWebSocket;
+  record.duration_micros = 0;
+  record.err = noError;
+  record.body = message;
+  write(&record, Poco::Timestamp());
+}
+
+error TrafficRecorder::Load(
+    const std::string &path, std::vector<TrafficRecord> *records) {
+  poco_assert(records);
+  Poco::FileInputStream *in = 0;
+  try {
+    in = new Poco::FileInputStream(path);
+  } catch(const Poco::Exception &exc) {
+    return error("Cannot open " + path + " for replaying traffic: "
+                 + exc.displayText());
+  }
+  std::string line("");
+  while (std::getline(*in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    JSONValue *root = JSONParse(line);
+    if (!root) {
+      delete in;
+      return error("Recorded traffic is not valid JSON: " + line);
+    }
+    TrafficRecord record;
+    record.at_micros = JSONInt(JSONGet(root, "at"));
+    record.kind = JSONString(JSONGet(root, "kind"));
+    record.duration_micros = JSONInt(JSONGet(root, "duration"));
+    record.method = JSONString(JSONGet(root, "method"));
+    record.url = JSONString(JSONGet(root, "url"));
+    record.request_body = JSONString(JSONGet(root, "request"));
+    record.err = JSONString(JSONGet(root, "error"));
+    record.body = JSONString(JSONGet(root, "body"));
+    JSONDelete(root);
+    records->push_back(record);
+  }
+  delete in;
+  return noError;
+}
+
+void TrafficRecorder::write(TrafficRecord *record, const Poco::Timestamp &at) {
+  Poco::Mutex::ScopedLock lock(mutex_);
+  if (!recording_) {
+    return;
+  }
+  record->at_micros = at - started_;
+
+  JSONWriter writer;
+  writer.BeginObject();
+  writer.Int("at", record->at_micros);
+  writer.String("kind", record->kind);
+  writer.Int("duration", record->duration_micros);
+  writer.String("method", record->method);
+  writer.String("url", record->url);
+  writer.String("request", record->request_body);
+  writer.String("error", record->err);
+  writer.String("body", record->body);
+  writer.EndObject();
+
+  *out_ << writer.Buffer() << '\n';
+  out_->flush();
+}
+
+void TrafficRecorder::close() {
+  if (out_) {
+    out_->close();
+    delete out_;
+    out_ = 0;
+  }
+}
+
+}  // namespace kopsik
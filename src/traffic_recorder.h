@@ -0,0 +1,93 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TRAFFIC_RECORDER_H_
+#define SRC_TRAFFIC_RECORDER_H_
+
+#include <string>
+#include <vector>
+
+#include "./json_reader.h"
+#include "./json_writer.h"
+#include "./types.h"
+
+#include "Poco/FileStream.h"
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  const std::string kTrafficHTTP("http");
+  const std::string kTrafficWebSocket("websocket");
+
+  // One request and its response, or one WebSocket message
+  typedef struct {
+    // Since recording started
+    Poco::Int64 at_micros;
+    // kTrafficHTTP or kTrafficWebSocket
+    std::string kind;
+    // How long the request took, 0 for messages
+    Poco::Int64 duration_micros;
+    std::string method;
+    std::string url;
+    std::string request_body;
+    // What the request returned, noError if it went through
+    error err;
+    // Response body, or the message
+    std::string body;
+  } TrafficRecord;
+
+  // Writes what HTTPSClient and WebSocketClient send and receive to a
+  // file as it happens, with timestamps, so a session from the field
+  // can be fed back with TrafficReplay. One JSON object per line.
+  // Bodies are recorded in full, so the file has the user's data and
+  // API token in it: only record when asked to.
+  class TrafficRecorder {
+  public:
+    TrafficRecorder();
+
+    ~TrafficRecorder();
+
+    static TrafficRecorder &Instance();
+
+    // Starts over in a new file
+    error Start(const std::string &path);
+
+    void Stop();
+
+    bool IsRecording() const;
+
+    void RecordHTTP(
+        const std::string &method,
+        const std::string &url,
+        const std::string &request_body,
+        const Poco::Timestamp &request_started,
+        const error &err,
+        const std::string &response_body);
+
+    void RecordWebSocket(const std::string &message);
+
+    // Records of a file written by Start, in the order they were
+    // written, which is the order the requests finished in
+    static error Load(
+        const std::string &path,
+        std::vector<TrafficRecord> *records);
+
+  private:
+    // Requests are placed at the time they started
+    void write(TrafficRecord *record, const Poco::Timestamp &at);
+
+    void close();
+
+    bool recording_;
+    Poco::Timestamp started_;
+    Poco::FileOutputStream *out_;
+    mutable Poco::Mutex mutex_;
+
+    TrafficRecorder(const TrafficRecorder &);
+    TrafficRecorder &operator=(const TrafficRecorder &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TRAFFIC_RECORDER_H_
@@ -0,0 +1,152 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./traffic_replay.h"
+
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+
+namespace kopsik {
+
+ReplayHTTPSClient::ReplayHTTPSClient(
+    const std::vector<TrafficRecord> &records, const double speed)
+  : HTTPSClient("https://localhost", "kopsik_replay", "0.1")
+  , records_(records)
+  , answered_(records.size(), false)
+  , speed_(speed)
+  , unanswered_(0) {}
+
+error ReplayHTTPSClient::PostJSON(
+    const std::string relative_url, const std::string &json,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password, std::string *response_body) {
+  return answer("POST", relative_url, response_body);
+}
+
+error ReplayHTTPSClient::GetJSON(
+    const std::string relative_url, const std::string basic_auth_username,
+    const std::string basic_auth_password, std::string *response_body) {
+  return answer("GET", relative_url, response_body);
+}
+
+error ReplayHTTPSClient::PostJSON(
+    const std::string relative_url, const RequestWriter *writer,
+    const std::string basic_auth_username,
+    const std::string basic_auth_password, std::string *response_body) {
+  return answer("POST", relative_url, response_body);
+}
+
+error ReplayHTTPSClient::GetJSON(
+    const std::string relative_url, const std::string basic_auth_username,
+    const std::string basic_auth_password, ResponseHandler *handler) {
+  poco_assert(handler);
+  std::string body("");
+  error err = answer("GET", relative_url, &body);
+  if (err == noError) {
+    handler->Consume(body.data(), body.size());
+  }
+  return err;
+}
+
+error ReplayHTTPSClient::ConditionalGetJSON(
+    const std::string relative_url, const std::string basic_auth_username,
+    const std::string basic_auth_password, HTTPValidators *validators,
+    std::string *response_body) {
+  poco_assert(validators);
+  error err = answer("GET", relative_url, response_body);
+  validators->not_modified = err == noError && response_body->empty();
+  return err;
+}
+
+Poco::UInt64 ReplayHTTPSClient::Unanswered() {
+  Poco::FastMutex::ScopedLock lock(m_);
+  return unanswered_;
+}
+
+error ReplayHTTPSClient::answer(
+    const std::string &method, const std::string &relative_url,
+    std::string *response_body) {
+  poco_assert(response_body);
+  *response_body = "";
+
+  const TrafficRecord *record = 0;
+  {
+    Poco::FastMutex::ScopedLock lock(m_);
+    std::size_t found = find(method, relative_url, false);
+    if (found == records_.size()) {
+      found = find(method, relative_url, true);
+    }
+    if (found < records_.size()) {
+      answered_[found] = true;
+      record = &records_[found];
+    } else {
+      unanswered_++;
+      return error("No recorded response to " + method + " "
+                   + relative_url);
+    }
+  }
+
+  if (speed_ > 0) {
+    Poco::Thread::sleep(static_cast<long>(  // NOLINT
+      record->duration_micros / speed_ / 1000));
+  }
+  *response_body = record->body;
+  return record->err;
+}
+
+std::size_t ReplayHTTPSClient::find(
+    const std::string &method, const std::string &relative_url,
+    const bool path_only) const {
+  std::string path(relative_url.substr(0, relative_url.find('?')));
+  for (std::size_t i = 0; i < records_.size(); i++) {
+    const TrafficRecord &record = records_[i];
+    if (answered_[i]
+        || kTrafficHTTP != record.kind
+        || method != record.method) {
+      continue;
+    }
+    if (path_only
+        ? path == record.url.substr(0, record.url.find('?'))
+        : relative_url == record.url) {
+      return i;
+    }
+  }
+  return records_.size();
+}
+
+TrafficReplay::TrafficReplay(
+    const std::vector<TrafficRecord> &records, const double speed)
+  : records_(records)
+  , speed_(speed)
+  , client_(records, speed) {}
+
+void TrafficReplay::Run(Context *context) {
+  poco_assert(context);
+  context->SetHTTPSClient(&client_);
+
+  Poco::Timestamp started;
+  for (std::vector<TrafficRecord>::const_iterator it = records_.begin();
+      it != records_.end();
+      it++) {
+    if (kTrafficWebSocket != it->kind) {
+      continue;
+    }
+    if (speed_ > 0) {
+      Poco::Timestamp::TimeDiff wait =
+        static_cast<Poco::Timestamp::TimeDiff>(it->at_micros / speed_)
+        - started.elapsed();
+      if (wait > 0) {
+        Poco::Thread::sleep(static_cast<long>(wait / 1000));  // NOLINT
+      }
+    }
+    JSONValue *root = JSONParse(it->body);
+    if (!root) {
+      continue;
+    }
+    if ("data" == WebSocketClient::MessageType(root)) {
+      context->LoadUpdateFromJSONNode(root);
+    }
+    JSONDelete(root);
+  }
+}
+
+}  // namespace kopsik
@@ -0,0 +1,113 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_TRAFFIC_REPLAY_H_
+#define SRC_TRAFFIC_REPLAY_H_
+
+#include <string>
+#include <vector>
+
+#include "./context.h"
+#include "./https_client.h"
+#include "./json_reader.h"
+#include "./traffic_recorder.h"
+#include "./websocket_client.h"
+
+#include "Poco/Mutex.h"
+
+namespace kopsik {
+
+  // Answers requests with the responses TrafficRecorder recorded.
+  // A request gets the first response to the same method and URL not
+  // given out yet, or failing that to the same path with another
+  // query (since= differs from run to run). It comes after as long as
+  // the request took when it was recorded, divided by speed. Speed 0
+  // answers right away.
+  class ReplayHTTPSClient : public HTTPSClient {
+  public:
+    ReplayHTTPSClient(
+        const std::vector<TrafficRecord> &records,
+        const double speed);
+
+    error PostJSON(
+        const std::string relative_url,
+        const std::string &json,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        std::string *response_body);
+
+    error GetJSON(
+        const std::string relative_url,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        std::string *response_body);
+
+    error PostJSON(
+        const std::string relative_url,
+        const RequestWriter *writer,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        std::string *response_body);
+
+    error GetJSON(
+        const std::string relative_url,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        ResponseHandler *handler);
+
+    // A recorded 304 has no body
+    error ConditionalGetJSON(
+        const std::string relative_url,
+        const std::string basic_auth_username,
+        const std::string basic_auth_password,
+        HTTPValidators *validators,
+        std::string *response_body);
+
+    // Requests there was no recorded response left for
+    Poco::UInt64 Unanswered();
+
+  private:
+    error answer(
+        const std::string &method,
+        const std::string &relative_url,
+        std::string *response_body);
+
+    // Index of the first record not answered yet that matches,
+    // or the number of records
+    std::size_t find(
+        const std::string &method,
+        const std::string &relative_url,
+        const bool path_only) const;
+
+    const std::vector<TrafficRecord> records_;
+    std::vector<bool> answered_;
+    double speed_;
+    Poco::UInt64 unanswered_;
+    Poco::FastMutex m_;
+  };
+
+  // Feeds a recorded session back into a context, to reproduce and
+  // measure what it did in the field. WebSocket messages arrive when
+  // they did, divided by speed (0 for no waiting at all), and the
+  // requests the context makes meanwhile are answered from the
+  // recording. The context is expected to be logged in already.
+  class TrafficReplay {
+  public:
+    TrafficReplay(
+        const std::vector<TrafficRecord> &records,
+        const double speed);
+
+    ReplayHTTPSClient *HTTPS() { return &client_; }
+
+    // Returns once the last message has been handed over. What the
+    // context does with it may still be going on.
+    void Run(Context *context);
+
+  private:
+    const std::vector<TrafficRecord> records_;
+    double speed_;
+    ReplayHTTPSClient client_;
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_TRAFFIC_REPLAY_H_
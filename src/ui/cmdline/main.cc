@@ -2,16 +2,190 @@
 
 #include "./main.h"
 
+#include <signal.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
 #include <sstream>
 
+#include "../../ipc_service.h"
+#include "../../json_reader.h"
+
+#include "Poco/FileStream.h"
 #include "Poco/Message.h"
+#include "Poco/StreamCopier.h"
+#include "Poco/Timestamp.h"
 #include "Poco/Util/Application.h"
 
 #define ERRLEN 1024
 
+// Every C++ allocation is counted, for the profile command.
+// Allocations made by C libraries (SQLite, libjson) are not.
+static volatile Poco::Int64 allocation_count = 0;
+static volatile Poco::Int64 allocation_bytes = 0;
+
+// Dynamic exception specifications are gone from C++17, the default
+// of newer compilers.
+#if __cplusplus < 201103L
+void *operator new(std::size_t size) throw(std::bad_alloc) {
+#else
+void *operator new(std::size_t size) {
+#endif
+  __sync_fetch_and_add(&allocation_count, 1);
+  __sync_fetch_and_add(&allocation_bytes, static_cast<Poco::Int64>(size));
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) throw() {
+  free(p);
+}
+
+void operator delete(void *p, std::size_t) throw() {
+  free(p);
+}
+
 namespace command_line_client {
 
 bool syncing = false;
+// Model changes aren't printed while profiling
+bool profiling = false;
+
+// Daemon mode. Callbacks aren't told which account they're for,
+// so they're only counted.
+volatile sig_atomic_t daemon_stopping = 0;
+static volatile Poco::Int64 daemon_changes = 0;
+static volatile Poco::Int64 daemon_errors = 0;
+
+// Accounts are started this far apart, so their first full syncs
+// don't all hit the server at once
+const long kDaemonStartIntervalMillis = 200;  // NOLINT
+// How often the daemon prints what it has seen
+const int kDaemonStatusIntervalSeconds = 60;
+// SQLite page cache of each account, kept small since there are
+// hundreds of them and they're mostly idle
+const unsigned int kDaemonCacheSizeKiB = 512;
+
+// Resources used by the process so far
+struct Usage {
+  Poco::Timestamp at;
+  Poco::Int64 cpu_micros;
+  Poco::Int64 allocations;
+  Poco::Int64 allocated_bytes;
+  Poco::Int64 peak_rss_kb;
+
+  static Usage Now() {
+    Usage usage;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    usage.cpu_micros =
+      (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * Poco::Int64(1000000)
+      + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    usage.allocations = allocation_count;
+    usage.allocated_bytes = allocation_bytes;
+#ifdef __APPLE__
+    usage.peak_rss_kb = ru.ru_maxrss / 1024;
+#else
+    usage.peak_rss_kb = ru.ru_maxrss;
+#endif
+    return usage;
+  }
+};
+
+void print_profile_header() {
+  std::cout << std::left << std::setw(12) << "stage" << std::right
+            << std::setw(11) << "wall ms"
+            << std::setw(11) << "cpu ms"
+            << std::setw(13) << "allocs"
+            << std::setw(13) << "alloc KB"
+            << std::setw(15) << "peak RSS KB"
+            << std::endl;
+}
+
+// What the stage used since start
+void print_profile_stage(const std::string name, const Usage &start) {
+  Usage end = Usage::Now();
+  std::cout << std::left << std::setw(12) << name << std::right
+            << std::fixed << std::setprecision(1)
+            << std::setw(11) << (end.at - start.at) / 1000.0
+            << std::setw(11) << (end.cpu_micros - start.cpu_micros) / 1000.0
+            << std::setw(13) << end.allocations - start.allocations
+            << std::setw(13)
+            << (end.allocated_bytes - start.allocated_bytes) / 1024
+            << std::setw(15) << end.peak_rss_kb
+            << std::endl;
+}
+
+// Statements shown by the profile command
+const std::size_t kProfileStatements = 10;
+
+struct StatementTime {
+  std::string sql;
+  Poco::Int64 count;
+  Poco::Int64 total_micros;
+  Poco::Int64 max_micros;
+
+  bool operator<(const StatementTime &other) const {
+    return total_micros > other.total_micros;
+  }
+};
+
+// The SQL statements that took the most time in all, from the
+// "sql." latencies of the library's metrics
+void print_profile_statements(void *ctx) {
+  char errmsg[ERRLEN];
+  char *json = 0;
+  if (KOPSIK_API_SUCCESS != kopsik_get_metrics(ctx, errmsg, ERRLEN, &json)) {
+    std::cerr << errmsg << std::endl;
+    return;
+  }
+  std::vector<StatementTime> statements;
+  kopsik::JSONValue *root = kopsik::JSONParse(json);
+  kopsik_metrics_clear(json);
+  if (!root) {
+    return;
+  }
+  kopsik::JSONValue *latencies = kopsik::JSONGet(root, "latencies");
+  for (std::size_t i = 0; latencies && i < kopsik::JSONSize(latencies); i++) {
+    kopsik::JSONValue *latency = kopsik::JSONAt(latencies, i);
+    std::string key(kopsik::JSONName(latency));
+    if (key.find("sql.") != 0) {
+      continue;
+    }
+    StatementTime statement;
+    statement.sql = key.substr(4);
+    statement.count = kopsik::JSONInt(kopsik::JSONGet(latency, "count"));
+    statement.total_micros =
+      kopsik::JSONInt(kopsik::JSONGet(latency, "total_us"));
+    statement.max_micros =
+      kopsik::JSONInt(kopsik::JSONGet(latency, "max_us"));
+    statements.push_back(statement);
+  }
+  kopsik::JSONDelete(root);
+
+  std::sort(statements.begin(), statements.end());
+  std::cout << std::endl << std::right
+            << std::setw(9) << "count"
+            << std::setw(11) << "total ms"
+            << std::setw(9) << "max ms"
+            << "  statement" << std::endl;
+  for (std::size_t i = 0;
+      i < statements.size() && i < kProfileStatements;
+      i++) {
+    const StatementTime &statement = statements[i];
+    std::cout << std::fixed << std::setprecision(1)
+              << std::setw(9) << statement.count
+              << std::setw(11) << statement.total_micros / 1000.0
+              << std::setw(9) << statement.max_micros / 1000.0
+              << "  " << statement.sql << std::endl;
+  }
+}
 
 std::string model_change_to_string(
     KopsikModelChange &change) {
@@ -33,16 +207,46 @@ void main_change_callback(
               << std::endl;
     return;
   }
+  if (profiling) {
+    return;
+  }
   std::cout << "main_change_callback change="
             << model_change_to_string(*change)
             << std::endl;
 }
 
+void daemon_change_callback(
+    kopsik_api_result result,
+    const char *errmsg,
+    KopsikModelChange *change) {
+  if (KOPSIK_API_SUCCESS != result) {
+    __sync_fetch_and_add(&daemon_errors, 1);
+    return;
+  }
+  __sync_fetch_and_add(&daemon_changes, 1);
+}
+
+void daemon_on_error_callback(
+    const char *errmsg) {
+  __sync_fetch_and_add(&daemon_errors, 1);
+  std::cerr << "daemon_on_error_callback errmsg="
+            << std::string(errmsg)
+            << std::endl;
+}
+
+void daemon_online_callback() {
+}
+
+void daemon_stop(int signal) {
+  daemon_stopping = 1;
+}
+
 void main_on_error_callback(
     const char *errmsg) {
   std::cerr << "main_on_error_callback errmsg="
             << std::string(errmsg)
             << std::endl;
+  syncing = false;
 }
 
 void main_check_updates_callback(
@@ -65,7 +269,10 @@ void main_check_updates_callback(
 }
 
 void main_online_callback() {
-  std::cout << "main_online_callback" << std::endl;
+  if (!profiling) {
+    std::cout << "main_online_callback" << std::endl;
+  }
+  syncing = false;
 }
 
 void on_sync_result(
@@ -115,7 +322,9 @@ void Main::initialize(Poco::Util::Application &self) { // NOLINT
 
 void Main::usage() const {
   std::cout << "Recognized commands are: "
-    "sync, start, stop, status, pushable, list, continue, listen"
+    "sync, start, stop, status, pushable, list, continue, listen, "
+    "profile [db path] [api url], daemon <accounts file>, serve, "
+    "remote <running|list|stop|sync|listen>"
     << std::endl;
 }
 
@@ -189,6 +398,18 @@ int Main::main(const std::vector<std::string>& args) {
     return Poco::Util::Application::EXIT_USAGE;
   }
 
+  // Has a token per account
+  if ("daemon" == args[0]) {
+    Poco::ErrorHandler::set(this);
+    return daemon(args);
+  }
+
+  // Talks to the serve command, which has the token
+  if ("remote" == args[0]) {
+    Poco::ErrorHandler::set(this);
+    return remote(args);
+  }
+
   char* apitoken = getenv("TOGGL_API_TOKEN");
   if (!apitoken) {
     std::cerr << "Please set TOGGL_API_TOKEN in environment"
@@ -196,6 +417,13 @@ int Main::main(const std::vector<std::string>& args) {
     return Poco::Util::Application::EXIT_USAGE;
   }
 
+  Poco::ErrorHandler::set(this);
+
+  // Times the session start as well
+  if ("profile" == args[0]) {
+    return profile(args, apitoken);
+  }
+
   char errmsg[ERRLEN];
   if (KOPSIK_API_SUCCESS != kopsik_set_db_path(
       ctx_, errmsg, ERRLEN, "kopsik.db")) {
@@ -203,8 +431,6 @@ int Main::main(const std::vector<std::string>& args) {
     return Poco::Util::Application::EXIT_SOFTWARE;
   }
 
-  Poco::ErrorHandler::set(this);
-
   // Start session in lib
   if (KOPSIK_API_SUCCESS != kopsik_set_api_token(
       ctx_, errmsg, ERRLEN, apitoken)) {
@@ -246,6 +472,9 @@ int Main::main(const std::vector<std::string>& args) {
   if ("continue" == args[0]) {
     return continueTimeEntry();
   }
+  if ("serve" == args[0]) {
+    return serve();
+  }
 
   usage();
   return Poco::Util::Application::EXIT_USAGE;
@@ -341,4 +570,246 @@ int Main::stopTimeEntry() {
   return Poco::Util::Application::EXIT_OK;
 }
 
+int Main::profile(
+    const std::vector<std::string>& args,
+    const std::string apitoken) {
+  std::string db_path(args.size() > 1 ? args[1] : "kopsik.db");
+  if (args.size() > 2) {
+    kopsik_set_api_url(ctx_, args[2].c_str());
+  }
+
+  profiling = true;
+  char errmsg[ERRLEN];
+  print_profile_header();
+
+  // Open the database and load the user of the session
+  Usage start = Usage::Now();
+  if (KOPSIK_API_SUCCESS != kopsik_set_db_path(
+      ctx_, errmsg, ERRLEN, db_path.c_str())) {
+    std::cerr << errmsg << std::endl;
+    return Poco::Util::Application::EXIT_SOFTWARE;
+  }
+  if (KOPSIK_API_SUCCESS != kopsik_set_api_token(
+      ctx_, errmsg, ERRLEN, apitoken.c_str())) {
+    std::cerr << errmsg << std::endl;
+    return Poco::Util::Application::EXIT_SOFTWARE;
+  }
+  KopsikUser *user = kopsik_user_init();
+  if (KOPSIK_API_SUCCESS != kopsik_current_user(
+      ctx_, errmsg, ERRLEN, user)) {
+    std::cerr << std::string(errmsg) << std::endl;
+    kopsik_user_clear(user);
+    return Poco::Util::Application::EXIT_SOFTWARE;
+  }
+  kopsik_user_clear(user);
+  print_profile_stage("load", start);
+
+  // The rest of the user's data is loaded in the background,
+  // ahead of the sync, so it adds to the sync stage
+  start = Usage::Now();
+  syncing = true;
+  kopsik_sync(ctx_);
+  while (syncing) {
+    Poco::Thread::sleep(10);
+  }
+  print_profile_stage("full sync", start);
+
+  start = Usage::Now();
+  if (KOPSIK_API_SUCCESS != kopsik_save(ctx_, errmsg, ERRLEN)) {
+    std::cerr << errmsg << std::endl;
+    return Poco::Util::Application::EXIT_SOFTWARE;
+  }
+  print_profile_stage("save", start);
+
+  start = Usage::Now();
+  KopsikTimeEntryViewItem *first = 0;
+  if (KOPSIK_API_SUCCESS != kopsik_time_entry_view_items(
+      ctx_, errmsg, ERRLEN, &first)) {
+    std::cerr << std::string(errmsg) << std::endl;
+    kopsik_time_entry_view_item_clear(first);
+    return Poco::Util::Application::EXIT_SOFTWARE;
+  }
+  kopsik_time_entry_view_item_clear(first);
+  print_profile_stage("view items", start);
+
+  start = Usage::Now();
+  KopsikAutocompleteItem *items = 0;
+  if (KOPSIK_API_SUCCESS != kopsik_autocomplete_items(
+      ctx_, errmsg, ERRLEN, &items, 1, 1, 1)) {
+    std::cerr << std::string(errmsg) << std::endl;
+    kopsik_autocomplete_item_clear(items);
+    return Poco::Util::Application::EXIT_SOFTWARE;
+  }
+  kopsik_autocomplete_item_clear(items);
+  print_profile_stage("autocomplete", start);
+
+  print_profile_statements(ctx_);
+
+  return Poco::Util::Application::EXIT_OK;
+}
+
+// Keeps the accounts listed in the accounts file in sync, each with
+// its own database, in one process. The contexts share the worker
+// pools, the timer, the WebSocket reactor and the TLS sessions of the
+// library, so an account mostly costs its database and its socket.
+// Each line of the file is an API token and the database path of the
+// account, separated by whitespace. Empty lines and lines starting
+// with # are skipped. Runs until interrupted.
+int Main::daemon(const std::vector<std::string>& args) {
+  if (args.size() < 2) {
+    usage();
+    return Poco::Util::Application::EXIT_USAGE;
+  }
+  std::string list("");
+  try {
+    Poco::FileInputStream fis(args[1]);
+    Poco::StreamCopier::copyToString(fis, list);
+  } catch(const Poco::Exception& exc) {
+    std::cerr << exc.displayText() << std::endl;
+    return Poco::Util::Application::EXIT_NOINPUT;
+  }
+  std::istringstream accounts(list);
+
+  signal(SIGINT, daemon_stop);
+  signal(SIGTERM, daemon_stop);
+
+  std::vector<void *> contexts;
+  std::string line("");
+  while (!daemon_stopping && std::getline(accounts, line)) {
+    std::istringstream fields(line);
+    std::string apitoken("");
+    std::string db_path("");
+    fields >> apitoken >> db_path;
+    if (apitoken.empty() || '#' == apitoken[0]) {
+      continue;
+    }
+    if (db_path.empty()) {
+      std::cerr << "No database path for the account on: " << line
+                << std::endl;
+      continue;
+    }
+
+    void *ctx = kopsik_context_init(
+      "cmdline",
+      "0.0.1",
+      daemon_change_callback,
+      daemon_on_error_callback,
+      main_check_updates_callback,
+      daemon_online_callback);
+    char errmsg[ERRLEN];
+    KopsikUser *user = kopsik_user_init();
+    if (KOPSIK_API_SUCCESS != kopsik_set_db_tuning(
+          ctx, errmsg, ERRLEN, 1, 0, kDaemonCacheSizeKiB, 0, 0)
+        || KOPSIK_API_SUCCESS != kopsik_set_db_path(
+          ctx, errmsg, ERRLEN, db_path.c_str())
+        || KOPSIK_API_SUCCESS != kopsik_set_api_token(
+          ctx, errmsg, ERRLEN, apitoken.c_str())
+        || KOPSIK_API_SUCCESS != kopsik_current_user(
+          ctx, errmsg, ERRLEN, user)) {
+      std::cerr << db_path << ": " << errmsg << std::endl;
+      kopsik_user_clear(user);
+      kopsik_context_clear(ctx);
+      continue;
+    }
+    kopsik_user_clear(user);
+
+    kopsik_websocket_switch(ctx, 1);
+    kopsik_sync(ctx);
+    contexts.push_back(ctx);
+
+    Poco::Thread::sleep(kDaemonStartIntervalMillis);
+  }
+  std::cout << "Keeping " << contexts.size() << " accounts in sync"
+            << std::endl;
+
+  int seconds(0);
+  while (!daemon_stopping) {
+    Poco::Thread::sleep(1000);
+    if (++seconds % kDaemonStatusIntervalSeconds) {
+      continue;
+    }
+    Usage usage = Usage::Now();
+    std::cout << "accounts=" << contexts.size()
+              << " changes=" << daemon_changes
+              << " errors=" << daemon_errors
+              << " peak_rss_kb=" << usage.peak_rss_kb
+              << std::endl;
+  }
+
+  std::cout << "Stopping" << std::endl;
+  for (std::vector<void *>::const_iterator it = contexts.begin();
+      it != contexts.end();
+      it++) {
+    kopsik_websocket_switch(*it, 0);
+  }
+  for (std::vector<void *>::const_iterator it = contexts.begin();
+      it != contexts.end();
+      it++) {
+    kopsik_context_clear(*it);
+  }
+  return Poco::Util::Application::EXIT_OK;
+}
+
+// Keeps the database in sync and serves it to the remote command, and
+// any other client of the IPC service, until interrupted
+int Main::serve() {
+  char errmsg[ERRLEN];
+  if (KOPSIK_API_SUCCESS != kopsik_ipc_serve(
+      ctx_, errmsg, ERRLEN, "kopsik.db")) {
+    std::cerr << errmsg << std::endl;
+    return Poco::Util::Application::EXIT_SOFTWARE;
+  }
+
+  signal(SIGINT, daemon_stop);
+  signal(SIGTERM, daemon_stop);
+
+  kopsik_websocket_switch(ctx_, 1);
+  kopsik_sync(ctx_);
+  std::cout << "Serving kopsik.db" << std::endl;
+  while (!daemon_stopping) {
+    Poco::Thread::sleep(1000);
+  }
+
+  std::cout << "Stopping" << std::endl;
+  kopsik_websocket_switch(ctx_, 0);
+  kopsik_ipc_stop(ctx_);
+  return Poco::Util::Application::EXIT_OK;
+}
+
+// Sends a request to the serve command and prints its answer as it
+// comes. "listen" prints the model changes until interrupted.
+int Main::remote(const std::vector<std::string>& args) {
+  if (args.size() < 2) {
+    usage();
+    return Poco::Util::Application::EXIT_USAGE;
+  }
+
+  kopsik::IpcClient client;
+  kopsik::error err = client.Connect("kopsik.db");
+  if (err != kopsik::noError) {
+    std::cerr << err << std::endl;
+    return Poco::Util::Application::EXIT_UNAVAILABLE;
+  }
+
+  bool listen("listen" == args[1]);
+  kopsik::JSONWriter request;
+  request.BeginObject();
+  request.Int("id", 1);
+  request.String("method", listen ? "subscribe" : args[1]);
+  request.EndObject();
+
+  std::string response("");
+  err = client.Call(request.Buffer(), &response);
+  if (err != kopsik::noError) {
+    std::cerr << err << std::endl;
+    return Poco::Util::Application::EXIT_UNAVAILABLE;
+  }
+  std::cout << response << std::endl;
+
+  while (listen && client.Receive(&response) == kopsik::noError) {
+    std::cout << response << std::endl;
+  }
+  return Poco::Util::Application::EXIT_OK;
+}
+
 }  // namespace command_line_client
@@ -46,6 +46,12 @@ class Main : public Poco::Util::Application, Poco::ErrorHandler {
     int listTimeEntries();
     int startTimeEntry();
     int stopTimeEntry();
+    int profile(
+      const std::vector<std::string>& args,
+      const std::string apitoken);
+    int daemon(const std::vector<std::string>& args);
+    int serve();
+    int remote(const std::vector<std::string>& args);
 
     static std::string modelChangeToString(KopsikModelChange * const);
     static std::string timeEntryToString(KopsikTimeEntryViewItem * const);
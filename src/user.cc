@@ -2,24 +2,31 @@
 
 #include "./user.h"
 
+#include <set>
 #include <sstream>
 
+#include "./const.h"
 #include "./version.h"
 #include "./formatter.h"
 #include "./json.h"
+#include "./log.h"
+#include "./memory_usage.h"
+#include "./metrics.h"
+#include "./trace.h"
 
 #include "Poco/Logger.h"
 #include "Poco/Stopwatch.h"
 
 namespace kopsik {
 
+static LogComponent log_user = { "user", 0 };
+
+LogComponent *User::logComponent() const {
+  return &log_user;
+}
+
 void User::ActiveProjects(std::vector<Project *> *list) const {
-  for (unsigned int i = 0; i < related.Projects.size(); i++) {
-    kopsik::Project *p = related.Projects[i];
-    if (p->Active()) {
-      list->push_back(p);
-    }
-  }
+  related.Buckets.ActiveProjects(list);
 }
 
 Project *User::AddProject(
@@ -33,6 +40,7 @@ Project *User::AddProject(
   p->SetUID(ID());
   p->SetActive(true);
   related.Projects.push_back(p);
+  related.Track(p);
   return p;
 }
 
@@ -83,6 +91,7 @@ TimeEntry *User::Start(
   te->SetUIModifiedAt(time(0));
 
   related.TimeEntries.push_back(te);
+  related.Track(te);
   return te;
 }
 
@@ -108,38 +117,74 @@ TimeEntry *User::Continue(const std::string GUID) {
     te->SetCreatedWith(kopsik::UserAgent(app_name_, app_version_));
     te->SetDurationInSeconds(-time(0));
     te->SetBillable(existing->Billable());
-    te->SetTags(existing->Tags());
+    te->SetTagIDs(existing->TagIDs());
     related.TimeEntries.push_back(te);
+    related.Track(te);
   }
   te->SetUIModifiedAt(time(0));
   return te;
 }
 
 TimeEntry *User::Latest() const {
+  if (related.DayTotalsComplete()) {
+    return related.TimeEntryDayTotals.Latest();
+  }
   if (related.TimeEntries.empty()) {
     return 0;
   }
-  std::vector<TimeEntry *> list(related.TimeEntries);
-  std::sort(list.begin(), list.end(), CompareTimeEntriesByStart);
-  return list[0];
+  TimeEntryFieldsPtr fields = related.TimeEntryFields.Refresh();
+  const std::vector<Poco::UInt64> &starts = fields->Starts;
+  std::size_t latest = 0;
+  for (std::size_t i = 1; i < starts.size(); i++) {
+    if (starts[i] > starts[latest]) {
+      latest = i;
+    }
+  }
+  return related.TimeEntries[latest];
+}
+
+void User::TimeEntriesBetween(
+    const Poco::UInt64 from,
+    const Poco::UInt64 to,
+    std::vector<TimeEntry *> *result) const {
+  poco_assert(result);
+  related.TimeEntryRanges.Refresh();
+  std::vector<std::size_t> positions;
+  related.TimeEntryRanges.Overlapping(from, to, &positions);
+  for (std::vector<std::size_t>::const_iterator it = positions.begin();
+      it != positions.end();
+      it++) {
+    result->push_back(related.TimeEntries[*it]);
+  }
+}
+
+void User::OverlappingTimeEntries(
+    TimeEntry *te,
+    std::vector<TimeEntry *> *result) const {
+  poco_assert(te);
+  poco_assert(result);
+  if (te->DeletedAt() || !te->Start()) {
+    return;
+  }
+  std::vector<TimeEntry *> found;
+  TimeEntriesBetween(te->Start(), TimeEntryIntervals::End(te), &found);
+  for (std::vector<TimeEntry *>::const_iterator it = found.begin();
+      it != found.end();
+      it++) {
+    if (*it != te) {
+      result->push_back(*it);
+    }
+  }
 }
 
 std::string User::DateDuration(TimeEntry * const te) const {
-    Poco::Int64 date_duration(0);
-    std::string date_header = te->DateHeaderString();
-    for (std::vector<TimeEntry *>::const_iterator it =
-            related.TimeEntries.begin();
-            it != related.TimeEntries.end();
-            it++) {
-        TimeEntry *n = *it;
-        if (n->DateHeaderString() == date_header) {
-            Poco::Int64 duration = n->DurationInSeconds();
-            if (duration > 0) {
-                date_duration += duration;
-            }
-        }
+    if (related.DayTotalsComplete()) {
+        return Formatter::FormatDurationInSecondsHHMMSS(
+            related.TimeEntryDayTotals.Seconds(te->Day()));
     }
-    return Formatter::FormatDurationInSecondsHHMMSS(date_duration);
+    TimeEntryFieldsPtr fields = related.TimeEntryFields.Refresh();
+    return Formatter::FormatDurationInSecondsHHMMSS(
+        fields->DaySeconds(te->Day()));
 }
 
 bool User::HasPremiumWorkspaces() const {
@@ -156,7 +201,7 @@ bool User::HasPremiumWorkspaces() const {
     return false;
 }
 
-void User::SetFullname(const std::string value) {
+void User::SetFullname(const std::string &value) {
   if (fullname_ != value) {
     fullname_ = value;
     SetDirty();
@@ -177,14 +222,14 @@ void User::SetRecordTimeline(const bool value) {
     }
 }
 
-void User::SetEmail(const std::string value) {
+void User::SetEmail(const std::string &value) {
   if (email_ != value) {
     email_ = value;
     SetDirty();
   }
 }
 
-void User::SetAPIToken(const std::string value) {
+void User::SetAPIToken(const std::string &value) {
     if (api_token_ != value) {
         api_token_ = value;
         SetDirty();
@@ -224,9 +269,7 @@ std::vector<TimeEntry *> User::Stop() {
 TimeEntry *User::SplitAt(const Poco::Int64 at) {
   poco_assert(at > 0);
 
-  std::stringstream ss;
-  ss << "User is splitting running time entry at " << at;
-  logger().debug(ss.str());
+  KOPSIK_LOG_DEBUG(logger(), "User is splitting running time entry at " << at);
 
   TimeEntry *running = RunningTimeEntry();
   if (!running) {
@@ -248,15 +291,14 @@ TimeEntry *User::SplitAt(const Poco::Int64 at) {
   poco_assert(te->DurationInSeconds() < 0);
 
   related.TimeEntries.push_back(te);
+  related.Track(te);
   return te;
 }
 
 TimeEntry *User::StopAt(const Poco::Int64 at) {
   poco_assert(at > 0);
 
-  std::stringstream ss;
-  ss << "User is stopping running time entry at " << at;
-  logger().debug(ss.str());
+  KOPSIK_LOG_DEBUG(logger(), "User is stopping running time entry at " << at);
 
   TimeEntry *running = RunningTimeEntry();
   if (running) {
@@ -266,15 +308,15 @@ TimeEntry *User::StopAt(const Poco::Int64 at) {
 }
 
 TimeEntry *User::RunningTimeEntry() const {
-    for (std::vector<TimeEntry *>::const_iterator it =
-            related.TimeEntries.begin();
-            it != related.TimeEntries.end();
-            it++) {
-        if ((*it)->DurationInSeconds() < 0) {
-            return *it;
-        }
+    if (related.DayTotalsComplete()) {
+        return related.TimeEntryDayTotals.Running();
     }
-    return 0;
+    TimeEntryFieldsPtr fields = related.TimeEntryFields.Refresh();
+    std::size_t i = fields->Running();
+    if (i == related.TimeEntries.size()) {
+        return 0;
+    }
+    return related.TimeEntries[i];
 }
 
 void User::ClearTasks() {
@@ -282,9 +324,11 @@ void User::ClearTasks() {
             related.Tasks.begin();
             it != related.Tasks.end();
             it++) {
+        related.Untrack(*it);
         delete *it;
     }
-    related.Tasks.clear();
+    std::vector<Task *>().swap(related.Tasks);
+    related.TaskIndex.Clear();
 }
 
 void User::ClearTags() {
@@ -292,9 +336,11 @@ void User::ClearTags() {
             related.Tags.begin();
             it != related.Tags.end();
             it++) {
+        related.Untrack(*it);
         delete *it;
     }
-    related.Tags.clear();
+    std::vector<Tag *>().swap(related.Tags);
+    related.TagIndex.Clear();
 }
 
 void User::ClearClients() {
@@ -302,9 +348,11 @@ void User::ClearClients() {
             related.Clients.begin();
             it != related.Clients.end();
             it++) {
+        related.Untrack(*it);
         delete *it;
     }
-    related.Clients.clear();
+    std::vector<Client *>().swap(related.Clients);
+    related.ClientIndex.Clear();
 }
 
 void User::ClearTimeEntries() {
@@ -312,9 +360,11 @@ void User::ClearTimeEntries() {
             related.TimeEntries.begin();
             it != related.TimeEntries.end();
             it++) {
+        related.Untrack(*it);
         delete *it;
     }
-    related.TimeEntries.clear();
+    std::vector<TimeEntry *>().swap(related.TimeEntries);
+    related.TimeEntryIndex.Clear();
 }
 
 void User::ClearWorkspaces() {
@@ -322,9 +372,11 @@ void User::ClearWorkspaces() {
             related.Workspaces.begin();
             it != related.Workspaces.end();
             it++) {
+        related.Untrack(*it);
         delete *it;
     }
-    related.Workspaces.clear();
+    std::vector<Workspace *>().swap(related.Workspaces);
+    related.WorkspaceIndex.Clear();
 }
 
 void User::ClearProjects() {
@@ -332,98 +384,107 @@ void User::ClearProjects() {
             related.Projects.begin();
             it != related.Projects.end();
             it++) {
+        related.Untrack(*it);
         delete *it;
     }
-    related.Projects.clear();
+    std::vector<Project *>().swap(related.Projects);
+    related.ProjectIndex.Clear();
 }
 
 Task *User::GetTaskByID(const Poco::UInt64 id) const {
     poco_assert(id > 0);
-    for (std::vector<Task *>::const_iterator it = related.Tasks.begin();
-            it != related.Tasks.end(); it++) {
-        if ((*it)->ID() == id) {
-            return *it;
-        }
-    }
-    return 0;
+    return related.TaskIndex.ByID(id);
 }
 
 Client *User::GetClientByID(const Poco::UInt64 id) const {
     poco_assert(id > 0);
-    for (std::vector<Client *>::const_iterator it = related.Clients.begin();
-            it != related.Clients.end(); it++) {
-        if ((*it)->ID() == id) {
-            return *it;
-        }
-    }
-    return 0;
+    return related.ClientIndex.ByID(id);
 }
 
 Project *User::GetProjectByID(const Poco::UInt64 id) const {
     poco_assert(id > 0);
-    for (std::vector<Project *>::const_iterator it = related.Projects.begin();
-            it != related.Projects.end(); it++) {
-        if ((*it)->ID() == id) {
-            return *it;
-        }
-    }
-    return 0;
+    return related.ProjectIndex.ByID(id);
 }
 
 TimeEntry *User::GetTimeEntryByGUID(const guid GUID) const {
     if (GUID.empty()) {
       return 0;
     }
-    for (std::vector<TimeEntry *>::const_iterator it =
-            related.TimeEntries.begin();
-            it != related.TimeEntries.end();
-            it++) {
-        if ((*it)->GUID() == GUID) {
-            return *it;
-        }
-    }
-    return 0;
+    return related.TimeEntryIndex.ByGUID(GUID);
 }
 
 Tag *User::GetTagByGUID(const guid GUID) const {
   if (GUID.empty()) {
     return 0;
   }
-  for (std::vector<Tag *>::const_iterator it =
-      related.Tags.begin();
-      it != related.Tags.end();
-      it++) {
-    if ((*it)->GUID() == GUID) {
-      return *it;
-    }
-  }
-  return 0;
+  return related.TagIndex.ByGUID(GUID);
 }
 
 Tag *User::GetTagByID(const Poco::UInt64 id) const {
     poco_assert(id > 0);
-    for (std::vector<Tag *>::const_iterator it = related.Tags.begin();
-            it != related.Tags.end(); it++) {
-        if ((*it)->ID() == id) {
-            return *it;
-        }
+    return related.TagIndex.ByID(id);
+}
+
+// The models of the outbox and the dirty ones that need a push.
+// All of them, once the outbox is loaded and all models are tracked.
+template <class T>
+static void collectPushable(
+    const RelatedData &related,
+    ModelIndex<T> *index,
+    const std::string &model_name,
+    std::vector<T *> *result,
+    ModelsByGUID *models) {
+  std::set<T *> found;
+  const PushOutbox::Entries &entries = related.Outbox.All();
+  for (PushOutbox::Entries::const_iterator it = entries.begin();
+      it != entries.end();
+      it++) {
+    if (it->second.model_name != model_name) {
+      continue;
     }
-    return 0;
+    T *model = index->ByGUID(it->first);
+    if (model && model->NeedsPush() && found.insert(model).second) {
+      result->push_back(model);
+    }
+  }
+  for (std::set<BaseModel *>::const_iterator it =
+      related.DirtyModels.begin();
+      it != related.DirtyModels.end();
+      it++) {
+    if ((*it)->ModelName() != model_name) {
+      continue;
+    }
+    T *model = static_cast<T *>(*it);
+    if (model->NeedsPush() && found.insert(model).second) {
+      result->push_back(model);
+    }
+  }
+  if (models) {
+    for (typename std::set<T *>::const_iterator it = found.begin();
+        it != found.end();
+        it++) {
+      (*models)[(*it)->GUIDKey()] = *it;
+    }
+  }
 }
 
 void User::CollectPushableTimeEntries(
     std::vector<TimeEntry *> *result,
-    std::map<std::string, BaseModel *> *models) const {
+    ModelsByGUID *models) const {
   poco_assert(result);
-  for (std::vector<TimeEntry *>::const_iterator it =
-      related.TimeEntries.begin();
-      it != related.TimeEntries.end();
-      it++) {
-    TimeEntry *model = *it;
-    if (model->NeedsPush()) {
+  if (related.Outbox.Loaded() && related.AllTracked()) {
+    collectPushable(related, &related.TimeEntryIndex, "time_entry",
+                    result, models);
+    return;
+  }
+  TimeEntryFieldsPtr fields = related.TimeEntryFields.Refresh();
+  const std::vector<char> &needs_push = fields->NeedsPush;
+  for (std::size_t i = 0; i < needs_push.size(); i++) {
+    if (needs_push[i]) {
+      TimeEntry *model = related.TimeEntries[i];
       result->push_back(model);
       if (models) {
-        (*models)[model->GUID()] = model;
+        (*models)[model->GUIDKey()] = model;
       }
     }
   }
@@ -431,8 +492,13 @@ void User::CollectPushableTimeEntries(
 
 void User::CollectPushableProjects(
     std::vector<Project *> *result,
-    std::map<std::string, BaseModel *> *models) const {
+    ModelsByGUID *models) const {
   poco_assert(result);
+  if (related.Outbox.Loaded() && related.AllTracked()) {
+    collectPushable(related, &related.ProjectIndex, "project",
+                    result, models);
+    return;
+  }
   for (std::vector<Project *>::const_iterator it =
       related.Projects.begin();
       it != related.Projects.end();
@@ -441,37 +507,76 @@ void User::CollectPushableProjects(
     if (model->NeedsPush()) {
       result->push_back(model);
       if (models) {
-        (*models)[model->GUID()] = model;
+        (*models)[model->GUIDKey()] = model;
       }
     }
   }
 }
 
 error User::FullSync(
-        HTTPSClient *https_client) {
+        HTTPSClient *https_client,
+        PushListener *listener) {
     BasicAuthUsername = APIToken();
     BasicAuthPassword = "api_token";
-    error err = pull(https_client, true, true);
+
+    // Everything is pulled while the changes are pushed, the two
+    // merged after
+    std::set<std::string> pushed;
+    CollectPushableGUIDs(&pushed);
+    UserJSONStreamLoader loader(true, true);
+    ChangesFetch fetch;
+    fetch.Start(https_client, BasicAuthUsername, BasicAuthPassword, 0,
+                &loader);
+    error push_err = Push(https_client, listener);
+    error err = fetch.Wait();
     if (err != noError) {
         return err;
     }
-    return push(https_client);
+    loader.SetPushedMeanwhile(pushed);
+    loader.Apply(this);
+    return push_err;
+}
+
+void User::CollectPushableGUIDs(std::set<std::string> *result) const {
+  poco_assert(result);
+
+  std::vector<TimeEntry *> time_entries;
+  CollectPushableTimeEntries(&time_entries);
+  for (std::size_t i = 0; i < time_entries.size(); i++) {
+    if (!time_entries[i]->GUID().empty()) {
+      result->insert(time_entries[i]->GUID());
+    }
+  }
+  std::vector<Project *> projects;
+  CollectPushableProjects(&projects);
+  for (std::size_t i = 0; i < projects.size(); i++) {
+    if (!projects[i]->GUID().empty()) {
+      result->insert(projects[i]->GUID());
+    }
+  }
 }
 
 error User::PartialSync(
-        HTTPSClient *https_client) {
+        HTTPSClient *https_client,
+        PushListener *listener) {
     BasicAuthUsername = APIToken();
     BasicAuthPassword = "api_token";
-    // FIXME: if last sync was a while ago, fetch data using "since" parameter
-    return push(https_client);
+    error err = pull(https_client, false, true);
+    if (err != noError) {
+        return err;
+    }
+    return Push(https_client, listener);
 }
 
-error User::push(HTTPSClient *https_client) {
+error User::Push(
+    HTTPSClient *https_client,
+    PushListener *listener) {
+  TraceSpan trace("User::push");
   try {
     Poco::Stopwatch stopwatch;
     stopwatch.start();
 
-    std::map<std::string, BaseModel *> models;
+    ModelsByGUID models;
 
     std::vector<TimeEntry *> time_entries;
     CollectPushableTimeEntries(&time_entries, &models);
@@ -483,36 +588,58 @@ error User::push(HTTPSClient *https_client) {
         return noError;
     }
 
-    std::string json = UpdateJSON(&projects, &time_entries);
-
-    logger().debug(json);
-
-    std::string response_body("");
-    error err = https_client->PostJSON("/api/v8/batch_updates",
-        json,
-        APIToken(),
-        "api_token",
-        &response_body);
-    if (err != noError) {
-        return err;
-    }
+    // Projects go in the first batches, because time entries
+    // depend on projects
+    std::vector<error> errors;
+    std::size_t pushed_projects = 0;
+    std::size_t pushed_time_entries = 0;
+    while (pushed_projects < projects.size()
+            || pushed_time_entries < time_entries.size()) {
+        std::size_t room = kBatchUpdateMaxModels;
+
+        std::vector<Project *> project_batch;
+        while (room && pushed_projects < projects.size()) {
+            project_batch.push_back(projects[pushed_projects++]);
+            room--;
+        }
 
-    std::vector<BatchUpdateResult> results;
-    ParseResponseArray(response_body, &results);
+        std::vector<TimeEntry *> time_entry_batch;
+        while (room && pushed_time_entries < time_entries.size()) {
+            TimeEntry *te = time_entries[pushed_time_entries++];
+            room--;
+            // A project pushed in an earlier batch has an ID by now
+            if (!te->PID() && !te->ProjectGUID().empty()) {
+                Project *p = related.ProjectIndex.ByGUID(te->ProjectGUID());
+                if (p && p->ID() && !p->IsMarkedAsDeletedOnServer()) {
+                    te->SetPID(p->ID());
+                }
+            }
+            time_entry_batch.push_back(te);
+        }
 
-    std::vector<error> errors;
+        error err = pushBatch(https_client, &project_batch,
+                              &time_entry_batch, &models, &errors);
+        if (err != noError) {
+            return err;
+        }
 
-    ProcessResponseArray(&results, &models, &errors);
+        if (listener) {
+            err = listener->BatchPushed();
+            if (err != noError) {
+                return err;
+            }
+        }
+    }
 
     if (!errors.empty()) {
         return collectErrors(&errors);
     }
 
     stopwatch.stop();
-    std::stringstream ss;
-    ss << "Changes data JSON pushed and responses parsed in "
-        << stopwatch.elapsed() / 1000 << " ms";
-    logger().debug(ss.str());
+    Metrics::Shared().Time("sync.push", stopwatch.elapsed());
+    KOPSIK_LOG_DEBUG(logger(),
+        "Changes data JSON pushed and responses parsed in "
+        << stopwatch.elapsed() / 1000 << " ms");
   } catch(const Poco::Exception& exc) {
     return exc.displayText();
   } catch(const std::exception& ex) {
@@ -523,6 +650,35 @@ error User::push(HTTPSClient *https_client) {
   return noError;
 }
 
+error User::pushBatch(
+    HTTPSClient *https_client,
+    std::vector<Project *> *projects,
+    std::vector<TimeEntry *> *time_entries,
+    ModelsByGUID *models,
+    std::vector<error> *errors) {
+  std::string json = UpdateJSON(projects, time_entries);
+
+  logger().debug(json);
+
+  // The HTTPS session is kept alive between batches
+  std::string response_body("");
+  error err = https_client->PostJSON("/api/v8/batch_updates",
+      json,
+      APIToken(),
+      "api_token",
+      &response_body);
+  if (err != noError) {
+      return err;
+  }
+
+  std::vector<BatchUpdateResult> results;
+  ParseResponseArray(response_body, &results);
+
+  ProcessResponseArray(&results, models, errors);
+
+  return noError;
+}
+
 std::string User::String() const {
   std::stringstream ss;
   ss  << "ID=" << ID()
@@ -534,19 +690,105 @@ std::string User::String() const {
   return ss.str();
 }
 
+std::size_t User::MemoryBytes() const {
+  return sizeof(*this) + ownedBytes()
+    + StringBytes(api_token_)
+    + StringBytes(fullname_)
+    + StringBytes(app_name_)
+    + StringBytes(app_version_)
+    + StringBytes(email_)
+    + StringBytes(BasicAuthUsername)
+    + StringBytes(BasicAuthPassword);
+}
+
 error User::Login(
     HTTPSClient *https_client,
     const std::string &email,
-    const std::string &password) {
+    const std::string &password,
+    const bool with_related_data) {
   BasicAuthUsername = email;
   BasicAuthPassword = password;
-  return pull(https_client, true, true);
+  if (with_related_data) {
+    return pull(https_client, true, true);
+  }
+  // Deltas are built on since, and nothing has been pulled yet
+  Poco::UInt64 since = since_;
+  error err = pull(https_client, true, false);
+  since_ = since;
+  return err;
+}
+
+error User::FetchRunningTimeEntry(HTTPSClient *https_client) {
+  TraceSpan trace("User::FetchRunningTimeEntry");
+  try {
+    std::string response_body("");
+    error err = https_client->GetJSON("/api/v8/time_entries/current",
+                                      APIToken(),
+                                      "api_token",
+                                      &response_body);
+    if (err != noError) {
+      return err;
+    }
+    LoadUserRunningTimeEntryFromJSONString(this, response_body);
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  } catch(const std::string& ex) {
+    return ex;
+  }
+  return noError;
 }
 
 error User::pull(
     HTTPSClient *https_client,
     const bool full_sync,
     const bool with_related_data) {
+  UserJSONStreamLoader loader(full_sync, with_related_data);
+  error err = FetchChanges(https_client,
+                           BasicAuthUsername,
+                           BasicAuthPassword,
+                           full_sync ? 0 : since_,
+                           &loader);
+  if (err != noError) {
+    return err;
+  }
+  loader.Apply(this);
+  return noError;
+}
+
+error User::FetchChanges(
+    HTTPSClient *https_client,
+    const std::string &username,
+    const std::string &password,
+    const Poco::UInt64 since,
+    UserJSONStreamLoader *loader) {
+  // Without a "since" timestamp we have nothing to
+  // build a delta on, so fetch all data instead.
+  if (since) {
+    loader->Reset(false);
+    error err = fetch(https_client, username, password, since, loader);
+    // Only a server refusing the "since" is worth a full fetch,
+    // other errors would only repeat with more data to go
+    if (err == noError || !IsSinceRefused(https_client->LastStatus())) {
+      return err;
+    }
+    std::stringstream ss;
+    ss << "Fetching changes since " << since
+       << " failed, fetching all data instead: " << err;
+    ComponentLogger(&log_user).warning(ss.str());
+  }
+  loader->Reset(true);
+  return fetch(https_client, username, password, 0, loader);
+}
+
+error User::fetch(
+    HTTPSClient *https_client,
+    const std::string &username,
+    const std::string &password,
+    const Poco::UInt64 since,
+    UserJSONStreamLoader *loader) {
+  TraceSpan trace("User::fetch");
   try {
     Poco::Stopwatch stopwatch;
     stopwatch.start();
@@ -554,33 +796,34 @@ error User::pull(
     std::stringstream relative_url;
     relative_url << "/api/v8/me?app_name=kopsik";
 
-    if (with_related_data) {
+    if (loader->WithRelatedData()) {
       relative_url << "&with_related_data=true";
     } else {
       relative_url << "&with_related_data=false";
     }
 
-    if (!full_sync) {
-        relative_url << "&since=" << since_;
+    if (since) {
+        relative_url << "&since=" << since;
     }
 
-    std::string response_body("");
-
     error err = https_client->GetJSON(relative_url.str(),
-                                      BasicAuthUsername,
-                                      BasicAuthPassword,
-                                      &response_body);
+                                      username,
+                                      password,
+                                      loader);
     if (err != noError) {
       return err;
     }
 
-    LoadUserFromJSONString(this, response_body, full_sync, with_related_data);
+    err = loader->Finish();
+    if (err != noError) {
+      return err;
+    }
 
     stopwatch.stop();
-    std::stringstream ss;
-    ss << "User with related data JSON fetched and parsed in "
-      << stopwatch.elapsed() / 1000 << " ms";
-    logger().debug(ss.str());
+    Metrics::Shared().Time("sync.pull", stopwatch.elapsed());
+    KOPSIK_LOG_DEBUG(ComponentLogger(&log_user),
+        "User with related data JSON fetched and parsed in "
+        << stopwatch.elapsed() / 1000 << " ms");
   } catch(const Poco::Exception& exc) {
     return exc.displayText();
   } catch(const std::exception& ex) {
@@ -589,7 +832,40 @@ error User::pull(
     return ex;
   }
   return noError;
-};
+}
+
+void ChangesFetch::Start(
+    HTTPSClient *https_client,
+    const std::string &username,
+    const std::string &password,
+    const Poco::UInt64 since,
+    UserJSONStreamLoader *loader) {
+  poco_assert(https_client);
+  poco_assert(loader);
+  poco_assert(!started_);
+
+  https_client_ = https_client;
+  username_ = username;
+  password_ = password;
+  since_ = since;
+  loader_ = loader;
+  started_ = true;
+  thread_.setName("changes_fetch");
+  thread_.start(*this);
+}
+
+error ChangesFetch::Wait() {
+  if (started_) {
+    thread_.join();
+    started_ = false;
+  }
+  return error_;
+}
+
+void ChangesFetch::run() {
+  error_ = User::FetchChanges(https_client_, username_, password_, since_,
+                              loader_);
+}
 
 error User::collectErrors(std::vector<error> * const errors) const {
   std::stringstream ss;
@@ -612,57 +888,29 @@ error User::collectErrors(std::vector<error> * const errors) const {
 
 Workspace *User::GetWorkspaceByID(const Poco::UInt64 id) const {
   poco_assert(id > 0);
-  for (std::vector<Workspace *>::const_iterator it =
-      related.Workspaces.begin();
-      it != related.Workspaces.end();
-      it++) {
-    if ((*it)->ID() == id) {
-      return *it;
-    }
-  }
-  return 0;
+  return related.WorkspaceIndex.ByID(id);
 }
 
 Project *User::GetProjectByGUID(const guid GUID) const {
     if (GUID.empty()) {
       return 0;
     }
-    for (std::vector<Project *>::const_iterator it = related.Projects.begin();
-            it != related.Projects.end(); it++) {
-        if ((*it)->GUID() == GUID) {
-            return *it;
-        }
-    }
-    return 0;
+    return related.ProjectIndex.ByGUID(GUID);
 }
 
 Client *User::GetClientByGUID(const guid GUID) const {
     if (GUID.empty()) {
       return 0;
     }
-    for (std::vector<Client *>::const_iterator it = related.Clients.begin();
-         it != related.Clients.end(); it++) {
-      if ((*it)->GUID() == GUID) {
-        return *it;
-      }
-    }
-    return 0;
+    return related.ClientIndex.ByGUID(GUID);
 }
 
 TimeEntry *User::GetTimeEntryByID(const Poco::UInt64 id) const {
     poco_assert(id > 0);
-    for (std::vector<TimeEntry *>::const_iterator it =
-            related.TimeEntries.begin();
-            it != related.TimeEntries.end();
-            it++) {
-        if ((*it)->ID() == id) {
-            return *it;
-        }
-    }
-    return 0;
+    return related.TimeEntryIndex.ByID(id);
 }
 
-void User::LoadFromJSONNode(JSONNODE * const) {
+void User::LoadFromJSONNode(JSONValue * const) {
 }
 
 }   // namespace kopsik
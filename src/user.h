@@ -8,7 +8,7 @@
 #include <set>
 #include <map>
 
-#include "libjson.h" // NOLINT
+#include "./json_reader.h"
 
 #include "./types.h"
 #include "./https_client.h"
@@ -24,9 +24,22 @@
 
 #include "Poco/Types.h"
 #include "Poco/Logger.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
 
 namespace kopsik {
 
+    class UserJSONStreamLoader;
+
+    // Told after the results of each batch pushed to the server have
+    // been applied to the models, so they can be saved before the next
+    // batch goes out. Pushing stops if it returns an error.
+    class PushListener {
+    public:
+        virtual ~PushListener() {}
+        virtual error BatchPushed() = 0;
+    };
+
     class User : public BaseModel {
     public:
         User(
@@ -37,6 +50,7 @@ namespace kopsik {
             api_token_(""),
             default_wid_(0),
             since_(0),
+            time_entries_loaded_since_(0),
             fullname_(""),
             app_name_(app_name),
             app_version_(app_version),
@@ -51,15 +65,46 @@ namespace kopsik {
             ClearTimeEntries();
         }
 
-        error FullSync(HTTPSClient *https_client);
-        error PartialSync(HTTPSClient *https_client);
+        // Pushes while everything is pulled, see ChangesFetch
+        error FullSync(
+            HTTPSClient *https_client,
+            PushListener *listener = 0);
+        error PartialSync(
+            HTTPSClient *https_client,
+            PushListener *listener = 0);
+        // Without related data only the user itself is pulled,
+        // and since is left as it was
         error Login(
             HTTPSClient *https_client,
             const std::string &email,
-            const std::string &password);
+            const std::string &password,
+            const bool with_related_data = true);
+        // Loads the time entry running on the server, if any, so it
+        // shows before the rest of the related data is pulled
+        error FetchRunningTimeEntry(HTTPSClient *https_client);
+
+        // Sync in stages, so only applying the changes needs the user
+        // locked. FetchChanges downloads and parses what changed since
+        // the given time into loader, or everything when since is 0 or
+        // the delta fails. It doesn't touch any user. Then loader's
+        // Apply and Push run under the exclusive lock.
+        static error FetchChanges(
+            HTTPSClient *https_client,
+            const std::string &username,
+            const std::string &password,
+            const Poco::UInt64 since,
+            UserJSONStreamLoader *loader);
+        // Pushes changes in batches of kBatchUpdateMaxModels, so a big
+        // backlog is not all lost when one request fails
+        error Push(
+            HTTPSClient *https_client,
+            PushListener *listener);
 
         std::string String() const;
+        // Without the related data, see RelatedData::MemoryUsage
+        std::size_t MemoryBytes() const;
 
+        // Delete the models and give back the memory of their lists
         void ClearWorkspaces();
         void ClearClients();
         void ClearProjects();
@@ -83,10 +128,13 @@ namespace kopsik {
 
         void CollectPushableTimeEntries(
             std::vector<TimeEntry *> *result,
-            std::map<std::string, BaseModel *> *models = 0) const;
+            ModelsByGUID *models = 0) const;
         void CollectPushableProjects(
             std::vector<Project *> *result,
-            std::map<std::string, BaseModel *> *models = 0) const;
+            ModelsByGUID *models = 0) const;
+        // GUIDs of the time entries and projects the next push sends,
+        // see UserJSONStreamLoader::SetPushedMeanwhile
+        void CollectPushableGUIDs(std::set<std::string> *result) const;
 
         TimeEntry *RunningTimeEntry() const;
         TimeEntry *Start(
@@ -100,6 +148,17 @@ namespace kopsik {
         TimeEntry *SplitAt(const Poco::Int64 at);
         TimeEntry *StopAt(const Poco::Int64 at);
 
+        // Time entries that overlap the time from..to, by start.
+        // Running ones overlap everything after their start.
+        void TimeEntriesBetween(
+            const Poco::UInt64 from,
+            const Poco::UInt64 to,
+            std::vector<TimeEntry *> *result) const;
+        // Other time entries that overlap the time entry, by start
+        void OverlappingTimeEntries(
+            TimeEntry *te,
+            std::vector<TimeEntry *> *result) const;
+
         Project *AddProject(
             const Poco::UInt64 workspace_id,
             const Poco::UInt64 client_id,
@@ -107,8 +166,8 @@ namespace kopsik {
 
         std::string DateDuration(TimeEntry *te) const;
 
-        std::string APIToken() const { return api_token_; }
-        void SetAPIToken(std::string api_token);
+        const std::string &APIToken() const { return api_token_; }
+        void SetAPIToken(const std::string &api_token);
 
         Poco::UInt64 DefaultWID() const { return default_wid_; }
         void SetDefaultWID(Poco::UInt64 value);
@@ -117,11 +176,21 @@ namespace kopsik {
         Poco::UInt64 Since() const { return since_; }
         void SetSince(const Poco::UInt64 value);
 
-        std::string Fullname() const { return fullname_; }
-        void SetFullname(std::string value);
+        // Time entries that started before this were not loaded from
+        // the database, except for the running one and the ones that
+        // need pushing. It's 0 when all were loaded.
+        Poco::UInt64 TimeEntriesLoadedSince() const {
+            return time_entries_loaded_since_;
+        }
+        void SetTimeEntriesLoadedSince(const Poco::UInt64 value) {
+            time_entries_loaded_since_ = value;
+        }
 
-        std::string Email() const { return email_; }
-        void SetEmail(const std::string value);
+        const std::string &Fullname() const { return fullname_; }
+        void SetFullname(const std::string &value);
+
+        const std::string &Email() const { return email_; }
+        void SetEmail(const std::string &value);
 
         bool RecordTimeline() const { return record_timeline_; }
         void SetRecordTimeline(const bool value);
@@ -142,15 +211,28 @@ namespace kopsik {
         std::string ModelName() const { return "user"; }
         std::string ModelURL() const { return "/api/v8/me"; }
 
-        void LoadFromJSONNode(JSONNODE * const);
+        void LoadFromJSONNode(JSONValue * const);
+
+    protected:
+        LogComponent *logComponent() const;
 
     private:
         error pull(
             HTTPSClient *https_client,
             const bool full_sync,
             const bool with_related_data);
-        error push(
-            HTTPSClient *https_client);
+        static error fetch(
+            HTTPSClient *https_client,
+            const std::string &username,
+            const std::string &password,
+            const Poco::UInt64 since,
+            UserJSONStreamLoader *loader);
+        error pushBatch(
+            HTTPSClient *https_client,
+            std::vector<Project *> *projects,
+            std::vector<TimeEntry *> *time_entries,
+            ModelsByGUID *models,
+            std::vector<error> *errors);
 
         std::string dirtyObjectsJSON(std::vector<TimeEntry *> * const) const;
         void processResponseArray(
@@ -159,20 +241,11 @@ namespace kopsik {
             std::vector<error> *errors);
         error collectErrors(std::vector<error> *errors) const;
 
-        error requestJSON(
-            const std::string method,
-            const std::string relative_url,
-            const std::string json,
-            const bool authenticate_with_api_token,
-            std::string *response_body);
-        void parseResponseArray(
-            const std::string response_body,
-            std::vector<BatchUpdateResult> *responses);
-
         std::string api_token_;
         Poco::UInt64 default_wid_;
         // Unix timestamp of the user data; returned from API
         Poco::UInt64 since_;
+        Poco::UInt64 time_entries_loaded_since_;
         std::string fullname_;
         std::string app_name_;
         std::string app_version_;
@@ -181,6 +254,48 @@ namespace kopsik {
         bool store_start_and_stop_time_;
     };
 
+    // Runs User::FetchChanges on a thread of its own, so a full sync
+    // pushes while it downloads instead of after. Each request gets a
+    // connection of its own from the session pool, so the two don't
+    // wait for each other, and the loader is applied once both are
+    // done.
+    class ChangesFetch : public Poco::Runnable {
+    public:
+        ChangesFetch()
+            : https_client_(0)
+            , since_(0)
+            , loader_(0)
+            , started_(false)
+            , error_(noError) {}
+        ~ChangesFetch() {
+            Wait();
+        }
+
+        void Start(
+            HTTPSClient *https_client,
+            const std::string &username,
+            const std::string &password,
+            const Poco::UInt64 since,
+            UserJSONStreamLoader *loader);
+        // What FetchChanges returned, noError when never started
+        error Wait();
+
+        void run();
+
+    private:
+        HTTPSClient *https_client_;
+        std::string username_;
+        std::string password_;
+        Poco::UInt64 since_;
+        UserJSONStreamLoader *loader_;
+        bool started_;
+        error error_;
+        Poco::Thread thread_;
+
+        ChangesFetch(const ChangesFetch &);
+        ChangesFetch &operator=(const ChangesFetch &);
+    };
+
 }  // namespace kopsik
 
 #endif  // SRC_USER_H_
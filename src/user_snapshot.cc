@@ -0,0 +1,147 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./user_snapshot.h"
+
+namespace kopsik {
+
+TimeEntrySnapshot::TimeEntrySnapshot()
+  : GUID("")
+  , Description("")
+  , ProjectAndTaskLabel("")
+  , Color("")
+  , Duration("")
+  , Tags("")
+  , DateHeader("")
+  , WID(0)
+  , TID(0)
+  , PID(0)
+  , DurationInSeconds(0)
+  , Started(0)
+  , Ended(0)
+  , UpdatedAt(0)
+  , Billable(false)
+  , DurOnly(false) {}
+
+bool TimeEntrySnapshot::operator==(const TimeEntrySnapshot &other) const {
+  return GUID == other.GUID
+    && Description == other.Description
+    && ProjectAndTaskLabel == other.ProjectAndTaskLabel
+    && Color == other.Color
+    && Duration == other.Duration
+    && Tags == other.Tags
+    && DateHeader == other.DateHeader
+    && WID == other.WID
+    && TID == other.TID
+    && PID == other.PID
+    && DurationInSeconds == other.DurationInSeconds
+    && Started == other.Started
+    && Ended == other.Ended
+    && UpdatedAt == other.UpdatedAt
+    && Billable == other.Billable
+    && DurOnly == other.DurOnly;
+}
+
+TimeEntryGroupSnapshot::TimeEntryGroupSnapshot()
+  : Key("")
+  , Description("")
+  , ProjectAndTaskLabel("")
+  , Color("")
+  , Duration("")
+  , DateHeader("")
+  , WID(0)
+  , TID(0)
+  , PID(0)
+  , DurationInSeconds(0)
+  , Started(0)
+  , Ended(0) {}
+
+bool TimeEntryGroupSnapshot::operator==(
+    const TimeEntryGroupSnapshot &other) const {
+  return Key == other.Key
+    && Description == other.Description
+    && ProjectAndTaskLabel == other.ProjectAndTaskLabel
+    && Color == other.Color
+    && Duration == other.Duration
+    && DateHeader == other.DateHeader
+    && WID == other.WID
+    && TID == other.TID
+    && PID == other.PID
+    && DurationInSeconds == other.DurationInSeconds
+    && Started == other.Started
+    && Ended == other.Ended
+    && GUIDs == other.GUIDs;
+}
+
+const std::string &UserSnapshot::FormattedDateDuration(
+    const std::string &date_header) const {
+  static const std::string none("");
+  std::map<std::string, std::string>::const_iterator it =
+    FormattedDateDurations.find(date_header);
+  if (it == FormattedDateDurations.end()) {
+    return none;
+  }
+  return it->second;
+}
+
+std::size_t UserSnapshot::MemoryBytes() const {
+  std::size_t bytes = sizeof(*this)
+    + VectorBytes(TimeEntries)
+    + VectorBytes(TimeEntryGroups)
+    + MapNodesBytes(TimeEntryGroupIndex)
+    + VectorBytes(AutocompleteGenerations)
+    + MapNodesBytes(TimeEntryIndex)
+    + MapNodesBytes(DateDurations)
+    + MapNodesBytes(FormattedDateDurations)
+    + StringVectorBytes(Tags);
+  for (std::vector<TimeEntrySnapshot>::const_iterator it =
+      TimeEntries.begin();
+      it != TimeEntries.end();
+      it++) {
+    bytes += StringBytes(it->GUID)
+      + StringBytes(it->Description)
+      + StringBytes(it->ProjectAndTaskLabel)
+      + StringBytes(it->Color)
+      + StringBytes(it->Duration)
+      + StringBytes(it->Tags)
+      + StringBytes(it->DateHeader);
+  }
+  for (std::map<std::string, std::size_t>::const_iterator it =
+      TimeEntryIndex.begin();
+      it != TimeEntryIndex.end();
+      it++) {
+    bytes += StringBytes(it->first);
+  }
+  for (std::vector<TimeEntryGroupSnapshot>::const_iterator it =
+      TimeEntryGroups.begin();
+      it != TimeEntryGroups.end();
+      it++) {
+    bytes += StringBytes(it->Key)
+      + StringBytes(it->Description)
+      + StringBytes(it->ProjectAndTaskLabel)
+      + StringBytes(it->Color)
+      + StringBytes(it->Duration)
+      + StringBytes(it->DateHeader)
+      + StringVectorBytes(it->GUIDs);
+  }
+  for (std::map<std::string, std::size_t>::const_iterator it =
+      TimeEntryGroupIndex.begin();
+      it != TimeEntryGroupIndex.end();
+      it++) {
+    bytes += StringBytes(it->first);
+  }
+  for (std::map<std::string, Poco::Int64>::const_iterator it =
+      DateDurations.begin();
+      it != DateDurations.end();
+      it++) {
+    bytes += StringBytes(it->first);
+  }
+  for (std::map<std::string, std::string>::const_iterator it =
+      FormattedDateDurations.begin();
+      it != FormattedDateDurations.end();
+      it++) {
+    bytes += StringBytes(it->first) + StringBytes(it->second);
+  }
+  return bytes;
+}
+
+}  // namespace kopsik
@@ -0,0 +1,141 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_USER_SNAPSHOT_H_
+#define SRC_USER_SNAPSHOT_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "./autocomplete_index.h"
+#include "./memory_usage.h"
+
+#include "Poco/AutoPtr.h"
+#include "Poco/RefCountedObject.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+// A time entry as it's shown in the time entry list
+class TimeEntrySnapshot {
+ public:
+  TimeEntrySnapshot();
+
+  bool operator==(const TimeEntrySnapshot &other) const;
+
+  std::string GUID;
+  std::string Description;
+  std::string ProjectAndTaskLabel;
+  std::string Color;
+  std::string Duration;
+  std::string Tags;
+  std::string DateHeader;
+  Poco::UInt64 WID;
+  Poco::UInt64 TID;
+  Poco::UInt64 PID;
+  Poco::Int64 DurationInSeconds;
+  Poco::UInt64 Started;
+  Poco::UInt64 Ended;
+  Poco::UInt64 UpdatedAt;
+  bool Billable;
+  bool DurOnly;
+};
+
+// Time entries of one day with the same description, project and
+// task, as the collapsed time entry list shows them
+class TimeEntryGroupSnapshot {
+ public:
+  TimeEntryGroupSnapshot();
+
+  bool operator==(const TimeEntryGroupSnapshot &other) const;
+
+  // Made of the day, project, task and description, so it stays the
+  // same for as long as the group has entries
+  std::string Key;
+  std::string Description;
+  std::string ProjectAndTaskLabel;
+  std::string Color;
+  // Total of the entries, formatted
+  std::string Duration;
+  std::string DateHeader;
+  Poco::UInt64 WID;
+  Poco::UInt64 TID;
+  Poco::UInt64 PID;
+  Poco::Int64 DurationInSeconds;
+  // Earliest start and latest end of the entries
+  Poco::UInt64 Started;
+  Poco::UInt64 Ended;
+  // Of the entries, in the order they are listed
+  std::vector<std::string> GUIDs;
+};
+
+// What the UI lists show of the user model, copied after a change.
+// A published snapshot is never modified, so it may be read from any
+// thread without locking while it's held, however long a sync takes.
+class UserSnapshot : public Poco::RefCountedObject {
+ public:
+  UserSnapshot() : Version(0) {}
+
+  // Grows by one with every snapshot published
+  Poco::UInt64 Version;
+
+  // Visible time entries, in the order they are listed
+  std::vector<TimeEntrySnapshot> TimeEntries;
+  // Position of each time entry in TimeEntries by GUID
+  std::map<std::string, std::size_t> TimeEntryIndex;
+  std::map<std::string, Poco::Int64> DateDurations;
+  // Same, formatted as the lists show them, and for the days of
+  // TimeEntries that have no total
+  std::map<std::string, std::string> FormattedDateDurations;
+
+  // Visible time entries grouped, see TimeEntryGroupSnapshot, in the
+  // order of their first entry
+  std::vector<TimeEntryGroupSnapshot> TimeEntryGroups;
+  // Position of each group in TimeEntryGroups by key
+  std::map<std::string, std::size_t> TimeEntryGroupIndex;
+
+  // Formatted total of the day by its date header, empty for a day
+  // without time entries in the list
+  const std::string &FormattedDateDuration(
+      const std::string &date_header) const;
+
+  // All autocomplete items, sorted with CompareAutocompleteItems.
+  // Snapshots share the index for as long as the items stay the same.
+  Poco::SharedPtr<AutocompleteIndex> Autocomplete;
+  // Generations of the lists the items were collected from, see
+  // RelatedData. Empty when they couldn't be told.
+  std::vector<int> AutocompleteGenerations;
+
+  std::vector<std::string> Tags;
+
+  // Without Autocomplete, which snapshots share
+  std::size_t MemoryBytes() const;
+
+ protected:
+  ~UserSnapshot() {}
+};
+
+// How the time entry list of one snapshot differs from the one
+// published before it, or from an older one when diffs are merged.
+// The grouped list has diffs of its own, with group keys for GUIDs.
+class TimeEntryListDiff {
+ public:
+  TimeEntryListDiff() : Version(0) {}
+
+  // Version of the snapshot the diff leads to
+  Poco::UInt64 Version;
+
+  // Time entry GUIDs, or group keys
+  std::vector<std::string> Inserted;
+  std::vector<std::string> Updated;
+  std::vector<std::string> Deleted;
+
+  // Days whose total duration may have changed
+  std::set<std::string> DateHeaders;
+};
+
+}  // namespace kopsik
+
+#endif  // SRC_USER_SNAPSHOT_H_
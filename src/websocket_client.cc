@@ -9,20 +9,28 @@
 #include "Poco/InflatingStream.h"
 #include "Poco/DeflatingStream.h"
 #include "Poco/URI.h"
+#include "Poco/NObserver.h"
 #include "Poco/NumberParser.h"
+#include "Poco/String.h"
 #include "Poco/Net/Context.h"
 #include "Poco/Net/NameValueCollection.h"
 #include "Poco/Net/HTTPMessage.h"
 #include "Poco/Net/HTTPBasicCredentials.h"
-#include "Poco/Net/InvalidCertificateHandler.h"
-#include "Poco/Net/AcceptCertificateHandler.h"
-#include "Poco/Net/SSLManager.h"
-#include "Poco/Net/PrivateKeyPassphraseHandler.h"
 
-#include "./libjson.h"
+#include "./json_reader.h"
 
+#include "./dns_cache.h"
+#include "./https_client.h"
 #include "./version.h"
 #include "./json.h"
+#include "./json_key.h"
+#include "./json_writer.h"
+#include "./log.h"
+#include "./memory_usage.h"
+#include "./metrics.h"
+#include "./network_reactor.h"
+#include "./trace.h"
+#include "./traffic_recorder.h"
 
 namespace kopsik {
 
@@ -30,13 +38,18 @@ Poco::Logger &WebSocketClient::logger() const {
   return Poco::Logger::get("websocket_client");
 }
 
+typedef Poco::NObserver<WebSocketClient, Poco::Net::ReadableNotification>
+  WebSocketObserver;
+
 void WebSocketClient::Start(
     void *ctx,
     const std::string api_token,
-    WebSocketMessageCallback on_websocket_message) {
+    WebSocketMessageCallback on_websocket_message,
+    WebSocketReconnectCallback on_reconnect) {
   poco_assert(ctx);
   poco_assert(!api_token.empty());
   poco_assert(on_websocket_message);
+  poco_assert(on_reconnect);
 
   if (activity_.isRunning()) {
     return;
@@ -48,16 +61,25 @@ void WebSocketClient::Start(
 
   ctx_ = ctx;
   on_websocket_message_ = on_websocket_message;
+  on_reconnect_ = on_reconnect;
   api_token_ = api_token;
+  reconnect_attempts_ = 0;
+  reconnect_at_ = 0;
+  receiving_ = false;
+  resync_pending_ = false;
+}
+
+void WebSocketClient::RequestStop() {
+    activity_.stop();
 }
 
 void WebSocketClient::Stop() {
     logger().debug("Stop");
 
-    if (!activity_.isRunning()) {
+    if (!activity_.isRunning() && !session_) {
       return;
     }
-    activity_.stop();  // request stop
+    RequestStop();
     activity_.wait();  // wait until activity actually stops
 
     deleteSession();
@@ -75,35 +97,53 @@ error WebSocketClient::createSession() {
   try {
     Poco::URI uri(websocket_url_);
 
-    Poco::SharedPtr<Poco::Net::InvalidCertificateHandler> acceptCertHandler =
-      new Poco::Net::AcceptCertificateHandler(true);
-
-    Poco::Net::Context::Ptr context(new Poco::Net::Context(
-      Poco::Net::Context::CLIENT_USE, "",
-      Poco::Net::Context::VERIFY_RELAXED, 9, true, "ALL"));
-
-    Poco::Net::SSLManager::instance().initializeClient(
-      0, acceptCertHandler, context);
-
-    session_ = new Poco::Net::HTTPSClientSession(uri.getHost(), uri.getPort(),
-      context);
+    // Reconnects resume the last TLS session to the server
+    HTTPSSessionPool &pool = HTTPSSessionPool::Instance();
+    Poco::Net::Session::Ptr tls_session = pool.TLSSession(uri, proxy_);
+    if (tls_session.isNull()) {
+      session_ = new Poco::Net::HTTPSClientSession(
+        uri.getHost(), uri.getPort(), pool.TLSContext());
+    } else {
+      session_ = new Poco::Net::HTTPSClientSession(
+        uri.getHost(), uri.getPort(), pool.TLSContext(), tls_session);
+    }
     if (proxy_.IsConfigured()) {
       session_->setProxy(proxy_.host, proxy_.port);
       if (proxy_.HasCredentials()) {
         session_->setProxyCredentials(proxy_.username, proxy_.password);
       }
+    } else {
+      // Reconnects don't wait for the resolver
+      std::string address =
+        DNSCache::Shared().Address(uri.getHost(), uri.getPort());
+      if (!address.empty()) {
+        session_->setHost(address);
+      }
     }
     req_ = new Poco::Net::HTTPRequest(Poco::Net::HTTPRequest::HTTP_GET, "/ws",
       Poco::Net::HTTPMessage::HTTP_1_1);
+    req_->setHost(uri.getHost(), uri.getPort());
     req_->set("Origin", "https://localhost");
     req_->set("User-Agent", kopsik::UserAgent(app_name_, app_version_));
+    // Messages are sent uncompressed, which the extension allows
+    req_->set("Sec-WebSocket-Extensions", kPerMessageDeflate);
     res_ = new Poco::Net::HTTPResponse();
     ws_ = new Poco::Net::WebSocket(*session_, *req_, *res_);
+
+    std::string extensions(
+      Poco::toLower(res_->get("Sec-WebSocket-Extensions", "")));
+    deflate_ = extensions.find(kPerMessageDeflate) != std::string::npos;
+    inflater_.Reset(
+      extensions.find("server_no_context_takeover") == std::string::npos);
+    pool.KeepTLSSession(uri, proxy_, session_->sslSession());
     ws_->setBlocking(false);
     ws_->setReceiveTimeout(Poco::Timespan(3 * Poco::Timespan::SECONDS));
     ws_->setSendTimeout(Poco::Timespan(3 * Poco::Timespan::SECONDS));
 
     authenticate();
+
+    NetworkReactor::Instance().Add(*ws_,
+      WebSocketObserver(*this, &WebSocketClient::onReadable));
   } catch(const Poco::Exception& exc) {
     return exc.displayText();
   } catch(const std::exception& ex) {
@@ -118,56 +158,162 @@ error WebSocketClient::createSession() {
 void WebSocketClient::authenticate() {
   logger().debug("authenticate");
 
-  JSONNODE *c = json_new(JSON_NODE);
-  json_push_back(c, json_new_a("type", "authenticate"));
-  json_push_back(c, json_new_a("api_token", api_token_.c_str()));
-  json_char *jc = json_write_formatted(c);
-  std::string payload(jc);
-  json_free(jc);
-  json_delete(c);
-
-  ws_->sendFrame(payload.data(),
-                 static_cast<int>(payload.size()),
-                 Poco::Net::WebSocket::FRAME_BINARY);
+  JSONWriter writer;
+  writer.BeginObject();
+  writer.Key("type");
+  writer.String("authenticate");
+  writer.Key("api_token");
+  writer.String(api_token_);
+  writer.EndObject();
+  const std::string &payload = writer.Buffer();
+
+  send(payload.data(),
+       static_cast<int>(payload.size()),
+       Poco::Net::WebSocket::FRAME_BINARY);
 }
 
-std::string WebSocketClient::parseWebSocketMessageType(
-    const std::string json) {
-  poco_assert(!json.empty());
-  std::string type("data");
+void WebSocketClient::send(
+    const char *data,
+    const int size,
+    const int flags) {
+  Poco::FastMutex::ScopedLock lock(send_m_);
+  ws_->sendFrame(data, size, flags);
+}
 
-  if (!IsValidJSON(json)) {
-    return "";
+error WebSocketClient::SendTimeline(
+    const Poco::UInt64 batch_id,
+    const std::string &events_json) {
+  // Not waited for while the session is being replaced
+  if (!mutex_.tryLock()) {
+    return error("WebSocket is connecting");
   }
+  error err = sendTimeline(batch_id, events_json);
+  mutex_.unlock();
+  return err;
+}
+
+error WebSocketClient::sendTimeline(
+    const Poco::UInt64 batch_id,
+    const std::string &events_json) {
+  if (!ws_ || failed_ || !receiving_) {
+    return error("WebSocket is not connected");
+  }
+  try {
+    JSONWriter writer;
+    writer.BeginObject();
+    writer.String("type", "timeline");
+    writer.Int("id", static_cast<Poco::Int64>(batch_id));
+    writer.Raw("events", events_json);
+    writer.EndObject();
+    const std::string &payload = writer.Buffer();
+
+    send(payload.data(),
+         static_cast<int>(payload.size()),
+         Poco::Net::WebSocket::FRAME_BINARY);
+    Metrics::Shared().Count("websocket.timeline_bytes_sent",
+                            static_cast<Poco::Int64>(payload.size()));
+  } catch(const Poco::Exception& exc) {
+    return exc.displayText();
+  } catch(const std::exception& ex) {
+    return ex.what();
+  } catch(const std::string& ex) {
+    return ex;
+  }
+  return noError;
+}
+
+void WebSocketClient::SetTimelineListener(TimelineStreamListener *listener) {
+  Poco::FastMutex::ScopedLock lock(timeline_m_);
+  timeline_listener_ = listener;
+}
 
-  const char *str = json.c_str();
+std::string WebSocketClient::MessageType(
+    JSONValue *root) {
+  poco_assert(root);
+  std::string type("data");
 
-  JSONNODE *root = json_parse(str);
-  JSONNODE_ITERATOR i = json_begin(root);
-  JSONNODE_ITERATOR e = json_end(root);
+  JSONIterator i = JSONBegin(root);
+  JSONIterator e = JSONEnd(root);
   while (i != e) {
-    json_char *node_name = json_name(*i);
-    if (strcmp(node_name, "type") == 0) {
-      type = std::string(json_as_string(*i));
+    JSONKey key = JSONNodeKey(*i);
+    if (kJSONKeyType == key) {
+      type = JSONString(*i);
       break;
     }
     ++i;
   }
-  json_delete(root);
 
   return type;
 }
 
-const int kWebsocketBufSize = 1024 * 10;
-
-error WebSocketClient::receiveWebSocketMessage(std::string *message) {
-  int flags = Poco::Net::WebSocket::FRAME_BINARY;
-  std::string json("");
+// Poco cannot tell the size of a frame before reading it,
+// so the frame buffer must fit the biggest frame we accept.
+const int kWebSocketMaxFrameSize = 1024 * 1024;
+const std::string::size_type kWebSocketMaxMessageSize = 16 * 1024 * 1024;
+
+error WebSocketMessageReader::Read(
+    Poco::Net::WebSocket *ws,
+    Poco::FastMutex *send_m,
+    std::string *message,
+    bool *rsv1) {
+  poco_assert(ws);
+  poco_assert(send_m);
+  poco_assert(message);
+  poco_assert(rsv1);
+
+  message->clear();
+  *rsv1 = false;
   try {
-    char buf[kWebsocketBufSize];
-    int n = ws_->receiveFrame(buf, kWebsocketBufSize, flags);
-    if (n > 0) {
-      json.append(buf, n);
+    if (frame_buffer_.empty()) {
+      frame_buffer_.resize(kWebSocketMaxFrameSize);
+    }
+    // Only the first frame of a message says if it's compressed
+    bool first(true);
+    while (true) {
+      int flags(0);
+      int n = ws->receiveFrame(&frame_buffer_[0],
+                               static_cast<int>(frame_buffer_.size()),
+                               flags);
+      int opcode = flags & Poco::Net::WebSocket::FRAME_OP_BITMASK;
+      if ((n <= 0 && !flags)
+          || Poco::Net::WebSocket::FRAME_OP_CLOSE == opcode) {
+        // Peer has closed the connection
+        message->clear();
+        return noError;
+      }
+
+      // Control frames can arrive between the fragments of a message
+      if (Poco::Net::WebSocket::FRAME_OP_PING == opcode) {
+        Poco::FastMutex::ScopedLock lock(*send_m);
+        ws->sendFrame(&frame_buffer_[0], n > 0 ? n : 0,
+          Poco::Net::WebSocket::FRAME_FLAG_FIN
+          | Poco::Net::WebSocket::FRAME_OP_PONG);
+        continue;
+      }
+      if (Poco::Net::WebSocket::FRAME_OP_PONG == opcode) {
+        continue;
+      }
+
+      if (first) {
+        first = false;
+        *rsv1 = (flags & Poco::Net::WebSocket::FRAME_FLAG_RSV1) != 0;
+      }
+
+      if (n > 0) {
+        if (message->size() + n > kWebSocketMaxMessageSize) {
+          return error("WebSocket message is too large");
+        }
+        message->append(&frame_buffer_[0], n);
+      }
+      if (flags & Poco::Net::WebSocket::FRAME_FLAG_FIN) {
+        break;
+      }
+
+      // Wait for the next fragment, socket is not blocking
+      Poco::Timespan span(3 * Poco::Timespan::SECONDS);
+      if (!ws->poll(span, Poco::Net::Socket::SELECT_READ)) {
+        return error("Timed out waiting for the rest of WebSocket message");
+      }
     }
   } catch(const Poco::Exception& exc) {
     return error(exc.displayText());
@@ -176,49 +322,84 @@ error WebSocketClient::receiveWebSocketMessage(std::string *message) {
   } catch(const std::string& ex) {
     return error(ex);
   }
-  *message = json;
   return noError;
 }
 
+std::size_t WebSocketMessageReader::BufferBytes() const {
+  return VectorBytes(frame_buffer_);
+}
+
+error WebSocketClient::receiveWebSocketMessage(std::string *message) {
+  bool compressed(false);
+  error err = reader_.Read(ws_, &send_m_, message, &compressed);
+  if (err != noError || !deflate_ || !compressed || message->empty()) {
+    return err;
+  }
+  compressed_message_.swap(*message);
+  Metrics::Shared().Count("websocket.bytes_compressed",
+                          compressed_message_.size());
+  return inflater_.Inflate(compressed_message_,
+                           kWebSocketMaxMessageSize,
+                           message);
+}
+
 const std::string kPong("{\"type\": \"pong\"}");
 
-error WebSocketClient::poll() {
-  try {
-    Poco::Timespan span(250 * Poco::Timespan::MILLISECONDS);
-    if (!ws_->poll(span, Poco::Net::Socket::SELECT_READ)) {
-      return noError;
-    }
+void WebSocketClient::onReadable(
+    const Poco::AutoPtr<Poco::Net::ReadableNotification> &notification) {
+  error err = receive();
+  if (err != noError) {
+    logger().error(err);
+    logger().debug("encountered an error and will delete session");
+    // Socket would stay readable until it's closed
+    NetworkReactor::Instance().Remove(*ws_,
+      WebSocketObserver(*this, &WebSocketClient::onReadable));
+    failed_ = true;
+    activity_.Wake();
+  }
+}
+
+error WebSocketClient::receive() {
+  TraceSpan trace("WebSocketClient::receive");
 
-    std::string json("");
-    error err = receiveWebSocketMessage(&json);
+  try {
+    error err = receiveWebSocketMessage(&message_);
+    buffer_bytes_ = reader_.BufferBytes() + StringBytes(message_)
+      + StringBytes(compressed_message_) + inflater_.WindowBytes();
     if (err != noError) {
       return err;
     }
-    if (json.empty()) {
+    if (message_.empty()) {
       return error("WebSocket peer has shut down or closed the connection");
     }
-    std::stringstream ss;
-    ss << "WebSocket message: " << json;
-    logger().debug(ss.str());
+    Metrics::Shared().Count("websocket.messages");
+    KOPSIK_LOG_DEBUG(logger(), "WebSocket message: " << message_);
+    TrafficRecorder::Instance().RecordWebSocket(message_);
 
     last_connection_at_ = time(0);
 
-    std::string type = parseWebSocketMessageType(json);
-
-    if (activity_.isStopped()) {
-      return noError;
+    if (!receiving_) {
+      receiving_ = true;
+      if (resync_pending_) {
+        resync_pending_ = false;
+        logger().debug("reconnected, fetching what was missed");
+        on_reconnect_(ctx_);
+      }
     }
 
-    if ("ping" == type) {
-      ws_->sendFrame(kPong.data(),
-        static_cast<int>(kPong.size()),
-        Poco::Net::WebSocket::FRAME_BINARY);
+    JSONValue *root = JSONParse(message_);
+    if (!root) {
+      logger().warning("Ignoring WebSocket message that is not valid JSON");
       return noError;
     }
-
-    if ("data" == type) {
-      on_websocket_message_(ctx_, json);
+    try {
+      err = handleWebSocketMessage(root);
+    } catch(...) {
+      JSONDelete(root);
+      throw;
     }
+    JSONDelete(root);
+    return err;
   } catch(const Poco::Exception& exc) {
     return error(exc.displayText());
   } catch(const std::exception& ex) {
@@ -229,44 +410,127 @@ error WebSocketClient::poll() {
   return noError;
 }
 
-const int kWebSocketRestartThreshold = 30;
+error WebSocketClient::handleWebSocketMessage(JSONValue *root) {
+  poco_assert(root);
 
-void WebSocketClient::runActivity() {
-  while (!activity_.isStopped()) {
-    if (ws_) {
-      error err = poll();
-      if (err != noError) {
-        logger().error(err);
-        logger().debug("encountered an error and will delete session");
-        deleteSession();
-        logger().debug("will sleep for 10 sec");
-        Poco::Thread::sleep(10000);
-        logger().debug("sleep done");
-      }
+  std::string type = MessageType(root);
+
+  if (activity_.isStopped()) {
+    return noError;
+  }
+
+  if ("ping" == type) {
+    send(kPong.data(),
+      static_cast<int>(kPong.size()),
+      Poco::Net::WebSocket::FRAME_BINARY);
+    return noError;
+  }
+
+  if ("timeline_ack" == type) {
+    handleTimelineAck(root);
+    return noError;
+  }
+
+  if ("data" == type) {
+    on_websocket_message_(ctx_, root);
+  }
+  return noError;
+}
+
+// {"type": "timeline_ack", "id": 12}, with an "error" if the
+// batch wasn't stored
+void WebSocketClient::handleTimelineAck(JSONValue *root) {
+  JSONValue *id = JSONGet(root, "id");
+  if (!id) {
+    logger().warning("Ignoring timeline acknowledgement without an ID");
+    return;
+  }
+  error err = noError;
+  JSONValue *message = JSONGet(root, "error");
+  if (message && JSONTypeOf(message) == kJSONString) {
+    err = JSONString(message);
+    if (err == noError) {
+      err = error("Timeline batch was rejected");
     }
+  }
 
-    if (time(0) - last_connection_at_ > kWebSocketRestartThreshold) {
-      logger().debug("restarting");
-      error err = createSession();
-      if (err != noError) {
-        logger().error(err);
-        Poco::Thread::sleep(10000);
-      }
+  Poco::FastMutex::ScopedLock lock(timeline_m_);
+  if (timeline_listener_) {
+    timeline_listener_->TimelineAcknowledged(JSONInt(id), err);
+  }
+}
+
+const int kWebSocketRestartThreshold = 30;
+
+void WebSocketClient::reconnectLater() {
+  deleteSession();
+
+  // Backoff starts over when a session that worked was lost,
+  // and grows while the server can't be reached
+  if (receiving_) {
+    reconnect_attempts_ = 0;
+    resync_pending_ = true;
+  }
+  receiving_ = false;
+
+  Poco::Timestamp::TimeDiff delay =
+    WebSocketReconnectDelay(reconnect_attempts_, random_.next());
+  reconnect_attempts_++;
+  reconnect_at_ = Poco::Timestamp() + delay;
+  Metrics::Shared().Count("websocket.reconnects");
+  KOPSIK_LOG_DEBUG(logger(), "will reconnect in "
+      << delay / Poco::Timestamp::resolution() << " sec");
+}
+
+Poco::Timestamp::TimeDiff WebSocketClient::supervise() {
+  if (failed_ || (ws_
+      && time(0) - last_connection_at_ > kWebSocketRestartThreshold)) {
+    reconnectLater();
+  }
+
+  Poco::Timestamp now;
+  if (!ws_ && now >= reconnect_at_) {
+    logger().debug("connecting");
+    error err = createSession();
+    if (err != noError) {
+      logger().error(err);
+      reconnectLater();
     }
+  }
 
-    Poco::Thread::sleep(1000);
+  // Runs again when it's time to connect, the session has been quiet
+  // for too long, or the reactor thread finds it has failed
+  Poco::Timestamp::TimeDiff wait(0);
+  if (ws_) {
+    wait = (last_connection_at_ + kWebSocketRestartThreshold + 1 - time(0))
+      * Poco::Timestamp::resolution();
+  } else {
+    wait = reconnect_at_ - Poco::Timestamp();
   }
+  return wait > 0 ? wait : 0;
+}
 
-  logger().debug("activity finished");
+bool WebSocketClient::Healthy() const {
+  return activity_.isRunning() && ws_ && !failed_ && receiving_
+    && time(0) - last_connection_at_ <= kWebSocketRestartThreshold;
 }
 
 WebSocketClient::~WebSocketClient() {
+  Stop();
   deleteSession();
 }
 
 void WebSocketClient::deleteSession() {
   logger().debug("deleteSession");
 
+  // Waits for a message being handled,
+  // so the handler must not lock mutex_
+  if (ws_) {
+    NetworkReactor::Instance().Remove(*ws_,
+      WebSocketObserver(*this, &WebSocketClient::onReadable));
+  }
+  failed_ = false;
+
   Poco::Mutex::ScopedLock lock(mutex_);
 
   if (ws_) {
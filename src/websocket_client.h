@@ -7,83 +7,231 @@
 #include <vector>
 #include <ctime>
 
-#include "Poco/Activity.h"
+#include "Poco/AutoPtr.h"
+#include "Poco/Net/SocketNotification.h"
 #include "Poco/Net/WebSocket.h"
 #include "Poco/Net/HTTPSClientSession.h"
 #include "Poco/Net/HTTPRequest.h"
 #include "Poco/Net/HTTPResponse.h"
 #include "Poco/Logger.h"
+#include "Poco/Mutex.h"
+#include "Poco/Random.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Types.h"
 
 #include "./types.h"
 #include "./proxy.h"
+#include "./json_reader.h"
+#include "./timeline_stream.h"
+#include "./websocket_inflater.h"
+#include "./worker_pool.h"
 
 namespace kopsik {
 
+  // Message is parsed once by the client and
+  // deleted after the callback returns.
   typedef void (*WebSocketMessageCallback)(
     void *callback,
-    std::string json);
+    JSONValue *message);
+
+  // Called when a session is up again after one was lost. Whatever
+  // was sent meanwhile was missed and has to be fetched.
+  typedef void (*WebSocketReconnectCallback)(
+    void *callback);
+
+  // Wait before the first reconnect, doubled with every attempt
+  // that fails, up to the max
+  const Poco::Timestamp::TimeDiff kWebSocketReconnectMinMicros =
+    5 * Poco::Timestamp::resolution();
+  const Poco::Timestamp::TimeDiff kWebSocketReconnectMaxMicros =
+    5 * 60 * Poco::Timestamp::resolution();
+
+  // Wait before reconnect attempt, counting from 0. It's spread over
+  // the upper half of the backoff by random, so clients that lost
+  // the connection at once don't all come back at once.
+  inline Poco::Timestamp::TimeDiff WebSocketReconnectDelay(
+      const unsigned int attempt,
+      const Poco::UInt32 random) {
+    Poco::Timestamp::TimeDiff backoff(kWebSocketReconnectMinMicros);
+    for (unsigned int i = 0;
+        i < attempt && backoff < kWebSocketReconnectMaxMicros;
+        i++) {
+      backoff *= 2;
+    }
+    if (backoff > kWebSocketReconnectMaxMicros) {
+      backoff = kWebSocketReconnectMaxMicros;
+    }
+    return backoff / 2 + random % (backoff / 2 + 1);
+  }
+
+  // Reads a message frame by frame, until its final fragment.
+  // The frame buffer is kept for the next messages.
+  class WebSocketMessageReader {
+  public:
+    WebSocketMessageReader() {}
+
+    // Pings between the fragments are answered, with send_m held.
+    // Message is left empty when the peer closes the connection.
+    // rsv1 tells if the first frame of the message had it set.
+    error Read(Poco::Net::WebSocket *ws,
+               Poco::FastMutex *send_m,
+               std::string *message,
+               bool *rsv1);
+
+    std::size_t BufferBytes() const;
+
+  private:
+    std::vector<char> frame_buffer_;
+
+    WebSocketMessageReader(const WebSocketMessageReader &);
+    WebSocketMessageReader &operator=(const WebSocketMessageReader &);
+  };
 
-  class WebSocketClient {
+  // Timeline batches can be sent on the session too, see
+  // TimelineStream. The server acknowledges them by their ID.
+  class WebSocketClient : public TimelineStream {
   public:
     explicit WebSocketClient(
         const std::string websocket_url,
         const std::string app_name,
         const std::string app_version) :
-      activity_(this, &WebSocketClient::runActivity),
+      activity_(this, &WebSocketClient::supervise, WorkerPool::Background),
       session_(0),
       req_(0),
       res_(0),
       ws_(0),
       on_websocket_message_(0),
+      on_reconnect_(0),
       ctx_(0),
       websocket_url_(websocket_url),
       app_name_(app_name),
       app_version_(app_version),
       last_connection_at_(0),
-      api_token_("") {}
+      api_token_(""),
+      message_(""),
+      buffer_bytes_(0),
+      deflate_(false),
+      failed_(false),
+      receiving_(false),
+      resync_pending_(false),
+      reconnect_attempts_(0),
+      reconnect_at_(0),
+      timeline_listener_(0) {
+      random_.seed();
+    }
     virtual ~WebSocketClient();
 
     virtual void Start(
       void *ctx,
       const std::string api_token,
-      WebSocketMessageCallback on_websocket_message);
+      WebSocketMessageCallback on_websocket_message,
+      WebSocketReconnectCallback on_reconnect);
+    // Asks the activity to stop, without waiting for it
+    virtual void RequestStop();
     virtual void Stop();
 
     void SetWebsocketURL(const std::string value) { websocket_url_ = value; }
     void SetProxy(const Proxy value) { proxy_ = value; }
 
+    // "data" unless the message says otherwise
+    static std::string MessageType(JSONValue *root);
+
+    // What the buffers for receiving messages hold on to,
+    // as of the last message
+    std::size_t BufferBytes() const { return buffer_bytes_; }
+
+    // Started, and the session has delivered something lately
+    bool Healthy() const;
+
+    // TimelineStream. Sent only once the session has received
+    // something since it was authenticated.
+    error SendTimeline(
+      const Poco::UInt64 batch_id,
+      const std::string &events_json);
+    void SetTimelineListener(TimelineStreamListener *listener);
+
   protected:
-    void runActivity();
+    // Keeps a session open, messages are received on the
+    // NetworkReactor thread. Returns the wait until it's time to
+    // connect again, or the session has been quiet for too long.
+    Poco::Timestamp::TimeDiff supervise();
 
   private:
     error createSession();
     void authenticate();
-    error poll();
-    std::string parseWebSocketMessageType(const std::string json);
+    void onReadable(
+      const Poco::AutoPtr<Poco::Net::ReadableNotification> &notification);
+    error receive();
+    // When the session is gone, for the activity to connect again
+    void reconnectLater();
+    error handleWebSocketMessage(JSONValue *root);
+    void handleTimelineAck(JSONValue *root);
+    // With mutex_ held
+    error sendTimeline(
+      const Poco::UInt64 batch_id,
+      const std::string &events_json);
+    // Frames are sent from the reactor thread too, one at a time
+    void send(const char *data, const int size, const int flags);
     error receiveWebSocketMessage(std::string *message);
     void deleteSession();
 
     Poco::Logger &logger() const;
 
-    Poco::Activity<WebSocketClient> activity_;
+    // Runs supervise on the shared workers, the waits between
+    // runs take no thread
+    WorkerLoop<WebSocketClient> activity_;
     Poco::Net::HTTPSClientSession *session_;
     Poco::Net::HTTPRequest *req_;
     Poco::Net::HTTPResponse *res_;
     Poco::Net::WebSocket *ws_;
     WebSocketMessageCallback on_websocket_message_;
+    WebSocketReconnectCallback on_reconnect_;
     void *ctx_;
 
     std::string websocket_url_;
     std::string app_name_;
     std::string app_version_;
 
-    std::time_t last_connection_at_;
+    // Written by the reactor thread too
+    volatile std::time_t last_connection_at_;
 
     std::string api_token_;
 
     Poco::Mutex mutex_;
 
     Proxy proxy_;
+
+    // Reused between messages, so they only grow
+    // when a bigger message than before arrives.
+    WebSocketMessageReader reader_;
+    std::string message_;
+    // Read from other threads
+    volatile std::size_t buffer_bytes_;
+
+    // Server agreed to compress messages with permessage-deflate
+    bool deflate_;
+    WebSocketInflater inflater_;
+    std::string compressed_message_;
+
+    // Set by the reactor thread when the session has failed,
+    // wakes up the activity to replace it
+    volatile bool failed_;
+
+    // Set by the reactor thread once the session has received
+    // something, so it's known to work
+    volatile bool receiving_;
+    // Session was lost after it worked, call on_reconnect_
+    // once the next one works
+    volatile bool resync_pending_;
+
+    // Used by the activity only
+    unsigned int reconnect_attempts_;
+    Poco::Timestamp reconnect_at_;
+    Poco::Random random_;
+
+    Poco::FastMutex send_m_;
+    TimelineStreamListener *timeline_listener_;
+    Poco::FastMutex timeline_m_;
   };
 }  // namespace kopsik
 
@@ -0,0 +1,88 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./websocket_inflater.h"
+
+#include <cstring>
+
+namespace kopsik {
+
+WebSocketInflater::WebSocketInflater()
+  : initialized_(false), context_takeover_(true) {
+  std::memset(&stream_, 0, sizeof(stream_));
+}
+
+WebSocketInflater::~WebSocketInflater() {
+  end();
+}
+
+void WebSocketInflater::Reset(const bool context_takeover) {
+  end();
+  context_takeover_ = context_takeover;
+}
+
+error WebSocketInflater::Inflate(
+    const std::string &compressed, const std::string::size_type max_size,
+    std::string *message) {
+  if (!initialized_) {
+    // Raw deflate, without zlib header or checksum
+    if (inflateInit2(&stream_, -MAX_WBITS) != Z_OK) {
+      return error("Cannot initialize WebSocket message inflater");
+    }
+    initialized_ = true;
+  }
+
+  message->clear();
+  error err = inflate(compressed.data(), compressed.size(),
+                      max_size, message);
+  if (err == noError) {
+    static const char tail[] = { 0x00, 0x00, '\xff', '\xff' };
+    err = inflate(tail, sizeof(tail), max_size, message);
+  }
+  if (err != noError || !context_takeover_) {
+    end();
+  }
+  return err;
+}
+
+std::size_t WebSocketInflater::WindowBytes() const {
+  return initialized_ ? (1 << MAX_WBITS) : 0;
+}
+
+error WebSocketInflater::inflate(
+    const char *data, const std::size_t size,
+    const std::string::size_type max_size, std::string *message) {
+  stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  stream_.avail_in = static_cast<uInt>(size);
+  char chunk[16384];
+  do {
+    stream_.next_out = reinterpret_cast<Bytef *>(chunk);
+    stream_.avail_out = sizeof(chunk);
+    int rc = ::inflate(&stream_, Z_SYNC_FLUSH);
+    if (Z_STREAM_END == rc) {
+      // Sender has ended the deflate stream, a new one follows
+      rc = inflateReset(&stream_);
+    }
+    if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      return error("Cannot inflate WebSocket message");
+    }
+    std::size_t n = sizeof(chunk) - stream_.avail_out;
+    if (message->size() + n > max_size) {
+      return error("WebSocket message is too large");
+    }
+    message->append(chunk, n);
+    if (Z_BUF_ERROR == rc && !n) {
+      break;
+    }
+  } while (stream_.avail_in || !stream_.avail_out);
+  return noError;
+}
+
+void WebSocketInflater::end() {
+  if (initialized_) {
+    inflateEnd(&stream_);
+    std::memset(&stream_, 0, sizeof(stream_));
+    initialized_ = false;
+  }
+}
+
+}  // namespace kopsik
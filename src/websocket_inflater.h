@@ -0,0 +1,59 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_WEBSOCKET_INFLATER_H_
+#define SRC_WEBSOCKET_INFLATER_H_
+
+#include <string>
+
+#if defined(POCO_UNBUNDLED)
+#include <zlib.h> // NOLINT
+#else
+#include "Poco/zlib.h" // NOLINT
+#endif
+
+#include "./types.h"
+
+namespace kopsik {
+
+  // Offered to the server when connecting, see RFC 7692
+  const char kPerMessageDeflate[] = "permessage-deflate";
+
+  // Inflates messages compressed with the permessage-deflate
+  // WebSocket extension. Unless the server has said it won't,
+  // it compresses each message with the window of the ones before,
+  // so the window is kept between messages.
+  class WebSocketInflater {
+  public:
+    WebSocketInflater();
+    ~WebSocketInflater();
+
+    // For a new session, with what the server agreed to
+    void Reset(const bool context_takeover);
+
+    // Message payload without the empty block the sender
+    // stripped from its end
+    error Inflate(const std::string &compressed,
+                  const std::string::size_type max_size,
+                  std::string *message);
+
+    std::size_t WindowBytes() const;
+
+  private:
+    error inflate(const char *data,
+                  const std::size_t size,
+                  const std::string::size_type max_size,
+                  std::string *message);
+
+    void end();
+
+    z_stream stream_;
+    bool initialized_;
+    bool context_takeover_;
+
+    WebSocketInflater(const WebSocketInflater &);
+    WebSocketInflater &operator=(const WebSocketInflater &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_WEBSOCKET_INFLATER_H_
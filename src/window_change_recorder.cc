@@ -5,10 +5,10 @@
 #include <sstream>
 
 #include "./get_focused_window.h"
+#include "./power_policy.h"
+#include "./timeline_dispatcher.h"
 #include "./timeline_event.h"
-
-#include "Poco/Thread.h"
-#include "Poco/NotificationCenter.h"
+#include "./thread_role.h"
 
 namespace kopsik {
 
@@ -30,19 +30,23 @@ void WindowChangeRecorder::inspect_focused_window() {
             time_t time_delta = now - last_event_started_at_;
 
             // if window was focussed at least X seconds, save it to timeline
-            if (time_delta >= window_focus_seconds_) {
+            // unless the filter drops it
+            std::string recorded_filename(last_filename_);
+            std::string recorded_title(last_title_);
+            if (time_delta >= window_focus_seconds_
+                    && (!filter_
+                        || filter_->Apply(&recorded_filename,
+                                          &recorded_title))) {
                 poco_assert(user_id_ > 0);
                 TimelineEvent event;
                 event.start_time = last_event_started_at_;
                 event.end_time = now;
-                event.filename = last_filename_;
-                event.title = last_title_;
+                event.filename =
+                    StringTable::Timeline().Intern(recorded_filename);
+                event.title = StringTable::Timeline().Intern(recorded_title);
                 event.user_id = static_cast<int>(user_id_);
-                Poco::NotificationCenter& nc =
-                    Poco::NotificationCenter::defaultCenter();
-                TimelineEventNotification notification(event);
-                Poco::AutoPtr<TimelineEventNotification> ptr(&notification);
-                nc.postNotification(ptr);
+                TimelineDispatcher::Instance().Post(
+                    new TimelineEventNotification(event), notifications_);
             }
         }
 
@@ -53,10 +57,39 @@ void WindowChangeRecorder::inspect_focused_window() {
 }
 
 void WindowChangeRecorder::record_loop() {
+    SetCurrentThreadRole(kThreadBackground);
     while (!recording_.isStopped()) {
         inspect_focused_window();
-        Poco::Thread::sleep(recording_interval_ms_);
+        if (!WaitForFocusedWindowChange(kWindowChangeEventTimeoutMillis)) {
+            // Less often on battery
+            wakeup_.tryWait(static_cast<long>(  // NOLINT
+                PowerPolicy::Shared().Stretch(recording_interval_ms_)));
+        }
+    }
+}
+
+void WindowChangeRecorder::RequestStop() {
+    if (recording_.isRunning()) {
+        recording_.stop();
+        InterruptFocusedWindowWait();
+        wakeup_.set();
+    }
+}
+
+error WindowChangeRecorder::Stop() {
+    try {
+        if (recording_.isRunning()) {
+            RequestStop();
+            recording_.wait();
+        }
+    } catch(const Poco::Exception& exc) {
+        return exc.displayText();
+    } catch(const std::exception& ex) {
+        return ex.what();
+    } catch(const std::string& ex) {
+        return ex;
     }
+    return noError;
 }
 
 }  // namespace kopsik
@@ -8,42 +8,39 @@
 #include "./timeline_event.h"
 #include "./timeline_notifications.h"
 #include "./timeline_constants.h"
+#include "./title_filter.h"
 #include "./types.h"
 
 #include "Poco/Activity.h"
+#include "Poco/Event.h"
 #include "Poco/Logger.h"
+#include "Poco/NotificationCenter.h"
 
 namespace kopsik {
 
 class WindowChangeRecorder {
  public:
-  explicit WindowChangeRecorder(const Poco::UInt64 user_id) :
+  // Events are posted to the notification center of its context.
+  // Windows go through the filter first, if there's one.
+  WindowChangeRecorder(const Poco::UInt64 user_id,
+                       Poco::NotificationCenter &notifications,  // NOLINT
+                       TitleFilter *filter = 0) :
             user_id_(user_id),
             last_title_(""),
             last_filename_(""),
             last_event_started_at_(0),
             window_focus_seconds_(kWindowFocusThresholdSeconds),
             recording_interval_ms_(kWindowChangeRecordingIntervalMillis),
+            notifications_(notifications),
+            filter_(filter),
             recording_(this, &WindowChangeRecorder::record_loop) {
         poco_assert(user_id_);
         recording_.start();
     }
 
-    error Stop() {
-        try {
-            if (recording_.isRunning()) {
-                recording_.stop();
-                recording_.wait();
-            }
-        } catch(const Poco::Exception& exc) {
-            return exc.displayText();
-        } catch(const std::exception& ex) {
-            return ex.what();
-        } catch(const std::string& ex) {
-            return ex;
-        }
-        return noError;
-    }
+    // Asks the recorder to stop, without waiting for it
+    void RequestStop();
+    error Stop();
 
     ~WindowChangeRecorder() {
         Stop();
@@ -70,6 +67,14 @@ class WindowChangeRecorder {
 
     unsigned int recording_interval_ms_;
 
+    // Set to end a wait between polls early, when stopping
+    Poco::Event wakeup_;
+
+    Poco::NotificationCenter &notifications_;
+
+    // Not owned
+    TitleFilter *filter_;
+
     Poco::Activity<WindowChangeRecorder> recording_;
 };
 
@@ -0,0 +1,157 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./worker_pool.h"
+
+#include "Poco/SingletonHolder.h"
+
+namespace kopsik {
+
+Poco::Util::Timer &SharedTimer() {
+  static Poco::SingletonHolder<Poco::Util::Timer> sh;
+  return *sh.get();
+}
+
+WorkerPool::WorkerPool(
+    const std::size_t interactive_workers,
+    const std::size_t background_workers)
+  : running_(0)
+  , stopped_(false) {
+  start(Interactive, interactive_workers, "interactive_worker");
+  start(Background, background_workers, "background_worker");
+}
+
+WorkerPool::WorkerPool()
+  : running_(0)
+  , stopped_(false) {
+  start(Interactive, kSharedInteractiveWorkers, "interactive_worker");
+  start(Background, kSharedBackgroundWorkers, "background_worker");
+}
+
+WorkerPool::~WorkerPool() {
+  Stop();
+}
+
+WorkerPool &WorkerPool::Shared() {
+  static Poco::SingletonHolder<WorkerPool> sh;
+  return *sh.get();
+}
+
+void WorkerPool::Enqueue(const Queue queue, WorkerTask::Ptr task) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  if (stopped_) {
+    return;
+  }
+  queues_[queue].push_back(task);
+  ready_[queue].signal();
+}
+
+void WorkerPool::Cancel() {
+  Poco::FastMutex::ScopedLock lock(m_);
+  for (int i = Interactive; i <= Background; i++) {
+    queues_[i].clear();
+  }
+  while (running_) {
+    idle_.wait(m_);
+  }
+}
+
+void WorkerPool::Cancel(const void *owner) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  for (int i = Interactive; i <= Background; i++) {
+    std::deque<WorkerTask::Ptr>::iterator it = queues_[i].begin();
+    while (it != queues_[i].end()) {
+      if ((*it)->Owner() == owner) {
+        it = queues_[i].erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  while (busy_.find(owner) != busy_.end()) {
+    idle_.wait(m_);
+  }
+}
+
+void WorkerPool::Stop() {
+  {
+    Poco::FastMutex::ScopedLock lock(m_);
+    if (stopped_) {
+      return;
+    }
+    stopped_ = true;
+    for (int i = Interactive; i <= Background; i++) {
+      queues_[i].clear();
+      ready_[i].broadcast();
+    }
+  }
+  for (std::vector<Worker *>::const_iterator it = workers_.begin();
+      it != workers_.end();
+      it++) {
+    (*it)->thread.join();
+    delete *it;
+  }
+  workers_.clear();
+}
+
+WorkerPool::Worker::Worker(WorkerPool *pool, const Queue queue)
+  : pool(pool), queue(queue) {}
+
+void WorkerPool::start(
+    const Queue queue, const std::size_t count, const std::string &name) {
+  for (std::size_t i = 0; i < count; i++) {
+    Worker *worker = new Worker(this, queue);
+    worker->thread.setName(name);
+    workers_.push_back(worker);
+    worker->thread.start(*worker);
+  }
+}
+
+WorkerTask::Ptr WorkerPool::takeNext(const Queue queue) {
+  for (std::deque<WorkerTask::Ptr>::iterator it = queues_[queue].begin();
+      it != queues_[queue].end();
+      it++) {
+    const void *owner = (*it)->Owner();
+    std::map<const void *, int>::const_iterator busy = busy_.find(owner);
+    if (busy != busy_.end() && (busy->second & (1 << queue))) {
+      continue;
+    }
+    WorkerTask::Ptr task = *it;
+    queues_[queue].erase(it);
+    return task;
+  }
+  return WorkerTask::Ptr();
+}
+
+void WorkerPool::work(const Queue queue) {
+  SetCurrentThreadRole(
+    Interactive == queue ? kThreadInteractive : kThreadUtility);
+  while (true) {
+    WorkerTask::Ptr task;
+    {
+      Poco::FastMutex::ScopedLock lock(m_);
+      while (!stopped_ && !(task = takeNext(queue))) {
+        ready_[queue].wait(m_);
+      }
+      if (stopped_) {
+        return;
+      }
+      busy_[task->Owner()] |= 1 << queue;
+      running_++;
+    }
+    if (!task->isCancelled()) {
+      task->Work();
+    }
+    Poco::FastMutex::ScopedLock lock(m_);
+    int &busy = busy_[task->Owner()];
+    busy &= ~(1 << queue);
+    if (!busy) {
+      busy_.erase(task->Owner());
+    }
+    --running_;
+    // The owner's next task may be waiting for this one
+    ready_[queue].broadcast();
+    idle_.broadcast();
+  }
+}
+
+}  // namespace kopsik
@@ -0,0 +1,318 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_WORKER_POOL_H_
+#define SRC_WORKER_POOL_H_
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./power_policy.h"
+#include "./thread_role.h"
+
+#include "Poco/AutoPtr.h"
+#include "Poco/Condition.h"
+#include "Poco/Mutex.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Util/Timer.h"
+#include "Poco/Util/TimerTask.h"
+
+namespace kopsik {
+
+  // Workers of the shared pool, per queue
+  const std::size_t kSharedInteractiveWorkers = 2;
+  const std::size_t kSharedBackgroundWorkers = 2;
+
+  // One timer thread for everyone in the process. Tasks are cancelled
+  // one by one by whoever scheduled them, never with Timer::cancel,
+  // which would cancel everybody's.
+  Poco::Util::Timer &SharedTimer();
+
+  // Timer task whose work is done by a WorkerPool. The timer only
+  // hands it over when it's due.
+  class WorkerTask : public Poco::Util::TimerTask {
+  public:
+    typedef Poco::AutoPtr<WorkerTask> Ptr;
+
+    // On a worker thread, unless cancelled meanwhile
+    virtual void Work() = 0;
+
+    // Whose task it is. Tasks of the same owner in the same
+    // queue run one at a time, in order.
+    virtual const void *Owner() const = 0;
+  };
+
+  // Runs due timer tasks on worker threads, instead of the timer
+  // thread. Each queue has its own workers, so what the user is
+  // waiting for never waits behind long background work. However many
+  // workers there are, the tasks of one owner in a queue run one at a
+  // time, in order, so a pool can be shared by several owners (like
+  // the contexts of a process) without their tasks running over each
+  // other.
+  class WorkerPool {
+  public:
+    enum Queue {
+      // Saving and pushing edits, switching things on and off
+      Interactive = 0,
+      // Downloads and uploads nobody is waiting for
+      Background = 1
+    };
+
+    WorkerPool(const std::size_t interactive_workers,
+               const std::size_t background_workers);
+
+    // The shared pool
+    WorkerPool();
+
+    ~WorkerPool();
+
+    static WorkerPool &Shared();
+
+    void Enqueue(const Queue queue, WorkerTask::Ptr task);
+
+    // Drops the tasks not started yet and waits for the running
+    // ones to finish. Workers keep taking new tasks afterwards.
+    // Must not be called from a worker.
+    void Cancel();
+
+    // Same, but only for the tasks of the owner
+    void Cancel(const void *owner);
+
+    // Like Cancel, but the workers exit too
+    void Stop();
+
+  private:
+    struct Worker : public Poco::Runnable {
+      Worker(WorkerPool *pool, const Queue queue);
+      void run() { pool->work(queue); }
+
+      WorkerPool *pool;
+      Queue queue;
+      Poco::Thread thread;
+    };
+
+    void start(const Queue queue,
+               const std::size_t count,
+               const std::string &name);
+
+    // First task in the queue whose owner has nothing
+    // running in it, or null
+    WorkerTask::Ptr takeNext(const Queue queue);
+
+    void work(const Queue queue);
+
+    std::deque<WorkerTask::Ptr> queues_[2];
+    Poco::Condition ready_[2];
+    // Tasks being worked on, and signalled when one is done
+    int running_;
+    Poco::Condition idle_;
+    // Queues each owner has a task running in, as bits
+    std::map<const void *, int> busy_;
+    bool stopped_;
+    Poco::FastMutex m_;
+    std::vector<Worker *> workers_;
+
+    WorkerPool(const WorkerPool &);
+    WorkerPool &operator=(const WorkerPool &);
+  };
+
+  // Like Poco::Util::TimerTaskAdapter, but the callback
+  // runs on a worker of the pool's queue
+  template <class C>
+  class WorkerTaskAdapter : public WorkerTask {
+  public:
+    typedef void (C::*Callback)(Poco::Util::TimerTask &);
+
+    WorkerTaskAdapter(C &object,  // NOLINT
+                      Callback method,
+                      WorkerPool *pool,
+                      const WorkerPool::Queue queue)
+      : object_(&object)
+      , method_(method)
+      , pool_(pool)
+      , queue_(queue) {}
+
+    // On the timer thread
+    void run() {
+      pool_->Enqueue(queue_, WorkerTask::Ptr(this, true));
+    }
+
+    // Not when cancelled after the timer ran it,
+    // the object may be gone by now
+    void Work() {
+      if (isCancelled()) {
+        return;
+      }
+      (object_->*method_)(*this);
+    }
+
+    const void *Owner() const {
+      return object_;
+    }
+
+  private:
+    C *object_;
+    Callback method_;
+    WorkerPool *pool_;
+    WorkerPool::Queue queue_;
+  };
+
+  // Replaces a Poco::Activity that mostly sleeps. Instead of a thread
+  // of its own, the loop is a chain of timer tasks: each run of the
+  // callback is worked on by the pool and returns how long to wait
+  // before the next one, so the wait costs no thread. Runs of a loop
+  // never overlap. On battery, the waits are stretched and lined up
+  // with the rest of the background work, see PowerPolicy.
+  template <class C>
+  class WorkerLoop {
+  public:
+    // Microseconds until the next run, 0 for right away,
+    // or negative when the loop is done
+    typedef Poco::Timestamp::TimeDiff (C::*Callback)();
+
+    WorkerLoop(C *object,
+               Callback method,
+               const WorkerPool::Queue queue,
+               WorkerPool *pool = &WorkerPool::Shared(),
+               Poco::Util::Timer *timer = &SharedTimer())
+      : object_(object)
+      , method_(method)
+      , queue_(queue)
+      , pool_(pool)
+      , timer_(timer)
+      , running_(false)
+      , stopped_(false)
+      , working_(false)
+      , wake_pending_(false) {}
+
+    ~WorkerLoop() {
+      stop();
+      wait();
+    }
+
+    // First run is right away
+    void start() {
+      Poco::FastMutex::ScopedLock lock(m_);
+      if (running_) {
+        return;
+      }
+      running_ = true;
+      stopped_ = false;
+      schedule(Poco::Timestamp());
+    }
+
+    // Asks the loop to stop, without waiting for a run under way
+    void stop() {
+      Poco::FastMutex::ScopedLock lock(m_);
+      stopped_ = true;
+      if (task_) {
+        task_->cancel();
+        task_ = 0;
+      }
+      if (!working_) {
+        running_ = false;
+      }
+    }
+
+    // Waits for a run under way. Must not be called from the loop.
+    void wait() {
+      pool_->Cancel(this);
+    }
+
+    // Runs the loop now instead of when it asked to. A run under
+    // way is followed by the next one right away.
+    void Wake() {
+      Poco::FastMutex::ScopedLock lock(m_);
+      if (!running_ || stopped_) {
+        return;
+      }
+      if (working_) {
+        wake_pending_ = true;
+        return;
+      }
+      if (task_) {
+        task_->cancel();
+      }
+      schedule(Poco::Timestamp());
+    }
+
+    bool isStopped() const { return stopped_; }
+    bool isRunning() const { return running_; }
+
+  private:
+    class Run : public WorkerTask {
+    public:
+      explicit Run(WorkerLoop *loop) : loop_(loop) {}
+
+      // On the timer thread
+      void run() {
+        loop_->pool_->Enqueue(loop_->queue_, WorkerTask::Ptr(this, true));
+      }
+
+      void Work() {
+        loop_->work(this);
+      }
+
+      const void *Owner() const {
+        return loop_;
+      }
+
+    private:
+      WorkerLoop *loop_;
+    };
+
+    void schedule(const Poco::Timestamp &at) {
+      task_ = new Run(this);
+      timer_->schedule(task_, at);
+    }
+
+    void work(Run *run) {
+      {
+        Poco::FastMutex::ScopedLock lock(m_);
+        // Wake() may have cancelled the run and scheduled the next
+        // one after the pool checked, leave that one be
+        if (stopped_ || run->isCancelled() || task_.get() != run) {
+          return;
+        }
+        task_ = 0;
+        working_ = true;
+        wake_pending_ = false;
+      }
+      Poco::Timestamp::TimeDiff next = (object_->*method_)();
+      Poco::FastMutex::ScopedLock lock(m_);
+      working_ = false;
+      if (stopped_ || next < 0) {
+        running_ = false;
+        return;
+      }
+      if (wake_pending_ || !next) {
+        schedule(Poco::Timestamp());
+      } else {
+        schedule(PowerPolicy::Shared().Defer(next));
+      }
+    }
+
+    C *object_;
+    Callback method_;
+    WorkerPool::Queue queue_;
+    WorkerPool *pool_;
+    Poco::Util::Timer *timer_;
+
+    // Next run, if one is scheduled
+    Poco::Util::TimerTask::Ptr task_;
+    volatile bool running_;
+    volatile bool stopped_;
+    bool working_;
+    bool wake_pending_;
+    Poco::FastMutex m_;
+
+    WorkerLoop(const WorkerLoop &);
+    WorkerLoop &operator=(const WorkerLoop &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_WORKER_POOL_H_
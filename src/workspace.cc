@@ -5,6 +5,9 @@
 #include <sstream>
 #include <cstring>
 
+#include "./json_key.h"
+#include "./memory_usage.h"
+
 namespace kopsik {
 
 std::string Workspace::String() const {
@@ -15,7 +18,12 @@ std::string Workspace::String() const {
   return ss.str();
 }
 
-void Workspace::SetName(const std::string value) {
+std::size_t Workspace::MemoryBytes() const {
+  return sizeof(*this) + ownedBytes()
+    + StringBytes(name_);
+}
+
+void Workspace::SetName(const std::string &value) {
   if (name_ != value) {
     name_ = value;
     SetDirty();
@@ -33,22 +41,30 @@ bool CompareWorkspaceByName(Workspace *a, Workspace *b) {
   return (strcmp(a->Name().c_str(), b->Name().c_str()) < 0);
 }
 
-void Workspace::LoadFromJSONNode(JSONNODE * const n) {
-  poco_assert(n);
-
-  JSONNODE_ITERATOR i = json_begin(n);
-  JSONNODE_ITERATOR e = json_end(n);
-  while (i != e) {
-    json_char *node_name = json_name(*i);
-    if (strcmp(node_name, "id") == 0) {
-      SetID(json_as_int(*i));
-    } else if (strcmp(node_name, "name") == 0) {
-      SetName(std::string(json_as_string(*i)));
-    } else if (strcmp(node_name, "premium") == 0) {
-      SetPremium(json_as_bool(*i));
-    }
-    ++i;
-  }
+static const ModelField<Workspace> kWorkspaceFields[] = {
+  UIntField<Workspace>("id", kJSONKeyID,
+    kFieldStored | kFieldLoaded,
+    &Workspace::ID, &Workspace::SetID),
+  UIntField<Workspace>("uid", kJSONKeyUnknown,
+    kFieldStored,
+    &Workspace::UID, &Workspace::SetUID),
+  StringField<Workspace>("name", kJSONKeyName,
+    kFieldStored | kFieldLoaded,
+    &Workspace::Name, &Workspace::SetName),
+  BoolField<Workspace>("premium", kJSONKeyPremium,
+    kFieldStored | kFieldLoaded,
+    &Workspace::Premium, &Workspace::SetPremium)
+};
+
+static const ModelSchema<Workspace> kWorkspaceSchema("workspaces",
+    kWorkspaceFields, sizeof(kWorkspaceFields) / sizeof(kWorkspaceFields[0]));
+
+const ModelSchema<Workspace> &Workspace::Schema() {
+  return kWorkspaceSchema;
+}
+
+void Workspace::LoadFromJSONNode(JSONValue * const n) {
+  Schema().LoadFromJSONNode(n, this);
 }
 
 }   // namespace kopsik
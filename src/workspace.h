@@ -5,7 +5,8 @@
 
 #include <string>
 
-#include "libjson.h" // NOLINT
+#include "./json_reader.h"
+#include "./model_schema.h"
 
 #include "Poco/Types.h"
 
@@ -21,9 +22,10 @@ namespace kopsik {
       , premium_(false) {}
 
     std::string String() const;
+    std::size_t MemoryBytes() const;
 
-    std::string Name() const { return name_; }
-    void SetName(const std::string value);
+    const std::string &Name() const { return name_; }
+    void SetName(const std::string &value);
 
     bool Premium() const { return premium_; }
     void SetPremium(const bool value);
@@ -31,7 +33,10 @@ namespace kopsik {
     std::string ModelName() const { return "workspace"; }
     std::string ModelURL() const { return "/api/v8/workspaces"; }
 
-    void LoadFromJSONNode(JSONNODE * const);
+    // Fields as stored and sent, listed once
+    static const ModelSchema<Workspace> &Schema();
+
+    void LoadFromJSONNode(JSONValue * const);
 
   private:
     std::string name_;
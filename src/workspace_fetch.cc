@@ -0,0 +1,330 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#include "./workspace_fetch.h"
+
+#include <algorithm>
+#include <ctime>
+#include <sstream>
+#include <vector>
+
+#include "Poco/DateTimeFormat.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+#include "Poco/URI.h"
+
+namespace kopsik {
+
+error WorkspaceFetchListener::Started(const SyncCheckpoint &checkpoint) {
+  return noError;
+}
+
+error WorkspaceFetchListener::PieceDone(const SyncCheckpointPiece &piece) {
+  return noError;
+}
+
+WorkspaceFetch::WorkspaceFetch(
+    HTTPSClient *https_client, const std::string &username,
+    const std::string &password, WorkspaceFetchListener *listener)
+  : https_client_(https_client)
+  , username_(username)
+  , password_(password)
+  , listener_(listener)
+  , threads_(kWorkspaceFetchThreads)
+  , time_entries_since_(0)
+  , time_entries_until_(0)
+  , resuming_(false)
+  , error_(noError) {
+  // And a day ahead, for entries from clocks that run fast
+  Poco::UInt64 now = Poco::Timestamp().epochTime();
+  time_entries_until_ = now + 24 * 60 * 60;
+  time_entries_since_ = now - kTimeEntryFetchDays * 24 * 60 * 60;
+  poco_assert(https_client_);
+  poco_assert(listener_);
+}
+
+void WorkspaceFetch::SetThreads(const std::size_t count) {
+  threads_ = count ? count : 1;
+}
+
+void WorkspaceFetch::SetTimeEntryWindow(
+    const Poco::UInt64 since, const Poco::UInt64 until) {
+  time_entries_since_ = since;
+  time_entries_until_ = until;
+}
+
+void WorkspaceFetch::Resume(const SyncCheckpoint &checkpoint) {
+  resume_ = checkpoint;
+  resuming_ = true;
+  SetTimeEntryWindow(checkpoint.time_entries_since,
+                     checkpoint.time_entries_until);
+}
+
+std::string WorkspaceFetch::TimeEntriesURL(
+    const Poco::UInt64 since, const Poco::UInt64 until) {
+  std::stringstream relative_url;
+  relative_url << "/api/v8/time_entries"
+               << "?start_date=" << dateParameter(since)
+               << "&end_date=" << dateParameter(until);
+  return relative_url.str();
+}
+
+std::string WorkspaceFetch::TimeEntryDigestsURL(
+    const Poco::UInt64 since, const Poco::UInt64 until) {
+  std::stringstream relative_url;
+  relative_url << "/api/v8/time_entries/digests"
+               << "?start_date=" << dateParameter(since)
+               << "&end_date=" << dateParameter(until);
+  return relative_url.str();
+}
+
+error WorkspaceFetch::Fetch() {
+  TraceSpan trace("WorkspaceFetch::Fetch");
+  Poco::Timestamp started;
+
+  Poco::UInt64 since(0);
+  error err = fetchUser(&since);
+  if (err == noError) {
+    err = fetchWorkspaces();
+  }
+  if (err != noError) {
+    return err;
+  }
+  addTimeEntryJobs();
+  err = start(&since);
+  if (err != noError) {
+    return err;
+  }
+
+  std::vector<Poco::Thread *> threads;
+  std::size_t thread_count = std::min(threads_, jobs_.size());
+  // This thread is one of them
+  for (std::size_t i = 1; i < thread_count; i++) {
+    Poco::Thread *thread = new Poco::Thread("workspace_fetch");
+    thread->start(*this);
+    threads.push_back(thread);
+  }
+  run();
+  for (std::vector<Poco::Thread *>::const_iterator it = threads.begin();
+      it != threads.end();
+      it++) {
+    (*it)->join();
+    delete *it;
+  }
+
+  if (error_ != noError) {
+    return error_;
+  }
+  Metrics::Shared().Time("sync.workspace_fetch", started.elapsed());
+  return listener_->Complete(since, time_entries_since_,
+                             time_entries_until_);
+}
+
+void WorkspaceFetch::run() {
+  Job job;
+  while (next(&job)) {
+    error err = job.wid ? fetchWorkspace(job) : fetchTimeEntries(job);
+    if (err == noError) {
+      err = pieceDone(job);
+    }
+    if (err != noError) {
+      fail(err);
+    }
+  }
+}
+
+error WorkspaceFetch::fetchUser(Poco::UInt64 *since) {
+  std::string json("");
+  error err = https_client_->GetJSON(
+    "/api/v8/me?app_name=kopsik&with_related_data=false",
+    username_, password_, &json);
+  if (err != noError) {
+    return err;
+  }
+  JSONValue *root = JSONParse(json);
+  if (!root) {
+    return error("Invalid JSON in user");
+  }
+  JSONValue *node = JSONGet(root, "since");
+  if (node) {
+    *since = JSONInt(node);
+  }
+  JSONDelete(root);
+  return apply("", json);
+}
+
+error WorkspaceFetch::fetchWorkspaces() {
+  std::string json("");
+  error err = https_client_->GetJSON("/api/v8/workspaces",
+                                     username_, password_, &json);
+  if (err != noError) {
+    return err;
+  }
+  if ("null" != json) {
+    JSONValue *root = JSONParse(json);
+    if (!root) {
+      return error("Invalid JSON in workspaces");
+    }
+    JSONValue *items = GetListFromJSONNode(root);
+    for (std::size_t i = 0; items && i < JSONSize(items); i++) {
+      JSONValue *workspace = JSONAt(items, i);
+      JSONValue *id = JSONGet(workspace, "id");
+      if (!id || IsDeletedAtServer(workspace)) {
+        continue;
+      }
+      JSONValue *premium = JSONGet(workspace, "premium");
+      Job job;
+      job.wid = JSONInt(id);
+      job.premium = premium && JSONBool(premium);
+      job.since = 0;
+      job.until = 0;
+      jobs_.push_back(job);
+    }
+    JSONDelete(root);
+  }
+  return apply("workspaces", json);
+}
+
+void WorkspaceFetch::addTimeEntryJobs() {
+  Poco::UInt64 range =
+    (time_entries_until_ - time_entries_since_) / kTimeEntryFetchRanges;
+  for (int i = 0; i < kTimeEntryFetchRanges; i++) {
+    Job job;
+    job.wid = 0;
+    job.premium = false;
+    job.since = time_entries_since_ + range * i;
+    job.until = i + 1 < kTimeEntryFetchRanges ?
+                job.since + range : time_entries_until_;
+    jobs_.push_back(job);
+  }
+}
+
+error WorkspaceFetch::start(Poco::UInt64 *since) {
+  SyncCheckpoint checkpoint;
+  checkpoint.started = Poco::Timestamp().epochTime();
+  checkpoint.since = *since;
+  checkpoint.time_entries_since = time_entries_since_;
+  checkpoint.time_entries_until = time_entries_until_;
+  if (resuming_) {
+    checkpoint.started = resume_.started;
+    if (resume_.since && (!*since || resume_.since < *since)) {
+      checkpoint.since = resume_.since;
+    }
+    std::deque<Job> wanted;
+    for (std::deque<Job>::const_iterator it = jobs_.begin();
+        it != jobs_.end();
+        it++) {
+      const SyncCheckpointPiece *piece = donePiece(*it);
+      if (piece) {
+        checkpoint.pieces.push_back(*piece);
+      } else {
+        wanted.push_back(*it);
+      }
+    }
+    jobs_.swap(wanted);
+    Metrics::Shared().Count("sync.resumed_pieces",
+                            checkpoint.pieces.size());
+  }
+  *since = checkpoint.since;
+  return listener_->Started(checkpoint);
+}
+
+const SyncCheckpointPiece *WorkspaceFetch::donePiece(const Job &job) const {
+  for (std::vector<SyncCheckpointPiece>::const_iterator it =
+      resume_.pieces.begin();
+      it != resume_.pieces.end();
+      it++) {
+    if (it->wid == job.wid
+        && (job.wid || (it->since == job.since
+                        && it->until == job.until))) {
+      return &(*it);
+    }
+  }
+  return 0;
+}
+
+error WorkspaceFetch::pieceDone(const Job &job) {
+  Poco::FastMutex::ScopedLock lock(apply_m_);
+  if (failed()) {
+    return noError;
+  }
+  SyncCheckpointPiece piece;
+  piece.wid = job.wid;
+  piece.since = job.since;
+  piece.until = job.until;
+  return listener_->PieceDone(piece);
+}
+
+error WorkspaceFetch::fetchWorkspace(const Job &job) {
+  const char *lists[] = { "clients", "projects", "tasks", "tags" };
+  for (std::size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+    if ("tasks" == std::string(lists[i]) && !job.premium) {
+      continue;
+    }
+    std::stringstream relative_url;
+    relative_url << "/api/v8/workspaces/" << job.wid << "/" << lists[i];
+    error err = fetchList(lists[i], relative_url.str());
+    if (err != noError) {
+      return err;
+    }
+  }
+  return noError;
+}
+
+error WorkspaceFetch::fetchTimeEntries(const Job &job) {
+  return fetchList("time_entries", TimeEntriesURL(job.since, job.until));
+}
+
+error WorkspaceFetch::fetchList(
+    const std::string &list, const std::string &relative_url) {
+  if (failed()) {
+    return noError;
+  }
+  std::string json("");
+  error err = https_client_->GetJSON(relative_url,
+                                     username_, password_, &json);
+  if (err != noError) {
+    return err;
+  }
+  return apply(list, json);
+}
+
+error WorkspaceFetch::apply(const std::string &list, const std::string &json) {
+  Poco::FastMutex::ScopedLock lock(apply_m_);
+  if (failed()) {
+    return noError;
+  }
+  return listener_->Apply(list, json);
+}
+
+bool WorkspaceFetch::next(Job *job) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  if (error_ != noError || jobs_.empty()) {
+    return false;
+  }
+  *job = jobs_.front();
+  jobs_.pop_front();
+  return true;
+}
+
+void WorkspaceFetch::fail(const error &err) {
+  Poco::FastMutex::ScopedLock lock(m_);
+  if (error_ == noError) {
+    error_ = err;
+  }
+}
+
+bool WorkspaceFetch::failed() {
+  Poco::FastMutex::ScopedLock lock(m_);
+  return error_ != noError;
+}
+
+std::string WorkspaceFetch::dateParameter(const Poco::UInt64 at) {
+  std::string encoded("");
+  Poco::URI::encode(Poco::DateTimeFormatter::format(
+    Poco::Timestamp::fromEpochTime(static_cast<std::time_t>(at)),
+    Poco::DateTimeFormat::ISO8601_FORMAT), "+", encoded);
+  return encoded;
+}
+
+}  // namespace kopsik
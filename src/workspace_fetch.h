@@ -0,0 +1,161 @@
+// Copyright 2014 Toggl Desktop developers.
+
+#ifndef SRC_WORKSPACE_FETCH_H_
+#define SRC_WORKSPACE_FETCH_H_
+
+#include <deque>
+#include <string>
+
+#include "./const.h"
+#include "./https_client.h"
+#include "./json.h"
+#include "./metrics.h"
+#include "./sync_checkpoint.h"
+#include "./trace.h"
+#include "./types.h"
+
+#include "Poco/Mutex.h"
+#include "Poco/Runnable.h"
+#include "Poco/Types.h"
+
+namespace kopsik {
+
+  // Takes the pieces of a WorkspaceFetch as they arrive, one at a
+  // time, on whichever thread fetched them
+  class WorkspaceFetchListener {
+  public:
+    virtual ~WorkspaceFetchListener() {}
+    // The user record (list "") or a related data list, as received.
+    // An error stops the fetch.
+    virtual error Apply(const std::string &list, const std::string &json) = 0;
+    // The user record and the workspaces are in, the other pieces
+    // are about to be fetched. The checkpoint has the since and the
+    // time entry window the fetch completes with, and the pieces an
+    // interrupted fetch got done, which aren't fetched again.
+    virtual error Started(const SyncCheckpoint &checkpoint);
+    // Each piece of it was applied
+    virtual error PieceDone(const SyncCheckpointPiece &piece);
+    // Every piece arrived and was applied. Only time entries that
+    // started from time_entries_since to time_entries_until were
+    // fetched.
+    virtual error Complete(
+      const Poco::UInt64 since,
+      const Poco::UInt64 time_entries_since,
+      const Poco::UInt64 time_entries_until) = 0;
+  };
+
+  // Fetches what a full sync needs in pieces, rather than in one /me
+  // response: the user record and the workspaces first, then the
+  // clients, projects, tasks and tags of each workspace and the time
+  // entries in a few date ranges, several requests at a time over
+  // the shared sessions. Each piece is handed on as it arrives, so
+  // one big or slow workspace doesn't hold the others back. The
+  // first error stops the requests that haven't started yet. Each
+  // piece done is reported, so that a fetch that didn't finish can
+  // be resumed, see Resume.
+  class WorkspaceFetch : public Poco::Runnable {
+  public:
+    WorkspaceFetch(
+        HTTPSClient *https_client,
+        const std::string &username,
+        const std::string &password,
+        WorkspaceFetchListener *listener);
+
+    // Requests in flight at once, the calling thread's included
+    void SetThreads(const std::size_t count);
+
+    // Time entries started in between are fetched, by default those
+    // of the last kTimeEntryFetchDays. Older ones are fetched when
+    // they're needed, see Context::FetchTimeEntries.
+    void SetTimeEntryWindow(
+        const Poco::UInt64 since,
+        const Poco::UInt64 until);
+
+    // Goes on from where an interrupted fetch stopped: with its
+    // time entry window and its since if that's older, and without
+    // the pieces it got done that are still wanted
+    void Resume(const SyncCheckpoint &checkpoint);
+
+    // Time entries that started from since to until
+    static std::string TimeEntriesURL(
+        const Poco::UInt64 since,
+        const Poco::UInt64 until);
+
+    // Checksums of the same, see TimeEntryDigests
+    static std::string TimeEntryDigestsURL(
+        const Poco::UInt64 since,
+        const Poco::UInt64 until);
+
+    error Fetch();
+
+    // Takes the next piece until none are left or one has failed
+    void run();
+
+  private:
+    // A workspace's lists (wid set) or a range of time entries
+    typedef struct {
+      Poco::UInt64 wid;
+      bool premium;
+      Poco::UInt64 since;
+      Poco::UInt64 until;
+    } Job;
+
+    error fetchUser(Poco::UInt64 *since);
+
+    // One job for each, so tasks only go out for premium ones
+    error fetchWorkspaces();
+
+    void addTimeEntryJobs();
+
+    // Drops the jobs an interrupted fetch got done and tells the
+    // listener what the fetch is going on with
+    error start(Poco::UInt64 *since);
+
+    const SyncCheckpointPiece *donePiece(const Job &job) const;
+
+    // Unless a piece has failed meanwhile, and a workspace's lists
+    // may not all have been applied
+    error pieceDone(const Job &job);
+
+    // In the order each finds the ones it refers to
+    error fetchWorkspace(const Job &job);
+
+    error fetchTimeEntries(const Job &job);
+
+    error fetchList(const std::string &list, const std::string &relative_url);
+
+    // Unless a piece has failed meanwhile
+    error apply(const std::string &list, const std::string &json);
+
+    bool next(Job *job);
+
+    void fail(const error &err);
+
+    bool failed();
+
+    // ISO 8601 in UTC, its "+" escaped for the query
+    static std::string dateParameter(const Poco::UInt64 at);
+
+    HTTPSClient *https_client_;
+    std::string username_;
+    std::string password_;
+    WorkspaceFetchListener *listener_;
+    std::size_t threads_;
+    Poco::UInt64 time_entries_since_;
+    Poco::UInt64 time_entries_until_;
+    SyncCheckpoint resume_;
+    bool resuming_;
+
+    std::deque<Job> jobs_;
+    error error_;
+    Poco::FastMutex m_;
+    // Pieces are applied one at a time
+    Poco::FastMutex apply_m_;
+
+    WorkspaceFetch(const WorkspaceFetch &);
+    WorkspaceFetch &operator=(const WorkspaceFetch &);
+  };
+
+}  // namespace kopsik
+
+#endif  // SRC_WORKSPACE_FETCH_H_